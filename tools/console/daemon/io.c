@@ -37,9 +37,13 @@
 #include <termios.h>
 #include <stdarg.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <assert.h>
 #include <sys/types.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 #if defined(__NetBSD__) || defined(__OpenBSD__)
 #include <util.h>
 #elif defined(__linux__)
@@ -60,6 +64,9 @@
 /* Duration of each time period in ms */
 #define RATE_LIMIT_PERIOD 200
 
+/* Most pieces (timestamps and lines) handed to one writev() */
+#define LOG_IOV 64
+
 extern int log_reload;
 extern int log_guest;
 extern int log_hv;
@@ -76,9 +83,38 @@ static int log_hv_fd = -1;
 static xengnttab_handle *xgt_handle = NULL;
 static xenforeignmemory_handle *xfm_handle;
 
-static struct pollfd  *fds;
-static unsigned int current_array_size;
-static unsigned int nr_fds;
+/*
+ * A file descriptor the main loop waits on.  Registrations persist
+ * across iterations and are only touched when the wanted events
+ * change, so an idle console costs nothing per loop.  On Linux they
+ * are kept in an epoll set; elsewhere they are gathered into a pollfd
+ * array for each poll().
+ */
+struct iowatch {
+	int fd;
+	short events;		/* POLL* wanted, 0 if not registered */
+	short revents;
+#ifndef __linux__
+	int idx;		/* index in watches[], or -1 */
+#endif
+	void (*handler)(struct iowatch *w);
+	void *priv;
+};
+
+#ifdef __linux__
+static int epoll_fd = -1;
+static struct epoll_event *ready_events;
+#else
+static struct iowatch **watches;
+static struct pollfd *fds;
+#endif
+static unsigned int nr_watches, watches_size;
+
+/* Set when the main loop must give up, e.g. on a broken xenstore fd */
+static bool io_failed;
+
+/* Milliseconds, CLOCK_MONOTONIC, updated on every loop iteration */
+static long long now_ms;
 
 struct buffer {
 	char *data;
@@ -91,7 +127,7 @@ struct buffer {
 struct console {
 	const char *ttyname;
 	int master_fd;
-	int master_pollfd_idx;
+	struct iowatch tty_watch;
 	int slave_fd;
 	int log_fd;
 	struct buffer buffer;
@@ -99,9 +135,12 @@ struct console {
 	const char *log_suffix;
 	int ring_ref;
 	xenevtchn_handle *xce_handle;
-	int xce_pollfd_idx;
-	int event_count;
+	struct iowatch xce_watch;
+	int tokens;
+	long long last_refill;
 	long long next_period;
+	bool throttled;
+	struct console *next_throttled;
 	xenevtchn_port_or_error_t local_port;
 	xenevtchn_port_or_error_t remote_port;
 	struct xencons_interface *interface;
@@ -148,6 +187,12 @@ struct domain {
 };
 
 static struct domain *dom_head;
+static struct console *throttled_head;
+static bool reap_pending;
+
+static void console_update_watches(struct console *con);
+static void console_tty_event(struct iowatch *w);
+static void console_evtchn_event(struct iowatch *w);
 
 typedef void (*VOID_ITER_FUNC_ARG1)(struct console *);
 typedef int (*INT_ITER_FUNC_ARG1)(struct console *);
@@ -265,37 +310,333 @@ static int write_all(int fd, const char* buf, size_t len)
 	return 0;
 }
 
+static int writev_all(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt) {
+		ssize_t ret = writev(fd, iov, cnt);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		while (cnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Timestamps every line, gathering up to LOG_IOV timestamps and lines
+ * into a single writev() rather than issuing two writes per line.
+ * Carriage returns at the start of a line are dropped.
+ */
+static int write_lines_with_timestamp(int fd, const char *data, size_t sz,
+				      const char *ts, size_t tslen,
+				      int *needts)
+{
+	struct iovec iov[LOG_IOV];
+	const char *end = data + sz;
+	int cnt = 0;
+
+	while (data < end) {
+		const char *nl;
+
+		if (*needts) {
+			while (data < end && *data == '\r')
+				data++;
+			if (data == end)
+				break;
+			iov[cnt].iov_base = (void *)ts;
+			iov[cnt++].iov_len = tslen;
+		}
+
+		nl = memchr(data, '\n', end - data);
+		iov[cnt].iov_base = (void *)data;
+		iov[cnt].iov_len = nl ? nl + 1 - data : end - data;
+		data += iov[cnt++].iov_len;
+		*needts = (nl != NULL);
+
+		if (cnt > LOG_IOV - 2) {
+			if (writev_all(fd, iov, cnt))
+				return -1;
+			cnt = 0;
+		}
+	}
+
+	return cnt ? writev_all(fd, iov, cnt) : 0;
+}
+
 static int write_with_timestamp(int fd, const char *data, size_t sz,
 				int *needts)
 {
-	char ts[32];
+	char ts[32], buf_replaced[4096];
 	time_t now = time(NULL);
 	const struct tm *tmnow = localtime(&now);
 	size_t tslen = strftime(ts, sizeof(ts), "[%Y-%m-%d %H:%M:%S] ", tmnow);
-	const char *last_byte = data + sz - 1;
+	size_t this_round;
+
+	if (!replace_escape)
+		return write_lines_with_timestamp(fd, data, sz, ts, tslen,
+						  needts);
+
+	while (sz) {
+		this_round = sz < sizeof(buf_replaced) ?
+			sz : sizeof(buf_replaced);
+		do_replace_escape(data, buf_replaced, this_round);
+		if (write_lines_with_timestamp(fd, buf_replaced, this_round,
+					       ts, tslen, needts))
+			return -1;
+		data += this_round;
+		sz -= this_round;
+	}
+
+	return 0;
+}
+
+static void iowatch_setup(struct iowatch *w,
+			  void (*handler)(struct iowatch *w), void *priv)
+{
+	w->fd = -1;
+	w->events = 0;
+	w->revents = 0;
+#ifndef __linux__
+	w->idx = -1;
+#endif
+	w->handler = handler;
+	w->priv = priv;
+}
 
-	while (data <= last_byte) {
-		const char *nl = memchr(data, '\n', last_byte + 1 - data);
-		int found_nl = (nl != NULL);
-		if (!found_nl)
-			nl = last_byte;
+static struct iowatch **ready;
+
+/* Makes room for one more registration in the per-wait arrays. */
+static int iowatch_grow(void)
+{
+	unsigned int newsize;
+	struct iowatch **new_ready;
 
-		if ((*needts && write_all(fd, ts, tslen))
-		    || write_all(fd, data, nl + 1 - data))
+	if (nr_watches < watches_size)
+		return 0;
+
+	newsize = ROUNDUP(nr_watches + 1, 8);
+
+	new_ready = realloc(ready, sizeof(*ready) * newsize);
+	if (!new_ready)
+		return -1;
+	ready = new_ready;
+
+#ifdef __linux__
+	{
+		struct epoll_event *new_events;
+
+		new_events = realloc(ready_events,
+				     sizeof(*ready_events) * newsize);
+		if (!new_events)
 			return -1;
+		ready_events = new_events;
+	}
+#else
+	{
+		struct iowatch **new_watches;
+		struct pollfd *new_fds;
 
-		*needts = found_nl;
-		data = nl + 1;
-		if (found_nl) {
-			// If we printed a newline, strip all \r following it
-			while (data <= last_byte && *data == '\r')
-				data++;
-		}
+		new_watches = realloc(watches, sizeof(*watches) * newsize);
+		if (!new_watches)
+			return -1;
+		watches = new_watches;
+
+		new_fds = realloc(fds, sizeof(*fds) * newsize);
+		if (!new_fds)
+			return -1;
+		fds = new_fds;
 	}
+#endif
 
+	watches_size = newsize;
 	return 0;
 }
 
+#ifdef __linux__
+static int iowatch_open(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		dolog(LOG_ERR, "Failed to create epoll set: %d (%s)",
+		      errno, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void iowatch_close(void)
+{
+	if (epoll_fd != -1)
+		close(epoll_fd);
+	epoll_fd = -1;
+	free(ready_events);
+	ready_events = NULL;
+}
+
+static uint32_t poll_to_epoll(short events)
+{
+	return ((events & POLLIN) ? EPOLLIN : 0) |
+	       ((events & POLLOUT) ? EPOLLOUT : 0) |
+	       ((events & POLLPRI) ? EPOLLPRI : 0);
+}
+
+static short epoll_to_poll(uint32_t events)
+{
+	return ((events & EPOLLIN) ? POLLIN : 0) |
+	       ((events & EPOLLOUT) ? POLLOUT : 0) |
+	       ((events & EPOLLPRI) ? POLLPRI : 0) |
+	       ((events & EPOLLERR) ? POLLERR : 0) |
+	       ((events & EPOLLHUP) ? POLLHUP : 0);
+}
+
+static void iowatch_set(struct iowatch *w, int fd, short events)
+{
+	struct epoll_event ev = { .data.ptr = w };
+
+	if (w->events && (fd != w->fd || !events)) {
+		/* Fails harmlessly if the fd is already gone. */
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, &ev);
+		w->events = 0;
+		nr_watches--;
+	}
+	if (fd != w->fd)
+		w->revents = 0;
+	w->fd = fd;
+
+	if (fd == -1 || !events || events == w->events)
+		return;
+
+	if (!w->events && iowatch_grow()) {
+		dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
+		return;
+	}
+
+	ev.events = poll_to_epoll(events);
+	if (epoll_ctl(epoll_fd, w->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		      fd, &ev)) {
+		dolog(LOG_ERR, "Failed to watch fd %d: %d (%s)",
+		      fd, errno, strerror(errno));
+		return;
+	}
+
+	if (!w->events)
+		nr_watches++;
+	w->events = events;
+}
+
+static int iowatch_wait(int timeout)
+{
+	int i, n;
+
+	n = epoll_wait(epoll_fd, ready_events, watches_size ? : 1, timeout);
+
+	for (i = 0; i < n; i++) {
+		ready[i] = ready_events[i].data.ptr;
+		ready[i]->revents = epoll_to_poll(ready_events[i].events);
+	}
+
+	return n;
+}
+#else /* !__linux__ */
+static int iowatch_open(void)
+{
+	return 0;
+}
+
+static void iowatch_close(void)
+{
+	free(watches);
+	watches = NULL;
+	free(fds);
+	fds = NULL;
+}
+
+static void iowatch_set(struct iowatch *w, int fd, short events)
+{
+	if (w->idx != -1 && (fd != w->fd || !events)) {
+		/* Move the last registration into the hole. */
+		watches[w->idx] = watches[--nr_watches];
+		watches[w->idx]->idx = w->idx;
+		w->idx = -1;
+		w->events = 0;
+	}
+	if (fd != w->fd)
+		w->revents = 0;
+	w->fd = fd;
+
+	if (fd == -1 || !events)
+		return;
+
+	if (w->idx == -1) {
+		if (iowatch_grow()) {
+			dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
+			return;
+		}
+		w->idx = nr_watches;
+		watches[nr_watches++] = w;
+	}
+	w->events = events;
+}
+
+static int iowatch_wait(int timeout)
+{
+	unsigned int i, nr_polled = nr_watches;
+	int n, ret;
+
+	for (i = 0; i < nr_polled; i++) {
+		fds[i].fd = watches[i]->fd;
+		fds[i].events = watches[i]->events;
+		fds[i].revents = 0;
+	}
+
+	ret = poll(fds, nr_polled, timeout);
+	if (ret <= 0)
+		return ret;
+
+	for (i = 0, n = 0; i < nr_polled; i++) {
+		if (!fds[i].revents)
+			continue;
+		watches[i]->revents = fds[i].revents;
+		ready[n++] = watches[i];
+	}
+
+	return n;
+}
+#endif /* !__linux__ */
+
+static void iowatch_clear(struct iowatch *w)
+{
+	iowatch_set(w, -1, 0);
+}
+
+/*
+ * Runs the handler of each watch iowatch_wait() found ready.  A handler
+ * may clear or move other watches, whose stale results are then skipped;
+ * nothing is freed until the loop reaps dead domains afterwards.
+ */
+static void iowatch_dispatch(int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct iowatch *w = ready[i];
+
+		if (w->events && w->revents)
+			w->handler(w);
+		w->revents = 0;
+	}
+}
+
 static inline bool buffer_available(struct console *con)
 {
 	if (discard_overflowed_data ||
@@ -490,6 +831,8 @@ static int create_console_log(struct console *con)
 
 static void console_close_tty(struct console *con)
 {
+	iowatch_clear(&con->tty_watch);
+
 	if (con->master_fd != -1) {
 		close(con->master_fd);
 		con->master_fd = -1;
@@ -670,6 +1013,16 @@ static int xs_gather(struct xs_handle *xs, const char *dir, ...)
 	return ret;
 }
 
+static void console_close_evtchn(struct console *con)
+{
+	iowatch_clear(&con->xce_watch);
+
+	if (con->xce_handle != NULL)
+		xenevtchn_close(con->xce_handle);
+
+	con->xce_handle = NULL;
+}
+
 static void console_unmap_interface(struct console *con)
 {
 	if (con->interface == NULL)
@@ -749,8 +1102,7 @@ static int console_create_ring(struct console *con)
 
 	con->local_port = -1;
 	con->remote_port = -1;
-	if (con->xce_handle != NULL)
-		xenevtchn_close(con->xce_handle);
+	console_close_evtchn(con);
 
 	/* Opening evtchn independently for each console is a bit
 	 * wasteful, but that's how the code is structured... */
@@ -765,8 +1117,7 @@ static int console_create_ring(struct console *con)
 
 	if (rc == -1) {
 		err = errno;
-		xenevtchn_close(con->xce_handle);
-		con->xce_handle = NULL;
+		console_close_evtchn(con);
 		goto out;
 	}
 	con->local_port = rc;
@@ -775,8 +1126,7 @@ static int console_create_ring(struct console *con)
 	if (con->master_fd == -1) {
 		if (!console_create_tty(con)) {
 			err = errno;
-			xenevtchn_close(con->xce_handle);
-			con->xce_handle = NULL;
+			console_close_evtchn(con);
 			con->local_port = -1;
 			con->remote_port = -1;
 			goto out;
@@ -787,6 +1137,7 @@ static int console_create_ring(struct console *con)
 		con->log_fd = create_console_log(con);
 
  out:
+	console_update_watches(con);
 	return err;
 }
 
@@ -826,14 +1177,15 @@ static int console_init(struct console *con, struct domain *dom, void **data)
 	}
 
 	con->master_fd = -1;
-	con->master_pollfd_idx = -1;
+	iowatch_setup(&con->tty_watch, console_tty_event, con);
 	con->slave_fd = -1;
 	con->log_fd = -1;
 	con->ring_ref = -1;
 	con->local_port = -1;
 	con->remote_port = -1;
-	con->xce_pollfd_idx = -1;
-	con->next_period = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + RATE_LIMIT_PERIOD;
+	iowatch_setup(&con->xce_watch, console_evtchn_event, con);
+	con->tokens = RATE_LIMIT_ALLOWANCE;
+	con->last_refill = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 	con->d = dom;
 	con->ttyname = (*con_type)->ttyname;
 	con->log_suffix = (*con_type)->log_suffix;
@@ -918,8 +1270,26 @@ static void remove_domain(struct domain *dom)
 	}
 }
 
+static void console_unthrottle(struct console *con)
+{
+	struct console **pp;
+
+	if (!con->throttled)
+		return;
+
+	for (pp = &throttled_head; *pp; pp = &(*pp)->next_throttled) {
+		if (*pp == con) {
+			*pp = con->next_throttled;
+			break;
+		}
+	}
+	con->throttled = false;
+}
+
 static void console_cleanup(struct console *con)
 {
+	console_unthrottle(con);
+
 	if (con->log_fd != -1) {
 		close(con->log_fd);
 		con->log_fd = -1;
@@ -941,17 +1311,10 @@ static void cleanup_domain(struct domain *d)
 	remove_domain(d);
 }
 
-static void console_close_evtchn(struct console *con)
-{
-	if (con->xce_handle != NULL)
-		xenevtchn_close(con->xce_handle);
-
-	con->xce_handle = NULL;
-}
-
 static void shutdown_domain(struct domain *d)
 {
 	d->is_dead = true;
+	reap_pending = true;
 	watch_domain(d, false);
 	console_iter_void_arg1(d, console_unmap_interface);
 	console_iter_void_arg1(d, console_close_evtchn);
@@ -966,6 +1329,7 @@ static void enum_domains(void)
 	struct domain *dom;
 
 	enum_pass++;
+	reap_pending = true;
 
 	while (xc_domain_getinfo(xc, domid, 1, &dominfo) == 1) {
 		dom = lookup_domain(dominfo.domid);
@@ -1070,24 +1434,79 @@ static void handle_tty_write(struct console *con)
 	}
 }
 
-static void console_evtchn_unmask(struct console *con, void *data)
+/*
+ * Each console has a token bucket holding up to RATE_LIMIT_ALLOWANCE
+ * events, refilled at RATE_LIMIT_ALLOWANCE per RATE_LIMIT_PERIOD.  A
+ * console that runs out is left masked and is not polled until half
+ * its bucket has refilled, so a flooding guest costs a couple of
+ * wakeups per period rather than one per event.
+ */
+static void console_refill(struct console *con)
 {
-	long long now = *(long long *)data;
+	long long gained;
 
-	if (!console_enabled(con))
+	gained = (now_ms - con->last_refill) * RATE_LIMIT_ALLOWANCE /
+		RATE_LIMIT_PERIOD;
+	if (gained <= 0)
 		return;
 
-	/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
-	 * for select(), it is not clear poll() has
-	 * similar behavior (returning a couple of ms
-	 * sooner than requested) as well. Just leave
-	 * the fuzz here. Remove it with a separate
-	 * patch if necessary */
-	if ((now+5) > con->next_period) {
-		con->next_period = now + RATE_LIMIT_PERIOD;
-		if (con->event_count >= RATE_LIMIT_ALLOWANCE)
+	if (con->tokens + gained >= RATE_LIMIT_ALLOWANCE) {
+		con->tokens = RATE_LIMIT_ALLOWANCE;
+		con->last_refill = now_ms;
+	} else {
+		con->tokens += gained;
+		con->last_refill += gained * RATE_LIMIT_PERIOD /
+			RATE_LIMIT_ALLOWANCE;
+	}
+}
+
+static void console_throttle(struct console *con)
+{
+	con->throttled = true;
+	con->next_period = con->last_refill + RATE_LIMIT_PERIOD / 2;
+	con->next_throttled = throttled_head;
+	throttled_head = con;
+}
+
+/* Returns the poll timeout needed for the next throttled console. */
+static int throttled_timeout(void)
+{
+	struct console *con;
+	long long next = 0, duration;
+
+	for (con = throttled_head; con; con = con->next_throttled)
+		if (!next || con->next_period < next)
+			next = con->next_period;
+
+	if (!next)
+		return -1;
+
+	duration = next - now_ms;
+	if (duration <= 0) /* sanity check */
+		duration = 1;
+	return (int)duration;
+}
+
+static void unthrottle_consoles(void)
+{
+	struct console *con, *next;
+
+	for (con = throttled_head; con; con = next) {
+		next = con->next_throttled;
+
+		/* CS 16257:955ee4fa1345 introduces a 5ms fuzz
+		 * for select(), it is not clear poll() has
+		 * similar behavior (returning a couple of ms
+		 * sooner than requested) as well. Just leave
+		 * the fuzz here. */
+		if (now_ms + 5 < con->next_period)
+			continue;
+
+		console_refill(con);
+		console_unthrottle(con);
+		if (console_enabled(con) && con->xce_handle)
 			(void)xenevtchn_unmask(con->xce_handle, con->local_port);
-		con->event_count = 0;
+		console_update_watches(con);
 	}
 }
 
@@ -1108,27 +1527,67 @@ static void handle_ring_read(struct console *con)
 		return;
 	}
 
-	con->event_count++;
+	console_refill(con);
+	if (con->tokens)
+		con->tokens--;
 
 	buffer_append(con);
 
-	if (con->event_count < RATE_LIMIT_ALLOWANCE)
+	if (con->tokens)
 		(void)xenevtchn_unmask(con->xce_handle, port);
+	else
+		console_throttle(con);
+}
+
+static void console_update_watches(struct console *con)
+{
+	short events = 0;
+
+	if (con->master_fd != -1) {
+		if (!con->d->is_dead && con->interface && ring_free_bytes(con))
+			events |= POLLIN;
+
+		if (!buffer_empty(&con->buffer))
+			events |= POLLOUT;
+
+		if (events)
+			events |= POLLPRI;
+	}
+	iowatch_set(&con->tty_watch, con->master_fd, events);
+
+	if (con->xce_handle != NULL && !con->throttled &&
+	    buffer_available(con))
+		iowatch_set(&con->xce_watch, xenevtchn_fd(con->xce_handle),
+			    POLLIN|POLLPRI);
+	else
+		iowatch_clear(&con->xce_watch);
+}
+
+static void console_evtchn_event(struct iowatch *w)
+{
+	struct console *con = w->priv;
+
+	if (!(w->revents & ~(POLLIN|POLLOUT|POLLPRI)) &&
+	    (w->revents & POLLIN))
+		handle_ring_read(con);
+
+	console_update_watches(con);
 }
 
-static void handle_console_ring(struct console *con)
+static void console_tty_event(struct iowatch *w)
 {
-	if (con->event_count < RATE_LIMIT_ALLOWANCE) {
-		if (con->xce_handle != NULL &&
-		    con->xce_pollfd_idx != -1 &&
-		    !(fds[con->xce_pollfd_idx].revents &
-		      ~(POLLIN|POLLOUT|POLLPRI)) &&
-		    (fds[con->xce_pollfd_idx].revents &
-		     POLLIN))
-			handle_ring_read(con);
+	struct console *con = w->priv;
+
+	if (w->revents & ~(POLLIN|POLLOUT|POLLPRI))
+		console_handle_broken_tty(con, domain_is_valid(con->d->domid));
+	else {
+		if (w->revents & POLLIN)
+			handle_tty_read(con);
+		if ((w->revents & POLLOUT) && con->master_fd != -1)
+			handle_tty_write(con);
 	}
 
-	con->xce_pollfd_idx = -1;
+	console_update_watches(con);
 }
 
 static void handle_xs(void)
@@ -1215,108 +1674,64 @@ static void handle_log_reload(void)
 	}
 }
 
-/* Returns index inside fds array if succees, -1 if fail */
-static int set_fds(int fd, short events)
+static void xs_event(struct iowatch *w)
 {
-	int ret;
-	if (current_array_size < nr_fds + 1) {
-		struct pollfd  *new_fds = NULL;
-		unsigned long newsize;
-
-		/* Round up to 2^8 boundary, in practice this just
-		 * make newsize larger than current_array_size.
-		 */
-		newsize = ROUNDUP(nr_fds + 1, 8);
-
-		new_fds = realloc(fds, sizeof(struct pollfd)*newsize);
-		if (!new_fds)
-			goto fail;
-		fds = new_fds;
-
-		memset(&fds[0] + current_array_size, 0,
-		       sizeof(struct pollfd) * (newsize-current_array_size));
-		current_array_size = newsize;
-	}
-
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
-
-	return ret;
-fail:
-	dolog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
-	return -1;
+	if (w->revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR, "Failure in poll xs_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (w->revents & POLLIN)
+		handle_xs();
 }
 
-static void reset_fds(void)
+static void hv_log_event(struct iowatch *w)
 {
-	nr_fds = 0;
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
+	if (w->revents & ~(POLLIN|POLLOUT|POLLPRI)) {
+		dolog(LOG_ERR, "Failure in poll xce_handle: %d (%s)",
+		      errno, strerror(errno));
+		io_failed = true;
+	} else if (w->revents & POLLIN)
+		handle_hv_logs(w->priv, false);
 }
 
-static void maybe_add_console_evtchn_fd(struct console *con, void *data)
+static void reap_domains(void)
 {
-	long long next_timeout = *((long long *)data);
+	struct domain *d, *n;
 
-	if (con->event_count >= RATE_LIMIT_ALLOWANCE) {
-		/* Determine if we're going to be the next time slice to expire */
-		if (!next_timeout ||
-		    con->next_period < next_timeout)
-			next_timeout = con->next_period;
-	} else if (con->xce_handle != NULL) {
-		if (buffer_available(con)) {
-			int evtchn_fd = xenevtchn_fd(con->xce_handle);
-			con->xce_pollfd_idx = set_fds(evtchn_fd,
-						      POLLIN|POLLPRI);
-		}
-	}
-
-	*((long long *)data) = next_timeout;
-}
+	for (d = dom_head; d; d = n) {
+		n = d->next;
 
-static void maybe_add_console_tty_fd(struct console *con)
-{
-	if (con->master_fd != -1) {
-		short events = 0;
-		if (!con->d->is_dead && ring_free_bytes(con))
-			events |= POLLIN;
-
-		if (!buffer_empty(&con->buffer))
-			events |= POLLOUT;
+		if (d->last_seen != enum_pass)
+			shutdown_domain(d);
 
-		if (events)
-			con->master_pollfd_idx =
-				set_fds(con->master_fd, events|POLLPRI);
+		if (d->is_dead)
+			cleanup_domain(d);
 	}
+
+	reap_pending = false;
 }
 
-static void handle_console_tty(struct console *con)
+static void update_now(void)
 {
-	if (con->master_fd != -1 && con->master_pollfd_idx != -1) {
-		if (fds[con->master_pollfd_idx].revents &
-		    ~(POLLIN|POLLOUT|POLLPRI))
-			console_handle_broken_tty(con, domain_is_valid(con->d->domid));
-		else {
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLIN)
-				handle_tty_read(con);
-			if (fds[con->master_pollfd_idx].revents &
-			    POLLOUT)
-				handle_tty_write(con);
-		}
-	}
-	con->master_pollfd_idx = -1;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		now_ms = ((long long)ts.tv_sec * 1000) +
+			(ts.tv_nsec / 1000000);
 }
 
 void handle_io(void)
 {
 	int ret;
 	xenevtchn_port_or_error_t log_hv_evtchn = -1;
-	int xce_pollfd_idx = -1;
-	int xs_pollfd_idx = -1;
 	xenevtchn_handle *xce_handle = NULL;
+	struct iowatch xs_watch, hv_watch;
+
+	iowatch_setup(&xs_watch, xs_event, NULL);
+	iowatch_setup(&hv_watch, hv_log_event, NULL);
+
+	if (iowatch_open())
+		return;
 
 	if (log_hv) {
 		xce_handle = xenevtchn_open(NULL, 0);
@@ -1352,48 +1767,21 @@ void handle_io(void)
 		goto out;
 	}
 
-	enum_domains();
-
-	for (;;) {
-		struct domain *d, *n;
-		int poll_timeout; /* timeout in milliseconds */
-		struct timespec ts;
-		long long now, next_timeout = 0;
-
-		reset_fds();
-
-		xs_pollfd_idx = set_fds(xs_fileno(xs), POLLIN|POLLPRI);
-
-		if (log_hv)
-			xce_pollfd_idx = set_fds(xenevtchn_fd(xce_handle),
-						 POLLIN|POLLPRI);
-
-		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
-			break;
-		now = ((long long)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
-
-		/* Re-calculate any event counter allowances & unblock
-		   domains with new allowance */
-		for (d = dom_head; d; d = d->next) {
-
-			console_iter_void_arg2(d, console_evtchn_unmask, (void *)&now);
-
-			console_iter_void_arg2(d, maybe_add_console_evtchn_fd, 
-					       (void *)&next_timeout);
+	iowatch_set(&xs_watch, xs_fileno(xs), POLLIN|POLLPRI);
+	if (log_hv) {
+		hv_watch.priv = xce_handle;
+		iowatch_set(&hv_watch, xenevtchn_fd(xce_handle),
+			    POLLIN|POLLPRI);
+	}
 
-			console_iter_void_arg1(d, maybe_add_console_tty_fd);
-		}
+	update_now();
+	enum_domains();
 
-		/* If any domain has been rate limited, we need to work
-		   out what timeout to supply to poll */
-		if (next_timeout) {
-			long long duration = (next_timeout - now);
-			if (duration <= 0) /* sanity check */
-				duration = 1;
-			poll_timeout = (int)duration;
-		}
+	while (!io_failed) {
+		if (reap_pending)
+			reap_domains();
 
-		ret = poll(fds, nr_fds, next_timeout ? poll_timeout : -1);
+		ret = iowatch_wait(throttled_timeout());
 
 		if (log_reload) {
 			int saved_errno = errno;
@@ -1414,53 +1802,23 @@ void handle_io(void)
 			break;
 		}
 
-		if (log_hv && xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xce_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN)
-				handle_hv_logs(xce_handle, false);
+		update_now();
 
-			xce_pollfd_idx = -1;
-		}
-
-		if (ret <= 0)
-			continue;
-
-		if (xs_pollfd_idx != -1) {
-			if (fds[xs_pollfd_idx].revents & ~(POLLIN|POLLOUT|POLLPRI)) {
-				dolog(LOG_ERR,
-				      "Failure in poll xs_handle: %d (%s)",
-				      errno, strerror(errno));
-				break;
-			} else if (fds[xs_pollfd_idx].revents & POLLIN)
-				handle_xs();
-
-			xs_pollfd_idx = -1;
-		}
-
-		for (d = dom_head; d; d = n) {
+		/* Give consoles whose bucket has refilled their events back */
+		unthrottle_consoles();
 
-			n = d->next;
-
-			console_iter_void_arg1(d, handle_console_ring);
-
-			console_iter_void_arg1(d, handle_console_tty);
-
-			if (d->last_seen != enum_pass)
-				shutdown_domain(d);
-
-			if (d->is_dead)
-				cleanup_domain(d);
-		}
+		iowatch_dispatch(ret);
 	}
 
-	free(fds);
-	current_array_size = 0;
-
  out:
+	iowatch_clear(&xs_watch);
+	iowatch_clear(&hv_watch);
+	iowatch_close();
+	free(ready);
+	ready = NULL;
+	nr_watches = watches_size = 0;
+	io_failed = false;
+
 	if (log_hv_fd != -1) {
 		close(log_hv_fd);
 		log_hv_fd = -1;
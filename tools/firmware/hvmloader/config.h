@@ -62,6 +62,7 @@ extern const uint32_t pci_mem_end;
 extern uint64_t pci_hi_mem_start, pci_hi_mem_end;
 
 extern bool acpi_enabled;
+extern bool fast_boot;
 
 /* Memory map. */
 #define SCRATCH_PHYSICAL_ADDRESS      0x00010000
@@ -28,6 +28,7 @@
 #include <acpi2_0.h>
 #include <xen/version.h>
 #include <xen/hvm/params.h>
+#include <xen/hvm/hvm_xs_strings.h>
 #include <xen/arch-x86/hvm/start_info.h>
 
 const struct hvm_start_info *hvm_start_info;
@@ -117,6 +118,7 @@ uint32_t ioapic_base_address = 0xfec00000;
 uint8_t ioapic_version;
 
 bool acpi_enabled;
+bool fast_boot;
 
 static void init_hypercalls(void)
 {
@@ -337,6 +339,10 @@ int main(void)
 
     xenbus_setup();
 
+    fast_boot = !strncmp(xenstore_read(HVM_XS_FAST_BOOT, "0"), "1", 1);
+    if ( fast_boot )
+        printf("Fast boot requested\n");
+
     bios = detect_bios();
     printf("System requested %s\n", bios->name);
 
@@ -347,7 +353,8 @@ int main(void)
 
     smp_initialise();
 
-    perform_tests();
+    if ( !fast_boot )
+        perform_tests();
 
     if ( bios->bios_info_setup )
         bios->bios_info_setup();
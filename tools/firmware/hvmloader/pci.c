@@ -36,6 +36,14 @@ uint64_t pci_hi_mem_start = 0, pci_hi_mem_end = 0;
 enum virtual_vga virtual_vga = VGA_none;
 unsigned long igd_opregion_pgbase = 0;
 
+/* Functions found by pci_setup(), so that later scans skip empty slots. */
+static uint32_t pci_devfn_map[256 / 32];
+
+bool pci_devfn_present(unsigned int devfn)
+{
+    return devfn < 256 && (pci_devfn_map[devfn / 32] & (1U << (devfn % 32)));
+}
+
 /* Check if the specified range conflicts with any reserved device memory. */
 static bool check_overlap_all(uint64_t start, uint64_t size)
 {
@@ -84,6 +92,7 @@ void pci_setup(void)
     uint16_t class, vendor_id, device_id;
     unsigned int bar, pin, link, isa_irq;
     uint8_t pci_devfn_decode_type[256] = {};
+    bool multifunction = false;
 
     /* Resources assignable to PCI devices via BARs. */
     struct resource {
@@ -154,12 +163,25 @@ void pci_setup(void)
     /* Scan the PCI bus and map resources. */
     for ( devfn = 0; devfn < 256; devfn++ )
     {
-        class     = pci_readw(devfn, PCI_CLASS_DEVICE);
+        /*
+         * Each config space access exits to the device model.  In fast boot
+         * mode, enumerate like a PCI BIOS does, probing functions 1-7 of a
+         * slot only if function 0 is a multi-function device.
+         */
+        if ( fast_boot && (devfn & 7) && !multifunction )
+            continue;
+
         vendor_id = pci_readw(devfn, PCI_VENDOR_ID);
-        device_id = pci_readw(devfn, PCI_DEVICE_ID);
-        if ( (vendor_id == 0xffff) && (device_id == 0xffff) )
+        if ( fast_boot && !(devfn & 7) )
+            multifunction = (vendor_id != 0xffff) &&
+                            (pci_readb(devfn, PCI_HEADER_TYPE) & 0x80);
+        if ( vendor_id == 0xffff )
             continue;
 
+        class     = pci_readw(devfn, PCI_CLASS_DEVICE);
+        device_id = pci_readw(devfn, PCI_DEVICE_ID);
+        pci_devfn_map[devfn / 32] |= 1U << (devfn % 32);
+
         ASSERT((devfn != PCI_ISA_DEVFN) ||
                ((vendor_id == 0x8086) && (device_id == 0x7000)));
 
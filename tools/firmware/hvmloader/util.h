@@ -229,6 +229,9 @@ int hvm_param_set(uint32_t index, uint64_t value);
 /* Setup PCI bus */
 void pci_setup(void);
 
+/* Was a function found at @devfn by pci_setup()? */
+bool pci_devfn_present(unsigned int devfn);
+
 /* Setup memory map  */
 void memory_map_setup(void);
 
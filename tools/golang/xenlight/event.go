@@ -0,0 +1,501 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package xenlight
+
+/*
+#include <stdlib.h>
+#include <poll.h>
+#include <libxl.h>
+
+void xenlight_set_osevent_hooks(libxl_ctx *ctx, uintptr_t user);
+void xenlight_ao_how_init(libxl_asyncop_how *how, uintptr_t id);
+*/
+import "C"
+
+import (
+	"errors"
+	"sync"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// An asynchronous context runs libxl's event loop itself, through the
+// osevent hooks (libxl_osevent_register_hooks): a goroutine polls the fds
+// libxl registers, and timeouts are Go timers.  Completion of asynchronous
+// operations is reported through a libxl_asyncop_how callback.
+//
+// libxl keeps the hooks' user pointer and registration values, so these
+// are small integer handles rather than Go pointers.  None of the locks
+// below is held while calling into libxl.
+
+type eventFd struct {
+	fd       int
+	events   int16
+	forLibxl unsafe.Pointer
+}
+
+type eventTimeout struct {
+	timer    *time.Timer
+	forLibxl unsafe.Pointer
+}
+
+type eventLoop struct {
+	id   uintptr
+	wake [2]int
+
+	mu       sync.Mutex
+	stopping bool
+	nextReg  uintptr
+	fds      map[uintptr]*eventFd
+	timeouts map[uintptr]*eventTimeout
+
+	// Timeout callbacks currently inside libxl.
+	inflight sync.WaitGroup
+	done     chan struct{}
+}
+
+var (
+	eventLoopsMu sync.Mutex
+	eventLoops   = map[uintptr]*Context{}
+	nextLoopID   uintptr
+
+	asyncOpsMu sync.Mutex
+	asyncOps   = map[uintptr]*AsyncOp{}
+	nextOpID   uintptr
+)
+
+// ErrNotAsync is returned by the *Async methods of a Context not created
+// with NewAsyncContext.
+var ErrNotAsync = errors.New("xenlight: context has no event loop")
+
+func lookupContext(user C.uintptr_t) *Context {
+	eventLoopsMu.Lock()
+	defer eventLoopsMu.Unlock()
+
+	return eventLoops[uintptr(user)]
+}
+
+func (ctx *Context) startEventLoop() error {
+	ev := &eventLoop{
+		fds:      map[uintptr]*eventFd{},
+		timeouts: map[uintptr]*eventTimeout{},
+		done:     make(chan struct{}),
+	}
+
+	if err := syscall.Pipe(ev.wake[:]); err != nil {
+		return err
+	}
+	for _, fd := range ev.wake {
+		syscall.CloseOnExec(fd)
+		if err := syscall.SetNonblock(fd, true); err != nil {
+			syscall.Close(ev.wake[0])
+			syscall.Close(ev.wake[1])
+			return err
+		}
+	}
+
+	ctx.events = ev
+
+	eventLoopsMu.Lock()
+	nextLoopID++
+	ev.id = nextLoopID
+	eventLoops[ev.id] = ctx
+	eventLoopsMu.Unlock()
+
+	C.xenlight_set_osevent_hooks(ctx.ctx, C.uintptr_t(ev.id))
+
+	go ctx.pollFds()
+
+	return nil
+}
+
+// stopEventLoop stops calling into libxl, before the libxl_ctx is freed.
+func (ctx *Context) stopEventLoop() {
+	ev := ctx.events
+
+	ev.mu.Lock()
+	ev.stopping = true
+	for reg, t := range ev.timeouts {
+		t.timer.Stop()
+		delete(ev.timeouts, reg)
+	}
+	ev.mu.Unlock()
+
+	ev.kick()
+	<-ev.done
+	ev.inflight.Wait()
+}
+
+// releaseEventLoop forgets about the event loop, once the libxl_ctx is gone.
+func (ctx *Context) releaseEventLoop() {
+	ev := ctx.events
+
+	eventLoopsMu.Lock()
+	delete(eventLoops, ev.id)
+	eventLoopsMu.Unlock()
+
+	syscall.Close(ev.wake[0])
+	syscall.Close(ev.wake[1])
+	ctx.events = nil
+}
+
+// kick makes the poller pick up a change in the registered fds.
+func (ev *eventLoop) kick() {
+	var b [1]byte
+
+	// The pipe being full is as good as a successful write.
+	syscall.Write(ev.wake[1], b[:])
+}
+
+func (ctx *Context) pollFds() {
+	ev := ctx.events
+	var pfds []C.struct_pollfd
+	var regs []*eventFd
+	var buf [64]byte
+
+	defer close(ev.done)
+
+	for {
+		ev.mu.Lock()
+		if ev.stopping {
+			ev.mu.Unlock()
+			return
+		}
+
+		pfds = append(pfds[:0], C.struct_pollfd{
+			fd:     C.int(ev.wake[0]),
+			events: C.POLLIN,
+		})
+		regs = regs[:0]
+		for _, f := range ev.fds {
+			// Registered with no events: nothing to report, not even
+			// POLLHUP.
+			if f.events == 0 {
+				continue
+			}
+			pfds = append(pfds, C.struct_pollfd{
+				fd:     C.int(f.fd),
+				events: C.short(f.events),
+			})
+			regs = append(regs, f)
+		}
+		ev.mu.Unlock()
+
+		if n, err := C.poll(&pfds[0], C.nfds_t(len(pfds)), -1); n < 0 {
+			if err == syscall.EINTR {
+				continue
+			}
+			panic("xenlight: poll: " + err.Error())
+		}
+
+		if pfds[0].revents != 0 {
+			for {
+				if n, _ := syscall.Read(ev.wake[0], buf[:]); n <= 0 {
+					break
+				}
+			}
+		}
+
+		// A registration may have gone away since the snapshot was taken.
+		// libxl tolerates events for stale registrations, as long as the
+		// libxl_ctx itself is still around, which stopEventLoop() ensures.
+		for i, f := range regs {
+			if pfds[i+1].revents == 0 {
+				continue
+			}
+			C.libxl_osevent_occurred_fd(ctx.ctx, f.forLibxl, C.int(f.fd),
+				pfds[i+1].events, pfds[i+1].revents)
+		}
+	}
+}
+
+func (ctx *Context) fireTimeout(ev *eventLoop, reg uintptr) {
+	// A timeout occurs at most once: whichever of the timer and
+	// timeout_modify gets here first removes it.
+	ev.mu.Lock()
+	t, ok := ev.timeouts[reg]
+	if !ok || ev.stopping {
+		ev.mu.Unlock()
+		return
+	}
+	delete(ev.timeouts, reg)
+	ev.inflight.Add(1)
+	ev.mu.Unlock()
+
+	C.libxl_osevent_occurred_timeout(ctx.ctx, t.forLibxl)
+	ev.inflight.Done()
+}
+
+func untilTimeval(sec, usec C.long) time.Duration {
+	return time.Until(time.Unix(int64(sec), int64(usec)*1000))
+}
+
+//export xenlightFdRegister
+func xenlightFdRegister(user C.uintptr_t, fd C.int, events C.short,
+	forLibxl unsafe.Pointer, reg *C.uintptr_t) C.int {
+	ctx := lookupContext(user)
+	if ctx == nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	ev := ctx.events
+
+	ev.mu.Lock()
+	ev.nextReg++
+	ev.fds[ev.nextReg] = &eventFd{
+		fd:       int(fd),
+		events:   int16(events),
+		forLibxl: forLibxl,
+	}
+	*reg = C.uintptr_t(ev.nextReg)
+	ev.mu.Unlock()
+
+	ev.kick()
+
+	return 0
+}
+
+//export xenlightFdModify
+func xenlightFdModify(user C.uintptr_t, reg C.uintptr_t, events C.short) C.int {
+	ctx := lookupContext(user)
+	if ctx == nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	ev := ctx.events
+
+	ev.mu.Lock()
+	if f, ok := ev.fds[uintptr(reg)]; ok {
+		f.events = int16(events)
+	}
+	ev.mu.Unlock()
+
+	ev.kick()
+
+	return 0
+}
+
+//export xenlightFdDeregister
+func xenlightFdDeregister(user C.uintptr_t, reg C.uintptr_t) {
+	ctx := lookupContext(user)
+	if ctx == nil {
+		return
+	}
+	ev := ctx.events
+
+	ev.mu.Lock()
+	delete(ev.fds, uintptr(reg))
+	ev.mu.Unlock()
+
+	ev.kick()
+}
+
+//export xenlightTimeoutRegister
+func xenlightTimeoutRegister(user C.uintptr_t, sec, usec C.long,
+	forLibxl unsafe.Pointer, reg *C.uintptr_t) C.int {
+	ctx := lookupContext(user)
+	if ctx == nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	ev := ctx.events
+
+	ev.mu.Lock()
+	ev.nextReg++
+	id := ev.nextReg
+	t := &eventTimeout{forLibxl: forLibxl}
+	ev.timeouts[id] = t
+	if !ev.stopping {
+		t.timer = time.AfterFunc(untilTimeval(sec, usec), func() {
+			ctx.fireTimeout(ev, id)
+		})
+	}
+	*reg = C.uintptr_t(id)
+	ev.mu.Unlock()
+
+	return 0
+}
+
+//export xenlightTimeoutModify
+func xenlightTimeoutModify(user C.uintptr_t, reg C.uintptr_t,
+	sec, usec C.long) C.int {
+	ctx := lookupContext(user)
+	if ctx == nil {
+		return C.ERROR_OSEVENT_REG_FAIL
+	}
+	ev := ctx.events
+	id := uintptr(reg)
+
+	// libxl only ever asks for the timeout to occur right away.  If it
+	// already has, or is about to, there is nothing to do.
+	ev.mu.Lock()
+	if t, ok := ev.timeouts[id]; ok && t.timer != nil {
+		t.timer.Stop()
+		t.timer = time.AfterFunc(untilTimeval(sec, usec), func() {
+			ctx.fireTimeout(ev, id)
+		})
+	}
+	ev.mu.Unlock()
+
+	return 0
+}
+
+// AsyncOp is an asynchronous libxl operation in progress.
+type AsyncOp struct {
+	done    chan struct{}
+	err     error
+	cleanup func()
+}
+
+// Done returns a channel which is closed once the operation completes.
+func (op *AsyncOp) Done() <-chan struct{} {
+	return op.done
+}
+
+// Wait waits for the operation to complete, and returns its result.
+func (op *AsyncOp) Wait() error {
+	<-op.done
+	return op.err
+}
+
+// WaitAll waits for all of ops to complete, and returns the first error
+// among them, if any.
+func WaitAll(ops ...*AsyncOp) (err error) {
+	for _, op := range ops {
+		if e := op.Wait(); e != nil && err == nil {
+			err = e
+		}
+	}
+
+	return
+}
+
+// startAsync issues an asynchronous libxl call.  call is passed the
+// libxl_asyncop_how to use, and returns the initiating function's result.
+// cleanup, if not nil, is run once libxl is done with the operation,
+// whether it succeeded or not.
+func (ctx *Context) startAsync(call func(how *C.libxl_asyncop_how) C.int,
+	cleanup func()) (*AsyncOp, error) {
+	var how C.libxl_asyncop_how
+
+	if ctx.events == nil {
+		if cleanup != nil {
+			cleanup()
+		}
+		return nil, ErrNotAsync
+	}
+
+	op := &AsyncOp{done: make(chan struct{}), cleanup: cleanup}
+
+	asyncOpsMu.Lock()
+	nextOpID++
+	id := nextOpID
+	asyncOps[id] = op
+	asyncOpsMu.Unlock()
+
+	C.xenlight_ao_how_init(&how, C.uintptr_t(id))
+
+	// On failure, libxl won't call the callback.
+	if ret := call(&how); ret != 0 {
+		asyncOpsMu.Lock()
+		delete(asyncOps, id)
+		asyncOpsMu.Unlock()
+
+		if cleanup != nil {
+			cleanup()
+		}
+		return nil, Error(ret)
+	}
+
+	return op, nil
+}
+
+//export xenlightAsyncCallback
+func xenlightAsyncCallback(rc C.int, id C.uintptr_t) {
+	asyncOpsMu.Lock()
+	op, ok := asyncOps[uintptr(id)]
+	delete(asyncOps, uintptr(id))
+	asyncOpsMu.Unlock()
+
+	if !ok {
+		return
+	}
+
+	if rc != 0 {
+		op.err = Error(rc)
+	}
+	if op.cleanup != nil {
+		op.cleanup()
+	}
+	close(op.done)
+}
+
+// DomainCreateNewAsync starts creating a new domain.  The domid is stored
+// into *domid once the operation completes successfully.
+func (ctx *Context) DomainCreateNewAsync(config *DomainConfig, domid *Domid) (*AsyncOp, error) {
+	// libxl uses both until the operation completes.
+	cconfig := (*C.libxl_domain_config)(C.malloc(C.sizeof_libxl_domain_config))
+	cdomid := (*C.uint32_t)(C.malloc(C.sizeof_uint32_t))
+
+	C.libxl_domain_config_init(cconfig)
+	if err := config.toC(cconfig); err != nil {
+		C.free(unsafe.Pointer(cconfig))
+		C.free(unsafe.Pointer(cdomid))
+		return nil, err
+	}
+
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_create_new(ctx.ctx, cconfig, cdomid, how, nil)
+	}, func() {
+		*domid = Domid(*cdomid)
+		C.libxl_domain_config_dispose(cconfig)
+		C.free(unsafe.Pointer(cconfig))
+		C.free(unsafe.Pointer(cdomid))
+	})
+}
+
+// DomainDestroyAsync starts destroying a domain.
+func (ctx *Context) DomainDestroyAsync(domid Domid) (*AsyncOp, error) {
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_destroy(ctx.ctx, C.uint32_t(domid), how)
+	}, nil)
+}
+
+// DomainShutdownAsync starts shutting down a domain.
+func (ctx *Context) DomainShutdownAsync(domid Domid) (*AsyncOp, error) {
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_shutdown(ctx.ctx, C.uint32_t(domid), how)
+	}, nil)
+}
+
+// DomainRebootAsync starts rebooting a domain.
+func (ctx *Context) DomainRebootAsync(domid Domid) (*AsyncOp, error) {
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_reboot(ctx.ctx, C.uint32_t(domid), how)
+	}, nil)
+}
+
+// DomainPauseAsync starts pausing a domain.
+func (ctx *Context) DomainPauseAsync(domid Domid) (*AsyncOp, error) {
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_pause(ctx.ctx, C.uint32_t(domid), how)
+	}, nil)
+}
+
+// DomainUnpauseAsync starts unpausing a domain.
+func (ctx *Context) DomainUnpauseAsync(domid Domid) (*AsyncOp, error) {
+	return ctx.startAsync(func(how *C.libxl_asyncop_how) C.int {
+		return C.libxl_domain_unpause(ctx.ctx, C.uint32_t(domid), how)
+	}, nil)
+}
@@ -1017,6 +1017,8 @@ if err := x.NumaPlacement.fromC(&xc.numa_placement);err != nil {
 return fmt.Errorf("converting field NumaPlacement: %v", err)
 }
 x.TscMode = TscMode(xc.tsc_mode)
+x.PerfClass = PerfClass(xc.perf_class)
+x.SecurityGroup = uint32(xc.security_group)
 x.MaxMemkb = uint64(xc.max_memkb)
 x.TargetMemkb = uint64(xc.target_memkb)
 x.VideoMemkb = uint64(xc.video_memkb)
@@ -1112,6 +1114,9 @@ x.Bootloader = C.GoString(xc.bootloader)
 if err := x.BootloaderArgs.fromC(&xc.bootloader_args);err != nil {
 return fmt.Errorf("converting field BootloaderArgs: %v", err)
 }
+if err := x.BootloaderCache.fromC(&xc.bootloader_cache);err != nil {
+return fmt.Errorf("converting field BootloaderCache: %v", err)
+}
 x.TimerMode = TimerMode(xc.timer_mode)
 if err := x.NestedHvm.fromC(&xc.nested_hvm);err != nil {
 return fmt.Errorf("converting field NestedHvm: %v", err)
@@ -1152,6 +1157,9 @@ x.ArchArm.Vuart = VuartType(xc.arch_arm.vuart)
 if err := x.ArchX86.MsrRelaxed.fromC(&xc.arch_x86.msr_relaxed);err != nil {
 return fmt.Errorf("converting field ArchX86.MsrRelaxed: %v", err)
 }
+if err := x.ArchX86.IpiVirt.fromC(&xc.arch_x86.ipi_virt);err != nil {
+return fmt.Errorf("converting field ArchX86.IpiVirt: %v", err)
+}
 x.Altp2M = Altp2MMode(xc.altp2m)
 x.VmtraceBufKb = int(xc.vmtrace_buf_kb)
 if err := x.Vpmu.fromC(&xc.vpmu);err != nil {
@@ -1275,6 +1283,9 @@ return fmt.Errorf("converting field Rdm: %v", err)
 }
 x.RdmMemBoundaryMemkb = uint64(tmp.rdm_mem_boundary_memkb)
 x.McaCaps = uint64(tmp.mca_caps)
+if err := x.FastBoot.fromC(&tmp.fast_boot);err != nil {
+return fmt.Errorf("converting field FastBoot: %v", err)
+}
 return nil
 }
 
@@ -1353,6 +1364,8 @@ if err := x.NumaPlacement.toC(&xc.numa_placement); err != nil {
 return fmt.Errorf("converting field NumaPlacement: %v", err)
 }
 xc.tsc_mode = C.libxl_tsc_mode(x.TscMode)
+xc.perf_class = C.libxl_perf_class(x.PerfClass)
+xc.security_group = C.uint32_t(x.SecurityGroup)
 xc.max_memkb = C.uint64_t(x.MaxMemkb)
 xc.target_memkb = C.uint64_t(x.TargetMemkb)
 xc.video_memkb = C.uint64_t(x.VideoMemkb)
@@ -1464,6 +1477,9 @@ xc.bootloader = C.CString(x.Bootloader)}
 if err := x.BootloaderArgs.toC(&xc.bootloader_args); err != nil {
 return fmt.Errorf("converting field BootloaderArgs: %v", err)
 }
+if err := x.BootloaderCache.toC(&xc.bootloader_cache); err != nil {
+return fmt.Errorf("converting field BootloaderCache: %v", err)
+}
 xc.timer_mode = C.libxl_timer_mode(x.TimerMode)
 if err := x.NestedHvm.toC(&xc.nested_hvm); err != nil {
 return fmt.Errorf("converting field NestedHvm: %v", err)
@@ -1603,6 +1619,9 @@ return fmt.Errorf("converting field Rdm: %v", err)
 }
 hvm.rdm_mem_boundary_memkb = C.uint64_t(tmp.RdmMemBoundaryMemkb)
 hvm.mca_caps = C.uint64_t(tmp.McaCaps)
+if err := tmp.FastBoot.toC(&hvm.fast_boot); err != nil {
+return fmt.Errorf("converting field FastBoot: %v", err)
+}
 hvmBytes := C.GoBytes(unsafe.Pointer(&hvm),C.sizeof_libxl_domain_build_info_type_union_hvm)
 copy(xc.u[:],hvmBytes)
 case DomainTypePv:
@@ -1656,6 +1675,9 @@ xc.arch_arm.vuart = C.libxl_vuart_type(x.ArchArm.Vuart)
 if err := x.ArchX86.MsrRelaxed.toC(&xc.arch_x86.msr_relaxed); err != nil {
 return fmt.Errorf("converting field ArchX86.MsrRelaxed: %v", err)
 }
+if err := x.ArchX86.IpiVirt.toC(&xc.arch_x86.ipi_virt); err != nil {
+return fmt.Errorf("converting field ArchX86.IpiVirt: %v", err)
+}
 xc.altp2m = C.libxl_altp2m_mode(x.Altp2M)
 xc.vmtrace_buf_kb = C.int(x.VmtraceBufKb)
 if err := x.Vpmu.toC(&xc.vpmu); err != nil {
@@ -3847,6 +3869,7 @@ return &x, nil}
 func (x *Numainfo) fromC(xc *C.libxl_numainfo) error {
  x.Size = uint64(xc.size)
 x.Free = uint64(xc.free)
+x.Zeroed = uint64(xc.zeroed)
 x.Dists = nil
 if n := int(xc.num_dists); n > 0 {
 cDists := (*[1<<28]C.uint32_t)(unsafe.Pointer(xc.dists))[:n:n]
@@ -3865,6 +3888,7 @@ C.libxl_numainfo_dispose(xc)}
 
 xc.size = C.uint64_t(x.Size)
 xc.free = C.uint64_t(x.Free)
+xc.zeroed = C.uint64_t(x.Zeroed)
 if numDists := len(x.Dists); numDists > 0 {
 xc.dists = (*C.uint32_t)(C.malloc(C.size_t(numDists*numDists)))
 xc.num_dists = C.int(numDists)
@@ -152,6 +152,14 @@ TscModeNative TscMode = 2
 TscModeNativeParavirt TscMode = 3
 )
 
+type PerfClass int
+const(
+PerfClassDefault PerfClass = 0
+PerfClassLatency PerfClass = 1
+PerfClassThroughput PerfClass = 2
+PerfClassBackground PerfClass = 3
+)
+
 type GfxPassthruKind int
 const(
 GfxPassthruKindDefault GfxPassthruKind = 0
@@ -512,6 +520,8 @@ VcpuHardAffinity []Bitmap
 VcpuSoftAffinity []Bitmap
 NumaPlacement Defbool
 TscMode TscMode
+PerfClass PerfClass
+SecurityGroup uint32
 MaxMemkb uint64
 TargetMemkb uint64
 VideoMemkb uint64
@@ -554,6 +564,7 @@ DeviceTree string
 Acpi Defbool
 Bootloader string
 BootloaderArgs StringList
+BootloaderCache Defbool
 TimerMode TimerMode
 NestedHvm Defbool
 Apic Defbool
@@ -567,6 +578,7 @@ Vuart VuartType
 }
 ArchX86 struct {
 MsrRelaxed Defbool
+IpiVirt Defbool
 }
 Altp2M Altp2MMode
 VmtraceBufKb int
@@ -625,6 +637,7 @@ SerialList StringList
 Rdm RdmReserve
 RdmMemBoundaryMemkb uint64
 McaCaps uint64
+FastBoot Defbool
 }
 
 func (x DomainBuildInfoTypeUnionHvm) isDomainBuildInfoTypeUnion(){}
@@ -1135,6 +1148,7 @@ Rref int
 type Numainfo struct {
 Size uint64
 Free uint64
+Zeroed uint64
 Dists []uint32
 }
 
@@ -32,6 +32,76 @@ static const libxl_childproc_hooks childproc_hooks = { .chldowner = libxl_sigchl
 void xenlight_set_chldproc(libxl_ctx *ctx) {
 	libxl_childproc_setmode(ctx, &childproc_hooks, NULL);
 }
+
+// Implemented in event.go.
+extern int xenlightFdRegister(uintptr_t user, int fd, short events,
+                              void *for_libxl, uintptr_t *reg);
+extern int xenlightFdModify(uintptr_t user, uintptr_t reg, short events);
+extern void xenlightFdDeregister(uintptr_t user, uintptr_t reg);
+extern int xenlightTimeoutRegister(uintptr_t user, long sec, long usec,
+                                   void *for_libxl, uintptr_t *reg);
+extern int xenlightTimeoutModify(uintptr_t user, uintptr_t reg,
+                                 long sec, long usec);
+extern void xenlightAsyncCallback(int rc, uintptr_t id);
+
+static int fd_register(void *user, int fd, void **for_app_registration_out,
+                       short events, void *for_libxl) {
+	uintptr_t reg;
+	int rc = xenlightFdRegister((uintptr_t)user, fd, events, for_libxl, &reg);
+
+	if (!rc)
+		*for_app_registration_out = (void *)reg;
+	return rc;
+}
+
+static int fd_modify(void *user, int fd, void **for_app_registration_update,
+                     short events) {
+	return xenlightFdModify((uintptr_t)user,
+	                        (uintptr_t)*for_app_registration_update, events);
+}
+
+static void fd_deregister(void *user, int fd, void *for_app_registration) {
+	xenlightFdDeregister((uintptr_t)user, (uintptr_t)for_app_registration);
+}
+
+static int timeout_register(void *user, void **for_app_registration_out,
+                            struct timeval abs, void *for_libxl) {
+	uintptr_t reg;
+	int rc = xenlightTimeoutRegister((uintptr_t)user, abs.tv_sec, abs.tv_usec,
+	                                 for_libxl, &reg);
+
+	if (!rc)
+		*for_app_registration_out = (void *)reg;
+	return rc;
+}
+
+static int timeout_modify(void *user, void **for_app_registration_update,
+                          struct timeval abs) {
+	return xenlightTimeoutModify((uintptr_t)user,
+	                             (uintptr_t)*for_app_registration_update,
+	                             abs.tv_sec, abs.tv_usec);
+}
+
+static const libxl_osevent_hooks osevent_hooks = {
+	.fd_register = fd_register,
+	.fd_modify = fd_modify,
+	.fd_deregister = fd_deregister,
+	.timeout_register = timeout_register,
+	.timeout_modify = timeout_modify,
+};
+
+void xenlight_set_osevent_hooks(libxl_ctx *ctx, uintptr_t user) {
+	libxl_osevent_register_hooks(ctx, &osevent_hooks, (void *)user);
+}
+
+static void async_callback(libxl_ctx *ctx, int rc, void *for_callback) {
+	xenlightAsyncCallback(rc, (uintptr_t)for_callback);
+}
+
+void xenlight_ao_how_init(libxl_asyncop_how *how, uintptr_t id) {
+	how->callback = async_callback;
+	how->u.for_callback = (void *)id;
+}
 */
 import "C"
 
@@ -97,6 +167,7 @@ type Context struct {
 	logger      *C.xentoollog_logger_stdiostream
 	sigchld     chan os.Signal
 	sigchldDone chan struct{}
+	events      *eventLoop
 }
 
 // Golang always unmasks SIGCHLD, and internally has ways of
@@ -128,6 +199,17 @@ func sigchldHandler(ctx *Context) {
 
 // NewContext returns a new Context.
 func NewContext() (ctx *Context, err error) {
+	return newContext(false)
+}
+
+// NewAsyncContext returns a new Context which runs libxl's event loop in
+// the background, as required by the *Async methods.  Synchronous calls
+// can be made on it as well.
+func NewAsyncContext() (ctx *Context, err error) {
+	return newContext(true)
+}
+
+func newContext(async bool) (ctx *Context, err error) {
 	ctx = &Context{}
 
 	defer func() {
@@ -159,6 +241,12 @@ func NewContext() (ctx *Context, err error) {
 	// ctx.Close(); at which point it will close ctx.sigchldDone.
 	go sigchldHandler(ctx)
 
+	if async {
+		if err = ctx.startEventLoop(); err != nil {
+			return ctx, err
+		}
+	}
+
 	return ctx, nil
 }
 
@@ -176,6 +264,12 @@ func (ctx *Context) Close() error {
 		ctx.sigchldDone = nil
 	}
 
+	// Stop delivering events before the libxl_ctx goes away.  libxl will
+	// still call the deregistration hooks while freeing it.
+	if ctx.events != nil {
+		ctx.stopEventLoop()
+	}
+
 	if ctx.ctx != nil {
 		ret := C.libxl_ctx_free(ctx.ctx)
 		if ret != 0 {
@@ -184,6 +278,10 @@ func (ctx *Context) Close() error {
 		ctx.ctx = nil
 	}
 
+	if ctx.events != nil {
+		ctx.releaseEventLoop()
+	}
+
 	if ctx.logger != nil {
 		C.xtl_logger_destroy((*C.xentoollog_logger)(unsafe.Pointer(ctx.logger)))
 		ctx.logger = nil
@@ -519,10 +617,15 @@ type Bitmap struct {
 }
 
 func (bm *Bitmap) fromC(cbm *C.libxl_bitmap) error {
-	bm.bitmap = nil
-	if size := int(cbm.size); size > 0 {
-		// Alloc a Go slice for the bytes
-		bm.bitmap = make([]C.uint8_t, size)
+	if size := int(cbm.size); size == 0 {
+		bm.bitmap = nil
+	} else {
+		// Alloc a Go slice for the bytes, unless we have room already
+		if cap(bm.bitmap) >= size {
+			bm.bitmap = bm.bitmap[:size]
+		} else {
+			bm.bitmap = make([]C.uint8_t, size)
+		}
 
 		// Make a slice pointing to the C array
 		cs := (*[1 << 30]C.uint8_t)(unsafe.Pointer(cbm._map))[:size:size]
@@ -1074,46 +1177,70 @@ func (ctx *Context) DomainReboot(id Domid) (err error) {
 //libxl_dominfo * libxl_list_domain(libxl_ctx*, int *nb_domain_out);
 //void libxl_dominfo_list_free(libxl_dominfo *list, int nb_domain);
 func (ctx *Context) ListDomain() (glist []Dominfo) {
+	return ctx.ListDomainInto(nil)
+}
+
+// ListDomainInto is like ListDomain, but fills in and returns buf[:0],
+// only allocating if buf is too small.  Callers polling the domain list
+// can pass the previous result back in, so as not to allocate every time.
+func (ctx *Context) ListDomainInto(buf []Dominfo) []Dominfo {
 	var nbDomain C.int
 	clist := C.libxl_list_domain(ctx.ctx, &nbDomain)
 	defer C.libxl_dominfo_list_free(clist, nbDomain)
 
-	if int(nbDomain) == 0 {
-		return
+	return dominfoListFromC(buf[:0], clist, int(nbDomain))
+}
+
+func dominfoListFromC(buf []Dominfo, clist *C.libxl_dominfo, n int) []Dominfo {
+	if n == 0 {
+		return buf
 	}
 
-	gslice := (*[1 << 30]C.libxl_dominfo)(unsafe.Pointer(clist))[:nbDomain:nbDomain]
+	if cap(buf) < n {
+		buf = make([]Dominfo, 0, n)
+	}
+	buf = buf[:n]
+
+	gslice := (*[1 << 30]C.libxl_dominfo)(unsafe.Pointer(clist))[:n:n]
 	for i := range gslice {
-		var info Dominfo
-		_ = info.fromC(&gslice[i])
-		glist = append(glist, info)
+		_ = buf[i].fromC(&gslice[i])
 	}
 
-	return
+	return buf
 }
 
 //libxl_vcpuinfo *libxl_list_vcpu(libxl_ctx *ctx, uint32_t domid,
 //				int *nb_vcpu, int *nr_cpus_out);
 //void libxl_vcpuinfo_list_free(libxl_vcpuinfo *, int nr_vcpus);
 func (ctx *Context) ListVcpu(id Domid) (glist []Vcpuinfo) {
+	return ctx.ListVcpuInto(id, nil)
+}
+
+// ListVcpuInto is like ListVcpu, but reuses buf as ListDomainInto does,
+// including the storage of the elements' cpumaps.
+func (ctx *Context) ListVcpuInto(id Domid, buf []Vcpuinfo) []Vcpuinfo {
 	var nbVcpu C.int
 	var nrCpu C.int
 
 	clist := C.libxl_list_vcpu(ctx.ctx, C.uint32_t(id), &nbVcpu, &nrCpu)
 	defer C.libxl_vcpuinfo_list_free(clist, nbVcpu)
 
-	if int(nbVcpu) == 0 {
-		return
+	n := int(nbVcpu)
+	if n == 0 {
+		return buf[:0]
 	}
 
-	gslice := (*[1 << 30]C.libxl_vcpuinfo)(unsafe.Pointer(clist))[:nbVcpu:nbVcpu]
+	if cap(buf) < n {
+		buf = make([]Vcpuinfo, 0, n)
+	}
+	buf = buf[:n]
+
+	gslice := (*[1 << 30]C.libxl_vcpuinfo)(unsafe.Pointer(clist))[:n:n]
 	for i := range gslice {
-		var info Vcpuinfo
-		_ = info.fromC(&gslice[i])
-		glist = append(glist, info)
+		_ = buf[i].fromC(&gslice[i])
 	}
 
-	return
+	return buf
 }
 
 func (ct ConsoleType) String() (str string) {
@@ -91,6 +91,8 @@ struct libxenvchan {
 	 * during cleanup.
 	 * */
 	char *xs_path;
+	/* how long blocking operations poll the ring before sleeping */
+	unsigned int spin_usec;
 };
 
 /**
@@ -179,3 +181,43 @@ int libxenvchan_is_open(struct libxenvchan* ctrl);
 int libxenvchan_data_ready(struct libxenvchan *ctrl);
 /** Amount of data it is possible to send without blocking */
 int libxenvchan_buffer_space(struct libxenvchan *ctrl);
+/**
+ * Zero-copy receive: finds the data ready to be read, without consuming it.
+ * Only the part up to the end of the ring is returned; the rest is available
+ * after libxenvchan_read_commit().  The data is in memory shared with the
+ * peer, which may still change it: copy anything which needs validating.
+ * @param ctrl The vchan control structure
+ * @param data Set to the start of the data
+ * @return -1 on error, otherwise the amount of contiguous data (which may be
+ *         zero if the vchan is nonblocking)
+ */
+int libxenvchan_read_peek(struct libxenvchan *ctrl, const void **data);
+/**
+ * Consumes data found by libxenvchan_read_peek().
+ * @param size Amount of data consumed, at most what was returned by the peek
+ * @return -1 on error, or $size
+ */
+int libxenvchan_read_commit(struct libxenvchan *ctrl, size_t size);
+/**
+ * Zero-copy send: finds free space in the ring, to be written in place.
+ * As for libxenvchan_read_peek(), only the part up to the end of the ring is
+ * returned.
+ * @param ctrl The vchan control structure
+ * @param data Set to the start of the free space
+ * @return -1 on error, otherwise the amount of contiguous space (which may be
+ *         zero if the vchan is nonblocking)
+ */
+int libxenvchan_write_peek(struct libxenvchan *ctrl, void **data);
+/**
+ * Sends data written in place after libxenvchan_write_peek().
+ * @param size Amount of data written, at most what was returned by the peek
+ * @return -1 on error, or $size
+ */
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size);
+/**
+ * Sets how long blocking operations poll the ring for the peer before
+ * asking it for a notification and sleeping.  While polling, neither side
+ * sends an event, which saves both of them a system call per transfer
+ * when data is streaming.  Defaults to 0 (no polling).
+ */
+void libxenvchan_set_spin(struct libxenvchan *ctrl, unsigned int usec);
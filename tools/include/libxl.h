@@ -127,6 +127,22 @@
  */
 #define LIBXL_HAVE_CPUPOOL_ADD_REM_CPUMAP 1
 
+/* LIBXL_HAVE_CPUPOOL_MOVECPUS
+ *
+ * If this is defined, libxl has a library function called
+ * libxl_cpupool_movecpus, which moves all the cpus specified in a bitmap
+ * from their cpupool (or the free cpus) to another cpupool in a single
+ * operation.
+ */
+#define LIBXL_HAVE_CPUPOOL_MOVECPUS 1
+
+/* LIBXL_HAVE_NUMAINFO_ZEROED
+ *
+ * If this is defined, libxl_numainfo has a zeroed field, holding the amount
+ * of the node's free memory known to be zero-filled.
+ */
+#define LIBXL_HAVE_NUMAINFO_ZEROED 1
+
 /*
  *
  * LIBXL_HAVE_BITMAP_AND_OR
@@ -507,6 +523,13 @@
  */
 #define LIBXL_HAVE_X86_MSR_RELAXED 1
 
+/*
+ * LIBXL_HAVE_X86_IPI_VIRT indicates the toolstack has support for requesting
+ * hardware IPI virtualisation for HVM guests, by setting the
+ * libxl_domain_build_info arch_x86.ipi_virt field.
+ */
+#define LIBXL_HAVE_X86_IPI_VIRT 1
+
 /*
  * LIBXL_HAVE_PHYSINFO_CAP_VPMU indicates that libxl_physinfo has a cap_vpmu
  * field, which indicates the availability of vPMU functionality.
@@ -1419,6 +1442,72 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_CREATEINFO_XEND_SUSPEND_EVTCHN_COMPAT
 
+/*
+ * LIBXL_HAVE_SUSPEND_COMPRESS
+ *
+ * libxl_domain_suspend() accepts LIBXL_SUSPEND_COMPRESS, to elide zero
+ * pages and compress memory in the stream.  The restoring side must be
+ * recent enough to understand such streams.
+ */
+#define LIBXL_HAVE_SUSPEND_COMPRESS 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_MAX_DOWNTIME
+ *
+ * If this is defined, libxl_domain_suspend_max_downtime() is available.
+ */
+#define LIBXL_HAVE_SUSPEND_MAX_DOWNTIME 1
+
+/*
+ * LIBXL_HAVE_CTX_NAME_CACHE
+ *
+ * If this is defined, libxl_ctx_enable_name_cache() is available.
+ */
+#define LIBXL_HAVE_CTX_NAME_CACHE 1
+
+/*
+ * LIBXL_HAVE_CTX_KEEP_QMP_CONNECTIONS
+ *
+ * If this is defined, libxl_ctx_keep_qmp_connections() is available.
+ */
+#define LIBXL_HAVE_CTX_KEEP_QMP_CONNECTIONS 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_PERF_CLASS
+ *
+ * If this is defined, libxl_domain_build_info has the perf_class field.
+ */
+#define LIBXL_HAVE_BUILDINFO_PERF_CLASS 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_SECURITY_GROUP
+ *
+ * If this is defined, libxl_domain_build_info has the security_group field.
+ */
+#define LIBXL_HAVE_BUILDINFO_SECURITY_GROUP 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_HVM_FAST_BOOT
+ *
+ * If this is defined, libxl_domain_build_info has the u.hvm.fast_boot field.
+ */
+#define LIBXL_HAVE_BUILDINFO_HVM_FAST_BOOT 1
+
+/*
+ * LIBXL_HAVE_BUILDINFO_BOOTLOADER_CACHE
+ *
+ * If this is defined, libxl_domain_build_info has the bootloader_cache
+ * field.
+ */
+#define LIBXL_HAVE_BUILDINFO_BOOTLOADER_CACHE 1
+
+/*
+ * LIBXL_HAVE_DOMAIN_FORK
+ *
+ * If this is defined, libxl_domain_fork() is available.
+ */
+#define LIBXL_HAVE_DOMAIN_FORK 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1676,6 +1765,28 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
                     xentoollog_logger *lg);
 int libxl_ctx_free(libxl_ctx *ctx /* 0 is OK */);
 
+/*
+ * Makes libxl_domid_to_name() remember the names it has looked up,
+ * so that long-running applications do not go to xenstore for each
+ * lookup.  Each cached name is covered by a xenstore watch, so the
+ * cache is only kept up to date while the application runs the libxl
+ * event loop (see libxl_event.h); applications which do not should
+ * not enable it.  The cache is released by libxl_ctx_free().
+ */
+int libxl_ctx_enable_name_cache(libxl_ctx *ctx);
+
+/*
+ * Makes libxl keep its connection to a device model's QMP socket open
+ * for idle_ms milliseconds after each operation, so that further
+ * operations on that domain within that time do not have to connect
+ * and negotiate again.  QEMU accepts a single QMP client at a time,
+ * so while a connection is kept open other processes wanting to talk
+ * to that device model wait for up to idle_ms.  Requires the
+ * application to run the libxl event loop.  0 (the default) closes
+ * connections straight away.
+ */
+int libxl_ctx_keep_qmp_connections(libxl_ctx *ctx, int idle_ms);
+
 /* domain related functions */
 
 #define INVALID_DOMID ~0
@@ -1748,6 +1859,24 @@ int libxl_domain_soft_reset(libxl_ctx *ctx,
                             *aop_console_how)
                             LIBXL_EXTERNAL_CALLERS_ONLY;
 
+/*
+ * Creates a new domain from d_config which carries on from where the
+ * domain parent stopped, sharing parent's memory copy-on-write.
+ *
+ * parent must be an HVM domain suspended with libxl_domain_suspend_only,
+ * and stays so; it can be forked any number of times.  d_config must
+ * have the same number of vcpus and memory as parent, and is normally
+ * parent's own configuration with a new name.  Devices are created
+ * afresh from d_config, so disks which parent opened for writing must
+ * be replaced.  The guest's PV drivers reconnect as after a restore.
+ * The new domain is left paused.
+ */
+int libxl_domain_fork(libxl_ctx *ctx, libxl_domain_config *d_config,
+                      uint32_t parent, uint32_t *domid,
+                      const libxl_asyncop_how *ao_how,
+                      const libxl_asyncprogress_how *aop_console_how)
+                      LIBXL_EXTERNAL_CALLERS_ONLY;
+
   /* A progress report will be made via ao_console_how, of type
    * domain_create_console_available, when the domain's primary
    * console is available and can be connected to.
@@ -1781,6 +1910,19 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_COMPRESS 4
+
+/*
+ * As libxl_domain_suspend(), but with LIBXL_SUSPEND_LIVE, keep on with the
+ * live phase until the remaining memory is predicted to be sent within
+ * max_downtime_ms, throttling the domain's vcpus if it dirties memory
+ * faster than it can be sent.  0 means the default policy.
+ */
+int libxl_domain_suspend_max_downtime(libxl_ctx *ctx, uint32_t domid, int fd,
+                                      int flags, /* LIBXL_SUSPEND_* */
+                                      uint32_t max_downtime_ms,
+                                      const libxl_asyncop_how *ao_how)
+                                      LIBXL_EXTERNAL_CALLERS_ONLY;
 
 /*
  * Only suspend domain, do not save its state to file, do not destroy it.
@@ -2729,6 +2871,8 @@ int libxl_cpupool_cpuremove(libxl_ctx *ctx, uint32_t poolid, int cpu);
 int libxl_cpupool_cpuremove_node(libxl_ctx *ctx, uint32_t poolid, int node, int *cpus);
 int libxl_cpupool_cpuremove_cpumap(libxl_ctx *ctx, uint32_t poolid,
                                    const libxl_bitmap *cpumap);
+int libxl_cpupool_movecpus(libxl_ctx *ctx, uint32_t poolid,
+                           const libxl_bitmap *cpumap);
 int libxl_cpupool_movedomain(libxl_ctx *ctx, uint32_t poolid, uint32_t domid);
 int libxl_cpupool_info(libxl_ctx *ctx, libxl_cpupoolinfo *info, uint32_t poolid);
 
@@ -127,6 +127,26 @@ void xencall_free_buffer_pages(xencall_handle *xcall, void *p, size_t nr_pages);
 void *xencall_alloc_buffer(xencall_handle *xcall, size_t size);
 void xencall_free_buffer(xencall_handle *xcall, void *p);
 
+/*
+ * Statistics of the hypercall buffer allocator of a handle, counted
+ * since it was opened.  Allocations are served from a cache of freed
+ * buffers (a hit) or newly mapped (a miss); buffers too big to be
+ * cached are always newly mapped.
+ */
+typedef struct xencall_buffer_stats {
+    unsigned int total_allocations;
+    unsigned int total_releases;
+    unsigned int current_allocations;
+    unsigned int maximum_allocations;
+    unsigned int cache_hits;
+    unsigned int cache_misses;
+    unsigned int cache_toobig;
+    unsigned int cache_pages;   /* Pages currently held in the cache. */
+} xencall_buffer_stats;
+
+int xencall_get_buffer_stats(xencall_handle *xcall,
+                             xencall_buffer_stats *stats);
+
 /*
  * Are allocated hypercall buffers safe to be accessed by the hypervisor all
  * the time?
@@ -744,6 +744,28 @@ int xc_domain_getinfolist(xc_interface *xch,
                           unsigned int max_domains,
                           xc_domaininfo_t *info);
 
+typedef xen_sysctl_domain_stats_t xc_domain_stats_t;
+typedef xen_sysctl_vcpu_stats_t xc_vcpu_stats_t;
+
+/**
+ * This function returns resource accounting statistics for as many domains
+ * as fit in the supplied buffer, using a single (preemptible) hypercall.
+ * Each xc_domain_stats_t record in the buffer is immediately followed by
+ * its nr_vcpus xc_vcpu_stats_t records.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm first_domain IN: the first domain to report on.  OUT: the first
+ *                    domain which didn't fit, or DOMID_INVALID.
+ * @parm buf the buffer to fill with records
+ * @parm size the size of buf in bytes
+ * @parm used OUT: the number of bytes of buf filled
+ * @return the number of domains reported, or -1 on error (ENOBUFS if not
+ *         even the first domain fits)
+ */
+int xc_domain_get_stats(xc_interface *xch,
+                        uint32_t *first_domain,
+                        void *buf, size_t size, size_t *used);
+
 /**
  * This function set p2m for broken page
  * &parm xch a handle to an open hypervisor interface
@@ -892,6 +914,29 @@ long long xc_logdirty_control(xc_interface *xch,
                               unsigned long pages,
                               unsigned int mode,
                               xc_shadow_op_stats_t *stats);
+/*
+ * XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE flavour of the above, covering 'pages'
+ * PFNs from 'first_pfn'.  dirty_bitmap is the bitmap for the entire guest,
+ * of which just the bits for the range are written.  Several such calls
+ * on disjoint ranges can be made in parallel.
+ */
+long long xc_logdirty_control_range(xc_interface *xch,
+                                    uint32_t domid,
+                                    unsigned int sop,
+                                    xc_hypercall_buffer_t *dirty_bitmap,
+                                    unsigned long first_pfn,
+                                    unsigned long pages,
+                                    xc_shadow_op_stats_t *stats);
+
+/*
+ * Per-vCPU dirty rings for a domain in log-dirty mode (HAP only), see
+ * XEN_DOMCTL_SHADOW_OP_DIRTY_RING.  Each ring is mapped with
+ * xenforeignmemory_map_resource(), type XENMEM_resource_dirty_ring and the
+ * vCPU ID as id.  nr_frames of 0 tears the rings down again.
+ */
+int xc_dirty_ring_enable(xc_interface *xch, uint32_t domid,
+                         unsigned int nr_frames);
+int xc_dirty_ring_reset(xc_interface *xch, uint32_t domid);
 
 int xc_get_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t *size);
 int xc_set_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t size);
@@ -1000,6 +1045,46 @@ int xc_domain_p2m_audit(xc_interface *xch,
                         uint64_t *m2p_bad,   
                         uint64_t *p2m_bad);
 
+#if defined(__i386__) || defined(__x86_64__)
+/**
+ * Start merging the 4k p2m entries of an HVM domain back into superpages,
+ * or only query the progress of doing so.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id
+ * @parm start true to start a pass (unless one is in progress), false to
+ *       only retrieve the statistics
+ * @parm stats the statistics of the domain, may be NULL
+ * return 0 on success, -1 on failure
+ * errno values on failure include:
+ *          EBUSY: log-dirty mode is enabled
+ */
+int xc_domain_p2m_recoalesce(xc_interface *xch,
+                             uint32_t domid,
+                             bool start,
+                             struct xen_domctl_p2m_recoalesce *stats);
+
+/**
+ * Retrieve the VM exit counts of an HVM domain per exit reason, with the
+ * cycles spent handling them.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id
+ * @parm vcpu the vcpu, or XEN_DOMCTL_EXIT_STATS_ALL_VCPUS for the sum
+ * @parm vendor set to XEN_DOMCTL_EXIT_STATS_{VMX,SVM}, telling how to
+ *       interpret the reasons
+ * @parm nr_stats IN: length of stats, OUT: number of exit reasons seen
+ * @parm stats an array of nr_stats elements, may be NULL
+ * return 0 on success, -1 on failure
+ */
+int xc_domain_get_exit_stats(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t vcpu,
+                             uint32_t *vendor,
+                             uint32_t *nr_stats,
+                             xen_domctl_exit_stat_t *stats);
+#endif
+
 /**
  * This function sets or clears the requirement that an access memory
  * event listener is required on the domain.
@@ -1022,6 +1107,17 @@ int xc_domain_set_access_required(xc_interface *xch,
  */
 int xc_domain_set_virq_handler(xc_interface *xch, uint32_t domid, int virq);
 
+/**
+ * This function returns the next domain which got shut down, became dying
+ * or was destroyed since it was last returned.  Only the handler of
+ * VIRQ_DOM_EXC may call it.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id, DOMID_INVALID if there are no more changes
+ * return 0 on success, -1 on failure
+ */
+int xc_domain_get_changed(xc_interface *xch, uint32_t *domid);
+
 /*
  * CPUPOOL MANAGEMENT FUNCTIONS
  */
@@ -1099,6 +1195,20 @@ int xc_cpupool_removecpu(xc_interface *xch,
                          uint32_t poolid,
                          int cpu);
 
+/**
+ * Move a set of cpus to a cpupool in one operation. The cpus not yet in the
+ * cpupool must either be free or all be in the same other cpupool. A failed
+ * operation can be retried, cpus already moved are skipped.
+ *
+ * @parm xc_handle a handle to an open hypervisor interface
+ * @parm poolid id of the destination cpupool
+ * @parm cpumap cpus to move
+ * return 0 on success, -1 on failure
+ */
+int xc_cpupool_movecpus(xc_interface *xch,
+                        uint32_t poolid,
+                        xc_cpumap_t cpumap);
+
 /**
  * Move domain to another cpupool.
  *
@@ -1238,6 +1348,35 @@ int xc_domain_getvnuma(xc_interface *xch,
                        unsigned int *vdistance,
                        unsigned int *vcpu_to_vnode);
 
+/*
+ * Retrieve the number of pages of a domain on each host NUMA node
+ * domid: IN, target domid
+ * nr_nodes: IN/OUT, length of pages on input, number of host nodes on
+ *           output, not NULL
+ * pages: OUT, an array which has length of nr_nodes, may be NULL
+ */
+int xc_domain_get_node_pages(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t *nr_nodes,
+                             uint64_t *pages);
+
+/*
+ * Set the performance class of a domain (XEN_DOMCTL_PERF_CLASS_*), a hint
+ * for hardware managed P-states.
+ */
+int xc_domain_set_perf_class(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t perf_class);
+
+/*
+ * Place a domain in a security group, whose members trust each other not
+ * to mount speculative attacks.  0 means no group.  Only possible before
+ * the domain is first unpaused.
+ */
+int xc_domain_set_security_group(xc_interface *xch,
+                                 uint32_t domid,
+                                 uint32_t group);
+
 int xc_domain_soft_reset(xc_interface *xch,
                          uint32_t domid);
 
@@ -1356,6 +1495,20 @@ int xc_domain_populate_physmap_exact(xc_interface *xch,
                                      unsigned int mem_flags,
                                      xen_pfn_t *extent_start);
 
+/*
+ * Populate nr_pages of the guest's physical address space from gfn, using
+ * extents of up to 2^max_order pages.  Disjoint ranges of the same guest may
+ * be populated from several threads concurrently.  *nr_done (if not NULL)
+ * gets the number of pages populated, also on error.
+ */
+int xc_domain_populate_physmap_range(xc_interface *xch,
+                                     uint32_t domid,
+                                     xen_pfn_t gfn,
+                                     unsigned long nr_pages,
+                                     unsigned int max_order,
+                                     unsigned int mem_flags,
+                                     unsigned long *nr_done);
+
 int xc_domain_claim_pages(xc_interface *xch,
                                uint32_t domid,
                                unsigned long nr_pages);
@@ -1421,6 +1574,19 @@ int xc_lockprof_query(xc_interface *xch,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
 
+typedef xen_sysctl_lockcont_data_t xc_lockcont_data_t;
+int xc_lockcont_enable(xc_interface *xch, uint32_t period);
+int xc_lockcont_disable(xc_interface *xch);
+int xc_lockcont_reset(xc_interface *xch);
+int xc_lockcont_query_number(xc_interface *xch,
+                             uint32_t *n_elems);
+int xc_lockcont_query(xc_interface *xch,
+                      uint32_t *n_elems,
+                      uint32_t *period,
+                      uint64_t *time,
+                      uint64_t *dropped,
+                      xc_hypercall_buffer_t *data);
+
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
 /**
@@ -1525,6 +1691,17 @@ int xc_tbuf_set_cpu_mask(xc_interface *xch, xc_cpumap_t mask);
 
 int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask);
 
+/*
+ * Sample the events of the given classes (TRC_* class masks): record only 1
+ * in @period of them, and at most @rate per second on each CPU, in bursts of
+ * up to @burst.  0 means no sampling / no limit.
+ */
+int xc_tbuf_set_sampling(xc_interface *xch, uint32_t classes, uint32_t period,
+                         uint32_t rate, uint32_t burst);
+
+/* Only trace events of @domid (DOMID_INVALID: of any domain). */
+int xc_tbuf_set_domain(xc_interface *xch, domid_t domid);
+
 /**
  * Enable vmtrace for given vCPU.
  *
@@ -1598,6 +1775,49 @@ int xc_vmtrace_get_option(xc_interface *xch, uint32_t domid,
 int xc_vmtrace_set_option(xc_interface *xch, uint32_t domid,
                           uint32_t vcpu, uint64_t key, uint64_t value);
 
+/**
+ * Switch the trace buffer of a given vCPU to streaming mode, in which its
+ * two halves are alternately handed over for draining, starting with the
+ * first one.  Tracing must be disabled.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid domain identifier
+ * @parm vcpu vcpu identifier
+ * @parm threshold bytes in a half at which to hand it over, or 0 for default
+ * @parm flags XEN_DOMCTL_VMTRACE_STREAM_block to pause the vCPU rather than
+ *             lose data, should the consumer fall behind
+ * @parm port remote port to bind to, for notifications of halves to drain
+ * @return 0 on success, -1 on failure
+ */
+int xc_vmtrace_stream_enable(xc_interface *xch, uint32_t domid,
+                             uint32_t vcpu, uint32_t threshold,
+                             uint32_t flags, evtchn_port_t *port);
+
+/**
+ * Leave streaming mode.  Tracing must be disabled.
+ */
+int xc_vmtrace_stream_disable(xc_interface *xch, uint32_t domid,
+                              uint32_t vcpu);
+
+/**
+ * Get the number of bytes to drain from the half handed over, 0 if none.
+ *
+ * @parm flush hand the current half over, should none be waiting
+ * @parm len bytes of trace data at the start of the half
+ * @parm wraps times data was lost to the current half wrapping since the
+ *             last call, or NULL
+ * @return 0 on success, -1 on failure
+ */
+int xc_vmtrace_stream_next(xc_interface *xch, uint32_t domid,
+                           uint32_t vcpu, bool flush, uint64_t *len,
+                           uint64_t *wraps);
+
+/**
+ * Release the half handed over, once its data has been copied.
+ */
+int xc_vmtrace_stream_ack(xc_interface *xch, uint32_t domid,
+                          uint32_t vcpu);
+
 int xc_domctl(xc_interface *xch, struct xen_domctl *domctl);
 int xc_sysctl(xc_interface *xch, struct xen_sysctl *sysctl);
 long xc_memory_op(xc_interface *xch, unsigned int cmd, void *arg, size_t len);
@@ -1885,6 +2105,9 @@ struct xc_cx_stat {
     uint32_t nr_cc;        /* entry nr in cc[] */
     uint64_t *pc;          /* 1-biased indexing (i.e. excl C0) */
     uint64_t *cc;          /* 1-biased indexing (i.e. excl C0) */
+    uint64_t pred_hit;     /* idle predictions which were right */
+    uint64_t pred_early;   /* ... which were too long */
+    uint64_t pred_late;    /* ... which were too short */
 };
 typedef struct xc_cx_stat xc_cx_stat_t;
 
@@ -2015,6 +2238,13 @@ int xc_mem_paging_evict(xc_interface *xch, uint32_t domain_id, uint64_t gfn);
 int xc_mem_paging_prep(xc_interface *xch, uint32_t domain_id, uint64_t gfn);
 int xc_mem_paging_load(xc_interface *xch, uint32_t domain_id,
                        uint64_t gfn, void *buffer);
+/*
+ * Mark nr never populated gfns starting at gfn as paged-out, so that guest
+ * accesses to them get forwarded to the pager, which fills them with
+ * xc_mem_paging_load().
+ */
+int xc_mem_paging_mark_paged(xc_interface *xch, uint32_t domain_id,
+                             uint64_t gfn, uint32_t nr);
 
 /** 
  * Access tracking operations.
@@ -2061,6 +2291,14 @@ int xc_vm_event_get_version(xc_interface *xch);
  * Caller has to unmap this page when done.
  */
 void *xc_monitor_enable(xc_interface *xch, uint32_t domain_id, uint32_t *port);
+/*
+ * Enables the VM event monitor ring with a ring of nr_frames pages allocated
+ * by Xen (see XEN_VM_EVENT_ENABLE_FRAMES).  The caller maps the ring with
+ * xenforeignmemory_map_resource(), type XENMEM_resource_vm_event and id
+ * XEN_DOMCTL_VM_EVENT_OP_MONITOR.
+ */
+int xc_monitor_enable_frames(xc_interface *xch, uint32_t domain_id,
+                             unsigned int nr_frames, uint32_t *port);
 int xc_monitor_disable(xc_interface *xch, uint32_t domain_id);
 int xc_monitor_resume(xc_interface *xch, uint32_t domain_id);
 /*
@@ -2458,6 +2696,33 @@ int xc_kexec_unload(xc_interface *xch, int type);
  */
 int xc_kexec_status(xc_interface *xch, int type);
 
+/*
+ * Batching of independent hypercalls.
+ *
+ * xc_batch_begin() starts a batch, the xc_batch_*() calls below queue
+ * operations in it, returning the entry's index or -1 (ENOSPC once
+ * XC_BATCH_MAX are queued), and xc_batch_submit() issues all of them as
+ * one multicall and frees the batch.
+ *
+ * Entries are independent: all are run, in order, even if earlier ones
+ * fail.  If results is not NULL, results[i] gets 0 or -errno for entry i.
+ * xc_batch_submit() returns 0 if all of them succeeded, or -1 with errno
+ * set from the first failure.
+ */
+#define XC_BATCH_MAX 32
+
+typedef struct xc_batch xc_batch;
+
+xc_batch *xc_batch_begin(xc_interface *xch);
+int xc_batch_domain_max_vcpus(xc_batch *b, uint32_t domid, unsigned int max);
+int xc_batch_domain_setmaxmem(xc_batch *b, uint32_t domid, uint64_t max_memkb);
+int xc_batch_domain_set_tsc_info(xc_batch *b, uint32_t domid,
+                                 uint32_t tsc_mode, uint64_t elapsed_nsec,
+                                 uint32_t gtsc_khz, uint32_t incarnation);
+int xc_batch_hvm_param_set(xc_batch *b, uint32_t dom, uint32_t param,
+                           uint64_t value);
+int xc_batch_submit(xc_batch *b, int *results);
+
 typedef xenpf_resource_entry_t xc_resource_entry_t;
 
 /*
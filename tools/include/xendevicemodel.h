@@ -101,6 +101,38 @@ int xendevicemodel_unmap_io_range_from_ioreq_server(
     xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, int is_mmio,
     uint64_t start, uint64_t end);
 
+/**
+ * This function marks a range of memory, registered for emulation with
+ * xendevicemodel_map_io_range_to_ioreq_server(), as having posted writes:
+ * these get sent through the buffered ioreq ring, as IOREQ_TYPE_COPY_POSTED
+ * records, and the vCPU doesn't wait for their completion.  The IOREQ Server
+ * must have been created with a buffered ioreq ring.
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_map_posted_mmio_range_to_ioreq_server(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id,
+    uint64_t start, uint64_t end);
+
+/**
+ * This function undoes xendevicemodel_map_posted_mmio_range_to_ioreq_server().
+ *
+ * @parm dmod a handle to an open devicemodel interface.
+ * @parm domid the domain id to be serviced
+ * @parm id the IOREQ Server id.
+ * @parm start start of range
+ * @parm end end of range (inclusive).
+ * @return 0 on success, -1 on failure.
+ */
+int xendevicemodel_unmap_posted_mmio_range_from_ioreq_server(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id,
+    uint64_t start, uint64_t end);
+
 /**
  * This function registers/deregisters a memory type for emulation.
  *
@@ -365,6 +397,40 @@ int xendevicemodel_pin_memory_cacheattr(
 int xendevicemodel_nr_vcpus(
     xendevicemodel_handle *dmod, domid_t domid, unsigned int *vcpus);
 
+/*
+ * Batching of independent operations into a single hypercall, for
+ * callers issuing many in a row (e.g. during interrupt storms).
+ *
+ * Operations are queued with the xendevicemodel_batch_* functions, which
+ * return the index of the operation in the batch or -1 with errno set
+ * (ENOSPC once XENDEVICEMODEL_BATCH_MAX are queued).
+ *
+ * xendevicemodel_batch_submit() issues them all and frees the batch.
+ * Every operation runs whether or not earlier ones failed; if @results
+ * is not NULL it receives each one's status (0 or -errno) by index.
+ * Returns 0 if all of them succeeded, or -1 with errno set from the
+ * first failure.  On hypervisors without XEN_DMOP_batch the operations
+ * are issued one by one.
+ */
+#define XENDEVICEMODEL_BATCH_MAX 64
+
+typedef struct xendevicemodel_batch xendevicemodel_batch;
+
+xendevicemodel_batch *xendevicemodel_batch_begin(
+    xendevicemodel_handle *dmod, domid_t domid);
+
+int xendevicemodel_batch_set_pci_intx_level(
+    xendevicemodel_batch *b, uint16_t segment, uint8_t bus, uint8_t device,
+    uint8_t intx, unsigned int level);
+
+int xendevicemodel_batch_set_isa_irq_level(
+    xendevicemodel_batch *b, uint8_t irq, unsigned int level);
+
+int xendevicemodel_batch_inject_msi(
+    xendevicemodel_batch *b, uint64_t msi_addr, uint32_t msi_data);
+
+int xendevicemodel_batch_submit(xendevicemodel_batch *b, int *results);
+
 /**
  * This function restricts the use of this handle to the specified
  * domain.
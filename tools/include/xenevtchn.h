@@ -163,6 +163,23 @@ xenevtchn_pending(xenevtchn_handle *xce);
  */
 int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port);
 
+/*
+ * Like xenevtchn_pending(), but returns up to @nr pending event channels
+ * at once in @ports, saving a system call per event on backends serving
+ * many of them.  Blocks as xenevtchn_pending() does until at least one is
+ * pending.  Returns the number of ports, or -1 on failure, in which case
+ * errno will be set appropriately.
+ */
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int nr);
+
+/*
+ * Unmask the @nr event channels in @ports.  Returns -1 on failure, in which
+ * case errno will be set appropriately.
+ */
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int nr);
+
 /**
  * This function restricts the use of this handle to the specified
  * domain.
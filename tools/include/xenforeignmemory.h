@@ -115,6 +115,15 @@ void *xenforeignmemory_map(xenforeignmemory_handle *fmem, uint32_t dom,
  * combinations are possible due to implementation details on different
  * platforms.
  */
+/*
+ * Flag for xenforeignmemory_map2(), asking for the mapping to be placed
+ * so that 2M aligned runs of contiguous 2M aligned frames in @arr can
+ * be mapped with large pages, where the OS supports it.  The mapping
+ * is made with small pages otherwise, so it is always safe to pass.
+ * Ignored when @addr is given.
+ */
+#define XENFOREIGNMEMORY_MAP_LARGE (1 << 30)
+
 void *xenforeignmemory_map2(xenforeignmemory_handle *fmem, uint32_t dom,
                             void *addr, int prot, int flags, size_t pages,
                             const xen_pfn_t arr[/*pages*/], int err[/*pages*/]);
@@ -194,6 +203,53 @@ int xenforeignmemory_resource_size(
     xenforeignmemory_handle *fmem, domid_t domid, unsigned int type,
     unsigned int id, size_t *size);
 
+/*
+ * A cache of mappings of one domain's memory, for callers which access
+ * the same guest pages over and over (e.g. device models), to save
+ * mapping and unmapping them each time.  Guest frames are mapped in 2M
+ * aligned buckets, and unreferenced buckets are unmapped least
+ * recently used first once more than max_buckets are mapped.
+ *
+ * The cache does not notice when the guest's p2m changes (ballooning,
+ * sharing, ...): callers must use xenforeignmemory_cache_invalidate()
+ * for gfns which may have been remapped.
+ *
+ * A cache may be used from several threads at once.
+ */
+typedef struct xenforeignmemory_cache xenforeignmemory_cache;
+
+/*
+ * Returns NULL and sets errno on failure.  prot is as for
+ * xenforeignmemory_map().
+ */
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot,
+    size_t max_buckets);
+
+/* Unmaps everything, whether or not it is still referenced. */
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache);
+
+/*
+ * Returns the address of gfn, and takes a reference on its mapping,
+ * which stays valid until it is dropped with xenforeignmemory_cache_put().
+ * Returns NULL and sets errno if the page cannot be mapped.
+ */
+void *xenforeignmemory_cache_get(xenforeignmemory_cache *cache,
+                                 xen_pfn_t gfn);
+
+/*
+ * Drops the reference taken by xenforeignmemory_cache_get() which
+ * returned addr.  Returns 0 on success, or sets errno and returns -1.
+ */
+int xenforeignmemory_cache_put(xenforeignmemory_cache *cache, void *addr);
+
+/*
+ * Discards the cached mappings of gfn .. gfn + num - 1.  Mappings still
+ * referenced stay valid until their last put; later gets map afresh.
+ */
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t num);
+
 #endif
 
 /*
@@ -356,6 +356,54 @@ int xengnttab_dmabuf_imp_to_refs(xengnttab_handle *xgt, uint32_t domid,
  */
 int xengnttab_dmabuf_imp_release(xengnttab_handle *xgt, uint32_t fd);
 
+/*
+ * Grant mapping pool: keeps grants mapped across requests, for backends
+ * whose frontends reuse the same grants (e.g. blkif "feature-persistent").
+ * Only use it for such grants: the pool cannot tell when a frontend ends
+ * a grant, and would keep mapping the old page.
+ *
+ * Grants missing from the pool are mapped in one batch.  Unreferenced
+ * grants are unmapped, least recently used first, once more than
+ * @max_grants are mapped.  A pool may be used from several threads.
+ */
+typedef struct xengnttab_pool xengnttab_pool;
+
+typedef struct xengnttab_pool_stats {
+    uint64_t hits;       /* grants found mapped */
+    uint64_t misses;     /* grants which had to be mapped */
+    uint64_t evictions;  /* grants dropped from the pool */
+    uint32_t entries;    /* grants in the pool */
+    uint32_t mapped;     /* pages mapped, including ones of evicted grants
+                            sharing a batch with ones still in the pool */
+} xengnttab_pool_stats;
+
+xengnttab_pool *xengnttab_pool_create(xengnttab_handle *xgt, int prot,
+                                      uint32_t max_grants);
+
+/* Unmaps everything, whether or not it is still referenced. */
+void xengnttab_pool_destroy(xengnttab_pool *pool);
+
+/*
+ * Looks up, or maps, the @count grants @refs of @domid and takes a
+ * reference on each, returning their addresses in @addrs.  Returns 0 on
+ * success, or -1 with errno set, in which case no references are held.
+ */
+int xengnttab_pool_get(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                       const uint32_t *refs, void **addrs);
+
+/* Drops the references taken by xengnttab_pool_get(). */
+void xengnttab_pool_put(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                        const uint32_t *refs);
+
+/*
+ * Unmaps the unreferenced grants of @domid, e.g. when its frontend
+ * disconnects.  Returns the number of grants still referenced.
+ */
+int xengnttab_pool_flush(xengnttab_pool *pool, uint32_t domid);
+
+void xengnttab_pool_get_stats(xengnttab_pool *pool,
+                              xengnttab_pool_stats *stats);
+
 /*
  * Grant Sharing Interface (allocating and granting pages to others)
  */
@@ -26,6 +26,23 @@
 
 #define XCFLAGS_LIVE      (1 << 0)
 #define XCFLAGS_DEBUG     (1 << 1)
+/* Elide zero pages and compress memory.  The restorer must support it. */
+#define XCFLAGS_COMPRESS  (1 << 2)
+/*
+ * Describe the guest's populated memory up front, so the restorer can
+ * allocate it as superpages.  Ignored for PV guests.
+ */
+#define XCFLAGS_MEMORY_LAYOUT (1 << 3)
+/*
+ * Remus: copy each checkpoint's dirty pages while the guest is suspended, and
+ * send them once it has been resumed.
+ */
+#define XCFLAGS_CHECKPOINT_SNAPSHOT (1 << 4)
+/*
+ * Non-live HVM save to a regular file: lay the page data out at pfn offsets
+ * in the file, for restore to read in parallel.  Ignored otherwise.
+ */
+#define XCFLAGS_INDEXED   (1 << 5)
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -184,6 +201,7 @@ struct xc_dom_image {
     xc_interface *xch;
     uint32_t guest_domid;
     int claim_enabled; /* 0 by default, 1 enables it */
+    unsigned int populate_threads; /* HVM: threads populating the p2m, 0/1 is serial */
 
     int xen_version;
     xen_capabilities_info_t xen_caps;
@@ -439,6 +457,9 @@ struct precopy_stats
     unsigned int iteration;
     unsigned long total_written;
     long dirty_count; /* -1 if unknown */
+    /* Estimates from the previous iteration, in pages/s.  0 if unknown. */
+    unsigned long dirty_rate;
+    unsigned long send_rate;
 };
 
 /*
@@ -469,6 +490,15 @@ struct save_callbacks {
                                         * remaining dirty pages. */
     precopy_policy_t precopy_policy;
 
+    /*
+     * Not a callback: if non-zero and precopy_policy is NULL, the target
+     * downtime (in ms) of the stop-and-copy phase.  Precopy then carries on
+     * until the remaining dirty pages are predicted to be sent within it,
+     * throttling the guest (through its scheduler cap) if it dirties memory
+     * faster than it can be sent.
+     */
+    unsigned int max_downtime_ms;
+
     /*
      * Called after the guest's dirty pages have been
      *  copied into an output buffer.
@@ -534,6 +564,51 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
                    uint32_t flags, struct save_callbacks *callbacks,
                    xc_stream_type_t stream_type, int recv_fd);
 
+/**
+ * This function will save a running domain, sending its memory over several
+ * data channels in parallel, alongside the main stream.
+ *
+ * Only supported for HVM domains and XC_STREAM_PLAIN streams.  XCFLAGS_DEBUG
+ * doesn't verify the memory sent.  The restoring side must use
+ * xc_domain_restore_parallel() with as many data channels.
+ *
+ * @param xch a handle to an open hypervisor interface
+ * @param io_fd the file descriptor to save a domain to
+ * @param data_fds the file descriptors of the data channels
+ * @param nr_data_fds the number of data channels (at most 64)
+ * @param dom the id of the domain
+ * @param flags XCFLAGS_xxx
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_save_parallel(xc_interface *xch, int io_fd,
+                            const int *data_fds, unsigned int nr_data_fds,
+                            uint32_t dom, uint32_t flags,
+                            struct save_callbacks *callbacks);
+
+/**
+ * This function will live migrate a running HVM domain using post-copy:
+ * when the precopy policy stops, the pages still dirty are not sent with the
+ * domain suspended.  Instead the primary stream ends early, and those pages
+ * follow over postcopy_fd, requested by the restoring side as the guest
+ * touches them there, and pushed in the background otherwise.
+ *
+ * A precopy policy stopping straight away gives pure post-copy.  The call
+ * returns once every page has been sent.  The restoring side must use
+ * xc_domain_restore_postcopy().  If either side fails after the primary
+ * stream has ended, the guest is lost.
+ *
+ * @param xch a handle to an open hypervisor interface
+ * @param io_fd the file descriptor to save a domain to
+ * @param postcopy_fd a bidirectional file descriptor (e.g. a socket) for the
+ *        post-copy phase
+ * @param dom the id of the domain
+ * @param flags XCFLAGS_xxx, which must include XCFLAGS_LIVE
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_save_postcopy(xc_interface *xch, int io_fd, int postcopy_fd,
+                            uint32_t dom, uint32_t flags,
+                            struct save_callbacks *callbacks);
+
 /* callbacks provided by xc_domain_restore */
 struct restore_callbacks {
     /*
@@ -583,6 +658,15 @@ struct restore_callbacks {
     void (*restore_results)(xen_pfn_t store_gfn, xen_pfn_t console_gfn,
                             void *data);
 
+    /*
+     * Post-copy only: called once the primary stream has been restored,
+     * after restore_results().  The callback unpauses the guest, which
+     * carries on running while its remaining memory is paged in.
+     *
+     * returns 0 to carry on, non-zero on failure.
+     */
+    int (*postcopy_resume)(void *data);
+
     /* to be provided as the last argument to each callback function */
     void *data;
 };
@@ -616,6 +700,49 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       xc_stream_type_t stream_type,
                       struct restore_callbacks *callbacks, int send_back_fd);
 
+/**
+ * This function will restore a domain saved by xc_domain_save_parallel(),
+ * receiving its memory over the data channels in parallel.
+ *
+ * @param xch a handle to an open hypervisor interface
+ * @param io_fd the file descriptor to restore a domain from
+ * @param data_fds the file descriptors of the data channels, in the order
+ *        the saving side used
+ * @param nr_data_fds the number of data channels
+ * Other parameters as for xc_domain_restore(), with a XC_STREAM_PLAIN stream.
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_restore_parallel(xc_interface *xch, int io_fd,
+                               const int *data_fds, unsigned int nr_data_fds,
+                               uint32_t dom, unsigned int store_evtchn,
+                               unsigned long *store_mfn, uint32_t store_domid,
+                               unsigned int console_evtchn,
+                               unsigned long *console_mfn,
+                               uint32_t console_domid,
+                               struct restore_callbacks *callbacks);
+
+/**
+ * This function will restore a domain saved by xc_domain_save_postcopy().
+ *
+ * Once the primary stream ends, the pages the sender left behind are marked
+ * as paged out, and the postcopy_resume() callback gets the guest running.
+ * The call then acts as the domain's pager, fetching pages over postcopy_fd
+ * as the guest touches them, until the sender has sent them all.  Requires
+ * HAP, and neither passthrough nor PoD.
+ *
+ * @param postcopy_fd the other end of the saving side's postcopy_fd
+ * Other parameters as for xc_domain_restore(), with a XC_STREAM_PLAIN stream.
+ * callbacks must provide restore_results() and postcopy_resume().
+ * @return 0 on success, -1 on failure
+ */
+int xc_domain_restore_postcopy(xc_interface *xch, int io_fd, int postcopy_fd,
+                               uint32_t dom, unsigned int store_evtchn,
+                               unsigned long *store_mfn, uint32_t store_domid,
+                               unsigned int console_evtchn,
+                               unsigned long *console_mfn,
+                               uint32_t console_domid,
+                               struct restore_callbacks *callbacks);
+
 /**
  * This function will create a domain for a paravirtualized Linux
  * using file names pointing to kernel and ramdisk
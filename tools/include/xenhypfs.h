@@ -76,6 +76,23 @@ struct xenhypfs_dirent *xenhypfs_readdir(xenhypfs_handle *fshdl,
                                          const char *path,
                                          unsigned int *num_entries);
 
+/*
+ * Called by xenhypfs_read_tree() for each entry, with its contents in
+ * raw form (NULL for directories).  A non-zero return value stops the
+ * walk, and is returned by xenhypfs_read_tree().
+ */
+typedef int xenhypfs_tree_fn(const char *path,
+                             const struct xenhypfs_dirent *dirent,
+                             const void *content, void *arg);
+
+/*
+ * Walk a Xen hypfs entry and everything below it, depth first, reading
+ * as many entries per hypercall as possible.
+ * Returns 0 when done, or -1 with errno set on error.
+ */
+int xenhypfs_read_tree(xenhypfs_handle *fshdl, const char *path,
+                       xenhypfs_tree_fn *fn, void *arg);
+
 /*
  * Write a Xen hypfs entry with a value. The value is converted from a string
  * to the appropriate type.
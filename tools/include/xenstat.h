@@ -29,6 +29,7 @@ typedef struct xenstat_node xenstat_node;
 typedef struct xenstat_vcpu xenstat_vcpu;
 typedef struct xenstat_network xenstat_network;
 typedef struct xenstat_vbd xenstat_vbd;
+typedef struct xenstat_vmexit xenstat_vmexit;
 
 /* Initialize the xenstat library.  Returns a handle to be used with
  * subsequent calls to the xenstat library, or NULL if an error occurs. */
@@ -42,6 +43,7 @@ void xenstat_uninit(xenstat_handle * handle);
 #define XENSTAT_NETWORK 0x2
 #define XENSTAT_XEN_VERSION 0x4
 #define XENSTAT_VBD 0x8
+#define XENSTAT_VMEXIT 0x10 /* Costly, hence not part of XENSTAT_ALL */
 #define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD)
 
 /* Get all available information about a node */
@@ -50,6 +52,18 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
 /* Free the information */
 void xenstat_free_node(xenstat_node * node);
 
+/* Incremental variant of xenstat_get_node(), for callers refreshing the
+ * information periodically with the same handle.  Per-domain data which
+ * rarely changes (names, and the network interfaces and block devices of
+ * each domain) is cached in the handle, and only refreshed when xenstore
+ * reports a domain being renamed, domains coming and going, or backend
+ * devices changing.  If prev is not NULL, it must be the node returned by the
+ * previous call; it is used for the delta queries below, and can be freed
+ * as soon as this returns. */
+xenstat_node *xenstat_get_node_incremental(xenstat_handle * handle,
+					   unsigned int flags,
+					   xenstat_node * prev);
+
 /*
  * Node functions - extract information from a xenstat_node
  */
@@ -71,6 +85,11 @@ unsigned long long xenstat_node_tot_mem(xenstat_node * node);
 /* Get amount of free memory on a node */
 unsigned long long xenstat_node_free_mem(xenstat_node * node);
 
+/* Get the time elapsed since the previous node, in nanoseconds.  Only
+ * available for nodes from xenstat_get_node_incremental() with a previous
+ * node, 0 otherwise. */
+unsigned long long xenstat_node_delta_ns(xenstat_node * node);
+
 /* Get amount of freeable memory on a node */
 long xenstat_node_freeable_mb(xenstat_node * node);
 
@@ -96,6 +115,10 @@ char *xenstat_domain_name(xenstat_domain * domain);
 /* Get information about how much CPU time has been used */
 unsigned long long xenstat_domain_cpu_ns(xenstat_domain * domain);
 
+/* Get domain CPU usage since the previous node, in nanoseconds (see
+ * xenstat_node_delta_ns()); 0 if the domain didn't exist back then */
+unsigned long long xenstat_domain_cpu_ns_delta(xenstat_domain * domain);
+
 /* Find the number of VCPUs allocated to a domain */
 unsigned int xenstat_domain_num_vcpus(xenstat_domain * domain);
 
@@ -134,6 +157,18 @@ unsigned int xenstat_domain_num_vbds(xenstat_domain *);
 xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 				    unsigned int vbd);
 
+/* Get the number of VM exit reasons seen for a given (HVM) domain */
+unsigned int xenstat_domain_num_vmexits(xenstat_domain *);
+
+/* Get the handle to obtain the stats of one VM exit reason */
+xenstat_vmexit *xenstat_domain_vmexit(xenstat_domain * domain,
+				      unsigned int vmexit);
+
+/* Get how to interpret the VM exit reasons of a domain */
+#define XENSTAT_VMEXIT_VMX 1	/* VMX basic exit reasons */
+#define XENSTAT_VMEXIT_SVM 2	/* SVM exit codes */
+unsigned int xenstat_domain_vmexit_vendor(xenstat_domain * domain);
+
 /*
  * VCPU functions - extract information from a xenstat_vcpu
  */
@@ -142,6 +177,20 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 unsigned int xenstat_vcpu_online(xenstat_vcpu * vcpu);
 unsigned long long xenstat_vcpu_ns(xenstat_vcpu * vcpu);
 
+/* Get VCPU usage since the previous node (see xenstat_node_delta_ns()) */
+unsigned long long xenstat_vcpu_ns_delta(xenstat_vcpu * vcpu);
+
+/*
+ * VM exit functions - extract information from a xenstat_vmexit
+ */
+
+/* Get the VMX basic exit reason or SVM exit code */
+unsigned int xenstat_vmexit_reason(xenstat_vmexit * vmexit);
+/* Get the number of exits, summed over all VCPUs */
+unsigned long long xenstat_vmexit_count(xenstat_vmexit * vmexit);
+/* Get the cycles spent from the exits to the following VM entries */
+unsigned long long xenstat_vmexit_cycles(xenstat_vmexit * vmexit);
+
 
 /*
  * Network functions - extract information from a xenstat_network
@@ -125,6 +125,29 @@ bool xs_mkdir(struct xs_handle *h, xs_transaction_t t,
 bool xs_rm(struct xs_handle *h, xs_transaction_t t,
 	   const char *path);
 
+/* Several node operations in one message (XS_MULTI).
+ * Each of ops[] is one of XS_READ, XS_WRITE, XS_MKDIR, XS_RM, XS_DIRECTORY,
+ * XS_DIRECTORY_PART, XS_GET_PERMS or XS_SET_PERMS on path, with data as
+ * the rest of its payload (e.g. the value to write).  They are run in order
+ * until the first one failing; with atomic set, either all of them take
+ * effect or none.
+ * Returns false on failure of the request as a whole.  Otherwise each
+ * op's err is 0, its errno, or ECANCELED if it wasn't run; a successful
+ * op's reply is malloced and nul terminated: call free() on it after use.
+ */
+struct xs_multi_op {
+	enum xsd_sockmsg_type type;
+	const char *path;
+	const void *data;
+	unsigned int len;
+
+	int err;
+	void *reply;
+	unsigned int reply_len;
+};
+bool xs_multi(struct xs_handle *h, xs_transaction_t t, bool atomic,
+	      struct xs_multi_op *ops, unsigned int num_ops);
+
 /* Fake function which will always return false (required to let
  * libxenstore remain at 3.0 version.
  */
@@ -268,6 +291,43 @@ char *xs_debug_command(struct xs_handle *h, const char *cmd,
 		       void *data, unsigned int len);
 
 int xs_suspend_evtchn_port(int domid);
+
+/* Asynchronous requests.
+ *
+ * xs_submit() and the *_async() variants send a request without waiting
+ * for its reply, so that many requests can be in flight on one handle.
+ * They return false if the request couldn't be sent; its callback is not
+ * called then.  Requests and synchronous calls made in between are
+ * processed by the daemon in the order they were issued.
+ *
+ * Replies are collected by xs_async_wait(), which runs the callback of
+ * every outstanding request in submission order, from the calling thread.
+ * The callback gets err == 0 and the nul terminated reply (only valid
+ * during the callback), or the errno the request failed with and a NULL
+ * reply.  The callback may be NULL, and it may submit further requests.
+ * Submitting can also run callbacks of older requests, if too many are
+ * outstanding.
+ */
+typedef void xs_async_done(struct xs_handle *h, void *cbdata, int err,
+			   const char *reply, unsigned int len);
+
+bool xs_submit(struct xs_handle *h, xs_transaction_t t,
+	       enum xsd_sockmsg_type type,
+	       const void *data, unsigned int len,
+	       xs_async_done *done, void *cbdata);
+bool xs_write_async(struct xs_handle *h, xs_transaction_t t,
+		    const char *path, const void *data, unsigned int len,
+		    xs_async_done *done, void *cbdata);
+bool xs_set_permissions_async(struct xs_handle *h, xs_transaction_t t,
+			      const char *path,
+			      struct xs_permissions *perms,
+			      unsigned int num_perms,
+			      xs_async_done *done, void *cbdata);
+
+/* Wait for all outstanding asynchronous requests to complete.
+ * Returns false if the connection failed on the way.
+ */
+bool xs_async_wait(struct xs_handle *h);
 #endif /* XENSTORE_H */
 
 /*
@@ -23,14 +23,16 @@
 #define DBGPRINTF(_m...) \
     xtl_log(xcall->logger, XTL_DEBUG, -1, "xencall:buffer", _m)
 
-pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
-
+/*
+ * The cache is per handle, so threads using different handles never
+ * contend; the lock is held only for a few instructions.
+ */
 static void cache_lock(xencall_handle *xcall)
 {
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_lock(&cache_mutex);
+    pthread_mutex_lock(&xcall->cache_mutex);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
@@ -40,7 +42,7 @@ static void cache_unlock(xencall_handle *xcall)
     int saved_errno = errno;
     if ( xcall->flags & XENCALL_OPENFLAG_NON_REENTRANT )
         return;
-    pthread_mutex_unlock(&cache_mutex);
+    pthread_mutex_unlock(&xcall->cache_mutex);
     /* Ignore pthread errors. */
     errno = saved_errno;
 }
@@ -56,13 +58,14 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
     if ( xcall->buffer_current_allocations > xcall->buffer_maximum_allocations )
         xcall->buffer_maximum_allocations = xcall->buffer_current_allocations;
 
-    if ( nr_pages > 1 )
+    if ( !nr_pages || nr_pages > BUFFER_CACHE_MAX_PAGES )
     {
         xcall->buffer_cache_toobig++;
     }
-    else if ( xcall->buffer_cache_nr > 0 )
+    else if ( xcall->buffer_cache_nr[nr_pages - 1] > 0 )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
+        p = xcall->buffer_cache[nr_pages - 1]
+                               [--xcall->buffer_cache_nr[nr_pages - 1]];
         xcall->buffer_cache_hits++;
     }
     else
@@ -78,17 +81,21 @@ static void *cache_alloc(xencall_handle *xcall, size_t nr_pages)
 static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
 {
     int rc = 0;
+    int *nr;
 
     cache_lock(xcall);
 
     xcall->buffer_total_releases++;
     xcall->buffer_current_allocations--;
 
-    if ( nr_pages == 1 &&
-         xcall->buffer_cache_nr < BUFFER_CACHE_SIZE )
+    if ( nr_pages && nr_pages <= BUFFER_CACHE_MAX_PAGES )
     {
-        xcall->buffer_cache[xcall->buffer_cache_nr++] = p;
-        rc = 1;
+        nr = &xcall->buffer_cache_nr[nr_pages - 1];
+        if ( *nr < BUFFER_CACHE_SIZE )
+        {
+            xcall->buffer_cache[nr_pages - 1][(*nr)++] = p;
+            rc = 1;
+        }
     }
 
     cache_unlock(xcall);
@@ -98,6 +105,7 @@ static int cache_free(xencall_handle *xcall, void *p, size_t nr_pages)
 
 void buffer_release_cache(xencall_handle *xcall)
 {
+    size_t i;
     void *p;
 
     cache_lock(xcall);
@@ -108,22 +116,46 @@ void buffer_release_cache(xencall_handle *xcall)
     DBGPRINTF("current allocations:%d maximum allocations:%d",
               xcall->buffer_current_allocations,
               xcall->buffer_maximum_allocations);
-    DBGPRINTF("cache current size:%d",
-              xcall->buffer_cache_nr);
     DBGPRINTF("cache hits:%d misses:%d toobig:%d",
               xcall->buffer_cache_hits,
               xcall->buffer_cache_misses,
               xcall->buffer_cache_toobig);
 
-    while ( xcall->buffer_cache_nr > 0 )
+    for ( i = 0; i < BUFFER_CACHE_MAX_PAGES; i++ )
     {
-        p = xcall->buffer_cache[--xcall->buffer_cache_nr];
-        osdep_free_pages(xcall, p, 1);
+        while ( xcall->buffer_cache_nr[i] > 0 )
+        {
+            p = xcall->buffer_cache[i][--xcall->buffer_cache_nr[i]];
+            osdep_free_pages(xcall, p, i + 1);
+        }
     }
 
     cache_unlock(xcall);
 }
 
+int xencall_get_buffer_stats(xencall_handle *xcall,
+                             xencall_buffer_stats *stats)
+{
+    size_t i;
+
+    cache_lock(xcall);
+
+    stats->total_allocations = xcall->buffer_total_allocations;
+    stats->total_releases = xcall->buffer_total_releases;
+    stats->current_allocations = xcall->buffer_current_allocations;
+    stats->maximum_allocations = xcall->buffer_maximum_allocations;
+    stats->cache_hits = xcall->buffer_cache_hits;
+    stats->cache_misses = xcall->buffer_cache_misses;
+    stats->cache_toobig = xcall->buffer_cache_toobig;
+    stats->cache_pages = 0;
+    for ( i = 0; i < BUFFER_CACHE_MAX_PAGES; i++ )
+        stats->cache_pages += xcall->buffer_cache_nr[i] * (i + 1);
+
+    cache_unlock(xcall);
+
+    return 0;
+}
+
 void *xencall_alloc_buffer_pages(xencall_handle *xcall, size_t nr_pages)
 {
     void *p = cache_alloc(xcall, nr_pages);
@@ -14,6 +14,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "private.h"
 
@@ -44,7 +45,8 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
     xentoolcore__register_active_handle(&xcall->tc_ah);
 
     xcall->flags = open_flags;
-    xcall->buffer_cache_nr = 0;
+    pthread_mutex_init(&xcall->cache_mutex, NULL);
+    memset(xcall->buffer_cache_nr, 0, sizeof(xcall->buffer_cache_nr));
 
     xcall->buffer_total_allocations = 0;
     xcall->buffer_total_releases = 0;
@@ -71,6 +73,7 @@ xencall_handle *xencall_open(xentoollog_logger *logger, unsigned open_flags)
 err:
     xentoolcore__deregister_active_handle(&xcall->tc_ah);
     osdep_xencall_close(xcall);
+    pthread_mutex_destroy(&xcall->cache_mutex);
     xtl_logger_destroy(xcall->logger_tofree);
     free(xcall);
     return NULL;
@@ -86,6 +89,7 @@ int xencall_close(xencall_handle *xcall)
     xentoolcore__deregister_active_handle(&xcall->tc_ah);
     rc = osdep_xencall_close(xcall);
     buffer_release_cache(xcall);
+    pthread_mutex_destroy(&xcall->cache_mutex);
     xtl_logger_destroy(xcall->logger_tofree);
     free(xcall);
     return rc;
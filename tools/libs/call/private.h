@@ -1,6 +1,8 @@
 #ifndef XENCALL_PRIVATE_H
 #define XENCALL_PRIVATE_H
 
+#include <pthread.h>
+
 #include <xentoollog.h>
 #include <xentoolcore_internal.h>
 
@@ -31,17 +33,19 @@ struct xencall_handle {
     Xentoolcore__Active_Handle tc_ah;
 
     /*
-     * A simple cache of unused, single page, hypercall buffers
+     * A cache of unused hypercall buffers, with a stack per size for
+     * buffers of up to BUFFER_CACHE_MAX_PAGES pages.
      *
-     * Protected by a global lock.
+     * Protected by cache_mutex, unless the handle is non-reentrant.
      */
-#define BUFFER_CACHE_SIZE 4
-    int buffer_cache_nr;
-    void *buffer_cache[BUFFER_CACHE_SIZE];
+#define BUFFER_CACHE_SIZE 8
+#define BUFFER_CACHE_MAX_PAGES 4
+    pthread_mutex_t cache_mutex;
+    int buffer_cache_nr[BUFFER_CACHE_MAX_PAGES];
+    void *buffer_cache[BUFFER_CACHE_MAX_PAGES][BUFFER_CACHE_SIZE];
 
     /*
-     * Hypercall buffer statistics. All protected by the global
-     * buffer_cache lock.
+     * Hypercall buffer statistics. All protected by cache_mutex.
      */
     int buffer_total_allocations;
     int buffer_total_releases;
@@ -0,0 +1,224 @@
+/*
+ * xc_batch.c
+ *
+ * Batching of independent hypercalls into a single multicall.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "xc_private.h"
+
+/*
+ * Only operations which pass all of their input in one structure and
+ * return nothing but a status can be batched: nothing is copied back.
+ */
+typedef union {
+    struct xen_domctl domctl;
+    xen_hvm_param_t hvm_param;
+} xc_batch_arg_t;
+
+/* Copied into a hypercall buffer on submission, calls[] pointing into args[]. */
+struct xc_batch_buf {
+    multicall_entry_t calls[XC_BATCH_MAX];
+    xc_batch_arg_t args[XC_BATCH_MAX];
+};
+
+struct xc_batch {
+    xc_interface *xch;
+    unsigned int nr;
+    struct xc_batch_buf q;
+};
+
+xc_batch *xc_batch_begin(xc_interface *xch)
+{
+    xc_batch *b = calloc(1, sizeof(*b));
+
+    if ( b )
+        b->xch = xch;
+
+    return b;
+}
+
+static int batch_add(xc_batch *b, unsigned long op, unsigned long arg0,
+                     xc_batch_arg_t **arg)
+{
+    if ( b->nr == XC_BATCH_MAX )
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memset(&b->q.calls[b->nr], 0, sizeof(b->q.calls[b->nr]));
+    memset(&b->q.args[b->nr], 0, sizeof(b->q.args[b->nr]));
+    b->q.calls[b->nr].op = op;
+    b->q.calls[b->nr].args[0] = arg0;
+    *arg = &b->q.args[b->nr];
+
+    return b->nr++;
+}
+
+static int batch_add_domctl(xc_batch *b, struct xen_domctl **domctl)
+{
+    xc_batch_arg_t *arg;
+    int idx = batch_add(b, __HYPERVISOR_domctl, 0, &arg);
+
+    if ( idx < 0 )
+        return idx;
+
+    *domctl = &arg->domctl;
+    (*domctl)->interface_version = XEN_DOMCTL_INTERFACE_VERSION;
+
+    return idx;
+}
+
+int xc_batch_domain_max_vcpus(xc_batch *b, uint32_t domid, unsigned int max)
+{
+    struct xen_domctl *domctl;
+    int idx = batch_add_domctl(b, &domctl);
+
+    if ( idx < 0 )
+        return idx;
+
+    domctl->cmd = XEN_DOMCTL_max_vcpus;
+    domctl->domain = domid;
+    domctl->u.max_vcpus.max = max;
+
+    return idx;
+}
+
+int xc_batch_domain_setmaxmem(xc_batch *b, uint32_t domid, uint64_t max_memkb)
+{
+    struct xen_domctl *domctl;
+    int idx = batch_add_domctl(b, &domctl);
+
+    if ( idx < 0 )
+        return idx;
+
+    domctl->cmd = XEN_DOMCTL_max_mem;
+    domctl->domain = domid;
+    domctl->u.max_mem.max_memkb = max_memkb;
+
+    return idx;
+}
+
+int xc_batch_domain_set_tsc_info(xc_batch *b, uint32_t domid,
+                                 uint32_t tsc_mode, uint64_t elapsed_nsec,
+                                 uint32_t gtsc_khz, uint32_t incarnation)
+{
+    struct xen_domctl *domctl;
+    int idx = batch_add_domctl(b, &domctl);
+
+    if ( idx < 0 )
+        return idx;
+
+    domctl->cmd = XEN_DOMCTL_settscinfo;
+    domctl->domain = domid;
+    domctl->u.tsc_info.tsc_mode = tsc_mode;
+    domctl->u.tsc_info.elapsed_nsec = elapsed_nsec;
+    domctl->u.tsc_info.gtsc_khz = gtsc_khz;
+    domctl->u.tsc_info.incarnation = incarnation;
+
+    return idx;
+}
+
+int xc_batch_hvm_param_set(xc_batch *b, uint32_t dom, uint32_t param,
+                           uint64_t value)
+{
+    xc_batch_arg_t *arg;
+    int idx = batch_add(b, __HYPERVISOR_hvm_op, HVMOP_set_param, &arg);
+
+    if ( idx < 0 )
+        return idx;
+
+    arg->hvm_param.domid = dom;
+    arg->hvm_param.index = param;
+    arg->hvm_param.value = value;
+
+    return idx;
+}
+
+int xc_batch_submit(xc_batch *b, int *results)
+{
+    xc_interface *xch = b->xch;
+    DECLARE_HYPERCALL_BUFFER(struct xc_batch_buf, buf);
+    unsigned int i, argi;
+    int rc = -1, err = 0;
+
+    if ( !b->nr )
+    {
+        rc = 0;
+        goto out;
+    }
+
+    buf = xc_hypercall_buffer_alloc(xch, buf, sizeof(*buf));
+    if ( !buf )
+    {
+        PERROR("Could not allocate memory for batch hypercall");
+        goto out;
+    }
+
+    memcpy(buf->calls, b->q.calls, sizeof(b->q.calls[0]) * b->nr);
+    memcpy(buf->args, b->q.args, sizeof(b->q.args[0]) * b->nr);
+    for ( i = 0; i < b->nr; i++ )
+    {
+        /* The structure is the first argument of domctl, second of hvmop. */
+        argi = buf->calls[i].op == __HYPERVISOR_domctl ? 0 : 1;
+        buf->calls[i].args[argi] = (unsigned long)&buf->args[i];
+    }
+
+    rc = do_multicall_op(xch, HYPERCALL_BUFFER(buf), b->nr);
+    if ( rc )
+    {
+        err = errno;
+        if ( results )
+            for ( i = 0; i < b->nr; i++ )
+                results[i] = -err;
+        goto free;
+    }
+
+    /* Every entry has been run, whether or not earlier ones failed. */
+    for ( i = 0; i < b->nr; i++ )
+    {
+        int r = buf->calls[i].result > ~0xfffUL ?
+                (int)buf->calls[i].result : 0;
+
+        if ( results )
+            results[i] = r;
+        if ( r && !err )
+            err = -r;
+    }
+
+    if ( err )
+        rc = -1;
+
+ free:
+    xc_hypercall_buffer_free(xch, buf);
+ out:
+    free(b);
+    if ( err )
+        errno = err;
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -166,6 +166,46 @@ int xc_cpupool_removecpu(xc_interface *xch,
     return err;
 }
 
+int xc_cpupool_movecpus(xc_interface *xch,
+                        uint32_t poolid,
+                        xc_cpumap_t cpumap)
+{
+    unsigned retries;
+    int err = -1;
+    int cpusize;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(cpumap, 0, XC_HYPERCALL_BUFFER_BOUNCE_IN);
+
+    cpusize = xc_get_cpumap_size(xch);
+    if ( cpusize <= 0 )
+    {
+        PERROR("Could not get number of cpus");
+        return -1;
+    }
+
+    HYPERCALL_BOUNCE_SET_SIZE(cpumap, cpusize);
+    if ( xc_hypercall_bounce_pre(xch, cpumap) )
+    {
+        PERROR("Could not allocate hcall buffer for xc_cpupool_movecpus");
+        return -1;
+    }
+
+    sysctl.cmd = XEN_SYSCTL_cpupool_op;
+    sysctl.u.cpupool_op.op = XEN_SYSCTL_CPUPOOL_OP_MOVECPUS;
+    sysctl.u.cpupool_op.cpupool_id = poolid;
+    set_xen_guest_handle(sysctl.u.cpupool_op.cpumap.bitmap, cpumap);
+    sysctl.u.cpupool_op.cpumap.nr_bits = cpusize * 8;
+    for ( retries = 0; retries < NUM_RMCPU_BUSY_RETRIES; retries++ ) {
+        err = do_sysctl_save(xch, &sysctl);
+        if ( err == 0 || errno != EADDRINUSE )
+            break;
+    }
+
+    xc_hypercall_bounce_post(xch, cpumap);
+
+    return err;
+}
+
 int xc_cpupool_movedomain(xc_interface *xch,
                           uint32_t poolid,
                           uint32_t domid)
@@ -439,6 +439,44 @@ int xc_domain_getinfolist(xc_interface *xch,
     return ret;
 }
 
+int xc_domain_get_stats(xc_interface *xch,
+                        uint32_t *first_domain,
+                        void *buf, size_t size, size_t *used)
+{
+    int ret;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(buf, size, XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( size > UINT32_MAX )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( xc_hypercall_bounce_pre(xch, buf) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_get_domain_stats;
+    sysctl.u.get_domain_stats.first_domain = *first_domain;
+    sysctl.u.get_domain_stats.size = size;
+    sysctl.u.get_domain_stats.used = 0;
+    sysctl.u.get_domain_stats.nr_domains = 0;
+    set_xen_guest_handle(sysctl.u.get_domain_stats.buffer, buf);
+
+    if ( xc_sysctl(xch, &sysctl) < 0 )
+        ret = -1;
+    else
+    {
+        *first_domain = sysctl.u.get_domain_stats.first_domain;
+        *used = sysctl.u.get_domain_stats.used;
+        ret = sysctl.u.get_domain_stats.nr_domains;
+    }
+
+    xc_hypercall_bounce_post(xch, buf);
+
+    return ret;
+}
+
 /* set broken page p2m */
 int xc_set_broken_page_p2m(xc_interface *xch,
                            uint32_t domid,
@@ -706,6 +744,67 @@ long long xc_logdirty_control(xc_interface *xch,
     return (rc == 0) ? domctl.u.shadow_op.pages : rc;
 }
 
+long long xc_logdirty_control_range(xc_interface *xch,
+                                    uint32_t domid,
+                                    unsigned int sop,
+                                    xc_hypercall_buffer_t *dirty_bitmap,
+                                    unsigned long first_pfn,
+                                    unsigned long pages,
+                                    xc_shadow_op_stats_t *stats)
+{
+    int rc;
+    struct xen_domctl domctl = {
+        .cmd         = XEN_DOMCTL_shadow_op,
+        .domain      = domid,
+        .u.shadow_op = {
+            .op        = sop,
+            .mode      = XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE,
+            .pages     = pages,
+            .first_pfn = first_pfn,
+        }
+    };
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(dirty_bitmap);
+
+    set_xen_guest_handle_impl(domctl.u.shadow_op.dirty_bitmap, dirty_bitmap,
+                              first_pfn / 8);
+
+    rc = do_domctl(xch, &domctl);
+
+    if ( stats )
+        memcpy(stats, &domctl.u.shadow_op.stats,
+               sizeof(xc_shadow_op_stats_t));
+
+    return (rc == 0) ? domctl.u.shadow_op.pages : rc;
+}
+
+int xc_dirty_ring_enable(xc_interface *xch, uint32_t domid,
+                         unsigned int nr_frames)
+{
+    struct xen_domctl domctl = {
+        .cmd         = XEN_DOMCTL_shadow_op,
+        .domain      = domid,
+        .u.shadow_op = {
+            .op    = XEN_DOMCTL_SHADOW_OP_DIRTY_RING,
+            .pages = nr_frames,
+        }
+    };
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_dirty_ring_reset(xc_interface *xch, uint32_t domid)
+{
+    struct xen_domctl domctl = {
+        .cmd         = XEN_DOMCTL_shadow_op,
+        .domain      = domid,
+        .u.shadow_op = {
+            .op    = XEN_DOMCTL_SHADOW_OP_DIRTY_RING_RESET,
+        }
+    };
+
+    return do_domctl(xch, &domctl);
+}
+
 int xc_get_paging_mempool_size(xc_interface *xch, uint32_t domid, uint64_t *size)
 {
     int rc;
@@ -1194,6 +1293,32 @@ int xc_domain_populate_physmap_exact(xc_interface *xch,
     return err;
 }
 
+int xc_domain_populate_physmap_range(xc_interface *xch,
+                                     uint32_t domid,
+                                     xen_pfn_t gfn,
+                                     unsigned long nr_pages,
+                                     unsigned int max_order,
+                                     unsigned int mem_flags,
+                                     unsigned long *nr_done)
+{
+    int err;
+    struct xen_memory_populate_range range = {
+        .domid     = domid,
+        .mem_flags = mem_flags,
+        .gfn       = gfn,
+        .nr_pages  = nr_pages,
+        .max_order = max_order,
+    };
+
+    err = xc_memory_op(xch, XENMEM_populate_physmap_range, &range,
+                       sizeof(range));
+
+    if ( nr_done )
+        *nr_done = range.nr_done;
+
+    return err;
+}
+
 int xc_domain_memory_exchange_pages(xc_interface *xch,
                                     uint32_t domid,
                                     unsigned long nr_in_extents,
@@ -2079,6 +2204,62 @@ int xc_domain_p2m_audit(xc_interface *xch,
     return rc;
 }
 
+#if defined(__i386__) || defined(__x86_64__)
+int xc_domain_p2m_recoalesce(xc_interface *xch,
+                             uint32_t domid,
+                             bool start,
+                             struct xen_domctl_p2m_recoalesce *stats)
+{
+    DECLARE_DOMCTL;
+    int rc;
+
+    domctl.cmd = XEN_DOMCTL_p2m_recoalesce;
+    domctl.domain = domid;
+    domctl.u.p2m_recoalesce.op = start ? XEN_DOMCTL_P2M_RECOALESCE_START
+                                       : XEN_DOMCTL_P2M_RECOALESCE_STATS;
+    rc = do_domctl(xch, &domctl);
+
+    if ( !rc && stats )
+        *stats = domctl.u.p2m_recoalesce;
+
+    return rc;
+}
+
+int xc_domain_get_exit_stats(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t vcpu,
+                             uint32_t *vendor,
+                             uint32_t *nr_stats,
+                             xen_domctl_exit_stat_t *stats)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(stats, sizeof(*stats) * *nr_stats,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, stats) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_get_exit_stats;
+    domctl.domain = domid;
+    domctl.u.exit_stats.vcpu = vcpu;
+    domctl.u.exit_stats.nr_stats = stats ? *nr_stats : 0;
+    domctl.u.exit_stats.pad = 0;
+    set_xen_guest_handle(domctl.u.exit_stats.stats, stats);
+
+    rc = do_domctl(xch, &domctl);
+    if ( !rc )
+    {
+        *nr_stats = domctl.u.exit_stats.nr_stats;
+        *vendor = domctl.u.exit_stats.vendor;
+    }
+
+    xc_hypercall_bounce_post(xch, stats);
+
+    return rc;
+}
+#endif
+
 int xc_domain_set_access_required(xc_interface *xch,
                                   uint32_t domid,
                                   unsigned int required)
@@ -2101,6 +2282,20 @@ int xc_domain_set_virq_handler(xc_interface *xch, uint32_t domid, int virq)
     return do_domctl(xch, &domctl);
 }
 
+int xc_domain_get_changed(xc_interface *xch, uint32_t *domid)
+{
+    DECLARE_DOMCTL;
+    int rc;
+
+    domctl.cmd = XEN_DOMCTL_get_changed_domain;
+    domctl.domain = DOMID_INVALID;
+    rc = do_domctl(xch, &domctl);
+    if ( !rc )
+        *domid = domctl.u.changed_domain.domid;
+
+    return rc;
+}
+
 /* Plumbing Xen with vNUMA topology */
 int xc_domain_setvnuma(xc_interface *xch,
                        uint32_t domid,
@@ -2222,6 +2417,62 @@ int xc_domain_getvnuma(xc_interface *xch,
     return rc;
 }
 
+int xc_domain_get_node_pages(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t *nr_nodes,
+                             uint64_t *pages)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(pages, sizeof(*pages) * *nr_nodes,
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, pages) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_get_node_pages;
+    domctl.domain = domid;
+    domctl.u.node_pages.nr_nodes = pages ? *nr_nodes : 0;
+    domctl.u.node_pages.pad = 0;
+    set_xen_guest_handle(domctl.u.node_pages.pages, pages);
+
+    rc = do_domctl(xch, &domctl);
+    if ( !rc )
+        *nr_nodes = domctl.u.node_pages.nr_nodes;
+
+    xc_hypercall_bounce_post(xch, pages);
+
+    return rc;
+}
+
+int xc_domain_set_perf_class(xc_interface *xch,
+                             uint32_t domid,
+                             uint32_t perf_class)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_set_perf_class;
+    domctl.domain = domid;
+    domctl.u.perf_class.perf_class = perf_class;
+    domctl.u.perf_class.pad = 0;
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_domain_set_security_group(xc_interface *xch,
+                                 uint32_t domid,
+                                 uint32_t group)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_set_security_group;
+    domctl.domain = domid;
+    domctl.u.security_group.group = group;
+    domctl.u.security_group.pad = 0;
+
+    return do_domctl(xch, &domctl);
+}
+
 int xc_domain_soft_reset(xc_interface *xch,
                          uint32_t domid)
 {
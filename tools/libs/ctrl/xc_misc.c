@@ -514,6 +514,77 @@ int xc_lockprof_query(xc_interface *xch,
     return rc;
 }
 
+static int xc_lockcont_op(xc_interface *xch, uint32_t cmd, uint32_t period)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = cmd;
+    sysctl.u.lockcont_op.period = period;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lockcont_enable(xc_interface *xch, uint32_t period)
+{
+    return xc_lockcont_op(xch, XEN_SYSCTL_LOCKCONT_enable, period);
+}
+
+int xc_lockcont_disable(xc_interface *xch)
+{
+    return xc_lockcont_op(xch, XEN_SYSCTL_LOCKCONT_disable, 0);
+}
+
+int xc_lockcont_reset(xc_interface *xch)
+{
+    return xc_lockcont_op(xch, XEN_SYSCTL_LOCKCONT_reset, 0);
+}
+
+int xc_lockcont_query_number(xc_interface *xch,
+                             uint32_t *n_elems)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_query;
+    sysctl.u.lockcont_op.max_elem = 0;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, HYPERCALL_BUFFER_NULL);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.lockcont_op.nr_elem;
+
+    return rc;
+}
+
+int xc_lockcont_query(xc_interface *xch,
+                      uint32_t *n_elems,
+                      uint32_t *period,
+                      uint64_t *time,
+                      uint64_t *dropped,
+                      struct xc_hypercall_buffer *data)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(data);
+
+    sysctl.cmd = XEN_SYSCTL_lockcont_op;
+    sysctl.u.lockcont_op.cmd = XEN_SYSCTL_LOCKCONT_query;
+    sysctl.u.lockcont_op.max_elem = *n_elems;
+    set_xen_guest_handle(sysctl.u.lockcont_op.data, data);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.lockcont_op.nr_elem;
+    *period = sysctl.u.lockcont_op.period;
+    *time = sysctl.u.lockcont_op.time;
+    *dropped = sysctl.u.lockcont_op.dropped;
+
+    return rc;
+}
+
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus)
 {
@@ -168,6 +168,9 @@ int xc_pm_get_cxstat(xc_interface *xch, int cpuid, struct xc_cx_stat *cxpt)
     cxpt->idle_time = sysctl.u.get_pmstat.u.getcx.idle_time;
     cxpt->nr_pc = sysctl.u.get_pmstat.u.getcx.nr_pc;
     cxpt->nr_cc = sysctl.u.get_pmstat.u.getcx.nr_cc;
+    cxpt->pred_hit = sysctl.u.get_pmstat.u.getcx.pred_hit;
+    cxpt->pred_early = sysctl.u.get_pmstat.u.getcx.pred_early;
+    cxpt->pred_late = sysctl.u.get_pmstat.u.getcx.pred_late;
 
 unlock_4:
     xc_hypercall_bounce_post(xch, cc);
@@ -170,3 +170,31 @@ int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask)
     return do_sysctl(xch, &sysctl);
 }
 
+int xc_tbuf_set_sampling(xc_interface *xch, uint32_t classes, uint32_t period,
+                         uint32_t rate, uint32_t burst)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_tbuf_op;
+    sysctl.interface_version = XEN_SYSCTL_INTERFACE_VERSION;
+    sysctl.u.tbuf_op.cmd  = XEN_SYSCTL_TBUFOP_set_sampling;
+    sysctl.u.tbuf_op.evt_mask = classes;
+    sysctl.u.tbuf_op.sample_period = period;
+    sysctl.u.tbuf_op.rate_limit = rate;
+    sysctl.u.tbuf_op.rate_burst = burst;
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_tbuf_set_domain(xc_interface *xch, domid_t domid)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_tbuf_op;
+    sysctl.interface_version = XEN_SYSCTL_INTERFACE_VERSION;
+    sysctl.u.tbuf_op.cmd  = XEN_SYSCTL_TBUFOP_set_domain;
+    sysctl.u.tbuf_op.domid = domid;
+
+    return do_sysctl(xch, &sysctl);
+}
+
@@ -126,3 +126,80 @@ int xc_vmtrace_set_option(
 
     return do_domctl(xch, &domctl);
 }
+
+int xc_vmtrace_stream_enable(
+    xc_interface *xch, uint32_t domid, uint32_t vcpu,
+    uint32_t threshold, uint32_t flags, evtchn_port_t *port)
+{
+    struct xen_domctl domctl = {
+        .cmd = XEN_DOMCTL_vmtrace_op,
+        .domain = domid,
+        .u.vmtrace_op = {
+            .cmd = XEN_DOMCTL_vmtrace_stream_enable,
+            .vcpu = vcpu,
+            .key = threshold,
+            .value = flags,
+        },
+    };
+    int rc = do_domctl(xch, &domctl);
+
+    if ( !rc )
+        *port = domctl.u.vmtrace_op.value;
+
+    return rc;
+}
+
+int xc_vmtrace_stream_disable(
+    xc_interface *xch, uint32_t domid, uint32_t vcpu)
+{
+    struct xen_domctl domctl = {
+        .cmd = XEN_DOMCTL_vmtrace_op,
+        .domain = domid,
+        .u.vmtrace_op = {
+            .cmd = XEN_DOMCTL_vmtrace_stream_disable,
+            .vcpu = vcpu,
+        },
+    };
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_vmtrace_stream_next(
+    xc_interface *xch, uint32_t domid, uint32_t vcpu, bool flush,
+    uint64_t *len, uint64_t *wraps)
+{
+    struct xen_domctl domctl = {
+        .cmd = XEN_DOMCTL_vmtrace_op,
+        .domain = domid,
+        .u.vmtrace_op = {
+            .cmd = XEN_DOMCTL_vmtrace_stream_next,
+            .vcpu = vcpu,
+            .key = flush ? XEN_DOMCTL_VMTRACE_STREAM_flush : 0,
+        },
+    };
+    int rc = do_domctl(xch, &domctl);
+
+    if ( !rc )
+    {
+        *len = domctl.u.vmtrace_op.value;
+        if ( wraps )
+            *wraps = domctl.u.vmtrace_op.key;
+    }
+
+    return rc;
+}
+
+int xc_vmtrace_stream_ack(
+    xc_interface *xch, uint32_t domid, uint32_t vcpu)
+{
+    struct xen_domctl domctl = {
+        .cmd = XEN_DOMCTL_vmtrace_op,
+        .domain = domid,
+        .u.vmtrace_op = {
+            .cmd = XEN_DOMCTL_vmtrace_stream_ack,
+            .vcpu = vcpu,
+        },
+    };
+
+    return do_domctl(xch, &domctl);
+}
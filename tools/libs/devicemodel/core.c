@@ -269,6 +269,46 @@ int xendevicemodel_unmap_io_range_from_ioreq_server(
     return xendevicemodel_op(dmod, domid, 1, &op, sizeof(op));
 }
 
+int xendevicemodel_map_posted_mmio_range_to_ioreq_server(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id,
+    uint64_t start, uint64_t end)
+{
+    struct xen_dm_op op;
+    struct xen_dm_op_ioreq_server_range *data;
+
+    memset(&op, 0, sizeof(op));
+
+    op.op = XEN_DMOP_map_io_range_to_ioreq_server;
+    data = &op.u.map_io_range_to_ioreq_server;
+
+    data->id = id;
+    data->type = XEN_DMOP_IO_RANGE_MEMORY_POSTED;
+    data->start = start;
+    data->end = end;
+
+    return xendevicemodel_op(dmod, domid, 1, &op, sizeof(op));
+}
+
+int xendevicemodel_unmap_posted_mmio_range_from_ioreq_server(
+    xendevicemodel_handle *dmod, domid_t domid, ioservid_t id,
+    uint64_t start, uint64_t end)
+{
+    struct xen_dm_op op;
+    struct xen_dm_op_ioreq_server_range *data;
+
+    memset(&op, 0, sizeof(op));
+
+    op.op = XEN_DMOP_unmap_io_range_from_ioreq_server;
+    data = &op.u.unmap_io_range_from_ioreq_server;
+
+    data->id = id;
+    data->type = XEN_DMOP_IO_RANGE_MEMORY_POSTED;
+    data->start = start;
+    data->end = end;
+
+    return xendevicemodel_op(dmod, domid, 1, &op, sizeof(op));
+}
+
 int xendevicemodel_map_mem_type_to_ioreq_server(
     xendevicemodel_handle *dmod, domid_t domid, ioservid_t id, uint16_t type,
     uint32_t flags)
@@ -645,6 +685,146 @@ int xendevicemodel_nr_vcpus(
     return 0;
 }
 
+struct xendevicemodel_batch {
+    xendevicemodel_handle *dmod;
+    domid_t domid;
+    unsigned int nr;
+    struct xen_dm_op ops[XENDEVICEMODEL_BATCH_MAX];
+};
+
+xendevicemodel_batch *xendevicemodel_batch_begin(
+    xendevicemodel_handle *dmod, domid_t domid)
+{
+    xendevicemodel_batch *b = calloc(1, sizeof(*b));
+
+    if (b) {
+        b->dmod = dmod;
+        b->domid = domid;
+    }
+
+    return b;
+}
+
+static int batch_add(xendevicemodel_batch *b, uint32_t type,
+                     struct xen_dm_op **op)
+{
+    if (b->nr == XENDEVICEMODEL_BATCH_MAX) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    *op = &b->ops[b->nr];
+    memset(*op, 0, sizeof(**op));
+    (*op)->op = type;
+
+    return b->nr++;
+}
+
+int xendevicemodel_batch_set_pci_intx_level(
+    xendevicemodel_batch *b, uint16_t segment, uint8_t bus, uint8_t device,
+    uint8_t intx, unsigned int level)
+{
+    struct xen_dm_op *op;
+    struct xen_dm_op_set_pci_intx_level *data;
+    int idx = batch_add(b, XEN_DMOP_set_pci_intx_level, &op);
+
+    if (idx < 0)
+        return idx;
+
+    data = &op->u.set_pci_intx_level;
+    data->domain = segment;
+    data->bus = bus;
+    data->device = device;
+    data->intx = intx;
+    data->level = level;
+
+    return idx;
+}
+
+int xendevicemodel_batch_set_isa_irq_level(
+    xendevicemodel_batch *b, uint8_t irq, unsigned int level)
+{
+    struct xen_dm_op *op;
+    struct xen_dm_op_set_isa_irq_level *data;
+    int idx = batch_add(b, XEN_DMOP_set_isa_irq_level, &op);
+
+    if (idx < 0)
+        return idx;
+
+    data = &op->u.set_isa_irq_level;
+    data->isa_irq = irq;
+    data->level = level;
+
+    return idx;
+}
+
+int xendevicemodel_batch_inject_msi(
+    xendevicemodel_batch *b, uint64_t msi_addr, uint32_t msi_data)
+{
+    struct xen_dm_op *op;
+    struct xen_dm_op_inject_msi *data;
+    int idx = batch_add(b, XEN_DMOP_inject_msi, &op);
+
+    if (idx < 0)
+        return idx;
+
+    data = &op->u.inject_msi;
+    data->addr = msi_addr;
+    data->data = msi_data;
+
+    return idx;
+}
+
+int xendevicemodel_batch_submit(xendevicemodel_batch *b, int *results)
+{
+    struct xen_dm_op op;
+    int32_t status[XENDEVICEMODEL_BATCH_MAX];
+    unsigned int i;
+    int rc = 0, err = 0;
+
+    if (!b->nr)
+        goto out;
+
+    memset(&op, 0, sizeof(op));
+    op.op = XEN_DMOP_batch;
+    op.u.batch.nr = b->nr;
+
+    rc = xendevicemodel_op(b->dmod, b->domid, 3, &op, sizeof(op),
+                           b->ops, sizeof(b->ops[0]) * b->nr,
+                           status, sizeof(status[0]) * b->nr);
+    if (rc && errno == EOPNOTSUPP) {
+        /* Xen without XEN_DMOP_batch: one hypercall per operation. */
+        for (i = 0; i < b->nr; i++)
+            status[i] = xendevicemodel_op(b->dmod, b->domid, 1, &b->ops[i],
+                                          sizeof(b->ops[i])) ? -errno : 0;
+        rc = 0;
+    }
+
+    if (rc) {
+        err = errno;
+        if (results)
+            for (i = 0; i < b->nr; i++)
+                results[i] = -err;
+        goto out;
+    }
+
+    for (i = 0; i < b->nr; i++) {
+        if (results)
+            results[i] = status[i];
+        if (status[i] && !err)
+            err = -status[i];
+    }
+
+    if (err) {
+        errno = err;
+        rc = -1;
+    }
+
+ out:
+    free(b);
+    return rc;
+}
+
 int xendevicemodel_restrict(xendevicemodel_handle *dmod, domid_t domid)
 {
     return osdep_xendevicemodel_restrict(dmod, domid);
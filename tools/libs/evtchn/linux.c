@@ -142,6 +142,35 @@ int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port)
     return 0;
 }
 
+
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int nr)
+{
+    int fd = xce->fd;
+    ssize_t len;
+
+    /* The device hands out as many pending ports as fit in the buffer. */
+    len = read(fd, ports, nr * sizeof(*ports));
+    if ( len < 0 )
+        return -1;
+
+    return len / sizeof(*ports);
+}
+
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int nr)
+{
+    int fd = xce->fd;
+
+    if ( !nr )
+        return 0;
+
+    if ( write(fd, ports, nr * sizeof(*ports)) != nr * sizeof(*ports) )
+        return -1;
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -130,6 +130,37 @@ int xenevtchn_unmask(xenevtchn_handle *xce, evtchn_port_t port)
     return write_exact(fd, (char *)&port, sizeof(port));
 }
 
+
+/* Backends whose device only hands out one port at a time. */
+int xenevtchn_pending_batch(xenevtchn_handle *xce, evtchn_port_t *ports,
+                            unsigned int nr)
+{
+    xenevtchn_port_or_error_t port;
+
+    if ( !nr )
+        return 0;
+
+    port = xenevtchn_pending(xce);
+    if ( port < 0 )
+        return -1;
+
+    ports[0] = port;
+
+    return 1;
+}
+
+int xenevtchn_unmask_batch(xenevtchn_handle *xce, const evtchn_port_t *ports,
+                           unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+        if ( xenevtchn_unmask(xce, ports[i]) < 0 )
+            return -1;
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
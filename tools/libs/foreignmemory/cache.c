@@ -0,0 +1,343 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A cache of foreign mappings of one domain's memory, in 2M aligned
+ * buckets of gfns, so that repeatedly accessing the same guest pages
+ * doesn't map and unmap them each time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "private.h"
+
+#define BUCKET_SHIFT (LARGE_SHIFT - XC_PAGE_SHIFT)
+#define BUCKET_PAGES (1U << BUCKET_SHIFT)
+#define HASH_SIZE    256
+
+struct bucket {
+    xen_pfn_t index;            /* gfn >> BUCKET_SHIFT */
+    void *addr;
+    unsigned int refs;
+    bool stale;                 /* invalidated while referenced */
+    struct bucket *hash_next;
+    struct bucket *lru_prev, *lru_next;
+    int err[BUCKET_PAGES];
+};
+
+struct xenforeignmemory_cache {
+    xenforeignmemory_handle *fmem;
+    uint32_t dom;
+    int prot;
+    size_t nr, max;
+    pthread_mutex_t lock;
+    struct bucket *hash[HASH_SIZE];
+    /* Least recently used first; only unreferenced buckets are on it. */
+    struct bucket *lru_head, *lru_tail;
+    /* Referenced buckets, linked through the same fields. */
+    struct bucket *busy;
+};
+
+static struct bucket **hash_slot(xenforeignmemory_cache *cache,
+                                 xen_pfn_t index)
+{
+    return &cache->hash[index % HASH_SIZE];
+}
+
+static void lru_remove(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    if ( b->lru_prev )
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        cache->lru_head = b->lru_next;
+    if ( b->lru_next )
+        b->lru_next->lru_prev = b->lru_prev;
+    else
+        cache->lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_append(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    b->lru_prev = cache->lru_tail;
+    b->lru_next = NULL;
+    if ( cache->lru_tail )
+        cache->lru_tail->lru_next = b;
+    else
+        cache->lru_head = b;
+    cache->lru_tail = b;
+}
+
+static void busy_remove(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    if ( b->lru_prev )
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        cache->busy = b->lru_next;
+    if ( b->lru_next )
+        b->lru_next->lru_prev = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void busy_add(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    b->lru_prev = NULL;
+    b->lru_next = cache->busy;
+    if ( cache->busy )
+        cache->busy->lru_prev = b;
+    cache->busy = b;
+}
+
+/*
+ * Unmaps and frees an unreferenced bucket, which must be on the LRU.
+ * Stale buckets are no longer hashed.
+ */
+static void hash_remove(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    struct bucket **p = hash_slot(cache, b->index);
+
+    while ( *p != b )
+        p = &(*p)->hash_next;
+    *p = b->hash_next;
+    b->hash_next = NULL;
+}
+
+static void bucket_free(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    if ( !b->stale )
+        hash_remove(cache, b);
+    lru_remove(cache, b);
+    osdep_xenforeignmemory_unmap(cache->fmem, b->addr, BUCKET_PAGES);
+    free(b);
+    cache->nr--;
+}
+
+static struct bucket *bucket_map(xenforeignmemory_cache *cache,
+                                 xen_pfn_t index)
+{
+    xen_pfn_t gfns[BUCKET_PAGES];
+    struct bucket *b;
+    unsigned int i;
+
+    b = calloc(1, sizeof(*b));
+    if ( !b )
+        return NULL;
+
+    for ( i = 0; i < BUCKET_PAGES; i++ )
+        gfns[i] = (index << BUCKET_SHIFT) + i;
+
+    /*
+     * Pages which can't be mapped (e.g. holes in the p2m) only fail
+     * individually, in err[].
+     */
+    b->addr = xenforeignmemory_map2(cache->fmem, cache->dom, NULL,
+                                    cache->prot, XENFOREIGNMEMORY_MAP_LARGE,
+                                    BUCKET_PAGES, gfns, b->err);
+    if ( !b->addr )
+    {
+        free(b);
+        return NULL;
+    }
+
+    b->index = index;
+    b->hash_next = *hash_slot(cache, index);
+    *hash_slot(cache, index) = b;
+    cache->nr++;
+
+    return b;
+}
+
+xenforeignmemory_cache *xenforeignmemory_cache_create(
+    xenforeignmemory_handle *fmem, uint32_t dom, int prot, size_t max_buckets)
+{
+    xenforeignmemory_cache *cache;
+
+    if ( !max_buckets )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if ( !cache )
+        return NULL;
+
+    cache->fmem = fmem;
+    cache->dom = dom;
+    cache->prot = prot;
+    cache->max = max_buckets;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void xenforeignmemory_cache_destroy(xenforeignmemory_cache *cache)
+{
+    unsigned int i;
+    struct bucket *b, *next;
+
+    if ( !cache )
+        return;
+
+    /* Referenced buckets too: the caller is done with all of them. */
+    for ( b = cache->busy; b; b = next )
+    {
+        next = b->lru_next;
+        if ( !b->stale )
+            continue;
+        osdep_xenforeignmemory_unmap(cache->fmem, b->addr, BUCKET_PAGES);
+        free(b);
+    }
+    for ( i = 0; i < HASH_SIZE; i++ )
+    {
+        for ( b = cache->hash[i]; b; b = next )
+        {
+            next = b->hash_next;
+            osdep_xenforeignmemory_unmap(cache->fmem, b->addr, BUCKET_PAGES);
+            free(b);
+        }
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/* Drops a reference.  Called with the lock held. */
+static void bucket_put(xenforeignmemory_cache *cache, struct bucket *b)
+{
+    if ( --b->refs )
+        return;
+
+    busy_remove(cache, b);
+    lru_append(cache, b);
+    if ( b->stale || cache->nr > cache->max )
+        bucket_free(cache, b);
+}
+
+void *xenforeignmemory_cache_get(xenforeignmemory_cache *cache,
+                                 xen_pfn_t gfn)
+{
+    xen_pfn_t index = gfn >> BUCKET_SHIFT;
+    unsigned int off = gfn & (BUCKET_PAGES - 1);
+    struct bucket *b;
+    void *ret = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for ( b = *hash_slot(cache, index); b; b = b->hash_next )
+        if ( b->index == index )
+            break;
+
+    if ( !b )
+    {
+        /* Make room first, so the new mapping doesn't add to the peak. */
+        while ( cache->nr >= cache->max && cache->lru_head )
+            bucket_free(cache, cache->lru_head);
+
+        b = bucket_map(cache, index);
+        if ( !b )
+            goto out;
+    }
+    else if ( !b->refs )
+        lru_remove(cache, b);
+
+    if ( !b->refs++ )
+        busy_add(cache, b);
+
+    if ( b->err[off] )
+    {
+        errno = -b->err[off];
+        bucket_put(cache, b);
+        goto out;
+    }
+
+    ret = (char *)b->addr + ((size_t)off << XC_PAGE_SHIFT);
+
+ out:
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+int xenforeignmemory_cache_put(xenforeignmemory_cache *cache, void *addr)
+{
+    struct bucket *b;
+    char *p = addr;
+    int rc = 0;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for ( b = cache->busy; b; b = b->lru_next )
+        if ( p >= (char *)b->addr &&
+             p < (char *)b->addr + ((size_t)BUCKET_PAGES << XC_PAGE_SHIFT) )
+            break;
+
+    if ( b )
+        bucket_put(cache, b);
+    else
+    {
+        errno = EINVAL;
+        rc = -1;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return rc;
+}
+
+void xenforeignmemory_cache_invalidate(xenforeignmemory_cache *cache,
+                                       xen_pfn_t gfn, size_t num)
+{
+    xen_pfn_t first = gfn >> BUCKET_SHIFT;
+    xen_pfn_t last = (gfn + num - 1) >> BUCKET_SHIFT;
+    struct bucket *b, *next;
+    unsigned int i;
+
+    if ( !num )
+        return;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for ( i = 0; i < HASH_SIZE; i++ )
+    {
+        for ( b = cache->hash[i]; b; b = next )
+        {
+            next = b->hash_next;
+            if ( b->index < first || b->index > last )
+                continue;
+            if ( b->refs )
+            {
+                /* Unmapped on the last put; later gets map afresh. */
+                hash_remove(cache, b);
+                b->stale = true;
+            }
+            else
+                bucket_free(cache, b);
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
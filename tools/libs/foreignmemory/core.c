@@ -80,19 +80,51 @@ int xenforeignmemory_close(xenforeignmemory_handle *fmem)
     return rc;
 }
 
+/*
+ * Whether arr[] contains a 2M aligned run of contiguous frames at a 2M
+ * aligned offset, which a large mapping could cover.
+ */
+static bool has_large_run(const xen_pfn_t arr[], size_t num)
+{
+    size_t i, j;
+
+    for ( i = 0; i + LARGE_PAGES <= num; i += LARGE_PAGES )
+    {
+        if ( arr[i] & (LARGE_PAGES - 1) )
+            continue;
+        for ( j = 1; j < LARGE_PAGES; j++ )
+            if ( arr[i + j] != arr[i] + j )
+                break;
+        if ( j == LARGE_PAGES )
+            return true;
+    }
+
+    return false;
+}
+
 void *xenforeignmemory_map2(xenforeignmemory_handle *fmem,
                             uint32_t dom, void *addr,
                             int prot, int flags, size_t num,
                             const xen_pfn_t arr[/*num*/], int err[/*num*/])
 {
-    void *ret;
+    void *ret, *reserved = NULL;
     int *err_to_free = NULL;
 
+    if ( flags & XENFOREIGNMEMORY_MAP_LARGE )
+    {
+        flags &= ~XENFOREIGNMEMORY_MAP_LARGE;
+
+        /* A placement hint from the caller wins. */
+        if ( !addr && has_large_run(arr, num) )
+            addr = reserved =
+                osdep_xenforeignmemory_reserve_large(fmem, num, &flags);
+    }
+
     if ( err == NULL )
         err = err_to_free = malloc(num * sizeof(int));
 
     if ( err == NULL )
-        return NULL;
+        goto out;
 
     ret = osdep_xenforeignmemory_map(fmem, dom, addr, prot, flags, num, arr, err);
 
@@ -114,7 +146,19 @@ void *xenforeignmemory_map2(xenforeignmemory_handle *fmem,
 
     free(err_to_free);
 
-    return ret;
+    if ( ret )
+        return ret;
+
+ out:
+    if ( reserved )
+    {
+        int saved_errno = errno;
+
+        (void)osdep_xenforeignmemory_unmap(fmem, reserved, num);
+        errno = saved_errno;
+    }
+
+    return NULL;
 }
 
 void *xenforeignmemory_map(xenforeignmemory_handle *fmem,
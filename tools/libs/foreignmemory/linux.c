@@ -285,6 +285,35 @@ int osdep_xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
     return munmap(addr, num << XC_PAGE_SHIFT);
 }
 
+void *osdep_xenforeignmemory_reserve_large(xenforeignmemory_handle *fmem,
+                                           size_t num, int *flags)
+{
+    size_t len = num << XC_PAGE_SHIFT;
+    size_t align = (size_t)1 << LARGE_SHIFT;
+    char *p, *start;
+
+    /*
+     * privcmd places foreign mappings wherever mmap(2) puts them, which
+     * is rarely 2M aligned, so no part of them can ever be mapped with
+     * large page table entries.  Over-allocate inaccessible address
+     * space, and trim it to an aligned range for the real mapping to
+     * replace with MAP_FIXED.
+     */
+    p = mmap(NULL, len + align, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if ( p == MAP_FAILED )
+        return NULL;
+
+    start = (char *)ROUNDUP(p, LARGE_SHIFT);
+    if ( start != p )
+        munmap(p, start - p);
+    munmap(start + len, p + align - start);
+
+    *flags |= MAP_FIXED;
+
+    return start;
+}
+
 int osdep_xenforeignmemory_restrict(xenforeignmemory_handle *fmem,
                                     domid_t domid)
 {
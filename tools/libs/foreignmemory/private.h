@@ -29,6 +29,26 @@ void *osdep_xenforeignmemory_map(xenforeignmemory_handle *fmem,
 int osdep_xenforeignmemory_unmap(xenforeignmemory_handle *fmem,
                                  void *addr, size_t num);
 
+/* Large (2M) mappings. */
+#define LARGE_SHIFT 21
+#define LARGE_PAGES (1U << (LARGE_SHIFT - XC_PAGE_SHIFT))
+
+/*
+ * Reserves num pages of address space aligned for large mappings, and
+ * adjusts *flags so that osdep_xenforeignmemory_map() maps over it.
+ * Returns NULL if the platform cannot place mappings this way.
+ */
+#if defined(__linux__)
+void *osdep_xenforeignmemory_reserve_large(xenforeignmemory_handle *fmem,
+                                           size_t num, int *flags);
+#else
+static inline void *osdep_xenforeignmemory_reserve_large(
+    xenforeignmemory_handle *fmem, size_t num, int *flags)
+{
+    return NULL;
+}
+#endif
+
 #if defined(__sun__)
 /* Strictly compat for those two only only */
 void *osdep_map_foreign_batch(xenforeignmemory_handle *fmem, uint32_t dom,
@@ -0,0 +1,390 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A pool of grant mappings kept across requests, for backends whose
+ * frontends reuse the same grants (e.g. blkif "feature-persistent").
+ *
+ * The grants missing from a request are mapped together, as one chunk.
+ * Each grant is an entry of its own, so that it can be looked up and
+ * evicted individually, but a chunk can only be unmapped as a whole:
+ * that happens when its last entry is evicted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <xenctrl.h>
+
+#include "private.h"
+
+#define HASH_SIZE 1024
+
+struct chunk {
+    void *addr;
+    uint32_t count;
+    uint32_t live;              /* entries still in the pool */
+};
+
+struct entry {
+    uint32_t domid, ref;
+    struct chunk *chunk;
+    void *addr;
+    unsigned int refs;
+    struct entry *hash_next;
+    struct entry *lru_prev, *lru_next;
+};
+
+struct xengnttab_pool {
+    xengnttab_handle *xgt;
+    int prot;
+    uint32_t max;
+    pthread_mutex_t lock;
+    struct entry *hash[HASH_SIZE];
+    /* Least recently used first; only unreferenced entries are on it. */
+    struct entry *lru_head, *lru_tail;
+    xengnttab_pool_stats stats;
+};
+
+static struct entry **hash_slot(xengnttab_pool *pool, uint32_t domid,
+                                uint32_t ref)
+{
+    return &pool->hash[(ref ^ (domid << 4)) % HASH_SIZE];
+}
+
+static struct entry *lookup(xengnttab_pool *pool, uint32_t domid,
+                            uint32_t ref)
+{
+    struct entry *e;
+
+    for ( e = *hash_slot(pool, domid, ref); e; e = e->hash_next )
+        if ( e->domid == domid && e->ref == ref )
+            break;
+
+    return e;
+}
+
+static void lru_remove(xengnttab_pool *pool, struct entry *e)
+{
+    if ( e->lru_prev )
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        pool->lru_head = e->lru_next;
+    if ( e->lru_next )
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        pool->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_append(xengnttab_pool *pool, struct entry *e)
+{
+    e->lru_prev = pool->lru_tail;
+    e->lru_next = NULL;
+    if ( pool->lru_tail )
+        pool->lru_tail->lru_next = e;
+    else
+        pool->lru_head = e;
+    pool->lru_tail = e;
+}
+
+static void get_entry(xengnttab_pool *pool, struct entry *e)
+{
+    if ( !e->refs++ )
+        lru_remove(pool, e);
+}
+
+/* Removes an unreferenced entry, unmapping its chunk if it was the last. */
+static void evict(xengnttab_pool *pool, struct entry *e)
+{
+    struct entry **p = hash_slot(pool, e->domid, e->ref);
+    struct chunk *c = e->chunk;
+
+    while ( *p != e )
+        p = &(*p)->hash_next;
+    *p = e->hash_next;
+
+    lru_remove(pool, e);
+    free(e);
+    pool->stats.entries--;
+    pool->stats.evictions++;
+
+    if ( --c->live )
+        return;
+
+    osdep_gnttab_unmap(pool->xgt, c->addr, c->count);
+    pool->stats.mapped -= c->count;
+    free(c);
+}
+
+/*
+ * Evicts least recently used entries until another @nr grants fit.
+ * Entries sharing a chunk with referenced ones free nothing, so this
+ * may evict more than strictly needed.
+ */
+static void trim(xengnttab_pool *pool, uint32_t nr)
+{
+    while ( pool->stats.mapped + nr > pool->max && pool->lru_head )
+        evict(pool, pool->lru_head);
+}
+
+static void put_entry(xengnttab_pool *pool, struct entry *e)
+{
+    if ( --e->refs )
+        return;
+
+    lru_append(pool, e);
+    trim(pool, 0);
+}
+
+xengnttab_pool *xengnttab_pool_create(xengnttab_handle *xgt, int prot,
+                                      uint32_t max_grants)
+{
+    xengnttab_pool *pool;
+
+    if ( !max_grants )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if ( !pool )
+        return NULL;
+
+    pool->xgt = xgt;
+    pool->prot = prot;
+    pool->max = max_grants;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+void xengnttab_pool_destroy(xengnttab_pool *pool)
+{
+    struct entry *e, *next;
+    unsigned int i;
+
+    if ( !pool )
+        return;
+
+    for ( i = 0; i < HASH_SIZE; i++ )
+    {
+        for ( e = pool->hash[i]; e; e = next )
+        {
+            next = e->hash_next;
+            if ( !--e->chunk->live )
+            {
+                osdep_gnttab_unmap(pool->xgt, e->chunk->addr,
+                                   e->chunk->count);
+                free(e->chunk);
+            }
+            free(e);
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int xengnttab_pool_get(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                       const uint32_t *refs, void **addrs)
+{
+    uint32_t *miss = NULL, nr_miss = 0, i, j;
+    struct chunk *c = NULL;
+    struct entry *e;
+    int rc = -1;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for ( i = 0; i < count; i++ )
+    {
+        addrs[i] = NULL;
+
+        e = lookup(pool, domid, refs[i]);
+        if ( e )
+        {
+            get_entry(pool, e);
+            addrs[i] = e->addr;
+            continue;
+        }
+
+        if ( !miss )
+        {
+            miss = malloc(count * sizeof(*miss));
+            if ( !miss )
+                goto out;
+        }
+
+        /* The same grant may appear twice in a request. */
+        for ( j = 0; j < nr_miss; j++ )
+            if ( miss[j] == refs[i] )
+                break;
+        if ( j == nr_miss )
+            miss[nr_miss++] = refs[i];
+    }
+
+    pool->stats.hits += count - nr_miss;
+    pool->stats.misses += nr_miss;
+
+    if ( !nr_miss )
+    {
+        rc = 0;
+        goto out;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if ( !c )
+        goto out;
+
+    trim(pool, nr_miss);
+
+    c->addr = osdep_gnttab_grant_map(pool->xgt, nr_miss,
+                                     XENGNTTAB_GRANT_MAP_SINGLE_DOMAIN,
+                                     pool->prot, &domid, miss, -1, -1);
+    if ( !c->addr )
+        goto out;
+
+    c->count = nr_miss;
+    pool->stats.mapped += nr_miss;
+
+    for ( j = 0; j < nr_miss; j++ )
+    {
+        e = calloc(1, sizeof(*e));
+        if ( !e )
+            break;
+
+        e->domid = domid;
+        e->ref = miss[j];
+        e->chunk = c;
+        e->addr = (char *)c->addr + (size_t)j * XC_PAGE_SIZE;
+        e->hash_next = *hash_slot(pool, domid, miss[j]);
+        *hash_slot(pool, domid, miss[j]) = e;
+        lru_append(pool, e);
+        c->live++;
+        pool->stats.entries++;
+    }
+
+    if ( !c->live )
+    {
+        osdep_gnttab_unmap(pool->xgt, c->addr, c->count);
+        pool->stats.mapped -= c->count;
+        goto out;
+    }
+    c = NULL;
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( addrs[i] )
+            continue;
+
+        e = lookup(pool, domid, refs[i]);
+        if ( !e )
+            goto out;
+
+        get_entry(pool, e);
+        addrs[i] = e->addr;
+    }
+
+    rc = 0;
+
+ out:
+    if ( rc )
+    {
+        int saved_errno = errno ?: ENOMEM;
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( !addrs[i] )
+                continue;
+            e = lookup(pool, domid, refs[i]);
+            if ( e && e->refs )
+                put_entry(pool, e);
+            addrs[i] = NULL;
+        }
+        errno = saved_errno;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    free(c);
+    free(miss);
+
+    return rc;
+}
+
+void xengnttab_pool_put(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                        const uint32_t *refs)
+{
+    struct entry *e;
+    uint32_t i;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for ( i = 0; i < count; i++ )
+    {
+        e = lookup(pool, domid, refs[i]);
+        if ( e && e->refs )
+            put_entry(pool, e);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int xengnttab_pool_flush(xengnttab_pool *pool, uint32_t domid)
+{
+    struct entry *e, *next;
+    unsigned int i;
+    int busy = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for ( i = 0; i < HASH_SIZE; i++ )
+    {
+        for ( e = pool->hash[i]; e; e = next )
+        {
+            next = e->hash_next;
+            if ( e->domid != domid )
+                continue;
+            if ( e->refs )
+                busy++;
+            else
+                evict(pool, e);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return busy;
+}
+
+void xengnttab_pool_get_stats(xengnttab_pool *pool,
+                              xengnttab_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -110,6 +110,40 @@ int xengnttab_dmabuf_imp_release(xengnttab_handle *xgt, uint32_t fd)
     abort();
 }
 
+xengnttab_pool *xengnttab_pool_create(xengnttab_handle *xgt, int prot,
+                                      uint32_t max_grants)
+{
+    abort();
+}
+
+void xengnttab_pool_destroy(xengnttab_pool *pool)
+{
+    abort();
+}
+
+int xengnttab_pool_get(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                       const uint32_t *refs, void **addrs)
+{
+    abort();
+}
+
+void xengnttab_pool_put(xengnttab_pool *pool, uint32_t domid, uint32_t count,
+                        const uint32_t *refs)
+{
+    abort();
+}
+
+int xengnttab_pool_flush(xengnttab_pool *pool, uint32_t domid)
+{
+    abort();
+}
+
+void xengnttab_pool_get_stats(xengnttab_pool *pool,
+                              xengnttab_pool_stats *stats)
+{
+    abort();
+}
+
 /*
  * Local variables:
  * mode: C
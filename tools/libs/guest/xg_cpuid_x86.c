@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <pthread.h>
 #include "xg_private.h"
 #include <xen/hvm/params.h>
 #include <xen-tools/common-macros.h>
@@ -36,6 +37,27 @@ enum {
 #define bitmaskof(idx)      (1u << ((idx) & 31))
 #define featureword_of(idx) ((idx) >> 5)
 
+/*
+ * Xen calculates its system policies once, at boot, and the maximum sizes of
+ * serialised policies are compile time constants.  Cache them for the
+ * lifetime of the process, so that a toolstack building many domains fetches
+ * each of them once, rather than several times per domain.
+ */
+struct system_policy {
+    uint32_t nr_leaves, nr_msrs;
+    xen_cpuid_leaf_t leaves[CPUID_MAX_SERIALISED_LEAVES];
+    xen_msr_entry_t msrs[MSR_MAX_SERIALISED_ENTRIES];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    bool have_size;
+    uint32_t nr_leaves, nr_msrs;
+    struct system_policy *policy[XEN_SYSCTL_cpu_policy_hvm_default + 1];
+} sys_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 int xc_get_cpu_levelling_caps(xc_interface *xch, uint32_t *caps)
 {
     DECLARE_SYSCTL;
@@ -110,24 +132,39 @@ int xc_cpu_policy_get_size(xc_interface *xch, uint32_t *nr_leaves,
                            uint32_t *nr_msrs)
 {
     struct xen_sysctl sysctl = {};
-    int ret;
+    int ret = 0;
 
-    sysctl.cmd = XEN_SYSCTL_get_cpu_policy;
+    pthread_mutex_lock(&sys_cache.lock);
 
-    ret = do_sysctl(xch, &sysctl);
+    if ( !sys_cache.have_size )
+    {
+        sysctl.cmd = XEN_SYSCTL_get_cpu_policy;
+
+        ret = do_sysctl(xch, &sysctl);
+
+        if ( !ret )
+        {
+            sys_cache.nr_leaves = sysctl.u.cpu_policy.nr_leaves;
+            sys_cache.nr_msrs = sysctl.u.cpu_policy.nr_msrs;
+            sys_cache.have_size = true;
+        }
+    }
 
     if ( !ret )
     {
-        *nr_leaves = sysctl.u.cpu_policy.nr_leaves;
-        *nr_msrs = sysctl.u.cpu_policy.nr_msrs;
+        *nr_leaves = sys_cache.nr_leaves;
+        *nr_msrs = sys_cache.nr_msrs;
     }
 
+    pthread_mutex_unlock(&sys_cache.lock);
+
     return ret;
 }
 
-static int get_system_cpu_policy(xc_interface *xch, uint32_t index,
-                                 uint32_t *nr_leaves, xen_cpuid_leaf_t *leaves,
-                                 uint32_t *nr_msrs, xen_msr_entry_t *msrs)
+static int fetch_system_cpu_policy(xc_interface *xch, uint32_t index,
+                                   uint32_t *nr_leaves,
+                                   xen_cpuid_leaf_t *leaves,
+                                   uint32_t *nr_msrs, xen_msr_entry_t *msrs)
 {
     struct xen_sysctl sysctl = {};
     DECLARE_HYPERCALL_BOUNCE(leaves,
@@ -163,6 +200,73 @@ static int get_system_cpu_policy(xc_interface *xch, uint32_t index,
     return ret;
 }
 
+/*
+ * Like XEN_SYSCTL_get_cpu_policy, but served from sys_cache after the first
+ * call for each policy.  As with the hypercall, a NULL buffer asks for the
+ * maximum number of entries, and a short buffer fails with ENOBUFS.
+ */
+static int get_system_cpu_policy(xc_interface *xch, uint32_t index,
+                                 uint32_t *nr_leaves, xen_cpuid_leaf_t *leaves,
+                                 uint32_t *nr_msrs, xen_msr_entry_t *msrs)
+{
+    struct system_policy *p;
+    int ret = -1;
+
+    if ( index >= ARRAY_SIZE(sys_cache.policy) )
+        return fetch_system_cpu_policy(xch, index, nr_leaves, leaves,
+                                       nr_msrs, msrs);
+
+    pthread_mutex_lock(&sys_cache.lock);
+
+    p = sys_cache.policy[index];
+    if ( !p )
+    {
+        if ( (p = malloc(sizeof(*p))) == NULL )
+            goto out;
+
+        p->nr_leaves = ARRAY_SIZE(p->leaves);
+        p->nr_msrs = ARRAY_SIZE(p->msrs);
+        if ( fetch_system_cpu_policy(xch, index, &p->nr_leaves, p->leaves,
+                                     &p->nr_msrs, p->msrs) )
+        {
+            free(p);
+            goto out;
+        }
+
+        sys_cache.policy[index] = p;
+    }
+
+    if ( (leaves && *nr_leaves < p->nr_leaves) ||
+         (msrs && *nr_msrs < p->nr_msrs) )
+    {
+        errno = ENOBUFS;
+        goto out;
+    }
+
+    if ( leaves )
+    {
+        memcpy(leaves, p->leaves, p->nr_leaves * sizeof(*leaves));
+        *nr_leaves = p->nr_leaves;
+    }
+    else
+        *nr_leaves = ARRAY_SIZE(p->leaves);
+
+    if ( msrs )
+    {
+        memcpy(msrs, p->msrs, p->nr_msrs * sizeof(*msrs));
+        *nr_msrs = p->nr_msrs;
+    }
+    else
+        *nr_msrs = ARRAY_SIZE(p->msrs);
+
+    ret = 0;
+
+ out:
+    pthread_mutex_unlock(&sys_cache.lock);
+
+    return ret;
+}
+
 static int get_domain_cpu_policy(xc_interface *xch, uint32_t domid,
                                  uint32_t *nr_leaves, xen_cpuid_leaf_t *leaves,
                                  uint32_t *nr_msrs, xen_msr_entry_t *msrs)
@@ -277,27 +381,19 @@ static xen_cpuid_leaf_t *find_leaf(
     return bsearch(&key, leaves, nr_leaves, sizeof(*leaves), compare_leaves);
 }
 
+/*
+ * Apply the xend style overrides to @cur, the serialised policy about to be
+ * given to a domain.
+ */
 static int xc_cpuid_xend_policy(
-    xc_interface *xch, uint32_t domid, const struct xc_xend_cpuid *xend)
+    xc_interface *xch, bool hvm, xen_cpuid_leaf_t *cur, unsigned int nr_cur,
+    const struct xc_xend_cpuid *xend)
 {
     int rc;
-    xc_dominfo_t di;
     unsigned int nr_leaves, nr_msrs;
-    uint32_t err_leaf = -1, err_subleaf = -1, err_msr = -1;
-    /*
-     * Three full policies.  The host, default for the domain type,
-     * and domain current.
-     */
-    xen_cpuid_leaf_t *host = NULL, *def = NULL, *cur = NULL;
-    unsigned int nr_host, nr_def, nr_cur;
-
-    if ( xc_domain_getinfo(xch, domid, 1, &di) != 1 ||
-         di.domid != domid )
-    {
-        ERROR("Failed to obtain d%d info", domid);
-        rc = -ESRCH;
-        goto fail;
-    }
+    /* The host policy and the default one for the domain type. */
+    xen_cpuid_leaf_t *host = NULL, *def = NULL;
+    unsigned int nr_host, nr_def;
 
     rc = xc_cpu_policy_get_size(xch, &nr_leaves, &nr_msrs);
     if ( rc )
@@ -309,33 +405,21 @@ static int xc_cpuid_xend_policy(
 
     rc = -ENOMEM;
     if ( (host = calloc(nr_leaves, sizeof(*host))) == NULL ||
-         (def  = calloc(nr_leaves, sizeof(*def)))  == NULL ||
-         (cur  = calloc(nr_leaves, sizeof(*cur)))  == NULL )
+         (def  = calloc(nr_leaves, sizeof(*def)))  == NULL )
     {
         ERROR("Unable to allocate memory for %u CPUID leaves", nr_leaves);
         goto fail;
     }
 
-    /* Get the domain's current policy. */
-    nr_msrs = 0;
-    nr_cur = nr_leaves;
-    rc = get_domain_cpu_policy(xch, domid, &nr_cur, cur, &nr_msrs, NULL);
-    if ( rc )
-    {
-        PERROR("Failed to obtain d%d current policy", domid);
-        rc = -errno;
-        goto fail;
-    }
-
     /* Get the domain type's default policy. */
     nr_msrs = 0;
     nr_def = nr_leaves;
-    rc = get_system_cpu_policy(xch, di.hvm ? XEN_SYSCTL_cpu_policy_hvm_default
-                                           : XEN_SYSCTL_cpu_policy_pv_default,
+    rc = get_system_cpu_policy(xch, hvm ? XEN_SYSCTL_cpu_policy_hvm_default
+                                        : XEN_SYSCTL_cpu_policy_pv_default,
                                &nr_def, def, &nr_msrs, NULL);
     if ( rc )
     {
-        PERROR("Failed to obtain %s def policy", di.hvm ? "hvm" : "pv");
+        PERROR("Failed to obtain %s def policy", hvm ? "hvm" : "pv");
         rc = -errno;
         goto fail;
     }
@@ -401,21 +485,9 @@ static int xc_cpuid_xend_policy(
         }
     }
 
-    /* Feed the transformed currrent policy back up to Xen. */
-    rc = xc_set_domain_cpu_policy(xch, domid, nr_cur, cur, 0, NULL,
-                                  &err_leaf, &err_subleaf, &err_msr);
-    if ( rc )
-    {
-        PERROR("Failed to set d%d's policy (err leaf %#x, subleaf %#x, msr %#x)",
-               domid, err_leaf, err_subleaf, err_msr);
-        rc = -errno;
-        goto fail;
-    }
-
-    /* Success! */
+    rc = 0;
 
  fail:
-    free(cur);
     free(def);
     free(host);
 
@@ -653,6 +725,14 @@ int xc_cpuid_apply_policy(xc_interface *xch, uint32_t domid, bool restore,
         goto out;
     }
 
+    /*
+     * Apply any overrides before handing the policy to Xen, so that it is
+     * only set and audited once.
+     */
+    if ( xend &&
+         (rc = xc_cpuid_xend_policy(xch, di.hvm, leaves, nr_leaves, xend)) )
+        goto out;
+
     rc = xc_set_domain_cpu_policy(xch, domid, nr_leaves, leaves, 0, NULL,
                                   &err_leaf, &err_subleaf, &err_msr);
     if ( rc )
@@ -663,9 +743,6 @@ int xc_cpuid_apply_policy(xc_interface *xch, uint32_t domid, bool restore,
         goto out;
     }
 
-    if ( xend && (rc = xc_cpuid_xend_policy(xch, domid, xend)) )
-        goto out;
-
     rc = 0;
 
 out:
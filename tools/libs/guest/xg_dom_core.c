@@ -30,6 +30,8 @@
 #include <inttypes.h>
 #include <zlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define XG_NEED_UNALIGNED
 #include "xg_private.h"
@@ -321,7 +323,7 @@ int xc_dom_kernel_check_size(struct xc_dom_image *dom, size_t sz)
 }
 
 /* ------------------------------------------------------------------------ */
-/* read files, copy memory blocks, with transparent gunzip                  */
+/* read files, copy memory blocks, with transparent decompression          */
 
 size_t xc_dom_check_gzip(xc_interface *xch, void *blob, size_t ziplen)
 {
@@ -405,6 +407,294 @@ int xc_dom_try_gunzip(struct xc_dom_image *dom, void **blob, size_t * size)
     return 0;
 }
 
+#if !defined(__MINIOS__) && (defined(HAVE_ZSTD) || defined(HAVE_LZMA))
+/*
+ * Modules are commonly compressed with zstd or xz as well.  Like gzip, they
+ * are decompressed straight into their guest segment, provided the format
+ * records the decompressed size up front.  Independent frames are decoded
+ * in parallel.
+ */
+#define MODULE_DECOMPRESS_MAX_THREADS 8U
+
+static unsigned int module_decompress_threads(unsigned int nr)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ( cpus < 1 )
+        cpus = 1;
+
+    return min(nr, min((unsigned int)cpus, MODULE_DECOMPRESS_MAX_THREADS));
+}
+#endif
+
+#if !defined(__MINIOS__) && defined(HAVE_ZSTD)
+#include <zstd.h>
+
+/*
+ * Walk the frames of a zstd stream, calling fn() for each data frame.  Fails
+ * unless every frame records its content size.  Returns the total content
+ * size, or 0 on error.
+ */
+static unsigned long long zstd_walk_frames(
+    const void *src, size_t srclen,
+    int (*fn)(const void *src, size_t srclen, unsigned long long out,
+              size_t dstlen, void *arg),
+    void *arg)
+{
+    unsigned long long out = 0;
+    size_t in = 0;
+
+    while ( in < srclen )
+    {
+        const uint8_t *p = src + in;
+        size_t zlen = ZSTD_findFrameCompressedSize(p, srclen - in);
+        unsigned long long len;
+
+        if ( ZSTD_isError(zlen) )
+            return 0;
+
+        if ( srclen - in >= 4 &&
+             (get_unaligned_le32(p) & ZSTD_MAGIC_SKIPPABLE_MASK) ==
+             ZSTD_MAGIC_SKIPPABLE_START )
+        {
+            in += zlen;
+            continue;
+        }
+
+        len = ZSTD_getFrameContentSize(p, srclen - in);
+        if ( len == ZSTD_CONTENTSIZE_UNKNOWN ||
+             len == ZSTD_CONTENTSIZE_ERROR ||
+             len > XC_DOM_DECOMPRESS_MAX - out )
+            return 0;
+
+        if ( fn && fn(p, zlen, out, len, arg) )
+            return 0;
+
+        in += zlen;
+        out += len;
+    }
+
+    return out;
+}
+
+static size_t xc_dom_check_zstd(xc_interface *xch, void *blob, size_t ziplen)
+{
+    unsigned long long unziplen;
+
+    if ( ziplen < 4 || get_unaligned_le32(blob) != ZSTD_MAGICNUMBER )
+        return 0;
+
+    unziplen = zstd_walk_frames(blob, ziplen, NULL, NULL);
+    if ( unziplen == 0 )
+        xc_dom_printf(xch, "%s: size of zstd module (zip %zd) unknown or "
+                      "insane, skip unzstd", __FUNCTION__, ziplen);
+
+    return unziplen;
+}
+
+struct zstd_frame {
+    const void *src;
+    size_t srclen;
+    void *dst;
+    size_t dstlen;
+};
+
+struct zstd_frames {
+    struct zstd_frame *frame;
+    unsigned int nr, max, next;
+    void *dst;
+    pthread_mutex_t lock;
+    bool failed;
+};
+
+static int add_zstd_frame(const void *src, size_t srclen,
+                          unsigned long long out, size_t dstlen, void *arg)
+{
+    struct zstd_frames *f = arg;
+
+    if ( f->nr == f->max )
+    {
+        unsigned int max = f->max ? f->max * 2 : 16;
+        struct zstd_frame *frame = realloc(f->frame, max * sizeof(*frame));
+
+        if ( !frame )
+            return -1;
+        f->frame = frame;
+        f->max = max;
+    }
+
+    f->frame[f->nr++] = (struct zstd_frame){
+        .src = src, .srclen = srclen, .dst = f->dst + out, .dstlen = dstlen,
+    };
+
+    return 0;
+}
+
+static void *unzstd_frames(void *arg)
+{
+    struct zstd_frames *f = arg;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    unsigned int i;
+    size_t rc;
+
+    for ( ;; )
+    {
+        pthread_mutex_lock(&f->lock);
+        i = f->failed ? f->nr : f->next++;
+        if ( !dctx )
+            f->failed = true;
+        pthread_mutex_unlock(&f->lock);
+
+        if ( !dctx || i >= f->nr )
+            break;
+
+        rc = ZSTD_decompressDCtx(dctx, f->frame[i].dst, f->frame[i].dstlen,
+                                 f->frame[i].src, f->frame[i].srclen);
+        if ( ZSTD_isError(rc) || rc != f->frame[i].dstlen )
+        {
+            pthread_mutex_lock(&f->lock);
+            f->failed = true;
+            pthread_mutex_unlock(&f->lock);
+            break;
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+
+    return NULL;
+}
+
+static int xc_dom_do_unzstd(xc_interface *xch,
+                            void *src, size_t srclen, void *dst, size_t dstlen)
+{
+    struct zstd_frames f = { .dst = dst, .lock = PTHREAD_MUTEX_INITIALIZER };
+    pthread_t threads[MODULE_DECOMPRESS_MAX_THREADS];
+    bool started[MODULE_DECOMPRESS_MAX_THREADS] = {};
+    unsigned int i, nr_threads;
+    int rc = -1;
+
+    /* Split the input into its frames, and place each frame's output. */
+    if ( zstd_walk_frames(src, srclen, add_zstd_frame, &f) != dstlen )
+        goto out;
+
+    nr_threads = module_decompress_threads(f.nr);
+    for ( i = 1; i < nr_threads; i++ )
+        started[i] = !pthread_create(&threads[i], NULL, unzstd_frames, &f);
+    unzstd_frames(&f);
+    for ( i = 1; i < nr_threads; i++ )
+        if ( started[i] )
+            pthread_join(threads[i], NULL);
+
+    if ( !f.failed )
+    {
+        xc_dom_printf(xch, "%s: unzstd ok, 0x%zx -> 0x%zx (%u frames)",
+                      __FUNCTION__, srclen, dstlen, f.nr);
+        rc = 0;
+    }
+
+ out:
+    if ( rc )
+        xc_dom_panic(xch, XC_INTERNAL_ERROR, "%s: unzstd failed",
+                     __FUNCTION__);
+    free(f.frame);
+
+    return rc;
+}
+#endif
+
+#if !defined(__MINIOS__) && defined(HAVE_LZMA)
+#include <lzma.h>
+
+static size_t xc_dom_check_xz(xc_interface *xch, void *blob, size_t ziplen)
+{
+    static const uint8_t magic[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+    const uint8_t *p = blob;
+    lzma_stream_flags footer;
+    lzma_index *index = NULL;
+    uint64_t memlimit = UINT64_MAX;
+    size_t pos = 0;
+    lzma_vli unziplen = 0;
+
+    if ( ziplen < 2 * LZMA_STREAM_HEADER_SIZE ||
+         memcmp(p, magic, sizeof(magic)) )
+        return 0;
+
+    /*
+     * The size lives in the index at the end of the stream.  Only a single
+     * stream without padding is handled; anything else is passed through.
+     */
+    if ( lzma_stream_footer_decode(&footer,
+                                   p + ziplen - LZMA_STREAM_HEADER_SIZE) !=
+         LZMA_OK ||
+         footer.backward_size > ziplen - 2 * LZMA_STREAM_HEADER_SIZE )
+        return 0;
+
+    if ( lzma_index_buffer_decode(&index, &memlimit, NULL,
+                                  p + ziplen - LZMA_STREAM_HEADER_SIZE -
+                                  footer.backward_size,
+                                  &pos, footer.backward_size) != LZMA_OK )
+        return 0;
+
+    if ( lzma_index_stream_size(index) == ziplen )
+        unziplen = lzma_index_uncompressed_size(index);
+    lzma_index_end(index, NULL);
+
+    if ( unziplen > XC_DOM_DECOMPRESS_MAX )
+    {
+        xc_dom_printf
+            (xch,
+             "%s: size (zip %zd, unzip %"PRIu64") looks insane, skip unxz",
+             __FUNCTION__, ziplen, (uint64_t)unziplen);
+        return 0;
+    }
+
+    return unziplen;
+}
+
+static int xc_dom_do_unxz(xc_interface *xch,
+                          void *src, size_t srclen, void *dst, size_t dstlen)
+{
+    lzma_stream stream = LZMA_STREAM_INIT;
+    lzma_ret ret;
+
+#if LZMA_VERSION >= 50040002 /* 5.4.0 */
+    /* Blocks are decoded in parallel, if the encoder split the input. */
+    lzma_mt mt = {
+        .threads = module_decompress_threads(MODULE_DECOMPRESS_MAX_THREADS),
+        .memlimit_threading = lzma_physmem() / 4,
+        .memlimit_stop = UINT64_MAX,
+    };
+
+    ret = lzma_stream_decoder_mt(&stream, &mt);
+#else
+    ret = lzma_stream_decoder(&stream, UINT64_MAX, 0);
+#endif
+    if ( ret != LZMA_OK )
+    {
+        xc_dom_panic(xch, XC_INTERNAL_ERROR,
+                     "%s: decoder init failed (rc=%d)", __FUNCTION__, ret);
+        return -1;
+    }
+
+    stream.next_in = src;
+    stream.avail_in = srclen;
+    stream.next_out = dst;
+    stream.avail_out = dstlen;
+    ret = lzma_code(&stream, LZMA_FINISH);
+    lzma_end(&stream);
+    if ( ret != LZMA_STREAM_END || stream.avail_out )
+    {
+        xc_dom_panic(xch, XC_INTERNAL_ERROR,
+                     "%s: unxz failed (rc=%d)", __FUNCTION__, ret);
+        return -1;
+    }
+
+    xc_dom_printf(xch, "%s: unxz ok, 0x%zx -> 0x%zx",
+                  __FUNCTION__, srclen, dstlen);
+    return 0;
+}
+#endif
+
 /* ------------------------------------------------------------------------ */
 /* domain memory                                                            */
 
@@ -980,15 +1270,29 @@ int xc_dom_mem_init(struct xc_dom_image *dom, unsigned int mem_mb)
 
 static int xc_dom_build_module(struct xc_dom_image *dom, unsigned int mod)
 {
-    size_t unziplen, modulelen;
+    size_t unziplen = 0, modulelen;
+    int (*unzip)(xc_interface *xch, void *src, size_t srclen,
+                 void *dst, size_t dstlen) = xc_dom_do_gunzip;
     void *modulemap;
     char name[10];
 
     if ( !dom->modules[mod].seg.vstart )
+    {
         unziplen = xc_dom_check_gzip(dom->xch,
                                      dom->modules[mod].blob, dom->modules[mod].size);
-    else
-        unziplen = 0;
+#if !defined(__MINIOS__) && defined(HAVE_ZSTD)
+        if ( !unziplen &&
+             (unziplen = xc_dom_check_zstd(dom->xch, dom->modules[mod].blob,
+                                           dom->modules[mod].size)) )
+            unzip = xc_dom_do_unzstd;
+#endif
+#if !defined(__MINIOS__) && defined(HAVE_LZMA)
+        if ( !unziplen &&
+             (unziplen = xc_dom_check_xz(dom->xch, dom->modules[mod].blob,
+                                         dom->modules[mod].size)) )
+            unzip = xc_dom_do_unxz;
+#endif
+    }
 
     modulelen = max(unziplen, dom->modules[mod].size);
     if ( dom->max_module_size )
@@ -1020,8 +1324,8 @@ static int xc_dom_build_module(struct xc_dom_image *dom, unsigned int mod)
     }
     if ( unziplen )
     {
-        if ( xc_dom_do_gunzip(dom->xch, dom->modules[mod].blob, dom->modules[mod].size,
-                              modulemap, unziplen) != -1 )
+        if ( unzip(dom->xch, dom->modules[mod].blob, dom->modules[mod].size,
+                   modulemap, unziplen) != -1 )
             return 0;
         if ( dom->modules[mod].size > modulelen )
             goto err;
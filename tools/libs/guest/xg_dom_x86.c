@@ -27,6 +27,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <xen/xen.h>
 #include <xen/foreign/x86_32.h>
@@ -1345,6 +1347,202 @@ static int check_mmio_hole(uint64_t start, uint64_t memsize,
         return 1;
 }
 
+/*
+ * Bulk population of HVM guest memory with XENMEM_populate_physmap_range.
+ * The vmemranges are cut into POPULATE_CHUNK_PFNS sized pieces which are
+ * handed out to dom->populate_threads threads; each piece is one (Xen side
+ * preemptible) hypercall which picks 1GB, 2MB or 4kB extents itself.
+ */
+#define POPULATE_CHUNK_PFNS (SUPERPAGE_1GB_NR_PFNS * 4)
+
+struct populate_chunk {
+    xen_pfn_t gfn;
+    unsigned long nr;
+    unsigned int max_order;
+    unsigned int memflags;
+};
+
+struct populate_work {
+    struct xc_dom_image *dom;
+    struct populate_chunk *chunks;
+    unsigned int nr_chunks;
+    unsigned int next;
+    int err;
+    pthread_mutex_t lock;
+};
+
+static void *populate_worker(void *arg)
+{
+    struct populate_work *w = arg;
+    struct xc_dom_image *dom = w->dom;
+    xc_interface *xch = dom->xch;
+
+    for ( ; ; )
+    {
+        struct populate_chunk *c;
+        unsigned long done;
+
+        pthread_mutex_lock(&w->lock);
+        c = (w->err || w->next >= w->nr_chunks) ? NULL
+                                                : &w->chunks[w->next++];
+        pthread_mutex_unlock(&w->lock);
+
+        if ( !c )
+            break;
+
+        if ( xc_domain_populate_physmap_range(xch, dom->guest_domid,
+                                              c->gfn, c->nr, c->max_order,
+                                              c->memflags, &done) )
+        {
+            int err = errno;
+
+            DOMPRINTF("%s: gfn 0x%"PRI_xen_pfn" count 0x%lx: done 0x%lx (errno %d)",
+                      __func__, c->gfn, c->nr, done, err);
+            pthread_mutex_lock(&w->lock);
+            if ( !w->err )
+                w->err = err ?: EINVAL;
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns 0 on success, or -1 with errno set.  errno of ENOSYS or EOPNOTSUPP
+ * means nothing was populated and the caller should use the legacy path.
+ */
+static int meminit_hvm_ranges(struct xc_dom_image *dom,
+                              const xen_vmemrange_t *vmemranges,
+                              unsigned int nr_vmemranges,
+                              const unsigned int *vnode_to_pnode,
+                              unsigned int memflags,
+                              unsigned long *nr_populated)
+{
+    struct populate_work w = {
+        .dom = dom,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    unsigned int i, nr_chunks, nr_threads = dom->populate_threads ?: 1;
+    unsigned long total = 0;
+    pthread_t *threads = NULL;
+    int rc = -1;
+
+    /* Work out how many chunks there are, then fill them in. */
+    for ( i = 0; i < 2; i++ )
+    {
+        unsigned int vmemid;
+
+        w.nr_chunks = 0;
+        for ( vmemid = 0; vmemid < nr_vmemranges; vmemid++ )
+        {
+            unsigned int pnode = vnode_to_pnode[vmemranges[vmemid].nid];
+            unsigned int new_memflags = memflags;
+            xen_pfn_t pfn = vmemranges[vmemid].start >> PAGE_SHIFT;
+            xen_pfn_t end = vmemranges[vmemid].end >> PAGE_SHIFT;
+            unsigned int max_order = SUPERPAGE_1GB_SHIFT;
+
+            if ( pnode != XC_NUMA_NO_NODE )
+                new_memflags |= XENMEMF_exact_node(pnode);
+
+            /* 0x00000-0xA0000 is populated by the caller, skip the VGA hole. */
+            if ( pfn == 0 && dom->device_model )
+                pfn = 0xc0;
+
+            if ( check_mmio_hole(pfn << PAGE_SHIFT, (end - pfn) << PAGE_SHIFT,
+                                 dom->mmio_start, dom->mmio_size) )
+                max_order = SUPERPAGE_2MB_SHIFT;
+
+            while ( pfn < end )
+            {
+                /* Chunks end on a chunk boundary, to keep 1GB extents whole. */
+                xen_pfn_t next = (pfn + POPULATE_CHUNK_PFNS) &
+                                 ~(POPULATE_CHUNK_PFNS - 1);
+
+                if ( next > end )
+                    next = end;
+
+                if ( w.chunks )
+                {
+                    w.chunks[w.nr_chunks].gfn = pfn;
+                    w.chunks[w.nr_chunks].nr = next - pfn;
+                    w.chunks[w.nr_chunks].max_order = max_order;
+                    w.chunks[w.nr_chunks].memflags = new_memflags;
+                    total += next - pfn;
+                }
+                w.nr_chunks++;
+                pfn = next;
+            }
+        }
+
+        if ( w.chunks || !w.nr_chunks )
+            break;
+
+        w.chunks = calloc(w.nr_chunks, sizeof(*w.chunks));
+        if ( !w.chunks )
+        {
+            DOMPRINTF("%s: Failed to allocate %u chunks", __func__,
+                      w.nr_chunks);
+            return -1;
+        }
+    }
+
+    if ( !w.nr_chunks )
+    {
+        *nr_populated = 0;
+        return 0;
+    }
+
+    /*
+     * Issue the first chunk synchronously: if Xen lacks the sub-op nothing
+     * will have been populated and the caller can fall back cleanly.
+     */
+    nr_chunks = w.nr_chunks;
+    w.nr_chunks = 1;
+    populate_worker(&w);
+    w.nr_chunks = nr_chunks;
+    if ( w.err )
+        goto out;
+
+    if ( nr_threads > nr_chunks - 1 )
+        nr_threads = nr_chunks - 1;
+
+    if ( nr_threads > 1 )
+    {
+        threads = calloc(nr_threads, sizeof(*threads));
+        if ( !threads )
+            nr_threads = 1;
+    }
+
+    if ( nr_threads > 1 )
+    {
+        /* The calling thread does its share too. */
+        for ( i = 1; i < nr_threads; i++ )
+            if ( pthread_create(&threads[i], NULL, populate_worker, &w) )
+                break;
+        nr_threads = i;
+        populate_worker(&w);
+        for ( i = 1; i < nr_threads; i++ )
+            pthread_join(threads[i], NULL);
+    }
+    else
+        populate_worker(&w);
+
+    if ( w.err )
+        goto out;
+
+    *nr_populated = total;
+    rc = 0;
+
+ out:
+    free(threads);
+    free(w.chunks);
+    if ( rc )
+        errno = w.err;
+    return rc;
+}
+
 static int meminit_hvm(struct xc_dom_image *dom)
 {
     unsigned long i, vmemid, nr_pages = dom->total_pages;
@@ -1353,9 +1551,10 @@ static int meminit_hvm(struct xc_dom_image *dom)
     unsigned long cur_pages, cur_pfn;
     int rc;
     unsigned long stat_normal_pages = 0, stat_2mb_pages = 0,
-        stat_1gb_pages = 0;
+        stat_1gb_pages = 0, stat_range_pages = 0;
     unsigned int memflags = 0;
     int claim_enabled = dom->claim_enabled;
+    bool ranged = false;
     uint64_t total_pages;
     xen_vmemrange_t dummy_vmemrange[2];
     unsigned int dummy_vnode_to_pnode[1];
@@ -1493,7 +1692,29 @@ static int meminit_hvm(struct xc_dom_image *dom)
     }
 
     stat_normal_pages = 0;
-    for ( vmemid = 0; vmemid < nr_vmemranges; vmemid++ )
+
+    /*
+     * Without PoD let Xen pick the extents for whole ranges, which can be
+     * done by several threads at once.  Only fall back to the loop below if
+     * the hypervisor doesn't support that.
+     */
+    if ( !(memflags & XENMEMF_populate_on_demand) )
+    {
+        if ( !meminit_hvm_ranges(dom, vmemranges, nr_vmemranges,
+                                 vnode_to_pnode, memflags, &stat_range_pages) )
+        {
+            ranged = true;
+            if ( dom->device_model )
+                stat_normal_pages += 0xa0;
+        }
+        else if ( errno != ENOSYS && errno != EOPNOTSUPP )
+        {
+            DOMPRINTF("Could not allocate memory for HVM guest.");
+            goto error_out;
+        }
+    }
+
+    for ( vmemid = 0; !ranged && vmemid < nr_vmemranges; vmemid++ )
     {
         unsigned int new_memflags = memflags;
         uint64_t end_pages;
@@ -1634,6 +1855,8 @@ static int meminit_hvm(struct xc_dom_image *dom)
     DPRINTF("  4KB PAGES: 0x%016lx\n", stat_normal_pages);
     DPRINTF("  2MB PAGES: 0x%016lx\n", stat_2mb_pages);
     DPRINTF("  1GB PAGES: 0x%016lx\n", stat_1gb_pages);
+    if ( ranged )
+        DPRINTF("  RANGED PAGES: 0x%016lx\n", stat_range_pages);
 
     rc = 0;
     goto out;
@@ -39,6 +39,17 @@ static const char *const mandatory_rec_types[] =
     [REC_TYPE_STATIC_DATA_END]              = "Static data end",
     [REC_TYPE_X86_CPUID_POLICY]             = "x86 CPUID policy",
     [REC_TYPE_X86_MSR_POLICY]               = "x86 MSR policy",
+    [REC_TYPE_DATA_CHANNELS]                = "Data channels",
+    [REC_TYPE_DATA_CHANNELS_END]            = "Data channels end",
+    [REC_TYPE_COMPRESSED_PAGE_DATA]         = "Compressed page data",
+    [REC_TYPE_POSTCOPY_PFNS]                = "Post-copy pfns",
+    [REC_TYPE_POSTCOPY_REQUEST]             = "Post-copy request",
+    [REC_TYPE_PAGE_DATA_INDEX]              = "Page data index",
+};
+
+static const char *const optional_rec_types[] =
+{
+    [REC_TYPE_MEMORY_LAYOUT & ~REC_TYPE_OPTIONAL] = "Memory layout",
 };
 
 const char *rec_type_to_str(uint32_t type)
@@ -49,12 +60,20 @@ const char *rec_type_to_str(uint32_t type)
              (mandatory_rec_types[type]) )
             return mandatory_rec_types[type];
     }
+    else
+    {
+        type &= ~REC_TYPE_OPTIONAL;
+
+        if ( (type < ARRAY_SIZE(optional_rec_types)) &&
+             (optional_rec_types[type]) )
+            return optional_rec_types[type];
+    }
 
     return "Reserved";
 }
 
-int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
-                       void *buf, size_t sz)
+int write_split_record_fd(struct xc_sr_context *ctx, int fd,
+                          struct xc_sr_record *rec, void *buf, size_t sz)
 {
     static const char zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
 
@@ -81,7 +100,7 @@ int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
     if ( sz )
         assert(buf);
 
-    if ( writev_exact(ctx->fd, parts, ARRAY_SIZE(parts)) )
+    if ( writev_exact(fd, parts, ARRAY_SIZE(parts)) )
         goto err;
 
     return 0;
@@ -91,6 +110,12 @@ int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
     return -1;
 }
 
+int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
+                       void *buf, size_t sz)
+{
+    return write_split_record_fd(ctx, ctx->fd, rec, buf, sz);
+}
+
 int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec)
 {
     xc_interface *xch = ctx->xch;
@@ -154,6 +179,11 @@ static void __attribute__((unused)) build_assertions(void)
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_x86_tsc_info)      != 24);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_hvm_params_entry)  != 16);
     BUILD_BUG_ON(sizeof(struct xc_sr_rec_hvm_params)        != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_data_channels)     != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_compressed_page_data_header) != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_memory_layout_entry) != 16);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_memory_layout)       != 8);
+    BUILD_BUG_ON(sizeof(struct xc_sr_rec_page_data_index)     != 24);
 }
 
 /*
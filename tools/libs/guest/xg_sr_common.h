@@ -1,8 +1,12 @@
 #ifndef __COMMON__H
 #define __COMMON__H
 
+#include <pthread.h>
 #include <stdbool.h>
 
+#include <xenevtchn.h>
+#include <xen/vm_event.h>
+
 #include "xg_private.h"
 #include "xg_save_restore.h"
 #include "xc_bitops.h"
@@ -211,6 +215,96 @@ static inline int update_blob(struct xc_sr_blob *blob,
     return 0;
 }
 
+/*
+ * A data channel, carrying PAGE_DATA records alongside the primary stream.
+ * Each has a thread of its own mapping, copying and sending (or receiving)
+ * the pages, so that this happens concurrently across channels.
+ */
+#define MAX_DATA_CHANNELS 64
+
+/* PFNs are spread across channels in chunks of 2M. */
+#define DATA_CHANNEL_PFN_SHIFT 9
+
+struct xc_sr_channel
+{
+    struct xc_sr_context *ctx;
+    int fd;
+    pthread_t thread;
+    bool running;
+
+    /* Save: batch being filled, and batch handed over to the thread. */
+    xen_pfn_t *batch_pfns;
+    unsigned int nr_batch_pfns;
+    xen_pfn_t *pending_pfns;
+    unsigned int nr_pending_pfns;
+    bool stop;
+
+    /* First error encountered by the thread. */
+    int rc;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/*
+ * A batch of pages mapped (and, for PV guests, localised) for sending.
+ */
+struct xc_sr_batch
+{
+    const xen_pfn_t *pfns;
+    unsigned int nr_pfns;
+    xen_pfn_t *types;
+    /* Pointers to page data to send.  Mapped gfns or local allocations. */
+    void **guest_data;
+    /* Pointers to locally allocated pages.  Need freeing. */
+    void **local_pages;
+    void *guest_mapping;
+    unsigned int nr_pages, nr_pages_mapped;
+};
+
+/*
+ * Without data channels, page data in the primary stream is sent by a writer
+ * thread, while the next batch gets mapped.
+ */
+#define MAX_WRITER_BATCH_SIZE 16384 /* up to 64MB at a time */
+
+struct xc_sr_writer
+{
+    pthread_t thread;
+    bool running;
+
+    /* Batch handed over to the thread, and pfn buffer to fill meanwhile. */
+    struct xc_sr_batch batch;
+    bool busy;
+    xen_pfn_t *spare_pfns;
+    bool stop;
+
+    /* First error encountered by the thread. */
+    int rc;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/*
+ * Remus: the dirty pages of a checkpoint, copied out of the guest while it
+ * is suspended, to be sent once it has been resumed.
+ */
+struct xc_sr_snapshot
+{
+    /* Snapshot checkpoints rather than sending them from a paused guest. */
+    bool enabled;
+    /* The current checkpoint's dirty pages are being snapshotted. */
+    bool active;
+
+    struct xc_sr_snapshot_batch
+    {
+        xen_pfn_t *pfns;
+        struct xc_sr_batch batch;
+    } *batches;
+    unsigned int nr_batches, max_batches;
+};
+
 struct xc_sr_context
 {
     xc_interface *xch;
@@ -237,15 +331,61 @@ struct xc_sr_context
             /* Further debugging information in the stream. */
             bool debug;
 
+            /* Elide zero pages, and compress page data. */
+            bool compress;
+
+            /* Send a MEMORY_LAYOUT record ahead of the page data. */
+            bool memory_layout;
+
+            /* Send a PAGE_DATA_INDEX record in place of page data. */
+            bool indexed;
+
             unsigned long p2m_size;
 
             struct precopy_stats stats;
 
             xen_pfn_t *batch_pfns;
-            unsigned int nr_batch_pfns;
+            unsigned int nr_batch_pfns, batch_size;
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
+            /* Taken for deferring pages, which channel threads may do. */
+            pthread_mutex_t deferred_lock;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+
+            /* Per-vCPU dirty rings, if Xen supports them for the domain. */
+            unsigned int nr_dirty_rings;
+            xenforeignmemory_resource_handle **dirty_ring_res;
+            xen_dirty_ring_t **dirty_rings;
+            /* PFNs harvested from the rings; -1 if in the bitmap instead. */
+            xen_pfn_t *dirty_ring_pfns;
+            long nr_dirty_ring_pfns;
+
+            /* Data channels for the page data, if any. */
+            unsigned int nr_channels;
+            struct xc_sr_channel *channels;
+            /* Otherwise, the writer thread for the primary stream. */
+            struct xc_sr_writer writer;
+            struct xc_sr_snapshot snapshot;
+
+            /*
+             * Auto-converge: percentage of CPU time taken away from the
+             * guest, and its scheduling parameters beforehand.
+             */
+            unsigned int throttle;
+            bool throttle_unsupported;
+            uint32_t sched_id;
+            union {
+                struct xen_domctl_sched_credit credit;
+                struct xen_domctl_sched_credit2 credit2;
+            } sched_params;
+
+            /*
+             * Post-copy: channel for the pages left behind when the domain
+             * got suspended, and those pages (bounded by p2m_size).
+             */
+            int postcopy_fd;
+            unsigned long *postcopy_pfns;
+            unsigned long nr_postcopy_pfns;
         } save;
 
         struct /* Restore data. */
@@ -297,6 +437,47 @@ struct xc_sr_context
 
             /* Sender has invoked verify mode on the stream. */
             bool verify;
+
+            /* Data channels provided by the caller, if any. */
+            unsigned int nr_channels;
+            struct xc_sr_channel *channels;
+            bool seen_data_channels_end;
+            /* Serialises populate_pfns() across channel threads. */
+            pthread_mutex_t populate_lock;
+
+            struct /* Post-copy. */
+            {
+                /* Channel for the pages left behind by the sender. */
+                int fd;
+
+                /* Those pfns, in ascending order. */
+                xen_pfn_t *pfns;
+                unsigned long nr_pfns;
+
+                /*
+                 * Set once the stream has ended and the guest may run: the
+                 * pager is loading the pages from the channel.  Bitmaps
+                 * index pfns[].
+                 */
+                bool active;
+                unsigned long *pending;
+                unsigned long nr_pending;
+                unsigned long *requested;
+
+                /* Paging ring. */
+                void *ring_page;
+                vm_event_back_ring_t back_ring;
+                xenevtchn_handle *xce;
+                evtchn_port_t port;
+
+                /* Guest accesses waiting for their page to arrive. */
+                vm_event_response_t *waiting;
+                unsigned int nr_waiting, max_waiting;
+
+                /* Pfns to request from the sender. */
+                uint64_t *queue;
+                unsigned int nr_queue;
+            } postcopy;
         } restore;
     };
 
@@ -417,6 +598,12 @@ struct xc_sr_record
 int write_split_record(struct xc_sr_context *ctx, struct xc_sr_record *rec,
                        void *buf, size_t sz);
 
+/*
+ * As write_split_record(), but to a stream other than the primary one.
+ */
+int write_split_record_fd(struct xc_sr_context *ctx, int fd,
+                          struct xc_sr_record *rec, void *buf, size_t sz);
+
 /*
  * Writes a record to the stream, applying correct padding where appropriate.
  * Records with a non-zero length must provide a valid data field; records
@@ -452,6 +639,13 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec);
 int populate_pfns(struct xc_sr_context *ctx, unsigned int count,
                   const xen_pfn_t *original_pfns, const uint32_t *types);
 
+/*
+ * Populate a pfn whose contents the sender left for post-copy, because the
+ * restore needs it ahead of the guest.  Its contents are then discarded
+ * when they arrive.  No-op for other pfns.
+ */
+int postcopy_populate_pfn(struct xc_sr_context *ctx, xen_pfn_t pfn);
+
 /* Handle a STATIC_DATA_END record. */
 int handle_static_data_end(struct xc_sr_context *ctx);
 
@@ -1,6 +1,9 @@
 #include <arpa/inet.h>
 
 #include <assert.h>
+#include <poll.h>
+
+#include <zlib.h>
 
 #include "xg_sr_common.h"
 
@@ -196,229 +199,1633 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned int count,
 }
 
 /*
- * Given a list of pfns, their types, and a block of page data from the
- * stream, populate and record their types, map the relevant subset and copy
- * the data into the guest.
+ * MEMORY_LAYOUT: the sender describes the runs of populated pfns up front
+ * (as does PAGE_DATA_INDEX).
+ * Each naturally aligned 1G/2M span lying entirely within a run and not yet
+ * populated is allocated as one extent, by a few threads in parallel.  The
+ * page data then lands in those extents.  Whatever cannot be allocated this
+ * way is left for populate_pfns() as the data arrives.
  */
-static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
-                             xen_pfn_t *pfns, uint32_t *types, void *page_data)
+#define LAYOUT_MAX_THREADS    4U
+
+#define SUPERPAGE_2MB_SHIFT   9
+#define SUPERPAGE_2MB_NR_PFNS (1UL << SUPERPAGE_2MB_SHIFT)
+#define SUPERPAGE_1GB_SHIFT   18
+#define SUPERPAGE_1GB_NR_PFNS (1UL << SUPERPAGE_1GB_SHIFT)
+
+struct layout_job
+{
+    xen_pfn_t pfn;
+    unsigned int order;
+    unsigned int unit;          /* Index of the first 2M unit. */
+};
+
+struct layout_populate
+{
+    xc_interface *xch;
+    uint32_t domid;
+    const struct layout_job *jobs;
+    unsigned int nr_jobs;
+    unsigned int first, stride;
+    uint8_t *ok;                /* One per 2M unit, written by one thread. */
+};
+
+static bool layout_populate_extent(xc_interface *xch, uint32_t domid,
+                                   xen_pfn_t pfn, unsigned int order)
+{
+    xen_pfn_t gfn = pfn;
+
+    return !xc_domain_populate_physmap_exact(xch, domid, 1, order, 0, &gfn);
+}
+
+static void *layout_populate_fn(void *arg)
+{
+    struct layout_populate *lp = arg;
+    unsigned int i, j;
+
+    for ( i = lp->first; i < lp->nr_jobs; i += lp->stride )
+    {
+        const struct layout_job *job = &lp->jobs[i];
+
+        if ( layout_populate_extent(lp->xch, lp->domid, job->pfn, job->order) )
+        {
+            memset(&lp->ok[job->unit], 1,
+                   1U << (job->order - SUPERPAGE_2MB_SHIFT));
+            continue;
+        }
+
+        if ( job->order == SUPERPAGE_2MB_SHIFT )
+            continue;
+
+        /* No 1G extent to be had; try for 2M ones instead. */
+        for ( j = 0; j < (1U << (job->order - SUPERPAGE_2MB_SHIFT)); ++j )
+            lp->ok[job->unit + j] = layout_populate_extent(
+                lp->xch, lp->domid,
+                job->pfn + ((xen_pfn_t)j << SUPERPAGE_2MB_SHIFT),
+                SUPERPAGE_2MB_SHIFT);
+    }
+
+    return NULL;
+}
+
+static bool layout_range_unpopulated(const struct xc_sr_context *ctx,
+                                     xen_pfn_t pfn, unsigned long nr)
+{
+    for ( ; nr; ++pfn, --nr )
+        if ( pfn_is_populated(ctx, pfn) )
+            return false;
+
+    return true;
+}
+
+static int populate_layout(struct xc_sr_context *ctx,
+                           const struct xc_sr_rec_memory_layout_entry *entry,
+                           unsigned int count)
 {
     xc_interface *xch = ctx->xch;
-    xen_pfn_t *mfns = malloc(count * sizeof(*mfns));
-    int *map_errs = malloc(count * sizeof(*map_errs));
-    int rc;
-    void *mapping = NULL, *guest_page = NULL;
-    unsigned int i, /* i indexes the pfns from the record. */
-        j,          /* j indexes the subset of pfns we decide to map. */
-        nr_pages = 0;
+    struct layout_job *jobs = NULL, *job;
+    struct layout_populate lp[LAYOUT_MAX_THREADS] = {};
+    pthread_t threads[LAYOUT_MAX_THREADS];
+    bool started[LAYOUT_MAX_THREADS] = {};
+    unsigned int i, k, nr_jobs = 0, max_jobs = 0, nr_units = 0, nr_threads;
+    unsigned long nr_populated = 0;
+    uint8_t *ok = NULL;
+    xen_pfn_t pfn, end;
+    int rc = -1;
 
-    if ( !mfns || !map_errs )
+    for ( i = 0; i < count; ++i )
     {
-        rc = -1;
-        ERROR("Failed to allocate %zu bytes to process page data",
-              count * (sizeof(*mfns) + sizeof(*map_errs)));
-        goto err;
+        end = entry[i].pfn + entry[i].nr_pfns;
+
+        pfn = ROUNDUP(entry[i].pfn, SUPERPAGE_2MB_SHIFT);
+        while ( pfn + SUPERPAGE_2MB_NR_PFNS <= end )
+        {
+            unsigned int order =
+                (!(pfn & (SUPERPAGE_1GB_NR_PFNS - 1)) &&
+                 pfn + SUPERPAGE_1GB_NR_PFNS <= end &&
+                 layout_range_unpopulated(ctx, pfn, SUPERPAGE_1GB_NR_PFNS))
+                ? SUPERPAGE_1GB_SHIFT : SUPERPAGE_2MB_SHIFT;
+
+            if ( order == SUPERPAGE_2MB_SHIFT &&
+                 !layout_range_unpopulated(ctx, pfn, SUPERPAGE_2MB_NR_PFNS) )
+            {
+                pfn += SUPERPAGE_2MB_NR_PFNS;
+                continue;
+            }
+
+            if ( nr_jobs == max_jobs )
+            {
+                max_jobs = max_jobs ? max_jobs * 2 : 64;
+                job = realloc(jobs, max_jobs * sizeof(*jobs));
+                if ( !job )
+                {
+                    ERROR("Unable to allocate memory for %u layout extents",
+                          max_jobs);
+                    goto out;
+                }
+                jobs = job;
+            }
+
+            jobs[nr_jobs].pfn = pfn;
+            jobs[nr_jobs].order = order;
+            jobs[nr_jobs].unit = nr_units;
+            nr_jobs++;
+            nr_units += 1U << (order - SUPERPAGE_2MB_SHIFT);
+            pfn += 1UL << order;
+        }
     }
 
-    rc = populate_pfns(ctx, count, pfns, types);
-    if ( rc )
+    if ( !nr_jobs )
     {
-        ERROR("Failed to populate pfns for batch of %u pages", count);
-        goto err;
+        rc = 0;
+        goto out;
     }
 
-    for ( i = 0; i < count; ++i )
+    ok = calloc(nr_units, sizeof(*ok));
+    if ( !ok )
     {
-        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+        ERROR("Unable to allocate memory for %u layout units", nr_units);
+        goto out;
+    }
 
-        if ( page_type_has_stream_data(types[i]) )
-            mfns[nr_pages++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+    nr_threads = min(nr_jobs, LAYOUT_MAX_THREADS);
+    for ( k = 0; k < nr_threads; ++k )
+    {
+        lp[k] = (struct layout_populate){
+            .xch = xch,
+            .domid = ctx->domid,
+            .jobs = jobs,
+            .nr_jobs = nr_jobs,
+            .first = k,
+            .stride = nr_threads,
+            .ok = ok,
+        };
+
+        /* Slice 0 runs here.  Any slice without a thread does too. */
+        if ( k )
+            started[k] = !pthread_create(&threads[k], NULL,
+                                         layout_populate_fn, &lp[k]);
     }
 
-    /* Nothing to do? */
-    if ( nr_pages == 0 )
-        goto done;
+    for ( k = 0; k < nr_threads; ++k )
+        if ( !started[k] )
+            layout_populate_fn(&lp[k]);
 
-    mapping = guest_page = xenforeignmemory_map(
-        xch->fmem, ctx->domid, PROT_READ | PROT_WRITE,
-        nr_pages, mfns, map_errs);
-    if ( !mapping )
+    for ( k = 1; k < nr_threads; ++k )
+        if ( started[k] )
+            pthread_join(threads[k], NULL);
+
+    for ( i = 0; i < nr_jobs; ++i )
     {
-        rc = -1;
-        PERROR("Unable to map %u mfns for %u pages of data",
-               nr_pages, count);
-        goto err;
+        for ( k = 0; k < (1U << (jobs[i].order - SUPERPAGE_2MB_SHIFT)); ++k )
+        {
+            if ( !ok[jobs[i].unit + k] )
+                continue;
+
+            pfn = jobs[i].pfn + ((xen_pfn_t)k << SUPERPAGE_2MB_SHIFT);
+            for ( end = pfn + SUPERPAGE_2MB_NR_PFNS; pfn < end; ++pfn )
+            {
+                if ( pfn_set_populated(ctx, pfn) )
+                    goto out;
+                ctx->restore.ops.set_gfn(ctx, pfn, pfn);
+            }
+            nr_populated += SUPERPAGE_2MB_NR_PFNS;
+        }
     }
 
-    for ( i = 0, j = 0; i < count; ++i )
-    {
-        if ( !page_type_has_stream_data(types[i]) )
-            continue;
+    DPRINTF("Populated %lu of %lu pfns from the memory layout as superpages",
+            nr_populated, (unsigned long)nr_units * SUPERPAGE_2MB_NR_PFNS);
+    rc = 0;
 
-        if ( map_errs[j] )
+ out:
+    free(ok);
+    free(jobs);
+
+    return rc;
+}
+
+/*
+ * Check the runs of a MEMORY_LAYOUT or PAGE_DATA_INDEX record: non-empty,
+ * valid, and ascending without overlap.
+ */
+static int validate_layout(struct xc_sr_context *ctx, const char *what,
+                           const struct xc_sr_rec_memory_layout_entry *entry,
+                           unsigned int count)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t end = 0;
+    unsigned int i;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( !entry[i].nr_pfns || entry[i].pfn < end ||
+             entry[i].pfn + entry[i].nr_pfns < entry[i].pfn ||
+             !ctx->restore.ops.pfn_is_valid(ctx, entry[i].pfn) ||
+             !ctx->restore.ops.pfn_is_valid(
+                 ctx, entry[i].pfn + entry[i].nr_pfns - 1) )
         {
-            rc = -1;
-            ERROR("Mapping pfn %#"PRIpfn" (mfn %#"PRIpfn", type %#"PRIx32") failed with %d",
-                  pfns[i], mfns[j], types[i], map_errs[j]);
-            goto err;
+            ERROR("%s entry %u (pfn %#"PRIx64", nr %#"PRIx64") invalid",
+                  what, i, entry[i].pfn, entry[i].nr_pfns);
+            return -1;
         }
 
-        /* Undo page normalisation done by the saver. */
-        rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
-        if ( rc )
+        end = entry[i].pfn + entry[i].nr_pfns;
+    }
+
+    return 0;
+}
+
+static int handle_memory_layout(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_memory_layout *layout = rec->data;
+
+    /* Superpages are only of use to an HVM guest's p2m. */
+    if ( !ctx->dominfo.hvm )
+        return RECORD_NOT_PROCESSED;
+
+    if ( rec->length < sizeof(*layout) )
+    {
+        ERROR("MEMORY_LAYOUT record truncated: length %u, min %zu",
+              rec->length, sizeof(*layout));
+        return -1;
+    }
+
+    if ( rec->length != sizeof(*layout) +
+         (size_t)layout->count * sizeof(*layout->entry) )
+    {
+        ERROR("MEMORY_LAYOUT record wrong size: length %u, count %u",
+              rec->length, layout->count);
+        return -1;
+    }
+
+    return validate_layout(ctx, "MEMORY_LAYOUT", layout->entry,
+                           layout->count) ?:
+        populate_layout(ctx, layout->entry, layout->count);
+}
+
+/*
+ * PAGE_DATA_INDEX: the page data follows the record in a region of the
+ * savefile, at pfn offsets.  Populate the pfns, then read their contents
+ * straight into the guest, a few threads at a time.
+ */
+struct index_load
+{
+    xc_interface *xch;
+    uint32_t domid;
+    int fd;
+    off_t start;
+    const struct xc_sr_rec_memory_layout_entry *entry;
+    unsigned int count;
+    unsigned int first, stride;
+    int rc;
+};
+
+static int pread_exact(int fd, void *data, size_t size, off_t offset)
+{
+    ssize_t len;
+
+    while ( size )
+    {
+        len = pread(fd, data, size, offset);
+        if ( len < 0 && errno == EINTR )
+            continue;
+        if ( len <= 0 )
         {
-            ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
-                  pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
-            goto err;
+            if ( len == 0 )
+                errno = 0;
+            return -1;
         }
 
-        if ( ctx->restore.verify )
+        data += len;
+        size -= len;
+        offset += len;
+    }
+
+    return 0;
+}
+
+static void *index_load_fn(void *arg)
+{
+    struct index_load *il = arg;
+    xc_interface *xch = il->xch;
+    xen_pfn_t gfns[MAX_BATCH_SIZE], pfn, end;
+    int errs[MAX_BATCH_SIZE];
+    unsigned int i, j, nr, chunk = 0;
+    void *mapping;
+
+    for ( i = 0; i < il->count && !il->rc; ++i )
+    {
+        end = il->entry[i].pfn + il->entry[i].nr_pfns;
+
+        for ( pfn = il->entry[i].pfn; pfn < end && !il->rc;
+              pfn += nr, ++chunk )
         {
-            /* Verify mode - compare incoming data to what we already have. */
-            if ( memcmp(guest_page, page_data, PAGE_SIZE) )
-                ERROR("verify pfn %#"PRIpfn" failed (type %#"PRIx32")",
-                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+            nr = min_t(xen_pfn_t, MAX_BATCH_SIZE, end - pfn);
+
+            /* Chunks are dealt out round robin. */
+            if ( chunk % il->stride != il->first )
+                continue;
+
+            for ( j = 0; j < nr; ++j )
+                gfns[j] = pfn + j;
+
+            mapping = xenforeignmemory_map(xch->fmem, il->domid,
+                                           PROT_READ | PROT_WRITE, nr,
+                                           gfns, errs);
+            if ( !mapping )
+            {
+                PERROR("Unable to map pfns %#"PRIpfn"-%#"PRIpfn,
+                       pfn, pfn + nr - 1);
+                il->rc = -1;
+                break;
+            }
+
+            for ( j = 0; j < nr; ++j )
+            {
+                if ( errs[j] )
+                {
+                    ERROR("Mapping pfn %#"PRIpfn" failed with %d",
+                          pfn + j, errs[j]);
+                    il->rc = -1;
+                }
+            }
+
+            if ( !il->rc &&
+                 pread_exact(il->fd, mapping, (size_t)nr * PAGE_SIZE,
+                             il->start + (off_t)pfn * PAGE_SIZE) )
+            {
+                PERROR("Failed to read page data for pfns %#"PRIpfn
+                       "-%#"PRIpfn, pfn, pfn + nr - 1);
+                il->rc = -1;
+            }
+
+            xenforeignmemory_unmap(xch->fmem, mapping, nr);
         }
-        else
+    }
+
+    return NULL;
+}
+
+static int handle_page_data_index(struct xc_sr_context *ctx,
+                                  struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_index *idx = rec->data;
+    struct index_load il[LAYOUT_MAX_THREADS] = {};
+    pthread_t threads[LAYOUT_MAX_THREADS];
+    bool started[LAYOUT_MAX_THREADS] = {};
+    xen_pfn_t pfns[MAX_BATCH_SIZE], pfn, end;
+    unsigned int i, k, nr = 0;
+    struct stat st;
+    off_t pos, start;
+    int rc;
+
+    if ( !ctx->dominfo.hvm )
+    {
+        ERROR("PAGE_DATA_INDEX record is only valid for HVM guests");
+        return -1;
+    }
+
+    if ( rec->length < sizeof(*idx) )
+    {
+        ERROR("PAGE_DATA_INDEX record truncated: length %u, min %zu",
+              rec->length, sizeof(*idx));
+        return -1;
+    }
+
+    if ( rec->length != sizeof(*idx) +
+         (size_t)idx->count * sizeof(*idx->entry) )
+    {
+        ERROR("PAGE_DATA_INDEX record wrong size: length %u, count %u",
+              rec->length, idx->count);
+        return -1;
+    }
+
+    if ( validate_layout(ctx, "PAGE_DATA_INDEX", idx->entry, idx->count) )
+        return -1;
+
+    if ( idx->count &&
+         idx->entry[idx->count - 1].pfn +
+         idx->entry[idx->count - 1].nr_pfns > idx->nr_pfns )
+    {
+        ERROR("PAGE_DATA_INDEX entries beyond the %#"PRIx64" pfns of data",
+              idx->nr_pfns);
+        return -1;
+    }
+
+    if ( fstat(ctx->fd, &st) || !S_ISREG(st.st_mode) ||
+         (pos = lseek(ctx->fd, 0, SEEK_CUR)) < 0 )
+    {
+        ERROR("PAGE_DATA_INDEX record needs the stream to be a file");
+        return -1;
+    }
+
+    start = pos + idx->data_offset;
+    if ( idx->data_offset >= PAGE_SIZE || start > st.st_size ||
+         idx->nr_pfns > (st.st_size - start) / PAGE_SIZE )
+    {
+        ERROR("PAGE_DATA_INDEX data (offset %#"PRIx64", %#"PRIx64
+              " pfns) beyond the end of the file", idx->data_offset,
+              idx->nr_pfns);
+        return -1;
+    }
+
+    /* Superpages first, and whatever is left a page at a time. */
+    rc = populate_layout(ctx, idx->entry, idx->count);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < idx->count; ++i )
+    {
+        end = idx->entry[i].pfn + idx->entry[i].nr_pfns;
+
+        for ( pfn = idx->entry[i].pfn; pfn < end; ++pfn )
         {
-            /* Regular mode - copy incoming data into place. */
-            memcpy(guest_page, page_data, PAGE_SIZE);
+            pfns[nr++] = pfn;
+
+            if ( nr == MAX_BATCH_SIZE || (pfn + 1 == end &&
+                                          i + 1 == idx->count) )
+            {
+                rc = populate_pfns(ctx, nr, pfns, NULL);
+                if ( rc )
+                    return rc;
+                nr = 0;
+            }
         }
+    }
 
-        ++j;
-        guest_page += PAGE_SIZE;
-        page_data += PAGE_SIZE;
+    for ( k = 0; k < LAYOUT_MAX_THREADS; ++k )
+    {
+        il[k] = (struct index_load){
+            .xch = xch,
+            .domid = ctx->domid,
+            .fd = ctx->fd,
+            .start = start,
+            .entry = idx->entry,
+            .count = idx->count,
+            .first = k,
+            .stride = LAYOUT_MAX_THREADS,
+        };
+
+        /* Slice 0 runs here.  Any slice without a thread does too. */
+        if ( k )
+            started[k] = !pthread_create(&threads[k], NULL,
+                                         index_load_fn, &il[k]);
     }
 
- done:
-    rc = 0;
+    for ( k = 0; k < LAYOUT_MAX_THREADS; ++k )
+        if ( !started[k] )
+            index_load_fn(&il[k]);
 
- err:
-    if ( mapping )
-        xenforeignmemory_unmap(xch->fmem, mapping, nr_pages);
+    for ( k = 1; k < LAYOUT_MAX_THREADS; ++k )
+        if ( started[k] )
+            pthread_join(threads[k], NULL);
 
-    free(map_errs);
-    free(mfns);
+    for ( k = 0; k < LAYOUT_MAX_THREADS; ++k )
+        rc = rc ?: il[k].rc;
+    if ( rc )
+        return rc;
+
+    /* Carry on with the stream after the page data. */
+    if ( lseek(ctx->fd, start + (off_t)idx->nr_pfns * PAGE_SIZE,
+               SEEK_SET) < 0 )
+    {
+        PERROR("Unable to seek past the page data");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Post-copy: find a pfn the sender left behind.  Returns its index in
+ * postcopy.pfns[], or -1.
+ */
+static long postcopy_find(const struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    const xen_pfn_t *pfns = ctx->restore.postcopy.pfns;
+    unsigned long lo = 0, hi = ctx->restore.postcopy.nr_pfns, mid;
+
+    while ( lo < hi )
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if ( pfns[mid] == pfn )
+            return mid;
+
+        if ( pfns[mid] < pfn )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return -1;
+}
+
+int postcopy_populate_pfn(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    if ( postcopy_find(ctx, pfn) < 0 )
+        return 0;
+
+    return populate_pfns(ctx, 1, &pfn, NULL);
+}
+
+static void postcopy_put_response(struct xc_sr_context *ctx,
+                                  const vm_event_response_t *rsp)
+{
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+
+    memcpy(RING_GET_RESPONSE(back_ring, back_ring->rsp_prod_pvt), rsp,
+           sizeof(*rsp));
+    back_ring->rsp_prod_pvt++;
+    RING_PUSH_RESPONSES(back_ring);
+}
+
+/*
+ * Post-copy counterpart of process_page_data(), once the guest may be
+ * running: page the pages in, and resume the accesses waiting for them.
+ * Pages the guest has since dropped, or which were populated ahead of it,
+ * are discarded.
+ */
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned int count,
+                               const xen_pfn_t *pfns, const uint32_t *types,
+                               void *page_data)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_response_t *waiting = ctx->restore.postcopy.waiting;
+    unsigned int i, j;
+    bool notify = false;
+    long idx;
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( !page_type_has_stream_data(types[i]) )
+            continue;
+
+        idx = postcopy_find(ctx, pfns[i]);
+        if ( idx >= 0 && test_bit(idx, ctx->restore.postcopy.pending) )
+        {
+            if ( xc_mem_paging_load(xch, ctx->domid, pfns[i], page_data) )
+            {
+                PERROR("Failed to page in pfn %#"PRIpfn, pfns[i]);
+                return -1;
+            }
+
+            clear_bit(idx, ctx->restore.postcopy.pending);
+            ctx->restore.postcopy.nr_pending--;
+
+            for ( j = 0; j < ctx->restore.postcopy.nr_waiting; )
+            {
+                if ( waiting[j].u.mem_paging.gfn != pfns[i] )
+                {
+                    j++;
+                    continue;
+                }
+
+                postcopy_put_response(ctx, &waiting[j]);
+                waiting[j] = waiting[--ctx->restore.postcopy.nr_waiting];
+                notify = true;
+            }
+        }
+
+        page_data += PAGE_SIZE;
+    }
+
+    if ( notify &&
+         xenevtchn_notify(ctx->restore.postcopy.xce,
+                          ctx->restore.postcopy.port) < 0 )
+    {
+        PERROR("Failed to notify the paging ring");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Given a list of pfns, their types, and a block of page data from the
+ * stream, populate and record their types, map the relevant subset and copy
+ * the data into the guest.
+ */
+static int process_page_data(struct xc_sr_context *ctx, unsigned int count,
+                             xen_pfn_t *pfns, uint32_t *types, void *page_data)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t *mfns;
+    int *map_errs;
+    int rc;
+    void *mapping = NULL, *guest_page = NULL;
+    unsigned int i, /* i indexes the pfns from the record. */
+        j,          /* j indexes the subset of pfns we decide to map. */
+        nr_pages = 0;
+
+    if ( ctx->restore.postcopy.active )
+        return postcopy_load_pages(ctx, count, pfns, types, page_data);
+
+    mfns = malloc(count * sizeof(*mfns));
+    map_errs = malloc(count * sizeof(*map_errs));
+    if ( !mfns || !map_errs )
+    {
+        rc = -1;
+        ERROR("Failed to allocate %zu bytes to process page data",
+              count * (sizeof(*mfns) + sizeof(*map_errs)));
+        goto err;
+    }
+
+    pthread_mutex_lock(&ctx->restore.populate_lock);
+    rc = populate_pfns(ctx, count, pfns, types);
+    pthread_mutex_unlock(&ctx->restore.populate_lock);
+    if ( rc )
+    {
+        ERROR("Failed to populate pfns for batch of %u pages", count);
+        goto err;
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+
+        if ( page_type_has_stream_data(types[i]) )
+            mfns[nr_pages++] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+    }
+
+    /* Nothing to do? */
+    if ( nr_pages == 0 )
+        goto done;
+
+    mapping = guest_page = xenforeignmemory_map(
+        xch->fmem, ctx->domid, PROT_READ | PROT_WRITE,
+        nr_pages, mfns, map_errs);
+    if ( !mapping )
+    {
+        rc = -1;
+        PERROR("Unable to map %u mfns for %u pages of data",
+               nr_pages, count);
+        goto err;
+    }
+
+    for ( i = 0, j = 0; i < count; ++i )
+    {
+        if ( !page_type_has_stream_data(types[i]) )
+            continue;
+
+        if ( map_errs[j] )
+        {
+            rc = -1;
+            ERROR("Mapping pfn %#"PRIpfn" (mfn %#"PRIpfn", type %#"PRIx32") failed with %d",
+                  pfns[i], mfns[j], types[i], map_errs[j]);
+            goto err;
+        }
+
+        /* Undo page normalisation done by the saver. */
+        rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
+        if ( rc )
+        {
+            ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
+                  pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+            goto err;
+        }
+
+        if ( ctx->restore.verify )
+        {
+            /* Verify mode - compare incoming data to what we already have. */
+            if ( memcmp(guest_page, page_data, PAGE_SIZE) )
+                ERROR("verify pfn %#"PRIpfn" failed (type %#"PRIx32")",
+                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+        }
+        else
+        {
+            /* Regular mode - copy incoming data into place. */
+            memcpy(guest_page, page_data, PAGE_SIZE);
+        }
+
+        ++j;
+        guest_page += PAGE_SIZE;
+        page_data += PAGE_SIZE;
+    }
+
+ done:
+    rc = 0;
+
+ err:
+    if ( mapping )
+        xenforeignmemory_unmap(xch->fmem, mapping, nr_pages);
+
+    free(map_errs);
+    free(mfns);
+
+    return rc;
+}
+
+/*
+ * Validate a PAGE_DATA record from the stream, and pass the results to
+ * process_page_data() to actually perform the legwork.
+ */
+static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_header *pages = rec->data;
+    unsigned int i, pages_of_data = 0;
+    int rc = -1;
+
+    xen_pfn_t *pfns = NULL, pfn;
+    uint32_t *types = NULL, type;
+
+    /*
+     * v2 compatibility only exists for x86 streams.  This is a bit of a
+     * bodge, but it is less bad than duplicating handle_page_data() between
+     * different architectures.
+     */
+#if defined(__i386__) || defined(__x86_64__)
+    /* v2 compat.  Infer the position of STATIC_DATA_END. */
+    if ( ctx->restore.format_version < 3 && !ctx->restore.seen_static_data_end )
+    {
+        rc = handle_static_data_end(ctx);
+        if ( rc )
+        {
+            ERROR("Inferred STATIC_DATA_END record failed");
+            goto err;
+        }
+        rc = -1;
+    }
+
+    if ( !ctx->restore.seen_static_data_end )
+    {
+        ERROR("No STATIC_DATA_END seen");
+        goto err;
+    }
+#endif
+
+    if ( rec->length < sizeof(*pages) )
+    {
+        ERROR("PAGE_DATA record truncated: length %u, min %zu",
+              rec->length, sizeof(*pages));
+        goto err;
+    }
+
+    if ( pages->count < 1 )
+    {
+        ERROR("Expected at least 1 pfn in PAGE_DATA record");
+        goto err;
+    }
+
+    if ( rec->length < sizeof(*pages) + (pages->count * sizeof(uint64_t)) )
+    {
+        ERROR("PAGE_DATA record (length %u) too short to contain %u"
+              " pfns worth of information", rec->length, pages->count);
+        goto err;
+    }
+
+    pfns = malloc(pages->count * sizeof(*pfns));
+    types = malloc(pages->count * sizeof(*types));
+    if ( !pfns || !types )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns",
+              pages->count);
+        goto err;
+    }
+
+    for ( i = 0; i < pages->count; ++i )
+    {
+        pfn = pages->pfn[i] & PAGE_DATA_PFN_MASK;
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
+        {
+            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
+            goto err;
+        }
+
+        type = (pages->pfn[i] & PAGE_DATA_TYPE_MASK) >> 32;
+        if ( !is_known_page_type(type) )
+        {
+            ERROR("Unknown type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
+                  type, pfn, i);
+            goto err;
+        }
+
+        if ( page_type_has_stream_data(type) )
+            /* NOTAB and all L1 through L4 tables (including pinned) should
+             * have a page worth of data in the record. */
+            pages_of_data++;
+
+        pfns[i] = pfn;
+        types[i] = type;
+    }
+
+    if ( rec->length != (sizeof(*pages) +
+                         (sizeof(uint64_t) * pages->count) +
+                         (PAGE_SIZE * pages_of_data)) )
+    {
+        ERROR("PAGE_DATA record wrong size: length %u, expected "
+              "%zu + %zu + %lu", rec->length, sizeof(*pages),
+              (sizeof(uint64_t) * pages->count), (PAGE_SIZE * pages_of_data));
+        goto err;
+    }
+
+    rc = process_page_data(ctx, pages->count, pfns, types,
+                           &pages->pfn[pages->count]);
+ err:
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Validate a COMPRESSED_PAGE_DATA record from the stream, expand its page
+ * data and pass the results to process_page_data().
+ */
+static int handle_compressed_page_data(struct xc_sr_context *ctx,
+                                       struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_compressed_page_data_header *pages = rec->data;
+    unsigned int i, pages_of_data = 0, nr_data = 0;
+    size_t data_len;
+    int rc = -1;
+
+    xen_pfn_t *pfns = NULL, pfn;
+    uint32_t *types = NULL, type;
+    void *page_data = NULL, *page, *data;
+    z_stream zs = { 0 };
+    bool inflating = false;
+
+    if ( !ctx->restore.seen_static_data_end )
+    {
+        ERROR("No STATIC_DATA_END seen");
+        goto err;
+    }
+
+    if ( rec->length < sizeof(*pages) )
+    {
+        ERROR("COMPRESSED_PAGE_DATA record truncated: length %u, min %zu",
+              rec->length, sizeof(*pages));
+        goto err;
+    }
+
+    if ( pages->count < 1 )
+    {
+        ERROR("Expected at least 1 pfn in COMPRESSED_PAGE_DATA record");
+        goto err;
+    }
+
+    if ( rec->length < sizeof(*pages) + (pages->count * sizeof(uint64_t)) )
+    {
+        ERROR("COMPRESSED_PAGE_DATA record (length %u) too short to contain"
+              " %u pfns worth of information", rec->length, pages->count);
+        goto err;
+    }
+
+    if ( pages->encoding != COMPRESSED_PAGE_DATA_RAW &&
+         pages->encoding != COMPRESSED_PAGE_DATA_DEFLATE )
+    {
+        ERROR("Unknown COMPRESSED_PAGE_DATA encoding %u", pages->encoding);
+        goto err;
+    }
+
+    pfns = malloc(pages->count * sizeof(*pfns));
+    types = malloc(pages->count * sizeof(*types));
+    if ( !pfns || !types )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns",
+              pages->count);
+        goto err;
+    }
+
+    for ( i = 0; i < pages->count; ++i )
+    {
+        pfn = pages->pfn[i] & PAGE_DATA_PFN_MASK;
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
+        {
+            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
+            goto err;
+        }
+
+        type = (pages->pfn[i] & PAGE_DATA_TYPE_MASK) >> 32;
+        if ( !is_known_page_type(type) )
+        {
+            ERROR("Unknown type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
+                  type, pfn, i);
+            goto err;
+        }
+
+        if ( page_type_has_stream_data(type) )
+        {
+            pages_of_data++;
+            if ( !(pages->pfn[i] & PAGE_DATA_ZERO) )
+                nr_data++;
+        }
+        else if ( pages->pfn[i] & PAGE_DATA_ZERO )
+        {
+            ERROR("Zero pfn %#"PRIpfn" (index %u) of type %#"PRIx32
+                  " without data", pfn, i, type);
+            goto err;
+        }
+
+        pfns[i] = pfn;
+        types[i] = type;
+    }
+
+    data = &pages->pfn[pages->count];
+    data_len = rec->length - sizeof(*pages) - pages->count * sizeof(uint64_t);
+
+    if ( pages->encoding == COMPRESSED_PAGE_DATA_RAW
+         ? data_len != (size_t)nr_data * PAGE_SIZE
+         : !nr_data != !data_len )
+    {
+        ERROR("COMPRESSED_PAGE_DATA record has %zu bytes of data for %u"
+              " non-zero pages", data_len, nr_data);
+        goto err;
+    }
+
+    page = page_data = malloc((size_t)pages_of_data * PAGE_SIZE);
+    if ( pages_of_data && !page_data )
+    {
+        ERROR("Unable to allocate %zu bytes for page data",
+              (size_t)pages_of_data * PAGE_SIZE);
+        goto err;
+    }
+
+    if ( pages->encoding == COMPRESSED_PAGE_DATA_DEFLATE && nr_data )
+    {
+        if ( inflateInit(&zs) != Z_OK )
+        {
+            ERROR("Failed to initialise decompression: %s", zs.msg);
+            goto err;
+        }
+        inflating = true;
+
+        zs.next_in = data;
+        zs.avail_in = data_len;
+    }
+
+    for ( i = 0; i < pages->count; ++i )
+    {
+        if ( !page_type_has_stream_data(types[i]) )
+            continue;
+
+        if ( pages->pfn[i] & PAGE_DATA_ZERO )
+            memset(page, 0, PAGE_SIZE);
+        else if ( !inflating )
+        {
+            memcpy(page, data, PAGE_SIZE);
+            data += PAGE_SIZE;
+        }
+        else
+        {
+            zs.next_out = page;
+            zs.avail_out = PAGE_SIZE;
+
+            rc = inflate(&zs, Z_SYNC_FLUSH);
+            if ( (rc != Z_OK && rc != Z_STREAM_END) || zs.avail_out )
+            {
+                ERROR("Failed to decompress data for pfn %#"PRIpfn": %s",
+                      pfns[i], zs.msg ?: "truncated");
+                rc = -1;
+                goto err;
+            }
+            rc = -1;
+        }
+
+        page += PAGE_SIZE;
+    }
+
+    if ( inflating && (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_in) )
+    {
+        ERROR("Trailing data in COMPRESSED_PAGE_DATA record");
+        goto err;
+    }
+
+    rc = process_page_data(ctx, pages->count, pfns, types, page_data);
+ err:
+    if ( inflating )
+        inflateEnd(&zs);
+    free(page_data);
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Data channel thread: process the PAGE_DATA records from the channel's
+ * stream, until its END record.
+ */
+static void *channel_fn(void *arg)
+{
+    struct xc_sr_channel *ch = arg;
+    struct xc_sr_context *ctx = ch->ctx;
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec;
+    int rc;
+
+    /* Only allow cancellation while waiting for the stream. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    do {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        rc = read_record(ctx, ch->fd, &rec);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if ( rc )
+            break;
+
+        switch ( rec.type )
+        {
+        case REC_TYPE_END:
+            break;
+
+        case REC_TYPE_PAGE_DATA:
+            rc = handle_page_data(ctx, &rec);
+            break;
+
+        case REC_TYPE_COMPRESSED_PAGE_DATA:
+            rc = handle_compressed_page_data(ctx, &rec);
+            break;
+
+        default:
+            ERROR("Unexpected record %#x (%s) on data channel %td",
+                  rec.type, rec_type_to_str(rec.type),
+                  ch - ctx->restore.channels);
+            rc = -1;
+            break;
+        }
+
+        free(rec.data);
+    } while ( !rc && rec.type != REC_TYPE_END );
+
+    ch->rc = rc;
+
+    return NULL;
+}
+
+/*
+ * Wait for the data channels' threads.  Returns the first error any of them
+ * encountered.
+ */
+static int join_channels(struct xc_sr_context *ctx, bool cancel)
+{
+    struct xc_sr_channel *ch;
+    unsigned int i;
+    int rc = 0;
+
+    for ( i = 0; i < ctx->restore.nr_channels; i++ )
+    {
+        ch = &ctx->restore.channels[i];
+        if ( !ch->running )
+            continue;
+
+        if ( cancel )
+            pthread_cancel(ch->thread);
+        pthread_join(ch->thread, NULL);
+        ch->running = false;
+
+        rc = rc ?: ch->rc;
+    }
+
+    return rc;
+}
+
+/*
+ * Check a DATA_CHANNELS record against what is expected.
+ */
+static int check_data_channels(struct xc_sr_context *ctx,
+                               struct xc_sr_record *rec, unsigned int channel)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_data_channels *dc = rec->data;
+
+    if ( rec->type != REC_TYPE_DATA_CHANNELS )
+    {
+        ERROR("Expected DATA_CHANNELS record on data channel %u, got %#x (%s)",
+              channel - 1, rec->type, rec_type_to_str(rec->type));
+        return -1;
+    }
+
+    if ( rec->length != sizeof(*dc) )
+    {
+        ERROR("DATA_CHANNELS record wrong size: length %u, expected %zu",
+              rec->length, sizeof(*dc));
+        return -1;
+    }
+
+    if ( dc->count != ctx->restore.nr_channels )
+    {
+        ERROR("Stream has %u data channels, but %u were provided",
+              dc->count, ctx->restore.nr_channels);
+        return -1;
+    }
+
+    if ( dc->channel != channel )
+    {
+        ERROR("Data channel %u found where %u was expected",
+              dc->channel, channel);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * The sender is about to send page data over data channels: check they match
+ * the ones we were given, and start receiving on them.
+ */
+static int handle_data_channels(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_channel *ch;
+    struct xc_sr_record crec;
+    unsigned int i;
+    int rc;
+
+    if ( !ctx->restore.nr_channels )
+    {
+        ERROR("Stream uses data channels, but none were provided");
+        return -1;
+    }
+
+    if ( ctx->restore.channels[0].running ||
+         ctx->restore.seen_data_channels_end )
+    {
+        ERROR("Duplicate DATA_CHANNELS record");
+        return -1;
+    }
+
+    rc = check_data_channels(ctx, rec, 0);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < ctx->restore.nr_channels; i++ )
+    {
+        ch = &ctx->restore.channels[i];
+
+        rc = read_record(ctx, ch->fd, &crec);
+        if ( rc )
+            return rc;
+
+        rc = check_data_channels(ctx, &crec, i + 1);
+        free(crec.data);
+        if ( rc )
+            return rc;
+
+        if ( pthread_create(&ch->thread, NULL, channel_fn, ch) )
+        {
+            PERROR("Failed to create thread for data channel %u", i);
+            return -1;
+        }
+        ch->running = true;
+    }
+
+    return 0;
+}
+
+/*
+ * All page data has been sent: wait for the data channels to have processed
+ * it before carrying on with the primary stream.
+ */
+static int handle_data_channels_end(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc;
+
+    if ( !ctx->restore.nr_channels || !ctx->restore.channels[0].running )
+    {
+        ERROR("DATA_CHANNELS_END record without DATA_CHANNELS");
+        return -1;
+    }
+
+    rc = join_channels(ctx, false);
+    if ( rc )
+        ERROR("Failed to receive page data over data channels");
+
+    ctx->restore.seen_data_channels_end = true;
+
+    return rc;
+}
+
+/*
+ * Send checkpoint dirty pfn list to primary.
+ */
+/*
+ * Process a POSTCOPY_PFNS record: the pages it lists will come over the
+ * post-copy channel once the guest runs.  Any of them populated by an earlier
+ * iteration are stale, and get taken out of the physmap again, so that they
+ * can be marked as paged out at the end of the stream.
+ */
+static int handle_postcopy_pfns(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    const uint64_t *pfns = rec->data;
+    unsigned int i, count = rec->length / sizeof(*pfns), nr_stale = 0;
+    unsigned long nr = ctx->restore.postcopy.nr_pfns;
+    xen_pfn_t *p, *stale = NULL;
+    int rc = -1;
+
+    if ( ctx->restore.postcopy.fd < 0 )
+    {
+        ERROR("POSTCOPY_PFNS record without a post-copy channel");
+        return -1;
+    }
+
+    if ( rec->length % sizeof(*pfns) )
+    {
+        ERROR("POSTCOPY_PFNS record length %u not a multiple of %zu",
+              rec->length, sizeof(*pfns));
+        return -1;
+    }
+
+    p = realloc(ctx->restore.postcopy.pfns, (nr + count) * sizeof(*p));
+    stale = malloc(count * sizeof(*stale));
+    if ( !p || !stale )
+    {
+        ERROR("Unable to allocate memory for %lu post-copy pfns",
+              nr + count);
+        if ( p )
+            ctx->restore.postcopy.pfns = p;
+        goto err;
+    }
+    ctx->restore.postcopy.pfns = p;
+
+    for ( i = 0; i < count; ++i, ++nr )
+    {
+        if ( nr && pfns[i] <= p[nr - 1] )
+        {
+            ERROR("POSTCOPY_PFNS pfn %#"PRIx64" out of order", pfns[i]);
+            goto err;
+        }
+
+        p[nr] = pfns[i];
+
+        if ( pfn_is_populated(ctx, p[nr]) )
+        {
+            clear_bit(p[nr], ctx->restore.populated_pfns);
+            stale[nr_stale++] = p[nr];
+        }
+    }
+    ctx->restore.postcopy.nr_pfns = nr;
+
+    if ( nr_stale &&
+         xc_domain_decrease_reservation_exact(xch, ctx->domid, nr_stale, 0,
+                                              stale) )
+    {
+        PERROR("Failed to remove %u stale post-copy pages", nr_stale);
+        goto err;
+    }
+
+    rc = 0;
+
+ err:
+    free(stale);
 
     return rc;
 }
 
 /*
- * Validate a PAGE_DATA record from the stream, and pass the results to
- * process_page_data() to actually perform the legwork.
+ * End of the primary stream in post-copy: become the domain's pager, with the
+ * pages still to come marked as paged out, and have the guest resumed.
  */
-static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
+static int postcopy_begin(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
-    struct xc_sr_rec_page_data_header *pages = rec->data;
-    unsigned int i, pages_of_data = 0;
-    int rc = -1;
+    struct restore_callbacks *cb = ctx->restore.callbacks;
+    unsigned long i, end, nr = ctx->restore.postcopy.nr_pfns;
+    const xen_pfn_t *pfns = ctx->restore.postcopy.pfns;
+    uint64_t ring_pfn;
+    uint32_t remote_port;
+    int rc;
 
-    xen_pfn_t *pfns = NULL, pfn;
-    uint32_t *types = NULL, type;
+    /* The ring page comes out of the guest's physmap. */
+    if ( xc_hvm_param_get(xch, ctx->domid, HVM_PARAM_PAGING_RING_PFN,
+                          &ring_pfn) || !ring_pfn )
+    {
+        PERROR("No paging ring pfn for post-copy");
+        return -1;
+    }
 
-    /*
-     * v2 compatibility only exists for x86 streams.  This is a bit of a
-     * bodge, but it is less bad than duplicating handle_page_data() between
-     * different architectures.
-     */
-#if defined(__i386__) || defined(__x86_64__)
-    /* v2 compat.  Infer the position of STATIC_DATA_END. */
-    if ( ctx->restore.format_version < 3 && !ctx->restore.seen_static_data_end )
+    if ( postcopy_populate_pfn(ctx, ring_pfn) )
+        return -1;
+
+    ctx->restore.postcopy.ring_page =
+        xc_vm_event_enable(xch, ctx->domid, HVM_PARAM_PAGING_RING_PFN,
+                           &remote_port);
+    if ( !ctx->restore.postcopy.ring_page )
     {
-        rc = handle_static_data_end(ctx);
-        if ( rc )
-        {
-            ERROR("Inferred STATIC_DATA_END record failed");
-            goto err;
-        }
-        rc = -1;
+        PERROR("Failed to enable paging for post-copy");
+        return -1;
     }
 
-    if ( !ctx->restore.seen_static_data_end )
+    ctx->restore.postcopy.xce = xenevtchn_open(NULL, 0);
+    if ( !ctx->restore.postcopy.xce )
     {
-        ERROR("No STATIC_DATA_END seen");
-        goto err;
+        PERROR("Failed to open event channel");
+        return -1;
     }
-#endif
 
-    if ( rec->length < sizeof(*pages) )
+    rc = xenevtchn_bind_interdomain(ctx->restore.postcopy.xce, ctx->domid,
+                                    remote_port);
+    if ( rc < 0 )
     {
-        ERROR("PAGE_DATA record truncated: length %u, min %zu",
-              rec->length, sizeof(*pages));
-        goto err;
+        PERROR("Failed to bind paging event channel");
+        return -1;
+    }
+    ctx->restore.postcopy.port = rc;
+
+    SHARED_RING_INIT((vm_event_sring_t *)ctx->restore.postcopy.ring_page);
+    BACK_RING_INIT(&ctx->restore.postcopy.back_ring,
+                   (vm_event_sring_t *)ctx->restore.postcopy.ring_page,
+                   XC_PAGE_SIZE);
+
+    ctx->restore.postcopy.pending = bitmap_alloc(nr);
+    ctx->restore.postcopy.requested = bitmap_alloc(nr);
+    ctx->restore.postcopy.queue = malloc(nr * sizeof(uint64_t));
+    if ( nr && (!ctx->restore.postcopy.pending ||
+                !ctx->restore.postcopy.requested ||
+                !ctx->restore.postcopy.queue) )
+    {
+        ERROR("Unable to allocate memory for %lu post-copy pages", nr);
+        return -1;
     }
 
-    if ( pages->count < 1 )
+    /* Pages populated ahead of the guest are no longer expected. */
+    for ( i = 0; i < nr; ++i )
     {
-        ERROR("Expected at least 1 pfn in PAGE_DATA record");
-        goto err;
+        if ( pfn_is_populated(ctx, pfns[i]) )
+            continue;
+
+        set_bit(i, ctx->restore.postcopy.pending);
+        ctx->restore.postcopy.nr_pending++;
     }
 
-    if ( rec->length < sizeof(*pages) + (pages->count * sizeof(uint64_t)) )
+    /* Mark the rest as paged out, a run of contiguous pfns at a time. */
+    for ( i = 0; i < nr; i = end )
     {
-        ERROR("PAGE_DATA record (length %u) too short to contain %u"
-              " pfns worth of information", rec->length, pages->count);
-        goto err;
+        end = i + 1;
+
+        if ( !test_bit(i, ctx->restore.postcopy.pending) )
+            continue;
+
+        while ( end < nr && test_bit(end, ctx->restore.postcopy.pending) &&
+                pfns[end] == pfns[end - 1] + 1 && end - i < UINT32_MAX )
+            end++;
+
+        if ( xc_mem_paging_mark_paged(xch, ctx->domid, pfns[i], end - i) )
+        {
+            PERROR("Failed to mark pfns %#"PRIpfn"-%#"PRIpfn" as paged out",
+                   pfns[i], pfns[end - 1]);
+            return -1;
+        }
     }
 
-    pfns = malloc(pages->count * sizeof(*pfns));
-    types = malloc(pages->count * sizeof(*types));
-    if ( !pfns || !types )
+    DPRINTF("%lu pages to come over post-copy",
+            ctx->restore.postcopy.nr_pending);
+
+    ctx->restore.postcopy.active = true;
+
+    cb->restore_results(ctx->restore.xenstore_gfn, ctx->restore.console_gfn,
+                        cb->data);
+
+    rc = cb->postcopy_resume(cb->data);
+    if ( rc )
     {
-        ERROR("Unable to allocate enough memory for %u pfns",
-              pages->count);
-        goto err;
+        ERROR("postcopy_resume() callback failed: %d", rc);
+        return -1;
     }
 
-    for ( i = 0; i < pages->count; ++i )
+    return 0;
+}
+
+/*
+ * Consume the requests on the paging ring.  Accesses to pages still to come
+ * wait for them, the sender being asked for each page once; the rest are
+ * resumed straight away.
+ */
+static int postcopy_handle_requests(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+    xenevtchn_port_or_error_t port;
+    vm_event_request_t req;
+    vm_event_response_t rsp, *w;
+    bool notify = false;
+    long idx;
+
+    port = xenevtchn_pending(ctx->restore.postcopy.xce);
+    if ( port >= 0 )
+        xenevtchn_unmask(ctx->restore.postcopy.xce, port);
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(back_ring) )
     {
-        pfn = pages->pfn[i] & PAGE_DATA_PFN_MASK;
-        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
+        memcpy(&req, RING_GET_REQUEST(back_ring, back_ring->req_cons),
+               sizeof(req));
+        back_ring->req_cons++;
+        back_ring->sring->req_event = back_ring->req_cons + 1;
+
+        if ( req.version != VM_EVENT_INTERFACE_VERSION )
         {
-            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
-            goto err;
+            ERROR("Paging request with interface version %#x, expected %#x",
+                  req.version, VM_EVENT_INTERFACE_VERSION);
+            return -1;
         }
 
-        type = (pages->pfn[i] & PAGE_DATA_TYPE_MASK) >> 32;
-        if ( !is_known_page_type(type) )
+        rsp = (vm_event_response_t){
+            .version = VM_EVENT_INTERFACE_VERSION,
+            .vcpu_id = req.vcpu_id,
+            .flags = req.flags & VM_EVENT_FLAG_VCPU_PAUSED,
+            .reason = req.reason,
+            .u.mem_paging.gfn = req.u.mem_paging.gfn,
+            .u.mem_paging.flags = req.u.mem_paging.flags &
+                                  MEM_PAGING_DROP_PAGE,
+        };
+
+        idx = postcopy_find(ctx, req.u.mem_paging.gfn);
+        if ( idx >= 0 && test_bit(idx, ctx->restore.postcopy.pending) )
         {
-            ERROR("Unknown type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
-                  type, pfn, i);
-            goto err;
+            if ( req.u.mem_paging.flags & MEM_PAGING_DROP_PAGE )
+            {
+                /* The guest has given the page up: its contents are moot. */
+                clear_bit(idx, ctx->restore.postcopy.pending);
+                ctx->restore.postcopy.nr_pending--;
+            }
+            else
+            {
+                if ( ctx->restore.postcopy.nr_waiting ==
+                     ctx->restore.postcopy.max_waiting )
+                {
+                    unsigned int max = ctx->restore.postcopy.max_waiting * 2
+                                       ?: 64;
+
+                    w = realloc(ctx->restore.postcopy.waiting,
+                                max * sizeof(*w));
+                    if ( !w )
+                    {
+                        ERROR("Unable to allocate memory for %u paging "
+                              "requests", max);
+                        return -1;
+                    }
+                    ctx->restore.postcopy.waiting = w;
+                    ctx->restore.postcopy.max_waiting = max;
+                }
+
+                ctx->restore.postcopy.waiting[
+                    ctx->restore.postcopy.nr_waiting++] = rsp;
+
+                if ( !test_and_set_bit(idx, ctx->restore.postcopy.requested) )
+                    ctx->restore.postcopy.queue[
+                        ctx->restore.postcopy.nr_queue++] =
+                        req.u.mem_paging.gfn;
+
+                continue;
+            }
         }
 
-        if ( page_type_has_stream_data(type) )
-            /* NOTAB and all L1 through L4 tables (including pinned) should
-             * have a page worth of data in the record. */
-            pages_of_data++;
+        postcopy_put_response(ctx, &rsp);
+        notify = true;
+    }
 
-        pfns[i] = pfn;
-        types[i] = type;
+    if ( notify &&
+         xenevtchn_notify(ctx->restore.postcopy.xce,
+                          ctx->restore.postcopy.port) < 0 )
+    {
+        PERROR("Failed to notify the paging ring");
+        return -1;
     }
 
-    if ( rec->length != (sizeof(*pages) +
-                         (sizeof(uint64_t) * pages->count) +
-                         (PAGE_SIZE * pages_of_data)) )
+    return 0;
+}
+
+/*
+ * The post-copy phase: serve the paging ring, and load the pages arriving
+ * over the post-copy channel, until its END record.
+ */
+static int postcopy_pager(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long nr = ctx->restore.postcopy.nr_pfns;
+    struct pollfd pfd[] = {
+        { .fd = xenevtchn_fd(ctx->restore.postcopy.xce), .events = POLLIN },
+        { .fd = ctx->restore.postcopy.fd },
+    };
+    struct xc_sr_record rec;
+    bool end = false;
+    int rc = 0;
+
+    xc_set_progress_prefix(xch, "Post-copy");
+
+    while ( !end )
     {
-        ERROR("PAGE_DATA record wrong size: length %u, expected "
-              "%zu + %zu + %lu", rec->length, sizeof(*pages),
-              (sizeof(uint64_t) * pages->count), (PAGE_SIZE * pages_of_data));
-        goto err;
+        pfd[1].events = POLLIN | (ctx->restore.postcopy.nr_queue ? POLLOUT
+                                                                 : 0);
+
+        if ( poll(pfd, ARRAY_SIZE(pfd), -1) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll for post-copy events");
+            rc = -1;
+            goto out;
+        }
+
+        if ( pfd[0].revents & POLLIN )
+        {
+            rc = postcopy_handle_requests(ctx);
+            if ( rc )
+                goto out;
+        }
+
+        if ( (pfd[1].revents & POLLOUT) && ctx->restore.postcopy.nr_queue )
+        {
+            struct xc_sr_record req = {
+                .type = REC_TYPE_POSTCOPY_REQUEST,
+                .length = ctx->restore.postcopy.nr_queue * sizeof(uint64_t),
+                .data = ctx->restore.postcopy.queue,
+            };
+
+            rc = write_split_record_fd(ctx, ctx->restore.postcopy.fd, &req,
+                                       NULL, 0);
+            if ( rc )
+                goto out;
+
+            ctx->restore.postcopy.nr_queue = 0;
+        }
+
+        if ( !(pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) )
+            continue;
+
+        rc = read_record(ctx, ctx->restore.postcopy.fd, &rec);
+        if ( rc )
+            goto out;
+
+        switch ( rec.type )
+        {
+        case REC_TYPE_END:
+            end = true;
+            break;
+
+        case REC_TYPE_PAGE_DATA:
+            rc = handle_page_data(ctx, &rec);
+            break;
+
+        case REC_TYPE_COMPRESSED_PAGE_DATA:
+            rc = handle_compressed_page_data(ctx, &rec);
+            break;
+
+        default:
+            ERROR("Unexpected record %#x (%s) on post-copy channel",
+                  rec.type, rec_type_to_str(rec.type));
+            rc = -1;
+            break;
+        }
+
+        free(rec.data);
+        if ( rc )
+            goto out;
+
+        xc_report_progress_step(xch, nr - ctx->restore.postcopy.nr_pending,
+                                nr);
     }
 
-    rc = process_page_data(ctx, pages->count, pfns, types,
-                           &pages->pfn[pages->count]);
- err:
-    free(types);
-    free(pfns);
+    if ( ctx->restore.postcopy.nr_pending )
+    {
+        ERROR("Post-copy channel ended with %lu pages missing",
+              ctx->restore.postcopy.nr_pending);
+        rc = -1;
+    }
+
+ out:
+    xc_set_progress_prefix(xch, NULL);
 
     return rc;
 }
 
-/*
- * Send checkpoint dirty pfn list to primary.
- */
+static void postcopy_cleanup(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( ctx->restore.postcopy.xce )
+    {
+        if ( ctx->restore.postcopy.port )
+            xenevtchn_unbind(ctx->restore.postcopy.xce,
+                             ctx->restore.postcopy.port);
+        xenevtchn_close(ctx->restore.postcopy.xce);
+    }
+
+    if ( ctx->restore.postcopy.ring_page )
+    {
+        if ( xc_mem_paging_disable(xch, ctx->domid) )
+            PERROR("Failed to disable paging");
+        xenforeignmemory_unmap(xch->fmem, ctx->restore.postcopy.ring_page, 1);
+    }
+
+    free(ctx->restore.postcopy.queue);
+    free(ctx->restore.postcopy.waiting);
+    free(ctx->restore.postcopy.requested);
+    free(ctx->restore.postcopy.pending);
+    free(ctx->restore.postcopy.pfns);
+}
+
 static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -651,12 +2058,41 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
     switch ( rec->type )
     {
     case REC_TYPE_END:
+        if ( ctx->restore.nr_channels && !ctx->restore.seen_data_channels_end )
+        {
+            ERROR("Data channels were provided, but not used by the stream");
+            rc = -1;
+        }
         break;
 
     case REC_TYPE_PAGE_DATA:
         rc = handle_page_data(ctx, rec);
         break;
 
+    case REC_TYPE_COMPRESSED_PAGE_DATA:
+        rc = handle_compressed_page_data(ctx, rec);
+        break;
+
+    case REC_TYPE_DATA_CHANNELS:
+        rc = handle_data_channels(ctx, rec);
+        break;
+
+    case REC_TYPE_DATA_CHANNELS_END:
+        rc = handle_data_channels_end(ctx);
+        break;
+
+    case REC_TYPE_POSTCOPY_PFNS:
+        rc = handle_postcopy_pfns(ctx, rec);
+        break;
+
+    case REC_TYPE_MEMORY_LAYOUT:
+        rc = handle_memory_layout(ctx, rec);
+        break;
+
+    case REC_TYPE_PAGE_DATA_INDEX:
+        rc = handle_page_data_index(ctx, rec);
+        break;
+
     case REC_TYPE_VERIFY:
         DPRINTF("Verify mode enabled");
         ctx->restore.verify = true;
@@ -736,6 +2172,9 @@ static void cleanup(struct xc_sr_context *ctx)
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->restore.dirty_bitmap_hbuf);
 
+    join_channels(ctx, true);
+    postcopy_cleanup(ctx);
+
     for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
         free(ctx->restore.buffered_records[i].data);
 
@@ -825,6 +2264,17 @@ static int restore(struct xc_sr_context *ctx)
     if ( rc )
         goto err;
 
+    if ( ctx->restore.postcopy.fd >= 0 )
+    {
+        rc = postcopy_begin(ctx);
+        if ( rc )
+            goto err;
+
+        rc = postcopy_pager(ctx);
+        if ( rc )
+            goto err;
+    }
+
     IPRINTF("Restore successful");
     goto done;
 
@@ -845,12 +2295,15 @@ static int restore(struct xc_sr_context *ctx)
     return rc;
 }
 
-int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
-                      unsigned int store_evtchn, unsigned long *store_mfn,
-                      uint32_t store_domid, unsigned int console_evtchn,
-                      unsigned long *console_gfn, uint32_t console_domid,
-                      xc_stream_type_t stream_type,
-                      struct restore_callbacks *callbacks, int send_back_fd)
+static int domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
+                          unsigned int store_evtchn, unsigned long *store_mfn,
+                          uint32_t store_domid, unsigned int console_evtchn,
+                          unsigned long *console_gfn, uint32_t console_domid,
+                          xc_stream_type_t stream_type,
+                          struct restore_callbacks *callbacks,
+                          int send_back_fd,
+                          const int *data_fds, unsigned int nr_data_fds,
+                          int postcopy_fd)
 {
     xen_pfn_t nr_pfns;
     struct xc_sr_context ctx = {
@@ -858,6 +2311,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         .fd = io_fd,
         .stream_type = stream_type,
     };
+    unsigned int i;
+    int rc;
 
     /* GCC 4.4 (of CentOS 6.x vintage) can' t initialise anonymous unions. */
     ctx.restore.console_evtchn = console_evtchn;
@@ -866,6 +2321,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.restore.xenstore_domid = store_domid;
     ctx.restore.callbacks = callbacks;
     ctx.restore.send_back_fd = send_back_fd;
+    ctx.restore.postcopy.fd = postcopy_fd;
 
     /* Sanity check stream_type-related parameters */
     switch ( stream_type )
@@ -899,6 +2355,15 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         return -1;
     }
 
+    if ( postcopy_fd >= 0 &&
+         (!ctx.dominfo.hvm || stream_type != XC_STREAM_PLAIN || nr_data_fds) )
+    {
+        ERROR("Post-copy is only supported for plain HVM streams, without "
+              "data channels");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
     DPRINTF("fd %d, dom %u, hvm %u, stream_type %d",
             io_fd, dom, ctx.dominfo.hvm, stream_type);
 
@@ -917,7 +2382,47 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.restore.ops = ctx.dominfo.hvm
         ? restore_ops_x86_hvm : restore_ops_x86_pv;
 
-    if ( restore(&ctx) )
+    if ( nr_data_fds )
+    {
+        if ( nr_data_fds > MAX_DATA_CHANNELS )
+        {
+            ERROR("Too many data channels (%u, max %u)",
+                  nr_data_fds, MAX_DATA_CHANNELS);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( !ctx.dominfo.hvm || stream_type != XC_STREAM_PLAIN )
+        {
+            ERROR("Data channels are only supported for plain HVM streams");
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+
+        ctx.restore.channels = calloc(nr_data_fds,
+                                      sizeof(*ctx.restore.channels));
+        if ( !ctx.restore.channels )
+        {
+            ERROR("Unable to allocate memory for data channels");
+            errno = ENOMEM;
+            return -1;
+        }
+
+        for ( i = 0; i < nr_data_fds; i++ )
+        {
+            ctx.restore.channels[i].ctx = &ctx;
+            ctx.restore.channels[i].fd = data_fds[i];
+        }
+        ctx.restore.nr_channels = nr_data_fds;
+    }
+    pthread_mutex_init(&ctx.restore.populate_lock, NULL);
+
+    rc = restore(&ctx);
+
+    free(ctx.restore.channels);
+    pthread_mutex_destroy(&ctx.restore.populate_lock);
+
+    if ( rc )
         return -1;
 
     IPRINTF("XenStore: mfn %#"PRIpfn", dom %d, evt %u",
@@ -936,6 +2441,55 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     return 0;
 }
 
+int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
+                      unsigned int store_evtchn, unsigned long *store_mfn,
+                      uint32_t store_domid, unsigned int console_evtchn,
+                      unsigned long *console_gfn, uint32_t console_domid,
+                      xc_stream_type_t stream_type,
+                      struct restore_callbacks *callbacks, int send_back_fd)
+{
+    return domain_restore(xch, io_fd, dom, store_evtchn, store_mfn,
+                          store_domid, console_evtchn, console_gfn,
+                          console_domid, stream_type, callbacks,
+                          send_back_fd, NULL, 0, -1);
+}
+
+int xc_domain_restore_parallel(xc_interface *xch, int io_fd,
+                               const int *data_fds, unsigned int nr_data_fds,
+                               uint32_t dom, unsigned int store_evtchn,
+                               unsigned long *store_mfn, uint32_t store_domid,
+                               unsigned int console_evtchn,
+                               unsigned long *console_gfn,
+                               uint32_t console_domid,
+                               struct restore_callbacks *callbacks)
+{
+    return domain_restore(xch, io_fd, dom, store_evtchn, store_mfn,
+                          store_domid, console_evtchn, console_gfn,
+                          console_domid, XC_STREAM_PLAIN, callbacks,
+                          -1, data_fds, nr_data_fds, -1);
+}
+
+int xc_domain_restore_postcopy(xc_interface *xch, int io_fd, int postcopy_fd,
+                               uint32_t dom, unsigned int store_evtchn,
+                               unsigned long *store_mfn, uint32_t store_domid,
+                               unsigned int console_evtchn,
+                               unsigned long *console_gfn,
+                               uint32_t console_domid,
+                               struct restore_callbacks *callbacks)
+{
+    if ( !callbacks || !callbacks->restore_results ||
+         !callbacks->postcopy_resume )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return domain_restore(xch, io_fd, dom, store_evtchn, store_mfn,
+                          store_domid, console_evtchn, console_gfn,
+                          console_domid, XC_STREAM_PLAIN, callbacks,
+                          -1, NULL, 0, postcopy_fd);
+}
+
 /*
  * Local variables:
  * mode: C
@@ -62,14 +62,17 @@ static int handle_hvm_params(struct xc_sr_context *ctx,
         {
         case HVM_PARAM_CONSOLE_PFN:
             ctx->restore.console_gfn = entry->value;
+            postcopy_populate_pfn(ctx, entry->value);
             xc_clear_domain_page(xch, ctx->domid, entry->value);
             break;
         case HVM_PARAM_STORE_PFN:
             ctx->restore.xenstore_gfn = entry->value;
+            postcopy_populate_pfn(ctx, entry->value);
             xc_clear_domain_page(xch, ctx->domid, entry->value);
             break;
         case HVM_PARAM_IOREQ_PFN:
         case HVM_PARAM_BUFIOREQ_PFN:
+            postcopy_populate_pfn(ctx, entry->value);
             xc_clear_domain_page(xch, ctx->domid, entry->value);
             break;
 
@@ -1,5 +1,9 @@
 #include <assert.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <zlib.h>
 
 #include "xg_sr_common.h"
 
@@ -75,49 +79,253 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
 }
 
 /*
- * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
- * is constructed in ctx->save.batch_pfns.
+ * Mark a pfn to be sent again in the final round.
+ */
+static void defer_page(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    pthread_mutex_lock(&ctx->save.deferred_lock);
+    set_bit(pfn, ctx->save.deferred_pages);
+    ++ctx->save.nr_deferred_pages;
+    pthread_mutex_unlock(&ctx->save.deferred_lock);
+}
+
+/*
+ * Is a page entirely zero?  Written so that the compiler can vectorise the
+ * inner loop, while still bailing early on the (common) non-zero pages.
+ */
+static bool page_is_zero(const void *page)
+{
+    const uint64_t *p = page;
+    uint64_t acc = 0;
+    unsigned int i, j;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i += 64 )
+    {
+        for ( j = 0; j < 64; j++ )
+            acc |= p[i + j];
+
+        if ( acc )
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Writes a batch of memory as a COMPRESSED_PAGE_DATA record into the stream
+ * @fd.  Zero pages are elided, and the others compressed unless this doesn't
+ * make them any smaller.
+ */
+static int write_compressed_batch(struct xc_sr_context *ctx, int fd,
+                                  const xen_pfn_t *batch_pfns,
+                                  unsigned int nr_pfns,
+                                  const xen_pfn_t *types,
+                                  void *const *guest_data)
+{
+    xc_interface *xch = ctx->xch;
+    static const uint8_t pad[1U << REC_ALIGN_ORDER];
+    struct xc_sr_rec_compressed_page_data_header hdr = {
+        .count = nr_pfns,
+        .encoding = COMPRESSED_PAGE_DATA_DEFLATE,
+    };
+    uint32_t type = REC_TYPE_COMPRESSED_PAGE_DATA, length;
+    uint64_t *rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
+    struct iovec *iov = malloc((nr_pfns + 5) * sizeof(*iov));
+    unsigned int i, nr_data = 0;
+    size_t data_len = 0;
+    void *buf = NULL;
+    z_stream zs = { 0 };
+    int iovcnt, rc = -1;
+
+    if ( !rec_pfns || !iov )
+    {
+        ERROR("Unable to allocate arrays for a batch of %u pages", nr_pfns);
+        goto err;
+    }
+
+    for ( i = 0; i < nr_pfns; ++i )
+    {
+        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | batch_pfns[i];
+
+        if ( !guest_data[i] )
+            continue;
+
+        if ( page_is_zero(guest_data[i]) )
+            rec_pfns[i] |= PAGE_DATA_ZERO;
+        else
+            ++nr_data;
+    }
+
+    if ( nr_data )
+    {
+        if ( deflateInit(&zs, Z_BEST_SPEED) != Z_OK )
+        {
+            ERROR("Failed to initialise compression: %s", zs.msg);
+            goto err;
+        }
+
+        data_len = deflateBound(&zs, nr_data * PAGE_SIZE);
+        buf = malloc(data_len);
+        if ( !buf )
+        {
+            ERROR("Unable to allocate %zu bytes for compressed pages",
+                  data_len);
+            goto err;
+        }
+
+        /* The output buffer is large enough for all of it. */
+        zs.next_out = buf;
+        zs.avail_out = data_len;
+
+        for ( i = 0; i < nr_pfns; ++i )
+        {
+            if ( !guest_data[i] || (rec_pfns[i] & PAGE_DATA_ZERO) )
+                continue;
+
+            zs.next_in = guest_data[i];
+            zs.avail_in = PAGE_SIZE;
+            if ( deflate(&zs, Z_NO_FLUSH) != Z_OK )
+            {
+                ERROR("Failed to compress page data: %s", zs.msg);
+                goto err;
+            }
+        }
+
+        if ( deflate(&zs, Z_FINISH) != Z_STREAM_END )
+        {
+            ERROR("Failed to compress page data: %s", zs.msg);
+            goto err;
+        }
+
+        data_len = zs.total_out;
+        if ( data_len >= nr_data * PAGE_SIZE )
+        {
+            hdr.encoding = COMPRESSED_PAGE_DATA_RAW;
+            data_len = nr_data * PAGE_SIZE;
+        }
+    }
+
+    length = sizeof(hdr) + nr_pfns * sizeof(*rec_pfns) + data_len;
+
+    iov[0].iov_base = &type;
+    iov[0].iov_len = sizeof(type);
+
+    iov[1].iov_base = &length;
+    iov[1].iov_len = sizeof(length);
+
+    iov[2].iov_base = &hdr;
+    iov[2].iov_len = sizeof(hdr);
+
+    iov[3].iov_base = rec_pfns;
+    iov[3].iov_len = nr_pfns * sizeof(*rec_pfns);
+
+    iovcnt = 4;
+
+    if ( hdr.encoding == COMPRESSED_PAGE_DATA_DEFLATE )
+    {
+        if ( data_len )
+        {
+            iov[iovcnt].iov_base = buf;
+            iov[iovcnt].iov_len = data_len;
+            iovcnt++;
+        }
+    }
+    else
+    {
+        for ( i = 0; i < nr_pfns; ++i )
+        {
+            if ( !guest_data[i] || (rec_pfns[i] & PAGE_DATA_ZERO) )
+                continue;
+
+            iov[iovcnt].iov_base = guest_data[i];
+            iov[iovcnt].iov_len = PAGE_SIZE;
+            iovcnt++;
+        }
+    }
+
+    if ( ROUNDUP(length, REC_ALIGN_ORDER) != length )
+    {
+        iov[iovcnt].iov_base = (void *)pad;
+        iov[iovcnt].iov_len = ROUNDUP(length, REC_ALIGN_ORDER) - length;
+        iovcnt++;
+    }
+
+    if ( writev_exact(fd, iov, iovcnt) )
+    {
+        PERROR("Failed to write compressed page data to stream");
+        goto err;
+    }
+
+    rc = 0;
+
+ err:
+    if ( nr_data )
+        deflateEnd(&zs);
+    free(buf);
+    free(iov);
+    free(rec_pfns);
+
+    return rc;
+}
+
+/*
+ * Release everything map_batch() set up for a batch.
+ */
+static void release_batch(struct xc_sr_context *ctx, struct xc_sr_batch *b)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i;
+
+    if ( b->guest_mapping )
+        xenforeignmemory_unmap(xch->fmem, b->guest_mapping,
+                               b->nr_pages_mapped);
+    for ( i = 0; b->local_pages && i < b->nr_pfns; ++i )
+        free(b->local_pages[i]);
+    free(b->local_pages);
+    free(b->guest_data);
+    free(b->types);
+
+    memset(b, 0, sizeof(*b));
+}
+
+/*
+ * Prepares a batch of memory for sending.
  *
  * This function:
  * - gets the types for each pfn in the batch.
  * - for each pfn with real data:
  *   - maps and attempts to localise the pages.
- * - construct and writes a PAGE_DATA record into the stream.
+ *
+ * @pfns must remain valid until the batch is released.  On error, the
+ * batch must still be released.
  */
-static int write_batch(struct xc_sr_context *ctx)
+static int map_batch(struct xc_sr_context *ctx, struct xc_sr_batch *b,
+                     const xen_pfn_t *pfns, unsigned int nr_pfns)
 {
     xc_interface *xch = ctx->xch;
-    xen_pfn_t *mfns = NULL, *types = NULL;
-    void *guest_mapping = NULL;
-    void **guest_data = NULL;
-    void **local_pages = NULL;
+    xen_pfn_t *mfns = NULL, *types;
     int *errors = NULL, rc = -1;
-    unsigned int i, p, nr_pages = 0, nr_pages_mapped = 0;
-    unsigned int nr_pfns = ctx->save.nr_batch_pfns;
+    unsigned int i, p, nr_pages = 0;
     void *page, *orig_page;
-    uint64_t *rec_pfns = NULL;
-    struct iovec *iov = NULL; int iovcnt = 0;
-    struct xc_sr_rec_page_data_header hdr = { 0 };
-    struct xc_sr_record rec = {
-        .type = REC_TYPE_PAGE_DATA,
-    };
 
     assert(nr_pfns != 0);
 
+    memset(b, 0, sizeof(*b));
+    b->pfns = pfns;
+    b->nr_pfns = nr_pfns;
+
     /* Mfns of the batch pfns. */
     mfns = malloc(nr_pfns * sizeof(*mfns));
     /* Types of the batch pfns. */
-    types = malloc(nr_pfns * sizeof(*types));
+    types = b->types = malloc(nr_pfns * sizeof(*types));
     /* Errors from attempting to map the gfns. */
     errors = malloc(nr_pfns * sizeof(*errors));
     /* Pointers to page data to send.  Mapped gfns or local allocations. */
-    guest_data = calloc(nr_pfns, sizeof(*guest_data));
+    b->guest_data = calloc(nr_pfns, sizeof(*b->guest_data));
     /* Pointers to locally allocated pages.  Need freeing. */
-    local_pages = calloc(nr_pfns, sizeof(*local_pages));
-    /* iovec[] for writev(). */
-    iov = malloc((nr_pfns + 4) * sizeof(*iov));
+    b->local_pages = calloc(nr_pfns, sizeof(*b->local_pages));
 
-    if ( !mfns || !types || !errors || !guest_data || !local_pages || !iov )
+    if ( !mfns || !types || !errors || !b->guest_data || !b->local_pages )
     {
         ERROR("Unable to allocate arrays for a batch of %u pages",
               nr_pfns);
@@ -126,15 +334,11 @@ static int write_batch(struct xc_sr_context *ctx)
 
     for ( i = 0; i < nr_pfns; ++i )
     {
-        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx,
-                                                      ctx->save.batch_pfns[i]);
+        types[i] = mfns[i] = ctx->save.ops.pfn_to_gfn(ctx, pfns[i]);
 
         /* Likely a ballooned page. */
         if ( mfns[i] == INVALID_MFN )
-        {
-            set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
-            ++ctx->save.nr_deferred_pages;
-        }
+            defer_page(ctx, pfns[i]);
     }
 
     rc = xc_get_pfn_type_batch(xch, ctx->domid, nr_pfns, types);
@@ -161,14 +365,14 @@ static int write_batch(struct xc_sr_context *ctx)
 
     if ( nr_pages > 0 )
     {
-        guest_mapping = xenforeignmemory_map(
+        b->guest_mapping = xenforeignmemory_map(
             xch->fmem, ctx->domid, PROT_READ, nr_pages, mfns, errors);
-        if ( !guest_mapping )
+        if ( !b->guest_mapping )
         {
             PERROR("Failed to map guest pages");
             goto err;
         }
-        nr_pages_mapped = nr_pages;
+        b->nr_pages_mapped = nr_pages;
 
         for ( i = 0, p = 0; i < nr_pfns; ++i )
         {
@@ -178,22 +382,21 @@ static int write_batch(struct xc_sr_context *ctx)
             if ( errors[p] )
             {
                 ERROR("Mapping of pfn %#"PRIpfn" (mfn %#"PRIpfn") failed %d",
-                      ctx->save.batch_pfns[i], mfns[p], errors[p]);
+                      pfns[i], mfns[p], errors[p]);
                 goto err;
             }
 
-            orig_page = page = guest_mapping + (p * PAGE_SIZE);
+            orig_page = page = b->guest_mapping + (p * PAGE_SIZE);
             rc = ctx->save.ops.normalise_page(ctx, types[i], &page);
 
             if ( orig_page != page )
-                local_pages[i] = page;
+                b->local_pages[i] = page;
 
             if ( rc )
             {
                 if ( rc == -1 && errno == EAGAIN )
                 {
-                    set_bit(ctx->save.batch_pfns[i], ctx->save.deferred_pages);
-                    ++ctx->save.nr_deferred_pages;
+                    defer_page(ctx, pfns[i]);
                     types[i] = XEN_DOMCTL_PFINFO_XTAB;
                     --nr_pages;
                 }
@@ -201,18 +404,51 @@ static int write_batch(struct xc_sr_context *ctx)
                     goto err;
             }
             else
-                guest_data[i] = page;
+                b->guest_data[i] = page;
 
             rc = -1;
             ++p;
         }
     }
 
+    b->nr_pages = nr_pages;
+    rc = 0;
+
+ err:
+    free(errors);
+    free(mfns);
+
+    return rc;
+}
+
+/*
+ * Writes a batch prepared by map_batch() as a PAGE_DATA record into the
+ * stream @fd.
+ */
+static int send_batch(struct xc_sr_context *ctx, int fd,
+                      const struct xc_sr_batch *b)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i, nr_pfns = b->nr_pfns, nr_pages = b->nr_pages;
+    uint64_t *rec_pfns = NULL;
+    struct iovec *iov = NULL; int iovcnt = 0;
+    struct xc_sr_rec_page_data_header hdr = { 0 };
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_PAGE_DATA,
+    };
+    int rc = -1;
+
+    if ( ctx->save.compress )
+        return write_compressed_batch(ctx, fd, b->pfns, nr_pfns, b->types,
+                                      b->guest_data);
+
     rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
-    if ( !rec_pfns )
+    /* iovec[] for writev(). */
+    iov = malloc((nr_pfns + 4) * sizeof(*iov));
+    if ( !rec_pfns || !iov )
     {
-        ERROR("Unable to allocate %zu bytes of memory for page data pfn list",
-              nr_pfns * sizeof(*rec_pfns));
+        ERROR("Unable to allocate memory for page data of %u pages",
+              nr_pfns);
         goto err;
     }
 
@@ -223,7 +459,7 @@ static int write_batch(struct xc_sr_context *ctx)
     rec.length += nr_pages * PAGE_SIZE;
 
     for ( i = 0; i < nr_pfns; ++i )
-        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+        rec_pfns[i] = ((uint64_t)(b->types[i]) << 32) | b->pfns[i];
 
     iov[0].iov_base = &rec.type;
     iov[0].iov_len = sizeof(rec.type);
@@ -243,9 +479,9 @@ static int write_batch(struct xc_sr_context *ctx)
     {
         for ( i = 0; i < nr_pfns; ++i )
         {
-            if ( guest_data[i] )
+            if ( b->guest_data[i] )
             {
-                iov[iovcnt].iov_base = guest_data[i];
+                iov[iovcnt].iov_base = b->guest_data[i];
                 iov[iovcnt].iov_len = PAGE_SIZE;
                 iovcnt++;
                 --nr_pages;
@@ -253,7 +489,7 @@ static int write_batch(struct xc_sr_context *ctx)
         }
     }
 
-    if ( writev_exact(ctx->fd, iov, iovcnt) )
+    if ( writev_exact(fd, iov, iovcnt) )
     {
         PERROR("Failed to write page data to stream");
         goto err;
@@ -261,191 +497,985 @@ static int write_batch(struct xc_sr_context *ctx)
 
     /* Sanity check we have sent all the pages we expected to. */
     assert(nr_pages == 0);
-    rc = ctx->save.nr_batch_pfns = 0;
+    rc = 0;
 
  err:
     free(rec_pfns);
-    if ( guest_mapping )
-        xenforeignmemory_unmap(xch->fmem, guest_mapping, nr_pages_mapped);
-    for ( i = 0; local_pages && i < nr_pfns; ++i )
-        free(local_pages[i]);
     free(iov);
-    free(local_pages);
-    free(guest_data);
-    free(errors);
-    free(types);
-    free(mfns);
 
     return rc;
 }
 
 /*
- * Flush a batch of pfns into the stream.
+ * Writes a batch of memory as a PAGE_DATA record into the stream @fd.
+ *
+ * With data channels, it runs concurrently in the channels' threads.
  */
-static int flush_batch(struct xc_sr_context *ctx)
+static int write_batch(struct xc_sr_context *ctx, int fd,
+                       const xen_pfn_t *batch_pfns, unsigned int nr_pfns)
 {
-    int rc = 0;
-
-    if ( ctx->save.nr_batch_pfns == 0 )
-        return rc;
-
-    rc = write_batch(ctx);
+    struct xc_sr_batch b;
+    int rc;
 
-    if ( !rc )
-    {
-        VALGRIND_MAKE_MEM_UNDEFINED(ctx->save.batch_pfns,
-                                    MAX_BATCH_SIZE *
-                                    sizeof(*ctx->save.batch_pfns));
-    }
+    rc = map_batch(ctx, &b, batch_pfns, nr_pfns) ?: send_batch(ctx, fd, &b);
+    release_batch(ctx, &b);
 
     return rc;
 }
 
 /*
- * Add a single pfn to the batch, flushing the batch if full.
+ * Writer thread: send out the batches mapped by submit_writer_batch(), while
+ * the next one gets mapped, until told to stop.
  */
-static int add_to_batch(struct xc_sr_context *ctx, xen_pfn_t pfn)
+static void *writer_fn(void *arg)
 {
-    int rc = 0;
+    struct xc_sr_context *ctx = arg;
+    struct xc_sr_writer *w = &ctx->save.writer;
+    int rc;
 
-    if ( ctx->save.nr_batch_pfns == MAX_BATCH_SIZE )
-        rc = flush_batch(ctx);
+    pthread_mutex_lock(&w->lock);
 
-    if ( rc == 0 )
-        ctx->save.batch_pfns[ctx->save.nr_batch_pfns++] = pfn;
+    for ( ; ; )
+    {
+        while ( !w->busy && !w->stop )
+            pthread_cond_wait(&w->cond, &w->lock);
 
-    return rc;
+        if ( !w->busy )
+            break;
+
+        pthread_mutex_unlock(&w->lock);
+        rc = w->rc ?: send_batch(ctx, ctx->fd, &w->batch);
+        release_batch(ctx, &w->batch);
+        pthread_mutex_lock(&w->lock);
+
+        w->rc = rc;
+        w->busy = false;
+        pthread_cond_broadcast(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
 }
 
 /*
- * Pause/suspend the domain, and refresh ctx->dominfo if required.
+ * Map the current batch, and hand it over to the writer thread once done
+ * with the previous one.  Returns the first error the thread encountered,
+ * if any.
  */
-static int suspend_domain(struct xc_sr_context *ctx)
+static int submit_writer_batch(struct xc_sr_context *ctx)
 {
-    xc_interface *xch = ctx->xch;
-
-    /* TODO: Properly specify the return value from this callback.  All
-     * implementations currently appear to return 1 for success, whereas
-     * the legacy code checks for != 0. */
-    int cb_rc = ctx->save.callbacks->suspend(ctx->save.callbacks->data);
+    struct xc_sr_writer *w = &ctx->save.writer;
+    struct xc_sr_batch b;
+    xen_pfn_t *pfns;
+    int rc;
 
-    if ( cb_rc == 0 )
+    rc = map_batch(ctx, &b, ctx->save.batch_pfns, ctx->save.nr_batch_pfns);
+    if ( rc )
     {
-        ERROR("save callback suspend() failed: %d", cb_rc);
-        return -1;
+        release_batch(ctx, &b);
+        return rc;
     }
 
-    /* Refresh domain information. */
-    if ( (xc_domain_getinfo(xch, ctx->domid, 1, &ctx->dominfo) != 1) ||
-         (ctx->dominfo.domid != ctx->domid) )
-    {
-        PERROR("Unable to refresh domain information");
-        return -1;
-    }
+    pthread_mutex_lock(&w->lock);
 
-    /* Confirm the domain has actually been paused. */
-    if ( !ctx->dominfo.shutdown ||
-         (ctx->dominfo.shutdown_reason != SHUTDOWN_suspend) )
+    while ( w->busy )
+        pthread_cond_wait(&w->cond, &w->lock);
+
+    rc = w->rc;
+    if ( !rc )
     {
-        ERROR("Domain has not been suspended: shutdown %d, reason %d",
-              ctx->dominfo.shutdown, ctx->dominfo.shutdown_reason);
-        return -1;
+        w->batch = b;
+        w->busy = true;
+        pthread_cond_broadcast(&w->cond);
+
+        /* The thread now owns the pfns; fill the other buffer meanwhile. */
+        pfns = w->spare_pfns;
+        w->spare_pfns = ctx->save.batch_pfns;
+        ctx->save.batch_pfns = pfns;
+        ctx->save.nr_batch_pfns = 0;
     }
 
-    xc_report_progress_single(xch, "Domain now suspended");
+    pthread_mutex_unlock(&w->lock);
 
-    return 0;
+    if ( rc )
+        release_batch(ctx, &b);
+
+    return rc;
+}
+
+static int wait_writer_idle(struct xc_sr_context *ctx)
+{
+    struct xc_sr_writer *w = &ctx->save.writer;
+    int rc;
+
+    pthread_mutex_lock(&w->lock);
+    while ( w->busy )
+        pthread_cond_wait(&w->cond, &w->lock);
+    rc = w->rc;
+    pthread_mutex_unlock(&w->lock);
+
+    return rc;
 }
 
 /*
- * Send a subset of pages in the guests p2m, according to the dirty bitmap.
- * Used for each subsequent iteration of the live migration loop.
- *
- * Bitmap is bounded by p2m_size.
+ * Map the current batch, and copy its pages out of the guest into the
+ * checkpoint's snapshot, to be sent by send_snapshot().
  */
-static int send_dirty_pages(struct xc_sr_context *ctx,
-                            unsigned long entries)
+static int snapshot_batch(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
-    xen_pfn_t p;
-    unsigned long written;
+    struct xc_sr_snapshot *snap = &ctx->save.snapshot;
+    struct xc_sr_snapshot_batch *sb;
+    struct xc_sr_batch *b;
+    unsigned int i, nr_pfns = ctx->save.nr_batch_pfns;
+    void *page;
     int rc;
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->save.dirty_bitmap_hbuf);
 
-    for ( p = 0, written = 0; p < ctx->save.p2m_size; ++p )
+    if ( !nr_pfns )
+        return 0;
+
+    if ( snap->nr_batches == snap->max_batches )
     {
-        if ( !test_bit(p, dirty_bitmap) )
-            continue;
+        unsigned int max = snap->max_batches ? snap->max_batches * 2 : 16;
 
-        rc = add_to_batch(ctx, p);
-        if ( rc )
-            return rc;
+        sb = realloc(snap->batches, max * sizeof(*sb));
+        if ( !sb )
+        {
+            ERROR("Unable to allocate memory for %u snapshot batches", max);
+            return -1;
+        }
+        snap->batches = sb;
+        snap->max_batches = max;
+    }
 
-        /* Update progress every 4MB worth of memory sent. */
-        if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
-            xc_report_progress_step(xch, written, entries);
+    sb = &snap->batches[snap->nr_batches];
+    b = &sb->batch;
 
-        ++written;
+    sb->pfns = malloc(nr_pfns * sizeof(*sb->pfns));
+    if ( !sb->pfns )
+    {
+        ERROR("Unable to allocate memory for a snapshot of %u pfns", nr_pfns);
+        return -1;
     }
+    memcpy(sb->pfns, ctx->save.batch_pfns, nr_pfns * sizeof(*sb->pfns));
+    /* From here on, the batch is released along with the snapshot. */
+    snap->nr_batches++;
 
-    rc = flush_batch(ctx);
+    rc = map_batch(ctx, b, sb->pfns, nr_pfns);
     if ( rc )
         return rc;
 
-    if ( written > entries )
-        DPRINTF("Bitmap contained more entries than expected...");
+    for ( i = 0; i < nr_pfns; ++i )
+    {
+        if ( !b->guest_data[i] || b->local_pages[i] )
+            continue;
 
-    xc_report_progress_step(xch, entries, entries);
+        page = malloc(PAGE_SIZE);
+        if ( !page )
+        {
+            ERROR("Unable to allocate memory for a snapshot page");
+            return -1;
+        }
+        memcpy(page, b->guest_data[i], PAGE_SIZE);
+        b->guest_data[i] = b->local_pages[i] = page;
+    }
 
-    return ctx->save.ops.check_vm_state(ctx);
+    /* Everything to send is local now. */
+    if ( b->guest_mapping )
+    {
+        xenforeignmemory_unmap(xch->fmem, b->guest_mapping,
+                               b->nr_pages_mapped);
+        b->guest_mapping = NULL;
+        b->nr_pages_mapped = 0;
+    }
+
+    ctx->save.nr_batch_pfns = 0;
+
+    return 0;
 }
 
-/*
+static void release_snapshot(struct xc_sr_context *ctx)
+{
+    struct xc_sr_snapshot *snap = &ctx->save.snapshot;
+    unsigned int i;
+
+    for ( i = 0; i < snap->nr_batches; ++i )
+    {
+        release_batch(ctx, &snap->batches[i].batch);
+        free(snap->batches[i].pfns);
+    }
+    snap->nr_batches = 0;
+}
+
+/*
+ * Send the checkpoint's snapshot into the stream.  The guest is running
+ * again meanwhile.
+ */
+static int send_snapshot(struct xc_sr_context *ctx)
+{
+    struct xc_sr_snapshot *snap = &ctx->save.snapshot;
+    unsigned int i;
+    int rc = 0;
+
+    for ( i = 0; !rc && i < snap->nr_batches; ++i )
+        rc = send_batch(ctx, ctx->fd, &snap->batches[i].batch);
+
+    release_snapshot(ctx);
+
+    return rc;
+}
+
+/*
+ * Data channel thread: write out the batches handed over by
+ * submit_channel_batch(), until told to stop.
+ */
+static void *channel_fn(void *arg)
+{
+    struct xc_sr_channel *ch = arg;
+    unsigned int nr;
+    int rc;
+
+    pthread_mutex_lock(&ch->lock);
+
+    for ( ; ; )
+    {
+        while ( !ch->nr_pending_pfns && !ch->stop )
+            pthread_cond_wait(&ch->cond, &ch->lock);
+
+        nr = ch->nr_pending_pfns;
+        if ( !nr )
+            break;
+
+        pthread_mutex_unlock(&ch->lock);
+        rc = ch->rc ?: write_batch(ch->ctx, ch->fd, ch->pending_pfns, nr);
+        pthread_mutex_lock(&ch->lock);
+
+        ch->rc = rc;
+        ch->nr_pending_pfns = 0;
+        pthread_cond_broadcast(&ch->cond);
+    }
+
+    pthread_mutex_unlock(&ch->lock);
+
+    return NULL;
+}
+
+/*
+ * Hand the channel's batch over to its thread, once done with the previous
+ * one.  Returns the first error the thread encountered, if any.
+ */
+static int submit_channel_batch(struct xc_sr_channel *ch)
+{
+    xen_pfn_t *pfns;
+    int rc;
+
+    pthread_mutex_lock(&ch->lock);
+
+    while ( ch->nr_pending_pfns )
+        pthread_cond_wait(&ch->cond, &ch->lock);
+
+    rc = ch->rc;
+    if ( !rc && ch->nr_batch_pfns )
+    {
+        pfns = ch->pending_pfns;
+        ch->pending_pfns = ch->batch_pfns;
+        ch->nr_pending_pfns = ch->nr_batch_pfns;
+        ch->batch_pfns = pfns;
+        ch->nr_batch_pfns = 0;
+        pthread_cond_broadcast(&ch->cond);
+    }
+
+    pthread_mutex_unlock(&ch->lock);
+
+    return rc;
+}
+
+static int wait_channel_idle(struct xc_sr_channel *ch)
+{
+    int rc;
+
+    pthread_mutex_lock(&ch->lock);
+    while ( ch->nr_pending_pfns )
+        pthread_cond_wait(&ch->cond, &ch->lock);
+    rc = ch->rc;
+    pthread_mutex_unlock(&ch->lock);
+
+    return rc;
+}
+
+/*
+ * Flush a batch of pfns into the stream.  With data channels or the writer
+ * thread, wait for all of them to have written out their batches.
+ */
+static int flush_batch(struct xc_sr_context *ctx)
+{
+    unsigned int i;
+    int rc = 0;
+
+    if ( ctx->save.nr_channels )
+    {
+        for ( i = 0; i < ctx->save.nr_channels; i++ )
+            rc = submit_channel_batch(&ctx->save.channels[i]) ?: rc;
+        for ( i = 0; i < ctx->save.nr_channels; i++ )
+            rc = wait_channel_idle(&ctx->save.channels[i]) ?: rc;
+
+        return rc;
+    }
+
+    if ( ctx->save.snapshot.active )
+        return snapshot_batch(ctx);
+
+    if ( ctx->save.writer.running )
+    {
+        if ( ctx->save.nr_batch_pfns )
+            rc = submit_writer_batch(ctx);
+
+        return rc ?: wait_writer_idle(ctx);
+    }
+
+    if ( ctx->save.nr_batch_pfns == 0 )
+        return rc;
+
+    rc = write_batch(ctx, ctx->fd, ctx->save.batch_pfns,
+                     ctx->save.nr_batch_pfns);
+
+    if ( !rc )
+    {
+        ctx->save.nr_batch_pfns = 0;
+        VALGRIND_MAKE_MEM_UNDEFINED(ctx->save.batch_pfns,
+                                    ctx->save.batch_size *
+                                    sizeof(*ctx->save.batch_pfns));
+    }
+
+    return rc;
+}
+
+/*
+ * Add a single pfn to the batch, flushing the batch if full.  With data
+ * channels, the batch is that of the channel the pfn belongs to.
+ */
+static int add_to_batch(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    struct xc_sr_channel *ch;
+    int rc = 0;
+
+    if ( ctx->save.nr_channels )
+    {
+        ch = &ctx->save.channels[(pfn >> DATA_CHANNEL_PFN_SHIFT) %
+                                 ctx->save.nr_channels];
+
+        if ( ch->nr_batch_pfns == MAX_BATCH_SIZE )
+            rc = submit_channel_batch(ch);
+
+        if ( rc == 0 )
+            ch->batch_pfns[ch->nr_batch_pfns++] = pfn;
+
+        return rc;
+    }
+
+    if ( ctx->save.nr_batch_pfns == ctx->save.batch_size )
+        rc = ctx->save.snapshot.active ? snapshot_batch(ctx)
+             : ctx->save.writer.running ? submit_writer_batch(ctx)
+                                        : flush_batch(ctx);
+
+    if ( rc == 0 )
+        ctx->save.batch_pfns[ctx->save.nr_batch_pfns++] = pfn;
+
+    return rc;
+}
+
+/*
+ * Write a record directly to a data channel's stream.  Only used for the
+ * channels' small control records.
+ */
+static int write_channel_record(struct xc_sr_context *ctx,
+                                struct xc_sr_channel *ch,
+                                uint32_t type, const void *data,
+                                uint32_t length)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rhdr rhdr = { .type = type, .length = length };
+    struct iovec iov[] = {
+        { &rhdr,        sizeof(rhdr) },
+        { (void *)data, length },
+    };
+
+    assert(!(length & ((1U << REC_ALIGN_ORDER) - 1)));
+
+    if ( writev_exact(ch->fd, iov, ARRAY_SIZE(iov)) )
+    {
+        PERROR("Unable to write record to data channel %td",
+               ch - ctx->save.channels);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Announce the data channels on the primary stream, identify each one at the
+ * start of its own stream, and start their threads.
+ */
+static int start_channels(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_data_channels dc = { .count = ctx->save.nr_channels };
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_DATA_CHANNELS,
+        .length = sizeof(dc),
+        .data = &dc,
+    };
+    struct xc_sr_channel *ch;
+    unsigned int i;
+    int rc;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        return rc;
+
+    for ( i = 0; i < ctx->save.nr_channels; i++ )
+    {
+        ch = &ctx->save.channels[i];
+
+        dc.channel = i + 1;
+        rc = write_channel_record(ctx, ch, REC_TYPE_DATA_CHANNELS,
+                                  &dc, sizeof(dc));
+        if ( rc )
+            return rc;
+
+        if ( pthread_create(&ch->thread, NULL, channel_fn, ch) )
+        {
+            PERROR("Failed to create thread for data channel %u", i);
+            return -1;
+        }
+        ch->running = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the channel threads.  They have no batches outstanding unless an
+ * error occurred.
+ */
+static void stop_channels(struct xc_sr_context *ctx)
+{
+    struct xc_sr_channel *ch;
+    unsigned int i;
+
+    for ( i = 0; i < ctx->save.nr_channels; i++ )
+    {
+        ch = &ctx->save.channels[i];
+        if ( !ch->running )
+            continue;
+
+        pthread_mutex_lock(&ch->lock);
+        ch->stop = true;
+        pthread_cond_broadcast(&ch->cond);
+        pthread_mutex_unlock(&ch->lock);
+
+        pthread_join(ch->thread, NULL);
+        ch->running = false;
+    }
+}
+
+static int start_writer(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( pthread_create(&ctx->save.writer.thread, NULL, writer_fn, ctx) )
+    {
+        PERROR("Failed to create page data writer thread");
+        return -1;
+    }
+    ctx->save.writer.running = true;
+
+    return 0;
+}
+
+static void stop_writer(struct xc_sr_context *ctx)
+{
+    struct xc_sr_writer *w = &ctx->save.writer;
+
+    if ( !w->running )
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    w->running = false;
+}
+
+/*
+ * All page data has been sent: end the data channels' streams, and tell
+ * the restorer to wait for them before going on with the primary stream.
+ */
+static int end_channels(struct xc_sr_context *ctx)
+{
+    struct xc_sr_record rec = { .type = REC_TYPE_DATA_CHANNELS_END };
+    unsigned int i;
+    int rc;
+
+    stop_channels(ctx);
+
+    for ( i = 0; i < ctx->save.nr_channels; i++ )
+    {
+        rc = ctx->save.channels[i].rc ?:
+            write_channel_record(ctx, &ctx->save.channels[i],
+                                 REC_TYPE_END, NULL, 0);
+        if ( rc )
+            return rc;
+    }
+
+    return write_record(ctx, &rec);
+}
+
+/*
+ * Pause/suspend the domain, and refresh ctx->dominfo if required.
+ */
+static int suspend_domain(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    /* TODO: Properly specify the return value from this callback.  All
+     * implementations currently appear to return 1 for success, whereas
+     * the legacy code checks for != 0. */
+    int cb_rc = ctx->save.callbacks->suspend(ctx->save.callbacks->data);
+
+    if ( cb_rc == 0 )
+    {
+        ERROR("save callback suspend() failed: %d", cb_rc);
+        return -1;
+    }
+
+    /* Refresh domain information. */
+    if ( (xc_domain_getinfo(xch, ctx->domid, 1, &ctx->dominfo) != 1) ||
+         (ctx->dominfo.domid != ctx->domid) )
+    {
+        PERROR("Unable to refresh domain information");
+        return -1;
+    }
+
+    /* Confirm the domain has actually been paused. */
+    if ( !ctx->dominfo.shutdown ||
+         (ctx->dominfo.shutdown_reason != SHUTDOWN_suspend) )
+    {
+        ERROR("Domain has not been suspended: shutdown %d, reason %d",
+              ctx->dominfo.shutdown, ctx->dominfo.shutdown_reason);
+        return -1;
+    }
+
+    xc_report_progress_single(xch, "Domain now suspended");
+
+    return 0;
+}
+
+/*
+ * Send a subset of pages in the guests p2m, according to the dirty bitmap.
+ * Used for each subsequent iteration of the live migration loop.
+ *
+ * Bitmap is bounded by p2m_size.
+ */
+static int send_dirty_pages(struct xc_sr_context *ctx,
+                            unsigned long entries)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t p;
+    unsigned long written;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    for ( p = 0, written = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( !test_bit(p, dirty_bitmap) )
+            continue;
+
+        rc = add_to_batch(ctx, p);
+        if ( rc )
+            return rc;
+
+        /* Update progress every 4MB worth of memory sent. */
+        if ( (written & ((1U << (22 - 12)) - 1)) == 0 )
+            xc_report_progress_step(xch, written, entries);
+
+        ++written;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    if ( written > entries )
+        DPRINTF("Bitmap contained more entries than expected...");
+
+    xc_report_progress_step(xch, entries, entries);
+
+    return ctx->save.ops.check_vm_state(ctx);
+}
+
+/*
  * Send all pages in the guests p2m.  Used as the first iteration of the live
  * migration loop, and for a non-live save.
  */
-static int send_all_pages(struct xc_sr_context *ctx)
+static int send_all_pages(struct xc_sr_context *ctx)
+{
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+
+    return send_dirty_pages(ctx, ctx->save.p2m_size);
+}
+
+static int enable_logdirty(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int on1 = 0, off = 0, on2 = 0;
+    int rc;
+
+    /* This juggling is required if logdirty is enabled for VRAM tracking. */
+    rc = xc_shadow_control(xch, ctx->domid,
+                           XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
+                           NULL, 0);
+    if ( rc < 0 )
+    {
+        on1 = errno;
+        rc = xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
+                               NULL, 0);
+        if ( rc < 0 )
+            off = errno;
+        else {
+            rc = xc_shadow_control(xch, ctx->domid,
+                                   XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
+                                   NULL, 0);
+            if ( rc < 0 )
+                on2 = errno;
+        }
+        if ( rc < 0 )
+        {
+            PERROR("Failed to enable logdirty: %d,%d,%d", on1, off, on2);
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/* Frames per vCPU dirty ring, i.e. 8190 entries. */
+#define DIRTY_RING_FRAMES 16
+
+static void disable_dirty_rings(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i;
+
+    for ( i = 0; ctx->save.dirty_ring_res && i < ctx->save.nr_dirty_rings;
+          i++ )
+        if ( ctx->save.dirty_ring_res[i] )
+            xenforeignmemory_unmap_resource(xch->fmem,
+                                            ctx->save.dirty_ring_res[i]);
+
+    free(ctx->save.dirty_ring_res);
+    free(ctx->save.dirty_rings);
+    free(ctx->save.dirty_ring_pfns);
+    ctx->save.dirty_ring_res = NULL;
+    ctx->save.dirty_rings = NULL;
+    ctx->save.dirty_ring_pfns = NULL;
+    ctx->save.nr_dirty_rings = 0;
+
+    xc_dirty_ring_enable(xch, ctx->domid, 0);
+}
+
+/*
+ * Have Xen log dirtied pages into per-vCPU rings, so that live rounds only
+ * need to look at the pages actually dirtied, rather than at the entire
+ * log-dirty bitmap.  Not being able to is not an error: the bitmap then
+ * continues to be used.
+ */
+static void enable_dirty_rings(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i, nr = ctx->dominfo.max_vcpu_id + 1;
+
+    if ( !ctx->dominfo.hap )
+        return;
+
+    if ( xc_dirty_ring_enable(xch, ctx->domid, DIRTY_RING_FRAMES) )
+    {
+        DPRINTF("No dirty rings (errno %d), using the log-dirty bitmap",
+                errno);
+        return;
+    }
+
+    ctx->save.nr_dirty_rings = nr;
+    ctx->save.nr_dirty_ring_pfns = -1;
+    ctx->save.dirty_ring_res = calloc(nr, sizeof(*ctx->save.dirty_ring_res));
+    ctx->save.dirty_rings = calloc(nr, sizeof(*ctx->save.dirty_rings));
+    ctx->save.dirty_ring_pfns =
+        malloc(nr * XEN_DIRTY_RING_ENTRIES(DIRTY_RING_FRAMES) *
+               sizeof(*ctx->save.dirty_ring_pfns));
+    if ( !ctx->save.dirty_ring_res || !ctx->save.dirty_rings ||
+         !ctx->save.dirty_ring_pfns )
+        goto err;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        void *addr = NULL;
+
+        ctx->save.dirty_ring_res[i] = xenforeignmemory_map_resource(
+            xch->fmem, ctx->domid, XENMEM_resource_dirty_ring, i, 0,
+            DIRTY_RING_FRAMES, &addr, PROT_READ | PROT_WRITE, 0);
+        if ( !ctx->save.dirty_ring_res[i] )
+            goto err;
+
+        ctx->save.dirty_rings[i] = addr;
+    }
+
+    return;
+
+ err:
+    PERROR("Failed to set up dirty rings, using the log-dirty bitmap");
+    disable_dirty_rings(ctx);
+}
+
+/*
+ * Collect the PFNs logged in the dirty rings since the previous call and
+ * not yet set in the dirty bitmap, then hand the entries back to Xen.
+ * Returns the number of PFNs collected, or -1 on error.
+ */
+static long harvest_dirty_rings(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int i, entries = XEN_DIRTY_RING_ENTRIES(DIRTY_RING_FRAMES);
+    long nr = 0;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    for ( i = 0; i < ctx->save.nr_dirty_rings; i++ )
+    {
+        xen_dirty_ring_t *ring = ctx->save.dirty_rings[i];
+        uint32_t cons = ring->cons, prod = ring->prod;
+
+        /* Read prod before the entries it covers. */
+        xen_rmb();
+
+        for ( ; cons != prod; cons = (cons + 1) % entries )
+        {
+            xen_pfn_t pfn = ring->gfn[cons];
+
+            if ( pfn >= ctx->save.p2m_size )
+            {
+                ERROR("Dirty ring %u: pfn %#"PRIpfn" out of range", i, pfn);
+                return -1;
+            }
+
+            if ( !test_and_set_bit(pfn, dirty_bitmap) )
+                ctx->save.dirty_ring_pfns[nr++] = pfn;
+        }
+
+        /* Done with the entries before handing them back. */
+        xen_mb();
+        ring->cons = cons;
+    }
+
+    if ( xc_dirty_ring_reset(xch, ctx->domid) )
+    {
+        PERROR("Failed to reset dirty rings");
+        return -1;
+    }
+
+    return nr;
+}
+
+/*
+ * Dirty ring counterpart of an OP_CLEAN round.  Unless a ring overflowed,
+ * the dirty pages are only listed in ctx->save.dirty_ring_pfns[], without
+ * the need to scan the entire bitmap.
+ */
+static int clean_dirty_rings(struct xc_sr_context *ctx,
+                             xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+    bool overflow = false;
+    unsigned int i;
+    long nr;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    /* Start from a clear bitmap again. */
+    if ( ctx->save.nr_dirty_ring_pfns < 0 )
+        bitmap_clear(dirty_bitmap, ctx->save.p2m_size);
+    else
+        for ( nr = 0; nr < ctx->save.nr_dirty_ring_pfns; nr++ )
+            clear_bit(ctx->save.dirty_ring_pfns[nr], dirty_bitmap);
+
+    for ( i = 0; i < ctx->save.nr_dirty_rings; i++ )
+        if ( ctx->save.dirty_rings[i]->overflow )
+        {
+            ctx->save.dirty_rings[i]->overflow = 0;
+            overflow = true;
+        }
+
+    /* PFNs which didn't fit in a ring went to Xen's bitmap instead. */
+    stats->dirty_count = 0;
+    if ( overflow &&
+         xc_logdirty_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                             &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
+                             0, stats) != ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        return -1;
+    }
+
+    nr = harvest_dirty_rings(ctx);
+    if ( nr < 0 )
+        return -1;
+
+    stats->dirty_count += nr;
+    ctx->save.nr_dirty_ring_pfns = overflow ? -1 : nr;
+
+    return 0;
+}
+
+/*
+ * Send the pages listed by clean_dirty_rings().
+ */
+static int send_dirty_ring_pages(struct xc_sr_context *ctx)
+{
+    long i;
+    int rc;
+
+    for ( i = 0; i < ctx->save.nr_dirty_ring_pfns; i++ )
+    {
+        rc = add_to_batch(ctx, ctx->save.dirty_ring_pfns[i]);
+        if ( rc )
+            return rc;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    return ctx->save.ops.check_vm_state(ctx);
+}
+
+/*
+ * For large HAP guests, the bitmap is harvested by several threads, each
+ * issuing ranged OP_CLEANs on a shard of the guest at a time.  Xen doesn't
+ * serialise these against each other, so the cost of scanning the bitmap and
+ * write-protecting the dirty pages is spread across CPUs.
+ */
+#define SHARDED_CLEAN_MIN_PAGES (1UL << 26)
+#define SHARDED_CLEAN_THREADS   4
+
+struct sharded_clean {
+    struct xc_sr_context *ctx;
+    pthread_mutex_t lock;
+    unsigned long next_pfn;
+    unsigned long dirty_count;
+    bool failed;
+};
+
+static void *sharded_clean_fn(void *arg)
 {
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->save.dirty_bitmap_hbuf);
+    struct sharded_clean *sc = arg;
+    struct xc_sr_context *ctx = sc->ctx;
+    xc_interface *xch = ctx->xch;
+    unsigned long first, pages, dirty = 0;
+    xc_shadow_op_stats_t stats;
+    bool failed = false;
 
-    bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&sc->lock);
+        first = sc->next_pfn;
+        if ( !sc->failed && first < ctx->save.p2m_size )
+            sc->next_pfn += XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE_MAX;
+        else
+            first = ctx->save.p2m_size;
+        pthread_mutex_unlock(&sc->lock);
 
-    return send_dirty_pages(ctx, ctx->save.p2m_size);
+        if ( first >= ctx->save.p2m_size )
+            break;
+
+        /* Ranges need to be a multiple of 64 PFNs; the bitmap is padded. */
+        pages = min(ctx->save.p2m_size - first,
+                    (unsigned long)XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE_MAX);
+        pages = ROUNDUP(pages, 6);
+
+        if ( xc_logdirty_control_range(
+                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                 &ctx->save.dirty_bitmap_hbuf, first, pages,
+                 &stats) != pages )
+        {
+            PERROR("Failed to retrieve logdirty bitmap for pfns %#lx-%#lx",
+                   first, first + pages - 1);
+            failed = true;
+            break;
+        }
+
+        dirty += stats.dirty_count;
+    }
+
+    pthread_mutex_lock(&sc->lock);
+    sc->dirty_count += dirty;
+    sc->failed |= failed;
+    pthread_mutex_unlock(&sc->lock);
+
+    return NULL;
 }
 
-static int enable_logdirty(struct xc_sr_context *ctx)
+/*
+ * Perform an OP_CLEAN round, sharded across threads where worthwhile.
+ */
+static int clean_logdirty(struct xc_sr_context *ctx,
+                          xc_shadow_op_stats_t *stats)
 {
     xc_interface *xch = ctx->xch;
-    int on1 = 0, off = 0, on2 = 0;
-    int rc;
+    struct sharded_clean sc = {
+        .ctx = ctx,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    pthread_t threads[SHARDED_CLEAN_THREADS - 1];
+    unsigned int i, nr = 0;
 
-    /* This juggling is required if logdirty is enabled for VRAM tracking. */
-    rc = xc_shadow_control(xch, ctx->domid,
-                           XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
-                           NULL, 0);
-    if ( rc < 0 )
+    if ( !ctx->dominfo.hap || ctx->save.p2m_size < SHARDED_CLEAN_MIN_PAGES )
     {
-        on1 = errno;
-        rc = xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
-                               NULL, 0);
-        if ( rc < 0 )
-            off = errno;
-        else {
-            rc = xc_shadow_control(xch, ctx->domid,
-                                   XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY,
-                                   NULL, 0);
-            if ( rc < 0 )
-                on2 = errno;
-        }
-        if ( rc < 0 )
+        if ( xc_logdirty_control(
+                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
+                 0, stats) != ctx->save.p2m_size )
         {
-            PERROR("Failed to enable logdirty: %d,%d,%d", on1, off, on2);
-            return rc;
+            PERROR("Failed to retrieve logdirty bitmap");
+            return -1;
         }
+
+        return 0;
     }
 
+    for ( i = 0; i < ARRAY_SIZE(threads); i++, nr++ )
+        if ( pthread_create(&threads[i], NULL, sharded_clean_fn, &sc) )
+        {
+            /* Carry on with fewer threads; this one always takes part. */
+            PERROR("Failed to create logdirty harvesting thread");
+            break;
+        }
+
+    sharded_clean_fn(&sc);
+
+    for ( i = 0; i < nr; i++ )
+        pthread_join(threads[i], NULL);
+
+    if ( sc.failed )
+        return -1;
+
+    stats->dirty_count = sc.dirty_count;
+
     return 0;
 }
 
@@ -490,6 +1520,179 @@ static int simple_precopy_policy(struct precopy_stats stats, void *user)
         : XGS_POLICY_CONTINUE_PRECOPY;
 }
 
+/*
+ * Auto-converge: take CPU time away from the guest, through its scheduler
+ * cap, so that it dirties memory more slowly.  Each call throttles further,
+ * up to APP_THROTTLE_MAX percent.  Only the credit schedulers have caps.
+ */
+#define APP_THROTTLE_INITIAL   20
+#define APP_THROTTLE_STEP      10
+#define APP_THROTTLE_MAX       90
+
+static void throttle_guest(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned int throttle, base, cap;
+    xc_cpupoolinfo_t *info;
+    int rc;
+
+    if ( ctx->save.throttle_unsupported ||
+         ctx->save.throttle >= APP_THROTTLE_MAX )
+        return;
+
+    if ( !ctx->save.throttle )
+    {
+        info = xc_cpupool_getinfo(xch, ctx->dominfo.cpupool);
+        if ( !info )
+        {
+            PERROR("Failed to get cpupool info, not throttling");
+            ctx->save.throttle_unsupported = true;
+            return;
+        }
+        ctx->save.sched_id = info->sched_id;
+        xc_cpupool_infofree(xch, info);
+
+        switch ( ctx->save.sched_id )
+        {
+        case XEN_SCHEDULER_CREDIT:
+            rc = xc_sched_credit_domain_get(xch, ctx->domid,
+                                            &ctx->save.sched_params.credit);
+            break;
+
+        case XEN_SCHEDULER_CREDIT2:
+            rc = xc_sched_credit2_domain_get(xch, ctx->domid,
+                                             &ctx->save.sched_params.credit2);
+            break;
+
+        default:
+            DPRINTF("No caps with scheduler %u, not throttling",
+                    ctx->save.sched_id);
+            ctx->save.throttle_unsupported = true;
+            return;
+        }
+
+        if ( rc )
+        {
+            PERROR("Failed to get scheduling parameters, not throttling");
+            ctx->save.throttle_unsupported = true;
+            return;
+        }
+
+        throttle = APP_THROTTLE_INITIAL;
+    }
+    else
+        throttle = min_t(unsigned int, ctx->save.throttle + APP_THROTTLE_STEP,
+                         APP_THROTTLE_MAX);
+
+    /* Caps are in percent of a pCPU, 0 meaning no cap. */
+    base = ctx->save.sched_id == XEN_SCHEDULER_CREDIT
+        ? ctx->save.sched_params.credit.cap
+        : ctx->save.sched_params.credit2.cap;
+    if ( !base )
+        base = min((ctx->dominfo.max_vcpu_id + 1) * 100U, 65535U);
+    cap = max(base * (100 - throttle) / 100, 1U);
+
+    if ( ctx->save.sched_id == XEN_SCHEDULER_CREDIT )
+    {
+        struct xen_domctl_sched_credit p = ctx->save.sched_params.credit;
+
+        p.cap = cap;
+        rc = xc_sched_credit_domain_set(xch, ctx->domid, &p);
+    }
+    else
+    {
+        struct xen_domctl_sched_credit2 p = ctx->save.sched_params.credit2;
+
+        p.cap = cap;
+        rc = xc_sched_credit2_domain_set(xch, ctx->domid, &p);
+    }
+
+    if ( rc )
+    {
+        PERROR("Failed to throttle guest to cap %u", cap);
+        return;
+    }
+
+    IPRINTF("Throttling guest by %u%% (cap %u)", throttle, cap);
+    ctx->save.throttle = throttle;
+}
+
+static void unthrottle_guest(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc;
+
+    if ( !ctx->save.throttle )
+        return;
+
+    if ( ctx->save.sched_id == XEN_SCHEDULER_CREDIT )
+        rc = xc_sched_credit_domain_set(xch, ctx->domid,
+                                        &ctx->save.sched_params.credit);
+    else
+        rc = xc_sched_credit2_domain_set(xch, ctx->domid,
+                                         &ctx->save.sched_params.credit2);
+
+    if ( rc )
+        PERROR("Failed to restore the guest's scheduler cap");
+
+    ctx->save.throttle = 0;
+}
+
+/*
+ * The precopy policy used when a maximum downtime is requested.
+ *
+ * The downtime is predicted from the number of dirty pages and the rate at
+ * which pages were sent in the previous iteration, going for stop-and-copy
+ * as soon as it is within the target.  When the guest dirties memory more
+ * than half as fast as it can be sent, precopy would take too many
+ * iterations to converge, if at all, so the guest is throttled further.
+ * After APP_MAX_ITERATIONS, stop-and-copy happens regardless.
+ */
+#define APP_MAX_ITERATIONS     30
+
+static int adaptive_precopy_policy(struct precopy_stats stats, void *user)
+{
+    struct xc_sr_context *ctx = user;
+    xc_interface *xch = ctx->xch;
+    unsigned int max_downtime_ms = ctx->save.callbacks->max_downtime_ms;
+    unsigned long downtime_ms;
+
+    /* Only decide on a fresh dirty count, with rates measured. */
+    if ( stats.dirty_count < 0 || !stats.iteration || !stats.send_rate )
+        return XGS_POLICY_CONTINUE_PRECOPY;
+
+    downtime_ms = stats.dirty_count * 1000UL / stats.send_rate;
+
+    if ( downtime_ms <= max_downtime_ms )
+    {
+        DPRINTF("Predicted downtime %lums, after %u iterations",
+                downtime_ms, stats.iteration);
+        return XGS_POLICY_STOP_AND_COPY;
+    }
+
+    if ( stats.iteration >= APP_MAX_ITERATIONS )
+    {
+        IPRINTF("Predicted downtime %lums exceeds the %ums target, but "
+                "precopy didn't converge after %u iterations",
+                downtime_ms, max_downtime_ms, stats.iteration);
+        return XGS_POLICY_STOP_AND_COPY;
+    }
+
+    if ( stats.dirty_rate > stats.send_rate / 2 )
+        throttle_guest(ctx);
+
+    return XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
 /*
  * Send memory while guest is running.
  */
@@ -501,6 +1704,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
     unsigned int x = 0;
     int rc;
     int policy_decision;
+    uint64_t start, last_clean = now_us();
 
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
@@ -519,63 +1723,272 @@ static int send_memory_live(struct xc_sr_context *ctx)
     };
     policy_stats = &ctx->save.stats;
 
-    if ( precopy_policy == NULL )
-        precopy_policy = simple_precopy_policy;
+    if ( precopy_policy == NULL && ctx->save.callbacks->max_downtime_ms )
+    {
+        precopy_policy = adaptive_precopy_policy;
+        data = ctx;
+    }
+    else if ( precopy_policy == NULL )
+        precopy_policy = simple_precopy_policy;
+
+    bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+
+    for ( ; ; )
+    {
+        policy_decision = precopy_policy(*policy_stats, data);
+        x++;
+
+        /*
+         * With post-copy, stopping means switching over to the destination
+         * rather than sending the dirty pages with the domain suspended:
+         * leave them to the post-copy phase instead.
+         */
+        if ( ctx->save.postcopy_fd >= 0 &&
+             policy_decision == XGS_POLICY_STOP_AND_COPY )
+        {
+            bitmap_or(ctx->save.deferred_pages, dirty_bitmap,
+                      ctx->save.p2m_size);
+            ctx->save.nr_deferred_pages += policy_stats->dirty_count;
+            break;
+        }
+
+        if ( stats.dirty_count > 0 && policy_decision != XGS_POLICY_ABORT )
+        {
+            rc = update_progress_string(ctx, &progress_str);
+            if ( rc )
+                goto out;
+
+            start = now_us();
+
+            if ( ctx->save.dirty_rings && ctx->save.nr_dirty_ring_pfns >= 0 )
+                rc = send_dirty_ring_pages(ctx);
+            else
+                rc = send_dirty_pages(ctx, stats.dirty_count);
+            if ( rc )
+                goto out;
+
+            policy_stats->send_rate =
+                stats.dirty_count * 1000000ULL / max_t(uint64_t, now_us() - start, 1);
+        }
+
+        if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
+            break;
+
+        policy_stats->iteration     = x;
+        policy_stats->total_written += policy_stats->dirty_count;
+        policy_stats->dirty_count   = -1;
+
+        policy_decision = precopy_policy(*policy_stats, data);
+
+        if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
+            break;
+
+        if ( ctx->save.dirty_rings )
+        {
+            rc = clean_dirty_rings(ctx, &stats);
+            if ( rc )
+                goto out;
+        }
+        else if ( clean_logdirty(ctx, &stats) )
+        {
+            rc = -1;
+            goto out;
+        }
+
+        policy_stats->dirty_count = stats.dirty_count;
+
+        start = now_us();
+        policy_stats->dirty_rate =
+            stats.dirty_count * 1000000ULL / max_t(uint64_t, start - last_clean, 1);
+        last_clean = start;
+    }
+
+    if ( policy_decision == XGS_POLICY_ABORT )
+    {
+        PERROR("Abort precopy loop");
+        rc = -1;
+        goto out;
+    }
+
+ out:
+    xc_set_progress_prefix(xch, NULL);
+    free(progress_str);
+    return rc;
+}
+
+/*
+ * Leave the pages dirty at suspend time to the post-copy phase, listing them
+ * in POSTCOPY_PFNS records so that the restoring side can mark them as paged
+ * out.  Pages without data (holes, broken pages) are sent right away instead,
+ * as their type is all there is to them.
+ */
+static int send_postcopy_pfns(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t p = 0, *pfns = NULL, *types = NULL;
+    uint64_t *rec_pfns = NULL;
+    unsigned int i, nr, nr_rec;
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_POSTCOPY_PFNS,
+    };
+    int rc = -1;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    pfns = malloc(MAX_BATCH_SIZE * sizeof(*pfns));
+    types = malloc(MAX_BATCH_SIZE * sizeof(*types));
+    rec_pfns = malloc(MAX_BATCH_SIZE * sizeof(*rec_pfns));
+    if ( !pfns || !types || !rec_pfns )
+    {
+        ERROR("Unable to allocate memory for post-copy pfn batches");
+        goto out;
+    }
+
+    for ( ; ; )
+    {
+        for ( nr = 0; p < ctx->save.p2m_size && nr < MAX_BATCH_SIZE; ++p )
+            if ( test_bit(p, dirty_bitmap) )
+                pfns[nr++] = p;
+
+        if ( !nr )
+            break;
+
+        for ( i = 0; i < nr; ++i )
+            types[i] = ctx->save.ops.pfn_to_gfn(ctx, pfns[i]);
+
+        if ( xc_get_pfn_type_batch(xch, ctx->domid, nr, types) )
+        {
+            PERROR("Failed to get types for pfn batch");
+            goto out;
+        }
+
+        for ( i = 0, nr_rec = 0; i < nr; ++i )
+        {
+            if ( !page_type_has_stream_data(types[i]) )
+            {
+                if ( add_to_batch(ctx, pfns[i]) )
+                    goto out;
+                continue;
+            }
+
+            set_bit(pfns[i], ctx->save.postcopy_pfns);
+            rec_pfns[nr_rec++] = pfns[i];
+        }
+
+        if ( !nr_rec )
+            continue;
+
+        rec.length = nr_rec * sizeof(*rec_pfns);
+        rec.data = rec_pfns;
+        if ( flush_batch(ctx) || write_record(ctx, &rec) )
+            goto out;
+
+        ctx->save.nr_postcopy_pfns += nr_rec;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        goto out;
+
+    DPRINTF("Left %lu pages for post-copy", ctx->save.nr_postcopy_pfns);
+
+ out:
+    free(rec_pfns);
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * The post-copy phase, once the primary stream has ended: push the pages left
+ * behind over the post-copy channel, ahead of which those the restoring side
+ * requests, as the guest is waiting for them there.
+ */
+static int send_postcopy_pages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int fd = ctx->save.postcopy_fd;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct xc_sr_record rec;
+    struct xc_sr_record end = { .type = REC_TYPE_END };
+    unsigned long next = 0, sent = 0, nr = ctx->save.nr_postcopy_pfns;
+    xen_pfn_t *pfns = malloc(MAX_BATCH_SIZE * sizeof(*pfns));
+    const uint64_t *req;
+    unsigned int i, n;
+    int rc = -1;
+
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory for post-copy batches");
+        return -1;
+    }
 
-    bitmap_set(dirty_bitmap, ctx->save.p2m_size);
+    xc_set_progress_prefix(xch, "Post-copy");
 
-    for ( ; ; )
+    while ( sent < nr )
     {
-        policy_decision = precopy_policy(*policy_stats, data);
-        x++;
+        n = 0;
 
-        if ( stats.dirty_count > 0 && policy_decision != XGS_POLICY_ABORT )
+        if ( poll(&pfd, 1, 0) > 0 )
         {
-            rc = update_progress_string(ctx, &progress_str);
-            if ( rc )
+            if ( read_record(ctx, fd, &rec) )
                 goto out;
 
-            rc = send_dirty_pages(ctx, stats.dirty_count);
-            if ( rc )
+            if ( rec.type != REC_TYPE_POSTCOPY_REQUEST ||
+                 rec.length % sizeof(*req) )
+            {
+                ERROR("Unexpected record %#x (%s), length %u, on post-copy "
+                      "channel", rec.type, rec_type_to_str(rec.type),
+                      rec.length);
+                free(rec.data);
                 goto out;
-        }
-
-        if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
-            break;
-
-        policy_stats->iteration     = x;
-        policy_stats->total_written += policy_stats->dirty_count;
-        policy_stats->dirty_count   = -1;
+            }
 
-        policy_decision = precopy_policy(*policy_stats, data);
+            /* Pages already sent are the ones in flight: skip them. */
+            for ( i = 0, req = rec.data; i < rec.length / sizeof(*req); ++i )
+            {
+                if ( req[i] >= ctx->save.p2m_size ||
+                     !test_and_clear_bit(req[i], ctx->save.postcopy_pfns) )
+                    continue;
 
-        if ( policy_decision != XGS_POLICY_CONTINUE_PRECOPY )
-            break;
+                pfns[n++] = req[i];
+                if ( n < MAX_BATCH_SIZE )
+                    continue;
 
-        if ( xc_logdirty_control(
-                 xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-                 &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
-                 0, &stats) != ctx->save.p2m_size )
+                if ( write_batch(ctx, fd, pfns, n) )
+                {
+                    free(rec.data);
+                    goto out;
+                }
+                sent += n;
+                n = 0;
+            }
+            free(rec.data);
+        }
+        else
         {
-            PERROR("Failed to retrieve logdirty bitmap");
-            rc = -1;
-            goto out;
+            for ( ; next < ctx->save.p2m_size && n < MAX_BATCH_SIZE; ++next )
+                if ( test_and_clear_bit(next, ctx->save.postcopy_pfns) )
+                    pfns[n++] = next;
         }
 
-        policy_stats->dirty_count = stats.dirty_count;
+        if ( n )
+        {
+            if ( write_batch(ctx, fd, pfns, n) )
+                goto out;
+            sent += n;
+        }
 
+        xc_report_progress_step(xch, sent, nr);
     }
 
-    if ( policy_decision == XGS_POLICY_ABORT )
-    {
-        PERROR("Abort precopy loop");
-        rc = -1;
-        goto out;
-    }
+    rc = write_split_record_fd(ctx, fd, &end, NULL, 0);
 
  out:
     xc_set_progress_prefix(xch, NULL);
-    free(progress_str);
+    free(pfns);
+
     return rc;
 }
 
@@ -660,6 +2073,21 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
         goto out;
     }
 
+    /* Hardware-cached dirty pages have been flushed into the rings. */
+    if ( ctx->save.dirty_rings )
+    {
+        long nr = harvest_dirty_rings(ctx);
+
+        if ( nr < 0 )
+        {
+            rc = -1;
+            goto out;
+        }
+
+        stats.dirty_count += nr;
+        ctx->save.nr_dirty_ring_pfns = -1;
+    }
+
     if ( ctx->save.live )
     {
         rc = update_progress_string(ctx, &progress_str);
@@ -681,7 +2109,11 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
         }
     }
 
-    rc = send_dirty_pages(ctx, stats.dirty_count + ctx->save.nr_deferred_pages);
+    if ( ctx->save.postcopy_fd >= 0 )
+        rc = send_postcopy_pfns(ctx);
+    else
+        rc = send_dirty_pages(ctx,
+                              stats.dirty_count + ctx->save.nr_deferred_pages);
     if ( rc )
         goto out;
 
@@ -740,6 +2172,10 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
+    /* Post-copy takes the pages left behind from the logdirty bitmap. */
+    if ( ctx->save.postcopy_fd < 0 )
+        enable_dirty_rings(ctx);
+
     rc = send_memory_live(ctx);
     if ( rc )
         goto out;
@@ -748,7 +2184,12 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    if ( ctx->save.debug && ctx->stream_type == XC_STREAM_PLAIN )
+    /*
+     * Verification relies on the VERIFY record being ordered with the page
+     * data, which data channels don't provide.
+     */
+    if ( ctx->save.debug && ctx->stream_type == XC_STREAM_PLAIN &&
+         !ctx->save.nr_channels && ctx->save.postcopy_fd < 0 )
     {
         rc = verify_frames(ctx);
         if ( rc )
@@ -764,7 +2205,213 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
  */
 static int send_domain_memory_checkpointed(struct xc_sr_context *ctx)
 {
-    return suspend_and_send_dirty(ctx);
+    int rc;
+
+    ctx->save.snapshot.active = ctx->save.snapshot.enabled;
+    rc = suspend_and_send_dirty(ctx);
+    ctx->save.snapshot.active = false;
+
+    return rc;
+}
+
+static int pwrite_exact(int fd, const void *data, size_t size, off_t offset)
+{
+    ssize_t len;
+
+    while ( size )
+    {
+        len = pwrite(fd, data, size, offset);
+        if ( len < 0 && errno == EINTR )
+            continue;
+        if ( len <= 0 )
+            return -1;
+
+        data += len;
+        size -= len;
+        offset += len;
+    }
+
+    return 0;
+}
+
+/*
+ * Indexed savefile: write a PAGE_DATA_INDEX record listing the runs of pfns
+ * with data, followed by a region of the file holding each of their pages at
+ * the pfn's offset.  Zero pages are left as holes.  Returns 1 without having
+ * written anything if the index would not fit in a record.
+ */
+static int send_indexed_pages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_index *idx = NULL, *p;
+    struct xc_sr_rec_memory_layout_entry *e = NULL;
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_PAGE_DATA_INDEX,
+    };
+    struct xc_sr_batch b = {};
+    xen_pfn_t *pfns = malloc(MAX_BATCH_SIZE * sizeof(*pfns));
+    xen_pfn_t *types = malloc(MAX_BATCH_SIZE * sizeof(*types));
+    xen_pfn_t pfn, nr_pfns, written = 0;
+    unsigned int nr, i, j, max = 0, count = 0;
+    off_t pos, start;
+    int rc = -1;
+
+    if ( !pfns || !types )
+    {
+        ERROR("Unable to allocate memory for the page data index");
+        goto out;
+    }
+
+    for ( pfn = 0; pfn < ctx->save.p2m_size; pfn += nr )
+    {
+        nr = min_t(xen_pfn_t, MAX_BATCH_SIZE, ctx->save.p2m_size - pfn);
+
+        for ( i = 0; i < nr; ++i )
+            types[i] = pfn + i;
+
+        if ( xc_get_pfn_type_batch(xch, ctx->domid, nr, types) )
+        {
+            PERROR("Failed to get types for pfns %#"PRIpfn"-%#"PRIpfn,
+                   pfn, pfn + nr - 1);
+            goto out;
+        }
+
+        for ( i = 0; i < nr; ++i )
+        {
+            if ( !page_type_has_stream_data(types[i]) )
+                continue;
+
+            if ( count && e[count - 1].pfn + e[count - 1].nr_pfns == pfn + i )
+            {
+                e[count - 1].nr_pfns++;
+                continue;
+            }
+
+            if ( count == max )
+            {
+                if ( sizeof(*idx) + (max + 1) * sizeof(*e) > REC_LENGTH_MAX )
+                {
+                    DPRINTF("Memory too fragmented for an indexed save");
+                    rc = 1;
+                    goto out;
+                }
+
+                max = max ? max * 2 : 64;
+                p = realloc(idx, sizeof(*idx) + max * sizeof(*e));
+                if ( !p )
+                {
+                    ERROR("Unable to allocate memory for the page data index");
+                    goto out;
+                }
+                idx = p;
+                e = idx->entry;
+            }
+
+            e[count].pfn = pfn + i;
+            e[count].nr_pfns = 1;
+            count++;
+        }
+    }
+
+    nr_pfns = count ? e[count - 1].pfn + e[count - 1].nr_pfns : 0;
+
+    pos = lseek(ctx->fd, 0, SEEK_CUR);
+    if ( pos < 0 )
+    {
+        PERROR("Unable to get the savefile position");
+        goto out;
+    }
+
+    rec.length = sizeof(*idx) + count * sizeof(*e);
+    rec.data = idx;
+
+    /* The page data starts at the first page boundary after the record. */
+    pos += sizeof(struct xc_sr_rhdr) + ROUNDUP(rec.length, REC_ALIGN_ORDER);
+    start = ROUNDUP(pos, XC_PAGE_SHIFT);
+
+    if ( !idx )
+    {
+        rec.data = idx = calloc(1, sizeof(*idx));
+        if ( !idx )
+        {
+            ERROR("Unable to allocate memory for the page data index");
+            goto out;
+        }
+    }
+
+    idx->count = count;
+    idx->_res1 = 0;
+    idx->data_offset = start - pos;
+    idx->nr_pfns = nr_pfns;
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        goto out;
+    rc = -1;
+
+    for ( i = 0; i < count; ++i )
+    {
+        for ( pfn = e[i].pfn; pfn < e[i].pfn + e[i].nr_pfns; pfn += nr )
+        {
+            nr = min_t(xen_pfn_t, MAX_BATCH_SIZE,
+                       e[i].pfn + e[i].nr_pfns - pfn);
+            for ( j = 0; j < nr; ++j )
+                pfns[j] = pfn + j;
+
+            if ( map_batch(ctx, &b, pfns, nr) )
+                goto out;
+
+            /* Write each run of consecutive non-zero pages in one go. */
+            for ( j = 0; j < nr; )
+            {
+                unsigned int k;
+
+                if ( !b.guest_data[j] || page_is_zero(b.guest_data[j]) )
+                {
+                    ++j;
+                    continue;
+                }
+
+                for ( k = j + 1; k < nr && b.guest_data[k] &&
+                          b.guest_data[k] == b.guest_data[k - 1] + PAGE_SIZE &&
+                          !page_is_zero(b.guest_data[k]); ++k )
+                    ;
+
+                if ( pwrite_exact(ctx->fd, b.guest_data[j],
+                                  (size_t)(k - j) * PAGE_SIZE,
+                                  start + (off_t)pfns[j] * PAGE_SIZE) )
+                {
+                    PERROR("Failed to write page data to savefile");
+                    goto out;
+                }
+
+                j = k;
+            }
+
+            release_batch(ctx, &b);
+
+            written += nr;
+            xc_report_progress_step(xch, written, ctx->save.p2m_size);
+        }
+    }
+
+    /* Carry on with the stream after the page data. */
+    if ( lseek(ctx->fd, start + (off_t)nr_pfns * PAGE_SIZE, SEEK_SET) < 0 )
+    {
+        PERROR("Unable to seek past the page data");
+        goto out;
+    }
+
+    xc_report_progress_step(xch, ctx->save.p2m_size, ctx->save.p2m_size);
+    rc = ctx->save.ops.check_vm_state(ctx);
+
+ out:
+    release_batch(ctx, &b);
+    free(idx);
+    free(types);
+    free(pfns);
+
+    return rc;
 }
 
 /*
@@ -782,6 +2429,13 @@ static int send_domain_memory_nonlive(struct xc_sr_context *ctx)
 
     xc_set_progress_prefix(xch, "Frames");
 
+    if ( ctx->save.indexed )
+    {
+        rc = send_indexed_pages(ctx);
+        if ( rc <= 0 )
+            goto err;
+    }
+
     rc = send_all_pages(ctx);
     if ( rc )
         goto err;
@@ -793,6 +2447,7 @@ static int send_domain_memory_nonlive(struct xc_sr_context *ctx)
 static int setup(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
+    unsigned int i;
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
@@ -803,11 +2458,23 @@ static int setup(struct xc_sr_context *ctx)
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
         xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
-    ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
+    /*
+     * Without data channels, the writer thread sends a batch while the next
+     * one gets mapped: make them large, to cut down on the number of
+     * hypercalls and system calls per page.
+     */
+    ctx->save.batch_size = ctx->save.nr_channels ? MAX_BATCH_SIZE
+                                                 : MAX_WRITER_BATCH_SIZE;
+    ctx->save.batch_pfns = malloc(ctx->save.batch_size *
                                   sizeof(*ctx->save.batch_pfns));
+    if ( !ctx->save.nr_channels )
+        ctx->save.writer.spare_pfns =
+            malloc(ctx->save.batch_size * sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = bitmap_alloc(ctx->save.p2m_size);
 
-    if ( !ctx->save.batch_pfns || !dirty_bitmap || !ctx->save.deferred_pages )
+    if ( !ctx->save.batch_pfns || !dirty_bitmap ||
+         !ctx->save.deferred_pages ||
+         (!ctx->save.nr_channels && !ctx->save.writer.spare_pfns) )
     {
         ERROR("Unable to allocate memory for dirty bitmaps, batch pfns and"
               " deferred pages");
@@ -816,6 +2483,33 @@ static int setup(struct xc_sr_context *ctx)
         goto err;
     }
 
+    if ( ctx->save.postcopy_fd >= 0 )
+    {
+        ctx->save.postcopy_pfns = bitmap_alloc(ctx->save.p2m_size);
+        if ( !ctx->save.postcopy_pfns )
+        {
+            ERROR("Unable to allocate memory for post-copy pages");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
+    for ( i = 0; i < ctx->save.nr_channels; i++ )
+    {
+        struct xc_sr_channel *ch = &ctx->save.channels[i];
+
+        ch->batch_pfns = malloc(MAX_BATCH_SIZE * sizeof(*ch->batch_pfns));
+        ch->pending_pfns = malloc(MAX_BATCH_SIZE * sizeof(*ch->pending_pfns));
+        if ( !ch->batch_pfns || !ch->pending_pfns )
+        {
+            ERROR("Unable to allocate memory for data channel %u batches", i);
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
     rc = 0;
 
  err:
@@ -827,7 +2521,19 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    unsigned int i;
 
+    unthrottle_guest(ctx);
+    stop_channels(ctx);
+    stop_writer(ctx);
+    for ( i = 0; i < ctx->save.nr_channels; i++ )
+    {
+        free(ctx->save.channels[i].batch_pfns);
+        free(ctx->save.channels[i].pending_pfns);
+    }
+
+    if ( ctx->save.dirty_rings )
+        disable_dirty_rings(ctx);
 
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
                       NULL, 0);
@@ -837,8 +2543,12 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    free(ctx->save.postcopy_pfns);
     free(ctx->save.deferred_pages);
+    free(ctx->save.writer.spare_pfns);
     free(ctx->save.batch_pfns);
+    release_snapshot(ctx);
+    free(ctx->save.snapshot.batches);
 }
 
 /*
@@ -848,6 +2558,7 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
 {
     xc_interface *xch = ctx->xch;
     int rc, saved_rc = 0, saved_errno = 0;
+    bool snapshot;
 
     IPRINTF("Saving domain %d, type %s",
             ctx->domid, dhdr_type_to_str(guest_type));
@@ -874,7 +2585,14 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
     if ( rc )
         goto err;
 
+    rc = ctx->save.nr_channels ? start_channels(ctx) : start_writer(ctx);
+    if ( rc )
+        goto err;
+
     do {
+        /* Only the synchronous checkpoints after the live phase. */
+        snapshot = ctx->save.snapshot.enabled && !ctx->save.live;
+
         rc = ctx->save.ops.start_of_checkpoint(ctx);
         if ( rc )
             goto err;
@@ -901,6 +2619,13 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
             goto err;
         }
 
+        if ( ctx->save.nr_channels )
+        {
+            rc = end_channels(ctx);
+            if ( rc )
+                goto err;
+        }
+
         rc = ctx->save.ops.end_of_checkpoint(ctx);
         if ( rc )
             goto err;
@@ -914,6 +2639,22 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
              */
             ctx->save.live = false;
 
+            if ( snapshot )
+            {
+                /*
+                 * The dirty pages are safe in the snapshot: let the guest
+                 * run while they go out.  Its output stays buffered until
+                 * the checkpoint callback commits it.
+                 */
+                rc = ctx->save.callbacks->postcopy(ctx->save.callbacks->data);
+                if ( rc <= 0 )
+                    goto err;
+
+                rc = send_snapshot(ctx);
+                if ( rc )
+                    goto err;
+            }
+
             rc = write_checkpoint_record(ctx);
             if ( rc )
                 goto err;
@@ -928,9 +2669,12 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
                 }
             }
 
-            rc = ctx->save.callbacks->postcopy(ctx->save.callbacks->data);
-            if ( rc <= 0 )
-                goto err;
+            if ( !snapshot )
+            {
+                rc = ctx->save.callbacks->postcopy(ctx->save.callbacks->data);
+                if ( rc <= 0 )
+                    goto err;
+            }
 
             if ( ctx->stream_type == XC_STREAM_COLO )
             {
@@ -960,6 +2704,13 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
     if ( rc )
         goto err;
 
+    if ( ctx->save.postcopy_fd >= 0 )
+    {
+        rc = send_postcopy_pages(ctx);
+        if ( rc )
+            goto err;
+    }
+
     xc_report_progress_single(xch, "Complete");
     goto done;
 
@@ -980,21 +2731,31 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
     return rc;
 };
 
-int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
-                   uint32_t flags, struct save_callbacks *callbacks,
-                   xc_stream_type_t stream_type, int recv_fd)
+static int domain_save(xc_interface *xch, int io_fd, uint32_t dom,
+                       uint32_t flags, struct save_callbacks *callbacks,
+                       xc_stream_type_t stream_type, int recv_fd,
+                       const int *data_fds, unsigned int nr_data_fds,
+                       int postcopy_fd)
 {
     struct xc_sr_context ctx = {
         .xch = xch,
         .fd = io_fd,
         .stream_type = stream_type,
     };
+    unsigned int i;
+    int rc;
 
     /* GCC 4.4 (of CentOS 6.x vintage) can' t initialise anonymous unions. */
     ctx.save.callbacks = callbacks;
     ctx.save.live  = !!(flags & XCFLAGS_LIVE);
     ctx.save.debug = !!(flags & XCFLAGS_DEBUG);
+    ctx.save.compress = !!(flags & XCFLAGS_COMPRESS);
+    ctx.save.memory_layout = !!(flags & XCFLAGS_MEMORY_LAYOUT);
+    /* COLO compares the primary against a secondary resumed in lockstep. */
+    ctx.save.snapshot.enabled = (flags & XCFLAGS_CHECKPOINT_SNAPSHOT) &&
+                                stream_type == XC_STREAM_REMUS;
     ctx.save.recv_fd = recv_fd;
+    ctx.save.postcopy_fd = postcopy_fd;
 
     if ( xc_domain_getinfo(xch, dom, 1, &ctx.dominfo) != 1 )
     {
@@ -1008,6 +2769,70 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
         return -1;
     }
 
+    if ( (flags & XCFLAGS_INDEXED) && ctx.dominfo.hvm && !ctx.save.live &&
+         !ctx.save.compress && stream_type == XC_STREAM_PLAIN &&
+         !nr_data_fds && postcopy_fd < 0 )
+    {
+        struct stat st;
+
+        /* The page data gets written at offsets into the file. */
+        ctx.save.indexed = !fstat(io_fd, &st) && S_ISREG(st.st_mode) &&
+            !(fcntl(io_fd, F_GETFL) & O_APPEND) &&
+            lseek(io_fd, 0, SEEK_CUR) >= 0;
+        /* The index describes the memory just as well. */
+        if ( ctx.save.indexed )
+            ctx.save.memory_layout = false;
+    }
+
+    if ( postcopy_fd >= 0 &&
+         (!ctx.dominfo.hvm || !ctx.save.live || nr_data_fds) )
+    {
+        ERROR("Post-copy is only supported for live migration of HVM "
+              "domains, without data channels");
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    if ( nr_data_fds )
+    {
+        if ( nr_data_fds > MAX_DATA_CHANNELS )
+        {
+            ERROR("Too many data channels (%u, max %u)",
+                  nr_data_fds, MAX_DATA_CHANNELS);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if ( !ctx.dominfo.hvm || stream_type != XC_STREAM_PLAIN )
+        {
+            ERROR("Data channels are only supported for plain HVM streams");
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+
+        ctx.save.channels = calloc(nr_data_fds, sizeof(*ctx.save.channels));
+        if ( !ctx.save.channels )
+        {
+            ERROR("Unable to allocate memory for data channels");
+            errno = ENOMEM;
+            return -1;
+        }
+
+        for ( i = 0; i < nr_data_fds; i++ )
+        {
+            struct xc_sr_channel *ch = &ctx.save.channels[i];
+
+            ch->ctx = &ctx;
+            ch->fd = data_fds[i];
+            pthread_mutex_init(&ch->lock, NULL);
+            pthread_cond_init(&ch->cond, NULL);
+        }
+        ctx.save.nr_channels = nr_data_fds;
+    }
+    pthread_mutex_init(&ctx.save.deferred_lock, NULL);
+    pthread_mutex_init(&ctx.save.writer.lock, NULL);
+    pthread_cond_init(&ctx.save.writer.cond, NULL);
+
     /* Sanity check stream_type-related parameters */
     switch ( stream_type )
     {
@@ -1035,13 +2860,50 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     if ( ctx.dominfo.hvm )
     {
         ctx.save.ops = save_ops_x86_hvm;
-        return save(&ctx, DHDR_TYPE_X86_HVM);
+        rc = save(&ctx, DHDR_TYPE_X86_HVM);
     }
     else
     {
         ctx.save.ops = save_ops_x86_pv;
-        return save(&ctx, DHDR_TYPE_X86_PV);
+        rc = save(&ctx, DHDR_TYPE_X86_PV);
+    }
+
+    for ( i = 0; i < ctx.save.nr_channels; i++ )
+    {
+        pthread_cond_destroy(&ctx.save.channels[i].cond);
+        pthread_mutex_destroy(&ctx.save.channels[i].lock);
     }
+    free(ctx.save.channels);
+    pthread_cond_destroy(&ctx.save.writer.cond);
+    pthread_mutex_destroy(&ctx.save.writer.lock);
+    pthread_mutex_destroy(&ctx.save.deferred_lock);
+
+    return rc;
+}
+
+int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
+                   uint32_t flags, struct save_callbacks *callbacks,
+                   xc_stream_type_t stream_type, int recv_fd)
+{
+    return domain_save(xch, io_fd, dom, flags, callbacks, stream_type,
+                       recv_fd, NULL, 0, -1);
+}
+
+int xc_domain_save_parallel(xc_interface *xch, int io_fd,
+                            const int *data_fds, unsigned int nr_data_fds,
+                            uint32_t dom, uint32_t flags,
+                            struct save_callbacks *callbacks)
+{
+    return domain_save(xch, io_fd, dom, flags, callbacks, XC_STREAM_PLAIN,
+                       -1, data_fds, nr_data_fds, -1);
+}
+
+int xc_domain_save_postcopy(xc_interface *xch, int io_fd, int postcopy_fd,
+                            uint32_t dom, uint32_t flags,
+                            struct save_callbacks *callbacks)
+{
+    return domain_save(xch, io_fd, dom, flags, callbacks, XC_STREAM_PLAIN,
+                       -1, NULL, 0, postcopy_fd);
 }
 
 /*
@@ -174,8 +174,108 @@ static int x86_hvm_static_data(struct xc_sr_context *ctx)
     return write_x86_cpu_policy_records(ctx);
 }
 
+/*
+ * Walk the p2m, and write a MEMORY_LAYOUT record describing the runs of
+ * populated pfns, so the restorer can allocate them as superpages before the
+ * page data arrives.
+ */
+static int write_memory_layout(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_memory_layout *hdr = NULL, *p;
+    struct xc_sr_rec_memory_layout_entry *e = NULL;
+    struct xc_sr_record rec = {
+        .type = REC_TYPE_MEMORY_LAYOUT,
+    };
+    xen_pfn_t *types = malloc(MAX_BATCH_SIZE * sizeof(*types));
+    unsigned int nr, i, max = 0, count = 0;
+    xen_pfn_t pfn;
+    int rc = -1;
+
+    if ( !types )
+    {
+        ERROR("Unable to allocate memory for the memory layout");
+        goto out;
+    }
+
+    for ( pfn = 0; pfn < ctx->save.p2m_size; pfn += nr )
+    {
+        nr = min_t(xen_pfn_t, MAX_BATCH_SIZE, ctx->save.p2m_size - pfn);
+
+        for ( i = 0; i < nr; ++i )
+            types[i] = pfn + i;
+
+        if ( xc_get_pfn_type_batch(xch, ctx->domid, nr, types) )
+        {
+            PERROR("Failed to get types for pfns %#"PRIpfn"-%#"PRIpfn,
+                   pfn, pfn + nr - 1);
+            goto out;
+        }
+
+        for ( i = 0; i < nr; ++i )
+        {
+            if ( !page_type_to_populate(types[i]) )
+                continue;
+
+            if ( count && e[count - 1].pfn + e[count - 1].nr_pfns == pfn + i )
+            {
+                e[count - 1].nr_pfns++;
+                continue;
+            }
+
+            if ( count == max )
+            {
+                /* Stay within REC_LENGTH_MAX. */
+                if ( sizeof(*hdr) + (max + 1) * sizeof(*e) > REC_LENGTH_MAX )
+                {
+                    DPRINTF("Memory layout too fragmented, not sending it");
+                    rc = 0;
+                    goto out;
+                }
+
+                max = max ? max * 2 : 64;
+                p = realloc(hdr, sizeof(*hdr) + max * sizeof(*e));
+                if ( !p )
+                {
+                    ERROR("Unable to allocate memory for the memory layout");
+                    goto out;
+                }
+                hdr = p;
+                e = hdr->entry;
+            }
+
+            e[count].pfn = pfn + i;
+            e[count].nr_pfns = 1;
+            count++;
+        }
+    }
+
+    if ( !count )
+    {
+        rc = 0;
+        goto out;
+    }
+
+    hdr->count = count;
+    hdr->_res1 = 0;
+
+    rec.length = sizeof(*hdr) + count * sizeof(*e);
+    rec.data = hdr;
+
+    rc = write_record(ctx, &rec);
+
+ out:
+    free(types);
+    free(hdr);
+
+    return rc;
+}
+
 static int x86_hvm_start_of_stream(struct xc_sr_context *ctx)
 {
+    if ( ctx->save.memory_layout )
+        return write_memory_layout(ctx);
+
     return 0;
 }
 
@@ -76,9 +76,17 @@ struct xc_sr_rhdr
 #define REC_TYPE_STATIC_DATA_END            0x00000010U
 #define REC_TYPE_X86_CPUID_POLICY           0x00000011U
 #define REC_TYPE_X86_MSR_POLICY             0x00000012U
+#define REC_TYPE_DATA_CHANNELS              0x00000013U
+#define REC_TYPE_DATA_CHANNELS_END          0x00000014U
+#define REC_TYPE_COMPRESSED_PAGE_DATA       0x00000015U
+#define REC_TYPE_POSTCOPY_PFNS              0x00000016U
+#define REC_TYPE_POSTCOPY_REQUEST           0x00000017U
+#define REC_TYPE_PAGE_DATA_INDEX            0x00000018U
 
 #define REC_TYPE_OPTIONAL             0x80000000U
 
+#define REC_TYPE_MEMORY_LAYOUT       (REC_TYPE_OPTIONAL | 0x00000000U)
+
 /* PAGE_DATA */
 struct xc_sr_rec_page_data_header
 {
@@ -90,6 +98,20 @@ struct xc_sr_rec_page_data_header
 #define PAGE_DATA_PFN_MASK  0x000fffffffffffffULL
 #define PAGE_DATA_TYPE_MASK 0xf000000000000000ULL
 
+/* COMPRESSED_PAGE_DATA */
+struct xc_sr_rec_compressed_page_data_header
+{
+    uint32_t count;
+    uint32_t encoding;
+    uint64_t pfn[0];
+};
+
+#define COMPRESSED_PAGE_DATA_RAW     0 /* Pages as they are. */
+#define COMPRESSED_PAGE_DATA_DEFLATE 1 /* Pages as a zlib stream. */
+
+/* Page entirely zero, for which there is no data. */
+#define PAGE_DATA_ZERO      0x0010000000000000ULL
+
 /* X86_PV_INFO */
 struct xc_sr_rec_x86_pv_info
 {
@@ -124,6 +146,13 @@ struct xc_sr_rec_x86_tsc_info
     uint32_t _res1;
 };
 
+/* DATA_CHANNELS */
+struct xc_sr_rec_data_channels
+{
+    uint32_t count;
+    uint32_t channel;
+};
+
 /* HVM_PARAMS */
 struct xc_sr_rec_hvm_params_entry
 {
@@ -138,6 +167,30 @@ struct xc_sr_rec_hvm_params
     struct xc_sr_rec_hvm_params_entry param[0];
 };
 
+/* MEMORY_LAYOUT */
+struct xc_sr_rec_memory_layout_entry
+{
+    uint64_t pfn;
+    uint64_t nr_pfns;
+};
+
+struct xc_sr_rec_memory_layout
+{
+    uint32_t count;
+    uint32_t _res1;
+    struct xc_sr_rec_memory_layout_entry entry[0];
+};
+
+/* PAGE_DATA_INDEX */
+struct xc_sr_rec_page_data_index
+{
+    uint32_t count;
+    uint32_t _res1;
+    uint64_t data_offset;
+    uint64_t nr_pfns;
+    struct xc_sr_rec_memory_layout_entry entry[0];
+};
+
 #endif
 /*
  * Local variables:
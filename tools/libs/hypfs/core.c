@@ -425,6 +425,174 @@ struct xenhypfs_dirent *xenhypfs_readdir(xenhypfs_handle *fshdl,
     return ret_buf;
 }
 
+#define TREE_BUF_SIZE (64 * 1024)
+#define TREE_ALIGN    8
+#define TREE_MAX_DEPTH (XEN_HYPFS_MAX_PATHLEN / 2)
+
+/* Reads the children of a directory which the hypervisor couldn't walk. */
+static int xenhypfs_read_unexpanded(xenhypfs_handle *fshdl, const char *path,
+                                    xenhypfs_tree_fn *fn, void *arg)
+{
+    struct xenhypfs_dirent *ents, *dirent = NULL;
+    unsigned int i, n;
+    char *child = NULL;
+    void *content = NULL;
+    int ret = 0;
+
+    ents = xenhypfs_readdir(fshdl, path, &n);
+    if (!ents)
+        return -1;
+
+    for (i = 0; i < n && !ret; i++) {
+        if (asprintf(&child, "%s%s%s", path,
+                     path[strlen(path) - 1] == '/' ? "" : "/",
+                     ents[i].name) < 0) {
+            child = NULL;
+            ret = -1;
+            break;
+        }
+
+        if (ents[i].type == xenhypfs_type_dir) {
+            ret = xenhypfs_read_tree(fshdl, child, fn, arg);
+        } else {
+            content = xenhypfs_read_raw(fshdl, child, &dirent);
+            if (!content)
+                ret = -1;
+            else
+                ret = fn(child, dirent, content, arg);
+            free(content);
+            free(dirent);
+            content = NULL;
+            dirent = NULL;
+        }
+
+        free(child);
+        child = NULL;
+    }
+
+    free(ents);
+
+    return ret;
+}
+
+int xenhypfs_read_tree(xenhypfs_handle *fshdl, const char *path,
+                       xenhypfs_tree_fn *fn, void *arg)
+{
+    struct xen_hypfs_tree_header *hdr;
+    struct xen_hypfs_tree_rec *rec;
+    struct xenhypfs_dirent dirent;
+    char *path_buf = NULL, *full = NULL, *name;
+    size_t *off = NULL, name_len;
+    void *buf = NULL, *content;
+    unsigned int sz = TREE_BUF_SIZE, pos, depth = 0, seen = 0;
+    int ret, path_sz, more, saved_errno;
+
+    ret = xenhypfs_get_pathbuf(fshdl, path, &path_buf);
+    if (ret < 0)
+        goto out;
+    path_sz = ret;
+    ret = -1;
+
+    full = malloc(XEN_HYPFS_MAX_PATHLEN);
+    off = malloc(TREE_MAX_DEPTH * sizeof(*off));
+    buf = xencall_alloc_buffer(fshdl->xcall, sz);
+    if (!full || !off || !buf) {
+        errno = ENOMEM;
+        goto out;
+    }
+
+    /* Children's paths are built on the path without a trailing '/'. */
+    strcpy(full, path);
+    off[0] = strlen(full);
+    if (off[0] && full[off[0] - 1] == '/')
+        off[0]--;
+
+    hdr = buf;
+    hdr->done = 0;
+    hdr->len = 0;
+
+    do {
+        ret = xencall5(fshdl->xcall, __HYPERVISOR_hypfs_op,
+                       XEN_HYPFS_OP_read_tree, (unsigned long)path_buf, path_sz,
+                       (unsigned long)buf, sz);
+        if (ret && errno != ENOBUFS)
+            goto out;
+        more = ret;
+        ret = -1;
+
+        if (more && !hdr->len) {
+            /* A single entry didn't fit: retry with a larger buffer. */
+            uint32_t done = hdr->done;
+
+            xencall_free_buffer(fshdl->xcall, buf);
+            sz *= 2;
+            buf = xencall_alloc_buffer(fshdl->xcall, sz);
+            if (!buf) {
+                errno = ENOMEM;
+                goto out;
+            }
+            hdr = buf;
+            hdr->done = done;
+            hdr->len = 0;
+            continue;
+        }
+
+        for (pos = 0; pos < hdr->len; pos += rec->rec_len) {
+            rec = (void *)(hdr + 1) + pos;
+            name = (char *)(rec + 1);
+            name_len = strlen(name);
+            content = name + ((name_len + TREE_ALIGN) & ~(TREE_ALIGN - 1));
+
+            /* Only the first entry has depth 0, then children follow. */
+            if (rec->rec_len < sizeof(*rec) || pos + rec->rec_len > hdr->len ||
+                (seen ? rec->depth < 1 || rec->depth > depth + 1
+                      : rec->depth != 0) ||
+                rec->depth >= TREE_MAX_DEPTH ||
+                (rec->depth &&
+                 off[rec->depth - 1] + name_len + 2 > XEN_HYPFS_MAX_PATHLEN)) {
+                errno = EPROTO;
+                goto out;
+            }
+
+            depth = rec->depth;
+            seen++;
+            if (depth) {
+                full[off[depth - 1]] = '/';
+                strcpy(full + off[depth - 1] + 1, name);
+                off[depth] = off[depth - 1] + 1 + name_len;
+            }
+
+            xenhypfs_set_attrs(&rec->e, &dirent);
+            dirent.name = depth ? name : (char *)path;
+
+            if (rec->e.type == XEN_HYPFS_TYPE_DIR)
+                content = NULL;
+
+            ret = fn(depth ? full : path, &dirent, content, arg);
+            if (!ret && (rec->flags & XEN_HYPFS_TREE_UNEXPANDED))
+                ret = xenhypfs_read_unexpanded(fshdl, depth ? full : path,
+                                               fn, arg);
+            if (ret)
+                goto out;
+            ret = -1;
+        }
+
+        hdr->len = 0;
+    } while (more);
+
+    ret = 0;
+
+ out:
+    saved_errno = errno;
+    xencall_free_buffer(fshdl->xcall, path_buf);
+    xencall_free_buffer(fshdl->xcall, buf);
+    free(full);
+    free(off);
+    errno = saved_errno;
+
+    return ret;
+}
+
 int xenhypfs_write(xenhypfs_handle *fshdl, const char *path, const char *val)
 {
     void *buf = NULL;
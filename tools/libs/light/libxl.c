@@ -66,6 +66,9 @@ int libxl_ctx_alloc(libxl_ctx **pctx, int version,
     XEN_TAILQ_INIT(&ctx->death_list);
     libxl__ev_xswatch_init(&ctx->death_watch);
 
+    XEN_LIST_INIT(&ctx->name_cache);
+    XEN_LIST_INIT(&ctx->qmp_idle);
+
     ctx->childproc_hooks = &libxl__childproc_default_hooks;
     ctx->childproc_user = 0;
 
@@ -153,6 +156,9 @@ int libxl_ctx_free(libxl_ctx *ctx)
     while ((eject = XEN_LIST_FIRST(&CTX->disk_eject_evgens)))
         libxl__evdisable_disk_eject(gc, eject);
 
+    libxl__name_cache_flush(gc);
+    libxl__qmp_idle_flush(gc, INVALID_DOMID);
+
     libxl_childproc_setmode(CTX,0,0);
     for (i = 0; i < ctx->watch_nslots; i++)
         assert(!libxl__watch_slot_contents(gc, i));
@@ -532,6 +538,7 @@ libxl_numainfo *libxl_get_numainfo(libxl_ctx *ctx, int *nr)
        LIBXL_NUMAINFO_INVALID_ENTRY : val
         ret[i].size = V(meminfo[i].memsize, XEN_INVALID_MEM_SZ);
         ret[i].free = V(meminfo[i].memfree, XEN_INVALID_MEM_SZ);
+        ret[i].zeroed = V(meminfo[i].memzeroed, XEN_INVALID_MEM_SZ);
         ret[i].num_dists = num_nodes;
         for (j = 0; j < ret[i].num_dists; j++) {
             unsigned idx = i * num_nodes + j;
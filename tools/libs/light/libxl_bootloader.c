@@ -207,6 +207,142 @@ static int parse_bootloader_result(libxl__egc *egc,
 }
 
 
+/*----- result cache -----*/
+
+/*
+ * With bootloader_cache, the kernel, ramdisk and command line picked by the
+ * bootloader are kept in BOOTLOADER_CACHE_DIR/<dev>.<ino>/, for the boot
+ * disk image file with that device and inode number.  The entry is only
+ * used while the size and modification time of the image, the bootloader
+ * and all its arguments are the same as when it was made.  Any write to the
+ * image invalidates it.  The "key" file recording these is written last, so
+ * that its presence means the entry is complete.
+ */
+#define BOOTLOADER_CACHE_DIR XEN_LIB_DIR "/bootloader-cache"
+
+/* Returns the contents of @dir/@leaf as a string, or NULL. */
+static char *bootloader_cache_read(libxl__gc *gc, const char *dir,
+                                   const char *leaf)
+{
+    void *data;
+    int len;
+    char *s;
+
+    if (libxl_read_file_contents(CTX, GCSPRINTF("%s/%s", dir, leaf),
+                                 &data, &len))
+        return NULL;
+
+    s = libxl__strndup(gc, data ?: "", len);
+    free(data);
+
+    return s;
+}
+
+static int bootloader_cache_write(libxl__gc *gc, const char *dir,
+                                  const char *leaf, const void *data,
+                                  size_t len)
+{
+    const char *path = GCSPRINTF("%s/%s", dir, leaf);
+    int fd, r;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd < 0)
+        return ERROR_FAIL;
+
+    r = libxl_write_exactly(CTX, fd, data, len, path, leaf);
+    if (close(fd) && !r)
+        r = errno;
+
+    return r ? ERROR_FAIL : 0;
+}
+
+/*
+ * Sets bl->cachedir and bl->cachekey if the boot disk is an image file.
+ * Returns true, with the outputs filled in, if the cache holds a result
+ * for it.
+ */
+static bool bootloader_cache_lookup(libxl__gc *gc,
+                                    libxl__bootloader_state *bl)
+{
+    const libxl_domain_build_info *info = bl->info;
+    const char *pdev_path = bl->disk->pdev_path;
+    const char *key, *ramdisk;
+    char **p;
+    struct stat st;
+
+    if (!pdev_path || stat(pdev_path, &st) || !S_ISREG(st.st_mode)) {
+        LOGD(DEBUG, bl->domid,
+             "boot disk is not an image file, not caching bootloader result");
+        return false;
+    }
+
+    key = GCSPRINTF("size %jd\nmtime %jd.%09ld\nbootloader %s\n"
+                    "kernel %s\nramdisk %s\ncmdline %s\n",
+                    (intmax_t)st.st_size, (intmax_t)st.st_mtim.tv_sec,
+                    (long)st.st_mtim.tv_nsec, info->bootloader,
+                    info->kernel ?: "", info->ramdisk ?: "",
+                    info->cmdline ?: "");
+    for (p = info->bootloader_args; p && *p; p++)
+        key = GCSPRINTF("%sarg %s\n", key, *p);
+
+    bl->cachedir = GCSPRINTF(BOOTLOADER_CACHE_DIR "/%ju.%ju",
+                             (uintmax_t)st.st_dev, (uintmax_t)st.st_ino);
+    bl->cachekey = key;
+
+    if (strcmp(bootloader_cache_read(gc, bl->cachedir, "key") ?: "", key))
+        return false;
+
+    bl->kernel->path = GCSPRINTF("%s/kernel", bl->cachedir);
+    ramdisk = GCSPRINTF("%s/ramdisk", bl->cachedir);
+    if (!access(ramdisk, R_OK))
+        bl->ramdisk->path = ramdisk;
+    bl->cmdline = bootloader_cache_read(gc, bl->cachedir, "cmdline");
+
+    return true;
+}
+
+/* Failing to cache a result isn't fatal: the next boot runs the bootloader. */
+static void bootloader_cache_store(libxl__gc *gc,
+                                   libxl__bootloader_state *bl)
+{
+    const char *tmp = GCSPRINTF("%s.%"PRIu32".tmp", bl->cachedir, bl->domid);
+
+    if (!bl->kernel->mapped ||
+        (bl->ramdisk->path && !bl->ramdisk->mapped))
+        return;
+
+    if (mkdir(BOOTLOADER_CACHE_DIR, 0700) && errno != EEXIST)
+        goto fail;
+
+    libxl__remove_directory(gc, tmp);
+    if (mkdir(tmp, 0700))
+        goto fail;
+
+    if (bootloader_cache_write(gc, tmp, "kernel",
+                               bl->kernel->data, bl->kernel->size) ||
+        (bl->ramdisk->path &&
+         bootloader_cache_write(gc, tmp, "ramdisk",
+                                bl->ramdisk->data, bl->ramdisk->size)) ||
+        (bl->cmdline &&
+         bootloader_cache_write(gc, tmp, "cmdline",
+                                bl->cmdline, strlen(bl->cmdline))) ||
+        bootloader_cache_write(gc, tmp, "key",
+                               bl->cachekey, strlen(bl->cachekey)))
+        goto fail;
+
+    libxl__remove_directory(gc, bl->cachedir);
+    if (rename(tmp, bl->cachedir))
+        goto fail;
+
+    LOGD(DEBUG, bl->domid, "cached bootloader result in %s", bl->cachedir);
+    return;
+
+ fail:
+    LOGED(WARN, bl->domid, "failed to cache bootloader result in %s",
+          bl->cachedir);
+    libxl__remove_directory(gc, tmp);
+}
+
 /*----- init and cleanup -----*/
 
 void libxl__bootloader_init(libxl__bootloader_state *bl)
@@ -214,6 +350,7 @@ void libxl__bootloader_init(libxl__bootloader_state *bl)
     assert(bl->ao);
     bl->rc = 0;
     bl->dls.diskpath = NULL;
+    bl->cachedir = bl->cachekey = NULL;
     bl->openpty.ao = bl->ao;
     bl->dls.ao = bl->ao;
     bl->ptys[0].master = bl->ptys[0].slave = 0;
@@ -346,6 +483,14 @@ void libxl__bootloader_run(libxl__egc *egc, libxl__bootloader_state *bl)
         goto out;
     }
 
+    if (libxl_defbool_val(info->bootloader_cache) &&
+        bootloader_cache_lookup(gc, bl)) {
+        LOGD(DEBUG, domid, "using cached bootloader result from %s",
+             bl->cachedir);
+        rc = 0;
+        goto out_ok;
+    }
+
     bootloader_setpaths(gc, bl);
 
     const char *logfile_leaf = GCSPRINTF("bootloader.%"PRIu32, domid);
@@ -664,6 +809,9 @@ static void bootloader_finished(libxl__egc *egc, libxl__ev_child *child,
     rc = parse_bootloader_result(egc, bl);
     if (rc) goto out;
 
+    if (bl->cachedir)
+        bootloader_cache_store(gc, bl);
+
     rc = 0;
     LOGD(DEBUG, bl->domid, "bootloader execution successful");
 
@@ -427,6 +427,32 @@ out:
     return ret;
 }
 
+int libxl_cpupool_movecpus(libxl_ctx *ctx, uint32_t poolid,
+                           const libxl_bitmap *cpumap)
+{
+    GC_INIT(ctx);
+    libxl_bitmap map;
+    int c, rc;
+
+    libxl_bitmap_init(&map);
+    rc = libxl_cpu_bitmap_alloc(ctx, &map, 0);
+    if (rc)
+        goto out;
+
+    libxl_for_each_set_bit(c, *cpumap)
+        libxl_bitmap_set(&map, c);
+
+    if (xc_cpupool_movecpus(ctx->xch, poolid, map.map)) {
+        LOGE(ERROR, "Error moving cpus to cpupool");
+        rc = ERROR_FAIL;
+    }
+
+out:
+    libxl_bitmap_dispose(&map);
+    GC_FREE;
+    return rc;
+}
+
 int libxl_cpupool_movedomain(libxl_ctx *ctx, uint32_t poolid, uint32_t domid)
 {
     GC_INIT(ctx);
@@ -22,6 +22,7 @@
 
 #include <xenguest.h>
 #include <xen/hvm/hvm_info_table.h>
+#include <xen/hvm/hvm_xs_strings.h>
 #include <xen/hvm/e820.h>
 
 #include <xen-xsm/flask/flask.h>
@@ -278,6 +279,7 @@ int libxl__domain_build_info_setdefault(libxl__gc *gc,
     }
 
     libxl_defbool_setdefault(&b_info->dm_restrict, false);
+    libxl_defbool_setdefault(&b_info->bootloader_cache, false);
 
     if (b_info->iommu_memkb == LIBXL_MEMKB_DEFAULT)
         /* Normally defaulted in libxl__domain_create_info_setdefault */
@@ -376,6 +378,7 @@ int libxl__domain_build_info_setdefault(libxl__gc *gc,
         libxl_defbool_setdefault(&b_info->u.hvm.usb,                false);
         libxl_defbool_setdefault(&b_info->u.hvm.vkb_device,         true);
         libxl_defbool_setdefault(&b_info->u.hvm.xen_platform_pci,   true);
+        libxl_defbool_setdefault(&b_info->u.hvm.fast_boot,          false);
 
         libxl_defbool_setdefault(&b_info->u.hvm.spice.enable, false);
         if (!libxl_defbool_val(b_info->u.hvm.spice.enable) &&
@@ -527,7 +530,7 @@ int libxl__domain_build(libxl__gc *gc,
         vments[4] = "start_time";
         vments[5] = GCSPRINTF("%jd.%02d", (intmax_t)start_time.tv_sec,(int)start_time.tv_usec/10000);
 
-        localents = libxl__calloc(gc, 13, sizeof(char *));
+        localents = libxl__calloc(gc, 15, sizeof(char *));
         i = 0;
         localents[i++] = "platform/acpi";
         localents[i++] = libxl__acpi_defbool_val(info) ? "1" : "0";
@@ -550,6 +553,10 @@ int libxl__domain_build(libxl__gc *gc,
         }
         localents[i++] = "platform/device-model";
         localents[i++] = (char *)libxl_device_model_version_to_string(info->device_model_version);
+        if (libxl_defbool_val(info->u.hvm.fast_boot)) {
+            localents[i++] = HVM_XS_FAST_BOOT;
+            localents[i++] = "1";
+        }
 
         break;
     case LIBXL_DOMAIN_TYPE_PV:
@@ -1271,6 +1278,29 @@ int libxl__domain_config_setdefault(libxl__gc *gc,
     return ret;
 }
 
+static long timespec_ms(const struct timespec *from,
+                        const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000L +
+           (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+/* Log how long the creation stage which just finished took. */
+static void domcreate_stage_done(libxl__gc *gc,
+                                 libxl__domain_create_state *dcs,
+                                 const char *stage)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now))
+        return;
+
+    LOGD(DEBUG, dcs->guest_domid, "%s: %ld ms (%ld ms since start)", stage,
+         timespec_ms(&dcs->stage_ts, &now),
+         timespec_ms(&dcs->create_ts, &now));
+    dcs->stage_ts = now;
+}
+
 static void initiate_domain_create(libxl__egc *egc,
                                    libxl__domain_create_state *dcs)
 {
@@ -1282,6 +1312,9 @@ static void initiate_domain_create(libxl__egc *egc,
     libxl_domain_config *const d_config = dcs->guest_config;
     libxl__domain_build_state *dbs = &dcs->build_state;
 
+    clock_gettime(CLOCK_MONOTONIC, &dcs->create_ts);
+    dcs->stage_ts = dcs->create_ts;
+
     domid = dcs->domid;
     libxl__domain_build_state_init(dbs);
     dbs->restore = dcs->restore_fd >= 0;
@@ -1372,6 +1405,92 @@ static void domcreate_console_available(libxl__egc *egc,
                                         dcs->aop_console_how.for_event));
 }
 
+/*
+ * Instead of building the domain, have Xen share the (suspended)
+ * parent's memory with it copy-on-write and copy its vcpu and HVM
+ * state.  The child then gets its own xenstore and console event
+ * channels and a copy of the parent's device model state, as a restore
+ * would, and its PV drivers reconnect when it carries on from the
+ * suspend.
+ */
+static int domcreate_fork(libxl__gc *gc, libxl__domain_create_state *dcs)
+{
+    const uint32_t domid = dcs->guest_domid;
+    const uint32_t parent = dcs->fork_parent;
+    libxl_domain_config *const d_config = dcs->guest_config;
+    libxl__domain_build_state *const state = &dcs->build_state;
+    const char *savefile, *restorefile;
+    uint64_t store_pfn, console_pfn;
+    void *data = NULL;
+    int datalen, fd = -1, rc, r;
+
+    rc = libxl__build_pre(gc, domid, d_config, state);
+    if (rc) goto out;
+
+    r = xc_memshr_fork(CTX->xch, parent, domid, false, false);
+    if (r) {
+        LOGED(ERROR, domid, "failed to fork domain %u", parent);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    if (xc_hvm_param_get(CTX->xch, domid, HVM_PARAM_STORE_PFN, &store_pfn) ||
+        xc_hvm_param_get(CTX->xch, domid, HVM_PARAM_CONSOLE_PFN,
+                         &console_pfn) ||
+        xc_hvm_param_set(CTX->xch, domid, HVM_PARAM_STORE_EVTCHN,
+                         state->store_port) ||
+        xc_hvm_param_set(CTX->xch, domid, HVM_PARAM_CONSOLE_EVTCHN,
+                         state->console_port)) {
+        LOGED(ERROR, domid, "failed to set up xenstore and console rings");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    state->store_mfn = store_pfn;
+    state->console_mfn = console_pfn;
+
+    r = xc_dom_gnttab_seed(CTX->xch, domid, true, console_pfn, store_pfn,
+                           state->console_domid, state->store_domid);
+    if (r) {
+        LOGED(ERROR, domid, "failed to seed grant table");
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    /* Spawning the device model consumes its state file, and the
+     * parent's is needed for further forks: hand over a copy. */
+    savefile = libxl__device_model_savefile(gc, parent);
+    r = libxl_read_file_contents(CTX, savefile, &data, &datalen);
+    if (r) {
+        LOGED(ERROR, domid, "failed to read device model state %s",
+              savefile);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    restorefile = GCSPRINTF(LIBXL_DEVICE_MODEL_RESTORE_FILE".%d", domid);
+    fd = open(restorefile, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        LOGED(ERROR, domid, "failed to create %s", restorefile);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+    rc = libxl_write_exactly(CTX, fd, data, datalen, restorefile,
+                             "device model state");
+    if (rc) goto out;
+    r = close(fd);
+    fd = -1;
+    if (r) {
+        LOGED(ERROR, domid, "failed to write %s", restorefile);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+ out:
+    if (fd >= 0) close(fd);
+    free(data);
+    return rc;
+}
+
 static void domcreate_bootloader_done(libxl__egc *egc,
                                       libxl__bootloader_state *bl,
                                       int rc)
@@ -1395,6 +1514,8 @@ static void domcreate_bootloader_done(libxl__egc *egc,
         return;
     }
 
+    domcreate_stage_done(gc, dcs, "domain creation and bootloader");
+
     /* consume bootloader outputs. state->pv_{kernel,ramdisk} have
      * been initialised by the bootloader already.
      */
@@ -1409,6 +1530,13 @@ static void domcreate_bootloader_done(libxl__egc *egc,
     dcs->sdss.dm.callback = domcreate_devmodel_started;
     dcs->sdss.callback = domcreate_devmodel_started;
 
+    if (dcs->fork_parent != INVALID_DOMID) {
+        dcs->srs.dcs = dcs;
+        rc = domcreate_fork(gc, dcs);
+        domcreate_stream_done(egc, &dcs->srs, rc);
+        return;
+    }
+
     if (restore_fd < 0 && !dcs->soft_reset) {
         rc = libxl__domain_build(gc, d_config, domid, state);
         domcreate_rebuild_done(egc, dcs, rc);
@@ -1624,52 +1752,18 @@ out:
     domcreate_rebuild_done(egc, dcs, ret);
 }
 
-static void domcreate_rebuild_done(libxl__egc *egc,
-                                   libxl__domain_create_state *dcs,
-                                   int ret)
-{
-    STATE_AO_GC(dcs->ao);
-
-    /* convenience aliases */
-    const uint32_t domid = dcs->guest_domid;
-    libxl_domain_config *const d_config = dcs->guest_config;
-
-    if (ret) {
-        LOGD(ERROR, domid, "cannot (re-)build domain: %d", ret);
-        ret = ERROR_FAIL;
-        goto error_out;
-    }
-
-    store_libxl_entry(gc, domid, &d_config->b_info);
-
-    libxl__multidev_begin(ao, &dcs->multidev);
-    dcs->multidev.callback = domcreate_launch_dm;
-    libxl__add_disks(egc, ao, domid, d_config, &dcs->multidev);
-    libxl__multidev_prepared(egc, &dcs->multidev, 0);
-
-    return;
-
- error_out:
-    assert(ret);
-    domcreate_complete(egc, dcs, ret);
-}
-
-static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
-                                int ret)
+/*
+ * Grant the domain its I/O resources and add the PV devices which need
+ * nothing but xenstore.  This runs while the disks' hotplug scripts do.
+ */
+static int domcreate_setup_resources(libxl__gc *gc,
+                                     libxl__domain_create_state *dcs)
 {
-    libxl__domain_create_state *dcs = CONTAINER_OF(multidev, *dcs, multidev);
-    STATE_AO_GC(dcs->ao);
-    int i;
+    int i, ret;
 
     /* convenience aliases */
     const uint32_t domid = dcs->guest_domid;
     libxl_domain_config *const d_config = dcs->guest_config;
-    libxl__domain_build_state *const state = &dcs->build_state;
-
-    if (ret) {
-        LOGD(ERROR, domid, "unable to add disk devices");
-        goto error_out;
-    }
 
     for (i = 0; i < d_config->b_info.num_ioports; i++) {
         libxl_ioport_range *io = &d_config->b_info.ioports[i];
@@ -1683,8 +1777,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
             LOGED(ERROR, domid,
                   "failed give domain access to ioports %"PRIx32"-%"PRIx32,
                   io->first, io->first + io->number - 1);
-            ret = ERROR_FAIL;
-            goto error_out;
+            return ERROR_FAIL;
         }
     }
 
@@ -1697,8 +1790,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
                        : -EOVERFLOW;
         if (ret) {
             LOGED(ERROR, domid, "failed give domain access to irq %d", irq);
-            ret = ERROR_FAIL;
-            goto error_out;
+            return ERROR_FAIL;
         }
     }
 
@@ -1714,8 +1806,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
             LOGED(ERROR, domid,
                   "failed give domain access to iomem range %"PRIx64"-%"PRIx64,
                   io->start, io->start + io->number - 1);
-            ret = ERROR_FAIL;
-            goto error_out;
+            return ERROR_FAIL;
         }
         ret = xc_domain_memory_mapping(CTX->xch, domid,
                                        io->gfn, io->start,
@@ -1725,8 +1816,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
                   "failed to map to domain iomem range %"PRIx64"-%"PRIx64
                   " to guest address %"PRIx64,
                   io->start, io->start + io->number - 1, io->gfn);
-            ret = ERROR_FAIL;
-            goto error_out;
+            return ERROR_FAIL;
         }
     }
 
@@ -1739,7 +1829,7 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
                                                &d_config->channels[i]);
         if ( ret ) {
             libxl__device_console_dispose(&console);
-            goto error_out;
+            return ret;
         }
         libxl__device_console_add(gc, domid, &console, NULL, &device);
         libxl__device_console_dispose(&console);
@@ -1756,6 +1846,67 @@ static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
         libxl__device_add(gc, domid, &libxl__virtio_devtype,
                           &d_config->virtios[i]);
 
+    return 0;
+}
+
+static void domcreate_rebuild_done(libxl__egc *egc,
+                                   libxl__domain_create_state *dcs,
+                                   int ret)
+{
+    STATE_AO_GC(dcs->ao);
+
+    /* convenience aliases */
+    const uint32_t domid = dcs->guest_domid;
+    libxl_domain_config *const d_config = dcs->guest_config;
+
+    if (ret) {
+        LOGD(ERROR, domid, "cannot (re-)build domain: %d", ret);
+        ret = ERROR_FAIL;
+        goto error_out;
+    }
+
+    domcreate_stage_done(gc, dcs, "domain build");
+
+    store_libxl_entry(gc, domid, &d_config->b_info);
+
+    /*
+     * The disks' hotplug scripts run as child processes, so the rest of
+     * the domain's setup which doesn't involve the device model is done
+     * while they do.  A failure is passed on to domcreate_launch_dm once
+     * the disks are done.
+     */
+    libxl__multidev_begin(ao, &dcs->multidev);
+    dcs->multidev.callback = domcreate_launch_dm;
+    libxl__add_disks(egc, ao, domid, d_config, &dcs->multidev);
+    ret = domcreate_setup_resources(gc, dcs);
+    libxl__multidev_prepared(egc, &dcs->multidev, ret);
+
+    return;
+
+ error_out:
+    assert(ret);
+    domcreate_complete(egc, dcs, ret);
+}
+
+static void domcreate_launch_dm(libxl__egc *egc, libxl__multidev *multidev,
+                                int ret)
+{
+    libxl__domain_create_state *dcs = CONTAINER_OF(multidev, *dcs, multidev);
+    STATE_AO_GC(dcs->ao);
+    int i;
+
+    /* convenience aliases */
+    const uint32_t domid = dcs->guest_domid;
+    libxl_domain_config *const d_config = dcs->guest_config;
+    libxl__domain_build_state *const state = &dcs->build_state;
+
+    if (ret) {
+        LOGD(ERROR, domid, "unable to add disk devices or domain resources");
+        goto error_out;
+    }
+
+    domcreate_stage_done(gc, dcs, "disks and resources");
+
     switch (d_config->c_info.type) {
     case LIBXL_DOMAIN_TYPE_HVM:
     {
@@ -1899,6 +2050,8 @@ static void domcreate_devmodel_started(libxl__egc *egc,
         goto error_out;
     }
 
+    domcreate_stage_done(gc, dcs, "device model");
+
     dcs->device_type_idx = -1;
     domcreate_attach_devices(egc, &dcs->multidev, 0);
     return;
@@ -1917,30 +2070,39 @@ static void domcreate_attach_devices(libxl__egc *egc,
     int domid = dcs->guest_domid;
     libxl_domain_config *const d_config = dcs->guest_config;
     const libxl__device_type *dt;
+    bool started = false;
     char *tty_path;
 
     if (ret) {
-        LOGD(ERROR, domid, "unable to add %s devices",
-             libxl__device_kind_to_string(device_type_tbl[dcs->device_type_idx]->type));
+        LOGD(ERROR, domid, "unable to add devices");
         goto error_out;
     }
 
-    dcs->device_type_idx++;
-    dt = device_type_tbl[dcs->device_type_idx];
-    if (dt) {
+    /*
+     * The device types are independent of each other, unless marked as
+     * attach_barrier, so all of them up to the next barrier are attached
+     * in parallel.
+     */
+    while ((dt = device_type_tbl[dcs->device_type_idx + 1])) {
+        if (started && dt->attach_barrier)
+            break;
+        dcs->device_type_idx++;
         if (*libxl__device_type_get_num(dt, d_config) > 0 && !dt->skip_attach) {
-            /* Attach devices */
-            libxl__multidev_begin(ao, &dcs->multidev);
-            dcs->multidev.callback = domcreate_attach_devices;
+            if (!started) {
+                libxl__multidev_begin(ao, &dcs->multidev);
+                dcs->multidev.callback = domcreate_attach_devices;
+                started = true;
+            }
             dt->add(egc, ao, domid, d_config, &dcs->multidev);
-            libxl__multidev_prepared(egc, &dcs->multidev, 0);
-            return;
         }
-
-        domcreate_attach_devices(egc, &dcs->multidev, 0);
+    }
+    if (started) {
+        libxl__multidev_prepared(egc, &dcs->multidev, 0);
         return;
     }
 
+    domcreate_stage_done(gc, dcs, "devices");
+
     ret = libxl__console_tty_path(gc, domid, 0, LIBXL_CONSOLE_TYPE_PV, &tty_path);
     if (ret) {
         LOG(ERROR, "failed to get domain %d console tty path",
@@ -2001,6 +2163,9 @@ static void domcreate_complete(libxl__egc *egc,
 
     libxl__xswait_stop(gc, &dcs->console_xswait);
 
+    if (!rc)
+        domcreate_stage_done(gc, dcs, "console");
+
     libxl__domain_build_state_dispose(&dcs->build_state);
 
     if (!rc && d_config->b_info.exec_ssidref)
@@ -2077,6 +2242,7 @@ static void domain_create_cb(libxl__egc *egc,
 static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
                             uint32_t *domid, int restore_fd, int send_back_fd,
                             const libxl_domain_restore_params *params,
+                            uint32_t fork_parent,
                             const libxl_asyncop_how *ao_how,
                             const libxl_asyncprogress_how *aop_console_how)
 {
@@ -2101,6 +2267,7 @@ static int do_domain_create(libxl_ctx *ctx, libxl_domain_config *d_config,
     cdcs->dcs.callback = domain_create_cb;
     cdcs->dcs.domid = INVALID_DOMID;
     cdcs->dcs.soft_reset = false;
+    cdcs->dcs.fork_parent = fork_parent;
     libxl__xswait_init(&cdcs->dcs.console_xswait);
 
     if (cdcs->dcs.restore_params.checkpointed_stream ==
@@ -2201,6 +2368,7 @@ static int do_domain_soft_reset(libxl_ctx *ctx,
     cdcs->dcs.restore_fd = -1;
     cdcs->dcs.domid = domid;
     cdcs->dcs.soft_reset = true;
+    cdcs->dcs.fork_parent = INVALID_DOMID;
     cdcs->dcs.callback = domain_create_cb;
     libxl__xswait_init(&cdcs->dcs.console_xswait);
     libxl__ao_progress_gethow(&srs->cdcs.dcs.aop_console_how,
@@ -2341,7 +2509,7 @@ int libxl_domain_create_new(libxl_ctx *ctx, libxl_domain_config *d_config,
 {
     unset_disk_colo_restore(d_config);
     return do_domain_create(ctx, d_config, domid, -1, -1, NULL,
-                            ao_how, aop_console_how);
+                            INVALID_DOMID, ao_how, aop_console_how);
 }
 
 int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
@@ -2365,7 +2533,49 @@ int libxl_domain_create_restore(libxl_ctx *ctx, libxl_domain_config *d_config,
     libxl_defbool_setdefault(&d_config->b_info.arch_x86.msr_relaxed, true);
 
     return do_domain_create(ctx, d_config, domid, restore_fd, send_back_fd,
-                            params, ao_how, aop_console_how);
+                            params, INVALID_DOMID, ao_how, aop_console_how);
+}
+
+int libxl_domain_fork(libxl_ctx *ctx, libxl_domain_config *d_config,
+                      uint32_t parent, uint32_t *domid,
+                      const libxl_asyncop_how *ao_how,
+                      const libxl_asyncprogress_how *aop_console_how)
+{
+    GC_INIT(ctx);
+    libxl_dominfo info;
+    int rc;
+
+    libxl_dominfo_init(&info);
+
+    if (d_config->b_info.type != LIBXL_DOMAIN_TYPE_HVM ||
+        d_config->b_info.device_model_version ==
+            LIBXL_DEVICE_MODEL_VERSION_QEMU_XEN_TRADITIONAL ||
+        (!libxl_defbool_is_default(d_config->b_info.device_model_stubdomain) &&
+         libxl_defbool_val(d_config->b_info.device_model_stubdomain))) {
+        LOGD(ERROR, parent,
+             "only HVM domains without a stub domain can be forked");
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    rc = libxl_domain_info(ctx, &info, parent);
+    if (rc) goto out;
+
+    if (!info.shutdown ||
+        info.shutdown_reason != LIBXL_SHUTDOWN_REASON_SUSPEND) {
+        LOGD(ERROR, parent, "domain must be suspended to be forked");
+        rc = ERROR_INVAL;
+        goto out;
+    }
+
+    unset_disk_colo_restore(d_config);
+    rc = do_domain_create(ctx, d_config, domid, -1, -1, NULL, parent,
+                          ao_how, aop_console_how);
+
+ out:
+    libxl_dominfo_dispose(&info);
+    GC_FREE;
+    return rc;
 }
 
 int libxl_domain_soft_reset(libxl_ctx *ctx,
@@ -1226,6 +1226,18 @@ static void device_hotplug(libxl__egc *egc, libxl__ao_device *aodev)
         return;
     }
 
+    /* The hotplug script's work might be done without running it */
+    hotplug = libxl__hotplug_native(gc, aodev->dev, aodev->action,
+                                    aodev->num_exec);
+    if (hotplug < 0) {
+        LOGD(ERROR, aodev->dev->domid, "unable to set up device %s",
+             be_path);
+        rc = hotplug;
+        goto out;
+    }
+    if (hotplug)
+        aodev->num_exec++;
+
     /* Check if we have to execute hotplug scripts for this device
      * and return the necessary args/env vars for execution */
     hotplug = libxl__get_hotplug_script_info(gc, aodev->dev, &args, &env,
@@ -1900,6 +1912,37 @@ void device_add_domain_config(libxl__gc *gc, libxl_domain_config *d_config,
     dt->copy(CTX, item, dev);
 }
 
+static void device_add_xenstore_config(libxl__gc *gc, uint32_t domid,
+                                       const libxl__device_type *dt,
+                                       void *type, libxl__device *device,
+                                       flexarray_t **back_r,
+                                       flexarray_t **front_r,
+                                       flexarray_t **ro_front_r)
+{
+    flexarray_t *back, *front, *ro_front;
+
+    back = flexarray_make(gc, 16, 1);
+    front = flexarray_make(gc, 16, 1);
+    ro_front = flexarray_make(gc, 16, 1);
+
+    flexarray_append_pair(back, "frontend-id", GCSPRINTF("%d", domid));
+    flexarray_append_pair(back, "online", "1");
+    flexarray_append_pair(back, "state",
+                          GCSPRINTF("%d", XenbusStateInitialising));
+
+    flexarray_append_pair(front, "backend-id",
+                          GCSPRINTF("%d", device->backend_domid));
+    flexarray_append_pair(front, "state",
+                          GCSPRINTF("%d", XenbusStateInitialising));
+
+    if (dt->set_xenstore_config)
+        dt->set_xenstore_config(gc, domid, type, back, front, ro_front);
+
+    *back_r = back;
+    *front_r = front;
+    *ro_front_r = ro_front;
+}
+
 void libxl__device_add_async(libxl__egc *egc, uint32_t domid,
                              const libxl__device_type *dt, void *type,
                              libxl__ao_device *aodev)
@@ -1954,22 +1997,8 @@ void libxl__device_add_async(libxl__egc *egc, uint32_t domid,
         if (rc) goto out;
     }
 
-    back = flexarray_make(gc, 16, 1);
-    front = flexarray_make(gc, 16, 1);
-    ro_front = flexarray_make(gc, 16, 1);
-
-    flexarray_append_pair(back, "frontend-id", GCSPRINTF("%d", domid));
-    flexarray_append_pair(back, "online", "1");
-    flexarray_append_pair(back, "state",
-                          GCSPRINTF("%d", XenbusStateInitialising));
-
-    flexarray_append_pair(front, "backend-id",
-                          GCSPRINTF("%d", device->backend_domid));
-    flexarray_append_pair(front, "state",
-                          GCSPRINTF("%d", XenbusStateInitialising));
-
-    if (dt->set_xenstore_config)
-        dt->set_xenstore_config(gc, domid, type, back, front, ro_front);
+    device_add_xenstore_config(gc, domid, dt, type, device,
+                               &back, &front, &ro_front);
 
     for (;;) {
         rc = libxl__xs_transaction_start(gc, &t);
@@ -2015,6 +2044,110 @@ out:
     return;
 }
 
+void libxl__device_add_batch_async(libxl__egc *egc, libxl__ao *ao,
+                                   uint32_t domid,
+                                   const libxl__device_type *dt,
+                                   libxl_domain_config *d_config,
+                                   libxl__multidev *multidev)
+{
+    AO_GC;
+    int num = *libxl__device_type_get_num(dt, d_config);
+    libxl__ao_device **aodevs;
+    libxl__device **devices;
+    char ***kvs;
+    xs_transaction_t t = XBT_NULL;
+    void *type;
+    int i, j, rc;
+
+    if (!num)
+        return;
+
+    GCNEW_ARRAY(aodevs, num);
+    GCNEW_ARRAY(devices, num);
+    GCNEW_ARRAY(kvs, num * 3);
+
+    for (i = 0; i < num; i++) {
+        flexarray_t *back, *front, *ro_front;
+
+        aodevs[i] = libxl__multidev_prepare(multidev);
+        aodevs[i]->action = LIBXL__DEVICE_ACTION_ADD;
+        type = libxl__device_type_get_elem(dt, d_config, i);
+
+        if (dt->set_default) {
+            rc = dt->set_default(gc, domid, type, false);
+            if (rc) goto out;
+        }
+
+        if (dt->update_devid) {
+            rc = dt->update_devid(gc, domid, type);
+            if (rc) goto out;
+        }
+
+        GCNEW(devices[i]);
+        rc = dt->to_device(gc, domid, type, devices[i]);
+        if (rc) goto out;
+
+        /*
+         * New devids are picked by looking at xenstore, which does not
+         * show the devices of this batch yet.
+         */
+        for (j = 0; j < i; j++) {
+            if (devices[j]->devid == devices[i]->devid) {
+                LOGD(ERROR, domid, "devid %d used twice",
+                     devices[i]->devid);
+                rc = ERROR_INVAL;
+                goto out;
+            }
+        }
+
+        device_add_xenstore_config(gc, domid, dt, type, devices[i],
+                                   &back, &front, &ro_front);
+        kvs[i * 3] = libxl__xs_kvs_of_flexarray(gc, back);
+        kvs[i * 3 + 1] = libxl__xs_kvs_of_flexarray(gc, front);
+        kvs[i * 3 + 2] = libxl__xs_kvs_of_flexarray(gc, ro_front);
+    }
+
+    /* One transaction, and so one round of watch events, for them all. */
+    for (;;) {
+        rc = libxl__xs_transaction_start(gc, &t);
+        if (rc) goto out;
+
+        for (i = 0; i < num; i++) {
+            rc = libxl__device_exists(gc, t, devices[i]);
+            if (rc < 0) goto out;
+            if (rc == 1) {
+                LOGD(ERROR, domid, "device already exists in xenstore");
+                rc = ERROR_DEVICE_EXISTS;
+                goto out;
+            }
+
+            rc = libxl__device_generic_add(gc, t, devices[i], kvs[i * 3],
+                                           kvs[i * 3 + 1], kvs[i * 3 + 2]);
+            if (rc) goto out;
+        }
+
+        rc = libxl__xs_transaction_commit(gc, &t);
+        if (!rc) break;
+        if (rc < 0) goto out;
+    }
+
+    for (i = 0; i < num; i++) {
+        aodevs[i]->dev = devices[i];
+        libxl__wait_device_connection(egc, aodevs[i]);
+    }
+    return;
+
+out:
+    libxl__xs_transaction_abort(gc, &t);
+    /* Nothing was written, so none of the devices will come up. */
+    for (i = 0; i < num; i++) {
+        if (!aodevs[i])
+            aodevs[i] = libxl__multidev_prepare(multidev);
+        aodevs[i]->rc = rc;
+        aodevs[i]->callback(egc, aodevs[i]);
+    }
+}
+
 int libxl__device_add(libxl__gc *gc, uint32_t domid,
                       const libxl__device_type *dt, void *type)
 {
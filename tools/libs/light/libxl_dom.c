@@ -110,6 +110,10 @@ out:
  * Two NUMA placement candidates are compared by means of the following
  * heuristics:
 
+ *  - the largest distance between two nodes of the candidates is
+ *    considered, and candidates with closer nodes are preferred, as the
+ *    domain's memory accesses to the other nodes will be faster. If two
+ *    candidates are equally spread,
  *  - the number of vcpus runnable on the candidates is considered, and
  *    candidates with fewer of them are preferred. If two candidate have
  *    the same number of runnable vcpus,
@@ -129,6 +133,9 @@ out:
 static int numa_cmpf(const libxl__numa_candidate *c1,
                      const libxl__numa_candidate *c2)
 {
+    if (c1->max_dist != c2->max_dist)
+        return c1->max_dist < c2->max_dist ? -1 : 1;
+
     if (c1->nr_vcpus != c2->nr_vcpus)
         return c1->nr_vcpus - c2->nr_vcpus;
 
@@ -246,13 +253,11 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
     libxl_domain_build_info *const info = &d_config->b_info;
     libxl_ctx *ctx = libxl__gc_owner(gc);
     char *xs_domid, *con_domid;
+    libxl_bitmap cpumap_soft;
     int rc;
     uint64_t size;
 
-    if (xc_domain_max_vcpus(ctx->xch, domid, info->max_vcpus) != 0) {
-        LOG(ERROR, "Couldn't set max vcpu count");
-        return ERROR_FAIL;
-    }
+    libxl_bitmap_init(&cpumap_soft);
 
     /*
      * Check if the domain has any CPU or node affinity already. If not, try
@@ -267,6 +272,10 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
      * the vcpus of the domain. Of course, we want that iff placement is
      * enabled and actually happens, so we only change info->cpumap_soft to
      * reflect the placement result if that is the case
+     *
+     * All this happens before the vcpus are created, so that Xen can
+     * allocate their (and the domain's) private structures from the
+     * chosen node(s).
      */
     if (libxl_defbool_val(info->numa_placement)) {
         if (info->cpumap.size || info->num_vcpu_soft_affinity)
@@ -276,8 +285,6 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
             LOG(WARN, "Can't run NUMA placement, as the domain has "
                       "NUMA node affinity set already");
         else {
-            libxl_bitmap cpumap_soft;
-
             rc = libxl_node_bitmap_alloc(ctx, &info->nodemap, 0);
             if (rc)
                 return rc;
@@ -295,18 +302,10 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
 
             /*
              * All we need to do now is converting the result of automatic
-             * placement from nodemap to cpumap, and then use such cpumap
-             * as the soft affinity for all the vcpus of the domain.
-             *
-             * When calling libxl_set_vcpuaffinity_all(), it is ok to use
-             * NULL as hard affinity, as we know we don't have one, or we
-             * won't be here.
+             * placement from nodemap to cpumap, to use it as the soft
+             * affinity for all the vcpus of the domain, once they exist.
              */
             libxl_nodemap_to_cpumap(ctx, &info->nodemap, &cpumap_soft);
-            libxl_set_vcpuaffinity_all(ctx, domid, info->max_vcpus,
-                                       NULL, &cpumap_soft);
-
-            libxl_bitmap_dispose(&cpumap_soft);
 
             /*
              * Placement has run, so avoid for it to be re-run, if this
@@ -322,6 +321,21 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
     if (info->nodemap.size)
         libxl_domain_set_nodeaffinity(ctx, domid, &info->nodemap);
 
+    if (xc_domain_max_vcpus(ctx->xch, domid, info->max_vcpus) != 0) {
+        LOG(ERROR, "Couldn't set max vcpu count");
+        libxl_bitmap_dispose(&cpumap_soft);
+        return ERROR_FAIL;
+    }
+
+    /*
+     * When calling libxl_set_vcpuaffinity_all(), it is ok to use NULL as
+     * hard affinity, as placement wouldn't have run if there was one.
+     */
+    if (cpumap_soft.size)
+        libxl_set_vcpuaffinity_all(ctx, domid, info->max_vcpus,
+                                   NULL, &cpumap_soft);
+    libxl_bitmap_dispose(&cpumap_soft);
+
     if (info->num_vcpu_hard_affinity || info->num_vcpu_soft_affinity) {
         libxl_bitmap *hard_affinity, *soft_affinity;
         int i, n_vcpus;
@@ -354,6 +368,18 @@ int libxl__build_pre(libxl__gc *gc, uint32_t domid,
     }
 
 
+    if (info->perf_class != LIBXL_PERF_CLASS_DEFAULT &&
+        xc_domain_set_perf_class(ctx->xch, domid, info->perf_class)) {
+        LOGE(ERROR, "Couldn't set performance class");
+        return ERROR_FAIL;
+    }
+
+    if (info->security_group &&
+        xc_domain_set_security_group(ctx->xch, domid, info->security_group)) {
+        LOGE(ERROR, "Couldn't set security group");
+        return ERROR_FAIL;
+    }
+
     rc = libxl__arch_extra_memory(gc, info, &size);
     if (rc < 0) {
         LOGE(ERROR, "Couldn't get arch extra constant memory size");
@@ -1144,6 +1170,18 @@ int libxl__build_hvm(libxl__gc *gc, uint32_t domid,
     dom->vga_hole_size = device_model ? LIBXL_VGA_HOLE_SIZE : 0;
     dom->device_model = device_model;
     dom->max_vcpus = info->max_vcpus;
+    /*
+     * Populate large guests from several threads, roughly one per 64GB of
+     * memory, but never more than there are pcpus to run them.
+     */
+    {
+        int online = libxl_get_online_cpus(CTX);
+        uint64_t threads = (mem_size >> 36) + 1;
+
+        if (online > 0 && threads > online)
+            threads = online;
+        dom->populate_threads = threads;
+    }
     dom->console_evtchn = state->console_port;
     dom->console_domid = state->console_domid;
     dom->xenstore_evtchn = state->store_port;
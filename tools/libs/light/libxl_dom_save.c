@@ -385,6 +385,7 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
     const libxl_domain_type type = dss->type;
     const int live = dss->live;
     const int debug = dss->debug;
+    const int compress = dss->compress;
     const libxl_domain_remus_info *const r_info = dss->remus;
     libxl__srm_save_autogen_callbacks *const callbacks =
         &dss->sws.shs.callbacks.save.a;
@@ -409,7 +410,12 @@ void libxl__domain_save(libxl__egc *egc, libxl__domain_save_state *dss)
     if (rc) goto out;
 
     dss->xcflags = (live ? XCFLAGS_LIVE : 0)
-          | (debug ? XCFLAGS_DEBUG : 0);
+          | (debug ? XCFLAGS_DEBUG : 0)
+          | (compress ? XCFLAGS_COMPRESS : 0)
+          | (live ? 0 : XCFLAGS_INDEXED)
+          | XCFLAGS_MEMORY_LAYOUT
+          | (dss->checkpointed_stream == LIBXL_CHECKPOINTED_STREAM_REMUS
+             ? XCFLAGS_CHECKPOINT_SNAPSHOT : 0);
 
     /* Disallow saving a guest with vNUMA configured because migration
      * stream does not preserve node information.
@@ -508,6 +508,14 @@ static void domain_suspend_cb(libxl__egc *egc,
 
 int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
                          const libxl_asyncop_how *ao_how)
+{
+    return libxl_domain_suspend_max_downtime(ctx, domid, fd, flags, 0,
+                                             ao_how);
+}
+
+int libxl_domain_suspend_max_downtime(libxl_ctx *ctx, uint32_t domid, int fd,
+                                      int flags, uint32_t max_downtime_ms,
+                                      const libxl_asyncop_how *ao_how)
 {
     AO_CREATE(ctx, domid, ao_how);
     int rc;
@@ -529,6 +537,8 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->compress = flags & LIBXL_SUSPEND_COMPRESS;
+    dss->max_downtime_ms = max_downtime_ms;
     dss->checkpointed_stream = LIBXL_CHECKPOINTED_STREAM_NONE;
 
     rc = libxl__fd_flags_modify_save(gc, dss->fd,
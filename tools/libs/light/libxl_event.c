@@ -601,6 +601,35 @@ int libxl__ev_time_register_rel(libxl__ao *ao, libxl__ev_time *ev,
     return rc;
 }
 
+int libxl__ev_time_register_rel_ctx(libxl__gc *gc, libxl__ev_time *ev,
+                                    libxl__ev_time_callback *func,
+                                    int milliseconds)
+{
+    struct timeval absolute;
+    int rc;
+
+    CTX_LOCK;
+
+    DBG("ev_time=%p register (ctx) ms=%d", ev, milliseconds);
+
+    assert(milliseconds >= 0);
+    libxl__ao_abortable_init(&ev->abrt);
+
+    rc = time_rel_to_abs(gc, milliseconds, &absolute);
+    if (rc) goto out;
+
+    rc = time_register_finite(gc, ev, absolute);
+    if (rc) goto out;
+
+    ev->func = func;
+    rc = 0;
+
+ out:
+    time_done_debug(gc,__func__,ev,rc);
+    CTX_UNLOCK;
+    return rc;
+}
+
 void libxl__ev_time_deregister(libxl__gc *gc, libxl__ev_time *ev)
 {
     CTX_LOCK;
@@ -192,6 +192,12 @@ out:
     return rc;
 }
 
+int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                          libxl__device_action action, int num_exec)
+{
+    return 0;
+}
+
 int libxl__get_hotplug_script_info(libxl__gc *gc, libxl__device *dev,
                                    char ***args, char ***env,
                                    libxl__device_action action,
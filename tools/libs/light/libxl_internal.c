@@ -44,20 +44,20 @@ void libxl__alloc_failed(libxl_ctx *ctx, const char *func,
 
 void libxl__ptr_add(libxl__gc *gc, void *ptr)
 {
-    int i;
-
     if (!libxl__gc_is_real(gc))
         return;
 
     if (!ptr)
         return;
 
-    /* fast case: we have space in the array for storing the pointer */
-    for (i = 0; i < gc->alloc_maxsize; i++) {
-        if (!gc->alloc_ptrs[i]) {
-            gc->alloc_ptrs[i] = ptr;
-            return;
-        }
+    /*
+     * fast case: we have space in the array for storing the pointer.
+     * Slots are only ever cleared all at once, by libxl__free_all, so
+     * the used ones are all below alloc_used.
+     */
+    if (gc->alloc_used < gc->alloc_maxsize) {
+        gc->alloc_ptrs[gc->alloc_used++] = ptr;
+        return;
     }
     int new_maxsize = gc->alloc_maxsize * 2 + 25;
     assert(new_maxsize < INT_MAX / sizeof(void*) / 2);
@@ -66,6 +66,7 @@ void libxl__ptr_add(libxl__gc *gc, void *ptr)
         libxl__alloc_failed(CTX, __func__, new_maxsize, sizeof(void*));
 
     gc->alloc_ptrs[gc->alloc_maxsize++] = ptr;
+    gc->alloc_used = gc->alloc_maxsize;
 
     while (gc->alloc_maxsize < new_maxsize)
         gc->alloc_ptrs[gc->alloc_maxsize++] = 0;
@@ -88,6 +89,7 @@ void libxl__free_all(libxl__gc *gc)
     free(gc->alloc_ptrs);
     gc->alloc_ptrs = 0;
     gc->alloc_maxsize = 0;
+    gc->alloc_used = 0;
 }
 
 void *libxl__malloc(libxl__gc *gc, size_t size)
@@ -120,7 +122,7 @@ void *libxl__calloc(libxl__gc *gc, size_t nmemb, size_t size)
 void *libxl__realloc(libxl__gc *gc, void *ptr, size_t new_size)
 {
     void *new_ptr = realloc(ptr, new_size);
-    int i = 0;
+    int i;
 
     if (new_ptr == NULL && new_size != 0)
         libxl__alloc_failed(CTX, __func__, new_size, 1);
@@ -128,8 +130,9 @@ void *libxl__realloc(libxl__gc *gc, void *ptr, size_t new_size)
     if (ptr == NULL) {
         libxl__ptr_add(gc, new_ptr);
     } else if (new_ptr != ptr && libxl__gc_is_real(gc)) {
-        for (i = 0; ; i++) {
-            assert(i < gc->alloc_maxsize);
+        /* What gets reallocated was usually allocated recently. */
+        for (i = gc->alloc_used - 1; ; i--) {
+            assert(i >= 0);
             if (gc->alloc_ptrs[i] == ptr) {
                 gc->alloc_ptrs[i] = new_ptr;
                 break;
@@ -320,6 +320,19 @@ struct libxl__ev_xswatch {
     uint32_t counterval;
 };
 
+/*
+ * Entry in ctx->name_cache (see libxl_ctx_enable_name_cache).  The
+ * watch is on /local/domain/<domid>/name; when it fires the name is
+ * read again, and the entry is dropped once the node has gone.
+ */
+typedef struct libxl__name_cache_entry libxl__name_cache_entry;
+struct libxl__name_cache_entry {
+    XEN_LIST_ENTRY(libxl__name_cache_entry) entry;
+    uint32_t domid;
+    char *name; /* malloc'd, may be NULL */
+    libxl__ev_xswatch watch;
+};
+
 typedef struct libxl__ev_evtchn libxl__ev_evtchn;
 typedef void libxl__ev_evtchn_callback(libxl__egc *egc, libxl__ev_evtchn*);
 struct libxl__ev_evtchn {
@@ -451,6 +464,11 @@ _hidden void libxl__ev_slowlock_dispose(libxl__gc *, libxl__ev_slowlock *);
  * keeping a libxl__ev_qmp Connected for to long and call
  * libxl__ev_qmp_dispose as soon as it is not needed anymore.
  *
+ * If the application asked for it with libxl_ctx_keep_qmp_connections,
+ * libxl__ev_qmp_dispose of a Connected libxl__ev_qmp keeps the
+ * connection open for a while, and a later libxl__ev_qmp_send to the
+ * same domain carries on using it.  This is invisible to the caller.
+ *
  * Possible states of a libxl__ev_qmp:
  *  Undefined
  *    Might contain anything.
@@ -560,6 +578,28 @@ struct libxl__ev_qmp {
     int msg_id;
 };
 
+/*
+ * A QMP connection parked by libxl__ev_qmp_dispose, see
+ * libxl_ctx_keep_qmp_connections.  Holds the QMP lock.
+ */
+typedef struct libxl__qmp_idle libxl__qmp_idle;
+struct libxl__qmp_idle {
+    XEN_LIST_ENTRY(libxl__qmp_idle) entry;
+    libxl_domid domid;
+    libxl__carefd *cfd;
+    libxl__ev_fd efd;
+    libxl__ev_time timeout;
+    libxl__ev_slowlock lock;
+    int next_id;
+    int qemu_major, qemu_minor, qemu_micro;
+    /* partial message left over, malloc'd */
+    char *rx_buf;
+    size_t rx_buf_used;
+};
+
+/* Closes the parked connections to domid, or all if INVALID_DOMID. */
+_hidden void libxl__qmp_idle_flush(libxl__gc *gc, uint32_t domid);
+
 /* QMP parameters helpers */
 
 _hidden void libxl__qmp_param_add_string(libxl__gc *gc,
@@ -666,6 +706,7 @@ struct libxl__poller {
 struct libxl__gc {
     /* mini-GC */
     int alloc_maxsize; /* -1 means this is the dummy non-gc gc */
+    int alloc_used; /* alloc_ptrs[alloc_used..] are all NULL */
     void **alloc_ptrs;
     libxl_ctx *owner;
 };
@@ -738,6 +779,13 @@ struct libxl__ctx {
 
     libxl_version_info version_info;
 
+    bool name_cache_enabled;
+    XEN_LIST_HEAD(, libxl__name_cache_entry) name_cache;
+
+    int qmp_idle_ms; /* 0: close QMP connections when disposed of */
+    int qmp_lock_waiters;
+    XEN_LIST_HEAD(, libxl__qmp_idle) qmp_idle;
+
     bool libxl_domain_need_memory_0x041200_called,
          libxl_domain_need_memory_called;
 };
@@ -836,6 +884,7 @@ struct libxl__ao {
 
 #define LIBXL_INIT_GC(gc,ctx) do{               \
         (gc).alloc_maxsize = 0;                 \
+        (gc).alloc_used = 0;                    \
         (gc).alloc_ptrs = 0;                    \
         (gc).owner = (ctx);                     \
     } while(0)
@@ -1183,6 +1232,11 @@ _hidden int libxl__ev_time_register_rel(libxl__ao*, libxl__ev_time *ev_out,
 _hidden int libxl__ev_time_register_abs(libxl__ao*, libxl__ev_time *ev_out,
                                         libxl__ev_time_callback*,
                                         struct timeval);
+/* Not tied to any ao, so never aborted; for state kept in the ctx.
+ * milliseconds must not be negative. */
+_hidden int libxl__ev_time_register_rel_ctx(libxl__gc*, libxl__ev_time *ev_out,
+                                            libxl__ev_time_callback*,
+                                            int milliseconds);
 _hidden int libxl__ev_time_modify_rel(libxl__gc*, libxl__ev_time *ev,
                                       int milliseconds /* as for poll(2) */);
 _hidden int libxl__ev_time_modify_abs(libxl__gc*, libxl__ev_time *ev,
@@ -2059,6 +2113,7 @@ _hidden char *libxl__abs_path(libxl__gc *gc, const char *s, const char *path);
 #define LIBXL__LOG_ERROR   XTL_ERROR
 
 _hidden char *libxl__domid_to_name(libxl__gc *gc, uint32_t domid);
+_hidden void libxl__name_cache_flush(libxl__gc *gc);
 _hidden char *libxl__cpupoolid_to_name(libxl__gc *gc, uint32_t poolid);
 
 _hidden int libxl__enum_from_string(const libxl_enum_string_table *t,
@@ -2193,6 +2248,8 @@ struct libxl__json_object {
         flexarray_t *map;
     } u;
     struct libxl__json_object *parent;
+    /* For maps: where libxl__json_map_get starts looking. */
+    int map_next;
 };
 
 typedef int (*libxl__json_parse_callback)(libxl__gc *gc,
@@ -3066,6 +3123,14 @@ _hidden int libxl__get_hotplug_script_info(libxl__gc *gc, libxl__device *dev,
                                            libxl__device_action action,
                                            int num_exec);
 
+/*
+ * libxl__hotplug_native does, in-process, what the hotplug script
+ * executed for num_exec would do, if that is possible for the device.
+ * Returns < 0 on error, 0 if the script is needed and 1 if it is done.
+ */
+_hidden int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                                  libxl__device_action action, int num_exec);
+
 /*----- local disk attach: attach a disk locally to run the bootloader -----*/
 
 typedef struct libxl__disk_local_state libxl__disk_local_state;
@@ -3657,6 +3722,8 @@ struct libxl__domain_save_state {
     libxl_domain_type type;
     int live;
     int debug;
+    int compress;
+    uint32_t max_downtime_ms;
     int checkpointed_stream;
     const libxl_domain_remus_info *remus;
     /* private */
@@ -3746,6 +3813,7 @@ struct libxl__bootloader_state {
     const char *cmdline;
     /* private to libxl__run_bootloader */
     char *outputpath, *outputdir, *logfile;
+    const char *cachedir, *cachekey;
     libxl__openpty_state openpty;
     libxl__openpty_result ptys[2];  /* [0] is for bootloader */
     libxl__ev_child child;
@@ -3795,6 +3863,17 @@ _hidden void libxl__bootloader_run(libxl__egc*, libxl__bootloader_state *st);
         }                                                               \
     }
 
+/* As LIBXL_DEFINE_DEVICES_ADD, for types using libxl__device_add_async */
+#define LIBXL_DEFINE_DEVICES_ADD_BATCHED(type)                          \
+    void libxl__add_##type##s(libxl__egc *egc, libxl__ao *ao, uint32_t domid, \
+                              libxl_domain_config *d_config,            \
+                              libxl__multidev *multidev)                \
+    {                                                                   \
+        libxl__device_add_batch_async(egc, ao, domid,                   \
+                                      &libxl__##type##_devtype,         \
+                                      d_config, multidev);              \
+    }
+
 #define LIBXL_DEFINE_DEVICE_REMOVE_EXT(type, remtype, removedestroy, f) \
     int libxl_device_##type##_##removedestroy(libxl_ctx *ctx,           \
         uint32_t domid, libxl_device_##type *type,                      \
@@ -3947,6 +4026,7 @@ typedef int (*device_set_xenstore_config_fn_t)(libxl__gc *, uint32_t, void *,
 struct libxl__device_type {
     libxl__device_kind type;
     int skip_attach;   /* Skip entry in domcreate_attach_devices() if 1 */
+    int attach_barrier; /* Attach only after all earlier entries if 1 */
     int ptr_offset;    /* Offset of device array ptr in libxl_domain_config */
     int num_offset;    /* Offset of # of devices in libxl_domain_config */
     int dev_elem_size; /* Size of one device element in array */
@@ -4216,11 +4296,13 @@ struct libxl__domain_create_state {
     libxl_domain_restore_params restore_params;
     uint32_t domid;
     bool soft_reset;
+    uint32_t fork_parent; /* INVALID_DOMID unless forking */
     libxl__domain_create_cb *callback;
     libxl_asyncprogress_how aop_console_how;
     /* private to domain_create */
     int guest_domid;
     int device_type_idx;
+    struct timespec create_ts, stage_ts; /* for the per-stage timing */
     const char *colo_proxy_script;
     libxl__domain_build_state build_state;
     libxl__colo_restore_state crs;
@@ -4480,6 +4562,7 @@ static inline void libxl__ctx_unlock(libxl_ctx *ctx) {
 typedef struct {
     int nr_cpus, nr_nodes;
     int nr_vcpus;
+    uint32_t max_dist; /* largest distance between two of the nodes */
     uint64_t free_memkb;
     libxl_bitmap nodemap;
 } libxl__numa_candidate;
@@ -4503,7 +4586,8 @@ typedef int (*libxl__numa_candidate_cmpf)(const libxl__numa_candidate *c1,
  * is where the heuristics for determining which candidate is the best
  * one is actually implemented. The only bit of it that is hardcoded in
  * this function is the fact that candidates with fewer nodes are always
- * preferrable.
+ * preferrable. Candidates with more than one node are not enumerated
+ * exhaustively: they are grown from each node by adding the closest nodes.
  *
  * If at least one suitable candidate is found, it is returned in cndt_out,
  * cndt_found is set to one, and the function returns successfully. On the
@@ -4532,6 +4616,7 @@ static inline void libxl__numa_candidate_init(libxl__numa_candidate *cndt)
 {
     cndt->free_memkb = 0;
     cndt->nr_cpus = cndt->nr_nodes = cndt->nr_vcpus = 0;
+    cndt->max_dist = 0;
     libxl_bitmap_init(&cndt->nodemap);
 }
 
@@ -4824,6 +4909,18 @@ void device_add_domain_config(libxl__gc *gc, libxl_domain_config *d_config,
 void libxl__device_add_async(libxl__egc *egc, uint32_t domid,
                              const libxl__device_type *dt, void *type,
                              libxl__ao_device *aodev);
+/*
+ * Like libxl__device_add_async for each device of type dt in d_config,
+ * with an aodev from multidev for each, but writing all of them to
+ * xenstore in a single transaction.  For domain creation only: the
+ * stored domain configuration is not updated, and the devices must not
+ * need new devids picked (as nics have theirs set beforehand).
+ */
+void libxl__device_add_batch_async(libxl__egc *egc, libxl__ao *ao,
+                                   uint32_t domid,
+                                   const libxl__device_type *dt,
+                                   libxl_domain_config *d_config,
+                                   libxl__multidev *multidev);
 int libxl__device_add(libxl__gc *gc, uint32_t domid,
                       const libxl__device_type *dt, void *type);
 
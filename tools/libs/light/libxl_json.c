@@ -589,16 +589,26 @@ const libxl__json_object *libxl__json_map_get(const char *key,
                                           libxl__json_node_type expected_type)
 {
     flexarray_t *maps = NULL;
-    int idx = 0;
+    int idx = 0, n;
 
     if (libxl__json_object_is_map(o)) {
         libxl__json_map_node *node = NULL;
 
+        /*
+         * The generated parsers ask for the keys in the order the
+         * generated generators wrote them, so start looking just after
+         * the previous hit. o is only const to our callers: all objects
+         * are allocated by the parser.
+         */
         maps = o->u.map;
-        for (idx = 0; idx < maps->count; idx++) {
+        idx = o->map_next;
+        for (n = 0; n < maps->count; n++, idx++) {
+            if (idx >= maps->count)
+                idx = 0;
             if (flexarray_get(maps, idx, (void**)&node) != 0)
                 return NULL;
             if (strcmp(key, node->map_key) == 0) {
+                ((libxl__json_object *)o)->map_next = idx + 1;
                 if (expected_type == JSON_ANY
                     || (node->obj && (node->obj->type & expected_type))) {
                     return node->obj;
@@ -15,7 +15,13 @@
 
 #include "libxl_osdeps.h" /* must come before any other headers */
 
+#include <mntent.h>
+#include <net/if.h>
+#include <linux/if_arp.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
 #include <sys/resource.h>
+#include <sys/sysmacros.h>
 #include "libxl_internal.h"
 
 
@@ -198,6 +204,301 @@ error:
     return rc;
 }
 
+/*
+ * In-process replacements for the common cases of the default hotplug
+ * scripts, enabled by setting LIBXL_HOTPLUG_NATIVE=1 in the environment.
+ *
+ * Only setups the script would handle without any extra work are dealt
+ * with here: a vif on a Linux bridge (vif-bridge, with no ip address
+ * configured) and a block device (block, phy).  The iptables rules and
+ * vif-post.d hooks of vif-bridge are not run.  Whenever
+ * something doesn't match, 0 is returned and the script runs as usual.
+ */
+
+#define HOTPLUG_LOCK_DIR "/var/run/xen-hotplug"
+
+static bool hotplug_script_is(libxl__gc *gc, const char *be_path,
+                              const char *name)
+{
+    const char *script = libxl__xs_read(gc, XBT_NULL,
+                                        GCSPRINTF("%s/script", be_path));
+
+    return script &&
+           !strcmp(script,
+                   GCSPRINTF("%s/%s", libxl__xen_script_dir_path(), name));
+}
+
+static int netdev_ioctl(int fd, unsigned long req, struct ifreq *ifr,
+                        const char *name)
+{
+    strncpy(ifr->ifr_name, name, IFNAMSIZ - 1);
+    ifr->ifr_name[IFNAMSIZ - 1] = 0;
+
+    return ioctl(fd, req, ifr);
+}
+
+static int netdev_set_up(int fd, const char *name, bool up)
+{
+    struct ifreq ifr = { };
+
+    if (netdev_ioctl(fd, SIOCGIFFLAGS, &ifr, name))
+        return -1;
+    if (up)
+        ifr.ifr_flags |= IFF_UP;
+    else
+        ifr.ifr_flags &= ~IFF_UP;
+
+    return netdev_ioctl(fd, SIOCSIFFLAGS, &ifr, name);
+}
+
+static int hotplug_native_nic(libxl__gc *gc, libxl__device *dev,
+                              libxl__device_action action)
+{
+    char *be_path = libxl__device_backend_path(gc, dev);
+    const char *bridge, *vif, *mtu;
+    libxl_nic_type nictype;
+    struct ifreq ifr = { };
+    int fd = -1, ifindex, rc;
+
+    if (!hotplug_script_is(gc, be_path, "vif-bridge"))
+        return 0;
+    if (libxl__nic_type(gc, dev, &nictype) || nictype != LIBXL_NIC_TYPE_VIF)
+        return 0;
+    /* Firewall rules for the guest's addresses need the script */
+    if (libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/ip", be_path)))
+        return 0;
+    bridge = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/bridge", be_path));
+    if (!bridge || access(GCSPRINTF("/sys/class/net/%s/bridge", bridge), F_OK))
+        return 0;
+
+    vif = libxl__device_nic_devname(gc, dev->domid, dev->devid,
+                                    LIBXL_NIC_TYPE_VIF);
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOGED(ERROR, dev->domid, "unable to open socket for %s", vif);
+        return ERROR_FAIL;
+    }
+
+    ifindex = if_nametoindex(vif);
+
+    if (action == LIBXL__DEVICE_ACTION_REMOVE) {
+        /* As the script does, ignore errors: the vif may be gone already */
+        if (ifindex) {
+            netdev_set_up(fd, vif, false);
+            ifr.ifr_ifindex = ifindex;
+            netdev_ioctl(fd, SIOCBRDELIF, &ifr, bridge);
+        }
+        rc = 1;
+        goto out;
+    }
+
+    if (!ifindex) {
+        LOGED(ERROR, dev->domid, "cannot find network device %s", vif);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    /*
+     * Set a dummy MAC address, numerically the largest non-broadcast one,
+     * so the bridge doesn't pick the vif's address for STP purposes.
+     */
+    netdev_set_up(fd, vif, false);
+    ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+    memset(ifr.ifr_hwaddr.sa_data, 0xff, 6);
+    ifr.ifr_hwaddr.sa_data[0] = 0xfe;
+    netdev_ioctl(fd, SIOCSIFHWADDR, &ifr, vif);
+
+    mtu = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/mtu", be_path));
+    memset(&ifr, 0, sizeof(ifr));
+    if (mtu && atoi(mtu) > 0)
+        ifr.ifr_mtu = atoi(mtu);
+    else if (netdev_ioctl(fd, SIOCGIFMTU, &ifr, bridge))
+        ifr.ifr_mtu = 0;
+    if (ifr.ifr_mtu > 0)
+        netdev_ioctl(fd, SIOCSIFMTU, &ifr, vif);
+
+    if (access(GCSPRINTF("/sys/class/net/%s/brif/%s", bridge, vif), F_OK)) {
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_ifindex = ifindex;
+        if (netdev_ioctl(fd, SIOCBRADDIF, &ifr, bridge)) {
+            LOGED(ERROR, dev->domid, "unable to add %s to bridge %s",
+                  vif, bridge);
+            rc = ERROR_FAIL;
+            goto out;
+        }
+    }
+
+    if (netdev_set_up(fd, vif, true)) {
+        LOGED(ERROR, dev->domid, "unable to bring up %s", vif);
+        rc = ERROR_FAIL;
+        goto out;
+    }
+
+    rc = libxl__xs_printf(gc, XBT_NULL, GCSPRINTF("%s/hotplug-status", be_path),
+                          "connected");
+    if (rc)
+        goto out;
+
+    LOGD(DEBUG, dev->domid, "added %s to bridge %s", vif, bridge);
+    rc = 1;
+
+out:
+    close(fd);
+    return rc;
+}
+
+/*
+ * Whether the block device rdev is in use in a way which conflicts with
+ * attaching it in mode (writable if write), as the block script checks:
+ * mounted (read-write, unless write), or attached to another domain
+ * (writable by either).  Any doubt is reported as a conflict, for the
+ * script to sort out.
+ */
+static bool block_dev_shared(libxl__gc *gc, libxl__device *dev, dev_t rdev,
+                             bool write)
+{
+    const char *mm = GCSPRINTF("%x:%x", major(rdev), minor(rdev));
+    const char *base, *phys, *mode;
+    char **doms, **devs;
+    unsigned int nr_doms, nr_devs, i, j;
+    struct mntent *m;
+    struct stat st;
+    FILE *f;
+    bool shared = false;
+
+    f = setmntent("/proc/mounts", "r");
+    if (!f)
+        return true;
+    while (!shared && (m = getmntent(f))) {
+        if (!stat(m->mnt_fsname, &st) && S_ISBLK(st.st_mode) &&
+            st.st_rdev == rdev && (write || !hasmntopt(m, "ro")))
+            shared = true;
+    }
+    endmntent(f);
+    if (shared)
+        return true;
+
+    base = GCSPRINTF("%s/backend/vbd",
+                     libxl__xs_get_dompath(gc, dev->backend_domid));
+    doms = libxl__xs_directory(gc, XBT_NULL, base, &nr_doms);
+    for (i = 0; i < nr_doms; i++) {
+        if (atoi(doms[i]) == dev->domid)
+            continue;
+        devs = libxl__xs_directory(gc, XBT_NULL,
+                                   GCSPRINTF("%s/%s", base, doms[i]),
+                                   &nr_devs);
+        for (j = 0; j < nr_devs; j++) {
+            phys = libxl__xs_read(gc, XBT_NULL,
+                                  GCSPRINTF("%s/%s/%s/physical-device",
+                                            base, doms[i], devs[j]));
+            if (!phys || strcmp(phys, mm))
+                continue;
+            mode = libxl__xs_read(gc, XBT_NULL,
+                                  GCSPRINTF("%s/%s/%s/mode",
+                                            base, doms[i], devs[j]));
+            if (write || !mode || mode[0] != 'r')
+                return true;
+        }
+    }
+
+    return false;
+}
+
+static int hotplug_native_disk(libxl__gc *gc, libxl__device *dev,
+                               libxl__device_action action)
+{
+    char *be_path = libxl__device_backend_path(gc, dev);
+    const char *params, *mode, *path;
+    libxl__flock *lock = NULL;
+    xs_transaction_t t = XBT_NULL;
+    char *real = NULL;
+    struct stat st;
+    int rc;
+
+    if (!hotplug_script_is(gc, be_path, "block"))
+        return 0;
+    params = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/params", be_path));
+    mode = libxl__xs_read(gc, XBT_NULL, GCSPRINTF("%s/mode", be_path));
+    if (!params || !mode || strchr(mode, '!'))
+        return 0;
+    path = params[0] == '/' ? params : GCSPRINTF("/dev/%s", params);
+    if (stat(path, &st) || !S_ISBLK(st.st_mode))
+        return 0;
+
+    /* Nothing to undo for a block device */
+    if (action == LIBXL__DEVICE_ACTION_REMOVE)
+        return 1;
+
+    if (libxl__xs_read(gc, XBT_NULL,
+                       GCSPRINTF("%s/physical-device", be_path)))
+        return 1;
+
+    real = realpath(path, NULL);
+    if (!real)
+        return 0;
+    path = libxl__strdup(gc, real);
+    free(real);
+
+    /* The same lock as the block script's, see locking.sh */
+    if (mkdir(HOTPLUG_LOCK_DIR, 0755) && errno != EEXIST)
+        return 0;
+    lock = libxl__lock_file(gc, HOTPLUG_LOCK_DIR "/block");
+    if (!lock)
+        return 0;
+
+    if (block_dev_shared(gc, dev, st.st_rdev, mode[0] != 'r')) {
+        rc = 0;
+        goto out;
+    }
+
+    for (;;) {
+        rc = libxl__xs_transaction_start(gc, &t);
+        if (rc) goto out;
+
+        rc = libxl__xs_printf(gc, t, GCSPRINTF("%s/physical-device", be_path),
+                              "%x:%x", major(st.st_rdev), minor(st.st_rdev));
+        if (rc) goto out;
+        rc = libxl__xs_printf(gc, t,
+                              GCSPRINTF("%s/physical-device-path", be_path),
+                              "%s", path);
+        if (rc) goto out;
+        rc = libxl__xs_printf(gc, t, GCSPRINTF("%s/hotplug-status", be_path),
+                              "connected");
+        if (rc) goto out;
+
+        rc = libxl__xs_transaction_commit(gc, &t);
+        if (!rc) break;
+        if (rc < 0) goto out;
+    }
+
+    LOGD(DEBUG, dev->domid, "attached block device %s", path);
+    rc = 1;
+
+out:
+    libxl__xs_transaction_abort(gc, &t);
+    libxl__unlock_file(lock);
+    return rc;
+}
+
+int libxl__hotplug_native(libxl__gc *gc, libxl__device *dev,
+                          libxl__device_action action, int num_exec)
+{
+    const char *enable = getenv("LIBXL_HOTPLUG_NATIVE");
+
+    if (!enable || strcmp(enable, "1") || num_exec)
+        return 0;
+
+    switch (dev->backend_kind) {
+    case LIBXL__DEVICE_KIND_VIF:
+        return hotplug_native_nic(gc, dev, action);
+    case LIBXL__DEVICE_KIND_VBD:
+        return hotplug_native_disk(gc, dev, action);
+    default:
+        return 0;
+    }
+}
+
 int libxl__get_hotplug_script_info(libxl__gc *gc, libxl__device *dev,
                                    char ***args, char ***env,
                                    libxl__device_action action,
@@ -19,123 +19,8 @@
 
 #include "libxl_internal.h"
 
-/*
- * What follows are helpers for generating all the k-combinations
- * without repetitions of a set S with n elements in it. Formally
- * speaking, they are subsets of k distinct elements of S and, if
- * S is n elements big, the number of k-combinations is equal to the
- * binomial coefficient C(n k)=n!/(k! * (n - k)!).
- *
- * The various subset are generated one after the other by calling
- * comb_init() first, and, after that, comb_next()
- * C(n k)-1 times. An iterator is used to store the current status
- * of the whole generation operation (i.e., basically, the last
- * combination that has been generated). As soon as all combinations
- * have been generated, comb_next() will start returning 0 instead of
- * 1. The same instance of the iterator and the same values for
- * n and k _must_ be used for each call (if that doesn't happen, the
- * result is unspecified).
- *
- * The algorithm is a well known one (see, for example, D. Knuth's "The
- * Art of Computer Programming - Volume 4, Fascicle 3" and it produces
- * the combinations in such a way that they (well, more precisely, their
- * indexes it the array/map representing the set) come with lexicographic
- * ordering.
- *
- * For example, with n = 5 and k = 3, calling comb_init()
- * will generate { 0, 1, 2 }, while subsequent valid calls to
- * comb_next() will produce the following:
- * { { 0, 1, 3 }, { 0, 1, 4 },
- *   { 0, 2, 3 }, { 0, 2, 4 }, { 0, 3, 4 },
- *   { 1, 2, 3 }, { 1, 2, 4 }, { 1, 3, 4 },
- *   { 2, 3, 4 } }
- *
- * This is used by the automatic NUMA placement logic below.
- */
-typedef int* comb_iter_t;
-
-static int comb_init(libxl__gc *gc, comb_iter_t *it, int n, int k)
-{
-    comb_iter_t new_iter;
-    int i;
-
-    if (n < k)
-        return 0;
-
-    /* First set is always { 0, 1, 2, ..., k-1 } */
-    GCNEW_ARRAY(new_iter, k);
-    for (i = 0; i < k; i++)
-        new_iter[i] = i;
-
-    *it = new_iter;
-    return 1;
-}
-
-static int comb_next(comb_iter_t it, int n, int k)
-{
-    int i;
-
-    /*
-     * The idea here is to find the leftmost element from where
-     * we should start incrementing the indexes of the iterator.
-     * This means looking for the highest index that can be increased
-     * while still producing value smaller than n-1. In the example
-     * above, when dealing with { 0, 1, 4 }, such an element is the
-     * second one, as the third is already equal to 4 (which actually
-     * is n-1).
-     * Once we found from where to start, we increment that element
-     * and override the right-hand rest of the iterator with its
-     * successors, thus achieving lexicographic ordering.
-     *
-     * Regarding the termination of the generation process, when we
-     * manage in bringing n-k at the very first position of the iterator,
-     * we know that is the last valid combination ( { 2, 3, 4 }, with
-     * n - k = 5 - 2 = 2, in the example above), and thus we start
-     * returning 0 as soon as we cross that border.
-     */
-    for (i = k - 1; it[i] == n - k + i; i--) {
-        if (i <= 0)
-            return 0;
-    }
-    for (it[i]++, i++; i < k; i++)
-        it[i] = it[i - 1] + 1;
-    return 1;
-}
-
 /* NUMA automatic placement (see libxl_internal.h for details) */
 
-/*
- * This function turns a k-combination iterator into a node map,
- * given another map, telling us which nodes should be considered.
- *
- * This means the bits that are set in suitable_nodemap and that
- * corresponds to the indexes of the given combination are the ones
- * that will be set in nodemap.
- *
- * For example, given a fully set suitable_nodemap, if the iterator
- * represents the combination { 0, 2, 4}, nodmeap will have bits #0,
- * #2 and #4 set.
- * On the other hand, if, say,  suitable_nodemap=01011011, the same
- * iterator will cause bits #1, #4 and #7 of nodemap to be set.
- */
-static void comb_get_nodemap(comb_iter_t it, libxl_bitmap *suitable_nodemap,
-                             libxl_bitmap *nodemap, int k)
-{
-    int i, m = 0, n = 0;
-
-    libxl_bitmap_set_none(nodemap);
-    libxl_for_each_set_bit(i, *suitable_nodemap) {
-        /* Check wether the n-th set bit of suitable_nodemap
-         * matches with the m-th element of the iterator (and,
-         * only if it does, advance to the next one) */
-        if (m < k && n == it[m]) {
-            libxl_bitmap_set(nodemap, i);
-            m++;
-        }
-        n++;
-    }
-}
-
 /* Retrieve the number of cpus that the nodes that are part of the nodemap
  * span and are also set in suitable_cpumap. */
 static int nodemap_to_nr_cpus(libxl_cputopology *tinfo, int nr_cpus,
@@ -177,6 +62,79 @@ static int nodemap_to_nr_vcpus(libxl__gc *gc, int vcpus_on_node[],
     return nr_vcpus;
 }
 
+/* Distance between two nodes, as reported by the hypervisor */
+static uint32_t node_distance(const libxl_numainfo *ninfo, int from, int to)
+{
+    if (from == to || to >= ninfo[from].num_dists)
+        return 0;
+
+    return ninfo[from].dists[to];
+}
+
+/* Largest distance between node and any of the nodes in nodemap */
+static uint32_t node_to_nodemap_distance(const libxl_numainfo *ninfo,
+                                         const libxl_bitmap *nodemap,
+                                         int node)
+{
+    uint32_t dist = 0;
+    int i;
+
+    libxl_for_each_set_bit(i, *nodemap) {
+        if (node_distance(ninfo, node, i) > dist)
+            dist = node_distance(ninfo, node, i);
+    }
+
+    return dist;
+}
+
+/* Largest distance between two of the nodes in nodemap */
+static uint32_t nodemap_to_max_distance(const libxl_numainfo *ninfo,
+                                        const libxl_bitmap *nodemap)
+{
+    uint32_t dist = 0, d;
+    int i;
+
+    libxl_for_each_set_bit(i, *nodemap) {
+        d = node_to_nodemap_distance(ninfo, nodemap, i);
+        if (d > dist)
+            dist = d;
+    }
+
+    return dist;
+}
+
+/*
+ * Pick the node to add to nodemap when growing a candidate: the suitable
+ * node closest to all the nodes already in it, and among equally close
+ * ones the one with the fewest vcpus and then the most free memory.
+ * Returns -1 if there is none left.
+ */
+static int nodemap_next_node(const libxl_numainfo *ninfo,
+                             const int vcpus_on_node[],
+                             const libxl_bitmap *suitable_nodemap,
+                             const libxl_bitmap *nodemap)
+{
+    uint32_t dist, best_dist = 0;
+    int i, best = -1;
+
+    libxl_for_each_set_bit(i, *suitable_nodemap) {
+        if (libxl_bitmap_test(nodemap, i))
+            continue;
+
+        dist = node_to_nodemap_distance(ninfo, nodemap, i);
+        if (best < 0 || dist < best_dist ||
+            (dist == best_dist &&
+             (vcpus_on_node[i] < vcpus_on_node[best] ||
+              (vcpus_on_node[i] == vcpus_on_node[best] &&
+               ninfo[i].free > ninfo[best].free)))) {
+            best = i;
+            best_dist = dist;
+        }
+    }
+
+    return best;
+}
+
 /* Number of vcpus able to run on the cpus of the various nodes
  * (reported by filling the array vcpus_on_node[]). */
 static int nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
@@ -185,42 +143,48 @@ static int nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
                              int vcpus_on_node[])
 {
     libxl_dominfo *dinfo = NULL;
+    libxl_cpupoolinfo *poolinfo = NULL;
     libxl_bitmap dom_nodemap, nodes_counted;
-    int nr_doms, nr_cpus;
-    int i, j, k;
+    int nr_doms, nr_pools = 0, nr_cpus;
+    int i, j, k, rc = ERROR_FAIL;
+
+    libxl_bitmap_init(&nodes_counted);
+    libxl_bitmap_init(&dom_nodemap);
 
     dinfo = libxl_list_domain(CTX, &nr_doms);
     if (dinfo == NULL)
         return ERROR_FAIL;
 
-    if (libxl_node_bitmap_alloc(CTX, &nodes_counted, 0) < 0) {
-        libxl_dominfo_list_free(dinfo, nr_doms);
-        return ERROR_FAIL;
-    }
+    /*
+     * The cpupools are looked up once here rather than for each domain:
+     * the domain info already tells which pool each domain is in.
+     */
+    poolinfo = libxl_list_cpupool(CTX, &nr_pools);
+    if (poolinfo == NULL)
+        goto out;
 
-    if (libxl_node_bitmap_alloc(CTX, &dom_nodemap, 0) < 0) {
-        libxl_bitmap_dispose(&nodes_counted);
-        libxl_dominfo_list_free(dinfo, nr_doms);
-        return ERROR_FAIL;
-    }
+    if (libxl_node_bitmap_alloc(CTX, &nodes_counted, 0) < 0)
+        goto out;
+    if (libxl_node_bitmap_alloc(CTX, &dom_nodemap, 0) < 0)
+        goto out;
 
     for (i = 0; i < nr_doms; i++) {
         libxl_vcpuinfo *vinfo = NULL;
         int nr_dom_vcpus = 0;
-        libxl_cpupoolinfo cpupool_info;
-        int cpupool;
-
-        libxl_cpupoolinfo_init(&cpupool_info);
+        const libxl_cpupoolinfo *cpupool_info = NULL;
 
-        cpupool = libxl__domain_cpupool(gc, dinfo[i].domid);
-        if (cpupool < 0)
-            goto next;
-        if (libxl_cpupool_info(CTX, &cpupool_info, cpupool))
-            goto next;
+        for (j = 0; j < nr_pools; j++) {
+            if (poolinfo[j].poolid == dinfo[i].cpupool) {
+                cpupool_info = &poolinfo[j];
+                break;
+            }
+        }
+        if (cpupool_info == NULL)
+            continue;
 
         vinfo = libxl_list_vcpu(CTX, dinfo[i].domid, &nr_dom_vcpus, &nr_cpus);
         if (vinfo == NULL)
-            goto next;
+            continue;
 
         /* Retrieve the domain's node-affinity map */
         libxl_domain_get_nodeaffinity(CTX, dinfo[i].domid, &dom_nodemap);
@@ -244,7 +208,7 @@ static int nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
                 int node = tinfo[k].node;
 
                 if (libxl_bitmap_test(suitable_cpumap, k) &&
-                    libxl_bitmap_test(&cpupool_info.cpumap, k) &&
+                    libxl_bitmap_test(&cpupool_info->cpumap, k) &&
                     libxl_bitmap_test(&dom_nodemap, node) &&
                     !libxl_bitmap_test(&nodes_counted, node)) {
                     libxl_bitmap_set(&nodes_counted, node);
@@ -253,15 +217,17 @@ static int nr_vcpus_on_nodes(libxl__gc *gc, libxl_cputopology *tinfo,
             }
         }
 
- next:
-        libxl_cpupoolinfo_dispose(&cpupool_info);
         libxl_vcpuinfo_list_free(vinfo, nr_dom_vcpus);
     }
+    rc = 0;
 
+ out:
     libxl_bitmap_dispose(&dom_nodemap);
     libxl_bitmap_dispose(&nodes_counted);
+    if (poolinfo)
+        libxl_cpupoolinfo_list_free(poolinfo, nr_pools);
     libxl_dominfo_list_free(dinfo, nr_doms);
-    return 0;
+    return rc;
 }
 
 /*
@@ -334,32 +300,6 @@ int libxl__get_numa_candidate(libxl__gc *gc,
 
     GCNEW_ARRAY(vcpus_on_node, nr_nodes);
 
-    /*
-     * The good thing about this solution is that it is based on heuristics
-     * (implemented in numa_cmpf() ), but we at least can evaluate it on
-     * all the possible placement candidates. That can happen because the
-     * number of nodes present in current NUMA systems is quite small.
-     * In fact, even if a sum of binomials is involved, if the system has
-     * up to 16 nodes it "only" takes 65535 steps. This is fine, as the
-     * number of nodes the biggest NUMA systems provide at the time of this
-     * writing is 8 (and it will probably continue to be so for a while).
-     * However, computanional complexity would explode on systems bigger
-     * than that, and it's really important we avoid trying to run this
-     * on monsters with 32, 64 or more nodes (if they ever pop into being).
-     * Therefore, here it comes a safety catch that disables the algorithm
-     * for the cases when it wouldn't work well.
-     */
-    if (nr_nodes > 16) {
-        /* Log we did nothing and return 0, as no real error occurred */
-        LOG(WARN, "System has %d NUMA nodes, which is too big for the "
-                  "placement algorithm to work effectively: skipping it. "
-                  "Consider manually pinning the vCPUs and/or looking at "
-                  "cpupools for manually partitioning the system.",
-                  nr_nodes);
-        *cndt_found = 0;
-        goto out;
-    }
-
     tinfo = libxl_get_cpu_topology(CTX, &nr_cpus);
     if (tinfo == NULL) {
         rc = ERROR_FAIL;
@@ -432,44 +372,50 @@ int libxl__get_numa_candidate(libxl__gc *gc,
         goto out;
 
     /*
-     * Consider all the combinations with sizes in [min_nodes, max_nodes]
-     * (see comb_init() and comb_next()). Note that, since the fewer the
-     * number of nodes the better, it is guaranteed that any candidate
-     * found during the i-eth step will be better than any other one we
-     * could find during the (i+1)-eth and all the subsequent steps (they
-     * all will have more nodes). It's thus pointless to keep going if
-     * we already found something.
+     * Consider candidates with sizes in [min_nodes, max_nodes]. Note that,
+     * since the fewer the number of nodes the better, it is guaranteed that
+     * any candidate found during the i-eth step will be better than any
+     * other one we could find during the (i+1)-eth and all the subsequent
+     * steps (they all will have more nodes). It's thus pointless to keep
+     * going if we already found something.
+     *
+     * Rather than generating all the combinations of min_nodes nodes, which
+     * explodes with the number of nodes, one candidate is grown from each
+     * suitable node, by repeatedly adding the node closest to the ones
+     * already in it (see nodemap_next_node()). With one node this still
+     * covers all the candidates, and in general it takes
+     * O(min_nodes * nr_nodes^2) steps per size.
      */
     *cndt_found = 0;
     while (min_nodes <= max_nodes && *cndt_found == 0) {
-        comb_iter_t comb_iter;
-        int comb_ok;
+        int seed, n, node;
 
         /*
-         * And here it is. Each step of this cycle generates a combination of
-         * nodes as big as min_nodes mandates.  Each of these combinations is
-         * checked against the constraints provided by the caller (namely,
-         * amount of free memory and number of cpus) and it can concur to
-         * become our best placement iff it passes the check.
+         * Each candidate is checked against the constraints provided by the
+         * caller (namely, amount of free memory and number of cpus) and it
+         * can concur to become our best placement iff it passes the check.
          */
-        for (comb_ok = comb_init(gc, &comb_iter, nr_suit_nodes, min_nodes);
-             comb_ok;
-             comb_ok = comb_next(comb_iter, nr_suit_nodes, min_nodes)) {
+        libxl_for_each_set_bit(seed, suitable_nodemap) {
             uint64_t nodes_free_memkb;
             int nodes_cpus;
 
-            /* Get the nodemap for the combination, only considering
-             * suitable nodes. */
-            comb_get_nodemap(comb_iter, &suitable_nodemap,
-                             &nodemap, min_nodes);
+            libxl_bitmap_set_none(&nodemap);
+            libxl_bitmap_set(&nodemap, seed);
+            for (n = 1; n < min_nodes; n++) {
+                node = nodemap_next_node(ninfo, vcpus_on_node,
+                                         &suitable_nodemap, &nodemap);
+                if (node < 0)
+                    break;
+                libxl_bitmap_set(&nodemap, node);
+            }
 
-            /* If there is not enough memory in this combination, skip it
-             * and go generating the next one... */
+            /* If there is not enough memory in this candidate, skip it
+             * and go growing the next one... */
             nodes_free_memkb = nodemap_to_free_memkb(ninfo, &nodemap);
             if (min_free_memkb && nodes_free_memkb < min_free_memkb)
                 continue;
 
-            /* And the same applies if this combination is short in cpus */
+            /* And the same applies if this candidate is short in cpus */
             nodes_cpus = nodemap_to_nr_cpus(tinfo, nr_cpus, suitable_cpumap,
                                             &nodemap);
             if (min_cpus && nodes_cpus < min_cpus)
@@ -485,6 +431,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
             new_cndt.free_memkb = nodes_free_memkb;
             new_cndt.nr_nodes = libxl_bitmap_count_set(&nodemap);
             new_cndt.nr_cpus = nodes_cpus;
+            new_cndt.max_dist = nodemap_to_max_distance(ninfo, &nodemap);
 
             /*
              * Check if the new candidate we is better the what we found up
@@ -497,8 +444,9 @@ int libxl__get_numa_candidate(libxl__gc *gc,
 
                 LOG(DEBUG, "New best NUMA placement candidate found: "
                            "nr_nodes=%d, nr_cpus=%d, nr_vcpus=%d, "
-                           "free_memkb=%"PRIu64"", new_cndt.nr_nodes,
-                           new_cndt.nr_cpus, new_cndt.nr_vcpus,
+                           "max_dist=%"PRIu32", free_memkb=%"PRIu64"",
+                           new_cndt.nr_nodes, new_cndt.nr_cpus,
+                           new_cndt.nr_vcpus, new_cndt.max_dist,
                            new_cndt.free_memkb / 1024);
 
                 libxl__numa_candidate_put_nodemap(gc, cndt_out, &nodemap);
@@ -506,6 +454,7 @@ int libxl__get_numa_candidate(libxl__gc *gc,
                 cndt_out->free_memkb = new_cndt.free_memkb;
                 cndt_out->nr_nodes = new_cndt.nr_nodes;
                 cndt_out->nr_cpus = new_cndt.nr_cpus;
+                cndt_out->max_dist = new_cndt.max_dist;
 
                 if (numa_cmpf == NULL)
                     break;
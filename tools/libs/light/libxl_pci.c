@@ -1102,6 +1102,9 @@ typedef struct pci_add_state {
     bool starting;
     void (*callback)(libxl__egc *, struct pci_add_state *, int rc);
 
+    /* private to pci_add_reset */
+    libxl__ev_child reset_child;
+
     /* private to device_pci_add_stubdom_wait */
     libxl__ev_devstate pciback_ds;
 
@@ -1617,6 +1620,9 @@ static bool libxl_pci_assignable(libxl_ctx *ctx, libxl_device_pci *pci)
     return assignable;
 }
 
+static void pci_add_reset(libxl__egc *egc, pci_add_state *pas);
+static void pci_add_reset_done(libxl__egc *egc,
+    libxl__ev_child *child, pid_t pid, int status);
 static void device_pci_add_stubdom_wait(libxl__egc *egc,
     pci_add_state *pas, int rc);
 static void device_pci_add_stubdom_ready(libxl__egc *egc,
@@ -1633,12 +1639,12 @@ void libxl__device_pci_add(libxl__egc *egc, uint32_t domid,
     STATE_AO_GC(aodev->ao);
     libxl_ctx *ctx = libxl__gc_owner(gc);
     int rc;
-    int stubdomid = 0;
     pci_add_state *pas;
 
     GCNEW(pas);
     pas->aodev = aodev;
     pas->domid = domid;
+    libxl__ev_child_init(&pas->reset_child);
 
     libxl_device_pci_copy(CTX, &pas->pci, pci);
     pci = &pas->pci;
@@ -1683,9 +1689,51 @@ void libxl__device_pci_add(libxl__egc *egc, uint32_t domid,
     rc = pci_info_xs_write(gc, pci, "domid", GCSPRINTF("%u", domid));
     if (rc) goto out;
 
-    libxl__device_pci_reset(gc, pci->domain, pci->bus, pci->dev, pci->func);
+    pci_add_reset(egc, pas); /* must be last */
+    return;
+
+out:
+    device_pci_add_done(egc, pas, rc); /* must be last */
+}
+
+/*
+ * Resetting a device can take a while (a FLR alone involves waiting for
+ * 100ms), so do it in a child process.  This way the resets of multiple
+ * devices added together, e.g. when creating a domain, overlap rather than
+ * being done one after the other.
+ */
+static void pci_add_reset(libxl__egc *egc, pci_add_state *pas)
+{
+    STATE_AO_GC(pas->aodev->ao);
+    libxl_device_pci *pci = &pas->pci;
+    pid_t pid;
+
+    pid = libxl__ev_child_fork(gc, &pas->reset_child, pci_add_reset_done);
+    if (pid < 0) {
+        device_pci_add_done(egc, pas, pid); /* must be last */
+        return;
+    }
+    if (!pid) { /* child */
+        /* Failures are logged, but have never been fatal. */
+        libxl__device_pci_reset(gc, pci->domain, pci->bus, pci->dev,
+                                pci->func);
+        _exit(0);
+    }
+}
 
-    stubdomid = libxl_get_stubdom_id(ctx, domid);
+static void pci_add_reset_done(libxl__egc *egc,
+                               libxl__ev_child *child,
+                               pid_t pid, int status)
+{
+    pci_add_state *pas = CONTAINER_OF(child, *pas, reset_child);
+    STATE_AO_GC(pas->aodev->ao);
+    int stubdomid;
+
+    if (status)
+        libxl_report_child_exitstatus(CTX, XTL_ERROR,
+                                      "PCI device reset", pid, status);
+
+    stubdomid = libxl_get_stubdom_id(CTX, pas->domid);
     if (stubdomid != 0) {
         pas->callback = device_pci_add_stubdom_wait;
 
@@ -1694,10 +1742,6 @@ void libxl__device_pci_add(libxl__egc *egc, uint32_t domid,
     }
 
     device_pci_add_stubdom_done(egc, pas, 0); /* must be last */
-    return;
-
-out:
-    device_pci_add_done(egc, pas, rc); /* must be last */
 }
 
 static void device_pci_add_stubdom_wait(libxl__egc *egc,
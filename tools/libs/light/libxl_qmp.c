@@ -721,6 +721,8 @@ void libxl__qmp_cleanup(libxl__gc *gc, uint32_t domid)
 {
     char *qmp_socket;
 
+    libxl__qmp_idle_flush(gc, domid);
+
     qmp_socket = GCSPRINTF("%s/qmp-libxl-%d", libxl__run_dir_path(), domid);
     if (unlink(qmp_socket) == -1) {
         if (errno != ENOENT) {
@@ -1144,6 +1146,7 @@ static void dm_state_saved(libxl__egc *egc, libxl__ev_qmp *ev,
  *
  * - Allowed internal state transition:
  * disconnected                     -> waiting_lock
+ * disconnected                     -> connected (parked connection)
  * waiting_lock                     -> connecting
  * connection                       -> capability_negotiation
  * capability_negotiation/connected -> waiting_reply
@@ -1159,6 +1162,7 @@ static void dm_state_saved(libxl__egc *egc, libxl__ev_qmp *ev,
 
 /* prototypes */
 
+static void qmp_ev_close(libxl__gc *gc, libxl__ev_qmp *ev);
 static void qmp_ev_fd_callback(libxl__egc *egc, libxl__ev_fd *ev_fd,
                                int fd, short events, short revents);
 static int qmp_ev_callback_writable(libxl__gc *gc,
@@ -1200,9 +1204,11 @@ static void qmp_ev_set_state(libxl__gc *gc, libxl__ev_qmp *ev,
         break;
     case qmp_state_waiting_lock:
         assert(ev->state == qmp_state_disconnected);
+        CTX->qmp_lock_waiters++;
         break;
     case qmp_state_connecting:
         assert(ev->state == qmp_state_waiting_lock);
+        CTX->qmp_lock_waiters--;
         break;
     case qmp_state_capability_negotiation:
         assert(ev->state == qmp_state_connecting);
@@ -1212,7 +1218,8 @@ static void qmp_ev_set_state(libxl__gc *gc, libxl__ev_qmp *ev,
                ev->state == qmp_state_connected);
         break;
     case qmp_state_connected:
-        assert(ev->state == qmp_state_waiting_reply);
+        assert(ev->state == qmp_state_waiting_reply ||
+               ev->state == qmp_state_disconnected);
         break;
     }
 
@@ -1262,6 +1269,221 @@ static int qmp_error_class_to_libxl_error_code(libxl__gc *gc,
     return ERROR_UNKNOWN_QMP_ERROR;
 }
 
+/*
+ * Parked connections
+ *
+ * With libxl_ctx_keep_qmp_connections, libxl__ev_qmp_dispose does not
+ * close a Connected libxl__ev_qmp but moves its socket and QMP lock to
+ * CTX->qmp_idle, and the next libxl__ev_qmp_send to the same domain
+ * takes them over, skipping the lock, connect and capability
+ * negotiation.  While parked, the socket is read so that QEMU's events
+ * do not pile up and so that we notice QEMU going away; only complete
+ * messages are discarded so that the stream stays in sync.
+ *
+ * A connection is not parked while another libxl__ev_qmp of this ctx
+ * waits for the lock, as that one would then have to wait for the
+ * timeout.
+ */
+
+static void qmp_idle_close(libxl__gc *gc, libxl__qmp_idle *idle)
+{
+    libxl__ev_fd_deregister(gc, &idle->efd);
+    libxl__ev_time_deregister(gc, &idle->timeout);
+    XEN_LIST_REMOVE(idle, entry);
+    libxl__carefd_close(idle->cfd);
+    libxl__ev_slowlock_unlock(gc, &idle->lock);
+    free(idle->rx_buf);
+    free(idle);
+}
+
+static void qmp_idle_timeout(libxl__egc *egc, libxl__ev_time *ev,
+                             const struct timeval *requested_abs, int rc)
+{
+    EGC_GC;
+    libxl__qmp_idle *idle = CONTAINER_OF(ev, *idle, timeout);
+
+    LOGD(DEBUG, idle->domid, "closing idle QMP connection");
+    qmp_idle_close(gc, idle);
+}
+
+static void qmp_idle_fd_callback(libxl__egc *egc, libxl__ev_fd *ev_fd,
+                                 int fd, short events, short revents)
+{
+    EGC_GC;
+    libxl__qmp_idle *idle = CONTAINER_OF(ev_fd, *idle, efd);
+    const char eom[] = "\r\n";
+    char *end;
+    size_t len;
+    ssize_t r;
+
+    if (revents & ~POLLIN)
+        goto close;
+
+    for (;;) {
+        idle->rx_buf = libxl__realloc(NOGC, idle->rx_buf,
+                                      idle->rx_buf_used +
+                                      QMP_RECEIVE_BUFFER_SIZE);
+        r = read(fd, idle->rx_buf + idle->rx_buf_used,
+                 QMP_RECEIVE_BUFFER_SIZE);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK)
+                break;
+            goto close;
+        }
+        if (r == 0)
+            goto close;
+        idle->rx_buf_used += r;
+
+        /* Drop complete messages, they can only be events. */
+        len = 0;
+        for (end = idle->rx_buf;
+             (end = memmem(end, idle->rx_buf_used - (end - idle->rx_buf),
+                           eom, sizeof(eom) - 1));
+             end += sizeof(eom) - 1)
+            len = end - idle->rx_buf + sizeof(eom) - 1;
+        idle->rx_buf_used -= len;
+        memmove(idle->rx_buf, idle->rx_buf + len, idle->rx_buf_used);
+
+        if (idle->rx_buf_used > QMP_MAX_SIZE_RX_BUF)
+            goto close;
+    }
+    return;
+
+ close:
+    LOGD(DEBUG, idle->domid, "idle QMP connection went away");
+    qmp_idle_close(gc, idle);
+}
+
+static bool qmp_idle_park(libxl__gc *gc, libxl__ev_qmp *ev)
+    /* connected -> disconnected, moving the connection to CTX->qmp_idle
+     * returns false, with ev untouched, if the connection isn't parked */
+{
+    libxl__qmp_idle *idle;
+    int rc;
+
+    if (!CTX->qmp_idle_ms ||
+        CTX->qmp_lock_waiters ||
+        ev->state != qmp_state_connected ||
+        ev->tx_buf || ev->msg ||
+        !ev->lock.held)
+        return false;
+
+    idle = libxl__zalloc(NOGC, sizeof(*idle));
+    idle->domid = ev->domid;
+    libxl__ev_fd_init(&idle->efd);
+    libxl__ev_time_init(&idle->timeout);
+
+    rc = libxl__ev_fd_register(gc, &idle->efd, qmp_idle_fd_callback,
+                               libxl__carefd_fd(ev->cfd), POLLIN);
+    if (rc) goto fail;
+    rc = libxl__ev_time_register_rel_ctx(gc, &idle->timeout,
+                                         qmp_idle_timeout,
+                                         CTX->qmp_idle_ms);
+    if (rc) goto fail;
+
+    libxl__ev_fd_deregister(gc, &ev->efd);
+    idle->cfd = ev->cfd;
+    idle->lock = ev->lock;
+    idle->next_id = ev->next_id;
+    idle->qemu_major = ev->qemu_version.major;
+    idle->qemu_minor = ev->qemu_version.minor;
+    idle->qemu_micro = ev->qemu_version.micro;
+    if (ev->rx_buf_used) {
+        idle->rx_buf = libxl__malloc(NOGC, ev->rx_buf_used);
+        memcpy(idle->rx_buf, ev->rx_buf, ev->rx_buf_used);
+        idle->rx_buf_used = ev->rx_buf_used;
+    }
+    XEN_LIST_INSERT_HEAD(&CTX->qmp_idle, idle, entry);
+
+    LOGD(DEBUG, ev->domid, "keeping QMP connection for %dms",
+         CTX->qmp_idle_ms);
+
+    libxl__ev_qmp_init(ev);
+    return true;
+
+ fail:
+    libxl__ev_fd_deregister(gc, &idle->efd);
+    libxl__ev_time_deregister(gc, &idle->timeout);
+    free(idle);
+    return false;
+}
+
+static int qmp_idle_adopt(libxl__egc *egc, libxl__ev_qmp *ev)
+    /* disconnected -> connected if a parked connection is available
+     * returns 1 if so, 0 if there is none, or an error (ev unchanged) */
+{
+    STATE_AO_GC(ev->ao);
+    libxl__qmp_idle *idle;
+    int rc;
+
+    assert(ev->state == qmp_state_disconnected);
+
+    XEN_LIST_FOREACH(idle, &CTX->qmp_idle, entry)
+        if (idle->domid == ev->domid)
+            break;
+    if (!idle)
+        return 0;
+
+    rc = libxl__ev_fd_register(gc, &ev->efd, qmp_ev_fd_callback,
+                               libxl__carefd_fd(idle->cfd), POLLIN);
+    if (rc)
+        return rc;
+
+    libxl__ev_fd_deregister(gc, &idle->efd);
+    libxl__ev_time_deregister(gc, &idle->timeout);
+    XEN_LIST_REMOVE(idle, entry);
+
+    ev->cfd = idle->cfd;
+    ev->lock = idle->lock;
+    ev->lock.ao = ev->ao;
+    ev->next_id = idle->next_id;
+    ev->qemu_version.major = idle->qemu_major;
+    ev->qemu_version.minor = idle->qemu_minor;
+    ev->qemu_version.micro = idle->qemu_micro;
+    if (idle->rx_buf_used) {
+        ev->rx_buf_size = idle->rx_buf_used;
+        ev->rx_buf = libxl__malloc(gc, ev->rx_buf_size);
+        memcpy(ev->rx_buf, idle->rx_buf, idle->rx_buf_used);
+        ev->rx_buf_used = idle->rx_buf_used;
+    }
+    free(idle->rx_buf);
+    free(idle);
+
+    LOGD(DEBUG, ev->domid, "reusing idle QMP connection");
+    qmp_ev_set_state(gc, ev, qmp_state_connected);
+    return 1;
+}
+
+void libxl__qmp_idle_flush(libxl__gc *gc, uint32_t domid)
+{
+    libxl__qmp_idle *idle, *tmp;
+
+    XEN_LIST_FOREACH_SAFE(idle, &CTX->qmp_idle, entry, tmp)
+        if (domid == INVALID_DOMID || idle->domid == domid)
+            qmp_idle_close(gc, idle);
+}
+
+int libxl_ctx_keep_qmp_connections(libxl_ctx *ctx, int idle_ms)
+{
+    GC_INIT(ctx);
+
+    if (idle_ms < 0) {
+        GC_FREE;
+        return ERROR_INVAL;
+    }
+
+    CTX_LOCK;
+    CTX->qmp_idle_ms = idle_ms;
+    if (!idle_ms)
+        libxl__qmp_idle_flush(gc, INVALID_DOMID);
+    CTX_UNLOCK;
+
+    GC_FREE;
+    return 0;
+}
+
 /* Setup connection */
 
 static void qmp_ev_lock_aquired(libxl__egc *, libxl__ev_slowlock *,
@@ -1367,7 +1589,7 @@ static void lock_error_callback(libxl__egc *egc, libxl__ev_immediate *ei)
     int rc = ev->rc;
 
     /* On error, deallocate all private resources */
-    libxl__ev_qmp_dispose(gc, ev);
+    qmp_ev_close(gc, ev);
 
     /* And tell libxl__ev_qmp user about the error */
     ev->callback(egc, ev, NULL, rc); /* must be last */
@@ -1439,7 +1661,7 @@ error:
          "Error happened with the QMP connection to QEMU");
 
     /* On error, deallocate all private ressources */
-    libxl__ev_qmp_dispose(gc, ev);
+    qmp_ev_close(gc, ev);
 
     /* And tell libxl__ev_qmp user about the error */
     ev->callback(egc, ev, NULL, rc); /* must be last */
@@ -1889,9 +2111,14 @@ int libxl__ev_qmp_send(libxl__egc *egc, libxl__ev_qmp *ev,
 
     /* Connect to QEMU if not already connected */
     if (ev->state == qmp_state_disconnected) {
-        rc = qmp_ev_connect(egc, ev);
-        if (rc)
+        rc = qmp_idle_adopt(egc, ev);
+        if (rc < 0)
             goto error;
+        if (!rc) {
+            rc = qmp_ev_connect(egc, ev);
+            if (rc)
+                goto error;
+        }
     }
 
     /* Prepare user command */
@@ -1910,14 +2137,15 @@ int libxl__ev_qmp_send(libxl__egc *egc, libxl__ev_qmp *ev,
     return 0;
 
 error:
-    libxl__ev_qmp_dispose(gc, ev);
+    qmp_ev_close(gc, ev);
     return rc;
 }
 
-void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev)
+static void qmp_ev_close(libxl__gc *gc, libxl__ev_qmp *ev)
     /* * -> disconnected */
 {
-    LOGD(DEBUG, ev->domid, " ev %p", ev);
+    if (ev->state == qmp_state_waiting_lock)
+        CTX->qmp_lock_waiters--;
 
     libxl__ev_fd_deregister(gc, &ev->efd);
     libxl__carefd_close(ev->cfd);
@@ -1926,6 +2154,17 @@ void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev)
     libxl__ev_qmp_init(ev);
 }
 
+void libxl__ev_qmp_dispose(libxl__gc *gc, libxl__ev_qmp *ev)
+    /* * -> disconnected */
+{
+    LOGD(DEBUG, ev->domid, " ev %p", ev);
+
+    if (qmp_idle_park(gc, ev))
+        return;
+
+    qmp_ev_close(gc, ev);
+}
+
 /*
  * Local variables:
  * mode: C
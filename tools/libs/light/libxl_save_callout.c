@@ -88,7 +88,7 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_save_state *dss,
 
     const unsigned long argnums[] = {
         dss->domid, dss->xcflags, cbflags,
-        dss->checkpointed_stream,
+        dss->checkpointed_stream, dss->max_downtime_ms,
     };
 
     shs->ao = ao;
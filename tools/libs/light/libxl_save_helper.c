@@ -251,9 +251,11 @@ int main(int argc, char **argv)
         uint32_t flags =                    strtoul(NEXTARG,0,10);
         unsigned cbflags =                  strtoul(NEXTARG,0,10);
         xc_stream_type_t stream_type =      strtoul(NEXTARG,0,10);
+        unsigned max_downtime_ms =          strtoul(NEXTARG,0,10);
         assert(!*++argv);
 
         helper_setcallbacks_save(&cb, cbflags);
+        cb.max_downtime_ms = max_downtime_ms;
 
         startup("save");
         setup_signals(save_signal_handler);
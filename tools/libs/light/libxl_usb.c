@@ -2147,7 +2147,9 @@ DEFINE_DEVICE_TYPE_STRUCT(usbctrl, VUSB, usbctrls,
 #define libxl__device_from_usbdev NULL
 #define libxl__device_usbdev_update_devid NULL
 
-DEFINE_DEVICE_TYPE_STRUCT(usbdev, VUSB, usbdevs);
+DEFINE_DEVICE_TYPE_STRUCT(usbdev, VUSB, usbdevs,
+    .attach_barrier = 1,
+);
 
 /*
  * Local variables:
@@ -42,14 +42,101 @@ unsigned long libxl_get_required_shadow_memory(unsigned long maxmem_kb, unsigned
                                              LIBXL_DOMAIN_TYPE_INVALID, false);
 }
 
+int libxl_ctx_enable_name_cache(libxl_ctx *ctx)
+{
+    libxl__ctx_lock(ctx);
+    ctx->name_cache_enabled = true;
+    libxl__ctx_unlock(ctx);
+    return 0;
+}
+
+static void name_cache_drop(libxl__gc *gc, libxl__name_cache_entry *nce)
+{
+    libxl__ev_xswatch_deregister(gc, &nce->watch);
+    XEN_LIST_REMOVE(nce, entry);
+    free(nce->name);
+    free(nce);
+}
+
+void libxl__name_cache_flush(libxl__gc *gc)
+{
+    libxl__name_cache_entry *nce;
+
+    while ((nce = XEN_LIST_FIRST(&CTX->name_cache)))
+        name_cache_drop(gc, nce);
+}
+
+static void name_cache_changed(libxl__egc *egc, libxl__ev_xswatch *watch,
+                               const char *watch_path,
+                               const char *event_path)
+{
+    EGC_GC;
+    libxl__name_cache_entry *nce = CONTAINER_OF(watch, *nce, watch);
+    unsigned int len;
+    char *s;
+
+    s = xs_read(CTX->xsh, XBT_NULL, watch_path, &len);
+    if (!s) {
+        /* Domain gone (or node unreadable): forget about it. */
+        name_cache_drop(gc, nce);
+        return;
+    }
+    free(nce->name);
+    nce->name = s;
+}
+
 char *libxl_domid_to_name(libxl_ctx *ctx, uint32_t domid)
 {
+    GC_INIT(ctx);
+    libxl__name_cache_entry *nce = NULL;
     unsigned int len;
     char path[strlen("/local/domain") + 12];
     char *s;
+    int rc;
 
     snprintf(path, sizeof(path), "/local/domain/%d/name", domid);
-    s = xs_read(ctx->xsh, XBT_NULL, path, &len);
+
+    CTX_LOCK;
+
+    if (!CTX->name_cache_enabled) {
+        s = xs_read(CTX->xsh, XBT_NULL, path, &len);
+        goto out;
+    }
+
+    XEN_LIST_FOREACH(nce, &CTX->name_cache, entry) {
+        if (nce->domid == domid) {
+            s = nce->name ? strdup(nce->name) : NULL;
+            goto out;
+        }
+    }
+
+    /*
+     * Watch before reading, so that a rename between the two is not
+     * missed.  If we cannot watch, fall back to an uncached read.
+     */
+    nce = libxl__zalloc(NOGC, sizeof(*nce));
+    nce->domid = domid;
+    libxl__ev_xswatch_init(&nce->watch);
+    rc = libxl__ev_xswatch_register(gc, &nce->watch, name_cache_changed,
+                                    path);
+    if (rc) {
+        free(nce);
+        s = xs_read(CTX->xsh, XBT_NULL, path, &len);
+        goto out;
+    }
+
+    s = xs_read(CTX->xsh, XBT_NULL, path, &len);
+    if (!s) {
+        libxl__ev_xswatch_deregister(gc, &nce->watch);
+        free(nce);
+        goto out;
+    }
+    nce->name = libxl__strdup(NOGC, s);
+    XEN_LIST_INSERT_HEAD(&CTX->name_cache, nce, entry);
+
+ out:
+    CTX_UNLOCK;
+    GC_FREE;
     return s;
 }
 
@@ -23,6 +23,8 @@ int libxl__arch_domain_prepare_config(libxl__gc *gc,
     config->arch.misc_flags = 0;
     if (libxl_defbool_val(d_config->b_info.arch_x86.msr_relaxed))
         config->arch.misc_flags |= XEN_X86_MSR_RELAXED;
+    if (libxl_defbool_val(d_config->b_info.arch_x86.ipi_virt))
+        config->arch.misc_flags |= XEN_X86_IPI_VIRT;
 
     return 0;
 }
@@ -402,10 +404,22 @@ err:
 static int hvm_set_conf_params(libxl__gc *gc, uint32_t domid,
                                const libxl_domain_build_info *info)
 {
-    libxl_ctx *ctx = libxl__gc_owner(gc);
-    xc_interface *xch = ctx->xch;
-    int ret = ERROR_FAIL;
+    const char *names[5];
+    int results[ARRAY_SIZE(names)];
+    xc_batch *batch;
     unsigned int altp2m = info->altp2m;
+    int i, nr = 0;
+
+    batch = xc_batch_begin(CTX->xch);
+    if (!batch) {
+        LOGE(ERROR, "Couldn't start a hypercall batch");
+        return ERROR_FAIL;
+    }
+
+#define SET_PARAM(p, v) do {                                   \
+        names[nr++] = #p;                                      \
+        xc_batch_hvm_param_set(batch, domid, (p), (v));        \
+    } while (0)
 
     switch(info->type) {
     case LIBXL_DOMAIN_TYPE_HVM:
@@ -418,44 +432,34 @@ static int hvm_set_conf_params(libxl__gc *gc, uint32_t domid,
             libxl_defbool_val(info->u.hvm.altp2m))
             altp2m = libxl_defbool_val(info->u.hvm.altp2m);
 
-        if (xc_hvm_param_set(xch, domid, HVM_PARAM_HPET_ENABLED,
-                             libxl_defbool_val(info->u.hvm.hpet))) {
-            LOG(ERROR, "Couldn't set HVM_PARAM_HPET_ENABLED");
-            goto out;
-        }
-        if (xc_hvm_param_set(xch, domid, HVM_PARAM_VPT_ALIGN,
-                             libxl_defbool_val(info->u.hvm.vpt_align))) {
-            LOG(ERROR, "Couldn't set HVM_PARAM_VPT_ALIGN");
-            goto out;
-        }
-        if (info->u.hvm.mca_caps &&
-            xc_hvm_param_set(CTX->xch, domid, HVM_PARAM_MCA_CAP,
-                             info->u.hvm.mca_caps)) {
-            LOG(ERROR, "Couldn't set HVM_PARAM_MCA_CAP");
-            goto out;
-        }
+        SET_PARAM(HVM_PARAM_HPET_ENABLED, libxl_defbool_val(info->u.hvm.hpet));
+        SET_PARAM(HVM_PARAM_VPT_ALIGN, libxl_defbool_val(info->u.hvm.vpt_align));
+        if (info->u.hvm.mca_caps)
+            SET_PARAM(HVM_PARAM_MCA_CAP, info->u.hvm.mca_caps);
 
         /* Fallthrough */
     case LIBXL_DOMAIN_TYPE_PVH:
-        if (xc_hvm_param_set(xch, domid, HVM_PARAM_TIMER_MODE,
-                             timer_mode(info))) {
-            LOG(ERROR, "Couldn't set HVM_PARAM_TIMER_MODE");
-            goto out;
-        }
-        if (xc_hvm_param_set(xch, domid, HVM_PARAM_ALTP2M, altp2m)) {
-            LOG(ERROR, "Couldn't set HVM_PARAM_ALTP2M");
-            goto out;
-        }
+        SET_PARAM(HVM_PARAM_TIMER_MODE, timer_mode(info));
+        SET_PARAM(HVM_PARAM_ALTP2M, altp2m);
         break;
 
     default:
         abort();
     }
 
-    ret = 0;
+#undef SET_PARAM
 
- out:
-    return ret;
+    /* All of them in a single hypercall. */
+    if (!xc_batch_submit(batch, results))
+        return 0;
+
+    for (i = 0; i < nr; i++) {
+        if (results[i]) {
+            errno = -results[i];
+            LOGE(ERROR, "Couldn't set %s", names[i]);
+        }
+    }
+    return ERROR_FAIL;
 }
 
 int libxl__arch_domain_create(libxl__gc *gc,
@@ -815,6 +819,7 @@ int libxl__arch_domain_build_info_setdefault(libxl__gc *gc,
 {
     libxl_defbool_setdefault(&b_info->acpi, true);
     libxl_defbool_setdefault(&b_info->arch_x86.msr_relaxed, false);
+    libxl_defbool_setdefault(&b_info->arch_x86.ipi_virt, false);
 
     return 0;
 }
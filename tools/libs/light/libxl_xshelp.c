@@ -57,15 +57,19 @@ int libxl__xs_writev_perms(libxl__gc *gc, xs_transaction_t t,
     if (!kvs)
         return 0;
 
+    /* Pipeline the writes rather than waiting for each reply in turn. */
     for (i = 0; kvs[i] != NULL; i += 2) {
         path = GCSPRINTF("%s/%s", dir, kvs[i]);
         if (path && kvs[i + 1]) {
             int length = strlen(kvs[i + 1]);
-            xs_write(ctx->xsh, t, path, kvs[i + 1], length);
+            xs_write_async(ctx->xsh, t, path, kvs[i + 1], length,
+                           NULL, NULL);
             if (perms)
-                xs_set_permissions(ctx->xsh, t, path, perms, num_perms);
+                xs_set_permissions_async(ctx->xsh, t, path, perms,
+                                         num_perms, NULL, NULL);
         }
     }
+    xs_async_wait(ctx->xsh);
     return 0;
 }
 
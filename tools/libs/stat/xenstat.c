@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "xenstat_priv.h"
@@ -54,13 +55,18 @@ typedef struct xenstat_collector {
 
 static int  xenstat_collect_vcpus(xenstat_node * node);
 static int  xenstat_collect_xen_version(xenstat_node * node);
+static int  xenstat_collect_vmexits(xenstat_node * node);
 static void xenstat_free_vcpus(xenstat_node * node);
 static void xenstat_free_networks(xenstat_node * node);
 static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
+static void xenstat_free_vmexits(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
+static void xenstat_uninit_vmexits(xenstat_handle * handle);
 static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
+static char *xenstat_cached_domain_name(xenstat_handle * handle,
+					xc_domaininfo_t * info);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
 static xenstat_collector collectors[] = {
@@ -71,7 +77,9 @@ static xenstat_collector collectors[] = {
 	{ XENSTAT_XEN_VERSION, xenstat_collect_xen_version,
 	  xenstat_free_xen_version, xenstat_uninit_xen_version },
 	{ XENSTAT_VBD, xenstat_collect_vbds,
-	  xenstat_free_vbds, xenstat_uninit_vbds }
+	  xenstat_free_vbds, xenstat_uninit_vbds },
+	{ XENSTAT_VMEXIT, xenstat_collect_vmexits,
+	  xenstat_free_vmexits, xenstat_uninit_vmexits }
 };
 
 #define NUM_COLLECTORS (sizeof(collectors)/sizeof(xenstat_collector))
@@ -124,6 +132,14 @@ void xenstat_uninit(xenstat_handle * handle)
 	if (handle) {
 		for (i = 0; i < NUM_COLLECTORS; i++)
 			collectors[i].uninit(handle);
+		if (handle->names) {
+			for (i = 0; i < DOMID_FIRST_RESERVED; i++)
+				if (handle->names[i])
+					free(handle->names[i]->name);
+			for (i = 0; i < DOMID_FIRST_RESERVED; i++)
+				free(handle->names[i]);
+			free(handle->names);
+		}
 		xc_interface_close(handle->xc_handle);
 		xs_close(handle->xshandle);
 		free(handle->priv);
@@ -131,12 +147,15 @@ void xenstat_uninit(xenstat_handle * handle)
 	}
 }
 
-xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
+static xenstat_node *xenstat_get_node_common(xenstat_handle * handle,
+					     unsigned int flags,
+					     bool incremental)
 {
 #define DOMAIN_CHUNK_SIZE 256
 	xenstat_node *node;
 	xc_physinfo_t physinfo;
 	xc_domaininfo_t domaininfo[DOMAIN_CHUNK_SIZE];
+	struct timespec ts;
 	int new_domains;
 	unsigned int i;
 
@@ -147,6 +166,10 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 
 	/* Store the handle in the node for later access */
 	node->handle = handle;
+	node->incremental = incremental;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	node->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 
 	/* Get information about the physical system */
 	if (xc_physinfo(handle->xc_handle, &physinfo) < 0) {
@@ -198,8 +221,12 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		for (i = 0; i < new_domains; i++) {
 			/* Fill in domain using domaininfo[i] */
 			domain->id = domaininfo[i].domain;
-			domain->name = xenstat_get_domain_name(handle, 
-							       domain->id);
+			if (incremental)
+				domain->name = xenstat_cached_domain_name(
+					handle, &domaininfo[i]);
+			else
+				domain->name = xenstat_get_domain_name(handle,
+								domain->id);
 			if (domain->name == NULL) {
 				if (errno == ENOMEM) {
 					/* fatal error */
@@ -213,6 +240,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 					continue;
 				}
 			}
+			memcpy(domain->uuid, domaininfo[i].handle,
+			       sizeof(domain->uuid));
 			domain->state = domaininfo[i].flags;
 			domain->cpu_ns = domaininfo[i].cpu_time;
 			domain->num_vcpus = (domaininfo[i].max_vcpu_id+1);
@@ -230,6 +259,8 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 			domain->networks = NULL;
 			domain->num_vbds = 0;
 			domain->vbds = NULL;
+			domain->num_vmexits = 0;
+			domain->vmexits = NULL;
 
 			domain++;
 			node->num_domains++;
@@ -256,6 +287,139 @@ err:
 	return NULL;
 }
 
+xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
+{
+	return xenstat_get_node_common(handle, flags, false);
+}
+
+#define XENSTAT_NAME_TOKEN "xenstat-name"
+#define XENSTAT_DEV_TOKEN "xenstat-dev"
+
+/* Set up the watches telling when the caches need refreshing */
+static int xenstat_init_incremental(xenstat_handle * handle)
+{
+	handle->names = calloc(DOMID_FIRST_RESERVED, sizeof(*handle->names));
+	if (handle->names == NULL)
+		return 0;
+
+	/* Domains coming and going, and backends (relative to this domain's
+	 * xenstore directory) being added or removed. */
+	if (!xs_watch(handle->xshandle, "@introduceDomain", XENSTAT_DEV_TOKEN) ||
+	    !xs_watch(handle->xshandle, "@releaseDomain", XENSTAT_DEV_TOKEN) ||
+	    !xs_watch(handle->xshandle, "backend", XENSTAT_DEV_TOKEN)) {
+		free(handle->names);
+		handle->names = NULL;
+		return 0;
+	}
+
+	handle->incremental = true;
+	return 1;
+}
+
+/* Invalidate the cached data xenstore reports as changed */
+static void xenstat_process_watches(xenstat_handle * handle)
+{
+	char **vec;
+	unsigned int domid;
+
+	while ((vec = xs_check_watch(handle->xshandle)) != NULL) {
+		if (strcmp(vec[XS_WATCH_TOKEN], XENSTAT_DEV_TOKEN) == 0)
+			handle->devices_gen++;
+		else if (strcmp(vec[XS_WATCH_TOKEN], XENSTAT_NAME_TOKEN) == 0 &&
+			 sscanf(vec[XS_WATCH_PATH], "/local/domain/%u/name",
+				&domid) == 1 &&
+			 domid < DOMID_FIRST_RESERVED &&
+			 handle->names[domid] != NULL) {
+			struct xenstat_name *n = handle->names[domid];
+
+			if (n->skip_events)
+				n->skip_events--;
+			else
+				n->valid = false;
+		}
+		free(vec);
+	}
+}
+
+/* Drop the cached names of domains which have gone away */
+static void xenstat_prune_names(xenstat_handle * handle)
+{
+	unsigned int domid;
+	char path[80];
+
+	for (domid = 0; domid < DOMID_FIRST_RESERVED; domid++) {
+		struct xenstat_name *n = handle->names[domid];
+
+		if (n == NULL || n->seen == handle->refresh)
+			continue;
+
+		if (n->watched) {
+			snprintf(path, sizeof(path), "/local/domain/%u/name",
+				 domid);
+			xs_unwatch(handle->xshandle, path, XENSTAT_NAME_TOKEN);
+		}
+		free(n->name);
+		free(n);
+		handle->names[domid] = NULL;
+	}
+}
+
+/* Compute the deltas between node and the previous node prev */
+static void xenstat_compute_deltas(xenstat_node * node, xenstat_node * prev)
+{
+	unsigned int i, vcpu;
+
+	if (prev == NULL || node->ns <= prev->ns)
+		return;
+
+	node->delta_ns = node->ns - prev->ns;
+
+	for (i = 0; i < node->num_domains; i++) {
+		xenstat_domain *domain = &node->domains[i];
+		xenstat_domain *old = xenstat_node_domain(prev, domain->id);
+
+		/* Skip new domains, including ones reusing an old domid */
+		if (old == NULL ||
+		    memcmp(old->uuid, domain->uuid, sizeof(domain->uuid)) ||
+		    domain->cpu_ns < old->cpu_ns)
+			continue;
+
+		domain->cpu_ns_delta = domain->cpu_ns - old->cpu_ns;
+
+		if (domain->vcpus == NULL || old->vcpus == NULL ||
+		    domain->num_vcpus != old->num_vcpus)
+			continue;
+
+		for (vcpu = 0; vcpu < domain->num_vcpus; vcpu++)
+			if (domain->vcpus[vcpu].ns >= old->vcpus[vcpu].ns)
+				domain->vcpus[vcpu].ns_delta =
+					domain->vcpus[vcpu].ns -
+					old->vcpus[vcpu].ns;
+	}
+}
+
+xenstat_node *xenstat_get_node_incremental(xenstat_handle * handle,
+					   unsigned int flags,
+					   xenstat_node * prev)
+{
+	xenstat_node *node;
+
+	if (!handle->incremental && !xenstat_init_incremental(handle))
+		return NULL;
+
+	xenstat_process_watches(handle);
+	handle->refresh++;
+
+	node = xenstat_get_node_common(handle, flags, true);
+	if (node == NULL)
+		return NULL;
+
+	xenstat_prune_names(handle);
+	xenstat_compute_deltas(node, prev);
+
+	return node;
+}
+
 void xenstat_free_node(xenstat_node * node)
 {
 	int i;
@@ -277,13 +441,19 @@ void xenstat_free_node(xenstat_node * node)
 
 xenstat_domain *xenstat_node_domain(xenstat_node * node, unsigned int domid)
 {
-	unsigned int i;
-
-	/* FIXME: binary search */
-	/* Find the appropriate domain entry in the node struct. */
-	for (i = 0; i < node->num_domains; i++) {
-		if (node->domains[i].id == domid)
-			return &(node->domains[i]);
+	unsigned int lo = 0, hi = node->num_domains;
+
+	/* Find the appropriate domain entry in the node struct.  Domains are
+	 * sorted by ID, as returned by xc_domain_getinfolist(). */
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (node->domains[mid].id == domid)
+			return &(node->domains[mid]);
+		if (node->domains[mid].id < domid)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 	return NULL;
 }
@@ -311,6 +481,11 @@ unsigned long long xenstat_node_free_mem(xenstat_node * node)
 	return node->free_mem;
 }
 
+unsigned long long xenstat_node_delta_ns(xenstat_node * node)
+{
+	return node->delta_ns;
+}
+
 long xenstat_node_freeable_mb(xenstat_node * node)
 {
 	return node->freeable_mb;
@@ -350,6 +525,11 @@ unsigned long long xenstat_domain_cpu_ns(xenstat_domain * domain)
 	return domain->cpu_ns;
 }
 
+unsigned long long xenstat_domain_cpu_ns_delta(xenstat_domain * domain)
+{
+	return domain->cpu_ns_delta;
+}
+
 /* Find the number of VCPUs for a domain */
 unsigned int xenstat_domain_num_vcpus(xenstat_domain * domain)
 {
@@ -517,6 +697,105 @@ unsigned long long xenstat_vcpu_ns(xenstat_vcpu * vcpu)
 	return vcpu->ns;
 }
 
+/* Get VCPU usage since the previous node */
+unsigned long long xenstat_vcpu_ns_delta(xenstat_vcpu * vcpu)
+{
+	return vcpu->ns_delta;
+}
+
+/*
+ * VM exit functions
+ */
+/* Collect the VM exit statistics of HVM domains */
+static int xenstat_collect_vmexits(xenstat_node * node)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int i, j;
+
+	for (i = 0; i < node->num_domains; i++) {
+		xenstat_domain *domain = &node->domains[i];
+		xen_domctl_exit_stat_t *stats;
+		uint32_t vendor, size, nr = 0;
+
+		if (!(domain->state & XEN_DOMINF_hvm_guest))
+			continue;
+
+		/* Size the array first; the domain may be going away. */
+		if (xc_domain_get_exit_stats(node->handle->xc_handle,
+					     domain->id,
+					     XEN_DOMCTL_EXIT_STATS_ALL_VCPUS,
+					     &vendor, &nr, NULL) != 0 || !nr)
+			continue;
+
+		/* Leave room for reasons seen in the meantime. */
+		size = nr = nr + 8;
+		stats = calloc(size, sizeof(*stats));
+		if (stats == NULL)
+			return 0;
+
+		if (xc_domain_get_exit_stats(node->handle->xc_handle,
+					     domain->id,
+					     XEN_DOMCTL_EXIT_STATS_ALL_VCPUS,
+					     &vendor, &nr, stats) != 0) {
+			free(stats);
+			continue;
+		}
+		if (nr > size)
+			nr = size;
+
+		domain->vmexits = calloc(nr, sizeof(xenstat_vmexit));
+		if (domain->vmexits == NULL) {
+			free(stats);
+			return 0;
+		}
+
+		for (j = 0; j < nr; j++) {
+			domain->vmexits[j].reason = stats[j].reason;
+			domain->vmexits[j].count = stats[j].count;
+			domain->vmexits[j].cycles = stats[j].cycles;
+		}
+		domain->num_vmexits = nr;
+		domain->vmexit_vendor = vendor == XEN_DOMCTL_EXIT_STATS_SVM
+					? XENSTAT_VMEXIT_SVM : XENSTAT_VMEXIT_VMX;
+
+		free(stats);
+	}
+#endif
+
+	return 1;
+}
+
+/* Free VM exit information */
+static void xenstat_free_vmexits(xenstat_node * node)
+{
+	unsigned int i;
+	for (i = 0; i < node->num_domains; i++)
+		free(node->domains[i].vmexits);
+}
+
+/* Free VM exit information in handle - nothing to do */
+static void xenstat_uninit_vmexits(xenstat_handle * handle)
+{
+}
+
+/* Get the VMX basic exit reason or SVM exit code */
+unsigned int xenstat_vmexit_reason(xenstat_vmexit * vmexit)
+{
+	return vmexit->reason;
+}
+
+/* Get the number of exits */
+unsigned long long xenstat_vmexit_count(xenstat_vmexit * vmexit)
+{
+	return vmexit->count;
+}
+
+/* Get the cycles spent handling the exits */
+unsigned long long xenstat_vmexit_cycles(xenstat_vmexit * vmexit)
+{
+	return vmexit->cycles;
+}
+
 /*
  * Network functions
  */
@@ -713,6 +992,57 @@ static char *xenstat_get_domain_name(xenstat_handle *handle, unsigned int domain
 	return xs_read(handle->xshandle, XBT_NULL, path, NULL);
 }
 
+/* Get the name of a domain from the cache, reading it from xenstore (and
+ * setting up a watch for it changing) if necessary */
+static char *xenstat_cached_domain_name(xenstat_handle * handle,
+					xc_domaininfo_t * info)
+{
+	unsigned int domid = info->domain;
+	struct xenstat_name *n;
+	char path[80];
+	char *name;
+
+	if (domid >= DOMID_FIRST_RESERVED)
+		return xenstat_get_domain_name(handle, domid);
+
+	n = handle->names[domid];
+	if (n == NULL) {
+		n = calloc(1, sizeof(*n));
+		if (n == NULL)
+			return NULL;
+		handle->names[domid] = n;
+	}
+	n->seen = handle->refresh;
+
+	/* A new domain reusing the ID of an old one */
+	if (memcmp(n->uuid, info->handle, sizeof(n->uuid)))
+		n->valid = false;
+
+	if (!n->valid) {
+		if (!n->watched) {
+			snprintf(path, sizeof(path), "/local/domain/%u/name",
+				 domid);
+			/* xenstore fires a watch once when it's set up */
+			if (xs_watch(handle->xshandle, path,
+				     XENSTAT_NAME_TOKEN)) {
+				n->watched = true;
+				n->skip_events = 1;
+			}
+		}
+
+		name = xenstat_get_domain_name(handle, domid);
+		if (name == NULL)
+			return NULL;
+		free(n->name);
+		n->name = name;
+		memcpy(n->uuid, info->handle, sizeof(n->uuid));
+		/* Without a watch, the name has to be read every time */
+		n->valid = n->watched;
+	}
+
+	return strdup(n->name);
+}
+
 /* Remove specified entry from list of domains */
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry)
 {
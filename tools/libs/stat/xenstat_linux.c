@@ -36,9 +36,37 @@
 
 #define SYSFS_VBD_PATH "/sys/bus/xen-backend/devices"
 
+/* Xen VIF an interface in /proc/net/dev belongs to */
+struct iface_map {
+	char iface[16];
+	int is_vif;
+	unsigned int domid;
+	unsigned int netid;
+};
+
+/* Backend device found in SYSFS_VBD_PATH */
+struct vbd_dir {
+	char name[NAME_MAX + 1];
+	unsigned int domid;
+	unsigned int dev;
+	unsigned int back_type;
+};
+
 struct priv_data {
 	FILE *procnetdev;
 	DIR *sysfsvbd;
+	regex_t netdev_re;
+	int netdev_re_ok;
+	/* Caches used for incremental collection, valid for devices_gen */
+	int net_cache_ok;
+	unsigned int net_cache_gen;
+	char dev_bridge[16];
+	struct iface_map *ifaces;
+	unsigned int num_ifaces;
+	int vbd_cache_ok;
+	unsigned int vbd_cache_gen;
+	struct vbd_dir *vbds;
+	unsigned int num_vbds;
 };
 
 static struct priv_data *
@@ -47,13 +75,10 @@ get_priv_data(xenstat_handle *handle)
 	if (handle->priv != NULL)
 		return handle->priv;
 
-	handle->priv = malloc(sizeof(struct priv_data));
+	handle->priv = calloc(1, sizeof(struct priv_data));
 	if (handle->priv == NULL)
 		return (NULL);
 
-	((struct priv_data *)handle->priv)->procnetdev = NULL;
-	((struct priv_data *)handle->priv)->sysfsvbd = NULL;
-
 	return handle->priv;
 }
 
@@ -97,7 +122,7 @@ static void getBridge(const char *excludeName, char *result, size_t resultLen)
 
 /* parseNetLine provides regular expression based parsing for lines from /proc/net/dev, all the */
 /* information are parsed but not all are used in our case, ie. for xenstat */
-static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsigned long long *rxPackets,
+static int parseNetDevLine(regex_t *r, char *line, char *iface, unsigned long long *rxBytes, unsigned long long *rxPackets,
 		unsigned long long *rxErrs, unsigned long long *rxDrops, unsigned long long *rxFifo,
 		unsigned long long *rxFrames, unsigned long long *rxComp, unsigned long long *rxMcast,
 		unsigned long long *txBytes, unsigned long long *txPackets, unsigned long long *txErrs,
@@ -105,18 +130,11 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 		unsigned long long *txCarrier, unsigned long long *txComp)
 {
 	/* Temporary/helper variables */
-	int ret;
 	char *tmp;
 	int i = 0, x = 0, col = 0;
-	regex_t r;
 	regmatch_t matches[19];
 	int num = 19;
 
-	/* Regular exception to parse all the information from /proc/net/dev line */
-	const char *regex = "([^:]*):([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)"
-			"[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*"
-			"([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)";
-
 	/* Initialize all variables called has passed as non-NULL to zeros */
 	if (iface != NULL)
 		memset(iface, 0, sizeof(*iface));
@@ -153,13 +171,8 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 	if (txComp != NULL)
 		*txComp = 0;
 
-	if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
-		regfree(&r);
-		return ret;
-	}
-
 	tmp = (char *)malloc( sizeof(char) );
-	if (regexec (&r, line, num, matches, REG_EXTENDED) == 0){
+	if (regexec (r, line, num, matches, REG_EXTENDED) == 0){
 		for (i = 1; i < num; i++) {
 			/* The expression matches are empty sometimes so we need to check it first */
 			if (matches[i].rm_eo - matches[i].rm_so > 0) {
@@ -239,7 +252,6 @@ static int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes,
 	}
 
 	free(tmp);
-	regfree(&r);
 
 	return 0;
 }
@@ -267,6 +279,51 @@ static int get_iface_domid_network(const char *iface, unsigned int *domid_p, uns
 	return 0;
 }
 
+/* Regular expression to parse all the information from /proc/net/dev line */
+static const char PROCNETDEV_REGEX[] =
+	"([^:]*):([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)"
+	"[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*"
+	"([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)[ ]*([^ ]*)";
+
+/* Like get_iface_domid_network(), but looking at the cache first when
+ * collecting incrementally.  The cache is flushed whenever xenstore reports
+ * domains or backends coming or going. */
+static int lookup_iface_domid_network(xenstat_node *node,
+				      struct priv_data *priv,
+				      const char *iface,
+				      unsigned int *domid_p,
+				      unsigned int *netid_p)
+{
+	struct iface_map *map;
+	unsigned int i;
+
+	if (!node->incremental)
+		return get_iface_domid_network(iface, domid_p, netid_p);
+
+	for (i = 0; i < priv->num_ifaces; i++) {
+		map = &priv->ifaces[i];
+		if (strcmp(map->iface, iface) == 0) {
+			*domid_p = map->domid;
+			*netid_p = map->netid;
+			return map->is_vif;
+		}
+	}
+
+	map = realloc(priv->ifaces, (priv->num_ifaces + 1) * sizeof(*map));
+	if (map == NULL)
+		return get_iface_domid_network(iface, domid_p, netid_p);
+	priv->ifaces = map;
+
+	map = &priv->ifaces[priv->num_ifaces++];
+	memset(map, 0, sizeof(*map));
+	snprintf(map->iface, sizeof(map->iface), "%s", iface);
+	map->is_vif = get_iface_domid_network(iface, &map->domid, &map->netid);
+	*domid_p = map->domid;
+	*netid_p = map->netid;
+
+	return map->is_vif;
+}
+
 /* Collect information about networks */
 int xenstat_collect_networks(xenstat_node * node)
 {
@@ -305,13 +362,33 @@ int xenstat_collect_networks(xenstat_node * node)
 		}
 	}
 
+	if (!priv->netdev_re_ok) {
+		if (regcomp(&priv->netdev_re, PROCNETDEV_REGEX, REG_EXTENDED)) {
+			fprintf(stderr, "Error compiling /proc/net/dev regex\n");
+			return 0;
+		}
+		priv->netdev_re_ok = 1;
+	}
+
 	/* Fill in networks */
 	/* FIXME: optimize this */
 	fseek(priv->procnetdev, sizeof(PROCNETDEV_HEADER) - 1,
 	      SEEK_SET);
 
 	/* We get the bridge devices for use with bonding interface to get bonding interface stats */
-	getBridge("vir", devBridge, sizeof(devBridge));
+	if (!node->incremental || !priv->net_cache_ok ||
+	    priv->net_cache_gen != node->handle->devices_gen) {
+		getBridge("vir", devBridge, sizeof(devBridge));
+		if (node->incremental) {
+			memcpy(priv->dev_bridge, devBridge, sizeof(devBridge));
+			free(priv->ifaces);
+			priv->ifaces = NULL;
+			priv->num_ifaces = 0;
+			priv->net_cache_gen = node->handle->devices_gen;
+			priv->net_cache_ok = 1;
+		}
+	} else
+		memcpy(devBridge, priv->dev_bridge, sizeof(devBridge));
 	snprintf(devNoBridge, sizeof(devNoBridge), "p%s", devBridge);
 
 	while (fgets(line, 512, priv->procnetdev)) {
@@ -319,7 +396,7 @@ int xenstat_collect_networks(xenstat_node * node)
 		xenstat_network net;
 		unsigned int domid;
 
-		parseNetDevLine(line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
+		parseNetDevLine(&priv->netdev_re, line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
 				NULL, &txBytes, &txPackets, &txErrs, &txDrops, NULL, NULL, NULL, NULL);
 
 		/* If the device parsed is network bridge and both tx & rx packets are zero, we are most */
@@ -343,7 +420,7 @@ int xenstat_collect_networks(xenstat_node * node)
 			}
 		}
 		else /* Otherwise we need to preserve old behaviour */
-		if (get_iface_domid_network(iface, &domid, &net.id)) {
+		if (lookup_iface_domid_network(node, priv, iface, &domid, &net.id)) {
 
 			net.tbytes = txBytes;
 			net.tpackets = txPackets;
@@ -391,6 +468,10 @@ void xenstat_uninit_networks(xenstat_handle * handle)
 	struct priv_data *priv = get_priv_data(handle);
 	if (priv != NULL && priv->procnetdev != NULL)
 		fclose(priv->procnetdev);
+	if (priv != NULL && priv->netdev_re_ok)
+		regfree(&priv->netdev_re);
+	if (priv != NULL)
+		free(priv->ifaces);
 }
 
 static int read_attributes_vbd(const char *vbd_directory, const char *what, char *ret, int cap)
@@ -409,11 +490,64 @@ static int read_attributes_vbd(const char *vbd_directory, const char *what, char
 	return num_read;
 }
 
+/* Read the statistics of a VBD and add them to its domain */
+static int collect_vbd(xenstat_node *node, const struct vbd_dir *d)
+{
+	xenstat_domain *domain;
+	xenstat_vbd vbd;
+	char buf[256];
+	int ret;
+
+	vbd.dev = d->dev;
+	vbd.back_type = d->back_type;
+
+	domain = xenstat_node_domain(node, d->domid);
+	if (domain == NULL) {
+		fprintf(stderr,
+			"Found interface %s but domain %u"
+			" does not exist.\n",
+			d->name, d->domid);
+		return 1;
+	}
+
+	if (vbd.back_type == 1 || vbd.back_type == 2)
+	{
+
+		vbd.error = 0;
+
+		if ((read_attributes_vbd(d->name, "statistics/oo_req", buf, 256)<=0) ||
+			((ret = sscanf(buf, "%llu", &vbd.oo_reqs)) != 1) ||
+			(read_attributes_vbd(d->name, "statistics/rd_req", buf, 256)<=0) ||
+			((ret = sscanf(buf, "%llu", &vbd.rd_reqs)) != 1) ||
+			(read_attributes_vbd(d->name, "statistics/wr_req", buf, 256)<=0) ||
+			((ret = sscanf(buf, "%llu", &vbd.wr_reqs)) != 1) ||
+			(read_attributes_vbd(d->name, "statistics/rd_sect", buf, 256)<=0) ||
+			((ret = sscanf(buf, "%llu", &vbd.rd_sects)) != 1) ||
+			(read_attributes_vbd(d->name, "statistics/wr_sect", buf, 256)<=0) ||
+			((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1))
+		{
+			vbd.error = 1;
+		}
+	}
+	else
+	{
+		vbd.error = 1;
+	}
+	if ((xenstat_save_vbd(domain, &vbd)) == NULL) {
+		perror("Allocation error");
+		return 0;
+	}
+
+	return 1;
+}
+
 /* Collect information about VBDs */
 int xenstat_collect_vbds(xenstat_node * node)
 {
 	struct dirent *dp;
 	struct priv_data *priv = get_priv_data(node->handle);
+	unsigned int i;
+	int cache;
 
 	if (priv == NULL) {
 		perror("Allocation error");
@@ -431,65 +565,63 @@ int xenstat_collect_vbds(xenstat_node * node)
 	/* Get qdisk statistics */
 	read_attributes_qdisk(node);
 
+	/* When collecting incrementally, the list of devices only needs
+	 * rescanning once xenstore reported backends or domains changing. */
+	if (node->incremental && priv->vbd_cache_ok &&
+	    priv->vbd_cache_gen == node->handle->devices_gen) {
+		for (i = 0; i < priv->num_vbds; i++)
+			if (!collect_vbd(node, &priv->vbds[i]))
+				return 0;
+		return 1;
+	}
+
+	cache = node->incremental;
+	priv->vbd_cache_ok = 0;
+	priv->num_vbds = 0;
+
 	rewinddir(priv->sysfsvbd);
 
 	for(dp = readdir(priv->sysfsvbd); dp != NULL ;
 	    dp = readdir(priv->sysfsvbd)) {
-		xenstat_domain *domain;
-		xenstat_vbd vbd;
-		unsigned int domid;
+		struct vbd_dir d;
 		int ret;
 		char buf[256];
 
-		ret = sscanf(dp->d_name, "%3s-%u-%u", buf, &domid, &vbd.dev);
+		ret = sscanf(dp->d_name, "%3s-%u-%u", buf, &d.domid, &d.dev);
 		if (ret != 3)
 			continue;
 		if (!(strstr(buf, "vbd")) && !(strstr(buf, "tap")))
 			continue;
 
 		if (strcmp(buf,"vbd") == 0)
-			vbd.back_type = 1;
+			d.back_type = 1;
 		else if (strcmp(buf,"tap") == 0)
-			vbd.back_type = 2;
+			d.back_type = 2;
 		else
-			vbd.back_type = 0;
+			d.back_type = 0;
 
-		domain = xenstat_node_domain(node, domid);
-		if (domain == NULL) {
-			fprintf(stderr,
-				"Found interface %s-%u-%u but domain %u"
-				" does not exist.\n",
-				buf, domid, vbd.dev, domid);
-			continue;
-		}
+		snprintf(d.name, sizeof(d.name), "%s", dp->d_name);
 
-		if (vbd.back_type == 1 || vbd.back_type == 2)
-		{
+		if (cache) {
+			struct vbd_dir *tmp;
 
-			vbd.error = 0;
-
-			if ((read_attributes_vbd(dp->d_name, "statistics/oo_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.oo_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/rd_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.rd_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/wr_req", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.wr_reqs)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/rd_sect", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.rd_sects)) != 1) ||
-				(read_attributes_vbd(dp->d_name, "statistics/wr_sect", buf, 256)<=0) ||
-				((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1))
-			{
-				vbd.error = 1;
+			tmp = realloc(priv->vbds,
+				      (priv->num_vbds + 1) * sizeof(*tmp));
+			if (tmp == NULL)
+				cache = 0;
+			else {
+				priv->vbds = tmp;
+				priv->vbds[priv->num_vbds++] = d;
 			}
 		}
-		else
-		{
-			vbd.error = 1;
-		}
-		if ((xenstat_save_vbd(domain, &vbd)) == NULL) {
-			perror("Allocation error");
+
+		if (!collect_vbd(node, &d))
 			return 0;
-		}
+	}
+
+	if (cache) {
+		priv->vbd_cache_gen = node->handle->devices_gen;
+		priv->vbd_cache_ok = 1;
 	}
 
 	return 1;	
@@ -501,4 +633,6 @@ void xenstat_uninit_vbds(xenstat_handle * handle)
 	struct priv_data *priv = get_priv_data(handle);
 	if (priv != NULL && priv->sysfsvbd != NULL)
 		closedir(priv->sysfsvbd);
+	if (priv != NULL)
+		free(priv->vbds);
 }
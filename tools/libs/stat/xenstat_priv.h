@@ -32,17 +32,33 @@
 #define SHORT_ASC_LEN 5                 /* length of 65535 */
 #define VERSION_SIZE (2 * SHORT_ASC_LEN + 1 + sizeof(xen_extraversion_t) + 1)
 
+/* Cached name of a domain, see xenstat_get_node_incremental() */
+struct xenstat_name {
+	char *name;
+	xen_domain_handle_t uuid;	/* of the domain the name was read for */
+	unsigned int seen;		/* refresh it was last used in */
+	unsigned int skip_events;	/* initial watch events yet to come */
+	bool watched;
+	bool valid;
+};
+
 struct xenstat_handle {
 	xc_interface *xc_handle;
 	struct xs_handle *xshandle; /* xenstore handle */
 	int page_size;
 	void *priv;
 	char xen_version[VERSION_SIZE]; /* xen version running on this node */
+	/* Incremental collection state */
+	bool incremental;		/* watches set up, caches in use */
+	struct xenstat_name **names;	/* indexed by domain id */
+	unsigned int refresh;		/* count of incremental refreshes */
+	unsigned int devices_gen;	/* bumped when devices may have changed */
 };
 
 struct xenstat_node {
 	xenstat_handle *handle;
 	unsigned int flags;
+	bool incremental;		/* may use the caches in the handle */
 	unsigned long long cpu_hz;
 	unsigned int num_cpus;
 	unsigned long long tot_mem;
@@ -50,13 +66,17 @@ struct xenstat_node {
 	unsigned int num_domains;
 	xenstat_domain *domains;	/* Array of length num_domains */
 	long freeable_mb;
+	unsigned long long ns;		/* CLOCK_MONOTONIC time of collection */
+	unsigned long long delta_ns;	/* since the previous node, or 0 */
 };
 
 struct xenstat_domain {
 	unsigned int id;
 	char *name;
+	xen_domain_handle_t uuid;
 	unsigned int state;
 	unsigned long long cpu_ns;
+	unsigned long long cpu_ns_delta;
 	unsigned int num_vcpus;		/* No. vcpus configured for domain */
 	xenstat_vcpu *vcpus;		/* Array of length num_vcpus */
 	unsigned long long cur_mem;	/* Current memory reservation */
@@ -66,11 +86,21 @@ struct xenstat_domain {
 	xenstat_network *networks;	/* Array of length num_networks */
 	unsigned int num_vbds;
 	xenstat_vbd *vbds;
+	unsigned int vmexit_vendor;
+	unsigned int num_vmexits;
+	xenstat_vmexit *vmexits;	/* Array of length num_vmexits */
 };
 
 struct xenstat_vcpu {
 	unsigned int online;
 	unsigned long long ns;
+	unsigned long long ns_delta;
+};
+
+struct xenstat_vmexit {
+	unsigned int reason;
+	unsigned long long count;
+	unsigned long long cycles;
 };
 
 struct xenstat_network {
@@ -386,17 +386,10 @@ static void read_attributes_qdisk_dom(xenstat_node *node, domid_t domain)
 {
 	const char *cmd_mode = "{ \"execute\": \"qmp_capabilities\" }";
 	const char *query_blockstats_cmd = "{ \"execute\": \"query-blockstats\" }";
-	unsigned char *qmp_stats, *val;
+	unsigned char *qmp_stats;
 	char path[80];
 	int qfd;
 
-	/* Verify that qdisk disks are used with this VM */
-	snprintf(path, sizeof(path),"/local/domain/0/backend/qdisk/%i", domain);
-	val = xs_read(node->handle->xshandle, XBT_NULL, path, NULL);
-	if (val == NULL)
-		return;
-	free(val);
-
 	/* Connect to this VMs QMP socket */
 	snprintf(path, sizeof(path), XEN_RUN_DIR "/qmp-libxenstat-%i", domain);
 	if ((qfd = qmp_connect(path)) < 0)
@@ -417,22 +410,25 @@ static void read_attributes_qdisk_dom(xenstat_node *node, domid_t domain)
 
 void read_attributes_qdisk(xenstat_node * node)
 {
-	xc_domaininfo_t dominfo[1024];
-	int i, num_doms;
-	domid_t next_domid = 0;
-
-	for (;;) {
-		num_doms = xc_domain_getinfolist(node->handle->xc_handle,
-						 next_domid, 1024, dominfo);
-		if (num_doms <= 0)
-			return;
-
-		for (i = 0; i < num_doms; i++)
-			if (dominfo[i].domain > 0)
-				read_attributes_qdisk_dom(node, dominfo[i].domain);
+	char **doms, *end;
+	unsigned int i, num_doms;
+	unsigned long domid;
+
+	/* Only the domains with qdisk backends need querying: list them with
+	 * a single xenstore request, rather than probing every domain. */
+	doms = xs_directory(node->handle->xshandle, XBT_NULL,
+			    "/local/domain/0/backend/qdisk", &num_doms);
+	if (doms == NULL)
+		return;
 
-		next_domid = dominfo[num_doms - 1].domain + 1;
+	for (i = 0; i < num_doms; i++) {
+		domid = strtoul(doms[i], &end, 10);
+		if (*end || domid == 0 || xenstat_node_domain(node, domid) == NULL)
+			continue;
+		read_attributes_qdisk_dom(node, domid);
 	}
+
+	free(doms);
 }
 
 #else /* !HAVE_YAJL_V2 */
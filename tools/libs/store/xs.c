@@ -46,6 +46,22 @@ struct xs_stored_msg {
 	char *body;
 };
 
+/* A request sent by xs_submit() whose reply hasn't been collected yet. */
+struct xs_async_req {
+	struct list_head list;
+	uint32_t req_id;
+	enum xsd_sockmsg_type type;
+	xs_async_done *done;
+	void *data;
+};
+
+/*
+ * Requests in flight per handle.  Stay below xenstored's default limit on
+ * outstanding requests of a domain, and don't let the replies we haven't
+ * read yet fill up the connection.
+ */
+#define XS_ASYNC_MAX_OUTSTANDING 16
+
 #ifdef USE_PTHREAD
 
 #include <pthread.h>
@@ -80,9 +96,10 @@ struct xs_handle {
 	bool unwatch_filter;
 
 	/*
-         * A list of replies. Currently only one will ever be outstanding
-         * because we serialise requests. The requester can wait on the
-         * conditional variable for its response.
+         * A list of replies. Synchronous requests are serialised, but any
+         * number of replies to requests sent by xs_submit() may be queued
+         * as well; they are told apart by their req_id. The requester can
+         * wait on the conditional variable for its response.
          */
 	struct list_head reply_list;
 	pthread_mutex_t reply_mutex;
@@ -91,12 +108,18 @@ struct xs_handle {
 	/* One request at a time. */
 	pthread_mutex_t request_mutex;
 
+	/* Requests sent by xs_submit(), oldest first. */
+	struct list_head async_list;
+	unsigned int async_count;
+	uint32_t async_req_id;
+
 	/* Lock discipline:
 	 *  Only holder of the request lock may write to h->fd.
 	 *  Only holder of the request lock may access read_thr_exists.
 	 *  If read_thr_exists==0, only holder of request lock may read h->fd;
 	 *  If read_thr_exists==1, only the read thread may read h->fd.
 	 *  Only holder of the reply lock may access reply_list.
+	 *  Only holder of the request lock may access async_list.
 	 *  Only holder of the watch lock may access watch_list.
 	 * Lock hierarchy:
 	 *  The order in which to acquire locks is
@@ -139,6 +162,10 @@ struct xs_handle {
 	int watch_pipe[2];
 	/* Filtering watch event in unwatch function? */
 	bool unwatch_filter;
+	/* Requests sent by xs_submit(), oldest first. */
+	struct list_head async_list;
+	unsigned int async_count;
+	uint32_t async_req_id;
 };
 
 #define mutex_lock(m)		((void)0)
@@ -264,6 +291,7 @@ static struct xs_handle *get_handle(const char *connect_to)
 
 	INIT_LIST_HEAD(&h->reply_list);
 	INIT_LIST_HEAD(&h->watch_list);
+	INIT_LIST_HEAD(&h->async_list);
 
 	/* Watch pipe is allocated on demand in xs_fileno(). */
 	h->watch_pipe[0] = h->watch_pipe[1] = -1;
@@ -328,6 +356,10 @@ struct xs_handle *xs_open(unsigned long flags)
 
 static void close_free_msgs(struct xs_handle *h) {
 	struct xs_stored_msg *msg, *tmsg;
+	struct xs_async_req *req, *treq;
+
+	list_for_each_entry_safe(req, treq, &h->async_list, list)
+		free(req);
 
 	list_for_each_entry_safe(msg, tmsg, &h->reply_list, list) {
 		free(msg->body);
@@ -443,9 +475,20 @@ static int get_error(const char *errorstring)
 	return xsd_errors[i].errnum;
 }
 
+static struct xs_stored_msg *find_reply(struct xs_handle *h, uint32_t req_id)
+{
+	struct xs_stored_msg *msg;
+
+	list_for_each_entry(msg, &h->reply_list, list)
+		if (msg->hdr.req_id == req_id)
+			return msg;
+
+	return NULL;
+}
+
 /* Adds extra nul terminator, because we generally (always?) hold strings. */
-static void *read_reply(
-	struct xs_handle *h, enum xsd_sockmsg_type *type, unsigned int *len)
+static void *read_reply(struct xs_handle *h, uint32_t req_id,
+			enum xsd_sockmsg_type *type, unsigned int *len)
 {
 	struct xs_stored_msg *msg;
 	char *body;
@@ -453,23 +496,29 @@ static void *read_reply(
 
 	read_from_thread = read_thread_exists(h);
 
-	/* Read from comms channel ourselves if there is no reader thread. */
-	if (!read_from_thread && (read_message(h, 0) == -1))
-		return NULL;
-
 	mutex_lock(&h->reply_mutex);
-#ifdef USE_PTHREAD
-	while (list_empty(&h->reply_list) && read_from_thread && h->fd != -1)
-		condvar_wait(&h->reply_condvar, &h->reply_mutex);
-#endif
-	if (list_empty(&h->reply_list)) {
+	while (!(msg = find_reply(h, req_id))) {
+		if (read_from_thread) {
+			if (h->fd == -1)
+				break;
+			condvar_wait(&h->reply_condvar, &h->reply_mutex);
+		} else {
+			/*
+			 * Read from comms channel ourselves if there is no
+			 * reader thread, until our reply shows up.
+			 */
+			mutex_unlock(&h->reply_mutex);
+			if (read_message(h, 0) == -1)
+				return NULL;
+			mutex_lock(&h->reply_mutex);
+		}
+	}
+	if (!msg) {
 		mutex_unlock(&h->reply_mutex);
 		errno = EINVAL;
 		return NULL;
 	}
-	msg = list_top(&h->reply_list, struct xs_stored_msg, list);
 	list_del(&msg->list);
-	assert(list_empty(&h->reply_list));
 	mutex_unlock(&h->reply_mutex);
 
 	*type = msg->hdr.type;
@@ -521,7 +570,7 @@ static void *xs_talkv(struct xs_handle *h, xs_transaction_t t,
 		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
 			goto fail;
 
-	ret = read_reply(h, &msg.type, len);
+	ret = read_reply(h, msg.req_id, &msg.type, len);
 	if (!ret)
 		goto fail;
 
@@ -575,6 +624,19 @@ static void *xs_single(struct xs_handle *h, xs_transaction_t t,
 	return xs_talkv(h, t, type, &iovec, 1, len);
 }
 
+/* Simplified version of xs_talkv: single message, binary payload. */
+static void *xs_single_buf(struct xs_handle *h, xs_transaction_t t,
+			   enum xsd_sockmsg_type type,
+			   const void *data, unsigned int len,
+			   unsigned int *reply_len)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)data;
+	iovec.iov_len = len;
+	return xs_talkv(h, t, type, &iovec, 1, reply_len);
+}
+
 static bool xs_bool(char *reply)
 {
 	if (!reply)
@@ -583,6 +645,160 @@ static bool xs_bool(char *reply)
 	return true;
 }
 
+/*
+ * Collect the reply to the oldest request sent by xs_submit() and run its
+ * callback.  Returns 0 if there was no such request, 1 if it got a reply
+ * (possibly an error) and -1 if the connection failed.
+ */
+static int async_complete_one(struct xs_handle *h)
+{
+	struct xs_async_req *req;
+	enum xsd_sockmsg_type type;
+	unsigned int len = 0;
+	char *reply;
+	int err = 0, ret = 1;
+
+	mutex_lock(&h->request_mutex);
+
+	if (list_empty(&h->async_list)) {
+		mutex_unlock(&h->request_mutex);
+		return 0;
+	}
+	req = list_top(&h->async_list, struct xs_async_req, list);
+	list_del(&req->list);
+	h->async_count--;
+
+	reply = read_reply(h, req->req_id, &type, &len);
+	if (!reply) {
+		err = errno ? errno : EIO;
+		ret = -1;
+	} else if (type == XS_ERROR) {
+		err = get_error(reply);
+	} else if (type != req->type) {
+		err = EBADF;
+		ret = -1;
+	}
+	if (ret == -1) {
+		/* We're in a bad state, so close fd. */
+		close(h->fd);
+		h->fd = -1;
+	}
+
+	mutex_unlock(&h->request_mutex);
+
+	if (err) {
+		free(reply);
+		reply = NULL;
+		len = 0;
+	}
+	if (req->done)
+		req->done(h, req->data, err, reply, len);
+
+	free(reply);
+	free(req);
+
+	return ret;
+}
+
+static bool xs_submitv(struct xs_handle *h, xs_transaction_t t,
+		       enum xsd_sockmsg_type type,
+		       const struct iovec *iovec,
+		       unsigned int num_vecs,
+		       xs_async_done *done, void *data)
+{
+	struct xsd_sockmsg msg;
+	struct xs_async_req *req;
+	int saved_errno;
+	unsigned int i;
+	struct sigaction ignorepipe, oldact;
+
+	msg.tx_id = t;
+	msg.type = type;
+	msg.len = 0;
+	for (i = 0; i < num_vecs; i++)
+		msg.len += iovec[i].iov_len;
+
+	if (msg.len > XENSTORE_PAYLOAD_MAX) {
+		errno = E2BIG;
+		return false;
+	}
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return false;
+	req->type = type;
+	req->done = done;
+	req->data = data;
+
+	/* Make room first: keep the number of requests in flight bounded. */
+	while (h->async_count >= XS_ASYNC_MAX_OUTSTANDING)
+		if (async_complete_one(h) < 0)
+			goto fail_free;
+
+	ignorepipe.sa_handler = SIG_IGN;
+	sigemptyset(&ignorepipe.sa_mask);
+	ignorepipe.sa_flags = 0;
+	sigaction(SIGPIPE, &ignorepipe, &oldact);
+
+	mutex_lock(&h->request_mutex);
+
+	/* Synchronous requests use req_id 0, so never hand that out. */
+	if (++h->async_req_id == 0)
+		h->async_req_id = 1;
+	msg.req_id = req->req_id = h->async_req_id;
+
+	if (!xs_write_all(h->fd, &msg, sizeof(msg)))
+		goto fail;
+
+	for (i = 0; i < num_vecs; i++)
+		if (!xs_write_all(h->fd, iovec[i].iov_base, iovec[i].iov_len))
+			goto fail;
+
+	list_add_tail(&req->list, &h->async_list);
+	h->async_count++;
+
+	mutex_unlock(&h->request_mutex);
+	sigaction(SIGPIPE, &oldact, NULL);
+
+	return true;
+
+fail:
+	/* We're in a bad state, so close fd. */
+	saved_errno = errno;
+	close(h->fd);
+	h->fd = -1;
+	mutex_unlock(&h->request_mutex);
+	sigaction(SIGPIPE, &oldact, NULL);
+	errno = saved_errno;
+fail_free:
+	free_no_errno(req);
+	return false;
+}
+
+bool xs_submit(struct xs_handle *h, xs_transaction_t t,
+	       enum xsd_sockmsg_type type,
+	       const void *data, unsigned int len,
+	       xs_async_done *done, void *cbdata)
+{
+	struct iovec iovec;
+
+	iovec.iov_base = (void *)data;
+	iovec.iov_len = len;
+	return xs_submitv(h, t, type, &iovec, 1, done, cbdata);
+}
+
+bool xs_async_wait(struct xs_handle *h)
+{
+	bool ok = true;
+	int ret;
+
+	while ((ret = async_complete_one(h)) != 0)
+		if (ret < 0)
+			ok = false;
+
+	return ok;
+}
+
 static char **xs_directory_common(char *strings, unsigned int len,
 				  unsigned int *num)
 {
@@ -703,6 +919,21 @@ bool xs_write(struct xs_handle *h, xs_transaction_t t,
 				ARRAY_SIZE(iovec), NULL));
 }
 
+bool xs_write_async(struct xs_handle *h, xs_transaction_t t,
+		    const char *path, const void *data, unsigned int len,
+		    xs_async_done *done, void *cbdata)
+{
+	struct iovec iovec[2];
+
+	iovec[0].iov_base = (void *)path;
+	iovec[0].iov_len = strlen(path) + 1;
+	iovec[1].iov_base = (void *)data;
+	iovec[1].iov_len = len;
+
+	return xs_submitv(h, t, XS_WRITE, iovec, ARRAY_SIZE(iovec),
+			  done, cbdata);
+}
+
 /* Create a new directory.
  * Returns false on failure, or success if it already exists.
  */
@@ -721,6 +952,79 @@ bool xs_rm(struct xs_handle *h, xs_transaction_t t,
 	return xs_bool(xs_single(h, t, XS_RM, path, NULL));
 }
 
+bool xs_multi(struct xs_handle *h, xs_transaction_t t, bool atomic,
+	      struct xs_multi_op *ops, unsigned int num_ops)
+{
+	struct xsd_sockmsg hdr;
+	char *buf, *reply, *p;
+	unsigned int i, len, pathlen, reply_len;
+
+	/* "T" or "F", then one complete message per operation. */
+	len = 2;
+	for (i = 0; i < num_ops; i++) {
+		ops[i].err = ECANCELED;
+		ops[i].reply = NULL;
+		ops[i].reply_len = 0;
+		len += sizeof(hdr) + strlen(ops[i].path) + 1 + ops[i].len;
+		if (len > XENSTORE_PAYLOAD_MAX) {
+			errno = E2BIG;
+			return false;
+		}
+	}
+
+	buf = malloc(len);
+	if (!buf)
+		return false;
+	strcpy(buf, atomic ? "T" : "F");
+	p = buf + 2;
+	for (i = 0; i < num_ops; i++) {
+		pathlen = strlen(ops[i].path) + 1;
+		hdr.type = ops[i].type;
+		hdr.req_id = i;
+		hdr.tx_id = t;
+		hdr.len = pathlen + ops[i].len;
+		memcpy(p, &hdr, sizeof(hdr));
+		p += sizeof(hdr);
+		memcpy(p, ops[i].path, pathlen);
+		p += pathlen;
+		if (ops[i].len)
+			memcpy(p, ops[i].data, ops[i].len);
+		p += ops[i].len;
+	}
+
+	reply = xs_single_buf(h, t, XS_MULTI, buf, len, &reply_len);
+	free_no_errno(buf);
+	if (!reply)
+		return false;
+
+	/* One reply message per operation run, in order. */
+	for (p = reply; p + sizeof(hdr) <= reply + reply_len; p += hdr.len) {
+		memcpy(&hdr, p, sizeof(hdr));
+		p += sizeof(hdr);
+		if (hdr.req_id >= num_ops ||
+		    hdr.len > reply + reply_len - p)
+			break;
+
+		i = hdr.req_id;
+		if (hdr.type == XS_ERROR) {
+			ops[i].err = get_error(p);
+			continue;
+		}
+		ops[i].reply = malloc(hdr.len + 1);
+		if (!ops[i].reply) {
+			ops[i].err = ENOMEM;
+			continue;
+		}
+		memcpy(ops[i].reply, p, hdr.len);
+		((char *)ops[i].reply)[hdr.len] = 0;
+		ops[i].reply_len = hdr.len;
+		ops[i].err = 0;
+	}
+
+	free(reply);
+	return true;
+}
+
 /* Get permissions of node (first element is owner).
  * Returns malloced array, or NULL: call free() after use.
  */
@@ -755,16 +1059,15 @@ struct xs_permissions *xs_get_permissions(struct xs_handle *h,
 	return ret;
 }
 
-/* Set permissions of node (must be owner).
- * Returns false on failure.
- */
-bool xs_set_permissions(struct xs_handle *h,
-			xs_transaction_t t,
-			const char *path,
-			struct xs_permissions *perms,
-			unsigned int num_perms)
+static bool set_permissions(struct xs_handle *h,
+			    xs_transaction_t t,
+			    const char *path,
+			    struct xs_permissions *perms,
+			    unsigned int num_perms,
+			    bool async, xs_async_done *done, void *cbdata)
 {
 	unsigned int i;
+	bool ok;
 	struct iovec iov[1+num_perms];
 
 	iov[0].iov_base = (void *)path;
@@ -782,7 +1085,13 @@ bool xs_set_permissions(struct xs_handle *h,
 			goto unwind;
 	}
 
-	if (!xs_bool(xs_talkv(h, t, XS_SET_PERMS, iov, 1+num_perms, NULL)))
+	if (async)
+		ok = xs_submitv(h, t, XS_SET_PERMS, iov, 1+num_perms,
+				done, cbdata);
+	else
+		ok = xs_bool(xs_talkv(h, t, XS_SET_PERMS, iov, 1+num_perms,
+				      NULL));
+	if (!ok)
 		goto unwind;
 	for (i = 0; i < num_perms; i++)
 		free(iov[i+1].iov_base);
@@ -795,6 +1104,30 @@ unwind:
 	return false;
 }
 
+/* Set permissions of node (must be owner).
+ * Returns false on failure.
+ */
+bool xs_set_permissions(struct xs_handle *h,
+			xs_transaction_t t,
+			const char *path,
+			struct xs_permissions *perms,
+			unsigned int num_perms)
+{
+	return set_permissions(h, t, path, perms, num_perms,
+			       false, NULL, NULL);
+}
+
+bool xs_set_permissions_async(struct xs_handle *h,
+			      xs_transaction_t t,
+			      const char *path,
+			      struct xs_permissions *perms,
+			      unsigned int num_perms,
+			      xs_async_done *done, void *cbdata)
+{
+	return set_permissions(h, t, path, perms, num_perms,
+			       true, done, cbdata);
+}
+
 /* Always return false a functionality has been removed in Xen 4.9 */
 bool xs_restrict(struct xs_handle *h, unsigned domid)
 {
@@ -1303,8 +1636,8 @@ static int read_message(struct xs_handle *h, int nonblocking)
 	} else {
 		mutex_lock(&h->reply_mutex);
 
-		/* There should only ever be one response pending! */
-		if (!list_empty(&h->reply_list)) {
+		/* There should only ever be one response per request! */
+		if (find_reply(h, msg->hdr.req_id)) {
 			mutex_unlock(&h->reply_mutex);
 			saved_errno = EEXIST;
 			goto error_freebody;
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <xenctrl.h>
@@ -127,6 +128,28 @@ static inline int raw_get_data_ready(struct libxenvchan *ctrl)
 	return ready;
 }
 
+/**
+ * Poll fn until it reaches request, for at most spin_usec.  Returns its last
+ * value.
+ */
+static int spin(struct libxenvchan *ctrl, int (*fn)(struct libxenvchan *),
+                size_t request)
+{
+	struct timespec start, now;
+	int ready;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		ready = fn(ctrl);
+		if (ready >= request)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000L +
+	         (now.tv_nsec - start.tv_nsec) / 1000 < ctrl->spin_usec);
+
+	return ready;
+}
+
 /**
  * Get the amount of buffer space available and enable notifications if needed.
  */
@@ -135,6 +158,12 @@ static inline int fast_get_data_ready(struct libxenvchan *ctrl, size_t request)
 	int ready = raw_get_data_ready(ctrl);
 	if (ready >= request)
 		return ready;
+	/* The writer may be about to send more, without needing to notify us */
+	if (ctrl->blocking && ctrl->spin_usec) {
+		ready = spin(ctrl, raw_get_data_ready, request);
+		if (ready >= request)
+			return ready;
+	}
 	/* We plan to consume all data; please tell us if you send more */
 	request_notify(ctrl, VCHAN_NOTIFY_WRITE);
 	/*
@@ -177,6 +206,11 @@ static inline int fast_get_buffer_space(struct libxenvchan *ctrl, size_t request
 	int ready = raw_get_buffer_space(ctrl);
 	if (ready >= request)
 		return ready;
+	if (ctrl->blocking && ctrl->spin_usec) {
+		ready = spin(ctrl, raw_get_buffer_space, request);
+		if (ready >= request)
+			return ready;
+	}
 	/* We plan to fill the buffer; please tell us when you've read it */
 	request_notify(ctrl, VCHAN_NOTIFY_READ);
 	/*
@@ -344,6 +378,74 @@ int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
+int libxenvchan_read_peek(struct libxenvchan *ctrl, const void **data)
+{
+	while (1) {
+		int avail = fast_get_data_ready(ctrl, 1);
+		if (avail) {
+			int real_idx = rd_cons(ctrl) & (rd_ring_size(ctrl) - 1);
+			int avail_contig = rd_ring_size(ctrl) - real_idx;
+			xen_rmb(); /* data read must happen /after/ rd_cons read */
+			*data = rd_ring(ctrl) + real_idx;
+			return avail < avail_contig ? avail : avail_contig;
+		}
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (!ctrl->blocking)
+			return 0;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
+int libxenvchan_read_commit(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_data_ready(ctrl))
+		return -1;
+	xen_mb(); /* consume /then/ notify */
+	rd_cons(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_READ))
+		return -1;
+	return size;
+}
+
+int libxenvchan_write_peek(struct libxenvchan *ctrl, void **data)
+{
+	while (1) {
+		int avail;
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		avail = fast_get_buffer_space(ctrl, 1);
+		if (avail) {
+			int real_idx = wr_prod(ctrl) & (wr_ring_size(ctrl) - 1);
+			int avail_contig = wr_ring_size(ctrl) - real_idx;
+			xen_mb(); /* read indexes /then/ write data */
+			*data = wr_ring(ctrl) + real_idx;
+			return avail < avail_contig ? avail : avail_contig;
+		}
+		if (!ctrl->blocking)
+			return 0;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_buffer_space(ctrl))
+		return -1;
+	xen_wmb(); /* write data /then/ notify */
+	wr_prod(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE))
+		return -1;
+	return size;
+}
+
+void libxenvchan_set_spin(struct libxenvchan *ctrl, unsigned int usec)
+{
+	ctrl->spin_usec = usec;
+}
+
 int libxenvchan_is_open(struct libxenvchan* ctrl)
 {
 	if (ctrl->is_server)
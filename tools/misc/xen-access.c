@@ -34,6 +34,7 @@
 #include <string.h>
 #include <time.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <poll.h>
@@ -41,6 +42,7 @@
 #define XC_WANT_COMPAT_DEVICEMODEL_API
 #include <xenctrl.h>
 #include <xenevtchn.h>
+#include <xenforeignmemory.h>
 #include <xen/vm_event.h>
 
 #include <xen-tools/common-macros.h>
@@ -70,6 +72,10 @@ typedef struct vm_event {
     vm_event_back_ring_t back_ring;
     uint32_t evtchn_port;
     void *ring_page;
+    /* Number of ring frames, if mapped via xenforeignmemory_map_resource() */
+    unsigned int ring_frames;
+    xenforeignmemory_handle *fmem;
+    xenforeignmemory_resource_handle *fres;
 } vm_event_t;
 
 typedef struct xenaccess {
@@ -137,9 +143,15 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
         return 0;
 
     /* Tear down domain xenaccess in Xen */
-    if ( xenaccess->vm_event.ring_page )
+    if ( xenaccess->vm_event.fres )
+        xenforeignmemory_unmap_resource(xenaccess->vm_event.fmem,
+                                        xenaccess->vm_event.fres);
+    else if ( xenaccess->vm_event.ring_page )
         munmap(xenaccess->vm_event.ring_page, XC_PAGE_SIZE);
 
+    if ( xenaccess->vm_event.fmem )
+        xenforeignmemory_close(xenaccess->vm_event.fmem);
+
     if ( mem_access_enable )
     {
         rc = xc_monitor_disable(xenaccess->xc_handle,
@@ -188,7 +200,42 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
     return 0;
 }
 
-xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
+/* Enable mem_access with a ring of ring_frames pages allocated by Xen. */
+static void *xenaccess_enable_frames(xenaccess_t *xenaccess,
+                                     unsigned int ring_frames)
+{
+    vm_event_t *vm_event = &xenaccess->vm_event;
+    void *ring = NULL;
+    int saved_errno;
+
+    if ( xc_monitor_enable_frames(xenaccess->xc_handle, vm_event->domain_id,
+                                  ring_frames, &vm_event->evtchn_port) )
+        return NULL;
+
+    vm_event->fmem = xenforeignmemory_open(NULL, 0);
+    if ( !vm_event->fmem )
+        goto err;
+
+    vm_event->fres = xenforeignmemory_map_resource(
+        vm_event->fmem, vm_event->domain_id, XENMEM_resource_vm_event,
+        XEN_DOMCTL_VM_EVENT_OP_MONITOR, 0, ring_frames, &ring,
+        PROT_READ | PROT_WRITE, 0);
+    if ( !vm_event->fres )
+        goto err;
+
+    vm_event->ring_frames = ring_frames;
+
+    return ring;
+
+ err:
+    saved_errno = errno;
+    xc_monitor_disable(xenaccess->xc_handle, vm_event->domain_id);
+    errno = saved_errno;
+    return NULL;
+}
+
+xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id,
+                            unsigned int ring_frames)
 {
     xenaccess_t *xenaccess = 0;
     xc_interface *xch;
@@ -212,7 +259,11 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     xenaccess->vm_event.domain_id = domain_id;
 
     /* Enable mem_access */
-    xenaccess->vm_event.ring_page =
+    if ( ring_frames )
+        xenaccess->vm_event.ring_page =
+            xenaccess_enable_frames(xenaccess, ring_frames);
+    else
+        xenaccess->vm_event.ring_page =
             xc_monitor_enable(xenaccess->xc_handle,
                               xenaccess->vm_event.domain_id,
                               &xenaccess->vm_event.evtchn_port);
@@ -254,11 +305,12 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     evtchn_bind = 1;
     xenaccess->vm_event.port = rc;
 
-    /* Initialise ring */
-    SHARED_RING_INIT((vm_event_sring_t *)xenaccess->vm_event.ring_page);
+    /* Initialise ring (Xen initialised the shared part of its own rings) */
+    if ( !ring_frames )
+        SHARED_RING_INIT((vm_event_sring_t *)xenaccess->vm_event.ring_page);
     BACK_RING_INIT(&xenaccess->vm_event.back_ring,
                    (vm_event_sring_t *)xenaccess->vm_event.ring_page,
-                   XC_PAGE_SIZE);
+                   (ring_frames ?: 1) * XC_PAGE_SIZE);
 
     /* Get max_gpfn */
     rc = xc_domain_maximum_gpfn(xenaccess->xc_handle,
@@ -357,9 +409,41 @@ static void put_response(vm_event_t *vm_event, vm_event_response_t *rsp)
     RING_PUSH_RESPONSES(back_ring);
 }
 
+/* Benchmark mode statistics, reported about once a second. */
+static struct {
+    struct timespec start;
+    unsigned long events, batches;
+} bench;
+
+static void benchmark_tick(unsigned long events)
+{
+    struct timespec now;
+    double elapsed;
+
+    if ( events )
+    {
+        bench.events += events;
+        bench.batches++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - bench.start.tv_sec) +
+              (now.tv_nsec - bench.start.tv_nsec) / 1e9;
+    if ( elapsed < 1 )
+        return;
+
+    printf("%.0f events/s, %.1f events per notification\n",
+           bench.events / elapsed,
+           bench.batches ? (double)bench.events / bench.batches : 0.0);
+    fflush(stdout);
+
+    bench.events = bench.batches = 0;
+    bench.start = now;
+}
+
 void usage(char* progname)
 {
-    fprintf(stderr, "Usage: %s [-m] <domain_id> write|exec", progname);
+    fprintf(stderr, "Usage: %s [-m] [-r <frames>] [-b] <domain_id> write|exec", progname);
 #if defined(__i386__) || defined(__x86_64__)
             fprintf(stderr, "|breakpoint|altp2m_write|altp2m_exec|debug|cpuid|desc_access|write_ctrlreg_cr4|altp2m_write_no_gpt");
 #elif defined(__arm__) || defined(__aarch64__)
@@ -369,7 +453,11 @@ void usage(char* progname)
             "\n"
             "Logs first page writes, execs, or breakpoint traps that occur on the domain.\n"
             "\n"
-            "-m requires this program to run, or else the domain may pause\n");
+            "-m requires this program to run, or else the domain may pause\n"
+            "-r uses a ring of <frames> pages (1-%u) allocated by Xen\n"
+            "-b measures event throughput: rather than logging accesses, they\n"
+            "   are emulated with the access restrictions left in place\n",
+            XEN_VM_EVENT_MAX_RING_FRAMES);
 }
 
 int main(int argc, char *argv[])
@@ -395,16 +483,31 @@ int main(int argc, char *argv[])
     int desc_access = 0;
     int write_ctrlreg_cr4 = 0;
     int altp2m_write_no_gpt = 0;
+    int benchmark = 0;
+    unsigned int ring_frames = 0;
     uint16_t altp2m_view_id = 0;
 
     char* progname = argv[0];
     argv++;
     argc--;
 
-    if ( argc == 3 && argv[0][0] == '-' )
+    while ( argc > 2 && argv[0][0] == '-' )
     {
         if ( !strcmp(argv[0], "-m") )
             required = 1;
+        else if ( !strcmp(argv[0], "-b") )
+            benchmark = 1;
+        else if ( !strcmp(argv[0], "-r") && argc > 3 )
+        {
+            ring_frames = atoi(argv[1]);
+            if ( !ring_frames || ring_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+            {
+                usage(progname);
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
         else
         {
             usage(progname);
@@ -488,7 +591,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    xenaccess = xenaccess_init(&xch, domain_id);
+    xenaccess = xenaccess_init(&xch, domain_id, ring_frames);
     if ( xenaccess == NULL )
     {
         ERROR("Error initialising xenaccess");
@@ -661,9 +764,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    if ( benchmark )
+        clock_gettime(CLOCK_MONOTONIC, &bench.start);
+
     /* Wait for access */
     for (;;)
     {
+        unsigned long handled = 0;
+
         if ( interrupted )
         {
             /* Unregister for every event */
@@ -726,6 +834,19 @@ int main(int argc, char *argv[])
             rsp.vcpu_id = req.vcpu_id;
             rsp.flags = (req.flags & VM_EVENT_FLAG_VCPU_PAUSED);
             rsp.reason = req.reason;
+            handled++;
+
+            if ( benchmark && req.reason == VM_EVENT_REASON_MEM_ACCESS )
+            {
+                /*
+                 * Keep the access restricted, and have Xen emulate the
+                 * faulting instruction, to sustain the stream of events.
+                 */
+                rsp.flags |= VM_EVENT_FLAG_EMULATE;
+                rsp.u.mem_access = req.u.mem_access;
+                put_response(&xenaccess->vm_event, &rsp);
+                continue;
+            }
 
             switch (req.reason) {
             case VM_EVENT_REASON_MEM_ACCESS:
@@ -911,6 +1032,9 @@ int main(int argc, char *argv[])
             interrupted = -1;
         }
 
+        if ( benchmark )
+            benchmark_tick(handled);
+
         if ( shutting_down )
             break;
     }
@@ -1,9 +1,18 @@
 /*
  * xen-lowmemd: demo VIRQ_ENOMEM
  * Andres Lagar-Cavilla (GridCentric Inc.)
+ *
+ * With -i <seconds>, additionally rebalance memory between guests which
+ * publish their memory pressure in xenstore, as
+ * /local/domain/<domid>/memory/pressure: the percentage of time (0-100,
+ * e.g. Linux's PSI "some avg10") tasks were stalled waiting for memory.
+ * Guests not publishing it are left alone.
  */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <xenevtchn.h>
 #include <xenctrl.h>
 #include <xenstore.h>
@@ -73,7 +82,8 @@ void handle_low_mem(void)
     printf("Shooting for dom0 target 0x%llx:%llu\n", 
             dom0_target, dom0_target);
 
-    snprintf(data, BUFSZ, "%llu", dom0_target);
+    /* The target is in KiB. */
+    snprintf(data, BUFSZ, "%llu", dom0_target << 2);
     if (!xs_write(xs_handle, XBT_NULL, 
             "/local/domain/0/memory/target", data, strlen(data)))
     {
@@ -82,9 +92,187 @@ void handle_low_mem(void)
     }
 }
 
+/* Guests below this pressure give memory back when the host runs low. */
+#define PRESSURE_LOW    5
+/* Guests above this pressure get more memory while the host has spare. */
+#define PRESSURE_HIGH   20
+
+/* Rate limit: move at most this much per guest and interval. */
+#define STEP_PG         ((64 << 20) >> 12)
+
+/* Never shrink a guest below 512 MiB */
+#define DOMU_FLOOR_PG   ((512 << 20) >> 12)
+
+#define MAX_DOMS 1024
+
+struct guest {
+    uint32_t domid;
+    unsigned int pressure;
+    unsigned long long target_pg, max_pg;
+};
+
+static int read_ull(uint32_t domid, const char *node, unsigned long long *val)
+{
+    char path[64], *data, *end;
+    unsigned int len;
+
+    snprintf(path, sizeof(path), "/local/domain/%u/memory/%s", domid, node);
+    data = xs_read(xs_handle, XBT_NULL, path, &len);
+    if (!data)
+        return -1;
+
+    *val = strtoull(data, &end, 10);
+    if (end == data) {
+        free(data);
+        return -1;
+    }
+    free(data);
+    return 0;
+}
+
+static int set_target(const struct guest *g, unsigned long long target_pg)
+{
+    char path[64], data[32];
+
+    snprintf(path, sizeof(path), "/local/domain/%u/memory/target", g->domid);
+    snprintf(data, sizeof(data), "%llu", target_pg << 2);
+    if (!xs_write(xs_handle, XBT_NULL, path, data, strlen(data))) {
+        perror("Failed to write target to xenstore");
+        return -1;
+    }
+
+    printf("d%u: pressure %u%%, target %llu -> %llu KiB\n", g->domid,
+           g->pressure, g->target_pg << 2, target_pg << 2);
+    return 0;
+}
+
+static int cmp_pressure(const void *a, const void *b)
+{
+    const struct guest *ga = a, *gb = b;
+
+    return (int)gb->pressure - (int)ga->pressure;
+}
+
+/*
+ * Take memory from relaxed guests while the host is short, hand spare
+ * memory to the most pressured guests first.  Growth is backed by a claim,
+ * so that a guest is only told to balloon up when the memory is there for
+ * it, and can't fail its allocations halfway through.
+ */
+static void rebalance(void)
+{
+    static struct guest guests[MAX_DOMS];
+    xc_dominfo_t info[64];
+    xc_physinfo_t phys;
+    unsigned long long avail, val;
+    unsigned int nr = 0, i;
+    uint32_t next = 1;
+    int n;
+
+    if (xc_physinfo(xch, &phys) < 0) {
+        perror("Getting physinfo failed");
+        return;
+    }
+    avail = phys.free_pages > phys.outstanding_pages
+            ? phys.free_pages - phys.outstanding_pages : 0;
+
+    while ((n = xc_domain_getinfo(xch, next, 64, info)) > 0) {
+        for (i = 0; i < n && nr < MAX_DOMS; i++) {
+            struct guest *g = &guests[nr];
+
+            next = info[i].domid + 1;
+            if (info[i].dying || info[i].shutdown)
+                continue;
+
+            g->domid = info[i].domid;
+            if (read_ull(g->domid, "pressure", &val))
+                continue;
+            g->pressure = val > 100 ? 100 : val;
+            if (read_ull(g->domid, "target", &val))
+                continue;
+            g->target_pg = val >> 2;
+            if (read_ull(g->domid, "static-max", &val))
+                continue;
+            g->max_pg = val >> 2;
+            nr++;
+        }
+        if (n < 64 || nr == MAX_DOMS)
+            break;
+    }
+
+    qsort(guests, nr, sizeof(*guests), cmp_pressure);
+
+    /* Short on memory: the least pressured guests give first. */
+    for (i = nr; avail < THRESHOLD_PG && i-- > 0; ) {
+        struct guest *g = &guests[i];
+        unsigned long long step = STEP_PG;
+
+        if (g->pressure >= PRESSURE_LOW)
+            break;
+        if (g->target_pg <= DOMU_FLOOR_PG)
+            continue;
+        if (g->target_pg - step < DOMU_FLOOR_PG)
+            step = g->target_pg - DOMU_FLOOR_PG;
+
+        /* Cancel a claim left over from growing this guest earlier. */
+        xc_domain_claim_pages(xch, g->domid, 0);
+        if (!set_target(g, g->target_pg - step))
+            avail += step;
+    }
+
+    /* Spare memory: the most pressured guests take first. */
+    for (i = 0; i < nr && avail >= THRESHOLD_PG + STEP_PG; i++) {
+        struct guest *g = &guests[i];
+        unsigned long long step = STEP_PG;
+        xc_dominfo_t d;
+
+        if (g->pressure <= PRESSURE_HIGH)
+            break;
+        if (g->target_pg >= g->max_pg)
+            continue;
+        if (g->target_pg + step > g->max_pg)
+            step = g->max_pg - g->target_pg;
+
+        if (xc_domain_getinfo(xch, g->domid, 1, &d) != 1 ||
+            d.domid != g->domid)
+            continue;
+
+        /* Only one claim per domain: replace whatever is left of the last. */
+        xc_domain_claim_pages(xch, g->domid, 0);
+        if (xc_domain_claim_pages(xch, g->domid, d.nr_pages + step)) {
+            printf("d%u: cannot claim %llu pages: %s\n", g->domid, step,
+                   strerror(errno));
+            continue;
+        }
+
+        if (set_target(g, g->target_pg + step))
+            xc_domain_claim_pages(xch, g->domid, 0);
+        else
+            avail -= step;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-i <seconds>]\n", prog);
+}
+
 int main(int argc, char *argv[])
 {
-    int rc;
+    int rc, opt, interval = 0;
+
+    while ((opt = getopt(argc, argv, "i:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
 
     atexit(cleanup);
 
@@ -120,6 +308,24 @@ int main(int argc, char *argv[])
     while(1)
     {
         evtchn_port_t port;
+        struct pollfd pfd = {
+            .fd = xenevtchn_fd(xce_handle),
+            .events = POLLIN,
+        };
+
+        rc = poll(&pfd, 1, interval > 0 ? interval * 1000 : -1);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to poll event channel");
+            return 5;
+        }
+        if (rc == 0)
+        {
+            rebalance();
+            continue;
+        }
 
         if ((port = xenevtchn_pending(xce_handle)) == -1)
         {
@@ -143,6 +349,8 @@ int main(int argc, char *argv[])
 
         printf("Got a virq kick, time to get work\n");
         handle_low_mem();
+        if (interval > 0)
+            rebalance();
     }
 
     return 0;
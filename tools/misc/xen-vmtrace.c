@@ -24,12 +24,17 @@
 
 #include <err.h>
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 
 #include <xenctrl.h>
+#include <xenevtchn.h>
 #include <xenforeignmemory.h>
 
 #define MSR_RTIT_CTL                        0x00000570
@@ -39,9 +44,13 @@
 
 static xc_interface *xch;
 static xenforeignmemory_handle *fh;
+static xenevtchn_handle *xce;
 static uint32_t domid, vcpu;
 static size_t size;
 static char *buf;
+static bool stream;
+static unsigned int half; /* Next half to drain, in streaming mode. */
+static uint64_t lost;
 
 static sig_atomic_t interrupted;
 static void close_handler(int signum)
@@ -73,10 +82,74 @@ static int get_more_data(void)
     return 0;
 }
 
+/*
+ * Streaming mode: write out the halves handed over by Xen, in order.  The
+ * output is the raw trace, as a perf AUX area would hold it, suitable for
+ * e.g. libipt's ptdump/ptxed.
+ */
+static int drain_halves(bool flush)
+{
+    for ( ;; )
+    {
+        uint64_t len, wraps;
+
+        if ( xc_vmtrace_stream_next(xch, domid, vcpu, flush, &len, &wraps) )
+        {
+            perror("xc_vmtrace_stream_next()");
+            return -1;
+        }
+
+        lost += wraps;
+        if ( !len )
+            return 0;
+
+        fwrite(buf + half * (size / 2), len, 1, stdout);
+        half ^= 1;
+
+        if ( xc_vmtrace_stream_ack(xch, domid, vcpu) )
+        {
+            perror("xc_vmtrace_stream_ack()");
+            return -1;
+        }
+    }
+}
+
+static int wait_for_data(void)
+{
+    struct pollfd pfd = {
+        .fd = xenevtchn_fd(xce),
+        .events = POLLIN,
+    };
+    xenevtchn_port_or_error_t port;
+
+    if ( poll(&pfd, 1, 100) <= 0 )
+        return 0;
+
+    port = xenevtchn_pending(xce);
+    if ( port >= 0 )
+        xenevtchn_unmask(xce, port);
+
+    return drain_halves(false);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s [-b] [-t threshold]] <domid> <vcpu_id>\n",
+            prog);
+    fprintf(stderr, "  -s  stream: drain each half of the buffer as it fills,\n");
+    fprintf(stderr, "      rather than polling, so that no data is lost\n");
+    fprintf(stderr, "  -b  pause the vcpu if the output can't keep up\n");
+    fprintf(stderr, "  -t  bytes in a half at which to drain it\n");
+    fprintf(stderr, "It's recommended to redirect thisprogram's output to file\n");
+    fprintf(stderr, "or to pipe it's output to xxd or other program.\n");
+}
+
 int main(int argc, char **argv)
 {
-    int rc, exit = 1;
+    int rc, opt, exit = 1;
     xenforeignmemory_resource_handle *fres = NULL;
+    uint32_t threshold = 0, flags = 0;
+    evtchn_port_t remote_port;
 
     struct sigaction act;
     act.sa_handler = close_handler;
@@ -87,16 +160,33 @@ int main(int argc, char **argv)
     sigaction(SIGINT,  &act, NULL);
     sigaction(SIGALRM, &act, NULL);
 
-    if ( argc != 3 )
+    while ( (opt = getopt(argc, argv, "sbt:")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 's':
+            stream = true;
+            break;
+        case 'b':
+            flags |= XEN_DOMCTL_VMTRACE_STREAM_block;
+            break;
+        case 't':
+            threshold = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ( argc - optind != 2 || (!stream && (flags || threshold)) )
     {
-        fprintf(stderr, "Usage: %s <domid> <vcpu_id>\n", argv[0]);
-        fprintf(stderr, "It's recommended to redirect thisprogram's output to file\n");
-        fprintf(stderr, "or to pipe it's output to xxd or other program.\n");
+        usage(argv[0]);
         return 1;
     }
 
-    domid = atoi(argv[1]);
-    vcpu  = atoi(argv[2]);
+    domid = atoi(argv[optind]);
+    vcpu  = atoi(argv[optind + 1]);
 
     xch = xc_interface_open(NULL, NULL, 0);
     fh = xenforeignmemory_open(NULL, 0);
@@ -117,6 +207,23 @@ int main(int argc, char **argv)
     if ( !fres )
         err(1, "xenforeignmemory_map_resource()");
 
+    if ( stream )
+    {
+        xce = xenevtchn_open(NULL, 0);
+        if ( !xce )
+            err(1, "xenevtchn_open()");
+
+        if ( xc_vmtrace_stream_enable(xch, domid, vcpu, threshold, flags,
+                                      &remote_port) )
+            err(1, "xc_vmtrace_stream_enable()");
+
+        if ( xenevtchn_bind_interdomain(xce, domid, remote_port) < 0 )
+        {
+            perror("xenevtchn_bind_interdomain()");
+            goto out;
+        }
+    }
+
     if ( xc_vmtrace_set_option(
              xch, domid, vcpu, MSR_RTIT_CTL,
              RTIT_CTL_BRANCH_EN | RTIT_CTL_USR | RTIT_CTL_OS) )
@@ -135,15 +242,16 @@ int main(int argc, char **argv)
     {
         xc_dominfo_t dominfo;
 
-        if ( get_more_data() )
+        if ( stream ? wait_for_data() : get_more_data() )
             goto out;
 
-        usleep(1000 * 100);
+        if ( !stream )
+            usleep(1000 * 100);
 
         if ( xc_domain_getinfo(xch, domid, 1, &dominfo) != 1 ||
              dominfo.domid != domid || dominfo.shutdown )
         {
-            if ( get_more_data() )
+            if ( !stream && get_more_data() )
                 goto out;
             break;
         }
@@ -155,6 +263,21 @@ int main(int argc, char **argv)
     if ( xc_vmtrace_disable(xch, domid, vcpu) )
         perror("xc_vmtrace_disable()");
 
+    if ( stream )
+    {
+        /* Collect what is left in both halves. */
+        if ( drain_halves(true) )
+            exit = 1;
+
+        if ( xc_vmtrace_stream_disable(xch, domid, vcpu) )
+            perror("xc_vmtrace_stream_disable()");
+
+        if ( lost )
+            fprintf(stderr, "Trace data lost %"PRIu64" time(s)\n", lost);
+
+        xenevtchn_close(xce);
+    }
+
     if ( fres && xenforeignmemory_unmap_resource(fh, fres) )
         perror("xenforeignmemory_unmap_resource()");
 
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -165,8 +166,36 @@ static int xenhypfs_tree_sub(const char *path, unsigned int depth)
     return ret;
 }
 
+static int xenhypfs_tree_print(const char *path,
+                               const struct xenhypfs_dirent *dirent,
+                               const void *content, void *arg)
+{
+    const char *name = strrchr(path, '/') + 1;
+    unsigned int depth = 0;
+
+    if (!*name) {
+        printf("/\n");
+        return 0;
+    }
+
+    for (; *path; path++)
+        depth += *path == '/';
+
+    printf("%*s%s%s\n", depth * 2, "", name,
+           dirent->type == xenhypfs_type_dir ? "/" : "");
+
+    return 0;
+}
+
 static int xenhypfs_tree(void)
 {
+    if (!xenhypfs_read_tree(hdl, "/", xenhypfs_tree_print, NULL))
+        return 0;
+
+    if (errno != EOPNOTSUPP)
+        return 2;
+
+    /* Hypervisor without XEN_HYPFS_OP_read_tree. */
     printf("/\n");
 
     return xenhypfs_tree_sub("/", 1);
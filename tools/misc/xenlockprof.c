@@ -17,32 +17,17 @@
 #include <errno.h>
 #include <string.h>
 #include <inttypes.h>
+#include <getopt.h>
 
-int main(int argc, char *argv[])
+static int lockprof(xc_interface *xc_handle, int reset)
 {
-    xc_interface      *xc_handle;
     uint32_t           i, j, n;
     uint64_t           time;
     double             l, b, sl, sb;
     char               name[100];
     DECLARE_HYPERCALL_BUFFER(xc_lockprof_data_t, data);
 
-    if ( (argc > 2) || ((argc == 2) && (strcmp(argv[1], "-r") != 0)) )
-    {
-        printf("%s: [-r]\n", argv[0]);
-        printf("no args: print lock profile data\n");
-        printf("    -r : reset profile data\n");
-        return 1;
-    }
-
-    if ( (xc_handle = xc_interface_open(0,0,0)) == 0 )
-    {
-        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
-                errno, strerror(errno));
-        return 1;
-    }
-
-    if ( argc > 1 )
+    if ( reset )
     {
         if ( xc_lockprof_reset(xc_handle) != 0 )
         {
@@ -118,3 +103,275 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+
+struct lockcont {
+    uint64_t lock;
+    uint64_t caller;
+    const char *caller_name;
+    uint64_t count;
+    uint64_t wait_time;
+    uint64_t wait_max;
+    uint64_t hist[XEN_SYSCTL_LOCKCONT_BUCKETS];
+    uint64_t lock_wait;          /* wait_time summed over all callers */
+};
+
+static int cmp_pair(const void *a, const void *b)
+{
+    const xc_lockcont_data_t *x = a, *y = b;
+
+    if ( x->lock != y->lock )
+        return x->lock < y->lock ? -1 : 1;
+    if ( x->caller != y->caller )
+        return x->caller < y->caller ? -1 : 1;
+    return 0;
+}
+
+static int cmp_wait(const void *a, const void *b)
+{
+    const struct lockcont *x = a, *y = b;
+
+    if ( x->lock_wait != y->lock_wait )
+        return x->lock_wait > y->lock_wait ? -1 : 1;
+    if ( x->lock != y->lock )
+        return x->lock < y->lock ? -1 : 1;
+    if ( x->wait_time != y->wait_time )
+        return x->wait_time > y->wait_time ? -1 : 1;
+    return 0;
+}
+
+/* Upper bound, in us, of the histogram bucket holding the given fraction. */
+static const char *hist_pct(const struct lockcont *c, double frac,
+                            char *buf, size_t size)
+{
+    uint64_t sum = 0, want = c->count * frac;
+    unsigned int i;
+
+    for ( i = 0; i < XEN_SYSCTL_LOCKCONT_BUCKETS - 1; i++ )
+    {
+        sum += c->hist[i];
+        if ( sum > want )
+            break;
+    }
+
+    if ( i == XEN_SYSCTL_LOCKCONT_BUCKETS - 1 )
+        snprintf(buf, size, ">%uus", 1u << (i - 1));
+    else
+        snprintf(buf, size, "<%uus", 1u << i);
+
+    return buf;
+}
+
+static int lockcont(xc_interface *xc_handle, long enable, int disable,
+                    int reset, unsigned int top)
+{
+    uint32_t           i, j, n, period;
+    uint64_t           time, dropped;
+    unsigned int       nr_locks;
+    struct lockcont   *c = NULL;
+    char               p50[16], p99[16];
+    DECLARE_HYPERCALL_BUFFER(xc_lockcont_data_t, data);
+
+    if ( enable >= 0 || disable || reset )
+    {
+        int rc;
+
+        if ( enable >= 0 )
+            rc = xc_lockcont_enable(xc_handle, enable);
+        else if ( disable )
+            rc = xc_lockcont_disable(xc_handle);
+        else
+            rc = xc_lockcont_reset(xc_handle);
+
+        if ( rc != 0 )
+        {
+            fprintf(stderr, "Error controlling contention sampling: %d (%s)\n",
+                    errno, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    n = 0;
+    if ( xc_lockcont_query_number(xc_handle, &n) != 0 )
+    {
+        fprintf(stderr, "Error getting number of contention records: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    n += 256;   /* new samples may arrive meanwhile */
+    data = xc_hypercall_buffer_alloc(xc_handle, data, sizeof(*data) * n);
+    c = calloc(n, sizeof(*c));
+    if ( data == NULL || c == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    i = n;
+    if ( xc_lockcont_query(xc_handle, &i, &period, &time, &dropped,
+                           HYPERCALL_BUFFER(data)) != 0 )
+    {
+        fprintf(stderr, "Error getting contention records: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( i > n )
+    {
+        printf("data incomplete, %d records are missing!\n\n", i - n);
+        i = n;
+    }
+
+    /* Fold the per-CPU records of each (lock, caller) pair together. */
+    qsort(data, i, sizeof(*data), cmp_pair);
+    for ( j = 0, n = 0; j < i; j++ )
+    {
+        struct lockcont *p;
+        unsigned int k;
+
+        if ( !n || c[n - 1].lock != data[j].lock ||
+             c[n - 1].caller != data[j].caller )
+        {
+            p = &c[n++];
+            p->lock = data[j].lock;
+            p->caller = data[j].caller;
+            p->caller_name = data[j].caller_name;
+        }
+        else
+            p = &c[n - 1];
+
+        p->count += data[j].count;
+        p->wait_time += data[j].wait_time;
+        if ( data[j].wait_max > p->wait_max )
+            p->wait_max = data[j].wait_max;
+        for ( k = 0; k < XEN_SYSCTL_LOCKCONT_BUCKETS; k++ )
+            p->hist[k] += data[j].hist[k];
+    }
+
+    /* Rank locks by their total wait time, callers likewise within each. */
+    for ( i = 0; i < n; i = j )
+    {
+        uint64_t sum = 0;
+
+        for ( j = i; j < n && c[j].lock == c[i].lock; j++ )
+            sum += c[j].wait_time;
+        while ( i < j )
+            c[i++].lock_wait = sum;
+    }
+    qsort(c, n, sizeof(*c), cmp_wait);
+
+    printf("contention sampling %s", period ? "enabled" : "disabled");
+    if ( period )
+        printf(", 1 in %u contended acquisitions", period);
+    printf(", %20.9fs\n", (double)time / 1E+09);
+    if ( dropped )
+        printf("%"PRIu64" samples dropped, per-CPU tables full\n", dropped);
+
+    for ( i = 0, nr_locks = 0; i < n; i++ )
+    {
+        if ( !i || c[i].lock != c[i - 1].lock )
+        {
+            if ( nr_locks++ == top )
+                break;
+            printf("\nlock %#"PRIx64": waited %14.9fs\n",
+                   c[i].lock, (double)c[i].lock_wait / 1E+09);
+        }
+
+        printf("  %-48s samples:%10"PRIu64" wait:%14.9fs avg:%9.3fus "
+               "max:%9.3fus p50:%s p99:%s\n",
+               c[i].caller_name[0] ? c[i].caller_name : "?",
+               c[i].count, (double)c[i].wait_time / 1E+09,
+               (double)c[i].wait_time / c[i].count / 1E+03,
+               (double)c[i].wait_max / 1E+03,
+               hist_pct(&c[i], 0.5, p50, sizeof(p50)),
+               hist_pct(&c[i], 0.99, p99, sizeof(p99)));
+    }
+
+    free(c);
+    xc_hypercall_buffer_free(xc_handle, data);
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("%s: [-r]\n", prog);
+    printf("no args: print lock profile data\n");
+    printf("    -r : reset profile data\n");
+    printf("%s: -c [-n <locks> | -e <period> | -d | -r]\n", prog);
+    printf("    -c : print sampled lock contention data\n");
+    printf("    -n : number of most contended locks to print (default 10)\n");
+    printf("    -e : sample 1 in <period> contended acquisitions\n");
+    printf("    -d : stop sampling\n");
+    printf("    -r : discard sampled data\n");
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface      *xc_handle;
+    int                c, cont = 0, reset = 0, disable = 0;
+    long               enable = -1;
+    unsigned int       top = 10;
+    char              *end;
+    int                rc;
+
+    while ( (c = getopt(argc, argv, "rcn:e:dh")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'r':
+            reset = 1;
+            break;
+        case 'c':
+            cont = 1;
+            break;
+        case 'n':
+            top = strtoul(optarg, &end, 0);
+            if ( *end || !top )
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            enable = strtol(optarg, &end, 0);
+            if ( *end || enable <= 0 || enable > UINT32_MAX )
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            disable = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ( optind != argc || (!cont && (enable >= 0 || disable)) ||
+         (reset + disable + (enable >= 0)) > 1 )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ( (xc_handle = xc_interface_open(0,0,0)) == 0 )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( cont )
+        rc = lockcont(xc_handle, enable, disable, reset, top);
+    else
+        rc = lockprof(xc_handle, reset);
+
+    xc_interface_close(xc_handle);
+
+    return rc;
+}
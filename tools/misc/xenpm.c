@@ -134,6 +134,15 @@ static void print_cxstat(int cpuid, struct xc_cx_stat *cxstat)
         if ( cxstat->cc[i] )
            printf("cc%d                  : [%20"PRIu64" ms]\n", i + 1,
                   cxstat->cc[i] / 1000000UL);
+    if ( cxstat->pred_hit || cxstat->pred_early || cxstat->pred_late )
+    {
+        printf("idle prediction      : hit   [%20"PRIu64"]\n",
+               cxstat->pred_hit);
+        printf("                       early [%20"PRIu64"]\n",
+               cxstat->pred_early);
+        printf("                       late  [%20"PRIu64"]\n",
+               cxstat->pred_late);
+    }
     printf("\n");
 }
 
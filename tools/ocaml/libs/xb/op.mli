@@ -20,6 +20,8 @@ type operation =
   | Resume
   | Set_target
   | Reset_watches
+  | Directory_part
+  | Multi
   | Invalid
 val operation_c_mapping : operation array
 val size : int
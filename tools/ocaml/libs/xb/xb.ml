@@ -123,6 +123,8 @@ type backend_mmap =
     mmap: Xenmmap.mmap_interface;     (* mmaped interface = xs_ring *)
     eventchn_notify: unit -> unit; (* function to notify through eventchn *)
     mutable work_again: bool;
+    mutable batching: bool; (* hold back notifications until the batch ends *)
+    mutable notify_pending: bool;
   }
 
 type backend_fd =
@@ -195,13 +197,19 @@ let read_fd back _con b len =
     raise End_of_file;
   rd
 
+let notify_mmap back =
+  if back.batching then
+    back.notify_pending <- true
+  else
+    back.eventchn_notify ()
+
 let read_mmap back _con b len =
   let s = Bytes.make len '\000' in
   let rd = Xs_ring.read back.mmap s len in
   Bytes.blit s 0 b 0 rd;
   back.work_again <- (rd > 0);
   if rd > 0 then
-    back.eventchn_notify ();
+    notify_mmap back;
   rd
 
 let read con b len =
@@ -215,7 +223,7 @@ let write_fd back _con b len =
 let write_mmap back _con s len =
   let ws = Xs_ring.write_substring back.mmap s len in
   if ws > 0 then
-    back.eventchn_notify ();
+    notify_mmap back;
   ws
 
 let write con s len =
@@ -223,6 +231,22 @@ let write con s len =
   | Fd backfd     -> write_fd backfd con s len
   | Xenmmap backmmap -> write_mmap backmmap con s len
 
+(* run [f] with ring notifications coalesced: however many requests it
+   consumes and replies it writes, the other end gets a single kick *)
+let batch con f =
+  match con.backend with
+  | Fd _ -> f ()
+  | Xenmmap back ->
+    back.batching <- true;
+    let flush () =
+      back.batching <- false;
+      if back.notify_pending then (
+        back.notify_pending <- false;
+        back.eventchn_notify ()
+      ) in
+    (try f () with exn -> flush (); raise exn);
+    flush ()
+
 (* NB: can throw Reconnect *)
 let output con =
   (* get the output string from a string_of(packet) or partial_out *)
@@ -303,7 +327,9 @@ let open_mmap mmap notifyfct =
   newcon (Xenmmap {
       mmap = mmap;
       eventchn_notify = notifyfct;
-      work_again = false; })
+      work_again = false;
+      batching = false;
+      notify_pending = false; })
 
 let close con =
   match con.backend with
@@ -23,6 +23,8 @@ sig
     | Resume
     | Set_target
     | Reset_watches
+    | Directory_part
+    | Multi
     | Invalid
   val operation_c_mapping : operation array
   val size : int
@@ -62,6 +64,8 @@ type backend_mmap = {
   mmap : Xenmmap.mmap_interface;
   eventchn_notify : unit -> unit;
   mutable work_again : bool;
+  mutable batching : bool;
+  mutable notify_pending : bool;
 }
 type backend_fd = { fd : Unix.file_descr; }
 type backend = Fd of backend_fd | Xenmmap of backend_mmap
@@ -77,6 +81,7 @@ val read : t -> bytes -> int -> int
 val write_fd : backend_fd -> 'a -> string -> int -> int
 val write_mmap : backend_mmap -> 'a -> string -> int -> int
 val write : t -> string -> int -> int
+val batch : t -> (unit -> unit) -> unit
 val output : t -> bool
 val input : t -> Packet.t option
 val newcon : capacity:capacity -> backend -> t
@@ -50,6 +50,7 @@ type x86_arch_emulation_flags =
 
 type x86_arch_misc_flags =
   | X86_MSR_RELAXED
+  | X86_IPI_VIRT
 
 type xen_x86_arch_domainconfig =
   {
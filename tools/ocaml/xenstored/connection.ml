@@ -110,9 +110,20 @@ and t = {
   anonid: int;
   mutable stat_nb_ops: int;
   mutable perm: Perms.Connection.t;
+  mutable dir_cursor: dir_cursor option;
   pending_source_watchevents: (watch * Xenbus.Xb.Packet.t) BoundedPipe.t
 }
 
+(* last child list served by XS_DIRECTORY_PART: clients page through a
+   large directory with several requests, so keep the serialized list
+   around as long as the node it was built from is unchanged *)
+and dir_cursor = {
+  dir_path: string;
+  dir_node: Store.Node.t;
+  dir_gen: string;
+  dir_children: string;
+}
+
 module Watch = struct
   module T = struct
     type t = watch
@@ -213,6 +224,7 @@ let create xbcon dom =
       anonid = id;
       stat_nb_ops = 0;
       perm = make_perm dom;
+      dir_cursor = None;
 
       (* the actual capacity will be lower, this is used as an overflow
          	   buffer: anything that doesn't fit elsewhere gets put here, only
@@ -415,6 +427,8 @@ let has_new_output con = Xenbus.Xb.has_new_output con.xb
 let peek_output con = Xenbus.Xb.peek_output con.xb
 let do_output con = Xenbus.Xb.output con.xb
 
+let batch con f = Xenbus.Xb.batch con.xb f
+
 let is_bad con = match con.dom with None -> false | Some dom -> Domain.is_bad_domain dom
 
 (* oxenstored currently only dumps limited information about its state.
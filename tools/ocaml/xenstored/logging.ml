@@ -226,6 +226,8 @@ let string_of_access_type = function
     | Xenbus.Xb.Op.Debug             -> "debug    "
 
     | Xenbus.Xb.Op.Directory         -> "directory"
+    | Xenbus.Xb.Op.Directory_part    -> "dirpart  "
+    | Xenbus.Xb.Op.Multi             -> "multi    "
     | Xenbus.Xb.Op.Read              -> "read     "
     | Xenbus.Xb.Op.Getperms          -> "getperms "
 
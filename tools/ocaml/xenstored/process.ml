@@ -264,6 +264,54 @@ let do_directory con t _domains _cons data =
   else
     ""
 
+(* The node generation handed out with each part is a digest of the full
+   child list, so that it only changes when the list does and replaying a
+   transaction yields the same reply. *)
+let directory_cursor con t path =
+  let node = Transaction.ls_node t (Connection.get_perm con) path in
+  let spath = Store.Path.to_string path in
+  match con.Connection.dir_cursor with
+  | Some c when c.Connection.dir_node == node && c.Connection.dir_path = spath -> c
+  | _ ->
+    let children =
+      Store.SymbolMap.fold (fun k _ accu -> Symbol.to_string k :: accu)
+        (Store.Node.get_children node) [] in
+    let children = String.concat "" (List.map (fun c -> c ^ "\000") children) in
+    let c = { Connection.dir_path = spath;
+              Connection.dir_node = node;
+              Connection.dir_gen = Digest.to_hex (Digest.string children);
+              Connection.dir_children = children } in
+    con.Connection.dir_cursor <- Some c;
+    c
+
+let do_directory_part con t _domains _cons data =
+  let path, off =
+    match split None '\000' data with
+    | path :: off :: _ ->
+      Store.Path.create path (Connection.get_path con),
+      (try int_of_string off with _ -> raise Invalid_Cmd_Args)
+    | _ -> raise Invalid_Cmd_Args
+  in
+  let c = directory_cursor con t path in
+  let children = c.Connection.dir_children in
+  let childlen = String.length children in
+  let gen = c.Connection.dir_gen ^ "\000" in
+  if off < 0 || off >= childlen then
+    gen ^ "\000"
+  else (
+    (* only whole names, as many as fit in one reply *)
+    let maxlen = Xenbus.Partial.xenstore_payload_max - String.length gen - 1 in
+    let rec fit len =
+      if off + len = childlen then len
+      else
+        let next = String.index_from children (off + len) '\000' + 1 - off in
+        if next - 1 < maxlen then fit next else len
+    in
+    let len = fit 0 in
+    let part = String.sub children off len in
+    if off + len = childlen then gen ^ part ^ "\000" else gen ^ part
+  )
+
 let do_read con t _domains _cons data =
   let path = split_one_path data con in
   Transaction.read t (Connection.get_perm con) path
@@ -373,8 +421,70 @@ let reply_none fct con t doms cons data =
   (* let the function reply *)
   fct con t doms cons data
 
+let input_handle_error ~cons ~doms ~fct ~con ~t ~req =
+  let reply_error e =
+    Packet.Error e in
+  try
+    Transaction.check_quota_exn ~perm:(Connection.get_perm con) t;
+    fct con t doms cons req.Packet.data
+  with
+  | Define.Invalid_path          -> reply_error "EINVAL"
+  | Define.Already_exist         -> reply_error "EEXIST"
+  | Define.Doesnt_exist          -> reply_error "ENOENT"
+  | Define.Lookup_Doesnt_exist _ -> reply_error "ENOENT"
+  | Define.Permission_denied     -> reply_error "EACCES"
+  | Not_found                    -> reply_error "ENOENT"
+  | Invalid_Cmd_Args             -> reply_error "EINVAL"
+  | Invalid_argument _           -> reply_error "EINVAL"
+  | Transaction_again            -> reply_error "EAGAIN"
+  | Transaction_nested           -> reply_error "EBUSY"
+  | Domain_not_match             -> reply_error "EINVAL"
+  | Quota.Limit_reached          -> reply_error "EQUOTA"
+  | Quota.Data_too_big           -> reply_error "E2BIG"
+  | Quota.Transaction_opened     -> reply_error "EQUOTA"
+  | (Failure "int_of_string")    -> reply_error "EINVAL"
+  | Define.Unknown_operation     -> reply_error "ENOSYS"
+
+(* Operations allowed in XS_MULTI: only those acting on nodes *)
+let multi_op_allowed = function
+  | Xenbus.Xb.Op.Directory
+  | Xenbus.Xb.Op.Directory_part
+  | Xenbus.Xb.Op.Read
+  | Xenbus.Xb.Op.Getperms
+  | Xenbus.Xb.Op.Write
+  | Xenbus.Xb.Op.Mkdir
+  | Xenbus.Xb.Op.Rm
+  | Xenbus.Xb.Op.Setperms -> true
+  | _                     -> false
+
+(* The operations of XS_MULTI are complete messages, header and payload *)
+let multi_split_ops data off =
+  let hdrlen = Xenbus.Partial.header_size () in
+  let rec split off acc =
+    if off = String.length data then List.rev acc
+    else if String.length data - off < hdrlen then raise Invalid_Cmd_Args
+    else
+      let tid, rid, ty, len =
+        Xenbus.Partial.header_of_string_internal (String.sub data off hdrlen) in
+      let off = off + hdrlen in
+      if len > String.length data - off then raise Invalid_Cmd_Args;
+      let req = { Packet.tid = tid; Packet.rid = rid;
+                  Packet.ty = Xenbus.Xb.Op.of_cval ty;
+                  Packet.data = String.sub data off len } in
+      split (off + len) (req :: acc)
+  in
+  split off []
+
+let multi_reply (req, response) =
+  let ty, data = match response with
+    | Packet.Ack _   -> req.Packet.ty, "OK\000"
+    | Packet.Reply x -> req.Packet.ty, x
+    | Packet.Error e -> Xenbus.Xb.Op.Error, e ^ "\000" in
+  Xenbus.Xb.Packet.to_string
+    (Xenbus.Xb.Packet.create req.Packet.tid req.Packet.rid ty data)
+
 (* Functions for 'simple' operations that cannot be part of a transaction *)
-let function_of_type_simple_op ty =
+let rec function_of_type_simple_op ty =
   match ty with
   | Xenbus.Xb.Op.Debug
   | Xenbus.Xb.Op.Watch
@@ -390,6 +500,7 @@ let function_of_type_simple_op ty =
   | Xenbus.Xb.Op.Invalid           -> error "called function_of_type_simple_op on operation %s" (Xenbus.Xb.Op.to_string ty);
     raise (Invalid_argument (Xenbus.Xb.Op.to_string ty))
   | Xenbus.Xb.Op.Directory         -> reply_data do_directory
+  | Xenbus.Xb.Op.Directory_part    -> reply_data do_directory_part
   | Xenbus.Xb.Op.Read              -> reply_data do_read
   | Xenbus.Xb.Op.Getperms          -> reply_data do_getperms
   | Xenbus.Xb.Op.Getdomainpath     -> reply_data do_getdomainpath
@@ -397,31 +508,63 @@ let function_of_type_simple_op ty =
   | Xenbus.Xb.Op.Mkdir             -> reply_ack do_mkdir
   | Xenbus.Xb.Op.Rm                -> reply_ack do_rm
   | Xenbus.Xb.Op.Setperms          -> reply_ack do_setperms
+  | Xenbus.Xb.Op.Multi             -> reply_data do_multi
   | _                              -> reply_ack do_error
 
-let input_handle_error ~cons ~doms ~fct ~con ~t ~req =
-  let reply_error e =
-    Packet.Error e in
-  try
-    Transaction.check_quota_exn ~perm:(Connection.get_perm con) t;
-    fct con t doms cons req.Packet.data
-  with
-  | Define.Invalid_path          -> reply_error "EINVAL"
-  | Define.Already_exist         -> reply_error "EEXIST"
-  | Define.Doesnt_exist          -> reply_error "ENOENT"
-  | Define.Lookup_Doesnt_exist _ -> reply_error "ENOENT"
-  | Define.Permission_denied     -> reply_error "EACCES"
-  | Not_found                    -> reply_error "ENOENT"
-  | Invalid_Cmd_Args             -> reply_error "EINVAL"
-  | Invalid_argument _           -> reply_error "EINVAL"
-  | Transaction_again            -> reply_error "EAGAIN"
-  | Transaction_nested           -> reply_error "EBUSY"
-  | Domain_not_match             -> reply_error "EINVAL"
-  | Quota.Limit_reached          -> reply_error "EQUOTA"
-  | Quota.Data_too_big           -> reply_error "E2BIG"
-  | Quota.Transaction_opened     -> reply_error "EQUOTA"
-  | (Failure "int_of_string")    -> reply_error "EINVAL"
-  | Define.Unknown_operation     -> reply_error "ENOSYS"
+(* XS_MULTI: "T" (all or nothing) or "F", followed by the operations.  They
+   are run in order up to the first failing one, and the reply holds the
+   reply message of each operation run. *)
+and do_multi con t domains cons data =
+  let nul = try String.index data '\000' with Not_found -> raise Invalid_Cmd_Args in
+  let atomic = match String.sub data 0 nul with
+    | "T" -> true
+    | "F" -> false
+    | _   -> raise Invalid_Cmd_Args in
+  let ops = multi_split_ops data (nul + 1) in
+  let tid = Transaction.get_id t in
+  if atomic && tid <> Transaction.none then
+    raise Transaction_nested;
+  (* outside of a transaction each operation is applied, and fires its
+     watches, on its own as if it had come in a message of its own *)
+  let run ~apply t_of =
+    let rec loop acc = function
+      | [] -> List.rev acc, true
+      | req :: rest ->
+        let ty = req.Packet.ty in
+        let response =
+          if multi_op_allowed ty then
+            input_handle_error ~cons ~doms:domains
+              ~fct:(function_of_type_simple_op ty) ~con ~t:(t_of ()) ~req
+          else
+            Packet.Error "EINVAL" in
+        let acc = (req, response) :: acc in
+        match response with
+        | Packet.Error _ -> List.rev acc, false
+        | Packet.Ack f   -> if apply then f (); loop acc rest
+        | Packet.Reply _ -> loop acc rest
+    in
+    loop [] ops
+  in
+  let replies =
+    if tid <> Transaction.none then
+      fst (run ~apply:false (fun () -> t))
+    else begin
+      let store = Transaction.get_store t in
+      let single () = Transaction.make Transaction.none store in
+      if atomic then begin
+        (* try them on a copy first, and only apply them if all succeed:
+           nothing can change the store in between *)
+        let trial_t = Transaction.make ~internal:true Transaction.none (Store.copy store) in
+        let trial, ok = run ~apply:false (fun () -> trial_t) in
+        if ok then fst (run ~apply:true single) else trial
+      end else
+        fst (run ~apply:true single)
+    end
+  in
+  let reply = String.concat "" (List.map multi_reply replies) in
+  if String.length reply > Xenbus.Partial.xenstore_payload_max then
+    raise Quota.Data_too_big;
+  reply
 
 let write_access_log ~ty ~tid ~con ~data =
   Logging.xb_op ~ty ~tid ~con data
@@ -636,9 +779,11 @@ let retain_op_in_history ty =
   | Xenbus.Xb.Op.Write
   | Xenbus.Xb.Op.Mkdir
   | Xenbus.Xb.Op.Rm
-  | Xenbus.Xb.Op.Setperms          -> true
+  | Xenbus.Xb.Op.Setperms
+  | Xenbus.Xb.Op.Multi             -> true
   | Xenbus.Xb.Op.Debug
   | Xenbus.Xb.Op.Directory
+  | Xenbus.Xb.Op.Directory_part
   | Xenbus.Xb.Op.Read
   | Xenbus.Xb.Op.Getperms
   | Xenbus.Xb.Op.Watch
@@ -763,3 +908,23 @@ let do_output _store _cons _doms con =
       info "%s reconnection complete" (Connection.get_domstr con)
   )
 
+(* Serve a domain's ring in batches: consume every complete request already
+   on the ring (up to [ring_batch], so one busy guest cannot starve the
+   others), push out as many replies as fit, and kick the event channel
+   only once for all of it. *)
+let ring_batch = 64
+
+let do_io store cons doms con =
+  Connection.batch con (fun () ->
+      let rec drain n =
+        do_input store cons doms con;
+        if n > 1 && not (Connection.is_bad con)
+           && Connection.has_more_input con && Connection.can_input con
+        then drain (n - 1) in
+      drain ring_batch;
+      let rec flush () =
+        do_output store cons doms con;
+        if Connection.has_new_output con && not (Connection.has_old_output con)
+        then flush () in
+      flush ()
+    )
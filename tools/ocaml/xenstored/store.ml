@@ -334,17 +334,19 @@ let read store perm path =
   ) else
     Path.apply store.root path do_read
 
+let ls_node store perm path =
+  if path = [] then (
+    Node.check_perm store.root perm Perms.READ;
+    store.root
+  ) else
+    let do_ls node name =
+      let cnode = Node.find node name in
+      Node.check_perm cnode perm Perms.READ;
+      cnode in
+    Path.apply store.root path do_ls
+
 let ls store perm path =
-  let children =
-    if path = [] then (
-      Node.check_perm store.root perm Perms.READ;
-      Node.get_children store.root
-    ) else
-      let do_ls node name =
-        let cnode = Node.find node name in
-        Node.check_perm cnode perm Perms.READ;
-        cnode.Node.children in
-      Path.apply store.root path do_ls in
+  let children = Node.get_children (ls_node store perm path) in
   SymbolMap.fold (fun k _ accu -> Symbol.to_string k :: accu) children []
 
 let getperms store perm path =
@@ -192,6 +192,11 @@ let ls t perm path =
   set_read_lowpath t path;
   r
 
+let ls_node t perm path =
+  let r = Store.ls_node t.store perm path in
+  set_read_lowpath t path;
+  r
+
 let read t perm path =
   let r = Store.read t.store perm path in
   set_read_lowpath t path;
@@ -60,8 +60,7 @@ let process_domains store cons domains =
     then () (* nothing to do *)
     else (
       let con = Connections.find_domain cons (Domain.get_id domain) in
-      Process.do_input store cons domains con;
-      Process.do_output store cons domains con;
+      Process.do_io store cons domains con;
       Domain.decr_io_credit domain
     ) in
   Domains.iter domains do_io_domain
@@ -514,8 +513,9 @@ let () =
       debug "Looking up domid %d" (Domain.get_id dom);
       let con = Connections.find_domain cons (Domain.get_id dom) in
       if not (Connection.has_more_work con) then (
-        Process.do_output store cons domains con;
-        Process.do_input store cons domains con;
+        Connection.batch con (fun () ->
+            Process.do_output store cons domains con;
+            Process.do_input store cons domains con);
         if Connection.has_more_work con then
           (* Previously thought as no work, but detect some after scan (as
              					   processing a new message involves multiple steps.) It's very
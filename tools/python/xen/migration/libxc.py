@@ -58,6 +58,15 @@ REC_TYPE_checkpoint_dirty_pfn_list  = 0x0000000f
 REC_TYPE_static_data_end            = 0x00000010
 REC_TYPE_x86_cpuid_policy           = 0x00000011
 REC_TYPE_x86_msr_policy             = 0x00000012
+REC_TYPE_data_channels              = 0x00000013
+REC_TYPE_data_channels_end          = 0x00000014
+REC_TYPE_compressed_page_data       = 0x00000015
+REC_TYPE_postcopy_pfns              = 0x00000016
+REC_TYPE_postcopy_request           = 0x00000017
+REC_TYPE_page_data_index            = 0x00000018
+
+REC_TYPE_OPTIONAL                   = 0x80000000
+REC_TYPE_memory_layout              = REC_TYPE_OPTIONAL | 0x00000000
 
 rec_type_to_str = {
     REC_TYPE_end                        : "End",
@@ -79,6 +88,13 @@ rec_type_to_str = {
     REC_TYPE_static_data_end            : "Static data end",
     REC_TYPE_x86_cpuid_policy           : "x86 CPUID policy",
     REC_TYPE_x86_msr_policy             : "x86 MSR policy",
+    REC_TYPE_data_channels              : "Data channels",
+    REC_TYPE_data_channels_end          : "Data channels end",
+    REC_TYPE_compressed_page_data       : "Compressed page data",
+    REC_TYPE_postcopy_pfns              : "Post-copy pfns",
+    REC_TYPE_postcopy_request           : "Post-copy request",
+    REC_TYPE_page_data_index            : "Page data index",
+    REC_TYPE_memory_layout              : "Memory layout",
 }
 
 # page_data
@@ -101,6 +117,12 @@ PAGE_DATA_TYPE_BROKEN        = (0xd << PAGE_DATA_TYPE_SHIFT) # Broken
 PAGE_DATA_TYPE_XALLOC        = (0xe << PAGE_DATA_TYPE_SHIFT) # Allocate-only
 PAGE_DATA_TYPE_XTAB          = (0xf << PAGE_DATA_TYPE_SHIFT) # Invalid
 
+# compressed_page_data
+COMPRESSED_PAGE_DATA_FORMAT  = "II"
+COMPRESSED_PAGE_DATA_RAW     = 0
+COMPRESSED_PAGE_DATA_DEFLATE = 1
+PAGE_DATA_ZERO               = 1 << 52
+
 # x86_pv_info
 X86_PV_INFO_FORMAT        = "BBHI"
 
@@ -122,6 +144,16 @@ X86_CPUID_POLICY_FORMAT   = "IIIIII"
 # x86_msr_policy => xen_msr_entry_t[]
 X86_MSR_POLICY_FORMAT     = "QII"
 
+# data_channels
+DATA_CHANNELS_FORMAT      = "II"
+
+# memory_layout
+MEMORY_LAYOUT_ENTRY_FORMAT = "QQ"
+MEMORY_LAYOUT_FORMAT      = "II"
+
+# page_data_index, followed by memory_layout entries
+PAGE_DATA_INDEX_FORMAT    = "IIQQ"
+
 class VerifyLibxc(VerifyBase):
     """ Verify a Libxc v2 (or later) stream """
 
@@ -476,6 +508,191 @@ class VerifyLibxc(VerifyBase):
                               (contentsz, sz))
 
 
+    def verify_record_data_channels(self, content):
+        """ data channels record """
+
+        sz = calcsize(DATA_CHANNELS_FORMAT)
+
+        if len(content) != sz:
+            raise RecordError("Length expected to be %u, got %u" %
+                              (sz, len(content)))
+
+        count, channel = unpack(DATA_CHANNELS_FORMAT, content)
+
+        if count == 0:
+            raise RecordError("No data channels")
+
+        if channel != 0:
+            raise RecordError("Data channel %u in primary stream" % (channel, ))
+
+        self.info("  Data channels: count %u" % (count, ))
+
+
+    def verify_record_compressed_page_data(self, content):
+        """ Compressed page data record """
+        minsz = calcsize(COMPRESSED_PAGE_DATA_FORMAT)
+
+        if len(content) <= minsz:
+            raise RecordError("COMPRESSED_PAGE_DATA record must be at least "
+                              "%d bytes long" % (minsz, ))
+
+        count, encoding = unpack(COMPRESSED_PAGE_DATA_FORMAT, content[:minsz])
+
+        if encoding not in (COMPRESSED_PAGE_DATA_RAW,
+                            COMPRESSED_PAGE_DATA_DEFLATE):
+            raise RecordError("Unknown encoding %u" % (encoding, ))
+
+        pfnsz = count * 8
+        if (len(content) - minsz) < pfnsz:
+            raise RecordError("COMPRESSED_PAGE_DATA record must contain a "
+                              "pfn record for each count")
+
+        pfns = list(unpack("=%dQ" % (count, ), content[minsz:minsz + pfnsz]))
+
+        nr_pages = 0
+        for idx, pfn in enumerate(pfns):
+
+            if pfn & PAGE_DATA_PFN_RESZ_MASK & ~PAGE_DATA_ZERO:
+                raise RecordError("Reserved bits set in pfn[%d]: 0x%016x" %
+                                  (idx, pfn & PAGE_DATA_PFN_RESZ_MASK))
+
+            if pfn >> PAGE_DATA_TYPE_SHIFT in (5, 6, 7, 8):
+                raise RecordError("Invalid type value in pfn[%d]: 0x%016x" %
+                                  (idx, pfn & PAGE_DATA_TYPE_LTAB_MASK))
+
+            has_data = PAGE_DATA_TYPE_NOTAB <= \
+                (pfn & PAGE_DATA_TYPE_LTABTYPE_MASK) <= PAGE_DATA_TYPE_L4TAB
+
+            if pfn & PAGE_DATA_ZERO:
+                if not has_data:
+                    raise RecordError("Zero page without data in pfn[%d]: "
+                                      "0x%016x" % (idx, pfn))
+            elif has_data:
+                nr_pages += 1
+
+        datasz = len(content) - minsz - pfnsz
+        if encoding == COMPRESSED_PAGE_DATA_RAW:
+            if datasz != nr_pages * 4096:
+                raise RecordError("Expected %u + %u + %u, got %u" %
+                                  (minsz, pfnsz, nr_pages * 4096,
+                                   len(content)))
+        elif (nr_pages == 0) != (datasz == 0):
+            raise RecordError("%u bytes of compressed data for %u pages" %
+                              (datasz, nr_pages))
+
+
+    def verify_record_data_channels_end(self, content):
+        """ data channels end record """
+
+        if len(content) != 0:
+            raise RecordError("Data channels end record with non-zero length")
+
+
+    def verify_record_postcopy_pfns(self, content):
+        """ post-copy pfns record """
+
+        if len(content) == 0 or len(content) % 8 != 0:
+            raise RecordError("Record length %u, expected non-zero multiple "
+                              "of 8" % (len(content), ))
+
+        pfns = unpack("=%dQ" % (len(content) // 8), content)
+
+        if any(a >= b for a, b in zip(pfns, pfns[1:])):
+            raise RecordError("Post-copy pfns not in ascending order")
+
+        self.info("  Post-copy pfns: %u" % (len(pfns), ))
+
+
+    def verify_record_postcopy_request(self, content):
+        """ post-copy request record """
+        raise RecordError("Found post-copy request record in stream")
+
+
+    def verify_record_memory_layout(self, content):
+        """ memory layout record """
+
+        sz = calcsize(MEMORY_LAYOUT_FORMAT)
+
+        if len(content) < sz:
+            raise RecordError("Length should be at least %u bytes" % (sz, ))
+
+        count, rsvd = unpack(MEMORY_LAYOUT_FORMAT, content[:sz])
+
+        if rsvd != 0:
+            raise RecordError("Reserved field not zero (0x%04x)" % (rsvd, ))
+
+        esz = calcsize(MEMORY_LAYOUT_ENTRY_FORMAT)
+
+        if len(content) != sz + count * esz:
+            raise RecordError("Length should be %u bytes" %
+                              (sz + count * esz, ))
+
+        end = 0
+        for i in range(count):
+            pfn, nr = unpack(MEMORY_LAYOUT_ENTRY_FORMAT,
+                             content[sz + i * esz:sz + (i + 1) * esz])
+
+            if nr == 0:
+                raise RecordError("Entry %u is empty" % (i, ))
+
+            if pfn < end:
+                raise RecordError("Entry %u out of order" % (i, ))
+
+            end = pfn + nr
+
+        self.info("  Memory layout: %u runs" % (count, ))
+
+
+    def verify_record_page_data_index(self, content):
+        """ page data index record """
+
+        sz = calcsize(PAGE_DATA_INDEX_FORMAT)
+
+        if len(content) < sz:
+            raise RecordError("Length should be at least %u bytes" % (sz, ))
+
+        count, rsvd, offset, nr_pfns = unpack(PAGE_DATA_INDEX_FORMAT,
+                                              content[:sz])
+
+        if rsvd != 0:
+            raise RecordError("Reserved field not zero (0x%04x)" % (rsvd, ))
+
+        if offset >= 4096:
+            raise RecordError("Data offset 0x%x not below a page" % (offset, ))
+
+        esz = calcsize(MEMORY_LAYOUT_ENTRY_FORMAT)
+
+        if len(content) != sz + count * esz:
+            raise RecordError("Length should be %u bytes" %
+                              (sz + count * esz, ))
+
+        end = 0
+        for i in range(count):
+            pfn, nr = unpack(MEMORY_LAYOUT_ENTRY_FORMAT,
+                             content[sz + i * esz:sz + (i + 1) * esz])
+
+            if nr == 0:
+                raise RecordError("Entry %u is empty" % (i, ))
+
+            if pfn < end:
+                raise RecordError("Entry %u out of order" % (i, ))
+
+            end = pfn + nr
+
+        if end > nr_pfns:
+            raise RecordError("Entries beyond the 0x%x pfns of data" %
+                              (nr_pfns, ))
+
+        self.info("  Page data index: %u runs, 0x%x pfns" % (count, nr_pfns))
+
+        # The page data follows the record, outside of it.
+        skip = offset + nr_pfns * 4096
+        while skip:
+            chunk = min(skip, 1 << 20)
+            self.rdexact(chunk)
+            skip -= chunk
+
+
 record_verifiers = {
     REC_TYPE_end:
         VerifyLibxc.verify_record_end,
@@ -525,4 +742,21 @@ record_verifiers = {
         VerifyLibxc.verify_record_x86_cpuid_policy,
     REC_TYPE_x86_msr_policy:
         VerifyLibxc.verify_record_x86_msr_policy,
+
+    REC_TYPE_data_channels:
+        VerifyLibxc.verify_record_data_channels,
+    REC_TYPE_data_channels_end:
+        VerifyLibxc.verify_record_data_channels_end,
+    REC_TYPE_compressed_page_data:
+        VerifyLibxc.verify_record_compressed_page_data,
+    REC_TYPE_postcopy_pfns:
+        VerifyLibxc.verify_record_postcopy_pfns,
+    REC_TYPE_postcopy_request:
+        VerifyLibxc.verify_record_postcopy_request,
+
+    REC_TYPE_page_data_index:
+        VerifyLibxc.verify_record_page_data_index,
+
+    REC_TYPE_memory_layout:
+        VerifyLibxc.verify_record_memory_layout,
     }
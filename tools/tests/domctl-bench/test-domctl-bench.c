@@ -0,0 +1,184 @@
+/*
+ * Measure how domctls issued concurrently from several threads scale,
+ * depending on whether the threads act on distinct domains or all on the
+ * same one.
+ *
+ * One scratch domain is created per thread.  Each thread issues
+ * XEN_DOMCTL_getvcpuinfo in a tight loop, either on its own domain or on
+ * the first one.  Domctls on distinct domains only serialise on a per-domain
+ * lock, so the former should scale with the number of threads while the
+ * latter doesn't.
+ *
+ * Usage: test-domctl-bench [max-threads [seconds-per-round]]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+
+#define MAX_THREADS 64
+
+static volatile bool stop;
+static volatile bool go;
+
+struct worker {
+    pthread_t thread;
+    xc_interface *xch;
+    uint32_t domid;
+    uint64_t calls;
+    uint64_t failed;
+};
+
+static struct worker workers[MAX_THREADS];
+static uint32_t domids[MAX_THREADS];
+static unsigned int nr_domains;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+#if defined(__x86_64__) || defined(__i386__)
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+#endif
+    },
+};
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    xc_vcpuinfo_t info;
+
+    while ( !go )
+        ;
+
+    while ( !stop )
+    {
+        if ( xc_vcpu_getinfo(w->xch, w->domid, 0, &info) )
+            w->failed++;
+        else
+            w->calls++;
+    }
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run_round(unsigned int nr, unsigned int seconds, bool shared)
+{
+    uint64_t calls = 0, failed = 0;
+    double start, elapsed;
+    unsigned int i;
+
+    stop = go = false;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        workers[i].domid = domids[shared ? 0 : i];
+        workers[i].calls = workers[i].failed = 0;
+        if ( pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) )
+            err(1, "pthread_create");
+    }
+
+    start = now();
+    go = true;
+    sleep(seconds);
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(workers[i].thread, NULL);
+        calls += workers[i].calls;
+        failed += workers[i].failed;
+    }
+    elapsed = now() - start;
+
+    if ( failed )
+        fprintf(stderr, "%"PRIu64" failed calls\n", failed);
+
+    return calls / elapsed;
+}
+
+static void cleanup(xc_interface *xch)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr_domains; i++ )
+        if ( xc_domain_destroy(xch, domids[i]) )
+            warn("destroying d%u", domids[i]);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max = 8, seconds = 1, nr, i;
+    xc_interface *xch;
+
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        seconds = strtoul(argv[2], NULL, 0);
+    if ( !max || max > MAX_THREADS || !seconds )
+        errx(1, "usage: %s [max-threads (1-%u) [seconds-per-round]]",
+             argv[0], MAX_THREADS);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    for ( i = 0; i < max; i++ )
+    {
+        struct xen_domctl_createdomain cfg = create;
+
+        domids[i] = 0;
+        if ( xc_domain_create(xch, &domids[i], &cfg) )
+        {
+            cleanup(xch);
+            err(1, "xc_domain_create");
+        }
+        nr_domains++;
+
+        /* A handle per thread, not to measure contention in libxenctrl. */
+        workers[i].xch = xc_interface_open(NULL, NULL, 0);
+        if ( !workers[i].xch )
+        {
+            cleanup(xch);
+            err(1, "xc_interface_open");
+        }
+    }
+
+    printf("Concurrent getvcpuinfo domctls, %us per round\n", seconds);
+    printf("threads   same domain/s  distinct domains/s\n");
+
+    for ( nr = 1; nr <= max; nr *= 2 )
+    {
+        double same = run_round(nr, seconds, true);
+        double distinct = run_round(nr, seconds, false);
+
+        printf("%7u %15.0f %19.0f\n", nr, same, distinct);
+    }
+
+    cleanup(xch);
+    for ( i = 0; i < max; i++ )
+        xc_interface_close(workers[i].xch);
+    xc_interface_close(xch);
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Stress a single event channel with a growing number of concurrent senders,
+ * reporting the rate of sends and of notifications delivered.
+ *
+ * A loopback interdomain channel is set up in the calling domain.  Sender
+ * threads notify its local end in a tight loop, while a receiver thread
+ * drains (and unmasks) the remote end.
+ *
+ * Usage: test-evtchn-stress [max-senders [seconds-per-round]]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenevtchn.h>
+#include <xen/xen.h>
+
+#define MAX_SENDERS 64
+
+static xenevtchn_handle *xce_tx, *xce_rx;
+static evtchn_port_t tx_port, rx_port;
+
+static volatile bool stop;
+static volatile bool go;
+
+struct sender {
+    pthread_t thread;
+    uint64_t sent;
+    uint64_t failed;
+};
+
+static struct sender senders[MAX_SENDERS];
+static uint64_t received;
+
+static void *sender_fn(void *arg)
+{
+    struct sender *s = arg;
+
+    while ( !go )
+        ;
+
+    while ( !stop )
+    {
+        if ( xenevtchn_notify(xce_tx, tx_port) )
+            s->failed++;
+        else
+            s->sent++;
+    }
+
+    return NULL;
+}
+
+static void *receiver_fn(void *arg)
+{
+    struct pollfd pfd = {
+        .fd = xenevtchn_fd(xce_rx),
+        .events = POLLIN,
+    };
+
+    while ( !stop )
+    {
+        xenevtchn_port_or_error_t port;
+
+        if ( poll(&pfd, 1, 10) <= 0 )
+            continue;
+
+        port = xenevtchn_pending(xce_rx);
+        if ( port < 0 )
+            continue;
+
+        if ( port == rx_port )
+            received++;
+
+        xenevtchn_unmask(xce_rx, port);
+    }
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_round(unsigned int nr, unsigned int seconds)
+{
+    pthread_t rx;
+    uint64_t sent = 0, failed = 0;
+    double start, elapsed;
+    unsigned int i;
+
+    stop = go = false;
+    received = 0;
+    memset(senders, 0, sizeof(senders));
+
+    if ( pthread_create(&rx, NULL, receiver_fn, NULL) )
+        err(1, "pthread_create");
+
+    for ( i = 0; i < nr; i++ )
+        if ( pthread_create(&senders[i].thread, NULL, sender_fn, &senders[i]) )
+            err(1, "pthread_create");
+
+    start = now();
+    go = true;
+    sleep(seconds);
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(senders[i].thread, NULL);
+        sent += senders[i].sent;
+        failed += senders[i].failed;
+    }
+    elapsed = now() - start;
+
+    pthread_join(rx, NULL);
+
+    printf("%3u senders: %12.0f sends/s %12.0f notifications/s",
+           nr, sent / elapsed, received / elapsed);
+    if ( failed )
+        printf(" (%"PRIu64" failed sends)", failed);
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max = MAX_SENDERS, seconds = 1, nr;
+    xenevtchn_port_or_error_t port;
+
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        seconds = strtoul(argv[2], NULL, 0);
+    if ( !max || max > MAX_SENDERS || !seconds )
+        errx(1, "usage: %s [max-senders (1-%u) [seconds-per-round]]",
+             argv[0], MAX_SENDERS);
+
+    xce_tx = xenevtchn_open(NULL, 0);
+    xce_rx = xenevtchn_open(NULL, 0);
+    if ( !xce_tx || !xce_rx )
+        err(1, "xenevtchn_open");
+
+    port = xenevtchn_bind_unbound_port(xce_tx, DOMID_SELF);
+    if ( port < 0 )
+        err(1, "xenevtchn_bind_unbound_port");
+    tx_port = port;
+
+    port = xenevtchn_bind_interdomain(xce_rx, DOMID_SELF, tx_port);
+    if ( port < 0 )
+        err(1, "xenevtchn_bind_interdomain");
+    rx_port = port;
+
+    printf("Event channel stress: ports %u -> %u, %us per round\n",
+           tx_port, rx_port, seconds);
+
+    for ( nr = 1; nr <= max; nr *= 2 )
+        run_round(nr, seconds);
+
+    xenevtchn_unbind(xce_rx, rx_port);
+    xenevtchn_unbind(xce_tx, tx_port);
+    xenevtchn_close(xce_rx);
+    xenevtchn_close(xce_tx);
+
+    return 0;
+}
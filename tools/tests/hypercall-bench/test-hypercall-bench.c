@@ -0,0 +1,278 @@
+/*
+ * Measure the round trip cost of a few cheap hypercalls, and of a CPUID
+ * exit, to compare hosts, builds, or boot options such as spec-ctrl=.
+ *
+ * Each operation is timed individually, many times over, and the median and
+ * 99th percentile are reported, in TSC cycles on x86 and nanoseconds
+ * elsewhere.  The Xen version and command line are printed first, so that
+ * results from differently configured boots can be told apart.
+ *
+ * The hvm_op and dm_op cases act on a scratch HVM domain, created for the
+ * purpose.  mmuext_op only exists for PV callers, and the CPUID case only
+ * exits to Xen when run in an HVM or PVH domain.  Operations which fail are
+ * reported as such rather than timed.
+ *
+ * Usage: test-hypercall-bench [iterations]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <xenctrl.h>
+#include <xenevtchn.h>
+#include <xengnttab.h>
+#include <xendevicemodel.h>
+
+static xc_interface *xch;
+static xenevtchn_handle *xce;
+static xengnttab_handle *xgt;
+static xengntshr_handle *xgs;
+static xendevicemodel_handle *dmod;
+
+static uint32_t domid = DOMID_INVALID;
+static evtchn_port_t port;
+static uint32_t gref;
+static void *shared;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+#if defined(__x86_64__) || defined(__i386__)
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+#endif
+    },
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UNIT "cycles"
+
+static inline uint64_t now(void)
+{
+    uint32_t lo, hi;
+
+    asm volatile ( "lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) );
+
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+#define UNIT "ns"
+
+static inline uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static int do_version(void)
+{
+    return xc_version(xch, XENVER_version, NULL) < 0 ? -errno : 0;
+}
+
+static int do_evtchn_send(void)
+{
+    return xenevtchn_notify(xce, port) ? -errno : 0;
+}
+
+static int do_grant_map(void)
+{
+    void *p = xengnttab_map_grant_ref(xgt, 0, gref, PROT_READ);
+
+    if ( !p )
+        return -errno;
+
+    return xengnttab_unmap(xgt, p, 1) ? -errno : 0;
+}
+
+static int do_mmuext(void)
+{
+    struct mmuext_op op = { .cmd = MMUEXT_TLB_FLUSH_LOCAL };
+
+    return xc_mmuext_op(xch, &op, 1, DOMID_SELF) ? -errno : 0;
+}
+
+static int do_hvm_param(void)
+{
+    uint64_t val;
+
+    return xc_hvm_param_get(xch, domid, HVM_PARAM_STORE_PFN, &val) ? -errno : 0;
+}
+
+static int do_dm_op(void)
+{
+    unsigned int vcpus;
+
+    return xendevicemodel_nr_vcpus(dmod, domid, &vcpus) ? -errno : 0;
+}
+
+static int do_cpuid(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t a = 0, b, c = 0, d;
+
+    asm volatile ( "cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d) );
+
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+static const struct test {
+    const char *name;
+    int (*fn)(void);
+    bool needs_domain;
+} tests[] = {
+    { "xen_version",               do_version },
+    { "event_channel_op send",     do_evtchn_send },
+    { "grant_table_op map+unmap",  do_grant_map },
+    { "mmuext_op tlb_flush_local", do_mmuext },
+    { "hvm_op get_param",          do_hvm_param, true },
+    { "dm_op nr_vcpus",            do_dm_op, true },
+    { "cpuid",                     do_cpuid },
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run(const struct test *t, uint64_t *samples, unsigned int nr)
+{
+    unsigned int i;
+    int rc;
+
+    if ( t->needs_domain && domid == DOMID_INVALID )
+    {
+        printf("%-28s %10s\n", t->name, "no domain");
+        return;
+    }
+
+    /* Warm up, and check the operation works at all. */
+    if ( (rc = t->fn()) )
+    {
+        printf("%-28s %10s (%s)\n", t->name, "failed", strerror(-rc));
+        return;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        uint64_t start = now();
+
+        t->fn();
+        samples[i] = now() - start;
+    }
+
+    qsort(samples, nr, sizeof(*samples), cmp_u64);
+
+    printf("%-28s %10"PRIu64" %10"PRIu64" %10"PRIu64"\n", t->name,
+           samples[0], samples[nr / 2], samples[nr - 1 - nr / 100]);
+}
+
+static void setup(void)
+{
+    xce = xenevtchn_open(NULL, 0);
+    if ( xce )
+    {
+        int local = xenevtchn_bind_unbound_port(xce, 0);
+
+        if ( local >= 0 )
+        {
+            int remote = xenevtchn_bind_interdomain(xce, 0, local);
+
+            if ( remote >= 0 )
+                port = remote;
+        }
+    }
+
+    xgs = xengntshr_open(NULL, 0);
+    xgt = xengnttab_open(NULL, 0);
+    if ( xgs && xgt )
+    {
+        shared = xengntshr_share_pages(xgs, 0, 1, &gref, 0);
+        if ( !shared )
+            warn("sharing a page with ourselves");
+    }
+
+    dmod = xendevicemodel_open(NULL, 0);
+
+    if ( xc_domain_create(xch, &domid, &create) )
+    {
+        warn("xc_domain_create");
+        domid = DOMID_INVALID;
+    }
+}
+
+static void cleanup(void)
+{
+    if ( domid != DOMID_INVALID && xc_domain_destroy(xch, domid) )
+        warn("destroying d%u", domid);
+
+    if ( dmod )
+        xendevicemodel_close(dmod);
+    if ( xgt )
+        xengnttab_close(xgt);
+    if ( shared )
+        xengntshr_unshare(xgs, shared, 1);
+    if ( xgs )
+        xengntshr_close(xgs);
+    if ( xce )
+        xenevtchn_close(xce);
+}
+
+int main(int argc, char **argv)
+{
+    static xen_commandline_t cmdline;
+    static xen_extraversion_t extra;
+    unsigned int nr = 100000, i;
+    uint64_t *samples;
+    int ver;
+
+    if ( argc > 1 )
+        nr = strtoul(argv[1], NULL, 0);
+    if ( nr < 100 )
+        errx(1, "usage: %s [iterations (>= 100)]", argv[0]);
+
+    samples = calloc(nr, sizeof(*samples));
+    if ( !samples )
+        err(1, "calloc");
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    ver = xc_version(xch, XENVER_version, NULL);
+    xc_version(xch, XENVER_extraversion, &extra);
+    xc_version(xch, XENVER_commandline, &cmdline);
+    printf("Xen %d.%d%s\n", ver >> 16, ver & 0xffff, extra);
+    printf("Command line: %s\n", cmdline);
+
+    setup();
+
+    printf("%u iterations, in " UNIT "\n", nr);
+    printf("%-28s %10s %10s %10s\n", "operation", "min", "p50", "p99");
+
+    for ( i = 0; i < sizeof(tests) / sizeof(tests[0]); i++ )
+        run(&tests[i], samples, nr);
+
+    cleanup();
+    xc_interface_close(xch);
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Generate a storm of TLB shootdown IPIs inside an HVM guest, reporting the
+ * rate at which they complete for a growing number of target vCPUs.
+ *
+ * To be run inside a (Linux) guest, not in dom0.  Reader threads are pinned
+ * to vCPUs 1..N and keep touching a shared page, so that they stay in the
+ * address space's CPU mask.  The main thread, pinned to vCPU 0, repeatedly
+ * write-protects and unprotects the page: each write-protection requires
+ * the guest kernel to IPI every reader and wait for it to flush its TLB.
+ *
+ * Usage: test-ipi-storm [max-targets [seconds-per-round]]
+ */
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile bool stop;
+static volatile uint8_t *page;
+static long page_size;
+
+static void pin(unsigned int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if ( sched_setaffinity(0, sizeof(set), &set) )
+        err(1, "sched_setaffinity(%u)", cpu);
+}
+
+static void *reader_fn(void *arg)
+{
+    unsigned int cpu = (uintptr_t)arg;
+
+    pin(cpu);
+
+    while ( !stop )
+        (void)page[(cpu * 64) % page_size];
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_round(unsigned int nr, unsigned int seconds)
+{
+    pthread_t *readers = calloc(nr ?: 1, sizeof(*readers));
+    unsigned long iters = 0;
+    double start, end;
+    unsigned int i;
+
+    if ( !readers )
+        err(1, "calloc");
+
+    stop = false;
+
+    for ( i = 0; i < nr; i++ )
+        if ( pthread_create(&readers[i], NULL, reader_fn,
+                            (void *)(uintptr_t)(i + 1)) )
+            err(1, "pthread_create");
+
+    /* Give the readers a chance to get going on their vCPUs. */
+    usleep(100000);
+
+    start = now();
+    end = start + seconds;
+
+    do {
+        if ( mprotect((void *)page, page_size, PROT_READ) ||
+             mprotect((void *)page, page_size, PROT_READ | PROT_WRITE) )
+            err(1, "mprotect");
+
+        /* Dirty the page so that the next protection change has to flush. */
+        page[0]++;
+    } while ( (++iters & 0xff) || now() < end );
+
+    end = now();
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+        pthread_join(readers[i], NULL);
+    free(readers);
+
+    printf("%3u targets: %10.0f shootdowns/s\n", nr, iters / (end - start));
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max, seconds = 1, nr;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ( cpus < 2 )
+        errx(1, "need at least 2 online vCPUs");
+
+    max = cpus - 1;
+
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        seconds = strtoul(argv[2], NULL, 0);
+    if ( !max || max >= cpus || !seconds )
+        errx(1, "usage: %s [max-targets (1-%ld) [seconds-per-round]]",
+             argv[0], cpus - 1);
+
+    page_size = sysconf(_SC_PAGESIZE);
+    page = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( page == MAP_FAILED )
+        err(1, "mmap");
+    page[0] = 1;
+
+    pin(0);
+
+    printf("TLB shootdown IPI storm: %ld vCPUs, %us per round\n",
+           cpus, seconds);
+
+    run_round(0, seconds);
+    for ( nr = 1; nr <= max; nr *= 2 )
+        run_round(nr, seconds);
+    if ( (nr / 2) != max )
+        run_round(max, seconds);
+
+    munmap((void *)page, page_size);
+
+    return 0;
+}
@@ -0,0 +1,554 @@
+/*
+ * Benchmark migration of a PVH domain with a synthetic memory-dirtying
+ * workload, reporting per-iteration times, bytes sent, and the downtime.
+ *
+ * A scratch domain is created and its memory filled.  While it is saved with
+ * xc_domain_save() and restored into a second scratch domain, both ends in
+ * this process, a thread keeps dirtying pages of a working set through
+ * foreign mappings, at the given rate and with the given pattern.  The
+ * dirtying stops when the domain is suspended.  The downtime is measured
+ * from the suspend until the restore completes, and the restored memory is
+ * checked against the original.
+ *
+ * The streams go through relay threads counting the bytes, over socketpairs,
+ * so stream features (compression, data channels) can be compared.
+ *
+ * Usage: test-migrate-bench [-m MiB] [-w MiB] [-r pages/s]
+ *                           [-p seq|random|hot] [-z percent-zero]
+ *                           [-c] [-j channels] [-n]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+#include <xenforeignmemory.h>
+#include <xenguest.h>
+
+#include <xen-tools/common-macros.h>
+
+#define BATCH        64
+#define MAX_CHANNELS 8
+#define MAX_ITERS    64
+
+enum pattern { PATTERN_SEQ, PATTERN_RANDOM, PATTERN_HOT };
+
+static const char *const pattern_names[] = {
+    [PATTERN_SEQ]    = "seq",
+    [PATTERN_RANDOM] = "random",
+    [PATTERN_HOT]    = "hot",
+};
+
+/* Parameters. */
+static unsigned long nr_pages = 256 << (20 - XC_PAGE_SHIFT);
+static unsigned long wss_pages = 64 << (20 - XC_PAGE_SHIFT);
+static unsigned long rate = 10000;
+static enum pattern pattern = PATTERN_RANDOM;
+static unsigned int zero_pct = 25;
+static bool compress, live = true;
+static unsigned int nr_channels;
+
+static xc_interface *xch;
+static xenforeignmemory_handle *fmem;
+static uint32_t src_domid, dst_domid;
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+#if defined(__x86_64__) || defined(__i386__)
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+#endif
+    },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    uint64_t x = *s;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *s = x;
+}
+
+/* Dirtying workload. */
+static pthread_t dirtier;
+static bool dirtying;
+static volatile bool stop_dirtying;
+static unsigned long nr_dirtied;
+static int dirtier_error;
+
+static xen_pfn_t next_gfn(uint64_t *seed, unsigned long *pos)
+{
+    switch ( pattern )
+    {
+    case PATTERN_SEQ:
+        return (*pos)++ % wss_pages;
+
+    case PATTERN_HOT:
+        /* 80% of the writes to the first 20% of the working set. */
+        if ( xorshift(seed) % 10 < 8 )
+            return xorshift(seed) % (wss_pages / 5 ?: 1);
+        /* Fallthrough */
+    case PATTERN_RANDOM:
+    default:
+        return xorshift(seed) % wss_pages;
+    }
+}
+
+static void *dirtier_fn(void *arg)
+{
+    xen_pfn_t gfns[BATCH];
+    int errs[BATCH];
+    uint64_t seed = 0x9e3779b97f4a7c15ULL, *p;
+    unsigned long pos = 0;
+    double start = now();
+    unsigned int i;
+    void *map;
+
+    while ( !stop_dirtying )
+    {
+        /* Hold back to the requested rate. */
+        if ( rate && nr_dirtied >= (now() - start) * rate )
+        {
+            usleep(1000);
+            continue;
+        }
+
+        for ( i = 0; i < BATCH; i++ )
+            gfns[i] = next_gfn(&seed, &pos);
+
+        /* Writable foreign mappings mark the pages dirty. */
+        map = xenforeignmemory_map(fmem, src_domid, PROT_READ | PROT_WRITE,
+                                   BATCH, gfns, errs);
+        if ( !map )
+        {
+            dirtier_error = errno;
+            break;
+        }
+
+        for ( i = 0; i < BATCH; i++ )
+        {
+            p = map + i * XC_PAGE_SIZE;
+            p[xorshift(&seed) % (XC_PAGE_SIZE / sizeof(*p))] = xorshift(&seed);
+        }
+
+        xenforeignmemory_unmap(fmem, map, BATCH);
+        nr_dirtied += BATCH;
+    }
+
+    return NULL;
+}
+
+/* Stream relays, counting the bytes. */
+struct relay {
+    pthread_t thread;
+    int in, out;
+    uint64_t bytes;
+};
+
+static struct relay relays[1 + MAX_CHANNELS];
+
+static void *relay_fn(void *arg)
+{
+    struct relay *r = arg;
+    char buf[1 << 16];
+    ssize_t len, done, w;
+
+    while ( (len = read(r->in, buf, sizeof(buf))) != 0 )
+    {
+        if ( len < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            break;
+        }
+
+        for ( done = 0; done < len; done += w )
+        {
+            w = write(r->out, buf + done, len - done);
+            if ( w < 0 && errno == EINTR )
+                w = 0;
+            else if ( w < 0 )
+                goto out;
+        }
+
+        r->bytes += len;
+    }
+
+ out:
+    shutdown(r->out, SHUT_WR);
+
+    return NULL;
+}
+
+/* Save side. */
+static double t_start, t_suspend, t_iter[MAX_ITERS];
+static struct precopy_stats iters[MAX_ITERS];
+static unsigned int nr_iters;
+
+static int precopy_policy(struct precopy_stats stats, void *user)
+{
+    if ( stats.iteration < MAX_ITERS )
+    {
+        if ( stats.iteration >= nr_iters )
+        {
+            t_iter[stats.iteration] = now();
+            nr_iters = stats.iteration + 1;
+        }
+        iters[stats.iteration] = stats;
+    }
+
+    /* As libxenguest's default policy. */
+    return ((stats.dirty_count >= 0 && stats.dirty_count < 50) ||
+            stats.iteration >= 5)
+        ? XGS_POLICY_STOP_AND_COPY : XGS_POLICY_CONTINUE_PRECOPY;
+}
+
+static int suspend_cb(void *data)
+{
+    stop_dirtying = true;
+    if ( dirtying )
+        pthread_join(dirtier, NULL);
+    dirtying = false;
+
+    t_suspend = now();
+
+    return !xc_domain_shutdown(xch, src_domid, SHUTDOWN_suspend);
+}
+
+static int switch_qemu_logdirty_cb(uint32_t domid, unsigned int enable,
+                                   void *data)
+{
+    return 0;
+}
+
+struct save_args {
+    pthread_t thread;
+    int io_fd, data_fds[MAX_CHANNELS];
+    int rc;
+};
+
+static void *save_fn(void *arg)
+{
+    struct save_args *s = arg;
+    struct save_callbacks cb = {
+        .suspend = suspend_cb,
+        .precopy_policy = precopy_policy,
+        .switch_qemu_logdirty = switch_qemu_logdirty_cb,
+    };
+    uint32_t flags = (live ? XCFLAGS_LIVE : 0) |
+                     (compress ? XCFLAGS_COMPRESS : 0);
+    unsigned int i;
+
+    if ( nr_channels )
+        s->rc = xc_domain_save_parallel(xch, s->io_fd, s->data_fds,
+                                        nr_channels, src_domid, flags, &cb);
+    else
+        s->rc = xc_domain_save(xch, s->io_fd, src_domid, flags, &cb,
+                               XC_STREAM_PLAIN, -1);
+
+    /* Let the relays see the end of the streams. */
+    shutdown(s->io_fd, SHUT_WR);
+    for ( i = 0; i < nr_channels; i++ )
+        shutdown(s->data_fds[i], SHUT_WR);
+
+    return NULL;
+}
+
+/* Restore side. */
+static void restore_results_cb(xen_pfn_t store_gfn, xen_pfn_t console_gfn,
+                               void *data)
+{
+}
+
+static int restore(int io_fd, const int *data_fds)
+{
+    struct restore_callbacks cb = {
+        .restore_results = restore_results_cb,
+    };
+    unsigned long store_gfn, console_gfn;
+
+    if ( nr_channels )
+        return xc_domain_restore_parallel(xch, io_fd, data_fds, nr_channels,
+                                          dst_domid, 0, &store_gfn, 0,
+                                          0, &console_gfn, 0, &cb);
+
+    return xc_domain_restore(xch, io_fd, dst_domid, 0, &store_gfn, 0,
+                             0, &console_gfn, 0, XC_STREAM_PLAIN, &cb, -1);
+}
+
+static void populate_and_fill(void)
+{
+    xen_pfn_t gfns[BATCH], pfns[BATCH];
+    int errs[BATCH];
+    uint64_t seed = 0x2545f4914f6cdd1dULL, *p;
+    unsigned long gfn, j;
+    unsigned int i, n;
+    void *map;
+
+    for ( gfn = 0; gfn < nr_pages; gfn += n )
+    {
+        n = nr_pages - gfn < BATCH ? nr_pages - gfn : BATCH;
+
+        for ( i = 0; i < n; i++ )
+            gfns[i] = pfns[i] = gfn + i;
+
+        if ( xc_domain_populate_physmap_exact(xch, src_domid, n, 0, 0, pfns) )
+            err(1, "Failed to populate d%u", src_domid);
+
+        map = xenforeignmemory_map(fmem, src_domid, PROT_READ | PROT_WRITE,
+                                   n, gfns, errs);
+        if ( !map )
+            err(1, "Failed to map d%u", src_domid);
+
+        for ( i = 0; i < n; i++ )
+        {
+            if ( xorshift(&seed) % 100 < zero_pct )
+                continue;
+
+            p = map + i * XC_PAGE_SIZE;
+            for ( j = 0; j < XC_PAGE_SIZE / sizeof(*p); j++ )
+                p[j] = xorshift(&seed);
+        }
+
+        xenforeignmemory_unmap(fmem, map, n);
+    }
+}
+
+/* Compare the restored memory with the original. */
+static unsigned long verify(void)
+{
+    xen_pfn_t gfns[BATCH];
+    int errs[BATCH];
+    unsigned long gfn, bad = 0;
+    unsigned int i, n;
+    void *a, *b;
+
+    for ( gfn = 0; gfn < nr_pages; gfn += n )
+    {
+        n = nr_pages - gfn < BATCH ? nr_pages - gfn : BATCH;
+
+        for ( i = 0; i < n; i++ )
+            gfns[i] = gfn + i;
+
+        a = xenforeignmemory_map(fmem, src_domid, PROT_READ, n, gfns, errs);
+        b = xenforeignmemory_map(fmem, dst_domid, PROT_READ, n, gfns, errs);
+        if ( !a || !b )
+            err(1, "Failed to map pages to verify");
+
+        for ( i = 0; i < n; i++ )
+            if ( errs[i] || memcmp(a + i * XC_PAGE_SIZE, b + i * XC_PAGE_SIZE,
+                                   XC_PAGE_SIZE) )
+                bad++;
+
+        xenforeignmemory_unmap(fmem, a, n);
+        xenforeignmemory_unmap(fmem, b, n);
+    }
+
+    return bad;
+}
+
+static uint32_t create_domain(void)
+{
+    uint32_t domid = 0;
+
+    if ( xc_domain_create(xch, &domid, &create) )
+        err(1, "xc_domain_create");
+
+    if ( xc_domain_setmaxmem(xch, domid, -1) )
+    {
+        xc_domain_destroy(xch, domid);
+        err(1, "xc_domain_setmaxmem");
+    }
+
+    return domid;
+}
+
+static void usage(const char *prog)
+{
+    errx(1, "usage: %s [-m MiB] [-w MiB] [-r pages/s (0: unlimited)] "
+         "[-p seq|random|hot] [-z percent-zero] [-c] [-j channels (0-%u)] "
+         "[-n]", prog, MAX_CHANNELS);
+}
+
+int main(int argc, char **argv)
+{
+    struct save_args s = { .rc = -1 };
+    int sv[2], rv[2], io_fd, data_fds[MAX_CHANNELS];
+    uint64_t total = 0;
+    double t_end;
+    unsigned int i, nr_relays;
+    unsigned long bad;
+    int opt, rc;
+
+    while ( (opt = getopt(argc, argv, "m:w:r:p:z:cj:n")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'm':
+            nr_pages = strtoul(optarg, NULL, 0) << (20 - XC_PAGE_SHIFT);
+            break;
+        case 'w':
+            wss_pages = strtoul(optarg, NULL, 0) << (20 - XC_PAGE_SHIFT);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            for ( i = 0; i < ARRAY_SIZE(pattern_names); i++ )
+                if ( !strcmp(optarg, pattern_names[i]) )
+                    break;
+            if ( i == ARRAY_SIZE(pattern_names) )
+                usage(argv[0]);
+            pattern = i;
+            break;
+        case 'z':
+            zero_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            compress = true;
+            break;
+        case 'j':
+            nr_channels = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            live = false;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( !nr_pages || !wss_pages || wss_pages > nr_pages || zero_pct > 100 ||
+         nr_channels > MAX_CHANNELS || (compress && nr_channels) )
+        usage(argv[0]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    fmem = xenforeignmemory_open(NULL, 0);
+    if ( !xch || !fmem )
+        err(1, "Failed to open Xen interfaces");
+
+    src_domid = create_domain();
+    dst_domid = create_domain();
+
+    printf("Migrating d%u to d%u: %lu MiB, working set %lu MiB, "
+           "dirtying %lu pages/s (%s), %u%% zero pages, %s%s",
+           src_domid, dst_domid, nr_pages >> (20 - XC_PAGE_SHIFT),
+           wss_pages >> (20 - XC_PAGE_SHIFT), rate, pattern_names[pattern],
+           zero_pct, live ? "live" : "non-live",
+           compress ? ", compressed" : "");
+    if ( nr_channels )
+        printf(", %u data channels", nr_channels);
+    printf("\n");
+
+    populate_and_fill();
+
+    /* Main stream, and the data channels, each relayed. */
+    nr_relays = 1 + nr_channels;
+    for ( i = 0; i < nr_relays; i++ )
+    {
+        if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ||
+             socketpair(AF_UNIX, SOCK_STREAM, 0, rv) )
+            err(1, "socketpair");
+
+        relays[i].in = sv[1];
+        relays[i].out = rv[0];
+        if ( pthread_create(&relays[i].thread, NULL, relay_fn, &relays[i]) )
+            err(1, "pthread_create");
+
+        if ( i )
+        {
+            s.data_fds[i - 1] = sv[0];
+            data_fds[i - 1] = rv[1];
+        }
+        else
+        {
+            s.io_fd = sv[0];
+            io_fd = rv[1];
+        }
+    }
+
+    /* Without live migration, the domain gets suspended straight away. */
+    if ( live )
+    {
+        if ( pthread_create(&dirtier, NULL, dirtier_fn, NULL) )
+            err(1, "pthread_create");
+        dirtying = true;
+    }
+
+    t_start = now();
+    if ( pthread_create(&s.thread, NULL, save_fn, &s) )
+        err(1, "pthread_create");
+
+    rc = restore(io_fd, data_fds);
+    t_end = now();
+
+    pthread_join(s.thread, NULL);
+    for ( i = 0; i < nr_relays; i++ )
+    {
+        pthread_join(relays[i].thread, NULL);
+        total += relays[i].bytes;
+    }
+
+    if ( dirtier_error )
+        warnx("Dirtying failed: %d - %s", dirtier_error,
+              strerror(dirtier_error));
+
+    if ( s.rc || rc )
+    {
+        warnx("Migration failed: save %d, restore %d", s.rc, rc);
+        rc = 1;
+        goto out;
+    }
+
+    for ( i = 0; i < nr_iters; i++ )
+        printf("  iteration %2u: %8.3fs, %10lu pages sent in total, "
+               "dirty %ld\n", i,
+               (i + 1 < nr_iters ? t_iter[i + 1] : t_suspend) - t_iter[i],
+               iters[i].total_written, iters[i].dirty_count);
+
+    printf("Sent %.1f MiB in %.3fs (%.1f MiB/s), %u iterations, "
+           "%lu pages dirtied\n",
+           total / 1048576.0, t_end - t_start,
+           total / 1048576.0 / (t_end - t_start), nr_iters, nr_dirtied);
+    printf("Downtime: %.1f ms\n", (t_end - t_suspend) * 1000);
+
+    bad = verify();
+    if ( bad )
+    {
+        warnx("%lu pages differ after restore", bad);
+        rc = 1;
+    }
+
+ out:
+    xc_domain_destroy(xch, dst_domid);
+    xc_domain_destroy(xch, src_domid);
+    xenforeignmemory_close(fmem);
+    xc_interface_close(xch);
+
+    return rc;
+}
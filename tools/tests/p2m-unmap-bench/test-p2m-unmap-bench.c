@@ -0,0 +1,137 @@
+/*
+ * Time the removal of 1GiB of guest memory in 4KB chunks, as done by a
+ * balloon driver, to measure the cost of the P2M updates and of the TLB
+ * flushes they require.
+ *
+ * A scratch domain is created and populated with 1GiB of order 0 extents.
+ * The memory is then released again with XENMEM_decrease_reservation, with
+ * a varying number of pages per hypercall.
+ *
+ * Usage: test-p2m-unmap-bench [rounds]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xenctrl.h>
+
+#define NR_PAGES    (1UL << (30 - XC_PAGE_SHIFT))
+#define CHUNK       512
+
+static xc_interface *xch;
+static uint32_t domid;
+static xen_pfn_t pfns[CHUNK];
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+#if defined(__x86_64__) || defined(__i386__)
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+#endif
+    },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(xen_pfn_t first, unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+        pfns[i] = first + i;
+}
+
+static void populate(void)
+{
+    unsigned long gfn;
+
+    for ( gfn = 0; gfn < NR_PAGES; gfn += CHUNK )
+    {
+        fill(gfn, CHUNK);
+        if ( xc_domain_populate_physmap_exact(xch, domid, CHUNK, 0, 0, pfns) )
+            err(1, "populate gfn %#lx", gfn);
+    }
+}
+
+/* Release all the memory, @batch pages per hypercall. */
+static double release(unsigned int batch)
+{
+    unsigned long gfn;
+    double start = now();
+
+    for ( gfn = 0; gfn < NR_PAGES; gfn += batch )
+    {
+        fill(gfn, batch);
+        if ( xc_domain_decrease_reservation_exact(xch, domid, batch, 0, pfns) )
+            err(1, "release gfn %#lx", gfn);
+    }
+
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int batches[] = { 1, 16, CHUNK };
+    unsigned int rounds = 3, r, i;
+
+    if ( argc > 1 )
+        rounds = strtoul(argv[1], NULL, 0);
+    if ( !rounds )
+        errx(1, "usage: %s [rounds]", argv[0]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    if ( xc_domain_create(xch, &domid, &create) )
+        err(1, "xc_domain_create");
+
+    /* Room for the page tables of 1GiB of 4KB mappings, and then some. */
+    if ( xc_domain_setmaxmem(xch, domid, -1) ||
+         xc_set_paging_mempool_size(xch, domid, 16 << 20) )
+    {
+        xc_domain_destroy(xch, domid);
+        err(1, "setting up d%u", domid);
+    }
+
+    printf("Release 1GiB in 4KB pages: d%u, %u rounds\n", domid, rounds);
+
+    for ( i = 0; i < sizeof(batches) / sizeof(batches[0]); i++ )
+    {
+        double best = 0;
+
+        for ( r = 0; r < rounds; r++ )
+        {
+            double t;
+
+            populate();
+            t = release(batches[i]);
+            if ( !r || t < best )
+                best = t;
+        }
+
+        printf("%4u pages/call: %8.3f ms %10.0f pages/s\n",
+               batches[i], best * 1e3, NR_PAGES / best);
+    }
+
+    if ( xc_domain_destroy(xch, domid) )
+        err(1, "xc_domain_destroy");
+    xc_interface_close(xch);
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Stress the hypervisor's memory allocator with a growing number of threads
+ * concurrently populating and releasing guest memory, reporting the rate of
+ * pages cycled.
+ *
+ * A scratch domain is created, and each thread repeatedly populates a range
+ * of GFNs of its own with order 0 extents, then releases it again.  All
+ * threads contend on the heap lock and on the domain's page_alloc_lock.
+ * Build Xen with CONFIG_DEBUG_LOCK_PROFILE and use xenlockprof to see the
+ * time spent waiting for them.
+ *
+ * Usage: test-physmap-stress [max-threads [seconds-per-round]]
+ */
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+
+#define MAX_THREADS 256
+#define BATCH       256
+
+static uint32_t domid;
+
+static volatile bool stop;
+static volatile bool go;
+
+struct worker {
+    pthread_t thread;
+    unsigned int idx;
+    uint64_t pages;
+    int error;
+};
+
+static struct worker workers[MAX_THREADS];
+
+static struct xen_domctl_createdomain create = {
+    .flags = XEN_DOMCTL_CDF_hvm | XEN_DOMCTL_CDF_hap,
+    .max_vcpus = 1,
+    .max_grant_frames = 1,
+    .grant_opts = XEN_DOMCTL_GRANT_version(1),
+
+    .arch = {
+#if defined(__x86_64__) || defined(__i386__)
+        .emulation_flags = XEN_X86_EMU_LAPIC,
+#endif
+    },
+};
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    xen_pfn_t gfns[BATCH], pfns[BATCH];
+    xc_interface *xch = xc_interface_open(NULL, NULL, 0);
+    unsigned int i;
+
+    if ( !xch )
+    {
+        w->error = errno;
+        return NULL;
+    }
+
+    for ( i = 0; i < BATCH; i++ )
+        gfns[i] = (xen_pfn_t)w->idx * BATCH + i;
+
+    while ( !go )
+        ;
+
+    while ( !stop )
+    {
+        /* The hypercalls overwrite the arrays they are passed. */
+        memcpy(pfns, gfns, sizeof(pfns));
+        if ( xc_domain_populate_physmap_exact(xch, domid, BATCH, 0, 0, pfns) )
+        {
+            w->error = errno;
+            break;
+        }
+
+        memcpy(pfns, gfns, sizeof(pfns));
+        if ( xc_domain_decrease_reservation_exact(xch, domid, BATCH, 0, pfns) )
+        {
+            w->error = errno;
+            break;
+        }
+
+        w->pages += BATCH;
+    }
+
+    xc_interface_close(xch);
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_round(unsigned int nr, unsigned int seconds)
+{
+    uint64_t pages = 0;
+    int rc = 0;
+    double start, elapsed;
+    unsigned int i;
+
+    stop = go = false;
+    memset(workers, 0, sizeof(workers));
+
+    for ( i = 0; i < nr; i++ )
+    {
+        workers[i].idx = i;
+        if ( pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) )
+            err(1, "pthread_create");
+    }
+
+    start = now();
+    go = true;
+    sleep(seconds);
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(workers[i].thread, NULL);
+        if ( workers[i].error )
+        {
+            warnx("thread %u failed: %d - %s", i, workers[i].error,
+                  strerror(workers[i].error));
+            rc = -1;
+        }
+        pages += workers[i].pages;
+    }
+    elapsed = now() - start;
+
+    if ( !rc )
+        printf("%3u threads: %12.0f pages/s %10.0f pages/s/thread\n",
+               nr, pages / elapsed, pages / elapsed / nr);
+
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max = sysconf(_SC_NPROCESSORS_ONLN), seconds = 1, nr;
+    xc_interface *xch;
+    int rc = 0;
+
+    if ( max > MAX_THREADS )
+        max = MAX_THREADS;
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        seconds = strtoul(argv[2], NULL, 0);
+    if ( !max || max > MAX_THREADS || !seconds )
+        errx(1, "usage: %s [max-threads (1-%u) [seconds-per-round]]",
+             argv[0], MAX_THREADS);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+        err(1, "xc_interface_open");
+
+    if ( xc_domain_create(xch, &domid, &create) )
+        err(1, "xc_domain_create");
+
+    if ( xc_domain_setmaxmem(xch, domid, -1) )
+    {
+        xc_domain_destroy(xch, domid);
+        err(1, "xc_domain_setmaxmem");
+    }
+
+    printf("Populate / release stress: d%u, %u pages per batch, %us per round\n",
+           domid, BATCH, seconds);
+
+    for ( nr = 1; !rc && nr <= max; nr *= 2 )
+        rc = run_round(nr, seconds);
+    if ( !rc && (nr / 2) != max )
+        rc = run_round(max, seconds);
+
+    if ( xc_domain_destroy(xch, domid) )
+        err(1, "xc_domain_destroy");
+    xc_interface_close(xch);
+
+    return !!rc;
+}
@@ -0,0 +1,91 @@
+/*
+ * Test harness for the radix tree code.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_RADIX_TREE_
+#define _TEST_RADIX_TREE_
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xen-tools/common-macros.h>
+
+#define ASSERT(x) assert(x)
+#define BUG_ON(x) assert(!(x))
+#define cf_check
+#define __init
+#define __read_mostly
+#define EXPORT_SYMBOL(s)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define BITS_PER_LONG (8 * sizeof(long))
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+/* Run the initcall before main(). */
+#define presmp_initcall(fn) \
+    static void __attribute__((__constructor__)) init_ ## fn(void) { fn(); }
+
+/*
+ * Readers run concurrently with one writer, so publication needs release
+ * semantics, and reads must not be torn or re-done.
+ */
+#define __rcu
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* Callbacks are deferred until rcu_barrier(), i.e. until no reader runs. */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void rcu_barrier(void);
+
+/* Each thread stands for a CPU. */
+#define DEFINE_PER_CPU(type, name) __thread type per_cpu__ ## name
+#define this_cpu(name) per_cpu__ ## name
+#define per_cpu(name, cpu) this_cpu(name)
+
+struct notifier_block {
+    int (*notifier_call)(struct notifier_block *nfb, unsigned long action,
+                         void *hcpu);
+};
+#define CPU_DEAD 0
+#define NOTIFY_DONE 0
+#define register_cpu_notifier(nb) ((void)(nb))
+
+/* Count allocations, for the preloading test. */
+extern __thread unsigned long nr_allocs;
+#define xmalloc(type) (nr_allocs++, (type *)malloc(sizeof(type)))
+#define xfree(p) free(p)
+
+#include "radix-tree.h"
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,322 @@
+/*
+ * Unit tests and lookup benchmark for the radix tree code.
+ *
+ * The radix tree code is built from xen/common/radix-tree.c.  Random
+ * insertions and deletions are checked against a plain array, as is
+ * insertion without allocating after radix_tree_preload().
+ *
+ * The benchmark mimics the pirq tree of a guest with many passed through
+ * interrupts: reader threads look up pirqs while a writer keeps mapping and
+ * unmapping some.  It is run with the readers taking a read lock, as if
+ * excluding the writer with the domain's event lock, and then locklessly
+ * relying on RCU, with the writer only serialising against itself.
+ *
+ * Usage: test_radix_tree [max-readers]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "emul.h"
+
+#define ARRAY_ENTRIES 4096
+#define RANDOM_OPS    100000
+
+#define NR_PIRQS      2048
+#define MAX_READERS   64
+#define ROUND_NS      500000000UL
+
+#define EXPECT(x) do {                                                  \
+    if ( !(x) )                                                         \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: expectation `%s' failed\n",             \
+                __func__, __LINE__, #x);                                \
+        exit(1);                                                        \
+    }                                                                   \
+} while ( 0 )
+
+__thread unsigned long nr_allocs;
+
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rcu_head *rcu_list;
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+    head->func = func;
+    pthread_mutex_lock(&rcu_lock);
+    head->next = rcu_list;
+    rcu_list = head;
+    pthread_mutex_unlock(&rcu_lock);
+}
+
+void rcu_barrier(void)
+{
+    struct rcu_head *head;
+
+    pthread_mutex_lock(&rcu_lock);
+    while ( (head = rcu_list) != NULL )
+    {
+        rcu_list = head->next;
+        head->func(head);
+    }
+    pthread_mutex_unlock(&rcu_lock);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Small indices like pirqs, plus a few far apart to make the tree tall. */
+static unsigned long random_index(void)
+{
+    unsigned long i = rand() % ARRAY_ENTRIES;
+
+    return i < ARRAY_ENTRIES - 8 ? i : i << 40;
+}
+
+static void test_random(void)
+{
+    static bool present[ARRAY_ENTRIES];
+    struct radix_tree_root root;
+    unsigned int i;
+
+    radix_tree_init(&root);
+    srand(1);
+
+    for ( i = 0; i < RANDOM_OPS; i++ )
+    {
+        unsigned long idx = random_index();
+        unsigned int slot = idx >> 40 ?: idx;
+        void *val = radix_tree_ulong_to_ptr(idx);
+
+        if ( rand() & 1 )
+        {
+            int rc = radix_tree_insert(&root, idx, val);
+
+            EXPECT(rc == (present[slot] ? -EEXIST : 0));
+            present[slot] = true;
+        }
+        else
+        {
+            EXPECT(radix_tree_delete(&root, idx) ==
+                   (present[slot] ? val : NULL));
+            present[slot] = false;
+        }
+    }
+
+    for ( i = 0; i < ARRAY_ENTRIES; i++ )
+    {
+        unsigned long idx = i < ARRAY_ENTRIES - 8 ? i : (unsigned long)i << 40;
+
+        EXPECT(radix_tree_lookup(&root, idx) ==
+               (present[i] ? radix_tree_ulong_to_ptr(idx) : NULL));
+    }
+
+    radix_tree_destroy(&root, NULL);
+    rcu_barrier();
+}
+
+static void test_preload(void)
+{
+    struct radix_tree_root root;
+
+    radix_tree_init(&root);
+    EXPECT(!radix_tree_insert(&root, 1, radix_tree_int_to_ptr(1)));
+
+    /* Growing to full height, and filling the path, needs no allocation. */
+    EXPECT(!radix_tree_preload());
+    nr_allocs = 0;
+    EXPECT(!radix_tree_insert(&root, ~0UL, radix_tree_int_to_ptr(2)));
+    EXPECT(!nr_allocs);
+
+    /* Spare nodes are kept, and topped up again. */
+    EXPECT(!radix_tree_insert(&root, 2, radix_tree_int_to_ptr(3)));
+    EXPECT(!nr_allocs);
+    EXPECT(!radix_tree_preload());
+    EXPECT(nr_allocs);
+
+    EXPECT(radix_tree_lookup(&root, ~0UL) == radix_tree_int_to_ptr(2));
+
+    radix_tree_destroy(&root, NULL);
+    rcu_barrier();
+}
+
+static struct radix_tree_root pirq_tree;
+static pthread_rwlock_t event_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool go, stop, lockless;
+
+struct reader {
+    pthread_t thread;
+    unsigned long lookups;
+};
+
+static struct reader readers[MAX_READERS];
+
+static void *reader_fn(void *arg)
+{
+    struct reader *r = arg;
+    unsigned int seed = r - readers, pirq;
+
+    while ( !go )
+        ;
+
+    while ( !stop )
+    {
+        void *val;
+
+        pirq = rand_r(&seed) % NR_PIRQS;
+
+        if ( lockless )
+            val = radix_tree_lookup(&pirq_tree, pirq);
+        else
+        {
+            pthread_rwlock_rdlock(&event_lock);
+            val = radix_tree_lookup(&pirq_tree, pirq);
+            pthread_rwlock_unlock(&event_lock);
+        }
+
+        EXPECT(!val || val == radix_tree_int_to_ptr(pirq));
+        r->lookups++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Even pirqs stay mapped, for leaf nodes never to be freed (which would
+ * defer an unbounded amount of memory to rcu_barrier()).  Odd ones are
+ * mapped and unmapped in turn.
+ */
+static void *writer_fn(void *arg)
+{
+    unsigned int seed = 0;
+
+    while ( !go )
+        ;
+
+    while ( !stop )
+    {
+        unsigned int pirq = (rand_r(&seed) % (NR_PIRQS / 2)) * 2 + 1;
+
+        radix_tree_preload();
+
+        if ( lockless )
+            pthread_mutex_lock(&writer_lock);
+        else
+            pthread_rwlock_wrlock(&event_lock);
+
+        if ( radix_tree_insert(&pirq_tree, pirq, radix_tree_int_to_ptr(pirq)) )
+            radix_tree_delete(&pirq_tree, pirq);
+
+        if ( lockless )
+            pthread_mutex_unlock(&writer_lock);
+        else
+            pthread_rwlock_unlock(&event_lock);
+    }
+
+    return NULL;
+}
+
+static double run_round(unsigned int nr)
+{
+    pthread_t writer;
+    unsigned long lookups = 0;
+    unsigned int i;
+    struct timespec ts = { .tv_nsec = ROUND_NS };
+    double t;
+
+    go = stop = false;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        readers[i].lookups = 0;
+        EXPECT(!pthread_create(&readers[i].thread, NULL, reader_fn,
+                               &readers[i]));
+    }
+    EXPECT(!pthread_create(&writer, NULL, writer_fn, NULL));
+
+    t = now_ns();
+    go = true;
+    nanosleep(&ts, NULL);
+    stop = true;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(readers[i].thread, NULL);
+        lookups += readers[i].lookups;
+    }
+    pthread_join(writer, NULL);
+    t = now_ns() - t;
+
+    return lookups / t * 1e9;
+}
+
+static void bench(unsigned int max)
+{
+    unsigned int nr, i;
+
+    radix_tree_init(&pirq_tree);
+    for ( i = 0; i < NR_PIRQS; i += 2 )
+        EXPECT(!radix_tree_insert(&pirq_tree, i, radix_tree_int_to_ptr(i)));
+
+    printf("pirq lookups with concurrent map/unmap, %lums per round\n",
+           ROUND_NS / 1000000);
+    printf("readers      locked/s    lockless/s\n");
+
+    for ( nr = 1; nr <= max; nr *= 2 )
+    {
+        double locked, rcu;
+
+        lockless = false;
+        locked = run_round(nr);
+        lockless = true;
+        rcu = run_round(nr);
+
+        printf("%7u %13.0f %13.0f\n", nr, locked, rcu);
+    }
+
+    radix_tree_destroy(&pirq_tree, NULL);
+    rcu_barrier();
+}
+
+int main(int argc, char **argv)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int max = cpus > 1 ? min(cpus - 1, (long)MAX_READERS) : 1;
+
+    if ( argc > 1 )
+        max = strtoul(argv[1], NULL, 0);
+    if ( !max || max > MAX_READERS )
+    {
+        fprintf(stderr, "usage: %s [max-readers (1-%u)]\n",
+                argv[0], MAX_READERS);
+        return 1;
+    }
+
+    test_random();
+    test_preload();
+    printf("radix tree tests passed\n");
+
+    bench(max);
+
+    return 0;
+}
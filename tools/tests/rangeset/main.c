@@ -0,0 +1,248 @@
+/*
+ * Unit tests and lookup benchmark for the rangeset code.
+ *
+ * The rangeset code is built from xen/common/rangeset.c.  Random additions
+ * and removals are checked against a plain bitmap, and lookups are timed
+ * for sets of 10, 1000 and 100000 ranges.  The sorted list walk rangesets
+ * used before being backed by a red-black tree is kept here as a baseline.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "emul.h"
+
+#define BITMAP_SIZE 4096
+#define RANDOM_OPS  20000
+
+/* Lookups to time per set, scaled down for the list baseline. */
+#define LOOKUPS     2000000UL
+#define LIST_WORK   200000000UL
+
+#define EXPECT(x) do {                                                  \
+    if ( !(x) )                                                         \
+    {                                                                   \
+        fprintf(stderr, "%s:%d: expectation `%s' failed\n",             \
+                __func__, __LINE__, #x);                                \
+        exit(1);                                                        \
+    }                                                                   \
+} while ( 0 )
+
+static bool bitmap[BITMAP_SIZE];
+
+struct check_state {
+    unsigned long next;
+    bool have_prev;
+    unsigned long prev_e;
+};
+
+/* Ranges must be reported in order, disjoint and not adjacent. */
+static int cf_check check_range(unsigned long s, unsigned long e, void *data)
+{
+    struct check_state *st = data;
+    unsigned long i;
+
+    EXPECT(s <= e);
+    EXPECT(!st->have_prev || st->prev_e + 1 < s);
+
+    for ( i = st->next; i < s; i++ )
+        EXPECT(!bitmap[i]);
+    for ( i = s; i <= e; i++ )
+        EXPECT(bitmap[i]);
+
+    st->have_prev = true;
+    st->prev_e = e;
+    st->next = e + 1;
+
+    return 0;
+}
+
+static void check_set(struct rangeset *r)
+{
+    struct check_state st = { 0 };
+    unsigned long i;
+
+    EXPECT(!rangeset_report_ranges(r, 0, ~0UL, check_range, &st));
+    for ( i = st.next; i < BITMAP_SIZE; i++ )
+        EXPECT(!bitmap[i]);
+    EXPECT(rangeset_is_empty(r) == !st.have_prev);
+}
+
+static void test_random(void)
+{
+    struct rangeset *r = rangeset_new(NULL, "random", 0);
+    unsigned int op;
+
+    EXPECT(r);
+    srand(42);
+
+    for ( op = 0; op < RANDOM_OPS; op++ )
+    {
+        unsigned long s = rand() % BITMAP_SIZE;
+        unsigned long e = s + rand() % (op & 1 ? 64 : 8);
+        bool add = rand() % 2, v;
+        unsigned long i;
+
+        if ( e >= BITMAP_SIZE )
+            e = BITMAP_SIZE - 1;
+
+        if ( add )
+            EXPECT(!rangeset_add_range(r, s, e));
+        else
+            EXPECT(!rangeset_remove_range(r, s, e));
+
+        for ( i = s; i <= e; i++ )
+            bitmap[i] = add;
+
+        /* Spot check contains/overlaps against the bitmap. */
+        v = true;
+        for ( i = s; i <= e; i++ )
+            v &= bitmap[i];
+        EXPECT(rangeset_contains_range(r, s, e) == v);
+        EXPECT(rangeset_overlaps_range(r, s, e) == add);
+
+        if ( !(op % 1000) )
+            check_set(r);
+    }
+
+    check_set(r);
+    rangeset_destroy(r);
+    memset(bitmap, 0, sizeof(bitmap));
+}
+
+static void test_claim_swap(void)
+{
+    struct rangeset *a = rangeset_new(NULL, "a", 0);
+    struct rangeset *b = rangeset_new(NULL, "b", 0);
+    unsigned long s;
+
+    EXPECT(a && b);
+
+    EXPECT(!rangeset_add_range(a, 0, 9));
+    EXPECT(!rangeset_add_range(a, 20, 29));
+    EXPECT(!rangeset_claim_range(a, 5, &s));
+    EXPECT(s == 10);
+    EXPECT(rangeset_contains_range(a, 0, 14));
+    EXPECT(!rangeset_claim_range(a, 6, &s));
+    EXPECT(s == 30);
+    EXPECT(rangeset_contains_range(a, 20, 35));
+
+    EXPECT(!rangeset_add_range(b, 100, 200));
+    rangeset_swap(a, b);
+    EXPECT(rangeset_contains_range(a, 100, 200));
+    EXPECT(!rangeset_overlaps_range(a, 0, 99));
+    EXPECT(rangeset_contains_range(b, 0, 14));
+    EXPECT(rangeset_contains_singleton(b, 35));
+
+    /* Removing from the middle splits a range. */
+    EXPECT(!rangeset_remove_range(a, 150, 150));
+    EXPECT(rangeset_contains_range(a, 100, 149));
+    EXPECT(rangeset_contains_range(a, 151, 200));
+    EXPECT(!rangeset_contains_singleton(a, 150));
+
+    rangeset_destroy(a);
+    rangeset_destroy(b);
+}
+
+/* The rangeset lookup as it was before: a walk of a sorted list. */
+struct list_range {
+    struct list_head list;
+    unsigned long s, e;
+};
+
+static bool list_contains(const struct list_head *head, unsigned long s)
+{
+    const struct list_range *x = NULL, *y;
+
+    list_for_each_entry ( y, head, list )
+    {
+        if ( y->s > s )
+            break;
+        x = y;
+    }
+
+    return x && x->e >= s;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(unsigned long nr)
+{
+    struct rangeset *r = rangeset_new(NULL, "bench", 0);
+    struct list_range *ranges = calloc(nr, sizeof(*ranges));
+    unsigned long i, list_lookups = max(LIST_WORK / nr, 1000UL);
+    unsigned long hits = 0, list_hits = 0;
+    LIST_HEAD(head);
+    double t;
+
+    EXPECT(r && ranges);
+
+    /* Ranges [4i, 4i + 1], so that half of the lookups below hit. */
+    for ( i = 0; i < nr; i++ )
+    {
+        EXPECT(!rangeset_add_range(r, i * 4, i * 4 + 1));
+        ranges[i].s = i * 4;
+        ranges[i].e = i * 4 + 1;
+        list_add_tail(&ranges[i].list, &head);
+    }
+
+    srand(nr);
+    t = now_ns();
+    for ( i = 0; i < LOOKUPS; i++ )
+        hits += rangeset_contains_singleton(r, rand() % (nr * 4));
+    t = now_ns() - t;
+    printf("%7lu ranges: tree %8.1f ns/lookup", nr, t / LOOKUPS);
+
+    srand(nr);
+    t = now_ns();
+    for ( i = 0; i < list_lookups; i++ )
+        list_hits += list_contains(&head, rand() % (nr * 4));
+    t = now_ns() - t;
+    printf(", list %10.1f ns/lookup\n", t / list_lookups);
+
+    /* Defeat the compiler dropping the lookups, and sanity check them. */
+    EXPECT(hits <= LOOKUPS && list_hits <= list_lookups);
+
+    rangeset_destroy(r);
+    free(ranges);
+}
+
+int main(int argc, char **argv)
+{
+    test_random();
+    test_claim_swap();
+    printf("rangeset tests passed\n");
+
+    bench(10);
+    bench(1000);
+    bench(100000);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
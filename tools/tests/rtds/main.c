@@ -0,0 +1,196 @@
+/*
+ * Benchmark of the RTDS scheduler run and replenishment queues.
+ *
+ * The run queue helpers (and struct rt_unit) are taken from
+ * xen/common/sched/rt.c at build time: units are kept in a red-black tree
+ * ordered by priority_level and deadline, and equal keys are served in FIFO
+ * order. The old sorted list implementation is kept here as a baseline.
+ *
+ * Each "decision" takes the unit at the front of the queue, pushes its
+ * deadline one period ahead and queues it again, which is what the
+ * replenishment timer and rt_schedule() do for each unit.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "emul.h"
+
+#define DECISIONS 200000
+
+#include "rt-queue.c"
+
+static void tree_insert(struct rb_root *queue, struct rt_unit *svc)
+{
+    RB_CLEAR_NODE(&svc->q_node);
+    deadline_runq_insert(svc, &svc->q_node, queue);
+}
+
+static struct rt_unit *tree_decide(struct rb_root *queue)
+{
+    struct rt_unit *svc = q_elem(rb_first(queue));
+
+    if ( !deadline_queue_remove(queue, &svc->q_node) )
+    {
+        fprintf(stderr, "front of the queue not reported as such\n");
+        exit(1);
+    }
+    svc->cur_deadline += svc->period;
+    deadline_runq_insert(svc, &svc->q_node, queue);
+
+    return svc;
+}
+
+static void list_insert(struct list_head *queue, struct rt_unit *svc)
+{
+    struct list_head *iter;
+
+    list_for_each ( iter, queue )
+        if ( compare_unit_priority(svc, list_entry(iter, struct rt_unit,
+                                                   q_elem)) > 0 )
+            break;
+    list_add_tail(&svc->q_elem, iter);
+}
+
+static struct rt_unit *list_decide(struct list_head *queue)
+{
+    struct rt_unit *svc = list_entry(queue->next, struct rt_unit, q_elem);
+
+    list_del(&svc->q_elem);
+    svc->cur_deadline += svc->period;
+    list_insert(queue, svc);
+
+    return svc;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void init_units(struct rt_unit *units, unsigned int nr)
+{
+    unsigned int i;
+
+    srand(nr);
+    for ( i = 0; i < nr; i++ )
+    {
+        units[i].period = 1000 + rand() % 100000;
+        units[i].cur_deadline = rand() % units[i].period;
+        units[i].priority_level = 0;
+    }
+}
+
+static bool tree_sorted(const struct rb_root *queue, unsigned int nr)
+{
+    struct rb_node *node;
+    const struct rt_unit *prev = NULL;
+    unsigned int count = 0;
+
+    for ( node = rb_first(queue); node; node = rb_next(node), count++ )
+    {
+        const struct rt_unit *svc = q_elem(node);
+
+        if ( prev && compare_unit_priority(prev, svc) < 0 )
+            return false;
+        prev = svc;
+    }
+
+    return count == nr;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int sizes[] = { 10, 50, 100, 250, 500, 1000 };
+    unsigned int s;
+
+    printf("%6s %12s %12s\n", "units", "tree ns/op", "list ns/op");
+
+    for ( s = 0; s < ARRAY_SIZE(sizes); s++ )
+    {
+        unsigned int nr = sizes[s], i;
+        struct rt_unit *units = calloc(nr, sizeof(*units));
+        struct rt_unit *lunits = calloc(nr, sizeof(*lunits));
+        struct rb_root tree = RB_ROOT;
+        LIST_HEAD(list);
+        const struct rt_unit *t, *l;
+        uint64_t start, tree_ns, list_ns;
+
+        if ( !units || !lunits )
+        {
+            fprintf(stderr, "cannot allocate %u units\n", nr);
+            return 1;
+        }
+
+        init_units(units, nr);
+        for ( i = 0; i < nr; i++ )
+            tree_insert(&tree, &units[i]);
+        start = now_ns();
+        for ( i = 0; i < DECISIONS; i++ )
+            tree_decide(&tree);
+        tree_ns = now_ns() - start;
+
+        if ( !tree_sorted(&tree, nr) )
+        {
+            fprintf(stderr, "%u units: tree not in EDF order\n", nr);
+            return 1;
+        }
+
+        /* Same workload on the list, which must make the same decisions. */
+        init_units(units, nr);
+        init_units(lunits, nr);
+        tree = RB_ROOT;
+        for ( i = 0; i < nr; i++ )
+        {
+            tree_insert(&tree, &units[i]);
+            list_insert(&list, &lunits[i]);
+        }
+        for ( i = 0; i < nr * 4; i++ )
+        {
+            l = list_decide(&list);
+            t = tree_decide(&tree);
+            if ( l - lunits != t - units )
+            {
+                fprintf(stderr, "%u units: tree and list disagree\n", nr);
+                return 1;
+            }
+        }
+
+        start = now_ns();
+        for ( i = 0; i < DECISIONS; i++ )
+            list_decide(&list);
+        list_ns = now_ns() - start;
+
+        printf("%6u %12.1f %12.1f\n", nr, (double)tree_ns / DECISIONS,
+               (double)list_ns / DECISIONS);
+
+        free(units);
+        free(lunits);
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -77,6 +77,9 @@ typedef union {
     };
 } pci_sbdf_t;
 
+#define PCI_CFG_SPACE_SIZE 256
+#define PCI_CFG_SPACE_EXP_SIZE 4096
+
 #define CONFIG_HAS_VPCI
 #include "vpci.h"
 
@@ -86,6 +89,7 @@ typedef union {
 
 #define xzalloc(type) ((type *)calloc(1, sizeof(type)))
 #define xmalloc(type) ((type *)malloc(sizeof(type)))
+#define xzalloc_array(type, num) ((type *)calloc(num, sizeof(type)))
 #define xfree(p) free(p)
 
 #define pci_get_pdev(...) (&test_pdev)
@@ -101,8 +105,6 @@ typedef union {
 #define pci_conf_write16(...)
 #define pci_conf_write32(...)
 
-#define PCI_CFG_SPACE_EXP_SIZE 4096
-
 #define BUG() assert(0)
 #define ASSERT_UNREACHABLE() assert(0)
 
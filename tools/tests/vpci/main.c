@@ -16,6 +16,9 @@
  * License along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <time.h>
+
 #include "emul.h"
 
 /* Single vcpu (current), and single domain with a single PCI device. */
@@ -141,6 +144,58 @@ void multiwrite4_check(unsigned int reg)
     multiread4_check(reg, val);
 }
 
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Measure the rate of accesses to a device with a handler in every dword of
+ * the config space, both to the standard header and the extended space.
+ */
+#define BENCH_ITERATIONS (1u << 24)
+static void bench(void)
+{
+    static uint32_t regs[PCI_CFG_SPACE_EXP_SIZE / 4];
+    unsigned int i, reg;
+    double start, elapsed;
+    uint32_t val, sum = 0;
+
+    for ( reg = 32; reg < PCI_CFG_SPACE_EXP_SIZE; reg += 4 )
+        VPCI_ADD_REG(vpci_read32, vpci_write32, reg, 4, regs[reg / 4]);
+
+    start = now();
+    for ( i = 0; i < BENCH_ITERATIONS; i++ )
+    {
+        reg = (i * 4) % PCI_CFG_SPACE_SIZE;
+        VPCI_WRITE(reg, 4, i);
+        VPCI_READ(reg, 4, val);
+        sum += val;
+    }
+    elapsed = now() - start;
+    printf("standard config space: %12.0f accesses/s\n",
+           2 * BENCH_ITERATIONS / elapsed);
+
+    start = now();
+    for ( i = 0; i < BENCH_ITERATIONS; i++ )
+    {
+        reg = (i * 4) % PCI_CFG_SPACE_EXP_SIZE;
+        VPCI_WRITE(reg, 4, i);
+        VPCI_READ(reg, 4, val);
+        sum += val;
+    }
+    elapsed = now() - start;
+    printf("extended config space: %12.0f accesses/s (%#x)\n",
+           2 * BENCH_ITERATIONS / elapsed, sum);
+
+    for ( reg = 32; reg < PCI_CFG_SPACE_EXP_SIZE; reg += 4 )
+        VPCI_REMOVE_REG(reg, 4);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -154,6 +209,8 @@ main(int argc, char **argv)
     uint16_t r20[2] = { };
     uint32_t r24 = 0;
     uint8_t r28, r30;
+    uint16_t r256, r258;
+    uint32_t r4092;
     unsigned int i;
     int rc;
 
@@ -296,6 +353,33 @@ main(int argc, char **argv)
     VPCI_REMOVE_INVALID_REG(16, 2);
     VPCI_REMOVE_INVALID_REG(30, 2);
 
+    /* Removal of the first handler in a dword must keep the rest reachable. */
+    VPCI_REMOVE_REG(16, 1);
+    multiread4_check(16, ((uint32_t)r16[3] << 24) | (r16[2] << 16) |
+                         (r16[1] << 8) | 0xff);
+    VPCI_WRITE_CHECK(17, 1, 0x5a);
+
+    /* Handlers in the extended config space. */
+    VPCI_READ_CHECK(256, 4, 0xffffffff);
+    VPCI_ADD_REG(vpci_read16, vpci_write16, 258, 2, r258);
+    VPCI_ADD_REG(vpci_read32, vpci_write32, 4092, 4, r4092);
+    VPCI_WRITE_CHECK(258, 2, 0x1234);
+    VPCI_READ_CHECK(256, 4, 0x1234ffff);
+    multiwrite4_check(4092);
+    VPCI_ADD_INVALID_REG(vpci_read32, vpci_write32, 256, 4);
+    VPCI_ADD_REG(vpci_read16, vpci_write16, 256, 2, r256);
+    VPCI_WRITE_CHECK(256, 4, 0xabcd0123);
+    VPCI_REMOVE_REG(256, 2);
+    VPCI_READ_CHECK(256, 4, 0xabcdffff);
+    VPCI_REMOVE_REG(258, 2);
+    VPCI_REMOVE_REG(4092, 4);
+    VPCI_READ_CHECK(256, 4, 0xffffffff);
+    VPCI_READ_CHECK(4092, 4, 0xffffffff);
+
+    /* The benchmark takes a while: only run it when asked to ("-b"). */
+    if ( argc > 1 && !strcmp(argv[1], "-b") )
+        bench();
+
     return 0;
 }
 
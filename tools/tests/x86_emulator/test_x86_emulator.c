@@ -4,6 +4,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <time.h>
 
 asm ( ".pushsection .test, \"ax\", @progbits; .popsection" );
 
@@ -890,6 +891,141 @@ static const struct {
 };
 #endif
 
+/*
+ * REP MOVS / REP STOS throughput, both one iteration per emulator invocation
+ * (no rep_* hooks) and with the string op handed to rep_* hooks in batches
+ * of up to bench_batch bytes, much like the HVM emulation code does.
+ */
+static unsigned long bench_batch;
+
+static int bench_rep_movs(
+    enum x86_segment src_seg,
+    unsigned long src_offset,
+    enum x86_segment dst_seg,
+    unsigned long dst_offset,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    if ( ctxt->regs->eflags & X86_EFLAGS_DF )
+        return X86EMUL_UNHANDLEABLE;
+
+    *reps = min(*reps, bench_batch / bytes_per_rep);
+    memcpy((void *)dst_offset, (void *)src_offset, *reps * bytes_per_rep);
+
+    return X86EMUL_OKAY;
+}
+
+static int bench_rep_stos(
+    void *p_data,
+    enum x86_segment seg,
+    unsigned long offset,
+    unsigned int bytes_per_rep,
+    unsigned long *reps,
+    struct x86_emulate_ctxt *ctxt)
+{
+    unsigned long i;
+
+    if ( ctxt->regs->eflags & X86_EFLAGS_DF )
+        return X86EMUL_UNHANDLEABLE;
+
+    *reps = min(*reps, bench_batch / bytes_per_rep);
+    for ( i = 0; i < *reps; i++ )
+        memcpy((void *)offset + i * bytes_per_rep, p_data, bytes_per_rep);
+
+    return X86EMUL_OKAY;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_rep(struct x86_emulate_ctxt *ctxt, char *instr)
+{
+    static const struct {
+        const char *name;
+        uint8_t opc;
+        unsigned int size;
+    } insns[] = {
+        { "rep stosb", 0xaa, 1 },
+        { "rep stosl", 0xab, 4 },
+        { "rep movsb", 0xa4, 1 },
+        { "rep movsl", 0xa5, 4 },
+    };
+    static const unsigned long lengths[] = { 64, 4096, 65536, 1 << 20 };
+    static const unsigned long batches[] = { 0, 4096, 32768, 65536 };
+    unsigned long max = lengths[ARRAY_SIZE(lengths) - 1];
+    struct x86_emulate_ops ops = emulops;
+    struct cpu_user_regs *regs = ctxt->regs;
+    char *src = malloc(max), *dst = malloc(max);
+    unsigned int i, j, k;
+
+    if ( !src || !dst )
+    {
+        fprintf(stderr, "Benchmark buffer allocation failed\n");
+        return 1;
+    }
+    memset(src, 0xa5, max);
+
+    printf("%-10s %8s", "", "bytes");
+    for ( k = 0; k < ARRAY_SIZE(batches); k++ )
+        if ( batches[k] )
+            printf(" %7lu-batch", batches[k]);
+        else
+            printf(" %13s", "per-rep");
+    printf("   (MB/s)\n");
+
+    for ( i = 0; i < ARRAY_SIZE(insns); i++ )
+        for ( j = 0; j < ARRAY_SIZE(lengths); j++ )
+        {
+            printf("%-10s %8lu", insns[i].name, lengths[j]);
+
+            for ( k = 0; k < ARRAY_SIZE(batches); k++ )
+            {
+                unsigned long done = 0;
+                double start = bench_now(), elapsed;
+
+                bench_batch = batches[k];
+                ops.rep_movs = bench_batch ? bench_rep_movs : NULL;
+                ops.rep_stos = bench_batch ? bench_rep_stos : NULL;
+
+                do {
+                    instr[0] = 0xf3; instr[1] = insns[i].opc;
+                    regs->eflags = X86_EFLAGS_IF | X86_EFLAGS_MBS;
+                    regs->eip    = (unsigned long)instr;
+                    regs->ecx    = lengths[j] / insns[i].size;
+                    regs->eax    = 0x5a5a5a5a;
+                    regs->esi    = (unsigned long)src;
+                    regs->edi    = (unsigned long)dst;
+
+                    while ( regs->ecx )
+                        if ( x86_emulate(ctxt, &ops) != X86EMUL_OKAY )
+                        {
+                            printf(" failed\n");
+                            return 1;
+                        }
+
+                    done += lengths[j];
+                    elapsed = bench_now() - start;
+                } while ( elapsed < 0.2 );
+
+                printf(" %13.1f", done / elapsed / (1 << 20));
+            }
+
+            printf("\n");
+        }
+
+    free(src);
+    free(dst);
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     struct x86_emulate_ctxt ctxt;
@@ -928,6 +1064,9 @@ int main(int argc, char **argv)
     if ( !stack_exec )
         printf("Warning: Stack could not be made executable (%d).\n", errno);
 
+    if ( argc > 1 && !strcmp(argv[1], "--bench-rep") )
+        return bench_rep(&ctxt, instr);
+
  rmw_restart:
     printf("%-40s", "Testing addl %ecx,(%eax)...");
     instr[0] = 0x01; instr[1] = 0x08;
@@ -0,0 +1,508 @@
+/*
+ * test-xenstore-bench.c
+ *
+ * Xenstore load generator: simulate a number of domains booting in
+ * parallel, each doing the xenstore traffic of a toolstack creating its
+ * devices and of the backends and frontends going through the xenbus
+ * handshake.  Reports the achieved operation rate, the latency of single
+ * operations and the latency of watch delivery.
+ *
+ * Nothing here is specific to one xenstore implementation, so the numbers
+ * can be compared between xenstored and oxenstored.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenstore.h>
+
+#include <xen-tools/common-macros.h>
+
+#define BENCH_PATH      "xenstore-bench"
+#define WATCH_TIMEOUT   10000          /* ms */
+#define MAX_TA_LOOPS    100
+
+static const char *const dev_types[] = { "vif", "vbd", "console", "vkbd" };
+
+struct samples {
+    uint64_t *ns;
+    unsigned int n, size;
+};
+
+struct dom {
+    pthread_t thread;
+    unsigned int id;
+    struct xs_handle *be;           /* toolstack and backend connection */
+    struct xs_handle *fe;           /* frontend connection */
+    struct samples op;
+    struct samples watch;
+    unsigned long ta_retries;
+    int ret;
+};
+
+static unsigned int n_domains = 8;
+static unsigned int n_devices = 4;
+static unsigned int iterations = 10;
+
+static struct option options[] = {
+    { "domains", 1, NULL, 'd' },
+    { "devices", 1, NULL, 'D' },
+    { "iterations", 1, NULL, 'i' },
+    { "help", 0, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+
+    return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void sample_add(struct samples *s, uint64_t ns)
+{
+    if ( s->n == s->size )
+    {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->ns = realloc(s->ns, s->size * sizeof(*s->ns));
+        if ( !s->ns )
+            err(2, "realloc() failure");
+    }
+    s->ns[s->n++] = ns;
+}
+
+/* Time a single xenstore operation and account it to domain d. */
+#define TIMED(d, expr) ({                           \
+    uint64_t t0_ = now_ns();                        \
+    typeof(expr) r_ = (expr);                       \
+    sample_add(&(d)->op, now_ns() - t0_);           \
+    r_;                                             \
+})
+
+static bool timed_write(struct dom *d, struct xs_handle *h,
+                        xs_transaction_t t, const char *path,
+                        const char *val)
+{
+    return TIMED(d, xs_write(h, t, path, val, strlen(val)));
+}
+
+/*
+ * Wait for the watch event on path to arrive at h, dropping others.  The
+ * event for a path is only expected once the previous one was consumed, so
+ * anything else is a stale event.
+ */
+static int wait_watch(struct xs_handle *h, const char *path)
+{
+    struct pollfd pfd = { .fd = xs_fileno(h), .events = POLLIN };
+    char **vec;
+    bool match;
+
+    for ( ;; )
+    {
+        vec = xs_check_watch(h);
+        if ( vec )
+        {
+            match = !strcmp(vec[XS_WATCH_PATH], path);
+            free(vec);
+            if ( match )
+                return 0;
+            continue;
+        }
+        if ( errno != EAGAIN )
+            return errno;
+
+        switch ( poll(&pfd, 1, WATCH_TIMEOUT) )
+        {
+        case -1:
+            if ( errno != EINTR )
+                return errno;
+            break;
+        case 0:
+            return ETIMEDOUT;
+        }
+    }
+}
+
+/*
+ * One step of the xenbus handshake: one end writes its state node, the
+ * other end receives the watch event and reads the new state.  The watch
+ * latency is measured from the start of the write to the arrival of the
+ * event.
+ */
+static int handshake_step(struct dom *d, struct xs_handle *wh,
+                          struct xs_handle *rh, const char *path,
+                          const char *state)
+{
+    uint64_t t0 = now_ns();
+    unsigned int len;
+    char *val;
+    int ret;
+
+    if ( !timed_write(d, wh, XBT_NULL, path, state) )
+        return errno;
+    ret = wait_watch(rh, path);
+    if ( ret )
+        return ret;
+    sample_add(&d->watch, now_ns() - t0);
+
+    val = TIMED(d, xs_read(rh, XBT_NULL, path, &len));
+    if ( !val )
+        return errno;
+    ret = strcmp(val, state) ? EIO : 0;
+    free(val);
+
+    return ret;
+}
+
+/* Run body in a transaction on h, retrying on conflicts. */
+#define IN_TRANSACTION(d, h, t, body) ({                        \
+    int ret_ = EAGAIN, loop_;                                   \
+    for ( loop_ = 0; ret_ == EAGAIN && loop_ < MAX_TA_LOOPS;    \
+          loop_++ )                                             \
+    {                                                           \
+        bool ok_;                                               \
+        (t) = TIMED(d, xs_transaction_start(h));                \
+        if ( (t) == XBT_NULL )                                  \
+        {                                                       \
+            ret_ = errno;                                       \
+            break;                                              \
+        }                                                       \
+        ok_ = (body);                                           \
+        if ( !TIMED(d, xs_transaction_end(h, t, !ok_)) )        \
+            ret_ = ok_ ? errno : EIO;                           \
+        else                                                    \
+            ret_ = ok_ ? 0 : EIO;                               \
+        if ( ret_ == EAGAIN )                                   \
+            (d)->ta_retries++;                                  \
+    }                                                           \
+    ret_;                                                       \
+})
+
+static void dev_paths(struct dom *d, unsigned int dev, char *be, char *fe,
+                      size_t len)
+{
+    const char *type = dev_types[dev % ARRAY_SIZE(dev_types)];
+
+    snprintf(be, len, "%s/%u/%u/backend/%s/%u/%u", BENCH_PATH, getpid(),
+             d->id, type, d->id, dev);
+    snprintf(fe, len, "%s/%u/%u/device/%s/%u", BENCH_PATH, getpid(),
+             d->id, type, dev);
+}
+
+#define NODE(buf, dir, name) \
+    (snprintf(buf, sizeof(buf), "%s/%s", dir, name), buf)
+
+/* Toolstack: create the backend and frontend directories of a device. */
+static bool dev_create(struct dom *d, xs_transaction_t t, const char *be,
+                       const char *fe)
+{
+    struct xs_permissions perms[2] = {
+        { .id = 0, .perms = XS_PERM_NONE },
+        { .id = d->id, .perms = XS_PERM_READ },
+    };
+    char node[256], val[16];
+
+    snprintf(val, sizeof(val), "%u", d->id);
+
+    return timed_write(d, d->be, t, NODE(node, be, "frontend"), fe) &&
+           timed_write(d, d->be, t, NODE(node, be, "frontend-id"), val) &&
+           timed_write(d, d->be, t, NODE(node, be, "online"), "1") &&
+           timed_write(d, d->be, t, NODE(node, be, "feature-foo"), "1") &&
+           timed_write(d, d->be, t, NODE(node, be, "state"), "1") &&
+           timed_write(d, d->be, t, NODE(node, fe, "backend"), be) &&
+           timed_write(d, d->be, t, NODE(node, fe, "backend-id"), "0") &&
+           timed_write(d, d->be, t, NODE(node, fe, "state"), "1") &&
+           TIMED(d, xs_set_permissions(d->be, t, fe, perms,
+                                       ARRAY_SIZE(perms)));
+}
+
+/* Frontend: publish the ring details after reading the backend features. */
+static bool dev_frontend_setup(struct dom *d, xs_transaction_t t,
+                               const char *fe)
+{
+    char node[256];
+
+    return timed_write(d, d->fe, t, NODE(node, fe, "ring-ref"), "8") &&
+           timed_write(d, d->fe, t, NODE(node, fe, "event-channel"), "9");
+}
+
+static int dev_handshake(struct dom *d, const char *be, const char *fe)
+{
+    char be_state[256], fe_state[256];
+    xs_transaction_t t;
+    unsigned int num;
+    char **dir;
+    int ret;
+
+    NODE(be_state, be, "state");
+    NODE(fe_state, fe, "state");
+
+    ret = handshake_step(d, d->be, d->fe, be_state, "2");    /* InitWait */
+    if ( ret )
+        return ret;
+
+    dir = TIMED(d, xs_directory(d->fe, XBT_NULL, be, &num));
+    if ( !dir )
+        return errno;
+    free(dir);
+
+    ret = IN_TRANSACTION(d, d->fe, t, dev_frontend_setup(d, t, fe));
+    if ( ret )
+        return ret;
+
+    ret = handshake_step(d, d->fe, d->be, fe_state, "3");    /* Initialised */
+    if ( !ret )
+        ret = handshake_step(d, d->be, d->fe, be_state, "4"); /* Connected */
+    if ( !ret )
+        ret = handshake_step(d, d->fe, d->be, fe_state, "4");
+
+    return ret;
+}
+
+/* Register a watch and consume the initial event it fires. */
+static int watch_path(struct dom *d, struct xs_handle *h, const char *path,
+                      const char *token)
+{
+    if ( !TIMED(d, xs_watch(h, path, token)) )
+        return errno;
+
+    return wait_watch(h, path);
+}
+
+static int dom_boot(struct dom *d)
+{
+    char be[n_devices][256], fe[n_devices][256];
+    char be_state[256], fe_state[256], top[256];
+    xs_transaction_t t;
+    unsigned int dev;
+    int ret;
+
+    for ( dev = 0; dev < n_devices; dev++ )
+    {
+        dev_paths(d, dev, be[dev], fe[dev], sizeof(be[dev]));
+        ret = IN_TRANSACTION(d, d->be, t, dev_create(d, t, be[dev], fe[dev]));
+        if ( ret )
+            return ret;
+    }
+
+    for ( dev = 0; dev < n_devices; dev++ )
+    {
+        ret = watch_path(d, d->be, NODE(fe_state, fe[dev], "state"), "be");
+        if ( !ret )
+            ret = watch_path(d, d->fe, NODE(be_state, be[dev], "state"),
+                             "fe");
+        if ( ret )
+            return ret;
+    }
+
+    for ( dev = 0; dev < n_devices; dev++ )
+    {
+        ret = dev_handshake(d, be[dev], fe[dev]);
+        if ( ret )
+            return ret;
+    }
+
+    for ( dev = 0; dev < n_devices; dev++ )
+    {
+        TIMED(d, xs_unwatch(d->be, NODE(fe_state, fe[dev], "state"), "be"));
+        TIMED(d, xs_unwatch(d->fe, NODE(be_state, be[dev], "state"), "fe"));
+    }
+
+    snprintf(top, sizeof(top), "%s/%u/%u", BENCH_PATH, getpid(), d->id);
+    if ( !TIMED(d, xs_rm(d->be, XBT_NULL, top)) )
+        return errno;
+
+    return 0;
+}
+
+static void *dom_thread(void *arg)
+{
+    struct dom *d = arg;
+    unsigned int i;
+
+    for ( i = 0; i < iterations && !d->ret; i++ )
+        d->ret = dom_boot(d);
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void report(const char *what, struct samples *s)
+{
+    if ( !s->n )
+        return;
+
+    qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+    printf("%-14s: p50 %"PRIu64" us, p99 %"PRIu64" us, max %"PRIu64" us\n",
+           what, s->ns[(s->n - 1) / 2] / 1000,
+           s->ns[(s->n - 1) * 99 / 100] / 1000, s->ns[s->n - 1] / 1000);
+}
+
+static void merge(struct samples *to, const struct samples *from)
+{
+    unsigned int i;
+
+    for ( i = 0; i < from->n; i++ )
+        sample_add(to, from->ns[i]);
+}
+
+static void usage(int ret)
+{
+    FILE *out;
+
+    out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: test-xenstore-bench [<options>]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -d|--domains <n>     simulate <n> domains (default %u)\n",
+            n_domains);
+    fprintf(out, "  -D|--devices <n>     with <n> devices each (default %u)\n",
+            n_devices);
+    fprintf(out, "  -i|--iterations <i>  boot each domain <i> times (default %u)\n",
+            iterations);
+    fprintf(out, "  -h|--help            print this help\n");
+    exit(ret);
+}
+
+int main(int argc, char *argv[])
+{
+    struct samples op = { }, watch = { };
+    unsigned long ta_retries = 0;
+    struct dom *doms;
+    uint64_t start, elapsed;
+    unsigned int i;
+    int opt, ret = 0;
+    struct xs_handle *xsh;
+    char *top;
+
+    while ( (opt = getopt_long(argc, argv, "d:D:i:h", options,
+                               NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            n_domains = atoi(optarg);
+            break;
+        case 'D':
+            n_devices = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'h':
+            usage(0);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if ( optind != argc || !n_domains || !iterations )
+        usage(1);
+
+    doms = calloc(n_domains, sizeof(*doms));
+    if ( !doms )
+        err(2, "calloc() failure");
+
+    for ( i = 0; i < n_domains; i++ )
+    {
+        doms[i].id = i + 1;
+        doms[i].be = xs_open(0);
+        doms[i].fe = xs_open(0);
+        if ( !doms[i].be || !doms[i].fe )
+        {
+            fprintf(stderr, "could not connect to xenstore\n");
+            exit(2);
+        }
+    }
+
+    start = now_ns();
+
+    for ( i = 0; i < n_domains; i++ )
+        if ( pthread_create(&doms[i].thread, NULL, dom_thread, &doms[i]) )
+            err(2, "pthread_create() failure");
+
+    for ( i = 0; i < n_domains; i++ )
+        pthread_join(doms[i].thread, NULL);
+
+    elapsed = now_ns() - start;
+
+    for ( i = 0; i < n_domains; i++ )
+    {
+        if ( doms[i].ret )
+        {
+            fprintf(stderr, "domain %u failed: %s\n", doms[i].id,
+                    strerror(doms[i].ret));
+            ret = 1;
+        }
+        merge(&op, &doms[i].op);
+        merge(&watch, &doms[i].watch);
+        ta_retries += doms[i].ta_retries;
+        xs_close(doms[i].fe);
+        xs_close(doms[i].be);
+        free(doms[i].op.ns);
+        free(doms[i].watch.ns);
+    }
+
+    xsh = xs_open(0);
+    if ( xsh && asprintf(&top, "%s/%u", BENCH_PATH, getpid()) >= 0 )
+    {
+        xs_rm(xsh, XBT_NULL, top);
+        free(top);
+    }
+    if ( xsh )
+        xs_close(xsh);
+
+    printf("%u domains, %u devices, %u iterations\n",
+           n_domains, n_devices, iterations);
+    printf("%-14s: %u in %"PRIu64" ms, %"PRIu64" ops/s\n", "operations",
+           op.n, elapsed / 1000000,
+           elapsed ? (uint64_t)op.n * 1000000000 / elapsed : 0);
+    report("op latency", &op);
+    report("watch latency", &watch);
+    printf("%-14s: %lu\n", "ta retries", ta_retries);
+
+    free(op.ns);
+    free(watch.ns);
+    free(doms);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
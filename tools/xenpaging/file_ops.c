@@ -22,20 +22,17 @@
 #include <unistd.h>
 #include <xenctrl.h>
 
+/* Positioned I/O, to avoid a separate lseek() syscall for every page. */
 static int file_op(int fd, void *page, int i,
-                   ssize_t (*fn)(int, void *, size_t))
+                   ssize_t (*fn)(int, void *, size_t, off_t))
 {
-    off_t offset = i;
+    off_t offset = (off_t)i << XC_PAGE_SHIFT;
     int total = 0;
     int bytes;
 
-    offset = lseek(fd, offset << XC_PAGE_SHIFT, SEEK_SET);
-    if ( offset == (off_t)-1 )
-        return -1;
-
     while ( total < XC_PAGE_SIZE )
     {
-        bytes = fn(fd, page + total, XC_PAGE_SIZE - total);
+        bytes = fn(fd, page + total, XC_PAGE_SIZE - total, offset + total);
         if ( bytes <= 0 )
             return -1;
 
@@ -45,19 +42,19 @@ static int file_op(int fd, void *page, int i,
     return 0;
 }
 
-static ssize_t my_write(int fd, void *buf, size_t count)
+static ssize_t my_pwrite(int fd, void *buf, size_t count, off_t offset)
 {
-    return write(fd, buf, count);
+    return pwrite(fd, buf, count, offset);
 }
 
 int read_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &read);
+    return file_op(fd, page, i, &pread);
 }
 
 int write_page(int fd, void *page, int i)
 {
-    return file_op(fd, page, i, &my_write);
+    return file_op(fd, page, i, &my_pwrite);
 }
 
 
@@ -208,6 +208,7 @@ static void usage(void)
     printf(" -f <file>      --pagefile=<file>        pagefile to use. This option is required.\n");
     printf(" -m <max_memkb> --max_memkb=<max_memkb>  maximum amount of memory to handle.\n");
     printf(" -r <num>       --mru_size=<num>         number of paged-in pages to keep in memory.\n");
+    printf(" -p <num>       --prefetch=<num>         number of following pages to page in with a requested one.\n");
     printf(" -v             --verbose                enable debug output.\n");
     printf(" -h             --help                   this output.\n");
 }
@@ -215,13 +216,14 @@ static void usage(void)
 static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
 {
     int ch;
-    static const char sopts[] = "hvd:f:m:r:";
+    static const char sopts[] = "hvd:f:m:r:p:";
     static const struct option lopts[] = {
         {"help", 0, NULL, 'h'},
         {"verbose", 0, NULL, 'v'},
         {"domain", 1, NULL, 'd'},
         {"pagefile", 1, NULL, 'f'},
         {"mru_size", 1, NULL, 'm'},
+        {"prefetch", 1, NULL, 'p'},
         { }
     };
 
@@ -242,6 +244,11 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         case 'r':
             paging->policy_mru_size = atoi(optarg);
             break;
+        case 'p':
+            paging->prefetch = atoi(optarg);
+            if ( paging->prefetch > XENPAGING_PAGEIN_QUEUE_SIZE )
+                paging->prefetch = XENPAGING_PAGEIN_QUEUE_SIZE;
+            break;
         case 'v':
             paging->debug = 1;
             break;
@@ -754,6 +761,37 @@ static void resume_pages(struct xenpaging *paging, int num_pages)
         page_in_trigger();
 }
 
+/*
+ * A guest touching a paged-out gfn is likely to touch the following ones
+ * soon.  Queue those still paged out for the page-in thread, so that their
+ * requests get serviced while the guest still works on the first one.
+ */
+static void prefetch_pages(struct xenpaging *paging, unsigned long gfn)
+{
+    unsigned long next;
+    int i = 0, num = 0;
+
+    for ( next = gfn + 1;
+          next <= gfn + paging->prefetch && next < paging->max_pages;
+          next++ )
+    {
+        if ( !test_bit(next, paging->bitmap) )
+            continue;
+
+        /* Use free queue entries only, an earlier batch may be pending */
+        while ( i < XENPAGING_PAGEIN_QUEUE_SIZE && paging->pagein_queue[i] )
+            i++;
+        if ( i == XENPAGING_PAGEIN_QUEUE_SIZE )
+            break;
+
+        paging->pagein_queue[i] = next;
+        num++;
+    }
+
+    if ( num )
+        page_in_trigger();
+}
+
 /* Evict one gfn and write it to the given slot
  * Returns < 0 on fatal error
  * Returns 0 on successful evict
@@ -961,6 +999,10 @@ int main(int argc, char *argv[])
 
                 /* Record this free slot */
                 paging->free_slot_stack[paging->stack_count++] = slot;
+
+                if ( paging->prefetch &&
+                     !(req.u.mem_paging.flags & MEM_PAGING_DROP_PAGE) )
+                    prefetch_pages(paging, req.u.mem_paging.gfn);
             }
             else
             {
@@ -67,6 +67,8 @@ struct xenpaging {
     int num_paged_out;
     int target_tot_pages;
     int policy_mru_size;
+    /* number of following gfns to page in along with a requested one */
+    int prefetch;
     int use_poll_timeout;
     int debug;
     int stack_count;
@@ -61,6 +61,8 @@
 #define TALLOC_MAGIC 0xe814ec70
 #define TALLOC_FLAG_FREE 0x01
 #define TALLOC_FLAG_LOOP 0x02
+#define TALLOC_FLAG_POOL 0x04		/* This is a talloc pool */
+#define TALLOC_FLAG_POOLMEM 0x08	/* This is allocated in a pool */
 #define TALLOC_MAGIC_REFERENCE ((const char *)1)
 
 /* by default we abort when given a bad pointer (such as when talloc_free() is called 
@@ -101,6 +103,14 @@ struct talloc_chunk {
 	const char *name;
 	size_t size;
 	unsigned flags;
+
+	/*
+	 * For a pool: the next free byte in it.
+	 * For pool memory: the pool it was allocated from.
+	 */
+	void *pool;
+	/* For a pool: the number of live objects in it, the pool included. */
+	unsigned int pool_objects;
 };
 
 /* 16 byte alignment seems to keep everyone happy */
@@ -165,12 +175,55 @@ void *talloc_parent(const void *ptr)
 	return tc? TC_PTR_FROM_CHUNK(tc) : NULL;
 }
 
-/* 
-   Allocate a bit of memory as a child of an existing pointer
+#define TC_POOL_SPACE_LEFT(pool) \
+	((size_t)((char *)TC_PTR_FROM_CHUNK(pool) + (pool)->size - \
+		  (char *)(pool)->pool))
+
+/*
+  carve a chunk out of the pool the parent is, or was allocated from
 */
-void *_talloc(const void *context, size_t size)
+static struct talloc_chunk *talloc_alloc_pool(struct talloc_chunk *parent,
+					      size_t size)
 {
-	struct talloc_chunk *tc;
+	struct talloc_chunk *pool, *tc;
+	size_t chunk_size = (TC_HDR_SIZE + size + 15) & ~15;
+
+	if (parent->flags & TALLOC_FLAG_POOL) {
+		pool = parent;
+	} else if (parent->flags & TALLOC_FLAG_POOLMEM) {
+		pool = parent->pool;
+	} else {
+		return NULL;
+	}
+
+	if (chunk_size > TC_POOL_SPACE_LEFT(pool)) {
+		return NULL;
+	}
+
+	tc = pool->pool;
+	pool->pool = (char *)tc + chunk_size;
+	pool->pool_objects++;
+
+	tc->flags = TALLOC_MAGIC | TALLOC_FLAG_POOLMEM;
+	tc->pool = pool;
+
+	return tc;
+}
+
+/*
+  drop one object of a pool, releasing the pool once all are gone
+*/
+static void talloc_pool_put(struct talloc_chunk *pool)
+{
+	if (--pool->pool_objects == 0) {
+		free(pool);
+	}
+}
+
+static void *__talloc(const void *context, size_t size, int use_pool)
+{
+	struct talloc_chunk *tc = NULL;
+	struct talloc_chunk *parent = NULL;
 
 	if (context == NULL) {
 		context = null_context;
@@ -180,20 +233,29 @@ void *_talloc(const void *context, size_t size)
 		return NULL;
 	}
 
-	tc = malloc(TC_HDR_SIZE+size);
-	if (tc == NULL) return NULL;
+	if (context) {
+		parent = talloc_chunk_from_ptr(context);
+		if (use_pool) {
+			tc = talloc_alloc_pool(parent, size);
+		}
+	}
+
+	if (tc == NULL) {
+		tc = malloc(TC_HDR_SIZE+size);
+		if (tc == NULL) return NULL;
+		tc->flags = TALLOC_MAGIC;
+		tc->pool = NULL;
+	}
 
 	tc->size = size;
-	tc->flags = TALLOC_MAGIC;
 	tc->destructor = NULL;
 	tc->child = NULL;
 	tc->name = NULL;
 	tc->refs = NULL;
 	tc->null_refs = 0;
+	tc->pool_objects = 0;
 
-	if (context) {
-		struct talloc_chunk *parent = talloc_chunk_from_ptr(context);
-
+	if (parent) {
 		tc->parent = parent;
 
 		if (parent->child) {
@@ -208,6 +270,38 @@ void *_talloc(const void *context, size_t size)
 	return TC_PTR_FROM_CHUNK(tc);
 }
 
+/* 
+   Allocate a bit of memory as a child of an existing pointer
+*/
+void *_talloc(const void *context, size_t size)
+{
+	return __talloc(context, size, 1);
+}
+
+/*
+  Allocate a pool: a context whose descendants are carved out of a single
+  block of the given size, instead of being malloc()ed one by one.  Freeing
+  them only gives the memory back once the pool and everything allocated
+  from it are gone.  Allocations not fitting in the pool any more fall
+  back to malloc().
+*/
+void *talloc_pool(const void *context, size_t size)
+{
+	void *ptr = __talloc(context, size, 0);
+	struct talloc_chunk *tc;
+
+	if (ptr == NULL) {
+		return NULL;
+	}
+
+	tc = talloc_chunk_from_ptr(ptr);
+	tc->flags |= TALLOC_FLAG_POOL;
+	tc->pool = ptr;
+	tc->pool_objects = 1;
+
+	return ptr;
+}
+
 
 /*
   setup a destructor to be called on free of a pointer
@@ -594,7 +688,13 @@ int talloc_free(void *ptr)
 
 	tc->flags |= TALLOC_FLAG_FREE;
 
-	free(tc);
+	if (tc->flags & TALLOC_FLAG_POOL) {
+		talloc_pool_put(tc);
+	} else if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		talloc_pool_put(tc->pool);
+	} else {
+		free(tc);
+	}
  success:
 	errno = saved_errno;
 	return 0;
@@ -630,23 +730,36 @@ void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *n
 
 	tc = talloc_chunk_from_ptr(ptr);
 
-	/* don't allow realloc on referenced pointers */
-	if (tc->refs) {
+	/* don't allow realloc on referenced pointers, or of a pool */
+	if (tc->refs || (tc->flags & TALLOC_FLAG_POOL)) {
 		return NULL;
 	}
 
 	/* by resetting magic we catch users of the old memory */
 	tc->flags |= TALLOC_FLAG_FREE;
 
+	if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		/* memory from a pool can't grow: move it out of the pool */
+		new_ptr = malloc(size + TC_HDR_SIZE);
+		if (new_ptr) {
+			memcpy(new_ptr, tc,
+			       (tc->size < size ? tc->size : size) + TC_HDR_SIZE);
+			talloc_pool_put(tc->pool);
+			((struct talloc_chunk *)new_ptr)->flags &=
+				~TALLOC_FLAG_POOLMEM;
+			((struct talloc_chunk *)new_ptr)->pool = NULL;
+		}
+	} else {
 #if ALWAYS_REALLOC
-	new_ptr = malloc(size + TC_HDR_SIZE);
-	if (new_ptr) {
-		memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
-		free(tc);
-	}
+		new_ptr = malloc(size + TC_HDR_SIZE);
+		if (new_ptr) {
+			memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
+			free(tc);
+		}
 #else
-	new_ptr = realloc(tc, size + TC_HDR_SIZE);
+		new_ptr = realloc(tc, size + TC_HDR_SIZE);
 #endif
+	}
 	if (!new_ptr) {	
 		tc->flags &= ~TALLOC_FLAG_FREE; 
 		return NULL; 
@@ -396,6 +396,22 @@ static int do_control_memreport(const void *ctx, struct connection *conn,
 	send_ack(conn, XS_CONTROL);
 	return 0;
 }
+
+static int do_control_snapshot(const void *ctx, struct connection *conn,
+			       char **vec, int num)
+{
+	int ret;
+
+	if (num > 1)
+		return EINVAL;
+
+	ret = db_snapshot(num ? vec[0] : xs_daemon_tdb());
+	if (ret)
+		return ret;
+
+	send_ack(conn, XS_CONTROL);
+	return 0;
+}
 #endif
 
 static int do_control_print(const void *ctx, struct connection *conn,
@@ -976,6 +992,7 @@ static struct cmd_s cmds[] = {
 #else
 	{ "logfile", do_control_logfile, "<file>" },
 	{ "memreport", do_control_memreport, "[<file>]" },
+	{ "snapshot", do_control_snapshot, "[<file>]" },
 #endif
 	{ "print", do_control_print, "<string>" },
 	{ "quota", do_control_quota, "[set <name> <val>|<domid>]" },
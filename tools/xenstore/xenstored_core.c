@@ -84,7 +84,18 @@ bool keep_orphans = false;
 static int reopen_log_pipe[2];
 static int reopen_log_pipe0_pollfd_idx = -1;
 char *tracefile = NULL;
-TDB_CONTEXT *tdb_ctx = NULL;
+/* Node records, indexed by (possibly transaction prefixed) node name. */
+static struct hashtable *nodes;
+
+struct db_record {
+	unsigned int size;
+	void *data;
+};
+
+/* Write a snapshot of the data base every snapshot_msec, if modified. */
+static unsigned int snapshot_msec;
+static uint64_t snapshot_due_msec;
+static bool db_modified;
 unsigned int trace_flags = TRACE_OBJ | TRACE_IO;
 
 static const char *sockmsg_string(enum xsd_sockmsg_type type);
@@ -544,6 +555,14 @@ static void initialize_fds(int *p_sock_pollfd_idx, int *ptimeout)
 	wrl_log_periodic(now);
 	msecs = get_now_msec();
 
+	if (snapshot_msec && db_modified) {
+		if (snapshot_due_msec <= msecs)
+			*ptimeout = 0;
+		else if (*ptimeout == -1 ||
+			 *ptimeout > snapshot_due_msec - msecs)
+			*ptimeout = snapshot_due_msec - msecs;
+	}
+
 	list_for_each_entry(conn, &connections, list) {
 		if (conn->domain) {
 			wrl_check_timeout(conn->domain, now, ptimeout);
@@ -577,22 +596,59 @@ void set_tdb_key(const char *name, TDB_DATA *key)
 	key->dsize = strlen(name);
 }
 
+static struct db_record *db_lookup(TDB_DATA *key)
+{
+	return hashtable_search(nodes, key->dptr);
+}
+
+struct xs_tdb_record_hdr *db_peek(TDB_DATA *key, size_t *size)
+{
+	struct db_record *rec = db_lookup(key);
+
+	if (!rec)
+		return NULL;
+
+	*size = rec->size;
+
+	return rec->data;
+}
+
+void *db_fetch(const void *ctx, TDB_DATA *key, size_t *size)
+{
+	struct db_record *rec = db_lookup(key);
+	void *data;
+
+	if (!rec) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	data = talloc_memdup(ctx, rec->data, rec->size);
+	if (!data) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	*size = rec->size;
+
+	return data;
+}
+
 static void get_acc_data(TDB_DATA *key, struct node_account_data *acc)
 {
-	TDB_DATA old_data;
+	struct db_record *rec;
 	struct xs_tdb_record_hdr *hdr;
 
 	if (acc->memory < 0) {
-		old_data = tdb_fetch(tdb_ctx, *key);
+		rec = db_lookup(key);
 		/* No check for error, as the node might not exist. */
-		if (old_data.dptr == NULL) {
+		if (!rec) {
 			acc->memory = 0;
 		} else {
-			hdr = (void *)old_data.dptr;
-			acc->memory = old_data.dsize;
+			hdr = rec->data;
+			acc->memory = rec->size;
 			acc->domid = hdr->perms[0].id;
 		}
-		talloc_free(old_data.dptr);
 	}
 }
 
@@ -609,8 +665,38 @@ static unsigned int get_acc_domid(struct connection *conn, TDB_DATA *key,
 	       ? domid : conn->id;
 }
 
-int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
-		 struct node_account_data *acc, bool no_quota_check)
+static int db_store(TDB_DATA *key, TDB_DATA *data)
+{
+	struct db_record *rec = db_lookup(key);
+	void *copy;
+	char *name;
+
+	if (rec) {
+		copy = talloc_memdup(rec, data->dptr, data->dsize);
+		if (!copy)
+			return ENOMEM;
+		talloc_free(rec->data);
+	} else {
+		rec = talloc(nodes, struct db_record);
+		if (!rec)
+			return ENOMEM;
+		name = talloc_strndup(rec, key->dptr, key->dsize);
+		copy = talloc_memdup(rec, data->dptr, data->dsize);
+		if (!name || !copy || !hashtable_insert(nodes, name, rec)) {
+			talloc_free(rec);
+			return ENOMEM;
+		}
+	}
+
+	rec->data = copy;
+	rec->size = data->dsize;
+	db_modified = true;
+
+	return 0;
+}
+
+int db_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
+	     struct node_account_data *acc, bool no_quota_check)
 {
 	struct xs_tdb_record_hdr *hdr = (void *)data->dptr;
 	struct node_account_data old_acc = {};
@@ -643,14 +729,14 @@ int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 		return ret;
 	}
 
-	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_ctx, *key, *data, TDB_REPLACE) != 0) {
+	ret = db_store(key, data);
+	if (ret) {
 		domain_memory_add_nochk(new_domid, -data->dsize - key->dsize);
 		/* Error path, so no quota check. */
 		if (old_acc.memory)
 			domain_memory_add_nochk(old_domid,
 						old_acc.memory + key->dsize);
-		errno = EIO;
+		errno = ret;
 		return errno;
 	}
 
@@ -663,8 +749,8 @@ int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
 	return 0;
 }
 
-int do_tdb_delete(struct connection *conn, TDB_DATA *key,
-		  struct node_account_data *acc)
+int db_delete(struct connection *conn, TDB_DATA *key,
+	      struct node_account_data *acc)
 {
 	struct node_account_data tmp_acc;
 	unsigned int domid;
@@ -676,10 +762,12 @@ int do_tdb_delete(struct connection *conn, TDB_DATA *key,
 
 	get_acc_data(key, acc);
 
-	if (tdb_delete(tdb_ctx, *key)) {
-		errno = EIO;
+	if (!db_lookup(key)) {
+		errno = ENOENT;
 		return errno;
 	}
+	hashtable_remove(nodes, key->dptr);
+	db_modified = true;
 
 	if (acc->memory) {
 		domid = get_acc_domid(conn, key, acc->domid);
@@ -696,9 +784,10 @@ int do_tdb_delete(struct connection *conn, TDB_DATA *key,
 struct node *read_node(struct connection *conn, const void *ctx,
 		       const char *name)
 {
-	TDB_DATA key, data;
+	TDB_DATA key;
 	struct xs_tdb_record_hdr *hdr;
 	struct node *node;
+	size_t size;
 	int err;
 
 	node = talloc(ctx, struct node);
@@ -715,25 +804,20 @@ struct node *read_node(struct connection *conn, const void *ctx,
 
 	transaction_prepend(conn, name, &key);
 
-	data = tdb_fetch(tdb_ctx, key);
+	hdr = db_fetch(node, &key, &size);
 
-	if (data.dptr == NULL) {
-		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST) {
+	if (hdr == NULL) {
+		if (errno == ENOENT) {
 			node->generation = NO_GENERATION;
 			err = access_node(conn, node, NODE_ACCESS_READ, NULL);
 			errno = err ? : ENOENT;
-		} else {
-			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
-			errno = EIO;
 		}
 		goto error;
 	}
 
 	node->parent = NULL;
-	talloc_steal(node, data.dptr);
 
 	/* Datalen, childlen, number of permissions */
-	hdr = (void *)data.dptr;
 	node->generation = hdr->generation;
 	node->perms.num = hdr->num_perms;
 	node->datalen = hdr->datalen;
@@ -742,7 +826,7 @@ struct node *read_node(struct connection *conn, const void *ctx,
 	/* Permissions are struct xs_permissions. */
 	node->perms.p = hdr->perms;
 	node->acc.domid = get_node_owner(node);
-	node->acc.memory = data.dsize;
+	node->acc.memory = size;
 	if (domain_adjust_node_perms(node))
 		goto error;
 
@@ -816,7 +900,7 @@ int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node,
 	p += node->datalen;
 	memcpy(p, node->children, node->childlen);
 
-	if (do_tdb_write(conn, key, &data, &node->acc, no_quota_check))
+	if (db_write(conn, key, &data, &node->acc, no_quota_check))
 		return EIO;
 
 	return 0;
@@ -1027,6 +1111,37 @@ static void send_error(struct connection *conn, int error)
 			  strlen(xsd_errors[i].errstring) + 1);
 }
 
+/* Replies of the operations of an XS_MULTI request, collected in order. */
+struct multi_reply {
+	/* Operation being processed. */
+	const struct buffered_data *op;
+	char *buffer;
+	unsigned int used;
+	int err;
+};
+
+static void multi_add_reply(struct multi_reply *multi,
+			    enum xsd_sockmsg_type type,
+			    const void *data, unsigned int len)
+{
+	struct xsd_sockmsg hdr = multi->op->hdr.msg;
+
+	if (multi->err)
+		return;
+
+	if (sizeof(hdr) > XENSTORE_PAYLOAD_MAX - multi->used ||
+	    len > XENSTORE_PAYLOAD_MAX - multi->used - sizeof(hdr)) {
+		multi->err = E2BIG;
+		return;
+	}
+
+	hdr.type = type;
+	hdr.len = len;
+	memcpy(multi->buffer + multi->used, &hdr, sizeof(hdr));
+	memcpy(multi->buffer + multi->used + sizeof(hdr), data, len);
+	multi->used += sizeof(hdr) + len;
+}
+
 void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 		const void *data, unsigned int len)
 {
@@ -1034,6 +1149,11 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	assert(type != XS_WATCH_EVENT);
 
+	if (conn->multi) {
+		multi_add_reply(conn->multi, type, data, len);
+		return;
+	}
+
 	if ( len > XENSTORE_PAYLOAD_MAX ) {
 		send_error(conn, E2BIG);
 		return;
@@ -1263,6 +1383,7 @@ static int send_directory(const void *ctx, struct connection *conn,
 	if (!node)
 		return errno;
 
+	ta_children_read(conn, node->name);
 	send_reply(conn, XS_DIRECTORY, node->children, node->childlen);
 
 	return 0;
@@ -1285,6 +1406,8 @@ static int send_directory_part(const void *ctx, struct connection *conn,
 	if (!node)
 		return errno;
 
+	ta_children_read(conn, node->name);
+
 	/* Second arg is childlist offset. */
 	off = atoi(in->buffer + strlen(in->buffer) + 1);
 
@@ -1442,7 +1565,7 @@ static void destroy_node_rm(struct connection *conn, struct node *node)
 	if (streq(node->name, "/"))
 		corrupt(NULL, "Destroying root node!");
 
-	do_tdb_delete(conn, &node->key, &node->acc);
+	db_delete(conn, &node->key, &node->acc);
 }
 
 static int destroy_node(struct connection *conn, struct node *node)
@@ -1640,7 +1763,7 @@ static int delnode_sub(const void *ctx, struct connection *conn,
 		return WALK_TREE_SUCCESS_STOP;
 
 	/* In case of error stop the walk. */
-	if (!ret && do_tdb_delete(conn, &key, &node->acc))
+	if (!ret && db_delete(conn, &key, &node->acc))
 		return WALK_TREE_SUCCESS_STOP;
 
 	/*
@@ -1950,6 +2073,9 @@ int walk_node_tree(const void *ctx, struct connection *conn, const char *root,
 	return ret < 0 ? ret : WALK_TREE_OK;
 }
 
+static int do_multi(const void *ctx, struct connection *conn,
+		    struct buffered_data *in);
+
 static struct {
 	const char *str;
 	int (*func)(const void *ctx, struct connection *conn,
@@ -1988,8 +2114,119 @@ static struct {
 	    { "SET_TARGET",    do_set_target,   XS_FLAG_PRIV },
 	[XS_RESET_WATCHES]     = { "RESET_WATCHES",     do_reset_watches },
 	[XS_DIRECTORY_PART]    = { "DIRECTORY_PART",    send_directory_part },
+	[XS_MULTI]             = { "MULTI",             do_multi },
 };
 
+/*
+ * Operations allowed in an XS_MULTI request: those acting on nodes only, so
+ * that no other state of the connection can change halfway through.
+ */
+static bool multi_op_allowed(enum xsd_sockmsg_type type)
+{
+	switch (type) {
+	case XS_DIRECTORY:
+	case XS_DIRECTORY_PART:
+	case XS_READ:
+	case XS_GET_PERMS:
+	case XS_WRITE:
+	case XS_MKDIR:
+	case XS_RM:
+	case XS_SET_PERMS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int do_multi(const void *ctx, struct connection *conn,
+		    struct buffered_data *in)
+{
+	struct multi_reply multi = { };
+	struct buffered_data *op;
+	enum xsd_sockmsg_type type;
+	unsigned int off;
+	bool atomic;
+	int err = 0, ret = 0;
+
+	/* First arg is "T" to run all operations as one transaction. */
+	off = get_string(in, 0);
+	if (!off)
+		return EINVAL;
+	if (streq(in->buffer, "T"))
+		atomic = true;
+	else if (streq(in->buffer, "F"))
+		atomic = false;
+	else
+		return EINVAL;
+
+	multi.buffer = talloc_array(ctx, char, XENSTORE_PAYLOAD_MAX);
+	if (!multi.buffer)
+		return ENOMEM;
+
+	if (atomic) {
+		struct transaction *trans = transaction_start(conn);
+
+		if (IS_ERR(trans))
+			return -PTR_ERR(trans);
+		conn->transaction = trans;
+	}
+
+	/* Followed by complete messages, each one header plus payload. */
+	conn->multi = &multi;
+	while (!err && off < in->used) {
+		op = talloc_zero(ctx, struct buffered_data);
+		if (!op) {
+			ret = ENOMEM;
+			break;
+		}
+		if (in->used - off < sizeof(op->hdr)) {
+			ret = EINVAL;
+			break;
+		}
+		memcpy(&op->hdr, in->buffer + off, sizeof(op->hdr));
+		off += sizeof(op->hdr);
+		if (op->hdr.msg.len > in->used - off) {
+			ret = EINVAL;
+			break;
+		}
+		op->buffer = talloc_memdup(op, in->buffer + off,
+					   op->hdr.msg.len);
+		if (!op->buffer && op->hdr.msg.len) {
+			ret = ENOMEM;
+			break;
+		}
+		op->used = op->hdr.msg.len;
+		off += op->hdr.msg.len;
+
+		type = op->hdr.msg.type;
+		multi.op = op;
+		err = multi_op_allowed(type) ? wire_funcs[type].func(ctx, conn, op)
+					     : EINVAL;
+		/* The first failing operation ends the request. */
+		if (err)
+			send_error(conn, err);
+		if (multi.err) {
+			ret = multi.err;
+			break;
+		}
+		talloc_free(op);
+	}
+	conn->multi = NULL;
+
+	if (atomic) {
+		int end = transaction_end(ctx, conn, !ret && !err);
+
+		if (!ret)
+			ret = end;
+	}
+	if (ret)
+		return ret;
+
+	send_reply(conn, XS_MULTI, multi.buffer, multi.used);
+
+	return 0;
+}
+
 static const char *sockmsg_string(enum xsd_sockmsg_type type)
 {
 	if ((unsigned int)type < ARRAY_SIZE(wire_funcs) && wire_funcs[type].str)
@@ -1998,6 +2235,9 @@ static const char *sockmsg_string(enum xsd_sockmsg_type type)
 	return "**UNKNOWN**";
 }
 
+/* Size of the memory pool for the temporary allocations of a request. */
+#define REQUEST_POOL_SIZE 8192
+
 /* Process "in" for conn: "in" will vanish after this conversation, so
  * we can talloc off it for temporary variables.  May free "conn".
  */
@@ -2031,7 +2271,11 @@ static void process_message(struct connection *conn, struct buffered_data *in)
 		return;
 	}
 
-	ctx = talloc_new(NULL);
+	/*
+	 * All temporary allocations of the request come from one pool, which
+	 * goes away in one step with the request.
+	 */
+	ctx = talloc_pool(NULL, REQUEST_POOL_SIZE);
 	if (!ctx) {
 		send_error(conn, ENOMEM);
 		return;
@@ -2308,7 +2552,23 @@ static void accept_connection(int sock)
 }
 #endif
 
-static int tdb_flags = TDB_INTERNAL | TDB_NOLOCK;
+static unsigned int hash_from_key_fn(const void *k)
+{
+	const char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+
+static int keys_equal_fn(const void *key1, const void *key2)
+{
+	return 0 == strcmp(key1, key2);
+}
 
 /* We create initial nodes manually. */
 static void manual_node(const char *name, const char *child)
@@ -2357,22 +2617,84 @@ static void tdb_logger(TDB_CONTEXT *tdb, int level, const char * fmt, ...)
 	errno = saved_errno;
 }
 
-void setup_structure(bool live_update)
+static int snapshot_node(const void *k, void *v, void *arg)
+{
+	const char *name = k;
+	struct db_record *rec = v;
+	TDB_CONTEXT *tdb = arg;
+	TDB_DATA key, data;
+
+	/* Skip nodes private to a transaction. */
+	if (name[0] != '/' && name[0] != '@')
+		return 0;
+
+	set_tdb_key(name, &key);
+	data.dptr = rec->data;
+	data.dsize = rec->size;
+
+	return tdb_store(tdb, key, data, TDB_INSERT) ? EIO : 0;
+}
+
+int db_snapshot(const char *filename)
 {
-	char *tdbname;
+	TDB_CONTEXT *tdb;
+	char *tmpname;
+	int ret;
+
+	tmpname = talloc_asprintf(NULL, "%s.new", filename);
+	if (!tmpname)
+		return ENOMEM;
+
+	unlink(tmpname);
+	tdb = tdb_open_ex(tmpname, 7919, TDB_NOLOCK,
+			  O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+			  0640, &tdb_logger, NULL);
+	if (!tdb) {
+		ret = errno ? : EIO;
+		goto out;
+	}
 
-	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
-	if (!tdbname)
-		barf_perror("Could not create tdbname");
+	ret = hashtable_iterate(nodes, snapshot_node, tdb);
+	if (tdb_close(tdb) && !ret)
+		ret = EIO;
+	if (!ret && rename(tmpname, filename))
+		ret = errno;
 
-	if (!(tdb_flags & TDB_INTERNAL))
-		unlink(tdbname);
+	if (ret)
+		unlink(tmpname);
+	else
+		db_modified = false;
 
-	tdb_ctx = tdb_open_ex(tdbname, 7919, tdb_flags,
-			      O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
-			      0640, &tdb_logger, NULL);
-	if (!tdb_ctx)
-		barf_perror("Could not create tdb file %s", tdbname);
+ out:
+	talloc_free(tmpname);
+	return ret;
+}
+
+static void periodic_snapshot(void)
+{
+	uint64_t now;
+	int ret;
+
+	if (!snapshot_msec || !db_modified)
+		return;
+
+	now = get_now_msec();
+	if (now < snapshot_due_msec)
+		return;
+
+	ret = db_snapshot(xs_daemon_tdb());
+	if (ret)
+		syslog(LOG_ERR, "Could not write data base snapshot: %s",
+		       strerror(ret));
+	snapshot_due_msec = now + snapshot_msec;
+}
+
+void setup_structure(bool live_update)
+{
+	nodes = create_hashtable(NULL, 7919, hash_from_key_fn, keys_equal_fn,
+				 HASHTABLE_FREE_VALUE);
+	if (!nodes)
+		barf_perror("Could not create node data base");
 
 	if (live_update)
 		manual_node("/", NULL);
@@ -2386,24 +2708,6 @@ void setup_structure(bool live_update)
 	}
 }
 
-static unsigned int hash_from_key_fn(const void *k)
-{
-	const char *str = k;
-	unsigned int hash = 5381;
-	char c;
-
-	while ((c = *str++))
-		hash = ((hash << 5) + hash) + (unsigned int)c;
-
-	return hash;
-}
-
-
-static int keys_equal_fn(const void *key1, const void *key2)
-{
-	return 0 == strcmp(key1, key2);
-}
-
 int remember_string(struct hashtable *hash, const char *str)
 {
 	char *k = talloc_strdup(NULL, str);
@@ -2463,12 +2767,12 @@ static int check_store_enoent(const void *ctx, struct connection *conn,
 /**
  * Helper to clean_store below.
  */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
+static int clean_store_(const void *k, void *v, void *private)
 {
 	struct hashtable *reachable = private;
 	char *slash;
-	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
+	char *name = talloc_strdup(NULL, k);
+	TDB_DATA key;
 
 	if (!name) {
 		log("clean_store: ENOMEM");
@@ -2483,7 +2787,8 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
-			do_tdb_delete(NULL, &key, NULL);
+			set_tdb_key(k, &key);
+			db_delete(NULL, &key, NULL);
 		}
 	}
 
@@ -2499,7 +2804,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
  */
 static void clean_store(struct check_store_data *data)
 {
-	tdb_traverse(tdb_ctx, &clean_store_, data->reachable);
+	hashtable_iterate(nodes, &clean_store_, data->reachable);
 	domain_check_acc(data->domains);
 }
 
@@ -2657,8 +2962,9 @@ static void usage(void)
 "                          watch-event: time a watch-event is kept pending\n"
 "  -R, --no-recovery       to request that no recovery should be attempted when\n"
 "                          the store is corrupted (debug only),\n"
-"  -I, --internal-db [on|off] store database in memory, not on disk, default is\n"
-"                          memory, with \"--internal-db off\" it is on disk\n"
+"  -I, --internal-db [on|off|<secs>] store database in memory only (default),\n"
+"                          or write a snapshot of it to disk every <secs>\n"
+"                          seconds if modified (\"off\" being every minute)\n"
 "  -K, --keep-orphans      don't delete nodes owned by a domain when the\n"
 "                          domain is deleted (this is a security risk!)\n"
 "  -V, --verbose           to request verbose execution.\n");
@@ -2842,8 +3148,12 @@ int main(int argc, char *argv[])
 				barf("Illegal trace switch \"%s\"\n", optarg);
 			break;
 		case 'I':
-			if (optarg && !strcmp(optarg, "off"))
-				tdb_flags = 0;
+			if (!optarg || !strcmp(optarg, "on"))
+				snapshot_msec = 0;
+			else if (!strcmp(optarg, "off"))
+				snapshot_msec = 60 * 1000;
+			else
+				snapshot_msec = strtoul(optarg, NULL, 10) * 1000;
 			break;
 		case 'K':
 			keep_orphans = true;
@@ -3051,6 +3361,8 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		periodic_snapshot();
+
 		initialize_fds(&sock_pollfd_idx, &timeout);
 	}
 }
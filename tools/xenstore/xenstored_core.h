@@ -139,6 +139,9 @@ struct connection
 	struct list_head out_list;
 	uint64_t timeout_msec;
 
+	/* Replies of the XS_MULTI being processed (NULL if none). */
+	struct multi_reply *multi;
+
 	/* Referenced requests no longer pending. */
 	struct list_head ref_list;
 
@@ -238,11 +241,11 @@ static inline unsigned int get_node_owner(const struct node *node)
 	return node->perms.p[0].id;
 }
 
-/* Write a node to the tdb data base. */
+/* Write a node to the data base. */
 int write_node_raw(struct connection *conn, TDB_DATA *key, struct node *node,
 		   bool no_quota_check);
 
-/* Get a node from the tdb data base. */
+/* Get a node from the data base. */
 struct node *read_node(struct connection *conn, const void *ctx,
 		       const char *name);
 
@@ -302,7 +305,6 @@ extern unsigned int trace_flags;
 extern const char *const trace_switches[];
 int set_trace_switch(const char *arg);
 
-extern TDB_CONTEXT *tdb_ctx;
 extern int dom0_domid;
 extern int dom0_event;
 extern int priv_domid;
@@ -358,10 +360,19 @@ extern xengnttab_handle **xgt_handle;
 int remember_string(struct hashtable *hash, const char *str);
 
 void set_tdb_key(const char *name, TDB_DATA *key);
-int do_tdb_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
-		 struct node_account_data *acc, bool no_quota_check);
-int do_tdb_delete(struct connection *conn, TDB_DATA *key,
-		  struct node_account_data *acc);
+/*
+ * Get a node's record in the data base, or NULL if there is none.  Only
+ * valid until the next data base modification.
+ */
+struct xs_tdb_record_hdr *db_peek(TDB_DATA *key, size_t *size);
+/* Get a copy of a node's record, allocated with ctx. Sets errno on error. */
+void *db_fetch(const void *ctx, TDB_DATA *key, size_t *size);
+int db_write(struct connection *conn, TDB_DATA *key, TDB_DATA *data,
+	     struct node_account_data *acc, bool no_quota_check);
+int db_delete(struct connection *conn, TDB_DATA *key,
+	      struct node_account_data *acc);
+/* Write all nodes to filename, in the format read by xs_tdb_dump. */
+int db_snapshot(const char *filename);
 
 void conn_free_buffered_data(struct connection *conn);
 
@@ -85,6 +85,10 @@ struct domain
 	/* Number of outstanding requests. */
 	int nboutstanding;
 
+	/* Number of transaction commits, and of those failing with EAGAIN. */
+	unsigned int nbcommits;
+	unsigned int nbconflicts;
+
 	/* write rate limit */
 	wrl_creditt wrl_credit; /* [ -wrl_config_writecost, +_dburst ] */
 	struct wrl_timestampt wrl_timestamp;
@@ -393,7 +397,45 @@ void check_domains(void)
 		fire_special_watches("@releaseDomain");
 }
 
-/* We scan all domains rather than use the information given here. */
+static struct domain *find_domain_struct(unsigned int domid)
+{
+	return hashtable_search(domhash, &domid);
+}
+
+/* Cleared if the hypervisor can't tell which domains have changed. */
+static bool changed_domains = true;
+
+/*
+ * Only look at the domains the hypervisor reports as changed, instead of
+ * scanning all domains.
+ */
+static void check_changed_domains(void)
+{
+	struct domain *domain;
+	bool notify = false;
+	uint32_t domid;
+
+	for (;;) {
+		if (xc_domain_get_changed(*xc_handle, &domid)) {
+			syslog(LOG_INFO, "Can't get changed domains (%s), "
+			       "scanning all domains from now on\n",
+			       strerror(errno));
+			changed_domains = false;
+			check_domains();
+			return;
+		}
+		if (domid == DOMID_INVALID)
+			break;
+
+		domain = find_domain_struct(domid);
+		if (domain)
+			check_domain(NULL, domain, &notify);
+	}
+
+	if (notify)
+		fire_special_watches("@releaseDomain");
+}
+
 void handle_event(void)
 {
 	evtchn_port_t port;
@@ -401,8 +443,12 @@ void handle_event(void)
 	if ((port = xenevtchn_pending(xce_handle)) == -1)
 		barf_perror("Failed to read from event fd");
 
-	if (port == virq_port)
-		check_domains();
+	if (port == virq_port) {
+		if (changed_domains)
+			check_changed_domains();
+		else
+			check_domains();
+	}
 
 	if (xenevtchn_unmask(xce_handle, port) == -1)
 		barf_perror("Failed to write to event fd");
@@ -413,9 +459,16 @@ static char *talloc_domain_path(const void *context, unsigned int domid)
 	return talloc_asprintf(context, "/local/domain/%u", domid);
 }
 
-static struct domain *find_domain_struct(unsigned int domid)
+void domain_ta_commit(struct connection *conn, bool conflict)
 {
-	return hashtable_search(domhash, &domid);
+	struct domain *d = find_domain_struct(conn->id);
+
+	if (!d)
+		return;
+
+	d->nbcommits++;
+	if (conflict)
+		d->nbconflicts++;
 }
 
 int domain_get_quota(const void *ctx, struct connection *conn,
@@ -442,6 +495,8 @@ int domain_get_quota(const void *ctx, struct connection *conn,
 	ent(transactions, ta);
 	ent(outstanding, d->nboutstanding);
 	ent(memory, d->memory);
+	ent(commits, d->nbcommits);
+	ent(conflicts, d->nbconflicts);
 
 #undef ent
 
@@ -94,6 +94,7 @@ int domain_watch(struct connection *conn);
 void domain_outstanding_inc(struct connection *conn);
 void domain_outstanding_dec(struct connection *conn);
 void domain_outstanding_domid_dec(unsigned int domid);
+void domain_ta_commit(struct connection *conn, bool conflict);
 int domain_get_quota(const void *ctx, struct connection *conn,
 		     unsigned int domid);
 
@@ -40,7 +40,7 @@
  * Some notes regarding detection and handling of transaction conflicts:
  *
  * Basic source of reference is the 'generation' count. Each writing access
- * (either normal write or in a transaction) to the tdb data base will set
+ * (either normal write or in a transaction) to the data base will set
  * the node specific generation count to the global generation count.
  * For being able to identify a transaction the transaction specific generation
  * count is initialized with the global generation count when starting the
@@ -106,6 +106,15 @@
  *    TA2: write node A:   g(2:A) = 6, G = 7
  *    End TA1: g(1:A) == g(A) => okay, B = 1:B, g(B) = 7, G = 8
  *    End TA2: g(2:B) != g(B) => EAGAIN
+ *
+ * A node read, but neither modified nor having had its children listed in
+ * a transaction, is not in conflict if only its children changed: e.g.
+ * another domain adding a child below it doesn't change what the
+ * transaction has seen. Its data and permissions are compared with the
+ * transaction's copy of the node if its generation count doesn't match.
+ *
+ * If no node has been modified globally since the start of a transaction
+ * there can't be any conflict, so no checks are needed at all.
  */
 
 struct accessed_node
@@ -126,6 +135,9 @@ struct accessed_node
 	/* Generation count checking required? */
 	bool check_gen;
 
+	/* Children have been listed? */
+	bool children_read;
+
 	/* Modified? */
 	bool modified;
 
@@ -169,6 +181,9 @@ struct transaction
 
 uint64_t generation;
 
+/* Generation count of the last modification of the global data base. */
+static uint64_t last_modification;
+
 void ta_node_created(struct transaction *trans)
 {
 	trans->node_created = true;
@@ -237,6 +252,8 @@ int access_node(struct connection *conn, struct node *node,
 
 	if (type != NODE_ACCESS_READ) {
 		node->generation = ++generation;
+		if (!conn || !conn->transaction)
+			last_modification = generation;
 		if (conn && !conn->transaction)
 			wrl_apply_debit_direct(conn);
 	}
@@ -276,7 +293,7 @@ int access_node(struct connection *conn, struct node *node,
 
 		introduce = true;
 		i->ta_node = false;
-		/* acc.memory < 0 means "unknown, get size from TDB". */
+		/* acc.memory < 0 means "unknown, get size from data base". */
 		node->acc.memory = -1;
 
 		/*
@@ -327,6 +344,18 @@ err:
 	return ret;
 }
 
+void ta_children_read(struct connection *conn, const char *name)
+{
+	struct accessed_node *i;
+
+	if (!conn || !conn->transaction)
+		return;
+
+	i = find_accessed_node(conn->transaction, name);
+	if (i)
+		i->children_read = true;
+}
+
 /*
  * A watch event should be fired for a node modified inside a transaction.
  * Set the corresponding information. A non-exact event is replacing an exact
@@ -357,35 +386,52 @@ void queue_watches(struct connection *conn, const char *name, bool watch_exact)
  * transaction prepended. Delete all transaction specific nodes in the data
  * base.
  */
+/* Check whether a node read in the transaction has been changed since. */
+static bool read_node_changed(struct accessed_node *i)
+{
+	TDB_DATA key;
+	struct xs_tdb_record_hdr *hdr, *ta_hdr;
+	size_t size;
+
+	set_tdb_key(i->node, &key);
+	hdr = db_peek(&key, &size);
+	if ((hdr ? hdr->generation : NO_GENERATION) == i->generation)
+		return false;
+
+	/* Only an unmodified copy tells what has been seen. */
+	if (!hdr || i->children_read || i->modified || !i->ta_node)
+		return true;
+
+	set_tdb_key(i->trans_name, &key);
+	ta_hdr = db_peek(&key, &size);
+	if (!ta_hdr)
+		return true;
+
+	/* Permissions and data are stored contiguously. */
+	return hdr->num_perms != ta_hdr->num_perms ||
+	       hdr->datalen != ta_hdr->datalen ||
+	       memcmp(hdr->perms, ta_hdr->perms,
+		      hdr->num_perms * sizeof(hdr->perms[0]) + hdr->datalen);
+}
+
 static int finalize_transaction(struct connection *conn,
 				struct transaction *trans, bool *is_corrupt)
 {
 	struct accessed_node *i, *n;
 	TDB_DATA key, ta_key, data;
 	struct xs_tdb_record_hdr *hdr;
-	uint64_t gen;
+	size_t size;
+	bool check = last_modification >= trans->generation;
 
 	list_for_each_entry_safe(i, n, &trans->accessed, list) {
-		if (i->check_gen) {
-			set_tdb_key(i->node, &key);
-			data = tdb_fetch(tdb_ctx, key);
-			hdr = (void *)data.dptr;
-			if (!data.dptr) {
-				if (tdb_error(tdb_ctx) != TDB_ERR_NOEXIST)
-					return EIO;
-				gen = NO_GENERATION;
-			} else
-				gen = hdr->generation;
-			talloc_free(data.dptr);
-			if (i->generation != gen)
-				return EAGAIN;
-		}
+		if (check && i->check_gen && read_node_changed(i))
+			return EAGAIN;
 
 		/* Entries for unmodified nodes can be removed early. */
 		if (!i->modified) {
 			if (i->ta_node) {
 				set_tdb_key(i->trans_name, &ta_key);
-				if (do_tdb_delete(conn, &ta_key, NULL))
+				if (db_delete(conn, &ta_key, NULL))
 					return EIO;
 			}
 			list_del(&i->list);
@@ -393,18 +439,26 @@ static int finalize_transaction(struct connection *conn,
 		}
 	}
 
+	/* The remaining nodes have been modified, and are made visible now. */
+	if (!list_empty(&trans->accessed))
+		last_modification = generation;
+
 	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
 		set_tdb_key(i->node, &key);
 		if (i->ta_node) {
 			set_tdb_key(i->trans_name, &ta_key);
-			data = tdb_fetch(tdb_ctx, ta_key);
-			if (data.dptr) {
-				hdr = (void *)data.dptr;
+			/*
+			 * The transaction's copy of the node is deleted below,
+			 * so it can be written back as is.
+			 */
+			hdr = db_peek(&ta_key, &size);
+			if (hdr) {
 				hdr->generation = ++generation;
-				*is_corrupt |= do_tdb_write(conn, &key, &data,
-							    NULL, true);
-				talloc_free(data.dptr);
-				if (do_tdb_delete(conn, &ta_key, NULL))
+				data.dptr = (void *)hdr;
+				data.dsize = size;
+				*is_corrupt |= db_write(conn, &key, &data,
+							NULL, true);
+				if (db_delete(conn, &ta_key, NULL))
 					*is_corrupt = true;
 			} else {
 				*is_corrupt = true;
@@ -417,7 +471,7 @@ static int finalize_transaction(struct connection *conn,
 			 */
 			*is_corrupt |= (i->generation == NO_GENERATION)
 				       ? false
-				       : do_tdb_delete(conn, &key, NULL);
+				       : db_delete(conn, &key, NULL);
 		}
 		if (i->fire_watch)
 			fire_watches(conn, trans, i->node, NULL, i->watch_exact,
@@ -441,7 +495,7 @@ static int destroy_transaction(void *_transaction)
 	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
 		if (i->ta_node) {
 			set_tdb_key(i->trans_name, &key);
-			do_tdb_delete(trans->conn, &key, NULL);
+			db_delete(trans->conn, &key, NULL);
 		}
 		list_del(&i->list);
 		talloc_free(i);
@@ -464,24 +518,25 @@ struct transaction *transaction_lookup(struct connection *conn, uint32_t id)
 	return ERR_PTR(-ENOENT);
 }
 
-int do_transaction_start(const void *ctx, struct connection *conn,
-			 struct buffered_data *in)
+struct transaction *transaction_start(struct connection *conn)
 {
 	struct transaction *trans, *exists;
-	char id_str[20];
 
 	/* We don't support nested transactions. */
 	if (conn->transaction)
-		return EBUSY;
+		return ERR_PTR(-EBUSY);
 
 	if (domain_is_unprivileged(conn) &&
 	    conn->transaction_started > quota_max_transaction)
-		return ENOSPC;
+		return ERR_PTR(-ENOSPC);
 
-	/* Attach transaction to ctx for autofree until it's complete */
-	trans = talloc_zero(ctx, struct transaction);
+	/*
+	 * Allocate off conn right away: the transaction outlives the request,
+	 * so it must not pin the request's memory pool.
+	 */
+	trans = talloc_zero(conn, struct transaction);
 	if (!trans)
-		return ENOMEM;
+		return ERR_PTR(-ENOMEM);
 
 	trace_create(trans, "transaction");
 	INIT_LIST_HEAD(&trans->accessed);
@@ -498,31 +553,38 @@ int do_transaction_start(const void *ctx, struct connection *conn,
 
 	/* Now we own it. */
 	list_add_tail(&trans->list, &conn->transaction_list);
-	talloc_steal(conn, trans);
 	talloc_set_destructor(trans, destroy_transaction);
 	if (!conn->transaction_started)
 		conn->ta_start_time = time(NULL);
 	conn->transaction_started++;
 	wrl_ntransactions++;
 
+	return trans;
+}
+
+int do_transaction_start(const void *ctx, struct connection *conn,
+			 struct buffered_data *in)
+{
+	struct transaction *trans;
+	char id_str[20];
+
+	trans = transaction_start(conn);
+	if (IS_ERR(trans))
+		return -PTR_ERR(trans);
+
 	snprintf(id_str, sizeof(id_str), "%u", trans->id);
 	send_reply(conn, XS_TRANSACTION_START, id_str, strlen(id_str)+1);
 
 	return 0;
 }
 
-int do_transaction_end(const void *ctx, struct connection *conn,
-		       struct buffered_data *in)
+int transaction_end(const void *ctx, struct connection *conn, bool commit)
 {
-	const char *arg = onearg(in);
 	struct transaction *trans;
 	bool is_corrupt = false;
 	bool chk_quota;
 	int ret;
 
-	if (!arg || (!streq(arg, "T") && !streq(arg, "F")))
-		return EINVAL;
-
 	if ((trans = conn->transaction) == NULL)
 		return ENOENT;
 
@@ -537,7 +599,7 @@ int do_transaction_end(const void *ctx, struct connection *conn,
 	/* Attach transaction to ctx for auto-cleanup */
 	talloc_steal(ctx, trans);
 
-	if (streq(arg, "T")) {
+	if (commit) {
 		if (trans->fail)
 			return ENOMEM;
 		ret = acc_fix_domains(&trans->changed_domains, chk_quota,
@@ -545,6 +607,7 @@ int do_transaction_end(const void *ctx, struct connection *conn,
 		if (ret)
 			return ret;
 		ret = finalize_transaction(conn, trans, &is_corrupt);
+		domain_ta_commit(conn, ret == EAGAIN);
 		if (ret)
 			return ret;
 
@@ -556,6 +619,23 @@ int do_transaction_end(const void *ctx, struct connection *conn,
 		if (is_corrupt)
 			corrupt(conn, "transaction inconsistency");
 	}
+
+	return 0;
+}
+
+int do_transaction_end(const void *ctx, struct connection *conn,
+		       struct buffered_data *in)
+{
+	const char *arg = onearg(in);
+	int ret;
+
+	if (!arg || (!streq(arg, "T") && !streq(arg, "F")))
+		return EINVAL;
+
+	ret = transaction_end(ctx, conn, streq(arg, "T"));
+	if (ret)
+		return ret;
+
 	send_ack(conn, XS_TRANSACTION_END);
 
 	return 0;
@@ -29,6 +29,10 @@ struct transaction;
 
 extern uint64_t generation;
 
+/* Start/end a transaction of conn, without sending any reply. */
+struct transaction *transaction_start(struct connection *conn);
+int transaction_end(const void *ctx, struct connection *conn, bool commit);
+
 int do_transaction_start(const void *ctx, struct connection *conn,
 			 struct buffered_data *node);
 int do_transaction_end(const void *ctx, struct connection *conn,
@@ -39,6 +43,9 @@ struct transaction *transaction_lookup(struct connection *conn, uint32_t id);
 /* Set flag for created node. */
 void ta_node_created(struct transaction *trans);
 
+/* The children of a node have been listed. */
+void ta_children_read(struct connection *conn, const char *name);
+
 /* This node was accessed. */
 int __must_check access_node(struct connection *conn, struct node *node,
                              enum node_access_type type, TDB_DATA *key);
@@ -25,17 +25,40 @@
 #include <assert.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
 #include "xenstored_domain.h"
 #include "xenstored_transaction.h"
 
+/* All watches on one path. */
+struct watch_path
+{
+	/* Watches on this path, of any connection. */
+	struct list_head watches;
+
+	char *path;
+};
+
+/*
+ * Index of all watches by their path.  Firing looks up the modified node
+ * and each of its ancestors, instead of testing every watch of every
+ * connection.
+ */
+static struct hashtable *watch_index;
+
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same path, in watch_index. */
+	struct list_head path_list;
+	struct watch_path *index;
+
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -46,24 +69,6 @@ struct watch
 	char *node;
 };
 
-/* Is child a subnode of parent, or equal? */
-static bool is_child(const char *child, const char *parent)
-{
-	unsigned int len = strlen(parent);
-
-	/*
-	 * / should really be "" for this algorithm to work, but that's a
-	 * usability nightmare.
-	 */
-	if (streq(parent, "/"))
-		return true;
-
-	if (strncmp(child, parent, len) != 0)
-		return false;
-
-	return child[len] == '/' || child[len] == '\0';
-}
-
 static const char *get_watch_path(const struct watch *watch, const char *name)
 {
 	return name + watch->prefix_len;
@@ -114,19 +119,43 @@ static bool watch_permitted(struct connection *conn, const void *ctx,
 	return perm & XS_PERM_READ;
 }
 
+/* Send events for the watches on path, name being the modified node. */
+static void fire_path(struct buffered_data *req, const void *ctx,
+		      const char *path, const char *name, struct node *node,
+		      struct node_perms *perms)
+{
+	struct watch_path *wp;
+	struct watch *watch;
+
+	if (!watch_index)
+		return;
+
+	wp = hashtable_search(watch_index, path);
+	if (!wp)
+		return;
+
+	list_for_each_entry(watch, &wp->watches, path_list) {
+		if (watch_permitted(watch->conn, ctx, name, node, perms))
+			send_event(req, watch->conn,
+				   get_watch_path(watch, name), watch->token);
+	}
+}
+
 /*
  * Check whether any watch events are to be sent.
  * Temporary memory allocations are done with ctx.
  * We need to take the (potential) old permissions of the node into account
  * as a watcher losing permissions to access a node should receive the
  * watch event, too.
+ * Unless exact, watches on all ancestors of the node fire, too, shallowest
+ * first.
  */
 void fire_watches(struct connection *conn, const void *ctx, const char *name,
 		  struct node *node, bool exact, struct node_perms *perms)
 {
-	struct connection *i;
 	struct buffered_data *req;
-	struct watch *watch;
+	char prefix[XENSTORE_ABS_PATH_MAX + 1];
+	unsigned int i;
 
 	/* During transactions, don't fire watches, but queue them. */
 	if (conn && conn->transaction) {
@@ -136,29 +165,86 @@ void fire_watches(struct connection *conn, const void *ctx, const char *name,
 
 	req = domain_is_unprivileged(conn) ? conn->in : NULL;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		if (!watch_permitted(i, ctx, name, node, perms))
-			continue;
-
-		list_for_each_entry(watch, &i->watches, list) {
-			if (exact) {
-				if (streq(name, watch->node))
-					send_event(req, i,
-						   get_watch_path(watch, name),
-						   watch->token);
-			} else {
-				if (is_child(name, watch->node))
-					send_event(req, i,
-						   get_watch_path(watch, name),
-						   watch->token);
-			}
+	if (!exact) {
+		/*
+		 * / should really be "" for this to work, but that's a
+		 * usability nightmare: a watch on / sees everything.
+		 */
+		if (!streq(name, "/"))
+			fire_path(req, ctx, "/", name, node, perms);
+
+		/* Node names have been validated, so are short enough. */
+		assert(strlen(name) < sizeof(prefix));
+		for (i = 1; name[i]; i++) {
+			if (name[i] != '/')
+				continue;
+			memcpy(prefix, name, i);
+			prefix[i] = 0;
+			fire_path(req, ctx, prefix, name, node, perms);
+		}
+	}
+
+	fire_path(req, ctx, name, name, node, perms);
+}
+
+static unsigned int watch_hash_fn(const void *k)
+{
+	const char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int watch_keys_equal_fn(const void *key1, const void *key2)
+{
+	return streq(key1, key2);
+}
+
+static int index_watch(struct watch *watch)
+{
+	struct watch_path *wp;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(NULL, 64, watch_hash_fn,
+					       watch_keys_equal_fn, 0);
+		if (!watch_index)
+			return ENOMEM;
+	}
+
+	wp = hashtable_search(watch_index, watch->node);
+	if (!wp) {
+		wp = talloc(watch_index, struct watch_path);
+		if (!wp)
+			return ENOMEM;
+		wp->path = talloc_strdup(wp, watch->node);
+		if (!wp->path || !hashtable_insert(watch_index, wp->path, wp)) {
+			talloc_free(wp);
+			return ENOMEM;
 		}
+		INIT_LIST_HEAD(&wp->watches);
 	}
+
+	list_add_tail(&watch->path_list, &wp->watches);
+	watch->index = wp;
+
+	return 0;
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+	struct watch_path *wp = watch->index;
+
+	list_del(&watch->path_list);
+	if (list_empty(&wp->watches)) {
+		hashtable_remove(watch_index, wp->path);
+		talloc_free(wp);
+	}
+
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -203,6 +289,12 @@ static struct watch *add_watch(struct connection *conn, char *path, char *token,
 			      no_quota_check))
 		goto nomem;
 
+	if (index_watch(watch)) {
+		domain_memory_add_nochk(conn->id, -strlen(path) - strlen(token));
+		goto nomem;
+	}
+
+	watch->conn = conn;
 	watch->prefix_len = relative ? strlen(get_implicit_path(conn)) + 1 : 0;
 
 	INIT_LIST_HEAD(&watch->events);
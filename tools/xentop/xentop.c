@@ -137,6 +137,7 @@ static void do_domain(xenstat_domain *);
 static void do_vcpu(xenstat_domain *);
 static void do_network(xenstat_domain *);
 static void do_vbd(xenstat_domain *);
+static void do_vmexits(xenstat_domain *);
 static void top(void);
 
 /* Field types */
@@ -209,6 +210,7 @@ unsigned int iterations = 0;
 int show_vcpus = 0;
 int show_networks = 0;
 int show_vbds = 0;
+int show_vmexits = 0;
 int repeat_header = 0;
 int show_full_name = 0;
 #define PROMPT_VAL_LEN 80
@@ -237,6 +239,7 @@ static void usage(const char *program)
 	       "-x, --vbds           output vbd block device data\n"
 	       "-r, --repeat-header  repeat table header before each domain\n"
 	       "-v, --vcpus          output vcpu data\n"
+	       "-e, --vmexits        output HVM VM exit data\n"
 	       "-b, --batch	     output in batch mode, no user input accepted\n"
 	       "-i, --iterations     number of iterations before exiting\n"
 	       "-f, --full-name      output the full domain name (not truncated)\n"
@@ -370,6 +373,9 @@ static int handle_key(int ch)
 		case 'v': case 'V':
 			show_vcpus ^= 1;
 			break;
+		case 'e': case 'E':
+			show_vmexits ^= 1;
+			break;
 		case KEY_DOWN:
 			first_domain_index++;
 			break;
@@ -499,17 +505,12 @@ static void print_cpu(xenstat_domain *domain)
 /* Computes the CPU percentage used for a specified domain */
 static double get_cpu_pct(xenstat_domain *domain)
 {
-	xenstat_domain *old_domain;
 	double us_elapsed;
 
 	/* Can't calculate CPU percentage without a previous sample. */
 	if(prev_node == NULL)
 		return 0.0;
 
-	old_domain = xenstat_node_domain(prev_node, xenstat_domain_id(domain));
-	if(old_domain == NULL)
-		return 0.0;
-
 	/* Calculate the time elapsed in microseconds */
 	us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
 		      +(curtime.tv_usec - oldtime.tv_usec));
@@ -517,8 +518,7 @@ static double get_cpu_pct(xenstat_domain *domain)
 	/* In the following, nanoseconds must be multiplied by 1000.0 to
 	 * convert to microseconds, then divided by 100.0 to get a percentage,
 	 * resulting in a multiplication by 10.0 */
-	return ((xenstat_domain_cpu_ns(domain)
-		 -xenstat_domain_cpu_ns(old_domain))/10.0)/us_elapsed;
+	return (xenstat_domain_cpu_ns_delta(domain)/10.0)/us_elapsed;
 }
 
 static int compare_cpu_pct(xenstat_domain *domain1, xenstat_domain *domain2)
@@ -1027,6 +1027,12 @@ void do_bottom_line(void)
 		attr_addstr(show_vcpus ? COLOR_PAIR(1) : 0, "CPUs");
 		addstr("  ");
 
+		/* VM exits */
+		attr_addstr(show_vmexits ? COLOR_PAIR(1) : 0, "VM");
+		addch(A_REVERSE | 'E');
+		attr_addstr(show_vmexits ? COLOR_PAIR(1) : 0, "xits");
+		addstr("  ");
+
 		/* repeat */
 		addch(A_REVERSE | 'R');
 		attr_addstr(repeat_header ? COLOR_PAIR(1) : 0, "epeat header");
@@ -1159,6 +1165,129 @@ void do_vbd(xenstat_domain *domain)
 	}
 }
 
+/* Names of the most common VM exit reasons */
+static const char *const vmx_exit_names[] = {
+	[0]  = "EXC_NMI",      [1]  = "EXT_INTR",    [7]  = "INTR_WINDOW",
+	[9]  = "TASK_SWITCH",  [10] = "CPUID",       [12] = "HLT",
+	[14] = "INVLPG",       [16] = "RDTSC",       [18] = "VMCALL",
+	[28] = "CR_ACCESS",    [29] = "DR_ACCESS",   [30] = "IO",
+	[31] = "RDMSR",        [32] = "WRMSR",       [36] = "MWAIT",
+	[40] = "PAUSE",        [43] = "TPR_BELOW",   [44] = "APIC_ACCESS",
+	[45] = "EOI_INDUCED",  [48] = "EPT_VIOL",    [49] = "EPT_MISCONF",
+	[51] = "RDTSCP",       [52] = "PREEMPT_TMR", [54] = "WBINVD",
+	[55] = "XSETBV",       [56] = "APIC_WRITE",  [62] = "PML_FULL",
+};
+
+static const char *const svm_exit_names[] = {
+	[0x60] = "INTR",       [0x61] = "NMI",       [0x64] = "VINTR",
+	[0x6e] = "RDTSC",      [0x72] = "CPUID",     [0x77] = "PAUSE",
+	[0x78] = "HLT",        [0x79] = "INVLPG",    [0x7b] = "IOIO",
+	[0x7c] = "MSR",        [0x7d] = "TASK_SWITCH", [0x81] = "VMMCALL",
+	[0x87] = "RDTSCP",     [0x89] = "WBINVD",    [0x8b] = "MWAIT",
+	[0x8d] = "XSETBV",
+};
+
+static const char *vmexit_name(unsigned int vendor, unsigned int reason,
+			       char *buf, size_t size)
+{
+	const char *name = NULL;
+
+	if (vendor == XENSTAT_VMEXIT_VMX &&
+	    reason < sizeof(vmx_exit_names) / sizeof(vmx_exit_names[0]))
+		name = vmx_exit_names[reason];
+	else if (vendor == XENSTAT_VMEXIT_SVM) {
+		if (reason < sizeof(svm_exit_names) / sizeof(svm_exit_names[0]))
+			name = svm_exit_names[reason];
+		else if (reason == 0x400)
+			name = "NPF";
+	}
+
+	if (name == NULL) {
+		snprintf(buf, size, "%#x", reason);
+		name = buf;
+	}
+
+	return name;
+}
+
+struct vmexit_rate {
+	unsigned int reason;
+	unsigned long long count;
+	unsigned long long cycles;
+};
+
+static int compare_vmexit_rates(const void *a, const void *b)
+{
+	const struct vmexit_rate *r1 = a, *r2 = b;
+
+	return r1->cycles < r2->cycles ? 1 : r1->cycles > r2->cycles ? -1 : 0;
+}
+
+/* Output the VM exits since the previous sample, the costliest first */
+#define VMEXITS_SHOWN 5
+void do_vmexits(xenstat_domain *domain)
+{
+	xenstat_domain *old_domain = NULL;
+	struct vmexit_rate *rates;
+	unsigned int i, j, num = xenstat_domain_num_vmexits(domain);
+	unsigned long long total = 0;
+	double sec_elapsed;
+
+	if (num == 0)
+		return;
+
+	if (prev_node != NULL)
+		old_domain = xenstat_node_domain(prev_node,
+						 xenstat_domain_id(domain));
+
+	sec_elapsed = (curtime.tv_sec - oldtime.tv_sec)
+		      + (curtime.tv_usec - oldtime.tv_usec) / 1000000.0;
+	/* No exit data in the previous sample if -e was only just toggled on. */
+	if (old_domain == NULL || sec_elapsed <= 0 ||
+	    xenstat_domain_num_vmexits(old_domain) == 0)
+		return;
+
+	rates = calloc(num, sizeof(*rates));
+	if (rates == NULL)
+		fail("Failed to allocate memory\n");
+
+	for (i = 0; i < num; i++) {
+		xenstat_vmexit *vmexit = xenstat_domain_vmexit(domain, i);
+
+		rates[i].reason = xenstat_vmexit_reason(vmexit);
+		rates[i].count = xenstat_vmexit_count(vmexit);
+		rates[i].cycles = xenstat_vmexit_cycles(vmexit);
+
+		for (j = 0; j < xenstat_domain_num_vmexits(old_domain); j++) {
+			xenstat_vmexit *old = xenstat_domain_vmexit(old_domain,
+								    j);
+
+			if (xenstat_vmexit_reason(old) == rates[i].reason) {
+				rates[i].count -= xenstat_vmexit_count(old);
+				rates[i].cycles -= xenstat_vmexit_cycles(old);
+				break;
+			}
+		}
+		total += rates[i].count;
+	}
+
+	qsort(rates, num, sizeof(*rates), compare_vmexit_rates);
+
+	print("VM exits/s: %8.0f ", total / sec_elapsed);
+	for (i = 0; i < num && i < VMEXITS_SHOWN && rates[i].count; i++) {
+		char buf[16];
+
+		print(" %s: %.0f (%llucyc)",
+		      vmexit_name(xenstat_domain_vmexit_vendor(domain),
+				  rates[i].reason, buf, sizeof(buf)),
+		      rates[i].count / sec_elapsed,
+		      rates[i].cycles / rates[i].count);
+	}
+	print("\n");
+
+	free(rates);
+}
+
 static void top(void)
 {
 	xenstat_domain **domains;
@@ -1168,7 +1297,10 @@ static void top(void)
 	if (prev_node != NULL)
 		xenstat_free_node(prev_node);
 	prev_node = cur_node;
-	cur_node = xenstat_get_node(xhandle, XENSTAT_ALL);
+	cur_node = xenstat_get_node_incremental(xhandle,
+	                                        XENSTAT_ALL |
+	                                        (show_vmexits ? XENSTAT_VMEXIT : 0),
+	                                        prev_node);
 	if (cur_node == NULL)
 		fail("Failed to retrieve statistics from libxenstat\n");
 
@@ -1211,6 +1343,8 @@ static void top(void)
 			do_network(domains[i]);
 		if (show_vbds)
 			do_vbd(domains[i]);
+		if (show_vmexits)
+			do_vmexits(domains[i]);
 	}
 
 	if (!batch)
@@ -1238,13 +1372,14 @@ int main(int argc, char **argv)
 		{ "vbds",          no_argument,       NULL, 'x' },
 		{ "repeat-header", no_argument,       NULL, 'r' },
 		{ "vcpus",         no_argument,       NULL, 'v' },
+		{ "vmexits",       no_argument,       NULL, 'e' },
 		{ "delay",         required_argument, NULL, 'd' },
 		{ "batch",	   no_argument,	      NULL, 'b' },
 		{ "iterations",	   required_argument, NULL, 'i' },
 		{ "full-name",     no_argument,       NULL, 'f' },
 		{ 0, 0, 0, 0 },
 	};
-	const char *sopts = "hVnxrvd:bi:f";
+	const char *sopts = "hVnxrved:bi:f";
 
 	if (atexit(cleanup) != 0)
 		fail("Failed to install cleanup handler.\n");
@@ -1273,6 +1408,9 @@ int main(int argc, char **argv)
 		case 'v':
 			show_vcpus = 1;
 			break;
+		case 'e':
+			show_vmexits = 1;
+			break;
 		case 'd':
 			delay = atoi(optarg);
 			break;
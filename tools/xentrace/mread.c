@@ -1,5 +1,7 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,9 +29,49 @@ mread_handle_t mread_init(int fd)
     fstat(fd, &s);
     h->file_size = s.st_size;
 
+    /*
+     * Map regular files in one go if the address space allows.  The
+     * per-pcpu streams are interleaved in the file, and on hosts with
+     * more pcpus than MREAD_MAPS the windows below get remapped for
+     * nearly every record.  Every stream moves forwards through the file,
+     * so ask for aggressive readahead.
+     */
+    if ( S_ISREG(s.st_mode) && s.st_size > 0
+         && (uintmax_t)s.st_size <= SIZE_MAX )
+    {
+        h->whole = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if ( h->whole == MAP_FAILED )
+            h->whole = NULL;
+        else
+            madvise(h->whole, s.st_size, MADV_SEQUENTIAL);
+    }
+
     return h;
 }
 
+/*
+ * Keep the kernel reading ahead of the furthest stream, so that I/O
+ * overlaps with analysis rather than stalling it on page faults.
+ */
+static void mread_readahead(mread_handle_t h, off_t offset)
+{
+    off_t len;
+
+    if ( offset + (off_t)(MREAD_RA_SIZE / 2) < h->ra_end
+         || h->ra_end >= h->file_size )
+        return;
+
+    if ( h->ra_end < (offset & MREAD_BUF_MASK) )
+        h->ra_end = offset & MREAD_BUF_MASK;
+
+    len = h->file_size - h->ra_end;
+    if ( len > MREAD_RA_SIZE )
+        len = MREAD_RA_SIZE;
+
+    madvise(h->whole + h->ra_end, len, MADV_WILLNEED);
+    h->ra_end += len;
+}
+
 ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
 {
     /* Idea: have a "cache" of N mmaped regions.  If the offset is
@@ -66,6 +108,13 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
         len = h->file_size - offset;
     }
 
+    if ( h->whole )
+    {
+        mread_readahead(h, offset);
+        memcpy(rec, h->whole + offset, len);
+        return len;
+    }
+
     /* Try to find the offset in our range */
     dprintf(warn, " Trying last, %d\n", last);
     if ( h->map[h->last].buffer
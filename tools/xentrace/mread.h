@@ -3,9 +3,14 @@
 #define PAGE_SHIFT 12
 #define MREAD_BUF_SIZE (1ULL<<(PAGE_SHIFT+MREAD_BUF_SHIFT))
 #define MREAD_BUF_MASK (~(MREAD_BUF_SIZE-1))
+/* Readahead hint granularity when the whole file is mapped */
+#define MREAD_RA_SIZE (64ULL<<20)
 typedef struct mread_ctrl {
     int fd;
     off_t file_size;
+    /* Whole file mapping, if we could get one; otherwise use map[] */
+    char * whole;
+    off_t ra_end;
     struct mread_buffer {
         char * buffer;
         off_t start_offset;
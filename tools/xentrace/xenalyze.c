@@ -190,6 +190,11 @@ struct {
     int interrupt_eip_enumeration_vector;
     int default_guest_paging_levels;
     int sample_size, sample_max;
+    enum {
+        SUMMARY_FORMAT_TEXT,
+        SUMMARY_FORMAT_JSON,
+        SUMMARY_FORMAT_CSV
+    } summary_format;
     enum error_level tolerance; /* Tolerate up to this level of error */
     struct {
         tsc_t cycles;
@@ -278,7 +283,11 @@ struct interval_element {
 };
 
 struct cycle_summary {
-    int event_count, count, sample_size;
+    /*
+     * count, event_count and cycles are scaled by the sample period of the
+     * events' class; samples is the number of updates actually seen.
+     */
+    int event_count, count, samples, sample_size;
     unsigned long long cycles;
     long long *sample;
     struct interval_element interval;
@@ -1869,6 +1878,12 @@ struct {
     tsc_t buffer_trace_virq_tsc;
     struct pcpu_info pcpu[MAX_CPUS];
 
+    /* Trace sampling policy in effect, per toplevel class. */
+    unsigned int sample_period[TOPLEVEL_MAX];
+    int rate_limited;
+    /* Number of events the one being processed stands for. */
+    unsigned int weight;
+
     struct {
         int id;
         /* Invariant: head null => tail null; head !null => tail valid */
@@ -2206,14 +2221,16 @@ static inline double summary_percent_global(struct cycle_summary *s) {
 }
 
 static inline void update_cycles(struct cycle_summary *s, long long c) {
-    s->event_count++;
+    unsigned int w = P.weight ?: 1;
+
+    s->event_count += w;
 
     if (!c)
         return;
             
     if(opt.sample_size) {
-        if (s->count >= s->sample_size
-            && (s->count == 0
+        if (s->samples >= s->sample_size
+            && (s->samples == 0
                 || opt.sample_max == 0
                 || s->sample_size < opt.sample_max)) {
             int new_size;
@@ -2235,26 +2252,27 @@ static inline void update_cycles(struct cycle_summary *s, long long c) {
             }
         }
         
-        if (s->count < s->sample_size) {
-            s->sample[s->count]=c;
+        if (s->samples < s->sample_size) {
+            s->sample[s->samples]=c;
         } else {
             /* 
              * If we run out of space for samples, start taking only a
              * subset of samples.
              */
             int lap, index;
-            lap = (s->count/s->sample_size)+1;
-            index =s->count % s->sample_size;
+            lap = (s->samples/s->sample_size)+1;
+            index =s->samples % s->sample_size;
             if((index - (lap/3))%lap == 0) {
                 s->sample[index]=c;
              }
          }
     }
-    s->count++;
-    s->cycles += c;
+    s->samples++;
+    s->count += w;
+    s->cycles += c * w;
     
-    s->interval.count++;
-    s->interval.cycles += c;
+    s->interval.count += w;
+    s->interval.cycles += c * w;
 }
 
 static inline void clear_interval_cycles(struct interval_element *e) {
@@ -2271,7 +2289,7 @@ static inline void print_cpu_affinity(struct cycle_summary *s, const char *p) {
 
         if ( opt.sample_size ) {
             long long  p5, p50, p95;
-            int data_size = s->count;
+            int data_size = s->samples;
            if(data_size > s->sample_size)
                data_size = s->sample_size;
 
@@ -2302,7 +2320,7 @@ static inline void print_cycle_percent_summary(struct cycle_summary *s,
 
         if ( opt.sample_size ) {
             long long p5, p50, p95;
-            int data_size = s->count;
+            int data_size = s->samples;
 
             if(data_size > s->sample_size)
                 data_size = s->sample_size;
@@ -2335,7 +2353,7 @@ static inline void print_cycle_summary(struct cycle_summary *s,
 
         if ( opt.sample_size ) {
             long long p5, p50, p95;
-            int data_size = s->count;
+            int data_size = s->samples;
 
             if(data_size > s->sample_size)
                 data_size = s->sample_size;
@@ -2359,7 +2377,7 @@ static inline void print_cycle_summary(struct cycle_summary *s,
         if((_s).event_count) {                                          \
             if ( opt.sample_size ) {                                    \
                 unsigned long long p5, p50, p95;                        \
-                int data_size=(_s).count;                               \
+                int data_size=(_s).samples;                             \
                 if(data_size > (_s).sample_size)                         \
                     data_size=(_s).sample_size;                          \
                 p50=percentile((_s).sample, data_size, 50);      \
@@ -8769,6 +8787,38 @@ struct lost_record_struct {
         tsc_t first_tsc;
 };
 
+void process_sampling(struct pcpu_info *p)
+{
+    struct record_info *ri = &p->ri;
+    struct {
+        unsigned int classes, period, rate, burst;
+    } *r = (typeof(r))ri->d;
+    int i;
+
+    if(ri->extra_words != 4)
+    {
+        fprintf(warn, "FATAL: Sampling record has unexpected extra words %d!\n",
+                ri->extra_words);
+        error(ERR_RECORD, ri);
+        return;
+    }
+
+    if(opt.dump_all)
+        printf(" %s sampling classes %x 1 in %u rate %u burst %u\n",
+               ri->dump_header, r->classes, r->period, r->rate, r->burst);
+
+    for(i=0; i<TOPLEVEL_MAX; i++)
+        if((r->classes >> TRC_CLS_SHIFT) & (1U<<i))
+            P.sample_period[i] = r->period;
+
+    /* Rate limited events can't be accounted for. */
+    if(r->rate && !P.rate_limited) {
+        fprintf(warn, "WARNING: trace rate limiting active for classes %x, "
+                "summaries undercount\n", r->classes);
+        P.rate_limited = 1;
+    }
+}
+
 void process_lost_records(struct pcpu_info *p)
 {
     struct record_info *ri = &p->ri;
@@ -8948,6 +8998,9 @@ void base_process(struct pcpu_info *p) {
     {
     case TRC_TRACE_WRAP_BUFFER:
         break;
+    case TRC_TRACE_SAMPLING:
+        process_sampling(p);
+        break;
     case TRC_LOST_RECORDS:
         process_lost_records(p);
         break;
@@ -9436,6 +9489,9 @@ void process_record(struct pcpu_info *p) {
     if ( toplevel < 0 )
         return;
 
+    /* Sampled out events get accounted for by the ones recorded. */
+    P.weight = P.sample_period[toplevel];
+
     /* Unify toplevel assertions */
     if ( toplevel_assert_check(toplevel, p) )
     {
@@ -9926,10 +9982,197 @@ void domain_summary(void)
     }
 }
 
+/*
+ * Structured summary: one row per (domain, vcpu, table, key), written as
+ * the domain list is walked, as JSON lines or CSV.  The field and table
+ * names are an interface: add new ones, but don't rename existing ones.
+ *
+ *  table            key                  count
+ *  total            time                 -
+ *  domain_runstate  runstate name        cycle summary count
+ *  runstate         runstate name        cycle summary count
+ *  runnable         runnable state name  cycle summary count
+ *  exit             exit reason          events
+ *  ipi_latency      all                  events
+ *  ipi_vector       vector               IPIs sent
+ *
+ * domain and vcpu are null (JSON) or empty (CSV) for rows which aren't
+ * specific to one; count, cycles, avg_cycles and the percentiles likewise
+ * when they don't apply.
+ */
+static void structured_string(const char *str)
+{
+    char quote = opt.summary_format == SUMMARY_FORMAT_CSV ? '"' : '\\';
+
+    putchar('"');
+    for ( ; *str; str++ )
+    {
+        if ( *str == '"' || (*str == '\\' && quote == '\\') )
+            putchar(quote);
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+static void structured_field(const char *name, int first)
+{
+    if ( !first )
+        putchar(',');
+    if ( opt.summary_format == SUMMARY_FORMAT_JSON )
+        printf("\"%s\":", name);
+}
+
+static void structured_number(const char *name, long long val, int valid,
+                              int first)
+{
+    structured_field(name, first);
+    if ( valid )
+        printf("%lld", val);
+    else if ( opt.summary_format == SUMMARY_FORMAT_JSON )
+        printf("null");
+}
+
+static void structured_header(void)
+{
+    if ( opt.summary_format == SUMMARY_FORMAT_CSV )
+        printf("domain,vcpu,table,key,count,cycles,avg_cycles,p5,p50,p95\n");
+}
+
+static void structured_row(int did, int vid, const char *table,
+                           const char *key, long long count,
+                           const struct cycle_summary *s,
+                           long long (*pct)(long long *, int, int))
+{
+    long long p[3] = { 0 };
+    int have_pct = s && pct && opt.sample_size;
+
+    if ( have_pct )
+    {
+        int data_size = s->samples;
+
+        if ( data_size > s->sample_size )
+            data_size = s->sample_size;
+
+        p[0] = pct(s->sample, data_size, 5);
+        p[1] = pct(s->sample, data_size, 50);
+        p[2] = pct(s->sample, data_size, 95);
+    }
+
+    if ( opt.summary_format == SUMMARY_FORMAT_JSON )
+        putchar('{');
+
+    structured_number("domain", did, did >= 0, 1);
+    structured_number("vcpu", vid, vid >= 0, 0);
+    structured_field("table", 0);
+    structured_string(table);
+    structured_field("key", 0);
+    structured_string(key);
+    structured_number("count", count, count >= 0, 0);
+    structured_number("cycles", s ? (long long)s->cycles : 0, !!s, 0);
+    structured_number("avg_cycles",
+                      s && s->count ? (long long)(s->cycles / s->count) : 0,
+                      !!s, 0);
+    structured_number("p5", p[0], have_pct, 0);
+    structured_number("p50", p[1], have_pct, 0);
+    structured_number("p95", p[2], have_pct, 0);
+
+    if ( opt.summary_format == SUMMARY_FORMAT_JSON )
+        putchar('}');
+    putchar('\n');
+}
+
+static void structured_summary_vcpu(struct vcpu_data *v)
+{
+    int did = v->d->did, i;
+    char key[16];
+
+    for ( i = 0; i < RUNSTATE_MAX; i++ )
+        if ( v->runstates[i].count )
+            structured_row(did, v->vid, "runstate", runstate_name[i],
+                           v->runstates[i].count, v->runstates + i,
+                           self_weighted_percentile);
+
+    for ( i = 0; i < RUNNABLE_STATE_MAX; i++ )
+        if ( i != RUNNABLE_STATE_INVALID && v->runnable_states[i].count )
+            structured_row(did, v->vid, "runnable", runnable_state_name[i],
+                           v->runnable_states[i].count,
+                           v->runnable_states + i, self_weighted_percentile);
+
+    if ( v->data_type == VCPU_DATA_HVM && v->hvm.summary_info )
+    {
+        struct hvm_data *h = &v->hvm;
+
+        for ( i = 0; i < h->exit_reason_max; i++ )
+        {
+            struct cycle_summary *s = h->summary.exit_reason + i;
+
+            if ( !s->event_count )
+                continue;
+
+            if ( !h->exit_reason_name[i] )
+                snprintf(key, sizeof(key), "%d", i);
+            structured_row(did, v->vid, "exit",
+                           h->exit_reason_name[i] ?: key,
+                           s->event_count, s, percentile);
+        }
+
+        if ( h->summary.ipi_latency.event_count )
+            structured_row(did, v->vid, "ipi_latency", "all",
+                           h->summary.ipi_latency.event_count,
+                           &h->summary.ipi_latency, percentile);
+
+        for ( i = 0; i < 256; i++ )
+            if ( h->summary.ipi_count[i] )
+            {
+                snprintf(key, sizeof(key), "%d", i);
+                structured_row(did, v->vid, "ipi_vector", key,
+                               h->summary.ipi_count[i], NULL, NULL);
+            }
+    }
+}
+
+static void structured_summary_domain(struct domain_data *d)
+{
+    int i;
+
+    for ( i = 0; i < DOMAIN_RUNSTATE_MAX; i++ )
+        if ( d->runstates[i].count )
+            structured_row(d->did, -1, "domain_runstate",
+                           domain_runstate_name[i], d->runstates[i].count,
+                           d->runstates + i, self_weighted_percentile);
+
+    for ( i = 0; i < MAX_CPUS; i++ )
+        if ( d->vcpu[i] )
+            structured_summary_vcpu(d->vcpu[i]);
+}
+
+static void structured_summary(void)
+{
+    struct domain_data *d;
+    struct cycle_summary total = { .count = 1, .cycles = P.f.total_cycles };
+
+    structured_header();
+
+    structured_row(-1, -1, "total", "time", -1, &total, NULL);
+
+    if ( opt.show_default_domain_summary )
+        structured_summary_domain(&default_domain);
+
+    for ( d = domain_list; d; d = d->next )
+        structured_summary_domain(d);
+}
+
 char * stringify_cpu_hz(long long cpu_hz);
 
 void summary(void) {
     int i;
+
+    if ( opt.summary_format != SUMMARY_FORMAT_TEXT )
+    {
+        structured_summary();
+        return;
+    }
+
     printf("Total time: %.2lf seconds (using cpu speed %s)\n",
            ((double)(P.f.total_cycles))/opt.cpu_hz,
            stringify_cpu_hz(opt.cpu_hz));
@@ -10036,6 +10279,7 @@ enum {
     OPT_SAMPLE_SIZE,
     OPT_SAMPLE_MAX,
     OPT_REPORT_PCPU,
+    OPT_SUMMARY_FORMAT,
     /* Guest info */
     OPT_DEFAULT_GUEST_PAGING_LEVELS,
     OPT_SYMBOL_FILE,
@@ -10470,6 +10714,19 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.summary_info = 1;
         G.output_defined = 1;
         break;
+    case OPT_SUMMARY_FORMAT:
+        if ( !strcmp(arg, "text") )
+            opt.summary_format = SUMMARY_FORMAT_TEXT;
+        else if ( !strcmp(arg, "json") )
+            opt.summary_format = SUMMARY_FORMAT_JSON;
+        else if ( !strcmp(arg, "csv") )
+            opt.summary_format = SUMMARY_FORMAT_CSV;
+        else
+            argp_usage(state);
+        opt.summary = 1;
+        opt.summary_info = 1;
+        G.output_defined = 1;
+        break;
     case OPT_REPORT_PCPU:
         opt.report_pcpu = 1;
         //opt.summary_info = 1;
@@ -10777,6 +11034,13 @@ const struct argp_option cmd_opts[] =  {
       .group = OPT_GROUP_SUMMARY,
       .doc = "Output a summary", },
 
+    { .name = "summary-format",
+      .key = OPT_SUMMARY_FORMAT,
+      .arg = "text|json|csv",
+      .group = OPT_GROUP_SUMMARY,
+      .doc = "Output the summary as text (default), or as one row per " \
+      "domain, vcpu and statistic in JSON lines or CSV.  Implies --summary.", },
+
     { .name = "report-pcpu",
       .key = OPT_REPORT_PCPU,
       .group = OPT_GROUP_SUMMARY,
@@ -10,6 +10,7 @@
  */
 
 #include <time.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/mman.h>
@@ -25,7 +26,13 @@
 #include <assert.h>
 #include <ctype.h>
 #include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -49,6 +56,9 @@ do {                                                            \
 #define POLL_SLEEP_MILLIS 100
 
 #define DEFAULT_TBUF_SIZE 32
+
+/* zstd's fastest levels keep up with busy trace buffers at little CPU cost */
+#define DEFAULT_COMPRESS_LEVEL 1
 /***** The code **************************************************************/
 
 typedef struct settings_st {
@@ -60,9 +70,18 @@ typedef struct settings_st {
     unsigned long disk_rsvd;
     unsigned long timeout;
     unsigned long memory_buffer;
+    char *network;
+    int compress_level;
+    unsigned int nr_samplings;
+    struct {
+        uint32_t classes, period, rate, burst;
+    } sampling[12];
+    int domid;
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        compress:1,
+        set_domain:1;
 } settings_t;
 
 struct t_struct {
@@ -85,6 +104,189 @@ static void close_handler(int signal)
     interrupted = 1;
 }
 
+/*
+ * Output.  Everything goes through write_out(), straight from the mapped
+ * trace buffers, optionally via an inline zstd compression stream (-z), to a
+ * file, standard output, or a TCP connection (-n).
+ */
+#ifdef HAVE_ZSTD
+static ZSTD_CCtx *zcctx;
+static void *zbuf;
+static size_t zbuf_size;
+#endif
+
+/* The reader of the output went away: discard everything from then on. */
+static bool output_broken;
+
+static void write_full(const struct iovec *iov, int iovcnt)
+{
+    struct iovec local[2];
+    ssize_t written;
+
+    if ( output_broken )
+        return;
+
+    assert(iovcnt <= sizeof(local) / sizeof(local[0]));
+    memcpy(local, iov, iovcnt * sizeof(*iov));
+
+    while ( iovcnt )
+    {
+        written = writev(outfd, local, iovcnt);
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EPIPE || errno == ECONNRESET )
+            {
+                /*
+                 * E.g. the remote end of a -n connection was closed.  Shut
+                 * down as if signalled, such that tracing gets disabled.
+                 */
+                fprintf(stderr, "Trace data consumer went away, exiting.\n");
+                output_broken = true;
+                interrupted = 1;
+                return;
+            }
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Deal with short writes, e.g. to sockets. */
+        while ( iovcnt && (size_t)written >= local[0].iov_len )
+        {
+            written -= local[0].iov_len;
+            memmove(local, local + 1, --iovcnt * sizeof(*local));
+        }
+        if ( iovcnt )
+        {
+            local[0].iov_base = (char *)local[0].iov_base + written;
+            local[0].iov_len -= written;
+        }
+    }
+}
+
+#ifdef HAVE_ZSTD
+static void compress_out(ZSTD_inBuffer *in, ZSTD_EndDirective mode)
+{
+    size_t rc;
+
+    do {
+        ZSTD_outBuffer out = { zbuf, zbuf_size, 0 };
+        struct iovec iov;
+
+        rc = ZSTD_compressStream2(zcctx, &out, in, mode);
+        if ( ZSTD_isError(rc) )
+        {
+            fprintf(stderr, "Compression failed: %s\n",
+                    ZSTD_getErrorName(rc));
+            exit(EXIT_FAILURE);
+        }
+
+        iov.iov_base = zbuf;
+        iov.iov_len = out.pos;
+        if ( out.pos )
+            write_full(&iov, 1);
+    } while ( mode == ZSTD_e_continue ? in->pos < in->size : rc );
+}
+#endif
+
+static void write_out(const struct iovec *iov, int iovcnt)
+{
+#ifdef HAVE_ZSTD
+    if ( zcctx )
+    {
+        int i;
+
+        for ( i = 0; i < iovcnt; i++ )
+        {
+            ZSTD_inBuffer in = { iov[i].iov_base, iov[i].iov_len, 0 };
+
+            compress_out(&in, ZSTD_e_continue);
+        }
+        return;
+    }
+#endif
+
+    write_full(iov, iovcnt);
+}
+
+/* Push out what has been compressed so far, ending the stream if @last. */
+static void flush_out(bool last)
+{
+#ifdef HAVE_ZSTD
+    if ( zcctx )
+    {
+        ZSTD_inBuffer in = { NULL, 0, 0 };
+
+        compress_out(&in, last ? ZSTD_e_end : ZSTD_e_flush);
+    }
+#endif
+}
+
+static int open_compression(void)
+{
+#ifdef HAVE_ZSTD
+    zcctx = ZSTD_createCCtx();
+    zbuf_size = ZSTD_CStreamOutSize();
+    zbuf = malloc(zbuf_size);
+    if ( !zcctx || !zbuf ||
+         ZSTD_isError(ZSTD_CCtx_setParameter(zcctx, ZSTD_c_compressionLevel,
+                                             opts.compress_level)) )
+    {
+        fprintf(stderr, "Cannot set up compression\n");
+        return -1;
+    }
+
+    return 0;
+#else
+    fprintf(stderr, "xentrace was built without compression support\n");
+    return -1;
+#endif
+}
+
+/* Connect to @dest, of the form HOST:PORT. */
+static int open_network(const char *dest)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    }, *res, *ai;
+    char *host = strdup(dest), *port = host ? strrchr(host, ':') : NULL;
+    int fd = -1, rc;
+
+    if ( !port )
+    {
+        fprintf(stderr, "Invalid network destination: %s\n", dest);
+        free(host);
+        return -1;
+    }
+    *port++ = '\0';
+
+    rc = getaddrinfo(host, port, &hints, &res);
+    if ( rc )
+    {
+        fprintf(stderr, "Cannot resolve %s: %s\n", dest, gai_strerror(rc));
+        free(host);
+        return -1;
+    }
+
+    for ( ai = res; ai; ai = ai->ai_next )
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( fd < 0 )
+            continue;
+        if ( !connect(fd, ai->ai_addr, ai->ai_addrlen) )
+            break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    free(host);
+
+    return fd;
+}
+
 static struct {
     char * buf;
     unsigned long prod, cons, size;
@@ -280,8 +482,8 @@ void membuf_write(void *start, unsigned long size) {
 
 void membuf_dump(void) {
     /* Dump circular memory buffer */
-    int cons, prod, wsize, written;
-    char * wstart;
+    unsigned long cons, prod;
+    struct iovec iov[2];
 
     fprintf(stderr, "Dumping memory buffer.\n");
 
@@ -291,45 +493,21 @@ void membuf_dump(void) {
     if(prod > cons)
     {
         /* Write in one go */
-        wstart = membuf.buf + cons;
-        wsize = prod - cons;
-
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-            goto fail;
+        iov[0].iov_base = membuf.buf + cons;
+        iov[0].iov_len = prod - cons;
+        write_out(iov, 1);
     }
     else
     {
         /* Write in two pieces: cons->end, beginning->prod. */
-        wstart = membuf.buf + cons;
-        wsize = membuf.size - cons;
-
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %d)\n",
-                    wsize, written);
-            goto fail;
-        }
-
-        wstart = membuf.buf;
-        wsize = prod;
-
-        written = write(outfd, wstart, wsize);
-        if ( written != wsize )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %d)\n",
-                    wsize, written);
-            goto fail;
-        }
+        iov[0].iov_base = membuf.buf + cons;
+        iov[0].iov_len = membuf.size - cons;
+        iov[1].iov_base = membuf.buf;
+        iov[1].iov_len = prod;
+        write_out(iov, 2);
     }
 
     membuf.cons = membuf.prod = 0;
-    
-    return;
-fail:
-    exit(1);
-    return;
 }
 
 /**
@@ -347,8 +525,10 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
                          int total_size)
 {
     struct statvfs stat;
-    size_t written = 0;
-    
+    struct cpu_change_record rec;
+    struct iovec iov[2];
+    int iovcnt = 0;
+
     if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
     {
         unsigned long long freespace;
@@ -387,19 +567,12 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
         }
         else
         {
-            struct cpu_change_record rec;
-
             rec.header = CPU_CHANGE_HEADER;
             rec.data.cpu = cpu;
             rec.data.window_size = total_size;
 
-            written = write(outfd, &rec, sizeof(rec));
-            if ( written != sizeof(rec) )
-            {
-                fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
-                        written);
-                goto fail;
-            }
+            iov[iovcnt].iov_base = &rec;
+            iov[iovcnt++].iov_len = sizeof(rec);
         }
     }
 
@@ -409,13 +582,10 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
     }
     else
     {
-        written = write(outfd, start, size);
-        if ( written != size )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
-                    size, written);
-            goto fail;
-        }
+        /* Record and data in one go, with no intermediate copy. */
+        iov[iovcnt].iov_base = start;
+        iov[iovcnt++].iov_len = size;
+        write_out(iov, iovcnt);
     }
 
     return;
@@ -584,6 +754,27 @@ static void set_evt_mask(uint32_t mask)
     }
 }
 
+static void apply_sampling(void)
+{
+    unsigned int i;
+
+    for ( i = 0; i < opts.nr_samplings; i++ )
+    {
+        if ( xc_tbuf_set_sampling(xc_handle, opts.sampling[i].classes,
+                                  opts.sampling[i].period,
+                                  opts.sampling[i].rate,
+                                  opts.sampling[i].burst) )
+        {
+            PERROR("Failure to set sampling for classes 0x%x",
+                   opts.sampling[i].classes);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "sampling 0x%x: 1 in %u, rate %u/s, burst %u\n",
+                opts.sampling[i].classes, opts.sampling[i].period,
+                opts.sampling[i].rate, opts.sampling[i].burst);
+    }
+}
+
 /**
  * get_num_cpus - get the number of logical CPUs
  */
@@ -684,6 +875,7 @@ static int monitor_tbufs(void)
     unsigned long data_size;
 
     int last_read = 1;
+    bool wrote;
 
     /* prepare to listen for VIRQ_TBUF */
     event_init();
@@ -711,9 +903,17 @@ static int monitor_tbufs(void)
             if ( meta[i] )
                 meta[i]->cons = meta[i]->prod;
 
+    /*
+     * Only now, as with tracing enabled Xen notes the policy in the trace
+     * buffers, for xenalyze to scale its results by.
+     */
+    apply_sampling();
+
     /* now, scan buffers for events */
     while ( 1 )
     {
+        wrote = false;
+
         for ( i = 0; i < num; i++ )
         {
             unsigned long start_offset, end_offset, window_size, cons, prod;
@@ -767,9 +967,13 @@ static int monitor_tbufs(void)
 
             xen_mb(); /* read buffer, then update cons. */
             meta[i]->cons = prod;
-
+            wrote = true;
         }
 
+        /* Don't leave data sitting in the compressor between polls. */
+        if ( wrote )
+            flush_out(false);
+
         if ( interrupted )
         {
             if ( last_read )
@@ -790,6 +994,8 @@ static int monitor_tbufs(void)
     if ( opts.memory_buffer )
         membuf_dump();
 
+    flush_out(true);
+
     /* cleanup */
     free(meta);
     free(data);
@@ -814,6 +1020,7 @@ static void usage(void)
 {
 #define USAGE_STR \
 "Usage: xentrace [OPTION...] [output file]\n" \
+"       xentrace [OPTION...] -n HOST:PORT\n" \
 "Tool to capture Xen trace buffer data\n" \
 "\n" \
 "  -c, --cpu-mask=c        Set cpu-mask, using either hex, CPU ranges, or\n" \
@@ -845,6 +1052,19 @@ static void usage(void)
 "  -r  --reserve-disk-space=n Before writing trace records to disk, check to see\n" \
 "                          that after the write there will be at least n space\n" \
 "                          left on the disk.\n" \
+"  -n  --network=HOST:PORT Stream trace records to a TCP connection to\n" \
+"                          HOST:PORT, rather than writing them to a file.\n" \
+"  -p  --sample=CLASS:N[:RATE[:BURST]]\n" \
+"                          Record only 1 in N events of CLASS (gen, sched,\n" \
+"                          dom0op, hvm, mem, pv, shadow, hw, guest, or a\n" \
+"                          mask), and at most RATE per second on each CPU,\n" \
+"                          in bursts of up to BURST (default: RATE).  May\n" \
+"                          be repeated.\n" \
+"  -d  --domain=D          Only record events occurring in domain D\n" \
+"                          (-1: any domain).\n" \
+"  -z  --compress[=l]      Compress the output as a zstd stream, at level l\n" \
+"                          (default " xstr(DEFAULT_COMPRESS_LEVEL) ").  Decompress with\n" \
+"                          e.g. zstd -d before further processing.\n" \
 "\n" \
 "This tool is used to capture trace buffer data from Xen. The\n" \
 "data is output in a binary format, in the following order:\n" \
@@ -929,6 +1149,55 @@ static long argtol(const char *restrict arg, int base)
     return val;
 }
 
+/* parse CLASS:N[:RATE[:BURST]] */
+static void parse_sampling(char *arg)
+{
+    static const struct {
+        const char *name;
+        uint32_t mask;
+    } classes[] = {
+        { "gen",    TRC_GEN },
+        { "sched",  TRC_SCHED },
+        { "dom0op", TRC_DOM0OP },
+        { "hvm",    TRC_HVM },
+        { "mem",    TRC_MEM },
+        { "pv",     TRC_PV },
+        { "shadow", TRC_SHADOW },
+        { "hw",     TRC_HW },
+        { "guest",  TRC_GUEST },
+    };
+    typeof(opts.sampling[0]) *smp;
+    char *cls = strtok(arg, ":"), *tok;
+    unsigned int i;
+
+    if ( opts.nr_samplings >= sizeof(opts.sampling) / sizeof(*smp) )
+    {
+        fprintf(stderr, "Too many sampling policies\n");
+        usage();
+    }
+    smp = &opts.sampling[opts.nr_samplings++];
+
+    if ( !cls )
+        usage();
+    for ( i = 0; i < sizeof(classes) / sizeof(*classes); i++ )
+        if ( !strcmp(cls, classes[i].name) )
+            smp->classes = classes[i].mask;
+    if ( !smp->classes )
+        smp->classes = argtol(cls, 0);
+
+    if ( !(tok = strtok(NULL, ":")) )
+        usage();
+    smp->period = argtol(tok, 0);
+    if ( (tok = strtok(NULL, ":")) )
+        smp->rate = argtol(tok, 0);
+    if ( (tok = strtok(NULL, ":")) )
+        smp->burst = argtol(tok, 0);
+    else
+        smp->burst = smp->rate;
+    if ( strtok(NULL, ":") )
+        usage();
+}
+
 static int parse_evtmask(char *arg)
 {
     /* search filtering class */
@@ -1093,12 +1362,16 @@ static void parse_args(int argc, char **argv)
         { "discard-buffers", no_argument,      0, 'D' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
+        { "network",        required_argument, 0, 'n' },
+        { "compress",       optional_argument, 0, 'z' },
+        { "sample",         required_argument, 0, 'p' },
+        { "domain",         required_argument, 0, 'd' },
         { "help",           no_argument,       0, '?' },
         { "version",        no_argument,       0, 'V' },
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:n:z::p:d:DxX?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -1147,11 +1420,38 @@ static void parse_args(int argc, char **argv)
             opts.memory_buffer = sargtol(optarg, 0);
             break;
 
+        case 'n': /* Stream to the network */
+            opts.network = optarg;
+            break;
+
+        case 'p': /* Sampling policy */
+            parse_sampling(optarg);
+            break;
+
+        case 'd': /* Domain filter */
+            opts.domid = argtol(optarg, 0);
+            opts.set_domain = 1;
+            break;
+
+        case 'z': /* Compress output */
+            opts.compress_level = optarg ? argtol(optarg, 0)
+                                         : DEFAULT_COMPRESS_LEVEL;
+            opts.compress = 1;
+            break;
+
         default:
             usage();
         }
     }
 
+    if ( opts.network )
+    {
+        /* No output file, and no disk to reserve space on. */
+        if ( optind != argc || opts.disk_rsvd )
+            usage();
+        return;
+    }
+
     /* get outfile (required last argument) */
     if (optind != (argc-1))
         usage();
@@ -1190,6 +1490,14 @@ int main(int argc, char **argv)
     if ( opts.evt_mask != 0 )
         set_evt_mask(opts.evt_mask);
 
+    if ( opts.set_domain &&
+         xc_tbuf_set_domain(xc_handle,
+                            opts.domid < 0 ? DOMID_INVALID : opts.domid) )
+    {
+        PERROR("Failure to set domain filter");
+        exit(EXIT_FAILURE);
+    }
+
     if ( opts.cpu_mask_str )
     {
         if ( parse_cpu_mask() )
@@ -1199,7 +1507,16 @@ int main(int argc, char **argv)
     if ( opts.timeout != 0 ) 
         alarm(opts.timeout);
 
-    if ( opts.outfile )
+    if ( opts.network )
+    {
+        outfd = open_network(opts.network);
+        if ( outfd < 0 )
+        {
+            perror("Could not connect to network destination");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if ( opts.outfile )
         outfd = open(opts.outfile,
                      O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
                      0644);
@@ -1210,6 +1527,9 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }        
 
+    if ( opts.compress && open_compression() )
+        exit(EXIT_FAILURE);
+
     if ( isatty(outfd) )
     {
         fprintf(stderr, "Cannot output to a TTY, specify a log file.\n");
@@ -1228,6 +1548,10 @@ int main(int argc, char **argv)
     sigaction(SIGINT,  &act, NULL);
     sigaction(SIGALRM, &act, NULL);
 
+    /* A closed pipe or connection is dealt with by write_full() instead. */
+    act.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &act, NULL);
+
     ret = monitor_tbufs();
 
     return ret;
@@ -413,6 +413,17 @@ int main(int argc, char **argv)
     }
     opterr = 0;
 
+    /*
+     * Plain listing commands are answered by "xl serve" if one is
+     * running; any global option means the caller wants this process
+     * to do the work itself.
+     */
+    if (optind == 1) {
+        ret = serve_forward(argc - optind, argv + optind);
+        if (ret >= 0)
+            exit(ret);
+    }
+
     if (progress_use_cr)
         xtl_flags |= XTL_STDIOSTREAM_PROGRESS_USE_CR;
     if (timestamps)
@@ -43,6 +43,8 @@ struct domain_create {
     const char *config_file;
     char *extra_config; /* extra config string */
     const char *restore_file;
+    const char *fork_parent; /* domain to fork instead of booting */
+    const char *fork_name; /* NULL: derived from the parent's */
     char *colo_proxy_script;
     bool userspace_colo_proxy;
     int migrate_fd; /* -1 means none */
@@ -129,6 +131,7 @@ int main_restore(int argc, char **argv);
 int main_migrate_receive(int argc, char **argv);
 int main_save(int argc, char **argv);
 int main_migrate(int argc, char **argv);
+int main_fork(int argc, char **argv);
 #endif
 int main_dump_core(int argc, char **argv);
 int main_pause(int argc, char **argv);
@@ -192,6 +195,7 @@ int main_cpupooldestroy(int argc, char **argv);
 int main_cpupoolrename(int argc, char **argv);
 int main_cpupoolcpuadd(int argc, char **argv);
 int main_cpupoolcpuremove(int argc, char **argv);
+int main_cpupoolcpumove(int argc, char **argv);
 int main_cpupoolmigrate(int argc, char **argv);
 int main_cpupoolnumasplit(int argc, char **argv);
 int main_getenforce(int argc, char **argv);
@@ -201,6 +205,7 @@ int main_loadpolicy(int argc, char **argv);
 int main_remus(int argc, char **argv);
 #endif
 int main_devd(int argc, char **argv);
+int main_serve(int argc, char **argv);
 #if defined(__i386__) || defined(__x86_64__)
 int main_psr_hwinfo(int argc, char **argv);
 int main_psr_cmt_attach(int argc, char **argv);
@@ -261,6 +266,10 @@ int child_report(xlchildnum child);
     /* waits and expects child to exit status 0.
      * otherwise, logs and returns ERROR_FAIL */
 
+int serve_forward(int argc, char **argv);
+    /* hands the command to a running "xl serve" if it can be served
+     * there; returns its exit status, or -1 if the caller must run it */
+
 /* global options */
 extern int autoballoon;
 extern int run_hotplug_scripts;
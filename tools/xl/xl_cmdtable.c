@@ -62,16 +62,17 @@ const struct cmd_spec cmd_table[] = {
     },
     { "destroy",
       &main_destroy, 0, 1,
-      "Terminate a domain immediately",
-      "[options] <Domain>\n",
+      "Terminate one or more domains immediately",
+      "[options] <Domain> [<Domain>...]\n",
       "-f                      Permit destroying domain 0, which will only succeed\n"
       "                        when run from disaggregated toolstack domain with a\n"
-      "                        hardware domain distinct from domain 0."
+      "                        hardware domain distinct from domain 0.\n"
+      "-j <N>                  Destroy up to N domains at once (default 4)."
     },
     { "shutdown",
       &main_shutdown, 0, 1,
-      "Issue a shutdown signal to a domain",
-      "[options] <-a|Domain>",
+      "Issue a shutdown signal to one or more domains",
+      "[options] <-a|Domain [Domain...]>",
       "-a, --all               Shutdown all guest domains.\n"
       "-h                      Print this help.\n"
       "-F                      Fallback to ACPI power event for HVM guests with\n"
@@ -80,8 +81,8 @@ const struct cmd_spec cmd_table[] = {
     },
     { "reboot",
       &main_reboot, 0, 1,
-      "Issue a reboot signal to a domain",
-      "[options] <-a|Domain>",
+      "Issue a reboot signal to one or more domains",
+      "[options] <-a|Domain [Domain...]>",
       "-a, --all               Shutdown all guest domains.\n"
       "-h                      Print this help.\n"
       "-F                      Fallback to ACPI reset event for HVM guests with\n"
@@ -163,8 +164,8 @@ const struct cmd_spec cmd_table[] = {
     },
     { "migrate",
       &main_migrate, 0, 1,
-      "Migrate a domain to another host",
-      "[options] <Domain> <host>",
+      "Migrate one or more domains to another host",
+      "[options] <Domain> [<Domain>...] <host>",
       "-h              Print this help.\n"
       "-C <config>     Send <config> instead of config file from creation.\n"
       "-s <sshcommand> Use <sshcommand> instead of ssh.  String will be passed\n"
@@ -173,8 +174,13 @@ const struct cmd_spec cmd_table[] = {
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
       "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--compress      Elide zero pages and compress memory sent.\n"
+      "--max-downtime <ms>\n"
+      "                Target downtime, throttling the domain if needed.\n"
       "-p              Do not unpause domain after migrating it.\n"
-      "-D              Preserve the domain id"
+      "-D              Preserve the domain id\n"
+      "-j <N>          Migrate up to N domains at once, largest first\n"
+      "                (default 2)."
     },
     { "restore",
       &main_restore, 0, 1,
@@ -187,6 +193,19 @@ const struct cmd_spec cmd_table[] = {
       "-V, --vncviewer          Connect to the VNC display after the domain is created.\n"
       "-A, --vncviewer-autopass Pass VNC password to viewer via stdin."
     },
+    { "fork",
+      &main_fork, 0, 1,
+      "Create a domain which carries on from where another one stopped",
+      "[options] <Domain>",
+      "-C <config>   Configuration of the new domain (default: that of\n"
+      "              <Domain>, with a new name, UUID and MAC addresses).\n"
+      "-n <name>     Name of the new domain.\n"
+      "-p            Leave the new domain paused.\n"
+      "-c            Connect to the console after the domain is created.\n"
+      "-e            Do not wait in the background for the death of the domain.\n"
+      "-F            Run in foreground until death of the domain.\n"
+      "-q            Quiet."
+    },
     { "migrate-receive",
       &main_migrate_receive, 0, 1,
       "Restore a domain from a saved state",
@@ -488,6 +507,12 @@ const struct cmd_spec cmd_table[] = {
       "Removes a CPU from a CPU pool",
       "<CPU Pool> <CPU nr>|node:<node nr>",
     },
+    { "cpupool-cpu-move",
+      &main_cpupoolcpumove, 0, 1,
+      "Moves CPUs to a CPU pool, from the free CPUs or another CPU pool",
+      "[-b <N>] <CPU Pool> <CPU nr>|node:<node nr>",
+      "-b N, --batch=N                Move at most N CPUs per operation"
+    },
     { "cpupool-migrate",
       &main_cpupoolmigrate, 0, 1,
       "Moves a domain into a CPU pool",
@@ -545,6 +570,13 @@ const struct cmd_spec cmd_table[] = {
       "-F                      Run in the foreground.\n"
       "-p, --pidfile [FILE]    Write PID to pidfile when daemonizing.",
     },
+    { "serve",
+      &main_serve, 0, 1,
+      "Daemon that answers xl list and xl vcpu-list from a cached context",
+      "[options]",
+      "-F                      Run in the foreground.\n"
+      "-p, --pidfile [FILE]    Write PID to pidfile when daemonizing.",
+    },
 #if defined(__i386__) || defined(__x86_64__)
     { "psr-hwinfo",
       &main_psr_hwinfo, 0, 1,
@@ -433,6 +433,93 @@ out:
     return rc;
 }
 
+static int cpupool_movecpus(uint32_t poolid, const char *pool,
+                            const libxl_bitmap *cpumap)
+{
+    if (libxl_cpupool_movecpus(ctx, poolid, cpumap)) {
+        fprintf(stderr, "some cpus may not have been moved to %s\n", pool);
+        fprintf(stderr, "The move can be retried, cpus already in '%s' are skipped.\n",
+                pool);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main_cpupoolcpumove(int argc, char **argv)
+{
+    int opt;
+    static struct option opts[] = {
+        {"batch", 1, 0, 'b'},
+        COMMON_LONG_OPTS
+    };
+    const char *pool;
+    uint32_t poolid;
+    libxl_bitmap cpumap, batch;
+    unsigned long batch_size = 0, n = 0;
+    char *endptr;
+    int cpu, rc = EXIT_FAILURE;
+
+    SWITCH_FOREACH_OPT(opt, "b:", opts, "cpupool-cpu-move", 2) {
+    case 'b':
+        batch_size = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || !batch_size) {
+            fprintf(stderr, "invalid batch size '%s'\n", optarg);
+            return EXIT_FAILURE;
+        }
+        break;
+    }
+
+    libxl_bitmap_init(&cpumap);
+    libxl_bitmap_init(&batch);
+    if (libxl_cpu_bitmap_alloc(ctx, &cpumap, 0) ||
+        libxl_cpu_bitmap_alloc(ctx, &batch, 0)) {
+        fprintf(stderr, "Unable to allocate cpumap");
+        goto out;
+    }
+
+    pool = argv[optind++];
+    if (parse_cpurange(argv[optind], &cpumap))
+        goto out;
+
+    if (libxl_cpupool_qualifier_to_cpupoolid(ctx, pool, &poolid, NULL) ||
+        !libxl_cpupoolid_is_valid(ctx, poolid)) {
+        fprintf(stderr, "unknown cpupool '%s'\n", pool);
+        goto out;
+    }
+
+    /*
+     * Without a batch size, move all the cpus in one operation.  Otherwise
+     * move them a batch at a time, so that the domains of the source cpupool
+     * only ever see the units of a few cpus being migrated at once.
+     */
+    if (!batch_size) {
+        if (cpupool_movecpus(poolid, pool, &cpumap))
+            goto out;
+    } else {
+        libxl_for_each_set_bit(cpu, cpumap) {
+            libxl_bitmap_set(&batch, cpu);
+            if (++n < batch_size)
+                continue;
+
+            if (cpupool_movecpus(poolid, pool, &batch))
+                goto out;
+            libxl_bitmap_set_none(&batch);
+            n = 0;
+        }
+
+        if (n && cpupool_movecpus(poolid, pool, &batch))
+            goto out;
+    }
+
+    rc = EXIT_SUCCESS;
+
+out:
+    libxl_bitmap_dispose(&batch);
+    libxl_bitmap_dispose(&cpumap);
+    return rc;
+}
+
 int main_cpupoolmigrate(int argc, char **argv)
 {
     int opt;
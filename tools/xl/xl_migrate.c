@@ -177,7 +177,8 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 }
 
 static void migrate_domain(uint32_t domid, int preserve_domid,
-                           const char *rune, int debug,
+                           const char *rune, int debug, int compress,
+                           unsigned int max_downtime_ms,
                            const char *override_config_file)
 {
     pid_t child = -1;
@@ -206,7 +207,10 @@ static void migrate_domain(uint32_t domid, int preserve_domid,
 
     if (debug)
         flags |= LIBXL_SUSPEND_DEBUG;
-    rc = libxl_domain_suspend(ctx, domid, send_fd, flags, NULL);
+    if (compress)
+        flags |= LIBXL_SUSPEND_COMPRESS;
+    rc = libxl_domain_suspend_max_downtime(ctx, domid, send_fd, flags,
+                                           max_downtime_ms, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
                 " (rc=%d)\n", rc);
@@ -530,22 +534,84 @@ int main_migrate_receive(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
-int main_migrate(int argc, char **argv)
+/*
+ * Several domains sharing the link each converge more slowly than one
+ * on its own, so only migrate a few at once by default.
+ */
+#define MIGRATE_DEFAULT_JOBS 2
+
+struct migrate_args {
+    int preserve_domid, debug, compress;
+    unsigned int max_downtime_ms;
+    const char *rune;
+};
+
+static void migrate_domain_fn(uint32_t domid, void *arg)
 {
+    struct migrate_args *ma = arg;
+
+    migrate_domain(domid, ma->preserve_domid, ma->rune, ma->debug,
+                   ma->compress, ma->max_downtime_ms, NULL);
+}
+
+struct domain_size {
     uint32_t domid;
+    uint64_t memkb;
+};
+
+static int domain_size_cmp(const void *a, const void *b)
+{
+    const struct domain_size *x = a, *y = b;
+
+    return x->memkb < y->memkb ? 1 : x->memkb > y->memkb ? -1 : 0;
+}
+
+/*
+ * Sorts domids largest first: whatever the number of jobs, starting the
+ * longest migrations first keeps the last ones from finishing alone.
+ */
+static void sort_domains_by_memory(uint32_t *domids, int nr)
+{
+    struct domain_size *sizes = xmalloc(sizeof(*sizes) * nr);
+    libxl_dominfo info;
+    int i;
+
+    libxl_dominfo_init(&info);
+    for (i = 0; i < nr; i++) {
+        sizes[i].domid = domids[i];
+        sizes[i].memkb = 0;
+        if (!libxl_domain_info(ctx, &info, domids[i]))
+            sizes[i].memkb = info.current_memkb;
+        libxl_dominfo_dispose(&info);
+    }
+
+    qsort(sizes, nr, sizeof(*sizes), domain_size_cmp);
+
+    for (i = 0; i < nr; i++)
+        domids[i] = sizes[i].domid;
+    free(sizes);
+}
+
+int main_migrate(int argc, char **argv)
+{
+    uint32_t domid, *domids;
     const char *config_filename = NULL;
     const char *ssh_command = "ssh";
     char *rune = NULL;
     char *host;
     int opt, daemonize = 1, monitor = 1, debug = 0, pause_after_migration = 0;
-    int preserve_domid = 0;
+    int preserve_domid = 0, compress = 0, jobs = MIGRATE_DEFAULT_JOBS, nr, rc;
+    unsigned int max_downtime_ms = 0;
+    struct migrate_args ma;
     static struct option opts[] = {
         {"debug", 0, 0, 0x100},
         {"live", 0, 0, 0x200},
+        {"compress", 0, 0, 0x300},
+        {"max-downtime", 1, 0, 0x400},
         COMMON_LONG_OPTS
     };
 
-    SWITCH_FOREACH_OPT(opt, "FC:s:epD", opts, "migrate", 2) {
+    SWITCH_FOREACH_OPT(opt, "FC:s:epDj:", opts, "migrate", 2) {
     case 'C':
         config_filename = optarg;
         break;
@@ -565,16 +631,29 @@ int main_migrate(int argc, char **argv)
     case 'D':
         preserve_domid = 1;
         break;
+    case 'j':
+        jobs = parse_jobs(optarg);
+        break;
     case 0x100: /* --debug */
         debug = 1;
         break;
     case 0x200: /* --live */
         /* ignored for compatibility with xm */
         break;
+    case 0x300: /* --compress */
+        compress = 1;
+        break;
+    case 0x400: /* --max-downtime */
+        max_downtime_ms = strtoul(optarg, NULL, 10);
+        break;
     }
 
-    domid = find_domain(argv[optind]);
-    host = argv[optind + 1];
+    nr = argc - optind - 1;
+    if (nr > 1 && config_filename) {
+        fprintf(stderr, "-C can only be used when migrating one domain.\n");
+        return EXIT_FAILURE;
+    }
+    host = argv[argc - 1];
 
     bool pass_tty_arg = progress_use_cr || (isatty(2) > 0);
 
@@ -602,8 +681,25 @@ int main_migrate(int argc, char **argv)
                   pause_after_migration ? " -p" : "");
     }
 
-    migrate_domain(domid, preserve_domid, rune, debug, config_filename);
-    return EXIT_SUCCESS;
+    if (nr == 1) {
+        domid = find_domain(argv[optind]);
+        migrate_domain(domid, preserve_domid, rune, debug, compress,
+                       max_downtime_ms, config_filename);
+        return EXIT_SUCCESS;
+    }
+
+    domids = find_domains(nr, argv + optind);
+    sort_domains_by_memory(domids, nr);
+
+    ma.preserve_domid = preserve_domid;
+    ma.debug = debug;
+    ma.compress = compress;
+    ma.max_downtime_ms = max_downtime_ms;
+    ma.rune = rune;
+    rc = run_for_domains(domids, nr, jobs, migrate_domain_fn, &ma);
+    free(domids);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main_remus(int argc, char **argv)
@@ -1666,6 +1666,22 @@ void parse_config_data(const char *config_source,
         }
     }
 
+    if (!xlu_cfg_get_string(config, "perf_class", &buf, 0) &&
+        libxl_perf_class_from_string(buf, &b_info->perf_class)) {
+        fprintf(stderr, "ERROR: invalid value \"%s\" for \"perf_class\"\n",
+                buf);
+        exit(1);
+    }
+
+    if (!xlu_cfg_get_long(config, "security_group", &l, 0)) {
+        if (l < 0 || l > UINT32_MAX) {
+            fprintf(stderr,
+                    "ERROR: invalid value %ld for \"security_group\"\n", l);
+            exit(1);
+        }
+        b_info->security_group = l;
+    }
+
     if (!xlu_cfg_get_long(config, "rtc_timeoffset", &l, 0))
         b_info->rtc_timeoffset = l;
 
@@ -1709,6 +1725,8 @@ void parse_config_data(const char *config_source,
         fprintf(stderr,"xl: Unable to parse bootloader_args.\n");
         exit(-ERROR_FAIL);
     }
+    xlu_cfg_get_defbool(config, "bootloader_cache", &b_info->bootloader_cache,
+                        0);
 
     if (!xlu_cfg_get_long(config, "timer_mode", &l, 1)) {
         const char *s = libxl_timer_mode_to_string(l);
@@ -1776,6 +1794,7 @@ void parse_config_data(const char *config_source,
                     "bios_path_override given without specific bios name\n");
 
         xlu_cfg_get_defbool(config, "pae", &b_info->u.hvm.pae, 0);
+        xlu_cfg_get_defbool(config, "fast_boot", &b_info->u.hvm.fast_boot, 0);
         xlu_cfg_get_defbool(config, "acpi_s3", &b_info->u.hvm.acpi_s3, 0);
         xlu_cfg_get_defbool(config, "acpi_s4", &b_info->u.hvm.acpi_s4, 0);
         xlu_cfg_get_defbool(config, "acpi_laptop_slate", &b_info->u.hvm.acpi_laptop_slate, 0);
@@ -2903,6 +2922,8 @@ skip_usbdev:
                     "If it fixes an issue you are having please report to "
                     "xen-devel@lists.xenproject.org.\n");
 
+    xlu_cfg_get_defbool(config, "ipi_virt", &b_info->arch_x86.ipi_virt, 0);
+
     xlu_cfg_get_defbool(config, "vpmu", &b_info->vpmu, 0);
 
     xlu_cfg_destroy(config);
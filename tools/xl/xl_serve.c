@@ -0,0 +1,397 @@
+/*
+ * Copyright 2009-2017 Citrix Ltd and other contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+
+/*
+ * "xl serve" keeps one libxl context open and runs read-only listing
+ * commands on behalf of other xl invocations, so that monitoring
+ * tools polling "xl list" do not pay for a fresh context, a fresh
+ * xenstore connection and a xenstore read per domain name each time.
+ *
+ * Protocol, over XL_SERVE_SOCKET:
+ *   client: argv[0] NUL argv[1] NUL ... then shuts down its write side
+ *   server: "<exit status> <stdout length> <stderr length>\n",
+ *           followed by the captured stdout and stderr
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <libxl.h>
+#include <libxl_utils.h>
+#include <libxlutil.h>
+
+#include "xl.h"
+#include "xl_utils.h"
+
+#define XL_SERVE_SOCKET XEN_RUN_DIR "/xl.sock"
+
+#define SERVE_MAX_REQUEST 4096
+#define SERVE_MAX_ARGS    64
+#define SERVE_TIMEOUT     10 /* seconds, client side */
+
+/*
+ * Only commands which neither modify anything nor exit() on bad
+ * input may be served: a domain name argument goes through
+ * find_domain(), which exits when the domain does not exist.
+ */
+static bool serve_allowed(int argc, char **argv)
+{
+    int i;
+
+    if (strcmp(argv[0], "list") && strcmp(argv[0], "vcpu-list"))
+        return false;
+
+    for (i = 1; i < argc; i++)
+        if (argv[i][0] != '-')
+            return false;
+
+    return true;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t r;
+
+    while (len) {
+        r = write(fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t r;
+
+    while (len) {
+        r = read(fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (!r) {
+            errno = EPROTO;
+            return -1;
+        }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+/* Copies the whole of file fd (from its start) to socket sfd. */
+static int copy_out(int fd, int sfd, size_t len)
+{
+    char buf[4096];
+    size_t n;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+
+    while (len) {
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        if (read_all(fd, buf, n)) return -1;
+        if (write_all(sfd, buf, n)) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+static int capture_file(void)
+{
+    FILE *f = tmpfile();
+    int fd;
+
+    if (!f) return -1;
+    fd = dup(fileno(f));
+    fclose(f);
+    return fd;
+}
+
+static void serve_one(int sfd)
+{
+    char req[SERVE_MAX_REQUEST + 1];
+    char *argv[SERVE_MAX_ARGS + 1];
+    char hdr[64];
+    int argc = 0, status, outfd = -1, errfd = -1, saved1 = -1, saved2 = -1;
+    size_t len = 0;
+    off_t outlen, errlen;
+    ssize_t r;
+    char *p;
+
+    while (len < SERVE_MAX_REQUEST) {
+        r = read(sfd, req + len, SERVE_MAX_REQUEST - len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            goto out;
+        }
+        if (!r) break;
+        len += r;
+    }
+    if (!len || len == SERVE_MAX_REQUEST || req[len - 1]) goto out;
+    req[len] = 0;
+
+    for (p = req; p < req + len; p += strlen(p) + 1) {
+        if (argc == SERVE_MAX_ARGS) goto out;
+        argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    if (!serve_allowed(argc, argv)) {
+        fprintf(stderr, "xl serve: refusing to run \"%s\"\n", argv[0]);
+        goto out;
+    }
+
+    outfd = capture_file();
+    errfd = capture_file();
+    if (outfd < 0 || errfd < 0) goto out;
+
+    fflush(stdout);
+    fflush(stderr);
+    saved1 = dup(1);
+    saved2 = dup(2);
+    if (saved1 < 0 || saved2 < 0) goto out;
+    dup2(outfd, 1);
+    dup2(errfd, 2);
+
+    optind = 1;
+    status = cmdtable_lookup(argv[0])->cmd_impl(argc, argv);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved1, 1);
+    dup2(saved2, 2);
+
+    outlen = lseek(outfd, 0, SEEK_END);
+    errlen = lseek(errfd, 0, SEEK_END);
+    if (outlen < 0 || errlen < 0) goto out;
+
+    snprintf(hdr, sizeof(hdr), "%d %lld %lld\n", status,
+             (long long)outlen, (long long)errlen);
+    if (write_all(sfd, hdr, strlen(hdr)) ||
+        copy_out(outfd, sfd, outlen) ||
+        copy_out(errfd, sfd, errlen))
+        fprintf(stderr, "xl serve: failed to send reply: %s\n",
+                strerror(errno));
+
+ out:
+    if (saved1 >= 0) close(saved1);
+    if (saved2 >= 0) close(saved2);
+    if (outfd >= 0) close(outfd);
+    if (errfd >= 0) close(errfd);
+    close(sfd);
+}
+
+static int serve_listen(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(XL_SERVE_SOCKET) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path %s too long\n", XL_SERVE_SOCKET);
+        return -1;
+    }
+    strcpy(addr.sun_path, XL_SERVE_SOCKET);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    unlink(XL_SERVE_SOCKET);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        chmod(XL_SERVE_SOCKET, 0600) ||
+        listen(fd, 16)) {
+        fprintf(stderr, "cannot listen on %s: %s\n", XL_SERVE_SOCKET,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int main_serve(int argc, char **argv)
+{
+    int opt = 0, daemonize = 1, lfd, nfds, nfds_alloc = 8, timeout, rc;
+    const char *pidfile = NULL;
+    struct pollfd *fds = NULL;
+    struct timeval now;
+    static const struct option opts[] = {
+        {"pidfile", 1, 0, 'p'},
+        COMMON_LONG_OPTS,
+        {0, 0, 0, 0}
+    };
+
+    SWITCH_FOREACH_OPT(opt, "Fp:", opts, "serve", 0) {
+    case 'F':
+        daemonize = 0;
+        break;
+    case 'p':
+        pidfile = optarg;
+        break;
+    }
+
+    if (daemonize) {
+        rc = do_daemonize("xlserve", pidfile);
+        if (rc)
+            return (rc == 1) ? 0 : rc;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    lfd = serve_listen();
+    if (lfd < 0)
+        return EXIT_FAILURE;
+
+    /* Cached names are kept current by the event loop below. */
+    libxl_ctx_enable_name_cache(ctx);
+
+    fds = xmalloc(sizeof(*fds) * nfds_alloc);
+
+    for (;;) {
+        timeout = -1;
+        nfds = nfds_alloc - 1;
+        gettimeofday(&now, NULL);
+        rc = libxl_osevent_beforepoll(ctx, &nfds, fds + 1, &timeout, now);
+        if (rc == ERROR_BUFFERFULL) {
+            nfds_alloc = nfds + 1;
+            fds = xrealloc(fds, sizeof(*fds) * nfds_alloc);
+            continue;
+        }
+        if (rc) {
+            fprintf(stderr, "libxl_osevent_beforepoll failed (%d)\n", rc);
+            break;
+        }
+
+        fds[0].fd = lfd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        if (poll(fds, nfds + 1, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        gettimeofday(&now, NULL);
+        libxl_osevent_afterpoll(ctx, nfds, fds + 1, now);
+
+        if (fds[0].revents & POLLIN) {
+            int sfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+            if (sfd >= 0)
+                serve_one(sfd);
+        }
+    }
+
+    free(fds);
+    close(lfd);
+    unlink(XL_SERVE_SOCKET);
+    return EXIT_FAILURE;
+}
+
+/*
+ * Client side: if the command can be served and a server is
+ * listening, hand it over.  Returns the command's exit status, or -1
+ * if the caller should run the command itself.
+ */
+int serve_forward(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct timeval tv = { .tv_sec = SERVE_TIMEOUT };
+    char hdr[64], buf[4096];
+    long long outlen, errlen, n;
+    int fd, i, status, ret = -1;
+    size_t len = 0;
+
+    if (!serve_allowed(argc, argv))
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(XL_SERVE_SOCKET) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, XL_SERVE_SOCKET);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        goto out;
+
+    for (i = 0; i < argc; i++)
+        if (write_all(fd, argv[i], strlen(argv[i]) + 1))
+            goto out;
+    shutdown(fd, SHUT_WR);
+
+    /* Nothing has been output yet, so any failure up to here falls back. */
+    while (len < sizeof(hdr) - 1) {
+        if (read_all(fd, hdr + len, 1))
+            goto out;
+        if (hdr[len++] == '\n')
+            break;
+    }
+    hdr[len] = 0;
+    if (sscanf(hdr, "%d %lld %lld\n", &status, &outlen, &errlen) != 3 ||
+        outlen < 0 || errlen < 0)
+        goto out;
+
+    for (i = 1; i <= 2; i++) {
+        for (n = i == 1 ? outlen : errlen; n; n -= len) {
+            len = n < sizeof(buf) ? n : sizeof(buf);
+            if (read_all(fd, buf, len) || write_all(i, buf, len)) {
+                /* Partial output is out, so we cannot retry. */
+                ret = EXIT_FAILURE;
+                goto out;
+            }
+        }
+    }
+    ret = status;
+
+ out:
+    close(fd);
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
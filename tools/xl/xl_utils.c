@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <libxl.h>
@@ -316,6 +317,79 @@ out:
     return ret;
 }
 
+uint32_t *find_domains(int nr, char **names)
+{
+    uint32_t *domids = xmalloc(sizeof(*domids) * nr);
+    int i;
+
+    for (i = 0; i < nr; i++)
+        domids[i] = find_domain(names[i]);
+
+    return domids;
+}
+
+int parse_jobs(const char *s)
+{
+    char *endptr;
+    long jobs = strtol(s, &endptr, 10);
+
+    if (*endptr || jobs < 1 || jobs > INT_MAX) {
+        fprintf(stderr, "invalid number of parallel jobs: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+    return jobs;
+}
+
+int run_for_domains(const uint32_t *domids, int nr, int jobs,
+                    void (*fn)(uint32_t domid, void *arg), void *arg)
+{
+    pid_t *pids = xcalloc(nr, sizeof(*pids));
+    int started = 0, running = 0, failed = 0, status, i;
+    char *what;
+    pid_t got;
+
+    while (started < nr || running) {
+        if (started < nr && running < jobs) {
+            flush_stream(stdout);
+            got = fork();
+            if (got == -1) {
+                perror("fork failed");
+                exit(EXIT_FAILURE);
+            }
+            if (!got) {
+                postfork();
+                fn(domids[started], arg);
+                exit(EXIT_SUCCESS);
+            }
+            pids[started++] = got;
+            running++;
+            continue;
+        }
+
+        got = waitpid(-1, &status, 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            perror("waitpid failed");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < started && pids[i] != got; i++)
+            ;
+        if (i == started)
+            continue;
+
+        running--;
+        if (status) {
+            xasprintf(&what, "child for domain %u", domids[i]);
+            libxl_report_child_exitstatus(ctx, XTL_ERROR, what, got, status);
+            free(what);
+            failed++;
+        }
+    }
+
+    free(pids);
+    return failed;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -144,6 +144,24 @@ uint32_t find_domain(const char *p) __attribute__((warn_unused_result));
 void print_bitmap(uint8_t *map, int maplen, FILE *stream);
 
 int do_daemonize(const char *name, const char *pidfile);
+
+/* Like find_domain, for each of names[0..nr-1]; the result is malloc'd. */
+uint32_t *find_domains(int nr, char **names);
+
+/* Parses the argument of a -j option; exits if it is not a positive number. */
+int parse_jobs(const char *s);
+
+/* Default for the -j option of commands acting on several domains. */
+#define XL_DEFAULT_JOBS 4
+
+/*
+ * Calls fn(domids[i], arg) for each domain, each in a child process of
+ * its own, with at most jobs of them running at a time, starting them in
+ * the order given.  fn may exit() to report failure.  Returns the number
+ * of domains for which the child did not exit with status 0.
+ */
+int run_for_domains(const uint32_t *domids, int nr, int jobs,
+                    void (*fn)(uint32_t domid, void *arg), void *arg);
 #endif /* XL_UTILS_H */
 
 /*
@@ -82,19 +82,37 @@ int main_unpause(int argc, char **argv)
     return EXIT_SUCCESS;
 }
 
+static void destroy_domain_fn(uint32_t domid, void *force)
+{
+    destroy_domain(domid, *(int *)force);
+}
+
 int main_destroy(int argc, char **argv)
 {
-    int opt;
-    int force = 0;
+    int opt, nr, rc;
+    int force = 0, jobs = XL_DEFAULT_JOBS;
+    uint32_t *domids;
 
-    SWITCH_FOREACH_OPT(opt, "f", NULL, "destroy", 1) {
+    SWITCH_FOREACH_OPT(opt, "fj:", NULL, "destroy", 1) {
     case 'f':
         force = 1;
         break;
+    case 'j':
+        jobs = parse_jobs(optarg);
+        break;
     }
 
-    destroy_domain(find_domain(argv[optind]), force);
-    return EXIT_SUCCESS;
+    nr = argc - optind;
+    if (nr == 1) {
+        destroy_domain(find_domain(argv[optind]), force);
+        return EXIT_SUCCESS;
+    }
+
+    domids = find_domains(nr, argv + optind);
+    rc = run_for_domains(domids, nr, jobs, destroy_domain_fn, &force);
+    free(domids);
+
+    return rc ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 static void reboot_domain(uint32_t domid, libxl_evgen_domain_death **deathw,
@@ -227,7 +245,7 @@ static int main_shutdown_or_reboot(int do_reboot, int argc, char **argv)
     }
 
     if (!argv[optind] && !all) {
-        fprintf(stderr, "You must specify -a or a domain id.\n\n");
+        fprintf(stderr, "You must specify -a or at least one domain.\n\n");
         return EXIT_FAILURE;
     }
 
@@ -257,13 +275,22 @@ static int main_shutdown_or_reboot(int do_reboot, int argc, char **argv)
 
         libxl_dominfo_list_free(dominfo, nb_domain);
     } else {
-        libxl_evgen_domain_death *deathw = NULL;
-        uint32_t domid = find_domain(argv[optind]);
+        libxl_evgen_domain_death **deathws;
+        uint32_t *domids;
 
-        fn(domid, wait_for_it ? &deathw : NULL, 0, fallback_trigger);
+        nb_domain = argc - optind;
+        domids = find_domains(nb_domain, argv + optind);
+        deathws = xcalloc(nb_domain, sizeof(*deathws));
+
+        for (i = 0; i < nb_domain; i++)
+            fn(domids[i], wait_for_it ? &deathws[i] : NULL, i,
+               fallback_trigger);
 
         if (wait_for_it)
-            wait_for_domain_deaths(&deathw, 1, wait_for_it == 1);
+            wait_for_domain_deaths(deathws, nb_domain, wait_for_it == 1);
+
+        free(deathws);
+        free(domids);
     }
 
 
@@ -649,6 +676,36 @@ static void autoconnect_console(libxl_ctx *ctx_ignored,
     _exit(1);
 }
 
+/*
+ * The child of a fork gets a name of its own (by default the parent's
+ * with the first free "-<n>" suffix), a new UUID and new MAC addresses.
+ */
+static void prepare_fork_config(libxl_domain_config *d_config,
+                                const char *name)
+{
+    char *new_name = NULL;
+    uint32_t ignored;
+    int i, n;
+
+    if (name) {
+        new_name = xstrdup(name);
+    } else {
+        for (n = 1; ; n++) {
+            free(new_name);
+            xasprintf(&new_name, "%s-%d", d_config->c_info.name, n);
+            if (libxl_name_to_domid(ctx, new_name, &ignored))
+                break;
+        }
+    }
+    free(d_config->c_info.name);
+    d_config->c_info.name = new_name;
+
+    d_config->c_info.domid = 0;
+    libxl_uuid_generate(&d_config->c_info.uuid);
+    for (i = 0; i < d_config->num_nics; i++)
+        memset(d_config->nics[i].mac, 0, sizeof(d_config->nics[i].mac));
+}
+
 int create_domain(struct domain_create *dom_info)
 {
     uint32_t domid = INVALID_DOMID;
@@ -685,9 +742,13 @@ int create_domain(struct domain_create *dom_info)
     uint32_t domid_soft_reset = INVALID_DOMID;
 
     int restoring = (restore_file || (migrate_fd >= 0));
+    uint32_t fork_domid = INVALID_DOMID;
 
     libxl_domain_config_init(&d_config);
 
+    if (dom_info->fork_parent)
+        fork_domid = find_domain(dom_info->fork_parent);
+
     if (restoring) {
         uint8_t *optdata_begin = 0;
         const uint8_t *optdata_here = 0;
@@ -771,7 +832,10 @@ int create_domain(struct domain_create *dom_info)
 
     }
 
-    if (config_file) {
+    if (fork_domid != INVALID_DOMID && !config_file) {
+        config_source = "<parent>";
+        config_in_json = false;
+    } else if (config_file) {
         free(config_data);  config_data = 0;
         /* /dev/null represents special case (read config. from command line) */
         if (!strcmp(config_file, "/dev/null")) {
@@ -808,13 +872,23 @@ int create_domain(struct domain_create *dom_info)
     if (!dom_info->quiet)
         fprintf(stderr, "Parsing config from %s\n", config_source);
 
-    if (config_in_json) {
+    if (fork_domid != INVALID_DOMID && !config_file) {
+        if (libxl_retrieve_domain_configuration(ctx, fork_domid, &d_config,
+                                                NULL)) {
+            fprintf(stderr, "unable to retrieve configuration of %s\n",
+                    dom_info->fork_parent);
+            return ERROR_FAIL;
+        }
+    } else if (config_in_json) {
         libxl_domain_config_from_json(ctx, &d_config,
                                       (const char *)config_data);
     } else {
         parse_config_data(config_source, config_data, config_len, &d_config);
     }
 
+    if (fork_domid != INVALID_DOMID)
+        prepare_fork_config(&d_config, dom_info->fork_name);
+
     if (!dom_info->ignore_global_affinity_masks) {
         libxl_domain_build_info *b_info = &d_config.b_info;
 
@@ -890,7 +964,8 @@ start:
             goto error_out;
     }
 
-    if (domid_soft_reset == INVALID_DOMID) {
+    /* A fork shares its parent's memory until it writes to it. */
+    if (domid_soft_reset == INVALID_DOMID && fork_domid == INVALID_DOMID) {
         if (!freemem(domid, &d_config)) {
             fprintf(stderr, "failed to free memory for the domain\n");
             ret = ERROR_FAIL;
@@ -938,6 +1013,12 @@ start:
          * restore/migrate-receive it again.
          */
         restoring = 0;
+    } else if (fork_domid != INVALID_DOMID) {
+        ret = libxl_domain_fork(ctx, &d_config, fork_domid, &domid,
+                                0, autoconnect_console_how);
+
+        /* On reboot the fork boots like any other domain. */
+        fork_domid = INVALID_DOMID;
     } else if (domid_soft_reset != INVALID_DOMID) {
         /* Do soft reset. */
         ret = libxl_domain_soft_reset(ctx, &d_config, domid_soft_reset,
@@ -1167,6 +1248,77 @@ out:
     return ret;
 }
 
+#ifndef LIBXL_HAVE_NO_SUSPEND_RESUME
+int main_fork(int argc, char **argv)
+{
+    struct domain_create dom_info = {
+        .daemonize = 1,
+        .monitor = 1,
+        .migrate_fd = -1,
+        .send_back_fd = -1,
+    };
+    libxl_dominfo info;
+    uint32_t parent;
+    int opt, rc;
+
+    SWITCH_FOREACH_OPT(opt, "FeC:n:pcq", NULL, "fork", 1) {
+    case 'F':
+        dom_info.daemonize = 0;
+        break;
+    case 'e':
+        dom_info.daemonize = 0;
+        dom_info.monitor = 0;
+        break;
+    case 'C':
+        dom_info.config_file = optarg;
+        break;
+    case 'n':
+        dom_info.fork_name = optarg;
+        break;
+    case 'p':
+        dom_info.paused = 1;
+        break;
+    case 'c':
+        dom_info.console_autoconnect = 1;
+        break;
+    case 'q':
+        dom_info.quiet = 1;
+        break;
+    }
+
+    dom_info.fork_parent = argv[optind];
+    parent = find_domain(dom_info.fork_parent);
+
+    /* The parent serves as a template: it must sit suspended. */
+    libxl_dominfo_init(&info);
+    rc = libxl_domain_info(ctx, &info, parent);
+    if (rc) {
+        fprintf(stderr, "unable to get information about %s\n",
+                dom_info.fork_parent);
+        return EXIT_FAILURE;
+    }
+    if (!info.shutdown ||
+        info.shutdown_reason != LIBXL_SHUTDOWN_REASON_SUSPEND) {
+        if (!dom_info.quiet)
+            fprintf(stderr, "Suspending %s to fork it\n",
+                    dom_info.fork_parent);
+        rc = libxl_domain_suspend_only(ctx, parent, NULL);
+        if (rc) {
+            fprintf(stderr, "failed to suspend %s\n", dom_info.fork_parent);
+            libxl_dominfo_dispose(&info);
+            return EXIT_FAILURE;
+        }
+    }
+    libxl_dominfo_dispose(&info);
+
+    rc = create_domain(&dom_info);
+    if (rc < 0)
+        return -rc;
+
+    return 0;
+}
+#endif
+
 int main_create(int argc, char **argv)
 {
     struct domain_create dom_info = {
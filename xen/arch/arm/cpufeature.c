@@ -20,6 +20,11 @@ static bool has_sb_instruction(const struct arm_cpu_capabilities *entry)
 {
     return system_cpuinfo.isa64.sb;
 }
+
+static bool has_tlb_range(const struct arm_cpu_capabilities *entry)
+{
+    return system_cpuinfo.isa64.tlb >= 2;
+}
 #endif
 
 static const struct arm_cpu_capabilities arm_features[] = {
@@ -29,6 +34,11 @@ static const struct arm_cpu_capabilities arm_features[] = {
         .capability = ARM_HAS_SB,
         .matches = has_sb_instruction,
     },
+    {
+        .desc = "Range TLB invalidation (FEAT_TLBIRANGE)",
+        .capability = ARM_HAS_TLB_RANGE,
+        .matches = has_tlb_range,
+    },
 #endif
     {},
 };
@@ -4,10 +4,13 @@
 #include <xen/grant_table.h>
 #include <xen/guest_access.h>
 #include <xen/hypercall.h>
+#include <xen/hypfs.h>
 #include <xen/init.h>
 #include <xen/ioreq.h>
+#include <xen/keyhandler.h>
 #include <xen/lib.h>
 #include <xen/livepatch.h>
+#include <xen/param.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/wait.h>
@@ -25,6 +28,7 @@
 #include <asm/procinfo.h>
 #include <asm/regs.h>
 #include <asm/tee/tee.h>
+#include <asm/time.h>
 #include <asm/vfp.h>
 #include <asm/vgic.h>
 #include <asm/vtimer.h>
@@ -82,15 +86,239 @@ static void noreturn idle_loop(void)
     }
 }
 
+/*
+ * Context switch profiling. When enabled, the time spent in each part of
+ * ctxt_switch_from() and ctxt_switch_to() is accumulated per pCPU, in
+ * ticks of the generic timer counter. Each ctxt_prof_mark() charges the
+ * time since the previous one to the given component.
+ */
+enum ctxt_prof_part {
+    CTXT_PROF_SYSREGS,
+    CTXT_PROF_P2M,
+    CTXT_PROF_VTIMER,
+    CTXT_PROF_VFP,
+    CTXT_PROF_GIC,
+    CTXT_PROF_NR
+};
+
+static const char *const ctxt_prof_names[CTXT_PROF_NR] = {
+    [CTXT_PROF_SYSREGS] = "sysregs",
+    [CTXT_PROF_P2M]     = "p2m",
+    [CTXT_PROF_VTIMER]  = "vtimer",
+    [CTXT_PROF_VFP]     = "vfp",
+    [CTXT_PROF_GIC]     = "gic",
+};
+
+/* Index 0 is for saving (ctxt_switch_from()), 1 for restoring. */
+struct ctxt_prof {
+    uint64_t count[2];
+    uint64_t ticks[2][CTXT_PROF_NR];
+};
+
+static DEFINE_PER_CPU(struct ctxt_prof, ctxt_prof);
+
+static bool __read_mostly opt_ctxt_prof;
+boolean_param("ctxt-switch-profile", opt_ctxt_prof);
+
+static uint64_t ctxt_prof_start(unsigned int dir)
+{
+    if ( likely(!opt_ctxt_prof) )
+        return 0;
+
+    this_cpu(ctxt_prof).count[dir]++;
+
+    return get_cycles();
+}
+
+static void ctxt_prof_mark(uint64_t *stamp, unsigned int dir,
+                           enum ctxt_prof_part part)
+{
+    uint64_t now;
+
+    /* Also skip if profiling got enabled half way through a switch. */
+    if ( likely(!opt_ctxt_prof) || !*stamp )
+        return;
+
+    now = get_cycles();
+    this_cpu(ctxt_prof).ticks[dir][part] += now - *stamp;
+    *stamp = now;
+}
+
+/* Average cost of each part in ns, over all the online CPUs. */
+static void ctxt_prof_sum(uint64_t count[2], uint64_t ns[2][CTXT_PROF_NR])
+{
+    unsigned int cpu, dir, i;
+
+    memset(ns, 0, sizeof(uint64_t[2][CTXT_PROF_NR]));
+    count[0] = count[1] = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct ctxt_prof *prof = &per_cpu(ctxt_prof, cpu);
+
+        for ( dir = 0; dir < 2; dir++ )
+        {
+            count[dir] += prof->count[dir];
+            for ( i = 0; i < CTXT_PROF_NR; i++ )
+                ns[dir][i] += prof->ticks[dir][i];
+        }
+    }
+
+    for ( dir = 0; dir < 2; dir++ )
+        for ( i = 0; i < CTXT_PROF_NR; i++ )
+            ns[dir][i] = count[dir] ? ticks_to_ns(ns[dir][i]) / count[dir] : 0;
+}
+
+static void cf_check ctxt_prof_dump(unsigned char key)
+{
+    uint64_t count[2], ns[2][CTXT_PROF_NR];
+    unsigned int i;
+
+    if ( !opt_ctxt_prof )
+    {
+        printk("Context switch profiling is disabled\n");
+        return;
+    }
+
+    ctxt_prof_sum(count, ns);
+
+    printk("Context switch profile: %"PRIu64" saves, %"PRIu64" restores\n",
+           count[0], count[1]);
+    printk("%-8s %10s %10s\n", "part", "save ns", "restore ns");
+    for ( i = 0; i < CTXT_PROF_NR; i++ )
+        printk("%-8s %10"PRIu64" %10"PRIu64"\n",
+               ctxt_prof_names[i], ns[0][i], ns[1][i]);
+}
+
+static int __init cf_check ctxt_prof_key_init(void)
+{
+    register_keyhandler('X', ctxt_prof_dump,
+                        "dump context switch profile", 1);
+    return 0;
+}
+__initcall(ctxt_prof_key_init);
+
+#ifdef CONFIG_HYPFS
+/* "<part> <save ns> <restore ns>\n" per part, plus a line of counts. */
+#define CTXT_PROF_STRLEN ((CTXT_PROF_NR + 1) * 64)
+
+struct ctxt_prof_str {
+    char buf[CTXT_PROF_STRLEN];
+};
+
+/* Snapshot taken when entering the node, so getsize() and read() agree. */
+static DEFINE_PER_CPU(char *, ctxt_prof_str);
+
+static unsigned int ctxt_prof_format(char *buf)
+{
+    uint64_t count[2], ns[2][CTXT_PROF_NR];
+    unsigned int i, len;
+
+    ctxt_prof_sum(count, ns);
+
+    len = snprintf(buf, CTXT_PROF_STRLEN, "count %"PRIu64" %"PRIu64"\n",
+                   count[0], count[1]);
+    for ( i = 0; i < CTXT_PROF_NR; i++ )
+        len += snprintf(buf + len, CTXT_PROF_STRLEN - len,
+                        "%s %"PRIu64" %"PRIu64"\n",
+                        ctxt_prof_names[i], ns[0][i], ns[1][i]);
+
+    return len + 1;
+}
+
+static const struct hypfs_entry *cf_check ctxt_prof_enter(
+    const struct hypfs_entry *entry)
+{
+    struct ctxt_prof_str *str = hypfs_alloc_dyndata(struct ctxt_prof_str);
+
+    if ( !str )
+        return ERR_PTR(-ENOMEM);
+
+    ctxt_prof_format(str->buf);
+    this_cpu(ctxt_prof_str) = str->buf;
+
+    return entry;
+}
+
+static void cf_check ctxt_prof_exit(const struct hypfs_entry *entry)
+{
+    this_cpu(ctxt_prof_str) = NULL;
+    hypfs_free_dyndata();
+}
+
+static int cf_check ctxt_prof_read(
+    const struct hypfs_entry *entry, XEN_GUEST_HANDLE_PARAM(void) uaddr)
+{
+    const char *buf = this_cpu(ctxt_prof_str);
+
+    ASSERT(buf);
+
+    return copy_to_guest(uaddr, buf, strlen(buf) + 1) ? -EFAULT : 0;
+}
+
+static unsigned int cf_check ctxt_prof_getsize(
+    const struct hypfs_entry *entry)
+{
+    const char *str = this_cpu(ctxt_prof_str);
+    unsigned int size;
+    char *buf;
+
+    if ( str )
+        return strlen(str) + 1;
+
+    /* Listing the parent directory: the node hasn't been entered. */
+    buf = xmalloc_array(char, CTXT_PROF_STRLEN);
+    if ( !buf )
+        return 0;
+    size = ctxt_prof_format(buf);
+    xfree(buf);
+
+    return size;
+}
+
+static const struct hypfs_funcs ctxt_prof_funcs = {
+    .enter = ctxt_prof_enter,
+    .exit = ctxt_prof_exit,
+    .read = ctxt_prof_read,
+    .write = hypfs_write_deny,
+    .getsize = ctxt_prof_getsize,
+    .findentry = hypfs_leaf_findentry,
+};
+
+static HYPFS_DIR_INIT(ctxt_prof_dir, "ctxt-switch");
+static HYPFS_BOOL_INIT_WRITABLE(ctxt_prof_enabled, "profile", opt_ctxt_prof);
+static struct hypfs_entry_leaf ctxt_prof_leaf = {
+    .e.type = XEN_HYPFS_TYPE_STRING,
+    .e.encoding = XEN_HYPFS_ENC_PLAIN,
+    .e.name = "costs",
+    .e.funcs = &ctxt_prof_funcs,
+};
+
+static int __init cf_check ctxt_prof_hypfs_init(void)
+{
+    hypfs_add_dir(&hypfs_root, &ctxt_prof_dir, true);
+    hypfs_add_leaf(&ctxt_prof_dir, &ctxt_prof_enabled, true);
+    hypfs_add_leaf(&ctxt_prof_dir, &ctxt_prof_leaf, true);
+
+    return 0;
+}
+__initcall(ctxt_prof_hypfs_init);
+#endif /* CONFIG_HYPFS */
+
 static void ctxt_switch_from(struct vcpu *p)
 {
+    uint64_t stamp;
+
     /* When the idle VCPU is running, Xen will always stay in hypervisor
      * mode. Therefore we don't need to save the context of an idle VCPU.
      */
     if ( is_idle_vcpu(p) )
         return;
 
+    stamp = ctxt_prof_start(0);
+
     p2m_save_state(p);
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_P2M);
 
     /* CP 15 */
     p->arch.csselr = READ_SYSREG(CSSELR_EL1);
@@ -103,9 +331,12 @@ static void ctxt_switch_from(struct vcpu *p)
     p->arch.tpidrro_el0 = READ_SYSREG(TPIDRRO_EL0);
     p->arch.tpidr_el1 = READ_SYSREG(TPIDR_EL1);
 
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_SYSREGS);
+
     /* Arch timer */
     p->arch.cntkctl = READ_SYSREG(CNTKCTL_EL1);
     virt_timer_save(p);
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_VTIMER);
 
     if ( is_32bit_domain(p->domain) && cpu_has_thumbee )
     {
@@ -155,18 +386,23 @@ static void ctxt_switch_from(struct vcpu *p)
 
     /* XXX MPU */
 
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_SYSREGS);
+
     /* VFP */
     vfp_save_state(p);
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_VFP);
 
     /* VGIC */
     gic_save_state(p);
 
     isb();
+    ctxt_prof_mark(&stamp, 0, CTXT_PROF_GIC);
 }
 
 static void ctxt_switch_to(struct vcpu *n)
 {
     register_t vpidr;
+    uint64_t stamp;
 
     /* When the idle VCPU is running, Xen will always stay in hypervisor
      * mode. Therefore we don't need to restore the context of an idle VCPU.
@@ -174,15 +410,20 @@ static void ctxt_switch_to(struct vcpu *n)
     if ( is_idle_vcpu(n) )
         return;
 
+    stamp = ctxt_prof_start(1);
+
     vpidr = READ_SYSREG(MIDR_EL1);
     WRITE_SYSREG(vpidr, VPIDR_EL2);
     WRITE_SYSREG(n->arch.vmpidr, VMPIDR_EL2);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_SYSREGS);
 
     /* VGIC */
     gic_restore_state(n);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_GIC);
 
     /* VFP */
     vfp_restore_state(n);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_VFP);
 
     /* XXX MPU */
 
@@ -226,12 +467,14 @@ static void ctxt_switch_to(struct vcpu *n)
     WRITE_SYSREG64(n->arch.amair, AMAIR_EL1);
 #endif
     isb();
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_SYSREGS);
 
     /*
      * ARM64_WORKAROUND_AT_SPECULATE: The P2M should be restored after
      * the stage-1 MMU sysregs have been restored.
      */
     p2m_restore_state(n);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_P2M);
 
     /* Control Registers */
     WRITE_SYSREG(n->arch.cpacr, CPACR_EL1);
@@ -262,13 +505,16 @@ static void ctxt_switch_to(struct vcpu *n)
     WRITE_SYSREG(n->arch.csselr, CSSELR_EL1);
 
     isb();
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_SYSREGS);
 
     /* This is could trigger an hardware interrupt from the virtual
      * timer. The interrupt needs to be injected into the guest. */
     WRITE_SYSREG(n->arch.cntkctl, CNTKCTL_EL1);
     virt_timer_restore(n);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_VTIMER);
 
     WRITE_SYSREG(n->arch.mdcr_el2, MDCR_EL2);
+    ctxt_prof_mark(&stamp, 1, CTXT_PROF_SYSREGS);
 }
 
 static void schedule_tail(struct vcpu *prev)
@@ -505,7 +751,8 @@ struct vcpu *alloc_vcpu_struct(const struct domain *d)
     struct vcpu *v;
 
     BUILD_BUG_ON(sizeof(*v) > MAX_PAGES_PER_VCPU * PAGE_SIZE);
-    v = alloc_xenheap_pages(get_order_from_bytes(sizeof(*v)), 0);
+    v = alloc_xenheap_pages(get_order_from_bytes(sizeof(*v)),
+                            MEMF_node(domain_alloc_node(d)));
     if ( v != NULL )
     {
         unsigned int i;
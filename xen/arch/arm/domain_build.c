@@ -7,6 +7,8 @@
 #include <xen/domain_page.h>
 #include <xen/sched.h>
 #include <xen/sizes.h>
+#include <xen/softirq.h>
+#include <xen/tasklet.h>
 #include <asm/irq.h>
 #include <asm/regs.h>
 #include <xen/errno.h>
@@ -46,6 +48,10 @@ integer_param("dom0_max_vcpus", opt_dom0_max_vcpus);
 static bool __initdata opt_ext_regions = true;
 boolean_param("ext_regions", opt_ext_regions);
 
+/* If true, dom0less domUs are constructed on all the online CPUs. */
+static bool __initdata opt_dom0less_parallel = true;
+boolean_param("dom0less-parallel", opt_dom0less_parallel);
+
 static u64 __initdata dom0_mem;
 static bool __initdata dom0_mem_set;
 
@@ -499,6 +505,48 @@ fail:
 }
 
 #ifdef CONFIG_STATIC_MEMORY
+/*
+ * Static memory is often given to real-time guests, for which the number
+ * of stage-2 TLB entries matters. Warn when the placement of a range
+ * prevents the use of block mappings, and report what was achieved.
+ */
+static void __init check_static_memory_mappings(struct domain *d,
+                                                gfn_t sgfn, mfn_t smfn,
+                                                unsigned long nr)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long count[3] = { 0 }, i;
+    unsigned long diff = gfn_x(sgfn) ^ mfn_x(smfn);
+    unsigned int order;
+
+    if ( nr >= (1UL << SECOND_ORDER) && (diff & ((1UL << SECOND_ORDER) - 1)) )
+        printk(XENLOG_WARNING
+               "%pd: static memory %#"PRIpaddr" mapped at %#"PRIpaddr": addresses differ modulo 2MB, no block mappings possible\n",
+               d, mfn_to_maddr(smfn), gfn_to_gaddr(sgfn));
+    else if ( nr >= (1UL << FIRST_ORDER) &&
+              (diff & ((1UL << FIRST_ORDER) - 1)) )
+        printk(XENLOG_WARNING
+               "%pd: static memory %#"PRIpaddr" mapped at %#"PRIpaddr": addresses differ modulo 1GB, no 1GB mappings possible\n",
+               d, mfn_to_maddr(smfn), gfn_to_gaddr(sgfn));
+
+    p2m_read_lock(p2m);
+    for ( i = 0; i < nr; i += 1UL << order )
+    {
+        mfn_t mfn = p2m_get_entry(p2m, gfn_add(sgfn, i), NULL, NULL,
+                                  &order, NULL);
+
+        /* p2m_set_entry() never lets a block cross the start of the range. */
+        ASSERT(mfn_eq(mfn, mfn_add(smfn, i)));
+        count[order == FIRST_ORDER ? 0 : order == SECOND_ORDER ? 1 : 2]++;
+    }
+    p2m_read_unlock(p2m);
+
+    printk(XENLOG_INFO
+           "%pd: static memory at guest %#"PRIpaddr"-%#"PRIpaddr": %lu 1GB, %lu 2MB, %lu 4KB mappings\n",
+           d, gfn_to_gaddr(sgfn), gfn_to_gaddr(gfn_add(sgfn, nr)),
+           count[0], count[1], count[2]);
+}
+
 static bool __init append_static_memory_to_bank(struct domain *d,
                                                 struct membank *bank,
                                                 mfn_t smfn,
@@ -525,6 +573,8 @@ static bool __init append_static_memory_to_bank(struct domain *d,
         return false;
     }
 
+    check_static_memory_mappings(d, sgfn, smfn, nr_pages);
+
     bank->size = bank->size + size;
 
     return true;
@@ -3869,13 +3919,138 @@ static int __init construct_domU(struct domain *d,
     return rc;
 }
 
+struct domU_build {
+    struct domain *d;
+    const struct dt_device_node *node;
+    int rc;
+    unsigned int cpu;
+    s_time_t time;
+};
+
+static struct domU_build *__initdata domU_builds;
+static unsigned int __initdata nr_domU_builds;
+static atomic_t __initdata domU_build_next;
+static atomic_t __initdata domU_build_done;
+
+/*
+ * Construct domUs until none is left. This runs on the boot CPU and, from
+ * a tasklet, on each other online CPU, so that the domUs (and in particular
+ * the copies of their kernels and ramdisks) get built in parallel.
+ */
+static void __init build_domUs(void *unused)
+{
+    unsigned int i;
+
+    while ( (i = atomic_inc_return(&domU_build_next) - 1) < nr_domU_builds )
+    {
+        struct domU_build *b = &domU_builds[i];
+        s_time_t start = NOW();
+
+        b->rc = construct_domU(b->d, b->node);
+        b->time = NOW() - start;
+        b->cpu = smp_processor_id();
+
+        smp_wmb();
+        atomic_inc(&domU_build_done);
+    }
+}
+
+/*
+ * Static shared memory is set up by the owner for the borrowers to map it,
+ * which needs the domUs to be built in order.
+ */
+static bool __init domUs_may_build_in_parallel(void)
+{
+    unsigned int i;
+
+    if ( !opt_dom0less_parallel || nr_domU_builds < 2 ||
+         num_online_cpus() < 2 )
+        return false;
+
+    for ( i = 0; i < nr_domU_builds; i++ )
+        if ( dt_find_compatible_node(domU_builds[i].node, NULL,
+                                     "xen,domain-shared-memory-v1") )
+            return false;
+
+    return true;
+}
+
+static void __init construct_domUs(void)
+{
+    struct tasklet *tasklets = NULL;
+    s_time_t start = NOW();
+    unsigned int i, cpu;
+
+    atomic_set(&domU_build_next, 0);
+    atomic_set(&domU_build_done, 0);
+
+    if ( domUs_may_build_in_parallel() )
+        tasklets = xzalloc_array(struct tasklet, nr_cpu_ids);
+
+    if ( tasklets )
+    {
+        for_each_online_cpu ( cpu )
+        {
+            if ( cpu == smp_processor_id() )
+                continue;
+            tasklet_init(&tasklets[cpu], build_domUs, NULL);
+            tasklet_schedule_on_cpu(&tasklets[cpu], cpu);
+        }
+    }
+
+    build_domUs(NULL);
+
+    while ( atomic_read(&domU_build_done) < nr_domU_builds )
+    {
+        cpu_relax();
+        process_pending_softirqs();
+    }
+    smp_rmb();
+
+    if ( tasklets )
+    {
+        for_each_online_cpu ( cpu )
+            if ( cpu != smp_processor_id() )
+                tasklet_kill(&tasklets[cpu]);
+        xfree(tasklets);
+    }
+
+    for ( i = 0; i < nr_domU_builds; i++ )
+    {
+        const struct domU_build *b = &domU_builds[i];
+
+        if ( b->rc )
+            panic("Could not set up domain %s (rc = %d)\n",
+                  dt_node_name(b->node), b->rc);
+
+        printk(XENLOG_INFO "%pd: built in %"PRI_stime"ms on CPU%u\n",
+               b->d, b->time / MILLISECS(1), b->cpu);
+    }
+
+    printk(XENLOG_INFO "Built %u domUs in %"PRI_stime"ms\n",
+           nr_domU_builds, (NOW() - start) / MILLISECS(1));
+}
+
 void __init create_domUs(void)
 {
     struct dt_device_node *node;
     const struct dt_device_node *cpupool_node,
                                 *chosen = dt_find_node_by_path("/chosen");
+    unsigned int nr = 0;
 
     BUG_ON(chosen == NULL);
+
+    dt_for_each_child_node(chosen, node)
+        if ( dt_device_is_compatible(node, "xen,domain") )
+            nr++;
+
+    if ( !nr )
+        return;
+
+    domU_builds = xzalloc_array(struct domU_build, nr);
+    if ( !domU_builds )
+        panic("Unable to allocate the domU build table\n");
+
     dt_for_each_child_node(chosen, node)
     {
         struct domain *d;
@@ -3895,7 +4070,6 @@ void __init create_domUs(void)
         };
         unsigned int flags = 0U;
         uint32_t val;
-        int rc;
 
         if ( !dt_device_is_compatible(node, "xen,domain") )
             continue;
@@ -3997,11 +4171,15 @@ void __init create_domUs(void)
         d->is_console = true;
         dt_device_set_used_by(node, d->domain_id);
 
-        rc = construct_domU(d, node);
-        if ( rc )
-            panic("Could not set up domain %s (rc = %d)\n",
-                  dt_node_name(node), rc);
+        domU_builds[nr_domU_builds].d = d;
+        domU_builds[nr_domU_builds].node = node;
+        nr_domU_builds++;
     }
+
+    construct_domUs();
+
+    xfree(domU_builds);
+    domU_builds = NULL;
 }
 
 static int __init construct_dom0(struct domain *d)
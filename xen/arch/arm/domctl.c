@@ -48,6 +48,12 @@ static int handle_vuart_init(struct domain *d,
     return rc;
 }
 
+bool arch_do_domctl_unlocked(struct xen_domctl *domctl, struct domain *d,
+                             long *ret)
+{
+    return false;
+}
+
 long arch_do_domctl(struct xen_domctl *domctl, struct domain *d,
                     XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
 {
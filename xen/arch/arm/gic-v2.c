@@ -165,15 +165,21 @@ static unsigned int gicv2_cpu_mask(const cpumask_t *cpumask)
     return mask;
 }
 
+/*
+ * Only the LRs in v->arch.lr_mask hold anything, the others are either
+ * clear or hold an already handled interrupt. gic_restore_state() takes
+ * care of clearing those the next vCPU doesn't use.
+ */
 static void gicv2_save_state(struct vcpu *v)
 {
-    int i;
+    unsigned int i;
 
     /* No need for spinlocks here because interrupts are disabled around
      * this call and it only accesses struct vcpu fields that cannot be
      * accessed simultaneously by another pCPU.
      */
-    for ( i = 0; i < gicv2_info.nr_lrs; i++ )
+    for_each_set_bit(i, (const unsigned long *)&v->arch.lr_mask,
+                     gicv2_info.nr_lrs)
         v->arch.gic.v2.lr[i] = readl_gich(GICH_LR + i * 4);
 
     v->arch.gic.v2.apr = readl_gich(GICH_APR);
@@ -184,9 +190,10 @@ static void gicv2_save_state(struct vcpu *v)
 
 static void gicv2_restore_state(const struct vcpu *v)
 {
-    int i;
+    unsigned int i;
 
-    for ( i = 0; i < gicv2_info.nr_lrs; i++ )
+    for_each_set_bit(i, (const unsigned long *)&v->arch.lr_mask,
+                     gicv2_info.nr_lrs)
         writel_gich(v->arch.gic.v2.lr[i], GICH_LR + i * 4);
 
     writel_gich(v->arch.gic.v2.apr, GICH_APR);
@@ -505,6 +512,16 @@ static void gicv2_clear_lr(int lr)
     writel_gich(0, GICH_LR + lr * 4);
 }
 
+static uint64_t gicv2_read_elrsr(void)
+{
+    uint64_t elrsr = readl_gich(GICH_ELSR0);
+
+    if ( gicv2_info.nr_lrs > 32 )
+        elrsr |= (uint64_t)readl_gich(GICH_ELSR1) << 32;
+
+    return elrsr;
+}
+
 static void gicv2_read_lr(int lr, struct gic_lr *lr_reg)
 {
     uint32_t lrv;
@@ -1333,6 +1350,7 @@ const static struct gic_hw_operations gicv2_ops = {
     .update_lr           = gicv2_update_lr,
     .update_hcr_status   = gicv2_hcr_status,
     .clear_lr            = gicv2_clear_lr,
+    .read_elrsr          = gicv2_read_elrsr,
     .read_lr             = gicv2_read_lr,
     .write_lr            = gicv2_write_lr,
     .read_vmcr_priority  = gicv2_read_vmcr_priority,
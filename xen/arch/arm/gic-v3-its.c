@@ -48,6 +48,9 @@ struct its_device {
     uint32_t eventids;                  /* Number of event IDs (MSIs) */
     uint32_t *host_lpi_blocks;          /* Which LPIs are used on the host */
     struct pending_irq *pend_irqs;      /* One struct per event */
+#ifdef CONFIG_GICV4
+    unsigned long *vlpi_events;         /* Events translated to vLPIs */
+#endif
 };
 
 bool gicv3_its_host_has_its(void)
@@ -56,7 +59,12 @@ bool gicv3_its_host_has_its(void)
 }
 
 #define BUFPTR_MASK                     GENMASK(19, 5)
-static int its_send_command(struct host_its *hw_its, const void *its_cmd)
+/*
+ * Copy a number of commands into the command queue and hand them over to
+ * the ITS with a single update of GITS_CWRITER.
+ */
+static int its_send_commands(struct host_its *hw_its, const void *its_cmds,
+                             unsigned int nr)
 {
     /*
      * The command queue should actually never become full, if it does anyway
@@ -65,16 +73,18 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
      * So to cover the one-off case where we actually hit a full command
      * queue, we introduce a small grace period to not give up too quickly.
      * Given the usual multi-hundred MHz frequency the ITS usually runs with,
-     * one millisecond (for a single command) seem to be more than enough.
+     * one millisecond (for a batch of commands) seem to be more than enough.
      * But this value is rather arbitrarily chosen based on theoretical
      * considerations.
      */
     s_time_t deadline = NOW() + MILLISECS(1);
     uint64_t readp, writep;
+    unsigned int i;
     int ret = -EBUSY;
 
     /* No ITS commands from an interrupt handler (at the moment). */
     ASSERT(!in_irq());
+    ASSERT(nr && nr < ITS_CMD_QUEUE_SZ / ITS_CMD_SIZE);
 
     spin_lock(&hw_its->cmd_lock);
 
@@ -82,7 +92,9 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
         readp = readq_relaxed(hw_its->its_base + GITS_CREADR) & BUFPTR_MASK;
         writep = readq_relaxed(hw_its->its_base + GITS_CWRITER) & BUFPTR_MASK;
 
-        if ( ((writep + ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ) != readp )
+        /* One slot always stays free, to tell a full from an empty queue. */
+        if ( ((readp - writep - ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ) >=
+             nr * ITS_CMD_SIZE )
         {
             ret = 0;
             break;
@@ -106,14 +118,20 @@ static int its_send_command(struct host_its *hw_its, const void *its_cmd)
         return ret;
     }
 
-    memcpy(hw_its->cmd_buf + writep, its_cmd, ITS_CMD_SIZE);
-    if ( hw_its->flags & HOST_ITS_FLUSH_CMD_QUEUE )
-        clean_and_invalidate_dcache_va_range(hw_its->cmd_buf + writep,
-                                             ITS_CMD_SIZE);
-    else
+    for ( i = 0; i < nr; i++ )
+    {
+        memcpy(hw_its->cmd_buf + writep, its_cmds + i * ITS_CMD_SIZE,
+               ITS_CMD_SIZE);
+        if ( hw_its->flags & HOST_ITS_FLUSH_CMD_QUEUE )
+            clean_and_invalidate_dcache_va_range(hw_its->cmd_buf + writep,
+                                                 ITS_CMD_SIZE);
+
+        writep = (writep + ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ;
+    }
+
+    if ( !(hw_its->flags & HOST_ITS_FLUSH_CMD_QUEUE) )
         dsb(ishst);
 
-    writep = (writep + ITS_CMD_SIZE) % ITS_CMD_QUEUE_SZ;
     writeq_relaxed(writep & BUFPTR_MASK, hw_its->its_base + GITS_CWRITER);
 
     spin_unlock(&hw_its->cmd_lock);
@@ -149,6 +167,88 @@ static int gicv3_its_wait_commands(struct host_its *hw_its)
     return -ETIMEDOUT;
 }
 
+void gicv3_its_batch_init(struct its_cmd_batch *batch)
+{
+    batch->its = NULL;
+    batch->nr = 0;
+    batch->sync_cpu = -1;
+    batch->vsync_vpeid = -1;
+    batch->ret = 0;
+}
+
+/* Hand the queued commands over to the ITS, without waiting for them. */
+static void its_batch_flush(struct its_cmd_batch *batch)
+{
+    if ( batch->nr && !batch->ret )
+        batch->ret = its_send_commands(batch->its, batch->cmds, batch->nr);
+
+    batch->nr = 0;
+}
+
+/*
+ * Returns the next command slot of a batch. Once an error occurred, the
+ * remaining commands are just dropped, the error is reported on completion.
+ */
+static uint64_t *its_batch_slot(struct its_cmd_batch *batch)
+{
+    if ( batch->nr == ARRAY_SIZE(batch->cmds) )
+        its_batch_flush(batch);
+
+    return batch->cmds[batch->nr++];
+}
+
+/* Ask for a SYNC on the given CPU's redistributor on completion. */
+static void its_batch_need_sync(struct its_cmd_batch *batch, unsigned int cpu)
+{
+    batch->sync_cpu = cpu;
+}
+
+static void its_queue_cmd_sync(struct its_cmd_batch *batch, unsigned int cpu);
+#ifdef CONFIG_GICV4
+static void its_queue_cmd_vsync(struct its_cmd_batch *batch, uint16_t vpeid);
+#endif
+
+/*
+ * Direct the following commands to a given host ITS. A batch only ever
+ * feeds one ITS, so one for another ITS completes the batch first.
+ */
+static void its_batch_target(struct its_cmd_batch *batch,
+                             struct host_its *its)
+{
+    if ( batch->its && batch->its != its )
+        batch->ret = gicv3_its_batch_complete(batch);
+
+    batch->its = its;
+}
+
+/*
+ * Queue the SYNC and VSYNC the batch's commands need, hand everything over
+ * to the ITS and wait for it to be processed. The batch can be reused.
+ */
+int gicv3_its_batch_complete(struct its_cmd_batch *batch)
+{
+    int ret;
+
+    if ( !batch->its )
+        return batch->ret;
+
+    if ( batch->sync_cpu >= 0 )
+        its_queue_cmd_sync(batch, batch->sync_cpu);
+#ifdef CONFIG_GICV4
+    if ( batch->vsync_vpeid >= 0 )
+        its_queue_cmd_vsync(batch, batch->vsync_vpeid);
+#endif
+
+    its_batch_flush(batch);
+    if ( !batch->ret )
+        batch->ret = gicv3_its_wait_commands(batch->its);
+
+    ret = batch->ret;
+    gicv3_its_batch_init(batch);
+
+    return ret;
+}
+
 static uint64_t encode_rdbase(struct host_its *hw_its, unsigned int cpu,
                               uint64_t reg)
 {
@@ -159,54 +259,53 @@ static uint64_t encode_rdbase(struct host_its *hw_its, unsigned int cpu,
     return reg;
 }
 
-static int its_send_cmd_sync(struct host_its *its, unsigned int cpu)
+static void its_queue_cmd_sync(struct its_cmd_batch *batch, unsigned int cpu)
 {
-    uint64_t cmd[4];
+    uint64_t *cmd = its_batch_slot(batch);
 
     cmd[0] = GITS_CMD_SYNC;
     cmd[1] = 0x00;
-    cmd[2] = encode_rdbase(its, cpu, 0x0);
+    cmd[2] = encode_rdbase(batch->its, cpu, 0x0);
     cmd[3] = 0x00;
-
-    return its_send_command(its, cmd);
 }
 
-static int its_send_cmd_mapti(struct host_its *its,
-                              uint32_t deviceid, uint32_t eventid,
-                              uint32_t pintid, uint16_t icid)
+/* For now we map every host LPI to host CPU 0, so that's where to SYNC. */
+static void its_queue_cmd_mapti(struct its_cmd_batch *batch,
+                                uint32_t deviceid, uint32_t eventid,
+                                uint32_t pintid, uint16_t icid)
 {
-    uint64_t cmd[4];
+    uint64_t *cmd = its_batch_slot(batch);
 
     cmd[0] = GITS_CMD_MAPTI | ((uint64_t)deviceid << 32);
     cmd[1] = eventid | ((uint64_t)pintid << 32);
     cmd[2] = icid;
     cmd[3] = 0x00;
 
-    return its_send_command(its, cmd);
+    its_batch_need_sync(batch, 0);
 }
 
-static int its_send_cmd_mapc(struct host_its *its, uint32_t collection_id,
-                             unsigned int cpu)
+static void its_queue_cmd_mapc(struct its_cmd_batch *batch,
+                               uint32_t collection_id, unsigned int cpu)
 {
-    uint64_t cmd[4];
+    uint64_t *cmd = its_batch_slot(batch);
 
     cmd[0] = GITS_CMD_MAPC;
     cmd[1] = 0x00;
-    cmd[2] = encode_rdbase(its, cpu, collection_id);
+    cmd[2] = encode_rdbase(batch->its, cpu, collection_id);
     cmd[2] |= GITS_VALID_BIT;
     cmd[3] = 0x00;
 
-    return its_send_command(its, cmd);
+    its_batch_need_sync(batch, cpu);
 }
 
-static int its_send_cmd_mapd(struct host_its *its, uint32_t deviceid,
-                             uint8_t size_bits, paddr_t itt_addr, bool valid)
+static void its_queue_cmd_mapd(struct its_cmd_batch *batch, uint32_t deviceid,
+                               uint8_t size_bits, paddr_t itt_addr, bool valid)
 {
-    uint64_t cmd[4];
+    uint64_t *cmd = its_batch_slot(batch);
 
     if ( valid )
     {
-        ASSERT(size_bits <= its->evid_bits);
+        ASSERT(size_bits <= batch->its->evid_bits);
         ASSERT(size_bits > 0);
         ASSERT(!(itt_addr & ~GENMASK(51, 8)));
 
@@ -220,39 +319,164 @@ static int its_send_cmd_mapd(struct host_its *its, uint32_t deviceid,
         cmd[2] |= GITS_VALID_BIT;
     cmd[3] = 0x00;
 
-    return its_send_command(its, cmd);
+    its_batch_need_sync(batch, 0);
 }
 
-static int its_send_cmd_inv(struct host_its *its,
-                            uint32_t deviceid, uint32_t eventid)
+static void its_queue_cmd_inv(struct its_cmd_batch *batch,
+                              uint32_t deviceid, uint32_t eventid)
 {
-    uint64_t cmd[4];
+    uint64_t *cmd = its_batch_slot(batch);
 
     cmd[0] = GITS_CMD_INV | ((uint64_t)deviceid << 32);
     cmd[1] = eventid;
     cmd[2] = 0x00;
     cmd[3] = 0x00;
 
-    return its_send_command(its, cmd);
+    its_batch_need_sync(batch, 0);
 }
 
-/* Set up the (1:1) collection mapping for the given host CPU. */
-int gicv3_its_setup_collection(unsigned int cpu)
+#ifdef CONFIG_GICV4
+/*
+ * Ask for a VSYNC of the given vPE on completion. Commands for another vPE
+ * get the VSYNC for the previous one queued right away.
+ */
+static void its_batch_need_vsync(struct its_cmd_batch *batch, uint16_t vpeid)
 {
+    if ( batch->vsync_vpeid >= 0 && batch->vsync_vpeid != vpeid )
+        its_queue_cmd_vsync(batch, batch->vsync_vpeid);
+
+    batch->vsync_vpeid = vpeid;
+}
+
+static void its_queue_cmd_discard(struct its_cmd_batch *batch,
+                                  uint32_t deviceid, uint32_t eventid)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_DISCARD | ((uint64_t)deviceid << 32);
+    cmd[1] = eventid;
+    cmd[2] = 0x00;
+    cmd[3] = 0x00;
+
+    its_batch_need_sync(batch, 0);
+}
+
+static void its_queue_cmd_vmapp(struct its_cmd_batch *batch,
+                                const struct domain *d,
+                                const struct its_vpe *vpe, bool valid,
+                                bool alloc)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VMAPP;
+    cmd[1] = ((uint64_t)vpe->vpeid << 32) | vpe->db_lpi;
+    cmd[2] = 0x00;
+    cmd[3] = 0x00;
+
+    if ( alloc )
+        cmd[0] |= GITS_VMAPP_ALLOC;
+
+    if ( valid )
+    {
+        /* A freshly allocated pending table is all zeroes. */
+        if ( alloc )
+            cmd[0] |= GITS_VMAPP_PTZ;
+        cmd[0] |= virt_to_maddr(d->arch.vgic.vlpi_prop) & GENMASK(51, 16);
+        cmd[2] = encode_rdbase(batch->its, vpe->col, 0x0) | GITS_VALID_BIT;
+        cmd[3] = virt_to_maddr(vpe->vpt) & GENMASK(51, 16);
+        cmd[3] |= d->arch.vgic.vlpi_bits - 1;
+
+        /* There is nothing to VSYNC for an unmapped vPE. */
+        its_batch_need_vsync(batch, vpe->vpeid);
+    }
+}
+
+static void its_queue_cmd_vmovp(struct its_cmd_batch *batch,
+                                const struct its_vpe *vpe, unsigned int cpu)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VMOVP;
+    cmd[1] = (uint64_t)vpe->vpeid << 32;
+    cmd[2] = encode_rdbase(batch->its, cpu, 0x0) | GITS_VMOVP_DB;
+    cmd[3] = vpe->db_lpi;
+
+    its_batch_need_vsync(batch, vpe->vpeid);
+}
+
+static void its_queue_cmd_vmapti(struct its_cmd_batch *batch,
+                                 uint32_t deviceid, uint32_t eventid,
+                                 uint16_t vpeid, uint32_t vintid)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VMAPTI | ((uint64_t)deviceid << 32);
+    cmd[1] = eventid | ((uint64_t)vpeid << 32);
+    cmd[2] = GITS_NO_DOORBELL | ((uint64_t)vintid << 32);
+    cmd[3] = 0x00;
+
+    its_batch_need_vsync(batch, vpeid);
+}
+
+static void its_queue_cmd_vmovi(struct its_cmd_batch *batch,
+                                uint32_t deviceid, uint32_t eventid,
+                                uint16_t vpeid)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VMOVI | ((uint64_t)deviceid << 32);
+    cmd[1] = eventid | ((uint64_t)vpeid << 32);
+    cmd[2] = 0x00;
+    cmd[3] = 0x00;
+
+    its_batch_need_vsync(batch, vpeid);
+}
+
+static void its_queue_cmd_vsync(struct its_cmd_batch *batch, uint16_t vpeid)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VSYNC;
+    cmd[1] = (uint64_t)vpeid << 32;
+    cmd[2] = 0x00;
+    cmd[3] = 0x00;
+}
+
+static void its_queue_cmd_vinvall(struct its_cmd_batch *batch, uint16_t vpeid)
+{
+    uint64_t *cmd = its_batch_slot(batch);
+
+    cmd[0] = GITS_CMD_VINVALL;
+    cmd[1] = (uint64_t)vpeid << 32;
+    cmd[2] = 0x00;
+    cmd[3] = 0x00;
+
+    its_batch_need_vsync(batch, vpeid);
+}
+
+/*
+ * Map or unmap a vPE on all host ITSes. They share the vPE table, so the
+ * first one allocates the entry and the last one to unmap releases it.
+ */
+int gicv3_its_map_vpe(const struct domain *d, const struct its_vpe *vpe,
+                      bool valid)
+{
+    struct its_cmd_batch batch;
     struct host_its *its;
     int ret;
 
+    gicv3_its_batch_init(&batch);
+
     list_for_each_entry(its, &host_its_list, entry)
     {
-        ret = its_send_cmd_mapc(its, cpu, cpu);
-        if ( ret )
-            return ret;
+        bool alloc = valid ? its->entry.prev == &host_its_list
+                           : its->entry.next == &host_its_list;
 
-        ret = its_send_cmd_sync(its, cpu);
-        if ( ret )
-            return ret;
+        its_batch_target(&batch, its);
+        its_queue_cmd_vmapp(&batch, d, vpe, valid, alloc);
 
-        ret = gicv3_its_wait_commands(its);
+        /* The next ITS must only see the vPE once this one is done. */
+        ret = gicv3_its_batch_complete(&batch);
         if ( ret )
             return ret;
     }
@@ -260,6 +484,56 @@ int gicv3_its_setup_collection(unsigned int cpu)
     return 0;
 }
 
+/*
+ * Point a vPE at the redistributor of another CPU. We only use GICv4.1
+ * with ITSes advertising GITS_TYPER.VMOVP, where one of them is enough.
+ */
+int gicv3_its_move_vpe(const struct its_vpe *vpe, unsigned int cpu)
+{
+    struct its_cmd_batch batch;
+
+    gicv3_its_batch_init(&batch);
+    its_batch_target(&batch, list_first_entry(&host_its_list,
+                                              struct host_its, entry));
+    its_queue_cmd_vmovp(&batch, vpe, cpu);
+
+    return gicv3_its_batch_complete(&batch);
+}
+
+int gicv3_its_invall_vpe(const struct its_vpe *vpe)
+{
+    struct its_cmd_batch batch;
+    struct host_its *its;
+
+    gicv3_its_batch_init(&batch);
+
+    list_for_each_entry(its, &host_its_list, entry)
+    {
+        its_batch_target(&batch, its);
+        its_queue_cmd_vinvall(&batch, vpe->vpeid);
+    }
+
+    return gicv3_its_batch_complete(&batch);
+}
+#endif /* CONFIG_GICV4 */
+
+/* Set up the (1:1) collection mapping for the given host CPU. */
+int gicv3_its_setup_collection(unsigned int cpu)
+{
+    struct its_cmd_batch batch;
+    struct host_its *its;
+
+    gicv3_its_batch_init(&batch);
+
+    list_for_each_entry(its, &host_its_list, entry)
+    {
+        its_batch_target(&batch, its);
+        its_queue_cmd_mapc(&batch, cpu, cpu);
+    }
+
+    return gicv3_its_batch_complete(&batch);
+}
+
 #define BASER_ATTR_MASK                                           \
         ((0x3UL << GITS_BASER_SHAREABILITY_SHIFT)               | \
          (0x7UL << GITS_BASER_OUTER_CACHEABILITY_SHIFT)         | \
@@ -482,8 +756,13 @@ static int gicv3_its_init_single_its(struct host_its *hw_its)
             if ( ret )
                 return ret;
             break;
-        /* In case this is a GICv4, provide a (dummy) vPE table as well. */
+        /*
+         * In case this is a GICv4, provide a vPE table as well. Unless we
+         * use direct vLPI injection, a dummy one will do.
+         */
         case GITS_BASER_TYPE_VCPU:
+            if ( !gicv4_its_init(hw_its, basereg, reg) )
+                break;
             ret = its_map_baser(basereg, reg, 1);
             if ( ret )
                 return ret;
@@ -511,19 +790,24 @@ static int gicv3_its_init_single_its(struct host_its *hw_its)
  */
 static int remove_mapped_guest_device(struct its_device *dev)
 {
-    int ret = 0;
+    struct its_cmd_batch batch;
+    int ret;
     unsigned int i;
 
+    gicv3_its_batch_init(&batch);
+
     if ( dev->hw_its )
+    {
         /* MAPD also discards all events with this device ID. */
-        ret = its_send_cmd_mapd(dev->hw_its, dev->host_devid, 0, 0, false);
+        its_batch_target(&batch, dev->hw_its);
+        its_queue_cmd_mapd(&batch, dev->host_devid, 0, 0, false);
+    }
 
     for ( i = 0; i < dev->eventids / LPI_BLOCK; i++ )
         gicv3_free_host_lpi_block(dev->host_lpi_blocks[i]);
 
     /* Make sure the MAPD command above is really executed. */
-    if ( !ret )
-        ret = gicv3_its_wait_commands(dev->hw_its);
+    ret = gicv3_its_batch_complete(&batch);
 
     /* This should never happen, but just in case ... */
     if ( ret && printk_ratelimit() )
@@ -533,6 +817,9 @@ static int remove_mapped_guest_device(struct its_device *dev)
     xfree(dev->itt_addr);
     xfree(dev->pend_irqs);
     xfree(dev->host_lpi_blocks);
+#ifdef CONFIG_GICV4
+    xfree(dev->vlpi_events);
+#endif
     xfree(dev);
 
     return 0;
@@ -573,33 +860,25 @@ static int compare_its_guest_devices(struct its_device *dev,
  * On the host ITS @its, map @nr_events consecutive LPIs.
  * The mapping connects a device @devid and event @eventid pair to LPI @lpi,
  * increasing both @eventid and @lpi to cover the number of requested LPIs.
+ * The commands are only queued in @batch, completing it syncs them.
  */
-static int gicv3_its_map_host_events(struct host_its *its,
-                                     uint32_t devid, uint32_t eventid,
-                                     uint32_t lpi, uint32_t nr_events)
+static void gicv3_its_map_host_events(struct its_cmd_batch *batch,
+                                      struct host_its *its,
+                                      uint32_t devid, uint32_t eventid,
+                                      uint32_t lpi, uint32_t nr_events)
 {
     uint32_t i;
-    int ret;
+
+    its_batch_target(batch, its);
 
     for ( i = 0; i < nr_events; i++ )
     {
         /* For now we map every host LPI to host CPU 0 */
-        ret = its_send_cmd_mapti(its, devid, eventid + i, lpi + i, 0);
-        if ( ret )
-            return ret;
-
-        ret = its_send_cmd_inv(its, devid, eventid + i);
-        if ( ret )
-            return ret;
+        its_queue_cmd_mapti(batch, devid, eventid + i, lpi + i, 0);
+        its_queue_cmd_inv(batch, devid, eventid + i);
     }
 
     /* TODO: Consider using INVALL here. Didn't work on the model, though. */
-
-    ret = its_send_cmd_sync(its, 0);
-    if ( ret )
-        return ret;
-
-    return gicv3_its_wait_commands(its);
 }
 
 /*
@@ -618,7 +897,9 @@ int gicv3_its_map_guest_device(struct domain *d,
     struct host_its *hw_its;
     struct its_device *dev = NULL;
     struct rb_node **new = &d->arch.vgic.its_devices.rb_node, *parent = NULL;
+    struct its_cmd_batch batch;
     int i, ret = -ENOENT;      /* "i" must be signed to check for >= 0 below. */
+    int err;
 
     hw_its = gicv3_its_find_by_doorbell(host_doorbell);
     if ( !hw_its )
@@ -709,10 +990,24 @@ int gicv3_its_map_guest_device(struct domain *d,
     if ( !dev->host_lpi_blocks )
         goto out_unlock;
 
-    ret = its_send_cmd_mapd(hw_its, host_devid, fls(nr_events - 1),
-                            virt_to_maddr(itt_addr), true);
-    if ( ret )
-        goto out_unlock;
+#ifdef CONFIG_GICV4
+    if ( gicv4_domain_has_vlpis(d) )
+    {
+        dev->vlpi_events = xzalloc_array(unsigned long,
+                                         BITS_TO_LONGS(nr_events));
+        if ( !dev->vlpi_events )
+            goto out_unlock;
+    }
+#endif
+
+    /*
+     * The MAPD and the MAPTI/INV for all the events below go out as one
+     * batch, with a single SYNC at the end.
+     */
+    gicv3_its_batch_init(&batch);
+    its_batch_target(&batch, hw_its);
+    its_queue_cmd_mapd(&batch, host_devid, fls(nr_events - 1),
+                       virt_to_maddr(itt_addr), true);
 
     dev->itt_addr = itt_addr;
     dev->hw_its = hw_its;
@@ -736,12 +1031,14 @@ int gicv3_its_map_guest_device(struct domain *d,
         if ( ret < 0 )
             break;
 
-        ret = gicv3_its_map_host_events(hw_its, host_devid, i * LPI_BLOCK,
-                                        dev->host_lpi_blocks[i], LPI_BLOCK);
-        if ( ret < 0 )
-            break;
+        gicv3_its_map_host_events(&batch, hw_its, host_devid, i * LPI_BLOCK,
+                                  dev->host_lpi_blocks[i], LPI_BLOCK);
     }
 
+    err = gicv3_its_batch_complete(&batch);
+    if ( !ret )
+        ret = err;
+
     if ( ret )
     {
         /* Clean up all allocated host LPI blocks. */
@@ -756,7 +1053,9 @@ int gicv3_its_map_guest_device(struct domain *d,
          * We are already on the failing path, so no error checking to
          * not mask the original error value. This should never fail anyway.
          */
-        its_send_cmd_mapd(hw_its, host_devid, 0, 0, false);
+        its_batch_target(&batch, hw_its);
+        its_queue_cmd_mapd(&batch, host_devid, 0, 0, false);
+        gicv3_its_batch_complete(&batch);
 
         goto out;
     }
@@ -771,6 +1070,9 @@ out:
     {
         xfree(dev->pend_irqs);
         xfree(dev->host_lpi_blocks);
+#ifdef CONFIG_GICV4
+        xfree(dev->vlpi_events);
+#endif
     }
     xfree(itt_addr);
     xfree(dev);
@@ -829,6 +1131,113 @@ static struct pending_irq *get_event_pending_irq(struct domain *d,
     return pirq;
 }
 
+#ifdef CONFIG_GICV4
+/* Returns the device an event belongs to, if the domain may use vLPIs. */
+static struct its_device *get_vlpi_event_device(struct domain *d,
+                                                paddr_t vdoorbell_address,
+                                                uint32_t vdevid,
+                                                uint32_t eventid)
+{
+    struct its_device *dev;
+
+    spin_lock(&d->arch.vgic.its_devices_lock);
+    dev = get_its_device(d, vdoorbell_address, vdevid);
+    if ( dev && (eventid >= dev->eventids || !dev->vlpi_events) )
+        dev = NULL;
+    spin_unlock(&d->arch.vgic.its_devices_lock);
+
+    return dev;
+}
+
+static uint32_t event_host_lpi(const struct its_device *dev, uint32_t eventid)
+{
+    return dev->host_lpi_blocks[eventid / LPI_BLOCK] + (eventid % LPI_BLOCK);
+}
+
+/* Point an event translated to a vLPI back at its host LPI. */
+static void its_unmap_vlpi_event(struct its_cmd_batch *batch,
+                                 struct its_device *dev, uint32_t eventid)
+{
+    if ( !dev->vlpi_events || !test_and_clear_bit(eventid, dev->vlpi_events) )
+        return;
+
+    its_batch_target(batch, dev->hw_its);
+    its_queue_cmd_discard(batch, dev->host_devid, eventid);
+    gicv3_its_map_host_events(batch, dev->hw_its, dev->host_devid, eventid,
+                              event_host_lpi(dev, eventid), 1);
+}
+
+/*
+ * Have the host ITS translate an event straight into a vLPI on the vPE
+ * of the given vCPU, instead of into the host LPI we inject from.
+ * vLPIs beyond what the VConf table covers stay on the software path.
+ * The commands are queued in @batch, see gicv3_its_batch_complete().
+ */
+int gicv3_its_map_vlpi(struct its_cmd_batch *batch,
+                       struct domain *d, paddr_t vdoorbell_address,
+                       uint32_t vdevid, uint32_t eventid,
+                       const struct vcpu *v, uint32_t virt_lpi)
+{
+    const struct its_vpe *vpe = v->arch.vgic.vpe;
+    struct its_device *dev;
+
+    if ( !vpe || virt_lpi >= BIT(d->arch.vgic.vlpi_bits, UL) )
+        return -ERANGE;
+
+    dev = get_vlpi_event_device(d, vdoorbell_address, vdevid, eventid);
+    if ( !dev )
+        return -ENOENT;
+
+    its_batch_target(batch, dev->hw_its);
+    its_queue_cmd_discard(batch, dev->host_devid, eventid);
+    its_queue_cmd_vmapti(batch, dev->host_devid, eventid, vpe->vpeid,
+                         virt_lpi);
+    its_queue_cmd_inv(batch, dev->host_devid, eventid);
+
+    set_bit(eventid, dev->vlpi_events);
+
+    return 0;
+}
+
+int gicv3_its_move_vlpi(struct its_cmd_batch *batch,
+                        struct domain *d, paddr_t vdoorbell_address,
+                        uint32_t vdevid, uint32_t eventid,
+                        const struct vcpu *v)
+{
+    const struct its_vpe *vpe = v->arch.vgic.vpe;
+    struct its_device *dev;
+
+    dev = get_vlpi_event_device(d, vdoorbell_address, vdevid, eventid);
+    if ( !dev || !test_bit(eventid, dev->vlpi_events) )
+        return 0;
+
+    its_batch_target(batch, dev->hw_its);
+    its_queue_cmd_vmovi(batch, dev->host_devid, eventid, vpe->vpeid);
+
+    return 0;
+}
+
+/* Make the ITS pick up a changed VConf entry. */
+int gicv3_its_inv_vlpi(struct its_cmd_batch *batch,
+                       struct domain *d, paddr_t vdoorbell_address,
+                       uint32_t vdevid, uint32_t eventid,
+                       const struct vcpu *v)
+{
+    const struct its_vpe *vpe = v->arch.vgic.vpe;
+    struct its_device *dev;
+
+    dev = get_vlpi_event_device(d, vdoorbell_address, vdevid, eventid);
+    if ( !dev || !test_bit(eventid, dev->vlpi_events) )
+        return 0;
+
+    its_batch_target(batch, dev->hw_its);
+    its_queue_cmd_inv(batch, dev->host_devid, eventid);
+    its_batch_need_vsync(batch, vpe->vpeid);
+
+    return 0;
+}
+#endif /* CONFIG_GICV4 */
+
 struct pending_irq *gicv3_its_get_event_pending_irq(struct domain *d,
                                                     paddr_t vdoorbell_address,
                                                     uint32_t vdevid,
@@ -837,7 +1246,8 @@ struct pending_irq *gicv3_its_get_event_pending_irq(struct domain *d,
     return get_event_pending_irq(d, vdoorbell_address, vdevid, eventid, NULL);
 }
 
-int gicv3_remove_guest_event(struct domain *d, paddr_t vdoorbell_address,
+int gicv3_remove_guest_event(struct its_cmd_batch *batch,
+                             struct domain *d, paddr_t vdoorbell_address,
                              uint32_t vdevid, uint32_t eventid)
 {
     uint32_t host_lpi = INVALID_LPI;
@@ -851,6 +1261,17 @@ int gicv3_remove_guest_event(struct domain *d, paddr_t vdoorbell_address,
 
     gicv3_lpi_update_host_entry(host_lpi, d->domain_id, INVALID_LPI);
 
+#ifdef CONFIG_GICV4
+    if ( gicv4_domain_has_vlpis(d) )
+    {
+        struct its_device *dev = get_vlpi_event_device(d, vdoorbell_address,
+                                                       vdevid, eventid);
+
+        if ( dev )
+            its_unmap_vlpi_event(batch, dev, eventid);
+    }
+#endif
+
     return 0;
 }
 
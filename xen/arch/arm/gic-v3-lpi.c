@@ -199,7 +199,10 @@ void gicv3_do_LPI(unsigned int lpi)
      * See the thread around here for some background:
      * https://lists.xen.org/archives/html/xen-devel/2016-12/msg00003.html
      */
-    vgic_vcpu_inject_lpi(d, hlpi.virt_lpi);
+    if ( hlpi.virt_lpi < LPI_OFFSET )
+        gicv4_vpe_doorbell(d, hlpi.virt_lpi - GICV4_DOORBELL_VLPI(0));
+    else
+        vgic_vcpu_inject_lpi(d, hlpi.virt_lpi);
 
     rcu_unlock_domain(d);
 
@@ -55,13 +55,24 @@ static DEFINE_PER_CPU(void __iomem*, rbase);
 #define GICD_RDIST_SGI_BASE    (GICD_RDIST_BASE + SZ_64K)
 
 /*
- * Saves all 16(Max) LR registers. Though number of LRs implemented
- * is implementation specific.
+ * LRs get allocated from the bottom, so only those up to the highest one
+ * in v->arch.lr_mask can hold anything. gic_restore_state() takes care of
+ * clearing the ones the next vCPU doesn't use.
+ */
+static inline unsigned int gicv3_nr_used_lrs(const struct vcpu *v)
+{
+    /* There are at most 16 LRs. */
+    return fls(v->arch.lr_mask & 0xffff);
+}
+
+/*
+ * Saves the used LR registers, up to 16(Max). The number of LRs
+ * implemented is implementation specific.
  */
 static inline void gicv3_save_lrs(struct vcpu *v)
 {
     /* Fall through for all the cases */
-    switch ( gicv3_info.nr_lrs )
+    switch ( gicv3_nr_used_lrs(v) )
     {
     case 16:
         v->arch.gic.v3.lr[15] = READ_SYSREG_LR(15);
@@ -96,19 +107,21 @@ static inline void gicv3_save_lrs(struct vcpu *v)
     case 1:
          v->arch.gic.v3.lr[0] = READ_SYSREG_LR(0);
          break;
+    case 0:
+         break;
     default:
          BUG();
     }
 }
 
 /*
- * Restores all 16(Max) LR registers. Though number of LRs implemented
- * is implementation specific.
+ * Restores the used LR registers, up to 16(Max). The number of LRs
+ * implemented is implementation specific.
  */
 static inline void gicv3_restore_lrs(const struct vcpu *v)
 {
     /* Fall through for all the cases */
-    switch ( gicv3_info.nr_lrs )
+    switch ( gicv3_nr_used_lrs(v) )
     {
     case 16:
         WRITE_SYSREG_LR(v->arch.gic.v3.lr[15], 15);
@@ -143,6 +156,8 @@ static inline void gicv3_restore_lrs(const struct vcpu *v)
     case 1:
         WRITE_SYSREG_LR(v->arch.gic.v3.lr[0], 0);
         break;
+    case 0:
+        break;
     default:
          BUG();
     }
@@ -364,6 +379,7 @@ static void gicv3_save_state(struct vcpu *v)
     save_aprn_regs(&v->arch.gic);
     v->arch.gic.v3.vmcr = READ_SYSREG(ICH_VMCR_EL2);
     v->arch.gic.v3.sre_el1 = READ_SYSREG(ICC_SRE_EL1);
+    gicv4_vpe_deschedule(v);
 }
 
 static void gicv3_restore_state(const struct vcpu *v)
@@ -394,6 +410,7 @@ static void gicv3_restore_state(const struct vcpu *v)
     WRITE_SYSREG(v->arch.gic.v3.vmcr, ICH_VMCR_EL2);
     restore_aprn_regs(&v->arch.gic);
     gicv3_restore_lrs(v);
+    gicv4_vpe_schedule(v);
 
     /*
      * Make sure all stores are visible the GIC
@@ -770,6 +787,9 @@ static int __init gicv3_populate_rdist(void)
                                smp_processor_id(), ret);
                         break;
                     }
+
+                    if ( !ret )
+                        gicv4_rdist_init(ptr, typer);
                 }
 
                 printk("GICv3: CPU%d: Found redistributor in region %d @%p\n",
@@ -1055,6 +1075,11 @@ static void gicv3_clear_lr(int lr)
     gicv3_ich_write_lr(lr, 0);
 }
 
+static uint64_t gicv3_read_elrsr(void)
+{
+    return READ_SYSREG(ICH_ELRSR_EL2);
+}
+
 static void gicv3_read_lr(int lr, struct gic_lr *lr_reg)
 {
     uint64_t lrv;
@@ -1844,6 +1869,7 @@ static const struct gic_hw_operations gicv3_ops = {
     .update_lr           = gicv3_update_lr,
     .update_hcr_status   = gicv3_hcr_status,
     .clear_lr            = gicv3_clear_lr,
+    .read_elrsr          = gicv3_read_elrsr,
     .read_lr             = gicv3_read_lr,
     .write_lr            = gicv3_write_lr,
     .read_vmcr_priority  = gicv3_read_vmcr_priority,
@@ -0,0 +1,503 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * xen/arch/arm/gic-v4-its.c
+ *
+ * ARM GICv4.1 direct injection of virtual LPIs
+ *
+ * Events a domain maps through its virtual ITS normally end up as host
+ * LPIs, which Xen then injects through a list register. With GICv4.1 the
+ * ITS can translate them into virtual LPIs instead, which the redistributor
+ * delivers straight to the vCPU while its vPE is resident there. When the
+ * vCPU is blocked, a doorbell (a host LPI per vCPU) tells Xen to wake it.
+ */
+
+#include <xen/delay.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/param.h>
+#include <xen/sched.h>
+#include <xen/sizes.h>
+#include <xen/spinlock.h>
+#include <asm/gic.h>
+#include <asm/gic_v3_defs.h>
+#include <asm/gic_v3_its.h>
+#include <asm/io.h>
+#include <asm/page.h>
+
+#define GICV4_MAX_VPES          4096U
+/* Bounds the size of the vLPI configuration and pending tables. */
+#define GICV4_MAX_VLPI_BITS     16U
+
+/* Cleared again if any ITS or redistributor turns out not to support it. */
+static bool __read_mostly opt_gicv4;
+boolean_param("gicv4", opt_gicv4);
+
+static DEFINE_PER_CPU(void __iomem *, vlpi_base);
+
+/*
+ * GICv4.1 lets all ITSes and redistributors share one vPE table, which
+ * is only ever written by the hardware.
+ */
+static struct {
+    void *base;
+    uint64_t baser;                     /* As accepted by the first ITS */
+    uint64_t vpropbaser;
+    unsigned int nr_vpes;
+    unsigned long *vpeid_map;
+} vpe_table;
+static DEFINE_SPINLOCK(vpeid_lock);
+
+/* The ITS BASE registers work with page sizes of 4K, 16K or 64K. */
+#define BASER_PAGE_BITS(sz) ((sz) * 2 + 12)
+
+static int gicv4_alloc_vpe_table(void __iomem *basereg, uint64_t regc)
+{
+    unsigned int entry_size = GITS_BASER_ENTRY_SIZE(regc);
+    unsigned int pagesz, page_bits = 0, table_size = 0;
+    uint64_t attr, reg = 0;
+    void *buffer = NULL;
+
+    attr  = GIC_BASER_InnerShareable << GITS_BASER_SHAREABILITY_SHIFT;
+    attr |= GIC_BASER_CACHE_SameAsInner << GITS_BASER_OUTER_CACHEABILITY_SHIFT;
+    attr |= GIC_BASER_CACHE_RaWaWb << GITS_BASER_INNER_CACHEABILITY_SHIFT;
+
+    /* Try 64K pages first, then go down. */
+    for ( pagesz = 3; pagesz-- > 0; )
+    {
+        page_bits = BASER_PAGE_BITS(pagesz);
+        table_size = ROUNDUP(GICV4_MAX_VPES * entry_size, BIT(page_bits, UL));
+        /* The BASE registers support at most 256 pages. */
+        table_size = min(table_size, 256U << page_bits);
+
+        buffer = _xzalloc(table_size, BIT(page_bits, UL));
+        if ( !buffer )
+            return -ENOMEM;
+
+        /* Keep it simple: don't bother with the 52-bit address encoding. */
+        if ( virt_to_maddr(buffer) & ~GENMASK(47, page_bits) )
+        {
+            xfree(buffer);
+            return -ERANGE;
+        }
+
+        reg  = attr | GITS_VALID_BIT;
+        reg |= regc & (GITS_BASER_TYPE_MASK |
+                       (0x1fULL << GITS_BASER_ENTRY_SIZE_SHIFT));
+        reg |= (uint64_t)pagesz << GITS_BASER_PAGE_SIZE_SHIFT;
+        reg |= (table_size >> page_bits) - 1;
+        reg |= virt_to_maddr(buffer);
+
+        writeq_relaxed(reg, basereg);
+        reg = readq_relaxed(basereg);
+
+        if ( (reg & GITS_VALID_BIT) &&
+             ((reg >> GITS_BASER_PAGE_SIZE_SHIFT) & 0x3UL) == pagesz )
+            break;
+
+        xfree(buffer);
+        buffer = NULL;
+    }
+
+    if ( !buffer )
+        return -EINVAL;
+
+    if ( (reg & GITS_BASER_INNER_CACHEABILITY_MASK) <= GIC_BASER_CACHE_nC )
+        clean_and_invalidate_dcache_va_range(buffer, table_size);
+
+    vpe_table.nr_vpes = min(table_size / entry_size, GICV4_MAX_VPES);
+    vpe_table.vpeid_map = xzalloc_array(unsigned long,
+                                        BITS_TO_LONGS(vpe_table.nr_vpes));
+    if ( !vpe_table.vpeid_map )
+    {
+        writeq_relaxed(0, basereg);
+        xfree(buffer);
+        return -ENOMEM;
+    }
+
+    /* The same table, in the GICv4.1 layout of GICR_VPROPBASER. */
+    vpe_table.vpropbaser =
+        GICR_VPROPBASER_4_1_VALID |
+        ((uint64_t)(entry_size - 1) << GICR_VPROPBASER_4_1_ENTRY_SIZE_SHIFT) |
+        (((reg & GITS_BASER_OUTER_CACHEABILITY_MASK) >>
+          GITS_BASER_OUTER_CACHEABILITY_SHIFT) <<
+         GICR_VPROPBASER_4_1_OUTER_CACHEABILITY_SHIFT) |
+        ((uint64_t)pagesz << GICR_VPROPBASER_4_1_PAGE_SIZE_SHIFT) |
+        virt_to_maddr(buffer) |
+        (((reg & GITS_BASER_SHAREABILITY_MASK) >>
+          GITS_BASER_SHAREABILITY_SHIFT) <<
+         GICR_VPROPBASER_4_1_SHAREABILITY_SHIFT) |
+        (((reg & GITS_BASER_INNER_CACHEABILITY_MASK) >>
+          GITS_BASER_INNER_CACHEABILITY_SHIFT) <<
+         GICR_VPROPBASER_4_1_INNER_CACHEABILITY_SHIFT) |
+        ((table_size >> page_bits) - 1);
+
+    vpe_table.base = buffer;
+    vpe_table.baser = reg;
+
+    return 0;
+}
+
+/*
+ * Called for the vPE BASE register of each host ITS. Returns an error if
+ * GICv4.1 is not (or no longer) in use, the caller then provides a dummy
+ * vPE table.
+ */
+int gicv4_its_init(struct host_its *hw_its, void __iomem *basereg,
+                   uint64_t regc)
+{
+    uint64_t typer = readq_relaxed(hw_its->its_base + GITS_TYPER);
+    int ret;
+
+    if ( !opt_gicv4 )
+        return -ENODEV;
+
+    if ( !(typer & GITS_TYPER_VLPIS) || !(typer & GITS_TYPER_VMAPP) ||
+         !(typer & GITS_TYPER_VMOVP) || !(typer & GITS_TYPER_SVPET_MASK) )
+    {
+        printk(XENLOG_WARNING
+               "ITS@%lx: no GICv4.1 vPE table sharing, not using GICv4\n",
+               hw_its->addr);
+        opt_gicv4 = false;
+        return -ENODEV;
+    }
+
+    if ( !vpe_table.base )
+        ret = gicv4_alloc_vpe_table(basereg, regc);
+    else
+    {
+        writeq_relaxed(vpe_table.baser, basereg);
+        ret = readq_relaxed(basereg) == vpe_table.baser ? 0 : -EINVAL;
+    }
+
+    if ( ret )
+    {
+        printk(XENLOG_WARNING
+               "ITS@%lx: cannot set up the vPE table (%d), not using GICv4\n",
+               hw_its->addr, ret);
+        opt_gicv4 = false;
+    }
+
+    return ret;
+}
+
+void gicv4_rdist_init(void __iomem *rdist_base, uint64_t typer)
+{
+    void __iomem *vlpi = rdist_base + GICR_VLPI_BASE_OFFSET;
+
+    if ( !opt_gicv4 )
+        return;
+
+    /*
+     * We rely on every redistributor sharing the vPE table with the ITSes,
+     * and on vPE IDs being the ones the ITS uses.
+     */
+    if ( !vpe_table.base || !(typer & GICR_TYPER_VLPIS) ||
+         !(typer & GICR_TYPER_RVPEID) ||
+         (typer & GICR_TYPER_COMMON_LPI_AFF_MASK) )
+        goto fail;
+
+    /* Nothing resident yet. */
+    writeq_relaxed(0, vlpi + GICR_VPENDBASER);
+
+    writeq_relaxed(vpe_table.vpropbaser, vlpi + GICR_VPROPBASER);
+    if ( !(readq_relaxed(vlpi + GICR_VPROPBASER) & GICR_VPROPBASER_4_1_VALID) )
+        goto fail;
+
+    this_cpu(vlpi_base) = vlpi;
+
+    return;
+
+fail:
+    /* Once domains may have vPEs there is no going back. */
+    if ( system_state >= SYS_STATE_active )
+        panic("GICv4: CPU%u: redistributor cannot handle vPEs\n",
+              smp_processor_id());
+
+    printk(XENLOG_WARNING
+           "GICv4: CPU%u: redistributor cannot handle vPEs, not using GICv4\n",
+           smp_processor_id());
+    opt_gicv4 = false;
+}
+
+int gicv4_domain_init(struct domain *d)
+{
+    unsigned int i, size;
+    int ret;
+
+    if ( !opt_gicv4 || !d->arch.vgic.has_its )
+        return 0;
+
+    d->arch.vgic.vlpi_bits = min(d->arch.vgic.intid_bits,
+                                 GICV4_MAX_VLPI_BITS);
+    if ( BIT(d->arch.vgic.vlpi_bits, UL) <= LPI_OFFSET )
+        return 0;
+
+    /*
+     * Like the LPI property table, VConf holds one byte per vLPI. The guest
+     * property table stays the reference, we copy entries over on INV.
+     */
+    size = BIT(d->arch.vgic.vlpi_bits, UL) - LPI_OFFSET;
+    d->arch.vgic.vlpi_prop = _xmalloc(size, SZ_64K);
+    if ( !d->arch.vgic.vlpi_prop )
+        return -ENOMEM;
+    memset(d->arch.vgic.vlpi_prop, GIC_PRI_IRQ | LPI_PROP_RES1, size);
+    clean_and_invalidate_dcache_va_range(d->arch.vgic.vlpi_prop, size);
+
+    d->arch.vgic.vpe_db_lpis = xzalloc_array(uint32_t,
+                                             DIV_ROUND_UP(d->max_vcpus,
+                                                          LPI_BLOCK));
+    if ( !d->arch.vgic.vpe_db_lpis )
+    {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    for ( i = 0; i < DIV_ROUND_UP(d->max_vcpus, LPI_BLOCK); i++ )
+    {
+        ret = gicv3_allocate_host_lpi_block(d, &d->arch.vgic.vpe_db_lpis[i]);
+        if ( ret )
+            goto fail;
+    }
+
+    return 0;
+
+fail:
+    gicv4_domain_free(d);
+
+    return ret;
+}
+
+static void gicv4_vpe_free(struct its_vpe *vpe)
+{
+    tasklet_kill(&vpe->move_tasklet);
+
+    spin_lock(&vpeid_lock);
+    __clear_bit(vpe->vpeid, vpe_table.vpeid_map);
+    spin_unlock(&vpeid_lock);
+
+    xfree(vpe->vpt);
+    xfree(vpe);
+}
+
+void gicv4_domain_free(struct domain *d)
+{
+    struct vcpu *v;
+    unsigned int i;
+
+    for_each_vcpu ( d, v )
+    {
+        struct its_vpe *vpe = v->arch.vgic.vpe;
+
+        if ( !vpe )
+            continue;
+
+        /* All events are gone already, just drop the vPE. */
+        gicv3_its_map_vpe(d, vpe, false);
+        gicv4_vpe_free(vpe);
+        v->arch.vgic.vpe = NULL;
+    }
+
+    if ( d->arch.vgic.vpe_db_lpis )
+    {
+        for ( i = 0; i < DIV_ROUND_UP(d->max_vcpus, LPI_BLOCK); i++ )
+            if ( d->arch.vgic.vpe_db_lpis[i] )
+                gicv3_free_host_lpi_block(d->arch.vgic.vpe_db_lpis[i]);
+
+        XFREE(d->arch.vgic.vpe_db_lpis);
+    }
+
+    XFREE(d->arch.vgic.vlpi_prop);
+}
+
+/* Runs on the vCPU's new CPU, with its vPE not resident. */
+static void gicv4_vpe_move(void *data)
+{
+    struct its_vpe *vpe = data;
+    unsigned int cpu = smp_processor_id();
+    unsigned long flags;
+
+    if ( vpe->col != cpu )
+    {
+        if ( gicv3_its_move_vpe(vpe, cpu) )
+        {
+            if ( printk_ratelimit() )
+                printk(XENLOG_WARNING "GICv4: cannot move vPE %u to CPU%u\n",
+                       vpe->vpeid, cpu);
+            return;
+        }
+        vpe->col = cpu;
+    }
+
+    local_irq_save(flags);
+    if ( current == vpe->vcpu && !vpe->resident )
+        gicv4_vpe_schedule(vpe->vcpu);
+    local_irq_restore(flags);
+}
+
+int gicv4_vcpu_init(struct vcpu *v)
+{
+    struct domain *d = v->domain;
+    unsigned int vpt_size;
+    struct its_vpe *vpe;
+    unsigned int vpeid;
+    int ret;
+
+    if ( !d->arch.vgic.vlpi_prop )
+        return 0;
+
+    vpe = xzalloc(struct its_vpe);
+    if ( !vpe )
+        return -ENOMEM;
+
+    spin_lock(&vpeid_lock);
+    vpeid = find_first_zero_bit(vpe_table.vpeid_map, vpe_table.nr_vpes);
+    if ( vpeid < vpe_table.nr_vpes )
+        __set_bit(vpeid, vpe_table.vpeid_map);
+    spin_unlock(&vpeid_lock);
+
+    if ( vpeid >= vpe_table.nr_vpes )
+    {
+        xfree(vpe);
+        return -ENOSPC;
+    }
+
+    vpe->vcpu = v;
+    vpe->vpeid = vpeid;
+    vpe->col = v->processor;
+    vpe->db_lpi = d->arch.vgic.vpe_db_lpis[v->vcpu_id / LPI_BLOCK] +
+                  v->vcpu_id % LPI_BLOCK;
+    softirq_tasklet_init(&vpe->move_tasklet, gicv4_vpe_move, vpe);
+
+    /* One pending bit per vINTID, the hardware zeroes nothing for us. */
+    vpt_size = BIT(d->arch.vgic.vlpi_bits, UL) / 8;
+    vpe->vpt = _xzalloc(vpt_size, SZ_64K);
+    if ( !vpe->vpt )
+    {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    clean_and_invalidate_dcache_va_range(vpe->vpt, vpt_size);
+
+    gicv3_lpi_update_host_entry(vpe->db_lpi, d->domain_id,
+                                GICV4_DOORBELL_VLPI(v->vcpu_id));
+
+    ret = gicv3_its_map_vpe(d, vpe, true);
+    if ( ret )
+    {
+        gicv3_lpi_update_host_entry(vpe->db_lpi, d->domain_id, INVALID_LPI);
+        goto fail;
+    }
+
+    v->arch.vgic.vpe = vpe;
+
+    return 0;
+
+fail:
+    gicv4_vpe_free(vpe);
+
+    return ret;
+}
+
+/* Called with interrupts disabled when the vCPU is about to run. */
+void gicv4_vpe_schedule(const struct vcpu *v)
+{
+    struct its_vpe *vpe = v->arch.vgic.vpe;
+
+    if ( !vpe )
+        return;
+
+    /*
+     * The ITS still delivers to the redistributor the vCPU last ran on.
+     * VMOVP is an ITS command, which we can't issue from here, so leave
+     * the vLPIs pending in memory until the tasklet moved the vPE.
+     */
+    if ( vpe->col != smp_processor_id() )
+    {
+        tasklet_schedule(&vpe->move_tasklet);
+        return;
+    }
+
+    writeq_relaxed(GICR_VPENDBASER_VALID | GICR_VPENDBASER_4_1_VGRP1EN |
+                   vpe->vpeid, this_cpu(vlpi_base) + GICR_VPENDBASER);
+    vpe->resident = true;
+}
+
+/* Called with interrupts disabled when the vCPU stops running. */
+void gicv4_vpe_deschedule(struct vcpu *v)
+{
+    struct its_vpe *vpe = v->arch.vgic.vpe;
+    void __iomem *vlpi = this_cpu(vlpi_base);
+    s_time_t deadline = NOW() + MILLISECS(1);
+    bool doorbell;
+    uint64_t reg;
+
+    if ( !vpe || !vpe->resident )
+        return;
+
+    /* Only a blocked vCPU needs waking up when a vLPI arrives. */
+    doorbell = test_bit(_VPF_blocked, &v->pause_flags);
+
+    writeq_relaxed(doorbell ? GICR_VPENDBASER_4_1_DB : 0,
+                   vlpi + GICR_VPENDBASER);
+    vpe->resident = false;
+
+    do {
+        reg = readq_relaxed(vlpi + GICR_VPENDBASER);
+        if ( !(reg & GICR_VPENDBASER_DIRTY) )
+            break;
+
+        cpu_relax();
+        udelay(1);
+    } while ( NOW() <= deadline );
+
+    if ( reg & GICR_VPENDBASER_DIRTY )
+    {
+        if ( printk_ratelimit() )
+            printk(XENLOG_WARNING "GICv4: vPE %u still dirty\n", vpe->vpeid);
+        return;
+    }
+
+    /*
+     * A vLPI which was already pending when the vPE went out won't ring
+     * the doorbell, so don't let the vCPU sleep on it.
+     */
+    if ( doorbell && (reg & GICR_VPENDBASER_PENDING_LAST) )
+        vcpu_unblock(v);
+}
+
+void gicv4_vpe_doorbell(struct domain *d, unsigned int vcpu_id)
+{
+    if ( vcpu_id < d->max_vcpus && d->vcpu[vcpu_id] )
+        vcpu_unblock(d->vcpu[vcpu_id]);
+}
+
+/* The caller is expected to issue an INV for the event afterwards. */
+void gicv4_update_vlpi_property(struct domain *d, uint32_t vlpi,
+                                uint8_t property)
+{
+    uint8_t *prop = d->arch.vgic.vlpi_prop;
+
+    if ( !prop || vlpi < LPI_OFFSET ||
+         vlpi >= BIT(d->arch.vgic.vlpi_bits, UL) )
+        return;
+
+    write_atomic(&prop[vlpi - LPI_OFFSET], property);
+    clean_dcache_va_range(&prop[vlpi - LPI_OFFSET], sizeof(*prop));
+}
+
+int gicv4_vcpu_invall(const struct vcpu *v)
+{
+    if ( !v->arch.vgic.vpe )
+        return 0;
+
+    return gicv3_its_invall_vpe(v->arch.vgic.vpe);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
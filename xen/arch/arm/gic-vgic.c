@@ -11,6 +11,7 @@
 #include <xen/errno.h>
 #include <xen/irq.h>
 #include <xen/lib.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <asm/domain.h>
 #include <asm/gic.h>
@@ -252,6 +253,16 @@ void vgic_sync_from_lrs(struct vcpu *v)
     if ( is_idle_vcpu(v) )
         return;
 
+    /*
+     * Nothing in the LRs, so nothing to sync back. This also means we
+     * didn't ask for an underflow interrupt on the way in.
+     */
+    if ( !this_cpu(lr_mask) )
+    {
+        perfc_incr(vgic_sync_lrs_empty);
+        return;
+    }
+
     gic_hw_ops->update_hcr_status(GICH_HCR_UIE, false);
 
     spin_lock_irqsave(&v->arch.vgic.lock, flags);
@@ -46,8 +46,17 @@ void register_gic_ops(const struct gic_hw_operations *ops)
     gic_hw_ops = ops;
 }
 
+/*
+ * Only the LRs in lr_mask are saved and restored on context switch, so
+ * start off with all of them empty.
+ */
 static void clear_cpu_lr_mask(void)
 {
+    unsigned int i;
+
+    for ( i = 0; i < gic_get_nr_lrs(); i++ )
+        gic_hw_ops->clear_lr(i);
+
     this_cpu(lr_mask) = 0ULL;
 }
 
@@ -77,9 +86,20 @@ void gic_save_state(struct vcpu *v)
 
 void gic_restore_state(struct vcpu *v)
 {
+    uint64_t stale;
+    unsigned int i;
+
     ASSERT(!local_irq_is_enabled());
     ASSERT(!is_idle_vcpu(v));
 
+    /*
+     * The hardware still holds the LRs of the last vCPU which ran here.
+     * Those this vCPU doesn't overwrite must not stay live.
+     */
+    stale = this_cpu(lr_mask) & ~v->arch.lr_mask;
+    for_each_set_bit(i, (const unsigned long *)&stale, gic_get_nr_lrs())
+        gic_hw_ops->clear_lr(i);
+
     this_cpu(lr_mask) = v->arch.lr_mask;
     gic_hw_ops->restore_state(v);
 
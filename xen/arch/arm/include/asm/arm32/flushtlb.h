@@ -43,6 +43,33 @@ TLB_HELPER(flush_all_guests_tlb, TLBIALLNSNHIS, ish);
 /* Flush all hypervisor mappings from the TLB of the local processor. */
 TLB_HELPER(flush_xen_tlb_local, TLBIALLH, nsh);
 
+/*
+ * Flush inner shareable TLBs for a range of IPAs, current VMID only.
+ * The TLBs may hold entries combining stage-1 and stage-2, so the stage-1
+ * entries of the VMID have to go as well.
+ */
+static inline void flush_guest_tlb_range_ipa(paddr_t ipa, unsigned long size)
+{
+    paddr_t end = ipa + size;
+
+    if ( (size >> PAGE_SHIFT) > FLUSH_GUEST_TLB_MAX_OPS )
+    {
+        flush_guest_tlb();
+        return;
+    }
+
+    dsb(ishst);
+    while ( ipa < end )
+    {
+        WRITE_CP32(ipa >> PAGE_SHIFT, TLBIIPAS2IS);
+        ipa += PAGE_SIZE;
+    }
+    dsb(ish);
+    WRITE_CP32(0, TLBIALLIS);
+    dsb(ish);
+    isb();
+}
+
 /* Flush TLB of local processor for address va. */
 static inline void __flush_xen_tlb_one_local(vaddr_t va)
 {
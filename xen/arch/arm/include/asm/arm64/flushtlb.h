@@ -1,6 +1,8 @@
 #ifndef __ASM_ARM_ARM64_FLUSHTLB_H__
 #define __ASM_ARM_ARM64_FLUSHTLB_H__
 
+#include <asm/cpufeature.h>
+
 /*
  * Every invalidation operation use the following patterns:
  *
@@ -81,6 +83,88 @@ TLB_HELPER(flush_all_guests_tlb, alle1is, ish);
 /* Flush all hypervisor mappings from the TLB of the local processor. */
 TLB_HELPER(flush_xen_tlb_local, alle2, nsh);
 
+/* Flush innershareable stage-1 TLBs, current VMID only. */
+TLB_HELPER(flush_guest_tlb_s1, vmalle1is, ish);
+
+/* Flush innershareable stage-2 TLBs for IPA ipa, current VMID only. */
+TLB_HELPER_VA(__flush_guest_tlb_one_ipa, ipas2e1is);
+
+/*
+ * FEAT_TLBIRANGE: a single TLBI RIPAS2E1IS covers (NUM + 1) * 2^(5 * SCALE + 1)
+ * pages. The operand holds the first page (4KB granule, TG = 1), NUM and
+ * SCALE. The instruction is spelt as a SYS for older assemblers.
+ */
+#define TLBI_RANGE_PAGES(num, scale) \
+    ((unsigned long)((num) + 1) << (5 * (scale) + 1))
+#define TLBI_RANGE_MAX_PAGES            TLBI_RANGE_PAGES(31, 3)
+
+static inline void __flush_guest_tlb_range_ipa(paddr_t ipa, unsigned int scale,
+                                               unsigned int num)
+{
+    uint64_t arg = ((ipa >> PAGE_SHIFT) & GENMASK(36, 0)) |
+                   ((uint64_t)num << 39) | ((uint64_t)scale << 44) |
+                   (1UL << 46);
+
+    asm volatile(
+        "sys  #4, c8, c0, #2, %0;"
+        ALTERNATIVE(
+            "nop; nop;",
+            "dsb  ish;"
+            "sys  #4, c8, c0, #2, %0;",
+            ARM64_WORKAROUND_REPEAT_TLBI,
+            CONFIG_ARM64_WORKAROUND_REPEAT_TLBI)
+        : : "r" (arg) : "memory");
+}
+
+/*
+ * Flush innershareable TLBs for a range of IPAs, current VMID only. The
+ * TLBs may hold entries combining stage-1 and stage-2, so the stage-1
+ * entries of the VMID have to go as well.
+ *
+ * With FEAT_TLBIRANGE, the range is split along its set bits: odd pages
+ * one by one, then up to 5 bits worth of pages per SCALE.
+ */
+static inline void flush_guest_tlb_range_ipa(paddr_t ipa, unsigned long size)
+{
+    unsigned long pages = size >> PAGE_SHIFT;
+    bool range = cpus_have_const_cap(ARM_HAS_TLB_RANGE);
+    unsigned int scale = 0;
+
+    if ( range ? pages >= TLBI_RANGE_MAX_PAGES
+               : pages > FLUSH_GUEST_TLB_MAX_OPS )
+    {
+        flush_guest_tlb();
+        return;
+    }
+
+    dsb(ishst);
+    while ( pages )
+    {
+        unsigned int num;
+
+        if ( !range || (pages & 1) )
+        {
+            __flush_guest_tlb_one_ipa(ipa);
+            ipa += PAGE_SIZE;
+            pages--;
+            continue;
+        }
+
+        num = (pages >> (5 * scale + 1)) & 0x1f;
+        if ( num )
+        {
+            __flush_guest_tlb_range_ipa(ipa, scale, num - 1);
+            ipa += TLBI_RANGE_PAGES(num - 1, scale) << PAGE_SHIFT;
+            pages -= TLBI_RANGE_PAGES(num - 1, scale);
+        }
+        scale++;
+    }
+
+    /* The stage-2 invalidation must complete before the stage-1 one. */
+    dsb(ish);
+    flush_guest_tlb_s1();
+}
+
 /* Flush TLB of local processor for address va. */
 TLB_HELPER_VA(__flush_xen_tlb_one_local, vae2);
 
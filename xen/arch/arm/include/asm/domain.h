@@ -51,6 +51,8 @@ struct vtimer {
     struct timer timer;
     register_t ctl;
     uint64_t cval;
+    /* timer is armed on behalf of the descheduled hardware timer */
+    bool sw_armed;
 };
 
 struct paging_domain {
@@ -17,6 +17,12 @@ static inline void page_set_tlbflush_timestamp(struct page_info *page)
     page->tlbflush_timestamp = tlbflush_current_time();
 }
 
+/*
+ * Beyond this many pages, invalidating guest TLB entries one IPA at a time
+ * costs more than flushing the whole VMID.
+ */
+#define FLUSH_GUEST_TLB_MAX_OPS                 512
+
 #if defined(CONFIG_ARM_32)
 # include <asm/arm32/flushtlb.h>
 #elif defined(CONFIG_ARM_64)
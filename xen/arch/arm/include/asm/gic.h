@@ -370,6 +370,8 @@ struct gic_hw_operations {
     void (*clear_lr)(int lr);
     /* Read LR register and populate gic_lr structure */
     void (*read_lr)(int lr, struct gic_lr *);
+    /* Read the mask of LRs which hold no interrupt anymore */
+    uint64_t (*read_elrsr)(void);
     /* Write LR register from gic_lr structure */
     void (*write_lr)(int lr, const struct gic_lr *);
     /* Read VMCR priority */
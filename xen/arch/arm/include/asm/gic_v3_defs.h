@@ -91,6 +91,11 @@
 #define GICR_SYNCR                   (0x00C0)
 #define GICR_PIDR2                   GICD_PIDR2
 
+/* GICv4 redistributors have a VLPI_base frame after SGI_base. */
+#define GICR_VLPI_BASE_OFFSET        (2 * SZ_64K)
+#define GICR_VPROPBASER              (0x0070)
+#define GICR_VPENDBASER              (0x0078)
+
 /* GICR for SGI's & PPI's */
 
 #define GICR_IGROUPR0                (0x0080)
@@ -112,6 +117,8 @@
 #define GICR_TYPER_PLPIS             (1U << 0)
 #define GICR_TYPER_VLPIS             (1U << 1)
 #define GICR_TYPER_LAST              (1U << 4)
+#define GICR_TYPER_RVPEID            (1U << 7)
+#define GICR_TYPER_COMMON_LPI_AFF_MASK (3U << 24)
 #define GICR_TYPER_PROC_NUM_SHIFT    8
 #define GICR_TYPER_PROC_NUM_MASK     (0xffff << GICR_TYPER_PROC_NUM_SHIFT)
 
@@ -158,6 +165,21 @@
         (BIT(63, ULL) | GENMASK_ULL(61, 59) | GENMASK_ULL(55, 52) |  \
          GENMASK_ULL(15, 12) | GENMASK_ULL(6, 0))
 
+/* GICv4.1 layout of GICR_VPROPBASER, which describes the vPE table. */
+#define GICR_VPROPBASER_4_1_VALID                       BIT(63, ULL)
+#define GICR_VPROPBASER_4_1_ENTRY_SIZE_SHIFT            59
+#define GICR_VPROPBASER_4_1_OUTER_CACHEABILITY_SHIFT    56
+#define GICR_VPROPBASER_4_1_PAGE_SIZE_SHIFT             53
+#define GICR_VPROPBASER_4_1_SHAREABILITY_SHIFT          10
+#define GICR_VPROPBASER_4_1_INNER_CACHEABILITY_SHIFT    7
+
+#define GICR_VPENDBASER_VALID                           BIT(63, ULL)
+#define GICR_VPENDBASER_4_1_DB                          BIT(62, ULL)
+#define GICR_VPENDBASER_PENDING_LAST                    BIT(61, ULL)
+#define GICR_VPENDBASER_DIRTY                           BIT(60, ULL)
+#define GICR_VPENDBASER_4_1_VGRP1EN                     BIT(58, ULL)
+#define GICR_VPENDBASER_4_1_VPEID_MASK                  0xffffULL
+
 #define DEFAULT_PMR_VALUE            0xff
 
 #define LPI_PROP_PRIO_MASK           0xfc
@@ -43,6 +43,9 @@
 #define GITS_CTLR_QUIESCENT             BIT(31, UL)
 #define GITS_CTLR_ENABLE                BIT(0, UL)
 
+#define GITS_TYPER_SVPET_MASK           (3UL << 41)
+#define GITS_TYPER_VMAPP                BIT(40, UL)
+#define GITS_TYPER_VMOVP                BIT(37, UL)
 #define GITS_TYPER_PTA                  BIT(19, UL)
 #define GITS_TYPER_DEVIDS_SHIFT         13
 #define GITS_TYPER_DEVIDS_MASK          (0x1fUL << GITS_TYPER_DEVIDS_SHIFT)
@@ -58,6 +61,7 @@
 #define GITS_TYPER_ITT_SIZE_MASK        (0xfUL << GITS_TYPER_ITT_SIZE_SHIFT)
 #define GITS_TYPER_ITT_SIZE(r)          ((((r) & GITS_TYPER_ITT_SIZE_MASK) >> \
                                                  GITS_TYPER_ITT_SIZE_SHIFT) + 1)
+#define GITS_TYPER_VLPIS                (1U << 1)
 #define GITS_TYPER_PHYSICAL             (1U << 0)
 
 #define GITS_BASER_INDIRECT             BIT(62, UL)
@@ -100,12 +104,26 @@
 #define GITS_CMD_INVALL                 0x0d
 #define GITS_CMD_MOVALL                 0x0e
 #define GITS_CMD_DISCARD                0x0f
+#define GITS_CMD_VMOVI                  0x21
+#define GITS_CMD_VMOVP                  0x22
+#define GITS_CMD_VSYNC                  0x25
+#define GITS_CMD_VMAPP                  0x29
+#define GITS_CMD_VMAPTI                 0x2a
+#define GITS_CMD_VINVALL                0x2d
+
+#define GITS_VMAPP_ALLOC                BIT(8, UL)
+#define GITS_VMAPP_PTZ                  BIT(9, UL)
+#define GITS_VMOVP_DB                   BIT(63, UL)
+
+/* No per-event doorbell: GICv4.1 uses the vPE's default doorbell. */
+#define GITS_NO_DOORBELL                1023
 
 #define ITS_DOORBELL_OFFSET             0x10040
 #define GICV3_ITS_SIZE                  SZ_128K
 
 #include <xen/device_tree.h>
 #include <xen/rbtree.h>
+#include <xen/tasklet.h>
 
 #define HOST_ITS_FLUSH_CMD_QUEUE        (1U << 0)
 #define HOST_ITS_USES_PTA               (1U << 1)
@@ -128,6 +146,45 @@ struct host_its {
     unsigned int flags;
 };
 
+/*
+ * Host ITS commands are collected in a batch and handed over to the ITS a
+ * number at a time. Completing the batch queues a single SYNC (and VSYNC)
+ * covering all of them and waits for the ITS just once.
+ */
+#define ITS_CMD_BATCH_NR                32
+
+struct its_cmd_batch {
+    struct host_its *its;               /* ITS the commands go to */
+    unsigned int nr;                    /* Commands not handed over yet */
+    int sync_cpu;                       /* Redistributor to SYNC, or -1 */
+    int vsync_vpeid;                    /* vPE to VSYNC, or -1 */
+    int ret;                            /* First error, reported on completion */
+    uint64_t cmds[ITS_CMD_BATCH_NR][4];
+};
+
+#ifdef CONFIG_GICV4
+/*
+ * A vCPU as known to GICv4.1 hardware: a vPE. The ITS translates events
+ * mapped with VMAPTI into virtual LPIs for it, which the redistributor
+ * delivers directly while the vPE is resident there.
+ */
+struct its_vpe {
+    struct vcpu *vcpu;
+    void *vpt;                          /* Virtual pending table */
+    uint32_t db_lpi;                    /* Host LPI used as doorbell */
+    uint16_t vpeid;
+    unsigned int col;                   /* CPU the ITS delivers vLPIs to */
+    bool resident;
+    struct tasklet move_tasklet;        /* Issues VMOVP on the new CPU */
+};
+#endif
+
+/*
+ * Host LPIs used as GICv4.1 doorbells are recorded with a virtual LPI
+ * below LPI_OFFSET, which encodes the vCPU to wake up.
+ */
+#define GICV4_DOORBELL_VLPI(vcpu_id)    ((vcpu_id) + 1)
+
 
 #ifdef CONFIG_HAS_ITS
 
@@ -160,6 +217,9 @@ uint64_t gicv3_get_redist_address(unsigned int cpu, bool use_pta);
 /* Map a collection for this host CPU to each host ITS. */
 int gicv3_its_setup_collection(unsigned int cpu);
 
+void gicv3_its_batch_init(struct its_cmd_batch *batch);
+int gicv3_its_batch_complete(struct its_cmd_batch *batch);
+
 /* Initialize and destroy the per-domain parts of the virtual ITS support. */
 int vgic_v3_its_init_domain(struct domain *d);
 void vgic_v3_its_free_domain(struct domain *d);
@@ -188,8 +248,9 @@ struct pending_irq *gicv3_its_get_event_pending_irq(struct domain *d,
                                                     paddr_t vdoorbell_address,
                                                     uint32_t vdevid,
                                                     uint32_t eventid);
-int gicv3_remove_guest_event(struct domain *d, paddr_t vdoorbell_address,
-                                     uint32_t vdevid, uint32_t eventid);
+int gicv3_remove_guest_event(struct its_cmd_batch *batch,
+                             struct domain *d, paddr_t vdoorbell_address,
+                             uint32_t vdevid, uint32_t eventid);
 struct pending_irq *gicv3_assign_guest_event(struct domain *d, paddr_t doorbell,
                                              uint32_t devid, uint32_t eventid,
                                              uint32_t virt_lpi);
@@ -271,6 +332,125 @@ static inline int gicv3_its_make_hwdom_dt_nodes(const struct domain *d,
 
 #endif /* CONFIG_HAS_ITS */
 
+#ifdef CONFIG_GICV4
+
+/* Set up the vPE table for a host ITS, returns non-zero if not using GICv4. */
+int gicv4_its_init(struct host_its *hw_its, void __iomem *basereg,
+                   uint64_t regc);
+void gicv4_rdist_init(void __iomem *rdist_base, uint64_t typer);
+
+int gicv4_domain_init(struct domain *d);
+void gicv4_domain_free(struct domain *d);
+int gicv4_vcpu_init(struct vcpu *v);
+
+void gicv4_vpe_schedule(const struct vcpu *v);
+void gicv4_vpe_deschedule(struct vcpu *v);
+void gicv4_vpe_doorbell(struct domain *d, unsigned int vcpu_id);
+
+void gicv4_update_vlpi_property(struct domain *d, uint32_t vlpi,
+                                uint8_t property);
+
+#define gicv4_domain_has_vlpis(d)   ((d)->arch.vgic.vlpi_prop != NULL)
+
+int gicv4_vcpu_invall(const struct vcpu *v);
+
+/* ITS commands for vPEs and for events mapped to virtual LPIs. */
+int gicv3_its_map_vpe(const struct domain *d, const struct its_vpe *vpe,
+                      bool valid);
+int gicv3_its_move_vpe(const struct its_vpe *vpe, unsigned int cpu);
+int gicv3_its_invall_vpe(const struct its_vpe *vpe);
+int gicv3_its_map_vlpi(struct its_cmd_batch *batch,
+                       struct domain *d, paddr_t vdoorbell_address,
+                       uint32_t vdevid, uint32_t eventid,
+                       const struct vcpu *v, uint32_t virt_lpi);
+int gicv3_its_move_vlpi(struct its_cmd_batch *batch,
+                        struct domain *d, paddr_t vdoorbell_address,
+                        uint32_t vdevid, uint32_t eventid,
+                        const struct vcpu *v);
+int gicv3_its_inv_vlpi(struct its_cmd_batch *batch,
+                       struct domain *d, paddr_t vdoorbell_address,
+                       uint32_t vdevid, uint32_t eventid,
+                       const struct vcpu *v);
+
+#else
+
+static inline int gicv4_its_init(struct host_its *hw_its,
+                                 void __iomem *basereg, uint64_t regc)
+{
+    return -ENODEV;
+}
+
+static inline void gicv4_rdist_init(void __iomem *rdist_base, uint64_t typer)
+{
+}
+
+static inline int gicv4_domain_init(struct domain *d)
+{
+    return 0;
+}
+
+static inline void gicv4_domain_free(struct domain *d)
+{
+}
+
+static inline int gicv4_vcpu_init(struct vcpu *v)
+{
+    return 0;
+}
+
+static inline void gicv4_vpe_schedule(const struct vcpu *v)
+{
+}
+
+static inline void gicv4_vpe_deschedule(struct vcpu *v)
+{
+}
+
+static inline void gicv4_vpe_doorbell(struct domain *d, unsigned int vcpu_id)
+{
+}
+
+static inline void gicv4_update_vlpi_property(struct domain *d, uint32_t vlpi,
+                                              uint8_t property)
+{
+}
+
+#define gicv4_domain_has_vlpis(d)   false
+
+static inline int gicv4_vcpu_invall(const struct vcpu *v)
+{
+    return 0;
+}
+
+static inline int gicv3_its_map_vlpi(struct its_cmd_batch *batch,
+                                     struct domain *d,
+                                     paddr_t vdoorbell_address,
+                                     uint32_t vdevid, uint32_t eventid,
+                                     const struct vcpu *v, uint32_t virt_lpi)
+{
+    return -EOPNOTSUPP;
+}
+
+static inline int gicv3_its_move_vlpi(struct its_cmd_batch *batch,
+                                      struct domain *d,
+                                      paddr_t vdoorbell_address,
+                                      uint32_t vdevid, uint32_t eventid,
+                                      const struct vcpu *v)
+{
+    return -EOPNOTSUPP;
+}
+
+static inline int gicv3_its_inv_vlpi(struct its_cmd_batch *batch,
+                                     struct domain *d,
+                                     paddr_t vdoorbell_address,
+                                     uint32_t vdevid, uint32_t eventid,
+                                     const struct vcpu *v)
+{
+    return -EOPNOTSUPP;
+}
+
+#endif /* CONFIG_GICV4 */
+
 #endif
 
 /*
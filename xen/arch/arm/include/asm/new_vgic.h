@@ -161,6 +161,8 @@ struct vgic_cpu {
     spinlock_t ap_list_lock;    /* Protects the ap_list */
 
     unsigned int used_lrs;
+    /* vINTID in each used LR, so that empty ones need not be read back. */
+    uint32_t lr_intid[64];
 
     /*
      * List of IRQs that this VCPU should consider because they are either
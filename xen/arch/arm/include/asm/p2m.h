@@ -69,8 +69,12 @@ struct p2m_domain {
      *
      * If an immediate flush is required (e.g, if a super page is
      * shattered), call p2m_tlb_flush_sync().
+     *
+     * [flush_start, flush_end) covers the GFNs the deferred flush is for,
+     * so that it can invalidate by IPA rather than the whole VMID.
      */
     bool need_flush;
+    gfn_t flush_start, flush_end;
 
     /* Gather some statistics for information purposes only */
     struct {
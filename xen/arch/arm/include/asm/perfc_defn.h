@@ -48,6 +48,8 @@ PERFCOUNTER(vgic_sgi_list  ,            "vgic: SGI send to list")
 PERFCOUNTER(vgic_sgi_others,            "vgic: SGI send to others")
 PERFCOUNTER(vgic_sgi_self,              "vgic: SGI send to self")
 PERFCOUNTER(vgic_irq_migrates,          "vgic: irq migration")
+PERFCOUNTER(vgic_sync_lrs_empty,        "vgic: no LR to sync back")
+PERFCOUNTER(vgic_lrs_empty_skipped,     "vgic: empty LR not read back")
 
 PERFCOUNTER(vuart_reads,  "vuart: read")
 PERFCOUNTER(vuart_writes, "vuart: write")
@@ -71,6 +73,7 @@ PERFCOUNTER(guest_irqs,           "#GUEST-IRQS")
 
 PERFCOUNTER(hyp_timer_irqs,   "Hypervisor timer interrupts")
 PERFCOUNTER(virt_timer_irqs,  "Virtual timer interrupts")
+PERFCOUNTER(phys_timer_irqs,  "Physical timer interrupts")
 PERFCOUNTER(maintenance_irqs, "Maintenance interrupts")
 
 PERFCOUNTER(atomics_guest,    "atomics: guest access")
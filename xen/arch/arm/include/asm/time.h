@@ -92,6 +92,9 @@ enum timer_ppi
  */
 extern uint32_t timer_dt_clock_frequency;
 
+/* Whether the guests program the EL1 physical timer without trapping. */
+extern bool opt_vtimer_phys_passthrough;
+
 /* Get one of the timer IRQ number */
 unsigned int timer_get_irq(enum timer_ppi ppi);
 
@@ -179,6 +179,11 @@ struct vgic_dist {
     bool rdists_enabled;                /* Is any redistributor enabled? */
     bool has_its;
 #endif
+#ifdef CONFIG_GICV4
+    uint8_t *vlpi_prop;                 /* vLPI configuration table (VConf) */
+    unsigned int vlpi_bits;             /* vINTID bits handled in hardware */
+    uint32_t *vpe_db_lpis;              /* Doorbell LPI blocks, one per 32 vCPUs */
+#endif
 };
 
 struct vgic_cpu {
@@ -212,6 +217,9 @@ struct vgic_cpu {
 #define VGIC_V3_RDIST_LAST      (1 << 0)        /* last vCPU of the rdist */
 #define VGIC_V3_LPIS_ENABLED    (1 << 1)
     uint8_t flags;
+#ifdef CONFIG_GICV4
+    struct its_vpe *vpe;                /* NULL unless vLPIs are direct */
+#endif
 };
 
 struct sgi_target {
@@ -16,7 +16,6 @@
 #include <xen/vmap.h>
 
 #include <asm/byteorder.h>
-#include <asm/fixmap.h>
 #include <asm/kernel.h>
 #include <asm/setup.h>
 
@@ -46,21 +45,29 @@ struct minimal_dtb_header {
  * @dst: destination virtual address
  * @paddr: source physical address
  * @len: length to copy
+ *
+ * The source is mapped a chunk at a time in the vmap area, rather than in a
+ * fixmap slot, so that domains can be built on several CPUs at once.
  */
+#define COPY_CHUNK_SIZE MB(2)
+
 void __init copy_from_paddr(void *dst, paddr_t paddr, unsigned long len)
 {
-    void *src = (void *)FIXMAP_ADDR(FIXMAP_MISC);
-
-    while (len) {
+    while ( len )
+    {
         unsigned long l, s;
+        void *src;
+
+        s = paddr & (PAGE_SIZE - 1);
+        l = min_t(unsigned long, COPY_CHUNK_SIZE - s, len);
 
-        s = paddr & (PAGE_SIZE-1);
-        l = min(PAGE_SIZE - s, len);
+        src = (void __force *)ioremap_wc(paddr - s, PAGE_ALIGN(s + l));
+        if ( !src )
+            panic("Unable to map %#"PRIpaddr" for copying\n", paddr);
 
-        set_fixmap(FIXMAP_MISC, maddr_to_mfn(paddr), PAGE_HYPERVISOR_WC);
         memcpy(dst, src + s, l);
         clean_dcache_va_range(dst, l);
-        clear_fixmap(FIXMAP_MISC);
+        iounmap((void __iomem *)src);
 
         paddr += l;
         dst += l;
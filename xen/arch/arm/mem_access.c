@@ -389,6 +389,12 @@ long p2m_set_mem_access(struct domain *d, gfn_t gfn, uint32_t nr,
         return 0;
     }
 
+    /*
+     * Have at least the first insertion into mem_access_settings not
+     * allocate nodes under the p2m lock.
+     */
+    radix_tree_preload();
+
     p2m_write_lock(p2m);
 
     for ( gfn = gfn_add(gfn, start); nr > start;
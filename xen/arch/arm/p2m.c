@@ -294,16 +294,48 @@ void p2m_restore_state(struct vcpu *n)
 }
 
 /*
- * Force a synchronous P2M TLB flush.
+ * Defer the TLB flush for [gfn, gfn + nr) until the P2M write lock is
+ * released. Ranges accumulate: the flush covers the span of all of them.
+ */
+static void p2m_defer_tlb_flush(struct p2m_domain *p2m, gfn_t gfn,
+                                unsigned long nr)
+{
+    gfn_t end = gfn_add(gfn, nr);
+
+    if ( !p2m->need_flush )
+    {
+        p2m->flush_start = gfn;
+        p2m->flush_end = end;
+        p2m->need_flush = true;
+    }
+    else
+    {
+        p2m->flush_start = gfn_min(p2m->flush_start, gfn);
+        p2m->flush_end = gfn_max(p2m->flush_end, end);
+    }
+}
+
+/* Defer a flush of all the TLB entries of the P2M. */
+static void p2m_defer_full_tlb_flush(struct p2m_domain *p2m)
+{
+    p2m->flush_start = _gfn(0);
+    p2m->flush_end = INVALID_GFN;
+    p2m->need_flush = true;
+}
+
+/*
+ * Synchronously flush the deferred range of the P2M TLB entries.
  *
  * Must be called with the p2m lock held.
  */
-static void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
+static void p2m_flush_deferred_tlb(struct p2m_domain *p2m)
 {
     unsigned long flags = 0;
+    unsigned long nr = gfn_x(p2m->flush_end) - gfn_x(p2m->flush_start);
     uint64_t ovttbr;
 
     ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(p2m->need_flush);
 
     /*
      * ARM only provides an instruction to flush TLBs for the current
@@ -333,7 +365,11 @@ static void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
         isb();
     }
 
-    flush_guest_tlb();
+    if ( gfn_eq(p2m->flush_end, INVALID_GFN) )
+        flush_guest_tlb();
+    else
+        flush_guest_tlb_range_ipa(gfn_to_gaddr(p2m->flush_start),
+                                  nr << PAGE_SHIFT);
 
     if ( ovttbr != READ_SYSREG64(VTTBR_EL2) )
     {
@@ -346,10 +382,34 @@ static void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
     p2m->need_flush = false;
 }
 
+/*
+ * Force a synchronous P2M TLB flush.
+ *
+ * Must be called with the p2m lock held.
+ */
+static void p2m_force_tlb_flush_sync(struct p2m_domain *p2m)
+{
+    p2m_defer_full_tlb_flush(p2m);
+    p2m_flush_deferred_tlb(p2m);
+}
+
+/*
+ * Force a synchronous flush of the P2M TLB entries for [gfn, gfn + nr),
+ * along with any flush deferred so far.
+ *
+ * Must be called with the p2m lock held.
+ */
+static void p2m_force_tlb_flush_range_sync(struct p2m_domain *p2m, gfn_t gfn,
+                                           unsigned long nr)
+{
+    p2m_defer_tlb_flush(p2m, gfn, nr);
+    p2m_flush_deferred_tlb(p2m);
+}
+
 void p2m_tlb_flush_sync(struct p2m_domain *p2m)
 {
     if ( p2m->need_flush )
-        p2m_force_tlb_flush_sync(p2m);
+        p2m_flush_deferred_tlb(p2m);
 }
 
 /*
@@ -1082,6 +1142,8 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
     {
         /* We need to split the original page. */
         lpae_t split_pte = *entry;
+        unsigned int order = XEN_PT_LEVEL_ORDER(level);
+        gfn_t base = _gfn(gfn_x(sgfn) & ~(BIT(order, UL) - 1));
 
         ASSERT(p2m_is_superpage(*entry, level));
 
@@ -1105,7 +1167,7 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
          * For more details see (D4.7.1 in ARM DDI 0487A.j).
          */
         p2m_remove_pte(entry, p2m->clean_pte);
-        p2m_force_tlb_flush_sync(p2m);
+        p2m_force_tlb_flush_range_sync(p2m, base, BIT(order, UL));
 
         p2m_write_pte(entry, split_pte, p2m->clean_pte);
 
@@ -1161,8 +1223,11 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
         p2m_remove_pte(entry, p2m->clean_pte);
 
     if ( removing_mapping )
+    {
         /* Flush can be deferred if the entry is removed */
-        p2m->need_flush |= !!lpae_is_valid(orig_pte);
+        if ( lpae_is_valid(orig_pte) )
+            p2m_defer_tlb_flush(p2m, sgfn, BIT(page_order, UL));
+    }
     else
     {
         lpae_t pte = mfn_to_p2m_entry(smfn, t, a);
@@ -1181,9 +1246,10 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
         {
             if ( likely(!p2m->mem_access_enabled) ||
                  P2M_CLEAR_PERM(pte) != P2M_CLEAR_PERM(orig_pte) )
-                p2m_force_tlb_flush_sync(p2m);
+                p2m_force_tlb_flush_range_sync(p2m, sgfn,
+                                               BIT(page_order, UL));
             else
-                p2m->need_flush = true;
+                p2m_defer_tlb_flush(p2m, sgfn, BIT(page_order, UL));
         }
         else if ( !p2m_is_valid(orig_pte) ) /* new mapping */
             p2m->stats.mappings[level]++;
@@ -1217,7 +1283,12 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
      */
     if ( p2m_is_valid(orig_pte) &&
          !mfn_eq(lpae_get_mfn(*entry), lpae_get_mfn(orig_pte)) )
+    {
+        /* Pages may be freed: no flush of theirs may still be deferred. */
+        if ( !rc )
+            rc = iommu_iotlb_batch_flush();
         p2m_free_entry(p2m, orig_pte, level);
+    }
 
 out:
     unmap_domain_page(table);
@@ -1252,18 +1323,23 @@ int p2m_set_entry(struct p2m_domain *p2m,
          * Don't take into account the MFN when removing mapping (i.e
          * MFN_INVALID) to calculate the correct target order.
          *
-         * XXX: Support superpage mappings if nr is not aligned to a
-         * superpage size.
+         * The size of the region doesn't need to be a multiple of a
+         * superpage: use the biggest mapping which both addresses are
+         * aligned to and which fits in what is left, so that a region
+         * which isn't a multiple of 1GB still gets 1GB mappings for the
+         * bulk of it.
          */
         mask = !mfn_eq(smfn, INVALID_MFN) ? mfn_x(smfn) : 0;
-        mask |= gfn_x(sgfn) | nr;
+        mask |= gfn_x(sgfn);
 
         /* Always map 4k by 4k when memaccess is enabled */
         if ( unlikely(p2m->mem_access_enabled) )
             order = THIRD_ORDER;
-        else if ( !(mask & ((1UL << FIRST_ORDER) - 1)) )
+        else if ( !(mask & ((1UL << FIRST_ORDER) - 1)) &&
+                  nr >= (1UL << FIRST_ORDER) )
             order = FIRST_ORDER;
-        else if ( !(mask & ((1UL << SECOND_ORDER) - 1)) )
+        else if ( !(mask & ((1UL << SECOND_ORDER) - 1)) &&
+                  nr >= (1UL << SECOND_ORDER) )
             order = SECOND_ORDER;
         else
             order = THIRD_ORDER;
@@ -1311,7 +1387,7 @@ static void p2m_invalidate_table(struct p2m_domain *p2m, mfn_t mfn)
 
     unmap_domain_page(table);
 
-    p2m->need_flush = true;
+    p2m_defer_full_tlb_flush(p2m);
 }
 
 /*
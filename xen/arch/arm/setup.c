@@ -714,35 +714,17 @@ static paddr_t __init next_module(paddr_t s, paddr_t *end)
 static void __init init_pdx(void)
 {
     paddr_t bank_start, bank_size, bank_end;
-
-    /*
-     * Arm does not have any restrictions on the bits to compress. Pass 0 to
-     * let the common code further restrict the mask.
-     *
-     * If the logic changes in pfn_pdx_hole_setup we might have to
-     * update this function too.
-     */
-    uint64_t mask = pdx_init_mask(0x0);
     int bank;
 
     for ( bank = 0 ; bank < bootinfo.mem.nr_banks; bank++ )
-    {
-        bank_start = bootinfo.mem.bank[bank].start;
-        bank_size = bootinfo.mem.bank[bank].size;
-
-        mask |= bank_start | pdx_region_mask(bank_start, bank_size);
-    }
-
-    for ( bank = 0 ; bank < bootinfo.mem.nr_banks; bank++ )
-    {
-        bank_start = bootinfo.mem.bank[bank].start;
-        bank_size = bootinfo.mem.bank[bank].size;
+        pfn_pdx_add_region(bootinfo.mem.bank[bank].start,
+                           bootinfo.mem.bank[bank].size);
 
-        if (~mask & pdx_region_mask(bank_start, bank_size))
-            mask = 0;
-    }
-
-    pfn_pdx_hole_setup(mask >> PAGE_SHIFT);
+    /*
+     * Arm does not have any restrictions on the addresses to compress.
+     * Pass 0 to let the common code apply its own restrictions.
+     */
+    pfn_pdx_compression_setup(0);
 
     for ( bank = 0 ; bank < bootinfo.mem.nr_banks; bank++ )
     {
@@ -18,6 +18,11 @@ void arch_do_physinfo(struct xen_sysctl_physinfo *pi)
     pi->capabilities |= XEN_SYSCTL_PHYSCAP_hvm | XEN_SYSCTL_PHYSCAP_hap;
 }
 
+void arch_get_vcpu_stats(const struct vcpu *v,
+                         struct xen_sysctl_vcpu_stats *stats)
+{
+}
+
 long arch_do_sysctl(struct xen_sysctl *sysctl,
                     XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
@@ -159,6 +159,8 @@ struct optee_shm_buf {
 /* Domain context */
 struct optee_domain {
     struct list_head call_list;
+    /* Completed call contexts, kept with their xen_arg_pg for reuse */
+    struct list_head free_call_list;
     struct list_head shm_rpc_list;
     struct list_head optee_shm_buf_list;
     atomic_t call_count;
@@ -256,6 +258,7 @@ static int optee_domain_init(struct domain *d)
     }
 
     INIT_LIST_HEAD(&ctx->call_list);
+    INIT_LIST_HEAD(&ctx->free_call_list);
     INIT_LIST_HEAD(&ctx->shm_rpc_list);
     INIT_LIST_HEAD(&ctx->optee_shm_buf_list);
     atomic_set(&ctx->call_count, 0);
@@ -310,11 +313,34 @@ static struct optee_std_call *allocate_std_call(struct optee_domain *ctx)
     if ( count == max_optee_threads )
         return ERR_PTR(-ENOSPC);
 
-    call = xzalloc(struct optee_std_call);
-    if ( !call )
+    /*
+     * Reuse the context of a completed call if there is one, saving the
+     * allocation and freeing of the context and of its shadow argument
+     * page on every call. There can't be more than max_optee_threads
+     * contexts cached, as this is the limit of calls in flight.
+     */
+    spin_lock(&ctx->lock);
+    call = list_first_entry_or_null(&ctx->free_call_list,
+                                    struct optee_std_call, list);
+    if ( call )
+        list_del(&call->list);
+    spin_unlock(&ctx->lock);
+
+    if ( call )
     {
-        atomic_dec(&ctx->call_count);
-        return ERR_PTR(-ENOMEM);
+        struct page_info *xen_arg_pg = call->xen_arg_pg;
+
+        memset(call, 0, sizeof(*call));
+        call->xen_arg_pg = xen_arg_pg;
+    }
+    else
+    {
+        call = xzalloc(struct optee_std_call);
+        if ( !call )
+        {
+            atomic_dec(&ctx->call_count);
+            return ERR_PTR(-ENOMEM);
+        }
     }
 
     call->optee_thread_id = -1;
@@ -328,18 +354,22 @@ static struct optee_std_call *allocate_std_call(struct optee_domain *ctx)
     return call;
 }
 
+/* Complete a call, keeping its context for the next one. */
 static void free_std_call(struct optee_domain *ctx,
                           struct optee_std_call *call)
 {
     atomic_dec(&ctx->call_count);
 
-    spin_lock(&ctx->lock);
-    list_del(&call->list);
-    spin_unlock(&ctx->lock);
-
     ASSERT(!call->in_flight);
     ASSERT(!call->xen_arg);
 
+    spin_lock(&ctx->lock);
+    list_move(&call->list, &ctx->free_call_list);
+    spin_unlock(&ctx->lock);
+}
+
+static void destroy_std_call(struct optee_std_call *call)
+{
     if ( call->xen_arg_pg )
         free_domheap_page(call->xen_arg_pg);
 
@@ -657,6 +687,12 @@ static int optee_relinquish_resources(struct domain *d)
     list_for_each_entry_safe( call, call_tmp, &ctx->call_list, list )
         free_std_call(ctx, call);
 
+    list_for_each_entry_safe( call, call_tmp, &ctx->free_call_list, list )
+    {
+        list_del(&call->list);
+        destroy_std_call(call);
+    }
+
     if ( hypercall_preempt_check() )
         return -ERESTART;
 
@@ -942,7 +978,9 @@ static bool copy_std_request(struct cpu_user_regs *regs,
 
     BUILD_BUG_ON(OPTEE_MSG_NONCONTIG_PAGE_SIZE > PAGE_SIZE);
 
-    call->xen_arg_pg = alloc_domheap_page(NULL, 0);
+    /* A reused call context already has its page. */
+    if ( !call->xen_arg_pg )
+        call->xen_arg_pg = alloc_domheap_page(NULL, 0);
     if ( !call->xen_arg_pg )
     {
         set_user_reg(regs, 0, OPTEE_SMC_RETURN_ENOMEM);
@@ -22,6 +22,7 @@
 #include <xen/acpi.h>
 #include <xen/cpu.h>
 #include <xen/notifier.h>
+#include <xen/param.h>
 #include <asm/system.h>
 #include <asm/time.h>
 #include <asm/vgic.h>
@@ -36,6 +37,14 @@ unsigned long __read_mostly cpu_khz;  /* CPU clock frequency in kHz. */
 
 uint32_t __read_mostly timer_dt_clock_frequency;
 
+/*
+ * Let the guests program the EL1 physical timer directly. Xen doesn't use
+ * it, and the guests see the physical counter without any offset, so it
+ * only needs to be context switched like the virtual timer.
+ */
+bool __read_mostly opt_vtimer_phys_passthrough = true;
+boolean_param("vtimer-phys-passthrough", opt_vtimer_phys_passthrough);
+
 static unsigned int timer_irq[MAX_TIMER_PPI];
 
 unsigned int timer_get_irq(enum timer_ppi ppi)
@@ -265,6 +274,19 @@ static void vtimer_interrupt(int irq, void *dev_id, struct cpu_user_regs *regs)
     vgic_inject_irq(current->domain, current, current->arch.virt_timer.irq, true);
 }
 
+static void ptimer_interrupt(int irq, void *dev_id, struct cpu_user_regs *regs)
+{
+    /* See vtimer_interrupt(). */
+    if ( unlikely(is_idle_vcpu(current)) )
+        return;
+
+    perfc_incr(phys_timer_irqs);
+
+    current->arch.phys_timer.ctl = READ_SYSREG(CNTP_CTL_EL0);
+    WRITE_SYSREG(current->arch.phys_timer.ctl | CNTx_CTL_MASK, CNTP_CTL_EL0);
+    vgic_inject_irq(current->domain, current, current->arch.phys_timer.irq, true);
+}
+
 /*
  * Arch timer interrupt really ought to be level triggered, since the
  * design of the timer/comparator mechanism is based around that
@@ -296,8 +318,13 @@ void init_timer_interrupt(void)
 {
     /* Sensible defaults */
     WRITE_SYSREG64(0, CNTVOFF_EL2);     /* No VM-specific offset */
-    /* Do not let the VMs program the physical timer, only read the physical counter */
-    WRITE_SYSREG(CNTHCTL_EL2_EL1PCTEN, CNTHCTL_EL2);
+    /*
+     * Let the VMs read the physical counter. Unless it is passed through,
+     * programming the physical timer traps and is emulated.
+     */
+    WRITE_SYSREG(CNTHCTL_EL2_EL1PCTEN |
+                 (opt_vtimer_phys_passthrough ? CNTHCTL_EL2_EL1PCEN : 0),
+                 CNTHCTL_EL2);
     WRITE_SYSREG(0, CNTP_CTL_EL0);    /* Physical timer disabled */
     WRITE_SYSREG(0, CNTHP_CTL_EL2);   /* Hypervisor's timer disabled */
     isb();
@@ -306,6 +333,9 @@ void init_timer_interrupt(void)
                 "hyptimer", NULL);
     request_irq(timer_irq[TIMER_VIRT_PPI], 0, vtimer_interrupt,
                    "virtimer", NULL);
+    if ( opt_vtimer_phys_passthrough )
+        request_irq(timer_irq[TIMER_PHYS_NONSECURE_PPI], 0, ptimer_interrupt,
+                    "phystimer", NULL);
 
     check_timer_irq_cfg(timer_irq[TIMER_HYP_PPI], "hypervisor");
     check_timer_irq_cfg(timer_irq[TIMER_VIRT_PPI], "virtual");
@@ -324,6 +354,8 @@ static void deinit_timer_interrupt(void)
 
     release_irq(timer_irq[TIMER_HYP_PPI], NULL);
     release_irq(timer_irq[TIMER_VIRT_PPI], NULL);
+    if ( opt_vtimer_phys_passthrough )
+        release_irq(timer_irq[TIMER_PHYS_NONSECURE_PPI], NULL);
 }
 
 /* Wait a set number of microseconds */
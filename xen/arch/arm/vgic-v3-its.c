@@ -410,6 +410,8 @@ static int update_lpi_property(struct domain *d, struct pending_irq *p)
     if ( ret )
         return ret;
 
+    gicv4_update_vlpi_property(d, p->irq, property);
+
     write_atomic(&p->lpi_priority, property & LPI_PROP_PRIO_MASK);
 
     if ( property & LPI_PROP_ENABLED )
@@ -442,7 +444,8 @@ static void update_lpi_vgic_status(struct vcpu *v, struct pending_irq *p)
         gic_remove_from_lr_pending(v, p);
 }
 
-static int its_handle_inv(struct virt_its *its, uint64_t *cmdptr)
+static int its_handle_inv(struct virt_its *its, uint64_t *cmdptr,
+                          struct its_cmd_batch *batch)
 {
     struct domain *d = its->d;
     uint32_t devid = its_cmd_get_deviceid(cmdptr);
@@ -493,6 +496,11 @@ out_unlock:
 out_unlock_its:
     spin_unlock(&its->its_lock);
 
+    /* A directly injected vLPI needs the ITS to reread its VConf entry. */
+    if ( !ret && gicv4_domain_has_vlpis(d) )
+        ret = gicv3_its_inv_vlpi(batch, d, its->doorbell_address, devid,
+                                 eventid, vcpu);
+
     return ret;
 }
 
@@ -569,12 +577,21 @@ static int its_handle_invall(struct virt_its *its, uint64_t *cmdptr)
     read_unlock(&its->d->arch.vgic.pend_lpi_tree_lock);
     spin_unlock_irqrestore(&vcpu->arch.vgic.lock, flags);
 
+    if ( gicv4_domain_has_vlpis(its->d) )
+    {
+        int err = gicv4_vcpu_invall(vcpu);
+
+        if ( err )
+            ret = err;
+    }
+
     return ret;
 }
 
 /* Must be called with the ITS lock held. */
 static int its_discard_event(struct virt_its *its,
-                             uint32_t vdevid, uint32_t vevid)
+                             uint32_t vdevid, uint32_t vevid,
+                             struct its_cmd_batch *batch)
 {
     struct pending_irq *p;
     unsigned long flags;
@@ -615,11 +632,12 @@ static int its_discard_event(struct virt_its *its,
     spin_unlock_irqrestore(&vcpu->arch.vgic.lock, flags);
 
     /* Remove the corresponding host LPI entry */
-    return gicv3_remove_guest_event(its->d, its->doorbell_address,
+    return gicv3_remove_guest_event(batch, its->d, its->doorbell_address,
                                     vdevid, vevid);
 }
 
-static void its_unmap_device(struct virt_its *its, uint32_t devid)
+static void its_unmap_device(struct virt_its *its, uint32_t devid,
+                             struct its_cmd_batch *batch)
 {
     dev_table_entry_t itt;
     uint64_t evid;
@@ -639,13 +657,14 @@ static void its_unmap_device(struct virt_its *its, uint32_t devid)
 
     for ( evid = 0; evid < DEV_TABLE_ITT_SIZE(itt); evid++ )
         /* Don't care about errors here, clean up as much as possible. */
-        its_discard_event(its, devid, evid);
+        its_discard_event(its, devid, evid, batch);
 
 out:
     spin_unlock(&its->its_lock);
 }
 
-static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr)
+static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr,
+                           struct its_cmd_batch *batch)
 {
     /* size and devid get validated by the functions called below. */
     uint32_t devid = its_cmd_get_deviceid(cmdptr);
@@ -660,7 +679,7 @@ static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr)
 
     if ( !valid )
         /* Discard all events and remove pending LPIs. */
-        its_unmap_device(its, devid);
+        its_unmap_device(its, devid, batch);
 
     /*
      * There is no easy and clean way for Xen to know the ITS device ID of a
@@ -673,13 +692,20 @@ static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr)
     if ( is_hardware_domain(its->d) )
     {
 
+        /*
+         * The host commands queued for the device's events so far must
+         * be done with before the device gets (re)mapped on the host.
+         */
+        ret = gicv3_its_batch_complete(batch);
+
         /*
          * Dom0's ITSes are mapped 1:1, so both addresses are the same.
          * Also the device IDs are equal.
          */
-        ret = gicv3_its_map_guest_device(its->d, its->doorbell_address, devid,
-                                         its->doorbell_address, devid,
-                                         BIT(size, UL), valid);
+        if ( !ret )
+            ret = gicv3_its_map_guest_device(its->d, its->doorbell_address,
+                                             devid, its->doorbell_address,
+                                             devid, BIT(size, UL), valid);
         if ( ret && valid )
             return ret;
     }
@@ -696,7 +722,8 @@ static int its_handle_mapd(struct virt_its *its, uint64_t *cmdptr)
     return ret;
 }
 
-static int its_handle_mapti(struct virt_its *its, uint64_t *cmdptr)
+static int its_handle_mapti(struct virt_its *its, uint64_t *cmdptr,
+                            struct its_cmd_batch *batch)
 {
     uint32_t devid = its_cmd_get_deviceid(cmdptr);
     uint32_t eventid = its_cmd_get_id(cmdptr);
@@ -776,7 +803,20 @@ static int its_handle_mapti(struct virt_its *its, uint64_t *cmdptr)
     write_unlock(&its->d->arch.vgic.pend_lpi_tree_lock);
 
     if ( !ret )
+    {
+        /*
+         * Let the hardware deliver this LPI to the vCPU directly if it can.
+         * Otherwise it keeps going through the host LPI and our injection.
+         */
+        if ( gicv4_domain_has_vlpis(its->d) &&
+             gicv3_its_map_vlpi(batch, its->d, its->doorbell_address, devid,
+                                eventid, vcpu, intid) &&
+             printk_ratelimit() )
+            printk(XENLOG_G_WARNING "%pd: vLPI %u is not directly injected\n",
+                   its->d, intid);
+
         return 0;
+    }
 
     /*
      * radix_tree_insert() returns an error either due to an internal
@@ -785,7 +825,8 @@ static int its_handle_mapti(struct virt_its *its, uint64_t *cmdptr)
      * cleanup and return an error here in any case.
      */
 out_remove_host_entry:
-    gicv3_remove_guest_event(its->d, its->doorbell_address, devid, eventid);
+    gicv3_remove_guest_event(batch, its->d, its->doorbell_address, devid,
+                             eventid);
 
 out_remove_mapping:
     spin_lock(&its->its_lock);
@@ -795,14 +836,15 @@ out_remove_mapping:
     return ret;
 }
 
-static int its_handle_movi(struct virt_its *its, uint64_t *cmdptr)
+static int its_handle_movi(struct virt_its *its, uint64_t *cmdptr,
+                           struct its_cmd_batch *batch)
 {
     uint32_t devid = its_cmd_get_deviceid(cmdptr);
     uint32_t eventid = its_cmd_get_id(cmdptr);
     uint16_t collid = its_cmd_get_collection(cmdptr);
     unsigned long flags;
     struct pending_irq *p;
-    struct vcpu *ovcpu, *nvcpu;
+    struct vcpu *ovcpu, *nvcpu = NULL;
     uint32_t vlpi;
     int ret = -1;
 
@@ -855,10 +897,15 @@ static int its_handle_movi(struct virt_its *its, uint64_t *cmdptr)
 out_unlock:
     spin_unlock(&its->its_lock);
 
+    if ( !ret && gicv4_domain_has_vlpis(its->d) )
+        ret = gicv3_its_move_vlpi(batch, its->d, its->doorbell_address,
+                                  devid, eventid, nvcpu);
+
     return ret;
 }
 
-static int its_handle_discard(struct virt_its *its, uint64_t *cmdptr)
+static int its_handle_discard(struct virt_its *its, uint64_t *cmdptr,
+                              struct its_cmd_batch *batch)
 {
     uint32_t devid = its_cmd_get_deviceid(cmdptr);
     uint32_t eventid = its_cmd_get_id(cmdptr);
@@ -867,7 +914,7 @@ static int its_handle_discard(struct virt_its *its, uint64_t *cmdptr)
     spin_lock(&its->its_lock);
 
     /* Remove from the radix tree and remove the host entry. */
-    ret = its_discard_event(its, devid, eventid);
+    ret = its_discard_event(its, devid, eventid, batch);
     if ( ret )
         goto out_unlock;
 
@@ -895,25 +942,29 @@ static void dump_its_command(uint64_t *command)
  * Must be called with the vcmd_lock held.
  * TODO: Investigate whether we can be smarter here and don't need to hold
  * the lock all of the time.
+ * Host ITS commands the guest's commands lead to are batched, the guest
+ * can only observe their effect once we are done with all of them anyway.
  */
 static int vgic_its_handle_cmds(struct domain *d, struct virt_its *its)
 {
     paddr_t addr = its->cbaser & GENMASK(51, 12);
+    struct its_cmd_batch batch;
     uint64_t command[4];
+    int ret = 0;
 
     ASSERT(spin_is_locked(&its->vcmd_lock));
 
     if ( its->cwriter >= ITS_CMD_BUFFER_SIZE(its->cbaser) )
         return -1;
 
+    gicv3_its_batch_init(&batch);
+
     while ( its->creadr != its->cwriter )
     {
-        int ret;
-
         ret = access_guest_memory_by_ipa(d, addr + its->creadr,
                                          command, sizeof(command), false);
         if ( ret )
-            return ret;
+            break;
 
         switch ( its_cmd_get_command(command) )
         {
@@ -921,13 +972,13 @@ static int vgic_its_handle_cmds(struct domain *d, struct virt_its *its)
             ret = its_handle_clear(its, command);
             break;
         case GITS_CMD_DISCARD:
-            ret = its_handle_discard(its, command);
+            ret = its_handle_discard(its, command, &batch);
             break;
         case GITS_CMD_INT:
             ret = its_handle_int(its, command);
             break;
         case GITS_CMD_INV:
-            ret = its_handle_inv(its, command);
+            ret = its_handle_inv(its, command, &batch);
             break;
         case GITS_CMD_INVALL:
             ret = its_handle_invall(its, command);
@@ -936,17 +987,17 @@ static int vgic_its_handle_cmds(struct domain *d, struct virt_its *its)
             ret = its_handle_mapc(its, command);
             break;
         case GITS_CMD_MAPD:
-            ret = its_handle_mapd(its, command);
+            ret = its_handle_mapd(its, command, &batch);
             break;
         case GITS_CMD_MAPI:
         case GITS_CMD_MAPTI:
-            ret = its_handle_mapti(its, command);
+            ret = its_handle_mapti(its, command, &batch);
             break;
         case GITS_CMD_MOVALL:
             gdprintk(XENLOG_G_INFO, "vGITS: ignoring MOVALL command\n");
             break;
         case GITS_CMD_MOVI:
-            ret = its_handle_movi(its, command);
+            ret = its_handle_movi(its, command, &batch);
             break;
         case GITS_CMD_SYNC:
             /* We handle ITS commands synchronously, so we ignore SYNC. */
@@ -967,9 +1018,13 @@ static int vgic_its_handle_cmds(struct domain *d, struct virt_its *its)
                      ret);
             dump_its_command(command);
         }
+        ret = 0;
     }
 
-    return 0;
+    if ( gicv3_its_batch_complete(&batch) )
+        gdprintk(XENLOG_WARNING, "vGITS: host ITS command error\n");
+
+    return ret;
 }
 
 /*****************************
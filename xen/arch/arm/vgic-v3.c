@@ -1633,7 +1633,7 @@ static int vgic_v3_vcpu_init(struct vcpu *v)
     if ( v->vcpu_id == last_cpu || (v->vcpu_id == (d->max_vcpus - 1)) )
         v->arch.vgic.flags |= VGIC_V3_RDIST_LAST;
 
-    return 0;
+    return gicv4_vcpu_init(v);
 }
 
 /*
@@ -1739,6 +1739,10 @@ static int vgic_v3_domain_init(struct domain *d)
     if ( ret )
         return ret;
 
+    ret = gicv4_domain_init(d);
+    if ( ret )
+        return ret;
+
     /* Register mmio handle for the Distributor */
     register_mmio_handler(d, &vgic_distr_mmio_handler, d->arch.vgic.dbase,
                           SZ_64K, NULL);
@@ -1764,6 +1768,7 @@ static int vgic_v3_domain_init(struct domain *d)
 static void vgic_v3_domain_free(struct domain *d)
 {
     vgic_v3_its_free_domain(d);
+    gicv4_domain_free(d);
     /*
      * It is expected that at this point all actual ITS devices have been
      * cleaned up already. The struct pending_irq's, for which the pointers
@@ -18,6 +18,7 @@
 #include <asm/new_vgic.h>
 #include <asm/gic.h>
 #include <xen/bug.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/sizes.h>
 
@@ -60,12 +61,21 @@ void vgic_v2_fold_lr_state(struct vcpu *vcpu)
     unsigned int used_lrs = vcpu->arch.vgic.used_lrs;
     unsigned long flags;
     unsigned int lr;
+    uint64_t elrsr;
 
     if ( !used_lrs )    /* No LRs used, so nothing to sync back here. */
         return;
 
     gic_hw_ops->update_hcr_status(GICH_HCR_UIE, false);
 
+    /*
+     * The ELRSR tells us which LRs the guest is done with. For those we
+     * know the outcome (neither pending nor active) and the IRQ number, so
+     * we can skip reading them back. Their stale content is harmless, as
+     * an empty LR is never presented to the guest.
+     */
+    elrsr = gic_hw_ops->read_elrsr();
+
     for ( lr = 0; lr < used_lrs; lr++ )
     {
         struct gic_lr lr_val;
@@ -73,20 +83,17 @@ void vgic_v2_fold_lr_state(struct vcpu *vcpu)
         struct vgic_irq *irq;
         struct irq_desc *desc = NULL;
 
-        gic_hw_ops->read_lr(lr, &lr_val);
-
-        /*
-         * TODO: Possible optimization to avoid reading LRs:
-         * Read the ELRSR to find out which of our LRs have been cleared
-         * by the guest. We just need to know the IRQ number for those, which
-         * we could save in an array when populating the LRs.
-         * This trades one MMIO access (ELRSR) for possibly more than one (LRs),
-         * but requires some more code to save the IRQ number and to handle
-         * those finished IRQs according to the algorithm below.
-         * We need some numbers to justify this: chances are that we don't
-         * have many LRs in use most of the time, so we might not save much.
-         */
-        gic_hw_ops->clear_lr(lr);
+        if ( elrsr & (1ULL << lr) )
+        {
+            memset(&lr_val, 0, sizeof(lr_val));
+            lr_val.virq = vgic_cpu->lr_intid[lr];
+            perfc_incr(vgic_lrs_empty_skipped);
+        }
+        else
+        {
+            gic_hw_ops->read_lr(lr, &lr_val);
+            gic_hw_ops->clear_lr(lr);
+        }
 
         intid = lr_val.virq;
         irq = vgic_get_irq(vcpu->domain, vcpu, intid);
@@ -246,6 +253,7 @@ void vgic_v2_populate_lr(struct vcpu *vcpu, struct vgic_irq *irq, int lr)
     /* The GICv2 LR only holds five bits of priority. */
     lr_val.priority = irq->priority >> 3;
 
+    vcpu->arch.vgic.lr_intid[lr] = irq->intid;
     gic_hw_ops->write_lr(lr, &lr_val);
 }
 
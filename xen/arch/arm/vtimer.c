@@ -51,6 +51,15 @@ static void virt_timer_expired(void *data)
     perfc_incr(vtimer_virt_inject);
 }
 
+/* The physical timer expired while its passed through vCPU was descheduled */
+static void phys_timer_direct_expired(void *data)
+{
+    struct vtimer *t = data;
+    t->ctl |= CNTx_CTL_MASK;
+    vgic_inject_irq(t->v->domain, t->v, t->irq, true);
+    perfc_incr(vtimer_phys_inject);
+}
+
 int domain_vtimer_init(struct domain *d, struct xen_arch_domainconfig *config)
 {
     d->arch.virt_timer_base.offset = get_cycles();
@@ -98,7 +107,10 @@ int vcpu_vtimer_init(struct vcpu *v)
      * platform.
      */
 
-    init_timer(&t->timer, phys_timer_expired, t, v->processor);
+    init_timer(&t->timer,
+               opt_vtimer_phys_passthrough ? phys_timer_direct_expired
+                                           : phys_timer_expired,
+               t, v->processor);
     t->ctl = 0;
     t->irq = d0
         ? timer_get_irq(TIMER_PHYS_NONSECURE_PPI)
@@ -127,19 +139,51 @@ void vcpu_timer_destroy(struct vcpu *v)
     kill_timer(&v->arch.phys_timer.timer);
 }
 
+/*
+ * Arm a software timer to deliver the interrupt of a hardware timer whose
+ * vCPU is being descheduled.
+ */
+static void vtimer_arm_sw_timer(struct vtimer *t, s_time_t expires)
+{
+    if ( !(t->ctl & CNTx_CTL_ENABLE) || (t->ctl & CNTx_CTL_MASK) )
+        return;
+
+    set_timer(&t->timer, expires);
+    t->sw_armed = true;
+}
+
+static void vtimer_stop_sw_timer(struct vtimer *t)
+{
+    /* Skip taking the timer lock in the common case of nothing pending. */
+    if ( !t->sw_armed )
+        return;
+
+    stop_timer(&t->timer);
+    t->sw_armed = false;
+}
+
 void virt_timer_save(struct vcpu *v)
 {
+    struct vtimer *t = &v->arch.virt_timer;
+
     ASSERT(!is_idle_vcpu(v));
 
-    v->arch.virt_timer.ctl = READ_SYSREG(CNTV_CTL_EL0);
-    WRITE_SYSREG(v->arch.virt_timer.ctl & ~CNTx_CTL_ENABLE, CNTV_CTL_EL0);
-    v->arch.virt_timer.cval = READ_SYSREG64(CNTV_CVAL_EL0);
-    if ( (v->arch.virt_timer.ctl & CNTx_CTL_ENABLE) &&
-         !(v->arch.virt_timer.ctl & CNTx_CTL_MASK))
+    t->ctl = READ_SYSREG(CNTV_CTL_EL0);
+    WRITE_SYSREG(t->ctl & ~CNTx_CTL_ENABLE, CNTV_CTL_EL0);
+    t->cval = READ_SYSREG64(CNTV_CVAL_EL0);
+    vtimer_arm_sw_timer(t, v->domain->arch.virt_timer_base.nanoseconds +
+                           ticks_to_ns(t->cval));
+
+    if ( opt_vtimer_phys_passthrough )
     {
-        set_timer(&v->arch.virt_timer.timer,
-                  v->domain->arch.virt_timer_base.nanoseconds +
-                  ticks_to_ns(v->arch.virt_timer.cval));
+        t = &v->arch.phys_timer;
+
+        t->ctl = READ_SYSREG(CNTP_CTL_EL0);
+        WRITE_SYSREG(t->ctl & ~CNTx_CTL_ENABLE, CNTP_CTL_EL0);
+        t->cval = READ_SYSREG64(CNTP_CVAL_EL0);
+        /* If cval is before the point Xen started, expire immediately. */
+        vtimer_arm_sw_timer(t, t->cval > boot_count
+                               ? ticks_to_ns(t->cval - boot_count) : 0);
     }
 }
 
@@ -147,13 +191,20 @@ void virt_timer_restore(struct vcpu *v)
 {
     ASSERT(!is_idle_vcpu(v));
 
-    stop_timer(&v->arch.virt_timer.timer);
+    vtimer_stop_sw_timer(&v->arch.virt_timer);
     migrate_timer(&v->arch.virt_timer.timer, v->processor);
     migrate_timer(&v->arch.phys_timer.timer, v->processor);
 
     WRITE_SYSREG64(v->domain->arch.virt_timer_base.offset, CNTVOFF_EL2);
     WRITE_SYSREG64(v->arch.virt_timer.cval, CNTV_CVAL_EL0);
     WRITE_SYSREG(v->arch.virt_timer.ctl, CNTV_CTL_EL0);
+
+    if ( opt_vtimer_phys_passthrough )
+    {
+        vtimer_stop_sw_timer(&v->arch.phys_timer);
+        WRITE_SYSREG64(v->arch.phys_timer.cval, CNTP_CVAL_EL0);
+        WRITE_SYSREG(v->arch.phys_timer.ctl, CNTP_CTL_EL0);
+    }
 }
 
 static bool vtimer_cntp_ctl(struct cpu_user_regs *regs, register_t *r,
@@ -386,8 +437,14 @@ void vtimer_update_irqs(struct vcpu *v)
     vtimer_update_irq(v, &v->arch.virt_timer,
                       READ_SYSREG(CNTV_CTL_EL0) & ~CNTx_CTL_MASK);
 
-    /* For the physical timer we rely on our emulated state. */
-    vtimer_update_irq(v, &v->arch.phys_timer, v->arch.phys_timer.ctl);
+    /*
+     * For the physical timer we rely on our emulated state, unless it is
+     * passed through, in which case it behaves like the virtual timer.
+     */
+    vtimer_update_irq(v, &v->arch.phys_timer,
+                      opt_vtimer_phys_passthrough
+                      ? READ_SYSREG(CNTP_CTL_EL0) & ~CNTx_CTL_MASK
+                      : v->arch.phys_timer.ctl);
 }
 
 /*
@@ -1519,6 +1519,7 @@ int pmstat_get_cx_stat(uint32_t cpuid, struct pm_cx_stat *stat)
         stat->idle_time = 0;
         stat->nr_pc = 0;
         stat->nr_cc = 0;
+        stat->pred_hit = stat->pred_early = stat->pred_late = 0;
         return 0;
     }
 
@@ -1609,12 +1610,17 @@ int pmstat_get_cx_stat(uint32_t cpuid, struct pm_cx_stat *stat)
 
     stat->nr_pc = nr_pc;
     stat->nr_cc = nr_cc;
+    menu_get_pred_stats(cpuid, &stat->pred_hit, &stat->pred_early,
+                        &stat->pred_late);
 
     return 0;
 }
 
 int pmstat_reset_cx_stat(uint32_t cpuid)
 {
+    if ( processor_powers[cpuid] )
+        menu_reset_pred_stats(cpuid);
+
     return 0;
 }
 
@@ -635,6 +635,9 @@ static int __init cf_check cpufreq_driver_init(void)
 
     if ( cpufreq_controller == FREQCTL_xen )
     {
+        if ( cpufreq_opt_hwp && !hwp_register_driver() )
+            return 0;
+
         switch ( boot_cpu_data.x86_vendor )
         {
         case X86_VENDOR_INTEL:
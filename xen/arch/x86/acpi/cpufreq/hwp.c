@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Hardware managed P-states: Intel HWP and AMD CPPC (MSR interface).
+ *
+ * With either enabled, the processor picks its operating point by itself,
+ * within the bounds and following the energy/performance preference (EPP)
+ * programmed in a per-logical-CPU request MSR.  Xen doesn't sample load;
+ * it only reprograms the request when a pCPU switches to a domain of a
+ * different performance class (XEN_DOMCTL_set_perf_class).
+ *
+ * Once enabled, neither can be disabled again short of a reset.
+ */
+
+#include <xen/cpu.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/notifier.h>
+#include <xen/percpu.h>
+#include <xen/sched.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <acpi/cpufreq/cpufreq.h>
+
+#define HWP_EPP_PERFORMANCE         0x00
+#define HWP_EPP_BALANCE_PERFORMANCE 0x80
+#define HWP_EPP_POWERSAVE           0xff
+
+bool __read_mostly hwp_active;
+
+static bool __ro_after_init hwp_amd;
+static bool __ro_after_init hwp_has_epp;
+
+/* Performance levels, in the processor's own abstract units. */
+struct hwp_caps {
+    uint8_t lowest;
+    uint8_t guaranteed;
+    uint8_t highest;
+};
+
+static DEFINE_PER_CPU(struct hwp_caps, hwp_caps);
+static DEFINE_PER_CPU(uint8_t, hwp_class);
+
+static void hwp_write_request(unsigned int perf_class)
+{
+    const struct hwp_caps *caps = &this_cpu(hwp_caps);
+    uint64_t min = caps->lowest, max = caps->highest;
+    uint64_t epp = HWP_EPP_BALANCE_PERFORMANCE;
+
+    switch ( perf_class )
+    {
+    case XEN_DOMCTL_PERF_CLASS_latency:
+        min = caps->guaranteed;
+        epp = HWP_EPP_PERFORMANCE;
+        break;
+
+    case XEN_DOMCTL_PERF_CLASS_background:
+        max = caps->guaranteed;
+        epp = HWP_EPP_POWERSAVE;
+        break;
+    }
+
+    /*
+     * The desired performance field (bits 23:16) is left 0, for the
+     * processor to choose autonomously.  Intel and AMD swap the min and max
+     * fields.  The activity window (Intel only) is left to the hardware.
+     */
+    if ( hwp_amd )
+        wrmsrl(MSR_AMD_CPPC_REQ, max | (min << 8) | (epp << 24));
+    else
+        wrmsrl(MSR_HWP_REQUEST,
+               min | (max << 8) | (hwp_has_epp ? epp << 24 : 0));
+
+    this_cpu(hwp_class) = perf_class;
+}
+
+void hwp_context_switch(const struct domain *d)
+{
+    unsigned int perf_class = read_atomic(&d->perf_class);
+
+    if ( perf_class != this_cpu(hwp_class) )
+        hwp_write_request(perf_class);
+}
+
+void hwp_cpu_init(void)
+{
+    struct hwp_caps *caps = &this_cpu(hwp_caps);
+    uint64_t val;
+
+    if ( hwp_amd )
+    {
+        wrmsrl(MSR_AMD_CPPC_ENABLE, AMD_CPPC_ENABLE);
+        rdmsrl(MSR_AMD_CPPC_CAP1, val);
+        /* Highest 31:24, nominal 23:16, lowest non-linear 15:8, lowest 7:0 */
+        caps->highest = val >> 24;
+        caps->guaranteed = val >> 16;
+        caps->lowest = val;
+    }
+    else
+    {
+        wrmsrl(MSR_PM_ENABLE, PM_ENABLE_HWP_ENABLE);
+        rdmsrl(MSR_HWP_CAPABILITIES, val);
+        /* Lowest 31:24, most efficient 23:16, guaranteed 15:8, highest 7:0 */
+        caps->highest = val;
+        caps->guaranteed = val >> 8;
+        caps->lowest = val >> 24;
+    }
+
+    if ( cpufreq_verbose )
+        printk(XENLOG_INFO
+               "CPU%u: %s performance levels %u-%u, guaranteed %u\n",
+               smp_processor_id(), hwp_amd ? "CPPC" : "HWP", caps->lowest,
+               caps->highest, caps->guaranteed);
+
+    hwp_write_request(XEN_DOMCTL_PERF_CLASS_default);
+}
+
+static int cf_check cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    if ( action == CPU_STARTING )
+        hwp_cpu_init();
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
+int __init hwp_register_driver(void)
+{
+    const struct cpuinfo_x86 *c = &boot_cpu_data;
+
+    switch ( c->x86_vendor )
+    {
+    case X86_VENDOR_INTEL:
+        if ( c->cpuid_level < 6 || !(cpuid_eax(6) & (1U << 7)) )
+            return -ENODEV;
+        hwp_has_epp = cpuid_eax(6) & (1U << 10);
+        break;
+
+    case X86_VENDOR_AMD:
+    case X86_VENDOR_HYGON:
+        if ( c->extended_cpuid_level < 0x80000008 ||
+             !(cpuid_ebx(0x80000008) & (1U << 27)) )
+            return -ENODEV;
+        hwp_amd = true;
+        hwp_has_epp = true;
+        break;
+
+    default:
+        return -ENODEV;
+    }
+
+    printk(XENLOG_INFO "cpufreq: using hardware managed P-states (%s%s)\n",
+           hwp_amd ? "CPPC" : "HWP", hwp_has_epp ? ", EPP" : "");
+
+    register_cpu_notifier(&cpu_nfb);
+    hwp_cpu_init();
+    hwp_active = true;
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -35,6 +35,8 @@
 #define DECAY 4
 #define MAX_INTERESTING 50000
 #define LATENCY_MULTIPLIER 10
+#define INTERVALS 8
+#define MAX_INTERVAL 1000000
 
 /*
  * Concepts and ideas behind the menu governor
@@ -90,6 +92,23 @@
  * As an additional rule to reduce the performance impact, menu tries to
  * limit the exit latency duration to be no more than 10% of the decaying
  * measured idle time.
+ *
+ * Repeating wakeup patterns
+ * -------------------------
+ * Under Xen most wakeups of an idle pCPU which aren't timer driven are the
+ * scheduler waking a vCPU whose event arrived, e.g. a latency sensitive
+ * guest being poked by its backend at a steady rate.  Neither the timer heap
+ * (which already holds the vCPUs' singleshot and periodic timers) nor the
+ * correction factor captures such a pattern, so the last few measured idle
+ * intervals are also kept.  If they're consistent enough (standard deviation
+ * within 1/6 of the average, ignoring outliers above the average) their
+ * average bounds the prediction, as in Linux.
+ *
+ * How well the prediction worked is accounted for each idle period, and
+ * reported by "xenpm get-cpuidle-states": a hit when the chosen state was
+ * the deepest one paying off, early when the pCPU woke before reaching the
+ * chosen state's target residency, and late when a deeper state's target
+ * residency was reached.
  */
 
 struct perf_factor{
@@ -109,7 +128,10 @@ struct menu_device
     unsigned int    exit_us;
     unsigned int    bucket;
     u64             correction_factor[BUCKETS];
+    unsigned int    intervals[INTERVALS];
+    unsigned int    interval_ptr;
     struct perf_factor pf;
+    uint64_t        pred_hit, pred_early, pred_late;
 };
 
 static DEFINE_PER_CPU(struct menu_device, menu_devices);
@@ -185,6 +207,63 @@ static unsigned int get_sleep_length_us(void)
     return (us >> 32) ? (unsigned int)-2000 : (unsigned int)us;
 }
 
+/*
+ * Return the average of the recent idle intervals if they're consistent
+ * enough, repeatedly discarding the largest one if they're not, or
+ * UINT_MAX if no pattern was found.
+ */
+static unsigned int get_typical_interval(const struct menu_device *data)
+{
+    unsigned int i, divisor, max, thresh = UINT_MAX;
+    uint64_t avg, variance;
+
+    for ( ; ; )
+    {
+        max = avg = divisor = 0;
+        for ( i = 0; i < INTERVALS; i++ )
+        {
+            unsigned int value = data->intervals[i];
+
+            if ( value > thresh )
+                continue;
+            avg += value;
+            divisor++;
+            if ( value > max )
+                max = value;
+        }
+
+        if ( !max )
+            return UINT_MAX;
+
+        avg /= divisor;
+
+        variance = 0;
+        for ( i = 0; i < INTERVALS; i++ )
+        {
+            unsigned int value = data->intervals[i];
+            int64_t diff = value - avg;
+
+            if ( value <= thresh )
+                variance += diff * diff;
+        }
+        variance /= divisor;
+
+        /*
+         * Intervals are capped at MAX_INTERVAL, so neither side can overflow.
+         * The second condition accepts a standard deviation up to 20us.
+         */
+        if ( (avg * avg > variance * 36 && divisor * 4 >= INTERVALS * 3) ||
+             variance <= 400 )
+            return avg;
+
+        /* Give up once a quarter of the samples would have been dropped. */
+        if ( divisor * 4 <= INTERVALS * 3 )
+            return UINT_MAX;
+
+        thresh = max - 1;
+    }
+}
+
 static int cf_check menu_select(struct acpi_processor_power *power)
 {
     struct menu_device *data = &this_cpu(menu_devices);
@@ -217,6 +296,8 @@ static int cf_check menu_select(struct acpi_processor_power *power)
     data->predicted_us = DIV_ROUND(
             data->expected_us * data->correction_factor[data->bucket],
             RESOLUTION * DECAY);
+    data->predicted_us = min_t(uint64_t, data->predicted_us,
+                               get_typical_interval(data));
 
     /* find the deepest idle state that satisfies our constraints */
     for ( i = CPUIDLE_DRIVER_STATE_START + 1; i < power->count; i++ )
@@ -251,6 +332,21 @@ static void cf_check menu_reflect(struct acpi_processor_power *power)
     if (data->measured_us > data->exit_us)
         data->measured_us -= data->exit_us;
 
+    data->intervals[data->interval_ptr++] = min(data->measured_us,
+                                                MAX_INTERVAL + 0U);
+    if ( data->interval_ptr >= INTERVALS )
+        data->interval_ptr = 0;
+
+    if ( data->measured_us <
+         power->states[data->last_state_idx].target_residency )
+        data->pred_early++;
+    else if ( data->last_state_idx + 1 < power->count &&
+              data->measured_us >=
+              power->states[data->last_state_idx + 1].target_residency )
+        data->pred_late++;
+    else
+        data->pred_hit++;
+
     /* update our correction ratio */
 
     new_factor = data->correction_factor[data->bucket]
@@ -299,3 +395,20 @@ void menu_get_trace_data(u32 *expected, u32 *pred)
     *expected = data->expected_us;
     *pred = data->predicted_us;
 }
+
+void menu_get_pred_stats(unsigned int cpu, uint64_t *hit, uint64_t *early,
+                         uint64_t *late)
+{
+    const struct menu_device *data = &per_cpu(menu_devices, cpu);
+
+    *hit = data->pred_hit;
+    *early = data->pred_early;
+    *late = data->pred_late;
+}
+
+void menu_reset_pred_stats(unsigned int cpu)
+{
+    struct menu_device *data = &per_cpu(menu_devices, cpu);
+
+    data->pred_hit = data->pred_early = data->pred_late = 0;
+}
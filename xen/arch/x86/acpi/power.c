@@ -318,6 +318,8 @@ static int enter_state(u32 state)
     acpi_sleep_post(state);
     if ( hvm_cpu_up() )
         BUG();
+    if ( hwp_active )
+        hwp_cpu_init();
     cpufreq_add_cpu(0);
 
  enable_cpu:
@@ -504,6 +504,11 @@ static void amd_get_topology(struct cpuinfo_x86 *c)
         c->cpu_core_id = c->phys_proc_id & ((1<<bits)-1);
         /* Convert local APIC ID into the socket ID */
         c->phys_proc_id >>= bits;
+        /* Leaf 0x8000001d (cache topology) is part of the extensions. */
+        if (cpu_has(c, X86_FEATURE_TOPOEXT) &&
+            c->extended_cpuid_level >= 0x8000001d)
+                cpuid4_llc_id(c, 0x8000001d);
+
         /* Collect compute unit ID if available */
         if (cpu_has(c, X86_FEATURE_TOPOEXT)) {
                 u32 eax, ebx, ecx, edx;
@@ -116,6 +116,32 @@ static int find_num_cache_leaves(void)
 	return i;
 }
 
+/*
+ * Derive the ID of the last level cache from a CPUID leaf laid out like
+ * leaf 4 (deterministic cache parameters).  AMD's leaf 0x8000001d uses the
+ * same format.  CPUs sharing the LLC only differ in the low order bits of
+ * their APIC ID covered by the number of threads sharing it.
+ */
+void cpuid4_llc_id(struct cpuinfo_x86 *c, unsigned int leaf)
+{
+	union _cpuid4_leaf_eax eax;
+	unsigned int ebx, ecx, edx, i, level = 0, sharing = 0;
+
+	for (i = 0; ; i++) {
+		cpuid_count(leaf, i, &eax.full, &ebx, &ecx, &edx);
+		if (eax.split.type == CACHE_TYPE_NULL)
+			break;
+		if (eax.split.type == CACHE_TYPE_INST ||
+		    eax.split.level < level)
+			continue;
+		level = eax.split.level;
+		sharing = eax.split.num_threads_sharing + 1;
+	}
+
+	if (sharing)
+		c->cpu_llc_id = c->apicid >> get_count_order(sharing);
+}
+
 void init_intel_cacheinfo(struct cpuinfo_x86 *c)
 {
 	unsigned int trace = 0, l1i = 0, l1d = 0, l2 = 0, l3 = 0; /* Cache sizes */
@@ -132,6 +158,9 @@ void init_intel_cacheinfo(struct cpuinfo_x86 *c)
 			is_initialized++;
 		}
 
+		if (num_cache_leaves)
+			cpuid4_llc_id(c, 4);
+
 		/*
 		 * Whenever possible use cpuid(4), deterministic cache
 		 * parameters cpuid leaf to find the cache details
@@ -29,6 +29,7 @@
 #include <xen/init.h>
 #include <xen/multiboot.h>
 #include <xen/param.h>
+#include <xen/softirq.h>
 #include <xen/spinlock.h>
 #include <xen/stop_machine.h>
 #include <xen/watchdog.h>
@@ -99,6 +100,9 @@ static bool ucode_in_nmi = true;
 
 bool __read_mostly opt_ucode_allow_same;
 
+/* Late loading one core at a time, rather than stopping the whole system. */
+static bool __read_mostly ucode_per_core;
+
 /* Protected by microcode_mutex */
 static struct microcode_patch *microcode_cache;
 
@@ -127,6 +131,8 @@ static int __init cf_check parse_ucode(const char *s)
             ucode_in_nmi = val;
         else if ( (val = parse_boolean("allow-same", s, ss)) >= 0 )
             opt_ucode_allow_same = val;
+        else if ( (val = parse_boolean("per-core", s, ss)) >= 0 )
+            ucode_per_core = val;
         else if ( !ucode_mod_forced ) /* Not forced by EFI */
         {
             if ( (val = parse_boolean("scan", s, ss)) >= 0 )
@@ -568,6 +574,59 @@ static int cf_check do_microcode_update(void *patch)
     return ret;
 }
 
+static int cf_check do_core_microcode_update(void *patch)
+{
+    int ret;
+
+    if ( !is_cpu_primary(smp_processor_id()) )
+        return 0;
+
+    ret = alternative_call(ucode_ops.apply_microcode, patch);
+    if ( !ret )
+        atomic_inc(&cpu_updated);
+
+    return ret;
+}
+
+/*
+ * Load @patch one core at a time.  Only the threads of the core being updated
+ * are held in stop_machine context (so SMT siblings are still quiet while the
+ * update happens), while all other CPUs keep running.
+ */
+static int microcode_update_per_core(struct microcode_patch *patch)
+{
+    unsigned int cpu, sibling;
+    int ret = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        const cpumask_t *siblings = per_cpu(cpu_sibling_mask, cpu);
+
+        /* Visit each core once, via its first thread. */
+        if ( cpu != cpumask_first(siblings) )
+            continue;
+
+        ret = stop_cpus_run(siblings, do_core_microcode_update, patch,
+                            NR_CPUS);
+        if ( ret )
+        {
+            printk(XENLOG_ERR
+                   "Late loading aborted: CPU%u failed to update ucode: %d\n",
+                   cpu, ret);
+            break;
+        }
+
+        /* Secondary threads share the update of their primary thread. */
+        for_each_cpu ( sibling, siblings )
+            if ( !is_cpu_primary(sibling) )
+                per_cpu(cpu_sig, sibling).rev = per_cpu(cpu_sig, cpu).rev;
+
+        process_pending_softirqs();
+    }
+
+    return ret;
+}
+
 struct ucode_buf {
     unsigned int len;
     char buffer[];
@@ -669,7 +728,10 @@ static long cf_check microcode_update_helper(void *data)
      *   this requirement can be relaxed in the future. Right now, this is
      *   conservative and good.
      */
-    ret = stop_machine_run(do_microcode_update, patch, NR_CPUS);
+    if ( ucode_per_core )
+        ret = microcode_update_per_core(patch);
+    else
+        ret = stop_machine_run(do_microcode_update, patch, NR_CPUS);
 
     updated = atomic_read(&cpu_updated);
     if ( updated > 0 )
@@ -34,6 +34,13 @@ CHECK_pmu_params;
 static unsigned int __read_mostly opt_vpmu_enabled;
 unsigned int __read_mostly vpmu_mode = XENPMU_MODE_OFF;
 unsigned int __read_mostly vpmu_features = 0;
+
+/*
+ * vpmu=lazy: the PMU context of an HVM vCPU is left in the hardware when the
+ * vCPU is descheduled, and only saved once another vCPU needs the PMU of that
+ * pCPU, or the vCPU runs on another pCPU.  Intel only.
+ */
+bool __read_mostly opt_vpmu_lazy;
 static struct arch_vpmu_ops __initdata vpmu_ops;
 
 static DEFINE_SPINLOCK(vpmu_lock);
@@ -63,6 +70,8 @@ static int __init cf_check parse_vpmu_params(const char *s)
             vpmu_features |= XENPMU_FEATURE_IPC_ONLY;
         else if ( !cmdline_strcmp(s, "arch") )
             vpmu_features |= XENPMU_FEATURE_ARCH_ONLY;
+        else if ( !cmdline_strcmp(s, "lazy") )
+            opt_vpmu_lazy = true;
         else if ( (val = parse_boolean("rtm-abort", s, ss)) >= 0 )
             printk(XENLOG_WARNING
                    "'rtm-abort=<bool>' superseded.  Use 'tsx=<bool>' instead\n");
@@ -72,8 +81,8 @@ static int __init cf_check parse_vpmu_params(const char *s)
         s = ss + 1;
     } while ( *ss );
 
-    /* Selecting bts/ipc/arch implies vpmu=1. */
-    if ( vpmu_features )
+    /* Selecting bts/ipc/arch/lazy implies vpmu=1. */
+    if ( vpmu_features || opt_vpmu_lazy )
         opt_vpmu_enabled = true;
 
     if ( opt_vpmu_enabled )
@@ -349,7 +358,7 @@ void cf_check vpmu_save_force(void *arg)
     per_cpu(last_vcpu, smp_processor_id()) = NULL;
 }
 
-void vpmu_save(struct vcpu *v)
+void vpmu_save(struct vcpu *v, bool lazy)
 {
     struct vpmu_struct *vpmu = vcpu_vpmu(v);
     int pcpu = smp_processor_id();
@@ -360,6 +369,17 @@ void vpmu_save(struct vcpu *v)
     vpmu->last_pcpu = pcpu;
     per_cpu(last_vcpu, pcpu) = v;
 
+    /*
+     * The VM exit has already stopped the counters (global control is 0 in
+     * the host MSR load list).  Leave everything else in place until
+     * vpmu_claim() or a load on another pCPU needs it saved.
+     */
+    if ( lazy && has_vlapic(v->domain) )
+    {
+        apic_write(APIC_LVTPC, PMU_APIC_VECTOR | APIC_LVT_MASKED);
+        return;
+    }
+
     vpmu_set(vpmu, VPMU_CONTEXT_SAVE);
 
     if ( alternative_call(vpmu_ops.arch_vpmu_save, v, 0) )
@@ -370,6 +390,29 @@ void vpmu_save(struct vcpu *v)
     apic_write(APIC_LVTPC, PMU_APIC_VECTOR | APIC_LVT_MASKED);
 }
 
+/*
+ * Make the PMU of this pCPU available to @v, saving the context of another
+ * vCPU left loaded there by vpmu=lazy.
+ */
+void vpmu_claim(struct vcpu *v)
+{
+    struct vcpu *prev;
+    unsigned long flags;
+
+    /* Prevent a forced context save from a remote CPU meanwhile. */
+    local_irq_save(flags);
+
+    prev = this_cpu(last_vcpu);
+    if ( prev && prev != v &&
+         vpmu_is_set(vcpu_vpmu(prev), VPMU_CONTEXT_LOADED) )
+    {
+        vpmu_save_force(prev);
+        vpmu_reset(vcpu_vpmu(prev), VPMU_CONTEXT_LOADED);
+    }
+
+    local_irq_restore(flags);
+}
+
 int vpmu_load(struct vcpu *v, bool_t from_guest)
 {
     struct vpmu_struct *vpmu = vcpu_vpmu(v);
@@ -378,12 +421,24 @@ int vpmu_load(struct vcpu *v, bool_t from_guest)
     if ( !vpmu_is_set(vpmu, VPMU_CONTEXT_ALLOCATED) )
         return 0;
 
+    /* vpmu=lazy may have left our context in the PMU of another pCPU. */
+    if ( opt_vpmu_lazy && vpmu_is_set(vpmu, VPMU_CONTEXT_LOADED) &&
+         vpmu->last_pcpu != smp_processor_id() )
+    {
+        on_selected_cpus(cpumask_of(vpmu->last_pcpu),
+                         vpmu_save_force, v, 1);
+        vpmu_reset(vpmu, VPMU_CONTEXT_LOADED);
+    }
+
     /* Only when PMU is counting, we load PMU context immediately. */
     if ( !vpmu_is_set(vpmu, VPMU_RUNNING) ||
          (!has_vlapic(vpmu_vcpu(vpmu)->domain) &&
          vpmu_is_set(vpmu, VPMU_CACHED)) )
         return 0;
 
+    if ( opt_vpmu_lazy )
+        vpmu_claim(v);
+
     apic_write(APIC_LVTPC, vpmu->hw_lapic_lvtpc);
     /* Arch code needs to set VPMU_CONTEXT_LOADED */
     ret = alternative_call(vpmu_ops.arch_vpmu_load, v, from_guest);
@@ -845,6 +900,12 @@ static int __init cf_check vpmu_init(void)
         break;
     }
 
+    if ( opt_vpmu_lazy && vendor != X86_VENDOR_INTEL )
+    {
+        printk(XENLOG_WARNING "VPMU: lazy mode is only supported on Intel\n");
+        opt_vpmu_lazy = false;
+    }
+
     if ( !IS_ERR_OR_NULL(ops) )
     {
         vpmu_ops = *ops;
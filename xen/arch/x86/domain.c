@@ -28,6 +28,7 @@
 #include <xen/event.h>
 #include <xen/console.h>
 #include <xen/percpu.h>
+#include <xen/perfc.h>
 #include <xen/compat.h>
 #include <xen/acpi.h>
 #include <xen/pci.h>
@@ -71,6 +72,7 @@
 #include <asm/pv/domain.h>
 #include <asm/pv/mm.h>
 #include <asm/spec_ctrl.h>
+#include <acpi/cpufreq/processor_perf.h>
 
 DEFINE_PER_CPU(struct vcpu *, curr_vcpu);
 
@@ -460,9 +462,11 @@ void domain_cpu_policy_changed(struct domain *d)
 
 #ifndef CONFIG_BIGMEM
 /*
- * The hole may be at or above the 44-bit boundary, so we need to determine
- * the total bit count until reaching 32 significant (not squashed out) bits
- * in PFN representations.
+ * PDX compression may squash out holes at or above the 44-bit boundary, so
+ * we need to determine the address bit count up to which all PDXes still fit
+ * in 32 bits.  PDXes grow monotonically with PFNs, so checking the last PFN
+ * of each candidate range suffices, and nothing above max_page needs to be
+ * (or can be) translated.
  * Note that the way "bits" gets initialized/updated/bounds-checked guarantees
  * that the function will never return zero, and hence will never be called
  * more than once (which is important due to it being deliberately placed in
@@ -471,12 +475,12 @@ void domain_cpu_policy_changed(struct domain *d)
 static unsigned int __init noinline _domain_struct_bits(void)
 {
     unsigned int bits = 32 + PAGE_SHIFT;
-    unsigned int sig = hweight32(~pfn_hole_mask);
-    unsigned int mask = pfn_hole_mask >> 32;
 
-    for ( ; bits < BITS_PER_LONG && sig < 32; ++bits, mask >>= 1 )
-        if ( !(mask & 1) )
-            ++sig;
+    while ( bits < BITS_PER_LONG &&
+            (1UL << (bits - PAGE_SHIFT)) < max_page &&
+            !(pfn_to_pdx(min(max_page,
+                             1UL << (bits + 1 - PAGE_SHIFT)) - 1) >> 32) )
+        ++bits;
 
     return bits;
 }
@@ -522,6 +526,8 @@ struct vcpu *alloc_vcpu_struct(const struct domain *d)
     unsigned int memflags =
         (is_hvm_domain(d) && paging_mode_shadow(d)) ? MEMF_bits(32) : 0;
 
+    memflags |= MEMF_node(domain_alloc_node(d));
+
     BUILD_BUG_ON(sizeof(*v) > PAGE_SIZE);
     v = alloc_xenheap_pages(0, memflags);
     if ( v != NULL )
@@ -561,7 +567,7 @@ int arch_vcpu_create(struct vcpu *v)
         paging_vcpu_init(v);
 
         if ( (rc = vcpu_init_fpu(v)) != 0 )
-            return rc;
+            goto fail;
 
         vmce_init_vcpu(v);
 
@@ -604,6 +610,8 @@ int arch_vcpu_create(struct vcpu *v)
     vcpu_destroy_fpu(v);
     xfree(v->arch.msrs);
     v->arch.msrs = NULL;
+    if ( is_pv_vcpu(v) )
+        mapcache_vcpu_destroy(v);
 
     return rc;
 }
@@ -695,13 +703,19 @@ int arch_sanitise_domain_config(struct xen_domctl_createdomain *config)
         }
     }
 
-    if ( config->arch.misc_flags & ~XEN_X86_MSR_RELAXED )
+    if ( config->arch.misc_flags & ~(XEN_X86_MSR_RELAXED | XEN_X86_IPI_VIRT) )
     {
         dprintk(XENLOG_INFO, "Invalid arch misc flags %#x\n",
                 config->arch.misc_flags);
         return -EINVAL;
     }
 
+    if ( !hvm && (config->arch.misc_flags & XEN_X86_IPI_VIRT) )
+    {
+        dprintk(XENLOG_INFO, "IPI virtualisation not supported for PV\n");
+        return -EINVAL;
+    }
+
     return 0;
 }
 
@@ -2014,10 +2028,16 @@ void context_switch(struct vcpu *prev, struct vcpu *next)
 
         ctxt_switch_levelling(next);
 
+        if ( hwp_active )
+            hwp_context_switch(nextd);
+
         if ( opt_ibpb_ctxt_switch && !is_idle_domain(nextd) )
         {
             static DEFINE_PER_CPU(unsigned int, last);
+            static DEFINE_PER_CPU(unsigned int, last_group);
             unsigned int *last_id = &this_cpu(last);
+            unsigned int *last_grp = &this_cpu(last_group);
+            unsigned int next_grp = nextd->security_group;
 
             /*
              * Squash the domid and vcpu id together for comparison
@@ -2037,8 +2057,20 @@ void context_switch(struct vcpu *prev, struct vcpu *next)
              */
             if ( *last_id != next_id )
             {
-                spec_ctrl_new_guest_context();
+                /*
+                 * Nor between domains of the same security group, which
+                 * the toolstack has declared to trust each other.
+                 */
+                if ( !next_grp || next_grp != *last_grp )
+                {
+                    spec_ctrl_new_guest_context();
+                    perfc_incr(ctxt_switch_ibpb);
+                }
+                else
+                    perfc_incr(ctxt_switch_ibpb_skipped);
+
                 *last_id = next_id;
+                *last_grp = next_grp;
             }
         }
 
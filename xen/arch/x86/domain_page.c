@@ -9,6 +9,7 @@
 #include <xen/domain_page.h>
 #include <xen/efi.h>
 #include <xen/mm.h>
+#include <xen/param.h>
 #include <xen/perfc.h>
 #include <xen/pfn.h>
 #include <xen/sched.h>
@@ -67,6 +68,164 @@ void __init mapcache_override_current(struct vcpu *v)
 #define MAPCACHE_L1ENT(idx) \
     __linear_l1_table[l1_linear_offset(MAPCACHE_VIRT_START + pfn_to_paddr(idx))]
 
+/*
+ * Per-VCPU mapcache mode.
+ *
+ * Rather than allocating from the domain wide pool of mapcache entries under
+ * the mapcache lock, each VCPU gets a private range of entries, used as a set
+ * of slots.  Mappings are looked up through a direct mapped hash keyed by MFN,
+ * and slots no longer in use keep their mapping until they get reused, in
+ * least recently used order.  Invalidation of the stale TLB entry is thus
+ * deferred until a slot gets reassigned, and is done for just that page.
+ * When the VCPU moves to another pCPU, that pCPU's TLB is flushed if slots
+ * were reassigned since it last got flushed.
+ */
+static bool __read_mostly opt_mapcache_per_vcpu;
+boolean_param("mapcache-per-vcpu", opt_mapcache_per_vcpu);
+
+#define MAPCACHE_SLOTS_MAX      64
+#define MAPCACHE_SLOT_HASH      (2 * MAPCACHE_SLOTS_MAX)
+#define MAPCACHE_SLOT_HASHFN(pfn) ((pfn) & (MAPCACHE_SLOT_HASH - 1))
+
+struct mapcache_slots {
+    /* First mapcache entry and number of entries owned by the VCPU. */
+    unsigned int base;
+    unsigned int nr;
+
+    /* pCPU the slots were last used on, and time of the last reassignment. */
+    unsigned int cpu;
+    uint32_t tlbflush_timestamp;
+
+    /* Slot last used for each hash bucket, possibly since reassigned. */
+    uint8_t hash[MAPCACHE_SLOT_HASH];
+
+    /* slot[nr] heads the LRU list of slots not currently in use. */
+    struct mapcache_slot {
+        unsigned long mfn;
+        uint16_t refcnt;
+        uint8_t prev, next;
+    } slot[];
+};
+
+static void slot_lru_del(struct mapcache_slots *ms, unsigned int i)
+{
+    ms->slot[ms->slot[i].prev].next = ms->slot[i].next;
+    ms->slot[ms->slot[i].next].prev = ms->slot[i].prev;
+}
+
+static void slot_lru_add_tail(struct mapcache_slots *ms, unsigned int i)
+{
+    struct mapcache_slot *head = &ms->slot[ms->nr];
+
+    ms->slot[i].prev = head->prev;
+    ms->slot[i].next = ms->nr;
+    ms->slot[head->prev].next = i;
+    head->prev = i;
+}
+
+static void *mapcache_slot_map(struct mapcache_slots *ms, mfn_t mfn)
+{
+    unsigned int cpu = smp_processor_id();
+    unsigned int h = MAPCACHE_SLOT_HASHFN(mfn_x(mfn)), i;
+    struct mapcache_slot *slot;
+    unsigned long flags;
+
+    local_irq_save(flags);
+
+    if ( unlikely(ms->cpu != cpu) )
+    {
+        ms->cpu = cpu;
+        if ( NEED_FLUSH(this_cpu(tlbflush_time), ms->tlbflush_timestamp) )
+        {
+            perfc_incr(domain_page_tlb_flush);
+            flush_tlb_local();
+        }
+    }
+
+    i = ms->hash[h];
+    if ( i < ms->nr && ms->slot[i].mfn == mfn_x(mfn) )
+    {
+        perfc_incr(domain_page_hit);
+        slot = &ms->slot[i];
+        if ( !slot->refcnt++ )
+            slot_lru_del(ms, i);
+        ASSERT(slot->refcnt);
+        ASSERT(mfn_eq(l1e_get_mfn(MAPCACHE_L1ENT(ms->base + i)), mfn));
+        goto out;
+    }
+
+    perfc_incr(domain_page_miss);
+
+    /* Reassign the least recently used slot. */
+    i = ms->slot[ms->nr].next;
+    BUG_ON(i >= ms->nr);
+    slot = &ms->slot[i];
+    slot_lru_del(ms, i);
+
+    l1e_write(&MAPCACHE_L1ENT(ms->base + i),
+              l1e_from_mfn(mfn, __PAGE_HYPERVISOR_RW));
+    if ( slot->mfn != mfn_x(INVALID_MFN) )
+    {
+        perfc_incr(domain_page_evict);
+        flush_tlb_one_local(MAPCACHE_VIRT_START +
+                            pfn_to_paddr(ms->base + i));
+        ms->tlbflush_timestamp = tlbflush_current_time();
+    }
+
+    slot->mfn = mfn_x(mfn);
+    slot->refcnt = 1;
+    ms->hash[h] = i;
+
+ out:
+    local_irq_restore(flags);
+
+    return (void *)MAPCACHE_VIRT_START + pfn_to_paddr(ms->base + i);
+}
+
+static void mapcache_slot_unmap(struct mapcache_slots *ms, unsigned int idx)
+{
+    unsigned int i = idx - ms->base;
+    unsigned long flags;
+
+    ASSERT(i < ms->nr);
+    ASSERT(ms->slot[i].refcnt);
+
+    local_irq_save(flags);
+
+    /* Keep the mapping, for it to be found again by a later lookup. */
+    if ( !--ms->slot[i].refcnt )
+        slot_lru_add_tail(ms, i);
+
+    local_irq_restore(flags);
+}
+
+static int mapcache_slots_init(struct vcpu *v)
+{
+    struct mapcache_domain *dcache = &v->domain->arch.pv.mapcache;
+    unsigned int i, nr = dcache->vcpu_entries;
+    struct mapcache_slots *ms;
+
+    ms = xzalloc_flex_struct(struct mapcache_slots, slot, nr + 1);
+    if ( !ms )
+        return -ENOMEM;
+
+    ms->base = v->vcpu_id * nr;
+    ms->nr = nr;
+    ms->cpu = nr_cpu_ids;
+    memset(ms->hash, 0xff, sizeof(ms->hash));
+
+    ms->slot[nr].prev = ms->slot[nr].next = nr;
+    for ( i = 0; i < nr; i++ )
+    {
+        ms->slot[i].mfn = mfn_x(INVALID_MFN);
+        slot_lru_add_tail(ms, i);
+    }
+
+    v->arch.pv.mapcache.slots = ms;
+
+    return 0;
+}
+
 void *map_domain_page(mfn_t mfn)
 {
     unsigned long flags;
@@ -92,11 +251,15 @@ void *map_domain_page(mfn_t mfn)
 
     perfc_incr(map_domain_page_count);
 
+    if ( dcache->vcpu_entries )
+        return mapcache_slot_map(vcache->slots, mfn);
+
     local_irq_save(flags);
 
     hashent = &vcache->hash[MAPHASH_HASHFN(mfn_x(mfn))];
     if ( hashent->mfn == mfn_x(mfn) )
     {
+        perfc_incr(domain_page_hit);
         idx = hashent->idx;
         ASSERT(idx < dcache->entries);
         hashent->refcnt++;
@@ -105,6 +268,8 @@ void *map_domain_page(mfn_t mfn)
         goto out;
     }
 
+    perfc_incr(domain_page_miss);
+
     spin_lock(&dcache->lock);
 
     /* Has some other CPU caused a wrap? We must flush if so. */
@@ -193,6 +358,13 @@ void unmap_domain_page(const void *ptr)
     ASSERT(dcache->inuse);
 
     idx = PFN_DOWN(va - MAPCACHE_VIRT_START);
+
+    if ( dcache->vcpu_entries )
+    {
+        mapcache_slot_unmap(v->arch.pv.mapcache.slots, idx);
+        return;
+    }
+
     mfn = l1e_get_pfn(MAPCACHE_L1ENT(idx));
     hashent = &v->arch.pv.mapcache.hash[MAPHASH_HASHFN(mfn)];
 
@@ -253,6 +425,20 @@ int mapcache_domain_init(struct domain *d)
 
     spin_lock_init(&dcache->lock);
 
+    /*
+     * In per-VCPU mode, share out the mapcache area between the VCPUs, giving
+     * each of them more than the number of entries it could use at a time.
+     */
+    if ( opt_mapcache_per_vcpu )
+    {
+        unsigned int ents = min_t(unsigned int,
+                                  MAPCACHE_ENTRIES / d->max_vcpus,
+                                  MAPCACHE_SLOTS_MAX);
+
+        if ( ents > MAPCACHE_VCPU_ENTRIES )
+            dcache->vcpu_entries = ents;
+    }
+
     return create_perdomain_mapping(d, (unsigned long)dcache->inuse,
                                     2 * bitmap_pages + 1,
                                     NIL(l1_pgentry_t *), NULL);
@@ -269,6 +455,18 @@ int mapcache_vcpu_init(struct vcpu *v)
     if ( !is_pv_vcpu(v) || !dcache->inuse )
         return 0;
 
+    if ( dcache->vcpu_entries )
+    {
+        /* Populate page tables for this VCPU's range of entries only. */
+        int rc = create_perdomain_mapping(d, MAPCACHE_VIRT_START +
+                                          pfn_to_paddr(v->vcpu_id *
+                                                       dcache->vcpu_entries),
+                                          dcache->vcpu_entries,
+                                          NIL(l1_pgentry_t *), NULL);
+
+        return rc ?: mapcache_slots_init(v);
+    }
+
     if ( ents > dcache->entries )
     {
         /* Populate page tables. */
@@ -302,6 +500,11 @@ int mapcache_vcpu_init(struct vcpu *v)
     return 0;
 }
 
+void mapcache_vcpu_destroy(struct vcpu *v)
+{
+    XFREE(v->arch.pv.mapcache.slots);
+}
+
 void *map_domain_page_global(mfn_t mfn)
 {
     ASSERT(!in_irq() &&
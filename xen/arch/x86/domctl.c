@@ -187,6 +187,13 @@ static int do_vmtrace_op(struct domain *d, struct xen_domctl_vmtrace_op *op,
         rc = hvm_vmtrace_set_option(v, op->key, op->value);
         break;
 
+    case XEN_DOMCTL_vmtrace_stream_enable:
+    case XEN_DOMCTL_vmtrace_stream_disable:
+    case XEN_DOMCTL_vmtrace_stream_next:
+    case XEN_DOMCTL_vmtrace_stream_ack:
+        rc = hvm_vmtrace_stream_op(v, op->cmd, &op->key, &op->value);
+        break;
+
     default:
         rc = -EOPNOTSUPP;
         break;
@@ -196,6 +203,22 @@ static int do_vmtrace_op(struct domain *d, struct xen_domctl_vmtrace_op *op,
     return rc;
 }
 
+bool arch_do_domctl_unlocked(
+    struct xen_domctl *domctl, struct domain *d, long *ret)
+{
+    /* Ranged log-dirty operations. */
+    if ( domctl->cmd == XEN_DOMCTL_shadow_op &&
+         (domctl->u.shadow_op.op == XEN_DOMCTL_SHADOW_OP_CLEAN ||
+          domctl->u.shadow_op.op == XEN_DOMCTL_SHADOW_OP_PEEK) &&
+         (domctl->u.shadow_op.mode & XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE) )
+    {
+        *ret = paging_log_dirty_range_op(d, &domctl->u.shadow_op);
+        return true;
+    }
+
+    return false;
+}
+
 #define MAX_IOPORTS 0x10000
 
 long arch_do_domctl(
@@ -1083,6 +1106,88 @@ long arch_do_domctl(
         break;
     }
 
+#ifdef CONFIG_HVM
+    case XEN_DOMCTL_p2m_recoalesce:
+    {
+        struct xen_domctl_p2m_recoalesce *rec = &domctl->u.p2m_recoalesce;
+        struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+        if ( !is_hvm_domain(d) )
+        {
+            ret = -EINVAL;
+            break;
+        }
+
+        if ( rec->op == XEN_DOMCTL_P2M_RECOALESCE_START )
+            ret = p2m_recoalesce_start(d, true);
+        else if ( rec->op != XEN_DOMCTL_P2M_RECOALESCE_STATS )
+            ret = -EOPNOTSUPP;
+
+        if ( ret )
+            break;
+
+        p2m_lock(p2m);
+        rec->active = p2m->recoalesce.active;
+        rec->next_gfn = p2m->recoalesce.next_gfn;
+        rec->passes = p2m->recoalesce.passes;
+        rec->promoted_2m = p2m->recoalesce.promoted_2m;
+        rec->promoted_1g = p2m->recoalesce.promoted_1g;
+        p2m_unlock(p2m);
+
+        copyback = true;
+        break;
+    }
+
+    case XEN_DOMCTL_get_exit_stats:
+    {
+        struct xen_domctl_exit_stats *es = &domctl->u.exit_stats;
+        const struct vcpu *v = NULL, *w;
+        unsigned int i, nr = 0;
+
+        ret = -EINVAL;
+        if ( !is_hvm_domain(d) || es->pad )
+            break;
+
+        if ( es->vcpu != XEN_DOMCTL_EXIT_STATS_ALL_VCPUS &&
+             !(v = domain_vcpu(d, es->vcpu)) )
+            break;
+
+        ret = 0;
+        for ( i = 0; i < HVM_NR_EXIT_STATS; i++ )
+        {
+            xen_domctl_exit_stat_t stat = {
+                .reason = (i == HVM_EXIT_STATS_SVM_NPF && cpu_has_svm)
+                          ? VMEXIT_NPF : i,
+            };
+
+            for_each_vcpu ( d, w )
+            {
+                if ( v && w != v )
+                    continue;
+                stat.count += read_atomic(&w->arch.hvm.exit_stats->count[i]);
+                stat.cycles += read_atomic(&w->arch.hvm.exit_stats->cycles[i]);
+            }
+
+            if ( !stat.count )
+                continue;
+
+            if ( nr < es->nr_stats && !guest_handle_is_null(es->stats) &&
+                 copy_to_guest_offset(es->stats, nr, &stat, 1) )
+            {
+                ret = -EFAULT;
+                break;
+            }
+            nr++;
+        }
+
+        es->nr_stats = nr;
+        es->vendor = cpu_has_svm ? XEN_DOMCTL_EXIT_STATS_SVM
+                                 : XEN_DOMCTL_EXIT_STATS_VMX;
+        copyback = true;
+        break;
+    }
+#endif
+
     case XEN_DOMCTL_get_vcpu_msrs:
     case XEN_DOMCTL_set_vcpu_msrs:
     {
@@ -159,6 +159,7 @@ static int __init cf_check stub_selftest(void)
                        (addr & ~PAGE_MASK);
         union stub_exception_token res = { .raw = ~0 };
 
+        this_cpu(stubs.io_emul_key) = 0;
         memset(ptr, 0xcc, STUB_BUF_SIZE / 2);
         memcpy(ptr, tests[i].opc, ARRAY_SIZE(tests[i].opc));
         unmap_domain_page(ptr);
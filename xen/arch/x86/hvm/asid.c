@@ -12,6 +12,7 @@
 #include <xen/smp.h>
 #include <xen/percpu.h>
 #include <asm/hvm/asid.h>
+#include <asm/hvm/nestedhvm.h>
 
 /* Xen command-line option to enable ASIDs */
 static bool __read_mostly opt_asid_enabled = true;
@@ -81,6 +82,27 @@ void hvm_asid_flush_vcpu(struct vcpu *v)
     hvm_asid_flush_vcpu_asid(&vcpu_nestedhvm(v).nv_n2asid);
 }
 
+static bool asid_flush_live(struct hvm_vcpu_asid *asid)
+{
+    /*
+     * A zero generation means no VM entry has been made with the ASID since
+     * it was last flushed; the next entry will pick a fresh one.  ASID 0
+     * means ASIDs aren't in use, in which case nothing can be inferred.
+     */
+    return xchg(&asid->generation, 0) || !read_atomic(&asid->asid);
+}
+
+bool hvm_asid_flush_vcpu_live(struct vcpu *v)
+{
+    bool live = asid_flush_live(&v->arch.hvm.n1asid);
+
+    if ( asid_flush_live(&vcpu_nestedhvm(v).nv_n2asid) &&
+         nestedhvm_enabled(v->domain) )
+        live = true;
+
+    return live;
+}
+
 void hvm_asid_flush_core(void)
 {
     struct hvm_asid_data *data = &this_cpu(hvm_asid_data);
@@ -624,6 +624,7 @@ int dm_op(const struct dmop_args *op_args)
 
 #include <compat/hvm/dm_op.h>
 
+CHECK_dm_op_batch;
 CHECK_dm_op_create_ioreq_server;
 CHECK_dm_op_get_ioreq_server_info;
 CHECK_dm_op_ioreq_server_range;
@@ -671,7 +672,7 @@ int compat_dm_op(
 #undef XLAT_dm_op_buf_HNDL_h
     }
 
-    rc = dm_op(&args);
+    rc = dm_op_dispatch(&args);
 
     if ( rc == -ERESTART )
         rc = hypercall_create_continuation(__HYPERVISOR_dm_op, "iih",
@@ -14,6 +14,8 @@
 #include <xen/lib.h>
 #include <xen/sched.h>
 #include <xen/paging.h>
+#include <xen/param.h>
+#include <xen/perfc.h>
 #include <xen/trace.h>
 #include <xen/vm_event.h>
 #include <asm/event.h>
@@ -22,6 +24,7 @@
 #include <asm/hvm/emulate.h>
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/monitor.h>
+#include <asm/hvm/nestedhvm.h>
 #include <asm/hvm/trace.h>
 #include <asm/hvm/support.h>
 #include <asm/iocap.h>
@@ -734,6 +737,9 @@ static void hvmemul_unmap_linear_addr(
 #endif
 }
 
+/* Upper bound on the bytes covered by one batch of a string instruction. */
+#define HVMEMUL_MAX_REP_BYTES (64 * 1024)
+
 /*
  * Convert addr from linear to physical form, valid over the range
  * [addr, addr + *reps * bytes_per_rep]. *reps is adjusted according to
@@ -755,8 +761,12 @@ static int hvmemul_linear_to_phys(
     /*
      * Clip repetitions to a sensible maximum. This avoids extensive looping in
      * this function while still amortising the cost of I/O trap-and-emulate.
+     * The bound is mostly in bytes, so that narrow string operations get
+     * batched just like wide ones.
      */
-    *reps = min_t(unsigned long, *reps, 4096);
+    *reps = min_t(unsigned long, *reps,
+                  max_t(unsigned long, 4096,
+                        HVMEMUL_MAX_REP_BYTES / bytes_per_rep));
 
     /* With no paging it's easy: linear == physical. */
     if ( !(curr->arch.hvm.guest_cr[0] & X86_CR0_PG) )
@@ -1806,6 +1816,41 @@ static int cf_check hvmemul_rep_outs(
                                !!(ctxt->regs->eflags & X86_EFLAGS_DF), gpa);
 }
 
+/*
+ * RAM-to-RAM copy for REP MOVS, straight out of mappings of the source
+ * frames rather than via a bounce buffer covering the entire range.  Returns
+ * HVMTRANS_bad_gfn_to_mfn if a source frame can't be mapped, in which case
+ * the caller needs to fall back to hvm_copy_from_guest_phys().  The ranges
+ * may not overlap, which also makes redoing (part of) the copy harmless.
+ */
+static enum hvm_translation_result hvmemul_copy_ram(
+    paddr_t dgpa, paddr_t sgpa, unsigned long bytes, struct vcpu *curr)
+{
+    while ( bytes )
+    {
+        unsigned int offset = sgpa & ~PAGE_MASK;
+        unsigned long chunk = min_t(unsigned long, bytes, PAGE_SIZE - offset);
+        void *src = hvm_map_guest_frame_ro(paddr_to_pfn(sgpa), false);
+        enum hvm_translation_result rc;
+
+        if ( !src )
+            return HVMTRANS_bad_gfn_to_mfn;
+
+        rc = hvm_copy_to_guest_phys(dgpa, src + offset, chunk, curr);
+
+        hvm_unmap_guest_frame(src, false);
+
+        if ( rc != HVMTRANS_okay )
+            return rc;
+
+        sgpa += chunk;
+        dgpa += chunk;
+        bytes -= chunk;
+    }
+
+    return HVMTRANS_okay;
+}
+
 static int cf_check hvmemul_rep_movs(
    enum x86_segment src_seg,
    unsigned long src_offset,
@@ -1918,6 +1963,18 @@ static int cf_check hvmemul_rep_movs(
     if ( df )
         dgpa -= bytes - bytes_per_rep;
 
+    /*
+     * Without overlap between the two ranges the copy can be done piecemeal,
+     * straight from the source frames.
+     */
+    if ( likely(!hvmemul_ctxt->set_context) &&
+         ((dgpa + bytes) <= sgpa || (sgpa + bytes) <= dgpa) )
+    {
+        rc = hvmemul_copy_ram(dgpa, sgpa, bytes, curr);
+        if ( rc != HVMTRANS_bad_gfn_to_mfn )
+            goto done;
+    }
+
     /* Allocate temporary buffer. Fall back to slow emulation if this fails. */
     buf = xmalloc_bytes(bytes);
     if ( buf == NULL )
@@ -1953,6 +2010,7 @@ static int cf_check hvmemul_rep_movs(
 
     xfree(buf);
 
+ done:
     switch ( rc )
     {
     case HVMTRANS_need_retry:
@@ -2024,22 +2082,25 @@ static int cf_check hvmemul_rep_stos(
 
     switch ( p2mt )
     {
-        unsigned long bytes;
+        unsigned long bytes, chunk, done;
         char *buf;
 
     default:
-        /* Allocate temporary buffer. */
-        for ( ; ; )
-        {
-            bytes = *reps * bytes_per_rep;
-            buf = xmalloc_bytes(bytes);
-            if ( buf || *reps <= 1 )
-                break;
-            *reps >>= 1;
-        }
+        /*
+         * Allocate temporary buffer, covering at most a page worth of
+         * repetitions.  It is copied as often as needed.
+         */
+        bytes = *reps * bytes_per_rep;
+        chunk = min_t(unsigned long, bytes,
+                      PAGE_SIZE - PAGE_SIZE % bytes_per_rep);
+        buf = xmalloc_bytes(chunk);
 
         if ( !buf )
+        {
+            *reps = 1;
+            bytes = chunk = bytes_per_rep;
             buf = p_data;
+        }
         else
             switch ( bytes_per_rep )
             {
@@ -2051,7 +2112,8 @@ static int cf_check hvmemul_rep_stos(
                       : "=m" (*buf),                           \
                         "=D" (dummy), "=c" (dummy)             \
                       : "a" (*(const uint##bits##_t *)p_data), \
-                        "1" (buf), "2" (*reps) : "memory" );   \
+                        "1" (buf), "2" (chunk / bytes_per_rep) \
+                      : "memory" );                            \
                 break
             CASE(8, b);
             CASE(16, w);
@@ -2069,7 +2131,10 @@ static int cf_check hvmemul_rep_stos(
         if ( df )
             gpa -= bytes - bytes_per_rep;
 
-        rc = hvm_copy_to_guest_phys(gpa, buf, bytes, curr);
+        for ( done = 0, rc = HVMTRANS_okay;
+              rc == HVMTRANS_okay && done < bytes; done += chunk )
+            rc = hvm_copy_to_guest_phys(gpa + done, buf,
+                                        min(chunk, bytes - done), curr);
 
         if ( buf != p_data )
             xfree(buf);
@@ -2518,6 +2583,7 @@ static int cf_check hvmemul_tlb_op(
     case x86emul_invpcid:
         if ( x86emul_invpcid_type(aux) != X86_INVPCID_INDIV_ADDR )
         {
+            hvmemul_insn_xlat_flush(current);
             hvm_asid_flush_vcpu(current);
             break;
         }
@@ -2849,6 +2915,112 @@ void hvm_emulate_init_once(
     hvmemul_ctxt->ctxt.force_writeback = true;
 }
 
+/*
+ * Emulation of the same few instructions (e.g. a driver's MMIO doorbell
+ * write) tends to be requested over and over.  Remember the translations of
+ * recent instruction fetches, so that the guest page tables don't need
+ * walking each time.  The code bytes themselves are still read afresh from
+ * the recorded frame, so code modifications are picked up.  The translations
+ * are dropped on every TLB flush Xen gets to see: CR0/CR3/CR4 writes, INVLPG,
+ * INVLPGA and INVPCID, paging_flush_tlb() (e.g. HVMOP_flush_tlbs) and P2M
+ * updates.  With HAP however a guest can change its page tables and flush
+ * its TLB without Xen noticing.  Hence this is off by default.
+ */
+static bool __ro_after_init opt_insn_xlat_cache;
+boolean_param("hvm-insn-fetch-cache", opt_insn_xlat_cache);
+
+void hvmemul_insn_xlat_flush(struct vcpu *v)
+{
+    struct hvm_vcpu_io *hvio = &v->arch.hvm.hvm_io;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(hvio->insn_xlat); i++ )
+        hvio->insn_xlat[i].gfn = INVALID_GFN;
+}
+
+/*
+ * Invalidate the translations cached by all of @d's vCPUs.  Other vCPUs may
+ * be running, so rather than altering their state just move the domain's
+ * generation on: entries recorded under an earlier one are ignored.
+ */
+void hvmemul_insn_xlat_flush_domain(struct domain *d)
+{
+    if ( opt_insn_xlat_cache && is_hvm_domain(d) )
+        atomic_inc(&d->arch.hvm.insn_xlat_gen);
+}
+
+static bool insn_xlat_usable(const struct vcpu *v)
+{
+    return opt_insn_xlat_cache && hvm_paging_enabled(v) &&
+           !nestedhvm_vcpu_in_guestmode(v);
+}
+
+static unsigned int insn_xlat_fetch(struct hvm_emulate_ctxt *hvmemul_ctxt,
+                                    unsigned long addr, uint32_t pfec)
+{
+    struct vcpu *curr = current;
+    struct hvm_vcpu_io *hvio = &curr->arch.hvm.hvm_io;
+    unsigned int i, offs = addr & ~PAGE_MASK;
+    unsigned int bytes = min_t(unsigned int, sizeof(hvmemul_ctxt->insn_buf),
+                               PAGE_SIZE - offs);
+
+    for ( i = 0; i < ARRAY_SIZE(hvio->insn_xlat); i++ )
+    {
+        struct hvm_insn_xlat *xlat = &hvio->insn_xlat[i];
+
+        if ( gfn_eq(xlat->gfn, INVALID_GFN) ||
+             xlat->linear != (addr & PAGE_MASK) ||
+             xlat->cr3 != curr->arch.hvm.guest_cr[3] ||
+             xlat->pfec != pfec ||
+             xlat->gen != atomic_read(&curr->domain->arch.hvm.insn_xlat_gen) )
+            continue;
+
+        /*
+         * Any bytes beyond the end of the page will be fetched (with a
+         * full translation) by hvmemul_insn_fetch() if actually needed.
+         */
+        if ( hvm_copy_from_guest_phys(hvmemul_ctxt->insn_buf,
+                                      gfn_to_gaddr(xlat->gfn) + offs,
+                                      bytes) == HVMTRANS_okay )
+        {
+            perfc_incr(hvm_insn_xlat_hit);
+            return bytes;
+        }
+
+        xlat->gfn = INVALID_GFN;
+        break;
+    }
+
+    perfc_incr(hvm_insn_xlat_miss);
+
+    return 0;
+}
+
+static void insn_xlat_insert(unsigned long addr, uint32_t pfec)
+{
+    struct vcpu *curr = current;
+    struct hvm_vcpu_io *hvio = &curr->arch.hvm.hvm_io;
+    struct hvm_insn_xlat *xlat;
+    uint32_t walk_pfec = pfec;
+    unsigned int gen = atomic_read(&curr->domain->arch.hvm.insn_xlat_gen);
+    gfn_t gfn;
+
+    /* Sample the generation first, so a racing flush isn't missed. */
+    smp_rmb();
+    gfn = _gfn(paging_gva_to_gfn(curr, addr, &walk_pfec));
+
+    if ( gfn_eq(gfn, INVALID_GFN) )
+        return;
+
+    xlat = &hvio->insn_xlat[hvio->insn_xlat_next++ %
+                            ARRAY_SIZE(hvio->insn_xlat)];
+    xlat->cr3 = curr->arch.hvm.guest_cr[3];
+    xlat->linear = addr & PAGE_MASK;
+    xlat->pfec = pfec;
+    xlat->gen = gen;
+    xlat->gfn = gfn;
+}
+
 void hvm_emulate_init_per_insn(
     struct hvm_emulate_ctxt *hvmemul_ctxt,
     const unsigned char *insn_buf,
@@ -2882,26 +3054,357 @@ void hvm_emulate_init_per_insn(
         unsigned int pfec = PFEC_page_present | PFEC_insn_fetch;
         unsigned long addr;
 
+        bool use_xlat = insn_xlat_usable(curr);
+
         if ( hvmemul_ctxt->seg_reg[x86_seg_ss].dpl == 3 )
             pfec |= PFEC_user_mode;
 
-        hvmemul_ctxt->insn_buf_bytes =
-            (hvm_virtual_to_linear_addr(x86_seg_cs,
-                                        &hvmemul_ctxt->seg_reg[x86_seg_cs],
-                                        hvmemul_ctxt->insn_buf_eip,
-                                        sizeof(hvmemul_ctxt->insn_buf),
-                                        hvm_access_insn_fetch,
-                                        &hvmemul_ctxt->seg_reg[x86_seg_cs],
-                                        &addr) &&
-             hvm_copy_from_guest_linear(hvmemul_ctxt->insn_buf, addr,
-                                        sizeof(hvmemul_ctxt->insn_buf),
-                                        pfec, NULL) == HVMTRANS_okay) ?
-            sizeof(hvmemul_ctxt->insn_buf) : 0;
+        if ( !hvm_virtual_to_linear_addr(x86_seg_cs,
+                                         &hvmemul_ctxt->seg_reg[x86_seg_cs],
+                                         hvmemul_ctxt->insn_buf_eip,
+                                         sizeof(hvmemul_ctxt->insn_buf),
+                                         hvm_access_insn_fetch,
+                                         &hvmemul_ctxt->seg_reg[x86_seg_cs],
+                                         &addr) )
+            hvmemul_ctxt->insn_buf_bytes = 0;
+        else if ( !use_xlat ||
+                  !(hvmemul_ctxt->insn_buf_bytes =
+                    insn_xlat_fetch(hvmemul_ctxt, addr, pfec)) )
+        {
+            if ( hvm_copy_from_guest_linear(hvmemul_ctxt->insn_buf, addr,
+                                            sizeof(hvmemul_ctxt->insn_buf),
+                                            pfec, NULL) != HVMTRANS_okay )
+                hvmemul_ctxt->insn_buf_bytes = 0;
+            else
+            {
+                hvmemul_ctxt->insn_buf_bytes = sizeof(hvmemul_ctxt->insn_buf);
+                if ( use_xlat )
+                    insn_xlat_insert(addr, pfec);
+            }
+        }
     }
 
     hvmemul_ctxt->is_mem_access = false;
 }
 
+/*
+ * Fast path for MMIO accesses handled within Xen by plain MOV instructions
+ * (opcodes 88, 89, 8A, 8B, C6 /0, and C7 /0) in 32- or 64-bit code.  Only
+ * as much of the instruction gets decoded as is needed to know operand size,
+ * direction, and register or immediate, and to establish the operand's offset
+ * within its page.  The page itself is known from the fault, so the data
+ * access doesn't need translating, and the generic emulator is bypassed
+ * altogether.  Anything not fitting this pattern is left to the caller to
+ * deal with through handle_mmio(), but only up to the point where an I/O
+ * handler gets invoked: from there on the access is seen through here.
+ */
+static bool mmio_fast_path(unsigned long gla, paddr_t gpa, struct npfec npfec)
+{
+    struct vcpu *curr = current;
+    struct vcpu_io *vio = &curr->io;
+    struct cpu_user_regs *regs = guest_cpu_user_regs();
+    struct segment_register cs, sreg;
+    const struct hvm_io_handler *handler;
+    uint8_t insn[MAX_INST_LEN], opc, modrm, sib;
+    unsigned int len, i = 0, rex = 0, reg, base, size, offs;
+    enum x86_segment seg = x86_seg_none;
+    bool mode64, opsize16 = false, rip_rel = false;
+    unsigned long ea = 0, *gpr;
+    int32_t disp = 0;
+    uint64_t data = 0;
+    ioreq_t p = {
+        .type = IOREQ_TYPE_COPY,
+        .count = 1,
+        .state = STATE_IOREQ_READY,
+    };
+    int rc;
+
+    /* The fault needs to be for the data access itself. */
+    if ( npfec.kind != npfec_kind_with_gla || npfec.insn_fetch )
+        return false;
+
+    if ( vio->req.state != STATE_IOREQ_NONE ||
+         (regs->eflags & (X86_EFLAGS_TF | X86_EFLAGS_VM)) ||
+         !(curr->arch.hvm.guest_cr[0] & X86_CR0_PE) ||
+         alternative_call(hvm_funcs.get_interrupt_shadow, curr) )
+        return false;
+
+    hvm_get_segment_register(curr, x86_seg_cs, &cs);
+    mode64 = hvm_long_mode_active(curr) && cs.l;
+    if ( !mode64 && !cs.db )
+        return false;
+
+    if ( !(len = hvm_get_insn_bytes(curr, insn)) )
+    {
+        unsigned long addr = cs.base + regs->rip;
+        uint32_t pfec = PFEC_page_present | PFEC_insn_fetch;
+
+        if ( !mode64 )
+            addr = (uint32_t)addr;
+
+        hvm_get_segment_register(curr, x86_seg_ss, &sreg);
+        if ( sreg.dpl == 3 )
+            pfec |= PFEC_user_mode;
+
+        /* Don't fetch across a page boundary: the insn may well not. */
+        len = min_t(unsigned int, sizeof(insn),
+                    PAGE_SIZE - (addr & ~PAGE_MASK));
+        if ( hvm_copy_from_guest_linear(insn, addr, len, pfec,
+                                        NULL) != HVMTRANS_okay )
+            return false;
+    }
+
+#define NEXT_BYTE() ({ if ( i >= len ) return false; insn[i++]; })
+
+    /* Segment overrides and operand size are the only prefixes permitted. */
+    for ( ; ; )
+    {
+        switch ( opc = NEXT_BYTE() )
+        {
+        case 0x26: seg = x86_seg_es; continue;
+        case 0x2e: seg = x86_seg_cs; continue;
+        case 0x36: seg = x86_seg_ss; continue;
+        case 0x3e: seg = x86_seg_ds; continue;
+        case 0x64: seg = x86_seg_fs; continue;
+        case 0x65: seg = x86_seg_gs; continue;
+        case 0x66: opsize16 = true;  continue;
+        }
+        break;
+    }
+
+    if ( mode64 && (opc & 0xf0) == 0x40 )
+    {
+        rex = opc;
+        opc = NEXT_BYTE();
+    }
+
+    switch ( opc )
+    {
+    case 0x88: case 0x89: /* mov r,r/m */
+    case 0xc6: case 0xc7: /* mov imm,r/m */
+        p.dir = IOREQ_WRITE;
+        break;
+
+    case 0x8a: case 0x8b: /* mov r/m,r */
+        p.dir = IOREQ_READ;
+        break;
+
+    default:
+        return false;
+    }
+
+    if ( npfec.write_access != (p.dir == IOREQ_WRITE) )
+        return false;
+
+    modrm = NEXT_BYTE();
+    if ( (modrm & 0xc0) == 0xc0 ||
+         ((opc & 0xfe) == 0xc6 && (modrm & 0x38)) )
+        return false;
+
+    size = !(opc & 1) ? 1 : (rex & 8) ? 8 : opsize16 ? 2 : 4;
+    reg = ((modrm >> 3) & 7) | ((rex & 4) << 1);
+
+    base = modrm & 7;
+    if ( base == 4 )
+    {
+        unsigned int index;
+
+        sib = NEXT_BYTE();
+        index = ((sib >> 3) & 7) | ((rex & 2) << 2);
+        if ( index != 4 )
+            ea = *decode_gpr(regs, index) << (sib >> 6);
+        base = sib & 7;
+    }
+
+    if ( !(modrm & 0xc0) && base == 5 )
+    {
+        /* No base register: disp32, or RIP-relative in 64-bit mode. */
+        rip_rel = mode64 && (modrm & 7) == 5;
+        base = ~0;
+    }
+    else
+    {
+        base |= (rex & 1) << 3;
+        ea += *decode_gpr(regs, base);
+    }
+
+    if ( (modrm & 0xc0) == 0x40 )
+        disp = (int8_t)NEXT_BYTE();
+    else if ( (modrm & 0xc0) == 0x80 || base == ~0 )
+    {
+        disp = NEXT_BYTE();
+        disp |= NEXT_BYTE() << 8;
+        disp |= NEXT_BYTE() << 16;
+        disp |= (uint32_t)NEXT_BYTE() << 24;
+    }
+    ea += disp;
+
+    if ( (opc & 0xfe) == 0xc6 )
+    {
+        /* Immediates are at most 32 bits, and get sign-extended. */
+        switch ( size )
+        {
+        case 1:
+            data = (int8_t)NEXT_BYTE();
+            break;
+
+        case 2:
+            data = NEXT_BYTE();
+            data = (int16_t)(data | (NEXT_BYTE() << 8));
+            break;
+
+        default:
+            data = NEXT_BYTE();
+            data |= NEXT_BYTE() << 8;
+            data |= NEXT_BYTE() << 16;
+            data = (int32_t)(data | ((uint32_t)NEXT_BYTE() << 24));
+            break;
+        }
+    }
+    else if ( p.dir == IOREQ_WRITE )
+        data = (size == 1 && !rex && reg >= 4)
+               ? *decode_gpr(regs, reg - 4) >> 8
+               : *decode_gpr(regs, reg);
+
+#undef NEXT_BYTE
+
+    if ( rip_rel )
+        ea += regs->rip + i;
+
+    if ( !mode64 )
+    {
+        if ( seg == x86_seg_none )
+            seg = (base == 4 || base == 5) ? x86_seg_ss : x86_seg_ds;
+        hvm_get_segment_register(curr, seg, &sreg);
+        ea = (uint32_t)((uint32_t)ea + sreg.base);
+    }
+    else if ( seg == x86_seg_fs || seg == x86_seg_gs )
+    {
+        hvm_get_segment_register(curr, seg, &sreg);
+        ea += sreg.base;
+    }
+
+    /*
+     * The operand needs to be what the fault was raised for.  It may not be
+     * if e.g. the instruction bytes were changed by another vCPU after the
+     * fault, or if (e.g. in 32-bit code) the decoding above went wrong.
+     * Accesses crossing a page boundary can't be dealt with here.
+     */
+    offs = ea & ~PAGE_MASK;
+    if ( ea != gla || offs != (gpa & ~PAGE_MASK) || offs + size > PAGE_SIZE )
+        return false;
+
+    p.addr = gpa;
+    p.size = size;
+    if ( p.dir == IOREQ_WRITE )
+        p.data = size < 8 ? data & ((1UL << (size * 8)) - 1) : data;
+
+    handler = hvm_find_io_handler(&p);
+    if ( !handler )
+        return false;
+
+    if ( p.dir == IOREQ_WRITE )
+        hvmtrace_io_assist(&p);
+
+    vio->req = p;
+    rc = hvm_process_io_intercept(handler, &p);
+    if ( handler->ops->complete )
+        handler->ops->complete(handler);
+
+    /*
+     * A handler may decline an access it accepted, for it to be forwarded to
+     * a device model, possibly after having acted upon it (msixtbl_write()
+     * does so).  Handlers mustn't see the same access twice, so the full
+     * emulator can't be left to deal with the access anymore: forward it
+     * from here, like hvmemul_do_io() would.
+     */
+    if ( rc == X86EMUL_UNHANDLEABLE )
+    {
+        struct ioreq_server *s = ioreq_server_select(curr->domain, &p);
+
+        if ( !s )
+            rc = hvm_process_io_intercept(&null_handler, &p);
+        else
+        {
+            rc = ioreq_send(s, &p, 0);
+            if ( rc == X86EMUL_RETRY && !vio->suspended )
+            {
+                if ( !ioreq_needs_completion(&vio->req) )
+                    rc = X86EMUL_OKAY;
+                else
+                {
+                    /*
+                     * Once the device model has responded, the instruction
+                     * gets emulated by handle_mmio(), picking up the response
+                     * instead of re-issuing the access.
+                     */
+                    vio->completion = VIO_mmio_completion;
+                    return true;
+                }
+            }
+        }
+    }
+
+    vio->req.state = STATE_IOREQ_NONE;
+
+    switch ( rc )
+    {
+    case X86EMUL_OKAY:
+        break;
+
+    case X86EMUL_RETRY:
+        /* Have the guest re-execute the instruction. */
+        return true;
+
+    default:
+        /* As the caller would if handle_mmio() failed. */
+        hvm_inject_hw_exception(X86_EXC_GP, 0);
+        return true;
+    }
+
+    if ( p.dir == IOREQ_READ )
+    {
+        hvmtrace_io_assist(&p);
+
+        if ( size == 1 && !rex && reg >= 4 )
+        {
+            gpr = decode_gpr(regs, reg - 4);
+            *gpr = (*gpr & ~0xff00UL) | ((p.data & 0xff) << 8);
+        }
+        else
+        {
+            gpr = decode_gpr(regs, reg);
+            switch ( size )
+            {
+            case 1: *(uint8_t *)gpr = p.data; break;
+            case 2: *(uint16_t *)gpr = p.data; break;
+            case 4: *gpr = (uint32_t)p.data; break;
+            case 8: *gpr = p.data; break;
+            }
+        }
+    }
+
+    regs->rip += i;
+    if ( !mode64 )
+        regs->rip = (uint32_t)regs->rip;
+    regs->eflags &= ~X86_EFLAGS_RF;
+
+    return true;
+}
+
+bool hvm_mmio_fast_path(unsigned long gla, paddr_t gpa, struct npfec npfec)
+{
+    if ( !mmio_fast_path(gla, gpa, npfec) )
+    {
+        perfc_incr(hvm_mmio_slow);
+        return false;
+    }
+
+    perfc_incr(hvm_mmio_fast);
+
+    return true;
+}
+
 void hvm_emulate_writeback(
     struct hvm_emulate_ctxt *hvmemul_ctxt)
 {
@@ -2986,6 +3489,8 @@ int hvmemul_cache_init(struct vcpu *v)
 
     v->arch.hvm.hvm_io.cache = cache;
 
+    hvmemul_insn_xlat_flush(v);
+
     return 0;
 }
 
@@ -7,6 +7,7 @@
  * Copyright (c) 2008, Citrix Systems, Inc.
  */
 
+#include <xen/console.h>
 #include <xen/ctype.h>
 #include <xen/init.h>
 #include <xen/ioreq.h>
@@ -493,7 +494,9 @@ void hvm_migrate_pirqs(struct vcpu *v)
 {
     struct domain *d = v->domain;
 
-    if ( !is_iommu_enabled(d) || !hvm_domain_irq(d)->dpci )
+    /* With hysteresis, re-targeting is done upon interrupt arrival instead. */
+    if ( !is_iommu_enabled(d) || !hvm_domain_irq(d)->dpci ||
+         opt_pt_irq_hysteresis )
        return;
 
     read_lock(&d->event_lock);
@@ -572,7 +575,8 @@ static int cf_check hvm_print_line(
     if ( (cd->pbuf_idx == (DOMAIN_PBUF_SIZE - 1)) || (c == '\n') )
     {
         cd->pbuf[cd->pbuf_idx] = '\0';
-        guest_printk(cd, XENLOG_G_DEBUG "%s\n", cd->pbuf);
+        if ( guest_console_ratelimit(cd, cd->pbuf_idx) )
+            guest_printk(cd, XENLOG_G_DEBUG "%s\n", cd->pbuf);
         cd->pbuf_idx = 0;
     }
     spin_unlock(&cd->pbuf_lock);
@@ -608,6 +612,8 @@ int hvm_domain_initialise(struct domain *d,
 
     hvm_init_cacheattr_region_list(d);
 
+    d->arch.hvm.ipi_virt = config->arch.misc_flags & XEN_X86_IPI_VIRT;
+
     rc = paging_enable(d, PG_refcounts|PG_translate|PG_external);
     if ( rc != 0 )
         goto fail0;
@@ -617,12 +623,14 @@ int hvm_domain_initialise(struct domain *d,
     d->arch.hvm.params = xzalloc_array(uint64_t, HVM_NR_PARAMS);
     d->arch.hvm.io_handler = xzalloc_array(struct hvm_io_handler,
                                            NR_IO_HANDLERS);
+    d->arch.hvm.io_range = xzalloc_array(struct hvm_io_range, NR_IO_HANDLERS);
     d->arch.hvm.irq = xzalloc_flex_struct(struct hvm_irq,
                                           gsi_assert_count, nr_gsis);
 
     rc = -ENOMEM;
     if ( !d->arch.hvm.pl_time || !d->arch.hvm.irq ||
-         !d->arch.hvm.params  || !d->arch.hvm.io_handler )
+         !d->arch.hvm.params  || !d->arch.hvm.io_handler ||
+         !d->arch.hvm.io_range )
         goto fail1;
 
     /* Set the number of GSIs */
@@ -698,6 +706,7 @@ int hvm_domain_initialise(struct domain *d,
  fail:
     hvm_domain_relinquish_resources(d);
     XFREE(d->arch.hvm.io_handler);
+    XFREE(d->arch.hvm.io_range);
     XFREE(d->arch.hvm.pl_time);
     return rc;
 }
@@ -741,6 +750,7 @@ void hvm_domain_destroy(struct domain *d)
     hvm_domain_relinquish_resources(d);
 
     XFREE(d->arch.hvm.io_handler);
+    XFREE(d->arch.hvm.io_range);
     XFREE(d->arch.hvm.params);
 
     hvm_destroy_cacheattr_region_list(d);
@@ -1553,8 +1563,13 @@ int hvm_vcpu_initialise(struct vcpu *v)
 
     hvm_asid_flush_vcpu(v);
 
-    spin_lock_init(&v->arch.hvm.tm_lock);
-    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    pt_vcpu_init(v);
+
+    v->arch.hvm.exit_stats = xzalloc(struct hvm_exit_stats);
+    v->arch.hvm.exit_idx = HVM_NR_EXIT_STATS;
+    rc = -ENOMEM;
+    if ( !v->arch.hvm.exit_stats )
+        goto fail1;
 
     rc = hvm_vcpu_cacheattr_init(v); /* teardown: vcpu_cacheattr_destroy */
     if ( rc != 0 )
@@ -1621,6 +1636,7 @@ int hvm_vcpu_initialise(struct vcpu *v)
     hvm_vcpu_cacheattr_destroy(v);
  fail1:
     viridian_vcpu_deinit(v);
+    XFREE(v->arch.hvm.exit_stats);
     return rc;
 }
 
@@ -1642,7 +1658,11 @@ void hvm_vcpu_destroy(struct vcpu *v)
 
     vlapic_destroy(v);
 
+    pt_vcpu_destroy(v);
+
     hvm_vcpu_cacheattr_destroy(v);
+
+    XFREE(v->arch.hvm.exit_stats);
 }
 
 void hvm_vcpu_down(struct vcpu *v)
@@ -1805,7 +1825,8 @@ int hvm_hap_nested_page_fault(paddr_t gpa, unsigned long gla,
      */
     if ( !nestedhvm_vcpu_in_guestmode(curr) && hvm_mmio_internal(gpa) )
     {
-        if ( !handle_mmio_with_translation(gla, gpa >> PAGE_SHIFT, npfec) )
+        if ( !hvm_mmio_fast_path(gla, gpa, npfec) &&
+             !handle_mmio_with_translation(gla, gpa >> PAGE_SHIFT, npfec) )
             hvm_inject_hw_exception(X86_EXC_GP, 0);
         rc = 1;
         goto out;
@@ -2384,6 +2405,7 @@ int hvm_set_cr0(unsigned long value, bool may_defer)
         alternative_vcall(hvm_funcs.handle_cd, v, value);
 
     hvm_update_cr(v, 0, value);
+    hvmemul_insn_xlat_flush(v);
 
     if ( (value ^ old_value) & X86_CR0_PG ) {
         if ( !nestedhvm_vmswitch_in_progress(v) && nestedhvm_vcpu_in_guestmode(v) )
@@ -2442,6 +2464,7 @@ int hvm_set_cr3(unsigned long value, bool noflush, bool may_defer)
 
     curr->arch.hvm.guest_cr[3] = value;
     paging_update_cr3(curr, noflush);
+    hvmemul_insn_xlat_flush(curr);
     return X86EMUL_OKAY;
 
  bad_cr3:
@@ -2506,6 +2529,7 @@ int hvm_set_cr4(unsigned long value, bool may_defer)
     }
 
     hvm_update_cr(v, 4, value);
+    hvmemul_insn_xlat_flush(v);
 
     /*
      * Modifying CR4.{PSE,PAE,PGE,SMEP}, or clearing CR4.PCIDE
@@ -4096,6 +4120,39 @@ static int hvmop_flush_tlb_all(void)
     return paging_flush_tlb(NULL) ? 0 : -ERESTART;
 }
 
+static int hvmop_flush_tlbs_vcpus(
+    XEN_GUEST_HANDLE_PARAM(xen_hvm_flush_tlbs_vcpus_t) uop)
+{
+    DECLARE_BITMAP(mask, HVM_MAX_VCPUS);
+    const struct domain *d = current->domain;
+    xen_hvm_flush_tlbs_vcpus_t op;
+    unsigned int i;
+
+    if ( !is_hvm_domain(d) )
+        return -EINVAL;
+
+    if ( copy_from_guest(&op, uop, 1) )
+        return -EFAULT;
+
+    if ( op.pad )
+        return -EINVAL;
+
+    if ( op.first_vcpu >= d->max_vcpus )
+        return 0;
+
+    bitmap_zero(mask, HVM_MAX_VCPUS);
+
+    for ( i = 0; op.mask && op.first_vcpu + i < d->max_vcpus;
+          i++, op.mask >>= 1 )
+        if ( op.mask & 1 )
+            __set_bit(op.first_vcpu + i, mask);
+
+    if ( bitmap_empty(mask, HVM_MAX_VCPUS) )
+        return 0;
+
+    return paging_flush_tlb(mask) ? 0 : -ERESTART;
+}
+
 static int hvmop_set_evtchn_upcall_vector(
     XEN_GUEST_HANDLE_PARAM(xen_hvm_evtchn_upcall_vector_t) uop)
 {
@@ -4243,7 +4300,7 @@ static int hvm_set_param(struct domain *d, uint32_t index, uint64_t value)
          * the domctl_lock.
          */
         rc = -ERESTART;
-        if ( !domctl_lock_acquire() )
+        if ( !domctl_lock_acquire(d) )
             break;
 
         rc = 0;
@@ -4253,7 +4310,7 @@ static int hvm_set_param(struct domain *d, uint32_t index, uint64_t value)
             paging_update_cr3(v, false);
         domain_unpause(d);
 
-        domctl_lock_release();
+        domctl_lock_release(d);
         break;
     case HVM_PARAM_DM_DOMAIN:
         /* The only value this should ever be set to is DOMID_SELF */
@@ -5070,6 +5127,11 @@ long do_hvm_op(unsigned long op, XEN_GUEST_HANDLE_PARAM(void) arg)
         rc = guest_handle_is_null(arg) ? hvmop_flush_tlb_all() : -EINVAL;
         break;
 
+    case HVMOP_flush_tlbs_vcpus:
+        rc = hvmop_flush_tlbs_vcpus(
+            guest_handle_cast(arg, xen_hvm_flush_tlbs_vcpus_t));
+        break;
+
     case HVMOP_get_mem_type:
         rc = hvmop_get_mem_type(
             guest_handle_cast(arg, xen_hvm_get_mem_type_t));
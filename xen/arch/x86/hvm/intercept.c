@@ -213,18 +213,62 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
     return rc;
 }
 
-static const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
+/*
+ * Find the earliest registered port I/O handler with a static range covering
+ * the entire access, without invoking any accept hooks.  Returns
+ * io_handler_count if there's none.
+ */
+static unsigned int find_portio_handler(const struct hvm_domain *hvm,
+                                        const ioreq_t *p)
 {
-    struct domain *curr_d = current->domain;
-    unsigned int i;
+    unsigned int lo = 0, hi = hvm->io_range_count;
+    unsigned int best = hvm->io_handler_count;
+
+    /* Determine the number of ranges starting at or below the port. */
+    while ( lo < hi )
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if ( hvm->io_range[mid].first <= p->addr )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /*
+     * Ranges may overlap, so check all which can possibly cover the access.
+     * The handler's present port is what counts (see
+     * relocate_portio_handler()), not the one recorded in the index.
+     */
+    while ( lo-- && p->addr - hvm->io_range[lo].first < hvm->io_range_max )
+    {
+        unsigned int idx = hvm->io_range[lo].idx;
+        const struct hvm_io_handler *handler = &hvm->io_handler[idx];
+
+        if ( idx < best &&
+             p->addr >= handler->portio.port &&
+             p->addr + p->size <= handler->portio.port + handler->portio.size )
+            best = idx;
+    }
+
+    return best;
+}
+
+const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
+{
+    const struct hvm_domain *hvm = &current->domain->arch.hvm;
+    unsigned int i, best = hvm->io_handler_count;
 
     BUG_ON((p->type != IOREQ_TYPE_PIO) &&
            (p->type != IOREQ_TYPE_COPY));
 
-    for ( i = 0; i < curr_d->arch.hvm.io_handler_count; i++ )
+    if ( p->type == IOREQ_TYPE_PIO )
+        best = find_portio_handler(hvm, p);
+
+    /* Handlers registered earlier than the one found take precedence. */
+    for_each_set_bit ( i, &hvm->io_handler_dynamic, best )
     {
-        const struct hvm_io_handler *handler =
-            &curr_d->arch.hvm.io_handler[i];
+        const struct hvm_io_handler *handler = &hvm->io_handler[i];
         const struct hvm_io_ops *ops = handler->ops;
 
         if ( handler->type != p->type )
@@ -234,7 +278,7 @@ static const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p)
             return handler;
     }
 
-    return NULL;
+    return best < hvm->io_handler_count ? &hvm->io_handler[best] : NULL;
 }
 
 int hvm_io_intercept(ioreq_t *p)
@@ -262,6 +306,7 @@ struct hvm_io_handler *hvm_next_io_handler(struct domain *d)
     unsigned int i = d->arch.hvm.io_handler_count++;
 
     ASSERT(d->arch.hvm.io_handler);
+    BUILD_BUG_ON(NR_IO_HANDLERS > BITS_PER_LONG);
 
     if ( i == NR_IO_HANDLERS )
     {
@@ -269,6 +314,9 @@ struct hvm_io_handler *hvm_next_io_handler(struct domain *d)
         return NULL;
     }
 
+    /* Until known otherwise, the handler's accept hook needs using. */
+    __set_bit(i, &d->arch.hvm.io_handler_dynamic);
+
     return &d->arch.hvm.io_handler[i];
 }
 
@@ -285,6 +333,29 @@ void register_mmio_handler(struct domain *d,
     handler->mmio.ops = ops;
 }
 
+/*
+ * Enter a port I/O handler into the range index, such that it can be found
+ * without calling its accept hook.  Only to be used while the domain can't
+ * run yet.
+ */
+static void io_range_insert(struct domain *d, unsigned int idx)
+{
+    struct hvm_domain *hvm = &d->arch.hvm;
+    const struct hvm_io_handler *handler = &hvm->io_handler[idx];
+    unsigned int i = hvm->io_range_count++;
+
+    for ( ; i && hvm->io_range[i - 1].first > handler->portio.port; i-- )
+        hvm->io_range[i] = hvm->io_range[i - 1];
+
+    hvm->io_range[i].first = handler->portio.port;
+    hvm->io_range[i].size = handler->portio.size;
+    hvm->io_range[i].idx = idx;
+
+    hvm->io_range_max = max(hvm->io_range_max, handler->portio.size);
+
+    __clear_bit(idx, &hvm->io_handler_dynamic);
+}
+
 void register_portio_handler(struct domain *d, unsigned int port,
                              unsigned int size, portio_action_t action)
 {
@@ -298,6 +369,8 @@ void register_portio_handler(struct domain *d, unsigned int port,
     handler->portio.port = port;
     handler->portio.size = size;
     handler->portio.action = action;
+
+    io_range_insert(d, handler - d->arch.hvm.io_handler);
 }
 
 bool relocate_portio_handler(struct domain *d, unsigned int old_port,
@@ -316,6 +389,15 @@ bool relocate_portio_handler(struct domain *d, unsigned int old_port,
         if ( (handler->portio.port == old_port) &&
              (handler->portio.size = size) )
         {
+            /*
+             * The range index can't be re-sorted while the domain may be
+             * running.  Have lookups use the accept hook instead.  The stale
+             * index entry is harmless, as lookups check the handler's
+             * present port.
+             */
+            if ( new_port != old_port )
+                set_bit(i, &d->arch.hvm.io_handler_dynamic);
+
             handler->portio.port = new_port;
             return true;
         }
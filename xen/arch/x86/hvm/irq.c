@@ -623,6 +623,7 @@ static void irq_dump(struct domain *d)
     printk("Callback via %i:%#"PRIx32",%s asserted\n",
            hvm_irq->callback_via_type, hvm_irq->callback_via.gsi, 
            hvm_irq->callback_via_asserted ? "" : " not");
+    pt_pirq_dump_stats(d);
 }
 
 static void cf_check dump_irq_info(unsigned char key)
@@ -1052,6 +1052,8 @@ void svm_vmenter_helper(void)
 
     ASSERT(hvmemul_cache_disabled(curr));
 
+    hvm_exit_stats_end(curr);
+
     svm_asid_handle_vmrun();
 
     if ( unlikely(tb_init_done) )
@@ -2384,6 +2386,7 @@ static void svm_vmexit_do_invalidate_cache(struct cpu_user_regs *regs,
 static void svm_invlpga_intercept(
     struct vcpu *v, unsigned long linear, uint32_t asid)
 {
+    hvmemul_insn_xlat_flush(v);
     svm_invlpga(linear,
                 (asid == 0)
                 ? v->arch.hvm.n1asid.asid
@@ -2617,6 +2620,10 @@ void svm_vmexit_handler(void)
 
     exit_reason = vmcb->exitcode;
 
+    hvm_exit_stats_begin(v, exit_reason < HVM_EXIT_STATS_SVM_NPF ? exit_reason
+                            : exit_reason == VMEXIT_NPF ? HVM_EXIT_STATS_SVM_NPF
+                            : HVM_NR_EXIT_STATS);
+
     if ( hvm_long_mode_active(v) )
         HVMTRACE_ND(VMEXIT64, vcpu_guestmode ? TRC_HVM_NESTEDFLAG : 0,
                     1/*cycles*/, exit_reason, TRC_PAR_LONG(regs->rip));
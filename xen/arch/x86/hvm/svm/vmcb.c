@@ -19,11 +19,11 @@
 #include <asm/hvm/svm/svmdebug.h>
 #include <asm/spec_ctrl.h>
 
-struct vmcb_struct *alloc_vmcb(void)
+struct vmcb_struct *alloc_vmcb(const struct domain *d)
 {
     struct vmcb_struct *vmcb;
 
-    vmcb = alloc_xenheap_page();
+    vmcb = alloc_xenheap_pages(0, MEMF_node(domain_alloc_node(d)));
     if ( vmcb == NULL )
     {
         printk(XENLOG_WARNING "Warning: failed to allocate vmcb.\n");
@@ -74,7 +74,8 @@ static int construct_vmcb(struct vcpu *v)
     svm->vmcb_sync_state = vmcb_needs_vmload;
 
     /* I/O and MSR permission bitmaps. */
-    svm->msrpm = alloc_xenheap_pages(get_order_from_bytes(MSRPM_SIZE), 0);
+    svm->msrpm = alloc_xenheap_pages(get_order_from_bytes(MSRPM_SIZE),
+                                     MEMF_node(domain_alloc_node(v->domain)));
     if ( svm->msrpm == NULL )
         return -ENOMEM;
     memset(svm->msrpm, 0xff, MSRPM_SIZE);
@@ -183,7 +184,7 @@ int svm_create_vmcb(struct vcpu *v)
     int rc;
 
     if ( (nv->nv_n1vmcx == NULL) &&
-         (nv->nv_n1vmcx = alloc_vmcb()) == NULL )
+         (nv->nv_n1vmcx = alloc_vmcb(v->domain)) == NULL )
     {
         printk("Failed to create a new VMCB\n");
         return -ENOMEM;
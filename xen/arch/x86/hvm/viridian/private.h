@@ -13,7 +13,8 @@ int viridian_synic_rdmsr(const struct vcpu *v, uint32_t idx, uint64_t *val);
 bool viridian_synic_deliver_timer_msg(struct vcpu *v, unsigned int sintx,
                                       unsigned int index,
                                       uint64_t expiration,
-                                      uint64_t delivery);
+                                      uint64_t delivery,
+                                      unsigned long *vectors);
 
 int viridian_synic_vcpu_init(const struct vcpu *v);
 int viridian_synic_domain_init(const struct domain *d);
@@ -322,7 +322,8 @@ void viridian_synic_poll(struct vcpu *v)
 bool viridian_synic_deliver_timer_msg(struct vcpu *v, unsigned int sintx,
                                       unsigned int index,
                                       uint64_t expiration,
-                                      uint64_t delivery)
+                                      uint64_t delivery,
+                                      unsigned long *vectors)
 {
     struct viridian_vcpu *vv = v->arch.hvm.viridian;
     const union hv_synic_sint *vs = &vv->sint[sintx];
@@ -339,9 +340,9 @@ bool viridian_synic_deliver_timer_msg(struct vcpu *v, unsigned int sintx,
     };
 
     /*
-     * To avoid using an atomic test-and-set, and barrier before calling
-     * vlapic_set_irq(), this function must be called in context of the
-     * vcpu receiving the message.
+     * To avoid using an atomic test-and-set, and barrier before the
+     * caller asserts the SINT, this function must be called in context
+     * of the vcpu receiving the message.
      */
     ASSERT(v == current);
 
@@ -358,8 +359,12 @@ bool viridian_synic_deliver_timer_msg(struct vcpu *v, unsigned int sintx,
     BUILD_BUG_ON(sizeof(payload) > sizeof(msg->u.payload));
     memcpy(msg->u.payload, &payload, sizeof(payload));
 
-    if ( !vs->masked && vlapic_enabled(vcpu_vlapic(v)) )
-        vlapic_set_irq(vcpu_vlapic(v), vs->vector, 0);
+    /*
+     * The SINT is asserted by the caller, so that several messages
+     * posted in one poll result in a single injection per vector.
+     */
+    if ( !vs->masked )
+        __set_bit(vs->vector, vectors);
 
     return true;
 }
@@ -15,6 +15,7 @@
 #include <asm/event.h>
 #include <asm/guest/hyperv.h>
 #include <asm/guest/hyperv-tlfs.h>
+#include <asm/hvm/vlapic.h>
 
 #include "private.h"
 
@@ -133,7 +134,13 @@ static void cf_check stimer_expire(void *data)
     unsigned int stimerx = vs - &vv->stimer[0];
 
     set_bit(stimerx, &vv->stimer_pending);
-    vcpu_kick(v);
+
+    /*
+     * A single kick is enough to have all pending timers polled, so
+     * skip it if one is already outstanding.
+     */
+    if ( !test_and_set_bool(vv->stimer_kicked) )
+        vcpu_kick(v);
 }
 
 static void start_stimer(struct viridian_stimer *vs)
@@ -209,7 +216,8 @@ static void start_stimer(struct viridian_stimer *vs)
     set_timer(&vs->timer, timeout + NOW());
 }
 
-static void poll_stimer(struct vcpu *v, unsigned int stimerx)
+static void poll_stimer(struct vcpu *v, unsigned int stimerx,
+                        unsigned long *vectors)
 {
     struct viridian_vcpu *vv = v->arch.hvm.viridian;
     struct viridian_stimer *vs = &vv->stimer[stimerx];
@@ -228,9 +236,13 @@ static void poll_stimer(struct vcpu *v, unsigned int stimerx)
     if ( !test_bit(stimerx, &vv->stimer_pending) )
         return;
 
-    if ( !viridian_synic_deliver_timer_msg(v, vs->config.sintx,
-                                           stimerx, vs->expiration,
-                                           time_ref_count(v->domain)) )
+    /* In direct mode the expiry is signalled by the vector alone. */
+    if ( vs->config.direct_mode )
+        __set_bit(vs->config.apic_vector, vectors);
+    else if ( !viridian_synic_deliver_timer_msg(v, vs->config.sintx,
+                                                stimerx, vs->expiration,
+                                                time_ref_count(v->domain),
+                                                vectors) )
         return;
 
     clear_bit(stimerx, &vv->stimer_pending);
@@ -244,13 +256,34 @@ static void poll_stimer(struct vcpu *v, unsigned int stimerx)
 void viridian_time_poll_timers(struct vcpu *v)
 {
     struct viridian_vcpu *vv = v->arch.hvm.viridian;
+    struct vlapic *vlapic = vcpu_vlapic(v);
+    DECLARE_BITMAP(vectors, X86_NR_VECTORS);
     unsigned int i;
 
+    /*
+     * Re-enable kicks before sampling the pending mask, so that an expiry
+     * racing with this poll either is seen below or kicks again.
+     */
+    if ( vv->stimer_kicked )
+    {
+        vv->stimer_kicked = false;
+        smp_mb();
+    }
+
     if ( !vv->stimer_pending )
        return;
 
+    bitmap_zero(vectors, X86_NR_VECTORS);
+
     for ( i = 0; i < ARRAY_SIZE(vv->stimer); i++ )
-        poll_stimer(v, i);
+        poll_stimer(v, i, vectors);
+
+    /* Assert each vector once, however many timers have expired on it. */
+    if ( !vlapic_enabled(vlapic) )
+        return;
+
+    for_each_set_bit ( i, vectors, X86_NR_VECTORS )
+        vlapic_set_irq(vlapic, i, 0);
 }
 
 static void time_vcpu_freeze(struct vcpu *v)
@@ -356,7 +389,12 @@ int viridian_time_wrmsr(struct vcpu *v, uint32_t idx, uint64_t val)
 
         vs->config.as_uint64 = val;
 
-        if ( !vs->config.sintx )
+        /*
+         * A direct mode timer does not use a SINT, but needs a vector that
+         * can be asserted in the local APIC.
+         */
+        if ( vs->config.direct_mode ? vs->config.apic_vector < 16
+                                    : !vs->config.sintx )
             vs->config.enable = 0;
 
         if ( vs->config.enable )
@@ -457,6 +457,79 @@ void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector)
     hvm_dpci_msi_eoi(d, vector);
 }
 
+static uint32_t x2apic_ldr(unsigned int id)
+{
+    return ((id & ~0xf) << 12) | (1 << (id & 0xf));
+}
+
+/*
+ * Track whether the vCPU's APIC ID and LDR are the x2APIC defaults.  To be
+ * called whenever the mode, ID or LDR may have changed.
+ */
+static void vlapic_update_id_map(struct vlapic *vlapic)
+{
+    const struct vcpu *v = vlapic_vcpu(vlapic);
+    unsigned long *map = v->domain->arch.hvm.x2apic_id_default;
+    bool changed;
+
+    if ( vlapic_x2apic_mode(vlapic) &&
+         vlapic_get_reg(vlapic, APIC_ID) == v->vcpu_id * 2 &&
+         vlapic_get_reg(vlapic, APIC_LDR) == x2apic_ldr(v->vcpu_id) )
+        changed = !test_and_set_bit(v->vcpu_id, map);
+    else
+        changed = test_and_clear_bit(v->vcpu_id, map);
+
+    if ( changed )
+        hvm_update_vlapic_ids(v->domain);
+}
+
+/*
+ * When all vCPUs use the default x2APIC IDs, the target(s) of a
+ * non-shorthand IPI can be found without checking every vCPU: physical ID
+ * N belongs to vCPU N / 2, and bit B of logical cluster C to vCPU
+ * C * 16 + B.  Returns false if the generic path needs to be used instead.
+ */
+static bool vlapic_ipi_x2apic(const struct vlapic *vlapic, uint32_t icr_low,
+                              uint32_t dest, bool dest_mode)
+{
+    struct domain *d = vlapic_domain(vlapic);
+    unsigned int id, bits;
+    bool batch;
+    struct vcpu *v;
+
+    if ( !bitmap_full(d->arch.hvm.x2apic_id_default, d->max_vcpus) )
+        return false;
+
+    if ( !dest_mode )
+    {
+        /* Broadcast is best dealt with by the generic path. */
+        if ( dest == 0xffffffff )
+            return false;
+
+        if ( !(dest & 1) && dest / 2 < d->max_vcpus &&
+             (v = d->vcpu[dest / 2]) != NULL )
+            vlapic_accept_irq(v, icr_low);
+
+        return true;
+    }
+
+    id = (dest >> 16) * 16;
+    bits = (uint16_t)dest;
+
+    batch = hweight16(bits) > 1;
+    if ( batch )
+        cpu_raise_softirq_batch_begin();
+
+    for ( ; bits && id < d->max_vcpus; id++, bits >>= 1 )
+        if ( (bits & 1) && (v = d->vcpu[id]) != NULL )
+            vlapic_accept_irq(v, icr_low);
+
+    if ( batch )
+        cpu_raise_softirq_batch_finish();
+
+    return true;
+}
+
 static bool_t is_multicast_dest(struct vlapic *vlapic, unsigned int short_hand,
                                 uint32_t dest, bool_t dest_mode)
 {
@@ -523,8 +596,13 @@ void vlapic_ipi(
         /* fall through */
     default: {
         struct vcpu *v;
-        bool_t batch = is_multicast_dest(vlapic, short_hand, dest, dest_mode);
+        bool_t batch;
 
+        if ( short_hand == APIC_DEST_NOSHORT && vlapic_x2apic_mode(vlapic) &&
+             vlapic_ipi_x2apic(vlapic, icr_low, dest, dest_mode) )
+            break;
+
+        batch = is_multicast_dest(vlapic, short_hand, dest, dest_mode);
         if ( batch )
             cpu_raise_softirq_batch_begin();
         for_each_vcpu ( vlapic_domain(vlapic), v )
@@ -779,6 +857,7 @@ void vlapic_reg_write(struct vcpu *v, unsigned int reg, uint32_t val)
     {
     case APIC_ID:
         vlapic_set_reg(vlapic, APIC_ID, val);
+        vlapic_update_id_map(vlapic);
         break;
 
     case APIC_TASKPRI:
@@ -791,6 +870,7 @@ void vlapic_reg_write(struct vcpu *v, unsigned int reg, uint32_t val)
 
     case APIC_LDR:
         vlapic_set_reg(vlapic, APIC_LDR, val & APIC_LDR_MASK);
+        vlapic_update_id_map(vlapic);
         break;
 
     case APIC_DFR:
@@ -947,11 +1027,26 @@ int vlapic_apicv_write(struct vcpu *v, unsigned int offset)
 
     if ( vlapic_x2apic_mode(vlapic) )
     {
-        if ( offset != APIC_SELF_IPI )
-            return X86EMUL_UNHANDLEABLE;
+        switch ( offset )
+        {
+        case APIC_SELF_IPI:
+            offset = APIC_ICR;
+            val = APIC_DEST_SELF | (val & APIC_VECTOR_MASK);
+            break;
 
-        offset = APIC_ICR;
-        val = APIC_DEST_SELF | (val & APIC_VECTOR_MASK);
+        case APIC_ICR:
+            /*
+             * Only seen with IPI virtualisation, for IPIs which hardware
+             * couldn't deliver itself.  The virtual ICR is 64 bits wide in
+             * x2APIC mode, and has already been checked for reserved bits.
+             */
+            vlapic_set_reg(vlapic, APIC_ICR2,
+                           vlapic_get_reg(vlapic, APIC_ICR + 4));
+            break;
+
+        default:
+            return X86EMUL_UNHANDLEABLE;
+        }
     }
 
     vlapic_reg_write(v, offset, val);
@@ -1064,10 +1159,9 @@ static const struct hvm_mmio_ops vlapic_mmio_ops = {
 static void set_x2apic_id(struct vlapic *vlapic)
 {
     u32 id = vlapic_vcpu(vlapic)->vcpu_id;
-    u32 ldr = ((id & ~0xf) << 12) | (1 << (id & 0xf));
 
     vlapic_set_reg(vlapic, APIC_ID, id * 2);
-    vlapic_set_reg(vlapic, APIC_LDR, ldr);
+    vlapic_set_reg(vlapic, APIC_LDR, x2apic_ldr(id));
 }
 
 int guest_wrmsr_apic_base(struct vcpu *v, uint64_t value)
@@ -1153,6 +1247,7 @@ int guest_wrmsr_apic_base(struct vcpu *v, uint64_t value)
 
     if ( vlapic_x2apic_mode(vlapic) )
         set_x2apic_id(vlapic);
+    vlapic_update_id_map(vlapic);
 
     hvm_update_vlapic_mode(vlapic_vcpu(vlapic));
 
@@ -1438,6 +1533,7 @@ void vlapic_reset(struct vlapic *vlapic)
 
     vlapic_set_reg(vlapic, APIC_ID, (v->vcpu_id * 2) << 24);
     vlapic_do_init(vlapic);
+    vlapic_update_id_map(vlapic);
 }
 
 /* rearm the actimer if needed, after a HVM restore */
@@ -1519,6 +1615,8 @@ static void lapic_load_fixup(struct vlapic *vlapic)
         vlapic_set_reg(vlapic, APIC_ID, id);
         vlapic_set_reg(vlapic, APIC_LDR, vlapic->loaded.ldr);
     }
+
+    vlapic_update_id_map(vlapic);
 }
 
 static int cf_check lapic_load_hidden(struct domain *d, hvm_domain_context_t *h)
@@ -33,6 +33,7 @@
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/irq.h>
+#include <xen/perfc.h>
 #include <xen/vpci.h>
 #include <public/hvm/ioreq.h>
 #include <asm/hvm/emulate.h>
@@ -268,6 +269,13 @@ static int cf_check msixtbl_read(
     
     r = X86EMUL_OKAY;
 out:
+    if ( entry )
+    {
+        if ( r == X86EMUL_OKAY )
+            perfc_incr(msixtbl_inline);
+        else
+            perfc_incr(msixtbl_forwarded);
+    }
     rcu_read_unlock(&msixtbl_rcu_lock);
     return r;
 }
@@ -329,7 +337,19 @@ static int msixtbl_write(struct vcpu *v, unsigned long address,
     msi_desc = msixtbl_addr_to_desc(entry, address);
     if ( !msi_desc || msi_desc->irq < 0 )
         goto out;
-    
+
+    /*
+     * Drivers may re-write the mask bit with its current value at a high
+     * rate.  There's nothing to do for those, so avoid taking the IRQ lock
+     * and accessing the device.
+     */
+    if ( msi_desc->msi_attrib.guest_masked ==
+         !!(val & PCI_MSIX_VECTOR_BITMASK) )
+    {
+        perfc_incr(msixtbl_mask_nop);
+        goto done;
+    }
+
     desc = irq_to_desc(msi_desc->irq);
     if ( !desc )
         goto out;
@@ -345,10 +365,18 @@ static int msixtbl_write(struct vcpu *v, unsigned long address,
 
 unlock:
     spin_unlock_irqrestore(&desc->lock, flags);
+done:
     if ( len == 4 )
         r = X86EMUL_OKAY;
 
 out:
+    if ( entry )
+    {
+        if ( r == X86EMUL_OKAY )
+            perfc_incr(msixtbl_inline);
+        else
+            perfc_incr(msixtbl_forwarded);
+    }
     rcu_read_unlock(&msixtbl_rcu_lock);
     return r;
 }
@@ -164,6 +164,7 @@ static int cf_check parse_ept_param_runtime(const char *s)
 u32 vmx_pin_based_exec_control __read_mostly;
 u32 vmx_cpu_based_exec_control __read_mostly;
 u32 vmx_secondary_exec_control __read_mostly;
+uint64_t vmx_tertiary_exec_control __read_mostly;
 u32 vmx_vmexit_control __read_mostly;
 u32 vmx_vmentry_control __read_mostly;
 u64 vmx_ept_vpid_cap __read_mostly;
@@ -202,6 +203,7 @@ static void __init vmx_display_features(void)
     P(cpu_has_vmx_tsc_scaling, "TSC Scaling");
     P(cpu_has_vmx_bus_lock_detection, "Bus Lock Detection");
     P(cpu_has_vmx_notify_vm_exiting, "Notify VM Exit");
+    P(cpu_has_vmx_ipi_virt, "IPI Virtualisation");
 #undef P
 
     if ( !printed )
@@ -229,10 +231,11 @@ static u32 adjust_vmx_controls(
     return ctl;
 }
 
-static bool_t cap_check(const char *name, u32 expected, u32 saw)
+static bool_t cap_check(const char *name, uint64_t expected, uint64_t saw)
 {
     if ( saw != expected )
-        printk("VMX %s: saw %#x expected %#x\n", name, saw, expected);
+        printk("VMX %s: saw %#"PRIx64" expected %#"PRIx64"\n",
+               name, saw, expected);
     return saw != expected;
 }
 
@@ -242,6 +245,7 @@ static int vmx_init_vmcs_config(bool bsp)
     u32 _vmx_pin_based_exec_control;
     u32 _vmx_cpu_based_exec_control;
     u32 _vmx_secondary_exec_control = 0;
+    uint64_t _vmx_tertiary_exec_control = 0;
     u64 _vmx_ept_vpid_cap = 0;
     u64 _vmx_misc_cap = 0;
     u32 _vmx_vmexit_control;
@@ -275,7 +279,8 @@ static int vmx_init_vmcs_config(bool bsp)
     opt = (CPU_BASED_ACTIVATE_MSR_BITMAP |
            CPU_BASED_TPR_SHADOW |
            CPU_BASED_MONITOR_TRAP_FLAG |
-           CPU_BASED_ACTIVATE_SECONDARY_CONTROLS);
+           CPU_BASED_ACTIVATE_SECONDARY_CONTROLS |
+           CPU_BASED_ACTIVATE_TERTIARY_CONTROLS);
     _vmx_cpu_based_exec_control = adjust_vmx_controls(
         "CPU-Based Exec Control", min, opt,
         MSR_IA32_VMX_PROCBASED_CTLS, &mismatch);
@@ -453,6 +458,32 @@ static int vmx_init_vmcs_config(bool bsp)
     if ( !(_vmx_secondary_exec_control & SECONDARY_EXEC_ENABLE_VM_FUNCTIONS) )
         _vmx_secondary_exec_control &= ~SECONDARY_EXEC_ENABLE_VIRT_EXCEPTIONS;
 
+    /*
+     * The tertiary controls are all allowed-0, so only the allowed-1 settings
+     * are reported by IA32_VMX_PROCBASED_CTLS3.
+     */
+    if ( _vmx_cpu_based_exec_control & CPU_BASED_ACTIVATE_TERTIARY_CONTROLS )
+    {
+        uint64_t caps;
+
+        rdmsrl(MSR_IA32_VMX_PROCBASED_CTLS3, caps);
+
+        /*
+         * IPI virtualisation sends through the PID-pointer table, so is only
+         * of use when the interrupt is delivered by posting it, and relies on
+         * the virtualised x2APIC ICR write being handled in hardware.
+         */
+        if ( (_vmx_pin_based_exec_control & PIN_BASED_POSTED_INTERRUPT) &&
+             (_vmx_secondary_exec_control &
+              SECONDARY_EXEC_APIC_REGISTER_VIRT) &&
+             (_vmx_secondary_exec_control &
+              SECONDARY_EXEC_VIRTUALIZE_X2APIC_MODE) )
+            _vmx_tertiary_exec_control |= caps & TERTIARY_EXEC_IPI_VIRT;
+    }
+
+    if ( !_vmx_tertiary_exec_control )
+        _vmx_cpu_based_exec_control &= ~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+
     min = 0;
     opt = (VM_ENTRY_LOAD_GUEST_PAT | VM_ENTRY_LOAD_GUEST_EFER |
            VM_ENTRY_LOAD_BNDCFGS);
@@ -469,6 +500,7 @@ static int vmx_init_vmcs_config(bool bsp)
         vmx_pin_based_exec_control = _vmx_pin_based_exec_control;
         vmx_cpu_based_exec_control = _vmx_cpu_based_exec_control;
         vmx_secondary_exec_control = _vmx_secondary_exec_control;
+        vmx_tertiary_exec_control  = _vmx_tertiary_exec_control;
         vmx_ept_vpid_cap           = _vmx_ept_vpid_cap;
         vmx_vmexit_control         = _vmx_vmexit_control;
         vmx_vmentry_control        = _vmx_vmentry_control;
@@ -504,6 +536,9 @@ static int vmx_init_vmcs_config(bool bsp)
         mismatch |= cap_check(
             "Secondary Exec Control",
             vmx_secondary_exec_control, _vmx_secondary_exec_control);
+        mismatch |= cap_check(
+            "Tertiary Exec Control",
+            vmx_tertiary_exec_control, _vmx_tertiary_exec_control);
         mismatch |= cap_check(
             "VMExit Control",
             vmx_vmexit_control, _vmx_vmexit_control);
@@ -561,12 +596,12 @@ static int vmx_init_vmcs_config(bool bsp)
     return 0;
 }
 
-static paddr_t vmx_alloc_vmcs(void)
+static paddr_t vmx_alloc_vmcs(nodeid_t node)
 {
     struct page_info *pg;
     struct vmcs_struct *vmcs;
 
-    if ( (pg = alloc_domheap_page(NULL, 0)) == NULL )
+    if ( (pg = alloc_domheap_page(NULL, MEMF_node(node))) == NULL )
     {
         gdprintk(XENLOG_WARNING, "Failed to allocate VMCS.\n");
         return 0;
@@ -663,7 +698,7 @@ int cf_check vmx_cpu_up_prepare(unsigned int cpu)
     if ( per_cpu(vmxon_region, cpu) )
         return 0;
 
-    per_cpu(vmxon_region, cpu) = vmx_alloc_vmcs();
+    per_cpu(vmxon_region, cpu) = vmx_alloc_vmcs(cpu_to_node(cpu));
     if ( per_cpu(vmxon_region, cpu) )
         return 0;
 
@@ -1083,6 +1118,18 @@ static int construct_vmcs(struct vcpu *v)
 
     v->arch.hvm.vmx.secondary_exec_control = vmx_secondary_exec_control;
 
+    /* IPI virtualisation only if requested for the domain. */
+    if ( d->arch.hvm.vmx.pid_table )
+        v->arch.hvm.vmx.tertiary_exec_control = vmx_tertiary_exec_control;
+    else
+    {
+        v->arch.hvm.vmx.tertiary_exec_control =
+            vmx_tertiary_exec_control & ~TERTIARY_EXEC_IPI_VIRT;
+        if ( !v->arch.hvm.vmx.tertiary_exec_control )
+            v->arch.hvm.vmx.exec_control &=
+                ~CPU_BASED_ACTIVATE_TERTIARY_CONTROLS;
+    }
+
     /*
      * Disable features which we don't want active by default:
      *  - Descriptor table exiting only if wanted by introspection
@@ -1136,10 +1183,15 @@ static int construct_vmcs(struct vcpu *v)
         __vmwrite(SECONDARY_VM_EXEC_CONTROL,
                   v->arch.hvm.vmx.secondary_exec_control);
 
+    if ( v->arch.hvm.vmx.exec_control & CPU_BASED_ACTIVATE_TERTIARY_CONTROLS )
+        __vmwrite(TERTIARY_VM_EXEC_CONTROL,
+                  v->arch.hvm.vmx.tertiary_exec_control);
+
     /* MSR access bitmap. */
     if ( cpu_has_vmx_msr_bitmap )
     {
-        struct vmx_msr_bitmap *msr_bitmap = alloc_xenheap_page();
+        struct vmx_msr_bitmap *msr_bitmap =
+            alloc_xenheap_pages(0, MEMF_node(domain_alloc_node(v->domain)));
 
         if ( msr_bitmap == NULL )
         {
@@ -1183,13 +1235,20 @@ static int construct_vmcs(struct vcpu *v)
 
     if ( cpu_has_vmx_posted_intr_processing )
     {
-        if ( iommu_intpost )
+        if ( iommu_intpost || d->arch.hvm.vmx.pid_table )
             pi_desc_init(v);
 
         __vmwrite(PI_DESC_ADDR, virt_to_maddr(&v->arch.hvm.vmx.pi_desc));
         __vmwrite(POSTED_INTR_NOTIFICATION_VECTOR, posted_intr_vector);
     }
 
+    if ( v->arch.hvm.vmx.tertiary_exec_control & TERTIARY_EXEC_IPI_VIRT )
+    {
+        /* Default x2APIC IDs are vcpu_id * 2, see vlapic_update_id_map(). */
+        __vmwrite(PID_POINTER_TABLE, virt_to_maddr(d->arch.hvm.vmx.pid_table));
+        __vmwrite(LAST_PID_POINTER_INDEX, (d->max_vcpus - 1) * 2);
+    }
+
     /* Host data selectors. */
     __vmwrite(HOST_SS_SELECTOR, __HYPERVISOR_DS);
     __vmwrite(HOST_DS_SELECTOR, __HYPERVISOR_DS);
@@ -1454,7 +1513,8 @@ int vmx_add_msr(struct vcpu *v, uint32_t msr, uint64_t val,
     {
         paddr_t addr;
 
-        if ( (*ptr = alloc_xenheap_page()) == NULL )
+        *ptr = alloc_xenheap_pages(0, MEMF_node(domain_alloc_node(v->domain)));
+        if ( *ptr == NULL )
         {
             rc = -ENOMEM;
             goto out;
@@ -1652,7 +1712,7 @@ void vmx_vcpu_disable_pml(struct vcpu *v)
 void vmx_vcpu_flush_pml_buffer(struct vcpu *v)
 {
     uint64_t *pml_buf;
-    unsigned long pml_idx;
+    unsigned long pml_idx, start;
 
     ASSERT((v == current) || (!vcpu_runnable(v) && !v->is_running));
     ASSERT(vmx_vcpu_pml_enabled(v));
@@ -1677,23 +1737,27 @@ void vmx_vcpu_flush_pml_buffer(struct vcpu *v)
     else
         pml_idx++;
 
-    for ( ; pml_idx < NR_PML_ENTRIES; pml_idx++ )
-    {
-        unsigned long gfn = pml_buf[pml_idx] >> PAGE_SHIFT;
-
-        /*
-         * Need to change type from log-dirty to normal memory for logged GFN.
-         * hap_track_dirty_vram depends on it to work. And we mark all logged
-         * GFNs to be dirty, as we cannot be sure whether it's safe to ignore
-         * GFNs on which p2m_change_type_one returns failure. The failure cases
-         * are very rare, and additional cost is negligible, but a missing mark
-         * is extremely difficult to debug.
-         */
-        p2m_change_type_one(v->domain, gfn, p2m_ram_logdirty, p2m_ram_rw);
+    /*
+     * Need to change type from log-dirty to normal memory for logged GFN.
+     * hap_track_dirty_vram depends on it to work. And we mark all logged
+     * GFNs to be dirty, as we cannot be sure whether it's safe to ignore
+     * GFNs on which p2m_change_type_one returns failure. The failure cases
+     * are very rare, and additional cost is negligible, but a missing mark
+     * is extremely difficult to debug.
+     *
+     * The P2M lock can't be acquired with the paging one held, so do all type
+     * changes first, and then mark all GFNs under a single paging lock.
+     */
+    for ( start = pml_idx; pml_idx < NR_PML_ENTRIES; pml_idx++ )
+        p2m_change_type_one(v->domain, pml_buf[pml_idx] >> PAGE_SHIFT,
+                            p2m_ram_logdirty, p2m_ram_rw);
 
+    paging_mark_dirty_batch_begin(v->domain);
+    for ( pml_idx = start; pml_idx < NR_PML_ENTRIES; pml_idx++ )
         /* HVM guest: pfn == gfn */
-        paging_mark_pfn_dirty(v->domain, _pfn(gfn));
-    }
+        paging_mark_pfn_dirty_vcpu(v->domain,
+                                   _pfn(pml_buf[pml_idx] >> PAGE_SHIFT), v);
+    paging_mark_dirty_batch_end(v->domain);
 
     unmap_domain_page(pml_buf);
 
@@ -1809,7 +1873,7 @@ int vmx_create_vmcs(struct vcpu *v)
     struct vmx_vcpu *vmx = &v->arch.hvm.vmx;
     int rc;
 
-    if ( (vmx->vmcs_pa = vmx_alloc_vmcs()) == 0 )
+    if ( (vmx->vmcs_pa = vmx_alloc_vmcs(domain_alloc_node(v->domain))) == 0 )
         return -ENOMEM;
 
     INIT_LIST_HEAD(&vmx->active_list);
@@ -2075,6 +2139,8 @@ void vmcs_dump_vcpu(struct vcpu *v)
            vmr32(PIN_BASED_VM_EXEC_CONTROL),
            vmr32(CPU_BASED_VM_EXEC_CONTROL),
            vmr32(SECONDARY_VM_EXEC_CONTROL));
+    if ( cpu_has_vmx_tertiary_exec_control )
+        printk("TertiaryExec=%016lx\n", vmr(TERTIARY_VM_EXEC_CONTROL));
     printk("EntryControls=%08x ExitControls=%08x\n", vmentry_ctl, vmexit_ctl);
     printk("ExceptionBitmap=%08x PFECmask=%08x PFECmatch=%08x\n",
            vmr32(EXCEPTION_BITMAP),
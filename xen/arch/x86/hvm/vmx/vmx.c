@@ -11,6 +11,7 @@
 #include <xen/trace.h>
 #include <xen/sched.h>
 #include <xen/irq.h>
+#include <xen/event.h>
 #include <xen/softirq.h>
 #include <xen/domain_page.h>
 #include <xen/hypercall.h>
@@ -202,7 +203,7 @@ void vmx_pi_desc_fixup(unsigned int cpu)
     spinlock_t *new_lock, *old_lock = &per_cpu(vmx_pi_blocking, cpu).lock;
     struct list_head *blocked_vcpus = &per_cpu(vmx_pi_blocking, cpu).list;
 
-    if ( !iommu_intpost )
+    if ( !iommu_intpost && !cpu_has_vmx_ipi_virt )
         return;
 
     /*
@@ -307,14 +308,10 @@ void vmx_pi_desc_fixup(unsigned int cpu)
  * vmx_intr_assist() path again (SN clear, NV = posted_interrupt).
  */
 
-/* This function is called when pcidevs_lock is held */
-void vmx_pi_hooks_assign(struct domain *d)
+static void vmx_pi_hooks_install(struct domain *d)
 {
     struct vcpu *v;
 
-    if ( !iommu_intpost || !is_hvm_domain(d) )
-        return;
-
     ASSERT(!d->arch.hvm.pi_ops.vcpu_block);
 
     /*
@@ -344,12 +341,24 @@ void vmx_pi_hooks_assign(struct domain *d)
     d->arch.hvm.pi_ops.vcpu_block = vmx_vcpu_block;
 }
 
+/*
+ * This function is called when pcidevs_lock is held.  Domains using IPI
+ * virtualisation have the hooks installed for their entire lifetime.
+ */
+void vmx_pi_hooks_assign(struct domain *d)
+{
+    if ( !iommu_intpost || !is_hvm_domain(d) || d->arch.hvm.vmx.pid_table )
+        return;
+
+    vmx_pi_hooks_install(d);
+}
+
 /* This function is called when pcidevs_lock is held */
 void vmx_pi_hooks_deassign(struct domain *d)
 {
     struct vcpu *v;
 
-    if ( !iommu_intpost || !is_hvm_domain(d) )
+    if ( !iommu_intpost || !is_hvm_domain(d) || d->arch.hvm.vmx.pid_table )
         return;
 
     ASSERT(d->arch.hvm.pi_ops.vcpu_block);
@@ -579,12 +588,60 @@ static int cf_check vmx_domain_initialise(struct domain *d)
     if ( (rc = vmx_alloc_vlapic_mapping(d)) != 0 )
         return rc;
 
+    if ( d->arch.hvm.ipi_virt && cpu_has_vmx_ipi_virt )
+    {
+        /* x2APIC IDs up to (HVM_MAX_VCPUS - 1) * 2 index the table. */
+        BUILD_BUG_ON(HVM_MAX_VCPUS * 2 * sizeof(uint64_t) > PAGE_SIZE);
+
+        d->arch.hvm.vmx.pid_table = alloc_xenheap_page();
+        if ( !d->arch.hvm.vmx.pid_table )
+            return -ENOMEM;
+        clear_page(d->arch.hvm.vmx.pid_table);
+        spin_lock_init(&d->arch.hvm.vmx.pid_table_lock);
+
+        /*
+         * IPIs may be posted by hardware at any time, so the notification
+         * destination and blocking state need tracking from the start.
+         */
+        vmx_pi_hooks_install(d);
+    }
+
     return 0;
 }
 
 static void cf_check vmx_domain_relinquish_resources(struct domain *d)
 {
     vmx_free_vlapic_mapping(d);
+
+    if ( d->arch.hvm.vmx.pid_table )
+    {
+        free_xenheap_page(d->arch.hvm.vmx.pid_table);
+        d->arch.hvm.vmx.pid_table = NULL;
+    }
+}
+
+/*
+ * Called whenever a vCPU's x2APIC ID state changes.  IPI virtualisation
+ * looks targets up directly by x2APIC ID, so only populate the PID-pointer
+ * table while every vCPU uses its default ID; any other IPI then takes an
+ * APIC-write exit and is handled by vlapic_ipi().
+ */
+static void cf_check vmx_update_vlapic_ids(struct domain *d)
+{
+    uint64_t *table = d->arch.hvm.vmx.pid_table;
+    bool valid = bitmap_full(d->arch.hvm.x2apic_id_default, d->max_vcpus);
+    struct vcpu *v;
+
+    if ( !table )
+        return;
+
+    spin_lock(&d->arch.hvm.vmx.pid_table_lock);
+
+    for_each_vcpu ( d, v )
+        write_atomic(&table[v->vcpu_id * 2],
+                     valid ? virt_to_maddr(&v->arch.hvm.vmx.pi_desc) | 1 : 0);
+
+    spin_unlock(&d->arch.hvm.vmx.pid_table_lock);
 }
 
 static void cf_check domain_creation_finished(struct domain *d)
@@ -618,6 +675,30 @@ static void vmx_init_ipt(struct vcpu *v)
     v->arch.msrs->rtit.output_limit = size - 1;
 }
 
+/*
+ * Processor Trace streaming: the output region is one half of the vmtrace
+ * buffer at a time.  Single-range output can't raise a PMI at a threshold
+ * (only ToPA can), so the fill level is checked on VM exits instead.
+ */
+struct vmx_ipt_stream {
+    evtchn_port_t port;          /* Xen-bound, for notifying the consumer */
+    bool          block;         /* pause rather than wrap */
+    bool          paused;        /* vcpu paused until the consumer acks */
+    unsigned int  cur;           /* half being written */
+    uint32_t      threshold;     /* bytes, for handing the half over */
+    uint32_t      last_offset;   /* at the previous check, to spot wraps */
+    uint32_t      full_len;      /* bytes in the other half, 0 if drained */
+    uint32_t      wraps;         /* since the last XEN_DOMCTL_..._next */
+};
+
+static paddr_t vmx_ipt_output_base(const struct vcpu *v)
+{
+    const struct vmx_ipt_stream *s = v->arch.hvm.vmx.ipt_stream;
+    paddr_t base = page_to_maddr(v->vmtrace.pg);
+
+    return s ? base + s->cur * (v->domain->vmtrace_size / 2) : base;
+}
+
 static int cf_check vmx_vcpu_initialise(struct vcpu *v)
 {
     int rc;
@@ -677,6 +758,12 @@ static void cf_check vmx_vcpu_destroy(struct vcpu *v)
     vmx_vcpu_disable_pml(v);
     vmx_destroy_vmcs(v);
     passive_domain_destroy(v);
+
+    if ( v->arch.hvm.vmx.ipt_stream )
+    {
+        free_xen_event_channel(v->domain, v->arch.hvm.vmx.ipt_stream->port);
+        XFREE(v->arch.hvm.vmx.ipt_stream);
+    }
 }
 
 /*
@@ -733,7 +820,7 @@ static void vmx_restore_guest_msrs(struct vcpu *v)
 
     if ( v->arch.hvm.vmx.ipt_active )
     {
-        wrmsrl(MSR_RTIT_OUTPUT_BASE, page_to_maddr(v->vmtrace.pg));
+        wrmsrl(MSR_RTIT_OUTPUT_BASE, vmx_ipt_output_base(v));
         wrmsrl(MSR_RTIT_OUTPUT_MASK, msrs->rtit.output_mask);
         wrmsrl(MSR_RTIT_STATUS, msrs->rtit.status);
     }
@@ -2566,6 +2653,8 @@ static int cf_check vmtrace_control(struct vcpu *v, bool enable, bool reset)
     {
         msrs->rtit.status = 0;
         msrs->rtit.output_offset = 0;
+        if ( v->arch.hvm.vmx.ipt_stream )
+            v->arch.hvm.vmx.ipt_stream->last_offset = 0;
     }
 
     new_ctl = msrs->rtit.ctl & ~RTIT_CTL_TRACE_EN;
@@ -2594,9 +2683,149 @@ static int cf_check vmtrace_reset(struct vcpu *v)
 
     v->arch.msrs->rtit.output_offset = 0;
     v->arch.msrs->rtit.status = 0;
+    if ( v->arch.hvm.vmx.ipt_stream )
+        v->arch.hvm.vmx.ipt_stream->last_offset = 0;
     return 0;
 }
 
+/* Hand the half being written over to the consumer, and switch halves. */
+static void vmtrace_stream_swap(struct vcpu *v, uint32_t len)
+{
+    struct vmx_ipt_stream *s = v->arch.hvm.vmx.ipt_stream;
+
+    s->full_len = len;
+    s->cur ^= 1;
+    s->last_offset = 0;
+    v->arch.msrs->rtit.output_offset = 0;
+
+    if ( v == current )
+    {
+        /* Tracing is off in root mode (host MSR_RTIT_CTL is 0). */
+        wrmsrl(MSR_RTIT_OUTPUT_BASE, vmx_ipt_output_base(v));
+        wrmsrl(MSR_RTIT_OUTPUT_MASK, v->arch.msrs->rtit.output_mask);
+    }
+
+    notify_via_xen_event_channel(v->domain, s->port);
+}
+
+/* On VM exit, with streaming enabled. */
+static void vmx_ipt_stream_check(struct vcpu *v)
+{
+    struct vmx_ipt_stream *s = v->arch.hvm.vmx.ipt_stream;
+    uint64_t mask;
+    uint32_t offset;
+
+    if ( !v->arch.hvm.vmx.ipt_active )
+        return;
+
+    rdmsrl(MSR_RTIT_OUTPUT_MASK, mask);
+    offset = mask >> 32;
+
+    if ( offset < s->last_offset )
+        s->wraps++;
+    s->last_offset = offset;
+
+    if ( offset < s->threshold )
+        return;
+
+    if ( !s->full_len )
+        vmtrace_stream_swap(v, offset);
+    else if ( s->block && !s->paused )
+    {
+        /* Stop before wrapping; XEN_DOMCTL_vmtrace_stream_ack unpauses. */
+        s->paused = true;
+        vcpu_pause_nosync(v);
+    }
+}
+
+static int cf_check vmtrace_stream_op(
+    struct vcpu *v, unsigned int cmd, uint64_t *key, uint64_t *value)
+{
+    struct vmx_ipt_stream *s = v->arch.hvm.vmx.ipt_stream;
+    struct vcpu_msrs *msrs = v->arch.msrs;
+    unsigned int half = v->domain->vmtrace_size / 2;
+    int rc;
+
+    switch ( cmd )
+    {
+    case XEN_DOMCTL_vmtrace_stream_enable:
+        if ( s || v->arch.hvm.vmx.ipt_active )
+            return -EBUSY;
+        if ( half < PAGE_SIZE || *key >= half ||
+             (*value & ~XEN_DOMCTL_VMTRACE_STREAM_block) )
+            return -EINVAL;
+
+        s = xzalloc(struct vmx_ipt_stream);
+        if ( !s )
+            return -ENOMEM;
+
+        rc = alloc_unbound_xen_event_channel(v->domain, 0,
+                                             current->domain->domain_id, NULL);
+        if ( rc < 0 )
+        {
+            xfree(s);
+            return rc;
+        }
+
+        s->port = rc;
+        s->block = *value & XEN_DOMCTL_VMTRACE_STREAM_block;
+        s->threshold = *key ?: half / 2;
+        v->arch.hvm.vmx.ipt_stream = s;
+
+        msrs->rtit.output_limit = half - 1;
+        msrs->rtit.output_offset = 0;
+        *value = s->port;
+        return 0;
+
+    case XEN_DOMCTL_vmtrace_stream_disable:
+        if ( !s )
+            return -EINVAL;
+        if ( v->arch.hvm.vmx.ipt_active )
+            return -EBUSY;
+
+        if ( s->paused )
+            vcpu_unpause(v);
+        free_xen_event_channel(v->domain, s->port);
+        XFREE(v->arch.hvm.vmx.ipt_stream);
+
+        msrs->rtit.output_limit = v->domain->vmtrace_size - 1;
+        msrs->rtit.output_offset = 0;
+        return 0;
+
+    case XEN_DOMCTL_vmtrace_stream_next:
+        if ( !s )
+            return -EINVAL;
+        if ( *key & ~XEN_DOMCTL_VMTRACE_STREAM_flush )
+            return -EINVAL;
+
+        if ( !s->full_len && (*key & XEN_DOMCTL_VMTRACE_STREAM_flush) &&
+             msrs->rtit.output_offset )
+            vmtrace_stream_swap(v, msrs->rtit.output_offset);
+
+        *value = s->full_len;
+        *key = s->wraps;
+        s->wraps = 0;
+        return 0;
+
+    case XEN_DOMCTL_vmtrace_stream_ack:
+        if ( !s )
+            return -EINVAL;
+
+        s->full_len = 0;
+        if ( s->paused )
+        {
+            /* Switch halves now, rather than at the next VM exit. */
+            if ( msrs->rtit.output_offset >= s->threshold )
+                vmtrace_stream_swap(v, msrs->rtit.output_offset);
+            s->paused = false;
+            vcpu_unpause(v);
+        }
+        return 0;
+    }
+
+    return -EOPNOTSUPP;
+}
+
 static uint64_t cf_check vmx_get_reg(struct vcpu *v, unsigned int reg)
 {
     const struct vcpu *curr = current;
@@ -2741,6 +2970,7 @@ static struct hvm_function_table __initdata_cf_clobber vmx_function_table = {
     .nhvm_intr_blocked    = nvmx_intr_blocked,
     .nhvm_domain_relinquish_resources = nvmx_domain_relinquish_resources,
     .update_vlapic_mode = vmx_vlapic_msr_changed,
+    .update_vlapic_ids    = vmx_update_vlapic_ids,
     .nhvm_hap_walk_L1_p2m = nvmx_hap_walk_L1_p2m,
     .enable_msr_interception = vmx_enable_msr_interception,
     .altp2m_vcpu_update_p2m = vmx_vcpu_update_eptp,
@@ -2752,6 +2982,7 @@ static struct hvm_function_table __initdata_cf_clobber vmx_function_table = {
     .vmtrace_set_option = vmtrace_set_option,
     .vmtrace_get_option = vmtrace_get_option,
     .vmtrace_reset = vmtrace_reset,
+    .vmtrace_stream_op = vmtrace_stream_op,
 
     .get_reg = vmx_get_reg,
     .set_reg = vmx_set_reg,
@@ -3000,12 +3231,10 @@ const struct hvm_function_table * __init start_vmx(void)
     if ( cpu_has_vmx_posted_intr_processing )
     {
         alloc_direct_apic_vector(&posted_intr_vector, pi_notification_interrupt);
-        if ( iommu_intpost )
-        {
+        if ( iommu_intpost || cpu_has_vmx_ipi_virt )
             alloc_direct_apic_vector(&pi_wakeup_vector, pi_wakeup_interrupt);
-
+        if ( iommu_intpost )
             vmx_function_table.pi_update_irte = vmx_pi_update_irte;
-        }
 
         vmx_function_table.deliver_posted_intr = vmx_deliver_posted_intr;
         vmx_function_table.sync_pir_to_irr     = vmx_sync_pir_to_irr;
@@ -3490,6 +3719,9 @@ void cf_check vmx_vlapic_msr_changed(struct vcpu *v)
                 vmx_clear_msr_intercept(v, MSR_X2APIC_TPR, VMX_MSR_W);
                 vmx_clear_msr_intercept(v, MSR_X2APIC_EOI, VMX_MSR_W);
                 vmx_clear_msr_intercept(v, MSR_X2APIC_SELF, VMX_MSR_W);
+                if ( v->arch.hvm.vmx.tertiary_exec_control &
+                     TERTIARY_EXEC_IPI_VIRT )
+                    vmx_clear_msr_intercept(v, MSR_X2APIC_ICR, VMX_MSR_W);
             }
         }
         else
@@ -4059,6 +4291,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
         HVMTRACE_ND(VMEXIT, 0, 1/*cycles*/, exit_reason, regs->eip);
 
     perfc_incra(vmexits, (uint16_t)exit_reason);
+    hvm_exit_stats_begin(v, (uint16_t)exit_reason);
 
     /* Handle the interrupt we missed before allowing any more in. */
     switch ( (uint16_t)exit_reason )
@@ -4092,6 +4325,9 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
     /* Now enable interrupts so it's safe to take locks. */
     local_irq_enable();
 
+    if ( unlikely(v->arch.hvm.vmx.ipt_stream) )
+        vmx_ipt_stream_check(v);
+
     /*
      * If the guest has the ability to switch EPTP without an exit,
      * figure out whether it has done so and update the altp2m data.
@@ -4896,6 +5132,8 @@ bool vmx_vmenter_helper(const struct cpu_user_regs *regs)
     }
 
  out:
+    hvm_exit_stats_end(curr);
+
     if ( unlikely(curr->arch.hvm.vmx.lbr_flags & LBR_FIXUP_MASK) )
         lbr_fixup();
 
@@ -2766,6 +2766,11 @@ int nvmx_n2_vmexit_handler(struct cpu_user_regs *regs,
         domain_crash(v->domain);
     }
 
+    if ( nvcpu->nv_vmexit_pending )
+        perfc_incra(nvmx_vmexits_l1, (uint16_t)exit_reason);
+    else
+        perfc_incra(nvmx_vmexits_l0, (uint16_t)exit_reason);
+
     return ( nvcpu->nv_vmexit_pending == 1 );
 }
 
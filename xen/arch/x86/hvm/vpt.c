@@ -181,6 +181,40 @@ static void pt_unlock(struct periodic_time *pt)
     read_unlock(&pt->vcpu->domain->arch.hvm.pl_time->pt_migrate);
 }
 
+/*
+ * All periodic_time instances attached to a vCPU share a single timer, set
+ * to the earliest deadline of the ones which are armed.  The functions below
+ * need to be called with the vCPU's tm_lock held.
+ */
+static void pt_arm(struct periodic_time *pt)
+{
+    struct timer *timer = &pt->vcpu->arch.hvm.pt_timer;
+
+    pt->armed = true;
+
+    /*
+     * If the timer is going to fire earlier, pt_timer_fn() will take care of
+     * this instance's deadline.
+     */
+    if ( !timer_is_active(timer) || pt->scheduled < timer->expires )
+        set_timer(timer, pt->scheduled);
+}
+
+static void pt_program(struct vcpu *v)
+{
+    const struct periodic_time *pt;
+    s_time_t next = STIME_MAX;
+
+    list_for_each_entry ( pt, &v->arch.hvm.tm_list, list )
+        if ( pt->armed && pt->scheduled < next )
+            next = pt->scheduled;
+
+    if ( next != STIME_MAX )
+        set_timer(&v->arch.hvm.pt_timer, next);
+    else
+        stop_timer(&v->arch.hvm.pt_timer);
+}
+
 static void pt_process_missed_ticks(struct periodic_time *pt)
 {
     s_time_t missed_ticks, now = NOW();
@@ -224,6 +258,7 @@ void pt_save_timer(struct vcpu *v)
 {
     struct list_head *head = &v->arch.hvm.tm_list;
     struct periodic_time *pt;
+    bool keep = false;
 
     if ( v->pause_flags & VPF_blocked )
         return;
@@ -232,7 +267,14 @@ void pt_save_timer(struct vcpu *v)
 
     list_for_each_entry ( pt, head, list )
         if ( !pt->do_not_freeze )
-            stop_timer(&pt->timer);
+            pt->armed = false;
+        else
+            keep |= pt->armed;
+
+    if ( keep )
+        pt_program(v);
+    else
+        stop_timer(&v->arch.hvm.pt_timer);
 
     pt_freeze_time(v);
 
@@ -251,10 +293,12 @@ void pt_restore_timer(struct vcpu *v)
         if ( pt->pending_intr_nr == 0 )
         {
             pt_process_missed_ticks(pt);
-            set_timer(&pt->timer, pt->scheduled);
+            pt->armed = true;
         }
     }
 
+    pt_program(v);
+
     pt_thaw_time(v);
 
     pt_vcpu_unlock(v);
@@ -262,17 +306,43 @@ void pt_restore_timer(struct vcpu *v)
 
 static void cf_check pt_timer_fn(void *data)
 {
-    struct periodic_time *pt = data;
+    struct vcpu *v = data;
+    struct periodic_time *pt;
+    s_time_t now = NOW();
+    bool kick = false;
 
-    pt_lock(pt);
+    pt_vcpu_lock(v);
 
-    pt->pending_intr_nr++;
-    pt->scheduled += pt->period;
-    pt->do_not_freeze = 0;
+    list_for_each_entry ( pt, &v->arch.hvm.tm_list, list )
+    {
+        if ( !pt->armed || pt->scheduled > now )
+            continue;
+
+        pt->armed = false;
+        pt->pending_intr_nr++;
+        pt->scheduled += pt->period;
+        pt->do_not_freeze = 0;
+        kick = true;
+    }
 
-    vcpu_kick(pt->vcpu);
+    pt_program(v);
 
-    pt_unlock(pt);
+    pt_vcpu_unlock(v);
+
+    if ( kick )
+        vcpu_kick(v);
+}
+
+void pt_vcpu_init(struct vcpu *v)
+{
+    spin_lock_init(&v->arch.hvm.tm_lock);
+    INIT_LIST_HEAD(&v->arch.hvm.tm_list);
+    init_timer(&v->arch.hvm.pt_timer, pt_timer_fn, v, v->processor);
+}
+
+void pt_vcpu_destroy(struct vcpu *v)
+{
+    kill_timer(&v->arch.hvm.pt_timer);
 }
 
 static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
@@ -292,7 +362,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         pt->last_plt_gtime = hvm_get_guest_time(v);
         pt_process_missed_ticks(pt);
         pt->pending_intr_nr = 0; /* 'collapse' all missed ticks */
-        set_timer(&pt->timer, pt->scheduled);
+        pt_arm(pt);
     }
     else
     {
@@ -301,7 +371,7 @@ static void pt_irq_fired(struct vcpu *v, struct periodic_time *pt)
         {
             pt_process_missed_ticks(pt);
             if ( pt->pending_intr_nr == 0 )
-                set_timer(&pt->timer, pt->scheduled);
+                pt_arm(pt);
         }
     }
 
@@ -472,15 +542,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
 
 void pt_migrate(struct vcpu *v)
 {
-    struct list_head *head = &v->arch.hvm.tm_list;
-    struct periodic_time *pt;
-
-    pt_vcpu_lock(v);
-
-    list_for_each_entry ( pt, head, list )
-        migrate_timer(&pt->timer, v->processor);
-
-    pt_vcpu_unlock(v);
+    migrate_timer(&v->arch.hvm.pt_timer, v->processor);
 }
 
 void create_periodic_time(
@@ -543,12 +605,10 @@ void create_periodic_time(
     pt->cb = cb;
     pt->priv = data;
 
-    init_timer(&pt->timer, pt_timer_fn, pt, v->processor);
-    set_timer(&pt->timer, pt->scheduled);
-
     pt_vcpu_lock(v);
     pt->on_list = 1;
     list_add(&pt->list, &v->arch.hvm.tm_list);
+    pt_arm(pt);
     pt_vcpu_unlock(v);
 
     write_unlock(&v->domain->arch.hvm.pl_time->pt_migrate);
@@ -560,18 +620,17 @@ void destroy_periodic_time(struct periodic_time *pt)
     if ( pt->vcpu == NULL )
         return;
 
+    /*
+     * Once off the list pt_timer_fn() won't access the structure anymore.
+     * The vCPU's timer may still fire for its deadline, to no effect.
+     */
     pt_lock(pt);
     if ( pt->on_list )
         list_del(&pt->list);
     pt->on_list = 0;
+    pt->armed = false;
     pt->pending_intr_nr = 0;
     pt_unlock(pt);
-
-    /*
-     * pt_timer_fn() can run until this kill_timer() returns. We must do this
-     * outside pt_lock() otherwise we can deadlock with pt_timer_fn().
-     */
-    kill_timer(&pt->timer);
 }
 
 static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
@@ -597,7 +656,8 @@ static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
     if ( pt->on_list )
     {
         list_add(&pt->list, &v->arch.hvm.tm_list);
-        migrate_timer(&pt->timer, v->processor);
+        if ( pt->armed )
+            pt_arm(pt);
     }
     pt_vcpu_unlock(v);
 
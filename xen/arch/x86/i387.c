@@ -8,6 +8,7 @@
  *  Gareth Hughes <gareth@valinux.com>, May 2000
  */
 
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <asm/current.h>
 #include <asm/processor.h>
@@ -31,6 +32,26 @@ static inline void fpu_xrstor(struct vcpu *v, uint64_t mask)
      */
     ok = set_xcr0(v->arch.xcr0_accum | XSTATE_FP_SSE);
     ASSERT(ok);
+
+    /*
+     * A component in its initial configuration both in the registers
+     * (XINUSE clear) and in the image (XSTATE_BV clear) needs no restoring.
+     * This avoids reinitialising e.g. the AVX-512 registers on every
+     * switch between vCPUs which don't use them. x87/SSE is always
+     * restored, as XINUSE doesn't reliably cover MXCSR.
+     */
+    if ( cpu_has_xgetbv1 )
+    {
+        uint64_t live = v->arch.xsave_area->xsave_hdr.xstate_bv |
+                        xgetbv(XCR_XFEATURE_IN_USE) | XSTATE_FP_SSE;
+
+        if ( mask & v->arch.xcr0_accum & ~live )
+        {
+            perfc_incr(xrstor_xinuse_trimmed);
+            mask &= live;
+        }
+    }
+
     xrstor(v, mask);
     ok = set_xcr0(v->arch.xcr0 ?: XSTATE_FP_SSE);
     ASSERT(ok);
@@ -38,6 +38,7 @@ struct cpuinfo_x86 {
     unsigned int phys_proc_id;         /* package ID of each logical CPU */
     unsigned int cpu_core_id;          /* core ID of each logical CPU */
     unsigned int compute_unit_id;      /* AMD compute unit ID of each logical CPU */
+    unsigned int cpu_llc_id;           /* last level cache ID of each logical CPU */
     unsigned short x86_clflush_size;
 } __cacheline_aligned;
 
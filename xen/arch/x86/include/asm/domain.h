@@ -55,6 +55,9 @@ struct mapcache_vcpu {
         uint32_t      idx;
         uint32_t      refcnt;
     } hash[MAPHASH_ENTRIES];
+
+    /* Private mapping slots, when the domain uses per-VCPU mapcaches. */
+    struct mapcache_slots *slots;
 };
 
 struct mapcache_domain {
@@ -72,10 +75,14 @@ struct mapcache_domain {
     /* Which mappings are in use, and which are garbage to reap next epoch? */
     unsigned long *inuse;
     unsigned long *garbage;
+
+    /* Number of mapcache entries owned by each VCPU, in per-VCPU mode. */
+    unsigned int vcpu_entries;
 };
 
 int mapcache_domain_init(struct domain *);
 int mapcache_vcpu_init(struct vcpu *);
+void mapcache_vcpu_destroy(struct vcpu *);
 void mapcache_override_current(struct vcpu *);
 
 /* x86/64: toggle guest between kernel and user modes. */
@@ -154,6 +161,9 @@ struct shadow_vcpu {
     /* Shadow out-of-sync: pages that this vcpu has let go out of sync */
     mfn_t oos[SHADOW_OOS_PAGES];
     mfn_t oos_snapshot[SHADOW_OOS_PAGES];
+    /* Number of TLB flushes each page has been left out of sync across */
+    uint8_t oos_age[SHADOW_OOS_PAGES];
+    unsigned int oos_count;
     struct oos_fixup {
         int next;
         mfn_t smfn[SHADOW_OOS_FIXUPS];
@@ -175,6 +185,12 @@ struct hap_domain {
 /*       common paging data structure           */
 /************************************************/
 struct log_dirty_domain {
+    /*
+     * Held for reading by lockless (ranged) walkers of the trie, and for
+     * writing while freeing (parts of) it.
+     */
+    rwlock_t       lock;
+
     /* log-dirty radix tree to record dirty pages */
     mfn_t          top;
     unsigned int   allocs;
@@ -184,6 +200,16 @@ struct log_dirty_domain {
     unsigned long  fault_count;
     unsigned long  dirty_count;
 
+    /* Per-vCPU dirty rings (XEN_DOMCTL_SHADOW_OP_DIRTY_RING), if any */
+    struct paging_dirty_ring {
+        struct xen_dirty_ring *ring;  /* Shared with the toolstack */
+        mfn_t *mfns;
+        unsigned int prod;            /* Private copy of ring->prod */
+        unsigned int reset;           /* Oldest entry not re-protected yet */
+    } *dirty_rings;
+    unsigned int   dirty_ring_frames;
+    unsigned int   dirty_ring_entries;
+
     /* functions which are paging mode specific */
     const struct log_dirty_ops {
         int        (*enable  )(struct domain *d, bool log_global);
@@ -259,7 +285,11 @@ struct paging_vcpu {
     struct shadow_vcpu shadow;
 };
 
-#define MAX_NESTEDP2M 10
+/*
+ * Nested p2m tables, one per L1 EPT/NPT base in use, recycled in LRU order.
+ * Each costs a top level table from the paging pool of every HVM domain.
+ */
+#define MAX_NESTEDP2M 16
 
 #define MAX_ALTP2M      10 /* arbitrary */
 #define INVALID_ALTP2M  0xffff
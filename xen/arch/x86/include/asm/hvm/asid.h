@@ -21,6 +21,13 @@ void hvm_asid_flush_vcpu_asid(struct hvm_vcpu_asid *asid);
 /* Invalidate all ASID allocations for specified VCPU: forces re-allocation. */
 void hvm_asid_flush_vcpu(struct vcpu *v);
 
+/*
+ * As hvm_asid_flush_vcpu(), but also report whether the VCPU may have entered
+ * guest context with its ASID since the previous flush, i.e. whether TLB
+ * entries tagged with the now stale ASID may exist and need shooting down.
+ */
+bool hvm_asid_flush_vcpu_live(struct vcpu *v);
+
 /* Flush all ASIDs on this processor core. */
 void hvm_asid_flush_core(void);
 
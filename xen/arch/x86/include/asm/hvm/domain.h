@@ -17,6 +17,8 @@
 #include <asm/hvm/vmx/vmcs.h>
 #include <asm/hvm/svm/vmcb.h>
 
+#include <public/hvm/hvm_info_table.h>
+
 #ifdef CONFIG_MEM_SHARING
 struct mem_sharing_domain
 {
@@ -66,6 +68,15 @@ struct hvm_domain {
     struct hvm_io_handler *io_handler;
     unsigned int          io_handler_count;
 
+    /*
+     * Port I/O handlers with a static range, sorted by first port, and the
+     * remaining handlers (by index) which need their accept hook invoked.
+     */
+    struct hvm_io_range   *io_range;
+    unsigned int          io_range_count;
+    unsigned int          io_range_max;
+    unsigned long         io_handler_dynamic;
+
     /* Lock protects access to irq, vpic and vioapic. */
     spinlock_t             irq_lock;
     struct hvm_irq        *irq;
@@ -87,6 +98,12 @@ struct hvm_domain {
     /* VCPU which is current target for 8259 interrupts. */
     struct vcpu           *i8259_target;
 
+    /*
+     * VCPUs whose local APIC is in x2APIC mode with the default ID and LDR,
+     * allowing IPI destinations to be mapped directly to VCPU IDs.
+     */
+    DECLARE_BITMAP(x2apic_id_default, HVM_MAX_VCPUS);
+
     /* emulated irq to pirq */
     struct radix_tree_root emuirq_pirq;
 
@@ -106,6 +123,15 @@ struct hvm_domain {
 
     bool                   is_s3_suspended;
 
+    /* Toolstack requested IPI virtualisation (XEN_X86_IPI_VIRT). */
+    bool                   ipi_virt;
+
+    /*
+     * Bumped to invalidate all vCPUs' cached instruction fetch translations
+     * (see hvmemul_insn_xlat_flush_domain()).
+     */
+    atomic_t               insn_xlat_gen;
+
     /* hypervisor intercepted msix table */
     struct list_head       msixtbl_list;
 
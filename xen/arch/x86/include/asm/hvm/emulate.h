@@ -86,6 +86,7 @@ struct segment_register *hvmemul_get_seg_reg(
     enum x86_segment seg,
     struct hvm_emulate_ctxt *hvmemul_ctxt);
 int hvm_emulate_one_mmio(unsigned long mfn, unsigned long gla);
+bool hvm_mmio_fast_path(unsigned long gla, paddr_t gpa, struct npfec npfec);
 
 static inline bool handle_mmio(void)
 {
@@ -126,6 +127,8 @@ bool hvmemul_read_cache(const struct vcpu *, paddr_t gpa,
 void hvmemul_write_cache(const struct vcpu *, paddr_t gpa,
                          const void *buffer, unsigned int size);
 unsigned int hvmemul_cache_disable(struct vcpu *);
+void hvmemul_insn_xlat_flush(struct vcpu *v);
+void hvmemul_insn_xlat_flush_domain(struct domain *d);
 void hvmemul_cache_restore(struct vcpu *, unsigned int token);
 /* For use in ASSERT()s only: */
 static inline bool hvmemul_cache_disabled(struct vcpu *v)
@@ -14,6 +14,7 @@
 #include <asm/alternative.h>
 #include <asm/asm_defns.h>
 #include <asm/current.h>
+#include <asm/msr.h>
 #include <asm/x86_emulate.h>
 #include <asm/hvm/asid.h>
 
@@ -207,6 +208,7 @@ struct hvm_function_table {
     int (*pi_update_irte)(const struct vcpu *v, const struct pirq *pirq,
                           uint8_t gvec);
     void (*update_vlapic_mode)(struct vcpu *v);
+    void (*update_vlapic_ids)(struct domain *d);
 
     /*Walk nested p2m  */
     int (*nhvm_hap_walk_L1_p2m)(struct vcpu *v, paddr_t L2_gpa,
@@ -227,6 +229,8 @@ struct hvm_function_table {
     int (*vmtrace_set_option)(struct vcpu *v, uint64_t key, uint64_t value);
     int (*vmtrace_get_option)(struct vcpu *v, uint64_t key, uint64_t *value);
     int (*vmtrace_reset)(struct vcpu *v);
+    int (*vmtrace_stream_op)(struct vcpu *v, unsigned int cmd,
+                             uint64_t *key, uint64_t *value);
 
     uint64_t (*get_reg)(struct vcpu *v, unsigned int reg);
     void (*set_reg)(struct vcpu *v, unsigned int reg, uint64_t val);
@@ -594,6 +598,27 @@ static inline void hvm_invalidate_regs_fields(struct cpu_user_regs *regs)
 #endif
 }
 
+/* Called by the vendor's VM exit handler, idx as for struct hvm_exit_stats. */
+static inline void hvm_exit_stats_begin(struct vcpu *v, unsigned int idx)
+{
+    v->arch.hvm.exit_idx = idx;
+    v->arch.hvm.exit_tsc = rdtsc();
+}
+
+/* Called on the way back into the guest. */
+static inline void hvm_exit_stats_end(struct vcpu *v)
+{
+    struct hvm_exit_stats *stats = v->arch.hvm.exit_stats;
+    unsigned int idx = v->arch.hvm.exit_idx;
+
+    if ( idx >= HVM_NR_EXIT_STATS )
+        return;
+
+    stats->count[idx]++;
+    stats->cycles[idx] += rdtsc() - v->arch.hvm.exit_tsc;
+    v->arch.hvm.exit_idx = HVM_NR_EXIT_STATS;
+}
+
 /*
  * Nested HVM
  */
@@ -732,6 +757,17 @@ static inline int hvm_vmtrace_reset(struct vcpu *v)
     return -EOPNOTSUPP;
 }
 
+/* XEN_DOMCTL_vmtrace_stream_*, with the vcpu paused. */
+static inline int hvm_vmtrace_stream_op(
+    struct vcpu *v, unsigned int cmd, uint64_t *key, uint64_t *value)
+{
+    if ( hvm_funcs.vmtrace_stream_op )
+        return alternative_call(hvm_funcs.vmtrace_stream_op,
+                                v, cmd, key, value);
+
+    return -EOPNOTSUPP;
+}
+
 /*
  * Accessors for registers which have per-guest-type or per-vendor locations
  * (e.g. VMCS, msr load/save lists, VMCB, VMLOAD lazy, etc).
@@ -782,6 +818,12 @@ static inline void hvm_update_vlapic_mode(struct vcpu *v)
         alternative_vcall(hvm_funcs.update_vlapic_mode, v);
 }
 
+static inline void hvm_update_vlapic_ids(struct domain *d)
+{
+    if ( hvm_funcs.update_vlapic_ids )
+        alternative_vcall(hvm_funcs.update_vlapic_ids, d);
+}
+
 #else  /* CONFIG_HVM */
 
 #define hvm_enabled false
@@ -891,6 +933,12 @@ static inline int hvm_vmtrace_get_option(
     return -EOPNOTSUPP;
 }
 
+static inline int hvm_vmtrace_stream_op(
+    struct vcpu *v, unsigned int cmd, uint64_t *key, uint64_t *value)
+{
+    return -EOPNOTSUPP;
+}
+
 static inline uint64_t hvm_get_reg(struct vcpu *v, unsigned int reg)
 {
     ASSERT_UNREACHABLE();
@@ -46,6 +46,11 @@ struct hvm_io_handler {
     uint8_t type;
 };
 
+struct hvm_io_range {
+    unsigned int first, size;
+    unsigned int idx;           /* Into hvm_domain.io_handler[]. */
+};
+
 typedef int (*hvm_io_read_t)(const struct hvm_io_handler *,
                              uint64_t addr,
                              uint32_t size,
@@ -69,6 +74,7 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
                              ioreq_t *p);
 
 int hvm_io_intercept(ioreq_t *p);
+const struct hvm_io_handler *hvm_find_io_handler(const ioreq_t *p);
 
 struct hvm_io_handler *hvm_next_io_handler(struct domain *d);
 
@@ -124,6 +124,12 @@ struct hvm_gmsi_info {
     uint32_t gflags;
     int dest_vcpu_id; /* -1 :multi-dest, non-negative: dest_vcpu_id */
     bool posted; /* directly deliver to guest via VT-d PI? */
+    /* Consecutive interrupts arriving away from the destination vCPU. */
+    unsigned int misses;
+    /* Arrival time of the last interrupt, and delivery latency stats. */
+    s_time_t raised;
+    unsigned long nr_delivered;
+    s_time_t latency_total, latency_max;
 };
 
 struct hvm_girq_dpci_mapping {
@@ -160,12 +166,20 @@ struct hvm_pirq_dpci {
     struct list_head softirq_list;
 };
 
+/*
+ * Number of consecutive interrupts to tolerate arriving on a pCPU other than
+ * the one the destination vCPU runs on before re-targeting a non-posted MSI.
+ * 0 means re-targeting upon every vCPU migration.
+ */
+extern unsigned int opt_pt_irq_hysteresis;
+
 void pt_pirq_init(struct domain *, struct hvm_pirq_dpci *);
 bool pt_pirq_cleanup_check(struct hvm_pirq_dpci *);
 int pt_pirq_iterate(struct domain *d,
                     int (*cb)(struct domain *,
                               struct hvm_pirq_dpci *, void *arg),
                     void *arg);
+void pt_pirq_dump_stats(struct domain *d);
 
 #ifdef CONFIG_HVM
 bool pt_pirq_softirq_active(struct hvm_pirq_dpci *);
@@ -33,6 +33,15 @@ struct hvm_mmio_cache {
     uint8_t buffer[64] __aligned(sizeof(long));
 };
 
+/* Translation of an instruction fetch, see hvmemul_insn_xlat_flush(). */
+struct hvm_insn_xlat {
+    unsigned long cr3;
+    unsigned long linear;   /* Page aligned. */
+    uint32_t      pfec;
+    unsigned int  gen;      /* Of the domain's insn_xlat_gen. */
+    gfn_t         gfn;      /* INVALID_GFN if unused. */
+};
+
 struct hvm_vcpu_io {
     /*
      * HVM emulation:
@@ -56,6 +65,10 @@ struct hvm_vcpu_io {
     unsigned char mmio_insn[16];
     struct hvmemul_cache *cache;
 
+    /* Recently used instruction fetch translations. */
+    struct hvm_insn_xlat insn_xlat[4];
+    unsigned int insn_xlat_next;
+
     /*
      * For string instruction emulation we need to be able to signal a
      * necessary retry through other than function return codes.
@@ -120,6 +133,18 @@ struct altp2mvcpu {
 
 #define vcpu_altp2m(v) ((v)->arch.hvm.avcpu)
 
+/*
+ * VM exit statistics, indexed by VMX basic exit reason or SVM exit code,
+ * except that SVM's nested page faults use the last slot.
+ */
+#define HVM_NR_EXIT_STATS       (VMEXIT_RDPRU + 2)
+#define HVM_EXIT_STATS_SVM_NPF  (HVM_NR_EXIT_STATS - 1)
+
+struct hvm_exit_stats {
+    uint64_t count[HVM_NR_EXIT_STATS];
+    uint64_t cycles[HVM_NR_EXIT_STATS]; /* from VM exit to next VM entry */
+};
+
 struct hvm_vcpu {
     /* Guest control-register and EFER values, just as the guest sees them. */
     unsigned long       guest_cr[5];
@@ -137,9 +162,13 @@ struct hvm_vcpu {
     s64                 cache_tsc_offset;
     u64                 guest_time;
 
-    /* Lock and list for virtual platform timers. */
+    /*
+     * Lock and list for virtual platform timers, and the timer firing at
+     * the earliest deadline of the ones on the list.
+     */
     spinlock_t          tm_lock;
     struct list_head    tm_list;
+    struct timer        pt_timer;
 
     bool                flag_dr_dirty;
     bool                debug_state_latch;
@@ -184,6 +213,11 @@ struct hvm_vcpu {
     struct x86_event     inject_event;
 
     struct viridian_vcpu *viridian;
+
+    /* Always-on VM exit statistics, and the exit currently being handled. */
+    struct hvm_exit_stats *exit_stats;
+    uint64_t            exit_tsc;
+    unsigned int        exit_idx;
 };
 
 #endif /* __ASM_X86_HVM_VCPU_H__ */
@@ -39,6 +39,7 @@ struct viridian_vcpu
     struct viridian_stimer stimer[4];
     unsigned int stimer_enabled;
     unsigned int stimer_pending;
+    bool stimer_kicked;
     uint64_t crash_param[5];
 };
 
@@ -26,6 +26,7 @@ struct periodic_time {
     bool irq_issued;
     bool warned_timeout_too_short;
     bool level;
+    bool armed;                 /* awaiting 'scheduled' (vcpu's pt_timer) */
 #define PTSRC_isa    1 /* ISA time source */
 #define PTSRC_lapic  2 /* LAPIC time source */
 #define PTSRC_ioapic 3 /* IOAPIC time source */
@@ -36,7 +37,6 @@ struct periodic_time {
     u64 period;                 /* frequency in ns */
     s_time_t scheduled;         /* scheduled timer interrupt */
     u64 last_plt_gtime;         /* platform time when last IRQ is injected */
-    struct timer timer;         /* ac_timer */
     time_cb *cb;
     void *priv;                 /* point back to platform time source */
 };
@@ -138,6 +138,8 @@ struct pl_time {    /* platform time */
     struct domain *domain;
 };
 
+void pt_vcpu_init(struct vcpu *v);
+void pt_vcpu_destroy(struct vcpu *v);
 void pt_save_timer(struct vcpu *v);
 void pt_restore_timer(struct vcpu *v);
 int pt_update_irq(struct vcpu *v);
@@ -6,6 +6,7 @@
 #include <xen/list.h>
 #include <xen/mem_access.h>
 #include <xen/spinlock.h>
+#include <xen/tasklet.h>
 #include <asm/apicdef.h>
 #include <asm/cache.h>
 #include <asm/processor.h>
@@ -37,6 +38,10 @@ struct arch_iommu
     struct {
         struct page_list_head list;
         spinlock_t lock;
+        /* Reserve of cleared pages, refilled in the background. */
+        struct page_list_head pool;
+        unsigned int pool_size;
+        struct tasklet refill;
     } pgtables;
 
     struct list_head identity_maps;
@@ -53,6 +58,8 @@ struct arch_iommu
             unsigned int paging_mode;
             struct page_info *root_table;
             struct guest_iommu *g_iommu;
+            /* Leaf table of the last walk (protected by mapping_lock). */
+            unsigned long leaf_dfn, leaf_mfn; /* leaf_mfn 0: none */
         } amd;
     };
 };
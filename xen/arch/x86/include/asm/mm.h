@@ -323,7 +323,13 @@ struct page_info
 #define PRtype_info "016lx"/* should only be used for printk's */
 
 /* The number of out-of-sync shadows we allow per vcpu (prime, please) */
-#define SHADOW_OOS_PAGES 3
+#define SHADOW_OOS_PAGES 13
+
+/* Number of consecutive hash slots an out-of-sync page may be found in */
+#define SHADOW_OOS_PROBE 4
+
+/* Number of guest TLB flushes a vcpu's OOS page is left out of sync across */
+#define SHADOW_OOS_MAX_AGE 4
 
 /* OOS fixup entries */
 #define SHADOW_OOS_FIXUPS 2
@@ -16,6 +16,7 @@
 
 #include <xen/paging.h>
 #include <xen/mem_access.h>
+#include <xen/tasklet.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
 
@@ -328,10 +329,28 @@ struct p2m_domain {
             unsigned long list[NR_POD_MRP_ENTRIES];
             unsigned int idx;
         } mrp;
+
+        /* Background reclaim of zeroed pages into the cache. */
+        struct tasklet   reclaim_tasklet;
+        bool             reclaim_active;
+        unsigned long    reclaim_left; /* # of gfns left to scan in pass    */
         mm_lock_t        lock;         /* Locking of private pod structs,   *
                                         * not relying on the p2m lock.      */
     } pod;
 
+    /*
+     * Host p2m: background re-coalescing of superpages, protected by the
+     * p2m lock.
+     */
+    struct {
+        struct tasklet   tasklet;
+        bool             active;
+        unsigned long    next_gfn;     /* Next 2M range to look at          */
+        unsigned long    passes,       /* # of completed passes             */
+                         promoted_2m,  /* # of 2M entries created           */
+                         promoted_1g;  /* # of 1G entries created           */
+    } recoalesce;
+
     /*
      * Host p2m: when this flag is set, don't flush all the nested-p2m
      * tables on every host-p2m change.  The setter of this flag
@@ -622,6 +641,16 @@ static inline void p2m_flush_hardware_cached_dirty(struct domain *d) {}
 
 #endif
 
+/* Merge 4k p2m entries back into superpages, in the background. */
+#ifdef CONFIG_HVM
+int p2m_recoalesce_start(struct domain *d, bool explicit);
+#else
+static inline int p2m_recoalesce_start(struct domain *d, bool explicit)
+{
+    return -EOPNOTSUPP;
+}
+#endif
+
 /* Change types across all p2m entries in a domain */
 void p2m_change_entry_type_global(struct domain *d, 
                                   p2m_type_t ot, p2m_type_t nt);
@@ -662,7 +691,8 @@ int set_identity_p2m_entry(struct domain *d, unsigned long gfn,
 int clear_identity_p2m_entry(struct domain *d, unsigned long gfn);
 /* HVM-only callers can use these directly: */
 int p2m_add_identity_entry(struct domain *d, unsigned long gfn,
-                           p2m_access_t p2ma, unsigned int flag);
+                           unsigned int order, p2m_access_t p2ma,
+                           unsigned int flag);
 int p2m_remove_identity_entry(struct domain *d, unsigned long gfn);
 
 /* 
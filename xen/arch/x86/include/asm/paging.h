@@ -136,12 +136,6 @@ struct paging_mode {
 
 #if PG_log_dirty
 
-/* get the dirty bitmap for a specific range of pfns */
-void paging_log_dirty_range(struct domain *d,
-                            unsigned long begin_pfn,
-                            unsigned long nr,
-                            uint8_t *dirty_bitmap);
-
 /* log dirty initialization */
 void paging_log_dirty_init(struct domain *d, const struct log_dirty_ops *ops);
 
@@ -149,6 +143,22 @@ void paging_log_dirty_init(struct domain *d, const struct log_dirty_ops *ops);
 void paging_mark_dirty(struct domain *d, mfn_t gmfn);
 /* mark a page as dirty with taking guest pfn as parameter */
 void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn);
+/* as above, on behalf of vcpu v (for the purpose of dirty rings) */
+void paging_mark_pfn_dirty_vcpu(struct domain *d, pfn_t pfn,
+                                const struct vcpu *v);
+/* bracket a series of the above, acquiring the paging lock just once */
+void paging_mark_dirty_batch_begin(struct domain *d);
+void paging_mark_dirty_batch_end(struct domain *d);
+
+/* XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE operations, not under the domctl lock */
+int paging_log_dirty_range_op(struct domain *d,
+                              struct xen_domctl_shadow_op *sc);
+
+/* XENMEM_resource_dirty_ring support */
+unsigned int paging_dirty_ring_max_frames(const struct domain *d);
+int paging_dirty_ring_acquire(struct domain *d, unsigned int id,
+                              unsigned int frame, unsigned int nr_frames,
+                              xen_pfn_t mfn_list[]);
 
 /* is this guest page dirty? 
  * This is called from inside paging code, with the paging lock held. */
@@ -177,6 +187,8 @@ bool paging_mfn_is_dirty(const struct domain *d, mfn_t gmfn);
 struct sh_dirty_vram {
     unsigned long begin_pfn;
     unsigned long end_pfn;
+    /* HAP: frames logged as written since the last harvest. */
+    unsigned long *logged;
 #ifdef CONFIG_SHADOW_PAGING
     paddr_t *sl1ma;
     uint8_t *dirty_bitmap;
@@ -191,6 +203,26 @@ static inline void paging_log_dirty_init(struct domain *d,
                                          const struct log_dirty_ops *ops) {}
 static inline void paging_mark_dirty(struct domain *d, mfn_t gmfn) {}
 static inline void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn) {}
+static inline void paging_mark_pfn_dirty_vcpu(struct domain *d, pfn_t pfn,
+                                              const struct vcpu *v) {}
+static inline void paging_mark_dirty_batch_begin(struct domain *d) {}
+static inline void paging_mark_dirty_batch_end(struct domain *d) {}
+static inline int paging_log_dirty_range_op(struct domain *d,
+                                            struct xen_domctl_shadow_op *sc)
+{
+    return -EOPNOTSUPP;
+}
+static inline unsigned int paging_dirty_ring_max_frames(const struct domain *d)
+{
+    return 0;
+}
+static inline int paging_dirty_ring_acquire(struct domain *d, unsigned int id,
+                                            unsigned int frame,
+                                            unsigned int nr_frames,
+                                            xen_pfn_t mfn_list[])
+{
+    return -EOPNOTSUPP;
+}
 static inline bool paging_mfn_is_dirty(struct domain *d, mfn_t gmfn) { return false; }
 
 #endif /* PG_log_dirty */
@@ -15,6 +15,14 @@ PERFCOUNTER_ARRAY(vmexits,              "vmexits",
 #define VMX_PERF_VECTOR_SIZE 0x20
 PERFCOUNTER_ARRAY(cause_vector,         "cause vector", VMX_PERF_VECTOR_SIZE)
 
+/* vmexits from a nested (L2) guest: handled by Xen, or reflected to L1. */
+PERFCOUNTER_ARRAY(nvmx_vmexits_l0,      "nested vmexits handled",
+                  VMX_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_ARRAY(nvmx_vmexits_l1,      "nested vmexits to L1",
+                  VMX_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER(np2m_hit,                   "nested p2m reused")
+PERFCOUNTER(np2m_evict,                 "nested p2m evicted")
+
 #endif /* CONFIG_HVM */
 
 PERFCOUNTER(seg_fixups,             "segmentation fixups")
@@ -22,12 +30,17 @@ PERFCOUNTER(seg_fixups,             "segmentation fixups")
 PERFCOUNTER(apic_timer,             "apic timer interrupts")
 
 PERFCOUNTER(domain_page_tlb_flush,  "domain page tlb flushes")
+PERFCOUNTER(domain_page_hit,        "domain page mapcache hits")
+PERFCOUNTER(domain_page_miss,       "domain page mapcache misses")
+PERFCOUNTER(domain_page_evict,      "domain page mapcache evictions")
 
 PERFCOUNTER(calls_to_mmuext_op,         "calls to mmuext_op")
 PERFCOUNTER(num_mmuext_ops,             "mmuext ops")
 PERFCOUNTER(calls_to_mmu_update,        "calls to mmu_update")
 PERFCOUNTER(num_page_updates,           "page updates")
 PERFCOUNTER(writable_mmu_updates,       "mmu_updates of writable pages")
+PERFCOUNTER(mmu_update_page_reuse,      "mmu_updates of a still locked page")
+PERFCOUNTER(io_emul_stub_reuse,         "PV I/O emulation stubs reused")
 PERFCOUNTER(calls_to_update_va,         "calls to update_va_map")
 PERFCOUNTER(page_faults,            "page faults")
 PERFCOUNTER(copy_user_faults,       "copy_user faults")
@@ -117,6 +130,10 @@ PERFCOUNTER(shadow_oos_fixup_evict,"shadow OOS fixup evictions")
 PERFCOUNTER(shadow_unsync,         "shadow OOS unsyncs")
 PERFCOUNTER(shadow_unsync_evict,   "shadow OOS evictions")
 PERFCOUNTER(shadow_resync,         "shadow OOS resyncs")
+PERFCOUNTER(shadow_resync_aged,    "shadow OOS resyncs of aged pages")
+PERFCOUNTER(shadow_resync_kept,    "shadow OOS pages kept unsynced on flush")
+PERFCOUNTER(shadow_oos_hit_local,  "shadow OOS lookups hitting this vcpu")
+PERFCOUNTER(shadow_oos_hit_remote, "shadow OOS lookups hitting other vcpus")
 
 #endif /* CONFIG_SHADOW_PAGING */
 
@@ -125,8 +142,25 @@ PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(hvm_insn_xlat_hit,  "HVM insn fetch translation cache hits")
+PERFCOUNTER(hvm_insn_xlat_miss, "HVM insn fetch translation cache misses")
+PERFCOUNTER(hvm_mmio_fast,      "HVM MMIO accesses on fast path")
+PERFCOUNTER(hvm_mmio_slow,      "HVM MMIO accesses needing full emulation")
+
 PERFCOUNTER(iommu_pt_shatters,    "IOMMU page table shatters")
 PERFCOUNTER(iommu_pt_coalesces,   "IOMMU page table coalesces")
+PERFCOUNTER(iommu_pt_leaf_hits,   "IOMMU page table leaf walk hits")
+
+PERFCOUNTER(msixtbl_inline,       "MSI-X table accesses handled in Xen")
+PERFCOUNTER(msixtbl_forwarded,    "MSI-X table accesses forwarded")
+PERFCOUNTER(msixtbl_mask_nop,     "MSI-X mask writes without change")
+PERFCOUNTER(pt_irq_steered,       "passthrough MSIs re-targeted")
+PERFCOUNTER(iommu_irte_unchanged, "IOMMU IRTE rewrites skipped")
+
+PERFCOUNTER(xrstor_xinuse_trimmed, "XRSTORs skipping components not in use")
+
+PERFCOUNTER(ctxt_switch_ibpb,         "context switch IBPBs")
+PERFCOUNTER(ctxt_switch_ibpb_skipped, "context switch IBPBs within a security group")
 
 PERFCOUNTER(buslock, "Bus Locks Detected")
 PERFCOUNTER(vmnotify_crash, "domain crashes by Notify VM Exit")
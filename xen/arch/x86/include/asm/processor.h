@@ -116,9 +116,11 @@ extern void setup_force_cpu_cap(unsigned int);
 extern bool is_forced_cpu_cap(unsigned int);
 extern void print_cpu_info(unsigned int cpu);
 extern void init_intel_cacheinfo(struct cpuinfo_x86 *c);
+extern void cpuid4_llc_id(struct cpuinfo_x86 *c, unsigned int leaf);
 
 #define cpu_to_core(_cpu)   (cpu_data[_cpu].cpu_core_id)
 #define cpu_to_socket(_cpu) (cpu_data[_cpu].phys_proc_id)
+#define cpu_to_llc(_cpu)    (cpu_data[_cpu].cpu_llc_id)
 
 unsigned int apicid_to_socket(unsigned int);
 
@@ -503,6 +505,11 @@ struct stubs {
         unsigned long addr;
     };
     unsigned long mfn;
+    /*
+     * Key of the I/O emulation stub in the second half of the buffer, or 0
+     * when that has been reused (see get_stub()).
+     */
+    unsigned int io_emul_key;
 };
 
 DECLARE_PER_CPU(struct stubs, stubs);
@@ -14,6 +14,7 @@
 
 #define BAD_APICID   (-1U)
 #define INVALID_CUID (~0U)   /* AMD Compute Unit ID */
+#define INVALID_LLC_ID (~0U) /* Last Level Cache ID */
 #ifndef __ASSEMBLY__
 
 /*
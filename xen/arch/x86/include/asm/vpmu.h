@@ -102,8 +102,9 @@ int vpmu_do_msr(unsigned int msr, uint64_t *msr_content, bool is_write);
 void vpmu_do_interrupt(struct cpu_user_regs *regs);
 void vpmu_initialise(struct vcpu *v);
 void vpmu_destroy(struct vcpu *v);
-void vpmu_save(struct vcpu *v);
+void vpmu_save(struct vcpu *v, bool lazy);
 void cf_check vpmu_save_force(void *arg);
+void vpmu_claim(struct vcpu *v);
 int vpmu_load(struct vcpu *v, bool_t from_guest);
 void vpmu_dump(struct vcpu *v);
 
@@ -118,12 +119,13 @@ static inline int vpmu_do_rdmsr(unsigned int msr, uint64_t *msr_content)
 
 extern unsigned int vpmu_mode;
 extern unsigned int vpmu_features;
+extern bool opt_vpmu_lazy;
 
 /* Context switch */
 static inline void vpmu_switch_from(struct vcpu *prev)
 {
     if ( vpmu_mode & (XENPMU_MODE_SELF | XENPMU_MODE_HV) )
-        vpmu_save(prev);
+        vpmu_save(prev, opt_vpmu_lazy);
 }
 
 static inline void vpmu_switch_to(struct vcpu *next)
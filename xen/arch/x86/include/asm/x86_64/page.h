@@ -46,16 +46,13 @@ static inline unsigned long __virt_to_maddr(unsigned long va)
 
         va += xen_phys_start - XEN_VIRT_START;
     }
-    return (va & ma_va_bottom_mask) |
-           ((va << pfn_pdx_hole_shift) & ma_top_mask);
+    return directmapoff_to_maddr(va);
 }
 
 static inline void *__maddr_to_virt(unsigned long ma)
 {
     ASSERT(pfn_to_pdx(ma >> PAGE_SHIFT) < (DIRECTMAP_SIZE >> PAGE_SHIFT));
-    return (void *)(DIRECTMAP_VIRT_START +
-                    ((ma & ma_va_bottom_mask) |
-                     ((ma & ma_top_mask) >> pfn_pdx_hole_shift)));
+    return (void *)(DIRECTMAP_VIRT_START + maddr_to_directmapoff(ma));
 }
 
 /* read access (should only be used for debug printk's) */
@@ -21,6 +21,7 @@ extern uint32_t mxcsr_mask;
 #define XSTATE_CPUID              0x0000000d
 
 #define XCR_XFEATURE_ENABLED_MASK 0x00000000  /* index of XCR0 */
+#define XCR_XFEATURE_IN_USE       0x00000001  /* XINUSE, XCR0 & in-use */
 
 #define XSAVE_HDR_SIZE            64
 #define XSAVE_SSE_OFFSET          160
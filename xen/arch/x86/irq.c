@@ -2855,6 +2855,9 @@ int allocate_and_map_gsi_pirq(struct domain *d, int index, int *pirq_p)
         }
     }
 
+    /* Don't have pirq_get_info() allocate tree nodes under the lock. */
+    radix_tree_preload();
+
     /* Verify or get pirq. */
     write_lock(&d->event_lock);
     pirq = allocate_pirq(d, index, *pirq_p, irq, MAP_PIRQ_TYPE_GSI, NULL);
@@ -2908,6 +2911,8 @@ int allocate_and_map_msi_pirq(struct domain *d, int index, int *pirq_p,
 
     msi->irq = irq;
 
+    radix_tree_preload();
+
     pcidevs_lock();
     /* Verify or get pirq. */
     write_lock(&d->event_lock);
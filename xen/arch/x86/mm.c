@@ -117,6 +117,7 @@
 #include <asm/io.h>
 #include <asm/ldt.h>
 #include <asm/x86_emulate.h>
+#include <asm/hvm/emulate.h>
 #include <asm/e820.h>
 #include <asm/shared.h>
 #include <asm/mem_sharing.h>
@@ -3957,8 +3958,8 @@ long do_mmu_update(
 {
     struct mmu_update req;
     void *va = NULL;
-    unsigned long gpfn, gmfn;
-    struct page_info *page;
+    unsigned long gpfn, gmfn, locked_gmfn = 0;
+    struct page_info *page, *locked_page = NULL;
     unsigned int cmd, i = 0, done = 0, pt_dom;
     struct vcpu *curr = current, *v = curr;
     struct domain *d = v->domain, *pt_owner = d, *pg_owner;
@@ -4037,6 +4038,21 @@ long do_mmu_update(
 
         cmd = req.ptr & (sizeof(l1_pgentry_t)-1);
 
+        /*
+         * Consecutive updates of the same page table page (e.g. a PV fork
+         * copying an L1 table) keep the reference and the page lock taken
+         * for the first one, instead of dropping and retaking them for every
+         * entry.
+         */
+        if ( locked_page &&
+             (cmd == MMU_MACHPHYS_UPDATE ||
+              ((req.ptr - cmd) >> PAGE_SHIFT) != locked_gmfn) )
+        {
+            page_unlock(locked_page);
+            put_page(locked_page);
+            locked_page = NULL;
+        }
+
         switch ( cmd )
         {
             /*
@@ -4049,6 +4065,7 @@ long do_mmu_update(
         case MMU_PT_UPDATE_NO_TRANSLATE:
         {
             p2m_type_t p2mt;
+            bool locked;
 
             rc = -EOPNOTSUPP;
             if ( unlikely(paging_mode_refcounts(pt_owner)) )
@@ -4072,21 +4089,35 @@ long do_mmu_update(
 
             req.ptr -= cmd;
             gmfn = req.ptr >> PAGE_SHIFT;
-            page = get_page_from_gfn(pt_owner, gmfn, &p2mt, P2M_ALLOC);
 
-            if ( unlikely(!page) || p2mt != p2m_ram_rw )
+            if ( locked_page )
             {
-                if ( page )
-                    put_page(page);
-                if ( p2m_is_paged(p2mt) )
+                ASSERT(gmfn == locked_gmfn);
+                page = locked_page;
+                locked_page = NULL;
+                locked = true;
+                perfc_incr(mmu_update_page_reuse);
+            }
+            else
+            {
+                page = get_page_from_gfn(pt_owner, gmfn, &p2mt, P2M_ALLOC);
+
+                if ( unlikely(!page) || p2mt != p2m_ram_rw )
                 {
-                    p2m_mem_paging_populate(pt_owner, _gfn(gmfn));
-                    rc = -ENOENT;
+                    if ( page )
+                        put_page(page);
+                    if ( p2m_is_paged(p2mt) )
+                    {
+                        p2m_mem_paging_populate(pt_owner, _gfn(gmfn));
+                        rc = -ENOENT;
+                    }
+                    else
+                        gdprintk(XENLOG_WARNING,
+                                 "Could not get page for normal update\n");
+                    break;
                 }
-                else
-                    gdprintk(XENLOG_WARNING,
-                             "Could not get page for normal update\n");
-                break;
+
+                locked = page_lock(page);
             }
 
             mfn = page_to_mfn(page);
@@ -4100,7 +4131,7 @@ long do_mmu_update(
             }
             va = _p(((unsigned long)va & PAGE_MASK) + (req.ptr & ~PAGE_MASK));
 
-            if ( page_lock(page) )
+            if ( locked )
             {
                 switch ( page->u.inuse.type_info & PGT_type_mask )
                 {
@@ -4164,19 +4195,33 @@ long do_mmu_update(
                     rc = 0;
                     break;
                 }
-                page_unlock(page);
-                if ( rc == -EINTR )
-                    rc = -ERESTART;
+
+                if ( likely(!rc) )
+                {
+                    /* Keep the page for a following update of it. */
+                    locked_page = page;
+                    locked_gmfn = gmfn;
+                }
+                else
+                {
+                    page_unlock(page);
+                    put_page(page);
+                    if ( rc == -EINTR )
+                        rc = -ERESTART;
+                }
             }
-            else if ( get_page_type(page, PGT_writable_page) )
+            else
             {
-                perfc_incr(writable_mmu_updates);
-                paging_write_guest_entry(v, va, req.val, mfn);
-                put_page_type(page);
-                rc = 0;
-            }
+                if ( get_page_type(page, PGT_writable_page) )
+                {
+                    perfc_incr(writable_mmu_updates);
+                    paging_write_guest_entry(v, va, req.val, mfn);
+                    put_page_type(page);
+                    rc = 0;
+                }
 
-            put_page(page);
+                put_page(page);
+            }
         }
         break;
 
@@ -4231,6 +4276,12 @@ long do_mmu_update(
         guest_handle_add_offset(ureqs, 1);
     }
 
+    if ( locked_page )
+    {
+        page_unlock(locked_page);
+        put_page(locked_page);
+    }
+
     if ( rc == -ERESTART )
         rc = hypercall_create_continuation(
             __HYPERVISOR_mmu_update, "hihi",
@@ -4409,6 +4460,7 @@ int steal_page(
     page->u.inuse.type_info = 0;
     page_set_owner(page, NULL);
     page_list_del(page, &d->page_list);
+    domain_adjust_node_pages(d, page, -1);
 
     /* Unlink from original owner. */
     if ( !(memflags & MEMF_no_refcount) && !domain_adjust_tot_pages(d, -1) )
@@ -5446,7 +5498,8 @@ int map_pages_to_xen(
             ol1e  = *pl1e;
             l1e_write_atomic(pl1e, l1e_from_mfn(mfn, flags));
             UNMAP_DOMAIN_PAGE(pl1e);
-            if ( (l1e_get_flags(ol1e) & _PAGE_PRESENT) )
+            if ( (l1e_get_flags(ol1e) & _PAGE_PRESENT) &&
+                 !(flags & MAP_NO_FLUSH) )
             {
                 unsigned int flush_flags = FLUSH_TLB | FLUSH_ORDER(0);
 
@@ -6311,6 +6364,9 @@ void paging_invlpg(struct vcpu *v, unsigned long linear)
     if ( !is_canonical_address(linear) )
         return;
 
+    if ( is_hvm_vcpu(v) )
+        hvmemul_insn_xlat_flush(v);
+
     if ( paging_mode_enabled(v->domain) &&
          !paging_get_hostmode(v)->invlpg(v, linear) )
         return;
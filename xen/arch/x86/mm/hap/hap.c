@@ -27,6 +27,7 @@
 #include <asm/p2m.h>
 #include <asm/domain.h>
 #include <xen/numa.h>
+#include <asm/hvm/emulate.h>
 #include <asm/hvm/nestedhvm.h>
 #include <public/sched.h>
 
@@ -36,16 +37,48 @@
 /*          HAP VRAM TRACKING SUPPORT           */
 /************************************************/
 
+/*
+ * hap_mark_vram_dirty()
+ * Called for every frame marked dirty while VRAM tracking is active, i.e.
+ * on each log-dirty write fault and for each GFN flushed out of the PML
+ * buffers.  Frames within the tracked range are recorded so that the next
+ * harvest only needs to look at what was actually written.  Callers marking
+ * many frames (like the PML buffer flush) hold the paging lock across the
+ * batch, making the acquisition here a cheap nested one.
+ */
+void hap_mark_vram_dirty(struct domain *d, pfn_t pfn)
+{
+    struct sh_dirty_vram *dirty_vram;
+
+    /* Recursive: this may be called with the paging lock held. */
+    paging_lock_recursive(d);
+
+    dirty_vram = d->arch.hvm.dirty_vram;
+    if ( dirty_vram && pfn_x(pfn) >= dirty_vram->begin_pfn &&
+         pfn_x(pfn) < dirty_vram->end_pfn )
+        __set_bit(pfn_x(pfn) - dirty_vram->begin_pfn, dirty_vram->logged);
+
+    paging_unlock(d);
+}
+
+static void hap_free_dirty_vram(struct sh_dirty_vram *dirty_vram)
+{
+    if ( dirty_vram )
+        xfree(dirty_vram->logged);
+    xfree(dirty_vram);
+}
+
 /*
  * hap_track_dirty_vram()
  * Create the domain's dv_dirty_vram struct on demand.
  * Create a dirty vram range on demand when some [begin_pfn:begin_pfn+nr] is
  * first encountered.
- * Collect the guest_dirty bitmask, a bit mask of the dirty vram pages, by
- * calling paging_log_dirty_range(), which interrogates each vram
- * page's p2m type looking for pages that have been made writable.
+ * Collect the guest_dirty bitmask, a bit mask of the dirty vram pages, from
+ * the frames logged by hap_mark_vram_dirty() since the previous call.  Only
+ * those frames need switching back to log-dirty mode, so the cost of each
+ * call scales with the number of pages written rather than the size of the
+ * range.
  */
-
 int hap_track_dirty_vram(struct domain *d,
                          unsigned long begin_pfn,
                          unsigned int nr_frames,
@@ -53,15 +86,21 @@ int hap_track_dirty_vram(struct domain *d,
 {
     long rc = 0;
     struct sh_dirty_vram *dirty_vram;
-    uint8_t *dirty_bitmap = NULL;
+    unsigned long *logged = NULL;
 
     if ( nr_frames )
     {
         unsigned int size = DIV_ROUND_UP(nr_frames, BITS_PER_BYTE);
+        unsigned int i;
 
+        /*
+         * A fresh (empty) log, either for a new range or to swap with the
+         * current one when harvesting.  Its byte layout is the bitmap format
+         * handed back to the caller.
+         */
         rc = -ENOMEM;
-        dirty_bitmap = vzalloc(size);
-        if ( !dirty_bitmap )
+        logged = xzalloc_array(unsigned long, BITS_TO_LONGS(nr_frames));
+        if ( !logged )
             goto out;
 
         paging_lock(d);
@@ -87,6 +126,7 @@ int hap_track_dirty_vram(struct domain *d,
 
             dirty_vram->begin_pfn = begin_pfn;
             dirty_vram->end_pfn = begin_pfn + nr_frames;
+            SWAP(dirty_vram->logged, logged);
 
             paging_unlock(d);
 
@@ -107,10 +147,18 @@ int hap_track_dirty_vram(struct domain *d,
 
             guest_flush_tlb_mask(d, d->dirty_cpumask);
 
-            memset(dirty_bitmap, 0xff, size); /* consider all pages dirty */
+            /* Drop the old range's log, and consider all pages dirty. */
+            xfree(logged);
+            logged = xmalloc_array(unsigned long, BITS_TO_LONGS(nr_frames));
+            if ( !logged )
+                goto out;
+            memset(logged, 0xff, size);
         }
         else
         {
+            struct p2m_domain *p2m = p2m_get_hostp2m(d);
+            bool flush = false, stale = false;
+
             paging_unlock(d);
 
             domain_pause(d);
@@ -118,14 +166,40 @@ int hap_track_dirty_vram(struct domain *d,
             /* Flush dirty GFNs potentially cached by hardware. */
             p2m_flush_hardware_cached_dirty(d);
 
-            /* get the bitmap */
-            paging_log_dirty_range(d, begin_pfn, nr_frames, dirty_bitmap);
+            /* Take the log, leaving the empty one in its place. */
+            paging_lock(d);
+            dirty_vram = d->arch.hvm.dirty_vram;
+            if ( dirty_vram && dirty_vram->begin_pfn == begin_pfn &&
+                 dirty_vram->end_pfn == begin_pfn + nr_frames )
+                SWAP(dirty_vram->logged, logged);
+            else
+            {
+                /* Raced with a range change: report everything as dirty. */
+                memset(logged, 0xff, size);
+                stale = true;
+            }
+            paging_unlock(d);
+
+            /*
+             * Set l1e entries of P2M table back to read-only for the pages
+             * which were written.  On first write, it page faults, its entry
+             * is changed to read-write, and the frame is logged again.
+             */
+            p2m_lock(p2m);
+            for_each_set_bit ( i, logged, stale ? 0 : nr_frames )
+                if ( !p2m_change_type_one(d, begin_pfn + i, p2m_ram_rw,
+                                          p2m_ram_logdirty) )
+                    flush = true;
+            p2m_unlock(p2m);
+
+            if ( flush )
+                guest_flush_tlb_mask(d, d->dirty_cpumask);
 
             domain_unpause(d);
         }
 
         rc = -EFAULT;
-        if ( copy_to_guest(guest_dirty_bitmap, dirty_bitmap, size) == 0 )
+        if ( copy_to_guest(guest_dirty_bitmap, (uint8_t *)logged, size) == 0 )
             rc = 0;
     }
     else
@@ -141,7 +215,7 @@ int hap_track_dirty_vram(struct domain *d,
              */
             begin_pfn = dirty_vram->begin_pfn;
             nr_frames = dirty_vram->end_pfn - dirty_vram->begin_pfn;
-            xfree(dirty_vram);
+            hap_free_dirty_vram(dirty_vram);
             d->arch.hvm.dirty_vram = NULL;
         }
 
@@ -152,7 +226,7 @@ int hap_track_dirty_vram(struct domain *d,
                                   p2m_ram_logdirty, p2m_ram_rw);
     }
 out:
-    vfree(dirty_bitmap);
+    xfree(logged);
 
     return rc;
 }
@@ -212,6 +286,18 @@ static int cf_check hap_disable_log_dirty(struct domain *d)
      * normal mode, or via hardware-assisted log-dirty.
      */
     p2m_change_entry_type_global(d, p2m_ram_logdirty, p2m_ram_rw);
+
+    /*
+     * Any tracked VRAM has just been made writable without its frames being
+     * logged.  Have the next harvest report, and re-protect, all of it.
+     */
+    paging_lock(d);
+    if ( d->arch.hvm.dirty_vram )
+        bitmap_fill(d->arch.hvm.dirty_vram->logged,
+                    d->arch.hvm.dirty_vram->end_pfn -
+                    d->arch.hvm.dirty_vram->begin_pfn);
+    paging_unlock(d);
+
     return 0;
 }
 
@@ -626,7 +712,8 @@ void hap_teardown(struct domain *d, bool *preempted)
 
     d->arch.paging.mode &= ~PG_log_dirty;
 
-    XFREE(d->arch.hvm.dirty_vram);
+    hap_free_dirty_vram(d->arch.hvm.dirty_vram);
+    d->arch.hvm.dirty_vram = NULL;
 
 out:
     paging_unlock(d);
@@ -716,9 +803,21 @@ static void cf_check hap_update_cr3(
     hvm_update_guest_cr3(v, noflush);
 }
 
-static bool flush_vcpu(const struct vcpu *v, const unsigned long *vcpu_bitmap)
+static void flush_vcpu(struct vcpu *v, cpumask_t *mask)
 {
-    return !vcpu_bitmap || test_bit(v->vcpu_id, vcpu_bitmap);
+    unsigned int cpu;
+
+    /*
+     * No IPI is needed if the vCPU hasn't entered the guest since its ASID
+     * was last invalidated: it will pick up a fresh one on its next entry.
+     */
+    if ( !hvm_asid_flush_vcpu_live(v) )
+        return;
+
+    cpu = read_atomic(&v->dirty_cpu);
+    if ( cpu != smp_processor_id() && is_vcpu_dirty_cpu(cpu) &&
+         v->is_running )
+        __cpumask_set_cpu(cpu, mask);
 }
 
 /* Flush TLB of selected vCPUs.  NULL for all. */
@@ -727,25 +826,29 @@ static bool cf_check flush_tlb(const unsigned long *vcpu_bitmap)
     static DEFINE_PER_CPU(cpumask_t, flush_cpumask);
     cpumask_t *mask = &this_cpu(flush_cpumask);
     struct domain *d = current->domain;
-    unsigned int this_cpu = smp_processor_id();
     struct vcpu *v;
 
     cpumask_clear(mask);
 
-    /* Flush paging-mode soft state (e.g., va->gfn cache; PAE PDPE cache). */
-    for_each_vcpu ( d, v )
-    {
-        unsigned int cpu;
+    /* The targeted vCPUs may be running: invalidate all their caches. */
+    hvmemul_insn_xlat_flush_domain(d);
 
-        if ( !flush_vcpu(v, vcpu_bitmap) )
-            continue;
-
-        hvm_asid_flush_vcpu(v);
+    /*
+     * Flush paging-mode soft state (e.g., va->gfn cache; PAE PDPE cache).
+     * Guests with many vCPUs typically target only a few of them, so only
+     * visit the ones named in the bitmap rather than walking the domain.
+     */
+    if ( vcpu_bitmap )
+    {
+        unsigned int id;
 
-        cpu = read_atomic(&v->dirty_cpu);
-        if ( cpu != this_cpu && is_vcpu_dirty_cpu(cpu) && v->is_running )
-            __cpumask_set_cpu(cpu, mask);
+        for_each_set_bit ( id, vcpu_bitmap, d->max_vcpus )
+            if ( (v = d->vcpu[id]) != NULL )
+                flush_vcpu(v, mask);
     }
+    else
+        for_each_vcpu ( d, v )
+            flush_vcpu(v, mask);
 
     /*
      * Trigger a vmexit on all pCPUs with dirty vCPU state in order to force an
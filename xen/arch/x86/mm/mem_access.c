@@ -296,6 +296,76 @@ static int set_mem_access(struct domain *d, struct p2m_domain *p2m,
     return rc;
 }
 
+/*
+ * Whether the 4k host entries of the 2M range starting at @gfn map
+ * contiguous, suitably aligned RAM, and hence could be a single superpage.
+ */
+static bool can_merge_2m(struct p2m_domain *p2m, gfn_t gfn, mfn_t mfn,
+                         p2m_type_t t)
+{
+    unsigned int i;
+
+    if ( !hap_has_2mb || t != p2m_ram_rw ||
+         (mfn_x(mfn) & ((1UL << PAGE_ORDER_2M) - 1)) )
+        return false;
+
+    for ( i = 1; i < (1U << PAGE_ORDER_2M); i++ )
+    {
+        p2m_access_t a;
+        p2m_type_t t2;
+        mfn_t mfn2 = p2m->get_entry(p2m, gfn_add(gfn, i), &t2, &a, 0,
+                                    NULL, NULL);
+
+        if ( t2 != t || !mfn_eq(mfn2, mfn_add(mfn, i)) )
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Set the access of the host p2m entry for @gfn, part of the range
+ * [@first, @last].  A superpage lying entirely within the range is updated
+ * as a whole rather than shattered, and a 2M range of 4k entries which
+ * could form a superpage is merged back into one.  Returns the number of
+ * gfns from @gfn onwards which were covered, or a negative error code.
+ */
+static long set_mem_access_range(struct p2m_domain *p2m, p2m_access_t a,
+                                 gfn_t gfn, unsigned long first,
+                                 unsigned long last)
+{
+    unsigned int order = PAGE_ORDER_4K;
+    unsigned long base;
+    p2m_access_t _a;
+    p2m_type_t t;
+    mfn_t mfn = p2m_get_gfn_type_access(p2m, gfn, &t, &_a, P2M_ALLOC,
+                                        &order, false);
+    int rc;
+
+    if ( !mfn_valid(mfn) )
+        order = PAGE_ORDER_4K;
+    else if ( order == PAGE_ORDER_4K &&
+              !(gfn_x(gfn) & ((1UL << PAGE_ORDER_2M) - 1)) &&
+              gfn_x(gfn) + (1UL << PAGE_ORDER_2M) - 1 <= last &&
+              can_merge_2m(p2m, gfn, mfn, t) )
+        order = PAGE_ORDER_2M;
+
+    base = gfn_x(gfn) & ~((1UL << order) - 1);
+    if ( base < first || base + (1UL << order) - 1 > last )
+    {
+        order = PAGE_ORDER_4K;
+        base = gfn_x(gfn);
+    }
+
+    rc = p2m->set_entry(p2m, _gfn(base),
+                        mfn_valid(mfn) ? mfn_add(mfn, base - gfn_x(gfn)) : mfn,
+                        order, t, a, -1);
+    if ( rc )
+        return rc;
+
+    return base + (1UL << order) - gfn_x(gfn);
+}
+
 bool xenmem_access_to_p2m_access(const struct p2m_domain *p2m,
                                  xenmem_access_t xaccess,
                                  p2m_access_t *paccess)
@@ -342,7 +412,7 @@ long p2m_set_mem_access(struct domain *d, gfn_t gfn, uint32_t nr,
     struct p2m_domain *p2m = p2m_get_hostp2m(d), *ap2m = NULL;
     p2m_access_t a;
     unsigned long gfn_l;
-    long rc = 0;
+    long done, rc = 0;
 
     /* altp2m view 0 is treated as the hostp2m */
     if ( altp2m_idx )
@@ -369,17 +439,35 @@ long p2m_set_mem_access(struct domain *d, gfn_t gfn, uint32_t nr,
     if ( ap2m )
         p2m_lock(ap2m);
 
-    for ( gfn_l = gfn_x(gfn) + start; nr > start; ++gfn_l )
+    for ( gfn_l = gfn_x(gfn) + start; nr > start; gfn_l += done )
     {
-        rc = set_mem_access(d, p2m, ap2m, a, _gfn(gfn_l));
+        uint32_t prev = start;
+
+        done = 1;
+        if ( ap2m )
+            rc = set_mem_access(d, p2m, ap2m, a, _gfn(gfn_l));
+        else
+        {
+            done = set_mem_access_range(p2m, a, _gfn(gfn_l), gfn_x(gfn),
+                                        gfn_x(gfn) + nr - 1);
+            rc = min(done, 0L);
+        }
 
         if ( rc )
             break;
 
-        /* Check for continuation if it's not the last iteration. */
-        if ( nr > ++start && !(start & mask) && hypercall_preempt_check() )
+        /*
+         * Check for continuation if it's not the last iteration.  A superpage
+         * may take us past a continuation boundary: resume from that
+         * boundary, which is harmless as setting the access again is
+         * idempotent, and won't split the superpage as it's again covered
+         * as a whole.
+         */
+        start += done;
+        if ( nr > start && (start & ~mask) != (prev & ~mask) &&
+             hypercall_preempt_check() )
         {
-            rc = start;
+            rc = start & ~mask;
             break;
         }
     }
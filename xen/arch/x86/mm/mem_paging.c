@@ -426,6 +426,47 @@ static int prepare(struct domain *d, gfn_t gfn,
     return ret;
 }
 
+/*
+ * mark_paged - Mark a never populated guest page as paged-out
+ * @d: guest domain
+ * @gfn: guest page to mark
+ *
+ * Returns 0 for success or negative errno values if the gfn is in use.
+ *
+ * mark_paged() is called by a pager which owns the contents of a gfn that
+ * was never populated in this domain, for example while a post-copy
+ * migration stream is still delivering them.  The gfn enters the paged-out
+ * state directly, so guest accesses to it get forwarded to the pager, which
+ * then uses prepare() with a buffer to fill it.
+ */
+static int mark_paged(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    p2m_type_t p2mt;
+    p2m_access_t a;
+    mfn_t mfn;
+    int ret = -EBUSY;
+
+    gfn_lock(p2m, gfn, 0);
+
+    mfn = p2m->get_entry(p2m, gfn, &p2mt, &a, 0, NULL, NULL);
+
+    /* Allow only gfns which are not backed by anything */
+    if ( mfn_valid(mfn) || (p2mt != p2m_invalid && p2mt != p2m_mmio_dm) )
+        goto out;
+
+    ret = p2m_set_entry(p2m, gfn, INVALID_MFN, PAGE_ORDER_4K,
+                        p2m_ram_paged, p2m->default_access);
+
+    /* Track number of paged gfns */
+    if ( !ret )
+        atomic_inc(&d->paged_pages);
+
+ out:
+    gfn_unlock(p2m, gfn, 0);
+    return ret;
+}
+
 int mem_paging_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_paging_op_t) arg)
 {
     int rc;
@@ -464,6 +505,26 @@ int mem_paging_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_paging_op_t) arg)
             copyback = 1;
         break;
 
+    case XENMEM_paging_op_mark_paged:
+        rc = 0;
+        while ( mpo.nr )
+        {
+            rc = mark_paged(d, _gfn(mpo.gfn));
+            if ( rc )
+                break;
+
+            mpo.gfn++;
+            if ( --mpo.nr && hypercall_preempt_check() )
+            {
+                rc = -ERESTART;
+                break;
+            }
+        }
+
+        /* Report progress, so the caller can tell which gfn failed. */
+        copyback = 1;
+        break;
+
     default:
         rc = -ENOSYS;
         break;
@@ -471,6 +532,9 @@ int mem_paging_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_paging_op_t) arg)
 
     if ( copyback && __copy_to_guest(arg, &mpo, 1) )
         rc = -EFAULT;
+    else if ( rc == -ERESTART )
+        rc = hypercall_create_continuation(__HYPERVISOR_memory_op, "lh",
+                                           XENMEM_paging_op, arg);
 
 out:
     rcu_unlock_domain(d);
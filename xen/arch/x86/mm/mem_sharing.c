@@ -14,11 +14,13 @@
 #include <xen/spinlock.h>
 #include <xen/rwlock.h>
 #include <xen/mm.h>
+#include <xen/param.h>
 #include <xen/grant_table.h>
 #include <xen/sched.h>
 #include <xen/rcupdate.h>
 #include <xen/guest_access.h>
 #include <xen/vm_event.h>
+#include <xen/xmem_cache.h>
 #include <asm/page.h>
 #include <asm/string.h>
 #include <asm/p2m.h>
@@ -56,6 +58,14 @@ static DEFINE_PER_CPU(pg_lock_data_t, __pld);
  */
 #define RMAP_LIGHT_SHARED_PAGE   (RMAP_HEAVY_SHARED_PAGE >> 2)
 
+/*
+ * Number of pages around a faulting gfn of a fork for which shared entries
+ * are populated in one go, see fork_prefetch().
+ */
+#define FORK_PREFETCH_MAX        64U
+static unsigned int __read_mostly fork_prefetch_pages = 16;
+integer_param("mem-sharing-fork-prefetch", fork_prefetch_pages);
+
 #if MEM_SHARING_AUDIT
 
 static LIST_HEAD(shr_audit_list);
@@ -390,10 +400,12 @@ static gfn_info_t *rmap_iterate(struct page_info *page,
     return list_entry(ri->curr, gfn_info_t, list);
 }
 
+static DEFINE_XMEM_CACHE(gfn_info_cache, "mem_sharing gfn_info", gfn_info_t);
+
 static gfn_info_t *mem_sharing_gfn_alloc(struct page_info *page,
                                          struct domain *d, unsigned long gfn)
 {
-    gfn_info_t *gfn_info = xmalloc(gfn_info_t);
+    gfn_info_t *gfn_info = xmem_cache_alloc(&gfn_info_cache);
 
     if ( gfn_info == NULL )
         return NULL;
@@ -417,7 +429,7 @@ static void mem_sharing_gfn_destroy(struct page_info *page, struct domain *d,
 
     /* Free the gfn_info structure. */
     rmap_del(gfn_info, page, 1);
-    xfree(gfn_info);
+    xmem_cache_free(&gfn_info_cache, gfn_info);
 }
 
 /* Deadlock-avoidance scheme when calling get_gfn on different gfn's */
@@ -728,6 +740,7 @@ static int page_make_sharable(struct domain *d,
         page_set_owner(page, dom_cow);
         drop_dom_ref = !domain_adjust_tot_pages(d, -1);
         page_list_del(page, &d->page_list);
+        domain_adjust_node_pages(d, page, -1);
     }
 
 out:
@@ -775,6 +788,7 @@ static int page_make_private(struct domain *d, struct page_info *page)
     if ( domain_adjust_tot_pages(d, 1) == 1 )
         get_knownalive_domain(d);
     page_list_add_tail(page, &d->page_list);
+    domain_adjust_node_pages(d, page, 1);
     spin_unlock(&d->page_alloc_lock);
 
     put_page(page);
@@ -1534,6 +1548,51 @@ static inline int mem_sharing_control(struct domain *d, bool enable,
  * The client p2m is already locked so we only need to lock
  * the parent's here.
  */
+/*
+ * Add shared entries for the holes in the aligned block of gfns around gfn,
+ * so that a fork touching memory sequentially takes one fault per block
+ * rather than one per page. This costs no memory: the entries point at the
+ * parent's pages, which get nominated for sharing here if they are not
+ * already. Failures are of no consequence, the gfn will simply fault later.
+ */
+static void fork_prefetch(struct domain *d, unsigned long gfn_l)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned int nr = min(fork_prefetch_pages, FORK_PREFETCH_MAX);
+    unsigned long start, cur;
+    shr_handle_t handle;
+    struct domain *parent;
+    p2m_type_t p2mt;
+    p2m_access_t p2ma;
+
+    if ( nr <= 1 )
+        return;
+
+    start = gfn_l - gfn_l % nr;
+
+    for ( cur = start; cur < start + nr; cur++ )
+    {
+        if ( cur == gfn_l )
+            continue;
+
+        /* The client's p2m is already locked */
+        p2m->get_entry(p2m, _gfn(cur), &p2mt, &p2ma, 0, NULL, NULL);
+        if ( !p2m_is_hole(p2mt) )
+            continue;
+
+        for ( parent = d->parent; parent; parent = parent->parent )
+            if ( !nominate_page(parent, _gfn(cur), 0, false, &handle) )
+                break;
+
+        if ( !parent )
+            continue;
+
+        p2m_lock(p2m_get_hostp2m(parent));
+        add_to_physmap(parent, cur, handle, d, cur, false);
+        p2m_unlock(p2m_get_hostp2m(parent));
+    }
+}
+
 int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing)
 {
     int rc = -ENOENT;
@@ -1569,7 +1628,10 @@ int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing)
             p2m_unlock(p2m);
 
             if ( !rc )
+            {
+                fork_prefetch(d, gfn_l);
                 return 0;
+            }
         }
     }
 
@@ -1607,8 +1669,12 @@ int mem_sharing_fork_page(struct domain *d, gfn_t gfn, bool unsharing)
 
     put_gfn(parent, gfn_l);
 
-    return p2m->set_entry(p2m, gfn, new_mfn, PAGE_ORDER_4K, p2m_ram_rw,
-                          p2m->default_access, -1);
+    rc = p2m->set_entry(p2m, gfn, new_mfn, PAGE_ORDER_4K, p2m_ram_rw,
+                        p2m->default_access, -1);
+    if ( !rc )
+        fork_prefetch(d, gfn_l);
+
+    return rc;
 }
 
 static int bring_up_vcpus(struct domain *cd, struct domain *d)
@@ -1668,7 +1734,7 @@ static int copy_vpmu(struct vcpu *d_vcpu, struct vcpu *cd_vcpu)
             vpmu_reset(d_vpmu, VPMU_CONTEXT_LOADED);
         }
         else
-            vpmu_save(d_vcpu);
+            vpmu_save(d_vcpu, false);
     }
 
     if ( vpmu_is_set(d_vpmu, VPMU_RUNNING) )
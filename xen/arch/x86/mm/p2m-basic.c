@@ -26,6 +26,7 @@ static int p2m_initialise(struct domain *d, struct p2m_domain *p2m)
     mm_rwlock_init(&p2m->lock);
     INIT_PAGE_LIST_HEAD(&p2m->pages);
     spin_lock_init(&p2m->ioreq.lock);
+    p2m_recoalesce_init(p2m);
 #endif
 
     p2m->domain = d;
@@ -69,6 +70,7 @@ struct p2m_domain *p2m_init_one(struct domain *d)
 
 void p2m_free_one(struct p2m_domain *p2m)
 {
+    p2m_recoalesce_kill(p2m);
     p2m_free_logdirty(p2m);
     if ( hap_enabled(p2m->domain) && cpu_has_vmx )
         ept_p2m_uninit(p2m);
@@ -155,6 +157,8 @@ void p2m_teardown(struct p2m_domain *p2m, bool remove_root, bool *preempted)
 
     d = p2m->domain;
 
+    p2m_recoalesce_kill(p2m);
+
     p2m_lock(p2m);
 
 #ifdef CONFIG_MEM_SHARING
@@ -984,7 +984,12 @@ out:
        from the iommu tables, so as to avoid a potential
        use-after-free. */
     if ( is_epte_present(&old_entry) )
+    {
+        /* The IOMMU may be walking the tables: don't defer their flush. */
+        if ( iommu_use_hap_pt(d) && !rc )
+            rc = iommu_iotlb_batch_flush();
         ept_free_entry(p2m, &old_entry, target);
+    }
 
     if ( entry_written && p2m_is_hostp2m(p2m) )
     {
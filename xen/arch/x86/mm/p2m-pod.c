@@ -386,6 +386,7 @@ int p2m_pod_empty_cache(struct domain *d)
     /* After this barrier no new PoD activities can happen. */
     BUG_ON(!d->is_dying);
     spin_barrier(&p2m->pod.lock.lock);
+    tasklet_kill(&p2m->pod.reclaim_tasklet);
 
     lock_page_alloc(p2m);
 
@@ -716,6 +717,27 @@ void p2m_pod_dump_data(struct domain *d)
 }
 
 
+/*
+ * Check whether the first @words words of a mapped page are all zero.  The
+ * vector registers hold guest state here, so stick to general purpose ones,
+ * but fold a whole cache line per iteration to keep branches off the path.
+ */
+#define POD_QUICK_CHECK_WORDS 16
+
+static bool pod_words_are_zero(const unsigned long *p, unsigned int words)
+{
+    const unsigned long *end = p + words;
+
+    BUILD_BUG_ON(POD_QUICK_CHECK_WORDS % 8);
+    BUILD_BUG_ON((PAGE_SIZE / sizeof(*p)) % 8);
+
+    for ( ; p < end; p += 8 )
+        if ( p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7] )
+            return false;
+
+    return true;
+}
+
 /*
  * Search for all-zero superpages to be reclaimed as superpages for the
  * PoD cache. Must be called w/ pod lock held, must lock the superpage
@@ -729,7 +751,6 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     unsigned long * map = NULL;
     int ret=0, reset = 0;
     unsigned long i, n;
-    unsigned int j;
     int max_ref = 1;
     struct domain *d = p2m->domain;
 
@@ -799,18 +820,15 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     /* Now, do a quick check to see if it may be zero before unmapping. */
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
+        bool zero;
+
         /* Quick zero-check */
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < 16; j++ )
-            if ( *(map + j) != 0 )
-                break;
-
+        zero = pod_words_are_zero(map, POD_QUICK_CHECK_WORDS);
         unmap_domain_page(map);
 
-        if ( j < 16 )
+        if ( !zero )
             goto out;
-
     }
 
     /* Try to remove the page, restoring old mapping if it fails. */
@@ -839,14 +857,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, gfn_t gfn)
     for ( i = 0; i < SUPERPAGE_PAGES; i++ )
     {
         map = map_domain_page(mfn_add(mfn0, i));
-
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map)); j++ )
-            if ( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
-
+        reset = !pod_words_are_zero(map, PAGE_SIZE / sizeof(*map));
         unmap_domain_page(map);
 
         if ( reset )
@@ -898,16 +909,23 @@ out:
 }
 
 #define POD_SWEEP_LIMIT 1024
-#define POD_SWEEP_STRIDE  16
+#define POD_SWEEP_STRIDE  64
 
+/*
+ * Pages are only mapped while being looked at, rather than for the whole
+ * batch, so the size of a batch isn't bounded by the number of mapcache
+ * entries and a single TLB flush covers POD_SWEEP_STRIDE pages.
+ */
 static void
 p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count)
 {
     mfn_t mfns[POD_SWEEP_STRIDE];
     p2m_type_t types[POD_SWEEP_STRIDE];
-    unsigned long *map[POD_SWEEP_STRIDE];
+    bool check[POD_SWEEP_STRIDE];
+    const unsigned long *map;
     struct domain *d = p2m->domain;
-    unsigned int i, j, max_ref = 1;
+    unsigned int i, max_ref = 1;
+    bool zero;
 
     BUG_ON(count > POD_SWEEP_STRIDE);
 
@@ -915,7 +933,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
     if ( paging_mode_shadow(d) )
         max_ref++;
 
-    /* First, get the gfn list, translate to mfns, and map the pages. */
+    /* First, get the gfn list and translate to mfns. */
     for ( i = 0; i < count; i++ )
     {
         p2m_access_t a;
@@ -925,9 +943,9 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
 
         /*
          * If this is ram, and not a pagetable or a special page, and
-         * probably not mapped elsewhere, map it; otherwise, skip.
+         * probably not mapped elsewhere, check it; otherwise, skip.
          */
-        map[i] = NULL;
+        check[i] = false;
         if ( p2m_is_ram(types[i]) )
         {
             const struct page_info *pg = mfn_to_page(mfns[i]);
@@ -936,7 +954,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
                  (pg->count_info & PGC_allocated) &&
                  !(pg->count_info & PGC_shadowed_pt) &&
                  ((pg->count_info & PGC_count_mask) <= max_ref) )
-                map[i] = map_domain_page(mfns[i]);
+                check[i] = true;
         }
     }
 
@@ -946,18 +964,22 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
      */
     for ( i = 0; i < count; i++ )
     {
-        if ( !map[i] )
+        if ( !check[i] )
             continue;
 
         /* Quick zero-check */
-        for ( j = 0; j < 16; j++ )
-            if ( *(map[i] + j) != 0 )
-                goto skip;
+        map = map_domain_page(mfns[i]);
+        zero = pod_words_are_zero(map, POD_QUICK_CHECK_WORDS);
+        unmap_domain_page(map);
 
         /* Try to remove the page, restoring old mapping if it fails. */
-        if ( p2m_set_entry(p2m, gfns[i], INVALID_MFN, PAGE_ORDER_4K,
+        if ( !zero ||
+             p2m_set_entry(p2m, gfns[i], INVALID_MFN, PAGE_ORDER_4K,
                            p2m_populate_on_demand, p2m->default_access) )
-            goto skip;
+        {
+            check[i] = false;
+            continue;
+        }
 
         /*
          * See if the page was successfully unmapped.  (Allow one refcount
@@ -974,14 +996,10 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
             {
                 ASSERT_UNREACHABLE();
                 domain_crash(d);
-                goto out_unmap;
+                return;
             }
 
-        skip:
-            unmap_domain_page(map[i]);
-            map[i] = NULL;
-
-            continue;
+            check[i] = false;
         }
     }
 
@@ -990,22 +1008,18 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
     /* Now check each page for real */
     for ( i = 0; i < count; i++ )
     {
-        if ( !map[i] )
+        if ( !check[i] )
             continue;
 
-        for ( j = 0; j < (PAGE_SIZE / sizeof(*map[i])); j++ )
-            if ( *(map[i] + j) != 0 )
-                break;
-
-        unmap_domain_page(map[i]);
-
-        map[i] = NULL;
+        map = map_domain_page(mfns[i]);
+        zero = pod_words_are_zero(map, PAGE_SIZE / sizeof(*map));
+        unmap_domain_page(map);
 
         /*
          * See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.
          */
-        if ( j < (PAGE_SIZE / sizeof(*map[i])) )
+        if ( !zero )
         {
             /*
              * If the previous p2m_set_entry call succeeded, this one shouldn't
@@ -1016,7 +1030,7 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
             {
                 ASSERT_UNREACHABLE();
                 domain_crash(d);
-                goto out_unmap;
+                return;
             }
         }
         else
@@ -1043,32 +1057,26 @@ p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns, unsigned int count
             ioreq_request_mapcache_invalidate(d);
         }
     }
-
-    return;
-
-out_unmap:
-    /*
-     * Something went wrong, probably crashing the domain.  Unmap
-     * everything and return.
-     */
-    for ( i = 0; i < count; i++ )
-        if ( map[i] )
-            unmap_domain_page(map[i]);
 }
 
-static void
-p2m_pod_emergency_sweep(struct p2m_domain *p2m)
+/*
+ * Sweep the p2m downwards from reclaim_single, looking for zeroed pages to
+ * add to the cache.  Once @limit gfns have been looked at, an emergency sweep
+ * stops as soon as it found something (or needs preempting), while a
+ * background one stops right away.  Returns the number of gfns looked at.
+ */
+static unsigned long
+p2m_pod_sweep(struct p2m_domain *p2m, unsigned long limit, bool background)
 {
     gfn_t gfns[POD_SWEEP_STRIDE];
-    unsigned long i, j = 0, start, limit;
+    unsigned long i, j = 0, start;
     p2m_type_t t;
 
-
     if ( gfn_eq(p2m->pod.reclaim_single, _gfn(0)) )
         p2m->pod.reclaim_single = p2m->pod.max_guest;
 
     start = gfn_x(p2m->pod.reclaim_single);
-    limit = (start > POD_SWEEP_LIMIT) ? (start - POD_SWEEP_LIMIT) : 0;
+    limit = (start > limit) ? (start - limit) : 0;
 
     /* FIXME: Figure out how to avoid superpages */
     /*
@@ -1077,7 +1085,7 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
      * careful about spinlock recursion limits and POD_SWEEP_STRIDE.
      */
     p2m_lock(p2m);
-    for ( i = gfn_x(p2m->pod.reclaim_single); i > 0 ; i-- )
+    for ( i = start; i > 0 ; i-- )
     {
         p2m_access_t a;
         (void)p2m->get_entry(p2m, _gfn(i), &t, &a, 0, NULL, NULL);
@@ -1099,7 +1107,8 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
          * by re-increasing our 'debt'.  Since we hold the pod lock,
          * (entry_count - count) must remain the same.
          */
-        if ( i < limit && (p2m->pod.count > 0 || hypercall_preempt_check()) )
+        if ( i < limit &&
+             (background || p2m->pod.count > 0 || hypercall_preempt_check()) )
             break;
     }
 
@@ -1109,6 +1118,67 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     p2m_unlock(p2m);
     p2m->pod.reclaim_single = _gfn(i ? i - 1 : i);
 
+    return start - i + 1;
+}
+
+/*
+ * Background reclaim: once a guest fault leaves fewer than
+ * "pod-reclaim-watermark" pages in the cache of an over-committed domain, a
+ * tasklet sweeps the p2m in batches until the cache holds twice that many, or
+ * a whole pass over the guest is done.  Guest faults then rarely need to do
+ * an emergency sweep themselves.
+ */
+static unsigned long __read_mostly opt_pod_reclaim_watermark =
+    2 * SUPERPAGE_PAGES;
+integer_param("pod-reclaim-watermark", opt_pod_reclaim_watermark);
+
+/* Number of gfns to look at per tasklet run. */
+#define POD_RECLAIM_BATCH (4 * POD_SWEEP_LIMIT)
+
+static void cf_check p2m_pod_reclaim_tasklet(void *data)
+{
+    struct p2m_domain *p2m = data;
+    bool again = false;
+
+    p2m_lock(p2m);
+    pod_lock(p2m);
+
+    if ( !p2m->domain->is_dying &&
+         p2m->pod.entry_count > p2m->pod.count &&
+         p2m->pod.count < 2 * opt_pod_reclaim_watermark )
+    {
+        unsigned long scanned = p2m_pod_sweep(p2m, POD_RECLAIM_BATCH, true);
+
+        if ( scanned < p2m->pod.reclaim_left )
+        {
+            p2m->pod.reclaim_left -= scanned;
+            again = p2m->pod.count < 2 * opt_pod_reclaim_watermark;
+        }
+    }
+
+    if ( !again )
+        p2m->pod.reclaim_active = false;
+
+    pod_unlock(p2m);
+    p2m_unlock(p2m);
+
+    if ( again )
+        tasklet_schedule(&p2m->pod.reclaim_tasklet);
+}
+
+/* Must be called w/ pod lock held. */
+static void pod_reclaim_kick(struct p2m_domain *p2m)
+{
+    ASSERT(pod_locked_by_me(p2m));
+
+    if ( p2m->pod.reclaim_active ||
+         p2m->pod.count >= opt_pod_reclaim_watermark ||
+         p2m->pod.entry_count <= p2m->pod.count )
+        return;
+
+    p2m->pod.reclaim_active = true;
+    p2m->pod.reclaim_left = gfn_x(p2m->pod.max_guest) + 1;
+    tasklet_schedule(&p2m->pod.reclaim_tasklet);
 }
 
 static void pod_eager_reclaim(struct p2m_domain *p2m)
@@ -1223,7 +1293,7 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, gfn_t gfn,
      * causes unnecessary time and fragmentation of superpages in the p2m.
      */
     if ( p2m->pod.count == 0 )
-        p2m_pod_emergency_sweep(p2m);
+        p2m_pod_sweep(p2m, POD_SWEEP_LIMIT, false);
 
     /* If the sweep failed, give up. */
     if ( p2m->pod.count == 0 )
@@ -1260,6 +1330,7 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, gfn_t gfn,
     BUG_ON(p2m->pod.entry_count < 0);
 
     pod_eager_record(p2m, gfn_aligned, order);
+    pod_reclaim_kick(p2m);
 
     if ( tb_init_done )
     {
@@ -1424,6 +1495,9 @@ void p2m_pod_init(struct p2m_domain *p2m)
 
     for ( i = 0; i < ARRAY_SIZE(p2m->pod.mrp.list); ++i )
         p2m->pod.mrp.list[i] = gfn_x(INVALID_GFN);
+
+    tasklet_init(&p2m->pod.reclaim_tasklet, p2m_pod_reclaim_tasklet, p2m);
+    tasklet_set_prio(&p2m->pod.reclaim_tasklet, TASKLET_PRIO_LOW);
 }
 
 bool p2m_pod_active(const struct domain *d)
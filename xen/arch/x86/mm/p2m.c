@@ -24,6 +24,7 @@
 #include <asm/paging.h>
 #include <asm/p2m.h>
 #include <asm/mem_sharing.h>
+#include <asm/hvm/emulate.h>
 #include <asm/hvm/nestedhvm.h>
 #include <asm/altp2m.h>
 #include <asm/vm_event.h>
@@ -418,6 +419,9 @@ int p2m_set_entry(struct p2m_domain *p2m, gfn_t gfn, mfn_t mfn,
         todo -= 1ul << order;
     }
 
+    /* Cached instruction fetch translations may refer to the old entries. */
+    hvmemul_insn_xlat_flush_domain(p2m->domain);
+
     return rc;
 }
 
@@ -1029,6 +1033,12 @@ static int set_typed_p2m_entry(struct domain *d, unsigned long gfn_l,
         gfn_unlock(p2m, gfn, order);
         return cur_order + 1;
     }
+    /* Bound the number of M2P entries to zap below. */
+    if ( order > PAGE_ORDER_2M && p2m_is_ram(ot) )
+    {
+        gfn_unlock(p2m, gfn, order);
+        return PAGE_ORDER_2M + 1;
+    }
     if ( p2m_is_special(ot) )
     {
         /* Special-case (almost) identical mappings. */
@@ -1188,14 +1198,20 @@ static int clear_mmio_p2m_entry(struct domain *d, unsigned long gfn_l,
     return rc;
 }
 
+/*
+ * Returns a positive value if @order is non-zero and the range isn't a single
+ * hole in the p2m: the caller should then retry with order (value - 1).
+ */
 int p2m_add_identity_entry(struct domain *d, unsigned long gfn_l,
-                           p2m_access_t p2ma, unsigned int flag)
+                           unsigned int order, p2m_access_t p2ma,
+                           unsigned int flag)
 {
     p2m_type_t p2mt;
     p2m_access_t a;
     gfn_t gfn = _gfn(gfn_l);
     mfn_t mfn;
     struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned int cur_order = 0;
     int ret;
 
     if ( !paging_mode_translate(d) )
@@ -1204,12 +1220,18 @@ int p2m_add_identity_entry(struct domain *d, unsigned long gfn_l,
         return -EPERM;
     }
 
-    gfn_lock(p2m, gfn, 0);
+    ASSERT(!(gfn_l & ((1UL << order) - 1)));
 
-    mfn = p2m->get_entry(p2m, gfn, &p2mt, &a, 0, NULL, NULL);
+    gfn_lock(p2m, gfn, order);
+
+    mfn = p2m->get_entry(p2m, gfn, &p2mt, &a, 0, &cur_order, NULL);
 
-    if ( p2mt == p2m_invalid || p2mt == p2m_mmio_dm )
-        ret = p2m_set_entry(p2m, gfn, _mfn(gfn_l), PAGE_ORDER_4K,
+    if ( order > PAGE_ORDER_4K &&
+         (cur_order < order || (p2mt != p2m_invalid && p2mt != p2m_mmio_dm)) )
+        ret = (p2mt == p2m_invalid || p2mt == p2m_mmio_dm ? cur_order
+                                                           : PAGE_ORDER_4K) + 1;
+    else if ( p2mt == p2m_invalid || p2mt == p2m_mmio_dm )
+        ret = p2m_set_entry(p2m, gfn, _mfn(gfn_l), order,
                             p2m_mmio_direct, p2ma);
     else if ( mfn_x(mfn) == gfn_l && p2mt == p2m_mmio_direct && a == p2ma )
         ret = 0;
@@ -1225,7 +1247,7 @@ int p2m_add_identity_entry(struct domain *d, unsigned long gfn_l,
                d->domain_id, gfn_l, mfn_x(mfn));
     }
 
-    gfn_unlock(p2m, gfn, 0);
+    gfn_unlock(p2m, gfn, order);
     return ret;
 }
 
@@ -1490,7 +1512,10 @@ p2m_get_nestedp2m_locked(struct vcpu *v)
         p2m_lock(p2m);
 
         if ( p2m->np2m_base == np2m_base )
+        {
+            perfc_incr(np2m_hit);
             goto found;
+        }
 
         p2m_unlock(p2m);
     }
@@ -1498,6 +1523,8 @@ p2m_get_nestedp2m_locked(struct vcpu *v)
     /* All p2m's are or were in use. Take the least recent used one,
      * flush it and reuse. */
     p2m = p2m_getlru_nestedp2m(d, NULL);
+    if ( p2m->np2m_base != P2M_BASE_EADDR )
+        perfc_incr(np2m_evict);
     p2m_flush_table(p2m);
     p2m_lock(p2m);
 
@@ -1636,12 +1663,12 @@ static unsigned int mmio_order(const struct domain *d,
          (start_fn & ((1UL << PAGE_ORDER_2M) - 1)) || !(nr >> PAGE_ORDER_2M) )
         return PAGE_ORDER_4K;
 
-    if ( 0 /*
-            * Don't use 1Gb pages, to limit the iteration count in
-            * set_typed_p2m_entry() when it needs to zap M2P entries
-            * for a RAM range.
-            */ &&
-         !(start_fn & ((1UL << PAGE_ORDER_1G) - 1)) && (nr >> PAGE_ORDER_1G) &&
+    /*
+     * Note that set_typed_p2m_entry() asks for a retry with 2Mb pages if a
+     * 1Gb one would replace RAM, to limit the iteration count when zapping
+     * M2P entries.
+     */
+    if ( !(start_fn & ((1UL << PAGE_ORDER_1G) - 1)) && (nr >> PAGE_ORDER_1G) &&
          hap_has_1gb )
         return PAGE_ORDER_1G;
 
@@ -1723,6 +1750,154 @@ int unmap_mmio_regions(struct domain *d,
     return i == nr ? 0 : i ?: ret;
 }
 
+/*
+ * Re-coalescing of superpages.
+ *
+ * Log-dirty tracking and mem_access shatter superpage mappings into 4k ones,
+ * which are never merged back on their own.  A background pass, run from
+ * a tasklet, looks for naturally aligned runs of 512 entries which map
+ * contiguous and suitably aligned MFNs with identical type, access and #VE
+ * suppression, and replaces them by a single 2M entry.  Runs of 512 such 2M
+ * entries are in turn replaced by 1G entries, where the hardware supports
+ * them.
+ */
+static bool __read_mostly opt_p2m_recoalesce = true;
+boolean_param("p2m-recoalesce", opt_p2m_recoalesce);
+
+/* Number of 2M ranges to look at per tasklet run. */
+#define RECOALESCE_BATCH 16
+
+static bool recoalesce_range(struct p2m_domain *p2m, unsigned long gfn,
+                             unsigned int order)
+{
+    unsigned int step = 1U << (order - PAGETABLE_ORDER), i, cur_order;
+    p2m_type_t t, t0 = p2m_invalid;
+    p2m_access_t a, a0 = p2m_access_n;
+    bool_t sve, sve0 = true;
+    mfn_t mfn, mfn0 = INVALID_MFN;
+
+    for ( i = 0; i < (1U << PAGETABLE_ORDER); i++ )
+    {
+        mfn = p2m->get_entry(p2m, _gfn(gfn + i * step), &t, &a, 0,
+                             &cur_order, &sve);
+
+        if ( !i )
+        {
+            if ( cur_order >= order ||
+                 (t != p2m_ram_rw && t != p2m_ram_ro) ||
+                 !mfn_valid(mfn) || (mfn_x(mfn) & ((1UL << order) - 1)) )
+                return false;
+
+            t0 = t;
+            a0 = a;
+            sve0 = sve;
+            mfn0 = mfn;
+            continue;
+        }
+
+        if ( t != t0 || a != a0 || sve != sve0 ||
+             cur_order < order - PAGETABLE_ORDER ||
+             !mfn_eq(mfn, mfn_add(mfn0, i * step)) )
+            return false;
+    }
+
+    if ( p2m->set_entry(p2m, _gfn(gfn), mfn0, order, t0, a0, sve0) )
+        return false;
+
+    if ( order == PAGE_ORDER_1G )
+        p2m->recoalesce.promoted_1g++;
+    else
+        p2m->recoalesce.promoted_2m++;
+
+    return true;
+}
+
+static void cf_check p2m_recoalesce_tasklet(void *data)
+{
+    struct p2m_domain *p2m = data;
+    struct domain *d = p2m->domain;
+    bool hap = hap_enabled(d), done = false;
+    unsigned int i;
+
+    p2m_lock(p2m);
+
+    for ( i = 0; i < RECOALESCE_BATCH; i++ )
+    {
+        unsigned long gfn = p2m->recoalesce.next_gfn;
+
+        /* Log-dirty tracking wants 4k granularity: give up the pass. */
+        if ( d->is_dying || paging_mode_log_dirty(d) ||
+             gfn > p2m->max_mapped_pfn )
+        {
+            done = true;
+            break;
+        }
+
+        if ( !hap || hap_has_2mb )
+            recoalesce_range(p2m, gfn, PAGE_ORDER_2M);
+
+        gfn += 1UL << PAGE_ORDER_2M;
+        p2m->recoalesce.next_gfn = gfn;
+
+        if ( hap && hap_has_1gb && !(gfn & ((1UL << PAGE_ORDER_1G) - 1)) )
+            recoalesce_range(p2m, gfn - (1UL << PAGE_ORDER_1G),
+                             PAGE_ORDER_1G);
+    }
+
+    if ( done )
+    {
+        if ( p2m->recoalesce.next_gfn > p2m->max_mapped_pfn )
+            p2m->recoalesce.passes++;
+        p2m->recoalesce.active = false;
+    }
+
+    p2m_unlock(p2m);
+
+    if ( !done )
+        tasklet_schedule(&p2m->recoalesce.tasklet);
+}
+
+void p2m_recoalesce_init(struct p2m_domain *p2m)
+{
+    tasklet_init(&p2m->recoalesce.tasklet, p2m_recoalesce_tasklet, p2m);
+    tasklet_set_prio(&p2m->recoalesce.tasklet, TASKLET_PRIO_LOW);
+}
+
+void p2m_recoalesce_kill(struct p2m_domain *p2m)
+{
+    tasklet_kill(&p2m->recoalesce.tasklet);
+}
+
+/*
+ * Start a background pass over the host p2m of d, unless one is in progress
+ * already.  Passes not explicitly asked for (via domctl) are subject to the
+ * "p2m-recoalesce" command line option.
+ */
+int p2m_recoalesce_start(struct domain *d, bool explicit)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    if ( !is_hvm_domain(d) )
+        return -EOPNOTSUPP;
+
+    if ( !explicit && !opt_p2m_recoalesce )
+        return 0;
+
+    if ( paging_mode_log_dirty(d) )
+        return -EBUSY;
+
+    p2m_lock(p2m);
+    if ( !p2m->recoalesce.active )
+    {
+        p2m->recoalesce.active = true;
+        p2m->recoalesce.next_gfn = 0;
+        tasklet_schedule(&p2m->recoalesce.tasklet);
+    }
+    p2m_unlock(p2m);
+
+    return 0;
+}
+
 int altp2m_get_effective_entry(struct p2m_domain *ap2m, gfn_t gfn, mfn_t *mfn,
                                p2m_type_t *t, p2m_access_t *a,
                                bool prepopulate)
@@ -1786,6 +1961,46 @@ bool_t p2m_switch_vcpu_altp2m_by_id(struct vcpu *v, unsigned int idx)
     return rc;
 }
 
+/*
+ * Neighbouring 4k host mappings are likely to be accessed soon after a
+ * faulting one.  Copy those which are still absent from the view, within a
+ * small aligned window.  They go into the page table just populated for the
+ * faulting gfn, so this costs no memory, and saves an EPT violation each.
+ */
+#define ALTP2M_PREFILL_ORDER 4
+
+static void altp2m_prefill(struct p2m_domain *ap2m, unsigned long gfn_l)
+{
+    struct p2m_domain *hp2m = p2m_get_hostp2m(ap2m->domain);
+    unsigned long start = gfn_l & ~((1UL << ALTP2M_PREFILL_ORDER) - 1), i;
+
+    /* The caller holds the host's lock for the faulting gfn, i.e. all of it. */
+    ASSERT(p2m_locked_by_me(hp2m));
+    ASSERT(p2m_locked_by_me(ap2m));
+
+    for ( i = start; i < start + (1UL << ALTP2M_PREFILL_ORDER); i++ )
+    {
+        p2m_type_t t;
+        p2m_access_t a;
+        mfn_t mfn;
+
+        if ( i == gfn_l )
+            continue;
+
+        mfn = ap2m->get_entry(ap2m, _gfn(i), &t, &a, 0, NULL, NULL);
+        if ( !mfn_eq(mfn, INVALID_MFN) )
+            continue;
+
+        /* Plain RAM only: anything else is left to its own fault path. */
+        mfn = hp2m->get_entry(hp2m, _gfn(i), &t, &a, 0, NULL, NULL);
+        if ( mfn_eq(mfn, INVALID_MFN) || t != p2m_ram_rw )
+            continue;
+
+        if ( p2m_set_entry(ap2m, _gfn(i), mfn, PAGE_ORDER_4K, t, a) )
+            break;
+    }
+}
+
 /*
  * Read info about the gfn in an altp2m, locking the gfn.
  *
@@ -1850,6 +2065,8 @@ bool p2m_altp2m_get_or_propagate(struct p2m_domain *ap2m, unsigned long gfn_l,
     gfn = _gfn(gfn_l & mask);
 
     rc = p2m_set_entry(ap2m, gfn, amfn, cur_order, *p2mt, *p2ma);
+    if ( !rc && cur_order == PAGE_ORDER_4K )
+        altp2m_prefill(ap2m, gfn_l);
     p2m_unlock(ap2m);
 
     if ( rc )
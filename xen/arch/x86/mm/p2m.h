@@ -11,9 +11,13 @@ void p2m_pod_init(struct p2m_domain *p2m);
 #ifdef CONFIG_HVM
 int p2m_init_logdirty(struct p2m_domain *p2m);
 void p2m_free_logdirty(struct p2m_domain *p2m);
+void p2m_recoalesce_init(struct p2m_domain *p2m);
+void p2m_recoalesce_kill(struct p2m_domain *p2m);
 #else
 static inline int p2m_init_logdirty(struct p2m_domain *p2m) { return 0; }
 static inline void p2m_free_logdirty(struct p2m_domain *p2m) {}
+static inline void p2m_recoalesce_init(struct p2m_domain *p2m) {}
+static inline void p2m_recoalesce_kill(struct p2m_domain *p2m) {}
 #endif
 
 int p2m_init_altp2m(struct domain *d);
@@ -17,6 +17,7 @@
 #include <asm/event.h>
 #include <asm/hvm/nestedhvm.h>
 #include <xen/numa.h>
+#include <xen/vmap.h>
 #include <xsm/xsm.h>
 #include <public/sched.h> /* SHUTDOWN_suspend */
 
@@ -66,6 +67,9 @@ static mfn_t paging_new_log_dirty_leaf(struct domain *d)
     if ( !mfn_eq(mfn, INVALID_MFN) )
         clear_domain_page(mfn);
 
+    /* Lockless walkers mustn't observe the node before its contents. */
+    smp_wmb();
+
     return mfn;
 }
 
@@ -82,6 +86,10 @@ static mfn_t paging_new_log_dirty_node(struct domain *d)
             node[i] = INVALID_MFN;
         unmap_domain_page(node);
     }
+
+    /* Lockless walkers mustn't observe the node before its contents. */
+    smp_wmb();
+
     return mfn;
 }
 
@@ -104,11 +112,13 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
     mfn_t *l4, *l3, *l2;
     int i4, i3, i2;
 
+    write_lock(&d->arch.paging.log_dirty.lock);
     paging_lock(d);
 
     if ( mfn_eq(d->arch.paging.log_dirty.top, INVALID_MFN) )
     {
         paging_unlock(d);
+        write_unlock(&d->arch.paging.log_dirty.lock);
         return 0;
     }
 
@@ -123,6 +133,7 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
               d->arch.paging.preempt.op != XEN_DOMCTL_SHADOW_OP_OFF )
     {
         paging_unlock(d);
+        write_unlock(&d->arch.paging.log_dirty.lock);
         return -EBUSY;
     }
 
@@ -196,6 +207,284 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
         d->arch.paging.preempt.op = XEN_DOMCTL_SHADOW_OP_OFF;
     }
 
+    paging_unlock(d);
+    write_unlock(&d->arch.paging.log_dirty.lock);
+
+    return rc;
+}
+
+/************************************************/
+/*              DIRTY RING SUPPORT              */
+/************************************************/
+
+static int paging_alloc_dirty_ring(struct domain *d,
+                                   struct paging_dirty_ring *dr,
+                                   unsigned int frames)
+{
+    unsigned int i;
+
+    dr->mfns = xmalloc_array(mfn_t, frames);
+    if ( !dr->mfns )
+        return -ENOMEM;
+
+    for ( i = 0; i < frames; i++ )
+        dr->mfns[i] = INVALID_MFN;
+
+    for ( i = 0; i < frames; i++ )
+    {
+        struct page_info *pg = alloc_domheap_page(d, MEMF_no_refcount);
+
+        if ( !pg )
+            return -ENOMEM;
+
+        if ( !get_page_and_type(pg, d, PGT_writable_page) )
+        {
+            /*
+             * The domain can't possibly know about this page yet, so it
+             * would have to be on its way out.
+             */
+            put_page_alloc_ref(pg);
+            return -ENODATA;
+        }
+
+        dr->mfns[i] = page_to_mfn(pg);
+        clear_domain_page(dr->mfns[i]);
+    }
+
+    dr->ring = vmap(dr->mfns, frames);
+
+    return dr->ring ? 0 : -ENOMEM;
+}
+
+static void paging_free_dirty_ring(struct paging_dirty_ring *dr,
+                                   unsigned int frames)
+{
+    unsigned int i;
+
+    if ( dr->ring )
+        vunmap(dr->ring);
+
+    for ( i = 0; dr->mfns && i < frames; i++ )
+    {
+        struct page_info *pg;
+
+        if ( mfn_eq(dr->mfns[i], INVALID_MFN) )
+            break;
+
+        pg = mfn_to_page(dr->mfns[i]);
+        put_page_alloc_ref(pg);
+        put_page_and_type(pg);
+    }
+
+    xfree(dr->mfns);
+}
+
+static void paging_free_dirty_rings(struct domain *d)
+{
+    struct paging_dirty_ring *rings;
+    unsigned int i, frames;
+
+    paging_lock(d);
+    rings = d->arch.paging.log_dirty.dirty_rings;
+    frames = d->arch.paging.log_dirty.dirty_ring_frames;
+    d->arch.paging.log_dirty.dirty_rings = NULL;
+    d->arch.paging.log_dirty.dirty_ring_frames = 0;
+    d->arch.paging.log_dirty.dirty_ring_entries = 0;
+    paging_unlock(d);
+
+    if ( !rings )
+        return;
+
+    for ( i = 0; i < d->max_vcpus; i++ )
+        paging_free_dirty_ring(&rings[i], frames);
+
+    xfree(rings);
+}
+
+static int paging_dirty_ring_enable(struct domain *d, unsigned long frames)
+{
+    struct paging_dirty_ring *rings;
+    unsigned int i;
+    int rc = 0;
+
+    if ( !frames )
+    {
+        paging_free_dirty_rings(d);
+        return 0;
+    }
+
+    if ( !hap_enabled(d) )
+        return -EOPNOTSUPP;
+
+    if ( !paging_mode_log_dirty(d) || frames > XEN_DIRTY_RING_MAX_FRAMES )
+        return -EINVAL;
+
+    if ( d->arch.paging.log_dirty.dirty_rings )
+        return -EBUSY;
+
+    rings = xzalloc_array(struct paging_dirty_ring, d->max_vcpus);
+    if ( !rings )
+        return -ENOMEM;
+
+    for ( i = 0; !rc && i < d->max_vcpus; i++ )
+        rc = paging_alloc_dirty_ring(d, &rings[i], frames);
+
+    if ( rc )
+    {
+        for ( i = 0; i < d->max_vcpus; i++ )
+            paging_free_dirty_ring(&rings[i], frames);
+        xfree(rings);
+
+        return rc;
+    }
+
+    paging_lock(d);
+    d->arch.paging.log_dirty.dirty_ring_frames = frames;
+    d->arch.paging.log_dirty.dirty_ring_entries =
+        XEN_DIRTY_RING_ENTRIES(frames);
+    d->arch.paging.log_dirty.dirty_rings = rings;
+    paging_unlock(d);
+
+    return 0;
+}
+
+/*
+ * Hand the entries the toolstack has consumed back to Xen, switching their
+ * GFNs back to log-dirty mode so that the next write gets logged again.
+ * Then drain what hardware has cached (e.g. PML buffers) into the rings.
+ */
+static int paging_dirty_ring_reset(struct domain *d)
+{
+    struct paging_dirty_ring *rings = d->arch.paging.log_dirty.dirty_rings;
+    unsigned int entries = d->arch.paging.log_dirty.dirty_ring_entries;
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned int i;
+    bool flush = false;
+    int rc = 0;
+
+    /* Set up and torn down only by other domctls, hence stable here. */
+    if ( !hap_enabled(d) || !rings )
+        return -EINVAL;
+
+    domain_pause(d);
+
+    for ( i = 0; i < d->max_vcpus; i++ )
+    {
+        struct paging_dirty_ring *dr = &rings[i];
+        unsigned int cons = ACCESS_ONCE(dr->ring->cons), idx;
+
+        /* The toolstack can't consume entries which weren't produced yet. */
+        paging_lock(d);
+        if ( cons >= entries ||
+             (cons + entries - dr->reset) % entries >
+             (dr->prod + entries - dr->reset) % entries )
+            rc = -EINVAL;
+        paging_unlock(d);
+        if ( rc )
+            break;
+
+        /*
+         * Entries from reset up to cons aren't going to be overwritten by
+         * producers, as they consider the ring full when reaching reset.
+         */
+        p2m_lock(p2m);
+        for ( idx = dr->reset; idx != cons; idx = (idx + 1) % entries )
+            if ( !p2m_change_type_one(d, ACCESS_ONCE(dr->ring->gfn[idx]),
+                                      p2m_ram_rw, p2m_ram_logdirty) )
+                flush = true;
+        p2m_unlock(p2m);
+
+        paging_lock(d);
+        dr->reset = cons;
+        paging_unlock(d);
+
+        if ( i + 1 < d->max_vcpus && hypercall_preempt_check() )
+        {
+            /* Rings already dealt with are no-ops when resuming. */
+            d->arch.paging.preempt.dom = current->domain;
+            d->arch.paging.preempt.op = XEN_DOMCTL_SHADOW_OP_DIRTY_RING_RESET;
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    if ( flush )
+        guest_flush_tlb_mask(d, d->dirty_cpumask);
+
+    if ( rc != -ERESTART )
+        d->arch.paging.preempt.dom = NULL;
+    if ( !rc )
+        p2m_flush_hardware_cached_dirty(d);
+
+    domain_unpause(d);
+
+    return rc;
+}
+
+/*
+ * Append pfn to the dirty ring of v, or of vCPU 0 if v isn't one of d's.
+ * Returns false if pfn needs recording in the log-dirty bitmap instead.
+ */
+static bool paging_dirty_ring_push(struct domain *d, pfn_t pfn,
+                                   const struct vcpu *v)
+{
+    struct paging_dirty_ring *dr;
+    unsigned int next;
+
+    ASSERT(paging_locked_by_me(d));
+
+    if ( !d->arch.paging.log_dirty.dirty_rings )
+        return false;
+
+    dr = &d->arch.paging.log_dirty.dirty_rings[v->domain == d ? v->vcpu_id
+                                                              : 0];
+
+    next = dr->prod + 1;
+    if ( next == d->arch.paging.log_dirty.dirty_ring_entries )
+        next = 0;
+
+    if ( unlikely(next == dr->reset) )
+    {
+        write_atomic(&dr->ring->overflow, 1);
+        return false;
+    }
+
+    dr->ring->gfn[dr->prod] = pfn_x(pfn);
+    smp_wmb();
+    write_atomic(&dr->ring->prod, next);
+    dr->prod = next;
+
+    return true;
+}
+
+unsigned int paging_dirty_ring_max_frames(const struct domain *d)
+{
+    return ACCESS_ONCE(d->arch.paging.log_dirty.dirty_ring_frames);
+}
+
+int paging_dirty_ring_acquire(struct domain *d, unsigned int id,
+                              unsigned int frame, unsigned int nr_frames,
+                              xen_pfn_t mfn_list[])
+{
+    const struct paging_dirty_ring *dr;
+    unsigned int i;
+    int rc = nr_frames;
+
+    if ( id >= d->max_vcpus )
+        return -ENOENT;
+
+    paging_lock(d);
+
+    if ( !d->arch.paging.log_dirty.dirty_rings ||
+         frame + nr_frames > d->arch.paging.log_dirty.dirty_ring_frames )
+        rc = -EINVAL;
+    else
+    {
+        dr = &d->arch.paging.log_dirty.dirty_rings[id];
+        for ( i = 0; i < nr_frames; i++ )
+            mfn_list[i] = mfn_x(dr->mfns[frame + i]);
+    }
+
     paging_unlock(d);
 
     return rc;
@@ -231,12 +520,18 @@ static int paging_log_dirty_disable(struct domain *d, bool_t resuming)
     if ( !resuming )
     {
         domain_pause(d);
-        /* Safe because the domain is paused. */
+        /*
+         * Safe because the domain is paused.  The lock keeps ranged
+         * operations from re-protecting pages behind our backs.
+         */
+        write_lock(&d->arch.paging.log_dirty.lock);
         if ( paging_mode_log_dirty(d) )
         {
             ret = d->arch.paging.log_dirty.ops->disable(d);
             ASSERT(ret <= 0);
         }
+        write_unlock(&d->arch.paging.log_dirty.lock);
+        paging_free_dirty_rings(d);
     }
 
     ret = paging_free_log_dirty_bitmap(d, ret);
@@ -245,17 +540,50 @@ static int paging_log_dirty_disable(struct domain *d, bool_t resuming)
 
     domain_unpause(d);
 
+    /* Undo the shattering of superpages done for log-dirty tracking. */
+    if ( !ret )
+        p2m_recoalesce_start(d, false);
+
     return ret;
 }
 
+/*
+ * Marking frames dirty (including for VRAM tracking) needs the paging lock.
+ * Callers with many frames to mark can take it once for all of them, such
+ * that the acquisitions for the individual frames merely nest.  No mm lock
+ * ordered before the paging lock (e.g. the P2M one) may be acquired in
+ * between.
+ */
+void paging_mark_dirty_batch_begin(struct domain *d)
+{
+    paging_lock_recursive(d);
+}
+
+void paging_mark_dirty_batch_end(struct domain *d)
+{
+    paging_unlock(d);
+}
+
 /* Mark a page as dirty, with taking guest pfn as parameter */
 void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
+{
+    paging_mark_pfn_dirty_vcpu(d, pfn, current);
+}
+
+/* As above, with the write attributed to v for the purpose of dirty rings */
+void paging_mark_pfn_dirty_vcpu(struct domain *d, pfn_t pfn,
+                                const struct vcpu *v)
 {
     bool changed;
     mfn_t mfn, *l4, *l3, *l2;
     unsigned long *l1;
     unsigned int i1, i2, i3, i4;
 
+#ifdef CONFIG_HVM
+    if ( unlikely(paging_mode_hap(d) && d->arch.hvm.dirty_vram) )
+        hap_mark_vram_dirty(d, pfn);
+#endif
+
     if ( !paging_mode_log_dirty(d) )
         return;
 
@@ -279,6 +607,9 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
     /* Recursive: this is called from inside the shadow code */
     paging_lock_recursive(d);
 
+    if ( paging_dirty_ring_push(d, pfn, v) )
+        goto out;
+
     if ( unlikely(mfn_eq(d->arch.paging.log_dirty.top, INVALID_MFN)) )
     {
          d->arch.paging.log_dirty.top = paging_new_log_dirty_node(d);
@@ -311,7 +642,8 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
         goto out;
 
     l1 = map_domain_page(mfn);
-    changed = !__test_and_set_bit(i1, l1);
+    /* Atomic, as ranged operations fetch and clear without the lock. */
+    changed = !test_and_set_bit(i1, l1);
     unmap_domain_page(l1);
     if ( changed )
     {
@@ -583,37 +915,156 @@ static int paging_log_dirty_op(struct domain *d,
     return rv;
 }
 
-#ifdef CONFIG_HVM
-void paging_log_dirty_range(struct domain *d,
-                           unsigned long begin_pfn,
-                           unsigned long nr,
-                           uint8_t *dirty_bitmap)
+/* Map the leaf of the trie covering pfn, without holding the paging lock. */
+static unsigned long *paging_map_log_dirty_leaf(const struct domain *d,
+                                                pfn_t pfn)
 {
-    struct p2m_domain *p2m = p2m_get_hostp2m(d);
-    int i;
-    unsigned long pfn;
+    mfn_t mfn = ACCESS_ONCE(d->arch.paging.log_dirty.top), *node;
+
+    if ( mfn_eq(mfn, INVALID_MFN) )
+        return NULL;
+
+    node = map_domain_page(mfn);
+    mfn = ACCESS_ONCE(node[L4_LOGDIRTY_IDX(pfn)]);
+    unmap_domain_page(node);
+    if ( mfn_eq(mfn, INVALID_MFN) )
+        return NULL;
+
+    node = map_domain_page(mfn);
+    mfn = ACCESS_ONCE(node[L3_LOGDIRTY_IDX(pfn)]);
+    unmap_domain_page(node);
+    if ( mfn_eq(mfn, INVALID_MFN) )
+        return NULL;
+
+    node = map_domain_page(mfn);
+    mfn = ACCESS_ONCE(node[L2_LOGDIRTY_IDX(pfn)]);
+    unmap_domain_page(node);
+    if ( mfn_eq(mfn, INVALID_MFN) )
+        return NULL;
+
+    smp_rmb();
+
+    return map_domain_page(mfn);
+}
+
+/*
+ * Read (and for CLEAN also clear) the part of the log-dirty bitmap covering
+ * sc->pages PFNs from sc->first_pfn.  Unlike paging_log_dirty_op(), this
+ * neither pauses the domain nor takes the paging lock: bits are fetched and
+ * cleared with atomic operations, and the trie is only protected against
+ * being freed.  Several operations on disjoint ranges can therefore be in
+ * progress at the same time.  Not preemptible, hence the size limit.
+ */
+int paging_log_dirty_range_op(struct domain *d,
+                              struct xen_domctl_shadow_op *sc)
+{
+    bool clean = sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN;
+    unsigned long first = sc->first_pfn, done, dirty = 0;
+    bool flush = false;
+    int rc;
+
+    if ( (sc->op != XEN_DOMCTL_SHADOW_OP_CLEAN &&
+          sc->op != XEN_DOMCTL_SHADOW_OP_PEEK) ||
+         sc->mode != XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE ||
+         (first | sc->pages) & (BITS_PER_LONG - 1) || !sc->pages ||
+         sc->pages > XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE_MAX ||
+         (first + sc->pages - 1) >> (PADDR_BITS - PAGE_SHIFT) )
+        return -EINVAL;
+
+    if ( unlikely(d == current->domain) || unlikely(d->is_dying) )
+        return -EINVAL;
+
+    if ( !hap_enabled(d) )
+        return -EOPNOTSUPP;
+
+    rc = xsm_shadow_control(XSM_HOOK, d, sc->op);
+    if ( rc )
+        return rc;
+
+    read_lock(&d->arch.paging.log_dirty.lock);
+
+    if ( !paging_mode_log_dirty(d) )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    for ( done = 0; !rc && done < sc->pages; )
+    {
+        pfn_t pfn = _pfn(first + done);
+        unsigned int idx = L1_LOGDIRTY_IDX(pfn) / BITS_PER_LONG;
+        unsigned int nr = min_t(unsigned long, PAGE_SIZE / sizeof(long) - idx,
+                                (sc->pages - done) / BITS_PER_LONG);
+        unsigned long *l1 = paging_map_log_dirty_leaf(d, pfn);
+
+        if ( !l1 )
+        {
+            if ( clear_guest_offset(sc->dirty_bitmap, done / 8,
+                                    nr * sizeof(long)) )
+                rc = -EFAULT;
+            done += nr * BITS_PER_LONG;
+            continue;
+        }
+
+        while ( nr )
+        {
+            unsigned long buf[32];
+            unsigned int i, n = min_t(unsigned int, nr, ARRAY_SIZE(buf));
+
+            for ( i = 0; i < n; i++ )
+            {
+                buf[i] = clean ? xchg(&l1[idx + i], 0UL)
+                               : ACCESS_ONCE(l1[idx + i]);
+                dirty += hweight_long(buf[i]);
+            }
+
+            if ( copy_to_guest_offset(sc->dirty_bitmap, done / 8,
+                                      (uint8_t *)buf, n * sizeof(long)) )
+            {
+                /* Don't lose what was cleared, but not handed back. */
+                for ( i = 0; clean && i < n; i++ )
+                {
+                    unsigned int bit;
+
+                    for_each_set_bit ( bit, &buf[i], BITS_PER_LONG )
+                        set_bit(bit, &l1[idx + i]);
+                }
+                rc = -EFAULT;
+                break;
+            }
+
+            idx += n;
+            nr -= n;
+            done += n * BITS_PER_LONG;
+        }
+
+        unmap_domain_page(l1);
+    }
 
     /*
-     * Set l1e entries of P2M table to be read-only.
-     *
-     * On first write, it page faults, its entry is changed to read-write,
-     * and on retry the write succeeds.
-     *
-     * We populate dirty_bitmap by looking for entries that have been
-     * switched to read-write.
+     * Switch the range back to log-dirty mode.  Writes racing with this got
+     * logged again, or will be covered by the caller sending the pages
+     * found dirty above.
      */
+    if ( clean && done )
+    {
+        p2m_change_type_range(d, first, first + done,
+                              p2m_ram_rw, p2m_ram_logdirty);
+        flush = true;
+    }
 
-    p2m_lock(p2m);
+    sc->stats.fault_count = min(d->arch.paging.log_dirty.fault_count,
+                                UINT32_MAX + 0UL);
+    sc->stats.dirty_count = dirty;
 
-    for ( i = 0, pfn = begin_pfn; pfn < begin_pfn + nr; i++, pfn++ )
-        if ( !p2m_change_type_one(d, pfn, p2m_ram_rw, p2m_ram_logdirty) )
-            dirty_bitmap[i >> 3] |= (1 << (i & 7));
+ out:
+    read_unlock(&d->arch.paging.log_dirty.lock);
 
-    p2m_unlock(p2m);
+    if ( flush )
+        guest_flush_tlb_mask(d, d->dirty_cpumask);
 
-    guest_flush_tlb_mask(d, d->dirty_cpumask);
+    return rc;
 }
-#endif
 
 /*
  * Callers must supply log_dirty_ops for the log dirty code to call. This
@@ -642,6 +1093,7 @@ int paging_domain_init(struct domain *d)
 
     INIT_PAGE_LIST_HEAD(&d->arch.paging.freelist);
     mm_lock_init(&d->arch.paging.lock);
+    rwlock_init(&d->arch.paging.log_dirty.lock);
 
     /* This must be initialized separately from the rest of the
      * log-dirty init code as that can be called more than once and we
@@ -740,6 +1192,12 @@ int paging_domctl(struct domain *d, struct xen_domctl_shadow_op *sc,
         if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
             return -EINVAL;
         return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING:
+        return paging_dirty_ring_enable(d, sc->pages);
+
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_RESET:
+        return paging_dirty_ring_reset(d);
     }
 
     /* Here, dispatch domctl to the appropriate paging code */
@@ -770,11 +1228,11 @@ long do_paging_domctl_cont(
     ret = xsm_domctl(XSM_OTHER, d, op.cmd);
     if ( !ret )
     {
-        if ( domctl_lock_acquire() )
+        if ( domctl_lock_acquire(d) )
         {
             ret = paging_domctl(d, &op.u.shadow_op, u_domctl, 1);
 
-            domctl_lock_release();
+            domctl_lock_release(d);
         }
         else
             ret = -ERESTART;
@@ -816,6 +1274,7 @@ int paging_teardown(struct domain *d)
 
 #if PG_log_dirty
     /* clean up log dirty resources. */
+    paging_free_dirty_rings(d);
     rc = paging_free_log_dirty_bitmap(d, 0);
     if ( rc == -ERESTART )
         return rc;
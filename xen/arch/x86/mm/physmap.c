@@ -76,7 +76,7 @@ int set_identity_p2m_entry(struct domain *d, unsigned long gfn,
                                 p2m_access_to_iommu_flags(p2ma));
     }
 
-    return p2m_add_identity_entry(d, gfn, p2ma, flag);
+    return p2m_add_identity_entry(d, gfn, PAGE_ORDER_4K, p2ma, flag);
 }
 
 int clear_identity_p2m_entry(struct domain *d, unsigned long gfn)
@@ -108,6 +108,7 @@ void shadow_vcpu_init(struct vcpu *v)
 #if (SHADOW_OPTIMIZATIONS & SHOPT_OUT_OF_SYNC)
     int i, j;
 
+    v->arch.paging.shadow.oos_count = 0;
     for ( i = 0; i < SHADOW_OOS_PAGES; i++ )
     {
         v->arch.paging.shadow.oos[i] = INVALID_MFN;
@@ -177,37 +178,107 @@ __initcall(shadow_audit_key_init);
  *    shadows.
  *
  * Currently out-of-sync pages are listed in a simple open-addressed
- * hash table with a second chance (must resist temptation to radically
- * over-engineer hash tables...)  The virtual address of the access
- * which caused us to unsync the page is also kept in the hash table, as
- * a hint for finding the writable mappings later.
+ * hash table, in which a page lives in one of SHADOW_OOS_PROBE slots
+ * starting at its hash (must resist temptation to radically
+ * over-engineer hash tables...)  When all of them are taken, the page
+ * which has been out of sync for longest is evicted.  Next to the hash
+ * table, the writable mappings of each page are recorded as fixups, for
+ * removing them quickly on resync.
  *
  * We keep a hash per vcpu, because we want as much as possible to do
- * the re-sync on the save vcpu we did the unsync on, so the VA hint
- * will be valid.
+ * the re-sync on the same vcpu we did the unsync on.  On a TLB flush
+ * (MOV CR3), that vcpu's pages only have their shadows updated, staying
+ * out of sync, until they have aged by SHADOW_OOS_MAX_AGE flushes: a
+ * process switch-heavy guest would otherwise have to write-protect and
+ * re-unsync the same pagetables over and over.
  */
 
+/* Look up gmfn in v's hash table, returning its slot or -1. */
+static int oos_hash_lookup(const struct vcpu *v, mfn_t gmfn)
+{
+    const mfn_t *oos = v->arch.paging.shadow.oos;
+    unsigned int i, idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
+
+    if ( !v->arch.paging.shadow.oos_count )
+        return -1;
+
+    for ( i = 0; i < SHADOW_OOS_PROBE; i++ )
+    {
+        if ( mfn_eq(oos[idx], gmfn) )
+            return idx;
+        idx = (idx + 1) % SHADOW_OOS_PAGES;
+    }
+
+    return -1;
+}
+
+/* Find the vcpu (and the slot in its hash table) which unsynced gmfn. */
+static struct vcpu *oos_hash_find(struct domain *d, mfn_t gmfn,
+                                  unsigned int *pidx)
+{
+    struct vcpu *v = current;
+    int idx;
+
+    /* Most of the time, it was the vcpu we're running on. */
+    if ( v->domain == d && (idx = oos_hash_lookup(v, gmfn)) >= 0 )
+    {
+        perfc_incr(shadow_oos_hit_local);
+        *pidx = idx;
+        return v;
+    }
+
+    for_each_vcpu(d, v)
+    {
+        if ( v == current || (idx = oos_hash_lookup(v, gmfn)) < 0 )
+            continue;
+
+        perfc_incr(shadow_oos_hit_remote);
+        *pidx = idx;
+        return v;
+    }
+
+    printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
+           mfn_x(gmfn));
+    BUG();
+}
+
+/* Release a slot of v's hash table. */
+static void oos_hash_clear(struct vcpu *v, unsigned int idx)
+{
+    mfn_t *oos = v->arch.paging.shadow.oos;
+
+    if ( mfn_eq(oos[idx], INVALID_MFN) )
+        return;
+
+    oos[idx] = INVALID_MFN;
+    ASSERT(v->arch.paging.shadow.oos_count);
+    v->arch.paging.shadow.oos_count--;
+}
+
 static void sh_oos_audit(struct domain *d)
 {
-    unsigned int idx, expected_idx, expected_idx_alt;
+    unsigned int idx, expected_idx, count;
     struct page_info *pg;
     struct vcpu *v;
 
     for_each_vcpu(d, v)
     {
+        count = 0;
+
         for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
         {
             mfn_t *oos = v->arch.paging.shadow.oos;
             if ( mfn_eq(oos[idx], INVALID_MFN) )
                 continue;
 
+            count++;
             expected_idx = mfn_x(oos[idx]) % SHADOW_OOS_PAGES;
-            expected_idx_alt = ((expected_idx + 1) % SHADOW_OOS_PAGES);
-            if ( idx != expected_idx && idx != expected_idx_alt )
+            if ( (idx + SHADOW_OOS_PAGES - expected_idx) % SHADOW_OOS_PAGES >=
+                 SHADOW_OOS_PROBE )
             {
-                printk("%s: idx %x contains gmfn %lx, expected at %x or %x.\n",
+                printk("%s: idx %x contains gmfn %lx, expected at %x+%u.\n",
                        __func__, idx, mfn_x(oos[idx]),
-                       expected_idx, expected_idx_alt);
+                       expected_idx, SHADOW_OOS_PROBE - 1);
                 BUG();
             }
             pg = mfn_to_page(oos[idx]);
@@ -230,32 +301,25 @@ static void sh_oos_audit(struct domain *d)
                 BUG();
             }
         }
+
+        if ( count != v->arch.paging.shadow.oos_count )
+        {
+            printk("%s: %pv has %u OOS pages, but a count of %u\n",
+                   __func__, v, count, v->arch.paging.shadow.oos_count);
+            BUG();
+        }
     }
 }
 
 #if SHADOW_AUDIT & SHADOW_AUDIT_ENTRIES
 void oos_audit_hash_is_present(struct domain *d, mfn_t gmfn)
 {
-    int idx;
-    struct vcpu *v;
-    mfn_t *oos;
+    unsigned int idx;
 
     ASSERT(mfn_is_out_of_sync(gmfn));
 
-    for_each_vcpu(d, v)
-    {
-        oos = v->arch.paging.shadow.oos;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-
-        if ( mfn_eq(oos[idx], gmfn) )
-            return;
-    }
-
-    printk(XENLOG_ERR "gmfn %"PRI_mfn" marked OOS but not in hash table\n",
-           mfn_x(gmfn));
-    BUG();
+    /* BUG()s if not found. */
+    oos_hash_find(d, gmfn, &idx);
 }
 #endif
 
@@ -333,69 +397,59 @@ static inline int oos_fixup_flush_gmfn(struct vcpu *v, mfn_t gmfn,
 void oos_fixup_add(struct domain *d, mfn_t gmfn,
                    mfn_t smfn,  unsigned long off)
 {
-    int idx, next;
-    mfn_t *oos;
-    struct oos_fixup *oos_fixup;
+    unsigned int i, idx, next;
+    struct oos_fixup *fixup;
     struct vcpu *v;
 
     perfc_incr(shadow_oos_fixup_add);
 
-    for_each_vcpu(d, v)
-    {
-        oos = v->arch.paging.shadow.oos;
-        oos_fixup = v->arch.paging.shadow.oos_fixup;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
-        {
-            int i;
-            for ( i = 0; i < SHADOW_OOS_FIXUPS; i++ )
-            {
-                if ( mfn_eq(oos_fixup[idx].smfn[i], smfn)
-                     && (oos_fixup[idx].off[i] == off) )
-                    return;
-            }
+    v = oos_hash_find(d, gmfn, &idx);
+    fixup = &v->arch.paging.shadow.oos_fixup[idx];
 
-            next = oos_fixup[idx].next;
+    for ( i = 0; i < SHADOW_OOS_FIXUPS; i++ )
+    {
+        if ( mfn_eq(fixup->smfn[i], smfn) && (fixup->off[i] == off) )
+            return;
+    }
 
-            if ( !mfn_eq(oos_fixup[idx].smfn[next], INVALID_MFN) )
-            {
-                TRACE_SHADOW_PATH_FLAG(TRCE_SFLAG_OOS_FIXUP_EVICT);
-
-                /* Reuse this slot and remove current writable mapping. */
-                sh_remove_write_access_from_sl1p(d, gmfn,
-                                                 oos_fixup[idx].smfn[next],
-                                                 oos_fixup[idx].off[next]);
-                perfc_incr(shadow_oos_fixup_evict);
-                /* We should flush the TLBs now, because we removed a
-                   writable mapping, but since the shadow is already
-                   OOS we have no problem if another vcpu write to
-                   this page table. We just have to be very careful to
-                   *always* flush the tlbs on resync. */
-            }
+    next = fixup->next;
 
-            oos_fixup[idx].smfn[next] = smfn;
-            oos_fixup[idx].off[next] = off;
-            oos_fixup[idx].next = (next + 1) % SHADOW_OOS_FIXUPS;
+    if ( !mfn_eq(fixup->smfn[next], INVALID_MFN) )
+    {
+        TRACE_SHADOW_PATH_FLAG(TRCE_SFLAG_OOS_FIXUP_EVICT);
 
-            TRACE_SHADOW_PATH_FLAG(TRCE_SFLAG_OOS_FIXUP_ADD);
-            return;
-        }
+        /* Reuse this slot and remove current writable mapping. */
+        sh_remove_write_access_from_sl1p(d, gmfn,
+                                         fixup->smfn[next],
+                                         fixup->off[next]);
+        perfc_incr(shadow_oos_fixup_evict);
+        /* We should flush the TLBs now, because we removed a
+           writable mapping, but since the shadow is already
+           OOS we have no problem if another vcpu write to
+           this page table. We just have to be very careful to
+           *always* flush the tlbs on resync. */
     }
 
-    printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
-           mfn_x(gmfn));
-    BUG();
+    fixup->smfn[next] = smfn;
+    fixup->off[next] = off;
+    fixup->next = (next + 1) % SHADOW_OOS_FIXUPS;
+
+    TRACE_SHADOW_PATH_FLAG(TRCE_SFLAG_OOS_FIXUP_ADD);
 }
 
+/*
+ * Pull all writable mappings of gmfn.  *flush gets set if the TLBs need
+ * flushing, which is left to the caller so that it can be batched across
+ * several pages.  Returns 1 if the page had to be unshadowed instead (with
+ * the TLBs already flushed).
+ */
 static int oos_remove_write_access(struct vcpu *v, mfn_t gmfn,
-                                   struct oos_fixup *fixup)
+                                   struct oos_fixup *fixup, bool *flush)
 {
     struct domain *d = v->domain;
-    int ftlb = 0;
 
-    ftlb |= oos_fixup_flush_gmfn(v, gmfn, fixup);
+    if ( oos_fixup_flush_gmfn(v, gmfn, fixup) )
+        *flush = true;
 
     switch ( sh_remove_write_access(d, gmfn, 0, 0) )
     {
@@ -404,7 +458,7 @@ static int oos_remove_write_access(struct vcpu *v, mfn_t gmfn,
         break;
 
     case 1:
-        ftlb |= 1;
+        *flush = true;
         break;
 
     case -1:
@@ -417,9 +471,6 @@ static int oos_remove_write_access(struct vcpu *v, mfn_t gmfn,
         return 1;
     }
 
-    if ( ftlb )
-        guest_flush_tlb_mask(d, d->dirty_cpumask);
-
     return 0;
 }
 
@@ -435,161 +486,162 @@ static inline void trace_resync(int event, mfn_t gmfn)
     }
 }
 
-/* Pull all the entries on an out-of-sync page back into sync. */
-static void _sh_resync(struct vcpu *v, mfn_t gmfn,
-                       struct oos_fixup *fixup, mfn_t snp)
+/*
+ * Pull the pages in the given slots of v's hash table back into sync, and
+ * release the slots.  Write access to all of them is pulled first, so that
+ * a single TLB flush covers the lot.
+ */
+static void oos_resync_slots(struct vcpu *v, unsigned long slots)
 {
-    struct page_info *pg = mfn_to_page(gmfn);
-
-    ASSERT(paging_locked_by_me(v->domain));
-    ASSERT(mfn_is_out_of_sync(gmfn));
-    /* Guest page must be shadowed *only* as L1 when out of sync. */
-    ASSERT(!(mfn_to_page(gmfn)->shadow_flags & SHF_page_type_mask
-             & ~SHF_L1_ANY));
-    ASSERT(!sh_page_has_multiple_shadows(mfn_to_page(gmfn)));
+    struct domain *d = v->domain;
+    mfn_t *oos = v->arch.paging.shadow.oos;
+    mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
+    struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
+    unsigned int idx;
+    bool flush = false;
 
-    SHADOW_PRINTK("%pv gmfn=%"PRI_mfn"\n", v, mfn_x(gmfn));
+    ASSERT(paging_locked_by_me(d));
 
-    /* Need to pull write access so the page *stays* in sync. */
-    if ( oos_remove_write_access(v, gmfn, fixup) )
+    for_each_set_bit ( idx, &slots, SHADOW_OOS_PAGES )
     {
-        /* Page has been unshadowed. */
-        return;
+        mfn_t gmfn = oos[idx];
+
+        /* Unshadowing an earlier page may have resynced this one already. */
+        if ( mfn_eq(gmfn, INVALID_MFN) )
+        {
+            __clear_bit(idx, &slots);
+            continue;
+        }
+
+        ASSERT(mfn_is_out_of_sync(gmfn));
+        /* Guest page must be shadowed *only* as L1 when out of sync. */
+        ASSERT(!(mfn_to_page(gmfn)->shadow_flags & SHF_page_type_mask
+                 & ~SHF_L1_ANY));
+        ASSERT(!sh_page_has_multiple_shadows(mfn_to_page(gmfn)));
+
+        SHADOW_PRINTK("%pv gmfn=%"PRI_mfn"\n", v, mfn_x(gmfn));
+
+        /* Need to pull write access so the page *stays* in sync. */
+        if ( oos_remove_write_access(v, gmfn, &oos_fixup[idx], &flush) )
+        {
+            /* Page has been unshadowed. */
+            __clear_bit(idx, &slots);
+            oos_hash_clear(v, idx);
+            continue;
+        }
+
+        /* No more writable mappings of this page, please */
+        mfn_to_page(gmfn)->shadow_flags &= ~SHF_oos_may_write;
     }
 
-    /* No more writable mappings of this page, please */
-    pg->shadow_flags &= ~SHF_oos_may_write;
+    if ( flush )
+        guest_flush_tlb_mask(d, d->dirty_cpumask);
+
+    for_each_set_bit ( idx, &slots, SHADOW_OOS_PAGES )
+    {
+        mfn_t gmfn = oos[idx];
+
+        /*
+         * Pulling write access from a later page in the first pass may have
+         * unshadowed (and hence resynced) this one after all.
+         */
+        if ( mfn_eq(gmfn, INVALID_MFN) )
+            continue;
 
-    /* Update the shadows with current guest entries. */
-    _sh_resync_l1(v, gmfn, snp);
+        /* Update the shadows with current guest entries. */
+        _sh_resync_l1(v, gmfn, oos_snapshot[idx]);
 
-    /* Now we know all the entries are synced, and will stay that way */
-    pg->shadow_flags &= ~SHF_out_of_sync;
-    perfc_incr(shadow_resync);
-    trace_resync(TRC_SHADOW_RESYNC_FULL, gmfn);
+        /* Now we know all the entries are synced, and will stay that way */
+        mfn_to_page(gmfn)->shadow_flags &= ~SHF_out_of_sync;
+        perfc_incr(shadow_resync);
+        trace_resync(TRC_SHADOW_RESYNC_FULL, gmfn);
+
+        oos_hash_clear(v, idx);
+    }
 }
 
+/* Mask of the slots in use in v's hash table. */
+static unsigned long oos_used_slots(const struct vcpu *v)
+{
+    const mfn_t *oos = v->arch.paging.shadow.oos;
+    unsigned long slots = 0;
+    unsigned int idx;
+
+    BUILD_BUG_ON(SHADOW_OOS_PAGES > BITS_PER_LONG);
+
+    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+        if ( !mfn_eq(oos[idx], INVALID_MFN) )
+            __set_bit(idx, &slots);
+
+    return slots;
+}
 
 /* Add an MFN to the list of out-of-sync guest pagetables */
 static void oos_hash_add(struct vcpu *v, mfn_t gmfn)
 {
-    int i, idx, oidx, swap = 0;
+    unsigned int i, idx = mfn_x(gmfn) % SHADOW_OOS_PAGES, victim = idx;
     mfn_t *oos = v->arch.paging.shadow.oos;
-    mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-    struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
-    struct oos_fixup fixup = { .next = 0 };
+    uint8_t *oos_age = v->arch.paging.shadow.oos_age;
+    struct oos_fixup *fixup;
 
-    for (i = 0; i < SHADOW_OOS_FIXUPS; i++ )
-        fixup.smfn[i] = INVALID_MFN;
-
-    idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-    oidx = idx;
-
-    if ( !mfn_eq(oos[idx], INVALID_MFN)
-         && (mfn_x(oos[idx]) % SHADOW_OOS_PAGES) == idx )
+    for ( i = 0; i < SHADOW_OOS_PROBE; i++ )
     {
-        /* Punt the current occupant into the next slot */
-        SWAP(oos[idx], gmfn);
-        SWAP(oos_fixup[idx], fixup);
-        swap = 1;
+        if ( mfn_eq(oos[idx], INVALID_MFN) )
+        {
+            victim = idx;
+            break;
+        }
+        if ( oos_age[idx] > oos_age[victim] )
+            victim = idx;
         idx = (idx + 1) % SHADOW_OOS_PAGES;
     }
-    if ( !mfn_eq(oos[idx], INVALID_MFN) )
+
+    if ( !mfn_eq(oos[victim], INVALID_MFN) )
     {
-        /* Crush the current occupant. */
-        _sh_resync(v, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
+        /* Crush the occupant which has been out of sync for longest. */
+        oos_resync_slots(v, 1UL << victim);
         perfc_incr(shadow_unsync_evict);
     }
-    oos[idx] = gmfn;
-    oos_fixup[idx] = fixup;
 
-    if ( swap )
-        SWAP(oos_snapshot[idx], oos_snapshot[oidx]);
+    oos[victim] = gmfn;
+    oos_age[victim] = 0;
+    v->arch.paging.shadow.oos_count++;
 
-    copy_domain_page(oos_snapshot[oidx], oos[oidx]);
+    fixup = &v->arch.paging.shadow.oos_fixup[victim];
+    fixup->next = 0;
+    for ( i = 0; i < SHADOW_OOS_FIXUPS; i++ )
+        fixup->smfn[i] = INVALID_MFN;
+
+    copy_domain_page(v->arch.paging.shadow.oos_snapshot[victim], gmfn);
 }
 
 /* Remove an MFN from the list of out-of-sync guest pagetables */
 static void oos_hash_remove(struct domain *d, mfn_t gmfn)
 {
-    int idx;
-    mfn_t *oos;
+    unsigned int idx;
     struct vcpu *v;
 
     SHADOW_PRINTK("d%d gmfn %lx\n", d->domain_id, mfn_x(gmfn));
 
-    for_each_vcpu(d, v)
-    {
-        oos = v->arch.paging.shadow.oos;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
-        {
-            oos[idx] = INVALID_MFN;
-            return;
-        }
-    }
-
-    printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
-           mfn_x(gmfn));
-    BUG();
+    v = oos_hash_find(d, gmfn, &idx);
+    oos_hash_clear(v, idx);
 }
 
 mfn_t oos_snapshot_lookup(struct domain *d, mfn_t gmfn)
 {
-    int idx;
-    mfn_t *oos;
-    mfn_t *oos_snapshot;
-    struct vcpu *v;
-
-    for_each_vcpu(d, v)
-    {
-        oos = v->arch.paging.shadow.oos;
-        oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-        if ( mfn_eq(oos[idx], gmfn) )
-        {
-            return oos_snapshot[idx];
-        }
-    }
+    unsigned int idx;
+    struct vcpu *v = oos_hash_find(d, gmfn, &idx);
 
-    printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
-           mfn_x(gmfn));
-    BUG();
+    return v->arch.paging.shadow.oos_snapshot[idx];
 }
 
 /* Pull a single guest page back into sync */
 void sh_resync(struct domain *d, mfn_t gmfn)
 {
-    int idx;
-    mfn_t *oos;
-    mfn_t *oos_snapshot;
-    struct oos_fixup *oos_fixup;
-    struct vcpu *v;
+    unsigned int idx;
+    struct vcpu *v = oos_hash_find(d, gmfn, &idx);
 
-    for_each_vcpu(d, v)
-    {
-        oos = v->arch.paging.shadow.oos;
-        oos_fixup = v->arch.paging.shadow.oos_fixup;
-        oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-        idx = mfn_x(gmfn) % SHADOW_OOS_PAGES;
-        if ( !mfn_eq(oos[idx], gmfn) )
-            idx = (idx + 1) % SHADOW_OOS_PAGES;
-
-        if ( mfn_eq(oos[idx], gmfn) )
-        {
-            _sh_resync(v, gmfn, &oos_fixup[idx], oos_snapshot[idx]);
-            oos[idx] = INVALID_MFN;
-            return;
-        }
-    }
-
-    printk(XENLOG_ERR "gmfn %"PRI_mfn" was OOS but not in hash table\n",
-           mfn_x(gmfn));
-    BUG();
+    oos_resync_slots(v, 1UL << idx);
 }
 
 /* Figure out whether it's definitely safe not to sync this l1 table,
@@ -613,31 +665,47 @@ static int sh_skip_sync(struct vcpu *v, mfn_t gl1mfn)
  * on other vcpus are allowed to remain out of sync, but their contents
  * will be made safe (TLB flush semantics); pages unsynced by this vcpu
  * are brought back into sync and write-protected.  If skip != 0, we try
- * to avoid resyncing at all if we think we can get away with it. */
+ * to avoid resyncing at all if we think we can get away with it: other
+ * vcpus' pages not mapped by our shadows are left alone, and this vcpu's
+ * pages only get their shadows updated until they have aged. */
 void sh_resync_all(struct vcpu *v, int skip, int this, int others)
 {
-    int idx;
+    unsigned int idx;
+    unsigned long slots;
     struct vcpu *other;
     mfn_t *oos = v->arch.paging.shadow.oos;
     mfn_t *oos_snapshot = v->arch.paging.shadow.oos_snapshot;
-    struct oos_fixup *oos_fixup = v->arch.paging.shadow.oos_fixup;
+    uint8_t *oos_age = v->arch.paging.shadow.oos_age;
 
     SHADOW_PRINTK("%pv\n", v);
 
     ASSERT(paging_locked_by_me(v->domain));
 
-    if ( !this )
+    if ( !this || !v->arch.paging.shadow.oos_count )
         goto resync_others;
 
-    /* First: resync all of this vcpu's oos pages */
-    for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
-        if ( !mfn_eq(oos[idx], INVALID_MFN) )
+    /* First: resync this vcpu's oos pages */
+    slots = oos_used_slots(v);
+    if ( skip )
+        for_each_set_bit ( idx, &slots, SHADOW_OOS_PAGES )
         {
-            /* Write-protect and sync contents */
-            _sh_resync(v, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
-            oos[idx] = INVALID_MFN;
+            if ( ++oos_age[idx] >= SHADOW_OOS_MAX_AGE )
+            {
+                perfc_incr(shadow_resync_aged);
+                continue;
+            }
+
+            /* Update the shadows and leave the page OOS. */
+            __clear_bit(idx, &slots);
+            perfc_incr(shadow_resync_kept);
+            trace_resync(TRC_SHADOW_RESYNC_ONLY, oos[idx]);
+            _sh_resync_l1(v, oos[idx], oos_snapshot[idx]);
         }
 
+    /* Write-protect and sync contents */
+    if ( slots )
+        oos_resync_slots(v, slots);
+
  resync_others:
     if ( !others )
         return;
@@ -645,32 +713,27 @@ void sh_resync_all(struct vcpu *v, int skip, int this, int others)
     /* Second: make all *other* vcpus' oos pages safe. */
     for_each_vcpu(v->domain, other)
     {
-        if ( v == other )
+        if ( v == other || !other->arch.paging.shadow.oos_count )
             continue;
 
         oos = other->arch.paging.shadow.oos;
-        oos_fixup = other->arch.paging.shadow.oos_fixup;
         oos_snapshot = other->arch.paging.shadow.oos_snapshot;
+        slots = oos_used_slots(other);
 
-        for ( idx = 0; idx < SHADOW_OOS_PAGES; idx++ )
+        if ( !skip )
         {
-            if ( mfn_eq(oos[idx], INVALID_MFN) )
-                continue;
+            /* Write-protect and sync contents */
+            oos_resync_slots(other, slots);
+            continue;
+        }
 
-            if ( skip )
-            {
-                /* Update the shadows and leave the page OOS. */
-                if ( sh_skip_sync(v, oos[idx]) )
-                    continue;
-                trace_resync(TRC_SHADOW_RESYNC_ONLY, oos[idx]);
-                _sh_resync_l1(other, oos[idx], oos_snapshot[idx]);
-            }
-            else
-            {
-                /* Write-protect and sync contents */
-                _sh_resync(other, oos[idx], &oos_fixup[idx], oos_snapshot[idx]);
-                oos[idx] = INVALID_MFN;
-            }
+        for_each_set_bit ( idx, &slots, SHADOW_OOS_PAGES )
+        {
+            /* Update the shadows and leave the page OOS. */
+            if ( sh_skip_sync(v, oos[idx]) )
+                continue;
+            trace_resync(TRC_SHADOW_RESYNC_ONLY, oos[idx]);
+            _sh_resync_l1(other, oos[idx], oos_snapshot[idx]);
         }
     }
 }
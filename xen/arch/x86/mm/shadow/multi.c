@@ -3187,7 +3187,8 @@ static void cf_check sh_update_cr3(struct vcpu *v, int do_locking, bool noflush)
 #if (SHADOW_OPTIMIZATIONS & SHOPT_OUT_OF_SYNC)
     /* Need to resync all the shadow entries on a TLB flush.  Resync
      * current vcpus OOS pages before switching to the new shadow
-     * tables so that the VA hint is still valid.  */
+     * tables.  Pages which went out of sync recently only have their
+     * shadows updated, as they're likely to be written to again. */
     shadow_resync_current_vcpu(v);
 #endif
 
@@ -442,7 +442,8 @@ void sh_resync(struct domain *d, mfn_t gmfn);
 void oos_fixup_add(struct domain *d, mfn_t gmfn, mfn_t smfn, unsigned long off);
 
 /* Pull all out-of-sync shadows back into sync.  If skip != 0, we try
- * to avoid resyncing where we think we can get away with it. */
+ * to avoid resyncing where we think we can get away with it, including
+ * leaving recently unsynced pages of v's out of sync. */
 
 void sh_resync_all(struct vcpu *v, int skip, int this, int others);
 
@@ -455,7 +456,7 @@ shadow_resync_all(struct vcpu *v)
 static inline void
 shadow_resync_current_vcpu(struct vcpu *v)
 {
-    sh_resync_all(v, 0 /* skip */, 1 /* this */, 0 /* others */);
+    sh_resync_all(v, 1 /* skip */, 1 /* this */, 0 /* others */);
 }
 
 static inline void
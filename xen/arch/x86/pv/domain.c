@@ -298,6 +298,7 @@ void pv_vcpu_destroy(struct vcpu *v)
 
     pv_destroy_gdt_ldt_l1tab(v);
     XFREE(v->arch.pv.trap_ctxt);
+    mapcache_vcpu_destroy(v);
 }
 
 int pv_vcpu_initialise(struct vcpu *v)
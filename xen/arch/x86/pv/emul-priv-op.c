@@ -12,6 +12,7 @@
 #include <xen/guest_access.h>
 #include <xen/hypercall.h>
 #include <xen/iocap.h>
+#include <xen/perfc.h>
 
 #include <asm/amd.h>
 #include <asm/debugreg.h>
@@ -79,9 +80,9 @@ static io_emul_stub_t *io_emul_stub_setup(struct priv_op_ctxt *ctxt, u8 opcode,
         0xc3,       /* ret       */
     };
 
-    const struct stubs *this_stubs = &this_cpu(stubs);
+    struct stubs *this_stubs = &this_cpu(stubs);
     const void *stub_va = (void *)this_stubs->addr + STUB_BUF_SIZE / 2;
-    unsigned int quirk_bytes = 0;
+    unsigned int quirk_bytes = 0, key = 0;
     char *p;
 
     /* Helpers - Read outer scope but only modify p. */
@@ -94,6 +95,24 @@ static io_emul_stub_t *io_emul_stub_setup(struct priv_op_ctxt *ctxt, u8 opcode,
         *(int32_t *)p = disp; p += 4;                                   \
     })
 
+    /*
+     * Drivers polling a port keep emulating the same instruction, so reuse
+     * the stub built last time if nothing else used the buffer since.  The
+     * port is only part of the stub for the imm8 forms.  Quirked stubs
+     * depend on the guest's registers and are always rebuilt.
+     */
+    if ( likely(!ioemul_handle_quirk) )
+    {
+        key = (1U << 31) | ((opcode & 8) ? 0 : (port & 0xff) << 16) |
+              (opcode << 8) | bytes;
+        if ( this_stubs->io_emul_key == key )
+        {
+            perfc_incr(io_emul_stub_reuse);
+            block_speculation(); /* SCSB */
+            return stub_va;
+        }
+    }
+
     if ( !ctxt->io_emul_stub )
         ctxt->io_emul_stub =
             map_domain_page(_mfn(this_stubs->mfn)) + PAGE_OFFSET(stub_va);
@@ -134,6 +153,8 @@ static io_emul_stub_t *io_emul_stub_setup(struct priv_op_ctxt *ctxt, u8 opcode,
     /* Runtime confirmation that we haven't clobbered an adjacent stub. */
     BUG_ON(STUB_BUF_SIZE / 2 < (p - ctxt->io_emul_stub));
 
+    this_stubs->io_emul_key = key;
+
     block_speculation(); /* SCSB */
 
     /* Handy function-typed pointer to the stub. */
@@ -36,6 +36,7 @@
 #include <asm/mpspec.h>
 #include <asm/apic.h>
 #include <asm/msi.h>
+#include <asm/msr.h>
 #include <asm/desc.h>
 #include <asm/paging.h>
 #include <asm/e820.h>
@@ -978,6 +979,7 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     unsigned long nr_pages, raw_max_page, modules_headroom, module_map[1];
     int i, j, e820_warn = 0, bytes = 0;
     unsigned long eb_start, eb_end;
+    uint64_t heap_init_tsc;
     bool acpi_boot_table_init_done = false, relocated = false;
     int ret;
     struct ns16550_defaults ns16550 = {
@@ -1720,6 +1722,9 @@ void __init noreturn __start_xen(unsigned long mbi_p)
 
     numa_initmem_init(0, raw_max_page);
 
+    /* Time isn't calibrated yet: keep TSC ticks, and report them later. */
+    heap_init_tsc = rdtsc_ordered();
+
     if ( max_page - 1 > virt_to_mfn(HYPERVISOR_VIRT_END - 1) )
     {
         unsigned long limit = virt_to_mfn(HYPERVISOR_VIRT_END - 1);
@@ -1749,6 +1754,8 @@ void __init noreturn __start_xen(unsigned long mbi_p)
     else
         end_boot_allocator();
 
+    heap_init_tsc = rdtsc_ordered() - heap_init_tsc;
+
     system_state = SYS_STATE_boot;
     /*
      * No calls involving ACPI code should go between the setting of
@@ -1932,6 +1939,9 @@ void __init noreturn __start_xen(unsigned long mbi_p)
      */
     init_xen_time();
 
+    printk("Domain heap initialisation took %lums\n",
+           (unsigned long)(heap_init_tsc / cpu_khz));
+
     initialize_keytable();
 
     console_init_postirq();
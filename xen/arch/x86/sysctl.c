@@ -105,6 +105,22 @@ void arch_do_physinfo(struct xen_sysctl_physinfo *pi)
         pi->capabilities |= XEN_SYSCTL_PHYSCAP_shadow;
 }
 
+void arch_get_vcpu_stats(const struct vcpu *v,
+                         struct xen_sysctl_vcpu_stats *stats)
+{
+    const struct hvm_exit_stats *es;
+    unsigned int i;
+
+    if ( !is_hvm_vcpu(v) || !(es = v->arch.hvm.exit_stats) )
+        return;
+
+    for ( i = 0; i < HVM_NR_EXIT_STATS; i++ )
+    {
+        stats->exits += es->count[i];
+        stats->exit_cycles += es->cycles[i];
+    }
+}
+
 long arch_do_sysctl(
     struct xen_sysctl *sysctl, XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
@@ -1162,13 +1162,13 @@ static int mem_hotadd_check(unsigned long spfn, unsigned long epfn)
     if ( (spfn >= epfn) )
         return 0;
 
-    if (pfn_to_pdx(epfn) > FRAMETABLE_NR)
+    if ( !pdx_is_region_compressible(pfn_to_paddr(spfn), epfn - spfn) )
         return 0;
 
-    if ( (spfn | epfn) & ((1UL << PAGETABLE_ORDER) - 1) )
+    if (pfn_to_pdx(epfn) > FRAMETABLE_NR)
         return 0;
 
-    if ( (spfn | epfn) & pfn_hole_mask )
+    if ( (spfn | epfn) & ((1UL << PAGETABLE_ORDER) - 1) )
         return 0;
 
     /* Make sure the new range is not present now */
@@ -664,6 +664,7 @@ amd_like(const struct x86_emulate_ctxt *ctxt)
     BUILD_BUG_ON(STUB_BUF_SIZE / 2 < MAX_INST_LEN + 1);      \
     ASSERT(!(stb).ptr);                                      \
     (stb).addr = this_cpu(stubs.addr) + STUB_BUF_SIZE / 2;   \
+    this_cpu(stubs.io_emul_key) = 0;                         \
     (stb).ptr = map_domain_page(_mfn(this_cpu(stubs.mfn))) + \
         ((stb).addr & ~PAGE_MASK);                           \
     ptr = memset((stb).ptr, 0xcc, STUB_BUF_SIZE / 2);        \
@@ -26,6 +26,7 @@
 #include <xen/param.h>
 #include <xen/sched.h>
 #include <xen/time.h>
+#include <xen/vmap.h>
 #include <xsm/xsm.h>
 
 #include <public/argo.h>
@@ -124,8 +125,8 @@ struct argo_ring_info
     unsigned int nmfns;
     /* cached tx pointer location, protected by L3 */
     unsigned int tx_ptr;
-    /* mapped ring pages protected by L3 */
-    void **mfn_mapping;
+    /* contiguous mapping of all the ring pages, protected by L3 */
+    void *ring_va;
     /* list of mfns of guest ring, protected by L3 */
     mfn_t *mfns;
     /* list of struct pending_ent for this ring, protected by L3 */
@@ -220,9 +221,13 @@ struct argo_domain
  * Since holding R(L1) will block acquiring W(L1), it will ensure that
  * no domains pointers that argo is interested in become invalid while either
  * W(L1) or R(L1) are held.
+ *
+ * W(L1) is only needed on domain creation and destruction, while every
+ * operation takes R(L1).  L1 is a per-CPU rwlock, so that readers don't
+ * contend on a single cache line in the common case.
  */
 
-static DEFINE_RWLOCK(L1_global_argo_rwlock); /* L1 */
+static DEFINE_BR_RWLOCK(L1_global_argo_rwlock); /* L1 */
 
 /*
  * == rings_L2 : The per-domain ring hash lock: d->argo->rings_L2_rwlock
@@ -280,14 +285,14 @@ static DEFINE_RWLOCK(L1_global_argo_rwlock); /* L1 */
  *
  * The LOCKING macros defined below here are for use at verification points.
  */
-#define LOCKING_Write_L1 (rw_is_write_locked(&L1_global_argo_rwlock))
+#define LOCKING_Write_L1 (br_rw_is_write_locked(&L1_global_argo_rwlock))
 /*
  * While LOCKING_Read_L1 will return true even if the lock is write-locked,
  * that's OK because everywhere that a Read lock is needed with these macros,
  * holding a Write lock there instead is OK too: we're checking that _at least_
  * the specified level of locks are held.
  */
-#define LOCKING_Read_L1 (rw_is_locked(&L1_global_argo_rwlock))
+#define LOCKING_Read_L1 (br_rw_is_locked(&L1_global_argo_rwlock))
 
 #define LOCKING_Write_rings_L2(d) \
     ((LOCKING_Read_L1 && rw_is_write_locked(&(d)->argo->rings_L2_rwlock)) || \
@@ -454,77 +459,38 @@ signal_domid(domid_t domain_id)
 static void
 ring_unmap(const struct domain *d, struct argo_ring_info *ring_info)
 {
-    unsigned int i;
-
-    ASSERT(LOCKING_L3(d, ring_info));
+    ASSERT(LOCKING_Write_rings_L2(d));
 
-    if ( !ring_info->mfn_mapping )
+    if ( !ring_info->ring_va )
         return;
 
-    ASSERT(!ring_info->nmfns || ring_info->mfns);
+    argo_dprintk("unmapping ring (vm%u:%x vm%u) from %p\n",
+                 ring_info->id.domain_id, ring_info->id.aport,
+                 ring_info->id.partner_id, ring_info->ring_va);
 
-    for ( i = 0; i < ring_info->nmfns; i++ )
-    {
-        if ( !ring_info->mfn_mapping[i] )
-            continue;
-
-        ASSERT(!mfn_eq(ring_info->mfns[i], INVALID_MFN));
-        argo_dprintk(XENLOG_ERR "argo: unmapping page %"PRI_mfn" from %p\n",
-                     mfn_x(ring_info->mfns[i]), ring_info->mfn_mapping[i]);
-
-        unmap_domain_page_global(ring_info->mfn_mapping[i]);
-        ring_info->mfn_mapping[i] = NULL;
-    }
+    vunmap(ring_info->ring_va);
+    ring_info->ring_va = NULL;
 }
 
 static int
-ring_map_page(const struct domain *d, struct argo_ring_info *ring_info,
-              unsigned int i, void **out_ptr)
+ring_map(const struct domain *d, struct argo_ring_info *ring_info)
 {
-    ASSERT(LOCKING_L3(d, ring_info));
-
-    /*
-     * FIXME: Investigate using vmap to create a single contiguous virtual
-     * address space mapping of the ring instead of using the array of single
-     * page mappings.
-     * Affects logic in memcpy_to_guest_ring, the mfn_mapping array data
-     * structure, and places where ring mappings are added or removed.
-     */
+    ASSERT(LOCKING_Write_rings_L2(d));
+    ASSERT(!ring_info->ring_va);
 
-    if ( i >= ring_info->nmfns )
+    ring_info->ring_va = vmap(ring_info->mfns, ring_info->nmfns);
+    if ( !ring_info->ring_va )
     {
         gprintk(XENLOG_ERR,
-               "argo: ring (vm%u:%x vm%u) %p attempted to map page %u of %u\n",
+                "argo: ring (vm%u:%x vm%u) %p failed to map %u pages\n",
                 ring_info->id.domain_id, ring_info->id.aport,
-                ring_info->id.partner_id, ring_info, i, ring_info->nmfns);
+                ring_info->id.partner_id, ring_info, ring_info->nmfns);
         return -ENOMEM;
     }
-    i = array_index_nospec(i, ring_info->nmfns);
 
-    if ( !ring_info->mfns || !ring_info->mfn_mapping )
-    {
-        ASSERT_UNREACHABLE();
-        ring_info->len = 0;
-        return -ENOMEM;
-    }
-
-    if ( !ring_info->mfn_mapping[i] )
-    {
-        ring_info->mfn_mapping[i] = map_domain_page_global(ring_info->mfns[i]);
-        if ( !ring_info->mfn_mapping[i] )
-        {
-            gprintk(XENLOG_ERR, "argo: ring (vm%u:%x vm%u) %p attempted to map "
-                    "page %u of %u\n",
-                    ring_info->id.domain_id, ring_info->id.aport,
-                    ring_info->id.partner_id, ring_info, i, ring_info->nmfns);
-            return -ENOMEM;
-        }
-        argo_dprintk("mapping page %"PRI_mfn" to %p\n",
-                     mfn_x(ring_info->mfns[i]), ring_info->mfn_mapping[i]);
-    }
-
-    if ( out_ptr )
-        *out_ptr = ring_info->mfn_mapping[i];
+    argo_dprintk("mapping ring (vm%u:%x vm%u) to %p\n",
+                 ring_info->id.domain_id, ring_info->id.aport,
+                 ring_info->id.partner_id, ring_info->ring_va);
 
     return 0;
 }
@@ -536,10 +502,10 @@ update_tx_ptr(const struct domain *d, struct argo_ring_info *ring_info,
     xen_argo_ring_t *ringp;
 
     ASSERT(LOCKING_L3(d, ring_info));
-    ASSERT(ring_info->mfn_mapping[0]);
+    ASSERT(ring_info->ring_va);
 
     ring_info->tx_ptr = tx_ptr;
-    ringp = ring_info->mfn_mapping[0];
+    ringp = ring_info->ring_va;
 
     write_atomic(&ringp->tx_ptr, tx_ptr);
     smp_wmb();
@@ -551,44 +517,27 @@ memcpy_to_guest_ring(const struct domain *d, struct argo_ring_info *ring_info,
                      const void *src, XEN_GUEST_HANDLE(uint8) src_hnd,
                      unsigned int len)
 {
-    unsigned int mfns_index = offset >> PAGE_SHIFT;
-    void *dst;
-    int ret;
-    unsigned int src_offset = 0;
+    unsigned int size = ring_info->nmfns << PAGE_SHIFT;
 
     ASSERT(LOCKING_L3(d, ring_info));
 
-    offset &= ~PAGE_MASK;
-
-    if ( len + offset > XEN_ARGO_MAX_RING_SIZE )
-        return -EFAULT;
-
-    while ( len )
+    /* The ring is mapped contiguously: one bounds check covers the copy. */
+    if ( !ring_info->ring_va || offset > size || len > size - offset )
     {
-        unsigned int head_len = (offset + len) > PAGE_SIZE ? PAGE_SIZE - offset
-                                                           : len;
-
-        ret = ring_map_page(d, ring_info, mfns_index, &dst);
-        if ( ret )
-            return ret;
-
-        if ( src )
-        {
-            memcpy(dst + offset, src + src_offset, head_len);
-            src_offset += head_len;
-        }
-        else
-        {
-            if ( copy_from_guest(dst + offset, src_hnd, head_len) )
-                return -EFAULT;
-
-            guest_handle_add_offset(src_hnd, head_len);
-        }
-
-        mfns_index++;
-        len -= head_len;
-        offset = 0;
+        gprintk(XENLOG_ERR,
+                "argo: ring (vm%u:%x vm%u) %p attempted to write [%u, +%u) of "
+                "%u\n",
+                ring_info->id.domain_id, ring_info->id.aport,
+                ring_info->id.partner_id, ring_info, offset, len, size);
+        return -EFAULT;
     }
+    offset = array_index_nospec(offset, size);
+
+    /* Guest handles have been checked with guest_handle_okay() by the caller. */
+    if ( src )
+        memcpy(ring_info->ring_va + offset, src, len);
+    else if ( __copy_from_guest(ring_info->ring_va + offset, src_hnd, len) )
+        return -EFAULT;
 
     return 0;
 }
@@ -601,20 +550,19 @@ static int
 get_rx_ptr(const struct domain *d, struct argo_ring_info *ring_info,
            uint32_t *rx_ptr)
 {
-    void *src;
     xen_argo_ring_t *ringp;
-    int ret;
 
     ASSERT(LOCKING_L3(d, ring_info));
 
     if ( !ring_info->nmfns || ring_info->nmfns < NPAGES_RING(ring_info->len) )
         return -EINVAL;
 
-    ret = ring_map_page(d, ring_info, 0, &src);
-    if ( ret )
-        return ret;
-
-    ringp = (xen_argo_ring_t *)src;
+    ringp = ring_info->ring_va;
+    if ( !ringp )
+    {
+        ASSERT_UNREACHABLE();
+        return -ENOMEM;
+    }
 
     *rx_ptr = read_atomic(&ringp->rx_ptr);
 
@@ -965,13 +913,8 @@ ringbuf_insert(const struct domain *d, struct argo_ring_info *ring_info,
     update_tx_ptr(d, ring_info, ring.tx_ptr);
 
     /*
-     * At this point (and also on an error exit paths from this function) it is
-     * possible to unmap the ring_info, ie:
-     *   ring_unmap(d, ring_info);
-     * but performance should be improved by not doing so, and retaining
-     * the mapping.
-     * An XSM policy control over level of confidentiality required
-     * versus performance cost could be added to decide that here.
+     * The ring stays mapped from registration until it is unregistered (or
+     * its owner is torn down): see ring_map() and ring_unmap().
      */
 
     return ret;
@@ -1210,12 +1153,6 @@ ring_remove_mfns(const struct domain *d, struct argo_ring_info *ring_info)
     if ( !ring_info->mfns )
         return;
 
-    if ( !ring_info->mfn_mapping )
-    {
-        ASSERT_UNREACHABLE();
-        return;
-    }
-
     ring_unmap(d, ring_info);
 
     for ( i = 0; i < ring_info->nmfns; i++ )
@@ -1224,7 +1161,6 @@ ring_remove_mfns(const struct domain *d, struct argo_ring_info *ring_info)
 
     ring_info->nmfns = 0;
     XFREE(ring_info->mfns);
-    XFREE(ring_info->mfn_mapping);
 }
 
 static void
@@ -1445,7 +1381,6 @@ find_ring_mfns(struct domain *d, struct argo_ring_info *ring_info,
     unsigned int i;
     int ret = 0;
     mfn_t *mfns;
-    void **mfn_mapping;
 
     ASSERT(LOCKING_Write_rings_L2(d));
 
@@ -1468,15 +1403,7 @@ find_ring_mfns(struct domain *d, struct argo_ring_info *ring_info,
     for ( i = 0; i < npage; i++ )
         mfns[i] = INVALID_MFN;
 
-    mfn_mapping = xzalloc_array(void *, npage);
-    if ( !mfn_mapping )
-    {
-        xfree(mfns);
-        return -ENOMEM;
-    }
-
     ring_info->mfns = mfns;
-    ring_info->mfn_mapping = mfn_mapping;
 
     for ( i = 0; i < npage; i++ )
     {
@@ -1506,18 +1433,22 @@ find_ring_mfns(struct domain *d, struct argo_ring_info *ring_info,
 
     ring_info->nmfns = i;
 
-    if ( ret )
-        ring_remove_mfns(d, ring_info);
-    else
+    if ( !ret )
     {
         ASSERT(ring_info->nmfns == NPAGES_RING(len));
 
+        /* Map the whole ring once, for the lifetime of its registration. */
+        ret = ring_map(d, ring_info);
+    }
+
+    if ( ret )
+        ring_remove_mfns(d, ring_info);
+    else
         argo_dprintk("argo: vm%u ring (vm%u:%x vm%u) %p "
-                     "mfn_mapping %p len %u nmfns %u\n",
+                     "ring_va %p len %u nmfns %u\n",
                      d->domain_id, ring_info->id.domain_id,
                      ring_info->id.aport, ring_info->id.partner_id, ring_info,
-                     ring_info->mfn_mapping, ring_info->len, ring_info->nmfns);
-    }
+                     ring_info->ring_va, ring_info->len, ring_info->nmfns);
 
     return ret;
 }
@@ -1544,11 +1475,11 @@ unregister_ring(struct domain *currd,
     ring_id.aport = unreg.aport;
     ring_id.domain_id = currd->domain_id;
 
-    read_lock(&L1_global_argo_rwlock);
+    br_read_lock(&L1_global_argo_rwlock);
 
     if ( unlikely(!currd->argo) )
     {
-        read_unlock(&L1_global_argo_rwlock);
+        br_read_unlock(&L1_global_argo_rwlock);
         return -ENODEV;
     }
 
@@ -1584,7 +1515,7 @@ unregister_ring(struct domain *currd,
  out:
     write_unlock(&currd->argo->rings_L2_rwlock);
 
-    read_unlock(&L1_global_argo_rwlock);
+    br_read_unlock(&L1_global_argo_rwlock);
 
     if ( dst_d )
         rcu_unlock_domain(dst_d);
@@ -1609,7 +1540,6 @@ register_ring(struct domain *currd,
 {
     xen_argo_register_ring_t reg;
     struct argo_ring_id ring_id;
-    void *map_ringp;
     xen_argo_ring_t *ringp;
     struct argo_ring_info *ring_info, *new_ring_info = NULL;
     struct argo_send_info *send_info = NULL;
@@ -1689,7 +1619,7 @@ register_ring(struct domain *currd,
         goto out;
     }
 
-    read_lock(&L1_global_argo_rwlock);
+    br_read_lock(&L1_global_argo_rwlock);
 
     if ( !currd->argo )
     {
@@ -1787,18 +1717,7 @@ register_ring(struct domain *currd,
      * The first page of the memory supplied for the ring has the xen_argo_ring
      * structure at its head, which is where the ring indexes reside.
      */
-    ret = ring_map_page(currd, ring_info, 0, &map_ringp);
-    if ( ret )
-    {
-        gprintk(XENLOG_ERR,
-                "argo: vm%u failed to map ring mfn 0 (vm%u:%x vm%u)\n",
-                currd->domain_id, ring_id.domain_id, ring_id.aport,
-                ring_id.partner_id);
-
-        ring_remove_info(currd, ring_info);
-        goto out_unlock2;
-    }
-    ringp = map_ringp;
+    ringp = ring_info->ring_va;
 
     private_tx_ptr = read_atomic(&ringp->tx_ptr);
 
@@ -1836,7 +1755,7 @@ register_ring(struct domain *currd,
     write_unlock(&currd->argo->rings_L2_rwlock);
 
  out_unlock:
-    read_unlock(&L1_global_argo_rwlock);
+    br_read_unlock(&L1_global_argo_rwlock);
 
  out:
     if ( dst_d )
@@ -1907,7 +1826,7 @@ notify(struct domain *currd,
 
     ASSERT(currd == current->domain);
 
-    read_lock(&L1_global_argo_rwlock);
+    br_read_lock(&L1_global_argo_rwlock);
 
     if ( !currd->argo )
     {
@@ -1948,7 +1867,7 @@ notify(struct domain *currd,
     }
 
  out:
-    read_unlock(&L1_global_argo_rwlock);
+    br_read_unlock(&L1_global_argo_rwlock);
 
     return ret;
 }
@@ -1998,7 +1917,7 @@ sendv(struct domain *src_d, xen_argo_addr_t *src_addr,
         return ret;
     }
 
-    read_lock(&L1_global_argo_rwlock);
+    br_read_lock(&L1_global_argo_rwlock);
 
     if ( !src_d->argo )
     {
@@ -2057,7 +1976,7 @@ sendv(struct domain *src_d, xen_argo_addr_t *src_addr,
     read_unlock(&dst_d->argo->rings_L2_rwlock);
 
  out_unlock:
-    read_unlock(&L1_global_argo_rwlock);
+    br_read_unlock(&L1_global_argo_rwlock);
 
     if ( ret >= 0 )
         signal_domain(dst_d);
@@ -2308,11 +2227,11 @@ argo_init(struct domain *d)
 
     argo_domain_init(argo);
 
-    write_lock(&L1_global_argo_rwlock);
+    br_write_lock(&L1_global_argo_rwlock);
 
     d->argo = argo;
 
-    write_unlock(&L1_global_argo_rwlock);
+    br_write_unlock(&L1_global_argo_rwlock);
 
     return 0;
 }
@@ -2322,7 +2241,7 @@ argo_destroy(struct domain *d)
 {
     BUG_ON(!d->is_dying);
 
-    write_lock(&L1_global_argo_rwlock);
+    br_write_lock(&L1_global_argo_rwlock);
 
     argo_dprintk("destroy: domid %u d->argo=%p\n", d->domain_id, d->argo);
 
@@ -2334,13 +2253,13 @@ argo_destroy(struct domain *d)
         XFREE(d->argo);
     }
 
-    write_unlock(&L1_global_argo_rwlock);
+    br_write_unlock(&L1_global_argo_rwlock);
 }
 
 void
 argo_soft_reset(struct domain *d)
 {
-    write_lock(&L1_global_argo_rwlock);
+    br_write_lock(&L1_global_argo_rwlock);
 
     argo_dprintk("soft reset d=%u d->argo=%p\n", d->domain_id, d->argo);
 
@@ -2358,5 +2277,5 @@ argo_soft_reset(struct domain *d)
         argo_domain_init(d->argo);
     }
 
-    write_unlock(&L1_global_argo_rwlock);
+    br_write_unlock(&L1_global_argo_rwlock);
 }
@@ -56,6 +56,10 @@ CHECK_gnttab_swap_grant_ref;
 CHECK_gnttab_cache_flush;
 #undef xen_gnttab_cache_flush
 
+#define xen_gnttab_copy_seg gnttab_copy_seg
+CHECK_gnttab_copy_seg;
+#undef xen_gnttab_copy_seg
+
 int compat_grant_table_op(
     unsigned int cmd, XEN_GUEST_HANDLE_PARAM(void) cmp_uop, unsigned int count)
 {
@@ -19,6 +19,80 @@
 #include <xen/hypercall.h>
 #include <xen/nospec.h>
 
+static int dm_op_batch(const struct dmop_args *args,
+                       struct xen_dm_op_batch *batch)
+{
+    struct dmop_args sub = { .domid = args->domid, .nr_bufs = 1 };
+    unsigned int i;
+    uint32_t op;
+    int32_t status;
+    int rc = 0;
+
+    if ( args->nr_bufs < 3 ||
+         args->buf[1].size / sizeof(struct xen_dm_op) < batch->nr ||
+         args->buf[2].size / sizeof(status) < batch->nr )
+        return -EINVAL;
+
+    for ( i = batch->done; i < batch->nr; i++ )
+    {
+        sub.buf[0].h = args->buf[1].h;
+        guest_handle_add_offset(sub.buf[0].h, i * sizeof(struct xen_dm_op));
+        sub.buf[0].size = sizeof(struct xen_dm_op);
+
+        if ( copy_from_guest_offset((void *)&op, sub.buf[0].h, 0,
+                                    sizeof(op)) )
+            return -EFAULT;
+
+        status = op == XEN_DMOP_batch ? -EINVAL : dm_op(&sub);
+
+        /* The operation has saved its own progress: resume it later. */
+        if ( status == -ERESTART )
+        {
+            rc = -ERESTART;
+            break;
+        }
+
+        if ( copy_to_guest_offset(args->buf[2].h, i * sizeof(status),
+                                  (void *)&status, sizeof(status)) )
+            return -EFAULT;
+
+        if ( i + 1 < batch->nr && hypercall_preempt_check() )
+        {
+            i++;
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+    if ( rc == -ERESTART )
+    {
+        batch->done = i;
+        if ( copy_to_guest_offset(args->buf[0].h,
+                                  offsetof(struct xen_dm_op, u),
+                                  (void *)batch, sizeof(*batch)) )
+            rc = -EFAULT;
+    }
+
+    return rc;
+}
+
+int dm_op_dispatch(const struct dmop_args *args)
+{
+    struct xen_dm_op op;
+    const size_t size = offsetof(struct xen_dm_op, u) + sizeof(op.u.batch);
+
+    /* Anything else, malformed or not, is for dm_op() to judge. */
+    if ( !args->nr_bufs || args->buf[0].size < size ||
+         copy_from_guest_offset((void *)&op, args->buf[0].h, 0, size) ||
+         op.op != XEN_DMOP_batch )
+        return dm_op(args);
+
+    if ( op.pad )
+        return -EINVAL;
+
+    return dm_op_batch(args, &op.u.batch);
+}
+
 long do_dm_op(
     domid_t domid, unsigned int nr_bufs,
     XEN_GUEST_HANDLE_PARAM(xen_dm_op_buf_t) bufs)
@@ -35,7 +109,7 @@ long do_dm_op(
     if ( copy_from_guest_offset(&args.buf[0], bufs, 0, args.nr_bufs) )
         return -EFAULT;
 
-    rc = dm_op(&args);
+    rc = dm_op_dispatch(&args);
 
     if ( rc == -ERESTART )
         rc = hypercall_create_continuation(__HYPERVISOR_dm_op, "iih",
@@ -54,13 +54,18 @@ unsigned int xen_processor_pmbits = XEN_PROCESSOR_PM_PX;
 bool_t opt_dom0_vcpus_pin;
 boolean_param("dom0_vcpus_pin", opt_dom0_vcpus_pin);
 
-/* Protect updates/reads (resp.) of domain_list and domain_hash. */
+/* Protect updates/reads (resp.) of domain_list and domid_table. */
 DEFINE_SPINLOCK(domlist_update_lock);
 DEFINE_RCU_READ_LOCK(domlist_read_lock);
 
-#define DOMAIN_HASH_SIZE 256
-#define DOMAIN_HASH(_id) ((int)(_id)&(DOMAIN_HASH_SIZE-1))
-static struct domain *domain_hash[DOMAIN_HASH_SIZE];
+/*
+ * Domains indexed by domid, in a two level table: leaves of
+ * DOMID_TABLE_LEAF_ENTRIES pointers get allocated when the first domain
+ * in their range is created, and are never freed.
+ */
+#define DOMID_TABLE_LEAF_ENTRIES (PAGE_SIZE / sizeof(struct domain *))
+#define DOMID_TABLE_LEAVES       ((DOMID_MASK + 1) / DOMID_TABLE_LEAF_ENTRIES)
+static struct domain **domid_table[DOMID_TABLE_LEAVES];
 struct domain *domain_list;
 
 struct domain *hardware_domain __read_mostly;
@@ -85,6 +90,34 @@ bool __read_mostly vmtrace_available;
 
 bool __read_mostly vpmu_is_available;
 
+/*
+ * Domains which got shut down, became dying or were destroyed, and haven't
+ * been reported to the VIRQ_DOM_EXC handler yet.
+ */
+static DECLARE_BITMAP(dom_state_changed, DOMID_FIRST_RESERVED);
+
+static void domain_changed_state(domid_t domid)
+{
+    if ( domid < DOMID_FIRST_RESERVED )
+        set_bit(domid, dom_state_changed);
+
+    send_global_virq(VIRQ_DOM_EXC);
+}
+
+domid_t domain_get_changed(void)
+{
+    unsigned int domid;
+
+    for ( domid = find_first_bit(dom_state_changed, DOMID_FIRST_RESERVED);
+          domid < DOMID_FIRST_RESERVED;
+          domid = find_next_bit(dom_state_changed, DOMID_FIRST_RESERVED,
+                                domid + 1) )
+        if ( test_and_clear_bit(domid, dom_state_changed) )
+            return domid;
+
+    return DOMID_INVALID;
+}
+
 static void __domain_finalise_shutdown(struct domain *d)
 {
     struct vcpu *v;
@@ -102,7 +135,7 @@ static void __domain_finalise_shutdown(struct domain *d)
     if ( (d->shutdown_code == SHUTDOWN_suspend) && d->suspend_evtchn )
         evtchn_send(d, d->suspend_evtchn);
     else
-        send_global_virq(VIRQ_DOM_EXC);
+        domain_changed_state(d->domain_id);
 }
 
 static void vcpu_check_shutdown(struct vcpu *v)
@@ -549,11 +582,40 @@ static int sanitise_domain_config(struct xen_domctl_createdomain *config)
     return arch_sanitise_domain_config(config);
 }
 
+/* Get (allocating it if need be) the domid_table leaf covering domid. */
+static struct domain **domid_table_leaf(domid_t domid)
+{
+    struct domain ***slot = &domid_table[domid / DOMID_TABLE_LEAF_ENTRIES];
+    struct domain **leaf = *slot;
+
+    ASSERT(domid <= DOMID_MASK);
+
+    if ( leaf )
+        return leaf;
+
+    leaf = xzalloc_array(struct domain *, DOMID_TABLE_LEAF_ENTRIES);
+    if ( !leaf )
+        return NULL;
+
+    spin_lock(&domlist_update_lock);
+    if ( !*slot )
+    {
+        rcu_assign_pointer(*slot, leaf);
+        leaf = NULL;
+    }
+    spin_unlock(&domlist_update_lock);
+
+    /* Somebody else may have got there first. */
+    xfree(leaf);
+
+    return *slot;
+}
+
 struct domain *domain_create(domid_t domid,
                              struct xen_domctl_createdomain *config,
                              unsigned int flags)
 {
-    struct domain *d, **pd, *old_hwdom = NULL;
+    struct domain *d, **pd, **leaf, *old_hwdom = NULL;
     enum { INIT_watchdog = 1u<<1,
            INIT_evtchn = 1u<<3, INIT_gnttab = 1u<<4, INIT_arch = 1u<<5 };
     int err, init_status = 0;
@@ -600,7 +662,9 @@ struct domain *domain_create(domid_t domid,
     RCU_READ_LOCK_INIT(&d->rcu_lock);
     spin_lock_init_prof(d, domain_lock);
     spin_lock_init_prof(d, page_alloc_lock);
+    spin_lock_set_queued(&d->page_alloc_lock);
     spin_lock_init(&d->hypercall_deadlock_mutex);
+    spin_lock_init(&d->domctl_lock);
     INIT_PAGE_LIST_HEAD(&d->page_list);
     INIT_PAGE_LIST_HEAD(&d->extra_page_list);
     INIT_PAGE_LIST_HEAD(&d->xenpage_list);
@@ -710,6 +774,11 @@ struct domain *domain_create(domid_t domid,
         if ( (err = late_hwdom_init(d)) != 0 )
             goto fail;
 
+        err = -ENOMEM;
+        leaf = domid_table_leaf(domid);
+        if ( !leaf )
+            goto fail;
+
         /*
          * Must not fail beyond this point, as our caller doesn't know whether
          * the domain has been entered into domain_list or not.
@@ -721,9 +790,8 @@ struct domain *domain_create(domid_t domid,
             if ( (*pd)->domain_id > d->domain_id )
                 break;
         d->next_in_list = *pd;
-        d->next_in_hashbucket = domain_hash[DOMAIN_HASH(domid)];
         rcu_assign_pointer(*pd, d);
-        rcu_assign_pointer(domain_hash[DOMAIN_HASH(domid)], d);
+        rcu_assign_pointer(leaf[domid % DOMID_TABLE_LEAF_ENTRIES], d);
         spin_unlock(&domlist_update_lock);
 
         memcpy(d->handle, config->handle, sizeof(d->handle));
@@ -835,20 +903,36 @@ out:
     return 0;
 }
 
+/*
+ * The node to allocate @d's hypervisor-private structures (vCPU structures,
+ * VMCS/VMCB, grant table frames...) from, for those allocations which don't
+ * go through the domheap on @d's behalf and hence don't get d->node_affinity
+ * applied by the page allocator.  NUMA_NO_NODE when the domain isn't
+ * confined to a subset of the online nodes.
+ */
+nodeid_t domain_alloc_node(const struct domain *d)
+{
+    nodemask_t nodes;
+
+    nodes_and(nodes, d->node_affinity, node_online_map);
+    if ( nodes_empty(nodes) || nodes_equal(nodes, node_online_map) )
+        return NUMA_NO_NODE;
+
+    return first_node(nodes);
+}
+
 /* rcu_read_lock(&domlist_read_lock) must be held. */
 static struct domain *domid_to_domain(domid_t dom)
 {
-    struct domain *d;
+    struct domain **leaf;
 
-    for ( d = rcu_dereference(domain_hash[DOMAIN_HASH(dom)]);
-          d != NULL;
-          d = rcu_dereference(d->next_in_hashbucket) )
-    {
-        if ( d->domain_id == dom )
-            return d;
-    }
+    if ( dom > DOMID_MASK )
+        return NULL;
 
-    return NULL;
+    leaf = rcu_dereference(domid_table[dom / DOMID_TABLE_LEAF_ENTRIES]);
+
+    return leaf ? rcu_dereference(leaf[dom % DOMID_TABLE_LEAF_ENTRIES])
+                : NULL;
 }
 
 struct domain *get_domain_by_id(domid_t dom)
@@ -968,8 +1052,8 @@ int domain_kill(struct domain *d)
         /* Mem event cleanup has to go here because the rings 
          * have to be put before we call put_domain. */
         vm_event_cleanup(d);
+        domain_changed_state(d->domain_id);
         put_domain(d);
-        send_global_virq(VIRQ_DOM_EXC);
         /* fallthrough */
     case DOMDYING_dead:
         break;
@@ -1101,6 +1185,7 @@ static void cf_check complete_domain_destroy(struct rcu_head *head)
 {
     struct domain *d = container_of(head, struct domain, rcu);
     struct vcpu *v;
+    domid_t domid;
     int i;
 
     /*
@@ -1155,15 +1240,16 @@ static void cf_check complete_domain_destroy(struct rcu_head *head)
 
     xfree(d->vcpu);
 
+    domid = d->domain_id;
     _domain_destroy(d);
 
-    send_global_virq(VIRQ_DOM_EXC);
+    domain_changed_state(domid);
 }
 
 /* Release resources belonging to task @p. */
 void domain_destroy(struct domain *d)
 {
-    struct domain **pd;
+    struct domain **pd, **leaf;
 
     BUG_ON(!d->is_dying);
 
@@ -1173,16 +1259,14 @@ void domain_destroy(struct domain *d)
 
     TRACE_1D(TRC_DOM0_DOM_REM, d->domain_id);
 
-    /* Delete from task list and task hashtable. */
+    /* Delete from task list and domid table. */
     spin_lock(&domlist_update_lock);
     pd = &domain_list;
     while ( *pd != d ) 
         pd = &(*pd)->next_in_list;
     rcu_assign_pointer(*pd, d->next_in_list);
-    pd = &domain_hash[DOMAIN_HASH(d->domain_id)];
-    while ( *pd != d ) 
-        pd = &(*pd)->next_in_hashbucket;
-    rcu_assign_pointer(*pd, d->next_in_hashbucket);
+    leaf = domid_table[d->domain_id / DOMID_TABLE_LEAF_ENTRIES];
+    rcu_assign_pointer(leaf[d->domain_id % DOMID_TABLE_LEAF_ENTRIES], NULL);
     spin_unlock(&domlist_update_lock);
 
     /* Schedule RCU asynchronous completion of domain destroy. */
@@ -1277,13 +1361,26 @@ void domain_pause_nosync(struct domain *d)
 
 void domain_unpause(struct domain *d)
 {
-    struct vcpu *v;
+    struct vcpu *v, *woken[VCPU_WAKE_BATCH];
+    unsigned int nr = 0;
 
     arch_domain_unpause(d);
 
-    if ( atomic_dec_and_test(&d->pause_count) )
-        for_each_vcpu( d, v )
-            vcpu_wake(v);
+    if ( !atomic_dec_and_test(&d->pause_count) )
+        return;
+
+    for_each_vcpu( d, v )
+    {
+        woken[nr++] = v;
+        if ( nr == ARRAY_SIZE(woken) )
+        {
+            vcpu_wake_batch(woken, nr);
+            nr = 0;
+        }
+    }
+
+    if ( nr )
+        vcpu_wake_batch(woken, nr);
 }
 
 static int _domain_pause_by_systemcontroller(struct domain *d, bool sync)
@@ -32,7 +32,12 @@
 #include <public/domctl.h>
 #include <xsm/xsm.h>
 
-static DEFINE_SPINLOCK(domctl_lock);
+/*
+ * Domctls acting on a single domain hold this for reading plus that
+ * domain's domctl_lock, so those on different domains run in parallel.
+ * All others hold it for writing.
+ */
+static DEFINE_RWLOCK(domctl_lock);
 
 static int nodemask_to_xenctl_bitmap(struct xenctl_bitmap *xenctl_nodemap,
                                      const nodemask_t *nodemask)
@@ -126,33 +131,110 @@ void getdomaininfo(struct domain *d, struct xen_domctl_getdomaininfo *info)
     arch_get_domain_info(d, info);
 }
 
-bool_t domctl_lock_acquire(void)
+/*
+ * Serialise against other domctls: only those acting on @d if it is
+ * non-NULL, all of them otherwise.  The same @d needs passing to
+ * domctl_lock_release().
+ */
+bool domctl_lock_acquire(struct domain *d)
 {
     /*
      * Caller may try to pause its own VCPUs. We must prevent deadlock
-     * against other non-domctl routines which try to do the same.
+     * against other non-domctl routines which try to do the same.  A caller
+     * acting on another single domain only pauses that one's vCPUs, and
+     * doesn't need this.
      */
-    if ( !spin_trylock(&current->domain->hypercall_deadlock_mutex) )
-        return 0;
+    if ( d == current->domain )
+        d = NULL;
+    if ( !d && !spin_trylock(&current->domain->hypercall_deadlock_mutex) )
+        return false;
 
     /*
      * Trylock here is paranoia if we have multiple privileged domains. Then
      * we could have one domain trying to pause another which is spinning
      * on domctl_lock -- results in deadlock.
      */
-    if ( spin_trylock(&domctl_lock) )
-        return 1;
+    if ( !d )
+    {
+        if ( write_trylock(&domctl_lock) )
+            return true;
+    }
+    else if ( read_trylock(&domctl_lock) )
+    {
+        if ( spin_trylock(&d->domctl_lock) )
+            return true;
+        read_unlock(&domctl_lock);
+    }
 
-    spin_unlock(&current->domain->hypercall_deadlock_mutex);
-    return 0;
+    if ( !d )
+        spin_unlock(&current->domain->hypercall_deadlock_mutex);
+    return false;
 }
 
-void domctl_lock_release(void)
+void domctl_lock_release(struct domain *d)
 {
-    spin_unlock(&domctl_lock);
+    if ( d == current->domain )
+        d = NULL;
+
+    if ( d )
+    {
+        spin_unlock(&d->domctl_lock);
+        read_unlock(&domctl_lock);
+        return;
+    }
+
+    write_unlock(&domctl_lock);
     spin_unlock(&current->domain->hypercall_deadlock_mutex);
 }
 
+/*
+ * Domctls which only act on the domain they are issued for.  Anything
+ * allocating domain IDs, touching global state (e.g. VIRQ handlers, device
+ * assignment, physical IRQs) or a second domain isn't listed, and remains
+ * fully serialised.  So are operations on a domain's own lifetime.
+ */
+static bool domctl_is_per_domain(const struct xen_domctl *op)
+{
+    switch ( op->cmd )
+    {
+    case XEN_DOMCTL_setvcpucontext:
+    case XEN_DOMCTL_getvcpucontext:
+    case XEN_DOMCTL_pausedomain:
+    case XEN_DOMCTL_unpausedomain:
+    case XEN_DOMCTL_getdomaininfo:
+    case XEN_DOMCTL_getvcpuinfo:
+    case XEN_DOMCTL_setnodeaffinity:
+    case XEN_DOMCTL_getnodeaffinity:
+    case XEN_DOMCTL_setvcpuaffinity:
+    case XEN_DOMCTL_getvcpuaffinity:
+    case XEN_DOMCTL_scheduler_op:
+    case XEN_DOMCTL_max_mem:
+    case XEN_DOMCTL_setdomainhandle:
+    case XEN_DOMCTL_settimeoffset:
+    case XEN_DOMCTL_get_paging_mempool_size:
+    case XEN_DOMCTL_get_node_pages:
+    case XEN_DOMCTL_set_perf_class:
+    case XEN_DOMCTL_set_security_group:
+    case XEN_DOMCTL_shadow_op:
+    case XEN_DOMCTL_gethvmcontext:
+    case XEN_DOMCTL_gethvmcontext_partial:
+    case XEN_DOMCTL_sethvmcontext:
+    case XEN_DOMCTL_settscinfo:
+    case XEN_DOMCTL_gettscinfo:
+    case XEN_DOMCTL_get_cpu_policy:
+    case XEN_DOMCTL_set_cpu_policy:
+    case XEN_DOMCTL_get_ext_vcpucontext:
+    case XEN_DOMCTL_set_ext_vcpucontext:
+    case XEN_DOMCTL_getvcpuextstate:
+    case XEN_DOMCTL_setvcpuextstate:
+    case XEN_DOMCTL_get_vcpu_msrs:
+    case XEN_DOMCTL_set_vcpu_msrs:
+        return true;
+    }
+
+    return false;
+}
+
 void vnuma_destroy(struct vnuma_info *vnuma)
 {
     if ( vnuma )
@@ -283,7 +365,7 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
     long ret = 0;
     bool_t copyback = 0;
     struct xen_domctl curop, *op = &curop;
-    struct domain *d;
+    struct domain *d, *lock_d;
 
     if ( copy_from_guest(op, u_domctl, 1) )
         return -EFAULT;
@@ -293,6 +375,12 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
 
     switch ( op->cmd )
     {
+    case XEN_DOMCTL_get_changed_domain:
+        if ( op->domain != DOMID_INVALID )
+            return -EINVAL;
+        d = NULL;
+        break;
+
     case XEN_DOMCTL_assign_device:
     case XEN_DOMCTL_deassign_device:
         if ( op->domain == DOMID_IO )
@@ -322,7 +410,14 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
     if ( ret )
         goto domctl_out_unlock_domonly;
 
-    if ( !domctl_lock_acquire() )
+    if ( arch_do_domctl_unlocked(op, d, &ret) )
+    {
+        copyback = true;
+        goto domctl_out_unlock_domonly;
+    }
+
+    lock_d = d && d != dom_io && domctl_is_per_domain(op) ? d : NULL;
+    if ( !domctl_lock_acquire(lock_d) )
     {
         if ( d && d != dom_io )
             rcu_unlock_domain(d);
@@ -573,6 +668,16 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
         break;
     }
 
+    case XEN_DOMCTL_get_changed_domain:
+        ret = -EACCES;
+        if ( current->domain != get_global_virq_handler(VIRQ_DOM_EXC) )
+            break;
+
+        op->u.changed_domain.domid = domain_get_changed();
+        ret = 0;
+        copyback = 1;
+        break;
+
     case XEN_DOMCTL_getvcpucontext:
     {
         vcpu_guest_context_u c = { .nat = NULL };
@@ -888,12 +993,71 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
                 __HYPERVISOR_domctl, "h", u_domctl);
         break;
 
+    case XEN_DOMCTL_get_node_pages:
+    {
+        struct xen_domctl_node_pages *np = &op->u.node_pages;
+        unsigned int i, nr_nodes = last_node(node_online_map) + 1;
+        uint64_t pages;
+
+        ret = -EINVAL;
+        if ( np->pad )
+            break;
+
+        ret = -EOPNOTSUPP;
+        if ( !d->node_pages )
+            break;
+
+        ret = 0;
+        if ( !guest_handle_is_null(np->pages) )
+            for ( i = 0; i < min(np->nr_nodes, nr_nodes); i++ )
+            {
+                pages = read_atomic(&d->node_pages[i]);
+                if ( copy_to_guest_offset(np->pages, i, &pages, 1) )
+                {
+                    ret = -EFAULT;
+                    break;
+                }
+            }
+
+        np->nr_nodes = nr_nodes;
+        copyback = 1;
+        break;
+    }
+
+    case XEN_DOMCTL_set_perf_class:
+        ret = -EINVAL;
+        if ( op->u.perf_class.pad ||
+             op->u.perf_class.perf_class > XEN_DOMCTL_PERF_CLASS_background )
+            break;
+
+        write_atomic(&d->perf_class, op->u.perf_class.perf_class);
+        ret = 0;
+        break;
+
+    case XEN_DOMCTL_set_security_group:
+        ret = -EINVAL;
+        if ( op->u.security_group.pad )
+            break;
+
+        /*
+         * Context switch code remembers the group of the domain which last
+         * ran on a pCPU.  Changing it once the domain may have run would
+         * let another domain of the new group skip a needed barrier.
+         */
+        ret = -EBUSY;
+        if ( d->creation_finished )
+            break;
+
+        write_atomic(&d->security_group, op->u.security_group.group);
+        ret = 0;
+        break;
+
     default:
         ret = arch_do_domctl(op, d, u_domctl);
         break;
     }
 
-    domctl_lock_release();
+    domctl_lock_release(lock_d);
 
  domctl_out_unlock_domonly:
     if ( d && d != dom_io )
@@ -1645,10 +1645,14 @@ static __init void copy_mapping(unsigned long mfn, unsigned long end,
 
 static bool __init cf_check ram_range_valid(unsigned long smfn, unsigned long emfn)
 {
-    unsigned long sz = pfn_to_pdx(emfn - 1) / PDX_GROUP_COUNT + 1;
+    unsigned long sz;
 
-    return !(smfn & pfn_hole_mask) &&
-           find_next_bit(pdx_group_valid, sz,
+    if ( !pdx_is_region_compressible(pfn_to_paddr(smfn), emfn - smfn) )
+        return false;
+
+    sz = pfn_to_pdx(emfn - 1) / PDX_GROUP_COUNT + 1;
+
+    return find_next_bit(pdx_group_valid, sz,
                          pfn_to_pdx(smfn) / PDX_GROUP_COUNT) < sz;
 }
 
@@ -1758,9 +1762,8 @@ void __init efi_init_memory(void)
         if ( desc->Attribute & EFI_MEMORY_XP )
             prot |= _PAGE_NX;
 
-        if ( pfn_to_pdx(emfn - 1) < (DIRECTMAP_SIZE >> PAGE_SHIFT) &&
-             !(smfn & pfn_hole_mask) &&
-             !((smfn ^ (emfn - 1)) & ~pfn_pdx_bottom_mask) )
+        if ( pdx_is_region_compressible(pfn_to_paddr(smfn), emfn - smfn) &&
+             pfn_to_pdx(emfn - 1) < (DIRECTMAP_SIZE >> PAGE_SHIFT) )
         {
             if ( (unsigned long)mfn_to_virt(emfn - 1) >= HYPERVISOR_VIRT_END )
                 prot &= ~_PAGE_GLOBAL;
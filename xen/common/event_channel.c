@@ -284,6 +284,101 @@ static void check_free_port(struct domain *d, evtchn_port_t port)
         write_atomic(&d->active_evtchns, d->active_evtchns - 1);
 }
 
+/*
+ * Moderation of the notifications raised on a port.  Once an event has been
+ * delivered, further ones are held back until the interval has passed (or
+ * enough of them have accumulated), and then get delivered as one.
+ */
+struct evtchn_moderation {
+    spinlock_t lock;
+    struct timer timer;
+    struct domain *d;
+    struct evtchn *chn;
+    s_time_t interval;     /* 0: moderation is off. */
+    unsigned int count;    /* Deliver once this many are held back. */
+    unsigned int held;     /* # of events held back. */
+    s_time_t last;         /* Time of the last delivery. */
+};
+
+/* Upper bound for the interval, 1s. */
+#define EVTCHN_MODERATION_MAX_US 1000000
+
+bool evtchn_moderate(struct evtchn *evtchn)
+{
+    struct evtchn_moderation *mod = evtchn->moderation;
+    s_time_t now = NOW();
+    unsigned long flags;
+    bool hold = false;
+
+    spin_lock_irqsave(&mod->lock, flags);
+
+    if ( mod->interval && now < mod->last + mod->interval &&
+         (!mod->count || mod->held + 1 < mod->count) )
+    {
+        if ( !mod->held++ )
+            set_timer(&mod->timer, mod->last + mod->interval);
+        hold = true;
+    }
+    else
+    {
+        if ( mod->held )
+        {
+            mod->held = 0;
+            stop_timer(&mod->timer);
+        }
+        mod->last = now;
+    }
+
+    spin_unlock_irqrestore(&mod->lock, flags);
+
+    return hold;
+}
+
+static void cf_check evtchn_moderation_timer(void *data)
+{
+    struct evtchn_moderation *mod = data;
+    struct evtchn *chn = mod->chn;
+    struct domain *d = mod->d;
+    unsigned long flags;
+    bool deliver;
+
+    /*
+     * The port may be in the process of being closed, with evtchn_free()
+     * waiting for us in kill_timer().  Don't spin on the lock, try again
+     * later instead.
+     */
+    if ( !evtchn_read_trylock(chn) )
+    {
+        set_timer(&mod->timer, NOW() + MICROSECS(10));
+        return;
+    }
+
+    spin_lock_irqsave(&mod->lock, flags);
+    deliver = mod->held;
+    mod->held = 0;
+    mod->last = NOW();
+    spin_unlock_irqrestore(&mod->lock, flags);
+
+    /* Bypass moderation, which would hold the event back again. */
+    if ( deliver && chn->state == ECS_INTERDOMAIN && evtchn_usable(chn) )
+        d->evtchn_port_ops->set_pending(d->vcpu[chn->notify_vcpu_id], chn);
+
+    evtchn_read_unlock(chn);
+}
+
+/* Called with the port locked for writing, so no-one is using it. */
+static void evtchn_moderation_free(struct evtchn *chn)
+{
+    struct evtchn_moderation *mod = chn->moderation;
+
+    if ( !mod )
+        return;
+
+    chn->moderation = NULL;
+    kill_timer(&mod->timer);
+    xfree(mod);
+}
+
 void evtchn_free(struct domain *d, struct evtchn *chn)
 {
     /* Clear pending event to avoid unexpected behavior on re-bind. */
@@ -297,6 +392,8 @@ void evtchn_free(struct domain *d, struct evtchn *chn)
     }
     write_atomic(&d->active_evtchns, d->active_evtchns - 1);
 
+    evtchn_moderation_free(chn);
+
     /* Reset binding to vcpu0 when the channel is freed. */
     chn->state          = ECS_FREE;
     chn->notify_vcpu_id = 0;
@@ -831,6 +928,52 @@ out:
     return ret;
 }
 
+/*
+ * Ports are copied from the guest in chunks of this size, and preemption is
+ * checked for between chunks.
+ */
+#define SEND_BATCH_CHUNK 32
+
+static int evtchn_send_batch(struct domain *ld,
+                             struct evtchn_send_batch *batch,
+                             XEN_GUEST_HANDLE_PARAM(void) arg)
+{
+    evtchn_port_t ports[SEND_BATCH_CHUNK];
+    unsigned int i, n;
+    size_t ports_off = offsetof(struct evtchn_send_batch, ports) /
+                       sizeof(ports[0]);
+    int rc;
+
+    if ( batch->done > batch->nr_ports )
+        return -EINVAL;
+
+    while ( batch->done < batch->nr_ports )
+    {
+        n = min(batch->nr_ports - batch->done, SEND_BATCH_CHUNK + 0U);
+
+        if ( copy_from_guest_offset(ports, arg, ports_off + batch->done, n) )
+            return -EFAULT;
+
+        /*
+         * There's no need to group notifications per target vCPU: once the
+         * first one has set evtchn_upcall_pending, vcpu_mark_events_pending()
+         * doesn't kick the vCPU again for the others.
+         */
+        for ( i = 0; i < n; i++ )
+        {
+            rc = evtchn_send(ld, ports[i]);
+            if ( rc )
+                return rc;
+            batch->done++;
+        }
+
+        if ( batch->done < batch->nr_ports && hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
 bool evtchn_virq_enabled(const struct vcpu *v, unsigned int virq)
 {
     if ( !v )
@@ -931,11 +1074,16 @@ static struct domain *global_virq_handlers[NR_VIRQS] __read_mostly;
 
 static DEFINE_SPINLOCK(global_virq_handlers_lock);
 
-void send_global_virq(uint32_t virq)
+struct domain *get_global_virq_handler(uint32_t virq)
 {
     ASSERT(virq_is_global(virq));
 
-    send_guest_global_virq(global_virq_handlers[virq] ?: hardware_domain, virq);
+    return global_virq_handlers[virq] ?: hardware_domain;
+}
+
+void send_global_virq(uint32_t virq)
+{
+    send_guest_global_virq(get_global_virq_handler(virq), virq);
 }
 
 int set_global_virq_handler(struct domain *d, uint32_t virq)
@@ -1222,6 +1370,84 @@ static int evtchn_set_priority(const struct evtchn_set_priority *set_priority)
     return ret;
 }
 
+static int evtchn_set_moderation(const struct evtchn_set_moderation *set)
+{
+    struct domain *d = current->domain;
+    struct evtchn *chn = _evtchn_from_port(d, set->port);
+    struct evtchn_moderation *mod, *new = NULL;
+    unsigned long flags;
+    bool deliver = false;
+    int rc = 0;
+
+    if ( !chn || set->interval_us > EVTCHN_MODERATION_MAX_US )
+        return -EINVAL;
+
+    if ( set->interval_us && !chn->moderation )
+    {
+        new = xzalloc(struct evtchn_moderation);
+        if ( !new )
+            return -ENOMEM;
+
+        spin_lock_init(&new->lock);
+        init_timer(&new->timer, evtchn_moderation_timer, new,
+                   smp_processor_id());
+        new->d = d;
+        new->chn = chn;
+    }
+
+    /* The event lock serialises against other callers and closing. */
+    write_lock(&d->event_lock);
+    evtchn_read_lock(chn);
+
+    if ( chn->state != ECS_INTERDOMAIN )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    mod = chn->moderation;
+    if ( !mod )
+    {
+        if ( !new )
+            goto out;
+
+        mod = new;
+        new = NULL;
+        mod->interval = MICROSECS(set->interval_us);
+        mod->count = set->count;
+        /* Initialise before publishing, senders don't take the event lock. */
+        smp_wmb();
+        chn->moderation = mod;
+        goto out;
+    }
+
+    spin_lock_irqsave(&mod->lock, flags);
+    mod->interval = MICROSECS(set->interval_us);
+    mod->count = set->count;
+    if ( !mod->interval && mod->held )
+    {
+        mod->held = 0;
+        stop_timer(&mod->timer);
+        deliver = true;
+    }
+    spin_unlock_irqrestore(&mod->lock, flags);
+
+    if ( deliver )
+        d->evtchn_port_ops->set_pending(d->vcpu[chn->notify_vcpu_id], chn);
+
+ out:
+    evtchn_read_unlock(chn);
+    write_unlock(&d->event_lock);
+
+    if ( new )
+    {
+        kill_timer(&new->timer);
+        xfree(new);
+    }
+
+    return rc;
+}
+
 long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
 {
     int rc;
@@ -1299,6 +1525,19 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_send_batch: {
+        struct evtchn_send_batch batch;
+        if ( copy_from_guest(&batch, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_send_batch(current->domain, &batch, arg);
+        if ( __copy_to_guest(arg, &batch, 1) )
+            rc = -EFAULT;
+        else if ( rc == -ERESTART )
+            rc = hypercall_create_continuation(__HYPERVISOR_event_channel_op,
+                                               "ih", cmd, arg);
+        break;
+    }
+
     case EVTCHNOP_status: {
         struct evtchn_status status;
         if ( copy_from_guest(&status, arg, 1) != 0 )
@@ -1375,6 +1614,14 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_set_moderation: {
+        struct evtchn_set_moderation set_moderation;
+        if ( copy_from_guest(&set_moderation, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_moderation(&set_moderation);
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -1473,14 +1720,18 @@ void notify_via_xen_event_channel(struct domain *ld, int lport)
 
 void evtchn_check_pollers(struct domain *d, unsigned int port)
 {
-    struct vcpu *v;
-    unsigned int vcpuid;
+    struct vcpu *v, *woken[VCPU_WAKE_BATCH];
+    unsigned int vcpuid, nr = 0;
 
     /* Check if some VCPU might be polling for this event. */
     if ( likely(bitmap_empty(d->poll_mask, d->max_vcpus)) )
         return;
 
-    /* Wake any interested (or potentially interested) pollers. */
+    /*
+     * Wake any interested (or potentially interested) pollers. This is
+     * what vcpu_unblock() does, but with the wakeups batched, as there may
+     * be many of them (e.g., with all the vCPUs polling on the same port).
+     */
     for ( vcpuid = find_first_bit(d->poll_mask, d->max_vcpus);
           vcpuid < d->max_vcpus;
           vcpuid = find_next_bit(d->poll_mask, d->max_vcpus, vcpuid+1) )
@@ -1490,9 +1741,20 @@ void evtchn_check_pollers(struct domain *d, unsigned int port)
              test_and_clear_bit(vcpuid, d->poll_mask) )
         {
             v->poll_evtchn = 0;
-            vcpu_unblock(v);
+            if ( !test_and_clear_bit(_VPF_blocked, &v->pause_flags) )
+                continue;
+
+            woken[nr++] = v;
+            if ( nr == ARRAY_SIZE(woken) )
+            {
+                vcpu_wake_batch(woken, nr);
+                nr = 0;
+            }
         }
     }
+
+    if ( nr )
+        vcpu_wake_batch(woken, nr);
 }
 
 int evtchn_init(struct domain *d, unsigned int max_port)
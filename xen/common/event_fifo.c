@@ -169,6 +169,7 @@ static void cf_check evtchn_fifo_set_pending(
     struct evtchn_fifo_queue *q, *old_q;
     unsigned int try;
     bool linked = true;
+    event_word_t w;
 
     port = evtchn->port;
     word = evtchn_fifo_word_from_port(d, port);
@@ -183,6 +184,21 @@ static void cf_check evtchn_fifo_set_pending(
         return;
     }
 
+    /*
+     * An event which is already PENDING, and either LINKED or MASKED, needs
+     * neither linking nor a notification: the locked path below would leave
+     * everything as is.  This is the common case for a busy channel with many
+     * senders, so don't contend on the queue locks for it.
+     *
+     * Only Xen sets PENDING and LINKED, and the guest clearing either of them
+     * afterwards means it is going to look at the event, so acting on a
+     * single snapshot of the word is fine.
+     */
+    w = read_atomic(word);
+    if ( (w & (1 << EVTCHN_FIFO_PENDING)) &&
+         (w & ((1 << EVTCHN_FIFO_LINKED) | (1 << EVTCHN_FIFO_MASKED))) )
+        return;
+
     /*
      * Lock all queues related to the event channel (in case of a queue change
      * this might be two).
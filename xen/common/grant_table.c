@@ -39,9 +39,12 @@
 #include <xen/paging.h>
 #include <xen/keyhandler.h>
 #include <xen/radix-tree.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
 #include <xen/vmap.h>
 #include <xen/nospec.h>
 #include <xsm/xsm.h>
+#include <public/sysctl.h>
 #include <asm/flushtlb.h>
 #include <asm/guest_atomics.h>
 
@@ -49,6 +52,13 @@
 #include <asm/guest.h>
 #endif
 
+struct gnttab_map_cache_entry {
+    grant_handle_t   handle;
+    s_time_t         expires;
+    struct list_head lru;   /* On map_cache_lru (oldest first) or _free. */
+    struct list_head hash;  /* On the map_cache_hash[] bucket of the key. */
+};
+
 /* Per-domain grant information. */
 struct grant_table {
     /*
@@ -96,6 +106,26 @@ struct grant_table {
      * protected by @lock, not @maptrack_lock.
      */
     struct radix_tree_root maptrack_tree;
+    /*
+     * Statistics: maptrack frames allocated ahead of a vCPU's free list
+     * running dry (protected by @maptrack_lock), and entries stolen from
+     * other vCPUs.
+     */
+    unsigned int          maptrack_prefetched;
+    atomic_t              maptrack_stolen;
+    /*
+     * Recently unmapped host mappings of foreign grants (see
+     * gnttab_map_cache_put()), hashed by (domid, ref) for lookup.  Only
+     * allocated if opt_gnttab_map_cache is non-zero.
+     */
+    struct gnttab_map_cache_entry *map_cache;
+    struct list_head     *map_cache_hash;
+    struct list_head      map_cache_lru;
+    struct list_head      map_cache_free;
+    unsigned int          map_cache_nr;
+    spinlock_t            map_cache_lock;
+    struct timer          map_cache_timer;
+    struct tasklet        map_cache_tasklet;
 
     /* Domain to which this struct grant_table belongs. */
     struct domain *domain;
@@ -189,6 +219,9 @@ static bool __ro_after_init opt_grant_transfer = true;
 #else
 #define opt_grant_transfer false
 #endif
+static unsigned int __ro_after_init opt_gnttab_map_cache;
+#define GNTTAB_MAP_CACHE_MAX 1024
+#define GNTTAB_MAP_CACHE_BUCKETS 64
 
 static int __init cf_check parse_gnttab(const char *s)
 {
@@ -210,6 +243,15 @@ static int __init cf_check parse_gnttab(const char *s)
             else
                 rc = -EINVAL;
         }
+        else if ( !strncmp(s, "map-cache:", 10) )
+        {
+            unsigned long nr = simple_strtoul(s + 10, &e, 10);
+
+            if ( e == ss && nr <= GNTTAB_MAP_CACHE_MAX )
+                opt_gnttab_map_cache = nr;
+            else
+                rc = -EINVAL;
+        }
         else if ( (val = parse_boolean("transitive", s, ss)) >= 0 )
             opt_transitive_grants = val;
 #ifndef opt_grant_transfer
@@ -255,12 +297,15 @@ struct gnttab_unmap_common {
     uint64_t dev_bus_addr;
     uint64_t new_addr;
     grant_handle_t handle;
+    struct domain *ld;
+    bool evict;             /* Drop a cached mapping. */
 
     /* Return */
     int16_t status;
 
     /* Shared state beteen *_unmap and *_unmap_complete */
     uint16_t done;
+    bool cached;            /* Mapping to be put in the cache. */
     mfn_t mfn;
     struct domain *rd;
     grant_ref_t ref;
@@ -269,6 +314,9 @@ struct gnttab_unmap_common {
 /* Number of unmap operations that are done between each tlb flush */
 #define GNTTAB_UNMAP_BATCH_SIZE 32
 
+/* Number of map operations copied from the guest in one go */
+#define GNTTAB_MAP_BATCH_SIZE 32
+
 
 #define PIN_FAIL(_lbl, _rc, _f, _a...)          \
     do {                                        \
@@ -314,6 +362,9 @@ nr_maptrack_frames(struct grant_table *t)
 
 #define MAPTRACK_TAIL (~0u)
 
+/* Maptrack entry flag (beyond GNTMAP_*) marking a cached mapping. */
+#define MAPTRACK_CACHED (1u << 15)
+
 #define SHGNT_PER_PAGE_V1 (PAGE_SIZE / sizeof(grant_entry_v1_t))
 #define shared_entry_v1(t, e) \
     ((t)->shared_v1[(e)/SHGNT_PER_PAGE_V1][(e)%SHGNT_PER_PAGE_V1])
@@ -560,13 +611,50 @@ _get_maptrack_handle(struct grant_table *t, struct vcpu *v)
     if ( unlikely(next == MAPTRACK_TAIL) )
         head = INVALID_MAPTRACK_HANDLE;
     else
+    {
         v->maptrack_head = next;
+        v->maptrack_free--;
+    }
 
     spin_unlock(&v->maptrack_freelist_lock);
 
     return head;
 }
 
+/*
+ * Take up to nr free maptrack entries of a VCPU in one go, keeping the last
+ * one on the list as _get_maptrack_handle() does.  Returns the number of
+ * handles obtained.
+ */
+static unsigned int
+_get_maptrack_handles(struct grant_table *t, struct vcpu *v,
+                      grant_handle_t *handles, unsigned int nr)
+{
+    unsigned int head, next, i = 0;
+
+    spin_lock(&v->maptrack_freelist_lock);
+
+    head = v->maptrack_head;
+    if ( likely(head != MAPTRACK_TAIL) )
+    {
+        for ( ; i < nr; i++ )
+        {
+            next = maptrack_entry(t, head).ref;
+            if ( next == MAPTRACK_TAIL )
+                break;
+            handles[i] = head;
+            head = next;
+        }
+
+        v->maptrack_head = head;
+        v->maptrack_free -= i;
+    }
+
+    spin_unlock(&v->maptrack_freelist_lock);
+
+    return i;
+}
+
 /*
  * Try to "steal" a free maptrack entry from another VCPU.
  *
@@ -595,6 +683,7 @@ static grant_handle_t steal_maptrack_handle(struct grant_table *t,
             if ( handle != INVALID_MAPTRACK_HANDLE )
             {
                 maptrack_entry(t, handle).vcpu = curr->vcpu_id;
+                atomic_inc(&t->maptrack_stolen);
                 return handle;
             }
         }
@@ -612,7 +701,6 @@ static inline void
 put_maptrack_handle(
     struct grant_table *t, grant_handle_t handle)
 {
-    struct domain *currd = current->domain;
     struct vcpu *v;
     unsigned int tail;
 
@@ -620,12 +708,13 @@ put_maptrack_handle(
     maptrack_entry(t, handle).ref = MAPTRACK_TAIL;
 
     /* 2. Add entry to the tail of the list on the original VCPU. */
-    v = currd->vcpu[maptrack_entry(t, handle).vcpu];
+    v = t->domain->vcpu[maptrack_entry(t, handle).vcpu];
 
     spin_lock(&v->maptrack_freelist_lock);
 
     tail = v->maptrack_tail;
     v->maptrack_tail = handle;
+    v->maptrack_free++;
 
     /* 3. Update the old tail entry to point to the new entry. */
     maptrack_entry(t, tail).ref = handle;
@@ -633,59 +722,33 @@ put_maptrack_handle(
     spin_unlock(&v->maptrack_freelist_lock);
 }
 
-static inline grant_handle_t
-get_maptrack_handle(
-    struct grant_table *lgt)
+/*
+ * Allocate another maptrack frame, from the memory of curr's NUMA node, and
+ * add its entries to curr's free list.  If @handlep is non-NULL, the first
+ * new entry is handed back there instead.  Returns false if there's no
+ * frame headroom left or no memory.
+ */
+static bool
+grow_maptrack(
+    struct grant_table *lgt, struct vcpu *curr, grant_handle_t *handlep)
 {
-    struct vcpu          *curr = current;
-    unsigned int          i;
+    unsigned int          i, nr = MAPTRACK_PER_PAGE;
     grant_handle_t        handle;
     struct grant_mapping *new_mt = NULL;
 
-    handle = _get_maptrack_handle(lgt, curr);
-    if ( likely(handle != INVALID_MAPTRACK_HANDLE) )
-        return handle;
-
     spin_lock(&lgt->maptrack_lock);
 
-    /*
-     * If we've run out of handles and still have frame headroom, try
-     * allocating a new maptrack frame.  If there is no headroom, or we're
-     * out of memory, try stealing an entry from another VCPU (in case the
-     * guest isn't mapping across its VCPUs evenly).
-     */
     if ( nr_maptrack_frames(lgt) < lgt->max_maptrack_frames )
-        new_mt = alloc_xenheap_page();
+        new_mt = alloc_xenheap_pages(0, MEMF_node(vcpu_to_node(curr)));
 
     if ( !new_mt )
     {
         spin_unlock(&lgt->maptrack_lock);
-
-        /*
-         * Uninitialized free list? Steal an extra entry for the tail
-         * sentinel.
-         */
-        if ( curr->maptrack_tail == MAPTRACK_TAIL )
-        {
-            handle = steal_maptrack_handle(lgt, curr);
-            if ( handle == INVALID_MAPTRACK_HANDLE )
-                return handle;
-            spin_lock(&curr->maptrack_freelist_lock);
-            maptrack_entry(lgt, handle).ref = MAPTRACK_TAIL;
-            curr->maptrack_tail = handle;
-            if ( curr->maptrack_head == MAPTRACK_TAIL )
-                curr->maptrack_head = handle;
-            spin_unlock(&curr->maptrack_freelist_lock);
-        }
-        return steal_maptrack_handle(lgt, curr);
+        return false;
     }
 
     clear_page(new_mt);
 
-    /*
-     * Use the first new entry and add the remaining entries to the
-     * head of the free list.
-     */
     handle = lgt->maptrack_limit;
 
     for ( i = 0; i < MAPTRACK_PER_PAGE; i++ )
@@ -702,15 +765,88 @@ get_maptrack_handle(
     lgt->maptrack[nr_maptrack_frames(lgt)] = new_mt;
     smp_wmb();
     lgt->maptrack_limit += MAPTRACK_PER_PAGE;
+    if ( !handlep )
+        lgt->maptrack_prefetched++;
 
     spin_unlock(&lgt->maptrack_lock);
 
+    /* Use the first new entry if asked to. */
+    if ( handlep )
+    {
+        *handlep = handle++;
+        nr--;
+    }
+
+    /* Add the (remaining) entries to the head of the free list. */
     spin_lock(&curr->maptrack_freelist_lock);
-    new_mt[i - 1].ref = curr->maptrack_head;
-    curr->maptrack_head = handle + 1;
+    new_mt[MAPTRACK_PER_PAGE - 1].ref = curr->maptrack_head;
+    curr->maptrack_head = handle;
+    curr->maptrack_free += nr;
     spin_unlock(&curr->maptrack_freelist_lock);
 
-    return handle;
+    return true;
+}
+
+/*
+ * Below this many free entries, a vCPU's free list gets grown right away,
+ * rather than when running dry.  This keeps both the slow path of
+ * get_maptrack_handle() and stealing from other vCPUs off the map path as
+ * long as there's frame headroom.
+ */
+#define MAPTRACK_LOW_WATER (MAPTRACK_PER_PAGE / 4)
+
+static void
+prefetch_maptrack(
+    struct grant_table *lgt, struct vcpu *curr)
+{
+    if ( unlikely(read_atomic(&curr->maptrack_free) < MAPTRACK_LOW_WATER) &&
+         curr->maptrack_tail != MAPTRACK_TAIL &&
+         nr_maptrack_frames(lgt) < lgt->max_maptrack_frames )
+        grow_maptrack(lgt, curr, NULL);
+}
+
+static inline grant_handle_t
+get_maptrack_handle(
+    struct grant_table *lgt)
+{
+    struct vcpu          *curr = current;
+    grant_handle_t        handle;
+
+    handle = _get_maptrack_handle(lgt, curr);
+    if ( likely(handle != INVALID_MAPTRACK_HANDLE) )
+    {
+        prefetch_maptrack(lgt, curr);
+        return handle;
+    }
+
+    /*
+     * If we've run out of handles and still have frame headroom, try
+     * allocating a new maptrack frame.  If there is no headroom, or we're
+     * out of memory, try stealing an entry from another VCPU (in case the
+     * guest isn't mapping across its VCPUs evenly).
+     */
+    if ( grow_maptrack(lgt, curr, &handle) )
+        return handle;
+
+    /*
+     * Uninitialized free list? Steal an extra entry for the tail
+     * sentinel.
+     */
+    if ( curr->maptrack_tail == MAPTRACK_TAIL )
+    {
+        handle = steal_maptrack_handle(lgt, curr);
+        if ( handle == INVALID_MAPTRACK_HANDLE )
+            return handle;
+        spin_lock(&curr->maptrack_freelist_lock);
+        maptrack_entry(lgt, handle).ref = MAPTRACK_TAIL;
+        curr->maptrack_tail = handle;
+        if ( curr->maptrack_head == MAPTRACK_TAIL )
+            curr->maptrack_head = handle;
+        curr->maptrack_free++;
+        spin_unlock(&curr->maptrack_freelist_lock);
+    }
+
+    return steal_maptrack_handle(lgt, curr);
 }
 
 /* Number of grant table entries. Caller must hold d's grant table lock. */
@@ -976,11 +1112,241 @@ union maptrack_node {
     unsigned long raw;
 };
 
+/*
+ * Cache of recently unmapped host mappings of foreign grants.
+ *
+ * Backends mapping and unmapping the same grants over and over (e.g. for
+ * frontends recycling a fixed pool of pages) pay for pinning the grant,
+ * taking the page references and, for PV, updating the IOMMU every time.
+ * With the cache enabled, unmapping a host-only mapping removes just the
+ * mapping itself.  The maptrack entry (flagged MAPTRACK_CACHED, so the guest
+ * can't use its handle anymore), the pin, the page references and any IOMMU
+ * mapping are kept, and a later request to map the same grant with the same
+ * access only needs to re-create the host mapping.
+ *
+ * While cached, the grant stays pinned, i.e. the granting domain can't
+ * revoke it.  Entries are therefore dropped once they've been in the cache
+ * for GNTTAB_MAP_CACHE_TTL, when the cache overflows, and when they're found
+ * to have been revoked (with v2 the granter clears the entry's flags before
+ * checking its status) or their domain to be dying.
+ *
+ * Entries are added only after the TLB flush completing their unmap, and
+ * belong to whoever took them out of the cache.
+ */
+#define GNTTAB_MAP_CACHE_TTL MILLISECS(100)
+
+static void unmap_common(struct gnttab_unmap_common *op);
+static void unmap_common_complete(struct gnttab_unmap_common *op);
+
+static void gnttab_map_cache_evict(struct domain *ld, grant_handle_t handle)
+{
+    struct gnttab_unmap_common op = {
+        .handle = handle,
+        .ld = ld,
+        .evict = true,
+        .mfn = INVALID_MFN,
+    };
+
+    unmap_common(&op);
+    /* Completing the eviction may release the page: no deferred flush. */
+    iommu_iotlb_batch_flush();
+    unmap_common_complete(&op);
+}
+
+/* May a cached mapping of @ref be (re-)used, i.e. is it still granted? */
+static bool gnttab_map_cache_valid(struct grant_table *rgt, grant_ref_t ref,
+                                   const struct domain *ld, bool readonly)
+{
+    const grant_entry_header_t *sha = shared_entry_header(rgt, ref);
+    uint16_t flags = ACCESS_ONCE(sha->flags);
+
+    return (flags & (GTF_type_mask | GTF_sub_page)) == GTF_permit_access &&
+           (readonly || !(flags & GTF_readonly)) &&
+           ACCESS_ONCE(sha->domid) == ld->domain_id;
+}
+
+static struct list_head *gnttab_map_cache_bucket(struct grant_table *lgt,
+                                                 domid_t domid,
+                                                 grant_ref_t ref)
+{
+    return &lgt->map_cache_hash[(ref ^ (domid * 0x9e37U)) &
+                                (GNTTAB_MAP_CACHE_BUCKETS - 1)];
+}
+
+/* Remove @e from the cache, returning the handle it held. */
+static grant_handle_t gnttab_map_cache_del(struct grant_table *lgt,
+                                           struct gnttab_map_cache_entry *e)
+{
+    ASSERT(spin_is_locked(&lgt->map_cache_lock));
+
+    list_del(&e->hash);
+    list_move(&e->lru, &lgt->map_cache_free);
+    --lgt->map_cache_nr;
+
+    return e->handle;
+}
+
+static struct gnttab_map_cache_entry *
+gnttab_map_cache_oldest(struct grant_table *lgt)
+{
+    return list_first_entry_or_null(&lgt->map_cache_lru,
+                                    struct gnttab_map_cache_entry, lru);
+}
+
+/* Add a mapping to the cache, evicting the oldest one if it's full. */
+static void gnttab_map_cache_put(struct domain *ld, grant_handle_t handle)
+{
+    struct grant_table *lgt = ld->grant_table;
+    const struct grant_mapping *mt = &maptrack_entry(lgt, handle);
+    grant_handle_t old = INVALID_MAPTRACK_HANDLE;
+    s_time_t expires = NOW() + GNTTAB_MAP_CACHE_TTL;
+    struct gnttab_map_cache_entry *e;
+
+    spin_lock(&lgt->map_cache_lock);
+
+    if ( lgt->map_cache_nr == opt_gnttab_map_cache )
+        old = gnttab_map_cache_del(lgt, gnttab_map_cache_oldest(lgt));
+
+    if ( !lgt->map_cache_nr )
+        set_timer(&lgt->map_cache_timer, expires);
+
+    e = list_first_entry(&lgt->map_cache_free,
+                         struct gnttab_map_cache_entry, lru);
+    e->handle = handle;
+    e->expires = expires;
+    list_move_tail(&e->lru, &lgt->map_cache_lru);
+    list_add(&e->hash, gnttab_map_cache_bucket(lgt, mt->domid, mt->ref));
+    ++lgt->map_cache_nr;
+
+    spin_unlock(&lgt->map_cache_lock);
+
+    if ( old != INVALID_MAPTRACK_HANDLE )
+        gnttab_map_cache_evict(ld, old);
+}
+
+/* Take a cached mapping of (@domid, @ref) out of the cache, if any. */
+static grant_handle_t gnttab_map_cache_take(struct grant_table *lgt,
+                                            domid_t domid, grant_ref_t ref,
+                                            bool readonly)
+{
+    grant_handle_t handle = INVALID_MAPTRACK_HANDLE;
+    struct gnttab_map_cache_entry *e;
+
+    spin_lock(&lgt->map_cache_lock);
+
+    list_for_each_entry ( e, gnttab_map_cache_bucket(lgt, domid, ref), hash )
+    {
+        const struct grant_mapping *mt = &maptrack_entry(lgt, e->handle);
+
+        if ( mt->domid == domid && mt->ref == ref &&
+             !(mt->flags & GNTMAP_readonly) == !readonly )
+        {
+            handle = gnttab_map_cache_del(lgt, e);
+            break;
+        }
+    }
+
+    spin_unlock(&lgt->map_cache_lock);
+
+    return handle;
+}
+
+/*
+ * Try to satisfy a host mapping request from the cache.  Returns true if
+ * @op was dealt with.
+ */
+static bool gnttab_map_cache_hit(struct domain *ld, struct domain *rd,
+                                 struct gnttab_map_grant_ref *op)
+{
+    struct grant_table *lgt = ld->grant_table, *rgt = rd->grant_table;
+    struct active_grant_entry *act;
+    struct grant_mapping *mt;
+    grant_handle_t handle;
+    bool valid;
+    mfn_t mfn;
+
+    handle = gnttab_map_cache_take(lgt, rd->domain_id, op->ref,
+                                   op->flags & GNTMAP_readonly);
+    if ( handle == INVALID_MAPTRACK_HANDLE )
+        return false;
+
+    mt = &maptrack_entry(lgt, handle);
+
+    grant_read_lock(rgt);
+    act = active_entry_acquire(rgt, mt->ref);
+    valid = !rd->is_dying &&
+            gnttab_map_cache_valid(rgt, mt->ref, ld,
+                                   op->flags & GNTMAP_readonly);
+    mfn = act->mfn;
+    active_entry_release(act);
+    grant_read_unlock(rgt);
+
+    if ( !valid ||
+         create_grant_host_mapping(op->host_addr, mfn, op->flags,
+                                   0) != GNTST_okay )
+    {
+        /* Leave it to the normal path to deal with (or fail) the request. */
+        gnttab_map_cache_evict(ld, handle);
+        return false;
+    }
+
+    TRACE_1D(TRC_MEM_PAGE_GRANT_MAP, op->dom);
+
+    write_atomic(&mt->flags, op->flags & ~MAPTRACK_CACHED);
+
+    op->dev_bus_addr = mfn_to_maddr(mfn);
+    op->handle       = handle;
+    op->status       = GNTST_okay;
+
+    return true;
+}
+
+static void cf_check gnttab_map_cache_timer(void *data)
+{
+    struct grant_table *gt = data;
+
+    tasklet_schedule(&gt->map_cache_tasklet);
+}
+
+static void cf_check gnttab_map_cache_expire(void *data)
+{
+    struct grant_table *lgt = data;
+    s_time_t now = NOW();
+
+    for ( ; ; )
+    {
+        grant_handle_t handle = INVALID_MAPTRACK_HANDLE;
+        struct gnttab_map_cache_entry *e;
+
+        spin_lock(&lgt->map_cache_lock);
+
+        e = gnttab_map_cache_oldest(lgt);
+        if ( e && e->expires <= now )
+            handle = gnttab_map_cache_del(lgt, e);
+        else if ( e )
+            set_timer(&lgt->map_cache_timer, e->expires);
+
+        spin_unlock(&lgt->map_cache_lock);
+
+        if ( handle == INVALID_MAPTRACK_HANDLE )
+            break;
+
+        gnttab_map_cache_evict(lgt->domain, handle);
+    }
+}
+
+/*
+ * rd is the (RCU locked) domain named by op->dom, or NULL if there's no such
+ * domain.  *handlep may hold a free maptrack handle to use.  It is set to
+ * INVALID_MAPTRACK_HANDLE if the handle got used, otherwise it is left for
+ * the caller to use for another operation or to put back.
+ */
 static void
 map_grant_ref(
-    struct gnttab_map_grant_ref *op)
+    struct gnttab_map_grant_ref *op, struct domain *rd,
+    grant_handle_t *handlep)
 {
-    struct domain *ld, *rd, *owner = NULL;
+    struct domain *ld, *owner = NULL;
     struct grant_table *lgt, *rgt;
     grant_ref_t ref;
     grant_handle_t handle;
@@ -1019,7 +1385,7 @@ map_grant_ref(
         return;
     }
 
-    if ( unlikely((rd = rcu_lock_domain_by_id(op->dom)) == NULL) )
+    if ( unlikely(!rd) )
     {
         gdprintk(XENLOG_INFO, "Could not find domain %d\n", op->dom);
         op->status = GNTST_bad_domain;
@@ -1029,16 +1395,23 @@ map_grant_ref(
     rc = xsm_grant_mapref(XSM_HOOK, ld, rd, op->flags);
     if ( rc )
     {
-        rcu_unlock_domain(rd);
         op->status = GNTST_permission_denied;
         return;
     }
 
     lgt = ld->grant_table;
-    handle = get_maptrack_handle(lgt);
+
+    if ( lgt->map_cache && ld != rd &&
+         (op->flags & (GNTMAP_host_map | GNTMAP_device_map)) ==
+         GNTMAP_host_map &&
+         gnttab_map_cache_hit(ld, rd, op) )
+        return;
+
+    if ( *handlep == INVALID_MAPTRACK_HANDLE )
+        *handlep = get_maptrack_handle(lgt);
+    handle = *handlep;
     if ( unlikely(handle == INVALID_MAPTRACK_HANDLE) )
     {
-        rcu_unlock_domain(rd);
         gdprintk(XENLOG_INFO, "Failed to obtain maptrack handle\n");
         op->status = GNTST_no_space;
         return;
@@ -1294,13 +1667,13 @@ map_grant_ref(
     mt->domid = op->dom;
     mt->ref   = op->ref;
     smp_wmb();
-    write_atomic(&mt->flags, op->flags);
+    write_atomic(&mt->flags, op->flags & ~MAPTRACK_CACHED);
 
     op->dev_bus_addr = mfn_to_maddr(mfn);
     op->handle       = handle;
     op->status       = GNTST_okay;
 
-    rcu_unlock_domain(rd);
+    *handlep = INVALID_MAPTRACK_HANDLE;
     return;
 
  undo_out:
@@ -1330,32 +1703,90 @@ map_grant_ref(
  unlock_out:
     grant_read_unlock(rgt);
     op->status = rc;
-    put_maptrack_handle(lgt, handle);
-    rcu_unlock_domain(rd);
 }
 
+/*
+ * Operations are copied in and out in batches.  The maptrack handles for a
+ * batch are taken off the local free list in one go, and the remote domain
+ * stays locked for as long as consecutive operations name the same one.
+ */
 static long
 gnttab_map_grant_ref(
     XEN_GUEST_HANDLE_PARAM(gnttab_map_grant_ref_t) uop, unsigned int count)
 {
-    int i;
-    struct gnttab_map_grant_ref op;
+    struct gnttab_map_grant_ref ops[GNTTAB_MAP_BATCH_SIZE];
+    grant_handle_t handles[GNTTAB_MAP_BATCH_SIZE];
+    struct grant_table *lgt = current->domain->grant_table;
+    struct domain *rd = NULL;
+    unsigned int i, c, done = 0, nr_handles = 0;
+    long rc = 0;
 
-    for ( i = 0; i < count; i++ )
+    iommu_iotlb_batch_start(current->domain);
+
+    while ( done < count )
     {
-        if ( i && hypercall_preempt_check() )
-            return i;
+        c = min(count - done, (unsigned int)GNTTAB_MAP_BATCH_SIZE);
 
-        if ( unlikely(__copy_from_guest_offset(&op, uop, i, 1)) )
-            return -EFAULT;
+        if ( unlikely(__copy_from_guest_offset(ops, uop, done, c)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
 
-        map_grant_ref(&op);
+        if ( nr_handles < c )
+        {
+            nr_handles += _get_maptrack_handles(lgt, current,
+                                                handles + nr_handles,
+                                                c - nr_handles);
+            prefetch_maptrack(lgt, current);
+        }
 
-        if ( unlikely(__copy_to_guest_offset(uop, i, &op, 1)) )
-            return -EFAULT;
+        for ( i = 0; i < c; i++ )
+        {
+            grant_handle_t handle = INVALID_MAPTRACK_HANDLE;
+
+            if ( (done + i) && hypercall_preempt_check() )
+                break;
+
+            if ( !rd || rd->domain_id != ops[i].dom )
+            {
+                if ( rd )
+                    rcu_unlock_domain(rd);
+                rd = rcu_lock_domain_by_id(ops[i].dom);
+            }
+
+            if ( nr_handles )
+                handle = handles[--nr_handles];
+
+            map_grant_ref(&ops[i], rd, &handle);
+
+            if ( handle != INVALID_MAPTRACK_HANDLE )
+                handles[nr_handles++] = handle;
+        }
+
+        if ( unlikely(__copy_to_guest_offset(uop, done, ops, i)) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        done += i;
+        if ( i < c )
+        {
+            rc = done;
+            break;
+        }
     }
 
-    return 0;
+    while ( nr_handles )
+        put_maptrack_handle(lgt, handles[--nr_handles]);
+
+    if ( rd )
+        rcu_unlock_domain(rd);
+
+    iommu_iotlb_batch_end();
+
+    return rc;
 }
 
 static void
@@ -1372,7 +1803,7 @@ unmap_common(
     unsigned int flags;
     bool put_handle = false;
 
-    ld = current->domain;
+    ld = op->ld;
     lgt = ld->grant_table;
 
     if ( unlikely(op->handle >= lgt->maptrack_limit) )
@@ -1399,7 +1830,14 @@ unmap_common(
     {
         /* This can happen when a grant is implicitly unmapped. */
         gdprintk(XENLOG_INFO, "Could not find domain %d\n", dom);
-        domain_crash(ld); /* naughty... */
+        if ( op->evict )
+        {
+            /* Nothing to clear up, as in gnttab_release_mappings(). */
+            map->flags = 0;
+            put_maptrack_handle(lgt, op->handle);
+        }
+        else
+            domain_crash(ld); /* naughty... */
         return;
     }
 
@@ -1461,6 +1899,15 @@ unmap_common(
         goto act_release_out;
     }
 
+    /* Cached mappings can only be dropped by gnttab_map_cache_evict(). */
+    if ( unlikely(!(flags & MAPTRACK_CACHED) != !op->evict) )
+    {
+        gdprintk(XENLOG_INFO, "Bad d%d handle %#x\n",
+                 lgt->domain->domain_id, op->handle);
+        rc = GNTST_bad_handle;
+        goto act_release_out;
+    }
+
     op->mfn = act->mfn;
 
     if ( op->dev_bus_addr && (flags & GNTMAP_device_map) &&
@@ -1486,11 +1933,35 @@ unmap_common(
         op->done |= GNTMAP_device_map | (flags & GNTMAP_readonly);
     }
 
-    if ( !(map->flags & (GNTMAP_device_map|GNTMAP_host_map)) )
+    if ( unlikely(op->evict) )
     {
+        /* The cached mapping still holds everything a host mapping does. */
         map->flags = 0;
+        op->done = GNTMAP_host_map | (flags & GNTMAP_readonly);
         put_handle = true;
     }
+    else if ( !(map->flags & (GNTMAP_device_map|GNTMAP_host_map)) )
+    {
+        if ( lgt->map_cache && ld != rd && !(flags & GNTMAP_device_map) &&
+             (op->done & GNTMAP_host_map) && !rd->is_dying &&
+             !is_iomem_page(act->mfn) &&
+             gnttab_map_cache_valid(rgt, ref, ld, flags & GNTMAP_readonly) )
+        {
+            /*
+             * Keep the pin, page references and IOMMU mapping, for
+             * unmap_common_complete() to put the mapping in the cache.
+             */
+            map->flags = MAPTRACK_CACHED | GNTMAP_host_map |
+                         (flags & GNTMAP_readonly);
+            op->done = 0;
+            op->cached = true;
+        }
+        else
+        {
+            map->flags = 0;
+            put_handle = true;
+        }
+    }
 
  act_release_out:
     active_entry_release(act);
@@ -1561,14 +2032,21 @@ unmap_common_complete(struct gnttab_unmap_common *op)
     struct page_info *pg;
     uint16_t *status;
 
+    ld = op->ld;
+
+    if ( op->cached )
+    {
+        /* The TLB flush has happened, so the mapping can be re-used. */
+        gnttab_map_cache_put(ld, op->handle);
+        return;
+    }
+
     if ( evaluate_nospec(!op->done) )
     {
         /* unmap_common() didn't do anything - nothing to complete. */
         return;
     }
 
-    ld = current->domain;
-
     rcu_lock_domain(rd);
     rgt = rd->grant_table;
 
@@ -1636,7 +2114,10 @@ unmap_grant_ref(
     common->handle = op->handle;
 
     /* Intialise these in case common contains old state */
+    common->ld = current->domain;
+    common->evict = false;
     common->done = 0;
+    common->cached = false;
     common->new_addr = 0;
     common->rd = NULL;
     common->mfn = INVALID_MFN;
@@ -1659,6 +2140,8 @@ gnttab_unmap_grant_ref(
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
 
+        iommu_iotlb_batch_start(current->domain);
+
         for ( i = 0; i < c; i++ )
         {
             if ( unlikely(__copy_from_guest(&op, uop, 1)) )
@@ -1670,6 +2153,7 @@ gnttab_unmap_grant_ref(
             guest_handle_add_offset(uop, 1);
         }
 
+        iommu_iotlb_batch_end();
         gnttab_flush_tlb(current->domain);
 
         for ( i = 0; i < partial_done; i++ )
@@ -1685,6 +2169,7 @@ gnttab_unmap_grant_ref(
     return 0;
 
 fault:
+    iommu_iotlb_batch_end();
     gnttab_flush_tlb(current->domain);
 
     for ( i = 0; i < partial_done; i++ )
@@ -1702,7 +2187,10 @@ unmap_and_replace(
     common->handle = op->handle;
 
     /* Intialise these in case common contains old state */
+    common->ld = current->domain;
+    common->evict = false;
     common->done = 0;
+    common->cached = false;
     common->dev_bus_addr = 0;
     common->rd = NULL;
     common->mfn = INVALID_MFN;
@@ -1724,6 +2212,8 @@ gnttab_unmap_and_replace(
         c = min(count, (unsigned int)GNTTAB_UNMAP_BATCH_SIZE);
         partial_done = 0;
 
+        iommu_iotlb_batch_start(current->domain);
+
         for ( i = 0; i < c; i++ )
         {
             if ( unlikely(__copy_from_guest(&op, uop, 1)) )
@@ -1735,6 +2225,7 @@ gnttab_unmap_and_replace(
             guest_handle_add_offset(uop, 1);
         }
 
+        iommu_iotlb_batch_end();
         gnttab_flush_tlb(current->domain);
 
         for ( i = 0; i < partial_done; i++ )
@@ -1750,6 +2241,7 @@ gnttab_unmap_and_replace(
     return 0;
 
 fault:
+    iommu_iotlb_batch_end();
     gnttab_flush_tlb(current->domain);
 
     for ( i = 0; i < partial_done; i++ )
@@ -1763,6 +2255,7 @@ gnttab_populate_status_frames(struct domain *d, struct grant_table *gt,
 {
     unsigned int i;
     unsigned int req_status_frames;
+    unsigned int memflags = MEMF_node(domain_alloc_node(d));
 
     req_status_frames = grant_to_status_frames(req_nr_frames);
 
@@ -1771,7 +2264,7 @@ gnttab_populate_status_frames(struct domain *d, struct grant_table *gt,
 
     for ( i = nr_status_frames(gt); i < req_status_frames; i++ )
     {
-        if ( (gt->status[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->status[i] = alloc_xenheap_pages(0, memflags)) == NULL )
             goto status_alloc_failed;
         clear_page(gt->status[i]);
     }
@@ -1873,6 +2366,7 @@ gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
 {
     struct grant_table *gt = d->grant_table;
     unsigned int i, j;
+    unsigned int memflags = MEMF_node(domain_alloc_node(d));
 
     if ( req_nr_frames < INITIAL_NR_GRANT_FRAMES )
         req_nr_frames = INITIAL_NR_GRANT_FRAMES;
@@ -1887,7 +2381,7 @@ gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
     for ( i = nr_active_grant_frames(gt);
           i < num_act_frames_from_sha_frames(req_nr_frames); i++ )
     {
-        if ( (gt->active[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->active[i] = alloc_xenheap_pages(0, memflags)) == NULL )
             goto active_alloc_failed;
         clear_page(gt->active[i]);
         for ( j = 0; j < ACGNT_PER_PAGE; j++ )
@@ -1897,7 +2391,7 @@ gnttab_grow_table(struct domain *d, unsigned int req_nr_frames)
     /* Shared */
     for ( i = nr_grant_frames(gt); i < req_nr_frames; i++ )
     {
-        if ( (gt->shared_raw[i] = alloc_xenheap_page()) == NULL )
+        if ( (gt->shared_raw[i] = alloc_xenheap_pages(0, memflags)) == NULL )
             goto shared_alloc_failed;
         clear_page(gt->shared_raw[i]);
     }
@@ -1998,6 +2492,32 @@ int grant_table_init(struct domain *d, int max_grant_frames,
             goto out;
 
         radix_tree_init(&gt->maptrack_tree);
+
+        if ( opt_gnttab_map_cache )
+        {
+            unsigned int i;
+
+            gt->map_cache_hash = xmalloc_array(struct list_head,
+                                               GNTTAB_MAP_CACHE_BUCKETS);
+            if ( gt->map_cache_hash == NULL )
+                goto out;
+            gt->map_cache = xmalloc_array(struct gnttab_map_cache_entry,
+                                          opt_gnttab_map_cache);
+            if ( gt->map_cache == NULL )
+                goto out;
+
+            for ( i = 0; i < GNTTAB_MAP_CACHE_BUCKETS; i++ )
+                INIT_LIST_HEAD(&gt->map_cache_hash[i]);
+            INIT_LIST_HEAD(&gt->map_cache_lru);
+            INIT_LIST_HEAD(&gt->map_cache_free);
+            for ( i = 0; i < opt_gnttab_map_cache; i++ )
+                list_add_tail(&gt->map_cache[i].lru, &gt->map_cache_free);
+
+            spin_lock_init(&gt->map_cache_lock);
+            init_coarse_timer(&gt->map_cache_timer, gnttab_map_cache_timer,
+                              gt, smp_processor_id());
+            tasklet_init(&gt->map_cache_tasklet, gnttab_map_cache_expire, gt);
+        }
     }
 
     /* Shared grant table. */
@@ -3106,6 +3626,218 @@ static long gnttab_copy(
     return rc;
 }
 
+/*
+ * Upper bound on the number of segments making up a single GNTTABOP_copy_sg
+ * copy.  Preemption only happens in between copies, so this also bounds the
+ * work done without checking for it.
+ */
+#define GNTTAB_COPY_SG_MAX_SEGS 128
+
+struct gnttab_copy_sg_pos {
+    unsigned int next;          /* Index of the next segment to look at. */
+    unsigned int done;          /* Bytes of the current segment copied. */
+    struct gnttab_copy_seg seg; /* Current segment. */
+};
+
+/*
+ * Move @pos to the next non-empty source (or destination) segment among the
+ * first @nr ones.  Returns 1 if there is one, 0 if not, or -EFAULT.
+ */
+static int gnttab_copy_sg_next(XEN_GUEST_HANDLE_PARAM(gnttab_copy_seg_t) uop,
+                               unsigned int nr, bool dest,
+                               struct gnttab_copy_sg_pos *pos)
+{
+    while ( pos->next < nr )
+    {
+        if ( unlikely(__copy_from_guest_offset(&pos->seg, uop, pos->next++,
+                                               1)) )
+            return -EFAULT;
+
+        if ( !(pos->seg.flags & GNTCOPY_SEG_dest) == !dest && pos->seg.len )
+        {
+            pos->done = 0;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int gnttab_copy_sg_ptr(struct gnttab_copy_ptr *ptr, uint16_t *flags,
+                              const struct gnttab_copy_sg_pos *pos,
+                              unsigned int gref_flag)
+{
+    ptr->domid = pos->seg.domid;
+    ptr->offset = pos->seg.offset + pos->done;
+
+    if ( pos->seg.flags & GNTCOPY_SEG_gref )
+    {
+        ptr->u.ref = pos->seg.frame;
+        if ( ptr->u.ref != pos->seg.frame )
+            return GNTST_bad_gntref;
+        *flags |= gref_flag;
+    }
+    else
+    {
+        ptr->u.gmfn = pos->seg.frame;
+        if ( ptr->u.gmfn != pos->seg.frame )
+            return GNTST_bad_copy_arg;
+    }
+
+    return GNTST_okay;
+}
+
+/*
+ * Carry out the copy described by the segments at the start of @uop (of
+ * which there are @count).  The number of segments belonging to it is stored
+ * in @nr, and its GNTST_* status in @status.  Returns 0, -EFAULT, or a
+ * positive value if the copy needs restarting.
+ *
+ * The copy is broken up into chunks which neither cross a source nor a
+ * destination segment boundary, each of which is handed to
+ * gnttab_copy_one().  As that keeps the last source and destination
+ * mapped, consecutive segments referring to the same frame (e.g. the
+ * fragments of a page sized grant) only get looked up and mapped once.
+ */
+static int gnttab_copy_sg_one(XEN_GUEST_HANDLE_PARAM(gnttab_copy_seg_t) uop,
+                              unsigned int count, unsigned int *nr,
+                              int16_t *status,
+                              struct gnttab_copy_buf *dest,
+                              struct gnttab_copy_buf *src)
+{
+    struct gnttab_copy_sg_pos s = {}, d = {};
+    struct gnttab_copy_seg seg;
+    unsigned int i, src_len = 0, dest_len = 0;
+    int rc;
+
+    *status = GNTST_okay;
+
+    /* Find the end of the copy, checking its segments on the way. */
+    for ( i = 0; ; i++ )
+    {
+        if ( i == count || i == GNTTAB_COPY_SG_MAX_SEGS )
+        {
+            *nr = i;
+            *status = GNTST_bad_copy_arg;
+            return 0;
+        }
+
+        if ( unlikely(__copy_from_guest_offset(&seg, uop, i, 1)) )
+            return -EFAULT;
+
+        if ( (seg.flags & ~(GNTCOPY_SEG_gref | GNTCOPY_SEG_dest |
+                            GNTCOPY_SEG_last)) ||
+             seg.offset + seg.len > PAGE_SIZE )
+            *status = GNTST_bad_copy_arg;
+
+        if ( seg.flags & GNTCOPY_SEG_dest )
+            dest_len += seg.len;
+        else
+            src_len += seg.len;
+
+        if ( seg.flags & GNTCOPY_SEG_last )
+            break;
+    }
+
+    *nr = i + 1;
+    if ( src_len != dest_len )
+        *status = GNTST_bad_copy_arg;
+    if ( *status != GNTST_okay )
+        return 0;
+
+    if ( (rc = gnttab_copy_sg_next(uop, *nr, false, &s)) <= 0 ||
+         (rc = gnttab_copy_sg_next(uop, *nr, true, &d)) <= 0 )
+        return rc;
+
+    for ( ; ; )
+    {
+        struct gnttab_copy op = {
+            .len = min(s.seg.len - s.done, d.seg.len - d.done),
+        };
+
+        rc = gnttab_copy_sg_ptr(&op.source, &op.flags, &s,
+                                GNTCOPY_source_gref);
+        if ( rc == GNTST_okay )
+            rc = gnttab_copy_sg_ptr(&op.dest, &op.flags, &d,
+                                    GNTCOPY_dest_gref);
+        if ( rc == GNTST_okay )
+            rc = gnttab_copy_one(&op, dest, src);
+        if ( rc > 0 )
+            return rc;
+        if ( rc != GNTST_okay )
+        {
+            *status = rc;
+            return 0;
+        }
+
+        s.done += op.len;
+        d.done += op.len;
+
+        /*
+         * The totals were checked to match above, but the guest may have
+         * changed the segments since.  Simply stop at whichever end is
+         * reached first.
+         */
+        if ( s.done == s.seg.len &&
+             (rc = gnttab_copy_sg_next(uop, *nr, false, &s)) <= 0 )
+            break;
+        if ( d.done == d.seg.len &&
+             (rc = gnttab_copy_sg_next(uop, *nr, true, &d)) <= 0 )
+            break;
+    }
+
+    return rc;
+}
+
+/* Like gnttab_copy(), this returns "count - i" when preempted. */
+static long gnttab_copy_sg(
+    XEN_GUEST_HANDLE_PARAM(gnttab_copy_seg_t) uop, unsigned int count)
+{
+    unsigned int i, nr;
+    struct gnttab_copy_seg seg;
+    struct gnttab_copy_buf src = {};
+    struct gnttab_copy_buf dest = {};
+    long rc = 0;
+
+    for ( i = 0; i < count; )
+    {
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = count - i;
+            break;
+        }
+
+        rc = gnttab_copy_sg_one(uop, count - i, &nr, &seg.status,
+                                &dest, &src);
+        if ( rc > 0 )
+        {
+            rc = count - i;
+            break;
+        }
+        if ( rc )
+            break;
+        if ( seg.status != GNTST_okay )
+        {
+            gnttab_copy_release_buf(&src);
+            gnttab_copy_release_buf(&dest);
+        }
+
+        for ( i += nr; nr--; guest_handle_add_offset(uop, 1) )
+            if ( unlikely(__copy_field_to_guest(uop, &seg, status)) )
+            {
+                rc = -EFAULT;
+                goto out;
+            }
+    }
+
+ out:
+    gnttab_copy_release_buf(&src);
+    gnttab_copy_release_buf(&dest);
+    gnttab_copy_unlock_domains(&src, &dest);
+
+    return rc;
+}
+
 static long
 gnttab_set_version(XEN_GUEST_HANDLE_PARAM(gnttab_set_version_t) uop)
 {
@@ -3666,6 +4398,22 @@ long do_grant_table_op(
         break;
     }
 
+    case GNTTABOP_copy_sg:
+    {
+        XEN_GUEST_HANDLE_PARAM(gnttab_copy_seg_t) seg =
+            guest_handle_cast(uop, gnttab_copy_seg_t);
+
+        if ( unlikely(!guest_handle_okay(seg, count)) )
+            goto out;
+        rc = gnttab_copy_sg(seg, count);
+        if ( rc > 0 )
+        {
+            guest_handle_add_offset(seg, count - rc);
+            uop = guest_handle_cast(seg, void);
+        }
+        break;
+    }
+
     case GNTTABOP_query_size:
         rc = gnttab_query_size(
             guest_handle_cast(uop, gnttab_query_size_t), count);
@@ -3727,7 +4475,7 @@ long do_grant_table_op(
     if ( rc > 0 || (opaque_out != 0 && rc == 0) )
     {
         /* Adjust rc, see gnttab_copy() for why this is needed. */
-        if ( cmd == GNTTABOP_copy )
+        if ( cmd == GNTTABOP_copy || cmd == GNTTABOP_copy_sg )
             rc = count - rc;
         ASSERT(rc < count);
         ASSERT((opaque_out & GNTTABOP_CMD_MASK) == 0);
@@ -3759,6 +4507,13 @@ int gnttab_release_mappings(struct domain *d)
     if ( !gt || !gt->maptrack )
         return 0;
 
+    /* Cached mappings get released below, like all others. */
+    if ( gt->map_cache )
+    {
+        kill_timer(&gt->map_cache_timer);
+        tasklet_kill(&gt->map_cache_tasklet);
+    }
+
     for ( handle = gt->maptrack_limit; handle; )
     {
         mfn_t mfn;
@@ -3827,7 +4582,8 @@ int gnttab_release_mappings(struct domain *d)
             {
                 BUG_ON(!(act->pin & GNTPIN_hstr_mask));
                 act->pin -= GNTPIN_hstr_inc;
-                if ( pg && gnttab_release_host_mappings(d) )
+                if ( pg && (gnttab_release_host_mappings(d) ||
+                            (map->flags & MAPTRACK_CACHED)) )
                     put_page(pg);
             }
         }
@@ -3845,7 +4601,9 @@ int gnttab_release_mappings(struct domain *d)
             {
                 BUG_ON(!(act->pin & GNTPIN_hstw_mask));
                 act->pin -= GNTPIN_hstw_inc;
-                if ( pg && gnttab_release_host_mappings(d) )
+                /* Cached mappings have no page table entry to drop them. */
+                if ( pg && (gnttab_release_host_mappings(d) ||
+                            (map->flags & MAPTRACK_CACHED)) )
                 {
                     if ( gnttab_host_mapping_get_page_type(false, d, rd) )
                         put_page_type(pg);
@@ -3946,6 +4704,14 @@ grant_table_destroy(
     ASSERT(!t->maptrack_limit);
     vfree(t->maptrack);
 
+    if ( t->map_cache )
+    {
+        kill_timer(&t->map_cache_timer);
+        tasklet_kill(&t->map_cache_tasklet);
+        xfree(t->map_cache);
+    }
+    xfree(t->map_cache_hash);
+
     for ( i = 0; i < nr_active_grant_frames(t); i++ )
         free_xenheap_page(t->active[i]);
     xfree(t->active);
@@ -3963,6 +4729,7 @@ void grant_table_init_vcpu(struct vcpu *v)
     spin_lock_init(&v->maptrack_freelist_lock);
     v->maptrack_head = MAPTRACK_TAIL;
     v->maptrack_tail = MAPTRACK_TAIL;
+    v->maptrack_free = 0;
 }
 
 #ifdef CONFIG_MEM_SHARING
@@ -4106,6 +4873,22 @@ unsigned int gnttab_resource_max_frames(const struct domain *d, unsigned int id)
     return nr;
 }
 
+void gnttab_get_stats(const struct domain *d,
+                      struct xen_sysctl_domain_stats *stats)
+{
+    const struct grant_table *gt = d->grant_table;
+
+    /* Gone already if the domain is being destroyed. */
+    if ( !gt )
+        return;
+
+    /* Unlocked snapshot: each value is read once, but they may be skewed. */
+    stats->gnttab_frames = read_atomic(&gt->nr_grant_frames);
+    stats->gnttab_max_frames = gt->max_grant_frames;
+    stats->maptrack_entries = read_atomic(&gt->maptrack_limit);
+    stats->maptrack_max_frames = gt->max_maptrack_frames;
+}
+
 int gnttab_acquire_resource(
     struct domain *d, unsigned int id, unsigned int frame,
     unsigned int nr_frames, xen_pfn_t mfn_list[])
@@ -4225,10 +5008,12 @@ static void gnttab_usage_print(struct domain *rd)
     grant_read_lock(gt);
 
     printk("grant-table for remote d%d (v%u)\n"
-           "  %u frames (%u max), %u maptrack frames (%u max)\n",
+           "  %u frames (%u max), %u maptrack frames (%u max, %u prefetched)\n"
+           "  %u maptrack entries stolen\n",
            rd->domain_id, gt->gt_version,
            nr_grant_frames(gt), gt->max_grant_frames,
-           nr_maptrack_frames(gt), gt->max_maptrack_frames);
+           nr_maptrack_frames(gt), gt->max_maptrack_frames,
+           gt->maptrack_prefetched, atomic_read(&gt->maptrack_stolen));
 
     nr_ents = nr_grant_entries(gt);
     for ( ref = 0; ref != nr_ents; ref++ )
@@ -17,6 +17,8 @@
 #ifdef CONFIG_COMPAT
 #include <compat/hypfs.h>
 CHECK_hypfs_dirlistentry;
+CHECK_hypfs_tree_header;
+CHECK_hypfs_tree_rec;
 #endif
 
 #define DIRENTRY_NAME_OFF offsetof(struct xen_hypfs_dirlistentry, name)
@@ -559,6 +561,145 @@ static int hypfs_read(const struct hypfs_entry *entry,
     return ret;
 }
 
+struct tree_state {
+    XEN_GUEST_HANDLE_PARAM(void) buf;   /* Start of the records. */
+    unsigned long size;                 /* Space for records. */
+    uint32_t skip;                      /* Entries returned by earlier calls. */
+    uint32_t done;
+    uint32_t len;
+};
+
+#define TREE_ALIGN 8
+
+/* Appends the record of one (entered) entry, unless it is to be skipped. */
+static int hypfs_tree_emit(const struct hypfs_entry *entry, unsigned int depth,
+                           bool expand, struct tree_state *st)
+{
+    struct xen_hypfs_tree_rec rec;
+    XEN_GUEST_HANDLE_PARAM(void) uaddr = st->buf;
+    unsigned int name_len = strlen(entry->name) + 1;
+    unsigned int size = 0, rec_len;
+    int ret;
+
+    if ( st->skip )
+    {
+        st->skip--;
+        return 0;
+    }
+
+    if ( entry->type != XEN_HYPFS_TYPE_DIR )
+        size = entry->funcs->getsize(entry);
+
+    rec_len = sizeof(rec) + ROUNDUP(name_len, TREE_ALIGN) +
+              ROUNDUP(size, TREE_ALIGN);
+    if ( st->len + rec_len > st->size )
+        return -ENOBUFS;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.e.type = entry->type;
+    rec.e.encoding = entry->encoding;
+    rec.e.content_len = size;
+    rec.e.max_write_len = entry->max_size;
+    rec.rec_len = rec_len;
+    rec.depth = depth;
+    if ( entry->type == XEN_HYPFS_TYPE_DIR && !expand )
+        rec.flags = XEN_HYPFS_TREE_UNEXPANDED;
+
+    guest_handle_add_offset(uaddr, st->len);
+    if ( copy_to_guest(uaddr, &rec, 1) ||
+         copy_to_guest_offset(uaddr, sizeof(rec), entry->name, name_len) )
+        return -EFAULT;
+
+    if ( size )
+    {
+        guest_handle_add_offset(uaddr,
+                                sizeof(rec) + ROUNDUP(name_len, TREE_ALIGN));
+        ret = entry->funcs->read(entry, uaddr);
+        if ( ret )
+            return ret;
+    }
+
+    st->len += rec_len;
+    st->done++;
+
+    return hypercall_preempt_check() ? -ERESTART : 0;
+}
+
+/*
+ * Only directories listing their static children are walked: the
+ * children of dynamic ones exist only while being looked up by name.
+ */
+static bool hypfs_tree_expand(const struct hypfs_entry *entry)
+{
+    return entry->type == XEN_HYPFS_TYPE_DIR &&
+           entry->funcs->read == hypfs_read_dir;
+}
+
+static int hypfs_tree_walk(const struct hypfs_entry *entry, unsigned int depth,
+                           struct tree_state *st)
+{
+    const struct hypfs_entry_dir *d;
+    const struct hypfs_entry *e;
+    bool expand = hypfs_tree_expand(entry);
+    int ret;
+
+    ret = hypfs_tree_emit(entry, depth, expand, st);
+    if ( ret || !expand )
+        return ret;
+
+    d = container_of(entry, const struct hypfs_entry_dir, e);
+
+    list_for_each_entry ( e, &d->dirlist, list )
+    {
+        ret = node_enter(e);
+        if ( ret )
+            return ret;
+
+        ret = hypfs_tree_walk(e, depth + 1, st);
+
+        node_exit(e);
+
+        if ( ret )
+            return ret;
+    }
+
+    return 0;
+}
+
+static int hypfs_read_tree(const struct hypfs_entry *entry,
+                           XEN_GUEST_HANDLE_PARAM(void) uaddr,
+                           unsigned long ulen)
+{
+    struct xen_hypfs_tree_header hdr;
+    struct tree_state st;
+    int ret;
+
+    if ( ulen < sizeof(hdr) )
+        return -EINVAL;
+
+    if ( copy_from_guest(&hdr, uaddr, 1) )
+        return -EFAULT;
+
+    st.buf = uaddr;
+    guest_handle_add_offset(st.buf, sizeof(hdr));
+    st.size = ulen - sizeof(hdr);
+    st.skip = st.done = hdr.done;
+    st.len = hdr.len;
+
+    if ( st.len > st.size )
+        return -EINVAL;
+
+    ret = hypfs_tree_walk(entry, 0, &st);
+
+    hdr.done = st.done;
+    hdr.len = st.len;
+    if ( (!ret || ret == -ENOBUFS || ret == -ERESTART) &&
+         copy_to_guest(uaddr, &hdr, 1) )
+        ret = -EFAULT;
+
+    return ret;
+}
+
 int cf_check hypfs_write_leaf(
     struct hypfs_entry_leaf *leaf, XEN_GUEST_HANDLE_PARAM(const_void) uaddr,
     unsigned int ulen)
@@ -725,6 +866,10 @@ long do_hypfs_op(
         ret = hypfs_write(entry, guest_handle_const_cast(arg3, void), arg4);
         break;
 
+    case XEN_HYPFS_OP_read_tree:
+        ret = hypfs_read_tree(entry, arg3, arg4);
+        break;
+
     default:
         ret = -EOPNOTSUPP;
         break;
@@ -735,5 +880,9 @@ long do_hypfs_op(
 
     hypfs_unlock();
 
+    if ( ret == -ERESTART )
+        ret = hypercall_create_continuation(__HYPERVISOR_hypfs_op, "ihlhl",
+                                            cmd, arg1, arg2, arg3, arg4);
+
     return ret;
 }
@@ -24,8 +24,10 @@
 #include <xen/irq.h>
 #include <xen/lib.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/trace.h>
+#include <xen/xmem_cache.h>
 
 #include <asm/guest_atomics.h>
 #include <asm/ioreq.h>
@@ -79,6 +81,19 @@ static struct ioreq_server *get_ioreq_server(const struct domain *d,
     return GET_IOREQ_SERVER(d, id);
 }
 
+/*
+ * Invalidate all vCPUs' cached ioreq_server_select() results.  To be called
+ * with the ioreq_server lock held, after the server or range update.
+ */
+static void invalidate_select_cache(struct domain *d)
+{
+    unsigned int gen = d->ioreq_server.select_gen + 1;
+
+    /* Generation 0 is what a never used cache holds. */
+    smp_wmb();
+    write_atomic(&d->ioreq_server.select_gen, gen ?: 1);
+}
+
 /*
  * Iterate over all possible ioreq servers.
  *
@@ -358,13 +373,15 @@ static void ioreq_server_update_evtchn(struct ioreq_server *s,
     }
 }
 
+static DEFINE_XMEM_CACHE(ioreq_vcpu_cache, "ioreq_vcpu", struct ioreq_vcpu);
+
 static int ioreq_server_add_vcpu(struct ioreq_server *s,
                                  struct vcpu *v)
 {
     struct ioreq_vcpu *sv;
     int rc;
 
-    sv = xzalloc(struct ioreq_vcpu);
+    sv = xmem_cache_zalloc(&ioreq_vcpu_cache);
 
     rc = -ENOMEM;
     if ( !sv )
@@ -404,7 +421,7 @@ static int ioreq_server_add_vcpu(struct ioreq_server *s,
 
  fail2:
     spin_unlock(&s->lock);
-    xfree(sv);
+    xmem_cache_free(&ioreq_vcpu_cache, sv);
 
  fail1:
     return rc;
@@ -431,7 +448,7 @@ static void ioreq_server_remove_vcpu(struct ioreq_server *s,
 
         free_xen_event_channel(v->domain, sv->ioreq_evtchn);
 
-        xfree(sv);
+        xmem_cache_free(&ioreq_vcpu_cache, sv);
         break;
     }
 
@@ -458,7 +475,7 @@ static void ioreq_server_remove_all_vcpus(struct ioreq_server *s)
 
         free_xen_event_channel(v->domain, sv->ioreq_evtchn);
 
-        xfree(sv);
+        xmem_cache_free(&ioreq_vcpu_cache, sv);
     }
 
     spin_unlock(&s->lock);
@@ -508,6 +525,7 @@ static int ioreq_server_alloc_rangesets(struct ioreq_server *s,
         case XEN_DMOP_IO_RANGE_PORT:   type = " port";   break;
         case XEN_DMOP_IO_RANGE_MEMORY: type = " memory"; break;
         case XEN_DMOP_IO_RANGE_PCI:    type = " pci";    break;
+        case XEN_DMOP_IO_RANGE_MEMORY_POSTED: type = " posted"; break;
         default:                       type = "";        break;
         }
 
@@ -727,6 +745,7 @@ static int ioreq_server_destroy(struct domain *d, ioservid_t id)
      */
     ioreq_server_deinit(s);
     set_ioreq_server(d, id, NULL);
+    invalidate_select_cache(d);
 
     domain_unpause(d);
 
@@ -869,6 +888,10 @@ static int ioreq_server_map_io_range(struct domain *d, ioservid_t id,
         r = s->range[type];
         break;
 
+    case XEN_DMOP_IO_RANGE_MEMORY_POSTED:
+        r = HANDLE_BUFIOREQ(s) ? s->range[type] : NULL;
+        break;
+
     default:
         r = NULL;
         break;
@@ -883,6 +906,8 @@ static int ioreq_server_map_io_range(struct domain *d, ioservid_t id,
         goto out;
 
     rc = rangeset_add_range(r, start, end);
+    if ( !rc )
+        invalidate_select_cache(d);
 
  out:
     spin_unlock_recursive(&d->ioreq_server.lock);
@@ -918,6 +943,7 @@ static int ioreq_server_unmap_io_range(struct domain *d, ioservid_t id,
     case XEN_DMOP_IO_RANGE_PORT:
     case XEN_DMOP_IO_RANGE_MEMORY:
     case XEN_DMOP_IO_RANGE_PCI:
+    case XEN_DMOP_IO_RANGE_MEMORY_POSTED:
         r = s->range[type];
         break;
 
@@ -935,6 +961,8 @@ static int ioreq_server_unmap_io_range(struct domain *d, ioservid_t id,
         goto out;
 
     rc = rangeset_remove_range(r, start, end);
+    if ( !rc )
+        invalidate_select_cache(d);
 
  out:
     spin_unlock_recursive(&d->ioreq_server.lock);
@@ -1010,6 +1038,8 @@ static int ioreq_server_set_state(struct domain *d, ioservid_t id,
     else
         ioreq_server_disable(s);
 
+    invalidate_select_cache(d);
+
     domain_unpause(d);
 
     rc = 0;
@@ -1093,63 +1123,164 @@ void ioreq_server_destroy_all(struct domain *d)
         xfree(s);
     }
 
+    invalidate_select_cache(d);
+
     spin_unlock_recursive(&d->ioreq_server.lock);
 }
 
+struct ioreq_select_range {
+    /* The access being looked up. */
+    unsigned long start, end;
+    /* The range around it which is known to select the same server. */
+    unsigned long s, e;
+};
+
+static int cf_check select_containing_range(unsigned long s, unsigned long e,
+                                            void *arg)
+{
+    struct ioreq_select_range *r = arg;
+
+    if ( e < r->start )
+        return 0;
+
+    /* The first range reaching the access is the one containing it. */
+    r->s = s;
+    r->e = e;
+
+    return 1;
+}
+
+static int cf_check select_clip_range(unsigned long s, unsigned long e,
+                                      void *arg)
+{
+    struct ioreq_select_range *r = arg;
+
+    if ( e < r->start )
+        r->s = max(r->s, e + 1);
+    else if ( s > r->end )
+        r->e = min(r->e, s - 1);
+    else
+    {
+        /* Partial overlap with the access itself: cache just the access. */
+        r->s = r->start;
+        r->e = r->end;
+    }
+
+    return 0;
+}
+
+/*
+ * Record in the current vCPU's cache that accesses of @type within the
+ * range of @s containing [@start, @end] select @s.  The range is narrowed
+ * so that it doesn't overlap any range of a server favoured over @s.
+ */
+static void select_cache_fill(struct domain *d, struct ioreq_server *s,
+                              unsigned int id, unsigned int gen, uint8_t type,
+                              unsigned long start, unsigned long end)
+{
+    struct ioreq_select_range r = {
+        .start = start, .end = end,
+        .s = start, .e = end,
+    };
+    struct vcpu *curr = current;
+    const struct ioreq_server *t;
+    unsigned int i;
+
+    rangeset_report_ranges(s->range[type], 0, ~0UL,
+                           select_containing_range, &r);
+
+    for ( i = id + 1; i < MAX_NR_IOREQ_SERVERS; i++ )
+    {
+        t = GET_IOREQ_SERVER(d, i);
+        if ( t && t->enabled )
+            rangeset_report_ranges(t->range[type], r.s, r.e,
+                                   select_clip_range, &r);
+    }
+
+    curr->io.select_cache.type = type;
+    curr->io.select_cache.id = id;
+    curr->io.select_cache.start = r.s;
+    curr->io.select_cache.end = r.e;
+    curr->io.select_cache.gen = gen;
+}
+
 struct ioreq_server *ioreq_server_select(struct domain *d,
                                          ioreq_t *p)
 {
     struct ioreq_server *s;
     uint8_t type;
     uint64_t addr;
-    unsigned int id;
+    unsigned long start, end;
+    unsigned int id, gen;
+    bool cache = d == current->domain;
 
     if ( !arch_ioreq_server_get_type_addr(d, p, &type, &addr) )
         return NULL;
 
-    FOR_EACH_IOREQ_SERVER(d, id, s)
+    switch ( type )
     {
-        struct rangeset *r;
-
-        if ( !s->enabled )
-            continue;
-
-        r = s->range[type];
+    case XEN_DMOP_IO_RANGE_PORT:
+        start = addr;
+        end = start + p->size - 1;
+        break;
 
-        switch ( type )
-        {
-            unsigned long start, end;
+    case XEN_DMOP_IO_RANGE_MEMORY:
+        start = ioreq_mmio_first_byte(p);
+        end = ioreq_mmio_last_byte(p);
+        break;
 
-        case XEN_DMOP_IO_RANGE_PORT:
-            start = addr;
-            end = start + p->size - 1;
-            if ( rangeset_contains_range(r, start, end) )
-                return s;
+    case XEN_DMOP_IO_RANGE_PCI:
+        start = end = addr >> 32;
+        break;
 
-            break;
+    default:
+        return NULL;
+    }
 
-        case XEN_DMOP_IO_RANGE_MEMORY:
-            start = ioreq_mmio_first_byte(p);
-            end = ioreq_mmio_last_byte(p);
+    /*
+     * Sample the generation ahead of the lookup, such that a result racing
+     * with a server or range update gets cached as already stale.
+     */
+    gen = read_atomic(&d->ioreq_server.select_gen);
+    smp_rmb();
 
-            if ( rangeset_contains_range(r, start, end) )
-                return s;
+    if ( cache )
+    {
+        const struct vcpu_io *vio = &current->io;
 
-            break;
+        if ( vio->select_cache.gen == gen && vio->select_cache.type == type &&
+             vio->select_cache.start <= start &&
+             end <= vio->select_cache.end &&
+             (s = get_ioreq_server(d, vio->select_cache.id)) != NULL &&
+             s->enabled )
+        {
+            perfc_incr(ioreq_select_hit);
+            goto found;
+        }
 
-        case XEN_DMOP_IO_RANGE_PCI:
-            if ( rangeset_contains_singleton(r, addr >> 32) )
-            {
-                p->type = IOREQ_TYPE_PCI_CONFIG;
-                p->addr = addr;
-                return s;
-            }
+        perfc_incr(ioreq_select_miss);
+    }
 
-            break;
+    FOR_EACH_IOREQ_SERVER(d, id, s)
+    {
+        if ( s->enabled && rangeset_contains_range(s->range[type], start, end) )
+        {
+            if ( cache )
+                select_cache_fill(d, s, id, gen, type, start, end);
+            goto found;
         }
     }
 
     return NULL;
+
+ found:
+    if ( type == XEN_DMOP_IO_RANGE_PCI )
+    {
+        p->type = IOREQ_TYPE_PCI_CONFIG;
+        p->addr = addr;
+    }
+
+    return s;
 }
 
 static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
@@ -1163,6 +1294,9 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
                        .dir = p->dir };
     /* Timeoffset sends 64b data, but no address. Use two consecutive slots. */
     int qw = 0;
+    /* Posted writes carry address bits 20-51 in an extra slot. */
+    bool ext = p->type == IOREQ_TYPE_COPY_POSTED;
+    unsigned int wp;
 
     /* Ensure buffered_iopage fits in a page */
     BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
@@ -1181,7 +1315,7 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
      *  - the count field is usually used with data_is_ptr and since we don't
      *    support data_is_ptr we do not waste space for the count field either
      */
-    if ( (p->addr > 0xffffful) || p->data_is_ptr || (p->count != 1) )
+    if ( (p->addr >> (ext ? 52 : 20)) || p->data_is_ptr || (p->count != 1) )
         return 0;
 
     switch ( p->size )
@@ -1207,24 +1341,31 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
     spin_lock(&s->bufioreq_lock);
 
     if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >=
-         (IOREQ_BUFFER_SLOT_NUM - qw) )
+         (IOREQ_BUFFER_SLOT_NUM - qw - ext) )
     {
         /* The queue is full: send the iopacket through the normal path. */
         spin_unlock(&s->bufioreq_lock);
         return IOREQ_STATUS_UNHANDLED;
     }
 
-    pg->buf_ioreq[pg->ptrs.write_pointer % IOREQ_BUFFER_SLOT_NUM] = bp;
+    wp = pg->ptrs.write_pointer;
+    pg->buf_ioreq[wp % IOREQ_BUFFER_SLOT_NUM] = bp;
+
+    if ( ext )
+    {
+        bp.data = p->addr >> 20;
+        pg->buf_ioreq[++wp % IOREQ_BUFFER_SLOT_NUM] = bp;
+    }
 
     if ( qw )
     {
         bp.data = p->data >> 32;
-        pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
+        pg->buf_ioreq[++wp % IOREQ_BUFFER_SLOT_NUM] = bp;
     }
 
     /* Make the ioreq_t visible /before/ write_pointer. */
     smp_wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    pg->ptrs.write_pointer = wp + 1;
 
     /* Canonicalize read/write pointers to prevent their overflow. */
     while ( (s->bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC) &&
@@ -1245,6 +1386,20 @@ static int ioreq_send_buffered(struct ioreq_server *s, ioreq_t *p)
     return IOREQ_STATUS_HANDLED;
 }
 
+/*
+ * Is @p a write to be posted (see XEN_DMOP_IO_RANGE_MEMORY_POSTED), i.e. to
+ * be sent through the buffered ring without waiting for its completion?
+ */
+static bool ioreq_is_posted(const struct ioreq_server *s, const ioreq_t *p)
+{
+    struct rangeset *r = s->range[XEN_DMOP_IO_RANGE_MEMORY_POSTED];
+
+    return p->type == IOREQ_TYPE_COPY && p->dir == IOREQ_WRITE &&
+           !p->data_is_ptr && p->count == 1 && HANDLE_BUFIOREQ(s) &&
+           !rangeset_is_empty(r) &&
+           rangeset_contains_range(r, p->addr, p->addr + p->size - 1);
+}
+
 int ioreq_send(struct ioreq_server *s, ioreq_t *proto_p,
                bool buffered)
 {
@@ -1258,6 +1413,17 @@ int ioreq_send(struct ioreq_server *s, ioreq_t *proto_p,
     if ( buffered )
         return ioreq_send_buffered(s, proto_p);
 
+    if ( ioreq_is_posted(s, proto_p) )
+    {
+        ioreq_t p = *proto_p;
+
+        p.type = IOREQ_TYPE_COPY_POSTED;
+        if ( ioreq_send_buffered(s, &p) == IOREQ_STATUS_HANDLED )
+            return IOREQ_STATUS_HANDLED;
+
+        /* The ring is full (or the write unsuitable): wait for it. */
+    }
+
     if ( unlikely(!vcpu_start_shutdown_deferral(curr)) )
     {
         vio->suspended = true;
@@ -1331,6 +1497,7 @@ unsigned int ioreq_broadcast(ioreq_t *p, bool buffered)
 void ioreq_domain_init(struct domain *d)
 {
     spin_lock_init(&d->ioreq_server.lock);
+    d->ioreq_server.select_gen = 1;
 
     arch_ioreq_domain_init(d);
 }
@@ -62,6 +62,15 @@ static unsigned long kexec_flags = 0; /* the lowest bits are for KEXEC_IMAGE...
 static unsigned char vmcoreinfo_data[VMCOREINFO_BYTES];
 static size_t vmcoreinfo_size = 0;
 
+/* The crash memory map, see public/kexec.h. */
+#define CRASH_MEMMAP_ORDER  5
+#define CRASH_MEMMAP_CHUNK  (1UL << (21 - PAGE_SHIFT))
+
+static bool __initdata opt_crashinfo_memmap;
+boolean_param("crashinfo_memmap", opt_crashinfo_memmap);
+
+static xen_kexec_crash_memmap_t *crash_memmap;
+
 xen_kexec_reserve_t kexec_crash_area;
 paddr_t __initdata kexec_crash_area_limit = ~(paddr_t)0;
 static struct {
@@ -357,6 +366,76 @@ crash_xen_info_t *kexec_crash_save_info(void)
     return out;
 }
 
+static unsigned int crash_page_type(const struct page_info *pg)
+{
+    const struct domain *owner;
+
+    if ( page_state_is(pg, free) )
+        return KEXEC_CRASH_MEM_FREE;
+
+    /*
+     * Only compare the owner: dereferencing it while crashing risks faulting
+     * on the very state which caused the crash.
+     */
+    owner = page_get_owner(pg);
+    if ( owner && (pg->count_info & PGC_allocated) &&
+         owner != hardware_domain && owner != dom_xen && owner != dom_io &&
+         owner != dom_cow )
+        return KEXEC_CRASH_MEM_GUEST;
+
+    return KEXEC_CRASH_MEM_XEN;
+}
+
+/* Classify all of RAM, with the other CPUs already stopped. */
+static void kexec_crash_save_memmap(void)
+{
+    xen_kexec_crash_memmap_t *map = crash_memmap;
+    xen_kexec_crash_memmap_entry_t *e = NULL;
+    unsigned int nr = 0;
+    unsigned long mfn, i;
+
+    if ( !map )
+        return;
+
+    for ( mfn = 0; mfn < max_page; mfn += CRASH_MEMMAP_CHUNK )
+    {
+        unsigned long end = min(mfn + CRASH_MEMMAP_CHUNK, max_page);
+        unsigned int type = KEXEC_CRASH_MEM_FREE;
+        bool ram = false;
+
+        /* A chunk is only as skippable as its least skippable page. */
+        for ( i = mfn; i < end; i++ )
+            if ( mfn_valid(_mfn(i)) )
+            {
+                ram = true;
+                type = min(type, crash_page_type(mfn_to_page(_mfn(i))));
+            }
+
+        if ( !ram )
+            e = NULL;
+        else if ( e && e->type == type )
+            e->size += CRASH_MEMMAP_CHUNK << PAGE_SHIFT;
+        else if ( nr < map->max_entries )
+        {
+            e = &map->entries[nr++];
+            e->start = pfn_to_paddr(mfn);
+            e->size = CRASH_MEMMAP_CHUNK << PAGE_SHIFT;
+            e->type = type;
+        }
+        else
+        {
+            e = &map->entries[nr - 1];
+            e->size = pfn_to_paddr(ROUNDUP(max_page, CRASH_MEMMAP_CHUNK)) -
+                      e->start;
+            e->type = KEXEC_CRASH_MEM_XEN;
+            break;
+        }
+    }
+
+    smp_wmb();
+    map->nr_entries = nr;
+}
+
 static int kexec_common_shutdown(void)
 {
     int ret;
@@ -390,6 +469,7 @@ void kexec_crash(enum crash_reason reason)
 
     kexec_crash_save_cpu();
     machine_crash_shutdown();
+    kexec_crash_save_memmap();
     machine_kexec(kexec_image[KEXEC_IMAGE_CRASH_BASE + pos]);
 
     BUG();
@@ -600,6 +680,20 @@ static int __init cf_check kexec_init(void)
         crash_heap_end = crash_heap_current + crash_heap_size;
     }
 
+    if ( opt_crashinfo_memmap )
+    {
+        crash_memmap = alloc_xenheap_pages(CRASH_MEMMAP_ORDER, 0);
+        if ( crash_memmap )
+        {
+            memset(crash_memmap, 0, PAGE_SIZE << CRASH_MEMMAP_ORDER);
+            crash_memmap->max_entries =
+                ((PAGE_SIZE << CRASH_MEMMAP_ORDER) - sizeof(*crash_memmap)) /
+                sizeof(crash_memmap->entries[0]);
+        }
+        else
+            printk(XENLOG_WARNING "kexec: no memory for the crash memory map\n");
+    }
+
     /* crash_notes may be allocated anywhere Xen can reach in memory.
        Only the individual CPU crash notes themselves must be allocated
        in lower memory if requested. */
@@ -665,6 +759,18 @@ static int kexec_get_vmcoreinfo(xen_kexec_range_t *range)
     return 0;
 }
 
+static int kexec_get_crash_memmap(xen_kexec_range_t *range)
+{
+    if ( crash_memmap )
+    {
+        range->start = __pa(crash_memmap);
+        range->size = PAGE_SIZE << CRASH_MEMMAP_ORDER;
+    }
+    else
+        range->start = range->size = 0;
+    return 0;
+}
+
 static int kexec_get_range_internal(xen_kexec_range_t *range)
 {
     int ret = -EINVAL;
@@ -680,6 +786,9 @@ static int kexec_get_range_internal(xen_kexec_range_t *range)
     case KEXEC_RANGE_MA_VMCOREINFO:
         ret = kexec_get_vmcoreinfo(range);
         break;
+    case KEXEC_RANGE_MA_CRASH_MEMMAP:
+        ret = kexec_get_crash_memmap(range);
+        break;
     default:
         ret = machine_kexec_get(range);
         break;
@@ -803,6 +912,9 @@ static void crash_save_vmcoreinfo(void)
     VMCOREINFO_OFFSET(domain, domain_id);
     VMCOREINFO_OFFSET(domain, next_in_list);
 
+    if ( crash_memmap )
+        vmcoreinfo_append_str("XEN_CRASH_MEMMAP=%lx\n", __pa(crash_memmap));
+
 #ifdef ARCH_CRASH_SAVE_VMCOREINFO
     arch_crash_save_vmcoreinfo();
 #endif
@@ -135,23 +135,46 @@ bool_t is_patch(const void *ptr)
     return r;
 }
 
+/* The System V ELF symbol hash. */
+static unsigned int symbol_hash(const char *name)
+{
+    unsigned int h = 0, g;
+
+    while ( *name )
+    {
+        h = (h << 4) + (unsigned char)*name++;
+        g = h & 0xf0000000U;
+        if ( g )
+            h ^= g >> 24;
+        h &= ~g;
+    }
+
+    return h;
+}
+
 unsigned long livepatch_symbols_lookup_by_name(const char *symname)
 {
     const struct payload *data;
+    unsigned int hash = symbol_hash(symname);
 
     ASSERT(spin_is_locked(&payload_lock));
     list_for_each_entry ( data, &payload_list, list )
     {
+        const unsigned int *chain;
         unsigned int i;
 
-        for ( i = 0; i < data->nsyms; i++ )
-        {
-            if ( !data->symtab[i].new_symbol )
-                continue;
+        if ( !data->sym_hash )
+            continue;
 
-            if ( !strcmp(data->symtab[i].name, symname) )
-                return data->symtab[i].value;
-        }
+        /*
+         * Entries are symtab indexes plus one, 0 ending a chain.  The
+         * chains follow the buckets.
+         */
+        chain = data->sym_hash + data->sym_hash_mask + 1;
+        for ( i = data->sym_hash[hash & data->sym_hash_mask]; i;
+              i = chain[i - 1] )
+            if ( !strcmp(data->symtab[i - 1].name, symname) )
+                return data->symtab[i - 1].value;
     }
 
     return 0;
@@ -975,9 +998,10 @@ static bool_t is_payload_symbol(const struct livepatch_elf *elf,
 static int build_symbol_table(struct payload *payload,
                               const struct livepatch_elf *elf)
 {
-    unsigned int i, j, nsyms = 0;
+    unsigned int i, j, nsyms = 0, nr_new = 0, mask;
     size_t strtab_len = 0;
     struct livepatch_symbol *symtab;
+    unsigned int *sym_hash = NULL;
     char *strtab;
 
     /* Recall that section @0 is always NULL. */
@@ -1041,6 +1065,7 @@ static int build_symbol_table(struct payload *payload,
                 return -EEXIST;
             }
             symtab[i].new_symbol = 1;
+            nr_new++;
             dprintk(XENLOG_DEBUG, LIVEPATCH "%s: new symbol %s\n",
                      elf->name, symtab[i].name);
         }
@@ -1052,9 +1077,40 @@ static int build_symbol_table(struct payload *payload,
         }
     }
 
+    /*
+     * Later payloads resolve their relocations against our new symbols:
+     * index them, for large payloads not to make that quadratic.
+     */
+    if ( nr_new )
+    {
+        mask = (1U << fls(nr_new)) - 1;
+        sym_hash = xzalloc_array(unsigned int, mask + 1 + nsyms);
+        if ( !sym_hash )
+        {
+            xfree(symtab);
+            xfree(strtab);
+            return -ENOMEM;
+        }
+
+        for ( i = nsyms; i-- > 0; )
+        {
+            unsigned int *head;
+
+            if ( !symtab[i].new_symbol )
+                continue;
+
+            head = &sym_hash[symbol_hash(symtab[i].name) & mask];
+            sym_hash[mask + 1 + i] = *head;
+            *head = i + 1;
+        }
+
+        payload->sym_hash_mask = mask;
+    }
+
     payload->symtab = symtab;
     payload->strtab = strtab;
     payload->nsyms = nsyms;
+    payload->sym_hash = sym_hash;
 
     return 0;
 }
@@ -1068,6 +1124,7 @@ static void free_payload(struct payload *data)
     free_payload_data(data);
     xfree((void *)data->symtab);
     xfree((void *)data->strtab);
+    xfree(data->sym_hash);
     xfree(data);
 }
 
@@ -1175,6 +1232,7 @@ static int livepatch_upload(struct xen_sysctl_livepatch_upload *upload)
     {
         xfree((void *)data->symtab);
         xfree((void *)data->strtab);
+        xfree(data->sym_hash);
         xfree(data);
     }
 
@@ -1616,6 +1674,28 @@ static inline bool livepatch_applied_have_vetoing_hooks(void)
     return false;
 }
 
+/*
+ * Only payloads patching code, or running hooks in the quiesced context, need
+ * all CPUs to rendezvous.  Others (e.g. ones only providing new symbols or
+ * data) can be applied or reverted by the CPU doing the work on its own,
+ * without pausing the rest of the system.
+ */
+static bool payload_needs_rendezvous(const struct payload *data, uint32_t cmd)
+{
+    switch ( cmd )
+    {
+    case LIVEPATCH_ACTION_APPLY:
+        return data->nfuncs || data->n_load_funcs ||
+               is_hook_enabled(data->hooks.apply.action);
+
+    case LIVEPATCH_ACTION_REVERT:
+        return data->nfuncs || data->n_unload_funcs ||
+               is_hook_enabled(data->hooks.revert.action);
+    }
+
+    return true;
+}
+
 static int schedule_work(struct payload *data, uint32_t cmd, uint32_t timeout)
 {
     ASSERT(spin_is_locked(&payload_lock));
@@ -1743,7 +1823,8 @@ void check_for_livepatch_work(void)
         arch_livepatch_mask();
 
         barrier(); /* MUST do it after get_cpu_maps. */
-        cpus = num_online_cpus() - 1;
+        cpus = payload_needs_rendezvous(p, livepatch_work.cmd)
+               ? num_online_cpus() - 1 : 0;
 
         if ( cpus )
         {
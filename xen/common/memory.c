@@ -25,6 +25,7 @@
 #include <xen/sched.h>
 #include <xen/trace.h>
 #include <xen/types.h>
+#include <xen/vm_event.h>
 #include <asm/current.h>
 #include <asm/hardirq.h>
 #include <asm/p2m.h>
@@ -190,8 +191,18 @@ static void populate_physmap(struct memop_args *a)
          * delayed.
          */
         a->memflags |= MEMF_no_icache_flush;
+        /*
+         * Building a domain benefits most from memory which doesn't need
+         * scrubbing, and which the toolstack doesn't need to clear.
+         */
+        a->memflags |= MEMF_prezeroed;
     }
 
+#ifdef CONFIG_HAS_PASSTHROUGH
+    /* Only mappings get added here, so the flush can wait until the end. */
+    iommu_iotlb_batch_start(d);
+#endif
+
     for ( i = a->nr_done; i < a->nr_extents; i++ )
     {
         mfn_t mfn;
@@ -302,6 +313,10 @@ static void populate_physmap(struct memop_args *a)
     }
 
 out:
+#ifdef CONFIG_HAS_PASSTHROUGH
+    iommu_iotlb_batch_end();
+#endif
+
     if ( need_tlbflush )
         filtered_flush_tlb_mask(tlbflush_timestamp);
 
@@ -1068,6 +1083,94 @@ static int construct_memop_from_reservation(
     return 0;
 }
 
+/*
+ * Extents which can't be allocated get retried at the next smaller multiple
+ * of this order, i.e. falling back from 1G to 2M to 4k with 4k pages.
+ */
+#define POPULATE_ORDER_STEP (21 - PAGE_SHIFT)
+
+static int populate_physmap_range(struct domain *d,
+                                  struct xen_memory_populate_range *r)
+{
+    struct xen_memory_reservation rsv = {
+        .mem_flags = r->mem_flags,
+        .domid     = r->domid,
+    };
+    struct memop_args a = { .domain = d };
+    unsigned int max = min(r->max_order, max_order(current->domain));
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    int rc = 0;
+
+    if ( !paging_mode_translate(d) || is_domain_direct_mapped(d) ||
+         is_domain_using_staticmem(d) ||
+         (r->mem_flags & XENMEMF_populate_on_demand) )
+        return -EOPNOTSUPP;
+
+    if ( r->nr_done > r->nr_pages || r->gfn + r->nr_pages < r->gfn ||
+         construct_memop_from_reservation(&rsv, &a) )
+        return -EINVAL;
+
+    /* See populate_physmap(). */
+    if ( unlikely(!d->creation_finished) )
+        a.memflags |= MEMF_no_tlbflush | MEMF_no_icache_flush |
+                      MEMF_prezeroed;
+
+    while ( r->nr_done < r->nr_pages )
+    {
+        unsigned long gfn = r->gfn + r->nr_done;
+        unsigned int order = min_t(unsigned int, max,
+                                   flsl(r->nr_pages - r->nr_done) - 1);
+        struct page_info *page;
+        unsigned int j;
+
+        /* Use the largest extent the alignment of the gfn allows. */
+        if ( gfn )
+            order = min_t(unsigned int, order, ffsl(gfn) - 1);
+
+        while ( !(page = alloc_domheap_pages(d, order, a.memflags)) )
+        {
+            if ( !order )
+            {
+                gdprintk(XENLOG_INFO,
+                         "Could not allocate memory for %pd at gfn %#lx\n",
+                         d, gfn);
+                rc = -ENOMEM;
+                goto out;
+            }
+            order = (order - 1) / POPULATE_ORDER_STEP * POPULATE_ORDER_STEP;
+        }
+
+        if ( unlikely(a.memflags & MEMF_no_tlbflush) )
+        {
+            for ( j = 0; j < (1U << order); j++ )
+                accumulate_tlbflush(&need_tlbflush, &page[j],
+                                    &tlbflush_timestamp);
+        }
+
+        rc = guest_physmap_add_page(d, _gfn(gfn), page_to_mfn(page), order);
+        if ( rc )
+            goto out;
+
+        r->nr_done += 1UL << order;
+
+        if ( r->nr_done < r->nr_pages && hypercall_preempt_check() )
+        {
+            rc = -ERESTART;
+            break;
+        }
+    }
+
+ out:
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    if ( a.memflags & MEMF_no_icache_flush )
+        invalidate_icache();
+
+    return rc;
+}
+
 #ifdef CONFIG_HAS_PASSTHROUGH
 struct get_reserved_device_memory {
     struct xen_reserved_device_memory_map map;
@@ -1154,6 +1257,14 @@ static unsigned int resource_max_frames(const struct domain *d,
     case XENMEM_resource_vmtrace_buf:
         return d->vmtrace_size >> PAGE_SHIFT;
 
+    case XENMEM_resource_vm_event:
+        return vm_event_resource_max_frames(d, id);
+
+#ifdef CONFIG_X86
+    case XENMEM_resource_dirty_ring:
+        return paging_dirty_ring_max_frames(d);
+#endif
+
     default:
         return -EOPNOTSUPP;
     }
@@ -1237,6 +1348,14 @@ static int _acquire_resource(
     case XENMEM_resource_vmtrace_buf:
         return acquire_vmtrace_buf(d, id, frame, nr_frames, mfn_list);
 
+    case XENMEM_resource_vm_event:
+        return vm_event_acquire_resource(d, id, frame, nr_frames, mfn_list);
+
+#ifdef CONFIG_X86
+    case XENMEM_resource_dirty_ring:
+        return paging_dirty_ring_acquire(d, id, frame, nr_frames, mfn_list);
+#endif
+
     default:
         return -EOPNOTSUPP;
     }
@@ -1683,6 +1802,40 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
 
         break;
 
+    case XENMEM_populate_physmap_range:
+    {
+        XEN_GUEST_HANDLE_PARAM(xen_memory_populate_range_t) rarg =
+            guest_handle_cast(arg, xen_memory_populate_range_t);
+        struct xen_memory_populate_range range;
+
+        if ( unlikely(start_extent) )
+            return -EINVAL;
+
+        if ( copy_from_guest(&range, rarg, 1) )
+            return -EFAULT;
+
+        if ( range.pad || range.pad2 )
+            return -EINVAL;
+
+        d = rcu_lock_domain_by_any_id(range.domid);
+        if ( d == NULL )
+            return -ESRCH;
+
+        rc = xsm_memory_adjust_reservation(XSM_TARGET, curr_d, d);
+        if ( !rc )
+            rc = populate_physmap_range(d, &range);
+
+        rcu_unlock_domain(d);
+
+        if ( __copy_field_to_guest(rarg, &range, nr_done) )
+            rc = -EFAULT;
+        else if ( rc == -ERESTART )
+            rc = hypercall_create_continuation(__HYPERVISOR_memory_op, "lh",
+                                               op, arg);
+
+        break;
+    }
+
     case XENMEM_get_vnumainfo:
     {
         struct xen_vnuma_topology_info topology;
@@ -120,6 +120,7 @@
  *   regions within it.
  */
 
+#include <xen/cpu.h>
 #include <xen/domain_page.h>
 #include <xen/event.h>
 #include <xen/init.h>
@@ -467,9 +468,36 @@ static unsigned long node_need_scrub[MAX_NUMNODES];
 static unsigned long *avail[MAX_NUMNODES];
 static long total_avail_pages;
 
-static DEFINE_SPINLOCK(heap_lock);
+/*
+ * Lowest zone whose pages may be set aside in per-CPU caches or in the
+ * zeroed pools.
+ */
+static unsigned int pcp_zone_lo(void)
+{
+    unsigned int zone = MEMZONE_XEN + 1;
+
+    if ( dma_bitsize )
+        zone = max(zone, bits_to_zone(dma_bitsize) + 1);
+
+    return zone;
+}
+
+/* Contended by all CPUs allocating or freeing memory at the same time. */
+static DEFINE_SPINLOCK_QUEUED(heap_lock);
 static long outstanding_claims; /* total outstanding claims by all domains */
 
+/*
+ * Account pages starting at pg, all on the same node, being added to or
+ * removed from d's page lists in d->node_pages[], if it is being tracked.
+ */
+void domain_adjust_node_pages(struct domain *d, const struct page_info *pg,
+                              int pages)
+{
+    ASSERT(spin_is_locked(&d->page_alloc_lock));
+    if ( d->node_pages )
+        d->node_pages[page_to_nid(pg)] += pages;
+}
+
 unsigned long domain_adjust_tot_pages(struct domain *d, long pages)
 {
     long dom_before, dom_after, dom_claimed, sys_before, sys_after;
@@ -924,6 +952,157 @@ static struct page_info *get_free_buddy(unsigned int zone_lo,
     }
 }
 
+/*
+ * Per-node pools of free chunks of up to 2M known to be zero-filled.  Once
+ * there is no dirty memory left to scrub, idle CPUs top up their node's pool
+ * to zeroed_pool_target pages, by taking clean chunks off the heap and
+ * clearing them.  Pooled pages remain accounted as free, but are
+ * PGC_state_inuse without an owner so they don't get merged into heap
+ * buddies, and need no safety TLB flush.  MEMF_prezeroed allocations are
+ * served from the pools first, others only ahead of dirty memory needing a
+ * synchronous scrub.  Protected by heap_lock.
+ */
+#define ZEROED_ORDER (21 - PAGE_SHIFT)
+
+static unsigned long __initdata opt_prezeroed_pool;
+size_param("prezeroed-pool", opt_prezeroed_pool);
+static unsigned long __read_mostly zeroed_pool_target;
+
+static struct page_list_head zeroed_heap[MAX_NUMNODES][ZEROED_ORDER + 1];
+static unsigned long node_zeroed[MAX_NUMNODES];
+
+static void free_heap_pages_locked(
+    struct page_info *pg, unsigned int order, bool need_scrub);
+
+/* Take a zeroed 2^@order chunk in [@zone_lo, @zone_hi] from @node's pool. */
+static struct page_info *take_zeroed_chunk(
+    nodeid_t node, unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order)
+{
+    struct page_info *pg;
+    unsigned int j, zone;
+
+    if ( node >= MAX_NUMNODES || node_zeroed[node] < (1UL << order) )
+        return NULL;
+
+    for ( j = order; j <= ZEROED_ORDER; j++ )
+    {
+        pg = page_list_first(&zeroed_heap[node][j]);
+        if ( !pg || (zone = page_to_zone(pg)) < zone_lo || zone > zone_hi )
+            continue;
+
+        page_list_del(pg, &zeroed_heap[node][j]);
+
+        /* Return the halves not needed to the pool. */
+        while ( j != order )
+        {
+            j--;
+            page_list_add(pg, &zeroed_heap[node][j]);
+            pg += 1U << j;
+        }
+
+        node_zeroed[node] -= 1UL << order;
+
+        return pg;
+    }
+
+    return NULL;
+}
+
+/*
+ * Get a zeroed 2^@order chunk for an allocation with the given constraints,
+ * looking at the pools of the requested (or local) node first.  The chunk is
+ * returned in the state get_free_buddy() would return a clean buddy in.
+ */
+static struct page_info *get_zeroed_chunk(
+    unsigned int zone_lo, unsigned int zone_hi, unsigned int order,
+    unsigned int memflags, const struct domain *d)
+{
+    nodeid_t n, node = MEMF_get_node(memflags);
+    nodemask_t nodemask = node_online_map;
+    struct page_info *pg;
+    unsigned int i;
+
+    ASSERT(spin_is_locked(&heap_lock));
+
+    if ( order > ZEROED_ORDER || !zeroed_pool_target )
+        return NULL;
+
+    if ( d && nodes_intersects(nodemask, d->node_affinity) )
+        nodes_and(nodemask, nodemask, d->node_affinity);
+
+    if ( node == NUMA_NO_NODE )
+        node = cpu_to_node(smp_processor_id());
+    else if ( memflags & MEMF_exact_node )
+        nodes_clear(nodemask);
+
+ retry:
+    if ( !(pg = take_zeroed_chunk(node, zone_lo, zone_hi, order)) )
+        for_each_node_mask ( n, nodemask )
+            if ( n != node &&
+                 (pg = take_zeroed_chunk(n, zone_lo, zone_hi, order)) != NULL )
+                break;
+
+    if ( !pg )
+        return NULL;
+
+    for ( i = 0; i < (1U << order); i++ )
+        if ( unlikely(!page_state_is(&pg[i], inuse)) )
+            break;
+
+    if ( unlikely(i < (1U << order)) )
+    {
+        /* Being offlined: hand the chunk to the heap and look again. */
+        avail[page_to_nid(pg)][page_to_zone(pg)] -= 1UL << order;
+        total_avail_pages -= 1UL << order;
+        free_heap_pages_locked(pg, order, false);
+        goto retry;
+    }
+
+    for ( i = 0; i < (1U << order); i++ )
+        pg[i].count_info = PGC_state_free;
+
+    PFN_ORDER(pg) = order;
+    pg->u.free.first_dirty = INVALID_DIRTY_IDX;
+
+    return pg;
+}
+
+/*
+ * Halve the free buddy @pg down to @order, returning the unused halves to the
+ * heap.  @first_dirty is adjusted to be relative to the returned chunk.
+ */
+static struct page_info *split_free_buddy(struct page_info *pg,
+                                          unsigned int order,
+                                          unsigned int *first_dirty)
+{
+    unsigned int node = page_to_nid(pg), zone = page_to_zone(pg);
+    unsigned int buddy_order = PFN_ORDER(pg);
+
+    ASSERT(spin_is_locked(&heap_lock));
+
+    /* We may have to halve the chunk a number of times. */
+    while ( buddy_order != order )
+    {
+        buddy_order--;
+        page_list_add_scrub(pg, node, zone, buddy_order,
+                            (1U << buddy_order) > *first_dirty ?
+                            *first_dirty : INVALID_DIRTY_IDX);
+        pg += 1U << buddy_order;
+
+        if ( *first_dirty != INVALID_DIRTY_IDX )
+        {
+            /* Adjust first_dirty */
+            if ( *first_dirty >= 1U << buddy_order )
+                *first_dirty -= 1U << buddy_order;
+            else
+                *first_dirty = 0; /* We've moved past original first_dirty */
+        }
+    }
+
+    return pg;
+}
+
 /* Allocate 2^@order contiguous pages. */
 static struct page_info *alloc_heap_pages(
     unsigned int zone_lo, unsigned int zone_hi,
@@ -931,7 +1110,7 @@ static struct page_info *alloc_heap_pages(
     struct domain *d)
 {
     nodeid_t node;
-    unsigned int i, buddy_order, zone, first_dirty;
+    unsigned int i, zone, first_dirty;
     unsigned long request = 1UL << order;
     struct page_info *pg;
     bool need_tlbflush = false;
@@ -962,7 +1141,14 @@ static struct page_info *alloc_heap_pages(
         return NULL;
     }
 
-    pg = get_free_buddy(zone_lo, zone_hi, order, memflags, d);
+    pg = NULL;
+    if ( memflags & MEMF_prezeroed )
+        pg = get_zeroed_chunk(zone_lo, zone_hi, order, memflags, d);
+    if ( !pg )
+        pg = get_free_buddy(zone_lo, zone_hi, order, memflags, d);
+    /* Prefer zeroed memory over a dirty buddy needing a synchronous scrub. */
+    if ( !pg && !(memflags & MEMF_prezeroed) )
+        pg = get_zeroed_chunk(zone_lo, zone_hi, order, memflags, d);
     /* Try getting a dirty buddy if we couldn't get a clean one. */
     if ( !pg && !(memflags & MEMF_no_scrub) )
         pg = get_free_buddy(zone_lo, zone_hi, order,
@@ -976,28 +1162,9 @@ static struct page_info *alloc_heap_pages(
 
     node = page_to_nid(pg);
     zone = page_to_zone(pg);
-    buddy_order = PFN_ORDER(pg);
-
     first_dirty = pg->u.free.first_dirty;
 
-    /* We may have to halve the chunk a number of times. */
-    while ( buddy_order != order )
-    {
-        buddy_order--;
-        page_list_add_scrub(pg, node, zone, buddy_order,
-                            (1U << buddy_order) > first_dirty ?
-                            first_dirty : INVALID_DIRTY_IDX);
-        pg += 1U << buddy_order;
-
-        if ( first_dirty != INVALID_DIRTY_IDX )
-        {
-            /* Adjust first_dirty */
-            if ( first_dirty >= 1U << buddy_order )
-                first_dirty -= 1U << buddy_order;
-            else
-                first_dirty = 0; /* We've moved past original first_dirty */
-        }
-    }
+    pg = split_free_buddy(pg, order, &first_dirty);
 
     ASSERT(avail[node][zone] >= request);
     avail[node][zone] -= request;
@@ -1264,7 +1431,7 @@ static void cf_check scrub_continue(void *data)
     }
 }
 
-bool scrub_free_pages(void)
+static bool scrub_dirty_pages(void)
 {
     struct page_info *pg;
     unsigned int zone;
@@ -1440,8 +1607,8 @@ static bool mark_page_free(struct page_info *pg, mfn_t mfn)
     return pg_offlined;
 }
 
-/* Free 2^@order set of pages. */
-static void free_heap_pages(
+/* Free 2^@order set of pages back to the buddy heap. */
+static void free_heap_pages_locked(
     struct page_info *pg, unsigned int order, bool need_scrub)
 {
     unsigned long mask;
@@ -1451,8 +1618,7 @@ static void free_heap_pages(
     bool pg_offlined = false;
 
     ASSERT(order <= MAX_ORDER);
-
-    spin_lock(&heap_lock);
+    ASSERT(spin_is_locked(&heap_lock));
 
     for ( i = 0; i < (1 << order); i++ )
     {
@@ -1535,10 +1701,500 @@ static void free_heap_pages(
 
     if ( pg_offlined )
         reserve_offlined_page(pg);
+}
+
+/*
+ * Per-CPU caches of free pages of the orders most commonly allocated and
+ * freed at runtime (4k and 2M), so guest populate and balloon traffic in the
+ * steady state doesn't need to take heap_lock.  A cache only holds clean
+ * pages of its CPU's node from above the DMA zone, and is refilled from and
+ * drained back to the buddy heap in batches.
+ *
+ * Cached pages are accounted as allocated: they are PGC_state_inuse without
+ * an owner, and keep the TLB flush information of their last free in
+ * u.free.  A page found to be offlining while cached is handed back to the
+ * heap instead of being allocated, and all caches are drained before an
+ * allocation request is failed.
+ */
+static bool __initdata opt_percpu_page_cache = true;
+boolean_param("percpu-page-cache", opt_percpu_page_cache);
+static bool __read_mostly pcp_enabled;
+
+#define PCP_NR_ORDERS 2
+
+static const struct {
+    unsigned int order;
+    unsigned int high;  /* Drain once a cache holds more chunks than this. */
+    unsigned int batch; /* Chunks moved per refill or drain. */
+} pcp_params[PCP_NR_ORDERS] = {
+    { 0, 64, 16 },
+    { 21 - PAGE_SHIFT, 2, 2 },
+};
+
+struct pcp_cache {
+    spinlock_t lock;
+    struct page_list_head list[PCP_NR_ORDERS];
+    unsigned int count[PCP_NR_ORDERS];
+};
+
+static DEFINE_PER_CPU(struct pcp_cache, pcp_cache);
+
+static int pcp_index(unsigned int order)
+{
+    unsigned int idx;
+
+    for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+        if ( pcp_params[idx].order == order )
+            return idx;
+
+    return -1;
+}
+
+/* Move up to a batch of clean chunks of @node from the heap into @pcp. */
+static void pcp_refill(struct pcp_cache *pcp, unsigned int idx,
+                       unsigned int node, unsigned int zone_lo,
+                       unsigned int zone_hi)
+{
+    unsigned int order = pcp_params[idx].order, n, i;
+    struct page_info *pg;
+
+    ASSERT(spin_is_locked(&pcp->lock));
+
+    spin_lock(&heap_lock);
+
+    /* Leave claimed memory to the domains which staked the claims. */
+    if ( outstanding_claims + ((unsigned long)pcp_params[idx].batch << order) >
+         total_avail_pages )
+        goto out;
+
+    for ( n = 0; n < pcp_params[idx].batch; n++ )
+    {
+        unsigned int zone, first_dirty;
+
+        pg = get_free_buddy(zone_lo, zone_hi, order,
+                            MEMF_node(node) | MEMF_exact_node, NULL);
+        if ( !pg )
+            break;
+
+        first_dirty = pg->u.free.first_dirty;
+        if ( first_dirty != INVALID_DIRTY_IDX )
+        {
+            /* Leave dirty memory to the scrubber rather than caching it. */
+            page_list_add_scrub(pg, node, page_to_zone(pg), PFN_ORDER(pg),
+                                first_dirty);
+            break;
+        }
+
+        pg = split_free_buddy(pg, order, &first_dirty);
+        zone = page_to_zone(pg);
 
+        ASSERT(avail[node][zone] >= (1UL << order));
+        avail[node][zone] -= 1UL << order;
+        total_avail_pages -= 1UL << order;
+
+        for ( i = 0; i < (1U << order); i++ )
+        {
+            BUG_ON(pg[i].count_info != PGC_state_free);
+            pg[i].count_info = PGC_state_inuse;
+            page_set_owner(&pg[i], NULL);
+        }
+
+        page_list_add_tail(pg, &pcp->list[idx]);
+        pcp->count[idx]++;
+    }
+
+    if ( n )
+        check_low_mem_virq();
+
+ out:
     spin_unlock(&heap_lock);
 }
 
+/* Return the chunks on @list, all of 2^@order pages, to the heap. */
+static unsigned long pcp_return(struct page_list_head *list,
+                                unsigned int order)
+{
+    struct page_info *pg;
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    unsigned long nr = 0;
+    unsigned int i;
+
+    if ( page_list_empty(list) )
+        return 0;
+
+    /*
+     * The heap considers pages without an owner not to need a safety TLB
+     * flush, so do the one owed by the previous owners now.
+     */
+    page_list_for_each ( pg, list )
+        for ( i = 0; i < (1U << order); i++ )
+            accumulate_tlbflush(&need_tlbflush, &pg[i], &tlbflush_timestamp);
+
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    spin_lock(&heap_lock);
+    while ( (pg = page_list_remove_head(list)) )
+    {
+        free_heap_pages_locked(pg, order, false);
+        nr += 1UL << order;
+    }
+    spin_unlock(&heap_lock);
+
+    return nr;
+}
+
+/* Drain all of @cpu's cache, returning the number of pages freed. */
+static unsigned long pcp_drain(unsigned int cpu)
+{
+    struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+    struct page_list_head list[PCP_NR_ORDERS];
+    unsigned long nr = 0;
+    unsigned int idx;
+
+    spin_lock(&pcp->lock);
+    for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+    {
+        INIT_PAGE_LIST_HEAD(&list[idx]);
+        page_list_move(&list[idx], &pcp->list[idx]);
+        pcp->count[idx] = 0;
+    }
+    spin_unlock(&pcp->lock);
+
+    for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+        nr += pcp_return(&list[idx], pcp_params[idx].order);
+
+    return nr;
+}
+
+static unsigned long pcp_drain_all(void)
+{
+    unsigned long nr = 0;
+    unsigned int cpu;
+
+    if ( !pcp_enabled )
+        return 0;
+
+    for_each_online_cpu ( cpu )
+        nr += pcp_drain(cpu);
+
+    return nr;
+}
+
+static struct page_info *pcp_alloc(unsigned int zone_hi, unsigned int order,
+                                   unsigned int memflags, struct domain *d)
+{
+    unsigned int cpu = smp_processor_id(), node = cpu_to_node(cpu);
+    unsigned int zone_lo = pcp_zone_lo(), req_node = MEMF_get_node(memflags);
+    struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+    bool need_tlbflush = false;
+    uint32_t tlbflush_timestamp = 0;
+    struct page_info *pg;
+    unsigned int i, zone;
+    int idx;
+
+    if ( !pcp_enabled || (idx = pcp_index(order)) < 0 || zone_hi < zone_lo )
+        return NULL;
+
+    /* Only serve requests which the heap would satisfy from this node. */
+    if ( req_node != NUMA_NO_NODE ? req_node != node
+                                  : d && !nodemask_test(node, &d->node_affinity) )
+        return NULL;
+
+    spin_lock(&pcp->lock);
+
+    if ( page_list_empty(&pcp->list[idx]) )
+        pcp_refill(pcp, idx, node, zone_lo, zone_hi);
+
+    pg = page_list_first(&pcp->list[idx]);
+    if ( pg && (zone = page_to_zone(pg)) >= zone_lo && zone <= zone_hi )
+    {
+        page_list_del(pg, &pcp->list[idx]);
+        pcp->count[idx]--;
+    }
+    else
+        pg = NULL;
+
+    spin_unlock(&pcp->lock);
+
+    if ( !pg )
+        return NULL;
+
+    for ( i = 0; i < (1U << order); i++ )
+        if ( unlikely(!page_state_is(&pg[i], inuse)) )
+            break;
+
+    if ( unlikely(i < (1U << order)) )
+    {
+        /* Being offlined: let the heap take care of the chunk. */
+        PAGE_LIST_HEAD(list);
+
+        page_list_add(pg, &list);
+        pcp_return(&list, order);
+
+        return NULL;
+    }
+
+    for ( i = 0; i < (1U << order); i++ )
+    {
+        if ( !(memflags & MEMF_no_tlbflush) )
+            accumulate_tlbflush(&need_tlbflush, &pg[i], &tlbflush_timestamp);
+
+        /* Initialise fields which have other uses for free pages. */
+        pg[i].u.inuse.type_info = PGT_TYPE_INFO_INITIALIZER;
+    }
+
+    if ( d != NULL )
+        d->last_alloc_node = node;
+
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    for ( i = 0; i < (1U << order); i++ )
+        flush_page_to_ram(mfn_x(page_to_mfn(pg)) + i,
+                          !(memflags & MEMF_no_icache_flush));
+
+    return pg;
+}
+
+/*
+ * Try to put 2^@order pages into the local cache instead of freeing them to
+ * the heap.  Returns false if the pages are to be freed to heap.
+ */
+static bool pcp_free(struct page_info *pg, unsigned int order, bool need_scrub)
+{
+    unsigned int cpu = smp_processor_id();
+    struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+    PAGE_LIST_HEAD(list);
+    mfn_t mfn = page_to_mfn(pg);
+    unsigned int i;
+    int idx;
+
+    if ( !pcp_enabled || need_scrub || scrub_debug ||
+         (idx = pcp_index(order)) < 0 ||
+         (mfn_x(mfn) & ((1UL << order) - 1)) ||
+         mfn_to_nid(mfn) != cpu_to_node(cpu) ||
+         page_to_zone(pg) < pcp_zone_lo() )
+        return false;
+
+    for ( i = 0; i < (1U << order); i++ )
+    {
+        unsigned long x = pg[i].count_info;
+
+        if ( (x & PGC_state) != PGC_state_inuse ||
+             (x & (PGC_broken | PGC_static | PGC_need_scrub)) )
+            return false;
+    }
+
+    /*
+     * Racing with offline_page() marking a page offlining leaves everything
+     * in a state free_heap_pages_locked() copes with.
+     */
+    for ( i = 0; i < (1U << order); i++ )
+    {
+        unsigned long x = pg[i].count_info;
+
+        if ( (x & PGC_state) != PGC_state_inuse ||
+             cmpxchg(&pg[i].count_info, x, PGC_state_inuse) != x )
+            return false;
+    }
+
+    for ( i = 0; i < (1U << order); i++ )
+    {
+        /* If a page has no owner it will need no safety TLB flush. */
+        pg[i].u.free.need_tlbflush = (page_get_owner(&pg[i]) != NULL);
+        if ( pg[i].u.free.need_tlbflush )
+            page_set_tlbflush_timestamp(&pg[i]);
+
+        /* This page is not a guest frame any more. */
+        page_set_owner(&pg[i], NULL); /* set_gpfn_from_mfn snoops pg owner */
+        set_gpfn_from_mfn(mfn_x(mfn) + i, INVALID_M2P_ENTRY);
+    }
+
+    spin_lock(&pcp->lock);
+
+    page_list_add(pg, &pcp->list[idx]);
+    if ( ++pcp->count[idx] > pcp_params[idx].high )
+    {
+        /* Give back the least recently freed chunks. */
+        for ( i = 0; i < pcp_params[idx].batch; i++ )
+        {
+            struct page_info *tail = page_list_last(&pcp->list[idx]);
+
+            page_list_del(tail, &pcp->list[idx]);
+            page_list_add(tail, &list);
+        }
+        pcp->count[idx] -= pcp_params[idx].batch;
+    }
+
+    spin_unlock(&pcp->lock);
+
+    pcp_return(&list, order);
+
+    return true;
+}
+
+static void pcp_init(unsigned int cpu)
+{
+    struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+    unsigned int idx;
+
+    spin_lock_init(&pcp->lock);
+    for ( idx = 0; idx < PCP_NR_ORDERS; idx++ )
+    {
+        INIT_PAGE_LIST_HEAD(&pcp->list[idx]);
+        pcp->count[idx] = 0;
+    }
+}
+
+static int cf_check pcp_cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        pcp_init(cpu);
+        break;
+
+    case CPU_DEAD:
+        pcp_drain(cpu);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block pcp_cpu_nfb = {
+    .notifier_call = pcp_cpu_callback
+};
+
+static int __init cf_check pcp_cache_init(void)
+{
+    if ( !opt_percpu_page_cache )
+        return 0;
+
+    pcp_init(smp_processor_id());
+    register_cpu_notifier(&pcp_cpu_nfb);
+    pcp_enabled = true;
+
+    return 0;
+}
+presmp_initcall(pcp_cache_init);
+
+/* Free 2^@order set of pages. */
+static void free_heap_pages(
+    struct page_info *pg, unsigned int order, bool need_scrub)
+{
+    if ( pcp_free(pg, order, need_scrub) )
+        return;
+
+    spin_lock(&heap_lock);
+    free_heap_pages_locked(pg, order, need_scrub);
+    spin_unlock(&heap_lock);
+}
+
+/* Clear a clean 2M chunk of the local node into the node's zeroed pool. */
+static bool fill_zeroed_pool(void)
+{
+    unsigned int cpu = smp_processor_id(), zone, i, nr;
+    unsigned int first_dirty = INVALID_DIRTY_IDX;
+    nodeid_t node = cpu_to_node(cpu);
+    bool need_tlbflush = false, more;
+    uint32_t tlbflush_timestamp = 0;
+    struct page_info *pg;
+
+    if ( !zeroed_pool_target || node >= MAX_NUMNODES )
+        return false;
+
+    spin_lock(&heap_lock);
+
+    if ( node_zeroed[node] + (1UL << ZEROED_ORDER) > zeroed_pool_target ||
+         !(pg = get_free_buddy(pcp_zone_lo(), NR_ZONES - 1, ZEROED_ORDER,
+                               MEMF_node(node) | MEMF_exact_node, NULL)) )
+    {
+        spin_unlock(&heap_lock);
+        return false;
+    }
+
+    ASSERT(pg->u.free.first_dirty == INVALID_DIRTY_IDX);
+    pg = split_free_buddy(pg, ZEROED_ORDER, &first_dirty);
+    zone = page_to_zone(pg);
+
+    for ( i = 0; i < (1U << ZEROED_ORDER); i++ )
+    {
+        BUG_ON(pg[i].count_info != PGC_state_free);
+        pg[i].count_info = PGC_state_inuse;
+        accumulate_tlbflush(&need_tlbflush, &pg[i], &tlbflush_timestamp);
+        pg[i].u.free.need_tlbflush = false;
+        page_set_owner(&pg[i], NULL);
+    }
+
+    node_zeroed[node] += 1UL << ZEROED_ORDER;
+
+    spin_unlock(&heap_lock);
+
+    /* Stale mappings must be gone before the contents are known to be zero. */
+    if ( need_tlbflush )
+        filtered_flush_tlb_mask(tlbflush_timestamp);
+
+    for ( nr = 0; nr < (1U << ZEROED_ORDER); )
+    {
+        if ( !(pg[nr].count_info & PGC_broken) )
+            clear_domain_page(page_to_mfn(&pg[nr]));
+
+        /* Clear a few (8) pages before becoming eligible for preemption. */
+        if ( !(++nr & 7) && (!cpu_online(cpu) || softirq_pending(cpu)) )
+            break;
+    }
+
+    spin_lock(&heap_lock);
+
+    /*
+     * Pool what got cleared and give back the rest, in power of two chunks
+     * aligned to their size.
+     */
+    for ( i = 0; i < (1U << ZEROED_ORDER); )
+    {
+        unsigned int end = i < nr ? nr : 1U << ZEROED_ORDER;
+        unsigned int order = flsl(end - i) - 1;
+
+        if ( i )
+            order = min(order, ffs(i) - 1U);
+
+        if ( i < nr )
+            page_list_add_tail(&pg[i], &zeroed_heap[node][order]);
+        else
+        {
+            node_zeroed[node] -= 1UL << order;
+            avail[node][zone] -= 1UL << order;
+            total_avail_pages -= 1UL << order;
+            free_heap_pages_locked(&pg[i], order, false);
+        }
+
+        i += 1U << order;
+    }
+
+    more = node_zeroed[node] + (1UL << ZEROED_ORDER) <= zeroed_pool_target;
+
+    spin_unlock(&heap_lock);
+
+    return more;
+}
+
+bool scrub_free_pages(void)
+{
+    /* Dirty memory comes first, topping up the zeroed pools second. */
+    return scrub_dirty_pages() || fill_zeroed_pool();
+}
+
+unsigned long avail_node_zeroed_pages(unsigned int nodeid)
+{
+    return nodeid < MAX_NUMNODES ? node_zeroed[nodeid] : 0;
+}
+
 
 /*
  * Following rules applied for page offline:
@@ -1875,6 +2531,9 @@ static void init_heap_pages(
         unsigned int nid = page_to_nid(pg);
         unsigned long left = nr_pages - i;
         unsigned long contig_pages;
+#if defined(CONFIG_NUMA) && !defined(CONFIG_SEPARATE_XENHEAP)
+        unsigned long pdx = mfn_to_pdx(page_to_mfn(pg));
+#endif
 
         /*
          * _init_heap_pages() is only able to accept range following
@@ -1898,7 +2557,18 @@ static void init_heap_pages(
 
             if ( nid != (page_to_nid(pg + contig_pages)) )
                 break;
+
+#if defined(CONFIG_NUMA) && !defined(CONFIG_SEPARATE_XENHEAP)
+            /*
+             * The node can only change at memnodemap granularity: move on to
+             * the last page of the current block rather than checking every
+             * page.
+             */
+            contig_pages = ((((pdx + contig_pages) >> memnode_shift) + 1) <<
+                            memnode_shift) - pdx - 1;
+#endif
         }
+        contig_pages = min(contig_pages, left);
 
         _init_heap_pages(pg, contig_pages, need_scrub);
 
@@ -2044,6 +2714,7 @@ static void __init scrub_heap_pages(void)
     unsigned long rem = 0;
     int last_distance, best_node;
     int cpus;
+    s_time_t start_time = NOW();
 
     cpumask_clear(&all_worker_cpus);
     /* Scrub block size. */
@@ -2158,7 +2829,7 @@ static void __init scrub_heap_pages(void)
         }
     }
 
-    printk("done.\n");
+    printk("done (%"PRI_stime"ms).\n", (NOW() - start_time) / MILLISECS(1));
 
 #ifdef CONFIG_SCRUB_DEBUG
     scrub_debug = true;
@@ -2173,6 +2844,20 @@ void __init heap_init_late(void)
      */
     setup_low_mem_virq();
 
+    /* Debug scrubbing poisons clean pages, rather than zeroing them. */
+    if ( !IS_ENABLED(CONFIG_SCRUB_DEBUG) && opt_prezeroed_pool )
+    {
+        unsigned int i, j;
+
+        for ( i = 0; i < MAX_NUMNODES; i++ )
+            for ( j = 0; j <= ZEROED_ORDER; j++ )
+                INIT_PAGE_LIST_HEAD(&zeroed_heap[i][j]);
+
+        zeroed_pool_target = opt_prezeroed_pool >> PAGE_SHIFT;
+        printk("Keeping up to %lu pre-zeroed pages per node\n",
+               zeroed_pool_target);
+    }
+
     switch ( opt_bootscrub )
     {
     default:
@@ -2412,6 +3097,7 @@ int assign_pages(
             (pg[i].count_info & (PGC_extra | PGC_static)) | PGC_allocated | 1;
 
         page_list_add_tail(&pg[i], page_to_list(d, &pg[i]));
+        domain_adjust_node_pages(d, &pg[i], 1);
     }
 
  out:
@@ -2431,6 +3117,7 @@ struct page_info *alloc_domheap_pages(
     struct page_info *pg = NULL;
     unsigned int bits = memflags >> _MEMF_bits, zone_hi = NR_ZONES - 1;
     unsigned int dma_zone;
+    bool drained = false;
 
     ASSERT_ALLOC_CONTEXT();
 
@@ -2445,14 +3132,28 @@ struct page_info *alloc_domheap_pages(
 
     if ( !dma_bitsize )
         memflags &= ~MEMF_no_dma;
-    else if ( (dma_zone = bits_to_zone(dma_bitsize)) < zone_hi )
+
+    pg = pcp_alloc(zone_hi, order, memflags, d);
+
+ retry:
+    if ( pg == NULL && dma_bitsize &&
+         (dma_zone = bits_to_zone(dma_bitsize)) < zone_hi )
         pg = alloc_heap_pages(dma_zone + 1, zone_hi, order, memflags, d);
 
     if ( (pg == NULL) &&
          ((memflags & MEMF_no_dma) ||
           ((pg = alloc_heap_pages(MEMZONE_XEN + 1, zone_hi, order,
                                   memflags, d)) == NULL)) )
-         return NULL;
+    {
+        /* Give cached pages back to the heap before failing the request. */
+        if ( !drained )
+        {
+            drained = true;
+            if ( pcp_drain_all() )
+                goto retry;
+        }
+        return NULL;
+    }
 
     if ( d && !(memflags & MEMF_no_owner) )
     {
@@ -2518,6 +3219,7 @@ void free_domheap_pages(struct page_info *pg, unsigned int order)
                     BUG();
                 }
                 arch_free_heap_page(d, &pg[i]);
+                domain_adjust_node_pages(d, &pg[i], -1);
                 if ( pg[i].count_info & PGC_extra )
                 {
                     ASSERT(d->extra_pages);
@@ -2658,6 +3360,13 @@ static void cf_check dump_heap(unsigned char key)
             continue;
         printk("Node %d has %lu unscrubbed pages\n", i, node_need_scrub[i]);
     }
+
+    for ( i = 0; i < MAX_NUMNODES; i++ )
+    {
+        if ( !node_zeroed[i] )
+            continue;
+        printk("Node %d has %lu pre-zeroed pages\n", i, node_zeroed[i]);
+    }
 }
 
 static __init int cf_check register_heap_trigger(void)
@@ -2746,6 +3455,7 @@ void free_domstatic_page(struct page_info *page)
     spin_lock_recursive(&d->page_alloc_lock);
 
     arch_free_heap_page(d, page);
+    domain_adjust_node_pages(d, page, -1);
 
     drop_dom_ref = !domain_adjust_tot_pages(d, -1);
 
@@ -19,9 +19,27 @@
 #include <xen/mm.h>
 #include <xen/bitops.h>
 #include <xen/nospec.h>
+#include <xen/string.h>
 
 /* Parameters for PFN/MADDR compression. */
 unsigned long __read_mostly max_pdx;
+
+unsigned long __read_mostly pdx_group_valid[BITS_TO_LONGS(
+    (FRAMETABLE_NR + PDX_GROUP_COUNT - 1) / PDX_GROUP_COUNT)] = { [0] = 1 };
+
+void set_pdx_range(unsigned long smfn, unsigned long emfn)
+{
+    unsigned long idx, eidx;
+
+    idx = pfn_to_pdx(smfn) / PDX_GROUP_COUNT;
+    eidx = (pfn_to_pdx(emfn - 1) + PDX_GROUP_COUNT) / PDX_GROUP_COUNT;
+
+    for ( ; idx < eidx; ++idx )
+        __set_bit(idx, pdx_group_valid);
+}
+
+#ifdef CONFIG_PDX_MASK_COMPRESSION
+
 unsigned long __read_mostly pfn_pdx_bottom_mask = ~0UL;
 unsigned long __read_mostly ma_va_bottom_mask = ~0UL;
 unsigned long __read_mostly pfn_top_mask = 0;
@@ -29,8 +47,7 @@ unsigned long __read_mostly ma_top_mask = 0;
 unsigned long __read_mostly pfn_hole_mask = 0;
 unsigned int __read_mostly pfn_pdx_hole_shift = 0;
 
-unsigned long __read_mostly pdx_group_valid[BITS_TO_LONGS(
-    (FRAMETABLE_NR + PDX_GROUP_COUNT - 1) / PDX_GROUP_COUNT)] = { [0] = 1 };
+static uint64_t __initdata pdx_ranges_mask;
 
 bool __mfn_valid(unsigned long mfn)
 {
@@ -41,6 +58,14 @@ bool __mfn_valid(unsigned long mfn)
                            pdx_group_valid));
 }
 
+bool pdx_is_region_compressible(paddr_t base, unsigned long npages)
+{
+    unsigned long pfn = paddr_to_pfn(base);
+
+    return !(pfn & pfn_hole_mask) &&
+           !((pfn ^ (pfn + npages - 1)) & ~pfn_pdx_bottom_mask);
+}
+
 /* Sets all bits from the most-significant 1-bit down to the LSB */
 static u64 __init fill_mask(u64 mask)
 {
@@ -51,29 +76,24 @@ static u64 __init fill_mask(u64 mask)
 }
 
 /* We don't want to compress the low MAX_ORDER bits of the addresses. */
-uint64_t __init pdx_init_mask(uint64_t base_addr)
+static uint64_t __init pdx_init_mask(uint64_t base_addr)
 {
     return fill_mask(max(base_addr,
                          (uint64_t)1 << (MAX_ORDER + PAGE_SHIFT)) - 1);
 }
 
-u64 __init pdx_region_mask(u64 base, u64 len)
+static u64 __init pdx_region_mask(u64 base, u64 len)
 {
     return fill_mask(base ^ (base + len - 1));
 }
 
-void set_pdx_range(unsigned long smfn, unsigned long emfn)
+void __init pfn_pdx_add_region(paddr_t base, paddr_t size)
 {
-    unsigned long idx, eidx;
-
-    idx = pfn_to_pdx(smfn) / PDX_GROUP_COUNT;
-    eidx = (pfn_to_pdx(emfn - 1) + PDX_GROUP_COUNT) / PDX_GROUP_COUNT;
-
-    for ( ; idx < eidx; ++idx )
-        __set_bit(idx, pdx_group_valid);
+    if ( size )
+        pdx_ranges_mask |= base | pdx_region_mask(base, size);
 }
 
-void __init pfn_pdx_hole_setup(unsigned long mask)
+static bool __init pfn_pdx_hole_setup(unsigned long mask)
 {
     unsigned int i, j, bottom_shift = 0, hole_shift = 0;
 
@@ -82,9 +102,6 @@ void __init pfn_pdx_hole_setup(unsigned long mask)
      * This guarantees that page-pointer arithmetic remains valid within
      * contiguous aligned ranges of 2^MAX_ORDER pages. Among others, our
      * buddy allocator relies on this assumption.
-     *
-     * If the logic changes here, we might have to update the ARM specific
-     * init_pdx too.
      */
     for ( j = MAX_ORDER-1; ; )
     {
@@ -101,7 +118,7 @@ void __init pfn_pdx_hole_setup(unsigned long mask)
         }
     }
     if ( !hole_shift )
-        return;
+        return false;
 
     printk(KERN_INFO "PFN compression on bits %u...%u\n",
            bottom_shift, bottom_shift + hole_shift - 1);
@@ -112,8 +129,159 @@ void __init pfn_pdx_hole_setup(unsigned long mask)
     pfn_hole_mask       = ((1UL << hole_shift) - 1) << bottom_shift;
     pfn_top_mask        = ~(pfn_pdx_bottom_mask | pfn_hole_mask);
     ma_top_mask         = pfn_top_mask << PAGE_SHIFT;
+
+    return true;
+}
+
+bool __init pfn_pdx_compression_setup(paddr_t base)
+{
+    return pfn_pdx_hole_setup((pdx_init_mask(base) | pdx_ranges_mask) >>
+                              PAGE_SHIFT);
+}
+
+#else /* CONFIG_PDX_OFFSET_COMPRESSION */
+
+/*
+ * Until set up, a single slot covers the whole PFN space, with a zero
+ * offset both ways.
+ */
+unsigned int __ro_after_init pfn_index_shift = BITS_PER_LONG - 1;
+unsigned long __ro_after_init pfn_pdx_lookup[PDX_NR_LOOKUP];
+unsigned long __ro_after_init pdx_pfn_lookup[PDX_NR_LOOKUP];
+
+/* Slots containing memory, i.e. those which aren't squashed out. */
+static unsigned long __ro_after_init pfn_slot_valid[
+    BITS_TO_LONGS(PDX_NR_LOOKUP)] = { [0] = 1 };
+
+/*
+ * Memory ranges, in PFNs, sorted and coalesced.  Should firmware report
+ * more of them than fit, the two closest ones get merged, at the expense
+ * of compressing their hole.
+ */
+#define PDX_MAX_RANGES 64
+
+static struct pdx_range {
+    unsigned long start, end;
+} __initdata pdx_ranges[PDX_MAX_RANGES + 1];
+static unsigned int __initdata nr_pdx_ranges;
+
+bool __mfn_valid(unsigned long mfn)
+{
+    if ( unlikely(evaluate_nospec(mfn >= max_page)) )
+        return false;
+    return likely(test_bit(mfn >> pfn_index_shift, pfn_slot_valid)) &&
+           likely(test_bit(pfn_to_pdx(mfn) / PDX_GROUP_COUNT,
+                           pdx_group_valid));
+}
+
+bool pdx_is_region_compressible(paddr_t base, unsigned long npages)
+{
+    unsigned long pfn = paddr_to_pfn(base);
+    unsigned long first = pfn >> pfn_index_shift;
+    unsigned long last = (pfn + npages - 1) >> pfn_index_shift;
+
+    /* Adjacent valid slots are contiguous in the PDX space too. */
+    return last < PDX_NR_LOOKUP &&
+           find_next_zero_bit(pfn_slot_valid, last + 1, first) > last;
+}
+
+void __init pfn_pdx_add_region(paddr_t base, paddr_t size)
+{
+    unsigned long start = PFN_DOWN(base), end = PFN_UP(base + size);
+    unsigned int i, j;
+
+    if ( !size )
+        return;
+
+    for ( i = 0; i < nr_pdx_ranges && pdx_ranges[i].start < start; i++ )
+        continue;
+    memmove(&pdx_ranges[i + 1], &pdx_ranges[i],
+            (nr_pdx_ranges - i) * sizeof(*pdx_ranges));
+    pdx_ranges[i].start = start;
+    pdx_ranges[i].end = end;
+    nr_pdx_ranges++;
+
+    for ( i = 1, j = 0; i < nr_pdx_ranges; i++ )
+    {
+        if ( pdx_ranges[i].start <= pdx_ranges[j].end )
+            pdx_ranges[j].end = max(pdx_ranges[j].end, pdx_ranges[i].end);
+        else
+            pdx_ranges[++j] = pdx_ranges[i];
+    }
+    nr_pdx_ranges = j + 1;
+
+    if ( nr_pdx_ranges <= PDX_MAX_RANGES )
+        return;
+
+    for ( i = 1, j = 0; i < nr_pdx_ranges - 1; i++ )
+        if ( pdx_ranges[i + 1].start - pdx_ranges[i].end <
+             pdx_ranges[j + 1].start - pdx_ranges[j].end )
+            j = i;
+    pdx_ranges[j].end = pdx_ranges[j + 1].end;
+    memmove(&pdx_ranges[j + 1], &pdx_ranges[j + 2],
+            (nr_pdx_ranges - j - 2) * sizeof(*pdx_ranges));
+    nr_pdx_ranges--;
+}
+
+bool __init pfn_pdx_compression_setup(paddr_t base)
+{
+    DECLARE_BITMAP(valid, PDX_NR_LOOKUP);
+    unsigned long end;
+    unsigned int shift, nr, used, i, j;
+
+    /*
+     * Memory below @base may already be in use with PDX == PFN.  Covering
+     * it as a whole keeps the offsets of its slots at zero.
+     */
+    if ( base )
+        pfn_pdx_add_region(0, base);
+
+    if ( !nr_pdx_ranges )
+        return false;
+    end = pdx_ranges[nr_pdx_ranges - 1].end;
+
+    /*
+     * Use the smallest slots which let the table cover all memory, but
+     * never split a 2^MAX_ORDER aligned range of pages: page-pointer
+     * arithmetic must remain valid within those, and our buddy allocator
+     * relies on it.
+     */
+    for ( shift = MAX_ORDER; ((end - 1) >> shift) >= PDX_NR_LOOKUP; shift++ )
+        continue;
+    nr = ((end - 1) >> shift) + 1;
+
+    bitmap_zero(valid, PDX_NR_LOOKUP);
+    for ( i = 0; i < nr_pdx_ranges; i++ )
+        bitmap_set(valid, pdx_ranges[i].start >> shift,
+                   ((pdx_ranges[i].end - 1) >> shift) -
+                   (pdx_ranges[i].start >> shift) + 1);
+
+    used = bitmap_weight(valid, nr);
+    if ( used == nr )
+        return false;
+
+    printk(KERN_INFO "PFN compression: %u of %u %luMiB slots in use\n",
+           used, nr, 1UL << (shift + PAGE_SHIFT - 20));
+
+    /*
+     * Each valid slot moves down by the size of the invalid ones below it.
+     * Invalid slots get the same offset as the next valid one, which keeps
+     * pfn_to_pdx() monotonic.
+     */
+    for ( i = j = 0; i < PDX_NR_LOOKUP; i++ )
+    {
+        pfn_pdx_lookup[i] = (unsigned long)(i - j) << shift;
+        if ( test_bit(i, valid) )
+            pdx_pfn_lookup[j++] = pfn_pdx_lookup[i];
+    }
+
+    bitmap_copy(pfn_slot_valid, valid, PDX_NR_LOOKUP);
+    pfn_index_shift = shift;
+
+    return true;
 }
 
+#endif /* CONFIG_PDX_OFFSET_COMPRESSION */
 
 /*
  * Local variables:
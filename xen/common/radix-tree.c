@@ -18,7 +18,9 @@
  * along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/cpu.h>
 #include <xen/init.h>
+#include <xen/percpu.h>
 #include <xen/radix-tree.h>
 #include <xen/errno.h>
 
@@ -52,9 +54,29 @@ struct rcu_node {
 	struct rcu_head rcu_head;
 };
 
+/*
+ * Per-CPU pool of nodes for the default allocator, filled by
+ * radix_tree_preload() ahead of taking the locks an insertion needs.  The
+ * worst case insertion grows the tree to full height, and then fills in the
+ * path down to the new item.
+ */
+#define RADIX_TREE_PRELOAD_SIZE (RADIX_TREE_MAX_PATH * 2 - 1)
+
+struct radix_tree_preload {
+	unsigned int nr;
+	struct rcu_node *nodes[RADIX_TREE_PRELOAD_SIZE];
+};
+static DEFINE_PER_CPU(struct radix_tree_preload, radix_tree_preloads);
+
 static struct radix_tree_node *cf_check rcu_node_alloc(void *arg)
 {
-	struct rcu_node *rcu_node = xmalloc(struct rcu_node);
+	struct radix_tree_preload *rtp = &this_cpu(radix_tree_preloads);
+	struct rcu_node *rcu_node;
+
+	if (rtp->nr)
+		rcu_node = rtp->nodes[--rtp->nr];
+	else
+		rcu_node = xmalloc(struct rcu_node);
 	return rcu_node ? &rcu_node->node : NULL;
 }
 
@@ -87,6 +109,33 @@ static void radix_tree_node_free(
 	root->node_free(node, root->node_alloc_free_arg);
 }
 
+/**
+ *	radix_tree_preload    -    load the per-CPU pool of nodes
+ *
+ *	Allocate ahead of time the nodes a single insertion may need, so that
+ *	it doesn't have to allocate any with locks held.  Call with no locks
+ *	held, then insert on the same CPU.  Only trees using the default node
+ *	allocator draw from the pool, and nodes an insertion doesn't use are
+ *	kept for the next one.
+ *
+ *	Returns -ENOMEM if the pool couldn't be filled, in which case the
+ *	insertion may still allocate nodes itself.
+ */
+int radix_tree_preload(void)
+{
+	struct radix_tree_preload *rtp = &this_cpu(radix_tree_preloads);
+
+	while (rtp->nr < ARRAY_SIZE(rtp->nodes)) {
+		struct rcu_node *rcu_node = xmalloc(struct rcu_node);
+
+		if (!rcu_node)
+			return -ENOMEM;
+		rtp->nodes[rtp->nr++] = rcu_node;
+	}
+
+	return 0;
+}
+
 /*
  *	Return the maximum key which can be store into a
  *	radix tree with height HEIGHT.
@@ -744,6 +793,23 @@ static __init unsigned long __maxindex(unsigned int height)
 	return ~0UL >> shift;
 }
 
+static int cf_check cpu_callback(
+	struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+	struct radix_tree_preload *rtp =
+		&per_cpu(radix_tree_preloads, (unsigned long)hcpu);
+
+	if (action == CPU_DEAD)
+		while (rtp->nr)
+			xfree(rtp->nodes[--rtp->nr]);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+	.notifier_call = cpu_callback
+};
+
 static int __init cf_check radix_tree_init_maxindex(void)
 {
 	unsigned int i;
@@ -751,6 +817,8 @@ static int __init cf_check radix_tree_init_maxindex(void)
 	for (i = 0; i < ARRAY_SIZE(height_to_maxindex); i++)
 		height_to_maxindex[i] = __maxindex(i);
 
+	register_cpu_notifier(&cpu_nfb);
+
 	return 0;
 }
 /* pre-SMP just so it runs before 'normal' initcalls */
@@ -10,11 +10,13 @@
 #include <xen/sched.h>
 #include <xen/errno.h>
 #include <xen/rangeset.h>
+#include <xen/rbtree.h>
+#include <xen/xmem_cache.h>
 #include <xsm/xsm.h>
 
-/* An inclusive range [s,e] and pointer to next range in ascending order. */
+/* An inclusive range [s,e], a node in its rangeset's tree of ranges. */
 struct range {
-    struct list_head list;
+    struct rb_node node;
     unsigned long s, e;
 };
 
@@ -23,8 +25,8 @@ struct rangeset {
     struct list_head rangeset_list;
     struct domain   *domain;
 
-    /* Ordered list of ranges contained in this set, and protecting lock. */
-    struct list_head range_list;
+    /* Tree of ranges contained in this set, ordered by s, and its lock. */
+    struct rb_root   range_tree;
 
     /* Number of ranges that can be allocated */
     long             nr_ranges;
@@ -38,20 +40,31 @@ struct rangeset {
 };
 
 /*****************************
- * Private range functions hide the underlying linked-list implemnetation.
+ * Private range functions hide the underlying red-black tree implementation.
+ *
+ * Ranges in a set never overlap, so ordering them by their start also orders
+ * them by their end.  The callers below adjust range boundaries in place,
+ * which is fine as long as that doesn't change the order of the ranges.
  */
 
 /* Find highest range lower than or containing s. NULL if no such range. */
 static struct range *find_range(
     struct rangeset *r, unsigned long s)
 {
-    struct range *x = NULL, *y;
+    struct rb_node *n = r->range_tree.rb_node;
+    struct range *x = NULL;
 
-    list_for_each_entry ( y, &r->range_list, list )
+    while ( n )
     {
+        struct range *y = rb_entry(n, struct range, node);
+
         if ( y->s > s )
-            break;
-        x = y;
+            n = n->rb_left;
+        else
+        {
+            x = y;
+            n = n->rb_right;
+        }
     }
 
     return x;
@@ -61,35 +74,62 @@ static struct range *find_range(
 static struct range *first_range(
     struct rangeset *r)
 {
-    if ( list_empty(&r->range_list) )
-        return NULL;
-    return list_entry(r->range_list.next, struct range, list);
+    struct rb_node *n = rb_first(&r->range_tree);
+
+    return n ? rb_entry(n, struct range, node) : NULL;
 }
 
 /* Return range following x in ascending order, or NULL if x is the highest. */
 static struct range *next_range(
     struct rangeset *r, struct range *x)
 {
-    if ( x->list.next == &r->range_list )
-        return NULL;
-    return list_entry(x->list.next, struct range, list);
+    struct rb_node *n = rb_next(&x->node);
+
+    return n ? rb_entry(n, struct range, node) : NULL;
 }
 
 /* Insert range y after range x in r. Insert as first range if x is NULL. */
 static void insert_range(
     struct rangeset *r, struct range *x, struct range *y)
 {
-    list_add(&y->list, (x != NULL) ? &x->list : &r->range_list);
+    struct rb_node *parent = NULL, **link;
+
+    /*
+     * The position is known from x, so y can be linked in without comparing
+     * keys: it becomes the left child of x's successor, or x's right child if
+     * x has no right subtree.
+     */
+    if ( x == NULL )
+        link = &r->range_tree.rb_node;
+    else if ( x->node.rb_right == NULL )
+    {
+        parent = &x->node;
+        link = &parent->rb_right;
+    }
+    else
+        link = &x->node.rb_right;
+
+    while ( *link )
+    {
+        parent = *link;
+        link = &parent->rb_left;
+    }
+
+    rb_link_node(&y->node, parent, link);
+    rb_insert_color(&y->node, &r->range_tree);
 }
 
-/* Remove a range from its list and free it. */
+/* Ranges are allocated and freed at a high rate, e.g. for the vPCI BARs. */
+static DEFINE_XMEM_CACHE(range_cache, "rangeset ranges", struct range);
+
+/* Remove a range from its set and free it. */
 static void destroy_range(
     struct rangeset *r, struct range *x)
 {
     r->nr_ranges++;
 
-    list_del(&x->list);
-    xfree(x);
+    rb_erase(&x->node, &r->range_tree);
+    xmem_cache_free(&range_cache, x);
 }
 
 /* Allocate a new range */
@@ -101,7 +141,7 @@ static struct range *alloc_range(
     if ( r->nr_ranges == 0 )
         return NULL;
 
-    x = xmalloc(struct range);
+    x = xmem_cache_alloc(&range_cache);
     if ( x )
         --r->nr_ranges;
 
@@ -225,9 +265,11 @@ int rangeset_remove_range(
         if ( x == NULL )
             x = first_range(r);
 
+        /* Trim a range overlapping s, but leave one ending before s alone. */
         if ( x->s < s )
         {
-            x->e = s - 1;
+            if ( x->e >= s )
+                x->e = s - 1;
             x = next_range(r, x);
         }
 
@@ -417,7 +459,7 @@ bool_t rangeset_contains_singleton(
 bool_t rangeset_is_empty(
     const struct rangeset *r)
 {
-    return ((r == NULL) || list_empty(&r->range_list));
+    return ((r == NULL) || RB_EMPTY_ROOT(&r->range_tree));
 }
 
 struct rangeset *rangeset_new(
@@ -430,7 +472,7 @@ struct rangeset *rangeset_new(
         return NULL;
 
     rwlock_init(&r->lock);
-    INIT_LIST_HEAD(&r->range_list);
+    r->range_tree = RB_ROOT;
     r->nr_ranges = -1;
 
     BUG_ON(flags & ~RANGESETF_prettyprint_hex);
@@ -504,7 +546,7 @@ void rangeset_domain_destroy(
 
 void rangeset_swap(struct rangeset *a, struct rangeset *b)
 {
-    LIST_HEAD(tmp);
+    struct rb_root tmp;
 
     if ( a < b )
     {
@@ -517,9 +559,9 @@ void rangeset_swap(struct rangeset *a, struct rangeset *b)
         write_lock(&a->lock);
     }
 
-    list_splice_init(&a->range_list, &tmp);
-    list_splice_init(&b->range_list, &a->range_list);
-    list_splice(&tmp, &b->range_list);
+    tmp = a->range_tree;
+    a->range_tree = b->range_tree;
+    b->range_tree = tmp;
 
     write_unlock(&a->lock);
     write_unlock(&b->lock);
@@ -32,9 +32,11 @@
  * http://lse.sourceforge.net/locking/rcupdate.html
  */
 #include <xen/types.h>
+#include <xen/hypfs.h>
 #include <xen/kernel.h>
 #include <xen/init.h>
 #include <xen/param.h>
+#include <xen/perfc.h>
 #include <xen/spinlock.h>
 #include <xen/smp.h>
 #include <xen/rcupdate.h>
@@ -53,6 +55,7 @@ static struct rcu_ctrlblk {
     long cur;           /* Current batch number.                      */
     long completed;     /* Number of the last completed batch         */
     int  next_pending;  /* Is the next batch already waiting?         */
+    s_time_t gp_start;  /* When the current batch was started         */
 
     spinlock_t  lock __cacheline_aligned;
     cpumask_t   cpumask; /* CPUs that need to switch in order ... */
@@ -81,9 +84,10 @@ struct rcu_data {
     long            qlen;             /* # of queued callbacks */
     struct rcu_head *curlist;
     struct rcu_head **curtail;
+    long            curlen;           /* # of callbacks on curlist */
     struct rcu_head *donelist;
     struct rcu_head **donetail;
-    long            blimit;           /* Upper limit on a processed batch */
+    long            donelen;          /* # of callbacks on donelist */
     int cpu;
     long            last_rs_qlen;     /* qlen during the last resched */
 
@@ -142,9 +146,48 @@ static DEFINE_PER_CPU(struct rcu_data, rcu_data);
 
 static int blimit = 10;
 static int qhimark = 10000;
-static int qlowmark = 100;
 static int rsinterval = 1000;
 
+/*
+ * Backlog handling.  Past qhimark queued callbacks, a CPU's batch limit grows
+ * with its backlog (by 1/2^RCU_BACKLOG_SHIFT of it per softirq run), while
+ * each run is bounded by rcu-batch-budget-us.  Completed callbacks in excess
+ * of offload_thresh are handed over to rcu-offload-cpu, or to an idle CPU, so
+ * that a storm of call_rcu()s (e.g. from destroying many domains at once)
+ * doesn't keep the CPU which queued them busy for milliseconds.
+ */
+#define RCU_BACKLOG_SHIFT 3
+static int offload_thresh = 1000;
+
+static unsigned int __read_mostly batch_budget_us = 500;
+integer_param("rcu-batch-budget-us", batch_budget_us);
+
+static bool __read_mostly opt_rcu_offload = true;
+boolean_param("rcu-offload", opt_rcu_offload);
+
+static int __read_mostly opt_rcu_offload_cpu = -1;
+integer_param("rcu-offload-cpu", opt_rcu_offload_cpu);
+
+/* Completed callbacks handed over to another CPU for invocation. */
+static struct {
+    spinlock_t lock;
+    struct rcu_head *list;
+    struct rcu_head **tail;
+    unsigned int qlen;  /* # of offloaded callbacks not invoked yet */
+    unsigned int cpu;   /* CPU invoking them, NR_CPUS if none */
+} rcu_offload = {
+    .lock = SPIN_LOCK_UNLOCKED,
+    .tail = &rcu_offload.list,
+    .cpu = NR_CPUS,
+};
+
+/* Statistics, exposed via hypfs. */
+static struct {
+    unsigned int gp_last_us;      /* Duration of the last grace period */
+    unsigned int gp_max_us;       /* Longest grace period seen */
+    unsigned int backlog_max;     /* Largest per-CPU callback backlog seen */
+} rcu_stats;
+
 /*
  * rcu_barrier() handling:
  * Two counters are used to synchronize rcu_barrier() work:
@@ -199,6 +242,13 @@ static void rcu_barrier_action(void)
         cpu_relax();
     }
 
+    /* Callbacks offloaded to another CPU must have been invoked as well. */
+    while ( read_atomic(&rcu_offload.qlen) )
+    {
+        process_pending_softirqs();
+        cpu_relax();
+    }
+
     smp_mb__before_atomic();
     atomic_dec(&pending_count);
 }
@@ -285,12 +335,121 @@ void call_rcu(struct rcu_head *head,
     *rdp->nxttail = head;
     rdp->nxttail = &head->next;
     if (unlikely(++rdp->qlen > qhimark)) {
-        rdp->blimit = INT_MAX;
+        if ( rdp->qlen > rcu_stats.backlog_max )
+            rcu_stats.backlog_max = rdp->qlen;
         force_quiescent_state(rdp, &rcu_ctrlblk);
     }
     local_irq_restore(flags);
 }
 
+static unsigned int rcu_offload_pick_cpu(unsigned int self)
+{
+    unsigned int cpu;
+
+    if ( opt_rcu_offload_cpu >= 0 )
+        return opt_rcu_offload_cpu != self &&
+               opt_rcu_offload_cpu < nr_cpu_ids &&
+               cpu_online(opt_rcu_offload_cpu) ? opt_rcu_offload_cpu
+                                               : NR_CPUS;
+
+    for_each_cpu ( cpu, &rcu_ctrlblk.idle_cpumask )
+        if ( cpu != self && cpu_online(cpu) )
+            return cpu;
+
+    return NR_CPUS;
+}
+
+/*
+ * Hand the remainder of this CPU's completed callbacks over to another CPU.
+ * Their grace period has elapsed already, so they may run anywhere.
+ */
+static bool rcu_offload_batch(struct rcu_data *rdp)
+{
+    unsigned int cpu;
+
+    if ( !opt_rcu_offload )
+        return false;
+
+    spin_lock(&rcu_offload.lock);
+
+    cpu = rcu_offload.cpu;
+    if ( cpu >= NR_CPUS )
+    {
+        cpu = rcu_offload_pick_cpu(rdp->cpu);
+        if ( cpu >= NR_CPUS )
+        {
+            spin_unlock(&rcu_offload.lock);
+            return false;
+        }
+        write_atomic(&rcu_offload.cpu, cpu);
+    }
+
+    *rcu_offload.tail = rdp->donelist;
+    rcu_offload.tail = rdp->donetail;
+    rcu_offload.qlen += rdp->donelen;
+    perfc_add(rcu_offloaded, rdp->donelen);
+
+    rdp->qlen -= rdp->donelen;
+    rdp->donelen = 0;
+    rdp->donelist = NULL;
+    rdp->donetail = &rdp->donelist;
+
+    spin_unlock(&rcu_offload.lock);
+
+    cpu_raise_softirq(cpu, RCU_SOFTIRQ);
+
+    return true;
+}
+
+/* Invoke callbacks offloaded to this CPU, within the time budget. */
+static void rcu_do_offloaded(void)
+{
+    struct rcu_head *list, *next, **tail;
+    unsigned int count = 0;
+    s_time_t deadline = batch_budget_us ? NOW() + MICROSECS(batch_budget_us)
+                                        : 0;
+
+    spin_lock(&rcu_offload.lock);
+    list = rcu_offload.list;
+    tail = rcu_offload.tail;
+    rcu_offload.list = NULL;
+    rcu_offload.tail = &rcu_offload.list;
+    spin_unlock(&rcu_offload.lock);
+
+    while ( list )
+    {
+        next = list->next;
+        list->func(list);
+        list = next;
+        if ( !(++count & 15) && deadline && NOW() > deadline )
+        {
+            perfc_incr(rcu_batch_budget);
+            break;
+        }
+    }
+
+    spin_lock(&rcu_offload.lock);
+
+    /* Account invoked callbacks only now, for rcu_barrier_action()'s sake. */
+    rcu_offload.qlen -= count;
+
+    /* Put what's left back at the head of the queue. */
+    if ( list )
+    {
+        *tail = rcu_offload.list;
+        if ( !rcu_offload.list )
+            rcu_offload.tail = tail;
+        rcu_offload.list = list;
+    }
+
+    if ( rcu_offload.list )
+        raise_softirq(RCU_SOFTIRQ);
+    else
+        write_atomic(&rcu_offload.cpu, NR_CPUS);
+
+    spin_unlock(&rcu_offload.lock);
+}
+
 /*
  * Invoke the completed RCU callbacks. They are expected to be in
  * a per-cpu list.
@@ -298,7 +457,16 @@ void call_rcu(struct rcu_head *head,
 static void rcu_do_batch(struct rcu_data *rdp)
 {
     struct rcu_head *next, *list;
-    int count = 0;
+    long count = 0, limit = blimit;
+    s_time_t deadline = 0;
+
+    /* Under a backlog, invoke more callbacks per run, but within budget. */
+    if ( rdp->qlen > qhimark )
+    {
+        limit = max_t(long, blimit, rdp->qlen >> RCU_BACKLOG_SHIFT);
+        if ( batch_budget_us )
+            deadline = NOW() + MICROSECS(batch_budget_us);
+    }
 
     list = rdp->donelist;
     while (list) {
@@ -306,14 +474,18 @@ static void rcu_do_batch(struct rcu_data *rdp)
         list->func(list);
         list = next;
         rdp->qlen--;
-        if (++count >= rdp->blimit)
+        rdp->donelen--;
+        if (++count >= limit)
             break;
+        if ( !(count & 15) && deadline && NOW() > deadline )
+        {
+            perfc_incr(rcu_batch_budget);
+            break;
+        }
     }
-    if (rdp->blimit == INT_MAX && rdp->qlen <= qlowmark)
-        rdp->blimit = blimit;
     if (!rdp->donelist)
         rdp->donetail = &rdp->donelist;
-    else
+    else if ( rdp->donelen <= offload_thresh || !rcu_offload_batch(rdp) )
     {
         rdp->process_callbacks = true;
         raise_softirq(RCU_SOFTIRQ);
@@ -354,6 +526,7 @@ static void rcu_start_batch(struct rcu_ctrlblk *rcp)
          */
         smp_wmb();
         rcp->cur++;
+        rcp->gp_start = NOW();
 
        /*
         * Make sure the increment of rcp->cur is visible so, even if a
@@ -378,7 +551,13 @@ static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
     cpumask_clear_cpu(cpu, &rcp->cpumask);
     if (cpumask_empty(&rcp->cpumask)) {
         /* batch completed ! */
+        unsigned int us = (NOW() - rcp->gp_start) / MICROSECS(1);
+
         rcp->completed = rcp->cur;
+        perfc_incr(rcu_grace_periods);
+        rcu_stats.gp_last_us = us;
+        if ( us > rcu_stats.gp_max_us )
+            rcu_stats.gp_max_us = us;
         rcu_start_batch(rcp);
     }
 }
@@ -428,6 +607,8 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
     if (rdp->curlist && !rcu_batch_before(rcp->completed, rdp->batch)) {
         *rdp->donetail = rdp->curlist;
         rdp->donetail = rdp->curtail;
+        rdp->donelen += rdp->curlen;
+        rdp->curlen = 0;
         rdp->curlist = NULL;
         rdp->curtail = &rdp->curlist;
     }
@@ -436,6 +617,8 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
     if (rdp->nxtlist && !rdp->curlist) {
         rdp->curlist = rdp->nxtlist;
         rdp->curtail = rdp->nxttail;
+        /* curlist was empty, so everything not done yet was on nxtlist. */
+        rdp->curlen = rdp->qlen - rdp->donelen;
         rdp->nxtlist = NULL;
         rdp->nxttail = &rdp->nxtlist;
         local_irq_enable();
@@ -476,6 +659,9 @@ static void cf_check rcu_process_callbacks(void)
         __rcu_process_callbacks(&rcu_ctrlblk, rdp);
     }
 
+    if ( read_atomic(&rcu_offload.cpu) == smp_processor_id() )
+        rcu_do_offloaded();
+
     if ( atomic_read(&cpu_count) && !rdp->barrier_active )
     {
         rdp->barrier_active = true;
@@ -618,6 +804,15 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
         cpu_quiet(rdp->cpu, rcp);
     spin_unlock(&rcp->lock);
 
+    /* Take over invoking offloaded callbacks, if they were handed to it. */
+    spin_lock(&rcu_offload.lock);
+    if ( rcu_offload.cpu == rdp->cpu )
+    {
+        write_atomic(&rcu_offload.cpu, this_rdp->cpu);
+        raise_softirq(RCU_SOFTIRQ);
+    }
+    spin_unlock(&rcu_offload.lock);
+
     rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
     rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
     rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail);
@@ -637,7 +832,6 @@ static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
     rdp->quiescbatch = rcp->completed;
     rdp->qs_pending = 0;
     rdp->cpu = cpu;
-    rdp->blimit = blimit;
     init_timer(&rdp->idle_timer, rcu_idle_timer_handler, rdp, cpu);
 }
 
@@ -718,3 +912,23 @@ void rcu_idle_exit(unsigned int cpu)
     ASSERT(cpumask_test_cpu(cpu, &rcu_ctrlblk.idle_cpumask));
     cpumask_clear_cpu(cpu, &rcu_ctrlblk.idle_cpumask);
 }
+
+#ifdef CONFIG_HYPFS
+static HYPFS_DIR_INIT(rcu_dir, "rcu");
+static HYPFS_UINT_INIT(gp_last, "gp-last-us", rcu_stats.gp_last_us);
+static HYPFS_UINT_INIT(gp_max, "gp-max-us", rcu_stats.gp_max_us);
+static HYPFS_UINT_INIT(backlog_max, "backlog-max", rcu_stats.backlog_max);
+static HYPFS_UINT_INIT(offload_backlog, "offload-backlog", rcu_offload.qlen);
+
+static int __init cf_check rcu_hypfs_init(void)
+{
+    hypfs_add_dir(&hypfs_root, &rcu_dir, true);
+    hypfs_add_leaf(&rcu_dir, &gp_last, true);
+    hypfs_add_leaf(&rcu_dir, &gp_max, true);
+    hypfs_add_leaf(&rcu_dir, &backlog_max, true);
+    hypfs_add_leaf(&rcu_dir, &offload_backlog, true);
+
+    return 0;
+}
+__initcall(rcu_hypfs_init);
+#endif
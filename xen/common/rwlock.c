@@ -1,5 +1,8 @@
 #include <xen/rwlock.h>
+#include <xen/cpu.h>
+#include <xen/init.h>
 #include <xen/irq.h>
+#include <xen/numa.h>
 
 /*
  * rspin_until_writer_unlock - spin until writer is gone.
@@ -153,3 +156,58 @@ void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
 
     lock_enter(&percpu_rwlock->rwlock.lock.debug);
 }
+
+DEFINE_PER_CPU(unsigned int, br_rwlock_slot);
+
+static void br_rwlock_set_slot(unsigned int cpu)
+{
+    nodeid_t node = cpu_to_node(cpu);
+
+    per_cpu(br_rwlock_slot, cpu) =
+        node == NUMA_NO_NODE ? 0 : node % BR_RWLOCK_SLOTS;
+}
+
+static int cf_check cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    /* The slot must not change while the CPU might be holding a read lock. */
+    if ( action == CPU_UP_PREPARE )
+        br_rwlock_set_slot((unsigned long)hcpu);
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback,
+};
+
+static int __init cf_check br_rwlock_presmp_init(void)
+{
+    br_rwlock_set_slot(smp_processor_id());
+    register_cpu_notifier(&cpu_nfb);
+
+    return 0;
+}
+presmp_initcall(br_rwlock_presmp_init);
+
+void _br_write_lock(br_rwlock_t *l)
+{
+    unsigned int i;
+
+    /*
+     * First take the write lock to protect against other writers or slow
+     * path readers.
+     */
+    write_lock(&l->rwlock);
+
+    /* Now set the flag so that readers start using read_lock. */
+    l->writer_activating = true;
+    smp_mb();
+
+    /* Wait for the fast path readers of every node to drain. */
+    for ( i = 0; i < BR_RWLOCK_SLOTS; i++ )
+        while ( atomic_read(&l->slot[i].readers) )
+            cpu_relax();
+
+    lock_enter(&l->rwlock.lock.debug);
+}
@@ -30,6 +30,7 @@
 #include <xen/err.h>
 #include <xen/guest_access.h>
 #include <xen/hypercall.h>
+#include <xen/hypfs.h>
 #include <xen/multicall.h>
 #include <xen/cpu.h>
 #include <xen/preempt.h>
@@ -95,6 +96,38 @@ static struct scheduler __read_mostly ops;
 
 static bool scheduler_active;
 
+/*
+ * Always-on log2 histograms of the wake to run latency of units and of the
+ * cost of the scheduler's do_schedule hook. They are per pCPU, so updating
+ * them needs no atomics, and there's one set for each scheduler (indexed
+ * by struct scheduler's hist_idx, i.e. the position of the scheduler in the
+ * schedulers array). Bucket i counts events which took [2^(i-1), 2^i) ns,
+ * with the last bucket also counting anything longer than that.
+ */
+#define SCHED_HIST_BUCKETS 32
+#define SCHED_HIST_NR      8
+
+struct sched_hist {
+    unsigned long wake[SCHED_HIST_BUCKETS];
+    unsigned long cost[SCHED_HIST_BUCKETS];
+};
+static DEFINE_PER_CPU(struct sched_hist[SCHED_HIST_NR], sched_hist);
+
+static inline void sched_hist_add(unsigned long *hist, s_time_t delta)
+{
+    unsigned int bucket = delta > 0 ? fls64(delta) : 0;
+
+    hist[min(bucket, SCHED_HIST_BUCKETS - 1U)]++;
+}
+
+static inline struct sched_hist *sched_hist_get(const struct scheduler *sched)
+{
+    if ( unlikely(sched->hist_idx >= SCHED_HIST_NR) )
+        return NULL;
+
+    return &this_cpu(sched_hist)[sched->hist_idx];
+}
+
 static void sched_set_affinity(
     struct sched_unit *unit, const cpumask_t *hard, const cpumask_t *soft);
 
@@ -131,6 +164,7 @@ static struct scheduler sched_idle_ops = {
     .name           = "Idle Scheduler",
     .opt_name       = "idle",
     .sched_data     = NULL,
+    .hist_idx       = SCHED_HIST_NR,
 
     .pick_resource  = sched_idle_res_pick,
     .do_schedule    = sched_idle_schedule,
@@ -802,6 +836,8 @@ int sched_move_domain(struct domain *d, struct cpupool *c)
         unit_idx++;
     }
 
+    /* All soft affinities have been reset above. */
+    d->sched_mem_node = NUMA_NO_NODE;
     domain_update_node_affinity(d);
 
     domain_unpause(d);
@@ -857,6 +893,28 @@ int sched_init_domain(struct domain *d, unsigned int poolid)
     ASSERT(d->cpupool == NULL);
     ASSERT(d->domain_id < DOMID_FIRST_RESERVED);
 
+    /*
+     * Only track where the domain's memory is if soft affinity is to follow
+     * it. Pages may have been assigned already (e.g. by arch code), so start
+     * from what is on the page lists.
+     */
+    if ( opt_sched_mem_affinity )
+    {
+        unsigned int *node_pages = xzalloc_array(unsigned int, MAX_NUMNODES);
+        const struct page_info *pg;
+
+        if ( !node_pages )
+            return -ENOMEM;
+
+        spin_lock(&d->page_alloc_lock);
+        page_list_for_each ( pg, &d->page_list )
+            node_pages[page_to_nid(pg)]++;
+        page_list_for_each ( pg, &d->extra_page_list )
+            node_pages[page_to_nid(pg)]++;
+        d->node_pages = node_pages;
+        spin_unlock(&d->page_alloc_lock);
+    }
+
     if ( (ret = cpupool_add_domain(d, poolid)) )
         return ret;
 
@@ -873,6 +931,7 @@ int sched_init_domain(struct domain *d, unsigned int poolid)
         return PTR_ERR(sdom);
 
     d->sched_priv = sdom;
+    d->sched_mem_node = NUMA_NO_NODE;
 
     return 0;
 }
@@ -895,6 +954,9 @@ void sched_destroy_domain(struct domain *d)
 
         cpupool_rm_domain(d);
     }
+
+    /* All pages are gone by now, nobody is accounting them any more. */
+    XFREE(d->node_pages);
 }
 
 static void vcpu_sleep_nosync_locked(struct vcpu *v)
@@ -910,7 +972,10 @@ static void vcpu_sleep_nosync_locked(struct vcpu *v)
 
         /* Only put unit to sleep in case all vcpus are not runnable. */
         if ( likely(!unit_runnable(unit)) )
+        {
+            unit->wake_time = 0;
             sched_sleep(unit_scheduler(unit), unit);
+        }
         else if ( unit_running(unit) > 1 && v->is_running &&
                   !v->force_context_switch )
         {
@@ -963,7 +1028,13 @@ void vcpu_wake(struct vcpu *v)
     if ( likely(vcpu_runnable(v)) )
     {
         if ( v->runstate.state >= RUNSTATE_blocked )
-            vcpu_runstate_change(v, RUNSTATE_runnable, NOW());
+        {
+            s_time_t now = NOW();
+
+            vcpu_runstate_change(v, RUNSTATE_runnable, now);
+            if ( !unit->is_running )
+                unit->wake_time = now;
+        }
         /*
          * Call sched_wake() unconditionally, even if unit is running already.
          * We might have not been de-scheduled after vcpu_sleep_nosync_locked()
@@ -987,6 +1058,111 @@ void vcpu_wake(struct vcpu *v)
     rcu_read_unlock(&sched_res_rculock);
 }
 
+/*
+ * Wake up to VCPU_WAKE_BATCH vcpus. Those whose units share the same
+ * scheduler lock are all dealt with while holding it once, and are handed
+ * to the scheduler together, so that it can insert all of them in its
+ * runqueue(s) before deciding which pCPUs to tickle.
+ */
+static void vcpu_wake_chunk(struct vcpu *const *vcpus, unsigned int nr)
+{
+    DECLARE_BITMAP(done, VCPU_WAKE_BATCH);
+    DECLARE_BITMAP(woken, VCPU_WAKE_BATCH);
+    struct sched_unit *units[VCPU_WAKE_BATCH];
+    unsigned int i, k, n, first;
+
+    ASSERT(nr <= VCPU_WAKE_BATCH);
+    bitmap_zero(done, nr);
+
+    for ( first = 0; first < nr; first = find_next_zero_bit(done, nr, first) )
+    {
+        struct sched_unit *funit = vcpus[first]->sched_unit;
+        const struct scheduler *ops;
+        unsigned long flags;
+        spinlock_t *lock;
+        s_time_t now;
+
+        lock = unit_schedule_lock_irqsave(funit, &flags);
+        ops = unit_scheduler(funit);
+        now = NOW();
+        bitmap_zero(woken, nr);
+
+        for ( n = 0, i = first; i < nr; i++ )
+        {
+            struct vcpu *v = vcpus[i];
+            struct sched_unit *unit = v->sched_unit;
+
+            /*
+             * With the lock held, units using it can't move to a resource
+             * with a different one, so this check is stable.
+             */
+            if ( test_bit(i, done) ||
+                 get_sched_res(sched_unit_master(unit))->schedule_lock != lock ||
+                 unit_scheduler(unit) != ops )
+                continue;
+
+            __set_bit(i, done);
+
+            TRACE_2D(TRC_SCHED_WAKE, v->domain->domain_id, v->vcpu_id);
+
+            if ( likely(vcpu_runnable(v)) )
+            {
+                if ( v->runstate.state >= RUNSTATE_blocked )
+                {
+                    vcpu_runstate_change(v, RUNSTATE_runnable, now);
+                    if ( !unit->is_running )
+                        unit->wake_time = now;
+                }
+                __set_bit(i, woken);
+
+                /* Vcpus of the same unit (sched-gran > 1) show up once. */
+                for ( k = 0; k < n && units[k] != unit; k++ )
+                    continue;
+                if ( k == n )
+                    units[n++] = unit;
+            }
+            else if ( !(v->pause_flags & VPF_blocked) )
+            {
+                if ( v->runstate.state == RUNSTATE_blocked )
+                    vcpu_runstate_change(v, RUNSTATE_offline, now);
+            }
+        }
+
+        /* See vcpu_wake() for why this is called for running units too. */
+        sched_wake_many(ops, units, n);
+
+        for_each_set_bit ( i, woken, nr )
+        {
+            struct vcpu *v = vcpus[i];
+
+            if ( v->sched_unit->is_running && !v->is_running &&
+                 !v->force_context_switch )
+            {
+                v->force_context_switch = true;
+                cpu_raise_softirq(v->processor, SCHED_SLAVE_SOFTIRQ);
+            }
+        }
+
+        unit_schedule_unlock_irqrestore(lock, flags, funit);
+    }
+}
+
+void vcpu_wake_batch(struct vcpu *const *vcpus, unsigned int nr)
+{
+    rcu_read_lock(&sched_res_rculock);
+
+    while ( nr )
+    {
+        unsigned int chunk = min(nr, (unsigned int)VCPU_WAKE_BATCH);
+
+        vcpu_wake_chunk(vcpus, chunk);
+        vcpus += chunk;
+        nr -= chunk;
+    }
+
+    rcu_read_unlock(&sched_res_rculock);
+}
+
 void vcpu_unblock(struct vcpu *v)
 {
     if ( !test_and_clear_bit(_VPF_blocked, &v->pause_flags) )
@@ -1190,10 +1366,13 @@ static bool sched_check_affinity_broken(const struct sched_unit *unit)
 
 /*
  * This function is used by cpu_hotplug code via cpu notifier chain
- * and from cpupools to switch schedulers on a cpu.
+ * and from cpupools to switch schedulers on a set of cpus, all belonging to
+ * the same cpupool. Units running on any of the cpus are moved to the
+ * remaining cpus of the cpupool in a single pass, so a unit is never moved
+ * to a cpu which is about to be disabled, too.
  * Caller must get domlist_read_lock.
  */
-int cpu_disable_scheduler(unsigned int cpu)
+int cpus_disable_scheduler(const cpumask_t *cpus)
 {
     struct domain *d;
     const struct cpupool *c;
@@ -1201,7 +1380,7 @@ int cpu_disable_scheduler(unsigned int cpu)
 
     rcu_read_lock(&sched_res_rculock);
 
-    c = get_sched_res(cpu)->cpupool;
+    c = get_sched_res(cpumask_first(cpus))->cpupool;
     if ( c == NULL )
         goto out;
 
@@ -1215,7 +1394,7 @@ int cpu_disable_scheduler(unsigned int cpu)
             spinlock_t *lock = unit_schedule_lock_irqsave(unit, &flags);
 
             if ( !cpumask_intersects(unit->cpu_hard_affinity, c->cpu_valid) &&
-                 cpumask_test_cpu(cpu, unit->cpu_hard_affinity) )
+                 cpumask_intersects(unit->cpu_hard_affinity, cpus) )
             {
                 if ( sched_check_affinity_broken(unit) )
                 {
@@ -1231,9 +1410,9 @@ int cpu_disable_scheduler(unsigned int cpu)
                 sched_set_affinity(unit, &cpumask_all, NULL);
             }
 
-            if ( unit->res != get_sched_res(cpu) )
+            if ( !cpumask_intersects(unit->res->cpus, cpus) )
             {
-                /* The unit is not on this cpu, so we can move on. */
+                /* The unit is not on these cpus, so we can move on. */
                 unit_schedule_unlock_irqrestore(lock, flags, unit);
                 continue;
             }
@@ -1255,7 +1434,7 @@ int cpu_disable_scheduler(unsigned int cpu)
              * the hypervisor isn't migratable. In this case, the caller
              * should try again after releasing and reaquiring all locks.
              */
-            if ( unit->res == get_sched_res(cpu) )
+            if ( cpumask_intersects(unit->res->cpus, cpus) )
                 ret = -EAGAIN;
         }
     }
@@ -1266,6 +1445,11 @@ out:
     return ret;
 }
 
+int cpu_disable_scheduler(unsigned int cpu)
+{
+    return cpus_disable_scheduler(cpumask_of(cpu));
+}
+
 static int cpu_disable_scheduler_check(unsigned int cpu)
 {
     struct domain *d;
@@ -1396,6 +1580,79 @@ static int vcpu_set_soft_affinity(struct vcpu *v, const cpumask_t *affinity)
     return vcpu_set_affinity(v, affinity, v->sched_unit->cpu_soft_affinity);
 }
 
+/* The node with most of d's memory, if more than half of it is there. */
+static unsigned int sched_mem_node(const struct domain *d)
+{
+    const cpumask_t *cpus = d->cpupool->cpu_valid;
+    unsigned int node, best = NUMA_NO_NODE;
+    unsigned long total = 0, max = 0;
+
+    if ( !d->node_pages )
+        return NUMA_NO_NODE;
+
+    for_each_online_node ( node )
+    {
+        unsigned int pages = read_atomic(&d->node_pages[node]);
+
+        total += pages;
+        /* Following memory to a node without cpus in our cpupool is futile. */
+        if ( pages > max && cpumask_intersects(&node_to_cpumask(node), cpus) )
+        {
+            max = pages;
+            best = node;
+        }
+    }
+
+    return (max * 2 > total) ? best : NUMA_NO_NODE;
+}
+
+/*
+ * Set the soft affinity of d's units to the cpus of the node holding the
+ * majority of d's memory, as accounted in d->node_pages[]. Only units with
+ * the default soft affinity (all cpus), or with the one set here before, are
+ * touched, so a soft affinity set by the toolstack always takes precedence.
+ * Used by cpupool code with sched-mem-affinity, cpupool_lock must be held.
+ */
+void sched_domain_follow_memory(struct domain *d)
+{
+    unsigned int node = sched_mem_node(d);
+    const cpumask_t *old, *new;
+    struct sched_unit *unit;
+
+    if ( node == d->sched_mem_node )
+        return;
+
+    old = (d->sched_mem_node == NUMA_NO_NODE)
+          ? &cpumask_all : &node_to_cpumask(d->sched_mem_node);
+    new = (node == NUMA_NO_NODE) ? &cpumask_all : &node_to_cpumask(node);
+
+    rcu_read_lock(&sched_res_rculock);
+
+    for_each_sched_unit ( d, unit )
+    {
+        spinlock_t *lock = unit_schedule_lock_irq(unit);
+        bool migrate = false;
+
+        if ( !sched_check_affinity_broken(unit) &&
+             cpumask_equal(unit->cpu_soft_affinity, old) )
+        {
+            sched_set_affinity(unit, NULL, new);
+            sched_unit_migrate_start(unit);
+            migrate = true;
+        }
+
+        unit_schedule_unlock_irq(lock, unit);
+
+        if ( migrate )
+            sched_unit_migrate_finish(unit);
+    }
+
+    d->sched_mem_node = node;
+    domain_update_node_affinity(d);
+
+    rcu_read_unlock(&sched_res_rculock);
+}
+
 /* Block the currently-executing domain until a pertinent event occurs. */
 void vcpu_block(void)
 {
@@ -1581,7 +1838,7 @@ void watchdog_domain_init(struct domain *d)
     d->watchdog_inuse_map = 0;
 
     for ( i = 0; i < NR_DOMAIN_WATCHDOG_TIMERS; i++ )
-        init_timer(&d->watchdog_timer[i], domain_watchdog_timeout, d, 0);
+        init_coarse_timer(&d->watchdog_timer[i], domain_watchdog_timeout, d, 0);
 }
 
 void watchdog_domain_destroy(struct domain *d)
@@ -2164,6 +2421,9 @@ static void sched_switch_units(struct sched_resource *sr,
 
     ASSERT(unit_running(prev));
 
+    /* Keep or drop the switch's records, including runstate changes, alike. */
+    trace_sample_group_begin(TRC_SCHED);
+
     if ( prev != next )
     {
         sr->curr = next;
@@ -2189,6 +2449,15 @@ static void sched_switch_units(struct sched_resource *sr,
         next->is_running = true;
         next->state_entry_time = now;
 
+        if ( next->wake_time )
+        {
+            struct sched_hist *hist = sched_hist_get(sr->scheduler);
+
+            if ( hist )
+                sched_hist_add(hist->wake, now - next->wake_time);
+            next->wake_time = 0;
+        }
+
         if ( is_idle_unit(prev) )
         {
             prev->runstate_cnt[RUNSTATE_running] = 0;
@@ -2220,6 +2489,8 @@ static void sched_switch_units(struct sched_resource *sr,
         if ( is_idle_vcpu(vnext) )
             vnext->sched_unit = next;
     }
+
+    trace_sample_group_end(TRC_SCHED);
 }
 
 static bool sched_tasklet_check_cpu(unsigned int cpu)
@@ -2265,11 +2536,16 @@ static struct sched_unit *do_schedule(struct sched_unit *prev, s_time_t now,
 {
     struct sched_resource *sr = get_sched_res(cpu);
     struct scheduler *sched = sr->scheduler;
+    struct sched_hist *hist = sched_hist_get(sched);
     struct sched_unit *next;
+    s_time_t start = NOW();
 
     /* get policy-specific decision on scheduling... */
     sched->do_schedule(sched, prev, now, sched_tasklet_check(cpu));
 
+    if ( hist )
+        sched_hist_add(hist->cost, NOW() - start);
+
     next = prev->next_task;
 
     if ( prev->next_time >= 0 ) /* -ve means no limit */
@@ -2463,6 +2739,28 @@ static struct vcpu *sched_force_context_switch(struct vcpu *vprev,
     return v;
 }
 
+/*
+ * Wait for the rendezvous to complete without holding the schedule lock, so
+ * that the cpu doing the scheduling decision doesn't have to fight with all
+ * its waiting siblings for it. Returns as soon as anything happened which
+ * needs sched_wait_rendezvous_in() to look at the rendezvous state again,
+ * under the lock.
+ */
+static void sched_rendezvous_spin(const struct sched_unit *prev,
+                                  const struct vcpu *v,
+                                  const struct sched_resource *sr,
+                                  unsigned int cpu)
+{
+    while ( read_atomic(&prev->rendezvous_in_cnt) &&
+            !(v && read_atomic(&v->force_context_switch)) &&
+            !rcu_pending(cpu) &&
+            !(is_idle_unit(prev) &&
+              (read_atomic(&per_cpu(tasklet_work_to_do, cpu)) &
+               TASKLET_enqueued)) &&
+            sr == get_sched_res(cpu) && scheduler_active )
+        cpu_relax();
+}
+
 /*
  * Rendezvous before taking a scheduling decision.
  * Called with schedule lock held, so all accesses to the rendezvous counter
@@ -2472,6 +2770,9 @@ static struct vcpu *sched_force_context_switch(struct vcpu *vprev,
  * zero do_schedule() is called and the rendezvous counter for leaving
  * context_switch() is set. All other members will wait until the counter is
  * becoming zero, dropping the schedule lock in between.
+ * If the decision is to keep running the same unit (which includes an idle
+ * resource staying idle), no cpu has any unit context to save, so the
+ * rendezvous for leaving context_switch() is skipped.
  * Either returns the new unit to run, or NULL if no context switch is
  * required or (on Arm) has already been performed. If NULL is returned
  * sched_res_rculock has been dropped.
@@ -2488,7 +2789,7 @@ static struct sched_unit *sched_wait_rendezvous_in(struct sched_unit *prev,
     if ( !--prev->rendezvous_in_cnt )
     {
         next = do_schedule(prev, now, cpu);
-        atomic_set(&next->rendezvous_out_cnt, gran + 1);
+        atomic_set(&next->rendezvous_out_cnt, next == prev ? 0 : gran + 1);
         return next;
     }
 
@@ -2499,7 +2800,9 @@ static struct sched_unit *sched_wait_rendezvous_in(struct sched_unit *prev,
         {
             struct vcpu *vprev = current;
 
+            trace_sample_group_begin(TRC_SCHED);
             v = sched_force_context_switch(vprev, v, cpu, now);
+            trace_sample_group_end(TRC_SCHED);
 
             if ( v )
             {
@@ -2547,7 +2850,7 @@ static struct sched_unit *sched_wait_rendezvous_in(struct sched_unit *prev,
 
         pcpu_schedule_unlock_irq(*lock, cpu);
 
-        cpu_relax();
+        sched_rendezvous_spin(prev, v, sr, cpu);
 
         *lock = pcpu_schedule_lock_irq(cpu);
 
@@ -2593,7 +2896,9 @@ static void cf_check sched_slave(void)
     v = unit2vcpu_cpu(prev, cpu);
     if ( v && v->force_context_switch )
     {
+        trace_sample_group_begin(TRC_SCHED);
         v = sched_force_context_switch(vprev, v, cpu, now);
+        trace_sample_group_end(TRC_SCHED);
 
         if ( v )
         {
@@ -2971,6 +3276,164 @@ int __init sched_get_id_by_name(const char *sched_name)
     return scheduler ? scheduler->sched_id : -1;
 }
 
+#ifdef CONFIG_HYPFS
+/*
+ * /scheduler/<name>/{wake-latency,schedule-cost}: the latency histograms of
+ * each scheduler, summed over all online pCPUs, as a list of counts.
+ */
+struct sched_hist_leaf {
+    struct hypfs_entry_leaf leaf;
+    unsigned int idx;
+    bool cost;
+};
+
+/* Up to 20 digits and a separator (or the terminating NUL) per bucket. */
+#define SCHED_HIST_STRLEN (SCHED_HIST_BUCKETS * 21)
+
+struct sched_hist_str {
+    char buf[SCHED_HIST_STRLEN];
+};
+
+/* Snapshot taken when entering the node, so getsize() and read() agree. */
+static DEFINE_PER_CPU(char *, sched_hist_str);
+
+static unsigned int sched_hist_format(const struct hypfs_entry *entry,
+                                      char *buf)
+{
+    const struct sched_hist_leaf *l =
+        container_of(entry, const struct sched_hist_leaf, leaf.e);
+    unsigned long sum[SCHED_HIST_BUCKETS] = {};
+    unsigned int cpu, b, len = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct sched_hist *h = &per_cpu(sched_hist, cpu)[l->idx];
+        const unsigned long *hist = l->cost ? h->cost : h->wake;
+
+        for ( b = 0; b < SCHED_HIST_BUCKETS; b++ )
+            sum[b] += hist[b];
+    }
+
+    for ( b = 0; b < SCHED_HIST_BUCKETS; b++ )
+        len += snprintf(buf + len, SCHED_HIST_STRLEN - len, "%s%lu",
+                        b ? " " : "", sum[b]);
+
+    return len + 1;
+}
+
+static const struct hypfs_entry *cf_check sched_hist_enter(
+    const struct hypfs_entry *entry)
+{
+    struct sched_hist_str *str = hypfs_alloc_dyndata(struct sched_hist_str);
+
+    if ( !str )
+        return ERR_PTR(-ENOMEM);
+
+    sched_hist_format(entry, str->buf);
+    this_cpu(sched_hist_str) = str->buf;
+
+    return entry;
+}
+
+static void cf_check sched_hist_exit(const struct hypfs_entry *entry)
+{
+    this_cpu(sched_hist_str) = NULL;
+    hypfs_free_dyndata();
+}
+
+static int cf_check sched_hist_read(
+    const struct hypfs_entry *entry, XEN_GUEST_HANDLE_PARAM(void) uaddr)
+{
+    const char *buf = this_cpu(sched_hist_str);
+
+    ASSERT(buf);
+
+    return copy_to_guest(uaddr, buf, strlen(buf) + 1) ? -EFAULT : 0;
+}
+
+static unsigned int cf_check sched_hist_getsize(
+    const struct hypfs_entry *entry)
+{
+    const char *str = this_cpu(sched_hist_str);
+    unsigned int size;
+    char *buf;
+
+    if ( str )
+        return strlen(str) + 1;
+
+    /* Listing the parent directory: the node hasn't been entered. */
+    buf = xmalloc_array(char, SCHED_HIST_STRLEN);
+    if ( !buf )
+        return 0;
+    size = sched_hist_format(entry, buf);
+    xfree(buf);
+
+    return size;
+}
+
+static const struct hypfs_funcs sched_hist_funcs = {
+    .enter = sched_hist_enter,
+    .exit = sched_hist_exit,
+    .read = sched_hist_read,
+    .write = hypfs_write_deny,
+    .getsize = sched_hist_getsize,
+    .findentry = hypfs_leaf_findentry,
+};
+
+static HYPFS_DIR_INIT(sched_hist_dir, "scheduler");
+
+static void __init sched_hist_add_leaf(struct hypfs_entry_dir *dir,
+                                       unsigned int idx, bool cost)
+{
+    struct sched_hist_leaf *l = xzalloc(struct sched_hist_leaf);
+
+    if ( !l )
+        panic("No memory for scheduler latency histograms\n");
+
+    l->leaf.e.type = XEN_HYPFS_TYPE_STRING;
+    l->leaf.e.encoding = XEN_HYPFS_ENC_PLAIN;
+    l->leaf.e.name = cost ? "schedule-cost" : "wake-latency";
+    l->leaf.e.funcs = &sched_hist_funcs;
+    l->idx = idx;
+    l->cost = cost;
+
+    hypfs_add_leaf(dir, &l->leaf, true);
+}
+
+static int __init cf_check sched_hist_hypfs_init(void)
+{
+    unsigned int i;
+
+    hypfs_add_dir(&hypfs_root, &sched_hist_dir, true);
+
+    for ( i = 0; i < NUM_SCHEDULERS && i < SCHED_HIST_NR; i++ )
+    {
+        struct hypfs_entry_dir *dir;
+
+        if ( !schedulers[i] )
+            continue;
+
+        dir = xzalloc(struct hypfs_entry_dir);
+        if ( !dir )
+            panic("No memory for scheduler latency histograms\n");
+
+        dir->e.type = XEN_HYPFS_TYPE_DIR;
+        dir->e.encoding = XEN_HYPFS_ENC_PLAIN;
+        dir->e.name = schedulers[i]->opt_name;
+        dir->e.funcs = &hypfs_dir_funcs;
+        INIT_LIST_HEAD(&dir->e.list);
+        INIT_LIST_HEAD(&dir->dirlist);
+        hypfs_add_dir(&sched_hist_dir, dir, true);
+
+        sched_hist_add_leaf(dir, i, false);
+        sched_hist_add_leaf(dir, i, true);
+    }
+
+    return 0;
+}
+__initcall(sched_hist_hypfs_init);
+#endif /* CONFIG_HYPFS */
+
 /* Initialise the data structures. */
 void __init scheduler_init(void)
 {
@@ -3008,6 +3471,11 @@ void __init scheduler_init(void)
         }
     }
 
+    if ( NUM_SCHEDULERS > SCHED_HIST_NR )
+        printk(XENLOG_WARNING
+               "Only the first %u schedulers have latency histograms\n",
+               SCHED_HIST_NR);
+
     scheduler = sched_get_by_name(opt_sched);
     if ( !scheduler )
     {
@@ -3017,6 +3485,9 @@ void __init scheduler_init(void)
         printk("Using '%s' (%s)\n", scheduler->name, scheduler->opt_name);
     }
     ops = *scheduler;
+    for ( i = 0; schedulers[i] != scheduler; i++ )
+        continue;
+    ops.hist_idx = i;
 
     if ( cpu_schedule_up(0) )
         BUG();
@@ -3381,6 +3852,7 @@ struct scheduler *scheduler_alloc(unsigned int sched_id)
     if ( (sched = xmalloc(struct scheduler)) == NULL )
         return ERR_PTR(-ENOMEM);
     memcpy(sched, schedulers[i], sizeof(*sched));
+    sched->hist_idx = i;
     if ( (ret = sched_init(sched)) != 0 )
     {
         xfree(sched);
@@ -3446,7 +3918,8 @@ void schedule_dump(struct cpupool *c)
 
 void wait(void)
 {
-    schedule();
+    if ( save_wait_context() )
+        schedule();
 }
 
 #ifdef CONFIG_X86
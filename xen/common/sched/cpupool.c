@@ -39,6 +39,13 @@ static cpumask_t cpupool_locked_cpus;
 /* This lock nests inside sysctl or hypfs lock. */
 static DEFINE_SPINLOCK(cpupool_lock);
 
+/* Let soft affinity follow the memory of domains. */
+bool __read_mostly opt_sched_mem_affinity;
+boolean_param("sched-mem-affinity", opt_sched_mem_affinity);
+
+#define SCHED_MEM_AFF_PERIOD    SECONDS(1)
+static struct timer sched_mem_aff_timer;
+
 static enum sched_gran __read_mostly opt_sched_granularity = SCHED_GRAN_cpu;
 static unsigned int __read_mostly sched_granularity = 1;
 
@@ -436,10 +443,42 @@ static void cpupool_update_node_affinity(const struct cpupool *c,
 }
 
 /*
- * assign a specific cpu to a cpupool
+ * Periodically check where the memory of the domains is, and let the domains'
+ * soft affinity follow it.
+ */
+static void cf_check sched_mem_aff_work(void *unused)
+{
+    struct cpupool *c;
+    struct domain *d;
+
+    spin_lock(&cpupool_lock);
+    rcu_read_lock(&domlist_read_lock);
+
+    list_for_each_entry(c, &cpupool_list, list)
+        for_each_domain_in_cpupool ( d, c )
+            if ( !d->is_dying )
+                sched_domain_follow_memory(d);
+
+    rcu_read_unlock(&domlist_read_lock);
+    spin_unlock(&cpupool_lock);
+
+    set_timer(&sched_mem_aff_timer, NOW() + SCHED_MEM_AFF_PERIOD);
+}
+
+/* Done in idle vcpu context, as units may be migrated. */
+static DECLARE_TASKLET(sched_mem_aff_tasklet, sched_mem_aff_work, NULL);
+
+static void cf_check sched_mem_aff_timer_fn(void *unused)
+{
+    tasklet_schedule(&sched_mem_aff_tasklet);
+}
+
+/*
+ * assign a specific cpu to a cpupool without updating the domains' node
+ * affinities
  * cpupool_lock must be held
  */
-static int cpupool_assign_cpu_locked(struct cpupool *c, unsigned int cpu)
+static int __cpupool_assign_cpu(struct cpupool *c, unsigned int cpu)
 {
     int ret;
     const cpumask_t *cpus;
@@ -466,11 +505,23 @@ static int cpupool_assign_cpu_locked(struct cpupool *c, unsigned int cpu)
 
     rcu_read_unlock(&sched_res_rculock);
 
-    cpupool_update_node_affinity(c, NULL);
-
     return 0;
 }
 
+/*
+ * assign a specific cpu to a cpupool
+ * cpupool_lock must be held
+ */
+static int cpupool_assign_cpu_locked(struct cpupool *c, unsigned int cpu)
+{
+    int ret = __cpupool_assign_cpu(c, cpu);
+
+    if ( !ret )
+        cpupool_update_node_affinity(c, NULL);
+
+    return ret;
+}
+
 static int cpupool_unassign_cpu_finish(struct cpupool *c,
                                        struct cpu_rm_data *mem)
 {
@@ -632,6 +683,206 @@ static int cpupool_unassign_cpu(struct cpupool *c, unsigned int cpu)
     return continue_hypercall_on_cpu(work_cpu, cpupool_unassign_cpu_helper, c);
 }
 
+/* Parameters of a batched cpu move, handed to the continuation. */
+struct cpupool_move_info {
+    struct cpupool *c;     /* destination, reference held */
+    cpumask_t cpus;        /* cpus to end up in c */
+    cpumask_t rm;          /* cpus to remove from their current cpupool */
+};
+
+/*
+ * move a set of cpus to a cpupool in one go
+ * All cpus not yet in c must either be free or belong to the same cpupool.
+ * Compared to removing and adding the cpus one by one, the units running on
+ * the cpus are moved away in a single pass over the domains of the old
+ * cpupool and only to cpus staying there, and the domains' node affinities
+ * are updated only once per cpupool.
+ * cpus already in c are skipped, so after a failure the operation can be
+ * retried with the same parameters. In case of failure nothing has been
+ * changed, apart from cpus having been moved to the free cpus already.
+ * cpupool_lock must be held
+ */
+static int cpupool_move_cpus_locked(struct cpupool_move_info *info)
+{
+    struct cpupool *c = info->c, *old = NULL;
+    const struct sched_resource *sr;
+    unsigned int cpu, cpu_iter;
+    int ret = 0;
+
+    if ( cpupool_moving_cpu != -1 )
+        return -EADDRNOTAVAIL;
+
+    cpumask_andnot(&info->cpus, &info->cpus, c->cpu_valid);
+    if ( cpumask_empty(&info->cpus) )
+        return 0;
+    if ( !cpumask_subset(&info->cpus, &cpu_online_map) )
+        return -EINVAL;
+
+    rcu_read_lock(&sched_res_rculock);
+
+    /* Find the cpupool the cpus are coming from, always moving whole units. */
+    cpumask_clear(&info->rm);
+    for_each_cpu ( cpu, &info->cpus )
+    {
+        sr = get_sched_res(cpu);
+        if ( sr->cpupool == NULL )
+            continue;
+
+        ret = -EINVAL;
+        if ( old && sr->cpupool != old )
+            goto out_rcu;
+        old = sr->cpupool;
+        cpumask_or(&info->rm, &info->rm, sr->cpus);
+    }
+    cpumask_or(&info->cpus, &info->cpus, &info->rm);
+
+    /* Cpu0 must remain in cpupool0, see cpupool_unassign_cpu(). */
+    ret = -EINVAL;
+    if ( old == cpupool0 && cpumask_test_cpu(0, &info->rm) )
+        goto out_rcu;
+    ret = -EBUSY;
+    if ( old && old->n_dom && cpumask_subset(old->cpu_valid, &info->rm) )
+        goto out_rcu;
+
+    ret = -ENODEV;
+    if ( cpumask_intersects(&info->cpus, &cpupool_locked_cpus) )
+        goto out_rcu;
+    for_each_cpu ( cpu, &info->cpus )
+    {
+        if ( !cpumask_test_cpu(cpu, &info->rm) &&
+             !cpumask_test_cpu(cpu, &cpupool_free_cpus) )
+            goto out_rcu;
+        for_each_cpu ( cpu_iter, sched_get_opt_cpumask(c->gran, cpu) )
+            if ( !cpumask_test_cpu(cpu_iter, &info->cpus) &&
+                 (!cpumask_test_cpu(cpu_iter, &cpupool_free_cpus) ||
+                  cpumask_test_cpu(cpu_iter, &cpupool_locked_cpus)) )
+                goto out_rcu;
+    }
+
+    ret = 0;
+    if ( old )
+    {
+        cpumask_andnot(old->cpu_valid, old->cpu_valid, &info->rm);
+        cpumask_and(old->res_valid, old->cpu_valid, &sched_res_mask);
+    }
+
+    rcu_read_unlock(&sched_res_rculock);
+
+    if ( old )
+    {
+        rcu_read_lock(&domlist_read_lock);
+        ret = cpus_disable_scheduler(&info->rm);
+        rcu_read_unlock(&domlist_read_lock);
+
+        rcu_read_lock(&sched_res_rculock);
+
+        for_each_cpu ( cpu, &info->rm )
+        {
+            sr = get_sched_res(cpu);
+            if ( ret || sr->cpupool != old )
+                continue;
+
+            cpumask_or(&cpupool_free_cpus, &cpupool_free_cpus, sr->cpus);
+            ret = schedule_cpu_rm(sr->master_cpu, NULL);
+            if ( ret )
+                cpumask_andnot(&cpupool_free_cpus, &cpupool_free_cpus,
+                               sr->cpus);
+        }
+
+        /* Give the cpus not moved back to the old cpupool. */
+        if ( ret )
+        {
+            for_each_cpu ( cpu, &info->rm )
+                if ( get_sched_res(cpu)->cpupool == old )
+                    cpumask_set_cpu(cpu, old->cpu_valid);
+            cpumask_and(old->res_valid, old->cpu_valid, &sched_res_mask);
+        }
+
+        rcu_read_unlock(&sched_res_rculock);
+
+        cpupool_update_node_affinity(old, NULL);
+
+        if ( ret )
+            return ret;
+    }
+
+    for_each_cpu ( cpu, &info->cpus )
+    {
+        if ( !cpumask_test_cpu(cpu, &cpupool_free_cpus) )
+            continue;
+        ret = __cpupool_assign_cpu(c, cpu);
+        if ( ret )
+            break;
+    }
+
+    cpupool_update_node_affinity(c, NULL);
+
+    return ret;
+
+ out_rcu:
+    rcu_read_unlock(&sched_res_rculock);
+
+    return ret;
+}
+
+static long cf_check cpupool_move_cpus_helper(void *data)
+{
+    struct cpupool_move_info *info = data;
+    bool moving;
+    long ret;
+
+    debugtrace_printk("cpupool_move_cpus(pool=%u,cpus=%*pbl)\n",
+                      info->c->cpupool_id, CPUMASK_PR(&info->cpus));
+    spin_lock(&cpupool_lock);
+
+    /* We must not run on one of the cpus to be moved, try again. */
+    rcu_read_lock(&sched_res_rculock);
+    moving = cpumask_intersects(get_sched_res(smp_processor_id())->cpus,
+                                &info->cpus);
+    rcu_read_unlock(&sched_res_rculock);
+
+    ret = moving ? -EAGAIN : cpupool_move_cpus_locked(info);
+
+    spin_unlock(&cpupool_lock);
+    debugtrace_printk("cpupool_move_cpus ret=%ld\n", ret);
+
+    cpupool_put(info->c);
+    xfree(info);
+
+    return ret;
+}
+
+/*
+ * move a set of cpus to a cpupool
+ * As with cpupool_unassign_cpu() the work is done via
+ * continue_hypercall_on_cpu() on a cpu not being moved, but only once for
+ * all cpus.
+ * The reference of c and info are consumed.
+ */
+static int cpupool_move_cpus(struct cpupool_move_info *info)
+{
+    unsigned int work_cpu;
+    int ret;
+
+    rcu_read_lock(&sched_res_rculock);
+    for_each_cpu ( work_cpu, &cpu_online_map )
+        if ( !cpumask_intersects(get_sched_res(work_cpu)->cpus, &info->cpus) )
+            break;
+    rcu_read_unlock(&sched_res_rculock);
+
+    ret = -EINVAL;
+    if ( work_cpu < nr_cpu_ids )
+        ret = continue_hypercall_on_cpu(work_cpu, cpupool_move_cpus_helper,
+                                        info);
+    if ( ret )
+    {
+        cpupool_put(info->c);
+        xfree(info);
+    }
+
+    return ret;
+}
+
 /*
  * add a new domain to a cpupool
  * possible failures:
@@ -957,6 +1208,30 @@ int cpupool_do_sysctl(struct xen_sysctl_cpupool_op *op)
     }
     break;
 
+    case XEN_SYSCTL_CPUPOOL_OP_MOVECPUS:
+    {
+        struct cpupool_move_info *info;
+
+        c = cpupool_get_by_id(op->cpupool_id);
+        ret = -ENOENT;
+        if ( c == NULL )
+            break;
+        ret = -ENOMEM;
+        info = xzalloc(struct cpupool_move_info);
+        if ( info )
+            ret = xenctl_bitmap_to_bitmap(cpumask_bits(&info->cpus),
+                                          &op->cpumap, nr_cpu_ids);
+        if ( ret )
+        {
+            xfree(info);
+            cpupool_put(c);
+            break;
+        }
+        info->c = c;
+        ret = cpupool_move_cpus(info);
+    }
+    break;
+
     case XEN_SYSCTL_CPUPOOL_OP_FREEINFO:
     {
         ret = cpumask_to_xenctl_bitmap(
@@ -1322,6 +1597,13 @@ static int __init cf_check cpupool_init(void)
 
     spin_unlock(&cpupool_lock);
 
+    if ( opt_sched_mem_affinity )
+    {
+        init_coarse_timer(&sched_mem_aff_timer, sched_mem_aff_timer_fn,
+                          NULL, 0);
+        set_timer(&sched_mem_aff_timer, NOW() + SCHED_MEM_AFF_PERIOD);
+    }
+
     return 0;
 }
 __initcall(cpupool_init);
@@ -153,6 +153,8 @@ struct csched_pcpu {
 
     unsigned int idle_bias;
     unsigned int nr_runnable;
+    /* Priority of the runq head, read by stealing pCPUs without locking. */
+    int steal_pri;
 
     unsigned int tick;
     struct timer ticker;
@@ -273,6 +275,23 @@ dec_nr_runnable(unsigned int cpu)
     CSCHED_PCPU(cpu)->nr_runnable--;
 }
 
+/*
+ * Publish the priority of the first unit in cpu's runq, for other pCPUs to
+ * look at without taking our scheduler lock (see csched_steal_victims()).
+ * Priorities of queued units can change without their runq being touched
+ * (e.g., in csched_acct()), so this is a hint, but it is refreshed at least
+ * every time the runq is sorted.
+ */
+static inline void
+runq_update_steal_pri(unsigned int cpu)
+{
+    const struct list_head * const runq = RUNQ(cpu);
+
+    write_atomic(&CSCHED_PCPU(cpu)->steal_pri,
+                 list_empty(runq) ? CSCHED_PRI_IDLE
+                                  : __runq_elem(runq->next)->pri);
+}
+
 static inline void
 __runq_insert(struct csched_unit *svc)
 {
@@ -302,6 +321,7 @@ __runq_insert(struct csched_unit *svc)
     }
 
     list_add_tail(&svc->runq_elem, iter);
+    runq_update_steal_pri(cpu);
 }
 
 static inline void
@@ -316,6 +336,7 @@ __runq_remove(struct csched_unit *svc)
 {
     BUG_ON( !__unit_on_runq(svc) );
     list_del_init(&svc->runq_elem);
+    runq_update_steal_pri(sched_unit_master(svc->unit));
 }
 
 static inline void
@@ -348,9 +369,17 @@ static void burn_credits(struct csched_unit *svc, s_time_t now)
 static bool __read_mostly opt_tickle_one_idle = true;
 boolean_param("tickle_one_idle_cpu", opt_tickle_one_idle);
 
+static bool __read_mostly opt_steal_hint;
+boolean_runtime_param("sched_credit_steal_hint", opt_steal_hint);
+
 static DEFINE_PER_CPU(unsigned int, last_tickle_cpu);
 
-static inline void __runq_tickle(const struct csched_unit *new)
+/*
+ * Decide which pcpus to tickle for new, and add them to picked. The pcpus
+ * already in picked (e.g., because of other units being woken in the same
+ * batch) are not considered idle any longer.
+ */
+static void runq_tickle_pick(const struct csched_unit *new, cpumask_t *picked)
 {
     unsigned int cpu = sched_unit_master(new->unit);
     const struct sched_resource *sr = get_sched_res(cpu);
@@ -365,6 +394,7 @@ static inline void __runq_tickle(const struct csched_unit *new)
 
     online = cpupool_domain_master_cpumask(new->sdom->dom);
     cpumask_and(&idle_mask, prv->idlers, online);
+    cpumask_andnot(&idle_mask, &idle_mask, picked);
     idlers_empty = cpumask_empty(&idle_mask);
 
     /*
@@ -482,31 +512,50 @@ static inline void __runq_tickle(const struct csched_unit *new)
 
  tickle:
     if ( !cpumask_empty(&mask) )
-    {
-        if ( unlikely(tb_init_done) )
-        {
-            /* Avoid TRACE_*: saves checking !tb_init_done each step */
-            for_each_cpu(cpu, &mask)
-                __trace_var(TRC_CSCHED_TICKLE, 1, sizeof(cpu), &cpu);
-        }
-
-        /*
-         * Mark the designated CPUs as busy and send them all the scheduler
-         * interrupt. We need the for_each_cpu for dealing with the
-         * !opt_tickle_one_idle case. We must use cpumask_clear_cpu() and
-         * can't use cpumask_andnot(), because prv->idlers needs atomic access.
-         *
-         * In the default (and most common) case, when opt_rickle_one_idle is
-         * true, the loop does only one step, and only one bit is cleared.
-         */
-        for_each_cpu(cpu, &mask)
-            cpumask_clear_cpu(cpu, prv->idlers);
-        cpumask_raise_softirq(&mask, SCHEDULE_SOFTIRQ);
-    }
+        cpumask_or(picked, picked, &mask);
     else
         SCHED_STAT_CRANK(tickled_no_cpu);
 }
 
+static void runq_tickle_commit(struct csched_private *prv,
+                               const cpumask_t *mask)
+{
+    unsigned int cpu;
+
+    if ( cpumask_empty(mask) )
+        return;
+
+    if ( unlikely(tb_init_done) )
+    {
+        /* Avoid TRACE_*: saves checking !tb_init_done each step */
+        for_each_cpu(cpu, mask)
+            __trace_var(TRC_CSCHED_TICKLE, 1, sizeof(cpu), &cpu);
+    }
+
+    /*
+     * Mark the designated CPUs as busy and send them all the scheduler
+     * interrupt. We need the for_each_cpu for dealing with the
+     * !opt_tickle_one_idle case. We must use cpumask_clear_cpu() and
+     * can't use cpumask_andnot(), because prv->idlers needs atomic access.
+     *
+     * In the default (and most common) case, when opt_rickle_one_idle is
+     * true, the loop does only one step, and only one bit is cleared.
+     */
+    for_each_cpu(cpu, mask)
+        cpumask_clear_cpu(cpu, prv->idlers);
+    cpumask_raise_softirq(mask, SCHEDULE_SOFTIRQ);
+}
+
+static inline void __runq_tickle(const struct csched_unit *new)
+{
+    cpumask_t mask;
+
+    cpumask_clear(&mask);
+    runq_tickle_pick(new, &mask);
+    runq_tickle_commit(CSCHED_PRIV(get_sched_res(
+                           sched_unit_master(new->unit))->scheduler), &mask);
+}
+
 static void cf_check
 csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
 {
@@ -593,7 +642,7 @@ init_pdata(struct csched_private *prv, struct csched_pcpu *spc, int cpu)
     if ( prv->ncpus == 1 )
     {
         prv->master = cpu;
-        init_timer(&prv->master_ticker, csched_acct, prv, cpu);
+        init_coarse_timer(&prv->master_ticker, csched_acct, prv, cpu);
         set_timer(&prv->master_ticker, NOW() + prv->tslice);
     }
 
@@ -612,6 +661,7 @@ init_pdata(struct csched_private *prv, struct csched_pcpu *spc, int cpu)
     BUG_ON(!is_idle_unit(curr_on_cpu(cpu)));
     cpumask_set_cpu(cpu, prv->idlers);
     spc->nr_runnable = 0;
+    spc->steal_pri = CSCHED_PRI_IDLE;
 }
 
 static void cf_check
@@ -1105,8 +1155,11 @@ csched_unit_sleep(const struct scheduler *ops, struct sched_unit *unit)
         runq_remove(svc);
 }
 
-static void cf_check
-csched_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
+/*
+ * Put a waking unit in its runqueue, if it needs to go there. Returns true
+ * if it did, in which case the caller must tickle pcpus for it.
+ */
+static bool unit_wake_insert(struct sched_unit *unit)
 {
     struct csched_unit * const svc = CSCHED_UNIT(unit);
     bool migrating;
@@ -1116,12 +1169,12 @@ csched_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
     if ( unlikely(curr_on_cpu(sched_unit_master(unit)) == unit) )
     {
         SCHED_STAT_CRANK(unit_wake_running);
-        return;
+        return false;
     }
     if ( unlikely(__unit_on_runq(svc)) )
     {
         SCHED_STAT_CRANK(unit_wake_onrunq);
-        return;
+        return false;
     }
 
     if ( likely(unit_runnable(unit)) )
@@ -1162,9 +1215,58 @@ csched_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
         svc->pri = CSCHED_PRI_TS_BOOST;
     }
 
-    /* Put the UNIT on the runq and tickle CPUs */
+    /* Put the UNIT on the runq */
     runq_insert(svc);
-    __runq_tickle(svc);
+
+    return true;
+}
+
+static void cf_check
+csched_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
+{
+    if ( unit_wake_insert(unit) )
+        __runq_tickle(CSCHED_UNIT(unit));
+}
+
+/*
+ * All the units share the same pcpu runqueue. Insert all of them, and then
+ * decide which pcpus to tickle for each one, in runqueue (i.e., priority)
+ * order, so that the most important ones get the best pcpus. All the
+ * chosen pcpus are then poked at once.
+ */
+static void cf_check
+csched_unit_wake_many(const struct scheduler *ops, struct sched_unit **units,
+                      unsigned int nr)
+{
+    struct csched_private *prv = CSCHED_PRIV(ops);
+    struct list_head *iter;
+    unsigned int i, left, n = 0;
+    cpumask_t mask;
+
+    for ( i = 0; i < nr; i++ )
+        if ( unit_wake_insert(units[i]) )
+            units[n++] = units[i];
+
+    if ( !n )
+        return;
+
+    cpumask_clear(&mask);
+    left = n;
+    list_for_each ( iter, RUNQ(sched_unit_master(units[0])) )
+    {
+        const struct csched_unit *svc = __runq_elem(iter);
+
+        for ( i = 0; i < n && units[i] != svc->unit; i++ )
+            continue;
+        if ( i == n )
+            continue;
+
+        runq_tickle_pick(svc, &mask);
+        if ( !--left )
+            break;
+    }
+
+    runq_tickle_commit(prv, &mask);
 }
 
 static void cf_check
@@ -1364,6 +1466,8 @@ csched_runq_sort(struct csched_private *prv, unsigned int cpu)
         elem = next;
     }
 
+    runq_update_steal_pri(cpu);
+
     pcpu_schedule_unlock_irqrestore(lock, flags, cpu);
 }
 
@@ -1676,6 +1780,92 @@ csched_runq_steal(int peer_cpu, int cpu, int pri, int balance_step)
     return NULL;
 }
 
+/* Try to steal work from peer_cpu, not spinning on its scheduler lock. */
+static struct csched_unit *
+csched_runq_trysteal(int peer_cpu, int cpu, int pri, int balance_step)
+{
+    const cpumask_t *online = get_sched_res(cpu)->cpupool->res_valid;
+    struct csched_unit *speer;
+    spinlock_t *lock;
+
+    /*
+     * Get ahold of the scheduler lock for this peer CPU.
+     *
+     * Note: We don't spin on this lock but simply try it. Spinning
+     * could cause a deadlock if the peer CPU is also load
+     * balancing and trying to lock this CPU.
+     */
+    lock = pcpu_schedule_trylock(peer_cpu);
+    SCHED_STAT_CRANK(steal_trylock);
+    if ( !lock )
+    {
+        SCHED_STAT_CRANK(steal_trylock_failed);
+        TRACE_2D(TRC_CSCHED_STEAL_CHECK, peer_cpu, /* skip */ 0);
+        return NULL;
+    }
+
+    TRACE_2D(TRC_CSCHED_STEAL_CHECK, peer_cpu, /* checked */ 1);
+
+    /* Any work over there to steal? */
+    speer = cpumask_test_cpu(peer_cpu, online) ?
+        csched_runq_steal(peer_cpu, cpu, pri, balance_step) : NULL;
+    pcpu_schedule_unlock(lock, peer_cpu);
+
+    return speer;
+}
+
+/*
+ * Number of pCPUs csched_steal_victims() picks for a node, i.e., how many
+ * trylocks the hint-driven balancer attempts there at most.
+ */
+#define CSCHED_STEAL_CANDIDATES 4
+
+/*
+ * Find (up to CSCHED_STEAL_CANDIDATES of) the pCPUs among workers with the
+ * highest priority work, higher than pri, in their runq, starting from bias.
+ * They are returned in victims[], best first. This is done in a single pass
+ * and without taking any lock, relying on what the pCPUs publish in
+ * runq_update_steal_pri(), so we will try to take the scheduler lock of only
+ * those pCPUs that really look like having something for us.
+ */
+static unsigned int
+csched_steal_victims(const cpumask_t *workers, unsigned int bias, int pri,
+                     unsigned int victims[CSCHED_STEAL_CANDIDATES])
+{
+    int pris[CSCHED_STEAL_CANDIDATES];
+    unsigned int peer_cpu, first_cpu, nr = 0, i;
+
+    first_cpu = cpumask_cycle(bias, workers);
+    if ( first_cpu >= nr_cpu_ids )
+        return 0;
+
+    peer_cpu = first_cpu;
+    do
+    {
+        const struct csched_pcpu *spc = CSCHED_PCPU(peer_cpu);
+        int peer_pri = read_atomic(&spc->steal_pri);
+
+        /* As in csched_load_balance(), a single runnable unit is not ours. */
+        if ( peer_pri > pri && spc->nr_runnable > 1 &&
+             (nr < CSCHED_STEAL_CANDIDATES || peer_pri > pris[nr - 1]) )
+        {
+            /* Insertion into the (short) sorted array of candidates. */
+            i = nr < CSCHED_STEAL_CANDIDATES ? nr++ : nr - 1;
+            for ( ; i > 0 && pris[i - 1] < peer_pri; i-- )
+            {
+                pris[i] = pris[i - 1];
+                victims[i] = victims[i - 1];
+            }
+            pris[i] = peer_pri;
+            victims[i] = peer_cpu;
+        }
+
+        peer_cpu = cpumask_cycle(peer_cpu, workers);
+    } while ( peer_cpu != first_cpu );
+
+    return nr;
+}
+
 static struct csched_unit *
 csched_load_balance(struct csched_private *prv, int cpu,
     struct csched_unit *snext, bool *stolen)
@@ -1724,14 +1914,34 @@ csched_load_balance(struct csched_private *prv, int cpu,
             cpumask_and(&workers, &workers, &node_to_cpumask(peer_node));
             __cpumask_clear_cpu(cpu, &workers);
 
+            /*
+             * With sched_credit_steal_hint, only try the pCPUs which look
+             * like having work for us, best first.
+             */
+            if ( opt_steal_hint )
+            {
+                unsigned int victims[CSCHED_STEAL_CANDIDATES], nr, i;
+
+                nr = csched_steal_victims(&workers,
+                                          prv->balance_bias[peer_node],
+                                          snext->pri, victims);
+                for ( i = 0; i < nr; i++ )
+                {
+                    peer_cpu = victims[i];
+                    speer = csched_runq_trysteal(peer_cpu, cpu, snext->pri,
+                                                 bstep);
+                    if ( speer != NULL )
+                        goto stolen;
+                }
+                goto next_node;
+            }
+
             first_cpu = cpumask_cycle(prv->balance_bias[peer_node], &workers);
             if ( first_cpu >= nr_cpu_ids )
                 goto next_node;
             peer_cpu = first_cpu;
             do
             {
-                spinlock_t *lock;
-
                 /*
                  * If there is only one runnable unit on peer_cpu, it means
                  * there's no one to be stolen in its runqueue, so skip it.
@@ -1764,41 +1974,11 @@ csched_load_balance(struct csched_private *prv, int cpu,
                     goto next_cpu;
                 }
 
-                /*
-                 * Get ahold of the scheduler lock for this peer CPU.
-                 *
-                 * Note: We don't spin on this lock but simply try it. Spinning
-                 * could cause a deadlock if the peer CPU is also load
-                 * balancing and trying to lock this CPU.
-                 */
-                lock = pcpu_schedule_trylock(peer_cpu);
-                SCHED_STAT_CRANK(steal_trylock);
-                if ( !lock )
-                {
-                    SCHED_STAT_CRANK(steal_trylock_failed);
-                    TRACE_2D(TRC_CSCHED_STEAL_CHECK, peer_cpu, /* skip */ 0);
-                    goto next_cpu;
-                }
-
-                TRACE_2D(TRC_CSCHED_STEAL_CHECK, peer_cpu, /* checked */ 1);
-
-                /* Any work over there to steal? */
-                speer = cpumask_test_cpu(peer_cpu, online) ?
-                    csched_runq_steal(peer_cpu, cpu, snext->pri, bstep) : NULL;
-                pcpu_schedule_unlock(lock, peer_cpu);
+                speer = csched_runq_trysteal(peer_cpu, cpu, snext->pri, bstep);
 
                 /* As soon as one unit is found, balancing ends */
                 if ( speer != NULL )
-                {
-                    *stolen = true;
-                    /*
-                     * Next time we'll look for work to steal on this node, we
-                     * will start from the next pCPU, with respect to this one,
-                     * so we don't risk stealing always from the same ones.
-                     */
-                    prv->balance_bias[peer_node] = peer_cpu;
-                    return speer;
-                }
+                    goto stolen;
 
  next_cpu:
                 peer_cpu = cpumask_cycle(peer_cpu, &workers);
@@ -1814,6 +1994,16 @@ csched_load_balance(struct csched_private *prv, int cpu,
     /* Failed to find more important work elsewhere... */
     __runq_remove(snext);
     return snext;
+
+ stolen:
+    *stolen = true;
+    /*
+     * Next time we'll look for work to steal on this node, we will start
+     * from the next pCPU, with respect to this one, so we don't risk
+     * stealing always from the same ones.
+     */
+    prv->balance_bias[peer_node] = peer_cpu;
+    return speer;
 }
 
 /*
@@ -2255,6 +2445,7 @@ static const struct scheduler sched_credit_def = {
 
     .sleep          = csched_unit_sleep,
     .wake           = csched_unit_wake,
+    .wake_many      = csched_unit_wake_many,
     .yield          = csched_unit_yield,
 
     .adjust         = csched_dom_cntl,
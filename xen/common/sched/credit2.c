@@ -425,6 +425,10 @@ integer_param("credit2_cap_period_ms", opt_cap_period);
  *             core of the host. This will happen if the opt_runqueue
  *             parameter is set to 'core';
  *
+ * - per-llc: meaning that there will be one runqueue per each group of
+ *            cores sharing a last level cache (e.g., an AMD CCX). This will
+ *            happen if the opt_runqueue parameter is set to 'llc';
+ *
  * - per-socket: meaning that there will be one runqueue per each physical
  *               socket (AKA package, which often, but not always, also
  *               matches a NUMA node) of the host; This will happen if
@@ -439,17 +443,20 @@ integer_param("credit2_cap_period_ms", opt_cap_period);
  *           the opt_runqueue parameter is set to 'all'.
  *
  * Depending on the value of opt_runqueue, therefore, cpus that are part of
- * either the same physical core, the same physical socket, the same NUMA
- * node, or just all of them, will be put together to form runqueues.
+ * either the same physical core, the same last level cache, the same
+ * physical socket, the same NUMA node, or just all of them, will be put
+ * together to form runqueues.
  */
 #define OPT_RUNQUEUE_CPU    0
 #define OPT_RUNQUEUE_CORE   1
-#define OPT_RUNQUEUE_SOCKET 2
-#define OPT_RUNQUEUE_NODE   3
-#define OPT_RUNQUEUE_ALL    4
+#define OPT_RUNQUEUE_LLC    2
+#define OPT_RUNQUEUE_SOCKET 3
+#define OPT_RUNQUEUE_NODE   4
+#define OPT_RUNQUEUE_ALL    5
 static const char *const opt_runqueue_str[] = {
     [OPT_RUNQUEUE_CPU] = "cpu",
     [OPT_RUNQUEUE_CORE] = "core",
+    [OPT_RUNQUEUE_LLC] = "llc",
     [OPT_RUNQUEUE_SOCKET] = "socket",
     [OPT_RUNQUEUE_NODE] = "node",
     [OPT_RUNQUEUE_ALL] = "all"
@@ -489,6 +496,21 @@ custom_param("credit2_runqueue", parse_credit2_runqueue);
 static unsigned int __read_mostly opt_max_cpus_runqueue = MAX_CPUS_RUNQ;
 integer_param("sched_credit2_max_cpus_runqueue", opt_max_cpus_runqueue);
 
+/*
+ * Cost of moving load between runqueues that do not share a last level
+ * cache, in eighths of the load of one fully busy CPU.
+ *
+ * When looking for the runqueue to balance with, balance_load() discounts
+ * the load imbalance by this amount if the two runqueues are in different
+ * LLCs (and by twice as much if they are in different NUMA nodes), so that
+ * cache-hot units are only pulled away from their caches when the gain is
+ * worth the refill. Moving between runqueues of SMT siblings, or of cores
+ * that share the LLC, is free. 0, the default, disables the topology
+ * weighting.
+ */
+static unsigned int __read_mostly opt_llc_migrate_cost;
+integer_param("credit2_llc_migrate_cost", opt_llc_migrate_cost);
+
 /*
  * Per-runqueue data
  */
@@ -512,6 +534,8 @@ struct csched2_runqueue_data {
         smt_idle,              /* Fully idle-and-untickled cores (see below) */
         tickled,               /* Have been asked to go through schedule     */
         idle;                  /* Currently idle pcpus                       */
+    unsigned long smt_idle_sum,/* Words of smt_idle with bits set (see below)*/
+        idle_sum;              /* Words of idle & ~tickled with bits set     */
 
     struct list_head svc;      /* List of all units assigned to the runqueue */
     unsigned int max_weight;   /* Max weight of the units in this runqueue   */
@@ -709,6 +733,88 @@ void smt_idle_mask_clear(unsigned int cpu, cpumask_t *mask)
         cpumask_andnot(mask, mask, cpu_siblings);
 }
 
+/*
+ * Summaries of the idle masks, for searching them hierarchically.
+ *
+ * Bit i of rqd->smt_idle_sum is set iff the i-th word of rqd->smt_idle is
+ * not empty, and bit i of rqd->idle_sum is set iff the i-th word of
+ * rqd->idle & ~rqd->tickled is not empty. As smt_idle only ever contains
+ * idle and untickled pcpus, smt_idle_sum is always a subset of idle_sum.
+ * With more cpumask words than bits in a long (i.e., very large NR_CPUS),
+ * bit i stands for all the words w with w % BITS_PER_LONG == i, and the
+ * search degrades gracefully towards a flat scan of the masks.
+ *
+ * The summaries must be refreshed, with the runqueue lock held, every time
+ * rqd->idle, rqd->tickled or rqd->smt_idle change. They are written
+ * atomically, so they can also be peeked at without holding the lock (e.g.,
+ * to figure out whether a runqueue has any idler at all). An idle pcpu can
+ * then be found by looking only at the words that have one, rather than by
+ * combining and scanning full cpumasks.
+ */
+static void update_idle_sums(struct csched2_runqueue_data *rqd)
+{
+    unsigned long smt_sum = 0, idle_sum = 0;
+    unsigned int i;
+
+    for ( i = 0; i < BITS_TO_LONGS(nr_cpu_ids); i++ )
+    {
+        if ( cpumask_bits(&rqd->smt_idle)[i] )
+            smt_sum |= 1UL << (i % BITS_PER_LONG);
+        if ( cpumask_bits(&rqd->idle)[i] & ~cpumask_bits(&rqd->tickled)[i] )
+            idle_sum |= 1UL << (i % BITS_PER_LONG);
+    }
+
+    write_atomic(&rqd->smt_idle_sum, smt_sum);
+    write_atomic(&rqd->idle_sum, idle_sum);
+}
+
+/*
+ * Look for a pcpu in idlers & ~tickled & mask1 & mask2, only considering the
+ * words flagged in sum. Like cpumask_test_or_cycle(), cpu itself is checked
+ * first, and then the other pcpus, in cyclic order starting from cpu.
+ *
+ * Returns nr_cpu_ids if there is no such pcpu.
+ */
+static unsigned int idle_sum_find(unsigned int cpu, unsigned long sum,
+                                  const cpumask_t *idlers,
+                                  const cpumask_t *tickled,
+                                  const cpumask_t *mask1,
+                                  const cpumask_t *mask2)
+{
+    unsigned int nr = BITS_TO_LONGS(nr_cpu_ids);
+    unsigned int start = cpu / BITS_PER_LONG, i;
+
+    for ( i = 0; i <= nr; i++ )
+    {
+        unsigned int w = (start + i) % nr;
+        unsigned long bits;
+
+        if ( !(sum & (1UL << (w % BITS_PER_LONG))) )
+            continue;
+
+        bits = cpumask_bits(idlers)[w] & ~cpumask_bits(tickled)[w] &
+               cpumask_bits(mask1)[w] & cpumask_bits(mask2)[w];
+
+        /*
+         * cpu's own word is visited twice: first for cpu and the pcpus
+         * after it, and, at the very end, for the ones before it.
+         */
+        if ( i == 0 )
+            bits &= ~0UL << (cpu % BITS_PER_LONG);
+        else if ( i == nr )
+            bits &= ~(~0UL << (cpu % BITS_PER_LONG));
+
+        if ( bits )
+        {
+            unsigned int ret = w * BITS_PER_LONG + ffsl(bits) - 1;
+
+            return ret < nr_cpu_ids ? ret : nr_cpu_ids;
+        }
+    }
+
+    return nr_cpu_ids;
+}
+
 /*
  * In csched2_res_pick(), it may not be possible to actually look at remote
  * runqueues (the trylock-s on their spinlocks can fail!). If that happens,
@@ -850,6 +956,12 @@ static inline bool same_socket(unsigned int cpua, unsigned int cpub)
     return cpu_to_socket(cpua) == cpu_to_socket(cpub);
 }
 
+static inline bool same_llc(unsigned int cpua, unsigned int cpub)
+{
+    return same_socket(cpua, cpub) &&
+           cpu_to_llc(cpua) == cpu_to_llc(cpub);
+}
+
 static inline bool same_core(unsigned int cpua, unsigned int cpub)
 {
     return same_socket(cpua, cpub) &&
@@ -866,6 +978,7 @@ cpu_runqueue_match(const struct csched2_runqueue_data *rqd, unsigned int cpu)
     /* OPT_RUNQUEUE_CPU will never find an existing runqueue. */
     return opt_runqueue == OPT_RUNQUEUE_ALL ||
            (opt_runqueue == OPT_RUNQUEUE_CORE && same_core(peer_cpu, cpu)) ||
+           (opt_runqueue == OPT_RUNQUEUE_LLC && same_llc(peer_cpu, cpu)) ||
            (opt_runqueue == OPT_RUNQUEUE_SOCKET && same_socket(peer_cpu, cpu)) ||
            (opt_runqueue == OPT_RUNQUEUE_NODE && same_node(peer_cpu, cpu));
 }
@@ -1487,6 +1600,7 @@ tickle_cpu(unsigned int cpu, struct csched2_runqueue_data *rqd)
 {
     __cpumask_set_cpu(cpu, &rqd->tickled);
     smt_idle_mask_clear(cpu, &rqd->smt_idle);
+    update_idle_sums(rqd);
     cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
 }
 
@@ -1602,6 +1716,7 @@ runq_tickle(const struct scheduler *ops, struct csched2_unit *new, s_time_t now)
     unsigned int bs, cpu = sched_unit_master(unit);
     struct csched2_runqueue_data *rqd = c2rqd(cpu);
     const cpumask_t *online = cpupool_domain_master_cpumask(unit->domain);
+    unsigned long smt_idle_sum, idle_sum;
     cpumask_t mask;
 
     ASSERT(new->rqd == rqd);
@@ -1642,6 +1757,22 @@ runq_tickle(const struct scheduler *ops, struct csched2_unit *new, s_time_t now)
         goto tickle;
     }
 
+    /*
+     * If there are no idle and untickled pcpus at all (which is what the
+     * summary tells us) there's no point in going through the balancing
+     * steps. Just set cpumask_scratch up as they would have done, for the
+     * code below.
+     */
+    smt_idle_sum = rqd->smt_idle_sum;
+    idle_sum = rqd->idle_sum;
+    if ( !idle_sum && likely(!sched_smt_power_savings) )
+    {
+        affinity_balance_cpumask(unit, BALANCE_HARD_AFFINITY,
+                                 cpumask_scratch_cpu(cpu));
+        cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu), online);
+        goto busy;
+    }
+
     for_each_affinity_balance_step( bs )
     {
         /* Just skip first step, if we don't have a soft affinity */
@@ -1662,11 +1793,13 @@ runq_tickle(const struct scheduler *ops, struct csched2_unit *new, s_time_t now)
         {
             cpumask_andnot(&mask, &rqd->idle, &rqd->smt_idle);
             cpumask_and(&mask, &mask, online);
+            cpumask_and(&mask, &mask, cpumask_scratch_cpu(cpu));
+            i = cpumask_test_or_cycle(cpu, &mask);
         }
         else
-            cpumask_and(&mask, &rqd->smt_idle, online);
-        cpumask_and(&mask, &mask, cpumask_scratch_cpu(cpu));
-        i = cpumask_test_or_cycle(cpu, &mask);
+            i = idle_sum_find(cpu, smt_idle_sum, &rqd->smt_idle,
+                              &rqd->tickled, online,
+                              cpumask_scratch_cpu(cpu));
         if ( i < nr_cpu_ids )
         {
             SCHED_STAT_CRANK(tickled_idle_cpu);
@@ -1679,10 +1812,9 @@ runq_tickle(const struct scheduler *ops, struct csched2_unit *new, s_time_t now)
          * having filtered out pcpus that have been tickled but haven't
          * gone through the scheduler yet.
          */
-        cpumask_andnot(&mask, &rqd->idle, &rqd->tickled);
         cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu), online);
-        cpumask_and(&mask, &mask, cpumask_scratch_cpu(cpu));
-        i = cpumask_test_or_cycle(cpu, &mask);
+        i = idle_sum_find(cpu, idle_sum, &rqd->idle, &rqd->tickled,
+                          cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu));
         if ( i < nr_cpu_ids )
         {
             SCHED_STAT_CRANK(tickled_idle_cpu);
@@ -1691,6 +1823,8 @@ runq_tickle(const struct scheduler *ops, struct csched2_unit *new, s_time_t now)
         }
     }
 
+ busy:
+
     /*
      * Note that, if we are here, it means we have done the hard-affinity
      * balancing step of the loop, and hence what we have in cpumask_scratch
@@ -2241,12 +2375,15 @@ csched2_unit_sleep(const struct scheduler *ops, struct sched_unit *unit)
         __clear_bit(__CSFLAG_delayed_runq_add, &svc->flags);
 }
 
-static void cf_check
-csched2_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
+/*
+ * Put a waking unit in its runqueue, if it needs to go there. Returns true
+ * if it did, in which case the caller must runq_tickle() for it.
+ */
+static bool unit_wake_insert(const struct scheduler *ops,
+                             struct sched_unit *unit, s_time_t now)
 {
     struct csched2_unit * const svc = csched2_unit(unit);
     unsigned int cpu = sched_unit_master(unit);
-    s_time_t now;
 
     ASSERT(spin_is_locked(get_sched_res(cpu)->schedule_lock));
 
@@ -2255,13 +2392,13 @@ csched2_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
     if ( unlikely(curr_on_cpu(cpu) == unit) )
     {
         SCHED_STAT_CRANK(unit_wake_running);
-        goto out;
+        return false;
     }
 
     if ( unlikely(unit_on_runq(svc)) )
     {
         SCHED_STAT_CRANK(unit_wake_onrunq);
-        goto out;
+        return false;
     }
 
     if ( likely(unit_runnable(unit)) )
@@ -2275,7 +2412,7 @@ csched2_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
     if ( unlikely(svc->flags & CSFLAG_scheduled) )
     {
         __set_bit(__CSFLAG_delayed_runq_add, &svc->flags);
-        goto out;
+        return false;
     }
 
     /* Add into the new runqueue if necessary */
@@ -2284,16 +2421,42 @@ csched2_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
     else
         ASSERT(c2rqd(sched_unit_master(unit)) == svc->rqd );
 
-    now = NOW();
-
     update_load(ops, svc->rqd, svc, 1, now);
 
     /* Put the UNIT on the runq */
     runq_insert(svc);
-    runq_tickle(ops, svc, now);
 
-out:
-    return;
+    return true;
+}
+
+static void cf_check
+csched2_unit_wake(const struct scheduler *ops, struct sched_unit *unit)
+{
+    s_time_t now = NOW();
+
+    if ( unit_wake_insert(ops, unit, now) )
+        runq_tickle(ops, csched2_unit(unit), now);
+}
+
+/*
+ * All the units share the runqueue lock, and hence the runqueue. Insert all
+ * of them first, and only then go through tickling, so that each tickle
+ * already sees the whole batch in the runqueue (and the pcpus tickled for
+ * the units that came before).
+ */
+static void cf_check
+csched2_unit_wake_many(const struct scheduler *ops, struct sched_unit **units,
+                       unsigned int nr)
+{
+    s_time_t now = NOW();
+    unsigned int i, n = 0;
+
+    for ( i = 0; i < nr; i++ )
+        if ( unit_wake_insert(ops, units[i], now) )
+            units[n++] = units[i];
+
+    for ( i = 0; i < n; i++ )
+        runq_tickle(ops, csched2_unit(units[i]), now);
 }
 
 static void cf_check
@@ -2695,12 +2858,33 @@ static bool unit_is_migrateable(const struct csched2_unit *svc,
            cpumask_intersects(cpumask_scratch_cpu(cpu), &rqd->active);
 }
 
+/*
+ * Topology aware cost of moving load between two runqueues. We use the
+ * pick_bias CPUs as representatives of the runqueues, which is exact when
+ * runqueues are not wider than an LLC, and a good enough approximation
+ * otherwise.
+ */
+static s_time_t rqd_migrate_cost(const struct csched2_private *prv,
+                                 const struct csched2_runqueue_data *lrqd,
+                                 const struct csched2_runqueue_data *orqd)
+{
+    unsigned int lcpu = lrqd->pick_bias, ocpu = orqd->pick_bias;
+    s_time_t cost = (s_time_t)opt_llc_migrate_cost <<
+                    (prv->load_precision_shift - 3);
+
+    if ( same_llc(lcpu, ocpu) )
+        return 0;
+
+    return same_node(lcpu, ocpu) ? cost : 2 * cost;
+}
+
 static void balance_load(const struct scheduler *ops, int cpu, s_time_t now)
 {
     struct csched2_private *prv = csched2_priv(ops);
     struct list_head *push_iter, *pull_iter;
     bool inner_load_updated = 0;
     struct csched2_runqueue_data *rqd, *max_delta_rqd;
+    s_time_t max_net_delta;
 
     balance_state_t st = { .best_push_svc = NULL, .best_pull_svc = NULL };
 
@@ -2722,10 +2906,11 @@ retry:
         return;
 
     st.load_delta = 0;
+    max_net_delta = 0;
 
     list_for_each_entry ( rqd, &prv->rql, rql )
     {
-        s_time_t delta;
+        s_time_t delta, net_delta;
 
         st.orqd = rqd;
 
@@ -2739,8 +2924,11 @@ retry:
         if ( delta < 0 )
             delta = -delta;
 
-        if ( delta > st.load_delta )
+        /* Moving load far away is less worth it, the farther it goes. */
+        net_delta = delta - rqd_migrate_cost(prv, st.lrqd, st.orqd);
+        if ( net_delta > max_net_delta )
         {
+            max_net_delta = net_delta;
             st.load_delta = delta;
             max_delta_rqd = rqd;
         }
@@ -2784,12 +2972,12 @@ retry:
          */
         if ( load_max < ((s_time_t)cpus_max << prv->load_precision_shift) )
         {
-            if ( st.load_delta < (1ULL << (prv->load_precision_shift +
+            if ( max_net_delta < (1ULL << (prv->load_precision_shift +
                                            opt_underload_balance_tolerance)) )
                  goto out;
         }
         else
-            if ( st.load_delta < (1ULL << (prv->load_precision_shift +
+            if ( max_net_delta < (1ULL << (prv->load_precision_shift +
                                            opt_overload_balance_tolerance)) )
                 goto out;
     }
@@ -3062,6 +3250,7 @@ csched2_dom_cntl(
                         burn_credits(rqd, svc, NOW());
                         __cpumask_set_cpu(cpu, &rqd->tickled);
                         ASSERT(!cpumask_test_cpu(cpu, &rqd->smt_idle));
+                        update_idle_sums(rqd);
                         cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
                     }
                     svc->budget = 0;
@@ -3602,6 +3791,7 @@ static void cf_check csched2_schedule(
         __cpumask_clear_cpu(sched_cpu, &rqd->tickled);
         cpumask_andnot(cpumask_scratch, &rqd->idle, &rqd->tickled);
         smt_idle_mask_set(sched_cpu, cpumask_scratch, &rqd->smt_idle);
+        update_idle_sums(rqd);
     }
 
     if ( unlikely(tb_init_done) )
@@ -3688,6 +3878,7 @@ static void cf_check csched2_schedule(
         {
             __cpumask_clear_cpu(sched_cpu, &rqd->idle);
             smt_idle_mask_clear(sched_cpu, &rqd->smt_idle);
+            update_idle_sums(rqd);
         }
 
         /*
@@ -3738,6 +3929,7 @@ static void cf_check csched2_schedule(
             {
                 __cpumask_clear_cpu(sched_cpu, &rqd->idle);
                 smt_idle_mask_clear(sched_cpu, &rqd->smt_idle);
+                update_idle_sums(rqd);
             }
         }
         else if ( !cpumask_test_cpu(sched_cpu, &rqd->idle) )
@@ -3745,6 +3937,7 @@ static void cf_check csched2_schedule(
             __cpumask_set_cpu(sched_cpu, &rqd->idle);
             cpumask_andnot(cpumask_scratch, &rqd->idle, &rqd->tickled);
             smt_idle_mask_set(sched_cpu, cpumask_scratch, &rqd->smt_idle);
+            update_idle_sums(rqd);
         }
         /* Make sure avgload gets updated periodically even
          * if there's no activity */
@@ -3974,6 +4167,7 @@ init_cpu_runqueue(struct csched2_private *prv, struct csched2_pcpu *spc,
     __cpumask_set_cpu(cpu, &rqd->active);
     __cpumask_set_cpu(cpu, &prv->initialized);
     __cpumask_set_cpu(cpu, &rqd->smt_idle);
+    update_idle_sums(rqd);
 
     rqd->nr_cpus++;
     ASSERT(cpumask_weight(&rqd->active) == rqd->nr_cpus);
@@ -4073,6 +4267,7 @@ csched2_deinit_pdata(const struct scheduler *ops, void *pcpu, int cpu)
     __cpumask_clear_cpu(cpu, &rqd->smt_idle);
     __cpumask_clear_cpu(cpu, &rqd->active);
     __cpumask_clear_cpu(cpu, &rqd->tickled);
+    update_idle_sums(rqd);
 
     for_each_cpu ( rcpu, &rqd->active )
         __cpumask_clear_cpu(cpu, &csched2_pcpu(rcpu)->sibling_mask);
@@ -4167,12 +4362,14 @@ csched2_init(struct scheduler *ops)
            XENLOG_INFO " underload_balance_tolerance: %d\n"
            XENLOG_INFO " overload_balance_tolerance: %d\n"
            XENLOG_INFO " runqueues arrangement: %s\n"
+           XENLOG_INFO " llc migrate cost: %u\n"
            XENLOG_INFO " cap enforcement granularity: %dms\n",
            opt_load_precision_shift,
            opt_load_window_shift,
            opt_underload_balance_tolerance,
            opt_overload_balance_tolerance,
            opt_runqueue_str[opt_runqueue],
+           opt_llc_migrate_cost,
            opt_cap_period);
 
     printk(XENLOG_INFO "load tracking window length %llu ns\n",
@@ -4226,6 +4423,7 @@ static const struct scheduler sched_credit2_def = {
 
     .sleep          = csched2_unit_sleep,
     .wake           = csched2_unit_wake,
+    .wake_many      = csched2_unit_wake_many,
     .yield          = csched2_unit_yield,
 
     .adjust         = csched2_dom_cntl,
@@ -56,10 +56,14 @@
  *  + is scheduler-wide;
  *  + serialize accesses to the list of units waiting to be assigned
  *    to pCPUs.
+ * - Free lock:
+ *  + is scheduler-wide;
+ *  + serializes the per-node lists of free pCPUs (and updates of the
+ *    cpus_free mask, which mirrors them and can be read locklessly).
  *
- * Ordering is: private lock, runqueue lock, waitqueue lock. Or, OTOH,
- * waitqueue lock nests inside runqueue lock which nests inside private
- * lock. More specifically:
+ * Ordering is: private lock, runqueue lock, waitqueue lock, free lock. Or,
+ * OTOH, free lock nests inside waitqueue lock, which nests inside runqueue
+ * lock, which nests inside private lock. More specifically:
  *  + if we need both runqueue and private locks, we must acquire the
  *    private lock for first;
  *  + if we need both runqueue and waitqueue locks, we must acquire
@@ -69,7 +73,8 @@
  *  + if we already own a runqueue lock, we must never acquire
  *    the private lock;
  *  + if we already own the waitqueue lock, we must never acquire
- *    the runqueue lock or the private lock.
+ *    the runqueue lock or the private lock;
+ *  + while holding the free lock, we must never acquire any other lock.
  */
 
 /*
@@ -81,6 +86,9 @@ struct null_private {
     struct list_head waitq; /* units not assigned to any pCPU            */
     spinlock_t waitq_lock;  /* serializes waitq; nests inside runq locks */
     cpumask_t cpus_free;    /* CPUs without a unit associated to them    */
+    spinlock_t free_lock;   /* serializes free_pcpus and cpus_free       */
+    nodemask_t nodes_free;  /* nodes with at least one free pCPU         */
+    struct list_head free_pcpus[MAX_NUMNODES]; /* free pCPUs, per node   */
 };
 
 /*
@@ -88,6 +96,8 @@ struct null_private {
  */
 struct null_pcpu {
     struct sched_unit *unit;
+    struct list_head free_elem; /* on prv->free_pcpus[], if free         */
+    unsigned int cpu;
 };
 
 /*
@@ -130,9 +140,110 @@ static inline bool unit_check_affinity(struct sched_unit *unit,
     return cpumask_test_cpu(cpu, cpumask_scratch_cpu(cpu));
 }
 
+/*
+ * Free pCPU tracking.
+ *
+ * Each free pCPU sits on the list of its NUMA node, so finding a free pCPU
+ * for a unit without restrictive affinity is O(1), and the lookup can be
+ * steered to the node(s) where the unit's memory is. cpus_free is kept in
+ * sync, for the (cheap and lockless) "is there any free pCPU in this mask"
+ * checks.
+ */
+static void pcpu_set_free(struct null_private *prv, struct null_pcpu *npc)
+{
+    unsigned int node = cpu_to_node(npc->cpu);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->free_lock, flags);
+    if ( !cpumask_test_and_set_cpu(npc->cpu, &prv->cpus_free) )
+    {
+        list_add_tail(&npc->free_elem, &prv->free_pcpus[node]);
+        node_set(node, prv->nodes_free);
+    }
+    spin_unlock_irqrestore(&prv->free_lock, flags);
+}
+
+static void pcpu_set_busy(struct null_private *prv, struct null_pcpu *npc)
+{
+    unsigned int node = cpu_to_node(npc->cpu);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->free_lock, flags);
+    if ( cpumask_test_and_clear_cpu(npc->cpu, &prv->cpus_free) )
+    {
+        list_del_init(&npc->free_elem);
+        if ( list_empty(&prv->free_pcpus[node]) )
+            node_clear(node, prv->nodes_free);
+    }
+    spin_unlock_irqrestore(&prv->free_lock, flags);
+}
+
+/* First free pCPU of node that is also in mask. Called with free_lock held. */
+static unsigned int node_first_free(const struct null_private *prv,
+                                    unsigned int node, const cpumask_t *mask)
+{
+    const struct null_pcpu *npc;
+
+    list_for_each_entry( npc, &prv->free_pcpus[node], free_elem )
+        if ( cpumask_test_cpu(npc->cpu, mask) )
+            return npc->cpu;
+
+    return nr_cpu_ids;
+}
+
+/*
+ * Find a free pCPU in mask, looking first in node, then in the nodes of the
+ * domain's NUMA node-affinity, and only then everywhere else. Returns
+ * nr_cpu_ids if there is no free pCPU in mask.
+ */
+static unsigned int pick_free_cpu(struct null_private *prv,
+                                  const struct domain *d,
+                                  const cpumask_t *mask, unsigned int node)
+{
+    unsigned int cpu = nr_cpu_ids, n;
+    nodemask_t nodes;
+    unsigned long flags;
+
+    if ( !cpumask_intersects(&prv->cpus_free, mask) )
+        return nr_cpu_ids;
+
+    spin_lock_irqsave(&prv->free_lock, flags);
+
+    if ( nodemask_test(node, &prv->nodes_free) )
+    {
+        cpu = node_first_free(prv, node, mask);
+        if ( cpu < nr_cpu_ids )
+            goto out;
+    }
+
+    nodes_and(nodes, prv->nodes_free, d->node_affinity);
+    node_clear(node, nodes);
+    for_each_node_mask( n, nodes )
+    {
+        cpu = node_first_free(prv, n, mask);
+        if ( cpu < nr_cpu_ids )
+            goto out;
+    }
+
+    nodes_andnot(nodes, prv->nodes_free, d->node_affinity);
+    node_clear(node, nodes);
+    for_each_node_mask( n, nodes )
+    {
+        cpu = node_first_free(prv, n, mask);
+        if ( cpu < nr_cpu_ids )
+            goto out;
+    }
+
+ out:
+    spin_unlock_irqrestore(&prv->free_lock, flags);
+
+    return cpu;
+}
+
 static int cf_check null_init(struct scheduler *ops)
 {
     struct null_private *prv;
+    unsigned int node;
 
     printk("Initializing null scheduler\n"
            "WARNING: This is experimental software in development.\n"
@@ -144,8 +255,11 @@ static int cf_check null_init(struct scheduler *ops)
 
     spin_lock_init(&prv->lock);
     spin_lock_init(&prv->waitq_lock);
+    spin_lock_init(&prv->free_lock);
     INIT_LIST_HEAD(&prv->ndom);
     INIT_LIST_HEAD(&prv->waitq);
+    for ( node = 0; node < MAX_NUMNODES; node++ )
+        INIT_LIST_HEAD(&prv->free_pcpus[node]);
 
     ops->sched_data = prv;
 
@@ -162,8 +276,9 @@ static void init_pdata(struct null_private *prv, struct null_pcpu *npc,
                        unsigned int cpu)
 {
     /* Mark the pCPU as free, and with no unit assigned */
-    cpumask_set_cpu(cpu, &prv->cpus_free);
+    npc->cpu = cpu;
     npc->unit = NULL;
+    pcpu_set_free(prv, npc);
 }
 
 static void cf_check null_deinit_pdata(
@@ -174,7 +289,7 @@ static void cf_check null_deinit_pdata(
 
     ASSERT(npc);
 
-    cpumask_clear_cpu(cpu, &prv->cpus_free);
+    pcpu_set_busy(prv, npc);
     npc->unit = NULL;
 }
 
@@ -186,6 +301,9 @@ static void *cf_check null_alloc_pdata(const struct scheduler *ops, int cpu)
     if ( npc == NULL )
         return ERR_PTR(-ENOMEM);
 
+    INIT_LIST_HEAD(&npc->free_elem);
+    npc->cpu = cpu;
+
     return npc;
 }
 
@@ -271,7 +389,7 @@ static void cf_check null_free_domdata(const struct scheduler *ops, void *data)
  * So this is not part of any hot path.
  */
 static struct sched_resource *
-pick_res(const struct null_private *prv, const struct sched_unit *unit)
+pick_res(struct null_private *prv, const struct sched_unit *unit)
 {
     unsigned int bs;
     unsigned int cpu = sched_unit_master(unit), new_cpu;
@@ -302,10 +420,13 @@ pick_res(const struct null_private *prv, const struct sched_unit *unit)
             goto out;
         }
 
-        /* If not, just go for a free pCPU, within our affinity, if any */
-        cpumask_and(cpumask_scratch_cpu(cpu), cpumask_scratch_cpu(cpu),
-                    &prv->cpus_free);
-        new_cpu = cpumask_first(cpumask_scratch_cpu(cpu));
+        /*
+         * If not, just go for a free pCPU, within our affinity, if any,
+         * preferring the NUMA node we are on, and then the ones where our
+         * memory is.
+         */
+        new_cpu = pick_free_cpu(prv, unit->domain, cpumask_scratch_cpu(cpu),
+                                cpu_to_node(cpu));
 
         if ( likely(new_cpu != nr_cpu_ids) )
             goto out;
@@ -350,7 +471,7 @@ static void unit_assign(struct null_private *prv, struct sched_unit *unit,
 
     npc->unit = unit;
     sched_set_res(unit, get_sched_res(cpu));
-    cpumask_clear_cpu(cpu, &prv->cpus_free);
+    pcpu_set_busy(prv, npc);
 
     dprintk(XENLOG_G_INFO, "%d <-- %pdv%d\n", cpu, unit->domain, unit->unit_id);
 
@@ -370,9 +491,8 @@ static void unit_assign(struct null_private *prv, struct sched_unit *unit,
 /* Returns true if a cpu was tickled */
 static bool unit_deassign(struct null_private *prv, const struct sched_unit *unit)
 {
-    unsigned int bs;
     unsigned int cpu = sched_unit_master(unit);
-    struct null_unit *wvc;
+    struct null_unit *wvc, *pick = NULL;
     struct null_pcpu *npc = get_sched_res(cpu)->sched_priv;
 
     ASSERT(list_empty(&null_unit(unit)->waitq_elem));
@@ -380,7 +500,7 @@ static bool unit_deassign(struct null_private *prv, const struct sched_unit *uni
     ASSERT(!cpumask_test_cpu(cpu, &prv->cpus_free));
 
     npc->unit = NULL;
-    cpumask_set_cpu(cpu, &prv->cpus_free);
+    pcpu_set_free(prv, npc);
 
     dprintk(XENLOG_G_INFO, "%d <-- NULL (%pdv%d)\n", cpu, unit->domain,
             unit->unit_id);
@@ -402,29 +522,38 @@ static bool unit_deassign(struct null_private *prv, const struct sched_unit *uni
     /*
      * If unit is assigned to a pCPU, let's see if there is someone waiting,
      * suitable to be assigned to it (prioritizing units that have
-     * soft-affinity with cpu).
+     * soft-affinity with cpu). We do that with just one pass over the
+     * waitqueue, remembering the first unit with hard-affinity with cpu,
+     * and stopping as soon as we find one with soft-affinity with it.
      */
-    for_each_affinity_balance_step( bs )
+    list_for_each_entry( wvc, &prv->waitq, waitq_elem )
     {
-        list_for_each_entry( wvc, &prv->waitq, waitq_elem )
+        if ( pick == NULL &&
+             unit_check_affinity(wvc->unit, cpu, BALANCE_HARD_AFFINITY) )
         {
-            if ( bs == BALANCE_SOFT_AFFINITY &&
-                 !has_soft_affinity(wvc->unit) )
+            pick = wvc;
+            if ( !has_soft_affinity(wvc->unit) )
                 continue;
+        }
+        else if ( !has_soft_affinity(wvc->unit) )
+            continue;
 
-            if ( unit_check_affinity(wvc->unit, cpu, bs) )
-            {
-                list_del_init(&wvc->waitq_elem);
-                unit_assign(prv, wvc->unit, cpu);
-                cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
-                spin_unlock(&prv->waitq_lock);
-                return true;
-            }
+        if ( unit_check_affinity(wvc->unit, cpu, BALANCE_SOFT_AFFINITY) )
+        {
+            pick = wvc;
+            break;
         }
     }
+
+    if ( pick != NULL )
+    {
+        list_del_init(&pick->waitq_elem);
+        unit_assign(prv, pick->unit, cpu);
+        cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
+    }
     spin_unlock(&prv->waitq_lock);
 
-    return false;
+    return pick != NULL;
 }
 
 /* Change the scheduler of cpu to us (null). */
@@ -921,7 +1050,7 @@ static void cf_check null_schedule(
 
         if ( prev->next_task == NULL &&
              !cpumask_test_cpu(sched_cpu, &prv->cpus_free) )
-            cpumask_set_cpu(sched_cpu, &prv->cpus_free);
+            pcpu_set_free(prv, npc);
     }
 
     if ( unlikely(prev->next_task == NULL ||
@@ -277,6 +277,7 @@ struct scheduler {
     unsigned int sched_id;  /* ID for this scheduler             */
     void *sched_data;       /* global data pointer               */
     struct cpupool *cpupool;/* points to this scheduler's pool   */
+    unsigned int hist_idx;  /* latency histograms to account to  */
 
     int          (*global_init)    (void);
 
@@ -308,6 +309,9 @@ struct scheduler {
                                     struct sched_unit *);
     void         (*wake)           (const struct scheduler *,
                                     struct sched_unit *);
+    /* Optional: wake several units sharing the same scheduler lock. */
+    void         (*wake_many)      (const struct scheduler *,
+                                    struct sched_unit **, unsigned int);
     void         (*yield)          (const struct scheduler *,
                                     struct sched_unit *);
     void         (*context_saved)  (const struct scheduler *,
@@ -437,6 +441,18 @@ static inline void sched_wake(const struct scheduler *s,
         s->wake(s, unit);
 }
 
+static inline void sched_wake_many(const struct scheduler *s,
+                                   struct sched_unit **units, unsigned int nr)
+{
+    unsigned int i;
+
+    if ( s->wake_many )
+        s->wake_many(s, units, nr);
+    else if ( s->wake )
+        for ( i = 0; i < nr; i++ )
+            s->wake(s, units[i]);
+}
+
 static inline void sched_yield(const struct scheduler *s,
                                struct sched_unit *unit)
 {
@@ -625,12 +641,15 @@ void schedule_dump(struct cpupool *c);
 struct scheduler *scheduler_get_default(void);
 struct scheduler *scheduler_alloc(unsigned int sched_id);
 void scheduler_free(struct scheduler *sched);
+int cpus_disable_scheduler(const cpumask_t *cpus);
 int cpu_disable_scheduler(unsigned int cpu);
 int schedule_cpu_add(unsigned int cpu, struct cpupool *c);
 struct cpu_rm_data *alloc_cpu_rm_data(unsigned int cpu, bool aff_alloc);
 void free_cpu_rm_data(struct cpu_rm_data *mem, unsigned int cpu);
 int schedule_cpu_rm(unsigned int cpu, struct cpu_rm_data *mem);
 int sched_move_domain(struct domain *d, struct cpupool *c);
+extern bool opt_sched_mem_affinity;
+void sched_domain_follow_memory(struct domain *d);
 void sched_migrate_timers(unsigned int cpu);
 struct cpupool *cpupool_get_by_id(unsigned int poolid);
 void cpupool_put(struct cpupool *pool);
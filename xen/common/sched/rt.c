@@ -29,6 +29,7 @@
 #include <xen/trace.h>
 #include <xen/err.h>
 #include <xen/guest_access.h>
+#include <xen/rbtree.h>
 
 #include "private.h"
 
@@ -66,9 +67,13 @@
  *
  * Queue scheme:
  * A global runqueue and a global depletedqueue for each CPU pool.
- * The runqueue holds all runnable UNITs with budget,
+ * The runqueue holds all runnable UNITs with budget, in a red-black tree
  * sorted by priority_level and deadline;
  * The depletedqueue holds all UNITs without budget, unsorted;
+ * The replenishment queue holds the replenishment events of all the UNITs
+ * that are runnable or running, in a red-black tree sorted by deadline.
+ * Inserting into, and removing from, either tree is O(log n) in the number
+ * of UNITs of the pool.
  *
  * Note: cpumask and cpupool is supported.
  */
@@ -184,11 +189,11 @@ struct rt_private {
     spinlock_t lock;            /* the global coarse-grained lock */
     struct list_head sdom;      /* list of availalbe domains, used for dump */
 
-    struct list_head runq;      /* ordered list of runnable units */
+    struct rb_root runq;        /* EDF ordered tree of runnable units */
     struct list_head depletedq; /* unordered list of depleted units */
 
     struct timer repl_timer;    /* replenishment timer */
-    struct list_head replq;     /* ordered list of units that need replenishment */
+    struct rb_root replq;       /* deadline ordered tree of replenishments */
 
     cpumask_t tickled;          /* cpus been tickled */
 };
@@ -197,8 +202,9 @@ struct rt_private {
  * Virtual CPU
  */
 struct rt_unit {
-    struct list_head q_elem;     /* on the runq/depletedq list */
-    struct list_head replq_elem; /* on the replenishment events list */
+    struct rb_node q_node;       /* on the runq tree */
+    struct list_head q_elem;     /* on the depletedq list */
+    struct rb_node replq_node;   /* on the replenishment events tree */
 
     /* UNIT parameters, in nanoseconds */
     s_time_t period;
@@ -239,7 +245,7 @@ static inline struct rt_unit *rt_unit(const struct sched_unit *unit)
     return unit->priv;
 }
 
-static inline struct list_head *rt_runq(const struct scheduler *ops)
+static inline struct rb_root *rt_runq(const struct scheduler *ops)
 {
     return &rt_priv(ops)->runq;
 }
@@ -249,7 +255,7 @@ static inline struct list_head *rt_depletedq(const struct scheduler *ops)
     return &rt_priv(ops)->depletedq;
 }
 
-static inline struct list_head *rt_replq(const struct scheduler *ops)
+static inline struct rb_root *rt_replq(const struct scheduler *ops)
 {
     return &rt_priv(ops)->replq;
 }
@@ -263,35 +269,41 @@ static inline bool has_extratime(const struct rt_unit *svc)
  * Helper functions for manipulating the runqueue, the depleted queue,
  * and the replenishment events queue.
  */
+static int
+unit_on_runq(const struct rt_unit *svc)
+{
+   return !RB_EMPTY_NODE(&svc->q_node);
+}
+
 static int
 unit_on_q(const struct rt_unit *svc)
 {
-   return !list_empty(&svc->q_elem);
+   return unit_on_runq(svc) || !list_empty(&svc->q_elem);
 }
 
 static struct rt_unit *cf_check
-q_elem(struct list_head *elem)
+q_elem(struct rb_node *node)
 {
-    return list_entry(elem, struct rt_unit, q_elem);
+    return rb_entry(node, struct rt_unit, q_node);
 }
 
 static struct rt_unit *cf_check
-replq_elem(struct list_head *elem)
+replq_elem(struct rb_node *node)
 {
-    return list_entry(elem, struct rt_unit, replq_elem);
+    return rb_entry(node, struct rt_unit, replq_node);
 }
 
 static int
 unit_on_replq(const struct rt_unit *svc)
 {
-    return !list_empty(&svc->replq_elem);
+    return !RB_EMPTY_NODE(&svc->replq_node);
 }
 
 /*
  * If v1 priority >= v2 priority, return value > 0
  * Otherwise, return value < 0
  */
-static s_time_t
+static s_time_t cf_check
 compare_unit_priority(const struct rt_unit *v1, const struct rt_unit *v2)
 {
     int prio = v2->priority_level - v1->priority_level;
@@ -302,6 +314,16 @@ compare_unit_priority(const struct rt_unit *v1, const struct rt_unit *v2)
     return prio;
 }
 
+/*
+ * If v1 deadline <= v2 deadline, return value >= 0
+ * Otherwise, return value < 0
+ */
+static s_time_t cf_check
+compare_unit_deadline(const struct rt_unit *v1, const struct rt_unit *v2)
+{
+    return v2->cur_deadline - v1->cur_deadline;
+}
+
 /*
  * Debug related code, dump unit/cpu information
  */
@@ -369,7 +391,9 @@ rt_dump_pcpu(const struct scheduler *ops, int cpu)
 static void cf_check
 rt_dump(const struct scheduler *ops)
 {
-    struct list_head *runq, *depletedq, *replq, *iter;
+    struct list_head *depletedq, *iter;
+    struct rb_root *runq, *replq;
+    struct rb_node *node;
     struct rt_private *prv = rt_priv(ops);
     const struct rt_unit *svc;
     const struct rt_dom *sdom;
@@ -385,23 +409,23 @@ rt_dump(const struct scheduler *ops)
     replq = rt_replq(ops);
 
     printk("Global RunQueue info:\n");
-    list_for_each ( iter, runq )
+    for ( node = rb_first(runq); node; node = rb_next(node) )
     {
-        svc = q_elem(iter);
+        svc = q_elem(node);
         rt_dump_unit(ops, svc);
     }
 
     printk("Global DepletedQueue info:\n");
     list_for_each ( iter, depletedq )
     {
-        svc = q_elem(iter);
+        svc = list_entry(iter, struct rt_unit, q_elem);
         rt_dump_unit(ops, svc);
     }
 
     printk("Global Replenishment Events info:\n");
-    list_for_each ( iter, replq )
+    for ( node = rb_first(replq); node; node = rb_next(node) )
     {
-        svc = replq_elem(iter);
+        svc = replq_elem(node);
         rt_dump_unit(ops, svc);
     }
 
@@ -488,56 +512,68 @@ rt_update_deadline(s_time_t now, struct rt_unit *svc)
  * are dealing with).
  */
 static inline bool
-deadline_queue_remove(struct list_head *queue, struct list_head *elem)
+deadline_queue_remove(struct rb_root *queue, struct rb_node *node)
 {
-    bool first = false;
+    bool first = rb_first(queue) == node;
 
-    if ( queue->next != elem )
-        first = true;
-
-    list_del_init(elem);
-    return !first;
+    rb_erase(node, queue);
+    RB_CLEAR_NODE(node);
+    return first;
 }
 
+/*
+ * Units comparing equal to some already queued ones go after them, so
+ * that ties are served in FIFO order.
+ */
 static inline bool
-deadline_queue_insert(struct rt_unit * (*qelem)(struct list_head *),
-                      struct rt_unit *svc, struct list_head *elem,
-                      struct list_head *queue)
+deadline_queue_insert(struct rt_unit * (*qelem)(struct rb_node *),
+                      s_time_t (*compare)(const struct rt_unit *,
+                                          const struct rt_unit *),
+                      struct rt_unit *svc, struct rb_node *node,
+                      struct rb_root *queue)
 {
-    struct list_head *iter;
+    struct rb_node **link = &queue->rb_node, *parent = NULL;
     bool first = true;
 
-    list_for_each ( iter, queue )
+    while ( *link )
     {
-        const struct rt_unit * iter_svc = (*qelem)(iter);
-        if ( compare_unit_priority(svc, iter_svc) > 0 )
-            break;
-        first = false;
+        parent = *link;
+        if ( (*compare)(svc, (*qelem)(parent)) > 0 )
+            link = &parent->rb_left;
+        else
+        {
+            link = &parent->rb_right;
+            first = false;
+        }
     }
-    list_add_tail(elem, iter);
+    rb_link_node(node, parent, link);
+    rb_insert_color(node, queue);
     return first;
 }
 #define deadline_runq_insert(...) \
-  deadline_queue_insert(&q_elem, ##__VA_ARGS__)
+  deadline_queue_insert(&q_elem, &compare_unit_priority, ##__VA_ARGS__)
 #define deadline_replq_insert(...) \
-  deadline_queue_insert(&replq_elem, ##__VA_ARGS__)
+  deadline_queue_insert(&replq_elem, &compare_unit_deadline, ##__VA_ARGS__)
 
 static inline void
-q_remove(struct rt_unit *svc)
+q_remove(const struct scheduler *ops, struct rt_unit *svc)
 {
     ASSERT( unit_on_q(svc) );
-    list_del_init(&svc->q_elem);
+    if ( unit_on_runq(svc) )
+        deadline_queue_remove(rt_runq(ops), &svc->q_node);
+    else
+        list_del_init(&svc->q_elem);
 }
 
 static inline void
 replq_remove(const struct scheduler *ops, struct rt_unit *svc)
 {
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
 
     ASSERT( unit_on_replq(svc) );
 
-    if ( deadline_queue_remove(replq, &svc->replq_elem) )
+    if ( deadline_queue_remove(replq, &svc->replq_node) )
     {
         /*
          * The replenishment timer needs to be set to fire when a
@@ -545,9 +581,9 @@ replq_remove(const struct scheduler *ops, struct rt_unit *svc)
          * queue is due. If it is such unit that we just removed, we may
          * need to reprogram the timer.
          */
-        if ( !list_empty(replq) )
+        if ( !RB_EMPTY_ROOT(replq) )
         {
-            const struct rt_unit *svc_next = replq_elem(replq->next);
+            const struct rt_unit *svc_next = replq_elem(rb_first(replq));
             set_timer(&prv->repl_timer, svc_next->cur_deadline);
         }
         else
@@ -564,7 +600,7 @@ static void
 runq_insert(const struct scheduler *ops, struct rt_unit *svc)
 {
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *runq = rt_runq(ops);
+    struct rb_root *runq = rt_runq(ops);
 
     ASSERT( spin_is_locked(&prv->lock) );
     ASSERT( !unit_on_q(svc) );
@@ -573,7 +609,7 @@ runq_insert(const struct scheduler *ops, struct rt_unit *svc)
     /* add svc to runq if svc still has budget or its extratime is set */
     if ( svc->cur_budget > 0 ||
          has_extratime(svc) )
-        deadline_runq_insert(svc, &svc->q_elem, runq);
+        deadline_runq_insert(svc, &svc->q_node, runq);
     else
         list_add(&svc->q_elem, &prv->depletedq);
 }
@@ -581,16 +617,16 @@ runq_insert(const struct scheduler *ops, struct rt_unit *svc)
 static void
 replq_insert(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
     struct rt_private *prv = rt_priv(ops);
 
     ASSERT( !unit_on_replq(svc) );
 
     /*
      * The timer may be re-programmed if svc is inserted
-     * at the front of the event list.
+     * at the front of the event queue.
      */
-    if ( deadline_replq_insert(svc, &svc->replq_elem, replq) )
+    if ( deadline_replq_insert(svc, &svc->replq_node, replq) )
         set_timer(&prv->repl_timer, svc->cur_deadline);
 }
 
@@ -603,7 +639,7 @@ replq_insert(const struct scheduler *ops, struct rt_unit *svc)
 static void
 replq_reinsert(const struct scheduler *ops, struct rt_unit *svc)
 {
-    struct list_head *replq = rt_replq(ops);
+    struct rb_root *replq = rt_replq(ops);
     const struct rt_unit *rearm_svc = svc;
     bool rearm = false;
 
@@ -618,14 +654,14 @@ replq_reinsert(const struct scheduler *ops, struct rt_unit *svc)
      * We may also need to re-program, if svc has been put at the front
      * of the replenishment queue when being re-inserted.
      */
-    if ( deadline_queue_remove(replq, &svc->replq_elem) )
+    if ( deadline_queue_remove(replq, &svc->replq_node) )
     {
-        deadline_replq_insert(svc, &svc->replq_elem, replq);
-        rearm_svc = replq_elem(replq->next);
+        deadline_replq_insert(svc, &svc->replq_node, replq);
+        rearm_svc = replq_elem(rb_first(replq));
         rearm = true;
     }
     else
-        rearm = deadline_replq_insert(svc, &svc->replq_elem, replq);
+        rearm = deadline_replq_insert(svc, &svc->replq_node, replq);
 
     if ( rearm )
         set_timer(&rt_priv(ops)->repl_timer, rearm_svc->cur_deadline);
@@ -687,9 +723,9 @@ rt_init(struct scheduler *ops)
 
     spin_lock_init(&prv->lock);
     INIT_LIST_HEAD(&prv->sdom);
-    INIT_LIST_HEAD(&prv->runq);
+    prv->runq = RB_ROOT;
     INIT_LIST_HEAD(&prv->depletedq);
-    INIT_LIST_HEAD(&prv->replq);
+    prv->replq = RB_ROOT;
 
     ops->sched_data = prv;
     rc = 0;
@@ -853,8 +889,9 @@ rt_alloc_udata(const struct scheduler *ops, struct sched_unit *unit, void *dd)
     if ( svc == NULL )
         return NULL;
 
+    RB_CLEAR_NODE(&svc->q_node);
     INIT_LIST_HEAD(&svc->q_elem);
-    INIT_LIST_HEAD(&svc->replq_elem);
+    RB_CLEAR_NODE(&svc->replq_node);
     svc->flags = 0U;
     svc->sdom = dd;
     svc->unit = unit;
@@ -935,7 +972,7 @@ rt_unit_remove(const struct scheduler *ops, struct sched_unit *unit)
 
     lock = unit_schedule_lock_irq(unit);
     if ( unit_on_q(svc) )
-        q_remove(svc);
+        q_remove(ops, svc);
 
     if ( unit_on_replq(svc) )
         replq_remove(ops,svc);
@@ -1016,16 +1053,15 @@ burn_budget(const struct scheduler *ops, struct rt_unit *svc, s_time_t now)
 static struct rt_unit *
 runq_pick(const struct scheduler *ops, const cpumask_t *mask, unsigned int cpu)
 {
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter;
+    struct rb_node *node;
     struct rt_unit *svc = NULL;
     struct rt_unit *iter_svc = NULL;
     cpumask_t *cpu_common = cpumask_scratch_cpu(cpu);
     const cpumask_t *online;
 
-    list_for_each ( iter, runq )
+    for ( node = rb_first(rt_runq(ops)); node; node = rb_next(node) )
     {
-        iter_svc = q_elem(iter);
+        iter_svc = q_elem(node);
 
         /* mask cpu_hard_affinity & cpupool & mask */
         online = cpupool_domain_master_cpumask(iter_svc->unit->domain);
@@ -1115,7 +1151,7 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
             if ( unit_runnable_state(snext->unit) )
                 break;
 
-            q_remove(snext);
+            q_remove(ops, snext);
             replq_remove(ops, snext);
         }
 
@@ -1139,7 +1175,7 @@ rt_schedule(const struct scheduler *ops, struct sched_unit *currunit,
     {
         if ( snext != scurr )
         {
-            q_remove(snext);
+            q_remove(ops, snext);
             __set_bit(__RTDS_scheduled, &snext->flags);
         }
         if ( sched_unit_master(snext->unit) != sched_cpu )
@@ -1170,7 +1206,7 @@ rt_unit_sleep(const struct scheduler *ops, struct sched_unit *unit)
         cpu_raise_softirq(sched_unit_master(unit), SCHEDULE_SOFTIRQ);
     else if ( unit_on_q(svc) )
     {
-        q_remove(svc);
+        q_remove(ops, svc);
         replq_remove(ops, svc);
     }
     else if ( svc->flags & RTDS_delayed_runq_add )
@@ -1486,11 +1522,11 @@ static void cf_check repl_timer_handler(void *data)
     s_time_t now;
     const struct scheduler *ops = data;
     struct rt_private *prv = rt_priv(ops);
-    struct list_head *replq = rt_replq(ops);
-    struct list_head *runq = rt_runq(ops);
-    struct list_head *iter, *tmp;
+    struct rb_root *replq = rt_replq(ops);
+    struct rb_root *runq = rt_runq(ops);
+    struct rb_root tmp_replq = RB_ROOT;
+    struct rb_node *node;
     struct rt_unit *svc;
-    LIST_HEAD(tmp_replq);
 
     spin_lock_irq(&prv->lock);
 
@@ -1498,43 +1534,43 @@ static void cf_check repl_timer_handler(void *data)
 
     /*
      * Do the replenishment and move replenished units
-     * to the temporary list to tickle.
+     * to the temporary queue to tickle.
      * If svc is on run queue, we need to put it at
      * the correct place since its deadline changes.
      */
-    list_for_each_safe ( iter, tmp, replq )
+    while ( (node = rb_first(replq)) != NULL )
     {
-        svc = replq_elem(iter);
+        svc = replq_elem(node);
 
         if ( now < svc->cur_deadline )
             break;
 
-        list_del(&svc->replq_elem);
+        deadline_queue_remove(replq, node);
         rt_update_deadline(now, svc);
-        list_add(&svc->replq_elem, &tmp_replq);
+        deadline_replq_insert(svc, node, &tmp_replq);
 
         if ( unit_on_q(svc) )
         {
-            q_remove(svc);
+            q_remove(ops, svc);
             runq_insert(ops, svc);
         }
     }
 
     /*
-     * Iterate through the list of updated units.
+     * Iterate through the queue of updated units.
      * If an updated unit is running, tickle the head of the
      * runqueue if it has a higher priority.
      * If an updated unit was depleted and on the runqueue, tickle it.
-     * Finally, reinsert the units back to replenishement events list.
+     * Finally, reinsert the units back to replenishement events queue.
      */
-    list_for_each_safe ( iter, tmp, &tmp_replq )
+    while ( (node = rb_first(&tmp_replq)) != NULL )
     {
-        svc = replq_elem(iter);
+        svc = replq_elem(node);
 
         if ( curr_on_cpu(sched_unit_master(svc->unit)) == svc->unit &&
-             !list_empty(runq) )
+             !RB_EMPTY_ROOT(runq) )
         {
-            struct rt_unit *next_on_runq = q_elem(runq->next);
+            struct rt_unit *next_on_runq = q_elem(rb_first(runq));
 
             if ( compare_unit_priority(svc, next_on_runq) < 0 )
                 runq_tickle(ops, next_on_runq);
@@ -1543,17 +1579,18 @@ static void cf_check repl_timer_handler(void *data)
                   unit_on_q(svc) )
             runq_tickle(ops, svc);
 
-        list_del(&svc->replq_elem);
-        deadline_replq_insert(svc, &svc->replq_elem, replq);
+        deadline_queue_remove(&tmp_replq, node);
+        deadline_replq_insert(svc, node, replq);
     }
 
     /*
-     * If there are units left in the replenishment event list,
+     * If there are units left in the replenishment event queue,
      * set the next replenishment to happen at the deadline of
      * the one in the front.
      */
-    if ( !list_empty(replq) )
-        set_timer(&prv->repl_timer, replq_elem(replq->next)->cur_deadline);
+    if ( !RB_EMPTY_ROOT(replq) )
+        set_timer(&prv->repl_timer,
+                  replq_elem(rb_first(replq))->cur_deadline);
 
     spin_unlock_irq(&prv->lock);
 }
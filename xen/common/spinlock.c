@@ -6,6 +6,7 @@
 #include <xen/smp.h>
 #include <xen/time.h>
 #include <xen/spinlock.h>
+#include <xen/symbols.h>
 #include <xen/guest_access.h>
 #include <xen/preempt.h>
 #include <public/sysctl.h>
@@ -289,6 +290,116 @@ void spin_debug_disable(void)
 
 #endif
 
+/*
+ * Sampled lock contention profiling.  Unlike the above this is always built
+ * in: uncontended acquisitions are not affected at all, and contended ones
+ * only bump a per-CPU counter unless they are picked as a sample, in which
+ * case the wait time is accounted to the (lock, caller) pair in a small
+ * per-CPU hash table.
+ */
+#define LOCK_CONTENTION_ENTRIES 128     /* per CPU, power of 2 */
+#define LOCK_CONTENTION_PROBES  8
+
+struct lock_contention_entry {
+    const spinlock_t *lock;
+    const void *caller;
+    uint64_t count;
+    uint64_t wait_time;
+    uint64_t wait_max;
+    uint32_t hist[XEN_SYSCTL_LOCKCONT_BUCKETS];
+};
+
+struct lock_contention_table {
+    unsigned int gen;                   /* stale if != lock_contention_gen */
+    unsigned long dropped;
+    struct lock_contention_entry ent[LOCK_CONTENTION_ENTRIES];
+};
+
+static unsigned int __read_mostly lock_contention_period;
+static unsigned int lock_contention_gen;
+static s_time_t lock_contention_start;
+static DEFINE_PER_CPU(unsigned int, lock_contention_count);
+static DEFINE_PER_CPU(struct lock_contention_table *, lock_contention_tab);
+
+static always_inline s_time_t lock_contention_sample(void)
+{
+    unsigned int period = read_atomic(&lock_contention_period);
+
+    if ( likely(!period) || ++this_cpu(lock_contention_count) < period )
+        return 0;
+
+    this_cpu(lock_contention_count) = 0;
+
+    return NOW();
+}
+
+static noinline void lock_contention_record(const spinlock_t *lock,
+                                            const void *caller,
+                                            s_time_t start)
+{
+    struct lock_contention_table *tab;
+    struct lock_contention_entry *ent;
+    uint64_t wait = NOW() - start;
+    unsigned long flags, hash;
+    unsigned int i, gen;
+
+    /* Don't race with contended locking from interrupt context. */
+    local_irq_save(flags);
+
+    tab = this_cpu(lock_contention_tab);
+    if ( !tab )
+        goto out;
+
+    gen = read_atomic(&lock_contention_gen);
+    if ( tab->gen != gen )
+    {
+        memset(tab->ent, 0, sizeof(tab->ent));
+        tab->dropped = 0;
+        tab->gen = gen;
+    }
+
+    hash = (unsigned long)lock ^ ((unsigned long)caller << 4);
+    hash ^= (hash >> 7) ^ (hash >> 17);
+
+    for ( i = 0; i < LOCK_CONTENTION_PROBES; i++ )
+    {
+        ent = &tab->ent[(hash + i) & (LOCK_CONTENTION_ENTRIES - 1)];
+
+        if ( !ent->lock )
+        {
+            ent->lock = lock;
+            ent->caller = caller;
+            break;
+        }
+        if ( ent->lock == lock && ent->caller == caller )
+            break;
+    }
+
+    if ( i == LOCK_CONTENTION_PROBES )
+    {
+        tab->dropped++;
+        goto out;
+    }
+
+    ent->count++;
+    ent->wait_time += wait;
+    if ( wait > ent->wait_max )
+        ent->wait_max = wait;
+    ent->hist[min_t(unsigned int, flsl(wait >> 10),
+                    XEN_SYSCTL_LOCKCONT_BUCKETS - 1)]++;
+
+ out:
+    local_irq_restore(flags);
+}
+
+#define LOCK_CONTENTION_VAR   s_time_t cont_start = -1
+#define LOCK_CONTENTION_BLOCK                                                \
+    if ( cont_start < 0 )                                                    \
+        cont_start = lock_contention_sample();
+#define LOCK_CONTENTION_GOT                                                  \
+    if ( unlikely(cont_start > 0) )                                          \
+        lock_contention_record(lock, caller, cont_start);
+
 static always_inline spinlock_tickets_t observe_lock(spinlock_tickets_t *t)
 {
     spinlock_tickets_t v;
@@ -304,37 +415,209 @@ static always_inline u16 observe_head(spinlock_tickets_t *t)
     return read_atomic(&t->head);
 }
 
-void inline _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
+static always_inline bool trylock_tickets(spinlock_t *lock)
+{
+    spinlock_tickets_t old, new;
+
+    old = observe_lock(&lock->tickets);
+    if ( old.head != old.tail )
+        return false;
+    new = old;
+    new.tail++;
+
+    return cmpxchg(&lock->tickets.head_tail,
+                   old.head_tail, new.head_tail) == old.head_tail;
+}
+
+/*
+ * Queued locks.
+ *
+ * With plain ticket locks, all waiters spin on the lock's cache line, which
+ * hence bounces between all of them on every hand-over.  For locks marked
+ * queued (or all locks, with "spinlock-queued"), waiters first line up in an
+ * MCS queue, each spinning on its own per-CPU node.  Only the CPU at the
+ * queue's head takes a ticket and spins on the lock itself, passing the
+ * head on to its successor once it owns the lock.
+ *
+ * A CPU waits for at most one lock in each of the contexts which can nest
+ * (normal, IRQ, NMI/#MC), each using its own node.  Should we ever run out
+ * of nodes, the lock is waited for as a plain ticket lock.
+ */
+#define SPIN_QUEUE_NODES 4
+
+struct spin_queue_node {
+    struct spin_queue_node *next;
+    bool locked;
+};
+
+static DEFINE_PER_CPU(struct spin_queue_node,
+                      spin_queue_nodes[SPIN_QUEUE_NODES]);
+static DEFINE_PER_CPU(unsigned int, spin_queue_depth);
+
+static bool __read_mostly opt_spinlock_queued;
+boolean_param("spinlock-queued", opt_spinlock_queued);
+
+static always_inline bool lock_is_queued(const spinlock_t *lock)
+{
+    return opt_spinlock_queued || (lock->queue & SPINLOCK_QUEUED);
+}
+
+static u16 queue_tail(unsigned int cpu, unsigned int idx)
+{
+    BUILD_BUG_ON(SPIN_QUEUE_NODES != 4);
+    BUILD_BUG_ON(((NR_CPUS << 2) | 3) + 1 > SPINLOCK_QUEUE_TAIL);
+
+    return ((cpu << 2) | idx) + 1;
+}
+
+static struct spin_queue_node *queue_node(u16 tail)
+{
+    tail = (tail & SPINLOCK_QUEUE_TAIL) - 1;
+
+    return &per_cpu(spin_queue_nodes, tail >> 2)[tail & 3];
+}
+
+/*
+ * Add ourselves to the lock's queue.  Returns our node (NULL if none is
+ * available), with *wait set if we need to wait to get to the queue's head.
+ */
+static struct spin_queue_node *queue_join(spinlock_t *lock, bool *wait)
+{
+    unsigned int idx = this_cpu(spin_queue_depth);
+    struct spin_queue_node *node;
+    u16 tail, old, prev;
+
+    if ( unlikely(idx >= SPIN_QUEUE_NODES) )
+        return NULL;
+
+    /* Claim the node before an interrupt can try to use it as well. */
+    this_cpu(spin_queue_depth) = idx + 1;
+    barrier();
+
+    node = &this_cpu(spin_queue_nodes)[idx];
+    node->next = NULL;
+    node->locked = false;
+    tail = queue_tail(smp_processor_id(), idx);
+
+    /* cmpxchg() is a full barrier, publishing the node's initialisation. */
+    old = read_atomic(&lock->queue);
+    do {
+        prev = old;
+        old = cmpxchg(&lock->queue, prev,
+                      (prev & ~SPINLOCK_QUEUE_TAIL) | tail);
+    } while ( old != prev );
+
+    *wait = prev & SPINLOCK_QUEUE_TAIL;
+    if ( *wait )
+        write_atomic(&queue_node(prev)->next, node);
+
+    return node;
+}
+
+/* Pass the head of the lock's queue on, now that we own the lock. */
+static void queue_leave(spinlock_t *lock, struct spin_queue_node *node)
+{
+    unsigned int idx = this_cpu(spin_queue_depth) - 1;
+    struct spin_queue_node *next = read_atomic(&node->next);
+
+    ASSERT(node == &this_cpu(spin_queue_nodes)[idx]);
+
+    if ( !next )
+    {
+        u16 tail = queue_tail(smp_processor_id(), idx);
+        u16 old = read_atomic(&lock->queue);
+
+        /* If we're the last in the queue, leave it empty. */
+        if ( (old & SPINLOCK_QUEUE_TAIL) != tail ||
+             cmpxchg(&lock->queue, old, old & ~SPINLOCK_QUEUE_TAIL) != old )
+        {
+            /* Someone is joining: wait for them to link in behind us. */
+            while ( !(next = read_atomic(&node->next)) )
+                cpu_relax();
+        }
+    }
+
+    if ( next )
+    {
+        write_atomic(&next->locked, true);
+        arch_lock_signal_wmb();
+    }
+
+    barrier();
+    this_cpu(spin_queue_depth) = idx;
+}
+
+static always_inline void spin_lock_common(spinlock_t *lock,
+                                           void (*cb)(void *), void *data,
+                                           const void *caller)
 {
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+    struct spin_queue_node *node = NULL;
+    bool wait = false;
+    LOCK_CONTENTION_VAR;
     LOCK_PROFILE_VAR;
 
     check_lock(&lock->debug, false);
     preempt_disable();
+
+    if ( lock_is_queued(lock) )
+    {
+        /* Uncontended: take the lock, unless others are queueing for it. */
+        if ( !(read_atomic(&lock->queue) & SPINLOCK_QUEUE_TAIL) &&
+             trylock_tickets(lock) )
+            goto got;
+
+        node = queue_join(lock, &wait);
+        while ( wait && !read_atomic(&node->locked) )
+        {
+            LOCK_CONTENTION_BLOCK;
+            LOCK_PROFILE_BLOCK;
+            if ( unlikely(cb) )
+                cb(data);
+            arch_lock_relax();
+        }
+    }
+
     tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
                                            tickets.head_tail);
     while ( tickets.tail != observe_head(&lock->tickets) )
     {
+        LOCK_CONTENTION_BLOCK;
         LOCK_PROFILE_BLOCK;
         if ( unlikely(cb) )
             cb(data);
         arch_lock_relax();
     }
     arch_lock_acquire_barrier();
+
+    if ( node )
+        queue_leave(lock, node);
+
+ got:
+    /*
+     * On the trylock path, cmpxchg() is a full barrier so no need for an
+     * arch_lock_acquire_barrier().
+     */
     got_lock(&lock->debug);
     LOCK_PROFILE_GOT;
+    LOCK_CONTENTION_GOT;
+}
+
+void _spin_lock_cb(spinlock_t *lock, void (*cb)(void *), void *data)
+{
+    spin_lock_common(lock, cb, data, __builtin_return_address(0));
 }
 
 void _spin_lock(spinlock_t *lock)
 {
-     _spin_lock_cb(lock, NULL, NULL);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
 }
 
 void _spin_lock_irq(spinlock_t *lock)
 {
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    _spin_lock(lock);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
@@ -342,7 +625,7 @@ unsigned long _spin_lock_irqsave(spinlock_t *lock)
     unsigned long flags;
 
     local_irq_save(flags);
-    _spin_lock(lock);
+    spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
     return flags;
 }
 
@@ -382,20 +665,9 @@ int _spin_is_locked(const spinlock_t *lock)
 
 int _spin_trylock(spinlock_t *lock)
 {
-    spinlock_tickets_t old, new;
-
     preempt_disable();
     check_lock(&lock->debug, true);
-    old = observe_lock(&lock->tickets);
-    if ( old.head != old.tail )
-    {
-        preempt_enable();
-        return 0;
-    }
-    new = old;
-    new.tail++;
-    if ( cmpxchg(&lock->tickets.head_tail,
-                 old.head_tail, new.head_tail) != old.head_tail )
+    if ( !trylock_tickets(lock) )
     {
         preempt_enable();
         return 0;
@@ -467,7 +739,7 @@ void _spin_lock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        _spin_lock(lock);
+        spin_lock_common(lock, NULL, NULL, __builtin_return_address(0));
         lock->recurse_cpu = cpu;
     }
 
@@ -528,8 +800,9 @@ static void cf_check spinlock_profile_print_elem(struct lock_profile *data,
     printk("%s ", lock_profile_ancs[type].name);
     if ( type != LOCKPROF_TYPE_GLOBAL )
         printk("%d ", idx);
-    printk("%s: addr=%p, lockval=%08x, ", data->name, lock,
-           lock->tickets.head_tail);
+    printk("%s: addr=%p, lockval=%08x%s, ", data->name, lock,
+           lock->tickets.head_tail,
+           lock_is_queued(lock) ? " (queued)" : "");
     if ( lock->debug.cpu == SPINLOCK_NO_CPU )
         printk("not locked\n");
     else
@@ -674,3 +947,167 @@ static int __init cf_check lock_prof_init(void)
 __initcall(lock_prof_init);
 
 #endif /* CONFIG_DEBUG_LOCK_PROFILE */
+
+static int cf_check cpu_lockcont_callback(struct notifier_block *nfb,
+                                          unsigned long action,
+                                          void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        if ( lock_contention_period && !per_cpu(lock_contention_tab, cpu) )
+            per_cpu(lock_contention_tab, cpu) =
+                xzalloc(struct lock_contention_table);
+        break;
+
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        XFREE(per_cpu(lock_contention_tab, cpu));
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static struct notifier_block cpu_lockcont_nfb = {
+    .notifier_call = cpu_lockcont_callback,
+};
+
+static int __init cf_check lockcont_init(void)
+{
+    register_cpu_notifier(&cpu_lockcont_nfb);
+
+    return 0;
+}
+presmp_initcall(lockcont_init);
+
+static void lock_contention_reset(void)
+{
+    lock_contention_start = NOW();
+    /* Tables get cleared by their owning CPU on its next sample. */
+    write_atomic(&lock_contention_gen, lock_contention_gen + 1);
+}
+
+static int lock_contention_copy(struct xen_sysctl_lockcont_op *lc,
+                                unsigned int cpu,
+                                const struct lock_contention_entry *ent)
+{
+    struct lock_contention_entry e = *ent;
+    struct xen_sysctl_lockcont_data elem = {};
+    char namebuf[KSYM_NAME_LEN + 1];
+    unsigned long size, offset;
+    const char *name;
+    unsigned int i;
+
+    if ( !e.lock )
+        return 0;
+
+    if ( lc->nr_elem < lc->max_elem )
+    {
+        elem.lock = (unsigned long)e.lock;
+        elem.caller = (unsigned long)e.caller;
+        name = symbols_lookup((unsigned long)e.caller, &size, &offset,
+                              namebuf);
+        if ( name )
+            snprintf(elem.caller_name, sizeof(elem.caller_name),
+                     "%s+%#lx/%#lx", name, offset, size);
+        elem.cpu = cpu;
+        elem.count = e.count;
+        elem.wait_time = e.wait_time;
+        elem.wait_max = e.wait_max;
+        for ( i = 0; i < XEN_SYSCTL_LOCKCONT_BUCKETS; i++ )
+            elem.hist[i] = e.hist[i];
+
+        if ( copy_to_guest_offset(lc->data, lc->nr_elem, &elem, 1) )
+            return -EFAULT;
+    }
+
+    lc->nr_elem++;
+
+    return 0;
+}
+
+/* Dom0 control of sampled lock contention profiling */
+int lock_contention_control(struct xen_sysctl_lockcont_op *lc)
+{
+    const struct lock_contention_table *tab;
+    unsigned int cpu, gen, i;
+    int rc = 0;
+
+    switch ( lc->cmd )
+    {
+    case XEN_SYSCTL_LOCKCONT_enable:
+        if ( !lc->period )
+            return -EINVAL;
+
+        if ( !get_cpu_maps() )
+            return -EBUSY;
+
+        for_each_online_cpu ( cpu )
+        {
+            if ( per_cpu(lock_contention_tab, cpu) )
+                continue;
+            per_cpu(lock_contention_tab, cpu) =
+                xzalloc(struct lock_contention_table);
+            if ( !per_cpu(lock_contention_tab, cpu) )
+            {
+                rc = -ENOMEM;
+                break;
+            }
+        }
+
+        if ( !rc )
+        {
+            lock_contention_reset();
+            smp_wmb();
+            write_atomic(&lock_contention_period, lc->period);
+        }
+
+        put_cpu_maps();
+        break;
+
+    case XEN_SYSCTL_LOCKCONT_disable:
+        write_atomic(&lock_contention_period, 0);
+        break;
+
+    case XEN_SYSCTL_LOCKCONT_reset:
+        lock_contention_reset();
+        break;
+
+    case XEN_SYSCTL_LOCKCONT_query:
+        if ( !get_cpu_maps() )
+            return -EBUSY;
+
+        gen = read_atomic(&lock_contention_gen);
+        lc->nr_elem = 0;
+        lc->dropped = 0;
+
+        for_each_online_cpu ( cpu )
+        {
+            tab = per_cpu(lock_contention_tab, cpu);
+            if ( !tab || read_atomic(&tab->gen) != gen )
+                continue;
+
+            lc->dropped += tab->dropped;
+            for ( i = 0; !rc && i < LOCK_CONTENTION_ENTRIES; i++ )
+                rc = lock_contention_copy(lc, cpu, &tab->ent[i]);
+        }
+
+        put_cpu_maps();
+
+        lc->period = lock_contention_period;
+        lc->time = NOW() - lock_contention_start;
+        break;
+
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    return rc;
+}
@@ -40,6 +40,7 @@ enum stopmachine_state {
 
 struct stopmachine_data {
     unsigned int nr_cpus;
+    cpumask_t cpus;
 
     enum stopmachine_state state;
     atomic_t done;
@@ -68,28 +69,30 @@ static void stopmachine_wait_state(void)
 }
 
 /*
- * Sync all processors and call a function on one or all of them.
- * As stop_machine_run() is using a tasklet for syncing the processors it is
+ * Sync a set of processors and call a function on one or all of them.
+ * As stop_cpus_run() is using a tasklet for syncing the processors it is
  * mandatory to be called only on an idle vcpu, as otherwise active core
  * scheduling might hang.
  */
-int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
+int stop_cpus_run(const cpumask_t *cpus, int (*fn)(void *), void *data,
+                  unsigned int cpu)
 {
     unsigned int i, nr_cpus;
     unsigned int this = smp_processor_id();
+    bool this_stopped;
     int ret;
 
     BUG_ON(!local_irq_is_enabled());
     BUG_ON(!is_idle_vcpu(current));
 
+    /* @fn() would silently not be run at all. */
+    if ( cpu != NR_CPUS && !cpumask_test_cpu(cpu, cpus) )
+        return -EINVAL;
+
     /* cpu_online_map must not change. */
     if ( !get_cpu_maps() )
         return -EBUSY;
 
-    nr_cpus = num_online_cpus();
-    if ( cpu_online(this) )
-        nr_cpus--;
-
     /* Must not spin here as the holder will expect us to be descheduled. */
     if ( !spin_trylock(&stopmachine_lock) )
     {
@@ -97,6 +100,18 @@ int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
         return -EBUSY;
     }
 
+    cpumask_and(&stopmachine_data.cpus, cpus, &cpu_online_map);
+    if ( cpu != NR_CPUS && !cpumask_test_cpu(cpu, &stopmachine_data.cpus) )
+    {
+        spin_unlock(&stopmachine_lock);
+        put_cpu_maps();
+        return -EINVAL;
+    }
+    this_stopped = cpumask_test_cpu(this, &stopmachine_data.cpus);
+    nr_cpus = cpumask_weight(&stopmachine_data.cpus);
+    if ( this_stopped )
+        nr_cpus--;
+
     stopmachine_data.fn = fn;
     stopmachine_data.fn_data = data;
     stopmachine_data.nr_cpus = nr_cpus;
@@ -107,7 +122,7 @@ int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
 
     smp_wmb();
 
-    for_each_online_cpu ( i )
+    for_each_cpu ( i, &stopmachine_data.cpus )
         if ( i != this )
             tasklet_schedule_on_cpu(&per_cpu(stopmachine_tasklet, i), i);
 
@@ -120,7 +135,7 @@ int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
     spin_debug_disable();
 
     stopmachine_set_state(STOPMACHINE_INVOKE);
-    if ( (cpu == this) || (cpu == NR_CPUS) )
+    if ( this_stopped && ((cpu == this) || (cpu == NR_CPUS)) )
     {
         ret = (*fn)(data);
         if ( ret )
@@ -141,6 +156,11 @@ int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
     return ret;
 }
 
+int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu)
+{
+    return stop_cpus_run(&cpu_online_map, fn, data, cpu);
+}
+
 static void cf_check stopmachine_action(void *data)
 {
     unsigned int cpu = (unsigned long)data;
@@ -188,8 +208,13 @@ static int cf_check cpu_callback(
     unsigned int cpu = (unsigned long)hcpu;
 
     if ( action == CPU_UP_PREPARE )
+    {
         tasklet_init(&per_cpu(stopmachine_tasklet, cpu),
                      stopmachine_action, hcpu);
+        /* Don't keep the other CPUs spinning behind unrelated tasklets. */
+        tasklet_set_prio(&per_cpu(stopmachine_tasklet, cpu),
+                         TASKLET_PRIO_HIGH);
+    }
 
     return NOTIFY_DONE;
 }
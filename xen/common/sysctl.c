@@ -29,6 +29,146 @@
 #include <xen/livepatch.h>
 #include <xen/coverage.h>
 
+static int get_domain_stats(struct xen_sysctl_get_domain_stats *gds)
+{
+    struct domain *d;
+    struct vcpu *v;
+    struct xen_sysctl_domain_stats ds;
+    struct xen_sysctl_vcpu_stats vs;
+    struct vcpu_runstate_info runstate;
+    domid_t first = gds->first_domain;
+    unsigned int i, size;
+    int ret = 0;
+
+    if ( gds->pad || gds->used > gds->size )
+        return -EINVAL;
+
+    gds->first_domain = DOMID_INVALID;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        if ( d->domain_id < first )
+            continue;
+
+        /* Preempted after the previous domain? */
+        if ( ret )
+        {
+            gds->first_domain = d->domain_id;
+            ret = -ERESTART;
+            break;
+        }
+
+        if ( xsm_getdomaininfo(XSM_HOOK, d) )
+            continue;
+
+        memset(&ds, 0, sizeof(ds));
+        ds.domid = d->domain_id;
+        for_each_vcpu ( d, v )
+            ds.nr_vcpus++;
+
+        size = sizeof(ds) + ds.nr_vcpus * sizeof(vs);
+        if ( size > gds->size - gds->used )
+        {
+            gds->first_domain = d->domain_id;
+            if ( !gds->nr_domains )
+                ret = -ENOBUFS;
+            break;
+        }
+
+        ds.flags = XEN_DOMINF_blocked;
+        i = 0;
+        for_each_vcpu ( d, v )
+        {
+            /* Don't overrun the space accounted for, should vcpus appear. */
+            if ( i == ds.nr_vcpus )
+                break;
+
+            memset(&vs, 0, sizeof(vs));
+            vs.vcpu_id = v->vcpu_id;
+
+            vcpu_runstate_get(v, &runstate);
+            BUILD_BUG_ON(ARRAY_SIZE(vs.runstate) !=
+                         ARRAY_SIZE(runstate.time));
+            memcpy(vs.runstate, runstate.time, sizeof(vs.runstate));
+            ds.cpu_time += runstate.time[RUNSTATE_running];
+
+            /* As for XEN_DOMCTL_getdomaininfo. */
+            if ( !(v->pause_flags & VPF_down) )
+            {
+                vs.flags |= XEN_VCPUSTAT_online;
+                if ( v->pause_flags & VPF_blocked )
+                    vs.flags |= XEN_VCPUSTAT_blocked;
+                else
+                    ds.flags &= ~XEN_DOMINF_blocked;
+                if ( v->is_running )
+                {
+                    vs.flags |= XEN_VCPUSTAT_running;
+                    ds.flags |= XEN_DOMINF_running;
+                }
+                ds.nr_online_vcpus++;
+            }
+
+            arch_get_vcpu_stats(v, &vs);
+
+            if ( copy_to_guest_offset(gds->buffer,
+                                      gds->used + sizeof(ds) +
+                                      i++ * sizeof(vs),
+                                      (uint8_t *)&vs, sizeof(vs)) )
+            {
+                ret = -EFAULT;
+                break;
+            }
+        }
+        if ( ret )
+            break;
+
+        ds.flags = (ds.nr_online_vcpus ? ds.flags : 0) |
+            ((d->is_dying == DOMDYING_dead) ? XEN_DOMINF_dying     : 0) |
+            (d->is_shut_down                ? XEN_DOMINF_shutdown  : 0) |
+            (d->controller_pause_count > 0  ? XEN_DOMINF_paused    : 0) |
+            (d->debugger_attached           ? XEN_DOMINF_debugged  : 0) |
+            (is_xenstore_domain(d)          ? XEN_DOMINF_xs_domain : 0) |
+            (is_hvm_domain(d)               ? XEN_DOMINF_hvm_guest : 0) |
+            d->shutdown_code << XEN_DOMINF_shutdownshift;
+        memcpy(ds.handle, d->handle, sizeof(xen_domain_handle_t));
+
+        ds.tot_pages         = domain_tot_pages(d);
+        ds.max_pages         = d->max_pages;
+        ds.outstanding_pages = d->outstanding_pages;
+        ds.xenheap_pages     = d->xenheap_pages;
+#ifdef CONFIG_MEM_SHARING
+        ds.shr_pages         = atomic_read(&d->shr_pages);
+#endif
+#ifdef CONFIG_MEM_PAGING
+        ds.paged_pages       = atomic_read(&d->paged_pages);
+#endif
+
+        ds.evtchn_active = read_atomic(&d->active_evtchns);
+        ds.evtchn_max = d->max_evtchn_port + 1;
+
+        gnttab_get_stats(d, &ds);
+
+        if ( copy_to_guest_offset(gds->buffer, gds->used,
+                                  (uint8_t *)&ds, sizeof(ds)) )
+        {
+            ret = -EFAULT;
+            break;
+        }
+
+        gds->used += size;
+        gds->nr_domains++;
+
+        /* Acted upon once the next domain is found, if there is one. */
+        ret = hypercall_preempt_check();
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    return ret > 0 ? 0 : ret;
+}
+
 long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
     long ret = 0;
@@ -125,6 +265,23 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         ret = spinlock_profile_control(&op->u.lockprof_op);
         break;
 #endif
+
+    case XEN_SYSCTL_lockcont_op:
+        ret = lock_contention_control(&op->u.lockcont_op);
+        break;
+
+    case XEN_SYSCTL_get_domain_stats:
+        ret = get_domain_stats(&op->u.get_domain_stats);
+        if ( ret == -ERESTART )
+        {
+            if ( !__copy_field_to_guest(u_sysctl, op, u.get_domain_stats) )
+                ret = hypercall_create_continuation(__HYPERVISOR_sysctl,
+                                                    "h", u_sysctl);
+            else
+                ret = -EFAULT;
+        }
+        break;
+
     case XEN_SYSCTL_debug_keys:
     {
         char c;
@@ -319,9 +476,12 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
                     {
                         meminfo.memsize = node_spanned_pages(i) << PAGE_SHIFT;
                         meminfo.memfree = avail_node_heap_pages(i) << PAGE_SHIFT;
+                        meminfo.memzeroed =
+                            avail_node_zeroed_pages(i) << PAGE_SHIFT;
                     }
                     else
-                        meminfo.memsize = meminfo.memfree = XEN_INVALID_MEM_SZ;
+                        meminfo.memsize = meminfo.memfree =
+                            meminfo.memzeroed = XEN_INVALID_MEM_SZ;
 
                     if ( copy_to_guest_offset(ni->meminfo, i, &meminfo, 1) )
                     {
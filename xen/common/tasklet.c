@@ -13,7 +13,10 @@
  *    Keir Fraser <keir@xen.org>
  */
 
+#include <xen/hypfs.h>
 #include <xen/init.h>
+#include <xen/param.h>
+#include <xen/perfc.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/tasklet.h>
@@ -24,28 +27,59 @@ static bool_t tasklets_initialised;
 
 DEFINE_PER_CPU(unsigned long, tasklet_work_to_do);
 
-static DEFINE_PER_CPU(struct list_head, tasklet_list);
-static DEFINE_PER_CPU(struct list_head, softirq_tasklet_list);
+/* One list per priority class. */
+static DEFINE_PER_CPU(struct list_head, tasklet_list[TASKLET_NR_PRIOS]);
+static DEFINE_PER_CPU(struct list_head,
+                      softirq_tasklet_list[TASKLET_NR_PRIOS]);
 
 /* Protects all lists and tasklet structures. */
 static DEFINE_SPINLOCK(tasklet_lock);
 
+/*
+ * Time a CPU may spend running tasklets back to back, before going through
+ * the scheduler (VCPU context) or the softirq loop again.  Tasklets are never
+ * interrupted, but long running ones can check tasklet_should_yield().
+ */
+static unsigned int __read_mostly tasklet_budget_us = 500;
+integer_param("tasklet-budget-us", tasklet_budget_us);
+
+static DEFINE_PER_CPU(s_time_t, tasklet_deadline);
+
+/* Protected by tasklet_lock. */
+static struct {
+    unsigned int latency_max_us;
+    unsigned int runtime_max_us;
+} tasklet_stats;
+
+static bool tasklet_lists_empty(const struct list_head *lists)
+{
+    unsigned int i;
+
+    for ( i = 0; i < TASKLET_NR_PRIOS; i++ )
+        if ( !list_empty(&lists[i]) )
+            return false;
+
+    return true;
+}
+
 static void tasklet_enqueue(struct tasklet *t)
 {
     unsigned int cpu = t->scheduled_on;
 
+    t->enqueued = NOW();
+
     if ( t->is_softirq )
     {
-        struct list_head *list = &per_cpu(softirq_tasklet_list, cpu);
-        bool_t was_empty = list_empty(list);
-        list_add_tail(&t->list, list);
+        struct list_head *lists = per_cpu(softirq_tasklet_list, cpu);
+        bool_t was_empty = tasklet_lists_empty(lists);
+        list_add_tail(&t->list, &lists[t->prio]);
         if ( was_empty )
             cpu_raise_softirq(cpu, TASKLET_SOFTIRQ);
     }
     else
     {
         unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
-        list_add_tail(&t->list, &per_cpu(tasklet_list, cpu));
+        list_add_tail(&t->list, &per_cpu(tasklet_list, cpu)[t->prio]);
         if ( !test_and_set_bit(_TASKLET_enqueued, work_to_do) )
             cpu_raise_softirq(cpu, SCHEDULE_SOFTIRQ);
     }
@@ -75,25 +109,61 @@ void tasklet_schedule(struct tasklet *t)
     tasklet_schedule_on_cpu(t, smp_processor_id());
 }
 
-static void do_tasklet_work(unsigned int cpu, struct list_head *list)
+bool tasklet_should_yield(void)
 {
-    struct tasklet *t;
+    unsigned int cpu = smp_processor_id();
 
-    if ( unlikely(list_empty(list) || cpu_is_offline(cpu)) )
+    return (softirq_pending(cpu) &
+            ((1UL << SCHEDULE_SOFTIRQ) | (1UL << TIMER_SOFTIRQ))) ||
+           NOW() >= per_cpu(tasklet_deadline, cpu);
+}
+
+static void tasklet_start_budget(unsigned int cpu)
+{
+    per_cpu(tasklet_deadline, cpu) =
+        tasklet_budget_us ? NOW() + MICROSECS(tasklet_budget_us) : STIME_MAX;
+}
+
+static void do_tasklet_work(unsigned int cpu, struct list_head *lists)
+{
+    struct tasklet *t = NULL;
+    unsigned int i;
+    s_time_t start, delta;
+
+    if ( unlikely(cpu_is_offline(cpu)) )
+        return;
+
+    for ( i = 0; i < TASKLET_NR_PRIOS; i++ )
+        if ( !list_empty(&lists[i]) )
+        {
+            t = list_entry(lists[i].next, struct tasklet, list);
+            break;
+        }
+
+    if ( !t )
         return;
 
-    t = list_entry(list->next, struct tasklet, list);
     list_del_init(&t->list);
 
     BUG_ON(t->is_dead || t->is_running || (t->scheduled_on != cpu));
     t->scheduled_on = -1;
     t->is_running = 1;
 
+    start = NOW();
+    delta = (start - t->enqueued) / MICROSECS(1);
+    if ( delta > tasklet_stats.latency_max_us )
+        tasklet_stats.latency_max_us = delta;
+
     spin_unlock_irq(&tasklet_lock);
     sync_local_execstate();
     t->func(t->data);
     spin_lock_irq(&tasklet_lock);
 
+    perfc_incr(tasklets_run);
+    delta = (NOW() - start) / MICROSECS(1);
+    if ( delta > tasklet_stats.runtime_max_us )
+        tasklet_stats.runtime_max_us = delta;
+
     t->is_running = 0;
 
     if ( t->scheduled_on >= 0 )
@@ -108,7 +178,7 @@ void do_tasklet(void)
 {
     unsigned int cpu = smp_processor_id();
     unsigned long *work_to_do = &per_cpu(tasklet_work_to_do, cpu);
-    struct list_head *list = &per_cpu(tasklet_list, cpu);
+    struct list_head *lists = per_cpu(tasklet_list, cpu);
 
     /*
      * We want to be sure any caller has checked that a tasklet is both
@@ -123,9 +193,27 @@ void do_tasklet(void)
 
     spin_lock_irq(&tasklet_lock);
 
-    do_tasklet_work(cpu, list);
+    /*
+     * Run as many tasklets as fit in the budget, rather than going through
+     * the scheduler after each one, but don't hold up the scheduler or timers
+     * once they have work to do.
+     */
+    tasklet_start_budget(cpu);
+    for ( ; ; )
+    {
+        do_tasklet_work(cpu, lists);
+
+        if ( tasklet_lists_empty(lists) || cpu_is_offline(cpu) )
+            break;
+
+        if ( tasklet_should_yield() )
+        {
+            perfc_incr(tasklet_yields);
+            break;
+        }
+    }
 
-    if ( list_empty(list) )
+    if ( tasklet_lists_empty(lists) )
     {
         clear_bit(_TASKLET_enqueued, work_to_do);        
         raise_softirq(SCHEDULE_SOFTIRQ);
@@ -138,13 +226,14 @@ void do_tasklet(void)
 static void cf_check tasklet_softirq_action(void)
 {
     unsigned int cpu = smp_processor_id();
-    struct list_head *list = &per_cpu(softirq_tasklet_list, cpu);
+    struct list_head *lists = per_cpu(softirq_tasklet_list, cpu);
 
     spin_lock_irq(&tasklet_lock);
 
-    do_tasklet_work(cpu, list);
+    tasklet_start_budget(cpu);
+    do_tasklet_work(cpu, lists);
 
-    if ( !list_empty(list) && !cpu_is_offline(cpu) )
+    if ( !tasklet_lists_empty(lists) && !cpu_is_offline(cpu) )
         raise_softirq(TASKLET_SOFTIRQ);
 
     spin_unlock_irq(&tasklet_lock);
@@ -180,21 +269,24 @@ void tasklet_kill(struct tasklet *t)
     spin_unlock_irqrestore(&tasklet_lock, flags);
 }
 
-static void migrate_tasklets_from_cpu(unsigned int cpu, struct list_head *list)
+static void migrate_tasklets_from_cpu(unsigned int cpu,
+                                      struct list_head *lists)
 {
     unsigned long flags;
     struct tasklet *t;
+    unsigned int i;
 
     spin_lock_irqsave(&tasklet_lock, flags);
 
-    while ( !list_empty(list) )
-    {
-        t = list_entry(list->next, struct tasklet, list);
-        BUG_ON(t->scheduled_on != cpu);
-        t->scheduled_on = smp_processor_id();
-        list_del(&t->list);
-        tasklet_enqueue(t);
-    }
+    for ( i = 0; i < TASKLET_NR_PRIOS; i++ )
+        while ( !list_empty(&lists[i]) )
+        {
+            t = list_entry(lists[i].next, struct tasklet, list);
+            BUG_ON(t->scheduled_on != cpu);
+            t->scheduled_on = smp_processor_id();
+            list_del(&t->list);
+            tasklet_enqueue(t);
+        }
 
     spin_unlock_irqrestore(&tasklet_lock, flags);
 }
@@ -204,6 +296,7 @@ void tasklet_init(struct tasklet *t, void (*func)(void *), void *data)
     memset(t, 0, sizeof(*t));
     INIT_LIST_HEAD(&t->list);
     t->scheduled_on = -1;
+    t->prio = TASKLET_PRIO_NORMAL;
     t->func = func;
     t->data = data;
 }
@@ -214,21 +307,45 @@ void softirq_tasklet_init(struct tasklet *t, void (*func)(void *), void *data)
     t->is_softirq = 1;
 }
 
+void tasklet_set_prio(struct tasklet *t, enum tasklet_prio prio)
+{
+    unsigned long flags;
+
+    ASSERT(prio < TASKLET_NR_PRIOS);
+
+    spin_lock_irqsave(&tasklet_lock, flags);
+
+    t->prio = prio;
+
+    /* Move an already queued tasklet over to its new class. */
+    if ( !list_empty(&t->list) )
+    {
+        list_del(&t->list);
+        tasklet_enqueue(t);
+    }
+
+    spin_unlock_irqrestore(&tasklet_lock, flags);
+}
+
 static int cf_check cpu_callback(
     struct notifier_block *nfb, unsigned long action, void *hcpu)
 {
     unsigned int cpu = (unsigned long)hcpu;
+    unsigned int i;
 
     switch ( action )
     {
     case CPU_UP_PREPARE:
-        INIT_LIST_HEAD(&per_cpu(tasklet_list, cpu));
-        INIT_LIST_HEAD(&per_cpu(softirq_tasklet_list, cpu));
+        for ( i = 0; i < TASKLET_NR_PRIOS; i++ )
+        {
+            INIT_LIST_HEAD(&per_cpu(tasklet_list, cpu)[i]);
+            INIT_LIST_HEAD(&per_cpu(softirq_tasklet_list, cpu)[i]);
+        }
         break;
     case CPU_UP_CANCELED:
     case CPU_DEAD:
-        migrate_tasklets_from_cpu(cpu, &per_cpu(tasklet_list, cpu));
-        migrate_tasklets_from_cpu(cpu, &per_cpu(softirq_tasklet_list, cpu));
+        migrate_tasklets_from_cpu(cpu, per_cpu(tasklet_list, cpu));
+        migrate_tasklets_from_cpu(cpu, per_cpu(softirq_tasklet_list, cpu));
         break;
     default:
         break;
@@ -251,6 +368,24 @@ void __init tasklet_subsys_init(void)
     tasklets_initialised = 1;
 }
 
+#ifdef CONFIG_HYPFS
+static HYPFS_DIR_INIT(tasklet_dir, "tasklet");
+static HYPFS_UINT_INIT(latency_max, "latency-max-us",
+                       tasklet_stats.latency_max_us);
+static HYPFS_UINT_INIT(runtime_max, "runtime-max-us",
+                       tasklet_stats.runtime_max_us);
+
+static int __init cf_check tasklet_hypfs_init(void)
+{
+    hypfs_add_dir(&hypfs_root, &tasklet_dir, true);
+    hypfs_add_leaf(&tasklet_dir, &latency_max, true);
+    hypfs_add_leaf(&tasklet_dir, &runtime_max, true);
+
+    return 0;
+}
+__initcall(tasklet_hypfs_init);
+#endif
+
 /*
  * Local variables:
  * mode: C
@@ -29,12 +29,43 @@
 static unsigned int timer_slop __read_mostly = 50000; /* 50 us */
 integer_param("timer_slop", timer_slop);
 
+/*
+ * Coarse timers live on a hierarchical, non-cascading timer wheel (modelled
+ * after Linux').  Level n has WHEEL_LVL_SIZE buckets, each covering 8^n ticks
+ * of 2^WHEEL_TICK_SHIFT ns.  A timer goes on the lowest level covering its
+ * timeout, into the bucket following its expiry: it fires late by at most a
+ * bucket's worth (about an eighth of the timeout), but never early.  A level's
+ * bucket is only looked at once wheel_clk reaches the bucket's start, so timers
+ * never need to be cascaded down from one level to the next.
+ */
+#define WHEEL_TICK_SHIFT     20 /* ~1ms */
+#define WHEEL_LVL_CLK_SHIFT  3
+#define WHEEL_LVL_CLK_MASK   ((1U << WHEEL_LVL_CLK_SHIFT) - 1)
+#define WHEEL_LVL_SIZE       64U
+#define WHEEL_LVL_MASK       (WHEEL_LVL_SIZE - 1)
+#define WHEEL_LVL_DEPTH      5
+#define WHEEL_SIZE           (WHEEL_LVL_SIZE * WHEEL_LVL_DEPTH)
+#define WHEEL_LVL_SHIFT(n)   ((n) * WHEEL_LVL_CLK_SHIFT)
+#define WHEEL_LVL_GRAN(n)    (1ULL << WHEEL_LVL_SHIFT(n))
+/* Shortest timeout, in ticks, for level n > 0. */
+#define WHEEL_LVL_START(n) \
+    ((uint64_t)(WHEEL_LVL_SIZE - 1) << WHEEL_LVL_SHIFT((n) - 1))
+/* Longer timeouts get re-queued when their (clamped) bucket comes up. */
+#define WHEEL_TIMEOUT_CUTOFF WHEEL_LVL_START(WHEEL_LVL_DEPTH)
+#define WHEEL_TIMEOUT_MAX \
+    (WHEEL_TIMEOUT_CUTOFF - WHEEL_LVL_GRAN(WHEEL_LVL_DEPTH - 1))
+
 struct timers {
     spinlock_t     lock;
     struct timer **heap;
     struct timer  *list;
     struct timer  *running;
     struct list_head inactive;
+
+    /* Timer wheel for coarse timers. */
+    uint64_t       wheel_clk; /* Next tick to process. */
+    DECLARE_BITMAP(wheel_pending, WHEEL_SIZE);
+    struct hlist_head wheel[WHEEL_SIZE];
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -176,6 +207,87 @@ static int add_to_list(struct timer **pprev, struct timer *t)
 }
 
 
+/****************************************************************************
+ * TIMER WHEEL OPERATIONS.
+ */
+
+/* Start of the first pending bucket of level @lvl, in ticks. */
+static uint64_t wheel_lvl_next(const struct timers *ts, unsigned int lvl)
+{
+    unsigned int base = lvl * WHEEL_LVL_SIZE, pos, bit;
+    uint64_t lvl_clk = (ts->wheel_clk + WHEEL_LVL_GRAN(lvl) - 1) >>
+                       WHEEL_LVL_SHIFT(lvl);
+
+    pos = lvl_clk & WHEEL_LVL_MASK;
+    bit = find_next_bit(ts->wheel_pending, base + WHEEL_LVL_SIZE, base + pos);
+    if ( bit >= base + WHEEL_LVL_SIZE )
+    {
+        /* Wrap around. */
+        bit = find_next_bit(ts->wheel_pending, base + pos, base);
+        if ( bit >= base + pos )
+            return ~0ULL;
+    }
+
+    return (lvl_clk + ((bit - base - pos) & WHEEL_LVL_MASK)) <<
+           WHEEL_LVL_SHIFT(lvl);
+}
+
+/* Start of the first pending bucket, in ticks, or ~0 if none. */
+static uint64_t wheel_next(const struct timers *ts)
+{
+    uint64_t next = ~0ULL;
+    unsigned int lvl;
+
+    for ( lvl = 0; lvl < WHEEL_LVL_DEPTH; lvl++ )
+        next = min(next, wheel_lvl_next(ts, lvl));
+
+    return next;
+}
+
+/*
+ * Add @t to the wheel.  Return the start of its bucket in ns, or 0 if @t
+ * expires too soon for the wheel.
+ */
+static s_time_t add_to_wheel(struct timers *ts, struct timer *t)
+{
+    uint64_t now = NOW() >> WHEEL_TICK_SHIFT, expires, delta, bucket;
+    unsigned int lvl;
+
+    /* Catch up with time passed, unless buckets are pending before now. */
+    if ( now > ts->wheel_clk )
+        ts->wheel_clk = min(now, wheel_next(ts));
+
+    expires = t->expires >> WHEEL_TICK_SHIFT;
+    if ( t->expires <= 0 || expires <= ts->wheel_clk )
+        return 0;
+
+    delta = expires - ts->wheel_clk;
+    for ( lvl = 0; lvl < WHEEL_LVL_DEPTH - 1; lvl++ )
+        if ( delta < WHEEL_LVL_START(lvl + 1) )
+            break;
+    if ( delta >= WHEEL_TIMEOUT_CUTOFF )
+        expires = ts->wheel_clk + WHEEL_TIMEOUT_MAX;
+
+    bucket = (expires >> WHEEL_LVL_SHIFT(lvl)) + 1;
+    t->wheel_idx = lvl * WHEEL_LVL_SIZE + (bucket & WHEEL_LVL_MASK);
+    hlist_add_head(&t->wheel, &ts->wheel[t->wheel_idx]);
+    __set_bit(t->wheel_idx, ts->wheel_pending);
+
+    return (bucket << WHEEL_LVL_SHIFT(lvl)) << WHEEL_TICK_SHIFT;
+}
+
+static void remove_from_wheel(struct timers *ts, struct timer *t)
+{
+    /*
+     * @t may be on timer_softirq_action()'s list of expired timers instead,
+     * but that's fine: its bucket's pending bit is still accurate.
+     */
+    __hlist_del(&t->wheel);
+    if ( hlist_empty(&ts->wheel[t->wheel_idx]) )
+        __clear_bit(t->wheel_idx, ts->wheel_pending);
+}
+
+
 /****************************************************************************
  * TIMER OPERATIONS.
  */
@@ -193,6 +305,10 @@ static int remove_entry(struct timer *t)
     case TIMER_STATUS_in_list:
         rc = remove_from_list(&timers->list, t);
         break;
+    case TIMER_STATUS_in_wheel:
+        remove_from_wheel(timers, t);
+        rc = 0;
+        break;
     default:
         rc = 0;
         BUG();
@@ -209,6 +325,18 @@ static int add_entry(struct timer *t)
 
     ASSERT(t->status == TIMER_STATUS_invalid);
 
+    if ( t->coarse )
+    {
+        s_time_t bucket = add_to_wheel(timers, t), deadline;
+
+        if ( bucket )
+        {
+            t->status = TIMER_STATUS_in_wheel;
+            deadline = per_cpu(timer_deadline, t->cpu);
+            return !deadline || bucket < deadline;
+        }
+    }
+
     /* Try to add to heap. t->heap_offset indicates whether we succeed. */
     t->heap_offset = 0;
     t->status = TIMER_STATUS_in_heap;
@@ -309,6 +437,17 @@ void init_timer(
 }
 
 
+void init_coarse_timer(
+    struct timer *timer,
+    void        (*function)(void *),
+    void         *data,
+    unsigned int  cpu)
+{
+    init_timer(timer, function, data, cpu);
+    timer->coarse = true;
+}
+
+
 void set_timer(struct timer *timer, s_time_t expires)
 {
     unsigned long flags;
@@ -450,11 +589,68 @@ static void execute_timer(struct timers *ts, struct timer *t)
 }
 
 
+/* Execute ready wheel timers. */
+static void run_wheel(struct timers *ts, s_time_t now)
+{
+    uint64_t now_tick = now >> WHEEL_TICK_SHIFT, clk;
+    struct hlist_head expired;
+    struct timer *t;
+    unsigned int lvl, idx;
+
+    for ( ; ; )
+    {
+        clk = wheel_next(ts);
+        if ( clk > now_tick )
+            break;
+
+        /*
+         * Detach all buckets due at clk before the lock gets dropped, as
+         * timers for clk + WHEEL_LVL_SIZE * granularity may land in them.
+         */
+        INIT_HLIST_HEAD(&expired);
+        for ( lvl = 0; lvl < WHEEL_LVL_DEPTH; lvl++ )
+        {
+            idx = lvl * WHEEL_LVL_SIZE +
+                  ((clk >> WHEEL_LVL_SHIFT(lvl)) & WHEEL_LVL_MASK);
+            while ( !hlist_empty(&ts->wheel[idx]) )
+            {
+                t = hlist_entry(ts->wheel[idx].first, struct timer, wheel);
+                __hlist_del(&t->wheel);
+                hlist_add_head(&t->wheel, &expired);
+            }
+            __clear_bit(idx, ts->wheel_pending);
+
+            /* Higher levels are only due at multiples of their granularity. */
+            if ( (clk >> WHEEL_LVL_SHIFT(lvl)) & WHEEL_LVL_CLK_MASK )
+                break;
+        }
+        ts->wheel_clk = clk + 1;
+
+        while ( !hlist_empty(&expired) )
+        {
+            t = hlist_entry(expired.first, struct timer, wheel);
+            __hlist_del(&t->wheel);
+            if ( t->expires < now )
+                execute_timer(ts, t);
+            else
+            {
+                /* A clamped long timeout: re-queue for the remainder. */
+                t->status = TIMER_STATUS_invalid;
+                add_entry(t);
+            }
+        }
+    }
+
+    if ( ts->wheel_clk <= now_tick )
+        ts->wheel_clk = now_tick + 1;
+}
+
 static void cf_check timer_softirq_action(void)
 {
     struct timer  *t, **heap, *next;
     struct timers *ts;
     s_time_t       now, deadline;
+    uint64_t       wheel;
 
     ts = &this_cpu(timers);
     heap = ts->heap;
@@ -506,6 +702,8 @@ static void cf_check timer_softirq_action(void)
         execute_timer(ts, t);
     }
 
+    run_wheel(ts, now);
+
     /* Try to move timers from linked list to more efficient heap. */
     next = ts->list;
     ts->list = NULL;
@@ -522,6 +720,9 @@ static void cf_check timer_softirq_action(void)
         deadline = heap[1]->expires;
     if ( (ts->list != NULL) && (ts->list->expires < deadline) )
         deadline = ts->list->expires;
+    wheel = wheel_next(ts);
+    if ( wheel != ~0ULL && (s_time_t)(wheel << WHEEL_TICK_SHIFT) < deadline )
+        deadline = wheel << WHEEL_TICK_SHIFT;
     now = NOW();
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : MAX(deadline, now + timer_slop);
@@ -549,6 +750,7 @@ static void dump_timer(struct timer *t, s_time_t now)
 static void cf_check dump_timerq(unsigned char key)
 {
     struct timer  *t;
+    struct hlist_node *n;
     struct timers *ts;
     unsigned long  flags;
     s_time_t       now = NOW();
@@ -566,6 +768,9 @@ static void cf_check dump_timerq(unsigned char key)
             dump_timer(ts->heap[j], now);
         for ( t = ts->list; t != NULL; t = t->list_next )
             dump_timer(t, now);
+        for_each_set_bit ( j, ts->wheel_pending, WHEEL_SIZE )
+            hlist_for_each_entry ( t, n, &ts->wheel[j], wheel )
+                dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
 }
@@ -575,6 +780,7 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
     unsigned int new_cpu = cpumask_any(&cpu_online_map);
     struct timers *old_ts, *new_ts;
     struct timer *t;
+    unsigned int i;
     bool_t notify = 0;
 
     ASSERT(!cpu_online(old_cpu) && cpu_online(new_cpu));
@@ -601,6 +807,15 @@ static void migrate_timers_from_cpu(unsigned int old_cpu)
         notify |= add_entry(t);
     }
 
+    for_each_set_bit ( i, old_ts->wheel_pending, WHEEL_SIZE )
+        while ( !hlist_empty(&old_ts->wheel[i]) )
+        {
+            t = hlist_entry(old_ts->wheel[i].first, struct timer, wheel);
+            remove_entry(t);
+            write_atomic(&t->cpu, new_cpu);
+            notify |= add_entry(t);
+        }
+
     while ( !list_empty(&old_ts->inactive) )
     {
         t = list_entry(old_ts->inactive.next, struct timer, inactive);
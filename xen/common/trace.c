@@ -29,6 +29,7 @@
 #include <xen/init.h>
 #include <xen/mm.h>
 #include <xen/percpu.h>
+#include <xen/perfc.h>
 #include <xen/pfn.h>
 #include <xen/cpu.h>
 #include <asm/atomic.h>
@@ -54,15 +55,24 @@ static struct t_info *t_info;
 static unsigned int t_info_pages;
 
 static DEFINE_PER_CPU_READ_MOSTLY(struct t_buf *, t_bufs);
-static DEFINE_PER_CPU_READ_MOSTLY(spinlock_t, t_lock);
 static u32 data_size __read_mostly;
 
+/*
+ * Writers don't take any lock, not even against interrupts: space in a CPU's
+ * buffer is reserved by advancing t_head with cmpxchg (only ever racing with
+ * interrupt / NMI context tracing on the same CPU), and handed to the
+ * consumer by advancing buf->prod up to t_head once the outermost of any
+ * nested writers (counted by t_nest) is done filling in its records.
+ */
+static DEFINE_PER_CPU(uint32_t, t_head);
+static DEFINE_PER_CPU(unsigned int, t_nest);
+
 /* High water mark for trace buffers; */
 /* Send virtual interrupt when buffer level reaches this point */
 static u32 t_buf_highwater;
 
 /* Number of records lost due to per-CPU trace buffer being full. */
-static DEFINE_PER_CPU(unsigned long, lost_records);
+static DEFINE_PER_CPU(atomic_t, lost_records);
 static DEFINE_PER_CPU(unsigned long, lost_records_first_tsc);
 
 /* a flag recording whether initialization has been done */
@@ -75,20 +85,30 @@ static cpumask_t tb_cpu_mask;
 /* which tracing events are enabled */
 static u32 tb_event_mask = TRC_ALL;
 
-static int cf_check cpu_callback(
-    struct notifier_block *nfb, unsigned long action, void *hcpu)
-{
-    unsigned int cpu = (unsigned long)hcpu;
+/* Sampling policy per event class, see XEN_SYSCTL_TBUFOP_set_sampling. */
+#define TRC_NR_CLASSES 12
+static struct {
+    unsigned int period;    /* Record 1 in period events. */
+    unsigned int rate;      /* Events per second and CPU, 0: unlimited. */
+    unsigned int burst;
+    s_time_t interval;      /* 1s / rate */
+    s_time_t slack;         /* Allowance for bursts, (burst - 1) * interval */
+} tb_sampling[TRC_NR_CLASSES];
+static unsigned long tb_sampled_classes; /* Classes with a policy in place. */
 
-    if ( action == CPU_UP_PREPARE )
-        spin_lock_init(&per_cpu(t_lock, cpu));
+/*
+ * Per-CPU sampling state.  Rate limiting uses the generic cell rate
+ * algorithm: tat is the earliest time the next event would be conforming if
+ * no burst was allowed.
+ */
+static DEFINE_PER_CPU(unsigned int, tb_sample_count[TRC_NR_CLASSES]);
+static DEFINE_PER_CPU(s_time_t, tb_sample_tat[TRC_NR_CLASSES]);
 
-    return NOTIFY_DONE;
-}
+/* Only trace events in the context of this domain, unless DOMID_INVALID. */
+static domid_t tb_domid = DOMID_INVALID;
 
-static struct notifier_block cpu_nfb = {
-    .notifier_call = cpu_callback
-};
+static void trace_record(u32 event, bool_t cycles, unsigned int extra,
+                         const void *extra_data);
 
 static uint32_t calc_tinfo_first_offset(void)
 {
@@ -225,13 +245,12 @@ static int alloc_trace_bufs(unsigned int pages)
     {
         struct t_buf *buf;
 
-        spin_lock_init(&per_cpu(t_lock, cpu));
-
         offset = t_info->mfn_offset[cpu];
 
         /* Initialize the buffer metadata */
         per_cpu(t_bufs, cpu) = buf = mfn_to_virt(t_info_mfn_list[offset]);
         buf->cons = buf->prod = 0;
+        per_cpu(t_head, cpu) = 0;
 
         printk(XENLOG_INFO "xentrace: p%d mfn %x offset %u\n",
                    cpu, t_info_mfn_list[offset], offset);
@@ -303,30 +322,124 @@ static int tb_set_size(unsigned int pages)
     return alloc_trace_bufs(pages);
 }
 
-int trace_will_trace_event(u32 event)
+/* Event, CPU and domain filters, common to trace_will_trace_event(). */
+static bool trace_event_enabled(u32 event)
 {
-    if ( !tb_init_done )
-        return 0;
-
-    /*
-     * Copied from __trace_var()
-     */
     if ( (tb_event_mask & event) == 0 )
-        return 0;
+        return false;
 
     /* match class */
     if ( ((tb_event_mask >> TRC_CLS_SHIFT) & (event >> TRC_CLS_SHIFT)) == 0 )
-        return 0;
+        return false;
 
     /* then match subclass */
     if ( (((tb_event_mask >> TRC_SUBCLS_SHIFT) & 0xf )
                 & ((event >> TRC_SUBCLS_SHIFT) & 0xf )) == 0 )
-        return 0;
+        return false;
 
     if ( !cpumask_test_cpu(smp_processor_id(), &tb_cpu_mask) )
-        return 0;
+        return false;
+
+    if ( unlikely(tb_domid != DOMID_INVALID) &&
+         current->domain->domain_id != tb_domid )
+        return false;
+
+    return true;
+}
+
+/*
+ * Sampling isn't accounted for here: callers use this to find out whether to
+ * bother collecting data for an event, and only the event itself should
+ * count towards the sampling policy.
+ */
+int trace_will_trace_event(u32 event)
+{
+    return tb_init_done && trace_event_enabled(event);
+}
+
+/* Apply the sampling policy for @cls, the single class bit of an event. */
+static bool trace_sample(unsigned int cls)
+{
+    unsigned int idx = ffs(cls) - 1;
+    unsigned int period = tb_sampling[idx].period;
+    s_time_t interval = tb_sampling[idx].interval;
+
+    if ( period > 1 )
+    {
+        unsigned int *count = &this_cpu(tb_sample_count)[idx];
+
+        if ( ++*count < period )
+        {
+            perfc_incr(trace_sampled_out);
+            return false;
+        }
+        *count = 0;
+    }
+
+    if ( interval )
+    {
+        s_time_t *tat = &this_cpu(tb_sample_tat)[idx];
+        s_time_t now = NOW(), next = max(*tat, now);
+
+        if ( next - now > tb_sampling[idx].slack )
+        {
+            perfc_incr(trace_rate_limited);
+            return false;
+        }
+        *tat = next + interval;
+    }
+
+    return true;
+}
+
+#define TRC_CLS_BITS(event) \
+    (((event) >> TRC_CLS_SHIFT) & ((1U << TRC_NR_CLASSES) - 1))
+
+void __trace_sample_group_begin(uint32_t event)
+{
+    struct vcpu *curr = current;
+    unsigned int cls = TRC_CLS_BITS(event);
+
+    curr->trace_group_open |= cls;
+    curr->trace_group_decided &= ~cls;
+}
+
+void __trace_sample_group_end(uint32_t event)
+{
+    current->trace_group_open &= ~TRC_CLS_BITS(event);
+}
+
+/*
+ * Apply the sampling policy for @event, of class @cls (a single class bit):
+ * within a group, only the first record is subject to it, and all others
+ * follow its fate.
+ */
+static bool trace_sample_event(uint32_t event, unsigned int cls)
+{
+    struct vcpu *curr = current;
+    bool keep;
 
-    return 1;
+    /* An HVM exit opens a group, which the next entry closes. */
+    if ( event == TRC_HVM_VMEXIT || event == TRC_HVM_VMEXIT64 )
+        __trace_sample_group_begin(event);
+
+    if ( !(curr->trace_group_open & cls) )
+        return trace_sample(cls);
+
+    if ( !(curr->trace_group_decided & cls) )
+    {
+        curr->trace_group_decided |= cls;
+        if ( trace_sample(cls) )
+            curr->trace_group_keep |= cls;
+        else
+            curr->trace_group_keep &= ~cls;
+    }
+    keep = curr->trace_group_keep & cls;
+
+    if ( event == TRC_HVM_VMENTRY )
+        __trace_sample_group_end(event);
+
+    return keep;
 }
 
 /**
@@ -339,7 +452,6 @@ int trace_will_trace_event(u32 event)
 void __init init_trace_bufs(void)
 {
     cpumask_setall(&tb_cpu_mask);
-    register_cpu_notifier(&cpu_nfb);
 
     if ( opt_tbuf_size )
     {
@@ -359,6 +471,56 @@ void __init init_trace_bufs(void)
     }
 }
 
+/* Record the sampling policy of @cls (a single class bit, unshifted). */
+static void trace_sampling_record(unsigned int cls)
+{
+    unsigned int idx = ffs(cls) - 1;
+    struct {
+        uint32_t classes;
+        uint32_t period, rate, burst;
+    } d = {
+        .classes = cls << TRC_CLS_SHIFT,
+        .period = tb_sampling[idx].period,
+        .rate = tb_sampling[idx].rate,
+        .burst = tb_sampling[idx].burst,
+    };
+
+    trace_record(TRC_TRACE_SAMPLING, 1, sizeof(d), &d);
+}
+
+static int tb_set_sampling(const struct xen_sysctl_tbuf_op *tbc)
+{
+    unsigned long classes = (tbc->evt_mask >> TRC_CLS_SHIFT) &
+                            ((1U << TRC_NR_CLASSES) - 1);
+    unsigned int i;
+
+    if ( !classes )
+        return -EINVAL;
+
+    for_each_set_bit ( i, &classes, TRC_NR_CLASSES )
+    {
+        unsigned int bit = 1U << i;
+
+        tb_sampling[i].period = tbc->sample_period;
+        tb_sampling[i].rate = tbc->rate_limit;
+        tb_sampling[i].burst = tbc->rate_burst;
+        tb_sampling[i].interval =
+            tbc->rate_limit ? SECONDS(1) / tbc->rate_limit : 0;
+        tb_sampling[i].slack = tbc->rate_burst > 1
+            ? (tbc->rate_burst - 1) * tb_sampling[i].interval : 0;
+
+        if ( tbc->sample_period > 1 || tb_sampling[i].interval )
+            tb_sampled_classes |= bit;
+        else
+            tb_sampled_classes &= ~bit;
+
+        if ( tb_init_done )
+            trace_sampling_record(bit);
+    }
+
+    return 0;
+}
+
 /**
  * tb_control - sysctl operations on trace buffers.
  * @tbc: a pointer to a struct xen_sysctl_tbuf_op to be filled out
@@ -400,7 +562,20 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
         if ( opt_tbuf_size == 0 )
             rc = -EINVAL;
         else
+        {
+            unsigned int i;
+
             tb_init_done = 1;
+            /* Let the consumer know what sampling is in effect. */
+            for_each_set_bit ( i, &tb_sampled_classes, TRC_NR_CLASSES )
+                trace_sampling_record(1U << i);
+        }
+        break;
+    case XEN_SYSCTL_TBUFOP_set_sampling:
+        rc = tb_set_sampling(tbc);
+        break;
+    case XEN_SYSCTL_TBUFOP_set_domain:
+        tb_domid = tbc->domid;
         break;
     case XEN_SYSCTL_TBUFOP_disable:
     {
@@ -413,14 +588,13 @@ int tb_control(struct xen_sysctl_tbuf_op *tbc)
         tb_init_done = 0;
         smp_wmb();
         /* Clear any lost-record info so we don't get phantom lost records next time we
-         * start tracing.  Grab the lock to make sure we're not racing anyone.  After this
-         * hypercall returns, no more records should be placed into the buffers. */
+         * start tracing.  Wait for writers to finish, so we're not racing anyone.  After
+         * this hypercall returns, no more records should be placed into the buffers. */
         for_each_online_cpu(i)
         {
-            unsigned long flags;
-            spin_lock_irqsave(&per_cpu(t_lock, i), flags);
-            per_cpu(lost_records, i)=0;
-            spin_unlock_irqrestore(&per_cpu(t_lock, i), flags);
+            while ( read_atomic(&per_cpu(t_nest, i)) )
+                cpu_relax();
+            atomic_set(&per_cpu(lost_records, i), 0);
         }
     }
         break;
@@ -457,16 +631,10 @@ static inline bool_t bogus(u32 prod, u32 cons)
     return 0;
 }
 
-static inline u32 calc_unconsumed_bytes(const struct t_buf *buf)
+static inline u32 calc_unconsumed_bytes(u32 prod, u32 cons)
 {
-    u32 prod = buf->prod, cons = buf->cons;
-    s32 x;
-
-    barrier(); /* must read buf->prod and buf->cons only once */
-    if ( bogus(prod, cons) )
-        return data_size;
+    s32 x = prod - cons;
 
-    x = prod - cons;
     if ( x < 0 )
         x += 2*data_size;
 
@@ -476,16 +644,10 @@ static inline u32 calc_unconsumed_bytes(const struct t_buf *buf)
     return x;
 }
 
-static inline u32 calc_bytes_to_wrap(const struct t_buf *buf)
+static inline u32 calc_bytes_to_wrap(u32 prod)
 {
-    u32 prod = buf->prod, cons = buf->cons;
-    s32 x;
+    s32 x = data_size - prod;
 
-    barrier(); /* must read buf->prod and buf->cons only once */
-    if ( bogus(prod, cons) )
-        return 0;
-
-    x = data_size - prod;
     if ( x <= 0 )
         x += data_size;
 
@@ -495,27 +657,15 @@ static inline u32 calc_bytes_to_wrap(const struct t_buf *buf)
     return x;
 }
 
-static inline u32 calc_bytes_avail(const struct t_buf *buf)
+static unsigned char *next_record(uint32_t x, unsigned char **next_page,
+                                  uint32_t *offset_in_page)
 {
-    return data_size - calc_unconsumed_bytes(buf);
-}
-
-static unsigned char *next_record(const struct t_buf *buf, uint32_t *next,
-                                 unsigned char **next_page,
-                                 uint32_t *offset_in_page)
-{
-    u32 x = buf->prod, cons = buf->cons;
     uint16_t per_cpu_mfn_offset;
     uint32_t per_cpu_mfn_nr;
     uint32_t *mfn_list;
     uint32_t mfn;
     unsigned char *this_page;
 
-    barrier(); /* must read buf->prod and buf->cons only once */
-    *next = x;
-    if ( !tb_init_done || bogus(x, cons) )
-        return NULL;
-
     if ( x >= data_size )
         x -= data_size;
 
@@ -544,7 +694,8 @@ static unsigned char *next_record(const struct t_buf *buf, uint32_t *next,
     return this_page;
 }
 
-static inline void __insert_record(struct t_buf *buf,
+/* Write a record at *pos, which must have been reserved, and advance *pos. */
+static inline void __insert_record(uint32_t *pos,
                                    unsigned long event,
                                    unsigned int extra,
                                    bool_t cycles,
@@ -556,16 +707,20 @@ static inline void __insert_record(struct t_buf *buf,
     unsigned char *this_page, *next_page;
     unsigned int extra_word = extra / sizeof(u32);
     unsigned int local_rec_size = calc_rec_size(cycles, extra);
-    uint32_t next;
+    uint32_t next = *pos;
     uint32_t offset;
     uint32_t remaining;
 
     BUG_ON(local_rec_size != rec_size);
     BUG_ON(extra & 3);
 
-    this_page = next_record(buf, &next, &next_page, &offset);
-    if ( !this_page )
-        return;
+    next += rec_size;
+    if ( next >= 2*data_size )
+        next -= 2*data_size;
+    ASSERT(next < 2*data_size);
+
+    this_page = next_record(*pos, &next_page, &offset);
+    *pos = next;
 
     remaining = PAGE_SIZE - offset;
 
@@ -575,8 +730,8 @@ static inline void __insert_record(struct t_buf *buf,
         {
             /* access beyond end of buffer */
             printk(XENLOG_WARNING
-                   "%s: size=%08x prod=%08x cons=%08x rec=%u remaining=%u\n",
-                   __func__, data_size, next, buf->cons, rec_size, remaining);
+                   "%s: size=%08x pos=%08x rec=%u remaining=%u\n",
+                   __func__, data_size, next, rec_size, remaining);
             return;
         }
         rec = &split_rec;
@@ -603,20 +758,11 @@ static inline void __insert_record(struct t_buf *buf,
         memcpy(this_page + offset, rec, remaining);
         memcpy(next_page, (char *)rec + remaining, rec_size - remaining);
     }
-
-    smp_wmb();
-
-    next += rec_size;
-    if ( next >= 2*data_size )
-        next -= 2*data_size;
-    ASSERT(next < 2*data_size);
-    buf->prod = next;
 }
 
-static inline void insert_wrap_record(struct t_buf *buf,
-                                      unsigned int size)
+static inline void insert_wrap_record(uint32_t *pos, unsigned int size)
 {
-    u32 space_left = calc_bytes_to_wrap(buf);
+    u32 space_left = calc_bytes_to_wrap(*pos);
     unsigned int extra_space = space_left - sizeof(u32);
     bool_t cycles = 0;
 
@@ -630,13 +776,14 @@ static inline void insert_wrap_record(struct t_buf *buf,
         ASSERT((extra_space/sizeof(u32)) <= TRACE_EXTRA_MAX);
     }
 
-    __insert_record(buf, TRC_TRACE_WRAP_BUFFER, extra_space, cycles,
+    __insert_record(pos, TRC_TRACE_WRAP_BUFFER, extra_space, cycles,
                     space_left, NULL);
 }
 
 #define LOST_REC_SIZE (4 + 8 + 16) /* header + tsc + sizeof(struct ed) */
 
-static inline void insert_lost_records(struct t_buf *buf)
+static inline void insert_lost_records(uint32_t *pos, unsigned int lost,
+                                       u64 first_tsc)
 {
     struct __packed {
         u32 lost_records;
@@ -646,15 +793,48 @@ static inline void insert_lost_records(struct t_buf *buf)
 
     ed.vid = current->vcpu_id;
     ed.did = current->domain->domain_id;
-    ed.lost_records = this_cpu(lost_records);
-    ed.first_tsc = this_cpu(lost_records_first_tsc);
-
-    this_cpu(lost_records) = 0;
+    ed.lost_records = lost;
+    ed.first_tsc = first_tsc;
 
-    __insert_record(buf, TRC_LOST_RECORDS, sizeof(ed), 1 /* cycles */,
+    __insert_record(pos, TRC_LOST_RECORDS, sizeof(ed), 1 /* cycles */,
                     LOST_REC_SIZE, &ed);
 }
 
+/*
+ * Hand reserved space over to the consumer, once no writer on this CPU is
+ * filling in any part of it anymore.  Writers which interrupted another one
+ * leave this to the interrupted (outermost) one.
+ */
+static void trace_commit(struct t_buf *buf)
+{
+    unsigned int *nest = &this_cpu(t_nest);
+    uint32_t head;
+
+ again:
+    head = read_atomic(&this_cpu(t_head));
+    if ( *nest > 1 )
+    {
+        --*nest;
+        return;
+    }
+
+    smp_wmb(); /* Records must be visible before the producer index. */
+    write_atomic(&buf->prod, head);
+    barrier();
+    *nest = 0;
+    barrier();
+
+    /*
+     * An interrupt arriving after we read t_head, but before we cleared
+     * t_nest, may have reserved (and filled) space without publishing it.
+     */
+    if ( unlikely(read_atomic(&this_cpu(t_head)) != head) )
+    {
+        *nest = 1;
+        goto again;
+    }
+}
+
 /*
  * Notification is performed in qtasklet to avoid deadlocks with contexts
  * which __trace_var() may be called from (e.g., scheduler critical regions).
@@ -663,8 +843,8 @@ static void cf_check trace_notify_dom0(void *unused)
 {
     send_global_virq(VIRQ_TBUF);
 }
-static DECLARE_SOFTIRQ_TASKLET(trace_notify_dom0_tasklet,
-                               trace_notify_dom0, NULL);
+static _DECLARE_TASKLET(trace_notify_dom0_tasklet, trace_notify_dom0, NULL,
+                        1, TASKLET_PRIO_LOW);
 
 /**
  * __trace_var - Enters a trace tuple into the trace buffer for the current CPU.
@@ -673,16 +853,15 @@ static DECLARE_SOFTIRQ_TASKLET(trace_notify_dom0_tasklet,
  * @extra: size of additional trace data in bytes
  * @extra_data: pointer to additional trace data
  *
- * Logs a trace record into the appropriate buffer.
+ * Logs a trace record into the appropriate buffer.  Safe to be called from any
+ * context, including interrupt handlers interrupting another invocation.
+ * Records from such nested invocations may end up in the buffer ahead of the
+ * one they interrupted, i.e. with timestamps slightly out of order.
  */
 void __trace_var(u32 event, bool_t cycles, unsigned int extra,
                  const void *extra_data)
 {
-    struct t_buf *buf;
-    unsigned long flags;
-    u32 bytes_to_tail, bytes_to_wrap;
-    unsigned int rec_size, total_size;
-    bool_t started_below_highwater;
+    unsigned int cls;
 
     if( !tb_init_done )
         return;
@@ -698,114 +877,117 @@ void __trace_var(u32 event, bool_t cycles, unsigned int extra,
                            "Trace event %#x bad size %u, discarding\n",
                            event, extra);
 
-    if ( (tb_event_mask & event) == 0 )
+    if ( !trace_event_enabled(event) )
         return;
 
-    /* match class */
-    if ( ((tb_event_mask >> TRC_CLS_SHIFT) & (event >> TRC_CLS_SHIFT)) == 0 )
+    cls = (event >> TRC_CLS_SHIFT) & tb_sampled_classes;
+    if ( unlikely(cls) && !trace_sample_event(event, cls) )
         return;
 
-    /* then match subclass */
-    if ( (((tb_event_mask >> TRC_SUBCLS_SHIFT) & 0xf )
-                & ((event >> TRC_SUBCLS_SHIFT) & 0xf )) == 0 )
-        return;
-
-    if ( !cpumask_test_cpu(smp_processor_id(), &tb_cpu_mask) )
-        return;
+    trace_record(event, cycles, extra, extra_data);
+}
 
-    spin_lock_irqsave(&this_cpu(t_lock), flags);
+/* Write a record to the current CPU's buffer, regardless of any filters. */
+static void trace_record(u32 event, bool_t cycles, unsigned int extra,
+                         const void *extra_data)
+{
+    struct t_buf *buf;
+    u32 head, next = 0, cons, bytes_to_wrap;
+    unsigned int rec_size, total_size, lost;
+    u64 lost_tsc;
+    bool_t started_below_highwater = 0;
 
     buf = this_cpu(t_bufs);
-
     if ( unlikely(!buf) )
-    {
-        /* Make gcc happy */
-        started_below_highwater = 0;
-        goto unlock;
-    }
-
-    started_below_highwater = (calc_unconsumed_bytes(buf) < t_buf_highwater);
+        return;
 
     /* Calculate the record size */
     rec_size = calc_rec_size(cycles, extra);
 
-    /* How many bytes are available in the buffer? */
-    bytes_to_tail = calc_bytes_avail(buf);
-
-    /* How many bytes until the next wrap-around? */
-    bytes_to_wrap = calc_bytes_to_wrap(buf);
-
     /*
-     * Calculate expected total size to commit this record by
-     * doing a dry-run.
+     * Claim lost records up front, so that only one writer reports them.
+     * Avoid the locked access in the common case of there being none.
      */
-    total_size = 0;
+    lost = atomic_read(&this_cpu(lost_records))
+           ? atomic_xchg(&this_cpu(lost_records), 0) : 0;
+    lost_tsc = this_cpu(lost_records_first_tsc);
 
-    /* First, check to see if we need to include a lost_record.
-     */
-    if ( this_cpu(lost_records) )
-    {
-        if ( LOST_REC_SIZE > bytes_to_wrap )
+    this_cpu(t_nest)++;
+    barrier();
+
+    /* Reserve space for everything to be written. */
+    do {
+        head = read_atomic(&this_cpu(t_head));
+        cons = ACCESS_ONCE(buf->cons);
+        if ( bogus(head, cons) )
+            goto commit;
+
+        bytes_to_wrap = calc_bytes_to_wrap(head);
+        total_size = 0;
+
+        /* First, check to see if we need to include a lost_record. */
+        if ( lost )
         {
-            total_size += bytes_to_wrap;
-            bytes_to_wrap = data_size;
+            if ( LOST_REC_SIZE > bytes_to_wrap )
+            {
+                total_size += bytes_to_wrap;
+                bytes_to_wrap = data_size;
+            }
+            total_size += LOST_REC_SIZE;
+            bytes_to_wrap -= LOST_REC_SIZE;
+
+            /* LOST_REC might line up perfectly with the buffer wrap */
+            if ( bytes_to_wrap == 0 )
+                bytes_to_wrap = data_size;
         }
-        total_size += LOST_REC_SIZE;
-        bytes_to_wrap -= LOST_REC_SIZE;
 
-        /* LOST_REC might line up perfectly with the buffer wrap */
-        if ( bytes_to_wrap == 0 )
-            bytes_to_wrap = data_size;
-    }
+        if ( rec_size > bytes_to_wrap )
+            total_size += bytes_to_wrap;
+        total_size += rec_size;
 
-    if ( rec_size > bytes_to_wrap )
-    {
-        total_size += bytes_to_wrap;
-    }
-    total_size += rec_size;
+        /* Do we have enough space for everything? */
+        if ( total_size > data_size - calc_unconsumed_bytes(head, cons) )
+        {
+            /* Hand back the lost records claimed, plus this one. */
+            if ( atomic_add_return(lost + 1, &this_cpu(lost_records)) ==
+                 lost + 1 )
+                this_cpu(lost_records_first_tsc) =
+                    lost ? lost_tsc : (u64)get_cycles();
+            goto commit;
+        }
 
-    /* Do we have enough space for everything? */
-    if ( total_size > bytes_to_tail )
-    {
-        if ( ++this_cpu(lost_records) == 1 )
-            this_cpu(lost_records_first_tsc)=(u64)get_cycles();
-        started_below_highwater = 0;
-        goto unlock;
-    }
+        next = head + total_size;
+        if ( next >= 2*data_size )
+            next -= 2*data_size;
+    } while ( cmpxchg(&this_cpu(t_head), head, next) != head );
+
+    started_below_highwater =
+        calc_unconsumed_bytes(head, cons) < t_buf_highwater;
 
     /*
      * Now, actually write information
      */
-    bytes_to_wrap = calc_bytes_to_wrap(buf);
-
-    if ( this_cpu(lost_records) )
+    if ( lost )
     {
-        if ( LOST_REC_SIZE > bytes_to_wrap )
-        {
-            insert_wrap_record(buf, LOST_REC_SIZE);
-            bytes_to_wrap = data_size;
-        }
-        insert_lost_records(buf);
-        bytes_to_wrap -= LOST_REC_SIZE;
-
-        /* LOST_REC might line up perfectly with the buffer wrap */
-        if ( bytes_to_wrap == 0 )
-            bytes_to_wrap = data_size;
+        if ( LOST_REC_SIZE > calc_bytes_to_wrap(head) )
+            insert_wrap_record(&head, LOST_REC_SIZE);
+        insert_lost_records(&head, lost, lost_tsc);
     }
 
-    if ( rec_size > bytes_to_wrap )
-        insert_wrap_record(buf, rec_size);
+    if ( rec_size > calc_bytes_to_wrap(head) )
+        insert_wrap_record(&head, rec_size);
 
     /* Write the original record */
-    __insert_record(buf, event, extra, cycles, rec_size, extra_data);
+    __insert_record(&head, event, extra, cycles, rec_size, extra_data);
+
+    ASSERT(head == next);
 
-unlock:
-    spin_unlock_irqrestore(&this_cpu(t_lock), flags);
+ commit:
+    trace_commit(buf);
 
     /* Notify trace buffer consumer that we've crossed the high water mark. */
-    if ( likely(buf!=NULL)
-         && started_below_highwater
-         && (calc_unconsumed_bytes(buf) >= t_buf_highwater) )
+    if ( started_below_highwater &&
+         calc_unconsumed_bytes(next, cons) >= t_buf_highwater )
         tasklet_schedule(&trace_notify_dom0_tasklet);
 }
 
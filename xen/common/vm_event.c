@@ -21,7 +21,9 @@
 
 
 #include <xen/sched.h>
+#include <xen/domain_page.h>
 #include <xen/event.h>
+#include <xen/vmap.h>
 #include <xen/wait.h>
 #include <xen/vm_event.h>
 #include <xen/mem_access.h>
@@ -41,6 +43,78 @@
 #define xen_rmb()  smp_rmb()
 #define xen_wmb()  smp_wmb()
 
+/*
+ * Protects the domain's vm_event_domain pointers against going away under
+ * vm_event_acquire_resource().  Nests outside of vm_event_domain's lock.
+ */
+static DEFINE_SPINLOCK(vm_event_resource_lock);
+
+/* Allocate (and map) a ring of nr_frames pages owned by, but hidden from d. */
+static int vm_event_alloc_ring(struct domain *d, struct vm_event_domain *ved,
+                               unsigned int nr_frames)
+{
+    unsigned int i;
+
+    ved->ring_mfns = xzalloc_array(mfn_t, nr_frames);
+    if ( !ved->ring_mfns )
+        return -ENOMEM;
+
+    for ( i = 0; i < nr_frames; i++ )
+    {
+        struct page_info *page = alloc_domheap_page(d, MEMF_no_refcount);
+
+        if ( !page )
+            return -ENOMEM;
+
+        if ( !get_page_and_type(page, d, PGT_writable_page) )
+        {
+            /*
+             * The domain can't possibly know about this page yet, so it
+             * would have to be on its way out.
+             */
+            put_page_alloc_ref(page);
+            return -ENODATA;
+        }
+
+        ved->ring_mfns[ved->ring_frames++] = page_to_mfn(page);
+        clear_domain_page(page_to_mfn(page));
+    }
+
+    ved->ring_page = vmap(ved->ring_mfns, nr_frames);
+    if ( !ved->ring_page )
+        return -ENOMEM;
+
+    SHARED_RING_INIT((vm_event_sring_t *)ved->ring_page);
+
+    return 0;
+}
+
+static void vm_event_free_ring(struct vm_event_domain *ved)
+{
+    unsigned int i;
+
+    if ( !ved->ring_mfns )
+    {
+        destroy_ring_for_helper(&ved->ring_page, ved->ring_pg_struct);
+        return;
+    }
+
+    if ( ved->ring_page )
+        vunmap(ved->ring_page);
+    ved->ring_page = NULL;
+
+    for ( i = 0; i < ved->ring_frames; i++ )
+    {
+        struct page_info *page = mfn_to_page(ved->ring_mfns[i]);
+
+        put_page_alloc_ref(page);
+        put_page_and_type(page);
+    }
+
+    ved->ring_frames = 0;
+    XFREE(ved->ring_mfns);
+}
+
 static int vm_event_enable(
     struct domain *d,
     struct xen_domctl_vm_event_op *vec,
@@ -51,6 +125,7 @@ static int vm_event_enable(
 {
     int rc;
     unsigned long ring_gfn = d->arch.hvm.params[param];
+    unsigned int nr_frames = 0;
     struct vm_event_domain *ved;
 
     /*
@@ -60,8 +135,14 @@ static int vm_event_enable(
     if ( *p_ved != NULL )
         return -EBUSY;
 
+    if ( vec->op == XEN_VM_EVENT_ENABLE_FRAMES )
+    {
+        nr_frames = vec->u.enable.nr_frames;
+        if ( !nr_frames || nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+            return -EINVAL;
+    }
     /* No chosen ring GFN?  Nothing we can do. */
-    if ( ring_gfn == 0 )
+    else if ( ring_gfn == 0 )
         return -EOPNOTSUPP;
 
     ved = xzalloc(struct vm_event_domain);
@@ -77,14 +158,17 @@ static int vm_event_enable(
     if ( rc < 0 )
         goto err;
 
-    rc = prepare_ring_for_helper(d, ring_gfn, &ved->ring_pg_struct,
-                                 &ved->ring_page);
+    if ( nr_frames )
+        rc = vm_event_alloc_ring(d, ved, nr_frames);
+    else
+        rc = prepare_ring_for_helper(d, ring_gfn, &ved->ring_pg_struct,
+                                     &ved->ring_page);
     if ( rc < 0 )
         goto err;
 
     FRONT_RING_INIT(&ved->front_ring,
                     (vm_event_sring_t *)ved->ring_page,
-                    PAGE_SIZE);
+                    (nr_frames ?: 1) * PAGE_SIZE);
 
     rc = alloc_unbound_xen_event_channel(d, 0, current->domain->domain_id,
                                          notification_fn);
@@ -94,12 +178,14 @@ static int vm_event_enable(
     ved->xen_port = vec->u.enable.port = rc;
 
     /* Success.  Fill in the domain's appropriate ved. */
+    spin_lock(&vm_event_resource_lock);
     *p_ved = ved;
+    spin_unlock(&vm_event_resource_lock);
 
     return 0;
 
  err:
-    destroy_ring_for_helper(&ved->ring_page, ved->ring_pg_struct);
+    vm_event_free_ring(ved);
     xfree(ved);
 
     return rc;
@@ -210,15 +296,18 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain **p_ved)
             }
         }
 
-        destroy_ring_for_helper(&ved->ring_page, ved->ring_pg_struct);
+        vm_event_free_ring(ved);
 
         vm_event_cleanup_domain(d);
 
         spin_unlock(&ved->lock);
     }
 
-    xfree(ved);
+    spin_lock(&vm_event_resource_lock);
     *p_ved = NULL;
+    spin_unlock(&vm_event_resource_lock);
+
+    xfree(ved);
 
     return 0;
 }
@@ -311,39 +400,49 @@ void vm_event_put_request(struct domain *d,
     notify_via_xen_event_channel(d, ved->xen_port);
 }
 
-static int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
-                                 vm_event_response_t *rsp)
+/*
+ * Responses pulled off the ring under a single acquisition of the lock, and
+ * with a single wakeup of the producers waiting for space.  Bounded by the
+ * stack space the copies take.
+ */
+#define VM_EVENT_RESUME_BATCH 4
+
+static unsigned int vm_event_get_responses(struct domain *d,
+                                           struct vm_event_domain *ved,
+                                           vm_event_response_t *rsp,
+                                           unsigned int nr)
 {
     vm_event_front_ring_t *front_ring;
     RING_IDX rsp_cons;
-    int rc = 0;
+    unsigned int done = 0;
 
     spin_lock(&ved->lock);
 
     front_ring = &ved->front_ring;
     rsp_cons = front_ring->rsp_cons;
 
-    if ( !RING_HAS_UNCONSUMED_RESPONSES(front_ring) )
-        goto out;
+    /* Copy responses */
+    for ( ; done < nr && RING_HAS_UNCONSUMED_RESPONSES(front_ring); done++ )
+    {
+        memcpy(&rsp[done], RING_GET_RESPONSE(front_ring, rsp_cons),
+               sizeof(*rsp));
+        front_ring->rsp_cons = ++rsp_cons;
+    }
 
-    /* Copy response */
-    memcpy(rsp, RING_GET_RESPONSE(front_ring, rsp_cons), sizeof(*rsp));
-    rsp_cons++;
+    if ( !done )
+        goto out;
 
     /* Update ring */
-    front_ring->rsp_cons = rsp_cons;
     front_ring->sring->rsp_event = rsp_cons + 1;
 
-    /* Kick any waiters -- since we've just consumed an event,
+    /* Kick any waiters -- since we've just consumed events,
      * there may be additional space available in the ring. */
     vm_event_wake(d, ved);
 
-    rc = 1;
-
  out:
     spin_unlock(&ved->lock);
 
-    return rc;
+    return done;
 }
 
 /*
@@ -356,7 +455,8 @@ static int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
  */
 static int vm_event_resume(struct domain *d, struct vm_event_domain *ved)
 {
-    vm_event_response_t rsp;
+    vm_event_response_t batch[VM_EVENT_RESUME_BATCH];
+    unsigned int i = 0, nr = 0;
 
     /*
      * vm_event_resume() runs in either XEN_DOMCTL_VM_EVENT_OP_*, or
@@ -372,18 +472,28 @@ static int vm_event_resume(struct domain *d, struct vm_event_domain *ved)
          return -ENODEV;
 
     /* Pull all responses off the ring. */
-    while ( vm_event_get_response(d, ved, &rsp) )
+    for ( ; ; i++ )
     {
+        vm_event_response_t *rsp;
         struct vcpu *v;
 
-        if ( rsp.version != VM_EVENT_INTERFACE_VERSION )
+        if ( i == nr )
+        {
+            nr = vm_event_get_responses(d, ved, batch, ARRAY_SIZE(batch));
+            if ( !nr )
+                break;
+            i = 0;
+        }
+        rsp = &batch[i];
+
+        if ( rsp->version != VM_EVENT_INTERFACE_VERSION )
         {
             printk(XENLOG_G_WARNING "vm_event interface version mismatch\n");
             continue;
         }
 
         /* Validate the vcpu_id in the response. */
-        v = domain_vcpu(d, rsp.vcpu_id);
+        v = domain_vcpu(d, rsp->vcpu_id);
         if ( !v )
             continue;
 
@@ -396,14 +506,14 @@ static int vm_event_resume(struct domain *d, struct vm_event_domain *ved)
         if ( atomic_read(&v->vm_event_pause_count) )
         {
 #ifdef CONFIG_MEM_PAGING
-            if ( rsp.reason == VM_EVENT_REASON_MEM_PAGING )
-                p2m_mem_paging_resume(d, &rsp);
+            if ( rsp->reason == VM_EVENT_REASON_MEM_PAGING )
+                p2m_mem_paging_resume(d, rsp);
 #endif
 #ifdef CONFIG_MEM_SHARING
             if ( mem_sharing_is_fork(d) )
             {
-                bool reset_state = rsp.flags & VM_EVENT_FLAG_RESET_FORK_STATE;
-                bool reset_mem = rsp.flags & VM_EVENT_FLAG_RESET_FORK_MEMORY;
+                bool reset_state = rsp->flags & VM_EVENT_FLAG_RESET_FORK_STATE;
+                bool reset_mem = rsp->flags & VM_EVENT_FLAG_RESET_FORK_MEMORY;
 
                 if ( (reset_state || reset_mem) &&
                      mem_sharing_fork_reset(d, reset_state, reset_mem) )
@@ -416,34 +526,34 @@ static int vm_event_resume(struct domain *d, struct vm_event_domain *ved)
              * has to set arch-specific flags when supported, and to avoid
              * bitmask overhead when it isn't supported.
              */
-            vm_event_emulate_check(v, &rsp);
+            vm_event_emulate_check(v, rsp);
 
             /*
              * Check in arch-specific handler to avoid bitmask overhead when
              * not supported.
              */
-            vm_event_register_write_resume(v, &rsp);
+            vm_event_register_write_resume(v, rsp);
 
             /*
              * Check in arch-specific handler to avoid bitmask overhead when
              * not supported.
              */
-            vm_event_toggle_singlestep(d, v, &rsp);
+            vm_event_toggle_singlestep(d, v, rsp);
 
             /* Check for altp2m switch */
-            if ( rsp.flags & VM_EVENT_FLAG_ALTERNATE_P2M )
-                p2m_altp2m_check(v, rsp.altp2m_idx);
+            if ( rsp->flags & VM_EVENT_FLAG_ALTERNATE_P2M )
+                p2m_altp2m_check(v, rsp->altp2m_idx);
 
-            if ( rsp.flags & VM_EVENT_FLAG_SET_REGISTERS )
-                vm_event_set_registers(v, &rsp);
+            if ( rsp->flags & VM_EVENT_FLAG_SET_REGISTERS )
+                vm_event_set_registers(v, rsp);
 
-            if ( rsp.flags & VM_EVENT_FLAG_GET_NEXT_INTERRUPT )
+            if ( rsp->flags & VM_EVENT_FLAG_GET_NEXT_INTERRUPT )
                 vm_event_monitor_next_interrupt(v);
 
-            if ( rsp.flags & VM_EVENT_FLAG_RESET_VMTRACE )
+            if ( rsp->flags & VM_EVENT_FLAG_RESET_VMTRACE )
                 vm_event_reset_vmtrace(v);
 
-            if ( rsp.flags & VM_EVENT_FLAG_VCPU_PAUSED )
+            if ( rsp->flags & VM_EVENT_FLAG_VCPU_PAUSED )
                 vm_event_vcpu_unpause(v);
         }
     }
@@ -637,6 +747,7 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec)
         switch( vec->op )
         {
         case XEN_VM_EVENT_ENABLE:
+        case XEN_VM_EVENT_ENABLE_FRAMES:
         {
             rc = -EOPNOTSUPP;
             /* hvm fixme: p2m_is_foreign types need addressing */
@@ -693,6 +804,7 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec)
         switch( vec->op )
         {
         case XEN_VM_EVENT_ENABLE:
+        case XEN_VM_EVENT_ENABLE_FRAMES:
             /* domain_pause() not required here, see XSA-99 */
             rc = arch_monitor_init_domain(d);
             if ( rc )
@@ -731,6 +843,7 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec)
         switch( vec->op )
         {
         case XEN_VM_EVENT_ENABLE:
+        case XEN_VM_EVENT_ENABLE_FRAMES:
             rc = -EOPNOTSUPP;
             /* hvm fixme: p2m_is_foreign types need addressing */
             if ( is_hvm_domain(hardware_domain) )
@@ -775,6 +888,78 @@ int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec)
     return rc;
 }
 
+static struct vm_event_domain **vm_event_ring_of(struct domain *d,
+                                                 unsigned int mode)
+{
+    switch ( mode )
+    {
+#ifdef CONFIG_MEM_PAGING
+    case XEN_DOMCTL_VM_EVENT_OP_PAGING:
+        return &d->vm_event_paging;
+#endif
+
+    case XEN_DOMCTL_VM_EVENT_OP_MONITOR:
+        return &d->vm_event_monitor;
+
+#ifdef CONFIG_MEM_SHARING
+    case XEN_DOMCTL_VM_EVENT_OP_SHARING:
+        return &d->vm_event_share;
+#endif
+    }
+
+    return NULL;
+}
+
+unsigned int vm_event_resource_max_frames(struct domain *d, unsigned int id)
+{
+    struct vm_event_domain **p_ved = vm_event_ring_of(d, id);
+    unsigned int nr = 0;
+
+    if ( !p_ved )
+        return 0;
+
+    spin_lock(&vm_event_resource_lock);
+    if ( *p_ved )
+        nr = (*p_ved)->ring_frames;
+    spin_unlock(&vm_event_resource_lock);
+
+    return nr;
+}
+
+int vm_event_acquire_resource(struct domain *d, unsigned int id,
+                              unsigned int frame, unsigned int nr_frames,
+                              xen_pfn_t mfn_list[])
+{
+    struct vm_event_domain **p_ved = vm_event_ring_of(d, id), *ved;
+    unsigned int i;
+    int rc = -EINVAL;
+
+    if ( !p_ved )
+        return -EINVAL;
+
+    spin_lock(&vm_event_resource_lock);
+
+    ved = *p_ved;
+    if ( ved )
+    {
+        spin_lock(&ved->lock);
+
+        if ( frame + nr_frames <= ved->ring_frames )
+        {
+            for ( i = 0; i < nr_frames; i++ )
+                mfn_list[i] = mfn_x(ved->ring_mfns[frame + i]);
+
+            rc = nr_frames;
+        }
+
+        spin_unlock(&ved->lock);
+    }
+
+    spin_unlock(&vm_event_resource_lock);
+
+    return rc;
+}
+
 void vm_event_vcpu_pause(struct vcpu *v)
 {
     ASSERT(v == current);
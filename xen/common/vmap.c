@@ -1,15 +1,21 @@
 #ifdef VMAP_VIRT_START
 #include <xen/bitmap.h>
 #include <xen/cache.h>
+#include <xen/cpu.h>
 #include <xen/init.h>
 #include <xen/mm.h>
+#include <xen/param.h>
+#include <xen/percpu.h>
 #include <xen/pfn.h>
 #include <xen/spinlock.h>
 #include <xen/types.h>
 #include <xen/vmap.h>
 #include <asm/page.h>
 
-static DEFINE_SPINLOCK(vm_lock);
+/* Each region's bitmap has its own lock. */
+static spinlock_t vm_lock[VMAP_REGION_NR] = {
+    [0 ... VMAP_REGION_NR - 1] = SPIN_LOCK_UNLOCKED,
+};
 static void *__read_mostly vm_base[VMAP_REGION_NR];
 #define vm_bitmap(x) ((unsigned long *)vm_base[x])
 /* highest allocated bit in the bitmap */
@@ -59,7 +65,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
     if ( !vm_base[t] )
         return NULL;
 
-    spin_lock(&vm_lock);
+    spin_lock(&vm_lock[t]);
     for ( ; ; )
     {
         struct page_info *pg;
@@ -92,7 +98,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
         if ( start < vm_top[t] )
             break;
 
-        spin_unlock(&vm_lock);
+        spin_unlock(&vm_lock[t]);
 
         if ( vm_top[t] >= vm_end[t] )
             return NULL;
@@ -101,7 +107,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
         if ( !pg )
             return NULL;
 
-        spin_lock(&vm_lock);
+        spin_lock(&vm_lock[t]);
 
         if ( start >= vm_top[t] )
         {
@@ -121,7 +127,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
 
         if ( start >= vm_top[t] )
         {
-            spin_unlock(&vm_lock);
+            spin_unlock(&vm_lock[t]);
             return NULL;
         }
     }
@@ -134,7 +140,7 @@ static void *vm_alloc(unsigned int nr, unsigned int align,
         ASSERT(bit == vm_top[t]);
     if ( start <= vm_low[t] + 2 )
         vm_low[t] = bit;
-    spin_unlock(&vm_lock);
+    spin_unlock(&vm_lock[t]);
 
     return vm_base[t] + start * PAGE_SIZE;
 }
@@ -169,16 +175,16 @@ static unsigned int vm_size(const void *va, enum vmap_region type)
     return min(end, vm_top[type]) - start;
 }
 
-static void vm_free(const void *va)
+static enum vmap_region vm_type(const void *va)
+{
+    return vm_index(va, VMAP_DEFAULT) ? VMAP_DEFAULT : VMAP_XEN;
+}
+
+static void vm_free_locked(const void *va, enum vmap_region type)
 {
-    enum vmap_region type = VMAP_DEFAULT;
     unsigned int bit = vm_index(va, type);
 
-    if ( !bit )
-    {
-        type = VMAP_XEN;
-        bit = vm_index(va, type);
-    }
+    ASSERT(spin_is_locked(&vm_lock[type]));
 
     if ( !bit )
     {
@@ -186,7 +192,6 @@ static void vm_free(const void *va)
         return;
     }
 
-    spin_lock(&vm_lock);
     if ( bit < vm_low[type] )
     {
         vm_low[type] = bit - 1;
@@ -196,15 +201,223 @@ static void vm_free(const void *va)
     while ( __test_and_clear_bit(bit, vm_bitmap(type)) )
         if ( ++bit == vm_top[type] )
             break;
-    spin_unlock(&vm_lock);
 }
 
+static void vm_free(const void *va)
+{
+    enum vmap_region type = vm_type(va);
+
+    spin_lock(&vm_lock[type]);
+    vm_free_locked(va, type);
+    spin_unlock(&vm_lock[type]);
+}
+
+#ifdef MAP_NO_FLUSH
+/*
+ * Lazy purging of unmapped areas.
+ *
+ * Tearing down a mapping otherwise costs a TLB flush on all CPUs for every
+ * page.  Instead vunmap_lazy() only clears the PTEs and queues the area on
+ * the local CPU, keeping its address space allocated.  Once enough areas (or
+ * pages) are queued, a single flush of all TLBs is done, after which all
+ * queued areas are handed back to the bitmap allocator, with one acquisition
+ * of the region locks.  The address space can't be reused before the flush,
+ * so no CPU can access a new mapping through a stale TLB entry.
+ *
+ * Stale entries do however keep pointing at the frames which were mapped
+ * until the purge, so this is only suitable for callers which don't free or
+ * reuse these frames right away (e.g. MMIO).  vunmap() remains synchronous.
+ */
+#define VM_LAZY_AREAS   32
+#define VM_LAZY_PAGES   512
+
+struct vm_lazy {
+    spinlock_t lock;
+    unsigned int nr;
+    unsigned int pages;
+    const void *va[VM_LAZY_AREAS];
+};
+
+static DEFINE_PER_CPU(struct vm_lazy, vm_lazy);
+
+static bool __read_mostly opt_vmap_lazy = true;
+boolean_param("vmap-lazy-purge", opt_vmap_lazy);
+static bool __read_mostly vm_lazy_enabled;
+
+static void vm_flush_all(void)
+{
+    flush_all(FLUSH_TLB_GLOBAL);
+}
+
+/* Free the areas queued on cpu, which must have been flushed already. */
+static void vm_lazy_free(unsigned int cpu)
+{
+    struct vm_lazy *lazy = &per_cpu(vm_lazy, cpu);
+    enum vmap_region type;
+    unsigned int i;
+
+    ASSERT(spin_is_locked(&lazy->lock));
+
+    for ( type = VMAP_DEFAULT; type < VMAP_REGION_NR; type++ )
+    {
+        bool locked = false;
+
+        for ( i = 0; i < lazy->nr; i++ )
+        {
+            if ( !lazy->va[i] || vm_type(lazy->va[i]) != type )
+                continue;
+
+            if ( !locked )
+            {
+                spin_lock(&vm_lock[type]);
+                locked = true;
+            }
+            vm_free_locked(lazy->va[i], type);
+            lazy->va[i] = NULL;
+        }
+
+        if ( locked )
+            spin_unlock(&vm_lock[type]);
+    }
+
+    lazy->nr = 0;
+    lazy->pages = 0;
+}
+
+static void vm_lazy_purge(unsigned int cpu)
+{
+    struct vm_lazy *lazy = &per_cpu(vm_lazy, cpu);
+
+    spin_lock(&lazy->lock);
+    if ( lazy->nr )
+    {
+        vm_flush_all();
+        vm_lazy_free(cpu);
+    }
+    spin_unlock(&lazy->lock);
+}
+
+/* Purge the queues of all CPUs, with a single flush.  */
+static bool vm_lazy_purge_all(void)
+{
+    unsigned int cpu;
+    bool flushed = false;
+
+    if ( !vm_lazy_enabled )
+        return false;
+
+    /* Queues of CPUs going away are purged by vm_lazy_cpu_callback(). */
+    if ( !get_cpu_maps() )
+        return false;
+
+    for_each_online_cpu ( cpu )
+    {
+        struct vm_lazy *lazy = &per_cpu(vm_lazy, cpu);
+
+        spin_lock(&lazy->lock);
+        if ( lazy->nr )
+        {
+            if ( !flushed )
+                vm_flush_all();
+            flushed = true;
+            vm_lazy_free(cpu);
+        }
+        spin_unlock(&lazy->lock);
+    }
+
+    put_cpu_maps();
+
+    return flushed;
+}
+
+static bool vm_lazy_unmap(const void *va, unsigned int pages)
+{
+    unsigned int cpu = smp_processor_id();
+    struct vm_lazy *lazy = &per_cpu(vm_lazy, cpu);
+
+    if ( !vm_lazy_enabled )
+        return false;
+
+    map_pages_to_xen((unsigned long)va, INVALID_MFN, pages,
+                     _PAGE_NONE | MAP_NO_FLUSH);
+
+    spin_lock(&lazy->lock);
+    if ( lazy->nr == VM_LAZY_AREAS )
+    {
+        vm_flush_all();
+        vm_lazy_free(cpu);
+    }
+    lazy->va[lazy->nr++] = va;
+    lazy->pages += pages;
+    if ( lazy->pages >= VM_LAZY_PAGES )
+    {
+        vm_flush_all();
+        vm_lazy_free(cpu);
+    }
+    spin_unlock(&lazy->lock);
+
+    return true;
+}
+
+static int cf_check vm_lazy_cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu;
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        spin_lock_init(&per_cpu(vm_lazy, cpu).lock);
+        break;
+
+    case CPU_DEAD:
+        vm_lazy_purge(cpu);
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block vm_lazy_cpu_nfb = {
+    .notifier_call = vm_lazy_cpu_callback
+};
+
+static int __init cf_check vm_lazy_init(void)
+{
+    if ( !opt_vmap_lazy )
+        return 0;
+
+    spin_lock_init(&this_cpu(vm_lazy).lock);
+    register_cpu_notifier(&vm_lazy_cpu_nfb);
+    vm_lazy_enabled = true;
+
+    return 0;
+}
+presmp_initcall(vm_lazy_init);
+#else /* !MAP_NO_FLUSH */
+static bool vm_lazy_purge_all(void)
+{
+    return false;
+}
+
+static bool vm_lazy_unmap(const void *va, unsigned int pages)
+{
+    return false;
+}
+#endif /* MAP_NO_FLUSH */
+
 void *__vmap(const mfn_t *mfn, unsigned int granularity,
              unsigned int nr, unsigned int align, unsigned int flags,
              enum vmap_region type)
 {
     void *va = vm_alloc(nr * granularity, align, type);
-    unsigned long cur = (unsigned long)va;
+    unsigned long cur;
+
+    /* Reclaim lazily unmapped areas if the region is exhausted. */
+    if ( !va && vm_lazy_purge_all() )
+        va = vm_alloc(nr * granularity, align, type);
+
+    cur = (unsigned long)va;
 
     for ( ; va && nr--; ++mfn, cur += PAGE_SIZE * granularity )
     {
@@ -223,7 +436,7 @@ void *vmap(const mfn_t *mfn, unsigned int nr)
     return __vmap(mfn, 1, nr, 1, PAGE_HYPERVISOR, VMAP_DEFAULT);
 }
 
-void vunmap(const void *va)
+static void vm_unmap(const void *va, bool lazy)
 {
     unsigned long addr = (unsigned long)va;
     unsigned int pages = vm_size(va, VMAP_DEFAULT);
@@ -231,14 +444,31 @@ void vunmap(const void *va)
     if ( !pages )
         pages = vm_size(va, VMAP_XEN);
 
+    if ( lazy && vm_lazy_unmap(va, pages) )
+        return;
+
 #ifndef _PAGE_NONE
     destroy_xen_mappings(addr, addr + PAGE_SIZE * pages);
+#elif defined(MAP_NO_FLUSH)
+    /* Avoid tearing down intermediate page tables, and flush just once. */
+    map_pages_to_xen(addr, INVALID_MFN, pages, _PAGE_NONE | MAP_NO_FLUSH);
+    vm_flush_all();
 #else /* Avoid tearing down intermediate page tables. */
     map_pages_to_xen(addr, INVALID_MFN, pages, _PAGE_NONE);
 #endif
     vm_free(va);
 }
 
+void vunmap(const void *va)
+{
+    vm_unmap(va, false);
+}
+
+void vunmap_lazy(const void *va)
+{
+    vm_unmap(va, true);
+}
+
 static void *vmalloc_type(size_t size, enum vmap_region type)
 {
     mfn_t *mfn;
@@ -326,7 +556,9 @@ void vfree(void *va)
         ASSERT(page);
         page_list_add(page, &pg_list);
     }
-    vunmap(va);
+
+    /* The pages must not be reachable through stale TLB entries once freed. */
+    vm_unmap(va, false);
 
     while ( (pg = page_list_remove_head(&pg_list)) != NULL )
         free_domheap_page(pg);
@@ -34,6 +34,7 @@ struct waitqueue_vcpu {
      */
     void *esp;
     char *stack;
+    bool resumed;
 #endif
 };
 
@@ -90,21 +91,55 @@ void destroy_waitqueue_head(struct waitqueue_head *wq)
     wake_up_all(wq);
 }
 
+/*
+ * Waiters are taken off the queue VCPU_WAKE_BATCH at a time, and unpaused
+ * outside of the queue's lock.  Those whose pause count drops to zero are
+ * woken together through vcpu_wake_batch(), taking each scheduler lock
+ * once per batch rather than once per vCPU.  The references taken in
+ * prepare_to_wait() are only dropped once the vCPUs have been woken.
+ */
 void wake_up_nr(struct waitqueue_head *wq, unsigned int nr)
 {
+    struct vcpu *vcpus[VCPU_WAKE_BATCH];
     struct waitqueue_vcpu *wqv;
+    unsigned int i, n, nr_wake;
 
-    spin_lock(&wq->lock);
-
-    while ( !list_empty(&wq->list) && nr-- )
+    while ( nr )
     {
-        wqv = list_entry(wq->list.next, struct waitqueue_vcpu, list);
-        list_del_init(&wqv->list);
-        vcpu_unpause(wqv->vcpu);
-        put_domain(wqv->vcpu->domain);
-    }
+        n = 0;
 
-    spin_unlock(&wq->lock);
+        spin_lock(&wq->lock);
+        while ( !list_empty(&wq->list) && 
+                n < min(nr, (unsigned int)VCPU_WAKE_BATCH) )
+        {
+            wqv = list_entry(wq->list.next, struct waitqueue_vcpu, list);
+            list_del_init(&wqv->list);
+            vcpus[n++] = wqv->vcpu;
+        }
+        spin_unlock(&wq->lock);
+
+        if ( !n )
+            break;
+
+        /* Move the vCPUs which became runnable to the front. */
+        for ( i = nr_wake = 0; i < n; i++ )
+        {
+            struct vcpu *v = vcpus[i];
+
+            if ( !atomic_dec_and_test(&v->pause_count) )
+                continue;
+
+            vcpus[i] = vcpus[nr_wake];
+            vcpus[nr_wake++] = v;
+        }
+
+        vcpu_wake_batch(vcpus, nr_wake);
+
+        for ( i = 0; i < n; i++ )
+            put_domain(vcpus[i]->domain);
+
+        nr -= n;
+    }
 }
 
 void wake_up_one(struct waitqueue_head *wq)
@@ -119,7 +154,7 @@ void wake_up_all(struct waitqueue_head *wq)
 
 #ifdef CONFIG_X86
 
-static void __prepare_to_wait(struct waitqueue_vcpu *wqv)
+static void __save_wait_context(struct waitqueue_vcpu *wqv)
 {
     struct cpu_info *cpu_info = get_cpu_info();
     struct vcpu *curr = current;
@@ -140,7 +175,7 @@ static void __prepare_to_wait(struct waitqueue_vcpu *wqv)
     /*
      * Hand-rolled setjmp().
      *
-     * __prepare_to_wait() is the leaf of a deep calltree.  Preserve the GPRs,
+     * __save_wait_context() is the leaf of a deep calltree.  Preserve the GPRs,
      * bounds check what we want to stash in wqv->stack, copy the active stack
      * (up to cpu_info) into wqv->stack, then return normally.  Our caller
      * will shortly schedule() and discard the current context.
@@ -181,8 +216,40 @@ static void __prepare_to_wait(struct waitqueue_vcpu *wqv)
     }
 }
 
+/*
+ * Called by wait() just before descheduling.  The context is only saved when
+ * the vCPU actually goes to sleep, not by prepare_to_wait(), so a wait_event()
+ * whose condition turns true on the re-check copies no stack at all.  If the
+ * vCPU sleeps again within the same wait_event(), the context saved the first
+ * time, from the same call site, is reused.
+ *
+ * Returns true on the way to sleep, false once resumed by
+ * check_wakeup_from_wait().
+ */
+bool save_wait_context(void)
+{
+    struct waitqueue_vcpu *wqv = current->waitqueue_vcpu;
+
+    if ( wqv->esp )
+        return true;
+
+    __save_wait_context(wqv);
+
+    if ( wqv->resumed )
+    {
+        wqv->resumed = false;
+        return false;
+    }
+
+    return true;
+}
+
 static void __finish_wait(struct waitqueue_vcpu *wqv)
 {
+    /* Nothing to undo if we never went to sleep. */
+    if ( !wqv->esp )
+        return;
+
     wqv->esp = NULL;
     vcpu_temporary_affinity(current, NR_CPUS, VCPU_AFFINITY_WAIT);
 }
@@ -238,12 +305,13 @@ void check_wakeup_from_wait(void)
      *
      * Adjust %rsp to be the correct depth for the (deeper) stack we want to
      * restore, then prepare %rsi, %rdi and %rcx such that when we rejoin the
-     * rep movs in __prepare_to_wait(), it copies from wqv->stack over the
+     * rep movs in __save_wait_context(), it copies from wqv->stack over the
      * active stack.
      *
      * All other GPRs are available for use; They're restored from the stack,
      * or explicitly clobbered.
      */
+    wqv->resumed = true;
     asm volatile ( "mov %%rdi, %%rsp;"
                    "jmp .L_wq_resume"
                    :
@@ -255,7 +323,11 @@ void check_wakeup_from_wait(void)
 
 #else /* !CONFIG_X86 */
 
-#define __prepare_to_wait(wqv) ((void)0)
+bool save_wait_context(void)
+{
+    return true;
+}
+
 #define __finish_wait(wqv) ((void)0)
 
 #endif
@@ -266,8 +338,6 @@ void prepare_to_wait(struct waitqueue_head *wq)
     struct waitqueue_vcpu *wqv = curr->waitqueue_vcpu;
 
     ASSERT_NOT_IN_ATOMIC();
-    __prepare_to_wait(wqv);
-
     ASSERT(list_empty(&wqv->list));
     spin_lock(&wq->lock);
     list_add_tail(&wqv->list, &wq->list);
@@ -23,8 +23,11 @@
  * Adapted for Xen by Dan Magenheimer (dan.magenheimer@oracle.com)
  */
 
+#include <xen/cpu.h>
 #include <xen/irq.h>
 #include <xen/mm.h>
+#include <xen/param.h>
+#include <xen/perfc.h>
 #include <xen/pfn.h>
 #include <asm/time.h>
 
@@ -372,47 +375,36 @@ void xmem_pool_destroy(struct xmem_pool *pool)
     free_xenheap_pages(pool,pool_order);
 }
 
-void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+static unsigned long pool_alloc_size(unsigned long size)
 {
-    struct bhdr *b, *b2, *next_b, *region;
-    int fl, sl;
     unsigned long tmp_size;
 
-    ASSERT_ALLOC_CONTEXT();
-
     if ( size < MIN_BLOCK_SIZE )
-        size = MIN_BLOCK_SIZE;
-    else
-    {
-        tmp_size = ROUNDUP_SIZE(size);
-        /* Guard against overflow. */
-        if ( tmp_size < size )
-            return NULL;
-        size = tmp_size;
-    }
+        return MIN_BLOCK_SIZE;
 
-    /* Rounding up the requested size and calculating fl and sl */
+    tmp_size = ROUNDUP_SIZE(size);
+    /* Guard against overflow. */
+    return tmp_size < size ? 0 : tmp_size;
+}
 
-    spin_lock(&pool->lock);
- retry_find:
+/*
+ * Carve a block of (rounded) size out of the free lists, without growing the
+ * pool.  Returns NULL if no free block is large enough.
+ */
+static void *pool_alloc_locked(unsigned long size, struct xmem_pool *pool)
+{
+    struct bhdr *b, *b2, *next_b;
+    int fl, sl;
+    unsigned long tmp_size;
+
+    ASSERT(spin_is_locked(&pool->lock));
+
+    /* Rounding up the requested size and calculating fl and sl */
     MAPPING_SEARCH(&size, &fl, &sl);
 
     /* Searching a free block */
     if ( !(b = FIND_SUITABLE_BLOCK(pool, &fl, &sl)) )
-    {
-        /* Not found */
-        if ( size > (pool->grow_size - 2 * BHDR_OVERHEAD) )
-            goto out_locked;
-        if ( pool->max_size && (pool->num_regions * pool->grow_size
-                                > pool->max_size) )
-            goto out_locked;
-        spin_unlock(&pool->lock);
-        if ( (region = pool->get_mem(pool->grow_size)) == NULL )
-            goto out;
-        spin_lock(&pool->lock);
-        ADD_REGION(region, pool->grow_size, pool);
-        goto retry_find;
-    }
+        return NULL;
     EXTRACT_BLOCK_HDR(b, pool, fl, sl);
 
     /*-- found: */
@@ -442,30 +434,52 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
 
     pool->used_size += (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
 
-    spin_unlock(&pool->lock);
     return (void *)b->ptr.buffer;
+}
+
+void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+{
+    struct bhdr *region;
+    unsigned long search_size;
+    int fl, sl;
+    void *p;
+
+    ASSERT_ALLOC_CONTEXT();
 
-    /* Failed alloc */
- out_locked:
+    if ( !(size = pool_alloc_size(size)) )
+        return NULL;
+
+    spin_lock(&pool->lock);
+    while ( !(p = pool_alloc_locked(size, pool)) )
+    {
+        /* Not found */
+        search_size = size;
+        MAPPING_SEARCH(&search_size, &fl, &sl);
+        if ( search_size > (pool->grow_size - 2 * BHDR_OVERHEAD) )
+            break;
+        if ( pool->max_size && (pool->num_regions * pool->grow_size
+                                > pool->max_size) )
+            break;
+        spin_unlock(&pool->lock);
+        if ( (region = pool->get_mem(pool->grow_size)) == NULL )
+            return NULL;
+        spin_lock(&pool->lock);
+        ADD_REGION(region, pool->grow_size, pool);
+    }
     spin_unlock(&pool->lock);
 
- out:
-    return NULL;
+    return p;
 }
 
-void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+static void pool_free_locked(void *ptr, struct xmem_pool *pool)
 {
     struct bhdr *b, *tmp_b;
     int fl = 0, sl = 0;
 
-    ASSERT_ALLOC_CONTEXT();
-
-    if ( unlikely(ptr == NULL) )
-        return;
+    ASSERT(spin_is_locked(&pool->lock));
 
     b = (struct bhdr *)((char *) ptr - BHDR_OVERHEAD);
 
-    spin_lock(&pool->lock);
     b->size |= FREE_BLOCK;
     pool->used_size -= (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
     b->ptr.free_ptr = (struct free_ptr) { NULL, NULL};
@@ -494,14 +508,24 @@ void xmem_pool_free(void *ptr, struct xmem_pool *pool)
         pool->put_mem(b);
         pool->num_regions--;
         pool->used_size -= BHDR_OVERHEAD; /* sentinel block header */
-        goto out;
+        return;
     }
 
     INSERT_BLOCK(b, pool, fl, sl);
 
     tmp_b->size |= PREV_FREE;
     tmp_b->prev_hdr = b;
- out:
+}
+
+void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+{
+    ASSERT_ALLOC_CONTEXT();
+
+    if ( unlikely(ptr == NULL) )
+        return;
+
+    spin_lock(&pool->lock);
+    pool_free_locked(ptr, pool);
     spin_unlock(&pool->lock);
 }
 
@@ -559,6 +583,180 @@ static void tlsf_init(void)
     BUG_ON(!xenpool);
 }
 
+/*
+ * Per-CPU magazines of small xenpool blocks.
+ *
+ * Freed blocks of up to MAG_MAX_SIZE bytes are kept on the freeing CPU,
+ * sorted into size classes, and handed out again by xmalloc() on that CPU
+ * without taking the pool lock.  A block goes into the largest class it can
+ * serve, provided that doesn't waste more than half of it.  Blocks stay
+ * allocated as far as TLSF is concerned while sitting in a magazine, and
+ * are moved between the magazines and the pool in batches, under a single
+ * acquisition of the pool lock.  Since xenheap memory isn't tied to a CPU,
+ * frees from a CPU other than the allocating one are cached like any other.
+ *
+ * xmalloc() and xfree() can't be used in interrupt context, so a CPU's
+ * magazines are only ever touched by that CPU, or once it went offline.
+ */
+static const unsigned short mag_sizes[] = {
+    32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+#define MAG_CLASSES     ARRAY_SIZE(mag_sizes)
+#define MAG_MAX_SIZE    2048
+/* Limit each magazine to this many objects, or about this many bytes. */
+#define MAG_MAX_DEPTH   64
+#define MAG_BYTES       8192
+
+struct magazine {
+    void *head;
+    unsigned int count;
+};
+
+static DEFINE_PER_CPU(struct magazine, xmalloc_mags[MAG_CLASSES]);
+
+static bool __read_mostly opt_xmalloc_magazines = true;
+boolean_param("xmalloc-magazines", opt_xmalloc_magazines);
+static bool __read_mostly mags_enabled;
+
+static unsigned int mag_depth(unsigned int cls)
+{
+    return min(MAG_MAX_DEPTH, MAG_BYTES / mag_sizes[cls]);
+}
+
+/* Smallest class which can serve an allocation of size bytes. */
+static unsigned int mag_class_alloc(unsigned long size)
+{
+    unsigned int cls = 0;
+
+    while ( mag_sizes[cls] < size )
+        cls++;
+
+    return cls;
+}
+
+/* Class a block of size bytes should be cached in, or -1 if none. */
+static int mag_class_free(unsigned long size)
+{
+    int cls = MAG_CLASSES - 1;
+
+    while ( cls >= 0 && mag_sizes[cls] > size )
+        cls--;
+
+    if ( cls < 0 || (size - mag_sizes[cls]) > mag_sizes[cls] / 2 )
+        return -1;
+
+    return cls;
+}
+
+static void *mag_pop(struct magazine *mag)
+{
+    void *p = mag->head;
+
+    mag->head = *(void **)p;
+    mag->count--;
+
+    return p;
+}
+
+static void mag_push(struct magazine *mag, void *p)
+{
+    *(void **)p = mag->head;
+    mag->head = p;
+    mag->count++;
+}
+
+/* Return all but keep blocks of a magazine to the pool. */
+static void mag_flush(struct magazine *mag, unsigned int keep)
+{
+    if ( mag->count <= keep )
+        return;
+
+    perfc_incr(xmalloc_mag_flush);
+
+    spin_lock(&xenpool->lock);
+    while ( mag->count > keep )
+        pool_free_locked(mag_pop(mag), xenpool);
+    spin_unlock(&xenpool->lock);
+}
+
+static void *mag_alloc(unsigned long size)
+{
+    unsigned int cls = mag_class_alloc(size), n;
+    struct magazine *mag = &this_cpu(xmalloc_mags)[cls];
+    void *p;
+
+    if ( mag->count )
+    {
+        perfc_incr(xmalloc_mag_hit);
+        return mag_pop(mag);
+    }
+
+    perfc_incr(xmalloc_mag_miss);
+
+    /* Refill half a magazine from what the pool has got, plus one to return. */
+    spin_lock(&xenpool->lock);
+    for ( n = mag_depth(cls) / 2; n; n-- )
+    {
+        if ( !(p = pool_alloc_locked(mag_sizes[cls], xenpool)) )
+            break;
+        mag_push(mag, p);
+    }
+    p = pool_alloc_locked(mag_sizes[cls], xenpool);
+    spin_unlock(&xenpool->lock);
+
+    /* Let the pool grow if it ran out. */
+    return p ?: xmem_pool_alloc(mag_sizes[cls], xenpool);
+}
+
+static bool mag_free(void *p)
+{
+    const struct bhdr *b = p - BHDR_OVERHEAD;
+    int cls = mag_class_free(b->size & BLOCK_SIZE_MASK);
+    struct magazine *mag;
+
+    if ( cls < 0 )
+        return false;
+
+    mag = &this_cpu(xmalloc_mags)[cls];
+    if ( mag->count >= mag_depth(cls) )
+        mag_flush(mag, mag_depth(cls) / 2);
+    mag_push(mag, p);
+    perfc_incr(xmalloc_mag_free);
+
+    return true;
+}
+
+static int cf_check mag_cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, cls;
+
+    if ( action == CPU_DEAD )
+        for ( cls = 0; cls < MAG_CLASSES; cls++ )
+            mag_flush(&per_cpu(xmalloc_mags, cpu)[cls], 0);
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block mag_cpu_nfb = {
+    .notifier_call = mag_cpu_callback
+};
+
+static int __init cf_check xmalloc_mags_init(void)
+{
+    if ( !opt_xmalloc_magazines )
+        return 0;
+
+    if ( !xenpool )
+        tlsf_init();
+
+    register_cpu_notifier(&mag_cpu_nfb);
+    mags_enabled = true;
+
+    return 0;
+}
+presmp_initcall(xmalloc_mags_init);
+
 /*
  * xmalloc()
  */
@@ -615,7 +813,9 @@ void *_xmalloc(unsigned long size, unsigned long align)
     if ( !xenpool )
         tlsf_init();
 
-    if ( size < PAGE_SIZE )
+    if ( mags_enabled && size <= MAG_MAX_SIZE )
+        p = mag_alloc(size);
+    else if ( size < PAGE_SIZE )
         p = xmem_pool_alloc(size, xenpool);
     if ( p == NULL )
         return xmalloc_whole_pages(size - align + MEM_ALIGN, align);
@@ -727,5 +927,6 @@ void xfree(void *p)
     /* Strip alignment padding. */
     p = strip_padding(p);
 
-    xmem_pool_free(p, xenpool);
+    if ( !mags_enabled || !mag_free(p) )
+        xmem_pool_free(p, xenpool);
 }
@@ -0,0 +1,277 @@
+/*
+ * Caches of fixed size objects, allocated in slabs of xenheap pages.
+ *
+ * Each slab starts with a small header, followed by as many objects as fit.
+ * Slabs are naturally aligned xenheap allocations, so the slab (and hence the
+ * cache) an object belongs to is found by masking its address.  Partially
+ * used slabs are kept on a list to allocate from, while full slabs are kept
+ * off it; one free slab is retained per cache to avoid page allocator churn
+ * when the number of objects hovers around a slab boundary.
+ */
+
+#include <xen/init.h>
+#include <xen/irq.h>
+#include <xen/keyhandler.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/xmalloc.h>
+#include <xen/xmem_cache.h>
+
+/* Try to get at least this many objects into a slab ... */
+#define SLAB_MIN_OBJS   8
+/* ... without using slabs larger than this. */
+#define SLAB_MAX_ORDER  3
+
+struct xmem_slab {
+    struct list_head list;
+    struct xmem_cache *cache;
+    void *free;
+    unsigned int inuse;
+};
+
+static DEFINE_SPINLOCK(cache_list_lock);
+static LIST_HEAD(cache_list);
+
+static unsigned int cache_stride(const struct xmem_cache *c)
+{
+    return ROUNDUP(max_t(unsigned int, c->size, sizeof(void *)), c->align);
+}
+
+static bool cache_setup(struct xmem_cache *c)
+{
+    unsigned int stride;
+
+    if ( c->per_slab )
+        return true;
+
+    if ( !c->align )
+        c->align = sizeof(void *);
+    if ( !c->size || (c->align & (c->align - 1)) || c->align > PAGE_SIZE )
+        return false;
+
+    stride = cache_stride(c);
+    c->offset = ROUNDUP(sizeof(struct xmem_slab), c->align);
+
+    for ( c->order = 0; ; c->order++ )
+    {
+        unsigned long bytes = PAGE_SIZE << c->order;
+
+        c->per_slab = bytes > c->offset ? (bytes - c->offset) / stride : 0;
+        if ( c->per_slab >= SLAB_MIN_OBJS || c->order == SLAB_MAX_ORDER )
+            break;
+    }
+
+    return c->per_slab;
+}
+
+static void cache_register(struct xmem_cache *c)
+{
+    spin_lock(&cache_list_lock);
+    if ( list_empty(&c->list) )
+        list_add_tail(&c->list, &cache_list);
+    spin_unlock(&cache_list_lock);
+}
+
+static struct xmem_slab *slab_create(struct xmem_cache *c)
+{
+    struct xmem_slab *slab = alloc_xenheap_pages(c->order, 0);
+    unsigned int stride = cache_stride(c), i;
+    void *obj;
+
+    if ( !slab )
+        return NULL;
+
+    slab->cache = c;
+    slab->inuse = 0;
+    slab->free = NULL;
+
+    /* Thread the free list such that objects get handed out in order. */
+    obj = (void *)slab + c->offset + (c->per_slab - 1) * stride;
+    for ( i = 0; i < c->per_slab; i++, obj -= stride )
+    {
+        *(void **)obj = slab->free;
+        slab->free = obj;
+    }
+
+    return slab;
+}
+
+struct xmem_cache *xmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align)
+{
+    struct xmem_cache *c = xmalloc(struct xmem_cache);
+
+    if ( !c )
+        return NULL;
+
+    *c = (struct xmem_cache)XMEM_CACHE_INIT(*c, name, size, align);
+    c->dynamic = true;
+
+    if ( !cache_setup(c) )
+    {
+        xfree(c);
+        return NULL;
+    }
+
+    cache_register(c);
+
+    return c;
+}
+
+void xmem_cache_destroy(struct xmem_cache *c)
+{
+    if ( !c )
+        return;
+
+    ASSERT(c->dynamic);
+
+    spin_lock(&cache_list_lock);
+    list_del(&c->list);
+    spin_unlock(&cache_list_lock);
+
+    /* Slabs with objects still in use get leaked along with them. */
+    if ( c->nr_inuse )
+        printk(XENLOG_WARNING
+               "memory leak in cache %s: %lu objects still in use\n",
+               c->name, c->nr_inuse);
+
+    if ( c->empty )
+        free_xenheap_pages(c->empty, c->order);
+
+    xfree(c);
+}
+
+void *xmem_cache_alloc(struct xmem_cache *c)
+{
+    struct xmem_slab *slab;
+    void *obj;
+
+    ASSERT_ALLOC_CONTEXT();
+
+    spin_lock(&c->lock);
+
+    if ( unlikely(!cache_setup(c)) )
+    {
+        ASSERT_UNREACHABLE();
+        goto fail;
+    }
+
+    if ( list_empty(&c->partial) )
+    {
+        slab = c->empty;
+        c->empty = NULL;
+
+        if ( !slab )
+        {
+            spin_unlock(&c->lock);
+
+            slab = slab_create(c);
+            cache_register(c);
+
+            spin_lock(&c->lock);
+            if ( !slab )
+                goto fail;
+            c->nr_slabs++;
+        }
+
+        list_add(&slab->list, &c->partial);
+    }
+
+    slab = list_first_entry(&c->partial, struct xmem_slab, list);
+    obj = slab->free;
+    slab->free = *(void **)obj;
+    if ( ++slab->inuse == c->per_slab )
+        list_move(&slab->list, &c->full);
+
+    c->nr_inuse++;
+    c->nr_allocs++;
+
+    spin_unlock(&c->lock);
+
+    return obj;
+
+ fail:
+    c->nr_failures++;
+    spin_unlock(&c->lock);
+
+    return NULL;
+}
+
+void *xmem_cache_zalloc(struct xmem_cache *c)
+{
+    void *obj = xmem_cache_alloc(c);
+
+    return obj ? memset(obj, 0, c->size) : NULL;
+}
+
+void xmem_cache_free(struct xmem_cache *c, void *obj)
+{
+    struct xmem_slab *slab, *release = NULL;
+
+    ASSERT_ALLOC_CONTEXT();
+
+    if ( !obj )
+        return;
+
+    slab = (void *)((unsigned long)obj & ~((PAGE_SIZE << c->order) - 1));
+    ASSERT(slab->cache == c);
+    ASSERT(!(((unsigned long)obj - (unsigned long)slab - c->offset) %
+             cache_stride(c)));
+
+    spin_lock(&c->lock);
+
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    if ( slab->inuse-- == c->per_slab )
+        list_move(&slab->list, &c->partial);
+    if ( !slab->inuse )
+    {
+        list_del(&slab->list);
+        if ( c->empty )
+        {
+            release = slab;
+            c->nr_slabs--;
+        }
+        else
+            c->empty = slab;
+    }
+
+    c->nr_inuse--;
+
+    spin_unlock(&c->lock);
+
+    if ( release )
+        free_xenheap_pages(release, c->order);
+}
+
+static void cf_check dump_xmem_caches(unsigned char key)
+{
+    const struct xmem_cache *c;
+
+    printk("'%c' pressed -> dumping xmem caches\n", key);
+
+    spin_lock(&cache_list_lock);
+    list_for_each_entry ( c, &cache_list, list )
+        printk("%-20s obj %4u/%-4u slab order %u x %-4u: slabs %lu  "
+               "in use %lu  allocs %lu  failed %lu\n",
+               c->name, c->size, c->align, c->order, c->per_slab,
+               c->nr_slabs, c->nr_inuse, c->nr_allocs, c->nr_failures);
+    spin_unlock(&cache_list_lock);
+}
+
+static int __init cf_check xmem_cache_keyhandler_init(void)
+{
+    register_keyhandler('K', dump_xmem_caches, "dump xmem cache info", 1);
+    return 0;
+}
+__initcall(xmem_cache_keyhandler_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -609,6 +609,50 @@ static inline void xen_console_write_debug_port(const char *buf, size_t len)
 }
 #endif
 
+/*
+ * Per-domain limit on the logging of lines written by guests other than the
+ * hardware domain, in characters per second (0: unlimited).  Up to
+ * GUEST_CONSOLE_BURST seconds' worth may be written at once.
+ */
+static unsigned int __read_mostly opt_guest_console_rate = 8192;
+integer_runtime_param("guest_console_rate", opt_guest_console_rate);
+
+#define GUEST_CONSOLE_BURST 4
+
+bool guest_console_ratelimit(struct domain *d, unsigned int len)
+{
+    unsigned int rate = ACCESS_ONCE(opt_guest_console_rate);
+    s_time_t now = NOW(), delta = now - d->pbuf_stamp;
+    uint64_t tokens;
+
+    ASSERT(spin_is_locked(&d->pbuf_lock));
+
+    if ( !rate )
+        return true;
+
+    d->pbuf_stamp = now;
+    delta = min(delta, SECONDS(GUEST_CONSOLE_BURST));
+    tokens = d->pbuf_tokens + (uint64_t)delta * rate / SECONDS(1);
+    d->pbuf_tokens = min(tokens, (uint64_t)rate * GUEST_CONSOLE_BURST);
+
+    if ( d->pbuf_tokens < len )
+    {
+        d->pbuf_dropped++;
+        perfc_incr(guest_console_dropped);
+        return false;
+    }
+    d->pbuf_tokens -= len;
+
+    if ( d->pbuf_dropped )
+    {
+        guest_printk(d, XENLOG_G_WARNING "%u lines of output suppressed\n",
+                     d->pbuf_dropped);
+        d->pbuf_dropped = 0;
+    }
+
+    return true;
+}
+
 static long guest_console_write(XEN_GUEST_HANDLE_PARAM(char) buffer,
                                 unsigned int count)
 {
@@ -680,7 +724,8 @@ static long guest_console_write(XEN_GUEST_HANDLE_PARAM(char) buffer,
             else
             {
                 cd->pbuf[cd->pbuf_idx] = '\0';
-                guest_printk(cd, XENLOG_G_DEBUG "%s%s\n", cd->pbuf, kbuf);
+                if ( guest_console_ratelimit(cd, cd->pbuf_idx + (kout - kbuf)) )
+                    guest_printk(cd, XENLOG_G_DEBUG "%s%s\n", cd->pbuf, kbuf);
                 cd->pbuf_idx = 0;
             }
             spin_unlock(&cd->pbuf_lock);
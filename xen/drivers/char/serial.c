@@ -126,7 +126,10 @@ static void __serial_putc(struct serial_port *port, char c)
         {
             /* Buffer filled and we are dropping characters. */
             if ( (port->txbufp - port->txbufc) > (serial_txbufsz / 2) )
+            {
+                perfc_incr(serial_tx_dropped);
                 return;
+            }
             port->tx_quench = 0;
         }
 
@@ -154,6 +157,7 @@ static void __serial_putc(struct serial_port *port, char c)
             {
                 /* Buffer is full: drop chars until buffer is half empty. */
                 port->tx_quench = 1;
+                perfc_incr(serial_tx_dropped);
             }
             return;
         }
@@ -81,6 +81,17 @@ static int __init cf_check setup_cpufreq_option(const char *str)
         return 0;
     }
 
+    if ( choice < 0 && !cmdline_strcmp(str, "hwp") )
+    {
+        xen_processor_pmbits |= XEN_PROCESSOR_PM_PX;
+        cpufreq_controller = FREQCTL_xen;
+        cpufreq_opt_hwp = true;
+        /* Options are for the governor used if HWP/CPPC isn't available. */
+        if ( *arg && *(arg + 1) )
+            return cpufreq_cmdline_parse(arg + 1);
+        return 0;
+    }
+
     if ( choice == 0 || !cmdline_strcmp(str, "none") )
     {
         xen_processor_pmbits &= ~XEN_PROCESSOR_PM_PX;
@@ -101,6 +112,7 @@ static int __init cf_check setup_cpufreq_option(const char *str)
 custom_param("cpufreq", setup_cpufreq_option);
 
 bool_t __read_mostly cpufreq_verbose;
+bool __initdata cpufreq_opt_hwp;
 
 struct cpufreq_governor *__find_governor(const char *governor)
 {
@@ -258,6 +258,11 @@ int cf_check amd_iommu_get_reserved_device_memory(
 int __must_check cf_check amd_iommu_flush_iotlb_pages(
     struct domain *d, dfn_t dfn, unsigned long page_count,
     unsigned int flush_flags);
+int __must_check cf_check amd_iommu_flush_iotlb_ranges(
+    struct domain *d, const struct iommu_flush_range *ranges,
+    unsigned int nr, unsigned int flush_flags);
+unsigned int amd_iommu_flush_order(unsigned long dfn,
+                                   unsigned long page_count);
 void amd_iommu_print_entries(const struct amd_iommu *iommu, unsigned int dev_id,
                              dfn_t dfn);
 
@@ -281,6 +286,9 @@ void iommu_dte_add_device_entry(struct amd_iommu_dte *dte,
 void amd_iommu_flush_all_pages(struct domain *d);
 void amd_iommu_flush_pages(struct domain *d, unsigned long dfn,
                            unsigned int order);
+void amd_iommu_flush_ranges(struct domain *d,
+                            const struct iommu_flush_range *ranges,
+                            unsigned int nr);
 void amd_iommu_flush_iotlb(u8 devfn, const struct pci_dev *pdev,
                            uint64_t gaddr, unsigned int order);
 void amd_iommu_flush_device(struct amd_iommu *iommu, uint16_t bdf);
@@ -363,6 +363,44 @@ void amd_iommu_flush_pages(struct domain *d,
     _amd_iommu_flush_pages(d, __dfn_to_daddr(dfn), order);
 }
 
+/*
+ * Flush several DFN ranges, each of which has to be coverable by a single
+ * flush (see amd_iommu_flush_order()), with one completion wait per IOMMU.
+ */
+void amd_iommu_flush_ranges(struct domain *d,
+                            const struct iommu_flush_range *ranges,
+                            unsigned int nr)
+{
+    struct amd_iommu *iommu;
+    unsigned int dom_id = d->domain_id, i;
+
+    for_each_amd_iommu ( iommu )
+    {
+        for ( i = 0; i < nr; i++ )
+            invalidate_iommu_pages(iommu, dfn_to_daddr(ranges[i].dfn), dom_id,
+                                   amd_iommu_flush_order(
+                                       dfn_x(ranges[i].dfn),
+                                       ranges[i].page_count));
+        flush_command_buffer(iommu, 0);
+    }
+
+    if ( !ats_enabled )
+        return;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        daddr_t daddr = dfn_to_daddr(ranges[i].dfn);
+        unsigned int order = amd_iommu_flush_order(dfn_x(ranges[i].dfn),
+                                                   ranges[i].page_count);
+
+        amd_iommu_flush_all_iotlbs(d, daddr, order);
+
+        /* See _amd_iommu_flush_pages(). */
+        if ( is_hardware_domain(d) )
+            amd_iommu_flush_all_iotlbs(dom_xen, daddr, order);
+    }
+}
+
 void amd_iommu_flush_device(struct amd_iommu *iommu, uint16_t bdf)
 {
     invalidate_dev_table_entry(iommu, bdf);
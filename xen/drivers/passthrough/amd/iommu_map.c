@@ -274,6 +274,19 @@ void __init iommu_dte_add_device_entry(struct amd_iommu_dte *dte,
     };
 }
 
+/*
+ * The leaf (level 1) table found by the last walk is remembered, so that
+ * runs of 4k (un)mappings, e.g. from p2m updates, don't each walk from the
+ * root.  It has to be forgotten whenever an entry above level 1 changes, as
+ * that may unhook (and free) the table.
+ */
+static void leaf_cache_invalidate(struct domain_iommu *hd)
+{
+    ASSERT(spin_is_locked(&hd->arch.mapping_lock));
+
+    hd->arch.amd.leaf_mfn = 0;
+}
+
 /* Walk io page tables and build level page tables if necessary
  * {Re, un}mapping super page frames causes re-allocation of io
  * page tables.
@@ -297,6 +310,14 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
         return 1;
     }
 
+    if ( target == 1 && hd->arch.amd.leaf_mfn &&
+         hd->arch.amd.leaf_dfn == (dfn >> PTE_PER_TABLE_SHIFT) )
+    {
+        perfc_incr(iommu_pt_leaf_hits);
+        *pt_mfn = hd->arch.amd.leaf_mfn;
+        return 0;
+    }
+
     /*
      * A frame number past what the current page tables can represent can't
      * possibly have a mapping.
@@ -385,6 +406,12 @@ static int iommu_pde_from_dfn(struct domain *d, unsigned long dfn,
         level--;
     }
 
+    if ( target == 1 )
+    {
+        hd->arch.amd.leaf_dfn = dfn >> PTE_PER_TABLE_SHIFT;
+        hd->arch.amd.leaf_mfn = next_table_mfn;
+    }
+
     /* mfn of target level page table */
     *pt_mfn = next_table_mfn;
     return 0;
@@ -462,12 +489,16 @@ int cf_check amd_iommu_map_page(
     old = set_iommu_pte_present(pt_mfn, dfn_x(dfn), mfn_x(mfn), level,
                                 flags & IOMMUF_writable,
                                 flags & IOMMUF_readable, &contig);
+    if ( level > 1 )
+        leaf_cache_invalidate(hd);
 
     while ( unlikely(contig) && ++level < hd->arch.amd.paging_mode )
     {
         struct page_info *pg = mfn_to_page(_mfn(pt_mfn));
         unsigned long next_mfn;
 
+        leaf_cache_invalidate(hd);
+
         if ( iommu_pde_from_dfn(d, dfn_x(dfn), level, &pt_mfn, flush_flags,
                                 false) )
             BUG();
@@ -533,11 +564,15 @@ int cf_check amd_iommu_unmap_page(
 
         /* Mark PTE as 'page not present'. */
         old = clear_iommu_pte_present(pt_mfn, dfn_x(dfn), level, &free);
+        if ( level > 1 )
+            leaf_cache_invalidate(hd);
 
         while ( unlikely(free) && ++level < hd->arch.amd.paging_mode )
         {
             struct page_info *pg = mfn_to_page(_mfn(pt_mfn));
 
+            leaf_cache_invalidate(hd);
+
             if ( iommu_pde_from_dfn(d, dfn_x(dfn), level, &pt_mfn,
                                     flush_flags, false) )
                 BUG();
@@ -617,11 +652,36 @@ static unsigned long flush_count(unsigned long dfn, unsigned long page_count,
     return end - start;
 }
 
+/*
+ * Flushes are expensive so find the minimal single flush that will cover
+ * the page range.  Returns its order, or UINT_MAX if only flushing
+ * everything will do (including when the range wraps).
+ *
+ * NOTE: It is unnecessary to round down the DFN value to align with the
+ *       flush order. This is done by the internals of the flush code.
+ */
+unsigned int amd_iommu_flush_order(unsigned long dfn,
+                                   unsigned long page_count)
+{
+    if ( dfn + page_count < dfn )
+        return UINT_MAX;
+
+    if ( page_count == 1 ) /* order 0 flush count */
+        return 0;
+    if ( flush_count(dfn, page_count, 9) == 1 )
+        return 9;
+    if ( flush_count(dfn, page_count, 18) == 1 )
+        return 18;
+
+    return UINT_MAX;
+}
+
 int cf_check amd_iommu_flush_iotlb_pages(
     struct domain *d, dfn_t dfn, unsigned long page_count,
     unsigned int flush_flags)
 {
     unsigned long dfn_l = dfn_x(dfn);
+    unsigned int order;
 
     if ( !(flush_flags & IOMMU_FLUSHF_all) )
     {
@@ -633,29 +693,38 @@ int cf_check amd_iommu_flush_iotlb_pages(
     if ( !(flush_flags & IOMMU_FLUSHF_modified) )
         return 0;
 
-    /* If so requested or if the range wraps then just flush everything. */
-    if ( (flush_flags & IOMMU_FLUSHF_all) || dfn_l + page_count < dfn_l )
-    {
+    /* If so requested or if no single flush covers the range, flush all. */
+    order = (flush_flags & IOMMU_FLUSHF_all)
+            ? UINT_MAX : amd_iommu_flush_order(dfn_l, page_count);
+    if ( order == UINT_MAX )
         amd_iommu_flush_all_pages(d);
+    else
+        amd_iommu_flush_pages(d, dfn_l, order);
+
+    return 0;
+}
+
+int cf_check amd_iommu_flush_iotlb_ranges(
+    struct domain *d, const struct iommu_flush_range *ranges,
+    unsigned int nr, unsigned int flush_flags)
+{
+    unsigned int i;
+
+    ASSERT(nr && flush_flags && !(flush_flags & IOMMU_FLUSHF_all));
+
+    /* Unless a PTE was modified, no flush is required */
+    if ( !(flush_flags & IOMMU_FLUSHF_modified) )
         return 0;
-    }
 
-    /*
-     * Flushes are expensive so find the minimal single flush that will
-     * cover the page range.
-     *
-     * NOTE: It is unnecessary to round down the DFN value to align with
-     *       the flush order here. This is done by the internals of the
-     *       flush code.
-     */
-    if ( page_count == 1 ) /* order 0 flush count */
-        amd_iommu_flush_pages(d, dfn_l, 0);
-    else if ( flush_count(dfn_l, page_count, 9) == 1 )
-        amd_iommu_flush_pages(d, dfn_l, 9);
-    else if ( flush_count(dfn_l, page_count, 18) == 1 )
-        amd_iommu_flush_pages(d, dfn_l, 18);
-    else
-        amd_iommu_flush_all_pages(d);
+    for ( i = 0; i < nr; i++ )
+        if ( amd_iommu_flush_order(dfn_x(ranges[i].dfn),
+                                   ranges[i].page_count) == UINT_MAX )
+        {
+            amd_iommu_flush_all_pages(d);
+            return 0;
+        }
+
+    amd_iommu_flush_ranges(d, ranges, nr);
 
     return 0;
 }
@@ -865,6 +934,7 @@ int cf_check amd_iommu_quarantine_init(struct pci_dev *pdev, bool scratch_page)
 
     /* Transiently install the root into DomIO, for iommu_identity_mapping(). */
     hd->arch.amd.root_table = pdev->arch.amd.root_table;
+    hd->arch.amd.leaf_mfn = 0;
 
     rc = amd_iommu_reserve_domain_unity_map(dom_io,
                                             ivrs_mappings[req_id].unity_map,
@@ -872,6 +942,7 @@ int cf_check amd_iommu_quarantine_init(struct pci_dev *pdev, bool scratch_page)
 
     iommu_identity_map_teardown(dom_io);
     hd->arch.amd.root_table = NULL;
+    hd->arch.amd.leaf_mfn = 0;
 
     if ( rc )
         AMD_IOMMU_WARN("%pp: quarantine unity mapping failed\n", &pdev->sbdf);
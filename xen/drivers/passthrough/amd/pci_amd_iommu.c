@@ -480,6 +480,15 @@ static int cf_check reassign_device(
         pdev->domain = target;
     }
 
+#ifdef CONFIG_NUMA
+    /*
+     * Allocate further page tables close to the device, along the lines of
+     * what VT-d does with the node of the DRHD.
+     */
+    if ( pdev->node != NUMA_NO_NODE )
+        dom_iommu(target)->node = pdev->node;
+#endif
+
     /*
      * If the device belongs to the hardware domain, and it has a unity mapping,
      * don't remove it from the hardware domain, because BIOS may reference that
@@ -539,6 +548,7 @@ static void cf_check amd_iommu_clear_root_pgtable(struct domain *d)
 
     spin_lock(&hd->arch.mapping_lock);
     hd->arch.amd.root_table = NULL;
+    hd->arch.amd.leaf_mfn = 0;
     spin_unlock(&hd->arch.mapping_lock);
 }
 
@@ -759,6 +769,7 @@ static const struct iommu_ops __initconst_cf_clobber _iommu_ops = {
     .map_page = amd_iommu_map_page,
     .unmap_page = amd_iommu_unmap_page,
     .iotlb_flush = amd_iommu_flush_iotlb_pages,
+    .iotlb_flush_ranges = amd_iommu_flush_iotlb_ranges,
     .reassign_device = reassign_device,
     .get_device_group_id = amd_iommu_group_id,
     .enable_x2apic = iov_enable_xt,
@@ -391,8 +391,11 @@ static int arm_smmu_cmdq_build_cmd(u64 *cmd, struct arm_smmu_cmdq_ent *ent)
 		cmd[1] |= FIELD_PREP(CMDQ_CFGI_1_RANGE, 31);
 		break;
 	case CMDQ_OP_TLBI_S2_IPA:
+		cmd[0] |= FIELD_PREP(CMDQ_TLBI_0_NUM, ent->tlbi.num);
+		cmd[0] |= FIELD_PREP(CMDQ_TLBI_0_SCALE, ent->tlbi.scale);
 		cmd[0] |= FIELD_PREP(CMDQ_TLBI_0_VMID, ent->tlbi.vmid);
 		cmd[1] |= FIELD_PREP(CMDQ_TLBI_1_LEAF, ent->tlbi.leaf);
+		cmd[1] |= FIELD_PREP(CMDQ_TLBI_1_TG, ent->tlbi.tg);
 		cmd[1] |= ent->tlbi.addr & CMDQ_TLBI_1_IPA_MASK;
 		break;
 	case CMDQ_OP_TLBI_S12_VMALL:
@@ -1090,6 +1093,83 @@ static void arm_smmu_tlb_inv_context(void *cookie)
 	arm_smmu_cmdq_issue_sync(smmu);
 }
 
+/*
+ * Queue the stage-2 invalidation of @pages pages from @ipa, without waiting
+ * for completion. With range invalidation (SMMUv3.2), a single command
+ * covers up to CMDQ_TLBI_RANGE_NUM_MAX + 1 blocks of a power of two number
+ * of pages; otherwise one command is needed per page.
+ */
+static void arm_smmu_tlb_inv_range_queue(struct arm_smmu_domain *smmu_domain,
+					 u64 ipa, unsigned long pages)
+{
+	struct arm_smmu_device *smmu = smmu_domain->smmu;
+	bool range = smmu->features & ARM_SMMU_FEAT_RANGE_INV;
+	u64 cmd[CMDQ_ENT_DWORDS];
+	unsigned long flags;
+	struct arm_smmu_cmdq_ent ent = {
+		.opcode	= CMDQ_OP_TLBI_S2_IPA,
+		.tlbi	= {
+			.vmid	= smmu_domain->s2_cfg.vmid,
+			/* Tables may have been freed: don't limit to leaves. */
+			.leaf	= false,
+			/* 4KB granule, as used by the shared P2M. */
+			.tg	= range ? (PAGE_SHIFT - 10) / 2 : 0,
+		},
+	};
+
+	spin_lock_irqsave(&smmu->cmdq.lock, flags);
+
+	while (pages) {
+		unsigned long num = 1;
+
+		if (range) {
+			/* Biggest power of two multiple of pages dividing the rest */
+			ent.tlbi.scale = __ffs(pages);
+			num = (pages >> ent.tlbi.scale) & CMDQ_TLBI_RANGE_NUM_MAX;
+			ent.tlbi.num = num - 1;
+			num <<= ent.tlbi.scale;
+		}
+
+		ent.tlbi.addr = ipa;
+		arm_smmu_cmdq_build_cmd(cmd, &ent);
+		arm_smmu_cmdq_insert_cmd(smmu, cmd);
+
+		ipa += (u64)num << PAGE_SHIFT;
+		pages -= num;
+	}
+
+	spin_unlock_irqrestore(&smmu->cmdq.lock, flags);
+}
+
+/*
+ * Invalidate the given ranges of the context, waiting for completion only
+ * once at the end.
+ */
+static void arm_smmu_tlb_inv_ranges(struct arm_smmu_domain *smmu_domain,
+				    const struct iommu_flush_range *ranges,
+				    unsigned int nr)
+{
+	unsigned long total = 0;
+	unsigned int i;
+
+	if (!(smmu_domain->smmu->features & ARM_SMMU_FEAT_RANGE_INV)) {
+		for (i = 0; i < nr; i++)
+			total += ranges[i].page_count;
+
+		if (total > ARM_SMMU_MAX_TLBI_OPS) {
+			arm_smmu_tlb_inv_context(smmu_domain);
+			return;
+		}
+	}
+
+	for (i = 0; i < nr; i++)
+		arm_smmu_tlb_inv_range_queue(smmu_domain,
+					     pfn_to_paddr(dfn_x(ranges[i].dfn)),
+					     ranges[i].page_count);
+
+	arm_smmu_cmdq_issue_sync(smmu_domain->smmu);
+}
+
 static struct iommu_domain *arm_smmu_domain_alloc(void)
 {
 	struct arm_smmu_domain *smmu_domain;
@@ -2256,6 +2336,11 @@ static int arm_smmu_device_hw_probe(struct arm_smmu_device *smmu)
 	if (smmu->sid_bits <= STRTAB_SPLIT)
 		smmu->features &= ~ARM_SMMU_FEAT_2_LVL_STRTAB;
 
+	/* IDR3 */
+	reg = readl_relaxed(smmu->base + ARM_SMMU_IDR3);
+	if (reg & IDR3_RIL)
+		smmu->features |= ARM_SMMU_FEAT_RANGE_INV;
+
 	/* IDR5 */
 	reg = readl_relaxed(smmu->base + ARM_SMMU_IDR5);
 
@@ -2550,10 +2635,47 @@ static int __must_check arm_smmu_iotlb_flush_all(struct domain *d)
 	return 0;
 }
 
+static int __must_check arm_smmu_iotlb_flush_ranges(struct domain *d,
+				const struct iommu_flush_range *ranges,
+				unsigned int nr, unsigned int flush_flags)
+{
+	struct arm_smmu_xen_domain *xen_domain = dom_iommu(d)->arch.priv;
+	struct iommu_domain *io_domain;
+
+	/*
+	 * The SMMU doesn't cache invalid entries, so only a PTE which was
+	 * modified needs invalidating.
+	 */
+	if (!(flush_flags & IOMMU_FLUSHF_modified))
+		return 0;
+
+	spin_lock(&xen_domain->lock);
+
+	list_for_each_entry(io_domain, &xen_domain->contexts, list) {
+		/* See arm_smmu_iotlb_flush_all() */
+		if (unlikely(!ACCESS_ONCE(to_smmu_domain(io_domain)->smmu)))
+			continue;
+
+		arm_smmu_tlb_inv_ranges(to_smmu_domain(io_domain), ranges, nr);
+	}
+
+	spin_unlock(&xen_domain->lock);
+
+	return 0;
+}
+
 static int __must_check arm_smmu_iotlb_flush(struct domain *d, dfn_t dfn,
 				unsigned long page_count, unsigned int flush_flags)
 {
-	return arm_smmu_iotlb_flush_all(d);
+	const struct iommu_flush_range range = {
+		.dfn		= dfn,
+		.page_count	= page_count,
+	};
+
+	if (flush_flags & IOMMU_FLUSHF_all)
+		return arm_smmu_iotlb_flush_all(d);
+
+	return arm_smmu_iotlb_flush_ranges(d, &range, 1, flush_flags);
 }
 
 static struct arm_smmu_device *arm_smmu_get_by_dev(struct device *dev)
@@ -2726,6 +2848,7 @@ static const struct iommu_ops arm_smmu_iommu_ops = {
 	.hwdom_init		= arch_iommu_hwdom_init,
 	.teardown		= arm_smmu_iommu_xen_domain_teardown,
 	.iotlb_flush		= arm_smmu_iotlb_flush,
+	.iotlb_flush_ranges	= arm_smmu_iotlb_flush_ranges,
 	.assign_device		= arm_smmu_assign_dev,
 	.reassign_device	= arm_smmu_reassign_dev,
 	.map_page		= arm_iommu_map_page,
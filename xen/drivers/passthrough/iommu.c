@@ -18,6 +18,7 @@
 #include <xen/guest_access.h>
 #include <xen/event.h>
 #include <xen/param.h>
+#include <xen/perfc.h>
 #include <xen/softirq.h>
 #include <xen/keyhandler.h>
 #include <xsm/xsm.h>
@@ -61,6 +62,16 @@ bool_t __read_mostly iommu_debug;
 
 DEFINE_PER_CPU(bool_t, iommu_dont_flush_iotlb);
 
+#define IOTLB_BATCH_RANGES 16
+
+struct iotlb_batch {
+    struct domain *d;
+    unsigned int flush_flags;
+    unsigned int nr;
+    struct iommu_flush_range range[IOTLB_BATCH_RANGES];
+};
+static DEFINE_PER_CPU(struct iotlb_batch, iotlb_batch);
+
 static int __init cf_check parse_iommu_param(const char *s)
 {
     const char *ss;
@@ -473,10 +484,109 @@ int iommu_lookup_page(struct domain *d, dfn_t dfn, mfn_t *mfn,
     return iommu_call(hd->platform_ops, lookup_page, d, dfn, mfn, flags);
 }
 
+/* Record a range in the batch, returning false if there's no room left. */
+static bool iotlb_batch_add(struct iotlb_batch *batch, dfn_t dfn,
+                            unsigned long page_count)
+{
+    unsigned long s = dfn_x(dfn), e = s + page_count;
+    unsigned int i;
+
+    for ( i = 0; i < batch->nr; i++ )
+    {
+        struct iommu_flush_range *r = &batch->range[i];
+        unsigned long rs = dfn_x(r->dfn), re = rs + r->page_count;
+
+        if ( s <= re && rs <= e )
+        {
+            r->dfn = _dfn(min(s, rs));
+            r->page_count = max(e, re) - dfn_x(r->dfn);
+            return true;
+        }
+    }
+
+    if ( batch->nr == ARRAY_SIZE(batch->range) )
+        return false;
+
+    batch->range[batch->nr].dfn = dfn;
+    batch->range[batch->nr++].page_count = page_count;
+
+    return true;
+}
+
+static int iotlb_batch_issue(struct iotlb_batch *batch)
+{
+    struct domain *d = batch->d;
+    const struct domain_iommu *hd = dom_iommu(d);
+    unsigned int i, nr = batch->nr, flush_flags = batch->flush_flags;
+    int rc = 0;
+
+    batch->nr = 0;
+    batch->flush_flags = 0;
+
+    if ( !nr )
+        return 0;
+
+    perfc_incr(iommu_iotlb_batch_flush);
+
+    if ( nr > 1 && hd->platform_ops->iotlb_flush_ranges )
+        rc = iommu_call(hd->platform_ops, iotlb_flush_ranges, d, batch->range,
+                        nr, flush_flags);
+    else
+        for ( i = 0; i < nr && !rc; i++ )
+            rc = iommu_call(hd->platform_ops, iotlb_flush, d,
+                            batch->range[i].dfn, batch->range[i].page_count,
+                            flush_flags);
+
+    if ( unlikely(rc) )
+    {
+        if ( !d->is_shutting_down && printk_ratelimit() )
+            printk(XENLOG_ERR
+                   "d%d: IOMMU IOTLB batch flush failed: %d, %u ranges flags %x\n",
+                   d->domain_id, rc, nr, flush_flags);
+
+        if ( !is_hardware_domain(d) )
+            domain_crash(d);
+    }
+
+    return rc;
+}
+
+void iommu_iotlb_batch_start(struct domain *d)
+{
+    struct iotlb_batch *batch = &this_cpu(iotlb_batch);
+
+    ASSERT(!batch->d);
+
+    if ( is_iommu_enabled(d) && dom_iommu(d)->platform_ops->iotlb_flush )
+        batch->d = d;
+}
+
+int iommu_iotlb_batch_flush(void)
+{
+    struct iotlb_batch *batch = &this_cpu(iotlb_batch);
+
+    return batch->d ? iotlb_batch_issue(batch) : 0;
+}
+
+int iommu_iotlb_batch_end(void)
+{
+    struct iotlb_batch *batch = &this_cpu(iotlb_batch);
+    int rc = 0;
+
+    if ( batch->d )
+    {
+        rc = iotlb_batch_issue(batch);
+        batch->d = NULL;
+    }
+
+    return rc;
+}
+
 int iommu_iotlb_flush(struct domain *d, dfn_t dfn, unsigned long page_count,
                       unsigned int flush_flags)
 {
     const struct domain_iommu *hd = dom_iommu(d);
+    struct iotlb_batch *batch = &this_cpu(iotlb_batch);
     int rc;
 
     if ( !is_iommu_enabled(d) || !hd->platform_ops->iotlb_flush ||
@@ -486,6 +596,22 @@ int iommu_iotlb_flush(struct domain *d, dfn_t dfn, unsigned long page_count,
     if ( dfn_eq(dfn, INVALID_DFN) )
         return -EINVAL;
 
+    if ( batch->d == d && dfn_x(dfn) + page_count > dfn_x(dfn) )
+    {
+        if ( !iotlb_batch_add(batch, dfn, page_count) )
+        {
+            rc = iotlb_batch_issue(batch);
+            if ( rc )
+                return rc;
+
+            iotlb_batch_add(batch, dfn, page_count);
+        }
+        batch->flush_flags |= flush_flags;
+        perfc_incr(iommu_iotlb_batched);
+
+        return 0;
+    }
+
     rc = iommu_call(hd->platform_ops, iotlb_flush, d, dfn, page_count,
                     flush_flags);
     if ( unlikely(rc) )
@@ -505,8 +631,17 @@ int iommu_iotlb_flush(struct domain *d, dfn_t dfn, unsigned long page_count,
 int iommu_iotlb_flush_all(struct domain *d, unsigned int flush_flags)
 {
     const struct domain_iommu *hd = dom_iommu(d);
+    struct iotlb_batch *batch = &this_cpu(iotlb_batch);
     int rc;
 
+    /* A full flush covers whatever the batch has recorded. */
+    if ( batch->d == d )
+    {
+        flush_flags |= batch->flush_flags;
+        batch->nr = 0;
+        batch->flush_flags = 0;
+    }
+
     if ( !is_iommu_enabled(d) || !hd->platform_ops->iotlb_flush ||
          !flush_flags )
         return 0;
@@ -75,6 +75,10 @@ int dev_invalidate_iotlb(struct vtd_iommu *iommu, u16 did,
 int __must_check qinval_device_iotlb_sync(struct vtd_iommu *iommu,
                                           struct pci_dev *pdev,
                                           u16 did, u16 size, u64 addr);
+void qinval_device_iotlb(struct vtd_iommu *iommu, const struct pci_dev *pdev,
+                         u16 size, u64 addr);
+int __must_check qinval_device_iotlb_wait(struct vtd_iommu *iommu,
+                                          struct pci_dev *pdev, u16 did);
 
 uint64_t alloc_pgtable_maddr(unsigned long npages, nodeid_t node);
 void free_pgtable_maddr(u64 maddr);
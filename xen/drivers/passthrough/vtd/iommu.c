@@ -725,6 +725,23 @@ static int __must_check iommu_flush_all(void)
     return rc;
 }
 
+/* Flush a DFN range, with the smallest PSI flush covering it if possible. */
+static int __must_check iommu_flush_iotlb_range(struct vtd_iommu *iommu,
+                                                u16 did, dfn_t dfn,
+                                                unsigned long page_count,
+                                                unsigned int flush_flags,
+                                                bool flush_dev_iotlb)
+{
+    if ( !page_count || (page_count & (page_count - 1)) ||
+         dfn_eq(dfn, INVALID_DFN) || !IS_ALIGNED(dfn_x(dfn), page_count) )
+        return iommu_flush_iotlb_dsi(iommu, did, 0, flush_dev_iotlb);
+
+    return iommu_flush_iotlb_psi(iommu, did, dfn_to_daddr(dfn),
+                                 get_order_from_pages(page_count),
+                                 !(flush_flags & IOMMU_FLUSHF_modified),
+                                 flush_dev_iotlb);
+}
+
 static int __must_check cf_check iommu_flush_iotlb(struct domain *d, dfn_t dfn,
                                                    unsigned long page_count,
                                                    unsigned int flush_flags)
@@ -765,16 +782,70 @@ static int __must_check cf_check iommu_flush_iotlb(struct domain *d, dfn_t dfn,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( !page_count || (page_count & (page_count - 1)) ||
-             dfn_eq(dfn, INVALID_DFN) || !IS_ALIGNED(dfn_x(dfn), page_count) )
-            rc = iommu_flush_iotlb_dsi(iommu, iommu_domid,
-                                       0, flush_dev_iotlb);
+        rc = iommu_flush_iotlb_range(iommu, iommu_domid, dfn, page_count,
+                                     flush_flags, flush_dev_iotlb);
+
+        if ( rc > 0 )
+            iommu_flush_write_buffer(iommu);
+        else if ( !ret )
+            ret = rc;
+    }
+
+    return ret;
+}
+
+static int __must_check cf_check iommu_flush_iotlb_ranges(
+    struct domain *d, const struct iommu_flush_range *ranges,
+    unsigned int nr, unsigned int flush_flags)
+{
+    struct domain_iommu *hd = dom_iommu(d);
+    struct acpi_drhd_unit *drhd;
+    struct vtd_iommu *iommu;
+    bool flush_dev_iotlb;
+    int iommu_domid;
+    int ret = 0;
+
+    ASSERT(nr && flush_flags && !(flush_flags & IOMMU_FLUSHF_all));
+
+    for_each_drhd_unit ( drhd )
+    {
+        unsigned int i;
+        int rc = 0;
+
+        iommu = drhd->iommu;
+
+        if ( !test_bit(iommu->index, hd->arch.vtd.iommu_bitmap) )
+            continue;
+
+        flush_dev_iotlb = !!find_ats_dev_drhd(iommu);
+        iommu_domid = get_iommu_did(d->domain_id, iommu, !d->is_dying);
+        if ( iommu_domid == -1 )
+            continue;
+
+        if ( iommu->flush.iotlb_ranges && cap_pgsel_inv(iommu->cap) )
+        {
+            vtd_ops_preamble_quirk(iommu);
+            rc = iommu->flush.iotlb_ranges(iommu, iommu_domid, ranges, nr,
+                                           !(flush_flags &
+                                             IOMMU_FLUSHF_modified),
+                                           flush_dev_iotlb);
+            vtd_ops_postamble_quirk(iommu);
+        }
         else
-            rc = iommu_flush_iotlb_psi(iommu, iommu_domid,
-                                       dfn_to_daddr(dfn),
-                                       get_order_from_pages(page_count),
-                                       !(flush_flags & IOMMU_FLUSHF_modified),
-                                       flush_dev_iotlb);
+            for ( i = 0; i < nr; i++ )
+            {
+                rc = iommu_flush_iotlb_range(iommu, iommu_domid,
+                                             ranges[i].dfn,
+                                             ranges[i].page_count,
+                                             flush_flags, flush_dev_iotlb);
+                if ( rc < 0 )
+                    break;
+                if ( rc > 0 )
+                {
+                    iommu_flush_write_buffer(iommu);
+                    rc = 0;
+                }
+            }
 
         if ( rc > 0 )
             iommu_flush_write_buffer(iommu);
@@ -3249,6 +3320,7 @@ static const struct iommu_ops __initconst_cf_clobber vtd_ops = {
     .resume = vtd_resume,
     .crash_shutdown = vtd_crash_shutdown,
     .iotlb_flush = iommu_flush_iotlb,
+    .iotlb_flush_ranges = iommu_flush_iotlb_ranges,
     .get_reserved_device_memory = intel_iommu_get_reserved_device_memory,
     .dump_page_tables = vtd_dump_page_tables,
 };
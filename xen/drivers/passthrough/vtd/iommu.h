@@ -503,6 +503,12 @@ struct vtd_iommu {
                                   unsigned int size_order, u64 type,
                                   bool flush_non_present_entry,
                                   bool flush_dev_iotlb);
+        /* Optional: PSI flushes of several ranges, with a single wait. */
+        int __must_check (*iotlb_ranges)(struct vtd_iommu *iommu, u16 did,
+                                         const struct iommu_flush_range *ranges,
+                                         unsigned int nr,
+                                         bool flush_non_present_entry,
+                                         bool flush_dev_iotlb);
     } flush;
 
     struct list_head ats_devices;
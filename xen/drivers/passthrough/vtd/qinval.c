@@ -116,10 +116,9 @@ static int __must_check queue_invalidate_context_sync(struct vtd_iommu *iommu,
     return invalidate_sync(iommu);
 }
 
-static int __must_check queue_invalidate_iotlb_sync(struct vtd_iommu *iommu,
-                                                    u8 granu, u8 dr, u8 dw,
-                                                    u16 did, u8 am, u8 ih,
-                                                    u64 addr)
+static void queue_invalidate_iotlb(struct vtd_iommu *iommu,
+                                   u8 granu, u8 dr, u8 dw,
+                                   u16 did, u8 am, u8 ih, u64 addr)
 {
     unsigned long flags;
     unsigned int index;
@@ -146,6 +145,14 @@ static int __must_check queue_invalidate_iotlb_sync(struct vtd_iommu *iommu,
     spin_unlock_irqrestore(&iommu->register_lock, flags);
 
     unmap_vtd_domain_page(qinval_entry);
+}
+
+static int __must_check queue_invalidate_iotlb_sync(struct vtd_iommu *iommu,
+                                                    u8 granu, u8 dr, u8 dw,
+                                                    u16 did, u8 am, u8 ih,
+                                                    u64 addr)
+{
+    queue_invalidate_iotlb(iommu, granu, dr, dw, did, am, ih, addr);
 
     return invalidate_sync(iommu);
 }
@@ -220,14 +227,19 @@ static int __must_check invalidate_sync(struct vtd_iommu *iommu)
     return queue_invalidate_wait(iommu, 0, 1, 1, 0);
 }
 
-static int __must_check dev_invalidate_sync(struct vtd_iommu *iommu,
-                                            struct pci_dev *pdev, u16 did)
+/*
+ * Wait for all previously queued device IOTLB invalidations.  @pdev names the
+ * device to blame for a timeout; it may be NULL when invalidations for several
+ * devices were queued, in which case the caller has to identify the culprit.
+ */
+int qinval_device_iotlb_wait(struct vtd_iommu *iommu, struct pci_dev *pdev,
+                             u16 did)
 {
     int rc;
 
     ASSERT(iommu->qinval_maddr);
     rc = queue_invalidate_wait(iommu, 0, 1, 1, 1);
-    if ( rc == -ETIMEDOUT && !pdev->broken )
+    if ( rc == -ETIMEDOUT && pdev && !pdev->broken )
     {
         struct domain *d = rcu_lock_domain_by_id(did_to_domain_id(iommu, did));
 
@@ -241,7 +253,7 @@ static int __must_check dev_invalidate_sync(struct vtd_iommu *iommu,
         iommu_dev_iotlb_flush_timeout(d, pdev);
         rcu_unlock_domain(d);
     }
-    else if ( rc == -ETIMEDOUT )
+    else if ( rc == -ETIMEDOUT && pdev )
         /*
          * The device is already marked as broken, ignore the error in order to
          * allow {de,}assign to succeed.
@@ -251,8 +263,8 @@ static int __must_check dev_invalidate_sync(struct vtd_iommu *iommu,
     return rc;
 }
 
-int qinval_device_iotlb_sync(struct vtd_iommu *iommu, struct pci_dev *pdev,
-                             u16 did, u16 size, u64 addr)
+void qinval_device_iotlb(struct vtd_iommu *iommu, const struct pci_dev *pdev,
+                         u16 size, u64 addr)
 {
     unsigned long flags;
     unsigned int index;
@@ -278,8 +290,14 @@ int qinval_device_iotlb_sync(struct vtd_iommu *iommu, struct pci_dev *pdev,
     spin_unlock_irqrestore(&iommu->register_lock, flags);
 
     unmap_vtd_domain_page(qinval_entry);
+}
+
+int qinval_device_iotlb_sync(struct vtd_iommu *iommu, struct pci_dev *pdev,
+                             u16 did, u16 size, u64 addr)
+{
+    qinval_device_iotlb(iommu, pdev, size, addr);
 
-    return dev_invalidate_sync(iommu, pdev, did);
+    return qinval_device_iotlb_wait(iommu, pdev, did);
 }
 
 static int __must_check queue_invalidate_iec_sync(struct vtd_iommu *iommu,
@@ -389,6 +407,66 @@ static int __must_check cf_check flush_iotlb_qi(
     return ret;
 }
 
+/* Smallest naturally aligned block (as an order) covering a DFN range. */
+static unsigned int range_order(const struct iommu_flush_range *range,
+                                daddr_t *addr)
+{
+    unsigned long s = dfn_x(range->dfn), e = s + range->page_count - 1;
+    unsigned int order = 0;
+
+    while ( (s >> order) != (e >> order) )
+        order++;
+
+    *addr = __dfn_to_daddr(s & ~((1UL << order) - 1));
+
+    return order;
+}
+
+/*
+ * Queue one PSI descriptor per range and wait for all of them at once.
+ * Should a range need a block larger than the hardware can invalidate, a
+ * single DSI flush covers the whole batch instead.
+ */
+static int __must_check cf_check flush_iotlb_ranges_qi(
+    struct vtd_iommu *iommu, u16 did, const struct iommu_flush_range *ranges,
+    unsigned int nr, bool flush_non_present_entry, bool flush_dev_iotlb)
+{
+    u8 dr = cap_read_drain(iommu->cap), dw = cap_write_drain(iommu->cap);
+    unsigned int i, order;
+    daddr_t addr;
+    int ret, rc;
+
+    ASSERT(iommu->qinval_maddr);
+
+    if ( flush_non_present_entry && !cap_caching_mode(iommu->cap) )
+        return 1;
+
+    for ( i = 0; i < nr; i++ )
+        if ( range_order(&ranges[i], &addr) > cap_max_amask_val(iommu->cap) )
+            return flush_iotlb_qi(iommu, did, 0, 0, DMA_TLB_DSI_FLUSH,
+                                  flush_non_present_entry, flush_dev_iotlb);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        order = range_order(&ranges[i], &addr);
+        queue_invalidate_iotlb(iommu,
+                               DMA_TLB_PSI_FLUSH >> DMA_TLB_FLUSH_GRANU_OFFSET,
+                               dr, dw, did, order, 0, addr);
+    }
+
+    ret = invalidate_sync(iommu);
+
+    for ( i = 0; flush_dev_iotlb && i < nr; i++ )
+    {
+        order = range_order(&ranges[i], &addr);
+        rc = dev_invalidate_iotlb(iommu, did, addr, order, DMA_TLB_PSI_FLUSH);
+        if ( !ret )
+            ret = rc;
+    }
+
+    return ret;
+}
+
 int enable_qinval(struct vtd_iommu *iommu)
 {
     u32 sts;
@@ -437,6 +515,7 @@ int enable_qinval(struct vtd_iommu *iommu)
 
     iommu->flush.context = flush_context_qi;
     iommu->flush.iotlb   = flush_iotlb_qi;
+    iommu->flush.iotlb_ranges = flush_iotlb_ranges_qi;
 
     spin_lock_irqsave(&iommu->register_lock, flags);
 
@@ -507,6 +586,7 @@ out:
      * Assign callbacks to noop to catch errors if register-based invalidation
      * isn't supported.
      */
+    iommu->flush.iotlb_ranges = NULL;
     if ( has_register_based_invalidation(iommu) )
     {
         iommu->flush.context = vtd_flush_context_reg;
@@ -71,96 +71,142 @@ int ats_device(const struct pci_dev *pdev, const struct acpi_drhd_unit *drhd)
     return pos;
 }
 
-static bool device_in_domain(const struct vtd_iommu *iommu,
+static bool device_in_domain(const struct root_entry *root_entry,
                              const struct pci_dev *pdev, uint16_t did)
 {
-    struct root_entry *root_entry;
-    struct context_entry *ctxt_entry = NULL;
-    unsigned int tt;
-    bool found = false;
+    struct context_entry *ctxt_entry;
+    bool found;
 
-    if ( unlikely(!iommu->root_maddr) )
-    {
-        ASSERT_UNREACHABLE();
-        return false;
-    }
-
-    root_entry = map_vtd_domain_page(iommu->root_maddr);
     if ( !root_present(root_entry[pdev->bus]) )
-        goto out;
+        return false;
 
     ctxt_entry = map_vtd_domain_page(root_entry[pdev->bus].val);
-    if ( context_domain_id(ctxt_entry[pdev->devfn]) != did )
-        goto out;
+    found = context_domain_id(ctxt_entry[pdev->devfn]) == did &&
+            context_translation_type(ctxt_entry[pdev->devfn]) ==
+            CONTEXT_TT_DEV_IOTLB;
+    unmap_vtd_domain_page(ctxt_entry);
 
-    tt = context_translation_type(ctxt_entry[pdev->devfn]);
-    if ( tt != CONTEXT_TT_DEV_IOTLB )
-        goto out;
+    return found;
+}
 
-    found = true;
-out:
-    if ( root_entry )
-        unmap_vtd_domain_page(root_entry);
+/*
+ * Work out the device IOTLB invalidation @pdev needs for a flush of the given
+ * type.  Returns false if the device can't hold translations for @did.
+ */
+static bool dev_iotlb_inval(const struct root_entry *root_entry,
+                            const struct pci_dev *pdev, u16 did, u64 type,
+                            u64 addr, unsigned int size_order,
+                            bool *sbit, u64 *inval_addr)
+{
+    switch ( type )
+    {
+    case DMA_TLB_DSI_FLUSH:
+        if ( !device_in_domain(root_entry, pdev, did) )
+            return false;
+        /* fall through if DSI condition met */
+    case DMA_TLB_GLOBAL_FLUSH:
+        /* invalidate all translations: sbit=1,bit_63=0,bit[62:12]=1 */
+        *sbit = true;
+        *inval_addr = (~0UL << PAGE_SHIFT_4K) & 0x7FFFFFFFFFFFFFFF;
+        return true;
+
+    case DMA_TLB_PSI_FLUSH:
+        if ( !device_in_domain(root_entry, pdev, did) )
+            return false;
+
+        /* if size <= 4K, set sbit = 0, else set sbit = 1 */
+        *sbit = size_order;
+
+        /* clear lower bits */
+        addr &= ~0UL << PAGE_SHIFT_4K;
+
+        /* if sbit == 1, zero out size_order bit and set lower bits to 1 */
+        if ( *sbit )
+        {
+            addr &= ~((u64)PAGE_SIZE_4K << (size_order - 1));
+            addr |= (((u64)1 << (size_order - 1)) - 1) << PAGE_SHIFT_4K;
+        }
 
-    if ( ctxt_entry )
-        unmap_vtd_domain_page(ctxt_entry);
+        *inval_addr = addr;
+        return true;
+    }
 
-    return found;
+    ASSERT_UNREACHABLE();
+    return false;
 }
 
+/*
+ * Invalidations for all affected devices are queued first and waited for
+ * once, so that the (potentially long) device round trips overlap rather
+ * than being serialized.  Only if that wait times out are the invalidations
+ * re-issued one device at a time, to find out which device is to blame.
+ */
 int dev_invalidate_iotlb(struct vtd_iommu *iommu, u16 did,
     u64 addr, unsigned int size_order, u64 type)
 {
-    struct pci_dev *pdev, *temp;
-    int ret = 0;
+    struct root_entry *root_entry;
+    struct pci_dev *pdev, *temp, *last = NULL;
+    unsigned int queued = 0;
+    u64 inval_addr;
+    bool sbit;
+    int ret;
+
+    if ( !ecap_dev_iotlb(iommu->ecap) || list_empty(&iommu->ats_devices) )
+        return 0;
 
-    if ( !ecap_dev_iotlb(iommu->ecap) )
-        return ret;
+    switch ( type )
+    {
+    case DMA_TLB_GLOBAL_FLUSH:
+    case DMA_TLB_DSI_FLUSH:
+    case DMA_TLB_PSI_FLUSH:
+        break;
+
+    default:
+        dprintk(XENLOG_WARNING VTDPREFIX, "invalid vt-d flush type\n");
+        return -EOPNOTSUPP;
+    }
 
-    list_for_each_entry_safe( pdev, temp, &iommu->ats_devices, ats.list )
+    if ( unlikely(!iommu->root_maddr) )
     {
-        bool_t sbit;
-        int rc = 0;
+        ASSERT_UNREACHABLE();
+        return 0;
+    }
+
+    root_entry = map_vtd_domain_page(iommu->root_maddr);
 
-        switch ( type )
+    list_for_each_entry ( pdev, &iommu->ats_devices, ats.list )
+    {
+        if ( !dev_iotlb_inval(root_entry, pdev, did, type, addr, size_order,
+                              &sbit, &inval_addr) )
+            continue;
+
+        qinval_device_iotlb(iommu, pdev, sbit, inval_addr);
+        last = pdev;
+        ++queued;
+    }
+
+    ret = queued ? qinval_device_iotlb_wait(iommu, queued == 1 ? last : NULL,
+                                            did)
+                 : 0;
+
+    if ( ret == -ETIMEDOUT && queued > 1 )
+    {
+        ret = 0;
+        list_for_each_entry_safe ( pdev, temp, &iommu->ats_devices, ats.list )
         {
-        case DMA_TLB_DSI_FLUSH:
-            if ( !device_in_domain(iommu, pdev, did) )
-                break;
-            /* fall through if DSI condition met */
-        case DMA_TLB_GLOBAL_FLUSH:
-            /* invalidate all translations: sbit=1,bit_63=0,bit[62:12]=1 */
-            sbit = 1;
-            addr = (~0UL << PAGE_SHIFT_4K) & 0x7FFFFFFFFFFFFFFF;
-            rc = qinval_device_iotlb_sync(iommu, pdev, did, sbit, addr);
-            break;
-        case DMA_TLB_PSI_FLUSH:
-            if ( !device_in_domain(iommu, pdev, did) )
-                break;
-
-            /* if size <= 4K, set sbit = 0, else set sbit = 1 */
-            sbit = size_order ? 1 : 0;
-
-            /* clear lower bits */
-            addr &= ~0UL << PAGE_SHIFT_4K;
-
-            /* if sbit == 1, zero out size_order bit and set lower bits to 1 */
-            if ( sbit )
-            {
-                addr &= ~((u64)PAGE_SIZE_4K << (size_order - 1));
-                addr |= (((u64)1 << (size_order - 1)) - 1) << PAGE_SHIFT_4K;
-            }
-
-            rc = qinval_device_iotlb_sync(iommu, pdev, did, sbit, addr);
-            break;
-        default:
-            dprintk(XENLOG_WARNING VTDPREFIX, "invalid vt-d flush type\n");
-            return -EOPNOTSUPP;
-        }
+            int rc;
+
+            if ( !dev_iotlb_inval(root_entry, pdev, did, type, addr,
+                                  size_order, &sbit, &inval_addr) )
+                continue;
 
-        if ( !ret )
-            ret = rc;
+            rc = qinval_device_iotlb_sync(iommu, pdev, did, sbit, inval_addr);
+            if ( !ret )
+                ret = rc;
+        }
     }
 
+    unmap_vtd_domain_page(root_entry);
+
     return ret;
 }
@@ -22,6 +22,8 @@
 #include <xen/iommu.h>
 #include <xen/cpu.h>
 #include <xen/irq.h>
+#include <xen/param.h>
+#include <xen/perfc.h>
 #include <asm/hvm/irq.h>
 #include <asm/io_apic.h>
 
@@ -39,6 +41,9 @@ static inline struct hvm_pirq_dpci *_pirq_dpci(struct pirq *pirq)
 
 static DEFINE_PER_CPU(struct list_head, dpci_list);
 
+unsigned int __read_mostly opt_pt_irq_hysteresis = 4;
+integer_param("pt-irq-hysteresis", opt_pt_irq_hysteresis);
+
 /*
  * These two bit states help to safely schedule, deschedule, and wait until
  * the softirq has finished.
@@ -294,6 +299,10 @@ int pt_irq_create_bind(
                                HVM_IRQ_DPCI_GUEST_MSI;
             pirq_dpci->gmsi.gvec = pt_irq_bind->u.msi.gvec;
             pirq_dpci->gmsi.gflags = gflags;
+            pirq_dpci->gmsi.misses = 0;
+            pirq_dpci->gmsi.nr_delivered = 0;
+            pirq_dpci->gmsi.latency_total = 0;
+            pirq_dpci->gmsi.latency_max = 0;
             /*
              * 'pt_irq_create_bind' can be called after 'pt_irq_destroy_bind'.
              * The 'pirq_cleanup_check' which would free the structure is only
@@ -754,6 +763,80 @@ int pt_pirq_iterate(struct domain *d,
     return rc;
 }
 
+/*
+ * Keep non-posted MSIs targeted at the pCPU their destination vCPU runs on.
+ * Rather than re-targeting upon every vCPU migration (and rewriting the
+ * MSI message or IRTE each time), this is done once enough consecutive
+ * interrupts arrived elsewhere, so that vCPUs moving around briefly don't
+ * cause churn.  Called with the IRQ descriptor locked.
+ */
+static void pt_msi_steer(const struct domain *d, const struct pirq *pirq,
+                         struct hvm_pirq_dpci *pirq_dpci)
+{
+    const struct vcpu *v;
+    unsigned int cpu;
+
+    pirq_dpci->gmsi.raised = NOW();
+
+    if ( !opt_pt_irq_hysteresis || pirq_dpci->gmsi.posted ||
+         pirq_dpci->gmsi.dest_vcpu_id < 0 )
+        return;
+
+    v = d->vcpu[pirq_dpci->gmsi.dest_vcpu_id];
+    cpu = read_atomic(&v->processor);
+    if ( cpu == smp_processor_id() )
+    {
+        pirq_dpci->gmsi.misses = 0;
+        return;
+    }
+
+    if ( ++pirq_dpci->gmsi.misses < opt_pt_irq_hysteresis )
+        return;
+
+    pirq_dpci->gmsi.misses = 0;
+    irq_set_affinity(irq_to_desc(pirq->arch.irq), cpumask_of(cpu));
+    perfc_incr(pt_irq_steered);
+}
+
+/* Account the latency from interrupt arrival to injection into the guest. */
+static void pt_msi_account(struct hvm_pirq_dpci *pirq_dpci)
+{
+    s_time_t latency = NOW() - pirq_dpci->gmsi.raised;
+
+    pirq_dpci->gmsi.nr_delivered++;
+    pirq_dpci->gmsi.latency_total += latency;
+    if ( latency > pirq_dpci->gmsi.latency_max )
+        pirq_dpci->gmsi.latency_max = latency;
+}
+
+static int cf_check dump_pirq_stats(
+    struct domain *d, struct hvm_pirq_dpci *pirq_dpci, void *arg)
+{
+    const struct hvm_gmsi_info *gmsi = &pirq_dpci->gmsi;
+
+    if ( !(pirq_dpci->flags & HVM_IRQ_DPCI_GUEST_MSI) || !gmsi->nr_delivered )
+        return 0;
+
+    printk("  pirq %3d vec %02x vcpu %d%s: %lu delivered, "
+           "latency avg %"PRI_stime"ns max %"PRI_stime"ns\n",
+           dpci_pirq(pirq_dpci)->pirq, gmsi->gvec, gmsi->dest_vcpu_id,
+           gmsi->posted ? " (posted)" : "", gmsi->nr_delivered,
+           gmsi->latency_total / gmsi->nr_delivered, gmsi->latency_max);
+
+    return 0;
+}
+
+void pt_pirq_dump_stats(struct domain *d)
+{
+    if ( !is_iommu_enabled(d) ||
+         (!hvm_domain_irq(d)->dpci && !is_hardware_domain(d)) )
+        return;
+
+    read_lock(&d->event_lock);
+    pt_pirq_iterate(d, dump_pirq_stats, NULL);
+    read_unlock(&d->event_lock);
+}
+
 int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
 {
     struct hvm_irq_dpci *dpci = domain_get_irq_dpci(d);
@@ -765,6 +848,9 @@ int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
          !pirq_dpci || !(pirq_dpci->flags & HVM_IRQ_DPCI_MAPPED) )
         return 0;
 
+    if ( pirq_dpci->flags & HVM_IRQ_DPCI_MACH_MSI )
+        pt_msi_steer(d, pirq, pirq_dpci);
+
     pirq_dpci->masked = 1;
     raise_softirq_for(pirq_dpci);
     return 1;
@@ -847,6 +933,7 @@ static void hvm_dirq_assist(struct domain *d, struct hvm_pirq_dpci *pirq_dpci)
         if ( pirq_dpci->flags & HVM_IRQ_DPCI_GUEST_MSI )
         {
             vmsi_deliver_pirq(d, pirq_dpci);
+            pt_msi_account(pirq_dpci);
             goto out;
         }
 
@@ -17,12 +17,14 @@
 #include <xen/iocap.h>
 #include <xen/iommu.h>
 #include <xen/paging.h>
+#include <xen/param.h>
 #include <xen/guest_access.h>
 #include <xen/event.h>
 #include <xen/softirq.h>
 #include <xen/vm_event.h>
 #include <xsm/xsm.h>
 
+#include <asm/e820.h>
 #include <asm/hvm/io.h>
 #include <asm/io_apic.h>
 #include <asm/mem_paging.h>
@@ -183,6 +185,13 @@ void __hwdom_init arch_iommu_check_autotranslated_hwdom(struct domain *d)
         panic("PVH hardware domain iommu must be set in 'strict' mode\n");
 }
 
+/* Number of page table pages each domain keeps in reserve. */
+static unsigned int __read_mostly opt_iommu_pt_pool = 64;
+integer_param("iommu-pt-pool", opt_iommu_pt_pool);
+
+static void cf_check pgtable_pool_refill(void *arg);
+static void pgtable_pool_drain(struct domain_iommu *hd);
+
 int arch_iommu_domain_init(struct domain *d)
 {
     struct domain_iommu *hd = dom_iommu(d);
@@ -191,6 +200,8 @@ int arch_iommu_domain_init(struct domain *d)
 
     INIT_PAGE_LIST_HEAD(&hd->arch.pgtables.list);
     spin_lock_init(&hd->arch.pgtables.lock);
+    INIT_PAGE_LIST_HEAD(&hd->arch.pgtables.pool);
+    tasklet_init(&hd->arch.pgtables.refill, pgtable_pool_refill, hd);
     INIT_LIST_HEAD(&hd->arch.identity_maps);
 
     return 0;
@@ -198,13 +209,17 @@ int arch_iommu_domain_init(struct domain *d)
 
 void arch_iommu_domain_destroy(struct domain *d)
 {
+    struct domain_iommu *hd = dom_iommu(d);
+
     /*
      * There should be not page-tables left allocated by the time the
      * domain is destroyed. Note that arch_iommu_domain_destroy() is
      * called unconditionally, so pgtables may be uninitialized.
      */
-    ASSERT(!dom_iommu(d)->platform_ops ||
-           page_list_empty(&dom_iommu(d)->arch.pgtables.list));
+    ASSERT(!hd->platform_ops || page_list_empty(&hd->arch.pgtables.list));
+
+    if ( hd->platform_ops )
+        pgtable_pool_drain(hd);
 }
 
 struct identity_map {
@@ -370,6 +385,67 @@ static unsigned int __hwdom_init hwdom_iommu_map(const struct domain *d,
     return perms;
 }
 
+/*
+ * If @pfn is fully covered by a RAM region of the (sanitized, hence
+ * non-overlapping) E820 map, return the first pfn past that region's last
+ * full page.  Return 0 otherwise.
+ */
+static unsigned long __hwdom_init hwdom_ram_end(unsigned long pfn)
+{
+    paddr_t maddr = pfn_to_paddr(pfn);
+    unsigned int i;
+
+    for ( i = 0; i < e820.nr_map; i++ )
+    {
+        const struct e820entry *e = &e820.map[i];
+
+        if ( e->type == E820_RAM && maddr >= e->addr &&
+             maddr + PAGE_SIZE <= e->addr + e->size )
+            return PFN_DOWN(e->addr + e->size);
+    }
+
+    return 0;
+}
+
+/*
+ * Identity map [start, start + count) in the p2m of a translated hardware
+ * domain, using the largest page sizes alignment permits.
+ */
+static void __hwdom_init hwdom_identity_map(struct domain *d,
+                                            unsigned long start,
+                                            unsigned long count,
+                                            unsigned int perms)
+{
+    p2m_access_t a = perms & IOMMUF_writable ? p2m_access_rw : p2m_access_r;
+
+    while ( count )
+    {
+        unsigned int order = PAGE_ORDER_4K;
+        int rc;
+
+        if ( !(start & ((1UL << PAGE_ORDER_1G) - 1)) &&
+             count >= (1UL << PAGE_ORDER_1G) )
+            order = PAGE_ORDER_1G;
+        else if ( !(start & ((1UL << PAGE_ORDER_2M) - 1)) &&
+                  count >= (1UL << PAGE_ORDER_2M) )
+            order = PAGE_ORDER_2M;
+
+        /* A positive return value asks for a retry with a smaller order. */
+        while ( (rc = p2m_add_identity_entry(d, start, order, a, 0)) > 0 )
+            order = rc - 1;
+
+        if ( rc )
+            printk(XENLOG_WARNING
+                   "%pd: identity mapping of [%lx,%lx) failed: %d\n",
+                   d, start, start + (1UL << order), rc);
+
+        start += 1UL << order;
+        count -= 1UL << order;
+
+        process_pending_softirqs();
+    }
+}
+
 void __hwdom_init arch_iommu_hwdom_init(struct domain *d)
 {
     unsigned long i, top, max_pfn, start, count;
@@ -412,37 +488,38 @@ void __hwdom_init arch_iommu_hwdom_init(struct domain *d)
         unsigned int perms = hwdom_iommu_map(d, pfn, max_pfn);
 
         if ( !perms )
-            /* nothing */;
-        else if ( paging_mode_translate(d) )
         {
-            int rc;
-
-            rc = p2m_add_identity_entry(d, pfn,
-                                        perms & IOMMUF_writable ? p2m_access_rw
-                                                                : p2m_access_r,
-                                        0);
-            if ( rc )
-                printk(XENLOG_WARNING
-                       "%pd: identity mapping of %lx failed: %d\n",
-                       d, pfn, rc);
+            /*
+             * Conventional RAM is never mapped here in strict mode: skip
+             * whole E820 RAM regions rather than checking every page.
+             */
+            unsigned long end = iommu_hwdom_strict ? hwdom_ram_end(pfn) : 0;
+
+            if ( end > pfn + 1 )
+                i = min(pfn_to_pdx(end - 1), top - 1);
         }
         else if ( pfn != start + count || perms != start_perms )
         {
             long rc;
 
         commit:
-            while ( (rc = iommu_map(d, _dfn(start), _mfn(start), count,
-                                    start_perms | IOMMUF_preempt,
-                                    &flush_flags)) > 0 )
+            if ( paging_mode_translate(d) )
+                hwdom_identity_map(d, start, count, start_perms);
+            else
             {
-                start += rc;
-                count -= rc;
-                process_pending_softirqs();
+                while ( (rc = iommu_map(d, _dfn(start), _mfn(start), count,
+                                        start_perms | IOMMUF_preempt,
+                                        &flush_flags)) > 0 )
+                {
+                    start += rc;
+                    count -= rc;
+                    process_pending_softirqs();
+                }
+                if ( rc )
+                    printk(XENLOG_WARNING
+                           "%pd: IOMMU identity mapping of [%lx,%lx) failed: %ld\n",
+                           d, start, start + count, rc);
             }
-            if ( rc )
-                printk(XENLOG_WARNING
-                       "%pd: IOMMU identity mapping of [%lx,%lx) failed: %ld\n",
-                       d, start, start + count, rc);
             start = pfn;
             count = 1;
             start_perms = perms;
@@ -540,6 +617,8 @@ int iommu_free_pgtables(struct domain *d)
      */
     iommu_vcall(hd->platform_ops, clear_root_pgtable, d);
 
+    pgtable_pool_drain(hd);
+
     while ( (pg = page_list_remove_head(&hd->arch.pgtables.list)) )
     {
         free_domheap_page(pg);
@@ -551,21 +630,94 @@ int iommu_free_pgtables(struct domain *d)
     return 0;
 }
 
-struct page_info *iommu_alloc_pgtable(struct domain_iommu *hd,
-                                      uint64_t contig_mask)
+static struct page_info *pgtable_alloc_page(const struct domain_iommu *hd)
 {
     unsigned int memflags = 0;
-    struct page_info *pg;
-    uint64_t *p;
 
 #ifdef CONFIG_NUMA
     if ( hd->node != NUMA_NO_NODE )
         memflags = MEMF_node(hd->node);
 #endif
 
-    pg = alloc_domheap_page(NULL, memflags);
+    return alloc_domheap_page(NULL, memflags);
+}
+
+/*
+ * Page table pages are taken from a per-domain reserve where possible, so
+ * that building mappings doesn't stall in the page allocator while holding
+ * the mapping lock.  The reserve is topped up by a tasklet once it drops
+ * below half of its target size.
+ */
+static void cf_check pgtable_pool_refill(void *arg)
+{
+    struct domain_iommu *hd = arg;
+
+    while ( ACCESS_ONCE(hd->arch.pgtables.pool_size) < opt_iommu_pt_pool )
+    {
+        struct page_info *pg = pgtable_alloc_page(hd);
+        void *p;
+
+        if ( !pg )
+            break;
+
+        p = __map_domain_page(pg);
+        clear_page(p);
+        iommu_sync_cache(p, PAGE_SIZE);
+        unmap_domain_page(p);
+
+        spin_lock(&hd->arch.pgtables.lock);
+        page_list_add_tail(pg, &hd->arch.pgtables.pool);
+        hd->arch.pgtables.pool_size++;
+        spin_unlock(&hd->arch.pgtables.lock);
+
+        if ( softirq_pending(smp_processor_id()) )
+        {
+            tasklet_schedule(&hd->arch.pgtables.refill);
+            break;
+        }
+    }
+}
+
+static void pgtable_pool_drain(struct domain_iommu *hd)
+{
+    struct page_info *pg;
+
+    tasklet_kill(&hd->arch.pgtables.refill);
+
+    spin_lock(&hd->arch.pgtables.lock);
+    while ( (pg = page_list_remove_head(&hd->arch.pgtables.pool)) )
+    {
+        hd->arch.pgtables.pool_size--;
+        free_domheap_page(pg);
+    }
+    spin_unlock(&hd->arch.pgtables.lock);
+}
+
+struct page_info *iommu_alloc_pgtable(struct domain_iommu *hd,
+                                      uint64_t contig_mask)
+{
+    struct page_info *pg;
+    uint64_t *p;
+    bool refill;
+
+    spin_lock(&hd->arch.pgtables.lock);
+    pg = page_list_remove_head(&hd->arch.pgtables.pool);
+    if ( pg )
+        hd->arch.pgtables.pool_size--;
+    refill = hd->arch.pgtables.pool_size < opt_iommu_pt_pool / 2;
+    spin_unlock(&hd->arch.pgtables.lock);
+
+    if ( refill )
+        tasklet_schedule(&hd->arch.pgtables.refill);
+
     if ( !pg )
-        return NULL;
+    {
+        pg = pgtable_alloc_page(hd);
+        if ( !pg )
+            return NULL;
+    }
+    else if ( !contig_mask )
+        goto out; /* Already cleared. */
 
     p = __map_domain_page(pg);
 
@@ -596,6 +748,7 @@ struct page_info *iommu_alloc_pgtable(struct domain_iommu *hd,
 
     unmap_domain_page(p);
 
+ out:
     spin_lock(&hd->arch.pgtables.lock);
     page_list_add(pg, &hd->arch.pgtables.list);
     spin_unlock(&hd->arch.pgtables.lock);
@@ -17,6 +17,7 @@
  * License along with this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/iommu.h>
 #include <xen/sched.h>
 #include <xen/softirq.h>
 #include <xen/vpci.h>
@@ -76,6 +77,30 @@ static int cf_check map_range(
     return rc;
 }
 
+/*
+ * Consume the pending ranges.  The IOTLB flushes resulting from the p2m
+ * changes are batched and issued once at the end (or when being preempted),
+ * rather than once per p2m entry.  Removing MMIO mappings doesn't free any
+ * guest memory, so the flushes for unmaps can be deferred as well.
+ */
+static int consume_ranges(struct rangeset *mem, struct map_data *data)
+{
+    int rc;
+
+#ifdef CONFIG_HAS_PASSTHROUGH
+    iommu_iotlb_batch_start(data->d);
+#endif
+
+    rc = rangeset_consume_ranges(mem, map_range, data);
+
+#ifdef CONFIG_HAS_PASSTHROUGH
+    if ( iommu_iotlb_batch_end() && !rc )
+        rc = -EIO;
+#endif
+
+    return rc;
+}
+
 /*
  * The rom_only parameter is used to signal the map/unmap helpers that the ROM
  * BAR's enable bit has changed with the memory decoding bit already enabled.
@@ -147,7 +172,7 @@ bool vpci_process_pending(struct vcpu *v)
             .d = v->domain,
             .map = v->vpci.cmd & PCI_COMMAND_MEMORY,
         };
-        int rc = rangeset_consume_ranges(v->vpci.mem, map_range, &data);
+        int rc = consume_ranges(v->vpci.mem, &data);
 
         if ( rc == -ERESTART )
             return true;
@@ -181,7 +206,7 @@ static int __init apply_map(struct domain *d, const struct pci_dev *pdev,
     struct map_data data = { .d = d, .map = true };
     int rc;
 
-    while ( (rc = rangeset_consume_ranges(mem, map_range, &data)) == -ERESTART )
+    while ( (rc = consume_ranges(mem, &data)) == -ERESTART )
         process_pending_softirqs();
     rangeset_destroy(mem);
     if ( !rc )
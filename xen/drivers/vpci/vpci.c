@@ -38,6 +38,8 @@ extern vpci_register_init_t *const __end_vpci_array[];
 
 void vpci_remove_device(struct pci_dev *pdev)
 {
+    unsigned int i;
+
     if ( !has_vpci(pdev->domain) || !pdev->vpci )
         return;
 
@@ -52,10 +54,10 @@ void vpci_remove_device(struct pci_dev *pdev)
         xfree(r);
     }
     spin_unlock(&pdev->vpci->lock);
+    for ( i = 0; i < ARRAY_SIZE(pdev->vpci->ext_map); i++ )
+        xfree(pdev->vpci->ext_map[i]);
     if ( pdev->vpci->msix )
     {
-        unsigned int i;
-
         list_del(&pdev->vpci->msix->next);
         for ( i = 0; i < ARRAY_SIZE(pdev->vpci->msix->table); i++ )
             if ( pdev->vpci->msix->table[i] )
@@ -115,6 +117,49 @@ static int vpci_register_cmp(const struct vpci_register *r1,
     return 0;
 }
 
+/*
+ * Return the lookup map slot for the dword containing 'reg', or NULL if it
+ * belongs to a chunk of the extended config space without handlers.
+ */
+static struct vpci_register **vpci_map_slot(struct vpci *vpci,
+                                            unsigned int reg)
+{
+    struct vpci_register **chunk;
+
+    if ( reg < PCI_CFG_SPACE_SIZE )
+        return &vpci->map[reg / 4];
+
+    if ( reg >= PCI_CFG_SPACE_EXP_SIZE )
+        return NULL;
+
+    chunk = vpci->ext_map[reg / PCI_CFG_SPACE_SIZE - 1];
+
+    return chunk ? &chunk[(reg / 4) % VPCI_MAP_DWORDS] : NULL;
+}
+
+/*
+ * Find the handler to start the list walk from for an access.  Registers are
+ * naturally aligned and hence never cross a dword boundary, so for accesses
+ * contained in a single dword the walk can start at the first handler of that
+ * dword.  If there's none the list head is returned, so that the walk
+ * terminates immediately.
+ */
+static struct vpci_register *vpci_find_first(struct vpci *vpci,
+                                             unsigned int reg,
+                                             unsigned int size)
+{
+    struct vpci_register **slot;
+
+    if ( (reg & 3) + size > 4 )
+        return list_first_entry(&vpci->handlers, struct vpci_register, node);
+
+    slot = vpci_map_slot(vpci, reg);
+    if ( slot && *slot )
+        return *slot;
+
+    return list_entry(&vpci->handlers, struct vpci_register, node);
+}
+
 /* Dummy hooks, writes are ignored, reads return 1's */
 static uint32_t cf_check vpci_ignored_read(
     const struct pci_dev *pdev, unsigned int reg, void *data)
@@ -144,7 +189,9 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
                       unsigned int size, void *data)
 {
     struct list_head *prev;
-    struct vpci_register *r;
+    struct vpci_register *r, **slot;
+    struct vpci_register **chunk = NULL;
+    unsigned int idx = offset / PCI_CFG_SPACE_SIZE - 1;
 
     /* Some sanity checks. */
     if ( (size != 1 && size != 2 && size != 4) ||
@@ -162,8 +209,24 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
     r->offset = offset;
     r->private = data;
 
+    if ( offset >= PCI_CFG_SPACE_SIZE && !vpci->ext_map[idx] )
+    {
+        chunk = xzalloc_array(struct vpci_register *, VPCI_MAP_DWORDS);
+        if ( !chunk )
+        {
+            xfree(r);
+            return -ENOMEM;
+        }
+    }
+
     spin_lock(&vpci->lock);
 
+    if ( chunk && !vpci->ext_map[idx] )
+    {
+        vpci->ext_map[idx] = chunk;
+        chunk = NULL;
+    }
+
     /* The list of handlers must be kept sorted at all times. */
     list_for_each ( prev, &vpci->handlers )
     {
@@ -176,13 +239,21 @@ int vpci_add_register(struct vpci *vpci, vpci_read_t *read_handler,
         if ( cmp == 0 )
         {
             spin_unlock(&vpci->lock);
+            xfree(chunk);
             xfree(r);
             return -EEXIST;
         }
     }
 
     list_add_tail(&r->node, prev);
+
+    slot = vpci_map_slot(vpci, offset);
+    ASSERT(slot);
+    if ( !*slot || (*slot)->offset > offset )
+        *slot = r;
+
     spin_unlock(&vpci->lock);
+    xfree(chunk);
 
     return 0;
 }
@@ -204,6 +275,21 @@ int vpci_remove_register(struct vpci *vpci, unsigned int offset,
          */
         if ( !cmp && rm->offset == offset && rm->size == size )
         {
+            struct vpci_register **slot = vpci_map_slot(vpci, offset);
+
+            ASSERT(slot);
+            if ( *slot == rm )
+            {
+                struct vpci_register *next = list_next_entry(rm, node);
+
+                /* Handlers in the same dword are adjacent in the list. */
+                if ( &next->node != &vpci->handlers &&
+                     next->offset / 4 == offset / 4 )
+                    *slot = next;
+                else
+                    *slot = NULL;
+            }
+
             list_del(&rm->node);
             spin_unlock(&vpci->lock);
             xfree(rm);
@@ -339,8 +425,10 @@ uint32_t vpci_read(pci_sbdf_t sbdf, unsigned int reg, unsigned int size)
 
     spin_lock(&pdev->vpci->lock);
 
+    r = vpci_find_first(pdev->vpci, reg, size);
+
     /* Read from the hardware or the emulated register handlers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    list_for_each_entry_from ( r, &pdev->vpci->handlers, node )
     {
         const struct vpci_register emu = {
             .offset = reg + data_offset,
@@ -452,8 +540,10 @@ void vpci_write(pci_sbdf_t sbdf, unsigned int reg, unsigned int size,
 
     spin_lock(&pdev->vpci->lock);
 
+    r = vpci_find_first(pdev->vpci, reg, size);
+
     /* Write the value to the hardware or emulated registers. */
-    list_for_each_entry ( r, &pdev->vpci->handlers, node )
+    list_for_each_entry_from ( r, &pdev->vpci->handlers, node )
     {
         const struct vpci_register emu = {
             .offset = reg + data_offset,
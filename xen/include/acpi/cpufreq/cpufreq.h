@@ -23,6 +23,7 @@
 DECLARE_PER_CPU(spinlock_t, cpufreq_statistic_lock);
 
 extern bool_t cpufreq_verbose;
+extern bool cpufreq_opt_hwp;
 
 struct cpufreq_governor;
 
@@ -9,6 +9,11 @@
 
 int powernow_cpufreq_init(void);
 unsigned int powernow_register_driver(void);
+struct domain;
+int hwp_register_driver(void);
+void hwp_cpu_init(void);
+void hwp_context_switch(const struct domain *d);
+extern bool hwp_active;
 unsigned int get_measured_perf(unsigned int cpu, unsigned int flag);
 void cpufreq_residency_update(unsigned int, uint8_t);
 void cpufreq_statistic_update(unsigned int, uint8_t, uint8_t);
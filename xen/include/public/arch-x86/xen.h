@@ -300,11 +300,18 @@ struct xen_arch_domainconfig {
  * doesn't allow the guest to read or write to the underlying MSR.
  */
 #define XEN_X86_MSR_RELAXED (1u << 0)
+/*
+ * Select whether interprocessor interrupts sent by the guest may be delivered
+ * by hardware (IPI virtualisation), without a VM exit on the sending side.
+ * Only HVM guests may request this; it is silently not used when the hardware
+ * lacks support.
+ */
+#define XEN_X86_IPI_VIRT    (1u << 1)
     uint32_t misc_flags;
 };
 
 /* Max  XEN_X86_* constant. Used for ABI checking. */
-#define XEN_X86_MISC_FLAGS_MAX XEN_X86_MSR_RELAXED
+#define XEN_X86_MISC_FLAGS_MAX XEN_X86_IPI_VIRT
 
 #endif
 
@@ -197,6 +197,28 @@ struct xen_domctl_getpageframeinfo3 {
  /* Return the bitmap but do not modify internal copy. */
 #define XEN_DOMCTL_SHADOW_OP_PEEK        12
 
+/*
+ * Per-vCPU dirty rings (HAP only), as an alternative to scanning the whole
+ * log-dirty bitmap on every round.  With rings in place, GFNs dirtied by
+ * (or on behalf of) a vCPU are appended to that vCPU's ring, and only end
+ * up in the bitmap if the ring is full.  Each ring is mapped by the
+ * toolstack through XENMEM_acquire_resource, type XENMEM_resource_dirty_ring
+ * with the vCPU ID as the id.
+ *
+ * The GFNs between a ring's producer and consumer indexes stay writable
+ * until handed back with DIRTY_RING_RESET.  A round hence is:
+ *  1. Read the GFNs from cons up to prod, then set cons to prod.
+ *  2. DIRTY_RING_RESET, re-protecting these GFNs and flushing GFNs cached
+ *     by hardware (e.g. PML buffers) into the rings.
+ *  3. Send the contents of the GFNs read in step 1.
+ * If the overflow field of any ring is set, that field needs clearing and
+ * an OP_CLEAN round needs doing as well.
+ */
+ /* Set up (pages != 0) or tear down (pages == 0) rings of 'pages' frames. */
+#define XEN_DOMCTL_SHADOW_OP_DIRTY_RING       13
+ /* Re-protect consumed GFNs, and flush hardware-cached GFNs into rings. */
+#define XEN_DOMCTL_SHADOW_OP_DIRTY_RING_RESET 14
+
 /*
  * Memory allocation accessors.  These APIs are broken and will be removed.
  * Use XEN_DOMCTL_{get,set}_paging_mempool_size instead.
@@ -242,6 +264,18 @@ struct xen_domctl_getpageframeinfo3 {
   * writably by the hypervisor in the dirty bitmap.
   */
 #define XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL   (1 << 0)
+ /*
+  * Only cover the 'pages' PFNs from 'first_pfn' (HAP only), with bit 0 of
+  * dirty_bitmap standing for first_pfn.  Both values need to be multiples
+  * of 64, and 'pages' can't exceed XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE_MAX.
+  * Such operations neither pause the domain nor serialise against one
+  * another, so disjoint ranges can be processed in parallel.  stats then
+  * reports the number of dirty pages found in the range.  Dirty pages
+  * still cached by hardware (e.g. PML buffers) only show up in later
+  * operations, the latest one without this flag.
+  */
+#define XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE   (1 << 5)
+#define XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE_MAX (1U << 24)
 
 struct xen_domctl_shadow_op_stats {
     uint32_t fault_count;
@@ -261,10 +295,35 @@ struct xen_domctl_shadow_op {
 
     /* OP_PEEK / OP_CLEAN */
     XEN_GUEST_HANDLE_64(uint8) dirty_bitmap;
-    uint64_aligned_t pages; /* Size of buffer. Updated with actual size. */
+    /*
+     * OP_PEEK / OP_CLEAN: Size of buffer. Updated with actual size.
+     * OP_DIRTY_RING: Frames per ring, at most XEN_DIRTY_RING_MAX_FRAMES.
+     */
+    uint64_aligned_t pages;
     struct xen_domctl_shadow_op_stats stats;
+
+    /* OP_PEEK / OP_CLEAN with XEN_DOMCTL_SHADOW_LOGDIRTY_RANGE */
+    uint64_aligned_t first_pfn;
 };
 
+/* Layout of a dirty ring, see XEN_DOMCTL_SHADOW_OP_DIRTY_RING. */
+struct xen_dirty_ring {
+    uint32_t prod;      /* Next entry Xen is going to write. */
+    uint32_t cons;      /* Next entry the toolstack is going to read. */
+    uint32_t overflow;  /* Set by Xen when GFNs went to the bitmap instead. */
+    uint32_t pad;
+    uint64_aligned_t gfn[XEN_FLEX_ARRAY_DIM];
+};
+typedef struct xen_dirty_ring xen_dirty_ring_t;
+
+#define XEN_DIRTY_RING_MAX_FRAMES 64
+/*
+ * Number of entries in a ring of 4k frames, the header taking the place of
+ * two.  One entry is always left unused, to tell a full ring from an empty
+ * one.
+ */
+#define XEN_DIRTY_RING_ENTRIES(frames) ((frames) * 512 - 2)
+
 
 /* XEN_DOMCTL_max_mem */
 struct xen_domctl_max_mem {
@@ -791,6 +850,16 @@ struct xen_domctl_gdbsx_domstatus {
 #define XEN_VM_EVENT_DISABLE              1
 #define XEN_VM_EVENT_RESUME               2
 #define XEN_VM_EVENT_GET_VERSION          3
+/*
+ * Like XEN_VM_EVENT_ENABLE, but rather than using the single guest frame
+ * named by the ring's HVM_PARAM_*_RING_PFN, Xen allocates a ring of
+ * u.enable.nr_frames (at most XEN_VM_EVENT_MAX_RING_FRAMES) frames.  The
+ * helper maps it with XENMEM_acquire_resource, type XENMEM_resource_vm_event
+ * and id XEN_DOMCTL_VM_EVENT_OP_*.  Xen initialises the shared ring.
+ */
+#define XEN_VM_EVENT_ENABLE_FRAMES        4
+
+#define XEN_VM_EVENT_MAX_RING_FRAMES      32
 
 /*
  * Domain memory paging
@@ -856,6 +925,7 @@ struct xen_domctl_vm_event_op {
     union {
         struct {
             uint32_t port;       /* OUT: event channel for ring */
+            uint32_t nr_frames;  /* IN: XEN_VM_EVENT_ENABLE_FRAMES only */
         } enable;
 
         uint32_t version;
@@ -948,6 +1018,75 @@ struct xen_domctl_paging_mempool {
     uint64_aligned_t size; /* Size in bytes. */
 };
 
+/*
+ * XEN_DOMCTL_get_node_pages
+ *
+ * Get the number of pages of the domain on each NUMA node, as accounted
+ * when pages are assigned to and freed by the domain.
+ *
+ * On input nr_nodes is the number of elements of the pages array, which
+ * may be null. On output nr_nodes is the number of nodes of the host,
+ * i.e. the highest online node id plus 1, and up to that many elements
+ * of pages have been filled in.
+ *
+ * Pages are only accounted per node when Xen runs with sched-mem-affinity,
+ * -EOPNOTSUPP is returned otherwise.
+ */
+struct xen_domctl_node_pages {
+    uint32_t nr_nodes;                 /* IN/OUT */
+    uint32_t pad;
+    XEN_GUEST_HANDLE_64(uint64) pages; /* OUT */
+};
+
+/*
+ * XEN_DOMCTL_get_changed_domain
+ *
+ * Get the next domain which got shut down, became dying or was destroyed
+ * since it was last reported, so the VIRQ_DOM_EXC handler doesn't need to
+ * look at all domains to find it.  The domain is reported once per batch
+ * of changes.  domid is DOMID_INVALID if there are no more changes.
+ *
+ * Only available to the domain handling VIRQ_DOM_EXC.  The domain field of
+ * struct xen_domctl must be DOMID_INVALID.
+ */
+struct xen_domctl_changed_domain {
+    domid_t domid;                     /* OUT */
+    uint16_t pad[3];
+};
+
+/*
+ * XEN_DOMCTL_set_perf_class
+ *
+ * Set the performance class of a domain.  With hardware managed P-states
+ * (cpufreq=hwp), the bounds and energy/performance preference programmed
+ * on a pCPU follow the class of the domain running there.  The class is
+ * otherwise ignored.  A new class takes effect when the domain's vCPUs are
+ * next scheduled.
+ */
+struct xen_domctl_perf_class {
+#define XEN_DOMCTL_PERF_CLASS_default    0 /* Same as throughput. */
+#define XEN_DOMCTL_PERF_CLASS_latency    1 /* Never below base frequency. */
+#define XEN_DOMCTL_PERF_CLASS_throughput 2 /* Full range, balanced. */
+#define XEN_DOMCTL_PERF_CLASS_background 3 /* Up to base frequency. */
+    uint32_t perf_class;               /* IN */
+    uint32_t pad;
+};
+
+/*
+ * XEN_DOMCTL_set_security_group
+ *
+ * Place a domain in a security group, i.e. declare it to trust the other
+ * domains of the same group.  Xen may then omit the speculative barriers it
+ * otherwise issues when a pCPU switches from one domain to another of the
+ * same group.  Group 0, the default, is trusted by no other domain.
+ *
+ * This can only be done before the domain is first unpaused.
+ */
+struct xen_domctl_security_group {
+    uint32_t group;                    /* IN */
+    uint32_t pad;
+};
+
 #if defined(__i386__) || defined(__x86_64__)
 struct xen_domctl_vcpu_msr {
     uint32_t         index;
@@ -979,6 +1118,60 @@ struct xen_domctl_vcpu_msrs {
     uint32_t msr_count;                              /* IN/OUT */
     XEN_GUEST_HANDLE_64(xen_domctl_vcpu_msr_t) msrs; /* IN/OUT */
 };
+
+/*
+ * XEN_DOMCTL_p2m_recoalesce
+ *
+ * Merge runs of 4k p2m entries of an HVM domain back into 2M and 1G ones, as
+ * left behind e.g. by log-dirty tracking or mem_access.  This is done by a
+ * pass in the background, which also gets started when log-dirty mode is
+ * turned off, unless disabled with the "p2m-recoalesce" boot option.
+ *
+ * Starting a pass fails with -EBUSY while log-dirty mode is enabled.  Both
+ * operations return the statistics of the domain.
+ */
+struct xen_domctl_p2m_recoalesce {
+#define XEN_DOMCTL_P2M_RECOALESCE_START  0 /* unless already in progress */
+#define XEN_DOMCTL_P2M_RECOALESCE_STATS  1
+    uint32_t op;                       /* IN */
+    uint32_t active;                   /* OUT: a pass is in progress */
+    uint64_aligned_t next_gfn;         /* OUT: progress of the pass */
+    uint64_aligned_t passes;           /* OUT: # of passes completed */
+    uint64_aligned_t promoted_2m;      /* OUT: # of 2M entries created */
+    uint64_aligned_t promoted_1g;      /* OUT: # of 1G entries created */
+};
+
+/*
+ * XEN_DOMCTL_get_exit_stats
+ *
+ * Get the number of VM exits of an HVM domain, and the cycles spent from
+ * each exit to the following VM entry, per exit reason.  These are kept
+ * for every vcpu at all times.  Reasons are VMX basic exit reasons or SVM
+ * exit codes, as indicated by vendor.
+ *
+ * On input nr_stats is the number of elements of the stats array, which may
+ * be null.  On output nr_stats is the number of exit reasons seen so far,
+ * and up to that many elements of stats have been filled in.
+ */
+struct xen_domctl_exit_stat {
+    uint32_t reason;
+    uint32_t pad;
+    uint64_aligned_t count;
+    uint64_aligned_t cycles;
+};
+typedef struct xen_domctl_exit_stat xen_domctl_exit_stat_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_exit_stat_t);
+
+struct xen_domctl_exit_stats {
+#define XEN_DOMCTL_EXIT_STATS_ALL_VCPUS  (~0U)
+    uint32_t vcpu;                     /* IN: vcpu, or the sum of all */
+    uint32_t nr_stats;                 /* IN/OUT */
+#define XEN_DOMCTL_EXIT_STATS_VMX        1
+#define XEN_DOMCTL_EXIT_STATS_SVM        2
+    uint32_t vendor;                   /* OUT */
+    uint32_t pad;
+    XEN_GUEST_HANDLE_64(xen_domctl_exit_stat_t) stats; /* OUT */
+};
 #endif
 
 /* XEN_DOMCTL_setvnumainfo: specifies a virtual NUMA topology for the guest */
@@ -1188,6 +1381,38 @@ struct xen_domctl_vmtrace_op {
      */
 #define XEN_DOMCTL_vmtrace_get_option         5
 #define XEN_DOMCTL_vmtrace_set_option         6
+
+    /*
+     * Streaming mode, for continuous tracing without losing data when the
+     * buffer wraps.  The buffer is split in two halves.  Once the half being
+     * written holds @key bytes (0 for half of a half) at a VM exit, it is
+     * handed over to the consumer, notified via an event channel, while
+     * tracing continues into the other half.  Halves are handed over
+     * alternately, starting with the first one.
+     *
+     * Should the consumer not have drained the other half by then, tracing
+     * continues into the current one, which wraps (losing data) at its end,
+     * unless XEN_DOMCTL_VMTRACE_STREAM_block was passed in @value, in which
+     * case the vcpu is paused until the consumer catches up.
+     *
+     * Streaming can only be enabled and disabled while tracing is disabled.
+     * XEN_DOMCTL_vmtrace_output_position then refers to the current half.
+     *
+     * stream_enable returns in @value the port of an unbound event channel
+     * for the caller to bind to.  stream_next returns in @value the number
+     * of bytes in the half handed over (0 if none), and in @key the number
+     * of times data was lost to the current half wrapping, since the last
+     * call.  If @key has XEN_DOMCTL_VMTRACE_STREAM_flush set on entry, the
+     * current half is handed over right away should none be waiting, e.g.
+     * to collect the remainder of the trace once it has been disabled.
+     * stream_ack releases the half handed over, once its data was copied.
+     */
+#define XEN_DOMCTL_vmtrace_stream_enable      7
+#define XEN_DOMCTL_vmtrace_stream_disable     8
+#define XEN_DOMCTL_vmtrace_stream_next        9
+#define XEN_DOMCTL_vmtrace_stream_ack        10
+#define XEN_DOMCTL_VMTRACE_STREAM_block   (1U << 0) /* stream_enable */
+#define XEN_DOMCTL_VMTRACE_STREAM_flush   (1U << 0) /* stream_next */
 };
 typedef struct xen_domctl_vmtrace_op xen_domctl_vmtrace_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_vmtrace_op_t);
@@ -1279,6 +1504,12 @@ struct xen_domctl {
 #define XEN_DOMCTL_vmtrace_op                    84
 #define XEN_DOMCTL_get_paging_mempool_size       85
 #define XEN_DOMCTL_set_paging_mempool_size       86
+#define XEN_DOMCTL_get_node_pages                87
+#define XEN_DOMCTL_p2m_recoalesce                88
+#define XEN_DOMCTL_get_exit_stats                89
+#define XEN_DOMCTL_get_changed_domain            90
+#define XEN_DOMCTL_set_perf_class                91
+#define XEN_DOMCTL_set_security_group            92
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1325,6 +1556,8 @@ struct xen_domctl {
         struct xen_domctl_cpu_policy        cpu_policy;
         struct xen_domctl_vcpuextstate      vcpuextstate;
         struct xen_domctl_vcpu_msrs         vcpu_msrs;
+        struct xen_domctl_p2m_recoalesce    p2m_recoalesce;
+        struct xen_domctl_exit_stats        exit_stats;
 #endif
         struct xen_domctl_set_access_required access_required;
         struct xen_domctl_audit_p2m         audit_p2m;
@@ -1341,6 +1574,10 @@ struct xen_domctl {
         struct xen_domctl_vuart_op          vuart_op;
         struct xen_domctl_vmtrace_op        vmtrace_op;
         struct xen_domctl_paging_mempool    paging_mempool;
+        struct xen_domctl_node_pages        node_pages;
+        struct xen_domctl_changed_domain    changed_domain;
+        struct xen_domctl_perf_class        perf_class;
+        struct xen_domctl_security_group    security_group;
         uint8_t                             pad[128];
     } u;
 };
@@ -60,6 +60,8 @@
 #ifdef __XEN__
 #define EVTCHNOP_reset_cont      14
 #endif
+#define EVTCHNOP_send_batch      15
+#define EVTCHNOP_set_moderation  16
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -298,6 +300,43 @@ struct evtchn_set_priority {
 };
 typedef struct evtchn_set_priority evtchn_set_priority_t;
 
+/*
+ * EVTCHNOP_send_batch: Send an event to the remote end of each of the
+ * channels whose local endpoints are listed in <ports>, as if by
+ * EVTCHNOP_send, in a single hypercall.
+ *
+ * Ports are processed in order.  On return, <done> holds the number of
+ * ports processed successfully; upon failure it is the index of the port
+ * which failed, and the ports after it have not been notified.
+ */
+struct evtchn_send_batch {
+    /* IN parameters. */
+    uint32_t nr_ports;
+    /* IN: must be zero.  OUT: see above. */
+    uint32_t done;
+    /* IN: the <nr_ports> local ports, immediately following the header. */
+    evtchn_port_t ports[XEN_FLEX_ARRAY_DIM];
+};
+typedef struct evtchn_send_batch evtchn_send_batch_t;
+
+/*
+ * EVTCHNOP_set_moderation: moderate the notifications raised on the local,
+ * interdomain bound <port>.  Once an event has been delivered, further ones
+ * are held back for up to <interval_us> microseconds, and then delivered as
+ * one.  If <count> is non-zero, held back events are delivered as soon as
+ * <count> of them have accumulated.
+ *
+ * An <interval_us> of zero turns moderation off, delivering any event held
+ * back right away.  The setting is dropped when the port is closed.
+ */
+struct evtchn_set_moderation {
+    /* IN parameters. */
+    evtchn_port_t port;
+    uint32_t interval_us;
+    uint32_t count;
+};
+typedef struct evtchn_set_moderation evtchn_set_moderation_t;
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_event_channel_op_compat(struct evtchn_op *op)
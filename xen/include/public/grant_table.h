@@ -298,6 +298,7 @@ typedef uint16_t grant_status_t;
 #define GNTTABOP_get_version          10
 #define GNTTABOP_swap_grant_ref	      11
 #define GNTTABOP_cache_flush	      12
+#define GNTTABOP_copy_sg              13
 #endif /* __XEN_INTERFACE_VERSION__ */
 /* ` } */
 
@@ -582,6 +583,50 @@ struct gnttab_cache_flush {
 typedef struct gnttab_cache_flush gnttab_cache_flush_t;
 DEFINE_XEN_GUEST_HANDLE(gnttab_cache_flush_t);
 
+/*
+ * GNTTABOP_copy_sg: Hypervisor based scatter-gather copy.
+ *
+ * Like GNTTABOP_copy, but a single copy (e.g. of a whole network packet)
+ * may be made up of any number of source and destination segments, so that
+ * it needn't be split up along the page boundaries of both sides.
+ *
+ * The array of segments describes one or more copies.  Each copy consists
+ * of the segments up to and including the next one with GNTCOPY_SEG_last
+ * set.  Its source segments (those without GNTCOPY_SEG_dest), concatenated
+ * in array order, are copied to its destination segments (those with
+ * GNTCOPY_SEG_dest), again concatenated in array order.  Source and
+ * destination segments may be interleaved in any way, but their lengths
+ * must add up to the same total.
+ *
+ * <frame> is a grant reference of <domid> if GNTCOPY_SEG_gref is set, or a
+ * GMFN of the calling domain (<domid> must be DOMID_SELF) otherwise.  A
+ * segment must not cross a page boundary.
+ *
+ * The status of each copy is stored in all of its segments.  A copy which
+ * failed may have been carried out partially.  The final copy in the array
+ * must have GNTCOPY_SEG_last set on its last segment.
+ */
+#define _GNTCOPY_SEG_gref         (0)
+#define GNTCOPY_SEG_gref          (1<<_GNTCOPY_SEG_gref)
+#define _GNTCOPY_SEG_dest         (1)
+#define GNTCOPY_SEG_dest          (1<<_GNTCOPY_SEG_dest)
+#define _GNTCOPY_SEG_last         (2)
+#define GNTCOPY_SEG_last          (1<<_GNTCOPY_SEG_last)
+
+struct gnttab_copy_seg {
+    /* IN parameters. */
+    uint64_t      frame;          /* grant_ref_t or xen_pfn_t */
+    domid_t       domid;
+    uint16_t      offset;
+    uint16_t      len;
+    uint16_t      flags;          /* GNTCOPY_SEG_* */
+    /* OUT parameters. */
+    int16_t       status;
+    uint16_t      pad[3];
+};
+typedef struct gnttab_copy_seg gnttab_copy_seg_t;
+DEFINE_XEN_GUEST_HANDLE(gnttab_copy_seg_t);
+
 #endif /* __XEN_INTERFACE_VERSION__ */
 
 /*
@@ -114,6 +114,15 @@ typedef struct xen_dm_op_get_ioreq_server_info xen_dm_op_get_ioreq_server_info_t
  *
  * NOTE: unless an emulation request falls entirely within a range mapped
  * by a secondary emulator, it will not be passed to that emulator.
+ *
+ * XEN_DMOP_IO_RANGE_MEMORY_POSTED ranges don't select the server: they mark
+ * parts of its XEN_DMOP_IO_RANGE_MEMORY ranges where single writes (not
+ * using rep prefixes) are posted, i.e. the vCPU doesn't wait for them to
+ * complete.  Posted writes are put on the buffered ioreq ring as
+ * IOREQ_TYPE_COPY_POSTED records (see hvm/ioreq.h), so the server needs
+ * to have one, and needs to drain it before processing any synchronous
+ * request to preserve ordering.  If the ring is full, the write is sent
+ * synchronously instead.
  */
 #define XEN_DMOP_map_io_range_to_ioreq_server 3
 #define XEN_DMOP_unmap_io_range_from_ioreq_server 4
@@ -127,6 +136,7 @@ struct xen_dm_op_ioreq_server_range {
 # define XEN_DMOP_IO_RANGE_PORT   0 /* I/O port range */
 # define XEN_DMOP_IO_RANGE_MEMORY 1 /* MMIO range */
 # define XEN_DMOP_IO_RANGE_PCI    2 /* PCI segment/bus/dev/func range */
+# define XEN_DMOP_IO_RANGE_MEMORY_POSTED 3 /* MMIO range with posted writes */
     /* IN - inclusive start and end of range */
     uint64_aligned_t start, end;
 };
@@ -444,6 +454,27 @@ struct xen_dm_op_nr_vcpus {
 };
 typedef struct xen_dm_op_nr_vcpus xen_dm_op_nr_vcpus_t;
 
+/*
+ * XEN_DMOP_batch: Run several independent operations in one hypercall.
+ *
+ * @bufs[1] holds @nr struct xen_dm_op, each run as if it were the only
+ * buffer of its own HYPERVISOR_dm_op: operations which need further
+ * buffers, and nested batches, fail with -EINVAL.  OUT fields are
+ * written back into @bufs[1], and each operation's status into the
+ * corresponding int32_t of @bufs[2].  A failing operation does not stop
+ * the ones after it; the hypercall itself only fails when the buffers
+ * are unusable.
+ *
+ * @done must be 0 on entry.  It records progress across preemption.
+ */
+#define XEN_DMOP_batch 21
+
+struct xen_dm_op_batch {
+    uint32_t nr;   /* IN - number of operations */
+    uint32_t done; /* IN/OUT - internal, must be 0 */
+};
+typedef struct xen_dm_op_batch xen_dm_op_batch_t;
+
 struct xen_dm_op {
     uint32_t op;
     uint32_t pad;
@@ -468,6 +499,7 @@ struct xen_dm_op {
         xen_dm_op_relocate_memory_t relocate_memory;
         xen_dm_op_pin_memory_cacheattr_t pin_memory_cacheattr;
         xen_dm_op_nr_vcpus_t nr_vcpus;
+        xen_dm_op_batch_t batch;
     } u;
 };
 
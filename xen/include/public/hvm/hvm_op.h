@@ -85,6 +85,21 @@ DEFINE_XEN_GUEST_HANDLE(xen_hvm_set_pci_link_route_t);
 /* Flushes all VCPU TLBs: @arg must be NULL. */
 #define HVMOP_flush_tlbs          5
 
+/*
+ * Flushes the TLBs of a subset of the calling domain's VCPUs.  Bit N of
+ * @mask selects VCPU (@first_vcpu + N); bits naming non-existent VCPUs are
+ * ignored.  Guests with more than 64 VCPUs issue one call per window.
+ * Only VCPUs which may have run since their previous flush are interrupted.
+ */
+#define HVMOP_flush_tlbs_vcpus    26
+struct xen_hvm_flush_tlbs_vcpus {
+    uint32_t first_vcpu;        /* IN */
+    uint32_t pad;               /* IN: must be zero */
+    uint64_aligned_t mask;      /* IN */
+};
+typedef struct xen_hvm_flush_tlbs_vcpus xen_hvm_flush_tlbs_vcpus_t;
+DEFINE_XEN_GUEST_HANDLE(xen_hvm_flush_tlbs_vcpus_t);
+
 /*
  * hvmmem_type_t should not be defined when generating the corresponding
  * compat header. This will ensure that the improperly named HVMMEM_(*)
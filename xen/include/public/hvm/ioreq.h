@@ -20,6 +20,7 @@
 #define IOREQ_TYPE_PCI_CONFIG   2
 #define IOREQ_TYPE_TIMEOFFSET   7
 #define IOREQ_TYPE_INVALIDATE   8 /* mapcache */
+#define IOREQ_TYPE_COPY_POSTED  9 /* posted mmio write, buffered ring only */
 
 /*
  * VMExit dispatcher should cooperate with instruction decoder to
@@ -64,6 +65,12 @@ struct buf_ioreq {
 };
 typedef struct buf_ioreq buf_ioreq_t;
 
+/*
+ * IOREQ_TYPE_COPY_POSTED records take one more slot than the above, with
+ * address bits 20-51 in its data field.  It comes right after the first
+ * slot, i.e. before the one holding the upper half of 8-byte data.
+ */
+
 #define IOREQ_BUFFER_SLOT_NUM     511 /* 8 bytes each, plus 2 4-byte indexes */
 struct buffered_iopage {
 #ifdef __XEN__
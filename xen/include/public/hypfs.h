@@ -110,4 +110,50 @@ struct xen_hypfs_dirlistentry {
  */
 #define XEN_HYPFS_OP_write_contents    2
 
+/*
+ * XEN_HYPFS_OP_read_tree
+ *
+ * Read a filesystem entry and everything below it.
+ *
+ * The buffer starts with a struct xen_hypfs_tree_header, followed by one
+ * struct xen_hypfs_tree_rec per entry, in depth first order, the entry
+ * read being the first one with depth 0.  Each record is followed by the
+ * zero terminated entry name, then the entry contents, each padded to a
+ * multiple of 8 bytes; rec_len covers all of it.  Directory contents are
+ * not returned: the records following a directory are its children.
+ * Directories whose contents are generated dynamically are returned with
+ * XEN_HYPFS_TREE_UNEXPANDED set and no children; they need to be read
+ * with XEN_HYPFS_OP_read.
+ *
+ * done and len must be 0 on the first call.  If the buffer fills up,
+ * -ENOBUFS is returned, with done and len covering the records returned
+ * so far.  Calling again with len reset to 0 returns the next ones.
+ *
+ * arg1: XEN_GUEST_HANDLE(path name)
+ * arg2: length of path name (including trailing zero byte)
+ * arg3: XEN_GUEST_HANDLE(data buffer, read and written by hypervisor)
+ * arg4: data buffer size
+ *
+ * Possible return values:
+ * 0: success, all entries returned
+ * <0 : negative Xen errno value
+ */
+#define XEN_HYPFS_OP_read_tree         3
+
+struct xen_hypfs_tree_header {
+    uint32_t done;             /* IN/OUT: entries returned in earlier calls. */
+    uint32_t len;              /* IN/OUT: bytes of records in the buffer. */
+};
+typedef struct xen_hypfs_tree_header xen_hypfs_tree_header_t;
+
+struct xen_hypfs_tree_rec {
+    xen_hypfs_direntry_t e;
+    uint32_t rec_len;          /* Offset in bytes to the next record. */
+    uint16_t depth;            /* Below the entry read. */
+    uint8_t flags;
+#define XEN_HYPFS_TREE_UNEXPANDED 0x01
+    uint8_t pad;               /* Returned as 0. */
+};
+typedef struct xen_hypfs_tree_rec xen_hypfs_tree_rec_t;
+
 #endif /* __XEN_PUBLIC_HYPFS_H__ */
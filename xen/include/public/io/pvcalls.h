@@ -41,6 +41,7 @@ DEFINE_XEN_FLEX_RING(pvcalls);
 #define PVCALLS_LISTEN         4
 #define PVCALLS_ACCEPT         5
 #define PVCALLS_POLL           6
+#define PVCALLS_SENDMSG        7 /* Needs "feature-sendmsg" from the backend */
 
 struct xen_pvcalls_request {
     uint32_t req_id; /* private to guest, echoed in response */
@@ -86,6 +87,17 @@ struct xen_pvcalls_request {
         struct xen_pvcalls_poll {
             uint64_t id;
         } poll;
+        struct xen_pvcalls_sendmsg {
+            uint64_t id;
+            uint32_t len;
+            uint16_t offset;
+            uint16_t nr_refs;
+#define _PVCALLS_SENDMSG_INDIRECT 0
+#define PVCALLS_SENDMSG_INDIRECT  (1U << _PVCALLS_SENDMSG_INDIRECT)
+            uint32_t flags;
+#define PVCALLS_SENDMSG_MAX_REFS 9
+            grant_ref_t ref[PVCALLS_SENDMSG_MAX_REFS];
+        } sendmsg;
         /* dummy member to force sizeof(struct xen_pvcalls_request)
          * to match across archs */
         struct xen_pvcalls_dummy {
@@ -121,6 +133,9 @@ struct xen_pvcalls_response {
         struct _xen_pvcalls_poll {
             uint64_t id;
         } poll;
+        struct _xen_pvcalls_sendmsg {
+            uint64_t id;
+        } sendmsg;
         struct _xen_pvcalls_dummy {
             uint8_t dummy[8];
         } dummy;
@@ -252,6 +252,42 @@ typedef struct __name##_back_ring __name##_back_ring_t
 #define RING_COPY_REQUEST(r, idx, req)  RING_COPY_(REQUEST, r, idx, req)
 #define RING_COPY_RESPONSE(r, idx, rsp) RING_COPY_(RESPONSE, r, idx, rsp)
 
+/*
+ * Bulk transfers between the ring and an array of nr local messages.
+ *
+ * RING_PUT_{REQUESTS,RESPONSES}() queue nr messages after the private
+ * producer index and advance it.  The caller must have checked there is room
+ * for them (RING_FREE_REQUESTS(), or the 1-for-1 request/response rule), and
+ * still needs to publish the whole batch with a single
+ * RING_PUSH_{REQUESTS,RESPONSES}[_AND_CHECK_NOTIFY]().
+ *
+ * RING_CONSUME_{REQUESTS,RESPONSES}() take a local copy of the next nr
+ * messages, as RING_COPY_{REQUEST,RESPONSE}() does for one, and advance the
+ * consumer index.  The caller must have checked nr messages are available
+ * (XEN_RING_NR_UNCONSUMED_{REQUESTS,RESPONSES}()).
+ */
+#define RING_PUT_(type, r, idx, src, nr) do {                          \
+    unsigned int __i;                                                   \
+    for (__i = 0; __i < (nr); __i++)                                    \
+        *RING_GET_##type(r, (idx)++) = (src)[__i];                      \
+} while (0)
+
+#define RING_PUT_REQUESTS(r, src, nr)                                   \
+    RING_PUT_(REQUEST, r, (r)->req_prod_pvt, src, nr)
+#define RING_PUT_RESPONSES(r, src, nr)                                  \
+    RING_PUT_(RESPONSE, r, (r)->rsp_prod_pvt, src, nr)
+
+#define RING_CONSUME_(type, r, idx, dest, nr) do {                     \
+    unsigned int __i;                                                   \
+    for (__i = 0; __i < (nr); __i++)                                    \
+        RING_COPY_(type, r, (idx)++, &(dest)[__i]);                     \
+} while (0)
+
+#define RING_CONSUME_REQUESTS(r, dest, nr)                              \
+    RING_CONSUME_(REQUEST, r, (r)->req_cons, dest, nr)
+#define RING_CONSUME_RESPONSES(r, dest, nr)                             \
+    RING_CONSUME_(RESPONSE, r, (r)->rsp_cons, dest, nr)
+
 /* Loop termination condition: Would the specified index overflow the ring? */
 #define RING_REQUEST_CONS_OVERFLOW(_r, _cons)                           \
     (((_cons) - (_r)->rsp_prod_pvt) >= RING_SIZE(_r))
@@ -302,6 +338,20 @@ typedef struct __name##_back_ring __name##_back_ring_t
  *  messages have been enqueued) then you will need to create a customised
  *  version of the FINAL_CHECK macro in your own code, which sets the event
  *  field appropriately.
+ *
+ * Polling:
+ *
+ *  The event fields double as a "receiver is polling" hint.  The sender only
+ *  notifies when the index in req_event/rsp_event is among the messages it
+ *  has just made visible.  A receiver which keeps checking the ring, instead
+ *  of waiting for an event, leaves the field behind the producer index by
+ *  not using RING_FINAL_CHECK_FOR_*() while it polls.  Senders then queue
+ *  messages without notifying, with no further support from either side.
+ *
+ *  A receiver switching back to waiting for events (e.g. because it found
+ *  no work for a while) must use RING_FINAL_CHECK_FOR_*() before sleeping,
+ *  exactly as after a batch of notified work, to re-arm the notification
+ *  and catch messages queued in the meantime.
  */
 
 #define RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(_r, _notify) do {           \
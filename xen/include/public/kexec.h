@@ -133,6 +133,8 @@ typedef struct xen_kexec_load_v1 {
 #define KEXEC_RANGE_MA_EFI_MEMMAP 5 /* machine address and size of
                                      * of the EFI Memory Map */
 #define KEXEC_RANGE_MA_VMCOREINFO 6 /* machine address and size of vmcoreinfo */
+#define KEXEC_RANGE_MA_CRASH_MEMMAP 7 /* machine address and size of the
+                                       * crash memory map, see below */
 
 /*
  * Find the address and size of certain memory areas
@@ -149,6 +151,44 @@ typedef struct xen_kexec_range {
     unsigned long start;
 } xen_kexec_range_t;
 
+/*
+ * Crash memory map, present when Xen was booted with "crashinfo_memmap".
+ *
+ * Xen fills it in when crashing, before entering the crash kernel.  It
+ * classifies RAM in 2MiB chunks so that the crash kernel can tell which
+ * parts of memory it needs to capture. For example, it can compress only
+ * the KEXEC_CRASH_MEM_XEN regions and skip the others.
+ *
+ * Entries are sorted by address and don't overlap.  Adjacent chunks of the
+ * same type share an entry.
+ *
+ * Entries may include non-RAM parts of a chunk, so this map only tells
+ * what may be skipped within the RAM described elsewhere.
+ *
+ * nr_entries remains zero if the map wasn't filled in.  Should the map run
+ * out of entries, the last one covers all the remaining memory, as
+ * KEXEC_CRASH_MEM_XEN.
+ *
+ * The map's machine address also appears in VMCOREINFO_XEN, as
+ * XEN_CRASH_MEMMAP.
+ */
+#define KEXEC_CRASH_MEM_XEN   0 /* Xen's, the hardware domain's, or unowned */
+#define KEXEC_CRASH_MEM_GUEST 1 /* Only other domains' pages, or free ones */
+#define KEXEC_CRASH_MEM_FREE  2 /* Only free pages */
+
+typedef struct xen_kexec_crash_memmap_entry {
+    uint64_t start;             /* machine address */
+    uint64_t size;              /* bytes */
+    uint32_t type;              /* KEXEC_CRASH_MEM_* */
+    uint32_t pad;
+} xen_kexec_crash_memmap_entry_t;
+
+typedef struct xen_kexec_crash_memmap {
+    uint32_t nr_entries;
+    uint32_t max_entries;
+    xen_kexec_crash_memmap_entry_t entries[XEN_FLEX_ARRAY_DIM];
+} xen_kexec_crash_memmap_t;
+
 #if __XEN_INTERFACE_VERSION__ >= 0x00040400
 /*
  * A contiguous chunk of a kexec image and it's destination machine
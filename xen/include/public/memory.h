@@ -381,10 +381,17 @@ typedef struct xen_pod_target xen_pod_target_t;
 #define XENMEM_paging_op_nominate           0
 #define XENMEM_paging_op_evict              1
 #define XENMEM_paging_op_prep               2
+#define XENMEM_paging_op_mark_paged         3
 
 struct xen_mem_paging_op {
     uint8_t     op;         /* XENMEM_paging_op_* */
     domid_t     domain;
+    /*
+     * IN: (XENMEM_paging_op_mark_paged) number of gfns to operate on,
+     * starting at gfn.  Both fields are updated when the operation gets
+     * preempted.
+     */
+    uint32_t    nr;
 
     /* IN: (XENMEM_paging_op_prep) buffer to immediately fill page from */
     XEN_GUEST_HANDLE_64(const_uint8) buffer;
@@ -602,6 +609,35 @@ struct xen_reserved_device_memory_map {
 typedef struct xen_reserved_device_memory_map xen_reserved_device_memory_map_t;
 DEFINE_XEN_GUEST_HANDLE(xen_reserved_device_memory_map_t);
 
+/*
+ * Populate a range of the physical address space of a translated guest,
+ * using extents of up to 2^max_order pages as far as the alignment of the
+ * range and the availability of memory allow, and falling back to smaller
+ * ones down to single pages.  mem_flags takes the XENMEMF_* address width
+ * and node flags; XENMEMF_populate_on_demand isn't supported.
+ *
+ * Disjoint ranges of the same guest may be populated in parallel, from
+ * several vcpus.  nr_done must be zero on the initial call, and is updated
+ * with the number of pages populated, including on error.
+ *
+ * Subject to the same permission checks as XENMEM_populate_physmap.
+ */
+#define XENMEM_populate_physmap_range       29
+struct xen_memory_populate_range {
+    /* IN */
+    domid_t domid;
+    uint16_t pad;
+    uint32_t mem_flags;
+    uint64_aligned_t gfn;
+    uint64_aligned_t nr_pages;
+    uint32_t max_order;
+    uint32_t pad2;
+    /* IN/OUT */
+    uint64_aligned_t nr_done;
+};
+typedef struct xen_memory_populate_range xen_memory_populate_range_t;
+DEFINE_XEN_GUEST_HANDLE(xen_memory_populate_range_t);
+
 #endif /* defined(__XEN__) || defined(__XEN_TOOLS__) */
 
 /*
@@ -618,6 +654,8 @@ struct xen_mem_acquire_resource {
 #define XENMEM_resource_ioreq_server 0
 #define XENMEM_resource_grant_table 1
 #define XENMEM_resource_vmtrace_buf 2
+#define XENMEM_resource_vm_event 3
+#define XENMEM_resource_dirty_ring 4
 
     /*
      * IN - a type-specific resource identifier, which must be zero
@@ -625,6 +663,8 @@ struct xen_mem_acquire_resource {
      *
      * type == XENMEM_resource_ioreq_server -> id == ioreq server id
      * type == XENMEM_resource_grant_table -> id defined below
+     * type == XENMEM_resource_vm_event -> id == XEN_DOMCTL_VM_EVENT_OP_*
+     * type == XENMEM_resource_dirty_ring -> id == vcpu id
      */
     uint32_t id;
 
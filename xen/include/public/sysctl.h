@@ -18,7 +18,7 @@
 #include "domctl.h"
 #include "physdev.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x00000015
+#define XEN_SYSCTL_INTERFACE_VERSION 0x00000017
 
 /*
  * Read console content from Xen buffer ring.
@@ -51,6 +51,8 @@ struct xen_sysctl_tbuf_op {
 #define XEN_SYSCTL_TBUFOP_set_size     3
 #define XEN_SYSCTL_TBUFOP_enable       4
 #define XEN_SYSCTL_TBUFOP_disable      5
+#define XEN_SYSCTL_TBUFOP_set_sampling 6
+#define XEN_SYSCTL_TBUFOP_set_domain   7
     uint32_t cmd;
     /* IN/OUT variables */
     struct xenctl_bitmap cpu_mask;
@@ -58,6 +60,21 @@ struct xen_sysctl_tbuf_op {
     /* OUT variables */
     uint64_aligned_t buffer_mfn;
     uint32_t size;  /* Also an IN variable! */
+    /*
+     * IN variables for XEN_SYSCTL_TBUFOP_set_sampling, setting the sampling
+     * policy of the event classes (TRC_GEN, TRC_HVM, ...) in evt_mask: only
+     * 1 in sample_period events gets recorded, and of those at most
+     * rate_limit per second on each CPU, with bursts of up to rate_burst.
+     * 0 means no sampling / no limit.
+     */
+    uint32_t sample_period;
+    uint32_t rate_limit;
+    uint32_t rate_burst;
+    /*
+     * IN variable for XEN_SYSCTL_TBUFOP_set_domain: only record events
+     * occurring in the context of this domain (DOMID_INVALID: any domain).
+     */
+    domid_t domid;
 };
 
 /*
@@ -226,6 +243,10 @@ struct pm_cx_stat {
      */
     XEN_GUEST_HANDLE_64(uint64) pc;
     XEN_GUEST_HANDLE_64(uint64) cc;
+    /* Idle governor prediction accuracy, since boot or the last reset. */
+    uint64_aligned_t pred_hit;   /* chosen state was the deepest paying off */
+    uint64_aligned_t pred_early; /* woken before the chosen state paid off */
+    uint64_aligned_t pred_late;  /* a deeper state would have paid off */
 };
 
 struct xen_sysctl_get_pmstat {
@@ -465,6 +486,52 @@ struct xen_sysctl_lockprof_op {
     XEN_GUEST_HANDLE_64(xen_sysctl_lockprof_data_t) data;
 };
 
+/*
+ * XEN_SYSCTL_lockcont_op
+ *
+ * Sampled lock contention profiling.  Unlike XEN_SYSCTL_lockprof_op this is
+ * available in every build: once enabled, one in every @period contended
+ * spinlock acquisitions on each CPU records its wait time against the
+ * (lock, caller) pair in a per-CPU table.  Uncontended acquisitions are never
+ * looked at.  A query returns one element per pair and CPU.
+ */
+/* Sub-operations: */
+#define XEN_SYSCTL_LOCKCONT_enable  1   /* Start sampling, 1 in @period. */
+#define XEN_SYSCTL_LOCKCONT_disable 2   /* Stop sampling, keep the data. */
+#define XEN_SYSCTL_LOCKCONT_reset   3   /* Discard all sampled data. */
+#define XEN_SYSCTL_LOCKCONT_query   4   /* Get sampled data. */
+/*
+ * Wait time histogram: bucket 0 counts waits below 1us, bucket n waits below
+ * 2^n us, and the last bucket everything longer.
+ */
+#define XEN_SYSCTL_LOCKCONT_BUCKETS 16
+struct xen_sysctl_lockcont_data {
+    uint64_aligned_t lock;         /* address of the lock */
+    uint64_aligned_t caller;       /* return address of the lock call */
+    char     caller_name[64];      /* "symbol+off/size" of caller, if known */
+    uint32_t cpu;                  /* CPU the samples were taken on */
+    uint32_t pad;
+    uint64_aligned_t count;        /* # of sampled contended acquisitions */
+    uint64_aligned_t wait_time;    /* nsecs waited in total */
+    uint64_aligned_t wait_max;     /* longest single wait in nsecs */
+    uint64_aligned_t hist[XEN_SYSCTL_LOCKCONT_BUCKETS];
+};
+typedef struct xen_sysctl_lockcont_data xen_sysctl_lockcont_data_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockcont_data_t);
+struct xen_sysctl_lockcont_op {
+    /* IN variables. */
+    uint32_t       cmd;               /* XEN_SYSCTL_LOCKCONT_??? */
+    uint32_t       period;            /* enable: sampling period (> 0) */
+                                      /* query: current period, 0 if off */
+    uint32_t       max_elem;          /* size of output buffer */
+    /* OUT variables (query only). */
+    uint32_t       nr_elem;           /* number of elements available */
+    uint64_aligned_t time;            /* nsecs since last enable or reset */
+    uint64_aligned_t dropped;         /* samples lost to full tables */
+    /* sampled data (or NULL) */
+    XEN_GUEST_HANDLE_64(xen_sysctl_lockcont_data_t) data;
+};
+
 /* XEN_SYSCTL_cputopoinfo */
 #define XEN_INVALID_CORE_ID     (~0U)
 #define XEN_INVALID_SOCKET_ID   (~0U)
@@ -502,6 +569,7 @@ struct xen_sysctl_cputopoinfo {
 struct xen_sysctl_meminfo {
     uint64_t memsize;
     uint64_t memfree;
+    uint64_t memzeroed;     /* Part of memfree known to be zero-filled. */
 };
 typedef struct xen_sysctl_meminfo xen_sysctl_meminfo_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_meminfo_t);
@@ -543,34 +611,46 @@ struct xen_sysctl_numainfo {
 #define XEN_SYSCTL_CPUPOOL_OP_RMCPU                 5  /* R */
 #define XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAIN            6  /* M */
 #define XEN_SYSCTL_CPUPOOL_OP_FREEINFO              7  /* F */
+#define XEN_SYSCTL_CPUPOOL_OP_MOVECPUS              8  /* V */
 #define XEN_SYSCTL_CPUPOOL_PAR_ANY     0xFFFFFFFF
 struct xen_sysctl_cpupool_op {
     uint32_t op;          /* IN */
-    uint32_t cpupool_id;  /* IN: CDIARM OUT: CI */
-    uint32_t sched_id;    /* IN: C      OUT: I  */
-    uint32_t domid;       /* IN: M              */
-    uint32_t cpu;         /* IN: AR             */
-    uint32_t n_dom;       /*            OUT: I  */
-    struct xenctl_bitmap cpumap; /*     OUT: IF */
+    uint32_t cpupool_id;  /* IN: CDIARMV OUT: CI */
+    uint32_t sched_id;    /* IN: C       OUT: I  */
+    uint32_t domid;       /* IN: M               */
+    uint32_t cpu;         /* IN: AR              */
+    uint32_t n_dom;       /*             OUT: I  */
+    struct xenctl_bitmap cpumap; /* IN: V OUT: IF */
 };
 
+/*
+ * XEN_SYSCTL_CPUPOOL_OP_MOVECPUS moves all cpus in cpumap to the cpupool
+ * cpupool_id in one operation. cpus not yet in that cpupool must either be
+ * free or all belong to the same other cpupool. cpus already in the target
+ * cpupool are ignored, so a failed operation can be retried with the same
+ * parameters.
+ */
+
 /*
  * Error return values of cpupool operations:
  *
  * -EADDRINUSE:
- *  XEN_SYSCTL_CPUPOOL_OP_RMCPU: A vcpu is temporarily pinned to the cpu
- *    which is to be removed from a cpupool.
+ *  XEN_SYSCTL_CPUPOOL_OP_RMCPU, XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: A vcpu is
+ *    temporarily pinned to a cpu which is to be removed from a cpupool.
  * -EADDRNOTAVAIL:
- *  XEN_SYSCTL_CPUPOOL_OP_ADDCPU, XEN_SYSCTL_CPUPOOL_OP_RMCPU: A previous
- *    request to remove a cpu from a cpupool was terminated with -EAGAIN
- *    and has not been retried using the same parameters.
+ *  XEN_SYSCTL_CPUPOOL_OP_ADDCPU, XEN_SYSCTL_CPUPOOL_OP_RMCPU,
+ *  XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: A previous request to remove a cpu from a
+ *    cpupool was terminated with -EAGAIN and has not been retried using the
+ *    same parameters.
  * -EAGAIN:
- *  XEN_SYSCTL_CPUPOOL_OP_RMCPU: The cpu can't be removed from the cpupool
- *    as it is active in the hypervisor. A retry will succeed soon.
+ *  XEN_SYSCTL_CPUPOOL_OP_RMCPU, XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: The cpu can't
+ *    be removed from the cpupool as it is active in the hypervisor. A retry
+ *    will succeed soon.
  * -EBUSY:
- *  XEN_SYSCTL_CPUPOOL_OP_DESTROY, XEN_SYSCTL_CPUPOOL_OP_RMCPU: A cpupool
- *    can't be destroyed or the last cpu can't be removed as there is still
- *    a running domain in that cpupool.
+ *  XEN_SYSCTL_CPUPOOL_OP_DESTROY, XEN_SYSCTL_CPUPOOL_OP_RMCPU,
+ *  XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: A cpupool can't be destroyed or the last
+ *    cpu can't be removed as there is still a running domain in that
+ *    cpupool.
  * -EEXIST:
  *  XEN_SYSCTL_CPUPOOL_OP_CREATE: A cpupool_id was specified and is already
  *    existing.
@@ -579,10 +659,15 @@ struct xen_sysctl_cpupool_op {
  *    cpu was specified (cpu does not exist).
  *  XEN_SYSCTL_CPUPOOL_OP_MOVEDOMAIN: An illegal domain was specified
  *    (domain id illegal or not suitable for operation).
+ *  XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: cpumap contains offline cpus, cpus of
+ *    multiple cpupools, cpu 0 to be removed from cpupool 0 or all online
+ *    cpus.
  * -ENODEV:
  *  XEN_SYSCTL_CPUPOOL_OP_ADDCPU, XEN_SYSCTL_CPUPOOL_OP_RMCPU: The specified
  *    cpu is either not free (add) or not member of the specified cpupool
  *    (remove).
+ *  XEN_SYSCTL_CPUPOOL_OP_MOVECPUS: A cpu is being hot-unplugged, or the
+ *    cpus don't form complete scheduling units of the target cpupool.
  * -ENOENT:
  *  all: The cpupool with the specified cpupool_id doesn't exist.
  *
@@ -1057,6 +1142,67 @@ typedef struct xen_sysctl_cpu_policy xen_sysctl_cpu_policy_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_cpu_policy_t);
 #endif
 
+/*
+ * XEN_SYSCTL_get_domain_stats
+ *
+ * Resource accounting snapshot of many domains in a single call, for
+ * monitoring agents.  Starting at @first_domain, @buffer gets filled with a
+ * struct xen_sysctl_domain_stats for each domain, each immediately followed
+ * by its @nr_vcpus struct xen_sysctl_vcpu_stats.  Only whole domains are
+ * written: on return @first_domain is the first domain which didn't fit in
+ * @size bytes, or DOMID_INVALID if all were reported.  Fails with -ENOBUFS
+ * if not even one domain fits.
+ *
+ * The operation is preemptible, and continued transparently; @used and
+ * @nr_domains track its progress and must be zero on entry.
+ */
+#define XEN_VCPUSTAT_online   (1u << 0)
+#define XEN_VCPUSTAT_running  (1u << 1)
+#define XEN_VCPUSTAT_blocked  (1u << 2)
+struct xen_sysctl_vcpu_stats {
+    uint32_t vcpu_id;
+    uint32_t flags;                    /* XEN_VCPUSTAT_* */
+    uint64_aligned_t runstate[4];      /* nsecs spent in each RUNSTATE_* */
+    uint64_aligned_t exits;            /* x86 HVM: # of VM exits */
+    uint64_aligned_t exit_cycles;      /* x86 HVM: TSC cycles handling them */
+};
+typedef struct xen_sysctl_vcpu_stats xen_sysctl_vcpu_stats_t;
+
+struct xen_sysctl_domain_stats {
+    domid_t  domid;
+    uint16_t pad;
+    uint32_t flags;                    /* XEN_DOMINF_* */
+    uint32_t nr_vcpus;                 /* # of vcpu records following */
+    uint32_t nr_online_vcpus;
+    xen_domain_handle_t handle;
+    uint64_aligned_t cpu_time;         /* nsecs, summed over all vcpus */
+    /* Memory, in pages. */
+    uint64_aligned_t tot_pages;
+    uint64_aligned_t max_pages;
+    uint64_aligned_t outstanding_pages;
+    uint64_aligned_t xenheap_pages;
+    uint64_aligned_t shr_pages;
+    uint64_aligned_t paged_pages;
+    /* Event channels. */
+    uint32_t evtchn_active;
+    uint32_t evtchn_max;
+    /* Grant table, in frames, and maptrack entries. */
+    uint32_t gnttab_frames;
+    uint32_t gnttab_max_frames;
+    uint32_t maptrack_entries;
+    uint32_t maptrack_max_frames;
+};
+typedef struct xen_sysctl_domain_stats xen_sysctl_domain_stats_t;
+
+struct xen_sysctl_get_domain_stats {
+    domid_t  first_domain;             /* IN/OUT */
+    uint16_t pad;                      /* IN: 0 */
+    uint32_t size;                     /* IN: size of @buffer in bytes */
+    uint32_t used;                     /* IN: 0, OUT: bytes written */
+    uint32_t nr_domains;               /* IN: 0, OUT: domains written */
+    XEN_GUEST_HANDLE_64(uint8) buffer; /* OUT */
+};
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1087,6 +1233,8 @@ struct xen_sysctl {
 #define XEN_SYSCTL_livepatch_op                  27
 /* #define XEN_SYSCTL_set_parameter              28 */
 #define XEN_SYSCTL_get_cpu_policy                29
+#define XEN_SYSCTL_lockcont_op                   30
+#define XEN_SYSCTL_get_domain_stats              31
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1106,6 +1254,7 @@ struct xen_sysctl {
         struct xen_sysctl_pm_op             pm_op;
         struct xen_sysctl_page_offline_op   page_offline;
         struct xen_sysctl_lockprof_op       lockprof_op;
+        struct xen_sysctl_lockcont_op       lockcont_op;
         struct xen_sysctl_cpupool_op        cpupool_op;
         struct xen_sysctl_scheduler_op      scheduler_op;
         struct xen_sysctl_coverage_op       coverage_op;
@@ -1114,6 +1263,7 @@ struct xen_sysctl {
         struct xen_sysctl_cpu_levelling_caps cpu_levelling_caps;
         struct xen_sysctl_cpu_featureset    cpu_featureset;
         struct xen_sysctl_livepatch_op      livepatch;
+        struct xen_sysctl_get_domain_stats  get_domain_stats;
 #if defined(__i386__) || defined(__x86_64__)
         struct xen_sysctl_cpu_policy        cpu_policy;
 #endif
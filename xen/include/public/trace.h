@@ -80,6 +80,12 @@
 #define TRC_LOST_RECORDS        (TRC_GEN + 1)
 #define TRC_TRACE_WRAP_BUFFER  (TRC_GEN + 2)
 #define TRC_TRACE_CPU_CHANGE    (TRC_GEN + 3)
+/*
+ * Sampling policy in effect from here on, for the classes in the first extra
+ * word: 1 in (second word) events recorded, at most (third word) of them per
+ * second per CPU, in bursts of up to (fourth word).  0 means no limit.
+ */
+#define TRC_TRACE_SAMPLING      (TRC_GEN + 5)
 
 #define TRC_SCHED_RUNSTATE_CHANGE   (TRC_SCHED_MIN + 1)
 #define TRC_SCHED_CONTINUE_RUNNING  (TRC_SCHED_MIN + 2)
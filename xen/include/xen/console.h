@@ -49,6 +49,10 @@ int console_resume(void);
 /* Emit a string via the serial console. */
 void console_serial_puts(const char *s, size_t nr);
 
+struct domain;
+/* Whether a guest may log a line of @len characters.  Needs d->pbuf_lock. */
+bool guest_console_ratelimit(struct domain *d, unsigned int len);
+
 extern int8_t opt_console_xen;
 
 #endif /* __CONSOLE_H__ */
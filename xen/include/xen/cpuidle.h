@@ -97,5 +97,8 @@ extern void cpuidle_wakeup_mwait(cpumask_t *mask);
 #define CPUIDLE_DRIVER_STATE_START  1
 
 extern void menu_get_trace_data(u32 *expected, u32 *pred);
+void menu_get_pred_stats(unsigned int cpu, uint64_t *hit, uint64_t *early,
+                         uint64_t *late);
+void menu_reset_pred_stats(unsigned int cpu);
 
 #endif /* _XEN_CPUIDLE_H */
@@ -26,11 +26,14 @@ struct dmop_args {
     domid_t domid;
     unsigned int nr_bufs;
     /* Reserve enough buf elements for all current hypercalls. */
-    struct xen_dm_op_buf buf[2];
+    struct xen_dm_op_buf buf[3];
 };
 
 int dm_op(const struct dmop_args *op_args);
 
+/* dm_op(), or XEN_DMOP_batch which is common to all architectures. */
+int dm_op_dispatch(const struct dmop_args *op_args);
+
 #endif /* __XEN_DM_H__ */
 
 /*
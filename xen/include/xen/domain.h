@@ -28,6 +28,10 @@ void getdomaininfo(struct domain *d, struct xen_domctl_getdomaininfo *info);
 void arch_get_domain_info(const struct domain *d,
                           struct xen_domctl_getdomaininfo *info);
 
+struct xen_sysctl_vcpu_stats;
+void arch_get_vcpu_stats(const struct vcpu *v,
+                         struct xen_sysctl_vcpu_stats *stats);
+
 /* CDF_* constant. Internal flags for domain creation. */
 /* Is this a privileged domain? */
 #define CDF_privileged           (1U << 0)
@@ -113,8 +117,8 @@ void arch_dump_domain_info(struct domain *d);
 
 int arch_vcpu_reset(struct vcpu *);
 
-bool_t domctl_lock_acquire(void);
-void domctl_lock_release(void);
+bool domctl_lock_acquire(struct domain *d);
+void domctl_lock_release(struct domain *d);
 
 /*
  * Continue the current hypercall via func(data) on specified cpu.
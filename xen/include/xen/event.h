@@ -29,6 +29,12 @@ void send_guest_vcpu_virq(struct vcpu *v, uint32_t virq);
  */
 void send_global_virq(uint32_t virq);
 
+/*
+ * get_global_virq_handler: Get the domain handling a global VIRQ.
+ *  @virq:     Virtual IRQ number (VIRQ_*), must be global
+ */
+struct domain *get_global_virq_handler(uint32_t virq);
+
 /*
  * send_guest_global_virq:
  *  @d:        Domain to which VIRQ should be sent
@@ -239,11 +245,15 @@ static inline void evtchn_port_init(struct domain *d, struct evtchn *evtchn)
         d->evtchn_port_ops->init(d, evtchn);
 }
 
+/* Returns true if the event is to be held back. */
+bool evtchn_moderate(struct evtchn *evtchn);
+
 static inline void evtchn_port_set_pending(struct domain *d,
                                            unsigned int vcpu_id,
                                            struct evtchn *evtchn)
 {
-    if ( evtchn_usable(evtchn) )
+    if ( evtchn_usable(evtchn) &&
+         likely(!evtchn->moderation || !evtchn_moderate(evtchn)) )
         d->evtchn_port_ops->set_pending(d->vcpu[vcpu_id], evtchn);
 }
 
@@ -29,6 +29,7 @@
 #include <asm/grant_table.h>
 
 struct grant_table;
+struct xen_sysctl_domain_stats;
 
 #ifdef CONFIG_GRANT_TABLE
 
@@ -58,6 +59,10 @@ int gnttab_map_frame(struct domain *d, unsigned long idx, gfn_t gfn,
 
 unsigned int gnttab_resource_max_frames(const struct domain *d, unsigned int id);
 
+/* Fill in the grant table fields of @stats, for XEN_SYSCTL_get_domain_stats. */
+void gnttab_get_stats(const struct domain *d,
+                      struct xen_sysctl_domain_stats *stats);
+
 int gnttab_acquire_resource(
     struct domain *d, unsigned int id, unsigned int frame,
     unsigned int nr_frames, xen_pfn_t mfn_list[]);
@@ -112,6 +117,9 @@ static inline int gnttab_acquire_resource(
     return -EINVAL;
 }
 
+static inline void gnttab_get_stats(const struct domain *d,
+                                    struct xen_sysctl_domain_stats *stats) {}
+
 #endif /* CONFIG_GRANT_TABLE */
 
 #endif /* __XEN_GRANT_TABLE_H__ */
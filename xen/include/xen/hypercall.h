@@ -29,6 +29,15 @@ arch_do_domctl(
     struct xen_domctl *domctl, struct domain *d,
     XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl);
 
+/*
+ * Deal with domctl sub-operations which are meant to be issued in parallel,
+ * and hence mustn't serialise on the domctl lock.  Returns false if @domctl
+ * isn't one of them, for it to be handled by arch_do_domctl() as usual.
+ */
+extern bool
+arch_do_domctl_unlocked(
+    struct xen_domctl *domctl, struct domain *d, long *ret);
+
 extern long
 arch_do_sysctl(
     struct xen_sysctl *sysctl,
@@ -187,6 +187,28 @@ int __must_check iommu_iotlb_flush(struct domain *d, dfn_t dfn,
 int __must_check iommu_iotlb_flush_all(struct domain *d,
                                        unsigned int flush_flags);
 
+struct iommu_flush_range {
+    dfn_t dfn;
+    unsigned long page_count;
+};
+
+/*
+ * IOTLB flush batching.  While a batch is open on a CPU, iommu_iotlb_flush()
+ * for the batch's domain only records the DFN range, merging it with any
+ * overlapping or adjacent one.  The recorded ranges are flushed together
+ * when too many have accumulated, when iommu_iotlb_batch_flush() is called,
+ * and at the latest by iommu_iotlb_batch_end().
+ *
+ * The batch needs ending before returning to guest context, and flushing
+ * before any page which had its mapping removed within the batch can be
+ * freed.  Batches don't nest.  Flush failures are reported (and non-hardware
+ * domains crashed) as for iommu_iotlb_flush(); the return value is for
+ * callers which can propagate it.
+ */
+void iommu_iotlb_batch_start(struct domain *d);
+int iommu_iotlb_batch_flush(void);
+int iommu_iotlb_batch_end(void);
+
 enum iommu_feature
 {
     IOMMU_FEAT_COHERENT_WALK,
@@ -294,6 +316,10 @@ struct iommu_ops {
     int __must_check (*iotlb_flush)(struct domain *d, dfn_t dfn,
                                     unsigned long page_count,
                                     unsigned int flush_flags);
+    /* Optional: flush several ranges, waiting for completion only once. */
+    int __must_check (*iotlb_flush_ranges)(
+        struct domain *d, const struct iommu_flush_range *ranges,
+        unsigned int nr, unsigned int flush_flags);
     int (*get_reserved_device_memory)(iommu_grdm_t *, void *);
     void (*dump_page_tables)(struct domain *d);
 
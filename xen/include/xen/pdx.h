@@ -4,18 +4,11 @@
 #ifdef CONFIG_HAS_PDX
 
 extern unsigned long max_pdx;
-extern unsigned long pfn_pdx_bottom_mask, ma_va_bottom_mask;
-extern unsigned int pfn_pdx_hole_shift;
-extern unsigned long pfn_hole_mask;
-extern unsigned long pfn_top_mask, ma_top_mask;
 
 #define PDX_GROUP_COUNT ((1 << PDX_GROUP_SHIFT) / \
                          (sizeof(*frame_table) & -sizeof(*frame_table)))
 extern unsigned long pdx_group_valid[];
 
-extern uint64_t pdx_init_mask(u64 base_addr);
-extern u64 pdx_region_mask(u64 base, u64 len);
-
 extern void set_pdx_range(unsigned long smfn, unsigned long emfn);
 
 #define page_to_pdx(pg)  ((pg) - frame_table)
@@ -23,6 +16,26 @@ extern void set_pdx_range(unsigned long smfn, unsigned long emfn);
 
 bool __mfn_valid(unsigned long mfn);
 
+/*
+ * Compression is set up from the memory ranges the firmware reports:
+ * register each of them with pfn_pdx_add_region(), then call
+ * pfn_pdx_compression_setup(), which leaves addresses below @base
+ * uncompressed.  Returns whether any compression is in use.
+ */
+extern void pfn_pdx_add_region(paddr_t base, paddr_t size);
+extern bool pfn_pdx_compression_setup(paddr_t base);
+
+/* Whether all of the range translates, and does so contiguously. */
+extern bool pdx_is_region_compressible(paddr_t base, unsigned long npages);
+
+#ifdef CONFIG_PDX_MASK_COMPRESSION
+
+/* A single range of address bits is squashed out. */
+extern unsigned long pfn_pdx_bottom_mask, ma_va_bottom_mask;
+extern unsigned int pfn_pdx_hole_shift;
+extern unsigned long pfn_hole_mask;
+extern unsigned long pfn_top_mask, ma_top_mask;
+
 static inline unsigned long pfn_to_pdx(unsigned long pfn)
 {
     return (pfn & pfn_pdx_bottom_mask) |
@@ -35,11 +48,65 @@ static inline unsigned long pdx_to_pfn(unsigned long pdx)
            ((pdx << pfn_pdx_hole_shift) & pfn_top_mask);
 }
 
+static inline unsigned long maddr_to_directmapoff(paddr_t ma)
+{
+    return (ma & ma_va_bottom_mask) |
+           ((ma & ma_top_mask) >> pfn_pdx_hole_shift);
+}
+
+static inline paddr_t directmapoff_to_maddr(unsigned long offset)
+{
+    return (offset & ma_va_bottom_mask) |
+           (((paddr_t)offset << pfn_pdx_hole_shift) & ma_top_mask);
+}
+
+#else /* CONFIG_PDX_OFFSET_COMPRESSION */
+
+/*
+ * The PFN space is split into PDX_NR_LOOKUP slots of 2^pfn_index_shift
+ * pages each, and the slots without any memory are squashed out.  Each way,
+ * translation is an addition of the offset looked up with the top bits of
+ * the input.  Masking the index keeps stray inputs within the tables.
+ */
+#define PDX_NR_LOOKUP (1U << CONFIG_PDX_OFFSET_TBL_ORDER)
+
+extern unsigned int pfn_index_shift;
+extern unsigned long pfn_pdx_lookup[PDX_NR_LOOKUP];
+extern unsigned long pdx_pfn_lookup[PDX_NR_LOOKUP];
+
+static inline unsigned int pdx_lookup_index(unsigned long nr)
+{
+    return (nr >> pfn_index_shift) & (PDX_NR_LOOKUP - 1);
+}
+
+static inline unsigned long pfn_to_pdx(unsigned long pfn)
+{
+    return pfn - pfn_pdx_lookup[pdx_lookup_index(pfn)];
+}
+
+static inline unsigned long pdx_to_pfn(unsigned long pdx)
+{
+    return pdx + pdx_pfn_lookup[pdx_lookup_index(pdx)];
+}
+
+static inline unsigned long maddr_to_directmapoff(paddr_t ma)
+{
+    return ma - ((paddr_t)pfn_pdx_lookup[pdx_lookup_index(ma >> PAGE_SHIFT)]
+                 << PAGE_SHIFT);
+}
+
+static inline paddr_t directmapoff_to_maddr(unsigned long offset)
+{
+    return offset +
+           ((paddr_t)pdx_pfn_lookup[pdx_lookup_index(offset >> PAGE_SHIFT)]
+            << PAGE_SHIFT);
+}
+
+#endif /* CONFIG_PDX_OFFSET_COMPRESSION */
+
 #define mfn_to_pdx(mfn) pfn_to_pdx(mfn_x(mfn))
 #define pdx_to_mfn(pdx) _mfn(pdx_to_pfn(pdx))
 
-extern void pfn_pdx_hole_setup(unsigned long);
-
 #endif /* HAS_PDX */
 #endif /* __XEN_PDX_H__ */
 
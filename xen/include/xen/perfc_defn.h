@@ -12,6 +12,15 @@ PERFCOUNTER(irqs,                   "#interrupts")
 PERFCOUNTER(ipis,                   "#IPIs")
 
 PERFCOUNTER(rcu_idle_timer,         "RCU: idle_timer")
+PERFCOUNTER(rcu_grace_periods,      "RCU: grace periods")
+PERFCOUNTER(rcu_offloaded,          "RCU: callbacks offloaded")
+PERFCOUNTER(rcu_batch_budget,       "RCU: batches cut by time budget")
+PERFCOUNTER(tasklets_run,           "tasklets run")
+PERFCOUNTER(tasklet_yields,         "tasklet runs cut by budget")
+PERFCOUNTER(trace_sampled_out,      "trace: events sampled out")
+PERFCOUNTER(trace_rate_limited,     "trace: events rate limited")
+PERFCOUNTER(guest_console_dropped,  "guest console lines dropped")
+PERFCOUNTER(serial_tx_dropped,      "serial: characters dropped")
 
 /* Generic scheduler counters (applicable to all schedulers) */
 PERFCOUNTER(sched_irq,              "sched: timer")
@@ -81,6 +90,21 @@ PERFCOUNTER(tickled_cpu_overwritten,"csched2: tickled_cpu_overwritten")
 PERFCOUNTER(tickled_cpu_overridden, "csched2: tickled_cpu_overridden")
 #endif
 
+#ifdef CONFIG_IOREQ_SERVER
+PERFCOUNTER(ioreq_select_hit,       "ioreq: server selection cache hits")
+PERFCOUNTER(ioreq_select_miss,      "ioreq: server selection cache misses")
+#endif
+
+#ifdef CONFIG_HAS_PASSTHROUGH
+PERFCOUNTER(iommu_iotlb_batched,    "iommu: IOTLB flushes batched")
+PERFCOUNTER(iommu_iotlb_batch_flush, "iommu: IOTLB batch flushes")
+#endif
+
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(xmalloc_mag_hit,        "xmalloc: magazine hits")
+PERFCOUNTER(xmalloc_mag_miss,       "xmalloc: magazine misses")
+PERFCOUNTER(xmalloc_mag_free,       "xmalloc: frees to magazines")
+PERFCOUNTER(xmalloc_mag_flush,      "xmalloc: magazine flushes to the pool")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
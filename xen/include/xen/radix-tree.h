@@ -120,6 +120,9 @@ void radix_tree_destroy(
  * that the items are freed by RCU (or only freed after having been deleted from
  * the radix tree *and* a synchronize_rcu() grace period).
  *
+ * Inserting may need to allocate nodes.  radix_tree_preload() allows doing
+ * so before taking the locks excluding other modifications.
+ *
  * (Note, rcu_assign_pointer and rcu_dereference are not needed to control
  * access to data items when inserting into or looking up from the radix tree)
  */
@@ -209,6 +212,7 @@ static inline unsigned long radix_tree_ptr_to_ulong(void *ptr)
     return (unsigned long)ptr >> 2;
 }
 
+int radix_tree_preload(void);
 int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
 void **radix_tree_lookup_slot(struct radix_tree_root *, unsigned long);
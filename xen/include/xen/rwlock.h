@@ -1,6 +1,7 @@
 #ifndef __RWLOCK_H__
 #define __RWLOCK_H__
 
+#include <xen/cache.h>
 #include <xen/percpu.h>
 #include <xen/preempt.h>
 #include <xen/smp.h>
@@ -413,6 +414,116 @@ static inline void _percpu_write_unlock(percpu_rwlock_t **per_cpudata,
 #define percpu_write_unlock(percpu, lock) \
     _percpu_write_unlock(&get_per_cpu_var(percpu), lock)
 
+/*
+ * Big-reader ("br") rwlocks: a generalisation of percpu_rwlock_t for
+ * read-mostly global locks.  Readers only touch a reader count local to their
+ * NUMA node, so uncontended read_lock/read_unlock pairs no longer bounce a
+ * shared cache line between sockets.  Writers are correspondingly expensive:
+ * they have to wait for every node's count to drain.
+ *
+ * Unlike percpu_rwlock_t, no per-CPU owner variable is needed and any number
+ * of br rwlocks may be read-locked at the same time.  As with any fair
+ * rwlock, recursive read locking is not allowed.
+ */
+#if !defined(CONFIG_NR_NUMA_NODES)
+#define BR_RWLOCK_SLOTS 1
+#elif CONFIG_NR_NUMA_NODES < 8
+#define BR_RWLOCK_SLOTS CONFIG_NR_NUMA_NODES
+#else
+#define BR_RWLOCK_SLOTS 8
+#endif
+
+typedef struct br_rwlock {
+    rwlock_t            rwlock;
+    bool                writer_activating;
+    struct {
+        atomic_t        readers;
+    } __cacheline_aligned slot[BR_RWLOCK_SLOTS];
+} br_rwlock_t;
+
+/* Reader slot of each CPU, derived from its NUMA node. */
+DECLARE_PER_CPU(unsigned int, br_rwlock_slot);
+
+#define BR_RW_LOCK_UNLOCKED { .rwlock = RW_LOCK_UNLOCKED }
+#define DEFINE_BR_RWLOCK(l) br_rwlock_t l = BR_RW_LOCK_UNLOCKED
+#define br_rwlock_init(l) (*(l) = (br_rwlock_t)BR_RW_LOCK_UNLOCKED)
+
+static inline void _br_read_lock(br_rwlock_t *l)
+{
+    atomic_t *readers;
+
+    /* The slot can't change under our feet while preemption is disabled. */
+    preempt_disable();
+    readers = &l->slot[this_cpu(br_rwlock_slot)].readers;
+
+    /* Indicate this node is reading. */
+    atomic_inc(readers);
+    smp_mb();
+    /* Check if a writer is waiting. */
+    if ( unlikely(ACCESS_ONCE(l->writer_activating)) )
+    {
+        /* Let the waiting writer know we aren't holding the lock. */
+        atomic_dec(readers);
+        /* Wait using the read lock to keep the lock fair. */
+        read_lock(&l->rwlock);
+        atomic_inc(readers);
+        /* Drop the read lock because we don't need it anymore. */
+        read_unlock(&l->rwlock);
+    }
+    else
+    {
+        /* All other paths have implicit check_lock() calls via read_lock(). */
+        check_lock(&l->rwlock.lock.debug, false);
+    }
+
+    lock_enter(&l->rwlock.lock.debug);
+}
+
+static inline void _br_read_unlock(br_rwlock_t *l)
+{
+    lock_exit(&l->rwlock.lock.debug);
+
+    /* Order the critical section before the writer can observe the drop. */
+    smp_mb__before_atomic();
+    atomic_dec(&l->slot[this_cpu(br_rwlock_slot)].readers);
+    preempt_enable();
+}
+
+/* Don't inline br write lock as it's a complex function. */
+void _br_write_lock(br_rwlock_t *l);
+
+static inline void _br_write_unlock(br_rwlock_t *l)
+{
+    ASSERT(l->writer_activating);
+    l->writer_activating = false;
+
+    lock_exit(&l->rwlock.lock.debug);
+
+    write_unlock(&l->rwlock);
+}
+
+static inline bool _br_rw_is_locked(br_rwlock_t *l)
+{
+    unsigned int i;
+
+    if ( _rw_is_locked(&l->rwlock) )
+        return true;
+
+    for ( i = 0; i < BR_RWLOCK_SLOTS; i++ )
+        if ( atomic_read(&l->slot[i].readers) )
+            return true;
+
+    return false;
+}
+
+#define br_read_lock(l)               _br_read_lock(l)
+#define br_read_unlock(l)             _br_read_unlock(l)
+#define br_write_lock(l)              _br_write_lock(l)
+#define br_write_unlock(l)            _br_write_unlock(l)
+
+#define br_rw_is_locked(l)            _br_rw_is_locked(l)
+#define br_rw_is_write_locked(l)      _rw_is_write_locked(&(l)->rwlock)
+
 #define DEFINE_PERCPU_RWLOCK_GLOBAL(name) DEFINE_PER_CPU(percpu_rwlock_t *, \
                                                          name)
 #define DECLARE_PERCPU_RWLOCK_GLOBAL(name) DECLARE_PER_CPU(percpu_rwlock_t *, \
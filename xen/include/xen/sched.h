@@ -119,6 +119,7 @@ struct evtchn
     unsigned char priority;        /* FIFO event channels only. */
     unsigned short notify_vcpu_id; /* VCPU for local delivery notification */
     uint32_t fifo_lastq;           /* Data for identifying last queue. */
+    struct evtchn_moderation *moderation; /* See EVTCHNOP_set_moderation. */
 
 #ifdef CONFIG_XSM
     union {
@@ -167,6 +168,13 @@ struct vcpu_io {
     ioreq_t              req;
     /* Arch specific info pertaining to the io request */
     struct arch_vcpu_io  info;
+    /* Last ioreq_server_select() result: [start, end] of type -> server id. */
+    struct {
+        unsigned int     gen;
+        uint8_t          type;
+        uint8_t          id;
+        unsigned long    start, end;
+    } select_cache;
 };
 
 struct vcpu
@@ -216,6 +224,16 @@ struct vcpu
     bool             is_urgent;
     /* VCPU must context_switch without scheduling unit. */
     bool             force_context_switch;
+#ifdef CONFIG_TRACEBUFFER
+    /*
+     * Trace classes with a group of records being emitted in this vCPU's
+     * context, whether a sampling decision was taken for the group yet, and
+     * which one (see trace_sample_group_begin()).
+     */
+    uint16_t         trace_group_open;
+    uint16_t         trace_group_decided;
+    uint16_t         trace_group_keep;
+#endif
     /* Require shutdown to be deferred for some asynchronous operation? */
     bool             defer_shutdown;
     /* VCPU is paused following shutdown request (d->is_shutting_down)? */
@@ -268,10 +286,12 @@ struct vcpu
      *  - entries in the freelist
      *  - maptrack_head
      *  - maptrack_tail
+     *  - maptrack_free
      */
     spinlock_t       maptrack_freelist_lock;
     unsigned int     maptrack_head;
     unsigned int     maptrack_tail;
+    unsigned int     maptrack_free;  /* Number of entries in the freelist. */
 
     /* IRQ-safe virq_lock protects against delivering VIRQ to stale evtchn. */
     evtchn_port_t    virq_to_evtchn[NR_VIRQS];
@@ -321,6 +341,8 @@ struct sched_unit {
 
     /* Last time unit got (de-)scheduled. */
     uint64_t               state_entry_time;
+    /* Last time unit got woken up while not running, 0 if none pending. */
+    s_time_t               wake_time;
     /* Vcpu state summary. */
     unsigned int           runstate_cnt[4];
 
@@ -395,6 +417,11 @@ struct domain
     unsigned int     outstanding_pages; /* pages claimed but not possessed */
     unsigned int     max_pages;         /* maximum value for domain_tot_pages() */
     unsigned int     extra_pages;       /* pages not included in domain_tot_pages() */
+    /*
+     * Domheap pages (including extra pages) on each NUMA node, only
+     * accounted with sched-mem-affinity (MAX_NUMNODES entries, or NULL).
+     */
+    unsigned int    *node_pages;
 
 #ifdef CONFIG_MEM_SHARING
     atomic_t         shr_pages;         /* shared pages */
@@ -408,9 +435,9 @@ struct domain
     void            *sched_priv;    /* scheduler-specific data */
     struct sched_unit *sched_unit_list;
     struct cpupool  *cpupool;
+    unsigned int     sched_mem_node; /* node soft affinity follows memory to */
 
     struct domain   *next_in_list;
-    struct domain   *next_in_hashbucket;
 
     struct list_head rangesets;
     spinlock_t       rangesets_lock;
@@ -478,6 +505,10 @@ struct domain
      * unpaused for the first time by the systemcontroller.
      */
     bool             creation_finished;
+    /* Performance class hint (XEN_DOMCTL_PERF_CLASS_*). */
+    uint8_t          perf_class;
+    /* Domains sharing a non-zero group trust each other (speculation). */
+    unsigned int     security_group;
 
     /* Which guest this guest has privileges on */
     struct domain   *target;
@@ -524,6 +555,10 @@ struct domain
     char       *pbuf;
     unsigned int pbuf_idx;
     spinlock_t  pbuf_lock;
+    /* Rate limiting of the above, see guest_console_ratelimit(). */
+    uint64_t    pbuf_tokens;
+    unsigned int pbuf_dropped;
+    s_time_t    pbuf_stamp;
 
     /* OProfile support. */
     struct xenoprof *xenoprof;
@@ -542,6 +577,9 @@ struct domain
      */
     spinlock_t hypercall_deadlock_mutex;
 
+    /* Serialises domctls acting on this domain only, see domctl.c. */
+    spinlock_t domctl_lock;
+
     struct lock_profile_qhead profile_head;
 
     /* Various vm_events */
@@ -597,6 +635,8 @@ struct domain
     struct {
         spinlock_t              lock;
         struct ioreq_server     *server[MAX_NR_IOREQ_SERVERS];
+        /* Bumped whenever the result of ioreq_server_select() may change. */
+        unsigned int            select_gen;
     } ioreq_server;
 #endif
 
@@ -624,7 +664,7 @@ static inline unsigned int domain_tot_pages(const struct domain *d)
     return d->tot_pages - d->extra_pages;
 }
 
-/* Protect updates/reads (resp.) of domain_list and domain_hash. */
+/* Protect updates/reads (resp.) of domain_list and domid_table. */
 extern spinlock_t domlist_update_lock;
 extern rcu_read_lock_t domlist_read_lock;
 
@@ -673,6 +713,7 @@ struct affinity_masks;
 
 int domain_set_node_affinity(struct domain *d, const nodemask_t *affinity);
 void domain_update_node_aff(struct domain *d, struct affinity_masks *affinity);
+nodeid_t domain_alloc_node(const struct domain *d);
 
 static inline void domain_update_node_affinity(struct domain *d)
 {
@@ -757,6 +798,9 @@ void domain_resume(struct domain *d);
 
 int domain_soft_reset(struct domain *d, bool resuming);
 
+/* Next domain with a state change not yet reported, or DOMID_INVALID. */
+domid_t domain_get_changed(void);
+
 int vcpu_start_shutdown_deferral(struct vcpu *v);
 void vcpu_end_shutdown_deferral(struct vcpu *v);
 
@@ -803,6 +847,8 @@ int  sched_id(void);
 int sched_get_id_by_name(const char *sched_name);
 
 void vcpu_wake(struct vcpu *v);
+#define VCPU_WAKE_BATCH 32
+void vcpu_wake_batch(struct vcpu *const *vcpus, unsigned int nr);
 long vcpu_yield(void);
 void vcpu_sleep_nosync(struct vcpu *v);
 void vcpu_sleep_sync(struct vcpu *v);
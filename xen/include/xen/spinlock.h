@@ -98,10 +98,11 @@ struct lock_profile_qhead {
     static struct lock_profile * const __lock_profile_##name                  \
     __used_section(".lockprofile.data") =                                     \
     &__lock_profile_data_##name
-#define _SPIN_LOCK_UNLOCKED(x) { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, x }
-#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL)
-#define DEFINE_SPINLOCK(l)                                                    \
-    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL);                                 \
+#define _SPIN_LOCK_UNLOCKED(x, q)                                             \
+    { { 0 }, SPINLOCK_NO_CPU, 0, q, _LOCK_DEBUG, x }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL, 0)
+#define _DEFINE_SPINLOCK(l, q)                                                \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL, q);                              \
     static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
     _LOCK_PROFILE_PTR(l)
 
@@ -109,7 +110,7 @@ struct lock_profile_qhead {
     do {                                                                      \
         struct lock_profile *prof;                                            \
         prof = xzalloc(struct lock_profile);                                  \
-        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof);                       \
+        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof, 0);                    \
         if ( !prof )                                                          \
         {                                                                     \
             printk(XENLOG_WARNING                                             \
@@ -140,8 +141,9 @@ extern void cf_check spinlock_profile_reset(unsigned char key);
 
 struct lock_profile_qhead { };
 
-#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG }
-#define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, 0, _LOCK_DEBUG }
+#define _DEFINE_SPINLOCK(l, q)                                                \
+    spinlock_t l = { { 0 }, SPINLOCK_NO_CPU, 0, q, _LOCK_DEBUG }
 
 #define spin_lock_init_prof(s, l) spin_lock_init(&((s)->l))
 #define lock_profile_register_struct(type, ptr, idx)
@@ -150,6 +152,12 @@ struct lock_profile_qhead { };
 
 #endif
 
+struct xen_sysctl_lockcont_op;
+int lock_contention_control(struct xen_sysctl_lockcont_op *lc);
+
+#define DEFINE_SPINLOCK(l)         _DEFINE_SPINLOCK(l, 0)
+#define DEFINE_SPINLOCK_QUEUED(l)  _DEFINE_SPINLOCK(l, SPINLOCK_QUEUED)
+
 typedef union {
     u32 head_tail;
     struct {
@@ -167,6 +175,14 @@ typedef struct spinlock {
 #define SPINLOCK_RECURSE_BITS  (16 - SPINLOCK_CPU_BITS)
     u16 recurse_cnt:SPINLOCK_RECURSE_BITS;
 #define SPINLOCK_MAX_RECURSE   ((1u << SPINLOCK_RECURSE_BITS) - 1)
+    /*
+     * Queued locks: CPUs waiting for the lock form an MCS queue, with only
+     * the one at its head spinning on the lock itself.  The low bits hold
+     * the tail of that queue (0 if empty).
+     */
+    u16 queue;
+#define SPINLOCK_QUEUED        0x8000
+#define SPINLOCK_QUEUE_TAIL    0x7fff
     union lock_debug debug;
 #ifdef CONFIG_DEBUG_LOCK_PROFILE
     struct lock_profile *profile;
@@ -176,6 +192,12 @@ typedef struct spinlock {
 
 #define spin_lock_init(l) (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED)
 
+/*
+ * Make a freshly initialised lock a queued one, for locks seeing heavy
+ * contention from many CPUs.  See also DEFINE_SPINLOCK_QUEUED().
+ */
+#define spin_lock_set_queued(l) ((l)->queue = SPINLOCK_QUEUED)
+
 void _spin_lock(spinlock_t *lock);
 void _spin_lock_cb(spinlock_t *lock, void (*cond)(void *), void *data);
 void _spin_lock_irq(spinlock_t *lock);
@@ -1,6 +1,8 @@
 #ifndef __XEN_STOP_MACHINE_H__
 #define __XEN_STOP_MACHINE_H__
 
+#include <xen/cpumask.h>
+
 /**
  * stop_machine_run: freeze the machine on all CPUs and run this function
  * @fn: the function to run
@@ -16,4 +18,22 @@
  * grabbing every spinlock in the kernel. */
 int stop_machine_run(int (*fn)(void *), void *data, unsigned int cpu);
 
+/**
+ * stop_cpus_run: freeze a set of CPUs and run this function
+ * @cpus: the CPUs to freeze
+ * @fn: the function to run
+ * @data: the data ptr for the @fn()
+ * @cpu: the cpu to run @fn() on (or all in @cpus, if @cpu == NR_CPUS).
+ *
+ * Description: As stop_machine_run(), except that only the online CPUs in
+ * @cpus (plus the current one, which always has interrupts disabled while
+ * @fn() runs) enter the safe point.  Each of them gets there independently,
+ * at its next scheduling point, and all other CPUs carry on undisturbed.
+ * This allows e.g. updating one core at a time, so that the pause seen by
+ * guests is limited to one core's worth of work.  Fails with -EINVAL if
+ * @cpu is neither NR_CPUS nor an online CPU in @cpus.
+ */
+int stop_cpus_run(const cpumask_t *cpus, int (*fn)(void *), void *data,
+                  unsigned int cpu);
+
 #endif /* __XEN_STOP_MACHINE_H__ */
@@ -13,6 +13,19 @@
 #include <xen/types.h>
 #include <xen/list.h>
 #include <xen/percpu.h>
+#include <xen/time.h>
+
+/*
+ * Priority classes: a CPU always runs the tasklets of the highest class it has
+ * pending first, in FIFO order within a class.  Background housekeeping
+ * should use TASKLET_PRIO_LOW.
+ */
+enum tasklet_prio {
+    TASKLET_PRIO_HIGH,
+    TASKLET_PRIO_NORMAL,
+    TASKLET_PRIO_LOW,
+    TASKLET_NR_PRIOS
+};
 
 struct tasklet
 {
@@ -21,17 +34,25 @@ struct tasklet
     bool_t is_softirq;
     bool_t is_running;
     bool_t is_dead;
+    uint8_t prio;
+    s_time_t enqueued;
     void (*func)(void *);
     void *data;
 };
 
-#define _DECLARE_TASKLET(name, func, data, softirq)                     \
+#define _DECLARE_TASKLET(name, fn, d, softirq, pri)                     \
     struct tasklet name = {                                             \
-        LIST_HEAD_INIT(name.list), -1, softirq, 0, 0, func, data }
+        .list = LIST_HEAD_INIT(name.list),                              \
+        .scheduled_on = -1,                                             \
+        .is_softirq = softirq,                                          \
+        .prio = pri,                                                    \
+        .func = fn,                                                     \
+        .data = d,                                                      \
+    }
 #define DECLARE_TASKLET(name, func, data)               \
-    _DECLARE_TASKLET(name, func, data, 0)
+    _DECLARE_TASKLET(name, func, data, 0, TASKLET_PRIO_NORMAL)
 #define DECLARE_SOFTIRQ_TASKLET(name, func, data)       \
-    _DECLARE_TASKLET(name, func, data, 1)
+    _DECLARE_TASKLET(name, func, data, 1, TASKLET_PRIO_NORMAL)
 
 /* Indicates status of tasklet work on each CPU. */
 DECLARE_PER_CPU(unsigned long, tasklet_work_to_do);
@@ -61,6 +82,14 @@ void do_tasklet(void);
 void tasklet_kill(struct tasklet *t);
 void tasklet_init(struct tasklet *t, void (*func)(void *), void *data);
 void softirq_tasklet_init(struct tasklet *t, void (*func)(void *), void *data);
+void tasklet_set_prio(struct tasklet *t, enum tasklet_prio prio);
+
+/*
+ * To be polled by long running tasklets: true once the current tasklet run
+ * has used up its time budget, or the scheduler or timers want the CPU.  A
+ * tasklet seeing this should reschedule itself and return.
+ */
+bool tasklet_should_yield(void);
 void tasklet_subsys_init(void);
 
 #endif /* __XEN_TASKLET_H__ */
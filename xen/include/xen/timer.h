@@ -24,6 +24,8 @@ struct timer {
         unsigned int heap_offset;
         /* Linked list (TIMER_STATUS_in_list). */
         struct timer *list_next;
+        /* Timer-wheel bucket (TIMER_STATUS_in_wheel). */
+        struct hlist_node wheel;
         /* Linked list of inactive timers (TIMER_STATUS_inactive). */
         struct list_head inactive;
     };
@@ -42,7 +44,14 @@ struct timer {
 #define TIMER_STATUS_killed   2 /* Not in use; cannot be activated. */
 #define TIMER_STATUS_in_heap  3 /* In use; on timer heap.           */
 #define TIMER_STATUS_in_list  4 /* In use; on overflow linked list. */
+#define TIMER_STATUS_in_wheel 5 /* In use; on coarse timer wheel.   */
     uint8_t status;
+
+    /* May fire late by a fraction of its timeout (see init_coarse_timer()). */
+    bool coarse;
+
+    /* Timer-wheel bucket index (TIMER_STATUS_in_wheel). */
+    uint16_t wheel_idx;
 };
 
 /*
@@ -61,6 +70,20 @@ void init_timer(
     void         *data,
     unsigned int  cpu);
 
+/*
+ * As init_timer(), but for a timer which tolerates firing late: by up to about
+ * an eighth of its timeout, and at least a millisecond.  Such timers are kept
+ * on a timer wheel rather than the timer heap, making set_timer() and
+ * stop_timer() O(1).  Suitable for watchdogs and other timeouts which usually
+ * get cancelled or re-armed before they fire; not for high-resolution
+ * deadlines.
+ */
+void init_coarse_timer(
+    struct timer *timer,
+    void        (*function)(void *),
+    void         *data,
+    unsigned int  cpu);
+
 /* Set the expiry time and activate a timer. */
 void set_timer(struct timer *timer, s_time_t expires);
 
@@ -84,7 +107,7 @@ bool timer_expires_before(struct timer *timer, s_time_t t);
  */
 static inline bool timer_is_active(const struct timer *timer)
 {
-    ASSERT(timer->status <= TIMER_STATUS_in_list);
+    ASSERT(timer->status <= TIMER_STATUS_in_wheel);
     return timer->status >= TIMER_STATUS_in_heap;
 }
 
@@ -49,6 +49,28 @@ static inline void trace_var(uint32_t event, bool cycles, unsigned int extra,
 void __trace_hypercall(uint32_t event, unsigned long op,
                        const xen_ulong_t *args);
 
+/*
+ * Have all records of @event's class emitted in the current vCPU's context,
+ * up to the matching trace_sample_group_end(), share a single sampling
+ * decision.  Sampling then doesn't tear apart records which only make sense
+ * together, like the runstate changes of a context switch.  (HVM exits and
+ * the following entry are grouped implicitly.)
+ */
+void __trace_sample_group_begin(uint32_t event);
+void __trace_sample_group_end(uint32_t event);
+
+static inline void trace_sample_group_begin(uint32_t event)
+{
+    if ( unlikely(tb_init_done) )
+        __trace_sample_group_begin(event);
+}
+
+static inline void trace_sample_group_end(uint32_t event)
+{
+    if ( unlikely(tb_init_done) )
+        __trace_sample_group_end(event);
+}
+
 #else /* CONFIG_TRACEBUFFER */
 
 #include <xen/errno.h>
@@ -72,6 +94,8 @@ static inline void __trace_var(uint32_t event, bool cycles, unsigned int extra,
                                const void *extra_data) {}
 static inline void __trace_hypercall(uint32_t event, unsigned long op,
                                      const xen_ulong_t *args) {}
+static inline void trace_sample_group_begin(uint32_t event) {}
+static inline void trace_sample_group_end(uint32_t event) {}
 #endif /* CONFIG_TRACEBUFFER */
 
 /* Convenience macros for calling the trace function. */
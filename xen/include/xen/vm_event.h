@@ -29,12 +29,15 @@
 struct vm_event_domain
 {
     spinlock_t lock;
-    /* The ring has 64 entries */
-    unsigned char foreign_producers;
-    unsigned char target_producers;
-    /* shared ring page */
+    /* Slots reserved on the ring, but not yet filled */
+    unsigned int foreign_producers;
+    unsigned int target_producers;
+    /* shared ring page(s) */
     void *ring_page;
+    /* The guest page, or ring_frames Xen allocated ones at ring_mfns */
     struct page_info *ring_pg_struct;
+    unsigned int ring_frames;
+    mfn_t *ring_mfns;
     /* front-end ring */
     vm_event_front_ring_t front_ring;
     /* event channel port (vcpu0 only) */
@@ -89,6 +92,12 @@ void vm_event_put_request(struct domain *d, struct vm_event_domain *ved,
 
 int vm_event_domctl(struct domain *d, struct xen_domctl_vm_event_op *vec);
 
+/* XENMEM_resource_vm_event support, id being XEN_DOMCTL_VM_EVENT_OP_* */
+unsigned int vm_event_resource_max_frames(struct domain *d, unsigned int id);
+int vm_event_acquire_resource(struct domain *d, unsigned int id,
+                              unsigned int frame, unsigned int nr_frames,
+                              xen_pfn_t mfn_list[]);
+
 void vm_event_vcpu_pause(struct vcpu *v);
 void vm_event_vcpu_unpause(struct vcpu *v);
 
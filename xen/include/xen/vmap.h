@@ -16,6 +16,11 @@ void *__vmap(const mfn_t *mfn, unsigned int granularity, unsigned int nr,
              unsigned int align, unsigned int flags, enum vmap_region);
 void *vmap(const mfn_t *mfn, unsigned int nr);
 void vunmap(const void *);
+/*
+ * Like vunmap(), but stale TLB entries may keep referencing the frames for a
+ * while: only for mappings of frames not freed or reused right afterwards.
+ */
+void vunmap_lazy(const void *);
 
 void *vmalloc(size_t size);
 void *vmalloc_xen(size_t size);
@@ -29,7 +34,7 @@ static inline void iounmap(void __iomem *va)
 {
     unsigned long addr = (unsigned long)(void __force *)va;
 
-    vunmap((void *)(addr & PAGE_MASK));
+    vunmap_lazy((void *)(addr & PAGE_MASK));
 }
 
 void *arch_vmap_virt_end(void);
@@ -57,10 +57,24 @@ uint32_t cf_check vpci_hw_read32(
  */
 bool __must_check vpci_process_pending(struct vcpu *v);
 
+/* Number of dword slots in each chunk of the handler lookup map. */
+#define VPCI_MAP_DWORDS (PCI_CFG_SPACE_SIZE / 4)
+
+struct vpci_register;
+
 struct vpci {
     /* List of vPCI handlers for a device. */
     struct list_head handlers;
     spinlock_t lock;
+    /*
+     * Lookup of the first handler in each dword of the config space, so that
+     * accesses can be dispatched without walking the handlers list.  The
+     * extended config space is covered by chunks of VPCI_MAP_DWORDS slots,
+     * only allocated once a handler is placed inside of them.
+     */
+    struct vpci_register *map[VPCI_MAP_DWORDS];
+    struct vpci_register **ext_map[PCI_CFG_SPACE_EXP_SIZE /
+                                   PCI_CFG_SPACE_SIZE - 1];
 
 #ifdef __XEN__
     /* Hide the rest of the vpci struct from the user-space test harness. */
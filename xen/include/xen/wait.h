@@ -53,6 +53,7 @@ int init_waitqueue_vcpu(struct vcpu *v);
 void destroy_waitqueue_vcpu(struct vcpu *v);
 void prepare_to_wait(struct waitqueue_head *wq);
 void wait(void);
+bool save_wait_context(void);
 void finish_wait(struct waitqueue_head *wq);
 void check_wakeup_from_wait(void);
 
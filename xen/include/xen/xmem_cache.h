@@ -0,0 +1,84 @@
+#ifndef __XEN_XMEM_CACHE_H__
+#define __XEN_XMEM_CACHE_H__
+
+#include <xen/list.h>
+#include <xen/spinlock.h>
+#include <xen/types.h>
+
+/*
+ * Caches of equally sized objects, carved out of xenheap pages.
+ *
+ * Objects of one cache are packed into slabs of one or a few pages, which
+ * keeps them together and avoids the TLSF lookups and fragmentation of
+ * xmalloc() for objects which are allocated and freed at a high rate.
+ *
+ * Caches can be created at runtime with xmem_cache_create(), or be defined
+ * statically with DEFINE_XMEM_CACHE(), which makes them usable from the very
+ * beginning of boot.  The 'K' debug key dumps the statistics of all caches.
+ */
+struct xmem_cache {
+    const char *name;
+    unsigned int size;
+    unsigned int align;
+
+    /* Slab geometry, set up when the first slab gets allocated. */
+    unsigned int order;
+    unsigned int per_slab;
+    unsigned int offset;
+
+    spinlock_t lock;
+    struct list_head partial;
+    struct list_head full;
+    /* At most one completely free slab is kept around. */
+    void *empty;
+
+    /* Statistics. */
+    unsigned long nr_slabs;
+    unsigned long nr_inuse;
+    unsigned long nr_allocs;
+    unsigned long nr_failures;
+
+    bool dynamic;
+    struct list_head list;
+};
+
+#define XMEM_CACHE_INIT(var, n, sz, al) {           \
+    .name    = n,                                   \
+    .size    = sz,                                  \
+    .align   = al,                                  \
+    .lock    = SPIN_LOCK_UNLOCKED,                  \
+    .partial = LIST_HEAD_INIT((var).partial),       \
+    .full    = LIST_HEAD_INIT((var).full),          \
+    .list    = LIST_HEAD_INIT((var).list),          \
+}
+
+/* Define a cache for objects of type. */
+#define DEFINE_XMEM_CACHE(var, name, type)                         \
+    struct xmem_cache var =                                        \
+        XMEM_CACHE_INIT(var, name, sizeof(type), __alignof__(type))
+
+/**
+ * xmem_cache_create - create a cache of objects
+ * @name: name of the cache, for the statistics
+ * @size: size of each object
+ * @align: alignment of each object, a power of 2 (0 for the default)
+ */
+struct xmem_cache *xmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align);
+
+/**
+ * xmem_cache_destroy - destroy a cache created by xmem_cache_create()
+ * @cache: cache to be destroyed
+ *
+ * All objects allocated from the cache must have been freed.
+ */
+void xmem_cache_destroy(struct xmem_cache *cache);
+
+/* Allocate an object, returns NULL on failure. */
+void *xmem_cache_alloc(struct xmem_cache *cache);
+void *xmem_cache_zalloc(struct xmem_cache *cache);
+
+/* Free an object allocated from cache, NULL is ignored. */
+void xmem_cache_free(struct xmem_cache *cache, void *obj);
+
+#endif /* __XEN_XMEM_CACHE_H__ */
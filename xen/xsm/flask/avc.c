@@ -25,6 +25,7 @@
 #include <xen/kernel.h>
 #include <xen/sched.h>
 #include <xen/init.h>
+#include <xen/param.h>
 #include <xen/rcupdate.h>
 #include <asm/atomic.h>
 #include <asm/current.h>
@@ -52,9 +53,10 @@ const struct selinux_class_perm selinux_class_perm = {
     .cts_len = ARRAY_SIZE(class_to_string),
 };
 
-#define AVC_CACHE_SLOTS            512
+#define AVC_DEF_CACHE_SLOTS        512
 #define AVC_DEF_CACHE_THRESHOLD        512
 #define AVC_CACHE_RECLAIM        16
+#define AVC_PCPU_ENTRIES        8
 
 #ifdef CONFIG_XSM_FLASK_AVC_STATS
 #define avc_cache_stats_incr(field)    \
@@ -79,13 +81,31 @@ struct avc_node {
 };
 
 struct avc_cache {
-    struct hlist_head    slots[AVC_CACHE_SLOTS]; /* head for avc_node->list */
-    spinlock_t        slots_lock[AVC_CACHE_SLOTS]; /* lock for writes */
+    struct hlist_head    *slots; /* head for avc_node->list */
+    spinlock_t        *slots_lock; /* lock for writes */
+    unsigned int        nr_slots;    /* power of two */
     atomic_t        lru_hint;    /* LRU hint for reclaim scan */
     atomic_t        active_nodes;
     u32            latest_notif;    /* latest revocation notification */
 };
 
+/*
+ * Per-CPU copies of recently granted decisions, looked up without any
+ * locking.  An entry is only valid while its generation matches
+ * avc_pcpu_gen, which is bumped whenever a cached decision gets replaced
+ * or the cache flushed.
+ */
+struct avc_pcpu_entry {
+    struct avc_entry    ae;
+    unsigned int        gen;
+};
+
+static DEFINE_PER_CPU(struct avc_pcpu_entry[AVC_PCPU_ENTRIES], avc_pcpu_cache);
+static atomic_t avc_pcpu_gen = ATOMIC_INIT(1);
+
+static unsigned int __initdata opt_avc_slots = AVC_DEF_CACHE_SLOTS;
+integer_param("flask_avc_slots", opt_avc_slots);
+
 /* Exported via Flask hypercall */
 unsigned int avc_cache_threshold = AVC_DEF_CACHE_THRESHOLD;
 
@@ -97,9 +117,20 @@ static struct avc_cache avc_cache;
 
 static DEFINE_RCU_READ_LOCK(avc_rcu_lock);
 
+static inline unsigned int avc_hash_raw(u32 ssid, u32 tsid, u16 tclass)
+{
+    return ssid ^ (tsid<<2) ^ (tclass<<4);
+}
+
 static inline int avc_hash(u32 ssid, u32 tsid, u16 tclass)
 {
-    return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_CACHE_SLOTS - 1);
+    return avc_hash_raw(ssid, tsid, tclass) & (avc_cache.nr_slots - 1);
+}
+
+static inline void avc_pcpu_invalidate(void)
+{
+    smp_wmb();
+    atomic_inc(&avc_pcpu_gen);
 }
 
 /* no use making this larger than the printk buffer */
@@ -232,7 +263,17 @@ void __init avc_init(void)
 {
     int i;
 
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    avc_cache.nr_slots = opt_avc_slots > 1 ? 1U << flsl(opt_avc_slots - 1) : 1;
+    avc_cache.slots = xmalloc_array(struct hlist_head, avc_cache.nr_slots);
+    avc_cache.slots_lock = xmalloc_array(spinlock_t, avc_cache.nr_slots);
+    if ( !avc_cache.slots || !avc_cache.slots_lock )
+        panic("Flask: cannot allocate %u AVC slots\n", avc_cache.nr_slots);
+
+    /* Don't start reclaiming before the hash chains get any length. */
+    if ( avc_cache_threshold < avc_cache.nr_slots )
+        avc_cache_threshold = avc_cache.nr_slots;
+
+    for ( i = 0; i < avc_cache.nr_slots; i++ )
     {
         INIT_HLIST_HEAD(&avc_cache.slots[i]);
         spin_lock_init(&avc_cache.slots_lock[i]);
@@ -251,7 +292,7 @@ int avc_get_hash_stats(struct xen_flask_hash_stats *arg)
 
     slots_used = 0;
     max_chain_len = 0;
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    for ( i = 0; i < avc_cache.nr_slots; i++ )
     {
         head = &avc_cache.slots[i];
         if ( !hlist_empty(head) )
@@ -271,7 +312,7 @@ int avc_get_hash_stats(struct xen_flask_hash_stats *arg)
 
     arg->entries = atomic_read(&avc_cache.active_nodes);
     arg->buckets_used = slots_used;
-    arg->buckets_total = AVC_CACHE_SLOTS;
+    arg->buckets_total = avc_cache.nr_slots;
     arg->max_chain_len = max_chain_len;
 
     return 0;
@@ -303,6 +344,7 @@ static void avc_node_replace(struct avc_node *new, struct avc_node *old)
     hlist_replace_rcu(&old->list, &new->list);
     call_rcu(&old->rhead, avc_node_free);
     atomic_dec(&avc_cache.active_nodes);
+    avc_pcpu_invalidate();
 }
 
 static inline int avc_reclaim_node(void)
@@ -314,10 +356,10 @@ static inline int avc_reclaim_node(void)
     struct hlist_node *next;
     spinlock_t *lock;
 
-    for ( try = 0, ecx = 0; try < AVC_CACHE_SLOTS; try++ )
+    for ( try = 0, ecx = 0; try < avc_cache.nr_slots; try++ )
     {
         atomic_inc(&avc_cache.lru_hint);
-        hvalue =  atomic_read(&avc_cache.lru_hint) & (AVC_CACHE_SLOTS - 1);
+        hvalue =  atomic_read(&avc_cache.lru_hint) & (avc_cache.nr_slots - 1);
         head = &avc_cache.slots[hvalue];
         lock = &avc_cache.slots_lock[hvalue];
 
@@ -683,7 +725,7 @@ int avc_ss_reset(u32 seqno)
     struct hlist_node *next;
     spinlock_t *lock;
 
-    for ( i = 0; i < AVC_CACHE_SLOTS; i++ )
+    for ( i = 0; i < avc_cache.nr_slots; i++ )
     {
         head = &avc_cache.slots[i];
         lock = &avc_cache.slots_lock[i];
@@ -695,6 +737,7 @@ int avc_ss_reset(u32 seqno)
         rcu_read_unlock(&avc_rcu_lock);
         spin_unlock_irqrestore(lock, flag);
     }
+    avc_pcpu_invalidate();
 
     avc_latest_notif_update(seqno, 0);
     return rc;
@@ -724,11 +767,27 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid, u16 tclass, u32 requested,
 {
     struct avc_node *node;
     struct av_decision avd_entry, *avd;
+    struct avc_pcpu_entry *pe;
+    unsigned int gen;
     int rc = 0;
     u32 denied;
 
     BUG_ON(!requested);
 
+    gen = atomic_read(&avc_pcpu_gen);
+    smp_rmb();
+    pe = &this_cpu(avc_pcpu_cache)[avc_hash_raw(ssid, tsid, tclass) &
+                                   (AVC_PCPU_ENTRIES - 1)];
+    if ( pe->gen == gen && pe->ae.ssid == ssid && pe->ae.tsid == tsid &&
+         pe->ae.tclass == tclass && !(requested & ~pe->ae.avd.allowed) )
+    {
+        avc_cache_stats_incr(lookups);
+        avc_cache_stats_incr(hits);
+        if ( in_avd )
+            memcpy(in_avd, &pe->ae.avd, sizeof(*in_avd));
+        return 0;
+    }
+
     rcu_read_lock(&avc_rcu_lock);
 
     node = avc_lookup(ssid, tsid, tclass);
@@ -761,6 +820,12 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid, u16 tclass, u32 requested,
         else
             rc = -EACCES;
     }
+    else if ( node )
+    {
+        /* Only remember decisions which made it into the AVC. */
+        pe->ae = node->ae;
+        pe->gen = gen;
+    }
 
     rcu_read_unlock(&avc_rcu_lock);
  out:
@@ -677,6 +677,9 @@ static int cf_check flask_domctl(struct domain *d, int cmd)
     case XEN_DOMCTL_set_target:
     case XEN_DOMCTL_vm_event_op:
 
+    /* Restricted to the VIRQ_DOM_EXC handler (common/domctl.c) */
+    case XEN_DOMCTL_get_changed_domain:
+
     /* These have individual XSM hooks (arch/../domctl.c) */
     case XEN_DOMCTL_bind_pt_irq:
     case XEN_DOMCTL_unbind_pt_irq:
@@ -711,8 +714,15 @@ static int cf_check flask_domctl(struct domain *d, int cmd)
     case XEN_DOMCTL_setnodeaffinity:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__SETAFFINITY);
 
+    case XEN_DOMCTL_set_perf_class:
+        return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__SETSCHEDULER);
+
+    case XEN_DOMCTL_set_security_group:
+        return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__CREATE);
+
     case XEN_DOMCTL_getvcpuaffinity:
     case XEN_DOMCTL_getnodeaffinity:
+    case XEN_DOMCTL_get_node_pages:
         return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETAFFINITY);
 
     case XEN_DOMCTL_resumedomain:
@@ -805,6 +815,14 @@ static int cf_check flask_domctl(struct domain *d, int cmd)
     case XEN_DOMCTL_audit_p2m:
         return current_has_perm(d, SECCLASS_HVM, HVM__AUDIT_P2M);
 
+#ifdef CONFIG_X86
+    case XEN_DOMCTL_p2m_recoalesce:
+        return current_has_perm(d, SECCLASS_SHADOW, SHADOW__LOGDIRTY);
+
+    case XEN_DOMCTL_get_exit_stats:
+        return current_has_perm(d, SECCLASS_DOMAIN, DOMAIN__GETVCPUINFO);
+#endif
+
     case XEN_DOMCTL_cacheflush:
         return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__CACHEFLUSH);
 
@@ -840,6 +858,7 @@ static int cf_check flask_sysctl(int cmd)
     /* These have individual XSM hooks */
     case XEN_SYSCTL_readconsole:
     case XEN_SYSCTL_getdomaininfolist:
+    case XEN_SYSCTL_get_domain_stats:
     case XEN_SYSCTL_page_offline_op:
     case XEN_SYSCTL_scheduler_op:
 #ifdef CONFIG_X86
@@ -872,6 +891,7 @@ static int cf_check flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__PM_OP);
 
     case XEN_SYSCTL_lockprof_op:
+    case XEN_SYSCTL_lockcont_op:
         return domain_has_xen(current->domain, XEN__LOCKPROF);
 
     case XEN_SYSCTL_cpupool_op:
@@ -1587,6 +1607,8 @@ static int cf_check flask_shadow_control(struct domain *d, uint32_t op)
     case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING:
+    case XEN_DOMCTL_SHADOW_OP_DIRTY_RING_RESET:
         perm = SHADOW__LOGDIRTY;
         break;
     default:
@@ -54,11 +54,11 @@
 #include "conditional.h"
 #include "mls.h"
 
-static DEFINE_RWLOCK(policy_rwlock);
-#define POLICY_RDLOCK read_lock(&policy_rwlock)
-#define POLICY_WRLOCK write_lock(&policy_rwlock)
-#define POLICY_RDUNLOCK read_unlock(&policy_rwlock)
-#define POLICY_WRUNLOCK write_unlock(&policy_rwlock)
+static DEFINE_BR_RWLOCK(policy_rwlock);
+#define POLICY_RDLOCK br_read_lock(&policy_rwlock)
+#define POLICY_WRLOCK br_write_lock(&policy_rwlock)
+#define POLICY_RDUNLOCK br_read_unlock(&policy_rwlock)
+#define POLICY_WRUNLOCK br_write_unlock(&policy_rwlock)
 
 static DEFINE_SPINLOCK(load_sem);
 #define LOAD_LOCK spin_lock(&load_sem)